@@ -0,0 +1,50 @@
+# Locate libjpeg-turbo (TurboJPEG API).
+# This module defines
+# TURBOJPEG_LIBRARY
+# TURBOJPEG_FOUND, if false, do not try to link to libjpeg-turbo (TurboJPEG API)
+# TURBOJPEG_INCLUDE_DIR, where to find the headers
+
+FIND_PATH(TURBOJPEG_INCLUDE_DIR turbojpeg.h
+  PATHS
+  $ENV{TURBOJPEG_DIR}
+  NO_DEFAULT_PATH
+    PATH_SUFFIXES include
+)
+
+FIND_PATH(TURBOJPEG_INCLUDE_DIR turbojpeg.h
+  PATHS
+  /usr/local/include
+  /usr/include
+  /sw/include # Fink
+  /opt/local/include # DarwinPorts
+  /opt/csw/include # Blastwave
+  /opt/include
+)
+
+FIND_LIBRARY(TURBOJPEG_LIBRARY
+  NAMES turbojpeg libturbojpeg turbojpeg-static
+  PATHS
+    $ENV{TURBOJPEG_DIR}
+    NO_DEFAULT_PATH
+    PATH_SUFFIXES lib64 lib
+)
+
+FIND_LIBRARY(TURBOJPEG_LIBRARY
+  NAMES turbojpeg libturbojpeg turbojpeg-static
+  PATHS
+    ~/Library/Frameworks
+    /Library/Frameworks
+    /usr/local
+    /usr
+    /sw
+    /opt/local
+    /opt/csw
+    /opt
+    /usr/freeware
+  PATH_SUFFIXES lib64 lib
+)
+
+SET(TURBOJPEG_FOUND "NO")
+IF(TURBOJPEG_LIBRARY AND TURBOJPEG_INCLUDE_DIR)
+  SET(TURBOJPEG_FOUND "YES")
+ENDIF(TURBOJPEG_LIBRARY AND TURBOJPEG_INCLUDE_DIR)
@@ -0,0 +1,44 @@
+# Install-time script that writes the osgEarth driver index (see
+# osgEarth::Registry::preloadDrivers) into the installed plugin directory.
+#
+# Required Vars:
+# ${DRIVER_INDEX_DIR}     installed plugin directory
+# ${DRIVER_INDEX_FILE}    name of the index file
+# ${DRIVER_DEBUG_POSTFIX} library postfix used by debug builds
+
+SET(INDEX_DIR "$ENV{DESTDIR}${DRIVER_INDEX_DIR}")
+
+FILE(GLOB DRIVER_LIBRARIES "${INDEX_DIR}/*osgdb_osgearth_*")
+LIST(SORT DRIVER_LIBRARIES)
+
+SET(INDEX_CONTENT "# osgEarth driver index: <plugin extension> <library>\n")
+
+FOREACH(library ${DRIVER_LIBRARIES})
+    GET_FILENAME_COMPONENT(library_file ${library} NAME)
+    GET_FILENAME_COMPONENT(library_ext ${library} EXT)
+
+    # skip import libraries, debug symbols and the like
+    IF(library_ext MATCHES "^\\.(so|dll|dylib)$")
+        GET_FILENAME_COMPONENT(library_base ${library} NAME_WE)
+        STRING(REGEX REPLACE "^.*osgdb_" "" extension ${library_base})
+
+        # debug builds only list the debug libraries, under the plain extension
+        SET(keep TRUE)
+        IF(DRIVER_DEBUG_POSTFIX)
+            IF(CMAKE_INSTALL_CONFIG_NAME MATCHES "^[Dd][Ee][Bb][Uu][Gg]$")
+                IF(extension MATCHES "${DRIVER_DEBUG_POSTFIX}$")
+                    STRING(REGEX REPLACE "${DRIVER_DEBUG_POSTFIX}$" "" extension ${extension})
+                ELSE()
+                    SET(keep FALSE)
+                ENDIF()
+            ENDIF()
+        ENDIF(DRIVER_DEBUG_POSTFIX)
+
+        IF(keep)
+            SET(INDEX_CONTENT "${INDEX_CONTENT}${extension} ${library_file}\n")
+        ENDIF(keep)
+    ENDIF()
+ENDFOREACH(library)
+
+MESSAGE(STATUS "Installing: ${INDEX_DIR}/${DRIVER_INDEX_FILE}")
+FILE(WRITE "${INDEX_DIR}/${DRIVER_INDEX_FILE}" "${INDEX_CONTENT}")
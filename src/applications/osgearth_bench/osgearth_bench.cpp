@@ -0,0 +1,562 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/Notify>
+#include <osgEarth/MapNode>
+#include <osgEarth/Viewpoint>
+#include <osgEarth/XmlUtils>
+#include <osgEarth/URI>
+#include <osgEarth/HTTPClient>
+#include <osgEarth/StringUtils>
+#include <osgEarthUtil/EarthManipulator>
+#include <osgEarthUtil/ExampleResources>
+#include <osgViewer/Viewer>
+#include <osgGA/GUIEventHandler>
+#include <osgDB/Registry>
+#include <osgDB/ReadFile>
+#include <osgDB/FileNameUtils>
+#include <osg/AnimationPath>
+#include <osg/Timer>
+#include <OpenThreads/Atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+
+#define LC "[bench] "
+
+using namespace osgEarth;
+using namespace osgEarth::Util;
+
+int
+usage(const char* name, const std::string& error ="")
+{
+    if ( !error.empty() )
+        OE_NOTICE << LC << error << std::endl;
+
+    OE_NOTICE
+        << "\nUsage: " << name << " file.earth [options]\n"
+        << "\n  Replay a camera path and measure paging and frame performance:\n"
+        << "    --path <file.path>          : osg::AnimationPath to replay\n"
+        << "    --viewpoints <file.xml>     : <viewpoints> sequence to fly through\n"
+        << "                                   (default: the earth file's <viewpoints> external)\n"
+        << "    --fly-time <s>              : transition time between viewpoints (default 3)\n"
+        << "    --fixed-step <s>            : advance the path by a fixed time per frame instead\n"
+        << "                                   of wall-clock time (reproducible camera motion)\n"
+        << "    --settle-frames <n>         : idle pager frames that count as settled (default 10)\n"
+        << "    --settle-timeout <s>        : give up waiting to settle after this long (default 120)\n"
+        << "    --headless                  : render into an offscreen pbuffer\n"
+        << "    --size <w> <h>              : window/pbuffer size (default 1280 720)\n"
+        << "    --out <file.json>           : write the results as JSON\n"
+        << "\n  Record a camera path interactively:\n"
+        << "    --record <file.path>        : sample the camera every frame and write it on exit\n"
+        << "    --record-viewpoints <file>  : press 'v' to append the current viewpoint\n"
+        << std::endl
+        << MapNodeHelper().usage() << std::endl;
+
+    return -1;
+}
+
+namespace
+{
+    /**
+     * Counts paged nodes (terrain tiles, feature tiles, etc.) as the database
+     * pager loads them. Chains to any callback that was already installed.
+     */
+    struct CountingReadFileCallback : public osgDB::ReadFileCallback
+    {
+        CountingReadFileCallback( osgDB::ReadFileCallback* next ) : _next(next) { }
+
+        virtual osgDB::ReaderWriter::ReadResult readNode(const std::string& filename, const osgDB::Options* options)
+        {
+            osgDB::ReaderWriter::ReadResult r = _next.valid() ?
+                _next->readNode( filename, options ) :
+                osgDB::ReadFileCallback::readNode( filename, options );
+
+            if ( r.validNode() )
+                ++_numNodes;
+
+            return r;
+        }
+
+        osg::ref_ptr<osgDB::ReadFileCallback> _next;
+        OpenThreads::Atomic                   _numNodes;
+    };
+
+    /**
+     * Samples the camera each frame into an animation path, and appends
+     * the manipulator's viewpoint to a list when 'v' is pressed.
+     */
+    struct RecordHandler : public osgGA::GUIEventHandler
+    {
+        RecordHandler() : _path(new osg::AnimationPath()), _start(-1.0) { }
+
+        bool handle(const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdapter& aa)
+        {
+            if ( ea.getEventType() == ea.FRAME )
+            {
+                osgViewer::View* view = dynamic_cast<osgViewer::View*>( &aa );
+                if ( view )
+                {
+                    if ( _start < 0.0 )
+                        _start = ea.getTime();
+
+                    osg::Matrixd m = view->getCamera()->getInverseViewMatrix();
+                    _path->insert( ea.getTime() - _start,
+                        osg::AnimationPath::ControlPoint(m.getTrans(), m.getRotate()) );
+                }
+            }
+            else if ( ea.getEventType() == ea.KEYDOWN && ea.getKey() == 'v' )
+            {
+                osgViewer::View* view = dynamic_cast<osgViewer::View*>( &aa );
+                EarthManipulator* manip = view ? dynamic_cast<EarthManipulator*>( view->getCameraManipulator() ) : 0L;
+                if ( manip )
+                {
+                    _viewpoints.push_back( manip->getViewpoint() );
+                    OE_NOTICE << LC << "Recorded viewpoint " << _viewpoints.size() << std::endl;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        osg::ref_ptr<osg::AnimationPath> _path;
+        std::vector<Viewpoint>           _viewpoints;
+        double                           _start;
+    };
+
+    /** Nearest-rank percentile of an already sorted sample list. */
+    double percentile(const std::vector<double>& sorted, double p)
+    {
+        if ( sorted.empty() )
+            return 0.0;
+        unsigned i = (unsigned)( p * (double)(sorted.size()-1) + 0.5 );
+        return sorted[ osg::minimum(i, (unsigned)sorted.size()-1) ];
+    }
+
+    /** Whether the database pager has nothing queued, loading, compiling or merging. */
+    bool pagerIdle(osgViewer::Viewer& viewer)
+    {
+        osgDB::DatabasePager* pager = viewer.getDatabasePager();
+        return
+            !pager ||
+            ( !pager->getRequestsInProgress() &&
+              pager->getFileRequestListSize()   == 0 &&
+              pager->getDataToCompileListSize() == 0 &&
+              pager->getDataToMergeListSize()   == 0 );
+    }
+
+    struct Bench
+    {
+        Bench(osgViewer::Viewer& viewer) :
+            _viewer       ( viewer ),
+            _settleFrames ( 10u ),
+            _settleTimeout( 120.0 ),
+            _numTimeouts  ( 0u )
+        {
+            _timer.setStartTick();
+        }
+
+        /** Renders one frame and records its duration. */
+        void frame()
+        {
+            osg::Timer_t t0 = osg::Timer::instance()->tick();
+            _viewer.frame();
+            _frameTimes.push_back( osg::Timer::instance()->delta_s(t0, osg::Timer::instance()->tick()) );
+        }
+
+        /** Renders frames until the pager stays idle; returns the time it took. */
+        double settle()
+        {
+            double   start = _timer.time_s();
+            unsigned idle  = 0u;
+
+            while( !_viewer.done() && idle < _settleFrames )
+            {
+                frame();
+                idle = pagerIdle(_viewer) ? idle+1 : 0u;
+
+                if ( _timer.time_s() - start > _settleTimeout )
+                {
+                    OE_WARN << LC << "Timed out waiting for the pager to settle" << std::endl;
+                    ++_numTimeouts;
+                    break;
+                }
+            }
+            return _timer.time_s() - start;
+        }
+
+        osgViewer::Viewer&  _viewer;
+        osg::ElapsedTime    _timer;
+        unsigned            _settleFrames;
+        double              _settleTimeout;
+        unsigned            _numTimeouts;
+        std::vector<double> _frameTimes;
+        std::vector<double> _settleTimes;
+    };
+
+    bool readViewpoints(const std::string& location, const Config& externals, std::vector<Viewpoint>& output)
+    {
+        Config conf;
+        if ( !location.empty() )
+        {
+            osg::ref_ptr<XmlDocument> doc = XmlDocument::load( location );
+            if ( !doc.valid() )
+                return false;
+            conf = doc->getConfig();
+            if ( conf.hasChild("viewpoints") )
+                conf = conf.child("viewpoints");
+        }
+        else
+        {
+            conf = externals.child("viewpoints");
+        }
+
+        ConfigSet vps = conf.children("viewpoint");
+        for( ConfigSet::const_iterator i = vps.begin(); i != vps.end(); ++i )
+            output.push_back( Viewpoint(*i) );
+
+        return !output.empty();
+    }
+
+    void setUpHeadless(osgViewer::Viewer& viewer, int width, int height)
+    {
+        osg::ref_ptr<osg::GraphicsContext::Traits> traits = new osg::GraphicsContext::Traits();
+        traits->readDISPLAY();
+        traits->setUndefinedScreenDetailsToDefaultScreen();
+        traits->x = 0;
+        traits->y = 0;
+        traits->width = width;
+        traits->height = height;
+        traits->red = traits->green = traits->blue = traits->alpha = 8;
+        traits->depth = 24;
+        traits->doubleBuffer = false;
+        traits->pbuffer = true;
+
+        osg::ref_ptr<osg::GraphicsContext> gc = osg::GraphicsContext::createGraphicsContext( traits.get() );
+        if ( !gc.valid() )
+            return;
+
+        osg::Camera* camera = viewer.getCamera();
+        camera->setGraphicsContext( gc.get() );
+        camera->setViewport( new osg::Viewport(0, 0, width, height) );
+        camera->setProjectionMatrixAsPerspective( 30.0, (double)width/(double)height, 1.0, 1000.0 );
+        camera->setDrawBuffer( GL_FRONT );
+        camera->setReadBuffer( GL_FRONT );
+    }
+
+    void writeJSON(std::ostream& out, const Config& values)
+    {
+        out << "{\n";
+        const ConfigSet& kids = values.children();
+        for( ConfigSet::const_iterator i = kids.begin(); i != kids.end(); ++i )
+        {
+            if ( i != kids.begin() ) out << ",\n";
+            out << "  \"" << i->key() << "\": ";
+            if ( i->children().empty() )
+            {
+                // numbers and booleans are written as-is; anything else is quoted.
+                const std::string& v = i->value();
+                char* end = 0L;
+                strtod( v.c_str(), &end );
+                bool bare = (!v.empty() && end && *end == '\0') || v == "true" || v == "false";
+                if ( bare ) out << v;
+                else           out << "\"" << v << "\"";
+            }
+            else
+            {
+                out << "[";
+                for( ConfigSet::const_iterator j = i->children().begin(); j != i->children().end(); ++j )
+                    out << (j != i->children().begin() ? ", " : "") << j->value();
+                out << "]";
+            }
+        }
+        out << "\n}\n";
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc,argv);
+
+    if ( arguments.read("--help") )
+        return usage(argv[0]);
+
+    // read our options before MapNodeHelper sees them (it also knows --path).
+    std::string pathFile, viewpointsFile, outFile, recordFile, recordViewpointsFile;
+    arguments.read( "--path", pathFile );
+    arguments.read( "--viewpoints", viewpointsFile );
+    arguments.read( "--out", outFile );
+    arguments.read( "--record", recordFile );
+    arguments.read( "--record-viewpoints", recordViewpointsFile );
+
+    double flyTime = 3.0;
+    arguments.read( "--fly-time", flyTime );
+
+    double fixedStep = 0.0;
+    arguments.read( "--fixed-step", fixedStep );
+
+    unsigned settleFrames = 10u;
+    arguments.read( "--settle-frames", settleFrames );
+
+    double settleTimeout = 120.0;
+    arguments.read( "--settle-timeout", settleTimeout );
+
+    int width = 1280, height = 720;
+    arguments.read( "--size", width, height );
+
+    bool headless = arguments.read( "--headless" );
+    bool recording = !recordFile.empty() || !recordViewpointsFile.empty();
+
+    osgViewer::Viewer viewer(arguments);
+    viewer.getDatabasePager()->setUnrefImageDataAfterApplyPolicy( false, false );
+    viewer.setCameraManipulator( new EarthManipulator() );
+
+    if ( headless && !recording )
+    {
+        setUpHeadless( viewer, width, height );
+        if ( !viewer.getCamera()->getGraphicsContext() )
+            return usage( argv[0], "Failed to create an offscreen pbuffer" );
+    }
+    else
+    {
+        viewer.setUpViewInWindow( 50, 50, width, height );
+    }
+
+    std::string earthFile;
+    for( int i = 1; i < arguments.argc() && earthFile.empty(); ++i )
+    {
+        if ( osgDB::getLowerCaseFileExtension(arguments[i]) == "earth" )
+            earthFile = arguments[i];
+    }
+
+    osg::Node* node = MapNodeHelper().load( arguments, &viewer );
+    if ( !node )
+        return usage( argv[0], "Failed to load an earth file" );
+
+    viewer.setSceneData( node );
+    viewer.getCamera()->setNearFarRatio( 0.00002 );
+    viewer.getCamera()->setSmallFeatureCullingPixelSize( -1.0f );
+
+    MapNode* mapNode = MapNode::findMapNode( node );
+
+    // record mode: fly around by hand, then write what we captured.
+    if ( recording )
+    {
+        RecordHandler* recorder = new RecordHandler();
+        viewer.addEventHandler( recorder );
+        int rc = viewer.run();
+
+        if ( !recordFile.empty() )
+        {
+            std::ofstream fout( recordFile.c_str() );
+            recorder->_path->write( fout );
+            OE_NOTICE << LC << "Wrote " << recorder->_path->getTimeControlPointMap().size()
+                << " control points to " << recordFile << std::endl;
+        }
+
+        if ( !recordViewpointsFile.empty() )
+        {
+            Config vps("viewpoints");
+            for( std::vector<Viewpoint>::const_iterator i = recorder->_viewpoints.begin(); i != recorder->_viewpoints.end(); ++i )
+                vps.add( i->getConfig() );
+
+            std::ofstream fout( recordViewpointsFile.c_str() );
+            osg::ref_ptr<XmlDocument> doc = new XmlDocument( vps );
+            doc->store( fout );
+            OE_NOTICE << LC << "Wrote " << recorder->_viewpoints.size()
+                << " viewpoints to " << recordViewpointsFile << std::endl;
+        }
+        return rc;
+    }
+
+    // work out what to replay.
+    osg::ref_ptr<osg::AnimationPath> path;
+    std::vector<Viewpoint> viewpoints;
+
+    if ( !pathFile.empty() )
+    {
+        std::ifstream fin( pathFile.c_str() );
+        if ( fin.is_open() )
+        {
+            path = new osg::AnimationPath();
+            path->read( fin );
+        }
+        if ( !path.valid() || path->empty() )
+            return usage( argv[0], "Failed to read camera path " + pathFile );
+    }
+    else if ( !readViewpoints(viewpointsFile, mapNode ? mapNode->externalConfig() : Config(), viewpoints) )
+    {
+        return usage( argv[0], "Nothing to replay; use --path or --viewpoints" );
+    }
+
+    // count paged loads:
+    osg::ref_ptr<CountingReadFileCallback> counter =
+        new CountingReadFileCallback( osgDB::Registry::instance()->getReadFileCallback() );
+    osgDB::Registry::instance()->setReadFileCallback( counter.get() );
+
+    viewer.realize();
+
+    // benchmark frames must not wait on vsync.
+    osgViewer::Viewer::Windows windows;
+    viewer.getWindows( windows );
+    for( osgViewer::Viewer::Windows::iterator w = windows.begin(); w != windows.end(); ++w )
+        (*w)->setSyncToVBlank( false );
+
+    Bench bench( viewer );
+    bench._settleFrames  = osg::maximum( settleFrames, 1u );
+    bench._settleTimeout = settleTimeout;
+
+    EarthManipulator* manip = dynamic_cast<EarthManipulator*>( viewer.getCameraManipulator() );
+
+    // start position:
+    osg::AnimationPath::ControlPoint cp;
+    if ( path.valid() )
+    {
+        viewer.setCameraManipulator( 0L );
+        path->getInterpolatedControlPoint( path->getFirstTime(), cp );
+        osg::Matrixd m;
+        cp.getInverse( m );
+        viewer.getCamera()->setViewMatrix( m );
+    }
+    else if ( manip )
+    {
+        manip->setViewpoint( viewpoints.front(), 0.0 );
+    }
+
+    // everything from here on is measured.
+    URI::resetStatistics();
+    HTTPClient::resetStatistics();
+    counter->_numNodes.exchange( 0 );
+
+    double initialSettle = bench.settle();
+
+    double replayStart = bench._timer.time_s();
+
+    if ( path.valid() )
+    {
+        double t = 0.0;
+        double period = path->getPeriod();
+        while( !viewer.done() && t <= period )
+        {
+            path->getInterpolatedControlPoint( path->getFirstTime() + t, cp );
+            osg::Matrixd m;
+            cp.getInverse( m );
+            viewer.getCamera()->setViewMatrix( m );
+
+            bench.frame();
+
+            t = fixedStep > 0.0 ? t + fixedStep : bench._timer.time_s() - replayStart;
+        }
+        bench._settleTimes.push_back( bench.settle() );
+    }
+    else if ( manip )
+    {
+        for( unsigned i = 1; i < viewpoints.size() && !viewer.done(); ++i )
+        {
+            manip->setViewpoint( viewpoints[i], flyTime );
+            bench.frame();
+            while( !viewer.done() && manip->isSettingViewpoint() )
+                bench.frame();
+            bench._settleTimes.push_back( bench.settle() );
+        }
+    }
+
+    double totalTime = bench._timer.time_s();
+    double replayTime = totalTime - replayStart;
+
+    osgDB::Registry::instance()->setReadFileCallback( counter->_next.get() );
+
+    // results:
+    std::vector<double> sorted( bench._frameTimes );
+    std::sort( sorted.begin(), sorted.end() );
+
+    double sumFrames = 0.0;
+    for( unsigned i = 0; i < sorted.size(); ++i )
+        sumFrames += sorted[i];
+
+    double maxSettle = 0.0, sumSettle = 0.0;
+    for( unsigned i = 0; i < bench._settleTimes.size(); ++i )
+    {
+        maxSettle = osg::maximum( maxSettle, bench._settleTimes[i] );
+        sumSettle += bench._settleTimes[i];
+    }
+
+    URIStatistics uriStats;
+    URI::getStatistics( uriStats );
+
+    HTTPStatistics httpStats;
+    HTTPClient::getStatistics( httpStats );
+
+    unsigned numTiles = counter->_numNodes;
+
+    Config results;
+    results.add( "earth_file",           earthFile );
+    results.add( "camera_path",          path.valid() ? pathFile : (viewpointsFile.empty() ? "<viewpoints>" : viewpointsFile) );
+    results.add( "headless",             std::string(headless ? "true" : "false") );
+    results.add( "width",                width );
+    results.add( "height",               height );
+    results.add( "frames",               (unsigned)bench._frameTimes.size() );
+    results.add( "total_time_s",         totalTime );
+    results.add( "replay_time_s",        replayTime );
+    results.add( "initial_settle_s",     initialSettle );
+    results.add( "max_settle_s",         maxSettle );
+    results.add( "mean_settle_s",        bench._settleTimes.empty() ? 0.0 : sumSettle/(double)bench._settleTimes.size() );
+    results.add( "settle_timeouts",      bench._numTimeouts );
+    results.add( "frame_mean_ms",        sorted.empty() ? 0.0 : 1000.0*sumFrames/(double)sorted.size() );
+    results.add( "frame_p50_ms",         1000.0*percentile(sorted, 0.50) );
+    results.add( "frame_p95_ms",         1000.0*percentile(sorted, 0.95) );
+    results.add( "frame_p99_ms",         1000.0*percentile(sorted, 0.99) );
+    results.add( "frame_max_ms",         sorted.empty() ? 0.0 : 1000.0*sorted.back() );
+    results.add( "tiles_loaded",         numTiles );
+    results.add( "tiles_per_s",          totalTime > 0.0 ? (double)numTiles/totalTime : 0.0 );
+    results.add( "http_requests",        httpStats._numRequests );
+    results.add( "http_failed",          httpStats._numFailed );
+    results.add( "bytes_fetched",        httpStats._bytesReceived );
+    results.add( "cache_hits",           uriStats._cacheHits );
+    results.add( "cache_misses",         uriStats._cacheMisses );
+    results.add( "cache_expired",        uriStats._cacheExpired );
+    results.add( "cache_hit_rate",       uriStats.cacheHitRate() );
+    results.add( "memcache_hits",        uriStats._memCacheHits );
+
+    Config settles("settle_times_s");
+    for( unsigned i = 0; i < bench._settleTimes.size(); ++i )
+        settles.add( "t", bench._settleTimes[i] );
+    results.add( settles );
+
+    for( ConfigSet::const_iterator i = results.children().begin(); i != results.children().end(); ++i )
+    {
+        if ( i->children().empty() )
+            OE_NOTICE << LC << std::setw(20) << std::left << i->key() << " = " << i->value() << std::endl;
+    }
+
+    if ( !outFile.empty() )
+    {
+        std::ofstream fout( outFile.c_str() );
+        if ( !fout.is_open() )
+            return usage( argv[0], "Failed to open " + outFile );
+        writeJSON( fout, results );
+        OE_NOTICE << LC << "Wrote results to " << outFile << std::endl;
+    }
+
+    return bench._numTimeouts > 0u ? 1 : 0;
+}
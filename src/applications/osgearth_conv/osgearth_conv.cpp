@@ -23,8 +23,11 @@
 #include <osgEarth/TileSource>
 #include <osgEarth/TileHandler>
 #include <osgEarth/TileVisitor>
+#include <osgEarth/ThreadingUtils>
 #include <osg/ArgumentParser>
 #include <osg/Timer>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Condition>
 #include <iomanip>
 
 using namespace osgEarth;
@@ -41,17 +44,121 @@ int usage(char** argv)
         << "\n    --profile [profile def]             : set an output profile (optional; default = same as input)"
         << "\n    --min-level [int]                   : minimum level of detail"
         << "\n    --max-level [int]                   : maximum level of detail"
+        << "\n    --threads [n]                       : number of threads reading from the input"
+        << "\n    --batch-size [n]                    : tiles per output write batch (default = 1000)"
         << std::endl;
         
     return 0;
 }
 
 
+// Collects the tiles produced by the reader threads and commits them to
+// the output on a single thread, in batches. Drivers that override
+// storeImages() (like mbtiles) write each batch in one transaction; the
+// bounded queue keeps fast readers from running away with memory.
+class TileWriter : public OpenThreads::Thread
+{
+public:
+    TileWriter(TileSource* dest, unsigned batchSize)
+        : _dest(dest), _batchSize(batchSize < 1 ? 1 : batchSize), _done(false), _numWritten(0), _numFailed(0)
+    {
+        //nop
+    }
+
+    void write(const TileKey& key, osg::Image* image)
+    {
+        push(key, image, 0L);
+    }
+
+    void write(const TileKey& key, osg::HeightField* hf)
+    {
+        push(key, 0L, hf);
+    }
+
+    // Commits everything still queued and stops the thread.
+    void finish()
+    {
+        {
+            Threading::ScopedMutexLock lock(_mutex);
+            _done = true;
+            _workAvailable.broadcast();
+        }
+        join();
+    }
+
+    unsigned getNumWritten() const { return _numWritten; }
+    unsigned getNumFailed() const { return _numFailed; }
+
+    void run()
+    {
+        std::vector<TileKey>                           keys;
+        std::vector< osg::ref_ptr<osg::Image> >        images;
+        std::vector< osg::ref_ptr<osg::HeightField> >  hfs;
+
+        while( true )
+        {
+            {
+                Threading::ScopedMutexLock lock(_mutex);
+                while( _keys.size() < _batchSize && !_done )
+                    _workAvailable.wait( &_mutex );
+
+                if ( _keys.empty() )
+                    break;
+
+                keys.swap( _keys );
+                images.swap( _images );
+                hfs.swap( _hfs );
+                _spaceAvailable.broadcast();
+            }
+
+            bool ok = hfs[0].valid() ?
+                _dest->storeHeightFields( keys, hfs, 0L ) :
+                _dest->storeImages( keys, images, 0L );
+
+            _numWritten += keys.size();
+            if ( !ok )
+                ++_numFailed;
+
+            keys.clear();
+            images.clear();
+            hfs.clear();
+        }
+    }
+
+private:
+    void push(const TileKey& key, osg::Image* image, osg::HeightField* hf)
+    {
+        Threading::ScopedMutexLock lock(_mutex);
+        while( _keys.size() >= 2*_batchSize )
+            _spaceAvailable.wait( &_mutex );
+
+        _keys.push_back( key );
+        _images.push_back( image );
+        _hfs.push_back( hf );
+
+        if ( _keys.size() >= _batchSize )
+            _workAvailable.signal();
+    }
+
+    TileSource*                                    _dest;
+    unsigned                                       _batchSize;
+    bool                                           _done;
+    unsigned                                       _numWritten;
+    unsigned                                       _numFailed;
+    std::vector<TileKey>                           _keys;
+    std::vector< osg::ref_ptr<osg::Image> >        _images;
+    std::vector< osg::ref_ptr<osg::HeightField> >  _hfs;
+    Threading::Mutex                               _mutex;
+    OpenThreads::Condition                         _workAvailable;
+    OpenThreads::Condition                         _spaceAvailable;
+};
+
+
 // TileHandler that copies images from one tilesource to another.
 struct TileSourceToTileSource : public TileHandler
 {
-    TileSourceToTileSource(TileSource* source, TileSource* dest, bool heightFields)
-        : _source(source), _dest(dest), _heightFields(heightFields)
+    TileSourceToTileSource(TileSource* source, TileWriter* writer, bool heightFields)
+        : _source(source), _writer(writer), _heightFields(heightFields)
     {
         //nop
     }
@@ -63,13 +170,19 @@ struct TileSourceToTileSource : public TileHandler
         {
             osg::ref_ptr<osg::HeightField> hf = _source->createHeightField(key);
             if ( hf.valid() )
-                ok = _dest->storeHeightField(key, hf.get(), 0L);
+            {
+                _writer->write(key, hf.get());
+                ok = true;
+            }
         }
         else
         {
             osg::ref_ptr<osg::Image> image = _source->createImage(key);
             if ( image.valid() )
-                ok = _dest->storeImage(key, image.get(), 0L);
+            {
+                _writer->write(key, image.get());
+                ok = true;
+            }
         }
         return ok;
     }
@@ -80,7 +193,7 @@ struct TileSourceToTileSource : public TileHandler
     }
 
     TileSource* _source;
-    TileSource* _dest;
+    TileWriter* _writer;
     bool        _heightFields;
 };
 
@@ -90,19 +203,19 @@ struct TileSourceToTileSource : public TileHandler
 // necessary to translate from one Profile/SRS to another.
 struct ImageLayerToTileSource : public TileHandler
 {
-    ImageLayerToTileSource(ImageLayer* source, TileSource* dest)
-        : _source(source), _dest(dest)
+    ImageLayerToTileSource(ImageLayer* source, TileWriter* writer)
+        : _source(source), _writer(writer)
     {
         //nop
     }
 
     bool handleTile(const TileKey& key, const TileVisitor& tv)
     {
-        bool ok = false;
         GeoImage image = _source->createImage(key);
-        if ( image.valid() )
-            ok = _dest->storeImage(key, image.getImage(), 0L);
-        return ok;
+        if ( !image.valid() )
+            return false;
+        _writer->write(key, image.getImage());
+        return true;
     }
     
     bool hasData(const TileKey& key) const
@@ -111,7 +224,7 @@ struct ImageLayerToTileSource : public TileHandler
     }
 
     osg::ref_ptr<ImageLayer> _source;
-    TileSource*              _dest;
+    TileWriter*              _writer;
 };
 
 
@@ -120,19 +233,19 @@ struct ImageLayerToTileSource : public TileHandler
 // necessary to translate from one Profile/SRS to another.
 struct ElevationLayerToTileSource : public TileHandler
 {
-    ElevationLayerToTileSource(ElevationLayer* source, TileSource* dest)
-        : _source(source), _dest(dest)
+    ElevationLayerToTileSource(ElevationLayer* source, TileWriter* writer)
+        : _source(source), _writer(writer)
     {
         //nop
     }
 
     bool handleTile(const TileKey& key, const TileVisitor& tv)
     {
-        bool ok = false;
         GeoHeightField hf = _source->createHeightField(key, 0L);
-        if ( hf.valid() )
-            ok = _dest->storeHeightField(key, hf.getHeightField(), 0L);
-        return ok;
+        if ( !hf.valid() )
+            return false;
+        _writer->write(key, hf.getHeightField());
+        return true;
     }
     
     bool hasData(const TileKey& key) const
@@ -141,13 +254,18 @@ struct ElevationLayerToTileSource : public TileHandler
     }
 
     osg::ref_ptr<ElevationLayer> _source;
-    TileSource*                  _dest;
+    TileWriter*                  _writer;
 };
 
 
-// Custom progress reporter
+// Custom progress reporter; also shows the conversion rate.
 struct ProgressReporter : public osgEarth::ProgressCallback
 {
+    ProgressReporter()
+    {
+        _start = osg::Timer::instance()->tick();
+    }
+
     bool reportProgress(double             current, 
                         double             total, 
                         unsigned           currentStage,
@@ -157,11 +275,13 @@ struct ProgressReporter : public osgEarth::ProgressCallback
         _mutex.lock();
 
         float percentage = current/total*100.0f;
+        double elapsed = osg::Timer::instance()->delta_s(_start, osg::Timer::instance()->tick());
         std::cout 
             << std::fixed
             << std::setprecision(1) << "\r" 
             << (int)current << "/" << (int)total
-            << " (" << percentage << "%)"
+            << " (" << percentage << "%), "
+            << (elapsed > 0.0 ? current/elapsed : 0.0) << " tiles/s"
             << "                        "
             << std::flush;
 
@@ -174,6 +294,7 @@ struct ProgressReporter : public osgEarth::ProgressCallback
     }
 
     Threading::Mutex _mutex;
+    osg::Timer_t     _start;
 };
 
 
@@ -191,6 +312,9 @@ struct ProgressReporter : public osgEarth::ProgressCallback
  *      --out driver mbtiles
  *      --out filename world.db
  *
+ * Use "--out filename world.gpkg" (or "--out geopackage true") to write
+ * an OGC GeoPackage instead.
+ *
  * The "in" properties come from the GDALOptions getConfig method. The
  * "out" properties come from the MBTilesOptions getConfig method.
  *
@@ -200,7 +324,8 @@ struct ProgressReporter : public osgEarth::ProgressCallback
  *      --profile [profile]   : reproject to the target profile, e.g. "wgs84"
  *      --min-level [int]     : min level of detail to copy
  *      --max-level [int]     : max level of detail to copy
- *      --threads [n]         : threads to use (may crash. Careful.)
+ *      --threads [n]         : threads reading from the input (may crash. Careful.)
+ *      --batch-size [n]      : tiles per output write batch (default = 1000)
  *
  *      --extents [minLat] [minLong] [maxLat] [maxLong] : Lat/Long extends to copy (*)
  *
@@ -295,6 +420,11 @@ main(int argc, char** argv)
         << outConf.toJSON(true)
         << std::endl;
 
+    // all tiles go through a single writer thread.
+    unsigned batchSize = 1000;
+    args.read("--batch-size", batchSize);
+    TileWriter* writer = new TileWriter(output.get(), batchSize);
+
     // create the visitor.
     osg::ref_ptr<TileVisitor> visitor;
 
@@ -314,7 +444,7 @@ main(int argc, char** argv)
     if ( isSameProfile )
     {
         OE_NOTICE << LC << "Profiles match - initiating simple tile copy" << std::endl;
-        visitor->setTileHandler( new TileSourceToTileSource(input.get(), output.get(), heightFields) );
+        visitor->setTileHandler( new TileSourceToTileSource(input.get(), writer, heightFields) );
     }
     else
     {
@@ -328,7 +458,7 @@ main(int argc, char** argv)
                 OE_WARN << LC << "Input profile is not valid" << std::endl;
                 return -1;
             }
-            visitor->setTileHandler( new ElevationLayerToTileSource(layer, output.get()) );
+            visitor->setTileHandler( new ElevationLayerToTileSource(layer, writer) );
         }
         else
         {
@@ -338,7 +468,7 @@ main(int argc, char** argv)
                 OE_WARN << LC << "Input profile is not valid" << std::endl;
                 return -1;
             }
-            visitor->setTileHandler( new ImageLayerToTileSource(layer, output.get()) );
+            visitor->setTileHandler( new ImageLayerToTileSource(layer, writer) );
         }
     }
     
@@ -390,16 +520,29 @@ main(int argc, char** argv)
 
     osg::Timer_t t0 = osg::Timer::instance()->tick();
 
+    writer->start();
+
     visitor->run( outputProfile.get() );
 
+    writer->finish();
+
     osg::Timer_t t1 = osg::Timer::instance()->tick();
+    double seconds = osg::Timer::instance()->delta_s(t0, t1);
 
     std::cout
         << "Time = " 
         << std::fixed
         << std::setprecision(1)
-        << osg::Timer::instance()->delta_s(t0, t1)
-        << " seconds." << std::endl;
+        << seconds
+        << " seconds; wrote " << writer->getNumWritten() << " tiles ("
+        << (seconds > 0.0 ? writer->getNumWritten()/seconds : 0.0) << " tiles/s)." << std::endl;
+
+    if ( writer->getNumFailed() > 0 )
+    {
+        OE_WARN << LC << writer->getNumFailed() << " write batches had errors" << std::endl;
+    }
+
+    delete writer;
 
     return 0;
 }
@@ -46,6 +46,16 @@ createUI()
     return vbox;
 } 
 
+//------------------------------------------------------------------------
+// queries whatever is under the mouse as it moves
+struct HoverPredicate : public FeatureQueryTool::InputPredicate
+{
+    bool accept( const osgGA::GUIEventAdapter& ea )
+    {
+        return ea.getEventType() == osgGA::GUIEventAdapter::MOVE;
+    }
+};
+
 //------------------------------------------------------------------------
 
 int
@@ -55,6 +65,10 @@ main(int argc, char** argv)
     if ( arguments.read("--stencil") )
         osg::DisplaySettings::instance()->setMinimumNumStencilBits( 8 );
 
+    // query with the GPU ID buffer (needs feature_indexing gpu_picking="true")
+    bool gpu   = arguments.read("--gpu");
+    bool hover = arguments.read("--hover");
+
     // a basic OSG viewer
     osgViewer::Viewer viewer(arguments);
 
@@ -82,6 +96,9 @@ main(int argc, char** argv)
         if ( mapNode )
         {
             FeatureQueryTool* tool = new FeatureQueryTool( mapNode );
+            tool->setGPUPicking( gpu );
+            if ( hover )
+                tool->setInputPredicate( new HoverPredicate() );
             viewer.addEventHandler( tool );
 
             VBox* readout = ControlCanvas::getOrCreate(&viewer)->addControl( new VBox() );
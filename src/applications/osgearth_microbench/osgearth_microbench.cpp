@@ -0,0 +1,654 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/Notify>
+#include <osgEarth/ImageUtils>
+#include <osgEarth/HeightFieldUtils>
+#include <osgEarth/SpatialReference>
+#include <osgEarth/Registry>
+#include <osgEarth/TileKey>
+#include <osgEarth/Profile>
+#include <osgEarth/GeoData>
+#include <osgEarth/Tessellator>
+#include <osgEarth/Map>
+#include <osgEarth/MapNode>
+#include <osgEarth/ElevationLayer>
+#include <osgEarth/TerrainEngineNode>
+#include <osgEarth/StringUtils>
+#include <osgEarthSymbology/Expression>
+#include <osgEarthSymbology/Geometry>
+#include <osgEarthSymbology/Style>
+#include <osgEarthSymbology/PolygonSymbol>
+#include <osgEarthSymbology/ExtrusionSymbol>
+#include <osgEarthFeatures/Feature>
+#include <osgEarthFeatures/GeometryCompiler>
+#include <osgEarthFeatures/FilterContext>
+#include <osg/ArgumentParser>
+#include <osg/Geometry>
+#include <osg/Timer>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <cmath>
+
+#define LC "[microbench] "
+
+using namespace osgEarth;
+using namespace osgEarth::Symbology;
+using namespace osgEarth::Features;
+
+int
+usage(const char* name)
+{
+    OE_NOTICE
+        << "\nUsage: " << name << " [options]\n"
+        << "\n  Measures the throughput of core library kernels.\n"
+        << "    --kernel <name>        : run only kernels whose name contains <name> (repeatable)\n"
+        << "    --list                 : list the kernels and exit\n"
+        << "    --trials <n>           : timed trials per kernel; the median is reported (default 5)\n"
+        << "    --min-time <s>         : minimum run time of each trial (default 0.25)\n"
+        << "    --out <file.json>      : write the results, for use as a baseline\n"
+        << "    --baseline <file.json> : compare against a stored baseline\n"
+        << "    --tolerance <f>        : slowdown fraction that counts as a regression (default 0.10)\n"
+        << "    --no-terrain           : skip the kernels that need a terrain engine\n"
+        << std::endl;
+
+    return -1;
+}
+
+namespace
+{
+    /**
+     * One benchmarked kernel. run() does one unit of work and returns the
+     * number of items (pixels, points, keys...) it processed.
+     */
+    struct Kernel : public osg::Referenced
+    {
+        Kernel(const std::string& name, const std::string& units) : _name(name), _units(units) { }
+
+        virtual bool setup() { return true; }
+        virtual unsigned run() =0;
+
+        std::string _name;
+        std::string _units;
+    };
+
+    /** Deterministic pseudo-random numbers in [0..1) so runs are comparable. */
+    struct Random
+    {
+        Random(unsigned seed =12345u) : _state(seed) { }
+        double next() { _state = _state * 1664525u + 1013904223u; return (double)(_state >> 8) / (double)(1u << 24); }
+        unsigned _state;
+    };
+
+    osg::Image* makeImage(unsigned s, unsigned t)
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage( s, t, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+        unsigned char* p = image->data();
+        for( unsigned i = 0; i < s*t*4; ++i )
+            p[i] = (unsigned char)( (i * 31u) & 0xff );
+        return image;
+    }
+
+    osg::HeightField* makeHeightField(unsigned cols, unsigned rows)
+    {
+        osg::HeightField* hf = new osg::HeightField();
+        hf->allocate( cols, rows );
+        for( unsigned r = 0; r < rows; ++r )
+            for( unsigned c = 0; c < cols; ++c )
+                hf->setHeight( c, r, 1000.0f * (float)(sin(0.1*c) * cos(0.07*r)) );
+        return hf;
+    }
+
+    //------------------------------------------------------------------
+
+    struct ImageResizeKernel : public Kernel
+    {
+        ImageResizeKernel() : Kernel("image_resize_bilinear", "pixels") { }
+        bool setup() { _input = makeImage(512, 512); return true; }
+        unsigned run()
+        {
+            osg::ref_ptr<osg::Image> output;
+            ImageUtils::resizeImage( _input.get(), 256, 256, output );
+            return 256*256;
+        }
+        osg::ref_ptr<osg::Image> _input;
+    };
+
+    struct ImageMixKernel : public Kernel
+    {
+        ImageMixKernel() : Kernel("image_mix", "pixels") { }
+        bool setup() { _dest = makeImage(256, 256); _src = makeImage(256, 256); return true; }
+        unsigned run()
+        {
+            ImageUtils::mix( _dest.get(), _src.get(), 0.5f );
+            return 256*256;
+        }
+        osg::ref_ptr<osg::Image> _dest, _src;
+    };
+
+    struct ImageConvertKernel : public Kernel
+    {
+        ImageConvertKernel() : Kernel("image_convert_rgba_rgb", "pixels") { }
+        bool setup() { _input = makeImage(256, 256); return true; }
+        unsigned run()
+        {
+            osg::ref_ptr<osg::Image> output = ImageUtils::convert( _input.get(), GL_RGB, GL_UNSIGNED_BYTE );
+            return 256*256;
+        }
+        osg::ref_ptr<osg::Image> _input;
+    };
+
+    //------------------------------------------------------------------
+
+    struct HeightFieldSampleKernel : public Kernel
+    {
+        HeightFieldSampleKernel(bool batch) :
+            Kernel(batch ? "heightfield_sample_batch" : "heightfield_sample", "samples"), _batch(batch) { }
+
+        bool setup()
+        {
+            _hf = makeHeightField( 257, 257 );
+            Random rand;
+            _nx.resize( 65536 );
+            _ny.resize( 65536 );
+            _out.resize( 65536 );
+            for( unsigned i = 0; i < _nx.size(); ++i )
+            {
+                _nx[i] = rand.next();
+                _ny[i] = rand.next();
+            }
+            return true;
+        }
+
+        unsigned run()
+        {
+            unsigned n = _nx.size();
+            if ( _batch )
+            {
+                HeightFieldUtils::getHeightsAtNormalizedLocations( _hf.get(), &_nx[0], &_ny[0], n, &_out[0] );
+            }
+            else
+            {
+                for( unsigned i = 0; i < n; ++i )
+                    _out[i] = HeightFieldUtils::getHeightAtNormalizedLocation( _hf.get(), _nx[i], _ny[i] );
+            }
+            return n;
+        }
+
+        bool                           _batch;
+        osg::ref_ptr<osg::HeightField> _hf;
+        std::vector<double>            _nx, _ny;
+        std::vector<float>             _out;
+    };
+
+    struct HeightFieldResampleKernel : public Kernel
+    {
+        HeightFieldResampleKernel() : Kernel("heightfield_resample", "posts") { }
+        bool setup()
+        {
+            _hf = makeHeightField( 257, 257 );
+            _extent = GeoExtent( SpatialReference::get("wgs84"), 0.0, 0.0, 1.0, 1.0 );
+            return true;
+        }
+        unsigned run()
+        {
+            osg::ref_ptr<osg::HeightField> out = HeightFieldUtils::resampleHeightField( _hf.get(), _extent, 129, 129 );
+            return 129*129;
+        }
+        osg::ref_ptr<osg::HeightField> _hf;
+        GeoExtent                      _extent;
+    };
+
+    //------------------------------------------------------------------
+
+    struct SRSTransformKernel : public Kernel
+    {
+        SRSTransformKernel(const std::string& name, const std::string& target) :
+            Kernel(name, "points"), _target(target) { }
+
+        bool setup()
+        {
+            _from = SpatialReference::get( "wgs84" );
+            _to   = _target == "ecef" ? _from->getECEF() : SpatialReference::get( _target );
+            if ( !_from.valid() || !_to.valid() )
+                return false;
+
+            Random rand;
+            _input.resize( 10000 );
+            for( unsigned i = 0; i < _input.size(); ++i )
+                _input[i].set( -180.0 + 360.0*rand.next(), -80.0 + 160.0*rand.next(), 1000.0*rand.next() );
+            return true;
+        }
+
+        unsigned run()
+        {
+            _work = _input;
+            _from->transform( _work, _to.get() );
+            return _work.size();
+        }
+
+        std::string                          _target;
+        osg::ref_ptr<const SpatialReference> _from, _to;
+        std::vector<osg::Vec3d>              _input, _work;
+    };
+
+    //------------------------------------------------------------------
+
+    struct TileKeyKernel : public Kernel
+    {
+        TileKeyKernel() : Kernel("tilekey_subdivide", "keys"), _sink(0.0) { }
+        bool setup() { _profile = Registry::instance()->getGlobalGeodeticProfile(); return _profile.valid(); }
+        unsigned run()
+        {
+            // walk four levels below a level-4 key, touching each extent:
+            unsigned count = 0;
+            std::vector<TileKey> keys, next;
+            keys.push_back( _profile->createTileKey(10.0, 45.0, 4) );
+            for( unsigned level = 0; level < 4; ++level )
+            {
+                next.clear();
+                for( unsigned k = 0; k < keys.size(); ++k )
+                {
+                    for( unsigned q = 0; q < 4; ++q )
+                    {
+                        TileKey child = keys[k].createChildKey( q );
+                        _sink += child.getExtent().width();
+                        next.push_back( child );
+                        ++count;
+                    }
+                }
+                keys.swap( next );
+            }
+            return count;
+        }
+        osg::ref_ptr<const Profile> _profile;
+        double                      _sink;
+    };
+
+    struct ProfileIntersectKernel : public Kernel
+    {
+        ProfileIntersectKernel() : Kernel("profile_intersecting_tiles", "keys") { }
+        bool setup()
+        {
+            _geodetic = Registry::instance()->getGlobalGeodeticProfile();
+            _mercator = Registry::instance()->getGlobalMercatorProfile();
+            Random rand;
+            for( unsigned i = 0; i < 256; ++i )
+            {
+                double x = -170.0 + 340.0*rand.next();
+                double y = -70.0 + 140.0*rand.next();
+                GeoPoint p( _geodetic->getSRS(), x, y );
+                GeoPoint m;
+                p.transform( _mercator->getSRS(), m );
+                _keys.push_back( _mercator->createTileKey(m.x(), m.y(), 8) );
+            }
+            return _geodetic.valid() && _mercator.valid();
+        }
+        unsigned run()
+        {
+            std::vector<TileKey> out;
+            for( unsigned i = 0; i < _keys.size(); ++i )
+            {
+                out.clear();
+                _geodetic->getIntersectingTiles( _keys[i], out );
+            }
+            return _keys.size();
+        }
+        osg::ref_ptr<const Profile> _geodetic, _mercator;
+        std::vector<TileKey>        _keys;
+    };
+
+    //------------------------------------------------------------------
+
+    struct ExpressionKernel : public Kernel
+    {
+        ExpressionKernel(bool batch) :
+            Kernel(batch ? "expression_eval_batch" : "expression_eval", "evals"), _batch(batch) { }
+
+        bool setup()
+        {
+            _expr = NumericExpression( "([a] * 2.0 + [b]) / 3.0 - [c] % 7" );
+            unsigned numVars = _expr.variables().size();
+            if ( numVars == 0 )
+                return false;
+            Random rand;
+            _values.resize( 4096 * numVars );
+            for( unsigned i = 0; i < _values.size(); ++i )
+                _values[i] = 100.0 * rand.next();
+            _out.resize( 4096 );
+            return true;
+        }
+
+        unsigned run()
+        {
+            unsigned numVars = _expr.variables().size();
+            if ( _batch )
+            {
+                _expr.eval( &_values[0], 4096, &_out[0] );
+            }
+            else
+            {
+                for( unsigned i = 0; i < 4096; ++i )
+                {
+                    for( unsigned v = 0; v < numVars; ++v )
+                        _expr.set( _expr.variables()[v], _values[i*numVars + v] );
+                    _out[i] = _expr.eval();
+                }
+            }
+            return 4096;
+        }
+
+        bool                _batch;
+        NumericExpression   _expr;
+        std::vector<double> _values;
+        std::vector<double> _out;
+    };
+
+    //------------------------------------------------------------------
+
+    struct TessellatorKernel : public Kernel
+    {
+        TessellatorKernel() : Kernel("tessellate_polygon", "vertices") { }
+        bool setup()
+        {
+            // a star-shaped (concave) ring
+            _ring = new osg::Vec3Array();
+            for( unsigned i = 0; i < 1000; ++i )
+            {
+                double a = 2.0*osg::PI*(double)i/1000.0;
+                double r = (i % 2 == 0) ? 100.0 : 60.0;
+                _ring->push_back( osg::Vec3(r*cos(a), r*sin(a), 0.0) );
+            }
+            return true;
+        }
+        unsigned run()
+        {
+            osg::ref_ptr<osg::Geometry> geom = new osg::Geometry();
+            geom->setVertexArray( new osg::Vec3Array(*_ring) );
+            geom->addPrimitiveSet( new osg::DrawArrays(GL_POLYGON, 0, _ring->size()) );
+            Tessellator tess;
+            tess.tessellateGeometry( *geom );
+            return _ring->size();
+        }
+        osg::ref_ptr<osg::Vec3Array> _ring;
+    };
+
+    //------------------------------------------------------------------
+
+    struct GeometryCompileKernel : public Kernel
+    {
+        GeometryCompileKernel() : Kernel("geometry_compile_extruded", "features") { }
+        bool setup()
+        {
+            _srs = SpatialReference::get( "wgs84" );
+            _style.getOrCreate<PolygonSymbol>()->fill()->color() = Color::Yellow;
+            _style.getOrCreate<ExtrusionSymbol>()->height() = 50.0f;
+            return _srs.valid();
+        }
+        unsigned run()
+        {
+            FeatureList features;
+            for( unsigned i = 0; i < 500; ++i )
+            {
+                double x = -80.0 + 0.01*(double)(i % 25);
+                double y =  40.0 + 0.01*(double)(i / 25);
+                Symbology::Polygon* poly = new Symbology::Polygon();
+                poly->push_back( osg::Vec3d(x,       y,       0) );
+                poly->push_back( osg::Vec3d(x+0.005, y,       0) );
+                poly->push_back( osg::Vec3d(x+0.005, y+0.005, 0) );
+                poly->push_back( osg::Vec3d(x,       y+0.005, 0) );
+                features.push_back( new Feature(poly, _srs.get()) );
+            }
+            GeometryCompiler compiler;
+            osg::ref_ptr<osg::Node> node = compiler.compile( features, _style, FilterContext(0L) );
+            return 500;
+        }
+        osg::ref_ptr<const SpatialReference> _srs;
+        Style                                _style;
+    };
+
+    //------------------------------------------------------------------
+
+    /** Synthetic elevation, so the terrain kernel does no I/O. */
+    class SineHeightSource : public TileSource
+    {
+    public:
+        SineHeightSource() : TileSource(TileSourceOptions()) { }
+
+        Status initialize(const osgDB::Options* dbOptions)
+        {
+            setProfile( Registry::instance()->getGlobalGeodeticProfile() );
+            return STATUS_OK;
+        }
+
+        osg::Image* createImage(const TileKey& key, ProgressCallback* progress)
+        {
+            return 0L;
+        }
+
+        osg::HeightField* createHeightField(const TileKey& key, ProgressCallback* progress)
+        {
+            return makeHeightField( 33, 33 );
+        }
+    };
+
+    struct TileCompileKernel : public Kernel
+    {
+        TileCompileKernel() : Kernel("terrain_tile_compile", "tiles"), _next(0u) { }
+        bool setup()
+        {
+            Map* map = new Map();
+            map->addElevationLayer( new ElevationLayer(ElevationLayerOptions("sine", TileSourceOptions()), new SineHeightSource()) );
+            _mapNode = new MapNode( map );
+            if ( !_mapNode->getTerrainEngine() )
+                return false;
+
+            const Profile* profile = map->getProfile();
+            TileKey base = profile->createTileKey( 10.0, 45.0, 10 );
+            for( int y = 0; y < 8; ++y )
+                for( int x = 0; x < 8; ++x )
+                    _keys.push_back( base.createNeighborKey(x, y) );
+            return true;
+        }
+        unsigned run()
+        {
+            osg::ref_ptr<osg::Node> tile = _mapNode->getTerrainEngine()->createTile( _keys[_next] );
+            _next = (_next + 1u) % _keys.size();
+            return tile.valid() ? 1u : 0u;
+        }
+        osg::ref_ptr<MapNode> _mapNode;
+        std::vector<TileKey>  _keys;
+        unsigned              _next;
+    };
+
+    //------------------------------------------------------------------
+
+    /** Runs a kernel for at least minTime seconds; returns items per second. */
+    double trial(Kernel* kernel, double minTime)
+    {
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        double elapsed = 0.0;
+        double items = 0.0;
+        do
+        {
+            items += (double)kernel->run();
+            elapsed = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+        }
+        while( elapsed < minTime );
+
+        return items / elapsed;
+    }
+
+    bool selected(const std::string& name, const std::vector<std::string>& filters)
+    {
+        if ( filters.empty() )
+            return true;
+        for( unsigned i = 0; i < filters.size(); ++i )
+            if ( name.find(filters[i]) != std::string::npos )
+                return true;
+        return false;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc,argv);
+
+    if ( arguments.read("--help") )
+        return usage(argv[0]);
+
+    std::vector<std::string> filters;
+    std::string filter;
+    while( arguments.read("--kernel", filter) )
+        filters.push_back( filter );
+
+    bool list = arguments.read( "--list" );
+
+    unsigned trials = 5u;
+    arguments.read( "--trials", trials );
+    trials = osg::maximum( trials, 1u );
+
+    double minTime = 0.25;
+    arguments.read( "--min-time", minTime );
+
+    std::string outFile, baselineFile;
+    arguments.read( "--out", outFile );
+    arguments.read( "--baseline", baselineFile );
+
+    double tolerance = 0.10;
+    arguments.read( "--tolerance", tolerance );
+
+    bool noTerrain = arguments.read( "--no-terrain" );
+
+    std::vector< osg::ref_ptr<Kernel> > kernels;
+    kernels.push_back( new ImageResizeKernel() );
+    kernels.push_back( new ImageMixKernel() );
+    kernels.push_back( new ImageConvertKernel() );
+    kernels.push_back( new HeightFieldSampleKernel(false) );
+    kernels.push_back( new HeightFieldSampleKernel(true) );
+    kernels.push_back( new HeightFieldResampleKernel() );
+    kernels.push_back( new SRSTransformKernel("srs_transform_wgs84_mercator", "spherical-mercator") );
+    kernels.push_back( new SRSTransformKernel("srs_transform_wgs84_ecef", "ecef") );
+    kernels.push_back( new TileKeyKernel() );
+    kernels.push_back( new ProfileIntersectKernel() );
+    kernels.push_back( new ExpressionKernel(false) );
+    kernels.push_back( new ExpressionKernel(true) );
+    kernels.push_back( new TessellatorKernel() );
+    kernels.push_back( new GeometryCompileKernel() );
+    if ( !noTerrain )
+        kernels.push_back( new TileCompileKernel() );
+
+    if ( list )
+    {
+        for( unsigned i = 0; i < kernels.size(); ++i )
+            OE_NOTICE << kernels[i]->_name << " (" << kernels[i]->_units << "/s)" << std::endl;
+        return 0;
+    }
+
+    // load the baseline if there is one:
+    Config baseline;
+    if ( !baselineFile.empty() )
+    {
+        std::ifstream fin( baselineFile.c_str() );
+        std::stringstream buf;
+        buf << fin.rdbuf();
+        if ( !fin.is_open() || !baseline.fromJSON(buf.str()) )
+        {
+            OE_WARN << LC << "Failed to read baseline " << baselineFile << std::endl;
+            return -1;
+        }
+        if ( baseline.hasChild("microbench") )
+            baseline = baseline.child("microbench");
+    }
+
+    Config results("microbench");
+    unsigned numRegressions = 0u;
+
+    for( unsigned k = 0; k < kernels.size(); ++k )
+    {
+        Kernel* kernel = kernels[k].get();
+        if ( !selected(kernel->_name, filters) )
+            continue;
+
+        if ( !kernel->setup() )
+        {
+            OE_WARN << LC << kernel->_name << ": setup failed, skipping" << std::endl;
+            continue;
+        }
+
+        // warm up caches and lazy initialization:
+        kernel->run();
+
+        std::vector<double> rates;
+        for( unsigned t = 0; t < trials; ++t )
+            rates.push_back( trial(kernel, minTime) );
+        std::sort( rates.begin(), rates.end() );
+        double rate = rates[rates.size()/2];
+
+        std::stringstream rateStr;
+        rateStr << std::fixed << std::setprecision(1) << rate;
+        results.add( kernel->_name, rateStr.str() );
+
+        std::stringstream line;
+        line << std::setw(32) << std::left << kernel->_name
+             << std::setw(14) << std::right << std::fixed << std::setprecision(0) << rate
+             << " " << kernel->_units << "/s";
+
+        if ( baseline.hasValue(kernel->_name) )
+        {
+            double base = baseline.value<double>( kernel->_name, 0.0 );
+            double ratio = base > 0.0 ? rate / base : 0.0;
+            line << "   " << std::setprecision(2) << ratio << "x baseline";
+            if ( ratio < 1.0 - tolerance )
+            {
+                line << "  REGRESSION";
+                ++numRegressions;
+            }
+        }
+
+        OE_NOTICE << line.str() << std::endl;
+    }
+
+    if ( !outFile.empty() )
+    {
+        std::ofstream fout( outFile.c_str() );
+        if ( !fout.is_open() )
+        {
+            OE_WARN << LC << "Failed to open " << outFile << std::endl;
+            return -1;
+        }
+        fout << results.toJSON( true ) << std::endl;
+        OE_NOTICE << LC << "Wrote results to " << outFile << std::endl;
+    }
+
+    if ( numRegressions > 0u )
+    {
+        OE_NOTICE << LC << numRegressions << " kernel(s) regressed more than "
+            << (int)(tolerance*100.0) << "% against the baseline" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -66,6 +66,7 @@ usage( const std::string& msg = "" )
         << "            [--ext <extension>]             : overrides the image file extension (e.g. jpg)\n"
         << "            [--overwrite]                   : overwrite existing tiles\n"
         << "            [--keep-empties]                : writes out fully transparent image tiles (normally discarded)\n"
+        << "            [--pyramid]                     : reads only the max level from the source and builds the coarser levels by downsampling it\n"
         << "            [--continue-single-color]       : continues to subdivide single color tiles, subdivision typicall stops on single color images\n"
         << "            [--elevation-pixel-depth]       : pixeldepth for elevations\n"
         << "            [--db-options]                : db options string to pass to the image writer in quotes (e.g., \"JPEG_QUALITY 60\")\n"
@@ -211,6 +212,9 @@ makeTMS( osg::ArgumentParser& args )
     // whether to keep 'empty' tiles    
     bool keepEmpties = args.read( "--keep-empties" );
 
+    // whether to build the coarser levels from the max level
+    bool buildPyramid = args.read( "--pyramid" );
+
     //TODO:  Single color
     bool continueSingleColor = args.read( "--continue-single-color" );
 
@@ -326,6 +330,11 @@ makeTMS( osg::ArgumentParser& args )
     packager.setWriteOptions(options);    
     packager.setOverwrite(overwrite);
     packager.setKeepEmpties(keepEmpties);
+    packager.setBuildPyramid(buildPyramid);
+    if (concurrency > 0)
+    {
+        packager.setNumPyramidThreads(concurrency);
+    }
 
 
     // new map for an output earth file if necessary.
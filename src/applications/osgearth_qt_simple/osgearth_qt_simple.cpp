@@ -22,6 +22,7 @@
 #include <osgEarthUtil/ExampleResources>
 #include <osgEarthUtil/EarthManipulator>
 #include <osgEarthQt/ViewerWidget>
+#include <osgEarthQt/OffscreenViewerWidget>
 #include <QApplication>
 #include <QMainWindow>
 #include <QStatusBar>
@@ -43,6 +44,7 @@ usage( const std::string& msg )
 {
     OE_NOTICE << msg << std::endl << std::endl;
     OE_NOTICE << "USAGE: osgearth_qt_simple file.earth" << std::endl;
+    OE_NOTICE << "          [--offscreen]    : render on a separate thread to an offscreen buffer" << std::endl;
         
     return -1;
 }
@@ -56,6 +58,7 @@ main(int argc, char** argv)
     if ( arguments.read("--stencil") )
         osg::DisplaySettings::instance()->setMinimumNumStencilBits(8);
 
+    bool offscreen = arguments.read("--offscreen");
 
     osgViewer::Viewer viewer(arguments);
     viewer.setRunFrameScheme( viewer.ON_DEMAND );
@@ -77,7 +80,9 @@ main(int argc, char** argv)
 
     QApplication app(argc, argv);
 
-    QWidget* viewerWidget = new ViewerWidget( &viewer );
+    QWidget* viewerWidget = offscreen ?
+        (QWidget*)new OffscreenViewerWidget( &viewer ) :
+        (QWidget*)new ViewerWidget( &viewer );
 
     QMainWindow win;
     win.setCentralWidget( viewerWidget );
@@ -87,6 +87,11 @@ int
         << "        [--mp]                          ; Use multiprocessing to process the tiles.  Useful for GDAL sources as this avoids the global GDAL lock" << std::endl
         << "        [--mt]                          ; Use multithreading to process the tiles." << std::endl
         << "        [--concurrency]                 ; The number of threads or proceses to use if --mp or --mt are provided." << std::endl
+        << "        [--keep-empty]                  ; Keep descending below tiles that come back empty (fully transparent or no-data)" << std::endl
+        << "        [--queue path]                  ; Share the seed among processes on many machines through a queue directory on a shared file system" << std::endl
+        << "        [--coordinator]                 ; With --queue, enumerate the tiles into the queue and report progress instead of seeding" << std::endl
+        << "        [--worker-name name]            ; With --queue, a unique name for this worker" << std::endl
+        << "        [--lease-timeout seconds]       ; With --queue, seconds after which an abandoned batch is handed to another worker (default=600)" << std::endl
         << "        [--verbose]                     ; Displays progress of the seed operation" << std::endl
         << std::endl
         << "    --purge file.earth                  ; Purges a layer cache in a .earth file (interactive)" << std::endl
@@ -140,6 +145,19 @@ int
     unsigned int batchSize = 0;
     args.read("--batchsize", batchSize);
 
+    std::string queuePath;
+    args.read("--queue", queuePath);
+
+    bool coordinator = args.read("--coordinator");
+
+    bool keepEmpty = args.read("--keep-empty");
+
+    std::string workerName;
+    args.read("--worker-name", workerName);
+
+    double leaseTimeout = 0.0;
+    args.read("--lease-timeout", leaseTimeout);
+
     // Read the concurrency level
     unsigned int concurrency = 0;
     args.read("-c", concurrency);
@@ -232,7 +250,30 @@ int
     // If we dont' have a visitor create one.
     if (!visitor.valid())
     {
-        if (args.read("--mt"))
+        if (!queuePath.empty())
+        {
+            // Create a distributed visitor
+            DistributedTileVisitor* v = new DistributedTileVisitor();
+            v->setQueuePath( queuePath );
+            v->setRole( coordinator ? DistributedTileVisitor::ROLE_COORDINATOR : DistributedTileVisitor::ROLE_WORKER );
+
+            if (batchSize > 0)
+            {
+                v->setBatchSize( batchSize );
+            }
+
+            if (!workerName.empty())
+            {
+                v->setWorkerName( workerName );
+            }
+
+            if (leaseTimeout > 0.0)
+            {
+                v->setLeaseTimeout( leaseTimeout );
+            }
+            visitor = v;
+        }
+        else if (args.read("--mt"))
         {
             // Create a multithreaded visitor
             MultithreadedTileVisitor* v = new MultithreadedTileVisitor();
@@ -300,6 +341,7 @@ int
     // Initialize the seeder
     CacheSeed seeder;
     seeder.setVisitor(visitor.get());
+    seeder.setSkipEmptyTiles( !keepEmpty );
 
     osgEarth::Map* map = mapNode->getMap();
 
@@ -21,6 +21,7 @@
 #include <osgEarthDrivers/feature_ogr/OGRFeatureOptions>
 
 #include <osgEarthUtil/TFSPackager>
+#include <OpenThreads/Thread>
 
 using namespace osgEarth;
 using namespace osgEarth::Util;
@@ -54,6 +55,9 @@ usage( const std::string& msg )
         << "    --crop             ; Crops features instead of doing a centroid check.  Features can be added to multiple tiles when cropping is enabled" << std::endl
         << "    --dest-srs         ; The destination SRS string in any format osgEarth can understand (wkt, proj4, epsg).  If none is specified the source data SRS will be used" << std::endl
         << "    --bounds minx miny maxx maxy ; The bounding box to use as Level 0.  Feature extent will be used by default" << std::endl
+        << "    --mod-attribute    ; Feature attribute that changes when a feature is edited, used to detect changes when re-packaging" << std::endl
+        << "    --full             ; Re-package every tile instead of only the tiles whose features changed since the last run" << std::endl
+        << "    --threads          ; Number of threads to use (default = number of processors)" << std::endl
         << std::endl;
 
     return -1;
@@ -108,6 +112,14 @@ int main(int argc, char** argv)
     std::string destSRS;
     while(arguments.read("--dest-srs", destSRS));
 
+    std::string modAttribute;
+    while(arguments.read("--mod-attribute", modAttribute));
+
+    bool incremental = !arguments.read("--full");
+
+    unsigned int numThreads = OpenThreads::GetNumberOfProcessors();
+    while(arguments.read("--threads", numThreads));
+
     std::string grid;
     float gridSizeMeters = -1.0f;
     while (arguments.read("--grid", grid));
@@ -222,6 +234,9 @@ int main(int argc, char** argv)
         << "  OrderBy=" << queryOrderBy << std::endl
         << "  Method= " << method << std::endl
         << "  DestSRS= " << destSRS << std::endl
+        << "  ModAttribute= " << modAttribute << std::endl
+        << "  Incremental= " << (incremental ? "yes" : "no") << std::endl
+        << "  Threads= " << numThreads << std::endl
         << std::endl;
 
     //buildTFS( features.get(), firstLevel, maxLevel, maxFeatures, destination, layer, description, query, cropMethod);
@@ -233,6 +248,9 @@ int main(int argc, char** argv)
     packager.setMethod( cropMethod );    
     packager.setDestSRS( destSRS );
     packager.setLod0Extent(ext);
+    packager.setModificationAttribute( modAttribute );
+    packager.setIncremental( incremental );
+    packager.setNumThreads( numThreads );
 
     packager.package( features, destination, layer, description );
     osg::Timer_t endTime = osg::Timer::instance()->tick();
@@ -0,0 +1,157 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/Arena>
+
+using namespace osgEarth;
+
+namespace
+{
+    // every allocation starts on a boundary suitable for any basic type.
+    const std::size_t ALIGNMENT = 16u;
+
+    // scratch vectors bigger than this are freed on check-in rather than kept.
+    const std::size_t MAX_SCRATCH_POINTS = 1u << 20;
+}
+
+Arena::Arena(std::size_t blockSize, std::size_t maxRetained) :
+_block      ( 0u ),
+_offset     ( 0u ),
+_blockSize  ( blockSize > ALIGNMENT ? blockSize : ALIGNMENT ),
+_maxRetained( maxRetained )
+{
+    //nop
+}
+
+Arena::~Arena()
+{
+    for( std::vector<Block>::iterator b = _blocks.begin(); b != _blocks.end(); ++b )
+        ::operator delete( b->_data );
+
+    for( std::vector< std::vector<osg::Vec3d>* >::iterator p = _freePoints.begin(); p != _freePoints.end(); ++p )
+        delete *p;
+}
+
+void*
+Arena::allocate(std::size_t bytes)
+{
+    bytes = (bytes + ALIGNMENT - 1u) & ~(ALIGNMENT - 1u);
+
+    if ( _block < _blocks.size() && _offset + bytes <= _blocks[_block]._size )
+    {
+        void* ptr = _blocks[_block]._data + _offset;
+        _offset += bytes;
+        return ptr;
+    }
+
+    // move on to the next block. One left over from a released scope is
+    // reused if it's big enough; otherwise a new one goes in its place.
+    unsigned next = _blocks.size() > 0 ? _block + 1u : 0u;
+    if ( next >= _blocks.size() || _blocks[next]._size < bytes )
+    {
+        Block block;
+        block._size = bytes > _blockSize ? bytes : _blockSize;
+        block._data = static_cast<char*>( ::operator new(block._size) );
+        _blocks.insert( _blocks.begin() + next, block );
+    }
+
+    _block  = next;
+    _offset = bytes;
+    return _blocks[_block]._data;
+}
+
+Arena::Mark
+Arena::mark() const
+{
+    Mark m;
+    m._block  = _block;
+    m._offset = _offset;
+    return m;
+}
+
+void
+Arena::release(const Mark& m)
+{
+    if ( m._block < _block || (m._block == _block && m._offset < _offset) )
+    {
+        _block  = m._block;
+        _offset = m._offset;
+    }
+
+    if ( _block == 0u && _offset == 0u )
+        trim();
+}
+
+std::size_t
+Arena::getBytesUsed() const
+{
+    std::size_t total = 0u;
+    for( unsigned b = 0; b < _block && b < _blocks.size(); ++b )
+        total += _blocks[b]._size;
+    return total + _offset;
+}
+
+std::size_t
+Arena::getBytesReserved() const
+{
+    std::size_t total = 0u;
+    for( std::vector<Block>::const_iterator b = _blocks.begin(); b != _blocks.end(); ++b )
+        total += b->_size;
+    return total;
+}
+
+void
+Arena::trim()
+{
+    // keep the first blocks (up to the limit) for the next scope.
+    std::size_t kept = 0u;
+    unsigned    keep = 0u;
+    while( keep < _blocks.size() && kept + _blocks[keep]._size <= _maxRetained )
+        kept += _blocks[keep++]._size;
+
+    for( unsigned b = keep; b < _blocks.size(); ++b )
+        ::operator delete( _blocks[b]._data );
+    _blocks.resize( keep );
+}
+
+std::vector<osg::Vec3d>*
+Arena::checkoutPoints()
+{
+    if ( _freePoints.empty() )
+        return new std::vector<osg::Vec3d>();
+
+    std::vector<osg::Vec3d>* points = _freePoints.back();
+    _freePoints.pop_back();
+    return points;
+}
+
+void
+Arena::checkinPoints(std::vector<osg::Vec3d>* points)
+{
+    if ( !points )
+        return;
+
+    if ( points->capacity() > MAX_SCRATCH_POINTS )
+    {
+        delete points;
+        return;
+    }
+
+    points->clear();
+    _freePoints.push_back( points );
+}
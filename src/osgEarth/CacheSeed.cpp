@@ -20,6 +20,7 @@
 #include <osgEarth/CacheSeed>
 #include <osgEarth/CacheEstimator>
 #include <osgEarth/MapFrame>
+#include <osgEarth/ImageUtils>
 #include <OpenThreads/ScopedLock>
 #include <limits.h>
 
@@ -28,10 +29,30 @@
 using namespace osgEarth;
 using namespace OpenThreads;
 
+namespace
+{
+    bool isEmptyHeightField( const osg::HeightField* hf )
+    {
+        const osg::FloatArray* heights = hf->getFloatArray();
+        for (osg::FloatArray::const_iterator i = heights->begin(); i != heights->end(); ++i)
+        {
+            if ( *i != NO_DATA_VALUE )
+                return false;
+        }
+        return true;
+    }
+}
+
 CacheTileHandler::CacheTileHandler( TerrainLayer* layer, Map* map ):
 _layer( layer ),
-_map( map )
+_map( map ),
+_skipEmptyTiles( true )
 {
+    TileSource* ts = layer->getTileSource();
+    if ( ts && ts->getProfile() && map->getProfile()->isHorizEquivalentTo(ts->getProfile()) )
+    {
+        _tileIndex = new TileExistenceIndex();
+    }
 }
 
 bool CacheTileHandler::handleTile(const TileKey& key, const TileVisitor& tv)
@@ -45,7 +66,13 @@ bool CacheTileHandler::handleTile(const TileKey& key, const TileVisitor& tv)
         GeoImage image = imageLayer->createImage( key );
         if (image.valid())
         {                
-            return true;
+            // A fully transparent tile means there's nothing below it either.
+            if ( !_skipEmptyTiles || !ImageUtils::isEmptyImage(image.getImage()) )
+            {
+                if ( _tileIndex.valid() )
+                    _tileIndex->add( key );
+                return true;
+            }
         }            
     }
     else if (elevationLayer )
@@ -53,7 +80,12 @@ bool CacheTileHandler::handleTile(const TileKey& key, const TileVisitor& tv)
         GeoHeightField hf = elevationLayer->createHeightField( key );
         if (hf.valid())
         {                
-            return true;
+            if ( !_skipEmptyTiles || !isEmptyHeightField(hf.getHeightField()) )
+            {
+                if ( _tileIndex.valid() )
+                    _tileIndex->add( key );
+                return true;
+            }
         }            
     }
 
@@ -72,6 +104,11 @@ bool CacheTileHandler::hasData( const TileKey& key ) const
     TileSource* ts = _layer->getTileSource();
     if (ts)
     {
+        // Tiles that already failed to load won't have children either.
+        if (ts->getBlacklist() && ts->getBlacklist()->contains(key))
+        {
+            return false;
+        }
         return ts->hasData(key);
     }
     return true;
@@ -114,7 +151,8 @@ std::string CacheTileHandler::getProcessString() const
 /***************************************************************************************/
 
 CacheSeed::CacheSeed():
-_visitor(new TileVisitor())
+_visitor(new TileVisitor()),
+_skipEmptyTiles(true)
 {
 }
 
@@ -130,6 +168,27 @@ void CacheSeed::setVisitor(TileVisitor* visitor)
 
 void CacheSeed::run( TerrainLayer* layer, Map* map )
 {
-    _visitor->setTileHandler( new CacheTileHandler( layer, map ) );
+    osg::ref_ptr<CacheTileHandler> handler = new CacheTileHandler( layer, map );
+    handler->setSkipEmptyTiles( _skipEmptyTiles );
+    _visitor->setTileHandler( handler.get() );
     _visitor->run( map->getProfile() );
+
+    // A tile index is only authoritative if this process visited the whole
+    // tree from the root, so skip partial and multiprocess traversals.
+    TileSource* ts = layer->getTileSource();
+    TileExistenceIndex* index = handler->getTileIndex();
+    if (ts && index && !index->empty() &&
+        _visitor->getMinLevel() == 0 &&
+        _visitor->getExtents().empty() &&
+        dynamic_cast<MultiprocessTileVisitor*>(_visitor.get()) == 0L &&
+        dynamic_cast<TileKeyListVisitor*>(_visitor.get()) == 0L)
+    {
+        ts->setTileIndex( index );
+        if ( ts->getOptions().tileIndexFilename().isSet() )
+        {
+            const std::string& filename = ts->getOptions().tileIndexFilename().get();
+            index->write( filename );
+            OE_INFO << LC << "Wrote tile index (" << index->size() << " tiles) to " << filename << std::endl;
+        }
+    }
 }
\ No newline at end of file
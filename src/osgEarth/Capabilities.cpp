@@ -30,6 +30,14 @@ using namespace osgEarth;
 
 #define LC "[Capabilities] "
 
+#ifndef GL_MAX_TEXTURE_BUFFER_SIZE
+#define GL_MAX_TEXTURE_BUFFER_SIZE 0x8C2B
+#endif
+
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
 // ---------------------------------------------------------------------------
 // A custom P-Buffer graphics context that we will use to query for OpenGL 
 // extension and hardware support. (Adapted from osgconv in OpenSceneGraph)
@@ -126,11 +134,15 @@ _supportsDepthPackedStencilBuffer( false ),
 _supportsOcclusionQuery ( false ),
 _supportsDrawInstanced  ( false ),
 _supportsUniformBufferObjects( false ),
+_supportsTextureBuffer  ( false ),
+_maxTextureBufferSize   ( 0 ),
+_supportsProgramBinary  ( false ),
 _supportsNonPowerOfTwoTextures( false ),
 _maxUniformBlockSize    ( 0 ),
 _preferDLforStaticGeom  ( true ),
 _numProcessors          ( 1 ),
 _supportsFragDepthWrite ( false ),
+_supportsClipControl    ( false ),
 _supportsS3TC           ( false ),
 _supportsPVRTC          ( false ),
 _supportsARBTC          ( false ),
@@ -289,6 +301,32 @@ _supportsRGTC           ( false )
             _supportsUniformBufferObjects = false;
         }
 
+        _supportsTextureBuffer = 
+            _supportsGLSL &&
+            osg::isGLExtensionOrVersionSupported( id, "GL_ARB_texture_buffer_object", 3.1f );
+
+        if ( _supportsTextureBuffer )
+        {
+            glGetIntegerv( GL_MAX_TEXTURE_BUFFER_SIZE, &_maxTextureBufferSize );
+            if ( _maxTextureBufferSize <= 0 )
+                _supportsTextureBuffer = false;
+        }
+        OE_INFO << LC << "  texture buffer objects = " << SAYBOOL(_supportsTextureBuffer) << std::endl;
+
+        _supportsProgramBinary =
+            _supportsGLSL &&
+            osg::isGLExtensionOrVersionSupported( id, "GL_ARB_get_program_binary", 4.1f );
+
+        if ( _supportsProgramBinary )
+        {
+            // a driver may expose the extension but support no binary formats.
+            GLint numFormats = 0;
+            glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats );
+            if ( numFormats <= 0 )
+                _supportsProgramBinary = false;
+        }
+        OE_INFO << LC << "  program binaries = " << SAYBOOL(_supportsProgramBinary) << std::endl;
+
         _supportsNonPowerOfTwoTextures =
             osg::isGLExtensionSupported( id, "GL_ARB_texture_non_power_of_two" );
         OE_INFO << LC << "  NPOT textures = " << SAYBOOL(_supportsNonPowerOfTwoTextures) << std::endl;
@@ -301,6 +339,10 @@ _supportsRGTC           ( false )
         _supportsFragDepthWrite = true;
 #endif
 
+        _supportsClipControl =
+            osg::isGLExtensionOrVersionSupported( id, "GL_ARB_clip_control", 4.5f );
+        OE_INFO << LC << "  clip control = " << SAYBOOL(_supportsClipControl) << std::endl;
+
         //_supportsTexture2DLod = osg::isGLExtensionSupported( id, "GL_ARB_shader_texture_lod" );
         //OE_INFO << LC << "  texture2DLod = " << SAYBOOL(_supportsTexture2DLod) << std::endl;
 
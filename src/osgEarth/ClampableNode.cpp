@@ -20,9 +20,16 @@
 #include <osgEarth/ClampableNode>
 #include <osgEarth/ClampingTechnique>
 #include <osgEarth/DepthOffset>
+#include <osgEarth/ElevationQuery>
 #include <osgEarth/OverlayDecorator>
 #include <osgEarth/MapNode>
+#include <osgEarth/Registry>
+#include <osgEarth/TaskService>
 #include <osgEarth/VirtualProgram>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Transform>
+#include <set>
 
 #define LC "[ClampableNode] "
 
@@ -36,13 +43,146 @@ namespace
     {
         return m ? m->getOverlayDecorator()->getGroup<ClampingTechnique>() : 0L;
     }
+
+    Threading::Mutex          s_bakeServiceMutex;
+    osg::ref_ptr<TaskService> s_bakeService;
+
+    TaskService* getBakeService()
+    {
+        Threading::ScopedMutexLock lock( s_bakeServiceMutex );
+        if ( !s_bakeService.valid() )
+        {
+            s_bakeService = new TaskService( "ClampableNode", 2 );
+            Registry::instance()->registerTaskService( s_bakeService.get() );
+        }
+        return s_bakeService.get();
+    }
+
+    /** One geometry to bake, with the vertices it had before baking. */
+    struct BakeTarget
+    {
+        osg::ref_ptr<osg::Geometry> _geometry;
+        osg::ref_ptr<osg::Vec3Array> _original;
+        osg::ref_ptr<osg::Vec3Array> _baked;
+        osg::Matrixd                 _local2world;
+    };
+
+    /**
+     * Collects the geometries of a subgraph along with their local-to-world
+     * matrices. A geometry shared by several paths is baked for the first one.
+     */
+    struct CollectBakeTargets : public osg::NodeVisitor
+    {
+        CollectBakeTargets( const osg::Matrixd& base, std::vector<BakeTarget>& targets ) :
+            osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ),
+            _targets        ( targets )
+        {
+            _matrixStack.push_back( base );
+        }
+
+        void apply( osg::Transform& xform )
+        {
+            osg::Matrixd m = _matrixStack.back();
+            xform.computeLocalToWorldMatrix( m, this );
+            _matrixStack.push_back( m );
+            traverse( xform );
+            _matrixStack.pop_back();
+        }
+
+        void apply( osg::Geode& geode )
+        {
+            for( unsigned i = 0; i < geode.getNumDrawables(); ++i )
+            {
+                osg::Geometry* geom = geode.getDrawable(i)->asGeometry();
+                if ( !geom || !_seen.insert(geom).second )
+                    continue;
+
+                osg::Vec3Array* verts = dynamic_cast<osg::Vec3Array*>( geom->getVertexArray() );
+                if ( !verts || verts->empty() )
+                    continue;
+
+                BakeTarget target;
+                target._geometry    = geom;
+                target._original    = verts;
+                target._local2world = _matrixStack.back();
+                _targets.push_back( target );
+            }
+        }
+
+        std::vector<BakeTarget>&  _targets;
+        std::vector<osg::Matrixd> _matrixStack;
+        std::set<osg::Geometry*>  _seen;
+    };
 }
 
 //------------------------------------------------------------------------
 
+/**
+ * Samples the terrain height under each vertex of the collected geometries
+ * and builds the baked vertex arrays. Runs in the bake service; only reads
+ * the original arrays, which stay untouched until the bake is applied.
+ */
+class ClampableNode::BakeTask : public TaskRequest
+{
+public:
+    BakeTask( const Map* map, double resolution ) :
+      _map       ( map ),
+      _resolution( resolution ) { }
+
+    void operator()( ProgressCallback* progress )
+    {
+        const SpatialReference* srs = _map->getSRS();
+        if ( !srs )
+            return;
+
+        ElevationQuery query( _map.get() );
+
+        std::vector<osg::Vec3d> points;
+        std::vector<double>     elevations;
+        std::vector<bool>       valid;
+
+        for( std::vector<BakeTarget>::iterator t = _targets.begin(); t != _targets.end(); ++t )
+        {
+            if ( wasCanceled() )
+                return;
+
+            const osg::Vec3Array& verts = *t->_original.get();
+            points.resize( verts.size() );
+            for( unsigned i = 0; i < verts.size(); ++i )
+            {
+                osg::Vec3d world = osg::Vec3d(verts[i]) * t->_local2world;
+                srs->transformFromWorld( world, points[i] );
+            }
+
+            query.getElevations( points, srs, elevations, valid, _resolution );
+
+            // like the GPU clamper, points with no elevation data go to zero.
+            osg::Matrixd world2local = osg::Matrixd::inverse( t->_local2world );
+            t->_baked = new osg::Vec3Array( verts.size() );
+            for( unsigned i = 0; i < verts.size(); ++i )
+            {
+                osg::Vec3d mapPoint( points[i].x(), points[i].y(), valid[i] ? elevations[i] : 0.0 );
+                osg::Vec3d world;
+                srs->transformToWorld( mapPoint, world );
+                (*t->_baked)[i] = world * world2local;
+            }
+        }
+    }
+
+    osg::ref_ptr<const Map>  _map;
+    double                   _resolution;
+    std::vector<BakeTarget>  _targets;
+};
+
+//------------------------------------------------------------------------
+
 ClampableNode::ClampableNode( MapNode* mapNode, bool active ) :
 OverlayNode( mapNode, active, &getTechniqueGroup ),
-_updatePending( false )
+_updatePending  ( false ),
+_bake           ( false ),
+_bakeResolution ( 0.0 ),
+_baked          ( false ),
+_rebakeRequested( false )
 {
     _adapter.setGraph( this );
 
@@ -50,6 +190,12 @@ _updatePending( false )
         _adapter.recalculate();
 }
 
+ClampableNode::~ClampableNode()
+{
+    if ( _bakeTask.valid() )
+        _bakeTask->cancel();
+}
+
 void
 ClampableNode::setDepthOffsetOptions(const DepthOffsetOptions& options)
 {
@@ -85,14 +231,184 @@ ClampableNode::computeBound() const
     return OverlayNode::computeBound();
 }
 
+void
+ClampableNode::setBakeClamping( bool value )
+{
+    if ( value != _bake )
+    {
+        _bake = value;
+        ADJUST_UPDATE_TRAV_COUNT( this, value ? 1 : -1 );
+
+        // turning it off is handled right away here since the
+        // update traversal no longer looks at this node's bake.
+        if ( !value )
+            restoreBake();
+    }
+}
+
+void
+ClampableNode::setBakeResolution( double value )
+{
+    if ( value != _bakeResolution )
+    {
+        _bakeResolution = value;
+        rebake();
+    }
+}
+
+void
+ClampableNode::rebake()
+{
+    _rebakeRequested = true;
+}
+
+void
+ClampableNode::updateBake( osg::NodeVisitor& nv )
+{
+    if ( _rebakeRequested || ((_baked || _bakeTask.valid()) && elevationLayersChanged()) )
+    {
+        _rebakeRequested = false;
+        restoreBake();
+    }
+
+    if ( _bakeTask.valid() )
+    {
+        if ( _bakeTask->isCompleted() )
+            applyBake();
+    }
+    else if ( !_baked && getActive() )
+    {
+        startBake( nv );
+    }
+}
+
+void
+ClampableNode::startBake( osg::NodeVisitor& nv )
+{
+    osg::ref_ptr<MapNode> mapNode = getMapNode();
+    if ( !mapNode.valid() || !mapNode->getMap() )
+        return;
+
+    const Map* map = mapNode->getMap();
+
+    ElevationLayerVector layers;
+    _bakedRevision = map->getElevationLayers( layers );
+    _bakedLayers.clear();
+    for( ElevationLayerVector::const_iterator i = layers.begin(); i != layers.end(); ++i )
+        _bakedLayers.push_back( std::make_pair(i->get()->getUID(), i->get()->getEnabled()) );
+
+    _bakeTask = new BakeTask( map, _bakeResolution );
+    _bakeTask->setName( "ClampableNode bake" );
+
+    // the update visitor's path ends at this node.
+    osg::Matrixd base = osg::computeLocalToWorld( nv.getNodePath() );
+    CollectBakeTargets collect( base, _bakeTask->_targets );
+    osg::Group::traverse( collect );
+
+    getBakeService()->add( _bakeTask.get() );
+}
+
+void
+ClampableNode::applyBake()
+{
+    osg::ref_ptr<BakeTask> task = _bakeTask.get();
+    _bakeTask = 0L;
+
+    if ( task->wasCanceled() )
+        return;
+
+    for( std::vector<BakeTarget>::iterator t = task->_targets.begin(); t != task->_targets.end(); ++t )
+    {
+        // skip geometries that changed since the bake started.
+        if ( !t->_baked.valid() || t->_geometry->getVertexArray() != t->_original.get() )
+            continue;
+
+        t->_geometry->setVertexArray( t->_baked.get() );
+        t->_geometry->dirtyDisplayList();
+        t->_geometry->dirtyBound();
+    }
+
+    // the previously applied task keeps the arrays it replaced alive
+    // until now, in case a draw thread was still using them.
+    _appliedTask = task.get();
+    _baked = true;
+
+    // the heights are in the geometry now; stop draping.
+    setActive( false );
+    dirtyBound();
+
+    OE_DEBUG << LC << "Baked " << task->_targets.size() << " geometries" << std::endl;
+}
+
+void
+ClampableNode::restoreBake()
+{
+    if ( _bakeTask.valid() )
+    {
+        _bakeTask->cancel();
+        _bakeTask = 0L;
+    }
+
+    if ( _baked )
+    {
+        for( std::vector<BakeTarget>::iterator t = _appliedTask->_targets.begin(); t != _appliedTask->_targets.end(); ++t )
+        {
+            if ( t->_geometry->getVertexArray() == t->_baked.get() )
+            {
+                t->_geometry->setVertexArray( t->_original.get() );
+                t->_geometry->dirtyDisplayList();
+                t->_geometry->dirtyBound();
+            }
+        }
+        _baked = false;
+
+        // back to GPU clamping until the next bake lands.
+        setActive( true );
+        dirtyBound();
+    }
+}
+
+bool
+ClampableNode::elevationLayersChanged()
+{
+    osg::ref_ptr<MapNode> mapNode = getMapNode();
+    if ( !mapNode.valid() || !mapNode->getMap() )
+        return false;
+
+    const Map* map = mapNode->getMap();
+    if ( map->getDataModelRevision() == _bakedRevision )
+        return false;
+
+    ElevationLayerVector layers;
+    _bakedRevision = map->getElevationLayers( layers );
+
+    LayerSignature signature;
+    for( ElevationLayerVector::const_iterator i = layers.begin(); i != layers.end(); ++i )
+        signature.push_back( std::make_pair(i->get()->getUID(), i->get()->getEnabled()) );
+
+    if ( signature == _bakedLayers )
+        return false;
+
+    _bakedLayers.swap( signature );
+    return true;
+}
+
 void
 ClampableNode::traverse(osg::NodeVisitor& nv)
 {
-    if ( _updatePending && nv.getVisitorType() == nv.UPDATE_VISITOR )
+    if ( nv.getVisitorType() == nv.UPDATE_VISITOR )
     {
-        _adapter.recalculate();
-        ADJUST_UPDATE_TRAV_COUNT( this, -1 );
-        _updatePending = false;
+        if ( _updatePending )
+        {
+            _adapter.recalculate();
+            ADJUST_UPDATE_TRAV_COUNT( this, -1 );
+            _updatePending = false;
+        }
+
+        if ( _bake )
+        {
+            updateBake( nv );
+        }
     }
     OverlayNode::traverse( nv );
 }
@@ -19,6 +19,7 @@
 #include <osgEarth/ClampingTechnique>
 #include <osgEarth/Capabilities>
 #include <osgEarth/CullingUtils>
+#include <osgEarth/FrameStats>
 #include <osgEarth/Registry>
 #include <osgEarth/VirtualProgram>
 #include <osgEarth/MapNode>
@@ -45,8 +46,6 @@
 //#define DUMP_RTT_IMAGE 1
 //#undef DUMP_RTT_IMAGE
 
-//#define TIME_RTT_CAMERA 1
-
 using namespace osgEarth;
 
 //---------------------------------------------------------------------------
@@ -58,20 +57,6 @@ namespace
         return mapNode ? mapNode->getOverlayDecorator()->getGroup<ClampingTechnique>() : 0L;
     }
 
-#ifdef TIME_RTT_CAMERA
-    static osg::Timer_t t0, t1;
-    struct RttIn : public osg::Camera::DrawCallback {
-        void operator()(osg::RenderInfo& r) const {
-            t0 = osg::Timer::instance()->tick();
-        }
-    };
-    struct RttOut : public osg::Camera::DrawCallback {
-        void operator()(osg::RenderInfo& r) const {
-            t1 = osg::Timer::instance()->tick();
-            OE_NOTICE << "RTT = " << osg::Timer::instance()->delta_m(t0, t1) << "ms" << std::endl;
-        }
-    };
-#endif
 }
 
 ClampingTechnique::TechniqueProvider ClampingTechnique::Provider = s_providerImpl;
@@ -83,7 +68,6 @@ namespace
     // Additional per-view data stored by the clamping technique.
     struct LocalPerViewData : public osg::Referenced
     {
-        osg::ref_ptr<osg::Texture2D> _rttTexture;
         osg::ref_ptr<osg::StateSet>  _groupStateSet;
         osg::ref_ptr<osg::Uniform>   _camViewToDepthClipUniform;
         osg::ref_ptr<osg::Uniform>   _depthClipToCamViewUniform;
@@ -94,12 +78,53 @@ namespace
         osg::ref_ptr<osg::Uniform>   _horizonDistance2Uniform;
 
         unsigned _renderLeafCount;
-
-#ifdef DUMP_RTT_IMAGE
-        osg::ref_ptr<osg::Image> _rttDebugImage;
-#endif
     };
 
+    // Enlarges an orthographic projection by a fraction of its extent on
+    // every side but the far one (growing the far plane past the horizon
+    // would let the other side of a geocentric globe bleed through).
+    osg::Matrixd padOrtho(const osg::Matrixd& proj, double margin)
+    {
+        double l, r, b, t, n, f;
+        if ( margin <= 0.0 || !proj.getOrtho(l, r, b, t, n, f) )
+            return proj;
+
+        double dx = (r-l)*margin, dy = (t-b)*margin, dz = (f-n)*margin;
+        return osg::Matrixd::ortho(l-dx, r+dx, b-dy, t+dy, n-dz, f);
+    }
+
+    // Whether the volume rendered with captureView/captureProj contains the
+    // entire volume described by view/proj, at no worse than maxScale times
+    // the resolution the new volume would get on its own.
+    bool covers(const osg::Matrixd& captureView, const osg::Matrixd& captureProj,
+                const osg::Matrixd& view,        const osg::Matrixd& proj,
+                double              maxScale)
+    {
+        osg::Matrixd clipToWorld;
+        if ( !clipToWorld.invert(view * proj) )
+            return false;
+
+        osg::Matrixd clipToCaptureClip = clipToWorld * captureView * captureProj;
+
+        const double epsilon = 1e-6;
+        for(int i=0; i<8; ++i)
+        {
+            osg::Vec3d corner( (i&1)? 1.0:-1.0, (i&2)? 1.0:-1.0, (i&4)? 1.0:-1.0 );
+            osg::Vec3d p = corner * clipToCaptureClip;
+            if ( fabs(p.x()) > 1.0+epsilon || fabs(p.y()) > 1.0+epsilon || fabs(p.z()) > 1.0+epsilon )
+                return false;
+        }
+
+        double l0, r0, b0, t0, n0, f0, l1, r1, b1, t1, n1, f1;
+        if ( captureProj.getOrtho(l0, r0, b0, t0, n0, f0) && proj.getOrtho(l1, r1, b1, t1, n1, f1) )
+        {
+            if ( (r0-l0) > maxScale*(r1-l1) || (t0-b0) > maxScale*(t1-b1) )
+                return false;
+        }
+
+        return true;
+    }
+
 #ifdef DUMP_RTT_IMAGE
     struct DumpTex : public osg::Camera::DrawCallback
     {
@@ -192,7 +217,12 @@ static osgEarthRegisterRenderBinProxy<ClampingRenderBin> s_regbin(OSGEARTH_CLAMP
 //---------------------------------------------------------------------------
 
 ClampingTechnique::ClampingTechnique() :
-_textureSize( 1024 )
+_textureSize  ( 1024 ),
+_engine       ( 0L ),
+_updatePolicy ( UPDATE_ON_CHANGE ),
+_captureMargin( 0.1f ),
+_moveThreshold( 0.0 ),
+_shareCaptures( true )
 {
     // disable if GLSL is not supported
     _supported = Registry::capabilities().supportsGLSL();
@@ -220,54 +250,58 @@ ClampingTechnique::reestablish(TerrainEngineNode* engine)
     // nop.
 }
 
-void
-ClampingTechnique::setUpCamera(OverlayDecorator::TechRTTParams& params)
+
+ClampingTechnique::DepthCapture*
+ClampingTechnique::createCapture(const void* context, int size) const
 {
-    // To store technique-specific per-view info:
-    LocalPerViewData* local = new LocalPerViewData();
-    params._techniqueData = local;
+    DepthCapture* capture = new DepthCapture();
+    capture->_context       = context;
+    capture->_size          = size;
+    capture->_owner         = 0L;
+    capture->_revision      = 0;
+    capture->_valid         = false;
+    capture->_renderedFrame = 0u;
+    capture->_usedFrame     = 0u;
 
     // create the projected texture:
-    local->_rttTexture = new osg::Texture2D();
-    local->_rttTexture->setTextureSize( *_textureSize, *_textureSize );
-    local->_rttTexture->setInternalFormat( GL_DEPTH_COMPONENT );
-    local->_rttTexture->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
-    local->_rttTexture->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
+    capture->_texture = new osg::Texture2D();
+    capture->_texture->setTextureSize( size, size );
+    capture->_texture->setInternalFormat( GL_DEPTH_COMPONENT );
+    capture->_texture->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+    capture->_texture->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
 
     // this is important. geometry that is outside the depth texture will clamp to the
     // closest edge value in the texture -- this is good when you are rendering a 
     // primitive that has one or more of its verts off-screen.
-    local->_rttTexture->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
-    local->_rttTexture->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
-    //local->_rttTexture->setBorderColor( osg::Vec4(0,0,0,1) );
+    capture->_texture->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    capture->_texture->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+    //capture->_texture->setBorderColor( osg::Vec4(0,0,0,1) );
 
     // set up the RTT camera:
-    params._rttCamera = new osg::Camera();
-    params._rttCamera->setReferenceFrame( osg::Camera::ABSOLUTE_RF_INHERIT_VIEWPOINT );
-    params._rttCamera->setClearDepth( 1.0 );
-    params._rttCamera->setClearMask( GL_DEPTH_BUFFER_BIT );
-    params._rttCamera->setComputeNearFarMode( osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR );
-    params._rttCamera->setViewport( 0, 0, *_textureSize, *_textureSize );
-    params._rttCamera->setRenderOrder( osg::Camera::PRE_RENDER );
-    params._rttCamera->setRenderTargetImplementation( osg::Camera::FRAME_BUFFER_OBJECT );
-    params._rttCamera->setImplicitBufferAttachmentMask(0, 0);
-    params._rttCamera->attach( osg::Camera::DEPTH_BUFFER, local->_rttTexture.get() );
+    osg::Camera* camera = new osg::Camera();
+    capture->_camera = camera;
+    camera->setReferenceFrame( osg::Camera::ABSOLUTE_RF_INHERIT_VIEWPOINT );
+    camera->setClearDepth( 1.0 );
+    camera->setClearMask( GL_DEPTH_BUFFER_BIT );
+    camera->setComputeNearFarMode( osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR );
+    camera->setViewport( 0, 0, size, size );
+    camera->setRenderOrder( osg::Camera::PRE_RENDER );
+    camera->setRenderTargetImplementation( osg::Camera::FRAME_BUFFER_OBJECT );
+    camera->setImplicitBufferAttachmentMask(0, 0);
+    camera->attach( osg::Camera::DEPTH_BUFFER, capture->_texture.get() );
+    camera->setInitialDrawCallback( new FrameStats::GPUTimerCallback(FrameStats::GPU_CLAMPING, true) );
+    camera->setFinalDrawCallback  ( new FrameStats::GPUTimerCallback(FrameStats::GPU_CLAMPING, false) );
 
 #ifdef DUMP_RTT_IMAGE
-    local->_rttDebugImage = new osg::Image();
-    local->_rttDebugImage->allocateImage(4096, 4096, 1, GL_RGB, GL_UNSIGNED_BYTE);
-    memset( (void*)local->_rttDebugImage->getDataPointer(), 0xff, local->_rttDebugImage->getTotalSizeInBytes() );
-    params._rttCamera->attach( osg::Camera::COLOR_BUFFER, local->_rttDebugImage.get() );
-    params._rttCamera->setFinalDrawCallback( new DumpTex(local->_rttDebugImage.get()) );
-#endif
-
-#ifdef TIME_RTT_CAMERA
-    params._rttCamera->setInitialDrawCallback( new RttIn() );
-    params._rttCamera->setFinalDrawCallback( new RttOut() );
+    osg::Image* rttDebugImage = new osg::Image();
+    rttDebugImage->allocateImage(4096, 4096, 1, GL_RGB, GL_UNSIGNED_BYTE);
+    memset( (void*)rttDebugImage->getDataPointer(), 0xff, rttDebugImage->getTotalSizeInBytes() );
+    camera->attach( osg::Camera::COLOR_BUFFER, rttDebugImage );
+    camera->setFinalDrawCallback( new DumpTex(rttDebugImage) );
 #endif
 
     // set up a StateSet for the RTT camera.
-    osg::StateSet* rttStateSet = params._rttCamera->getOrCreateStateSet();
+    osg::StateSet* rttStateSet = camera->getOrCreateStateSet();
 
     rttStateSet->setMode(
         GL_BLEND, 
@@ -286,7 +320,26 @@ ClampingTechnique::setUpCamera(OverlayDecorator::TechRTTParams& params)
     
     // attach the terrain to the camera.
     // todo: should probably protect this with a mutex.....
-    params._rttCamera->addChild( _engine ); // the terrain itself.
+    camera->addChild( _engine ); // the terrain itself.
+
+    // stateset that binds this capture's depth texture for the clamping shader.
+    capture->_stateSet = new osg::StateSet();
+    capture->_stateSet->setDataVariance( osg::Object::DYNAMIC );
+    capture->_stateSet->setTextureAttributeAndModes( 
+        _textureUnit, 
+        capture->_texture.get(), 
+        osg::StateAttribute::ON | osg::StateAttribute::OVERRIDE );
+
+    return capture;
+}
+
+
+void
+ClampingTechnique::setUpCamera(OverlayDecorator::TechRTTParams& params)
+{
+    // To store technique-specific per-view info:
+    LocalPerViewData* local = new LocalPerViewData();
+    params._techniqueData = local;
 
     // assemble the overlay graph stateset.
     local->_groupStateSet = new osg::StateSet();
@@ -295,11 +348,6 @@ ClampingTechnique::setUpCamera(OverlayDecorator::TechRTTParams& params)
     // TODO: figure out why and fix it. This is a workaround for now.
     local->_groupStateSet->setDataVariance( osg::Object::DYNAMIC );
 
-    local->_groupStateSet->setTextureAttributeAndModes( 
-        _textureUnit, 
-        local->_rttTexture.get(), 
-        osg::StateAttribute::ON | osg::StateAttribute::OVERRIDE );
-
     // set up depth test/write parameters for the overlay geometry:
     local->_groupStateSet->setAttributeAndModes(
         new osg::Depth( osg::Depth::LEQUAL, 0.0, 1.0, true ),
@@ -360,7 +408,7 @@ void
 ClampingTechnique::preCullTerrain(OverlayDecorator::TechRTTParams& params,
                                  osgUtil::CullVisitor*             cv )
 {
-    if ( !params._rttCamera.valid() && hasData(params) )
+    if ( !params._techniqueData.valid() && hasData(params) )
     {
         setUpCamera( params );
 
@@ -381,9 +429,96 @@ ClampingTechnique::preCullTerrain(OverlayDecorator::TechRTTParams& params,
 
 #endif
     }
+}
 
-#ifdef TIME_RTT_CAMERA
-#endif
+
+ClampingTechnique::DepthCapture*
+ClampingTechnique::getCapture(OverlayDecorator::TechRTTParams& params,
+                              unsigned                         frame,
+                              osg::Matrixd&                    out_viewMatrix,
+                              osg::Matrixd&                    out_projMatrix,
+                              bool&                            out_render)
+{
+    // a texture can only be shared by views rendering on the same graphics context.
+    // Without one (e.g. a nested camera), keep each view's captures to itself.
+    const void* context = params._mainCamera->getGraphicsContext();
+    if ( !context )
+        context = params._mainCamera;
+
+    int          size     = getTextureSize( params._mainCamera );
+    UpdatePolicy policy   = getUpdatePolicy( params._mainCamera );
+    int          revision = _revision;
+    double       margin   = policy == UPDATE_ON_CHANGE ? (double)_captureMargin : 0.0;
+    double       maxScale = 1.5 * (1.0 + 2.0*margin);
+
+    Threading::ScopedMutexLock lock( _capturesMutex );
+
+    DepthCapture* spare = 0L;
+
+    for(DepthCaptures::iterator i = _captures.begin(); i != _captures.end(); )
+    {
+        DepthCapture* c = i->get();
+
+        // retire captures nobody has used in a long while.
+        if ( c->_usedFrame + 300u < frame && c->_renderedFrame + 300u < frame )
+        {
+            i = _captures.erase( i );
+            continue;
+        }
+
+        if ( c->_context == context )
+        {
+            // re-use a valid capture that still covers this view. Skip any capture
+            // already rendered this frame by a different view, since its texture
+            // may not be drawn until after ours.
+            bool reusable =
+                policy == UPDATE_ON_CHANGE &&
+                c->_valid                  &&
+                c->_revision == revision   &&
+                c->_size >= size           &&
+                c->_renderedFrame != frame &&
+                (_shareCaptures || c->_owner == params._mainCamera) &&
+                (_moveThreshold <= 0.0 || (c->_eye - params._eyeWorld).length() <= _moveThreshold) &&
+                covers( c->_viewMatrix, c->_projMatrix, params._rttViewMatrix, params._rttProjMatrix, maxScale );
+
+            if ( reusable )
+            {
+                c->_usedFrame  = frame;
+                out_viewMatrix = c->_viewMatrix;
+                out_projMatrix = c->_projMatrix;
+                out_render     = false;
+                return c;
+            }
+
+            // a capture nobody has touched this frame may be rendered over.
+            if ( !spare && c->_size == size && c->_usedFrame != frame && c->_renderedFrame != frame )
+            {
+                spare = c;
+            }
+        }
+
+        ++i;
+    }
+
+    if ( !spare )
+    {
+        spare = createCapture( context, size );
+        _captures.push_back( spare );
+    }
+
+    spare->_viewMatrix    = params._rttViewMatrix;
+    spare->_projMatrix    = padOrtho( params._rttProjMatrix, margin );
+    spare->_eye           = params._eyeWorld;
+    spare->_owner         = params._mainCamera;
+    spare->_revision      = revision;
+    spare->_valid         = true;
+    spare->_renderedFrame = frame;
+    spare->_usedFrame     = frame;
+
+    out_viewMatrix = spare->_viewMatrix;
+    out_projMatrix = spare->_projMatrix;
+    out_render     = true;
+    return spare;
 }
 
 
@@ -391,16 +526,29 @@ void
 ClampingTechnique::cullOverlayGroup(OverlayDecorator::TechRTTParams& params,
                                     osgUtil::CullVisitor*            cv )
 {
-    if ( params._rttCamera.valid() && hasData(params) )
+    if ( params._techniqueData.valid() && hasData(params) )
     {
-        // update the RTT camera.
-        params._rttCamera->setViewMatrix      ( params._rttViewMatrix );
-        params._rttCamera->setProjectionMatrix( params._rttProjMatrix );
-
         LocalPerViewData& local = *static_cast<LocalPerViewData*>(params._techniqueData.get());
 
-        // create the depth texture (render the terrain to tex)
-        params._rttCamera->accept( *cv );
+        const osg::FrameStamp* fs = cv->getFrameStamp();
+        unsigned frame = fs ? fs->getFrameNumber() : (unsigned)(++_frameCounter);
+
+        // find (or render) a depth capture for this view.
+        osg::Matrix depthViewMatrix, depthProjMatrix;
+        bool render = false;
+        DepthCapture* capture = getCapture( params, frame, depthViewMatrix, depthProjMatrix, render );
+
+        if ( render )
+        {
+            // update the RTT camera.
+            capture->_camera->setViewMatrix      ( depthViewMatrix );
+            capture->_camera->setProjectionMatrix( depthProjMatrix );
+
+            // create the depth texture (render the terrain to tex)
+            capture->_camera->accept( *cv );
+        }
+
+        params._rttCamera = capture->_camera.get();
 
 
         // construct a matrix that transforms from camera view coords to depth texture
@@ -417,10 +565,10 @@ ClampingTechnique::cullOverlayGroup(OverlayDecorator::TechRTTParams& params,
         vm.invert( *cv->getModelViewMatrix() );
         osg::Matrix cameraViewToDepthView =
             vm *
-            params._rttViewMatrix;
+            depthViewMatrix;
 
         osg::Matrix depthViewToDepthClip = 
-            params._rttProjMatrix *
+            depthProjMatrix *
             s_scaleBiasMat;
 
         osg::Matrix cameraViewToDepthClip =
@@ -450,8 +598,10 @@ ClampingTechnique::cullOverlayGroup(OverlayDecorator::TechRTTParams& params,
 
         if ( params._group->getNumChildren() > 0 )
         {
-            // traverse the overlay nodes, applying the clamping shader.
+            // traverse the overlay nodes, applying the clamping shaders
+            // and the depth texture of the chosen capture.
             cv->pushStateSet( local._groupStateSet.get() );
+            cv->pushStateSet( capture->_stateSet.get() );
 
             // Since the vertex shader is moving the verts to clamp them to the terrain,
             // OSG will not be able to properly cull the geometry. (Specifically: OSG may
@@ -465,6 +615,7 @@ ClampingTechnique::cullOverlayGroup(OverlayDecorator::TechRTTParams& params,
 
             // done; pop the clamping shaders.
             cv->popStateSet();
+            cv->popStateSet();
         }
     }
 }
@@ -480,6 +631,89 @@ ClampingTechnique::setTextureSize( int texSize )
 }
 
 
+void
+ClampingTechnique::setTextureSize( const osg::Camera* view, int texSize )
+{
+    Threading::ScopedMutexLock lock( _viewSettingsMutex );
+    _viewSettings[view]._textureSize = texSize;
+}
+
+
+int
+ClampingTechnique::getTextureSize( const osg::Camera* view ) const
+{
+    Threading::ScopedMutexLock lock( _viewSettingsMutex );
+    ViewSettingsMap::const_iterator i = _viewSettings.find( view );
+    if ( i != _viewSettings.end() && i->second._textureSize.isSet() )
+        return *i->second._textureSize;
+    return *_textureSize;
+}
+
+
+void
+ClampingTechnique::setUpdatePolicy( UpdatePolicy value )
+{
+    _updatePolicy = value;
+}
+
+
+void
+ClampingTechnique::setUpdatePolicy( const osg::Camera* view, UpdatePolicy value )
+{
+    Threading::ScopedMutexLock lock( _viewSettingsMutex );
+    _viewSettings[view]._updatePolicy = value;
+}
+
+
+ClampingTechnique::UpdatePolicy
+ClampingTechnique::getUpdatePolicy( const osg::Camera* view ) const
+{
+    Threading::ScopedMutexLock lock( _viewSettingsMutex );
+    ViewSettingsMap::const_iterator i = _viewSettings.find( view );
+    if ( i != _viewSettings.end() && i->second._updatePolicy.isSet() )
+        return *i->second._updatePolicy;
+    return _updatePolicy;
+}
+
+
+void
+ClampingTechnique::setCaptureMargin( float value )
+{
+    _captureMargin = osg::clampBetween( value, 0.0f, 1.0f );
+}
+
+
+void
+ClampingTechnique::setMoveThreshold( double meters )
+{
+    _moveThreshold = osg::maximum( meters, 0.0 );
+}
+
+
+void
+ClampingTechnique::setShareCaptures( bool value )
+{
+    _shareCaptures = value;
+}
+
+
+void
+ClampingTechnique::dirty()
+{
+    ++_revision;
+}
+
+
+void
+ClampingTechnique::onTileAdded(const TileKey&          key,
+                               osg::Node*              tile,
+                               TerrainCallbackContext& context)
+{
+    // new terrain geometry invalidates existing depth captures.
+    dirty();
+}
+
+
 void
 ClampingTechnique::onInstall( TerrainEngineNode* engine )
 {
@@ -493,11 +727,29 @@ ClampingTechnique::onInstall( TerrainEngineNode* engine )
 
         OE_INFO << LC << "Using texture size = " << *_textureSize << std::endl;
     }
+
+    // refresh depth captures when the terrain changes.
+    if ( engine && engine->getTerrain() )
+    {
+        _terrainCallback = new TerrainCallbackAdapter<ClampingTechnique>( this );
+        engine->getTerrain()->addTerrainCallback( _terrainCallback.get() );
+    }
 }
 
 
 void
 ClampingTechnique::onUninstall( TerrainEngineNode* engine )
 {
+    if ( engine && engine->getTerrain() && _terrainCallback.valid() )
+    {
+        engine->getTerrain()->removeTerrainCallback( _terrainCallback.get() );
+    }
+    _terrainCallback = 0L;
+
+    {
+        Threading::ScopedMutexLock lock( _capturesMutex );
+        _captures.clear();
+    }
+
     _engine = 0L;
 }
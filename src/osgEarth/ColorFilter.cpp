@@ -18,9 +18,133 @@
  */
 #include <osgEarth/ColorFilter>
 #include <osgEarth/ThreadingUtils>
+#include <sstream>
 
 using namespace osgEarth;
 
+//------------------------------------------------------------------------
+
+namespace
+{
+    // a filter's guard: true when the filter changes the color.
+    std::string active(const ColorFilter::InlineCode& code)
+    {
+        return "!(" + code.identity + ")";
+    }
+
+    void writeCode(std::stringstream& buf, const std::string& code, const std::string& indent)
+    {
+        std::stringstream in(code);
+        std::string line;
+        while( std::getline(in, line) )
+        {
+            if ( !line.empty() )
+                buf << indent << line << "\n";
+        }
+    }
+
+    // one filter's statements, skipped at run time when it has no effect.
+    void writeGuarded(std::stringstream& buf, const ColorFilter::InlineCode& code, const std::string& indent)
+    {
+        if ( code.identity.empty() )
+        {
+            writeCode( buf, code.code, indent );
+        }
+        else
+        {
+            buf << indent << "if (" << active(code) << ") {\n";
+            writeCode( buf, code.code, indent + "    " );
+            buf << indent << "}\n";
+        }
+    }
+}
+
+void
+ColorFilterChainCompiler::compile(const ColorFilterChain& chain,
+                                  std::string&            out_declarations,
+                                  std::string&            out_body,
+                                  const std::string&      indent)
+{
+    std::stringstream head, body;
+
+    unsigned i = 0;
+    while( i < chain.size() )
+    {
+        const ColorFilter* filter = chain[i].get();
+        ColorFilter::InlineCode code;
+
+        if ( !filter->getInlineCode(code) )
+        {
+            head << "void " << filter->getEntryPointFunctionName() << "(inout vec4 color);\n";
+            body << indent << filter->getEntryPointFunctionName() << "(color);\n";
+            ++i;
+        }
+
+        else if ( code.space.empty() )
+        {
+            head << code.declarations;
+            writeGuarded( body, code, indent );
+            ++i;
+        }
+
+        else
+        {
+            // collect the run of inline filters working in the same color space:
+            std::vector<ColorFilter::InlineCode> run;
+            run.push_back( code );
+            for( ++i; i < chain.size(); ++i )
+            {
+                ColorFilter::InlineCode next;
+                if ( !chain[i]->getInlineCode(next) || next.space != code.space )
+                    break;
+                run.push_back( next );
+            }
+
+            // convert in and out once, and only if some member of the run is active:
+            std::string guard;
+            bool        always = false;
+            for( unsigned r = 0; r < run.size(); ++r )
+            {
+                head << run[r].declarations;
+                if ( run[r].identity.empty() )
+                    always = true;
+                else
+                    guard += (r > 0 ? " || " : "") + active(run[r]);
+            }
+            if ( always )
+                guard.clear();
+
+            std::string inner = indent + "    ";
+            body << indent << (guard.empty() ? "{" : "if (" + guard + ") {") << "\n";
+            writeCode( body, code.enterSpace, inner );
+            for( unsigned r = 0; r < run.size(); ++r )
+                writeGuarded( body, run[r], inner );
+            writeCode( body, code.leaveSpace, inner );
+            body << indent << "}\n";
+        }
+    }
+
+    out_declarations += head.str();
+    out_body         += body.str();
+}
+
+void
+ColorFilterChainCompiler::install(const ColorFilterChain& chain,
+                                  osg::StateSet*          stateSet)
+{
+    for( ColorFilterChain::const_iterator i = chain.begin(); i != chain.end(); ++i )
+    {
+        const ColorFilter* filter = i->get();
+        ColorFilter::InlineCode code;
+        if ( filter->getInlineCode(code) )
+            filter->installInline( stateSet );
+        else
+            filter->install( stateSet );
+    }
+}
+
+//------------------------------------------------------------------------
+
 ColorFilterRegistry*
 ColorFilterRegistry::instance()
 {
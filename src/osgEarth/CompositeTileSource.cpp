@@ -22,7 +22,11 @@
 #include <osgEarth/Registry>
 #include <osgEarth/Progress>
 #include <osgEarth/HeightFieldUtils>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
 #include <osgDB/FileNameUtils>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Condition>
 
 #define LC "[CompositeTileSource] "
 
@@ -128,6 +132,178 @@ namespace
 
     // some helper types.    
     typedef std::vector<ImageInfo> ImageMixVector;   
+
+    Threading::Mutex          s_fetchServiceMutex;
+    osg::ref_ptr<TaskService> s_fetchService;
+
+    TaskService* getFetchService()
+    {
+        Threading::ScopedMutexLock lock( s_fetchServiceMutex );
+        if ( !s_fetchService.valid() )
+        {
+            s_fetchService = new TaskService( "CompositeTileSource", 4 );
+            Registry::instance()->registerTaskService( s_fetchService.get() );
+        }
+        return s_fetchService.get();
+    }
+
+    /**
+     * Fetches the images of several components concurrently: either the image
+     * for the key itself, or (for the fallback pass) the nearest ancestor's,
+     * cropped to the key. As with the ImageLayer mosaic fetch, the caller and
+     * the pool tasks pull from the same work index, so the caller never waits
+     * on a task that's still queued.
+     */
+    struct ComponentFetch : public osg::Referenced
+    {
+        ComponentFetch(const ImageLayerVector&      layers,
+                       const TileKey&               key,
+                       const std::vector<unsigned>& indices,
+                       ImageMixVector&              images,
+                       bool                         fallback,
+                       const osg::Vec2s&            textureSize,
+                       ProgressCallback*            progress) :
+            _layers     ( layers ),
+            _key        ( key ),
+            _indices    ( indices ),
+            _images     ( images ),
+            _fallback   ( fallback ),
+            _textureSize( textureSize ),
+            _progress   ( progress ),
+            _next       ( 0 ),
+            _numDone    ( 0 ) { }
+
+        // fetches the next unclaimed component; false if none are left.
+        bool runOne()
+        {
+            unsigned n = (++_next) - 1;
+            if ( n >= _indices.size() )
+                return false;
+
+            if ( !_progress || !_progress->isCanceled() )
+            {
+                unsigned i = _indices[n];
+                if ( _fallback )
+                    fetchFallback( _layers[i].get(), _images[i] );
+                else
+                    fetch( _layers[i].get(), _images[i] );
+            }
+
+            if ( (unsigned)(++_numDone) == _indices.size() )
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                _cond.broadcast();
+            }
+            return true;
+        }
+
+        void fetch(ImageLayer* layer, ImageInfo& info)
+        {
+            GeoImage image = layer->createImage( _key, _progress );
+            if ( image.valid() )
+                info.image = image.getImage();
+        }
+
+        void fetchFallback(ImageLayer* layer, ImageInfo& info)
+        {
+            GeoImage image;
+            for( TileKey parentKey = _key.createParentKey(); !image.valid() && parentKey.valid(); parentKey = parentKey.createParentKey() )
+            {
+                image = layer->createImage( parentKey, _progress );
+            }
+
+            if ( image.valid() )
+            {
+                // TODO:  Bilinear options?
+                bool bilinear = layer->isCoverage() ? false : true;
+                GeoImage cropped = image.crop( _key.getExtent(), true, _textureSize.x(), _textureSize.y(), bilinear );
+                info.image = cropped.getImage();
+            }
+        }
+
+        void waitForAll()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            while ( (unsigned)_numDone < _indices.size() )
+                _cond.wait( &_mutex );
+        }
+
+        struct Task : public TaskRequest
+        {
+            Task(ComponentFetch* fetch) : _fetch(fetch) { }
+
+            void operator()( ProgressCallback* progress )
+            {
+                while( _fetch->runOne() );
+            }
+
+            osg::ref_ptr<ComponentFetch> _fetch;
+        };
+
+        // the layers and images are only touched while the caller waits.
+        const ImageLayerVector& _layers;
+        TileKey                 _key;
+        std::vector<unsigned>   _indices;
+        ImageMixVector&         _images;
+        bool                    _fallback;
+        osg::Vec2s              _textureSize;
+        ProgressCallback*       _progress;
+        OpenThreads::Atomic     _next;
+        OpenThreads::Atomic     _numDone;
+        Threading::Mutex        _mutex;
+        OpenThreads::Condition  _cond;
+    };
+
+    // Fetches the images for the listed components, in parallel when there
+    // is more than one.
+    void fetchComponents(const ImageLayerVector&      layers,
+                         const TileKey&               key,
+                         const std::vector<unsigned>& indices,
+                         ImageMixVector&              images,
+                         bool                         fallback,
+                         const osg::Vec2s&            textureSize,
+                         ProgressCallback*            progress)
+    {
+        if ( indices.empty() )
+            return;
+
+        osg::ref_ptr<ComponentFetch> fetch = new ComponentFetch(
+            layers, key, indices, images, fallback, textureSize, progress );
+
+        if ( indices.size() > 1 )
+        {
+            TaskService* service = getFetchService();
+            for( unsigned i=1; i<indices.size(); ++i )
+                service->add( new ComponentFetch::Task(fetch.get()) );
+        }
+
+        while( fetch->runOne() );
+        fetch->waitForAll();
+    }
+
+    // Whether an image completely hides whatever is beneath it.
+    bool isOpaque(const osg::Image* image)
+    {
+        if ( !ImageUtils::hasAlphaChannel(image) )
+            return true;
+
+        if ( image->getPixelFormat() != GL_RGBA || image->getDataType() != GL_UNSIGNED_BYTE )
+            return false;
+
+        for( int r=0; r<image->r(); ++r )
+        {
+            for( int t=0; t<image->t(); ++t )
+            {
+                const unsigned char* p = image->data(0, t, r) + 3;
+                for( int s=0; s<image->s(); ++s, p += 4 )
+                {
+                    if ( *p != 255 )
+                        return false;
+                }
+            }
+        }
+        return true;
+    }
 }
 
 //-----------------------------------------------------------------------
@@ -148,26 +324,38 @@ CompositeTileSource::createImage(const TileKey&    key,
     ImageMixVector images;
     images.reserve(_imageLayers.size());
 
-    // Try to get an image from each of the layers for the given key.
+    // Rule out the layers that can't contribute before fetching anything. A
+    // layer out of LOD range, or without data for this very key, may still
+    // supply a fallback image from an ancestor below.
+    std::vector<unsigned> fetchIndices;
     for (ImageLayerVector::const_iterator itr = _imageLayers.begin(); itr != _imageLayers.end(); ++itr)
     {
         ImageLayer* layer = itr->get();
+        TileSource* source = layer->getTileSource();
         ImageInfo imageInfo;
-        imageInfo.dataInExtents = layer->getTileSource()->hasDataInExtent( key.getExtent() );
+        imageInfo.dataInExtents = source ? source->hasDataInExtent( key.getExtent() ) : true;
         imageInfo.opacity = layer->getOpacity();
 
-        if (imageInfo.dataInExtents)
+        if (imageInfo.dataInExtents && layer->isKeyInRange(key))
         {
-            GeoImage image = layer->createImage(key, progress);
-            if (image.valid())
+            bool hasData =
+                !source ||
+                !layer->getProfile() ||
+                !key.getProfile()->isHorizEquivalentTo( layer->getProfile() ) ||
+                source->hasData( key );
+
+            if ( hasData )
             {
-                imageInfo.image = image.getImage();
+                fetchIndices.push_back( images.size() );
             }
         }
 
         images.push_back(imageInfo);
     }
 
+    // Try to get an image from each of those layers for the given key, concurrently.
+    fetchComponents( _imageLayers, key, fetchIndices, images, false, osg::Vec2s(), progress );
+
     // Determine the output texture size to use based on the image that were creatd.
     unsigned numValidImages = 0;
     osg::Vec2s textureSize;
@@ -187,34 +375,17 @@ CompositeTileSource::createImage(const TileKey&    key,
     // Create fallback images if we have some valid data but not for all the layers
     if (numValidImages > 0 && numValidImages < images.size())
     {
+        std::vector<unsigned> fallbackIndices;
         for (unsigned int i = 0; i < images.size(); i++)
         {
             ImageInfo& info = images[i];
-            ImageLayer* layer = _imageLayers[i].get();
             if (!info.image.valid() && info.dataInExtents)
-            {                      
-                TileKey parentKey = key.createParentKey();
-
-                GeoImage image;
-                while (!image.valid() && parentKey.valid())
-                {
-                    image = layer->createImage(parentKey, progress);
-                    if (image.valid())
-                    {
-                        break;
-                    }
-                    parentKey = parentKey.createParentKey();
-                }
-
-                if (image.valid())
-                {                                        
-                    // TODO:  Bilinear options?
-                    bool bilinear = layer->isCoverage() ? false : true;
-                    GeoImage cropped = image.crop( key.getExtent(), true, textureSize.x(), textureSize.y(), bilinear);
-                    info.image = cropped.getImage();
-                }                    
+            {
+                fallbackIndices.push_back( i );
             }
         }
+
+        fetchComponents( _imageLayers, key, fallbackIndices, images, true, textureSize, progress );
     }
 
     // Now finally create the output image.
@@ -247,8 +418,32 @@ CompositeTileSource::createImage(const TileKey&    key,
     }
     else
     {
+        // Everything beneath the topmost fully opaque image is hidden, so the
+        // blend starts there.
+        unsigned first = 0;
+        for (unsigned int i = images.size(); i > 0; --i)
+        {
+            ImageInfo& info = images[i-1];
+            if (info.image.valid() && info.opacity >= 1.0f && isOpaque(info.image.get()))
+            {
+                first = i-1;
+                break;
+            }
+        }
+
+        unsigned numAbove = 0;
+        for (unsigned int i = first+1; i < images.size(); i++)
+        {
+            if (images[i].image.valid()) numAbove++;
+        }
+
+        if ( numAbove == 0 && images[first].image.valid() )
+        {
+            return images[first].image.release();
+        }
+
         osg::Image* result = 0;
-        for (unsigned int i = 0; i < images.size(); i++)
+        for (unsigned int i = first; i < images.size(); i++)
         {
             ImageInfo& imageInfo = images[i];
             if (!result)
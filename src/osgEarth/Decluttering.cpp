@@ -17,6 +17,9 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include <osgEarth/Decluttering>
+#include <osgEarth/FrameStats>
+#include <osgEarth/Registry>
+#include <osgEarth/TaskService>
 #include <osgEarth/ThreadingUtils>
 #include <osgEarth/Utils>
 #include <osgEarth/VirtualProgram>
@@ -77,14 +80,229 @@ namespace
     // TODO: a way to clear out this list when drawables go away
     struct DrawableInfo
     {
-        DrawableInfo() : _lastAlpha(1.0), _lastScale(1.0) { }
+        DrawableInfo() : _lastAlpha(1.0), _lastScale(1.0), _visible(false) { }
         float _lastAlpha, _lastScale;
+        bool  _visible;   // passed the declutter test in the previous pass
     };
 
     typedef std::map<const osg::Drawable*, DrawableInfo> DrawableMemory;
     
     typedef std::pair<const osg::Node*, osg::BoundingBox> RenderLeafBox;
 
+    // Size (pixels) of a cell in the screen-space occupancy grid.
+    static const double s_cellSize = 64.0;
+
+    // One cell of the occupancy grid: indices of the occupied boxes that
+    // overlap it. The stamp lets us reset the grid without touching every cell.
+    struct GridCell
+    {
+        GridCell() : _stamp(0u) { }
+        unsigned              _stamp;
+        std::vector<unsigned> _boxes;
+    };
+
+    // Maps a window coordinate to a grid row or column, clamping to the grid
+    // so that off-screen boxes still land in (and are tested against) edge cells.
+    inline int toCell(double v, int n)
+    {
+        if ( !(v >= 0.0) )
+            return 0;
+        if ( v >= s_cellSize*(double)n )
+            return n-1;
+        return (int)(v/s_cellSize);
+    }
+
+    // Uniform screen-space grid over the boxes occupied so far, so that an
+    // occupancy test only visits the boxes sharing a cell with the candidate.
+    class OccupancyGrid
+    {
+    public:
+        OccupancyGrid() : _x(0.0), _y(0.0), _cols(0), _rows(0), _stamp(0u) { }
+
+        // empties the grid and sizes it to a viewport.
+        void reset(double x, double y, double width, double height)
+        {
+            int cols = std::max( 1, (int)ceil(width /s_cellSize) );
+            int rows = std::max( 1, (int)ceil(height/s_cellSize) );
+            if ( cols != _cols || rows != _rows )
+            {
+                _cells.assign( cols*rows, GridCell() );
+                _cols  = cols;
+                _rows  = rows;
+                _stamp = 0u;
+            }
+            ++_stamp;
+            _x = x;
+            _y = y;
+            _used.clear();
+        }
+
+        // whether the box overlaps no occupied box (boxes from the same drawable
+        // parent do not conflict).
+        bool isClear(const osg::BoundingBox& box, const osg::Node* parent) const
+        {
+            int c0, c1, r0, r1;
+            range( box, c0, c1, r0, r1 );
+
+            for( int r = r0; r <= r1; ++r )
+            {
+                for( int c = c0; c <= c1; ++c )
+                {
+                    const GridCell& cell = _cells[r*_cols + c];
+                    if ( cell._stamp != _stamp )
+                        continue;
+
+                    for( std::vector<unsigned>::const_iterator k = cell._boxes.begin(); k != cell._boxes.end(); ++k )
+                    {
+                        const RenderLeafBox& used = _used[*k];
+
+                        // only need a 2D test since we're in clip space
+                        bool isClear =
+                            box.xMin() > used.second.xMax() ||
+                            box.xMax() < used.second.xMin() ||
+                            box.yMin() > used.second.yMax() ||
+                            box.yMax() < used.second.yMin();
+
+                        if ( !isClear && parent != used.first )
+                            return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // marks the box as occupied.
+        void insert(const osg::BoundingBox& box, const osg::Node* parent)
+        {
+            unsigned index = _used.size();
+            _used.push_back( std::make_pair(parent, box) );
+
+            int c0, c1, r0, r1;
+            range( box, c0, c1, r0, r1 );
+
+            for( int r = r0; r <= r1; ++r )
+            {
+                for( int c = c0; c <= c1; ++c )
+                {
+                    GridCell& cell = _cells[r*_cols + c];
+                    if ( cell._stamp != _stamp )
+                    {
+                        cell._stamp = _stamp;
+                        cell._boxes.clear();
+                    }
+                    cell._boxes.push_back( index );
+                }
+            }
+        }
+
+    private:
+        void range(const osg::BoundingBox& box, int& c0, int& c1, int& r0, int& r1) const
+        {
+            c0 = toCell( box.xMin() - _x, _cols );
+            c1 = toCell( box.xMax() - _x, _cols );
+            r0 = toCell( box.yMin() - _y, _rows );
+            r1 = toCell( box.yMax() - _y, _rows );
+        }
+
+        std::vector<GridCell>      _cells;
+        std::vector<RenderLeafBox> _used;
+        double                     _x, _y;
+        int                        _cols, _rows;
+        unsigned                   _stamp;
+    };
+
+    typedef std::set<const osg::Node*> NodeSet;
+
+    // Declutter state exchanged between the cull thread and the async worker.
+    struct AsyncDeclutter : public osg::Referenced
+    {
+        AsyncDeclutter() : _busy(false), _ready(false), _hasResult(false) { }
+
+        Threading::Mutex _mutex;
+        bool             _busy;      // a job is in flight
+        bool             _ready;     // _next holds a result not yet picked up
+        NodeSet          _next;      // result from the worker (guarded by _mutex)
+
+        // cull-thread only:
+        bool             _hasResult;
+        NodeSet          _visible;   // drawable parents that passed, as of the last result
+    };
+
+    // Computes the set of visible drawable parents from a list of candidate
+    // boxes (in priority order) on a worker thread.
+    struct DeclutterJob : public TaskRequest
+    {
+        osg::ref_ptr<AsyncDeclutter> _async;
+        std::vector<RenderLeafBox>   _candidates;
+        double                       _x, _y, _width, _height;
+        unsigned                     _limit;
+
+        void operator()(ProgressCallback* progress)
+        {
+            OccupancyGrid grid;
+            grid.reset( _x, _y, _width, _height );
+
+            NodeSet culled;
+            std::vector<const osg::Node*> passed;
+
+            for( std::vector<RenderLeafBox>::const_iterator i = _candidates.begin();
+                 i != _candidates.end() && passed.size() < _limit;
+                 ++i )
+            {
+                if ( culled.find(i->first) != culled.end() )
+                    continue;
+
+                if ( grid.isClear(i->second, i->first) )
+                {
+                    grid.insert( i->second, i->first );
+                    passed.push_back( i->first );
+                }
+                else
+                {
+                    culled.insert( i->first );
+                }
+            }
+
+            NodeSet visible;
+            for( std::vector<const osg::Node*>::const_iterator i = passed.begin(); i != passed.end(); ++i )
+            {
+                if ( culled.find(*i) == culled.end() )
+                    visible.insert( *i );
+            }
+
+            Threading::ScopedMutexLock lock( _async->_mutex );
+            _async->_next.swap( visible );
+            _async->_ready = true;
+            _async->_busy  = false;
+        }
+    };
+
+    Threading::Mutex          s_declutterServiceMutex;
+    osg::ref_ptr<TaskService> s_declutterService;
+
+    TaskService* getDeclutterService()
+    {
+        Threading::ScopedMutexLock lock( s_declutterServiceMutex );
+        if ( !s_declutterService.valid() )
+        {
+            s_declutterService = new TaskService( "Declutter", 1 );
+            Registry::instance()->registerTaskService( s_declutterService.get() );
+        }
+        return s_declutterService.get();
+    }
+
+    // Predicate for partitioning leaves visible on the previous pass to the front.
+    struct WasVisible
+    {
+        WasVisible(const DrawableMemory& memory) : _memory(memory) { }
+        const DrawableMemory& _memory;
+        bool operator()(const osgUtil::RenderLeaf* leaf) const
+        {
+            DrawableMemory::const_iterator i = _memory.find( leaf->getDrawable() );
+            return i != _memory.end() && i->second._visible;
+        }
+    };
+
     // Data structure stored one-per-View.
     struct PerCamInfo
     {
@@ -96,7 +314,10 @@ namespace
         // re-usable structures (to avoid unnecessary re-allocation)
         osgUtil::RenderBin::RenderLeafList _passed;
         osgUtil::RenderBin::RenderLeafList _failed;
-        std::vector<RenderLeafBox>         _used;
+        OccupancyGrid                      _grid;
+
+        // state shared with the async declutter worker
+        osg::ref_ptr<AsyncDeclutter>       _async;
 
         // time stamp of the previous pass, for calculating animation speed
         //double _lastTimeStamp;
@@ -126,6 +347,8 @@ DeclutteringOptions::fromConfig( const Config& conf )
     conf.getIfSet( "out_animation_time",  _outAnimTime );
     conf.getIfSet( "sort_by_priority",    _sortByPriority );
     conf.getIfSet( "max_objects",         _maxObjects );
+    conf.getIfSet( "temporal_coherence",  _temporalCoherence );
+    conf.getIfSet( "async",               _asynchronous );
 }
 
 Config
@@ -138,6 +361,8 @@ DeclutteringOptions::getConfig() const
     conf.addIfSet( "out_animation_time",  _outAnimTime );
     conf.addIfSet( "sort_by_priority",    _sortByPriority );
     conf.addIfSet( "max_objects",         _maxObjects );
+    conf.addIfSet( "temporal_coherence",  _temporalCoherence );
+    conf.addIfSet( "async",               _asynchronous );
     return conf;
 }
 
@@ -206,6 +431,14 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
         osg::Camera* cam   = bin->getStage()->getCamera();                
         PerCamInfo& local = _perCam.get( cam );
 
+        const DeclutteringOptions& options = _context->_options;
+
+        // give objects that were visible last time first claim on screen space.
+        if ( s_enabledGlobally && options.temporalCoherence() == true )
+        {
+            std::stable_partition( leaves.begin(), leaves.end(), WasVisible(local._memory) );
+        }
+
         osg::Timer_t now = osg::Timer::instance()->tick();
         if (local._firstFrame)
         {            
@@ -221,24 +454,70 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
         // Reset the local re-usable containers
         local._passed.clear();          // drawables that pass occlusion test
         local._failed.clear();          // drawables that fail occlusion test
-        local._used.clear();            // list of occupied bounding boxes in screen space
 
         // compute a window matrix so we can do window-space culling:
         const osg::Viewport* vp = cam->getViewport();
         osg::Matrix windowMatrix = vp->computeWindowMatrix();
 
+        // occupied bounding boxes in screen space
+        local._grid.reset( vp->x(), vp->y(), vp->width(), vp->height() );
+
+        // In async mode, visibility comes from the result the worker computed from
+        // an earlier frame's boxes, and this frame's boxes go out in a new job.
+        // Until the first result arrives we declutter synchronously.
+        osg::ref_ptr<DeclutterJob> job;
+        bool useAsyncResult = false;
+        if ( s_enabledGlobally && options.asynchronous() == true )
+        {
+            if ( !local._async.valid() )
+                local._async = new AsyncDeclutter();
+
+            AsyncDeclutter& async = *local._async.get();
+            {
+                Threading::ScopedMutexLock lock( async._mutex );
+                if ( async._ready )
+                {
+                    async._visible.swap( async._next );
+                    async._ready     = false;
+                    async._hasResult = true;
+                }
+                if ( !async._busy )
+                {
+                    job = new DeclutterJob();
+                    async._busy = true;
+                }
+            }
+
+            useAsyncResult = async._hasResult;
+
+            if ( job.valid() )
+            {
+                job->_async  = local._async.get();
+                job->_x      = vp->x();
+                job->_y      = vp->y();
+                job->_width  = vp->width();
+                job->_height = vp->height();
+                job->_limit  = *options.maxObjects();
+                job->_candidates.reserve( leaves.size() );
+            }
+        }
+        else if ( local._async.valid() )
+        {
+            local._async = 0L;
+        }
+
         // Track the parent nodes of drawables that are obscured (and culled). Drawables
         // with the same parent node (typically a Geode) are considered to be grouped and
         // will be culled as a group.
         std::set<const osg::Node*> culledParents;
 
-        const DeclutteringOptions& options = _context->_options;
         unsigned limit = *options.maxObjects();
 
         // Go through each leaf and test for visibility.
-        // Enforce the "max objects" limit along the way.
+        // Enforce the "max objects" limit along the way. (A pending async job still
+        // wants every candidate box, so in that case keep going past the limit.)
         for(osgUtil::RenderBin::RenderLeafList::iterator i = leaves.begin(); 
-            i != leaves.end() && local._passed.size() < limit; 
+            i != leaves.end() && (local._passed.size() < limit || job.valid()); 
             ++i )
         {
             bool visible = true;
@@ -263,6 +542,15 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
                 winPos.y() + box.yMax(),
                 winPos.z() );
 
+            if ( job.valid() )
+            {
+                job->_candidates.push_back( std::make_pair(drawableParent, box) );
+
+                // past the limit, we're only here to collect boxes for the job.
+                if ( local._passed.size() >= limit )
+                    continue;
+            }
+
             // if this leaf is already in a culled group, skip it.
             if ( s_enabledGlobally )
             {
@@ -270,28 +558,16 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
                 {
                     visible = false;
                 }
+                else if ( useAsyncResult )
+                {
+                    // precomputed by the worker:
+                    visible = local._async->_visible.find(drawableParent) != local._async->_visible.end();
+                }
                 else
                 {
                     // weed out any drawables that are obscured by closer drawables.
-                    // TODO: think about a more efficient algorithm - right now we are just using
-                    // brute force to compare all bbox's
-                    for( std::vector<RenderLeafBox>::const_iterator j = local._used.begin(); j != local._used.end(); ++j )
-                    {
-                        // only need a 2D test since we're in clip space
-                        bool isClear =
-                            box.xMin() > j->second.xMax() ||
-                            box.xMax() < j->second.xMin() ||
-                            box.yMin() > j->second.yMax() ||
-                            box.yMax() < j->second.yMin();
-
-                        // if there's an overlap (and the conflict isn't from the same drawable
-                        // parent, which is acceptable), then the leaf is culled.
-                        if ( !isClear && drawableParent != j->first )
-                        {
-                            visible = false;
-                            break;
-                        }
-                    }
+                    // (the conflict is acceptable if it comes from the same drawable parent.)
+                    visible = local._grid.isClear( box, drawableParent );
                 }
             }
 
@@ -299,7 +575,9 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
             {
                 // passed the test, so add the leaf's bbox to the "used" list, and add the leaf
                 // to the final draw list.
-                local._used.push_back( std::make_pair(drawableParent, box) );
+                if ( !useAsyncResult )
+                    local._grid.insert( box, drawableParent );
+
                 local._passed.push_back( leaf );
             }
 
@@ -323,6 +601,12 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
             leaf->_modelview = new osg::RefMatrix( newModelView );
         }
 
+        // hand this frame's boxes to the worker; the result applies to a later frame.
+        if ( job.valid() )
+        {
+            getDeclutterService()->add( job.get() );
+        }
+
         // copy the final draw list back into the bin, rejecting any leaves whose parents
         // are in the cull list.
 
@@ -337,6 +621,7 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
                 if ( culledParents.find( drawable->getParent(0) ) == culledParents.end() )
                 {
                     DrawableInfo& info = local._memory[drawable];
+                    info._visible = true;
 
                     bool fullyIn = true;
 
@@ -378,6 +663,7 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
                 const osg::Drawable* drawable = leaf->getDrawable();
 
                 DrawableInfo& info = local._memory[drawable];
+                info._visible = false;
 
                 bool isText = dynamic_cast<const osgText::Text*>(drawable) != 0L;
                 bool fullyOut = true;
@@ -445,6 +731,8 @@ struct DeclutterDraw : public osgUtil::RenderBin::DrawCallback
      */
     void drawImplementation( osgUtil::RenderBin* bin, osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& previous )
     {
+        FrameStats::beginGPU( FrameStats::GPU_DECLUTTER, renderInfo );
+
         osg::State& state = *renderInfo.getState();
 
         unsigned int numToPop = (previous ? osgUtil::StateGraph::numToPop(previous->_parent) : 0);
@@ -490,6 +778,8 @@ struct DeclutterDraw : public osgUtil::RenderBin::DrawCallback
         {
             state.removeStateSet(insertStateSetPosition);
         }
+
+        FrameStats::endGPU( FrameStats::GPU_DECLUTTER, renderInfo );
     }
 
     /**
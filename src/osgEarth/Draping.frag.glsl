@@ -5,10 +5,27 @@ $GLSL_DEFAULT_PRECISION_FLOAT
 #pragma vp_location   "fragment_coloring"
 
 uniform sampler2D oe_overlay_tex;
+uniform sampler2D oe_overlay_near_tex;
+uniform int       oe_overlay_cascades;
 varying vec4      oe_overlay_texcoord;
+varying vec4      oe_overlay_near_texcoord;
 
 void oe_overlay_fragment( inout vec4 color )
 {
-    vec4 texel = texture2DProj(oe_overlay_tex, oe_overlay_texcoord);
+    vec4 texel;
+
+    // prefer the high-resolution near cascade wherever it has coverage.
+    vec2 nearCoord = oe_overlay_near_texcoord.xy / oe_overlay_near_texcoord.w;
+    if ( oe_overlay_cascades > 1 &&
+         all(greaterThanEqual(nearCoord, vec2(0.0))) &&
+         all(lessThanEqual(nearCoord, vec2(1.0))) )
+    {
+        texel = texture2D(oe_overlay_near_tex, nearCoord);
+    }
+    else
+    {
+        texel = texture2DProj(oe_overlay_tex, oe_overlay_texcoord);
+    }
+
     color = vec4( mix( color.rgb, texel.rgb, texel.a ), color.a);
-}
\ No newline at end of file
+}
@@ -5,9 +5,14 @@ $GLSL_DEFAULT_PRECISION_FLOAT
 #pragma vp_location   "vertex_view"
 
 uniform mat4 oe_overlay_texmatrix;
+uniform mat4 oe_overlay_near_texmatrix;
+uniform int  oe_overlay_cascades;
 varying vec4 oe_overlay_texcoord;
+varying vec4 oe_overlay_near_texcoord;
 
 void oe_overlay_vertex(inout vec4 vertexVIEW)
 {
     oe_overlay_texcoord = oe_overlay_texmatrix * vertexVIEW;
-}
\ No newline at end of file
+    if ( oe_overlay_cascades > 1 )
+        oe_overlay_near_texcoord = oe_overlay_near_texmatrix * vertexVIEW;
+}
@@ -18,6 +18,7 @@
 */
 #include <osgEarth/DrapingTechnique>
 #include <osgEarth/Capabilities>
+#include <osgEarth/FrameStats>
 #include <osgEarth/Registry>
 #include <osgEarth/VirtualProgram>
 #include <osgEarth/Shaders>
@@ -38,11 +39,136 @@ using namespace osgEarth;
 
 namespace
 {
+    // One RTT camera/texture pair, along with the state it last rendered with
+    // so we can tell whether it needs to render again.
+    struct Cascade
+    {
+        osg::ref_ptr<osg::Camera>  _camera;
+        osg::ref_ptr<osg::Uniform> _texGenUniform;
+        osg::Matrixd               _viewMatrix;
+        osg::Matrixd               _projMatrix;
+        osg::BoundingSphere        _bound;
+        unsigned                   _numChildren;
+        int                        _revision;
+        bool                       _rendered;
+
+        Cascade() : _numChildren(0), _revision(0), _rendered(false) { }
+    };
+
     // Additional per-view data stored by the draping technique.
     struct LocalPerViewData : public osg::Referenced
     {
-        osg::ref_ptr<osg::Uniform> _texGenUniform;
+        Cascade _far;
+        Cascade _near;
     };
+
+    bool sameMatrix(const osg::Matrixd& a, const osg::Matrixd& b)
+    {
+        const double* pa = a.ptr();
+        const double* pb = b.ptr();
+        for(unsigned i=0; i<16; ++i)
+        {
+            double mag = osg::maximum(1.0, osg::maximum(fabs(pa[i]), fabs(pb[i])));
+            if ( !osg::equivalent(pa[i], pb[i], 1e-9*mag) )
+                return false;
+        }
+        return true;
+    }
+
+    // Whether a cascade's texture is stale with respect to the new RTT matrices
+    // and the current contents of the overlay group.
+    bool needsRender(const Cascade&       c,
+                     const osg::Matrixd&  viewMatrix,
+                     const osg::Matrixd&  projMatrix,
+                     osg::Group*          group,
+                     int                  revision)
+    {
+        if ( !c._rendered )
+            return true;
+
+        if ( c._revision != revision || c._numChildren != group->getNumChildren() )
+            return true;
+
+        const osg::BoundingSphere& bs = group->getBound();
+        if ( bs.center() != c._bound.center() || bs.radius() != c._bound.radius() )
+            return true;
+
+        return !sameMatrix(viewMatrix, c._viewMatrix) || !sameMatrix(projMatrix, c._projMatrix);
+    }
+
+    // Calculates a projection matrix for the near cascade: an orthographic
+    // sub-rectangle of the far cascade's extent, centered (as far as possible)
+    // under the eyepoint.
+    bool computeNearProjection(const OverlayDecorator::TechRTTParams& params,
+                               double                                 extent,
+                               osg::Matrixd&                          out)
+    {
+        double l, r, b, t, n, f;
+        if ( !params._rttProjMatrix.getOrtho(l, r, b, t, n, f) )
+            return false;
+
+        double hx = 0.5*(r-l)*extent;
+        double hy = 0.5*(t-b)*extent;
+
+        osg::Vec3d eye = params._eyeWorld * params._rttViewMatrix;
+        double cx = osg::clampBetween(eye.x(), l+hx, r-hx);
+        double cy = osg::clampBetween(eye.y(), b+hy, t-hy);
+
+        out.makeOrtho(cx-hx, cx+hx, cy-hy, cy+hy, n, f);
+        return true;
+    }
+
+    // Renders a cascade if necessary and updates its texture projection.
+    void cullCascade(Cascade&              cascade,
+                     const osg::Matrixd&   viewMatrix,
+                     const osg::Matrixd&   projMatrix,
+                     osg::Group*           group,
+                     const osg::Matrixd&   inverseViewMatrix,
+                     bool                  dirtyTracking,
+                     int                   revision,
+                     osgUtil::CullVisitor* cv )
+    {
+        // this xforms from clip [-1..1] to texture [0..1] space
+        static osg::Matrix s_scaleBiasMat = 
+            osg::Matrix::translate(1.0,1.0,1.0) * 
+            osg::Matrix::scale(0.5,0.5,0.5);
+
+        // with dirty tracking on, a cascade whose coverage and content have not
+        // changed keeps the texture it rendered on an earlier frame.
+        if ( !dirtyTracking || needsRender(cascade, viewMatrix, projMatrix, group, revision) )
+        {
+            cascade._camera->setViewMatrix      ( viewMatrix );
+            cascade._camera->setProjectionMatrix( projMatrix );
+
+            cascade._viewMatrix  = viewMatrix;
+            cascade._projMatrix  = projMatrix;
+            cascade._bound       = group->getBound();
+            cascade._numChildren = group->getNumChildren();
+            cascade._revision    = revision;
+            cascade._rendered    = true;
+
+            // traverse the overlay group (via the RTT camera).
+            cascade._camera->accept( *cv );
+        }
+
+        if ( cascade._texGenUniform.valid() )
+        {
+            // always project with the matrices the texture was actually rendered with.
+            osg::Matrix VPT = cascade._viewMatrix * cascade._projMatrix * s_scaleBiasMat;
+
+            // premultiply the inv view matrix so we don't have precision problems in the shader 
+            // (and it's faster too)
+
+            // TODO:
+            // This only works properly if the terrain tiles have a DYNAMIC data variance.
+            // That is because we are setting a Uniform value during the CULL traversal, and
+            // it's possible that the stateset from the previous frame has not yet been
+            // dispatched to render. So we need to come up with a way to address this.
+            // In the meantime, I patched the MP engine to set a DYNAMIC data variance on
+            // terrain tiles to work around the problem.
+            cascade._texGenUniform->set( inverseViewMatrix * VPT );
+        }
+    }
 }
 
 namespace
@@ -296,7 +422,10 @@ _textureSize     ( 1024 ),
 _mipmapping      ( false ),
 _rttBlending     ( true ),
 _attachStencil   ( false ),
-_maxFarNearRatio ( 5.0 )
+_maxFarNearRatio ( 5.0 ),
+_numCascades     ( 1 ),
+_nearCascadeExtent( 0.25f ),
+_dirtyTracking   ( false )
 {
     _supported = Registry::capabilities().supportsGLSL();
 
@@ -304,6 +433,13 @@ _maxFarNearRatio ( 5.0 )
     const char* nfr2 = ::getenv("OSGEARTH_OVERLAY_RESOLUTION_RATIO");
     if ( nfr2 )
         _maxFarNearRatio = as<double>(nfr2, 0.0);
+
+    const char* cascades = ::getenv("OSGEARTH_OVERLAY_CASCADES");
+    if ( cascades )
+        setNumCascades( as<unsigned>(cascades, 1u) );
+
+    if ( ::getenv("OSGEARTH_OVERLAY_DIRTY_TRACKING") )
+        _dirtyTracking = true;
 }
 
 
@@ -343,13 +479,28 @@ DrapingTechnique::reestablish(TerrainEngineNode* engine)
             }
         }
     }
+
+    // the near cascade needs its own texture image unit.
+    if ( _numCascades > 1 && !_nearTextureUnit.isSet() )
+    {
+        int texUnit;
+        if ( engine->getResources()->reserveTextureImageUnit(texUnit, "DrapingTechnique near cascade") )
+        {
+            _nearTextureUnit = texUnit;
+            OE_INFO << LC << "Reserved texture image unit " << *_nearTextureUnit << " for the near cascade" << std::endl;
+        }
+        else
+        {
+            OE_WARN << LC << "No texture image unit available for the near cascade; using a single cascade" << std::endl;
+            _numCascades = 1;
+        }
+    }
 }
 
 
-void
-DrapingTechnique::setUpCamera(OverlayDecorator::TechRTTParams& params)
+osg::Texture2D*
+DrapingTechnique::createCascadeTexture() const
 {
-    // create the projected texture:
     osg::Texture2D* projTexture = new osg::Texture2D();
     projTexture->setTextureSize( *_textureSize, *_textureSize );
     projTexture->setInternalFormat( GL_RGBA );
@@ -361,19 +512,26 @@ DrapingTechnique::setUpCamera(OverlayDecorator::TechRTTParams& params)
     projTexture->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_BORDER );
     //projTexture->setWrap( osg::Texture::WRAP_R, osg::Texture::CLAMP_TO_EDGE );
     projTexture->setBorderColor( osg::Vec4(0,0,0,0) );
+    return projTexture;
+}
 
-    // set up the RTT camera:
-    params._rttCamera = new osg::Camera();
-    params._rttCamera->setClearColor( osg::Vec4f(0,0,0,0) );
+
+osg::Camera*
+DrapingTechnique::createCascadeCamera(osg::Texture2D* projTexture) const
+{
+    osg::Camera* camera = new osg::Camera();
+    camera->setClearColor( osg::Vec4f(0,0,0,0) );
     // this ref frame causes the RTT to inherit its viewpoint from above (in order to properly
     // process PagedLOD's etc. -- it doesn't affect the perspective of the RTT camera though)
-    params._rttCamera->setReferenceFrame( osg::Camera::ABSOLUTE_RF_INHERIT_VIEWPOINT );
-    params._rttCamera->setViewport( 0, 0, *_textureSize, *_textureSize );
-    params._rttCamera->setComputeNearFarMode( osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR );
-    params._rttCamera->setRenderOrder( osg::Camera::PRE_RENDER );
-    params._rttCamera->setRenderTargetImplementation( osg::Camera::FRAME_BUFFER_OBJECT );
-    params._rttCamera->setImplicitBufferAttachmentMask(0, 0);
-    params._rttCamera->attach( osg::Camera::COLOR_BUFFER0, projTexture, 0, 0, _mipmapping );
+    camera->setReferenceFrame( osg::Camera::ABSOLUTE_RF_INHERIT_VIEWPOINT );
+    camera->setViewport( 0, 0, *_textureSize, *_textureSize );
+    camera->setComputeNearFarMode( osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR );
+    camera->setRenderOrder( osg::Camera::PRE_RENDER );
+    camera->setRenderTargetImplementation( osg::Camera::FRAME_BUFFER_OBJECT );
+    camera->setImplicitBufferAttachmentMask(0, 0);
+    camera->attach( osg::Camera::COLOR_BUFFER0, projTexture, 0, 0, _mipmapping );
+    camera->setInitialDrawCallback( new FrameStats::GPUTimerCallback(FrameStats::GPU_DRAPING, true) );
+    camera->setFinalDrawCallback  ( new FrameStats::GPUTimerCallback(FrameStats::GPU_DRAPING, false) );
 
     if ( _attachStencil )
     {
@@ -385,24 +543,35 @@ DrapingTechnique::setUpCamera(OverlayDecorator::TechRTTParams& params)
         if ( Registry::capabilities().supportsDepthPackedStencilBuffer() )
         {
 #ifdef OSG_GLES2_AVAILABLE 
-            params._rttCamera->attach( osg::Camera::PACKED_DEPTH_STENCIL_BUFFER, GL_DEPTH24_STENCIL8_EXT );
+            camera->attach( osg::Camera::PACKED_DEPTH_STENCIL_BUFFER, GL_DEPTH24_STENCIL8_EXT );
 #else
-            params._rttCamera->attach( osg::Camera::PACKED_DEPTH_STENCIL_BUFFER, GL_DEPTH_STENCIL_EXT );
+            camera->attach( osg::Camera::PACKED_DEPTH_STENCIL_BUFFER, GL_DEPTH_STENCIL_EXT );
 #endif
         }
         else
         {
-            params._rttCamera->attach( osg::Camera::STENCIL_BUFFER, GL_STENCIL_INDEX );
+            camera->attach( osg::Camera::STENCIL_BUFFER, GL_STENCIL_INDEX );
         }
 
-        params._rttCamera->setClearStencil( 0 );
-        params._rttCamera->setClearMask( GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT ); //GL_DEPTH_BUFFER_BIT |  );
+        camera->setClearStencil( 0 );
+        camera->setClearMask( GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT ); //GL_DEPTH_BUFFER_BIT |  );
     }
     else
     {
-        params._rttCamera->setClearMask( GL_COLOR_BUFFER_BIT ); //| GL_DEPTH_BUFFER_BIT );
+        camera->setClearMask( GL_COLOR_BUFFER_BIT ); //| GL_DEPTH_BUFFER_BIT );
     }
 
+    return camera;
+}
+
+
+void
+DrapingTechnique::setUpCamera(OverlayDecorator::TechRTTParams& params)
+{
+    // create the projected texture and the (far cascade) RTT camera:
+    osg::Texture2D* projTexture = createCascadeTexture();
+    params._rttCamera = createCascadeCamera( projTexture );
+
     // set up a StateSet for the RTT camera.
     osg::StateSet* rttStateSet = params._rttCamera->getOrCreateStateSet();
 
@@ -455,6 +624,7 @@ DrapingTechnique::setUpCamera(OverlayDecorator::TechRTTParams& params)
     // fire up the local per-view data:
     LocalPerViewData* local = new LocalPerViewData();
     params._techniqueData = local;
+    local->_far._camera = params._rttCamera.get();
     
 
     // Assemble the terrain shaders that will apply projective texturing.
@@ -466,9 +636,33 @@ DrapingTechnique::setUpCamera(OverlayDecorator::TechRTTParams& params)
         "oe_overlay_tex", osg::Uniform::SAMPLER_2D )->set( *_textureUnit );
 
     // the texture projection matrix uniform.
-    local->_texGenUniform = params._terrainStateSet->getOrCreateUniform(
+    local->_far._texGenUniform = params._terrainStateSet->getOrCreateUniform(
         "oe_overlay_texmatrix", osg::Uniform::FLOAT_MAT4 );
 
+    // the near cascade renders the same overlay group, with the same state,
+    // into its own texture covering only the area around the eyepoint.
+    int numCascades = 1;
+    if ( _numCascades > 1 && _nearTextureUnit.isSet() )
+    {
+        osg::Texture2D* nearTexture = createCascadeTexture();
+        local->_near._camera = createCascadeCamera( nearTexture );
+        local->_near._camera->setStateSet( rttStateSet );
+        local->_near._camera->addChild( params._group );
+
+        params._terrainStateSet->setTextureAttributeAndModes( *_nearTextureUnit, nearTexture, osg::StateAttribute::ON );
+
+        params._terrainStateSet->getOrCreateUniform(
+            "oe_overlay_near_tex", osg::Uniform::SAMPLER_2D )->set( *_nearTextureUnit );
+
+        local->_near._texGenUniform = params._terrainStateSet->getOrCreateUniform(
+            "oe_overlay_near_texmatrix", osg::Uniform::FLOAT_MAT4 );
+
+        numCascades = 2;
+    }
+
+    params._terrainStateSet->getOrCreateUniform(
+        "oe_overlay_cascades", osg::Uniform::INT )->set( numCascades );
+
     // shaders
     Shaders pkg;
     pkg.loadFunction( terrain_vp, pkg.DrapingVertex );
@@ -493,10 +687,14 @@ DrapingTechnique::cullOverlayGroup(OverlayDecorator::TechRTTParams& params,
 {
     if ( params._rttCamera.valid() )
     {
-        // this xforms from clip [-1..1] to texture [0..1] space
-        static osg::Matrix s_scaleBiasMat = 
-            osg::Matrix::translate(1.0,1.0,1.0) * 
-            osg::Matrix::scale(0.5,0.5,0.5);
+        LocalPerViewData& local = *static_cast<LocalPerViewData*>(params._techniqueData.get());
+
+        // the near cascade works from the un-warped ortho extent, so compute
+        // it before optimizing the far projection.
+        osg::Matrixd nearProjMatrix;
+        bool useNear =
+            local._near._camera.valid() &&
+            computeNearProjection( params, _nearCascadeExtent, nearProjMatrix );
 
         // resolution weighting based on camera distance.
         if ( _maxFarNearRatio > 1.0 )
@@ -504,34 +702,18 @@ DrapingTechnique::cullOverlayGroup(OverlayDecorator::TechRTTParams& params,
             optimizeProjectionMatrix( params, _maxFarNearRatio );
         }
 
-        params._rttCamera->setViewMatrix      ( params._rttViewMatrix );
-        params._rttCamera->setProjectionMatrix( params._rttProjMatrix );
+        // Note that we require the InverseViewMatrix, but it is OK to invert the ModelView matrix as the model matrix is identity here.
+        osg::Matrix vm;
+        vm.invert( *cv->getModelViewMatrix() );
 
-        osg::Matrix VPT = params._rttViewMatrix * params._rttProjMatrix * s_scaleBiasMat;
+        int revision = _revision;
 
-        LocalPerViewData& local = *static_cast<LocalPerViewData*>(params._techniqueData.get());
+        cullCascade( local._far, params._rttViewMatrix, params._rttProjMatrix, params._group, vm, _dirtyTracking, revision, cv );
 
-        if ( local._texGenUniform.valid() )
+        if ( useNear )
         {
-            // premultiply the inv view matrix so we don't have precision problems in the shader 
-            // (and it's faster too)
-
-            // TODO:
-            // This only works properly if the terrain tiles have a DYNAMIC data variance.
-            // That is because we are setting a Uniform value during the CULL traversal, and
-            // it's possible that the stateset from the previous frame has not yet been
-            // dispatched to render. So we need to come up with a way to address this.
-            // In the meantime, I patched the MP engine to set a DYNAMIC data variance on
-            // terrain tiles to work around the problem.
-            //
-            // Note that we require the InverseViewMatrix, but it is OK to invert the ModelView matrix as the model matrix is identity here.
-            osg::Matrix vm;
-            vm.invert( *cv->getModelViewMatrix() );
-            local._texGenUniform->set( vm * VPT );
+            cullCascade( local._near, params._rttViewMatrix, nearProjMatrix, params._group, vm, _dirtyTracking, revision, cv );
         }
-
-        // traverse the overlay group (via the RTT camera).
-        params._rttCamera->accept( *cv );
     }
 }
 
@@ -603,6 +785,34 @@ DrapingTechnique::getResolutionRatio() const
     return (float)_maxFarNearRatio;
 }
 
+void
+DrapingTechnique::setNumCascades(unsigned value)
+{
+    _numCascades = osg::clampBetween(value, 1u, 2u);
+}
+
+void
+DrapingTechnique::setNearCascadeExtent(float value)
+{
+    _nearCascadeExtent = osg::clampBetween(value, 0.01f, 1.0f);
+}
+
+void
+DrapingTechnique::setDirtyTracking(bool value)
+{
+    if ( value != _dirtyTracking )
+    {
+        _dirtyTracking = value;
+        OE_INFO << LC << "Overlay dirty tracking " << (value?"enabled":"disabled") << std::endl;
+    }
+}
+
+void
+DrapingTechnique::dirty()
+{
+    ++_revision;
+}
+
 void
 DrapingTechnique::onInstall( TerrainEngineNode* engine )
 {
@@ -622,4 +832,10 @@ DrapingTechnique::onUninstall( TerrainEngineNode* engine )
         engine->getResources()->releaseTextureImageUnit( *_textureUnit );
         _textureUnit.unset();
     }
+
+    if ( _nearTextureUnit.isSet() )
+    {
+        engine->getResources()->releaseTextureImageUnit( *_nearTextureUnit );
+        _nearTextureUnit.unset();
+    }
 }
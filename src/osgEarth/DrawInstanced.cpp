@@ -33,6 +33,10 @@
 #include <osg/LOD>
 #include <osgUtil/MeshOptimizers>
 
+#if OSG_MIN_VERSION_REQUIRED(3,2,0)
+#   include <osg/TextureBuffer>
+#endif
+
 #define LC "[DrawInstanced] "
 
 using namespace osgEarth;
@@ -120,6 +124,19 @@ namespace
 #endif // USE_INSTANCE_LODS
 
     typedef std::map< osg::ref_ptr<osg::Node>, std::vector<osg::Matrix> > ModelNodeMatrices;
+
+    // whether to store instance matrices in a texture buffer object instead
+    // of a 2D texture. TBOs hold far more matrices, so most models need only
+    // one slice (and one draw call).
+    bool useTextureBuffer()
+    {
+#if OSG_MIN_VERSION_REQUIRED(3,2,0)
+        const Capabilities& caps = Registry::capabilities();
+        return caps.supportsTextureBuffer() && caps.getMaxTextureBufferSize() >= 4;
+#else
+        return false;
+#endif
+    }
     
     /**
      * Simple bbox callback to return a static bbox.
@@ -181,7 +198,8 @@ ConvertToDrawInstanced::ConvertToDrawInstanced(unsigned                numInstan
                                                const osg::BoundingBox& bbox,
                                                bool                    optimize ) :
 _numInstances    ( numInstances ),
-_optimize        ( optimize )
+_optimize        ( optimize ),
+_maxRange        ( 0.0f )
 {
     setTraversalMode( TRAVERSE_ALL_CHILDREN );
     setNodeMaskOverride( ~0 );
@@ -235,6 +253,7 @@ ConvertToDrawInstanced::apply(osg::LOD& lod)
     // find the highest LOD:
     int   minIndex = 0;
     float minRange = FLT_MAX;
+    float maxRange = 0.0f;
     for(unsigned i=0; i<lod.getNumRanges(); ++i)
     {
         if ( lod.getRangeList()[i].first < minRange )
@@ -242,8 +261,12 @@ ConvertToDrawInstanced::apply(osg::LOD& lod)
             minRange = lod.getRangeList()[i].first;
             minIndex = i;
         }
+        maxRange = osg::maximum(maxRange, lod.getRangeList()[i].second);
     }
 
+    // remember the visibility range so the shader can cull by it instead.
+    _maxRange = osg::maximum(_maxRange, maxRange);
+
     // remove all but the highest:
     osg::ref_ptr<osg::Node> highestLOD = lod.getChild( minIndex );
     lod.removeChildren( 0, lod.getNumChildren() );
@@ -265,9 +288,17 @@ DrawInstanced::install(osg::StateSet* stateset)
     VirtualProgram* vp = VirtualProgram::getOrCreate(stateset);
     
     osgEarth::Shaders pkg;
-    pkg.loadFunction( vp, pkg.InstancingVertex );
 
-    stateset->getOrCreateUniform("oe_di_postex", osg::Uniform::SAMPLER_2D)->set(POSTEX_TEXTURE_UNIT);
+    if ( useTextureBuffer() )
+    {
+        pkg.loadFunction( vp, pkg.InstancingBufferVertex );
+        stateset->getOrCreateUniform("oe_di_postex_tbo", osg::Uniform::SAMPLER_BUFFER)->set(POSTEX_TEXTURE_UNIT);
+    }
+    else
+    {
+        pkg.loadFunction( vp, pkg.InstancingVertex );
+        stateset->getOrCreateUniform("oe_di_postex", osg::Uniform::SAMPLER_2D)->set(POSTEX_TEXTURE_UNIT);
+    }
 }
 
 
@@ -283,8 +314,10 @@ DrawInstanced::remove(osg::StateSet* stateset)
 
     Shaders pkg;
     pkg.unloadFunction( vp, pkg.InstancingVertex );
+    pkg.unloadFunction( vp, pkg.InstancingBufferVertex );
 
     stateset->removeUniform("oe_di_postex");
+    stateset->removeUniform("oe_di_postex_tbo");
     stateset->removeUniform("oe_di_postex_size");
 }
 
@@ -319,8 +352,11 @@ DrawInstanced::convertGraphToUseDrawInstanced( osg::Group* parent )
     parent->removeChildren(0, parent->getNumChildren());
 
     // maximum size of a slice.
+    bool     useTBO       = useTextureBuffer();
     unsigned maxTexSize   = POSTEX_MAX_TEXTURE_SIZE;
-    unsigned maxSliceSize = (maxTexSize*maxTexSize)/4; // 4 vec4s per matrix.
+    unsigned maxSliceSize =
+        useTBO ? (unsigned)Registry::capabilities().getMaxTextureBufferSize()/4 :
+        (maxTexSize*maxTexSize)/4; // 4 vec4s per matrix.
 
     // For each model:
     for( ModelNodeMatrices::iterator i = models.begin(); i != models.end(); ++i )
@@ -333,6 +369,9 @@ DrawInstanced::convertGraphToUseDrawInstanced( osg::Group* parent )
         node->accept( cbv );
         const osg::BoundingBox& nodeBox = cbv.getBoundingBox();
 
+        // model-space bounding sphere, for culling each instance on the GPU:
+        osg::Vec4f nodeBound( nodeBox.center(), nodeBox.radius() );
+
         osg::BoundingBox bbox;
         for( std::vector<osg::Matrix>::iterator m = matrices.begin(); m != matrices.end(); ++m )
         {
@@ -404,32 +443,57 @@ DrawInstanced::convertGraphToUseDrawInstanced( osg::Group* parent )
 
             // this group is simply a container for the uniform:
             osg::Group* sliceGroup = new osg::Group();
-
-            // calculate the ideal texture size for this slice:
-            osg::Vec2f texSize = calculateIdealTextureSize(currentSize, maxTexSize);
-            OE_DEBUG << LC << "size = " << currentSize << ", tex = " << texSize.x() << ", " << texSize.y() << std::endl;
+            osg::StateSet* stateset = sliceGroup->getOrCreateStateSet();
 
             // sampler that will hold the instance matrices:
             osg::Image* image = new osg::Image();
             image->setName("osgearth.drawinstanced.postex");
-            image->allocateImage( (int)texSize.x(), (int)texSize.y(), 1, GL_RGBA, GL_FLOAT );
-
-            osg::Texture2D* postex = new osg::Texture2D( image );
-            postex->setInternalFormat( GL_RGBA16F_ARB );
-            postex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
-            postex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
-            postex->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP );
-            postex->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP );
-            postex->setUnRefImageDataAfterApply( true );
-            if ( !ImageUtils::isPowerOfTwo(image) )
-                postex->setResizeNonPowerOfTwoHint( false );
+
+            osg::Texture* postex = 0L;
+
+#if OSG_MIN_VERSION_REQUIRED(3,2,0)
+            if ( useTBO )
+            {
+                // one texel per matrix row, fetched by index in the shader:
+                image->allocateImage( 4*currentSize, 1, 1, GL_RGBA, GL_FLOAT );
+
+                osg::TextureBuffer* tbo = new osg::TextureBuffer();
+                tbo->setImage( image );
+                tbo->setInternalFormat( GL_RGBA32F_ARB );
+                postex = tbo;
+            }
+            else
+#endif
+            {
+                // calculate the ideal texture size for this slice:
+                osg::Vec2f texSize = calculateIdealTextureSize(currentSize, maxTexSize);
+                OE_DEBUG << LC << "size = " << currentSize << ", tex = " << texSize.x() << ", " << texSize.y() << std::endl;
+
+                image->allocateImage( (int)texSize.x(), (int)texSize.y(), 1, GL_RGBA, GL_FLOAT );
+
+                osg::Texture2D* tex = new osg::Texture2D( image );
+                tex->setInternalFormat( GL_RGBA16F_ARB );
+                tex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+                tex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
+                tex->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP );
+                tex->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP );
+                tex->setUnRefImageDataAfterApply( true );
+                if ( !ImageUtils::isPowerOfTwo(image) )
+                    tex->setResizeNonPowerOfTwoHint( false );
+                postex = tex;
+
+                stateset->getOrCreateUniform("oe_di_postex_size", osg::Uniform::FLOAT_VEC2)->set(texSize);
+            }
 
             // Tell the SG to skip the positioning texture.
             ShaderGenerator::setIgnoreHint(postex, true);
 
-            osg::StateSet* stateset = sliceGroup->getOrCreateStateSet();
             stateset->setTextureAttributeAndModes(POSTEX_TEXTURE_UNIT, postex, 1);
-            stateset->getOrCreateUniform("oe_di_postex_size", osg::Uniform::FLOAT_VEC2)->set(texSize);
+
+            // per-instance culling parameters:
+            float maxRange = cdi.getMaxRange() < FLT_MAX ? cdi.getMaxRange() : 0.0f;
+            stateset->getOrCreateUniform("oe_di_bound", osg::Uniform::FLOAT_VEC4)->set(nodeBound);
+            stateset->getOrCreateUniform("oe_di_maxRange", osg::Uniform::FLOAT)->set(maxRange);
 
             // could use PixelWriter but we know the format.
             GLfloat* ptr = reinterpret_cast<GLfloat*>( image->data() );
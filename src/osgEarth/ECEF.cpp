@@ -18,7 +18,19 @@
  */
 
 #include <osgEarth/ECEF>
+#include <osgEarth/Arena>
 #include <osgEarth/Notify>
+#include <cmath>
+
+// AVX processes four doubles at a time; SSE2 (always available on x86-64)
+// processes two. Either way the arithmetic matches the scalar code exactly.
+#if defined(__AVX__)
+#   define OE_ECEF_AVX 1
+#   include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define OE_ECEF_SSE2 1
+#   include <emmintrin.h>
+#endif
 
 using namespace osgEarth;
 
@@ -26,6 +38,57 @@ using namespace osgEarth;
 
 // --------------------------------------------------------------------------
 
+namespace
+{
+    /**
+     * Rows of an affine matrix, laid out for p' = x*row0 + y*row1 + z*row2 + row3
+     * (OSG's row-vector convention, summed in the same order as Matrixd::preMult).
+     */
+    struct AffineRows
+    {
+        AffineRows( const osg::Matrixd& m ) : _m(m)
+        {
+            _affine = m(0,3) == 0.0 && m(1,3) == 0.0 && m(2,3) == 0.0 && m(3,3) == 1.0;
+#if defined(OE_ECEF_AVX)
+            for( int r = 0; r < 4; ++r )
+                _row[r] = _mm256_set_pd( 0.0, m(r,2), m(r,1), m(r,0) );
+#elif defined(OE_ECEF_SSE2)
+            for( int r = 0; r < 4; ++r )
+                _rowXY[r] = _mm_set_pd( m(r,1), m(r,0) );
+#endif
+        }
+
+        // out must have room for 4 doubles.
+        inline void apply( double x, double y, double z, double* out ) const
+        {
+#if defined(OE_ECEF_AVX)
+            __m256d v = _mm256_add_pd( _mm256_mul_pd(_mm256_set1_pd(x), _row[0]), _mm256_mul_pd(_mm256_set1_pd(y), _row[1]) );
+            v = _mm256_add_pd( _mm256_add_pd(v, _mm256_mul_pd(_mm256_set1_pd(z), _row[2])), _row[3] );
+            _mm256_storeu_pd( out, v );
+#elif defined(OE_ECEF_SSE2)
+            __m128d xy = _mm_add_pd( _mm_mul_pd(_mm_set1_pd(x), _rowXY[0]), _mm_mul_pd(_mm_set1_pd(y), _rowXY[1]) );
+            xy = _mm_add_pd( _mm_add_pd(xy, _mm_mul_pd(_mm_set1_pd(z), _rowXY[2])), _rowXY[3] );
+            _mm_storeu_pd( out, xy );
+            out[2] = _m(0,2)*x + _m(1,2)*y + _m(2,2)*z + _m(3,2);
+#else
+            out[0] = _m(0,0)*x + _m(1,0)*y + _m(2,0)*z + _m(3,0);
+            out[1] = _m(0,1)*x + _m(1,1)*y + _m(2,1)*z + _m(3,1);
+            out[2] = _m(0,2)*x + _m(1,2)*y + _m(2,2)*z + _m(3,2);
+#endif
+        }
+
+        const osg::Matrixd& _m;
+        bool                _affine;
+#if defined(OE_ECEF_AVX)
+        __m256d _row[4];
+#elif defined(OE_ECEF_SSE2)
+        __m128d _rowXY[4];
+#endif
+    };
+}
+
+// --------------------------------------------------------------------------
+
 osg::Matrixd
 ECEF::createLocalToWorld( const osg::Vec3d& input )
 {
@@ -85,18 +148,18 @@ ECEF::transformAndLocalize(const std::vector<osg::Vec3d>& input,
                            const SpatialReference*        inputSRS,
                            osg::Vec3Array*                output,
                            const SpatialReference*        outputSRS,
-                           const osg::Matrixd&            world2local )
+                           const osg::Matrixd&            world2local,
+                           Arena*                         arena )
 {
-    const SpatialReference* ecefSRS = outputSRS->getECEF();
-    output->reserve( output->size() + input.size() );
+    // one batch transform for the whole array instead of one per point.
+    ScratchPoints scratch( arena );
+    std::vector<osg::Vec3d>& local = scratch.get();
+    local.assign( input.begin(), input.end() );
+    transformAndLocalize( local, inputSRS, outputSRS, world2local );
 
-    for( std::vector<osg::Vec3d>::const_iterator i = input.begin(); i != input.end(); ++i )
-    {
-        osg::Vec3d ecef;
-        inputSRS->transform( *i, ecefSRS, ecef );
-        //inputSRS->transformToECEF( *i, ecef );
-        output->push_back( ecef * world2local );
-    }
+    output->reserve( output->size() + local.size() );
+    for( std::vector<osg::Vec3d>::const_iterator i = local.begin(); i != local.end(); ++i )
+        output->push_back( *i );
 }
 
 
@@ -106,17 +169,10 @@ ECEF::transformAndLocalize(const std::vector<osg::Vec3d>& input,
                            osg::Vec3Array*                out_verts,
                            osg::Vec3Array*                out_normals,
                            const SpatialReference*        outputSRS,
-                           const osg::Matrixd&            world2local )
+                           const osg::Matrixd&            world2local,
+                           Arena*                         arena )
 {
-    const SpatialReference* ecefSRS = outputSRS->getECEF();
-    out_verts->reserve( out_verts->size() + input.size() );
-    
-    for( std::vector<osg::Vec3d>::const_iterator i = input.begin(); i != input.end(); ++i )
-    {
-        osg::Vec3d ecef;
-        inputSRS->transform( *i, ecefSRS, ecef );
-        out_verts->push_back( ecef * world2local );
-    }
+    transformAndLocalize( input, inputSRS, out_verts, outputSRS, world2local, arena );
 
     if ( out_normals )
     {
@@ -152,6 +208,145 @@ ECEF::transformAndLocalize(const std::vector<osg::Vec3d>& input,
     }
 }
 
+bool
+ECEF::transformAndLocalize(std::vector<osg::Vec3d>& points,
+                           const SpatialReference*  inputSRS,
+                           const SpatialReference*  outputSRS,
+                           const osg::Matrixd&      world2local)
+{
+    if ( points.empty() )
+        return true;
+
+    bool ok = inputSRS->transform( points, outputSRS->getECEF() );
+    transformPoints( world2local, points );
+    return ok;
+}
+
+void
+ECEF::geodeticToECEF(const osg::EllipsoidModel* ellipsoid,
+                     osg::Vec3d*                points,
+                     unsigned                   count)
+{
+    // same derivation as osg::EllipsoidModel, so the results match bit for bit.
+    const double a  = ellipsoid->getRadiusEquator();
+    const double f  = (a - ellipsoid->getRadiusPolar()) / a;
+    const double e2 = 2.0*f - f*f;
+
+    unsigned i = 0;
+
+#if defined(OE_ECEF_AVX) || defined(OE_ECEF_SSE2)
+    // the trig is scalar; the rest runs on whole blocks of points.
+    for( ; i+4 <= count; i += 4 )
+    {
+        double sLat[4], cLat[4], sLon[4], cLon[4], h[4], x[4], y[4], z[4];
+        for( unsigned k = 0; k < 4; ++k )
+        {
+            const osg::Vec3d& p = points[i+k];
+            double lat = osg::DegreesToRadians( p.y() );
+            double lon = osg::DegreesToRadians( p.x() );
+            sLat[k] = sin(lat); cLat[k] = cos(lat);
+            sLon[k] = sin(lon); cLon[k] = cos(lon);
+            h[k]    = p.z();
+        }
+
+#  if defined(OE_ECEF_AVX)
+        {
+            __m256d S  = _mm256_loadu_pd( sLat );
+            __m256d H  = _mm256_loadu_pd( h );
+            __m256d N  = _mm256_div_pd( _mm256_set1_pd(a),
+                _mm256_sqrt_pd( _mm256_sub_pd(_mm256_set1_pd(1.0), _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(e2), S), S)) ) );
+            __m256d CN = _mm256_mul_pd( _mm256_add_pd(N, H), _mm256_loadu_pd(cLat) );
+            _mm256_storeu_pd( x, _mm256_mul_pd(CN, _mm256_loadu_pd(cLon)) );
+            _mm256_storeu_pd( y, _mm256_mul_pd(CN, _mm256_loadu_pd(sLon)) );
+            _mm256_storeu_pd( z, _mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(N, _mm256_set1_pd(1.0-e2)), H), S) );
+        }
+#  else
+        for( unsigned k = 0; k < 4; k += 2 )
+        {
+            __m128d S  = _mm_loadu_pd( sLat+k );
+            __m128d H  = _mm_loadu_pd( h+k );
+            __m128d N  = _mm_div_pd( _mm_set1_pd(a),
+                _mm_sqrt_pd( _mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(_mm_mul_pd(_mm_set1_pd(e2), S), S)) ) );
+            __m128d CN = _mm_mul_pd( _mm_add_pd(N, H), _mm_loadu_pd(cLat+k) );
+            _mm_storeu_pd( x+k, _mm_mul_pd(CN, _mm_loadu_pd(cLon+k)) );
+            _mm_storeu_pd( y+k, _mm_mul_pd(CN, _mm_loadu_pd(sLon+k)) );
+            _mm_storeu_pd( z+k, _mm_mul_pd(_mm_add_pd(_mm_mul_pd(N, _mm_set1_pd(1.0-e2)), H), S) );
+        }
+#  endif
+
+        for( unsigned k = 0; k < 4; ++k )
+            points[i+k].set( x[k], y[k], z[k] );
+    }
+#endif
+
+    for( ; i < count; ++i )
+    {
+        osg::Vec3d& p = points[i];
+        double lat = osg::DegreesToRadians( p.y() );
+        double lon = osg::DegreesToRadians( p.x() );
+        double sinLat = sin(lat);
+        double cosLat = cos(lat);
+        double N = a / sqrt( 1.0 - e2*sinLat*sinLat );
+        p.set(
+            (N + p.z()) * cosLat * cos(lon),
+            (N + p.z()) * cosLat * sin(lon),
+            (N*(1.0-e2) + p.z()) * sinLat );
+    }
+}
+
+void
+ECEF::transformPoints(const osg::Matrixd& matrix,
+                      osg::Vec3d*         points,
+                      unsigned            count)
+{
+    AffineRows rows( matrix );
+    if ( !rows._affine )
+    {
+        for( unsigned i = 0; i < count; ++i )
+            points[i] = points[i] * matrix;
+        return;
+    }
+
+    double out[4];
+    for( unsigned i = 0; i < count; ++i )
+    {
+        osg::Vec3d& p = points[i];
+        rows.apply( p.x(), p.y(), p.z(), out );
+        p.set( out[0], out[1], out[2] );
+    }
+}
+
+void
+ECEF::transformPoints(const osg::Matrixd&      matrix,
+                      std::vector<osg::Vec3d>& points)
+{
+    if ( !points.empty() )
+        transformPoints( matrix, &points[0], points.size() );
+}
+
+void
+ECEF::transformPoints(const osg::Matrixd& matrix,
+                      osg::Vec3Array*     points)
+{
+    if ( !points )
+        return;
+
+    AffineRows rows( matrix );
+    if ( !rows._affine )
+    {
+        for( osg::Vec3Array::iterator i = points->begin(); i != points->end(); ++i )
+            *i = osg::Vec3d(*i) * matrix;
+        return;
+    }
+
+    double out[4];
+    for( osg::Vec3Array::iterator i = points->begin(); i != points->end(); ++i )
+    {
+        rows.apply( i->x(), i->y(), i->z(), out );
+        i->set( out[0], out[1], out[2] );
+    }
+}
+
 void
 ECEF::transformAndGetRotationMatrix(const osg::Vec3d&       input,
                                     const SpatialReference* inputSRS,
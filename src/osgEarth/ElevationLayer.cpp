@@ -18,10 +18,16 @@
  */
 #include <osgEarth/ElevationLayer>
 #include <osgEarth/VerticalDatum>
+#include <osgEarth/FrameStats>
 #include <osgEarth/HeightFieldUtils>
 #include <osgEarth/Progress>
 #include <osgEarth/MemCache>
+#include <osgEarth/Registry>
+#include <osgEarth/Profiler>
+#include <osgEarth/TaskService>
 #include <osg/Version>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Condition>
 #include <iterator>
 
 using namespace osgEarth;
@@ -149,7 +155,7 @@ _runtimeOptions( options )
 void
 ElevationLayer::init()
 {
-    //nop
+    shareMemCache( "elevation" );
 }
 
 std::string
@@ -366,6 +372,8 @@ GeoHeightField
 ElevationLayer::createHeightField(const TileKey&    key,
                                   ProgressCallback* progress )
 {
+    FrameStats::FetchTimer fetchTimer( getName() );
+
     GeoHeightField result;
     osg::ref_ptr<osg::HeightField> hf;
 
@@ -568,6 +576,183 @@ namespace
     typedef osg::ref_ptr<ElevationLayer>          RefElevationLayer;
     typedef std::pair<RefElevationLayer, TileKey> LayerAndKey;
     typedef std::vector<LayerAndKey>              LayerAndKeyVector;
+
+    // Fetches the heightfields for a set of layers concurrently. The calling
+    // thread and the pool tasks all pull from the same work index, so the
+    // caller never blocks on a task that is still sitting in the queue (which
+    // would deadlock when populateHeightField is nested, e.g. by a
+    // CompositeTileSource running on a pool thread).
+    struct ParallelFetch : public osg::Referenced
+    {
+        ParallelFetch(const LayerAndKeyVector& layers, ProgressCallback* progress) :
+            _layers  ( layers ),
+            _results ( layers.size() ),
+            _progress( progress ),
+            _next    ( 0 ),
+            _numDone ( 0 ) { }
+
+        // fetches the next unclaimed heightfield; false if none are left.
+        bool runOne()
+        {
+            unsigned i = (++_next) - 1;
+            if ( i >= _layers.size() )
+                return false;
+
+            _results[i] = _layers[i].first->createHeightField( _layers[i].second, _progress );
+
+            if ( (unsigned)(++_numDone) == _layers.size() )
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                _cond.broadcast();
+            }
+            return true;
+        }
+
+        void waitForAll()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            while ( (unsigned)_numDone < _layers.size() )
+                _cond.wait( &_mutex );
+        }
+
+        LayerAndKeyVector    _layers;
+        GeoHeightFieldVector _results;
+        ProgressCallback*    _progress;
+        OpenThreads::Atomic  _next;
+        OpenThreads::Atomic  _numDone;
+        Threading::Mutex     _mutex;
+        OpenThreads::Condition _cond;
+    };
+
+    struct ParallelFetchTask : public TaskRequest
+    {
+        ParallelFetchTask(ParallelFetch* fetch) : _fetch(fetch) { }
+
+        void operator()( ProgressCallback* progress )
+        {
+            while( _fetch->runOne() );
+        }
+
+        osg::ref_ptr<ParallelFetch> _fetch;
+    };
+
+    Threading::Mutex          s_fetchServiceMutex;
+    osg::ref_ptr<TaskService> s_fetchService;
+
+    TaskService* getFetchService()
+    {
+        Threading::ScopedMutexLock lock( s_fetchServiceMutex );
+        if ( !s_fetchService.valid() )
+        {
+            s_fetchService = new TaskService( "ElevationLayerVector", 4 );
+            Registry::instance()->registerTaskService( s_fetchService.get() );
+        }
+        return s_fetchService.get();
+    }
+
+    // Fetches each layer's heightfield, in parallel when there is more than one.
+    void fetchHeightFields(const LayerAndKeyVector& layers,
+                           GeoHeightFieldVector&    out_fields,
+                           ProgressCallback*        progress)
+    {
+        if ( layers.size() == 1 )
+        {
+            out_fields.push_back( layers[0].first->createHeightField(layers[0].second, progress) );
+            return;
+        }
+
+        osg::ref_ptr<ParallelFetch> fetch = new ParallelFetch( layers, progress );
+
+        TaskService* service = getFetchService();
+        for( unsigned i=1; i<layers.size(); ++i )
+            service->add( new ParallelFetchTask(fetch.get()) );
+
+        while( fetch->runOne() );
+        fetch->waitForAll();
+
+        out_fields.insert( out_fields.end(), fetch->_results.begin(), fetch->_results.end() );
+    }
+
+    // Samples a layer heightfield at the posts listed in "indices", writing one
+    // height per index (NO_DATA_VALUE where the layer has nothing).
+    void sampleHeightField(const GeoHeightField&        layerHF,
+                           const std::vector<double>&   xs,
+                           const std::vector<double>&   ys,
+                           const std::vector<unsigned>& indices,
+                           const SpatialReference*      keySRS,
+                           ElevationInterpolation       interpolation,
+                           std::vector<float>&          out_heights)
+    {
+        out_heights.assign( indices.size(), NO_DATA_VALUE );
+
+        const GeoExtent& extent = layerHF.getExtent();
+        const osg::HeightField* hf = layerHF.getHeightField();
+        double maxCol = (double)(hf->getNumColumns()-1);
+        double maxRow = (double)(hf->getNumRows()-1);
+        double xInterval = extent.width()  / maxCol;
+        double yInterval = extent.height() / maxRow;
+
+        // Different horizontal SRS: move the posts into the heightfield's SRS
+        // with the cached approximation of the transform over the tile (within
+        // 1/8 of a heightfield post), instead of transforming them one by one.
+        std::vector<osg::Vec3d> local;
+        bool sameSRS = extent.getSRS()->isEquivalentTo(keySRS);
+        if ( !sameSRS && keySRS->isVertEquivalentTo(extent.getSRS()) && !xs.empty() )
+        {
+            local.reserve( indices.size() );
+            for( unsigned i=0; i<indices.size(); ++i )
+                local.push_back( osg::Vec3d(xs[indices[i]], ys[indices[i]], 0.0) );
+
+            // the posts are row-major, so the first and last are the corners.
+            if ( !keySRS->transformApprox(local, extent.getSRS(), xs.front(), ys.front(), xs.back(), ys.back(),
+                                          0.125 * osg::minimum(xInterval, yInterval)) )
+            {
+                local.clear();
+            }
+        }
+
+        // Otherwise (e.g. a vertical datum change), take the slow path that
+        // transforms each point.
+        if ( !sameSRS && local.empty() )
+        {
+            for( unsigned i=0; i<indices.size(); ++i )
+            {
+                float elevation;
+                if ( layerHF.getElevation(keySRS, xs[indices[i]], ys[indices[i]], interpolation, keySRS, elevation) )
+                    out_heights[i] = elevation;
+            }
+            return;
+        }
+
+        // Convert to pixel space and sample the whole batch at once.
+
+        std::vector<double>   cols, rows;
+        std::vector<unsigned> inside;
+        cols.reserve( indices.size() );
+        rows.reserve( indices.size() );
+        inside.reserve( indices.size() );
+
+        for( unsigned i=0; i<indices.size(); ++i )
+        {
+            double x = sameSRS ? xs[indices[i]] : local[i].x();
+            double y = sameSRS ? ys[indices[i]] : local[i].y();
+            if ( extent.contains(x, y) )
+            {
+                cols.push_back( osg::clampBetween((x - extent.xMin()) / xInterval, 0.0, maxCol) );
+                rows.push_back( osg::clampBetween((y - extent.yMin()) / yInterval, 0.0, maxRow) );
+                inside.push_back( i );
+            }
+        }
+
+        if ( inside.empty() )
+            return;
+
+        std::vector<float> heights( inside.size() );
+        HeightFieldUtils::getHeightsAtPixels( hf, &cols[0], &rows[0], inside.size(), &heights[0], interpolation );
+
+        for( unsigned i=0; i<inside.size(); ++i )
+            out_heights[inside[i]] = heights[i];
+    }
 }
 
 
@@ -578,6 +763,7 @@ ElevationLayerVector::populateHeightField(osg::HeightField*      hf,
                                           ElevationInterpolation interpolation,
                                           ProgressCallback*      progress ) const
 {
+    OE_PROFILING_ZONE("ElevationLayerVector::populateHeightField");
     //osg::Timer_t startTime = osg::Timer::instance()->tick();
     // heightfield must already exist.
     if ( !hf )
@@ -676,123 +862,85 @@ ElevationLayerVector::populateHeightField(osg::HeightField*      hf,
     double   ymin       = key.getExtent().yMin();
     double   dx         = key.getExtent().width() / (double)(numColumns-1);
     double   dy         = key.getExtent().height() / (double)(numRows-1);
-    
-    // We will load the actual heightfields on demand. We might not need them all.
-    GeoHeightFieldVector heightFields(contenders.size());
-    GeoHeightFieldVector offsetFields(offsets.size());
-    std::vector<bool>    heightFailed(contenders.size(), false);
-    std::vector<bool>    offsetFailed(offsets.size(), false);
 
-    // The maximum number of heightfields to keep in this local cache
-    unsigned int maxHeightFields = 50;
-    unsigned numHeightFieldsInCache = 0;
+    // Fetch all the contributing heightfields at once; with several layers
+    // the tile latency becomes that of the slowest layer instead of the sum.
+    LayerAndKeyVector all( contenders );
+    all.insert( all.end(), offsets.begin(), offsets.end() );
+
+    GeoHeightFieldVector fields;
+    fields.reserve( all.size() );
+    fetchHeightFields( all, fields, progress );
 
     const SpatialReference* keySRS = keyToUse.getProfile()->getSRS();
 
     bool realData = false;
+    for( unsigned i=0; i<fields.size() && !realData; ++i )
+        realData = fields[i].valid();
 
-
-    unsigned int total = numColumns * numRows;
-    unsigned int completed = 0;
-
-    for (unsigned c = 0; c < numColumns; ++c)
+    // Post locations, row-major to match the heightfield.
+    unsigned total = numColumns * numRows;
+    std::vector<double> xs( total ), ys( total );
+    for (unsigned r = 0; r < numRows; ++r)
     {
-        double x = xmin + (dx * (double)c);
-        for (unsigned r = 0; r < numRows; ++r)
+        double y = ymin + (dy * (double)r);
+        for (unsigned c = 0; c < numColumns; ++c)
         {
-            double y = ymin + (dy * (double)r);
+            xs[r*numColumns + c] = xmin + (dx * (double)c);
+            ys[r*numColumns + c] = y;
+        }
+    }
 
-            // Collect elevations from each layer as necessary.
-            bool resolved = false;
+    std::vector<unsigned> pending( total );
+    for (unsigned i = 0; i < total; ++i)
+        pending[i] = i;
 
-            for(int i=0; i<contenders.size() && !resolved; ++i)
-            {
-                if ( heightFailed[i] )
-                    continue;
+    std::vector<float>    heights;
+    std::vector<unsigned> unresolved;
+    unresolved.reserve( total );
 
-                ElevationLayer* layer = contenders[i].first.get();
+    // Composite the contenders in priority order. Each layer only samples the
+    // posts that no higher-priority layer resolved, and we stop as soon as
+    // every post is covered.
+    for (unsigned i = 0; i < contenders.size() && !pending.empty(); ++i)
+    {
+        if ( !fields[i].valid() )
+            continue;
 
-                GeoHeightField& layerHF = heightFields[i];
-                if ( !layerHF.valid() )
-                {
-                    //TileKey mappedKey = 
-                    //    keyToUse.mapResolution(hf->getNumColumns(), layer->getTileSize());
+        sampleHeightField( fields[i], xs, ys, pending, keySRS, interpolation, heights );
 
-                    layerHF = layer->createHeightField(contenders[i].second, progress); //contenders[i]->createHeightField(mappedKey, progress);
-                    if ( !layerHF.valid() )
-                    {
-                        heightFailed[i] = true;
-                        continue;
-                    }
-                    else
-                    {
-                        numHeightFieldsInCache++;
-                    }
-                }
-
-                // If we actually got a layer then we have real data
-                realData = true;
+        unresolved.clear();
+        for (unsigned p = 0; p < pending.size(); ++p)
+        {
+            if ( heights[p] != NO_DATA_VALUE )
+                (*hf->getFloatArray())[pending[p]] = heights[p];
+            else
+                unresolved.push_back( pending[p] );
+        }
+        pending.swap( unresolved );
+    }
 
-                float elevation;
-                if (layerHF.getElevation(keySRS, x, y, interpolation, keySRS, elevation) &&
-                    elevation != NO_DATA_VALUE)
-                {
-                    resolved = true;                    
-                    hf->setHeight(c, r, elevation);
-                }
+    // Offset layers add to every post.
+    if ( !offsets.empty() )
+    {
+        std::vector<unsigned> allPosts( total );
+        for (unsigned i = 0; i < total; ++i)
+            allPosts[i] = i;
 
+        for (unsigned i = contenders.size(); i < fields.size(); ++i)
+        {
+            if ( !fields[i].valid() )
+                continue;
 
-                // Clear the heightfield cache if we have too many heightfields in the cache.
-                if (numHeightFieldsInCache >= maxHeightFields)
-                {
-                    //OE_NOTICE << "Clearing cache" << std::endl;
-                    for (unsigned int k = 0; k < heightFields.size(); k++)
-                    {
-                        heightFields[k] = GeoHeightField::INVALID;
-                    }
-                    numHeightFieldsInCache = 0;
-                }
-            }
+            sampleHeightField( fields[i], xs, ys, allPosts, keySRS, interpolation, heights );
 
-            for(int i=offsets.size()-1; i>=0; --i)
+            for (unsigned p = 0; p < total; ++p)
             {
-                if ( offsetFailed[i] )
-                    continue;
-
-                GeoHeightField& layerHF = offsetFields[i];
-                if ( !layerHF.valid() )
-                {
-                    ElevationLayer* offset = offsets[i].first.get();
-
-                    //TileKey mappedKey = 
-                    //    keyToUse.mapResolution(hf->getNumColumns(), offset->getTileSize());
-
-                    layerHF = offset->createHeightField(offsets[i].second, progress);
-                    if ( !layerHF.valid() )
-                    {
-                        offsetFailed[i] = true;
-                        continue;
-                    }
-                }
-
-                // If we actually got a layer then we have real data
-                realData = true;
-
-                float elevation = 0.0f;
-                if (layerHF.getElevation(keySRS, x, y, interpolation, keySRS, elevation) &&
-                    elevation != NO_DATA_VALUE)
-                {                    
-                    hf->getHeight(c, r) += elevation;
-                }
+                if ( heights[p] != NO_DATA_VALUE )
+                    (*hf->getFloatArray())[p] += heights[p];
             }
-
-            completed++;
-            //OE_NOTICE << "Completed " << completed << " of " << total << std::endl;
         }
-    }   
-
-    //osg::Timer_t endTime = osg::Timer::instance()->tick();
-    //OE_NOTICE << "populateHeightField took " << osg::Timer::instance()->delta_s(startTime, endTime) << "s" << std::endl;
+    }
 
     // Return whether or not we actually read any real data
     return realData;
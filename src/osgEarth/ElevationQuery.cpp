@@ -21,6 +21,8 @@
 #include <osgEarth/HeightFieldUtils>
 #include <osgEarth/DPLineSegmentIntersector>
 #include <osgUtil/IntersectionVisitor>
+#include <algorithm>
+#include <cfloat>
 
 #define LC "[ElevationQuery] "
 
@@ -38,6 +40,53 @@ namespace
         x |= x >> 16;
         return x+1;
     }
+
+    // Creates the heightfield for one elevation tile, or returns false
+    // if the map has no data for the tile.
+    bool createGeoHeightField(const MapFrame& mapf, const TileKey& key, unsigned tileSize, GeoHeightField& out)
+    {
+        osg::ref_ptr<osg::HeightField> hf = new osg::HeightField();
+        hf->allocate( tileSize, tileSize );
+
+        // Initialize the heightfield to nodata
+        for (unsigned int i = 0; i < hf->getFloatArray()->size(); i++)
+        {
+            hf->getFloatArray()->at( i ) = NO_DATA_VALUE;
+        }   
+
+        if (mapf.populateHeightField(hf, key, false))
+        {                
+            out = GeoHeightField( hf.get(), key.getExtent() );
+            return true;
+        }
+        return false;
+    }
+
+    // Fetches one elevation tile for a bulk query.
+    struct FetchHeightField
+    {
+        const MapFrame* _mapf;
+        TileKey         _key;
+        unsigned        _tileSize;
+        GeoHeightField  _result;
+
+        void execute()
+        {
+            createGeoHeightField( *_mapf, _key, _tileSize, _result );
+        }
+    };
+    typedef ParallelTask<FetchHeightField> FetchHeightFieldTask;
+
+    // One point of a bulk query, and the tile to sample it from.
+    struct BulkSample
+    {
+        TileKey  _key;
+        unsigned _index;
+
+        bool operator < (const BulkSample& rhs) const {
+            return _key < rhs._key;
+        }
+    };
 }
 
 ElevationQueryCacheReadCallback::ElevationQueryCacheReadCallback()
@@ -108,6 +157,34 @@ osg::Node* ElevationQueryCacheReadCallback::readNodeFile(const std::string& file
     return node.release();
 }
 
+// Heightfields fetched in the background, waiting for processAsyncResults().
+struct ElevationQuery::AsyncResults : public osg::Referenced
+{
+    Threading::Mutex                          _mutex;
+    std::vector< osg::ref_ptr<AsyncFetch> >   _done;
+};
+
+// Background fetch of one elevation tile for getElevationNow().
+struct ElevationQuery::AsyncFetch : public TaskRequest
+{
+    MapFrame                   _mapf;
+    TileKey                    _key;
+    unsigned                   _tileSize;
+    int                        _generation;
+    GeoHeightField             _result;
+    osg::ref_ptr<AsyncResults> _results;
+
+    AsyncFetch(const MapFrame& mapf) : _mapf(mapf) { }
+
+    void operator()( ProgressCallback* progress )
+    {
+        createGeoHeightField( _mapf, _key, _tileSize, _result );
+
+        Threading::ScopedMutexLock lock( _results->_mutex );
+        _results->_done.push_back( this );
+    }
+};
+
 ElevationQuery::ElevationQuery(const Map* map) :
 _mapf( map, (Map::ModelParts)(Map::TERRAIN_LAYERS | Map::MODEL_LAYERS) )
 {
@@ -120,6 +197,15 @@ _mapf( mapFrame )
     postCTOR();
 }
 
+ElevationQuery::~ElevationQuery()
+{
+    // stop the background fetches before the results go away.
+    _asyncService = 0L;
+
+    Threading::ScopedMutexLock lock( _asyncResults->_mutex );
+    _asyncResults->_done.clear();
+}
+
 void
 ElevationQuery::postCTOR()
 {
@@ -127,7 +213,11 @@ ElevationQuery::postCTOR()
     _maxLevelOverride = -1;
     _queries          = 0.0;
     _totalTime        = 0.0;  
+    _numBulkThreads   = 0u;
+    _sortByTile       = true;
     _cache.setMaxSize( 500 );
+    _asyncGeneration  = 0;
+    _asyncResults     = new AsyncResults();
 
     // set read callback for IntersectionVisitor
     setElevationQueryCacheReadCallback(new ElevationQueryCacheReadCallback);
@@ -144,6 +234,11 @@ ElevationQuery::sync()
         _mapf.sync();
         _cache.clear();
         gatherPatchLayers();
+
+        // outstanding background fetches are for the old map; ignore them.
+        _asyncRequests.clear();
+        _asyncNoData.clear();
+        ++_asyncGeneration;
     }
 }
 
@@ -265,6 +360,16 @@ ElevationQuery::getMaxLevelOverride() const
     return _maxLevelOverride;
 }
 
+void
+ElevationQuery::setNumBulkQueryThreads(unsigned value)
+{
+    if ( value != _numBulkThreads )
+    {
+        _numBulkThreads = value;
+        _bulkService = value > 1 ? new TaskService("ElevationQuery", value) : 0L;
+    }
+}
+
 bool
 ElevationQuery::getElevation(const GeoPoint&         point,
                              double&                 out_elevation,
@@ -283,6 +388,161 @@ ElevationQuery::getElevation(const GeoPoint&         point,
     }
 }
 
+bool
+ElevationQuery::getElevationNow(const GeoPoint& point,
+                                double&         out_elevation,
+                                double          desiredResolution,
+                                double*         out_actualResolution,
+                                AsyncCallback*  callback)
+{
+    sync();
+    processAsyncResults();
+
+    GeoPoint point_abs = point;
+    if ( point.altitudeMode() != ALTMODE_ABSOLUTE )
+        point_abs = GeoPoint( point.getSRS(), point.x(), point.y(), 0.0, ALTMODE_ABSOLUTE );
+
+    // terrain patches intersect the scene graph; and no elevation layers means no tiles.
+    if ( !_patchLayers.empty() || _mapf.elevationLayers().empty() )
+    {
+        return getElevationImpl( point_abs, out_elevation, desiredResolution, out_actualResolution );
+    }
+
+    AsyncRequest request;
+    unsigned     tileSize;
+    if ( !getTargetKey(point_abs, desiredResolution, request._mapPoint, request._targetKey, tileSize) )
+        return false;
+
+    osg::Timer_t begin = osg::Timer::instance()->tick();
+
+    double  resolution = DBL_MAX;
+    TileKey missingKey;
+    bool    result = sampleFromCache( request._targetKey, request._mapPoint, out_elevation, resolution, missingKey );
+
+    if ( result && out_actualResolution )
+        *out_actualResolution = resolution;
+
+    // a better tile isn't in the cache; go get it.
+    if ( missingKey.valid() )
+    {
+        request._point      = point_abs;
+        request._resolution = resolution;
+        request._callback   = callback;
+        requestAsync( missingKey, tileSize, callback ? &request : 0L );
+    }
+
+    osg::Timer_t end = osg::Timer::instance()->tick();
+    _queries++;
+    _totalTime += osg::Timer::instance()->delta_s( begin, end );
+
+    return result;
+}
+
+void
+ElevationQuery::processAsyncResults()
+{
+    std::vector< osg::ref_ptr<AsyncFetch> > done;
+    {
+        Threading::ScopedMutexLock lock( _asyncResults->_mutex );
+        done.swap( _asyncResults->_done );
+    }
+
+    for( std::vector< osg::ref_ptr<AsyncFetch> >::const_iterator i = done.begin(); i != done.end(); ++i )
+    {
+        const AsyncFetch* fetch = i->get();
+        if ( fetch->_generation != _asyncGeneration )
+            continue;
+
+        if ( fetch->_result.valid() )
+            _cache.insert( fetch->_key, fetch->_result );
+        else
+            _asyncNoData.insert( fetch->_key );
+
+        AsyncRequests::iterator r = _asyncRequests.find( fetch->_key );
+        if ( r == _asyncRequests.end() )
+            continue;
+
+        std::vector<AsyncRequest> waiting;
+        waiting.swap( r->second );
+        _asyncRequests.erase( r );
+
+        // re-sample each waiting point; report it if it improved, and keep
+        // going if there's an even better tile still to fetch.
+        for( std::vector<AsyncRequest>::iterator w = waiting.begin(); w != waiting.end(); ++w )
+        {
+            double  elevation, resolution;
+            TileKey missingKey;
+            if ( sampleFromCache(w->_targetKey, w->_mapPoint, elevation, resolution, missingKey) &&
+                 resolution < w->_resolution )
+            {
+                w->_resolution = resolution;
+                w->_callback->onElevationAvailable( w->_point, elevation, resolution );
+            }
+
+            if ( missingKey.valid() )
+            {
+                requestAsync( missingKey, fetch->_tileSize, &(*w) );
+            }
+        }
+    }
+}
+
+void
+ElevationQuery::requestAsync(const TileKey& key, unsigned tileSize, const AsyncRequest* request)
+{
+    AsyncRequests::iterator i = _asyncRequests.find( key );
+    if ( i == _asyncRequests.end() )
+    {
+        if ( !_asyncService.valid() )
+            _asyncService = new TaskService( "ElevationQuery async", 2 );
+
+        AsyncFetch* fetch  = new AsyncFetch( _mapf );
+        fetch->_key        = key;
+        fetch->_tileSize   = tileSize;
+        fetch->_generation = _asyncGeneration;
+        fetch->_results    = _asyncResults.get();
+        _asyncService->add( fetch );
+
+        i = _asyncRequests.insert( AsyncRequests::value_type(key, std::vector<AsyncRequest>()) ).first;
+    }
+
+    if ( request )
+        i->second.push_back( *request );
+}
+
+bool
+ElevationQuery::sampleFromCache(const TileKey&  targetKey,
+                                const GeoPoint& mapPoint,
+                                double&         out_elevation,
+                                double&         out_resolution,
+                                TileKey&        out_missingKey)
+{
+    out_missingKey = TileKey::INVALID;
+
+    // Same fallback order as getElevationImpl, but only looks at the cache.
+    // The first tile in the chain that isn't loaded yet is the one to fetch.
+    for( TileKey key = targetKey; key.valid(); key = key.createParentKey() )
+    {
+        TileCache::Record record;
+        if ( _cache.get(key, record) )
+        {
+            const GeoHeightField& geoHF = record.value();
+            float elevation = 0.0f;
+            if ( geoHF.getElevation(mapPoint.getSRS(), mapPoint.x(), mapPoint.y(), _mapf.getMapInfo().getElevationInterpolation(), mapPoint.getSRS(), elevation) &&
+                 elevation != NO_DATA_VALUE )
+            {
+                out_elevation  = (double)elevation;
+                out_resolution = geoHF.getXInterval();
+                return true;
+            }
+        }
+        else if ( !out_missingKey.valid() && _asyncNoData.find(key) == _asyncNoData.end() )
+        {
+            out_missingKey = key;
+        }
+    }
+    return false;
+}
 
 bool
 ElevationQuery::getElevations(std::vector<osg::Vec3d>& points,
@@ -291,6 +551,20 @@ ElevationQuery::getElevations(std::vector<osg::Vec3d>& points,
                               double                   desiredResolution )
 {
     sync();
+
+    if ( _numBulkThreads > 0 && _patchLayers.empty() )
+    {
+        std::vector<double> elevations;
+        std::vector<bool>   valid;
+        getElevationsBulk( points, pointsSRS, elevations, valid, desiredResolution );
+        for( unsigned i=0; i<points.size(); ++i )
+        {
+            if ( valid[i] )
+                points[i].z() = ignoreZ ? elevations[i] : elevations[i] + points[i].z();
+        }
+        return true;
+    }
+
     for( osg::Vec3dArray::iterator i = points.begin(); i != points.end(); ++i )
     {
         double elevation;
@@ -311,6 +585,16 @@ ElevationQuery::getElevations(const std::vector<osg::Vec3d>& points,
                               double                         desiredResolution )
 {
     sync();
+
+    if ( _numBulkThreads > 0 && _patchLayers.empty() )
+    {
+        std::vector<double> elevations;
+        std::vector<bool>   valid;
+        getElevationsBulk( points, pointsSRS, elevations, valid, desiredResolution );
+        out_elevations.insert( out_elevations.end(), elevations.begin(), elevations.end() );
+        return true;
+    }
+
     for( osg::Vec3dArray::const_iterator i = points.begin(); i != points.end(); ++i )
     {
         double elevation;
@@ -328,6 +612,37 @@ ElevationQuery::getElevations(const std::vector<osg::Vec3d>& points,
     return true;
 }
 
+bool
+ElevationQuery::getElevations(const std::vector<osg::Vec3d>& points,
+                              const SpatialReference*        pointsSRS,
+                              std::vector<double>&           out_elevations,
+                              std::vector<bool>&             out_valid,
+                              double                         desiredResolution )
+{
+    sync();
+
+    if ( _numBulkThreads > 0 && _patchLayers.empty() )
+    {
+        return getElevationsBulk( points, pointsSRS, out_elevations, out_valid, desiredResolution );
+    }
+
+    out_elevations.assign( points.size(), 0.0 );
+    out_valid.assign( points.size(), false );
+
+    for( unsigned i=0; i<points.size(); ++i )
+    {
+        double elevation;
+        GeoPoint p(pointsSRS, points[i], ALTMODE_ABSOLUTE);
+
+        if ( getElevationImpl(p, elevation, desiredResolution) )
+        {
+            out_elevations[i] = elevation;
+            out_valid[i]      = true;
+        }
+    }
+    return true;
+}
+
 bool
 ElevationQuery::getElevationImpl(const GeoPoint& point, /* abs */
                                  double&         out_elevation,
@@ -417,39 +732,11 @@ ElevationQuery::getElevationImpl(const GeoPoint& point, /* abs */
         return true;        
     }
 
-    // tile size (resolution of elevation tiles)
-    unsigned tileSize = std::max(_mapf.getMapOptions().elevationTileSize().get(), 2u);
-
-    //This is the max resolution that we actually have data at this point
-    unsigned int bestAvailLevel = getMaxLevel( point.x(), point.y(), point.getSRS(), _mapf.getProfile());
-
-    if (desiredResolution > 0.0)
-    {
-        unsigned int desiredLevel = _mapf.getProfile()->getLevelOfDetailForHorizResolution( desiredResolution, tileSize );
-        if (desiredLevel < bestAvailLevel) bestAvailLevel = desiredLevel;
-    }
-
-    OE_DEBUG << LC << "Best available data level " << point.x() << ", " << point.y() << " = "  << bestAvailLevel << std::endl;
-
-    // transform the input coords to map coords:
-    GeoPoint mapPoint = point;
-    if ( point.isValid() && !point.getSRS()->isHorizEquivalentTo( _mapf.getProfile()->getSRS() ) )
-    {
-        mapPoint = point.transform(_mapf.getProfile()->getSRS());
-        if ( !mapPoint.isValid() )
-        {
-            OE_WARN << LC << "Fail: coord transform failed" << std::endl;
-            return false;
-        }
-    }    
-
-    // get the tilekey corresponding to the tile we need:
-    TileKey key = _mapf.getProfile()->createTileKey( mapPoint.x(), mapPoint.y(), bestAvailLevel );
-    if ( !key.valid() )
-    {
-        OE_WARN << LC << "Fail: coords fall outside map" << std::endl;
+    unsigned tileSize;
+    GeoPoint mapPoint;
+    TileKey  key;
+    if ( !getTargetKey(point, desiredResolution, mapPoint, key, tileSize) )
         return false;
-    }
         
     bool result = false;      
     while (!result)
@@ -464,18 +751,8 @@ ElevationQuery::getElevationImpl(const GeoPoint& point, /* abs */
         else
         {
             // Create it            
-            osg::ref_ptr<osg::HeightField> hf = new osg::HeightField();
-            hf->allocate( tileSize, tileSize );
-
-            // Initialize the heightfield to nodata
-            for (unsigned int i = 0; i < hf->getFloatArray()->size(); i++)
-            {
-                hf->getFloatArray()->at( i ) = NO_DATA_VALUE;
-            }   
-
-            if (_mapf.populateHeightField(hf, key, false))
+            if ( createGeoHeightField(_mapf, key, tileSize, geoHF) )
             {                
-                geoHF = GeoHeightField( hf.get(), key.getExtent() );
                 _cache.insert( key, geoHF );
             }
         }
@@ -517,6 +794,269 @@ ElevationQuery::getElevationImpl(const GeoPoint& point, /* abs */
     return result;
 }
 
+bool
+ElevationQuery::getElevationsBulk(const std::vector<osg::Vec3d>& points,
+                                  const SpatialReference*        pointsSRS,
+                                  std::vector<double>&           out_elevations,
+                                  std::vector<bool>&             out_valid,
+                                  double                         desiredResolution)
+{
+    osg::Timer_t begin = osg::Timer::instance()->tick();
+
+    out_elevations.assign( points.size(), 0.0 );
+    out_valid.assign( points.size(), false );
+
+    if ( _mapf.elevationLayers().empty() )
+    {
+        // this means there are no heightfields.
+        out_valid.assign( points.size(), true );
+        return true;
+    }
+
+    const Profile*          profile  = _mapf.getProfile();
+    const SpatialReference* mapSRS   = profile->getSRS();
+    unsigned                tileSize = std::max(_mapf.getMapOptions().elevationTileSize().get(), 2u);
+
+    unsigned desiredLevel = ~0u;
+    if ( desiredResolution > 0.0 )
+        desiredLevel = profile->getLevelOfDetailForHorizResolution( desiredResolution, tileSize );
+
+    // transform the input coords to map coords, all at once if possible:
+    const SpatialReference* querySRS  = pointsSRS;
+    std::vector<osg::Vec3d> mapPoints ( points );
+    std::vector<bool>       mapped    ( points.size(), true );
+    if ( !pointsSRS || !pointsSRS->isHorizEquivalentTo(mapSRS) )
+    {
+        querySRS = mapSRS;
+        if ( pointsSRS && !pointsSRS->transform(mapPoints, mapSRS) )
+        {
+            // find out which points failed.
+            for( unsigned i=0; i<points.size(); ++i )
+                mapped[i] = pointsSRS->transform( points[i], mapSRS, mapPoints[i] );
+        }
+    }
+
+    // resolve the tile key for each point:
+    std::vector<BulkSample> samples;
+    samples.reserve( points.size() );
+    for( unsigned i=0; i<points.size(); ++i )
+    {
+        if ( !mapped[i] )
+            continue;
+
+        unsigned level = std::min( desiredLevel, getMaxLevel(points[i].x(), points[i].y(), pointsSRS, profile) );
+
+        BulkSample sample;
+        sample._key   = profile->createTileKey( mapPoints[i].x(), mapPoints[i].y(), level );
+        sample._index = i;
+        if ( sample._key.valid() )
+            samples.push_back( sample );
+    }
+
+    ElevationInterpolation interp = _mapf.getMapInfo().getElevationInterpolation();
+
+    typedef std::map<PackedTileKey, GeoHeightField> TileMap;
+
+    // Each pass samples the remaining points; a point with no data in its
+    // tile moves on to the parent tile in the next pass.
+    while( !samples.empty() )
+    {
+        if ( _sortByTile )
+            std::sort( samples.begin(), samples.end() );
+
+        // gather this pass's tiles, and fetch the ones not in the cache in parallel.
+        TileMap tiles;
+        std::vector<TileKey> missing;
+        for( std::vector<BulkSample>::const_iterator i = samples.begin(); i != samples.end(); ++i )
+        {
+            if ( tiles.find(i->_key) != tiles.end() )
+                continue;
+
+            GeoHeightField& geoHF = tiles[i->_key];
+            TileCache::Record record;
+            if ( _cache.get(i->_key, record) )
+                geoHF = record.value();
+            else
+                missing.push_back( i->_key );
+        }
+
+        if ( !missing.empty() && !_bulkService.valid() )
+        {
+            // single-threaded bulk query: fetch in the calling thread.
+            for( std::vector<TileKey>::const_iterator k = missing.begin(); k != missing.end(); ++k )
+            {
+                GeoHeightField geoHF;
+                if ( createGeoHeightField(_mapf, *k, tileSize, geoHF) )
+                {
+                    tiles[*k] = geoHF;
+                    _cache.insert( *k, geoHF );
+                }
+            }
+        }
+        else if ( !missing.empty() )
+        {
+            std::vector< osg::ref_ptr<FetchHeightFieldTask> > tasks;
+            tasks.reserve( missing.size() );
+
+            Threading::MultiEvent semaphore( (int)missing.size() );
+            for( std::vector<TileKey>::const_iterator k = missing.begin(); k != missing.end(); ++k )
+            {
+                FetchHeightFieldTask* task = new FetchHeightFieldTask( &semaphore );
+                task->_mapf     = &_mapf;
+                task->_key      = *k;
+                task->_tileSize = tileSize;
+                tasks.push_back( task );
+                _bulkService->add( task );
+            }
+            semaphore.wait();
+
+            for( unsigned t=0; t<tasks.size(); ++t )
+            {
+                if ( tasks[t]->_result.valid() )
+                {
+                    tiles[tasks[t]->_key] = tasks[t]->_result;
+                    _cache.insert( tasks[t]->_key, tasks[t]->_result );
+                }
+            }
+        }
+
+        // sample the points; sorted points walk each tile in one run.
+        std::vector<BulkSample> retry;
+        std::vector<double>     nx, ny;
+        std::vector<float>      heights;
+        std::vector<unsigned>   runIndices;
+        for( std::vector<BulkSample>::const_iterator run = samples.begin(); run != samples.end(); )
+        {
+            std::vector<BulkSample>::const_iterator runEnd = run;
+            while( runEnd != samples.end() && runEnd->_key == run->_key )
+                ++runEnd;
+
+            TileMap::const_iterator tile = tiles.find( run->_key );
+            const GeoHeightField& geoHF = tile->second;
+
+            runIndices.clear();
+            heights.clear();
+
+            if ( geoHF.valid() && querySRS->isVertEquivalentTo(geoHF.getExtent().getSRS()) )
+            {
+                // same frame as the tile: sample the whole run in one batch.
+                const GeoExtent& ex = geoHF.getExtent();
+                nx.clear();
+                ny.clear();
+                for( std::vector<BulkSample>::const_iterator i = run; i != runEnd; ++i )
+                {
+                    const osg::Vec3d& p = mapPoints[i->_index];
+                    if ( ex.contains(p.x(), p.y()) )
+                    {
+                        nx.push_back( (p.x()-ex.xMin())/ex.width() );
+                        ny.push_back( (p.y()-ex.yMin())/ex.height() );
+                        runIndices.push_back( i->_index );
+                    }
+                    else
+                    {
+                        BulkSample parent;
+                        parent._key   = i->_key.createParentKey();
+                        parent._index = i->_index;
+                        if ( parent._key.valid() )
+                            retry.push_back( parent );
+                    }
+                }
+
+                heights.resize( runIndices.size() );
+                if ( !runIndices.empty() )
+                {
+                    HeightFieldUtils::getHeightsAtNormalizedLocations(
+                        geoHF.getHeightField(), &nx[0], &ny[0], runIndices.size(), &heights[0], interp );
+                }
+            }
+            else
+            {
+                for( std::vector<BulkSample>::const_iterator i = run; i != runEnd; ++i )
+                {
+                    const osg::Vec3d& p = mapPoints[i->_index];
+                    float elevation = NO_DATA_VALUE;
+                    if ( geoHF.valid() )
+                        geoHF.getElevation(querySRS, p.x(), p.y(), interp, querySRS, elevation);
+
+                    runIndices.push_back( i->_index );
+                    heights.push_back( elevation );
+                }
+            }
+
+            for( unsigned j=0; j<runIndices.size(); ++j )
+            {
+                if ( heights[j] != NO_DATA_VALUE )
+                {
+                    out_elevations[runIndices[j]] = (double)heights[j];
+                    out_valid[runIndices[j]]      = true;
+                }
+                else
+                {
+                    BulkSample parent;
+                    parent._key   = run->_key.createParentKey();
+                    parent._index = runIndices[j];
+                    if ( parent._key.valid() )
+                        retry.push_back( parent );
+                }
+            }
+
+            run = runEnd;
+        }
+
+        samples.swap( retry );
+    }
+
+    osg::Timer_t end = osg::Timer::instance()->tick();
+    _queries   += (double)points.size();
+    _totalTime += osg::Timer::instance()->delta_s( begin, end );
+
+    return true;
+}
+
+bool
+ElevationQuery::getTargetKey(const GeoPoint& point, /* abs */
+                             double          desiredResolution,
+                             GeoPoint&       out_mapPoint,
+                             TileKey&        out_key,
+                             unsigned&       out_tileSize) const
+{
+    // tile size (resolution of elevation tiles)
+    out_tileSize = std::max(_mapf.getMapOptions().elevationTileSize().get(), 2u);
+
+    //This is the max resolution that we actually have data at this point
+    unsigned int bestAvailLevel = getMaxLevel( point.x(), point.y(), point.getSRS(), _mapf.getProfile());
+
+    if (desiredResolution > 0.0)
+    {
+        unsigned int desiredLevel = _mapf.getProfile()->getLevelOfDetailForHorizResolution( desiredResolution, out_tileSize );
+        if (desiredLevel < bestAvailLevel) bestAvailLevel = desiredLevel;
+    }
+
+    OE_DEBUG << LC << "Best available data level " << point.x() << ", " << point.y() << " = "  << bestAvailLevel << std::endl;
+
+    // transform the input coords to map coords:
+    out_mapPoint = point;
+    if ( point.isValid() && !point.getSRS()->isHorizEquivalentTo( _mapf.getProfile()->getSRS() ) )
+    {
+        out_mapPoint = point.transform(_mapf.getProfile()->getSRS());
+        if ( !out_mapPoint.isValid() )
+        {
+            OE_WARN << LC << "Fail: coord transform failed" << std::endl;
+            return false;
+        }
+    }    
+
+    // get the tilekey corresponding to the tile we need:
+    out_key = _mapf.getProfile()->createTileKey( out_mapPoint.x(), out_mapPoint.y(), bestAvailLevel );
+    if ( !out_key.valid() )
+    {
+        OE_WARN << LC << "Fail: coords fall outside map" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
 void ElevationQuery::setElevationQueryCacheReadCallback(ElevationQueryCacheReadCallback* eqcrc)
 {
     _eqcrc = eqcrc;
@@ -0,0 +1,343 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarth/FrameStats>
+#include <osgEarth/Profiler>
+#include <osgEarth/ThreadingUtils>
+#include <osg/GL>
+#include <osg/GLExtensions>
+#include <osg/buffered_value>
+
+#ifndef GL_TIME_ELAPSED
+#  define GL_TIME_ELAPSED           0x88BF
+#endif
+#ifndef GL_QUERY_RESULT
+#  define GL_QUERY_RESULT           0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE
+#  define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+
+#if defined(_MSC_VER)
+#  define OE_FRAMESTATS_THREAD_LOCAL __declspec(thread)
+#else
+#  define OE_FRAMESTATS_THREAD_LOCAL __thread
+#endif
+
+#define LC "[FrameStats] "
+
+using namespace osgEarth;
+
+volatile bool FrameStats::s_enabled = false;
+
+namespace
+{
+    // queries in flight per stage and context; results come back a few frames late.
+    const unsigned QUERIES_PER_STAGE = 4u;
+
+    typedef void (GL_APIENTRY * GenQueriesProc)         (GLsizei, GLuint*);
+    typedef void (GL_APIENTRY * BeginQueryProc)         (GLenum, GLuint);
+    typedef void (GL_APIENTRY * EndQueryProc)           (GLenum);
+    typedef void (GL_APIENTRY * GetQueryObjectivProc)   (GLuint, GLenum, GLint*);
+    typedef void (GL_APIENTRY * GetQueryObjectuivProc)  (GLuint, GLenum, GLuint*);
+    typedef void (GL_APIENTRY * GetQueryObjectui64vProc)(GLuint, GLenum, unsigned long long*);
+
+    struct ContextQueries
+    {
+        ContextQueries() : _initialized(false), _supported(false), _active(-1) { }
+
+        bool                    _initialized;
+        bool                    _supported;
+        int                     _active;   // stage with an open query, or -1
+
+        GenQueriesProc          _glGenQueries;
+        BeginQueryProc          _glBeginQuery;
+        EndQueryProc            _glEndQuery;
+        GetQueryObjectivProc    _glGetQueryObjectiv;
+        GetQueryObjectuivProc   _glGetQueryObjectuiv;
+        GetQueryObjectui64vProc _glGetQueryObjectui64v;
+
+        GLuint                  _ids    [FrameStats::NUM_GPU_STAGES][QUERIES_PER_STAGE];
+        bool                    _pending[FrameStats::NUM_GPU_STAGES][QUERIES_PER_STAGE];
+        unsigned                _next   [FrameStats::NUM_GPU_STAGES];
+    };
+
+    osg::buffered_object<ContextQueries> s_contexts;
+
+    // accumulators since the last collect():
+    Threading::Mutex        s_mutex;
+    unsigned long long      s_cull_ns [FrameStats::NUM_CULL_STAGES];
+    unsigned long long      s_gpu_ns  [FrameStats::NUM_GPU_STAGES];
+    bool                    s_gpuValid[FrameStats::NUM_GPU_STAGES];
+    FrameStats::Fetches     s_fetches;
+
+    // innermost open cull timer on this thread
+    OE_FRAMESTATS_THREAD_LOCAL FrameStats::CullTimer* s_currentCull = 0L;
+
+    void initialize(ContextQueries& q, unsigned contextID)
+    {
+        q._initialized = true;
+
+        if ( !osg::isGLExtensionOrVersionSupported(contextID, "GL_ARB_timer_query", 3.3f) &&
+             !osg::isGLExtensionSupported(contextID, "GL_EXT_timer_query") )
+        {
+            OE_INFO << LC << "Timer queries not supported; GPU times disabled" << std::endl;
+            return;
+        }
+
+        osg::setGLExtensionFuncPtr( q._glGenQueries,          "glGenQueries",          "glGenQueriesARB" );
+        osg::setGLExtensionFuncPtr( q._glBeginQuery,          "glBeginQuery",          "glBeginQueryARB" );
+        osg::setGLExtensionFuncPtr( q._glEndQuery,            "glEndQuery",            "glEndQueryARB" );
+        osg::setGLExtensionFuncPtr( q._glGetQueryObjectiv,    "glGetQueryObjectiv",    "glGetQueryObjectivARB" );
+        osg::setGLExtensionFuncPtr( q._glGetQueryObjectuiv,   "glGetQueryObjectuiv",   "glGetQueryObjectuivARB" );
+        osg::setGLExtensionFuncPtr( q._glGetQueryObjectui64v, "glGetQueryObjectui64v", "glGetQueryObjectui64vEXT" );
+
+        q._supported =
+            q._glGenQueries && q._glBeginQuery && q._glEndQuery &&
+            q._glGetQueryObjectiv && (q._glGetQueryObjectui64v || q._glGetQueryObjectuiv);
+
+        if ( q._supported )
+        {
+            for( unsigned s = 0; s < FrameStats::NUM_GPU_STAGES; ++s )
+            {
+                q._glGenQueries( QUERIES_PER_STAGE, q._ids[s] );
+                for( unsigned i = 0; i < QUERIES_PER_STAGE; ++i )
+                    q._pending[s][i] = false;
+                q._next[s] = 0u;
+            }
+        }
+    }
+
+    // gathers whatever results the GPU has finished, without waiting.
+    void harvest(ContextQueries& q)
+    {
+        for( unsigned s = 0; s < FrameStats::NUM_GPU_STAGES; ++s )
+        {
+            for( unsigned i = 0; i < QUERIES_PER_STAGE; ++i )
+            {
+                if ( !q._pending[s][i] )
+                    continue;
+
+                GLint available = 0;
+                q._glGetQueryObjectiv( q._ids[s][i], GL_QUERY_RESULT_AVAILABLE, &available );
+                if ( !available )
+                    continue;
+
+                unsigned long long elapsed = 0ull;
+                if ( q._glGetQueryObjectui64v )
+                {
+                    q._glGetQueryObjectui64v( q._ids[s][i], GL_QUERY_RESULT, &elapsed );
+                }
+                else
+                {
+                    GLuint elapsed32 = 0u;
+                    q._glGetQueryObjectuiv( q._ids[s][i], GL_QUERY_RESULT, &elapsed32 );
+                    elapsed = elapsed32;
+                }
+                q._pending[s][i] = false;
+
+                Threading::ScopedMutexLock lock( s_mutex );
+                s_gpu_ns  [s] += elapsed;
+                s_gpuValid[s]  = true;
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+
+FrameStats::Sample::Sample()
+{
+    for( unsigned i = 0; i < NUM_CULL_STAGES; ++i )
+        _cull_ms[i] = 0.0;
+    for( unsigned i = 0; i < NUM_GPU_STAGES; ++i )
+    {
+        _gpu_ms[i]   = 0.0;
+        _gpuValid[i] = false;
+    }
+}
+
+void
+FrameStats::setEnabled(bool value)
+{
+    if ( value && !s_enabled )
+    {
+        // drop anything left over from an earlier session.
+        Sample discard;
+        collect( discard );
+    }
+    s_enabled = value;
+}
+
+void
+FrameStats::collect(Sample& out)
+{
+    Threading::ScopedMutexLock lock( s_mutex );
+
+    for( unsigned i = 0; i < NUM_CULL_STAGES; ++i )
+    {
+        out._cull_ms[i] = (double)s_cull_ns[i] * 1.0e-6;
+        s_cull_ns[i] = 0ull;
+    }
+
+    for( unsigned i = 0; i < NUM_GPU_STAGES; ++i )
+    {
+        out._gpu_ms  [i] = (double)s_gpu_ns[i] * 1.0e-6;
+        out._gpuValid[i] = s_gpuValid[i];
+        s_gpu_ns  [i] = 0ull;
+        s_gpuValid[i] = false;
+    }
+
+    out._fetches.clear();
+    out._fetches.swap( s_fetches );
+}
+
+const char*
+FrameStats::getName(CullStage stage)
+{
+    switch( stage )
+    {
+    case CULL_TERRAIN:     return "Terrain";
+    case CULL_FEATURES:    return "Features";
+    case CULL_ANNOTATIONS: return "Annotations";
+    case CULL_OVERLAY:     return "Overlay RTT";
+    default:               return "";
+    }
+}
+
+const char*
+FrameStats::getName(GPUStage stage)
+{
+    switch( stage )
+    {
+    case GPU_TERRAIN:   return "Terrain";
+    case GPU_DRAPING:   return "Draping RTT";
+    case GPU_CLAMPING:  return "Clamping capture";
+    case GPU_DECLUTTER: return "Declutter bin";
+    default:            return "";
+    }
+}
+
+//------------------------------------------------------------------------
+
+void
+FrameStats::CullTimer::begin(CullStage stage)
+{
+    unsigned long long now = Profiler::now();
+
+    // pause the enclosing timer so each stage reports exclusive time.
+    _parent = s_currentCull;
+    if ( _parent )
+    {
+        Threading::ScopedMutexLock lock( s_mutex );
+        s_cull_ns[_parent->_stage] += now - _parent->_start;
+    }
+
+    _stage        = stage;
+    _start        = now;
+    _active       = true;
+    s_currentCull = this;
+}
+
+void
+FrameStats::CullTimer::end()
+{
+    unsigned long long now = Profiler::now();
+    {
+        Threading::ScopedMutexLock lock( s_mutex );
+        s_cull_ns[_stage] += now - _start;
+    }
+
+    s_currentCull = _parent;
+    if ( _parent )
+        _parent->_start = now;
+}
+
+//------------------------------------------------------------------------
+
+void
+FrameStats::FetchTimer::begin(const std::string& layerName)
+{
+    _name  = &layerName;
+    _start = Profiler::now();
+}
+
+void
+FrameStats::FetchTimer::end()
+{
+    double t = (double)(Profiler::now() - _start) * 1.0e-9;
+
+    Threading::ScopedMutexLock lock( s_mutex );
+    Fetch& fetch = s_fetches[*_name];
+    fetch._count++;
+    fetch._total_s += t;
+    if ( t > fetch._max_s )
+        fetch._max_s = t;
+}
+
+//------------------------------------------------------------------------
+
+void
+FrameStats::beginGPU(GPUStage stage, osg::RenderInfo& renderInfo)
+{
+    if ( !s_enabled )
+        return;
+
+    unsigned contextID = renderInfo.getContextID();
+    ContextQueries& q = s_contexts[contextID];
+    if ( !q._initialized )
+        initialize( q, contextID );
+
+    // time elapsed queries don't nest; an inner stage (like the terrain drawn
+    // into a clamping capture) counts toward the outer one.
+    if ( !q._supported || q._active >= 0 )
+        return;
+
+    harvest( q );
+
+    unsigned slot = q._next[stage];
+    if ( q._pending[stage][slot] )
+        return; // GPU is too far behind; skip this sample
+
+    q._glBeginQuery( GL_TIME_ELAPSED, q._ids[stage][slot] );
+    q._active = (int)stage;
+}
+
+void
+FrameStats::endGPU(GPUStage stage, osg::RenderInfo& renderInfo)
+{
+    ContextQueries& q = s_contexts[renderInfo.getContextID()];
+    if ( q._active != (int)stage )
+        return;
+
+    q._glEndQuery( GL_TIME_ELAPSED );
+
+    unsigned slot = q._next[stage];
+    q._pending[stage][slot] = true;
+    q._next[stage] = (slot + 1u) % QUERIES_PER_STAGE;
+    q._active = -1;
+}
+
+void
+FrameStats::GPUTimerCallback::operator()(osg::RenderInfo& renderInfo) const
+{
+    if ( _begin )
+        FrameStats::beginGPU( _stage, renderInfo );
+    else
+        FrameStats::endGPU( _stage, renderInfo );
+}
@@ -1582,6 +1582,174 @@ namespace
     }    
 
 
+    /**
+     * Inner loop of manualReproject, templated on the reader and the writer so
+     * the per-sample reads and writes inline for the common image formats.
+     * Walks the output a row at a time, so the writes (and mostly the reads)
+     * are sequential in memory.
+     */
+    struct ReprojectSampler
+    {
+        ReprojectSampler(const osg::Image* image, const GeoExtent& src_extent,
+                         const double* srcPointsX, const double* srcPointsY,
+                         unsigned width, unsigned height,
+                         osg::Image* result) :
+            image(image), src_extent(src_extent),
+            srcPointsX(srcPointsX), srcPointsY(srcPointsY),
+            width(width), height(height), result(result) { }
+
+        const osg::Image*        image;
+        const GeoExtent&         src_extent;
+        const double*            srcPointsX;
+        const double*            srcPointsY;
+        unsigned                 width, height;
+        osg::Image*              result;
+
+        template<typename READER>
+        struct WithReader
+        {
+            WithReader(ReprojectSampler& sampler, const READER& ia) : sampler(sampler), ia(ia) { }
+            ReprojectSampler& sampler;
+            const READER&     ia;
+
+            template<typename WRITER>
+            void operator()(WRITER& writer) { sampler.sample(ia, writer); }
+        };
+
+        template<typename READER>
+        void operator()(const READER& ia)
+        {
+            WithReader<READER> withReader(*this, ia);
+            ImageUtils::dispatchPixelWriter(result, withReader);
+        }
+
+        template<typename READER, typename WRITER>
+        void sample(const READER& ia, WRITER& writer)
+        {
+            double xfac = (image->s() - 1) / src_extent.width();
+            double yfac = (image->t() - 1) / src_extent.height();
+            for (unsigned int r = 0; r < height; ++r)
+            {
+                for (unsigned int c = 0; c < width; ++c)
+                {   
+                    // the source points are column-major (see transformExtentPoints).
+                    unsigned pixel = c*height + r;
+                    double src_x = srcPointsX[pixel];
+                    double src_y = srcPointsY[pixel];
+
+                    if ( src_x < src_extent.xMin() || src_x > src_extent.xMax() || src_y < src_extent.yMin() || src_y > src_extent.yMax() )
+                    {
+                        //If the sample point is outside of the bound of the source extent, keep looping through.
+                        //OE_WARN << LC << "ERROR: sample point out of bounds: " << src_x << ", " << src_y << std::endl;
+                        continue;
+                    }
+
+                    float px = (src_x - src_extent.xMin()) * xfac;
+                    float py = (src_y - src_extent.yMin()) * yfac;
+
+                    int px_i = osg::clampBetween( (int)osg::round(px), 0, image->s()-1 );
+                    int py_i = osg::clampBetween( (int)osg::round(py), 0, image->t()-1 );
+
+                    osg::Vec4 color(0,0,0,0);
+
+                    // TODO: consider this again later. Causes blockiness.
+                    if ( false ) //! isSrcContiguous ) // non-contiguous space- use nearest neighbot
+                    {
+                        color = ia(px_i, py_i);
+                    }
+
+                    else // contiguous space - use bilinear sampling
+                    {
+                        int rowMin = osg::maximum((int)floor(py), 0);
+                        int rowMax = osg::maximum(osg::minimum((int)ceil(py), (int)(image->t()-1)), 0);
+                        int colMin = osg::maximum((int)floor(px), 0);
+                        int colMax = osg::maximum(osg::minimum((int)ceil(px), (int)(image->s()-1)), 0);
+
+                        if (rowMin > rowMax) rowMin = rowMax;
+                        if (colMin > colMax) colMin = colMax;
+
+                        osg::Vec4 urColor = ia(colMax, rowMax);
+                        osg::Vec4 llColor = ia(colMin, rowMin);
+                        osg::Vec4 ulColor = ia(colMin, rowMax);
+                        osg::Vec4 lrColor = ia(colMax, rowMin);
+
+                        /*Average Interpolation*/
+                        /*double x_rem = px - (int)px;
+                        double y_rem = py - (int)py;
+
+                        double w00 = (1.0 - y_rem) * (1.0 - x_rem);
+                        double w01 = (1.0 - y_rem) * x_rem;
+                        double w10 = y_rem * (1.0 - x_rem);
+                        double w11 = y_rem * x_rem;
+                        double wsum = w00 + w01 + w10 + w11;
+                        wsum = 1.0/wsum;
+
+                        color.r() = (w00 * llColor.r() + w01 * lrColor.r() + w10 * ulColor.r() + w11 * urColor.r()) * wsum;
+                        color.g() = (w00 * llColor.g() + w01 * lrColor.g() + w10 * ulColor.g() + w11 * urColor.g()) * wsum;
+                        color.b() = (w00 * llColor.b() + w01 * lrColor.b() + w10 * ulColor.b() + w11 * urColor.b()) * wsum;
+                        color.a() = (w00 * llColor.a() + w01 * lrColor.a() + w10 * ulColor.a() + w11 * urColor.a()) * wsum;*/
+
+                        /*Nearest Neighbor Interpolation*/
+                        /*if (px_i >= 0 && px_i < image->s() &&
+                        py_i >= 0 && py_i < image->t())
+                        {
+                        //OE_NOTICE << "[osgEarth::GeoData] Sampling pixel " << px << "," << py << std::endl;
+                        color = ImageUtils::getColor(image, px_i, py_i);
+                        }
+                        else
+                        {
+                        OE_NOTICE << "[osgEarth::GeoData] Pixel out of range " << px_i << "," << py_i << "  image is " << image->s() << "x" << image->t() << std::endl;
+                        }*/
+
+                        /*Bilinear interpolation*/
+                        //Check for exact value
+                        if ((colMax == colMin) && (rowMax == rowMin))
+                        {
+                            //OE_NOTICE << "[osgEarth::GeoData] Exact value" << std::endl;
+                            color = ia(px_i, py_i);
+                        }
+                        else if (colMax == colMin)
+                        {
+                            //OE_NOTICE << "[osgEarth::GeoData] Vertically" << std::endl;
+                            //Linear interpolate vertically
+                            for (unsigned int i = 0; i < 4; ++i)
+                            {
+                                color[i] = ((float)rowMax - py) * llColor[i] + (py - (float)rowMin) * ulColor[i];
+                            }
+                        }
+                        else if (rowMax == rowMin)
+                        {
+                            //OE_NOTICE << "[osgEarth::GeoData] Horizontally" << std::endl;
+                            //Linear interpolate horizontally
+                            for (unsigned int i = 0; i < 4; ++i)
+                            {
+                                color[i] = ((float)colMax - px) * llColor[i] + (px - (float)colMin) * lrColor[i];
+                            }
+                        }
+                        else
+                        {
+                            //OE_NOTICE << "[osgEarth::GeoData] Bilinear" << std::endl;
+                            //Bilinear interpolate
+                            float col1 = colMax - px, col2 = px - colMin;
+                            float row1 = rowMax - py, row2 = py - rowMin;
+                            for (unsigned int i = 0; i < 4; ++i)
+                            {
+                                float r1 = col1 * llColor[i] + col2 * lrColor[i];
+                                float r2 = col1 * ulColor[i] + col2 * urColor[i];
+
+                                //OE_INFO << "r1, r2 = " << r1 << " , " << r2 << std::endl;
+                                color[i] = row1 * r1 + row2 * r2;
+                            }
+                        }
+                    }
+
+                    writer(color, c, r);
+                }
+            }
+        }
+    };
+
+
     osg::Image*
     manualReproject(
         const osg::Image* image, 
@@ -1608,8 +1776,6 @@ namespace
         //Initialize the image to be completely transparent/black
         memset(result->data(), 0, result->getImageSizeInBytes());
 
-        //ImageUtils::PixelReader ra(result);
-        ImageUtils::PixelWriter writer(result);
         const double dx = dest_extent.width() / (double)width;
         const double dy = dest_extent.height() / (double)height;
 
@@ -1622,138 +1788,25 @@ namespace
         // Start by creating a sample grid over the destination
         // extent. These will be the source coordinates. Then, reproject
         // the sample grid into the source coordinate system.
+        // An approximation within 1/8 of a source pixel is as good as exact
+        // for sampling, and costs a small fraction of the transforms.
+        double tolerance = 0.125 * osg::minimum(
+            src_extent.width()  / (double)image->s(),
+            src_extent.height() / (double)image->t() );
+
         double *srcPointsX = new double[numPixels * 2];
         double *srcPointsY = srcPointsX + numPixels;
-        dest_extent.getSRS()->transformExtentPoints(
+        dest_extent.getSRS()->transformExtentPointsApprox(
             src_extent.getSRS(),
             dest_extent.xMin() + .5 * dx, dest_extent.yMin() + .5 * dy,
             dest_extent.xMax() - .5 * dx, dest_extent.yMax() - .5 * dy,
-            srcPointsX, srcPointsY, width, height);
+            srcPointsX, srcPointsY, width, height,
+            tolerance );
 
         // Next, go through the source-SRS sample grid, read the color at each point from the source image,
         // and write it to the corresponding pixel in the destination image.
-        int pixel = 0;
-        ImageUtils::PixelReader ia(image);
-        double xfac = (image->s() - 1) / src_extent.width();
-        double yfac = (image->t() - 1) / src_extent.height();
-        for (unsigned int c = 0; c < width; ++c)
-        {
-            for (unsigned int r = 0; r < height; ++r)
-            {   
-                double src_x = srcPointsX[pixel];
-                double src_y = srcPointsY[pixel];
-
-                if ( src_x < src_extent.xMin() || src_x > src_extent.xMax() || src_y < src_extent.yMin() || src_y > src_extent.yMax() )
-                {
-                    //If the sample point is outside of the bound of the source extent, increment the pixel and keep looping through.
-                    //OE_WARN << LC << "ERROR: sample point out of bounds: " << src_x << ", " << src_y << std::endl;
-                    pixel++;
-                    continue;
-                }
-
-                float px = (src_x - src_extent.xMin()) * xfac;
-                float py = (src_y - src_extent.yMin()) * yfac;
-
-                int px_i = osg::clampBetween( (int)osg::round(px), 0, image->s()-1 );
-                int py_i = osg::clampBetween( (int)osg::round(py), 0, image->t()-1 );
-
-                osg::Vec4 color(0,0,0,0);
-
-                // TODO: consider this again later. Causes blockiness.
-                if ( false ) //! isSrcContiguous ) // non-contiguous space- use nearest neighbot
-                {
-                    color = ia(px_i, py_i);
-                }
-
-                else // contiguous space - use bilinear sampling
-                {
-                    int rowMin = osg::maximum((int)floor(py), 0);
-                    int rowMax = osg::maximum(osg::minimum((int)ceil(py), (int)(image->t()-1)), 0);
-                    int colMin = osg::maximum((int)floor(px), 0);
-                    int colMax = osg::maximum(osg::minimum((int)ceil(px), (int)(image->s()-1)), 0);
-
-                    if (rowMin > rowMax) rowMin = rowMax;
-                    if (colMin > colMax) colMin = colMax;
-
-                    osg::Vec4 urColor = ia(colMax, rowMax);
-                    osg::Vec4 llColor = ia(colMin, rowMin);
-                    osg::Vec4 ulColor = ia(colMin, rowMax);
-                    osg::Vec4 lrColor = ia(colMax, rowMin);
-
-                    /*Average Interpolation*/
-                    /*double x_rem = px - (int)px;
-                    double y_rem = py - (int)py;
-
-                    double w00 = (1.0 - y_rem) * (1.0 - x_rem);
-                    double w01 = (1.0 - y_rem) * x_rem;
-                    double w10 = y_rem * (1.0 - x_rem);
-                    double w11 = y_rem * x_rem;
-                    double wsum = w00 + w01 + w10 + w11;
-                    wsum = 1.0/wsum;
-
-                    color.r() = (w00 * llColor.r() + w01 * lrColor.r() + w10 * ulColor.r() + w11 * urColor.r()) * wsum;
-                    color.g() = (w00 * llColor.g() + w01 * lrColor.g() + w10 * ulColor.g() + w11 * urColor.g()) * wsum;
-                    color.b() = (w00 * llColor.b() + w01 * lrColor.b() + w10 * ulColor.b() + w11 * urColor.b()) * wsum;
-                    color.a() = (w00 * llColor.a() + w01 * lrColor.a() + w10 * ulColor.a() + w11 * urColor.a()) * wsum;*/
-
-                    /*Nearest Neighbor Interpolation*/
-                    /*if (px_i >= 0 && px_i < image->s() &&
-                    py_i >= 0 && py_i < image->t())
-                    {
-                    //OE_NOTICE << "[osgEarth::GeoData] Sampling pixel " << px << "," << py << std::endl;
-                    color = ImageUtils::getColor(image, px_i, py_i);
-                    }
-                    else
-                    {
-                    OE_NOTICE << "[osgEarth::GeoData] Pixel out of range " << px_i << "," << py_i << "  image is " << image->s() << "x" << image->t() << std::endl;
-                    }*/
-
-                    /*Bilinear interpolation*/
-                    //Check for exact value
-                    if ((colMax == colMin) && (rowMax == rowMin))
-                    {
-                        //OE_NOTICE << "[osgEarth::GeoData] Exact value" << std::endl;
-                        color = ia(px_i, py_i);
-                    }
-                    else if (colMax == colMin)
-                    {
-                        //OE_NOTICE << "[osgEarth::GeoData] Vertically" << std::endl;
-                        //Linear interpolate vertically
-                        for (unsigned int i = 0; i < 4; ++i)
-                        {
-                            color[i] = ((float)rowMax - py) * llColor[i] + (py - (float)rowMin) * ulColor[i];
-                        }
-                    }
-                    else if (rowMax == rowMin)
-                    {
-                        //OE_NOTICE << "[osgEarth::GeoData] Horizontally" << std::endl;
-                        //Linear interpolate horizontally
-                        for (unsigned int i = 0; i < 4; ++i)
-                        {
-                            color[i] = ((float)colMax - px) * llColor[i] + (px - (float)colMin) * lrColor[i];
-                        }
-                    }
-                    else
-                    {
-                        //OE_NOTICE << "[osgEarth::GeoData] Bilinear" << std::endl;
-                        //Bilinear interpolate
-                        float col1 = colMax - px, col2 = px - colMin;
-                        float row1 = rowMax - py, row2 = py - rowMin;
-                        for (unsigned int i = 0; i < 4; ++i)
-                        {
-                            float r1 = col1 * llColor[i] + col2 * lrColor[i];
-                            float r2 = col1 * ulColor[i] + col2 * urColor[i];
-
-                            //OE_INFO << "r1, r2 = " << r1 << " , " << r2 << std::endl;
-                            color[i] = row1 * r1 + row2 * r2;
-                        }
-                    }
-                }
-
-                writer(color, c, r);
-                pixel++;
-            }
-        }
+        ReprojectSampler sampler(image, src_extent, srcPointsX, srcPointsY, width, height, result);
+        ImageUtils::dispatchPixelReader(image, sampler);
 
         delete[] srcPointsX;
 
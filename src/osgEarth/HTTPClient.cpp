@@ -1,1390 +1,2621 @@
-/* -*-c++-*- */
-/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
- * Copyright 2008-2014 Pelican Mapping
- * http://osgearth.org
- *
- * osgEarth is free software; you can redistribute it and/or modify
- * it under the terms of the GNU Lesser General Public License as published by
- * the Free Software Foundation; either version 2 of the License, or
- * (at your option) any later version.
- *
- * This program is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU Lesser General Public License for more details.
- *
- * You should have received a copy of the GNU Lesser General Public License
- * along with this program.  If not, see <http://www.gnu.org/licenses/>
- */
-#include <osgEarth/HTTPClient>
-#include <osgEarth/Registry>
-#include <osgEarth/Version>
-#include <osgEarth/Progress>
-#include <osgEarth/StringUtils>
-#include <osgDB/ReadFile>
-#include <osgDB/Registry>
-#include <osgDB/FileNameUtils>
-#include <osg/Notify>
-#include <osg/Timer>
-#include <string.h>
-#include <sstream>
-#include <fstream>
-#include <iterator>
-#include <iostream>
-#include <algorithm>
-#include <curl/curl.h>
-
-#define LC "[HTTPClient] "
-
-//#define OE_TEST OE_NOTICE
-#define OE_TEST OE_NULL
-
-using namespace osgEarth;
-
-//----------------------------------------------------------------------------
-
-ProxySettings::ProxySettings( const Config& conf )
-{
-    mergeConfig( conf );
-}
-
-ProxySettings::ProxySettings( const std::string& host, int port ) :
-_hostName(host),
-_port(port)
-{
-    //nop
-}
-
-void
-ProxySettings::mergeConfig( const Config& conf )
-{
-    _hostName = conf.value<std::string>( "host", "" );
-    _port = conf.value<int>( "port", 8080 );
-    _userName = conf.value<std::string>( "username", "" );
-    _password = conf.value<std::string>( "password", "" );
-}
-
-Config
-ProxySettings::getConfig() const
-{
-    Config conf( "proxy" );
-    conf.add( "host", _hostName );
-    conf.add( "port", toString(_port) );
-    conf.add( "username", _userName);
-    conf.add( "password", _password);
-
-    return conf;
-}
-
-bool
-ProxySettings::fromOptions( const osgDB::Options* dbOptions, optional<ProxySettings>& out )
-{
-    if ( dbOptions )
-    {
-        std::string jsonString = dbOptions->getPluginStringData( "osgEarth::ProxySettings" );
-        if ( !jsonString.empty() )
-        {
-            Config conf;
-            conf.fromJSON( jsonString );
-            out = ProxySettings( conf );
-            return true;
-        }
-    }
-    return false;
-}
-
-void
-ProxySettings::apply( osgDB::Options* dbOptions ) const
-{
-    if ( dbOptions )
-    {
-        Config conf = getConfig();
-        dbOptions->setPluginStringData( "osgEarth::ProxySettings", conf.toJSON() );
-    }
-}
-
-/****************************************************************************/
-   
-namespace osgEarth
-{
-    struct StreamObject
-    {
-        StreamObject(std::ostream* stream) : _stream(stream) { }
-
-        void write(const char* ptr, size_t realsize)
-        {
-            if (_stream) _stream->write(ptr, realsize);
-        }
-
-        void writeHeader(const char* ptr, size_t realsize)
-        {            
-            std::string header(ptr);            
-            StringTokenizer tok(":");
-            StringVector tized;
-            tok.tokenize(header, tized);            
-            if ( tized.size() >= 2 )
-                _headers[tized[0]] = tized[1];                
-        }
-
-        std::ostream* _stream;
-        Headers _headers;
-        std::string     _resultMimeType;
-    };
-
-    static size_t
-    StreamObjectReadCallback(void* ptr, size_t size, size_t nmemb, void* data)
-    {
-        size_t realsize = size* nmemb;
-        StreamObject* sp = (StreamObject*)data;
-        sp->write((const char*)ptr, realsize);
-        return realsize;
-    }
-
-    static size_t
-    StreamObjectHeaderCallback(void* ptr, size_t size, size_t nmemb, void* data)
-    {
-        size_t realsize = size* nmemb;
-        StreamObject* sp = (StreamObject*)data;                
-        sp->writeHeader((const char*)ptr, realsize);        
-        return realsize;
-    }
-
-    TimeStamp
-    getCurlFileTime(void* curl)
-    {
-        long filetime;
-        if (CURLE_OK != curl_easy_getinfo(curl, CURLINFO_FILETIME, &filetime))
-            return TimeStamp(0);
-        else if (filetime < 0)
-            return TimeStamp(0);
-        else
-            return TimeStamp(filetime);
-    }
-}
-
-static int CurlProgressCallback(void *clientp,double dltotal,double dlnow,double ultotal,double ulnow)
-{
-    ProgressCallback* callback = (ProgressCallback*)clientp;
-    bool cancelled = false;
-    if (callback)
-    {
-        cancelled = callback->isCanceled() || callback->reportProgress(dlnow, dltotal);
-    }
-    return cancelled;
-}
-
-/****************************************************************************/
-
-HTTPRequest::HTTPRequest( const std::string& url )
-: _url( url )
-{
-    //NOP
-}
-
-HTTPRequest::HTTPRequest( const HTTPRequest& rhs ) :
-_parameters( rhs._parameters ),
-_headers(rhs._headers),
-_url( rhs._url )
-{
-    //nop
-}
-
-void
-HTTPRequest::addParameter( const std::string& name, const std::string& value )
-{
-    _parameters[name] = value;
-}
-
-void
-HTTPRequest::addParameter( const std::string& name, int value )
-{
-    std::stringstream buf;
-    buf << value;
-     std::string bufStr;
-    bufStr = buf.str();
-    _parameters[name] = bufStr;
-}
-
-void
-HTTPRequest::addParameter( const std::string& name, double value )
-{
-    std::stringstream buf;
-    buf << value;
-     std::string bufStr;
-    bufStr = buf.str();
-    _parameters[name] = bufStr;
-}
-
-const HTTPRequest::Parameters&
-HTTPRequest::getParameters() const
-{
-    return _parameters; 
-}
-
-void
-HTTPRequest::addHeader( const std::string& name, const std::string& value )
-{
-    _headers[name] = value;
-}
-
-const Headers&
-HTTPRequest::getHeaders() const
-{
-    return _headers; 
-}
-
-void HTTPRequest::setLastModified( const DateTime &lastModified)
-{    
-    addHeader("If-Modified-Since", lastModified.asRFC1123());
-}
-
-
-std::string
-HTTPRequest::getURL() const
-{
-    if ( _parameters.size() == 0 )
-    {
-        return _url;
-    }
-    else
-    {
-        std::stringstream buf;
-        buf << _url;
-        for( Parameters::const_iterator i = _parameters.begin(); i != _parameters.end(); i++ )
-        {
-            buf << ( i == _parameters.begin() && _url.find( "?" ) == std::string::npos? "?" : "&" );
-            buf << i->first << "=" << i->second;
-        }
-         std::string bufStr;
-         bufStr = buf.str();
-        return bufStr;
-    }
-}
-
-/****************************************************************************/
-
-HTTPResponse::HTTPResponse( long _code )
-: _response_code( _code ),
-  _cancelled(false)
-{
-    _parts.reserve(1);
-}
-
-HTTPResponse::HTTPResponse( const HTTPResponse& rhs ) :
-_response_code( rhs._response_code ),
-_parts( rhs._parts ),
-_mimeType( rhs._mimeType ),
-_cancelled( rhs._cancelled )
-{
-    //nop
-}
-
-unsigned
-HTTPResponse::getCode() const {
-    return _response_code;
-}
-
-bool
-HTTPResponse::isOK() const {
-    return _response_code == 200L && !isCancelled();
-}
-
-bool
-HTTPResponse::isCancelled() const {
-    return _cancelled;
-}
-
-unsigned int
-HTTPResponse::getNumParts() const {
-    return _parts.size();
-}
-
-unsigned int
-HTTPResponse::getPartSize( unsigned int n ) const {
-    return _parts[n]->_size;
-}
-
-const std::string&
-HTTPResponse::getPartHeader( unsigned int n, const std::string& name ) const {
-    return _parts[n]->_headers[name];
-}
-
-std::istream&
-HTTPResponse::getPartStream( unsigned int n ) const {
-    return _parts[n]->_stream;
-}
-
-std::string
-HTTPResponse::getPartAsString( unsigned int n ) const {
-     std::string streamStr;
-     streamStr = _parts[n]->_stream.str();
-    return streamStr;
-}
-
-const std::string&
-HTTPResponse::getMimeType() const {
-    return _mimeType;
-}
-
-Config
-HTTPResponse::getHeadersAsConfig() const
-{
-    Config conf;
-    if ( _parts.size() > 0 )
-    {
-        for( Headers::const_iterator i = _parts[0]->_headers.begin(); i != _parts[0]->_headers.end(); ++i )
-        {
-            conf.set(i->first, i->second);
-        }
-    }
-    return conf;
-}
-
-/****************************************************************************/
-
-#define QUOTE_(X) #X
-#define QUOTE(X) QUOTE_(X)
-#define USER_AGENT "osgearth" QUOTE(OSGEARTH_MAJOR_VERSION) "." QUOTE(OSGEARTH_MINOR_VERSION)
-
-
-namespace
-{
-    // TODO: consider moving this stuff into the osgEarth::Registry;
-    // don't like it here in the global scope
-    // per-thread client map (must be global scope)
-    static Threading::PerThread<HTTPClient> s_clientPerThread;
-
-    static optional<ProxySettings>     s_proxySettings;
-
-    static std::string                 s_userAgent = USER_AGENT;
-
-    static long                        s_timeout = 0;
-    static long                        s_connectTimeout = 0;
-
-    // HTTP debugging.
-    static bool                        s_HTTP_DEBUG = false;
-    static Threading::Mutex            s_HTTP_DEBUG_mutex;
-    static int                         s_HTTP_DEBUG_request_count;
-    static double                      s_HTTP_DEBUG_total_duration;
-
-    static osg::ref_ptr< URLRewriter > s_rewriter;
-
-    static osg::ref_ptr< CurlConfigHandler > s_curlConfigHandler;
-}
-
-HTTPClient&
-HTTPClient::getClient()
-{
-    return s_clientPerThread.get();
-}
-
-HTTPClient::HTTPClient() :
-_initialized    ( false ),
-_curl_handle    ( 0L ),
-_simResponseCode( -1L )
-{
-    //nop
-    //do no CURL calls here.
-}
-
-void
-HTTPClient::initialize() const
-{
-    if ( !_initialized )
-    {
-        const_cast<HTTPClient*>(this)->initializeImpl();
-    }
-}
-
-void
-HTTPClient::initializeImpl()
-{
-    _previousHttpAuthentication = 0;
-    _curl_handle = curl_easy_init();
-
-    //Get the user agent
-    std::string userAgent = s_userAgent;
-    const char* userAgentEnv = getenv("OSGEARTH_USERAGENT");
-    if (userAgentEnv)
-    {
-        userAgent = std::string(userAgentEnv);
-    }
-
-    //Check for a response-code simulation (for testing)
-    const char* simCode = getenv("OSGEARTH_SIMULATE_HTTP_RESPONSE_CODE");
-    if ( simCode )
-    {
-        _simResponseCode = osgEarth::as<long>(std::string(simCode), 404L);
-        OE_WARN << LC << "Simulating a network error with Response Code = " << _simResponseCode << std::endl;
-    }
-
-    // Dumps out HTTP request/response info
-    if ( ::getenv("OSGEARTH_HTTP_DEBUG") )
-    {
-        s_HTTP_DEBUG = true;
-        OE_WARN << LC << "HTTP debugging enabled" << std::endl;
-    }
-
-    OE_DEBUG << LC << "HTTPClient setting userAgent=" << userAgent << std::endl;
-
-    curl_easy_setopt( _curl_handle, CURLOPT_USERAGENT, userAgent.c_str() );
-    curl_easy_setopt( _curl_handle, CURLOPT_WRITEFUNCTION, osgEarth::StreamObjectReadCallback );
-    curl_easy_setopt( _curl_handle, CURLOPT_HEADERFUNCTION, osgEarth::StreamObjectHeaderCallback );
-    curl_easy_setopt( _curl_handle, CURLOPT_FOLLOWLOCATION, (void*)1 );
-    curl_easy_setopt( _curl_handle, CURLOPT_MAXREDIRS, (void*)5 );
-    curl_easy_setopt( _curl_handle, CURLOPT_PROGRESSFUNCTION, &CurlProgressCallback);
-    curl_easy_setopt( _curl_handle, CURLOPT_NOPROGRESS, (void*)0 ); //0=enable.
-    curl_easy_setopt( _curl_handle, CURLOPT_FILETIME, true );
-
-    osg::ref_ptr< CurlConfigHandler > curlConfigHandler = getCurlConfigHandler();
-    if (curlConfigHandler.valid()) {
-        curlConfigHandler->onInitialize(_curl_handle);
-    }
-
-    long timeout = s_timeout;
-    const char* timeoutEnv = getenv("OSGEARTH_HTTP_TIMEOUT");
-    if (timeoutEnv)
-    {
-        timeout = osgEarth::as<long>(std::string(timeoutEnv), 0);
-    }
-    OE_DEBUG << LC << "Setting timeout to " << timeout << std::endl;
-    curl_easy_setopt( _curl_handle, CURLOPT_TIMEOUT, timeout );
-    long connectTimeout = s_connectTimeout;
-    const char* connectTimeoutEnv = getenv("OSGEARTH_HTTP_CONNECTTIMEOUT");
-    if (connectTimeoutEnv)
-    {
-        connectTimeout = osgEarth::as<long>(std::string(connectTimeoutEnv), 0);
-    }
-    OE_DEBUG << LC << "Setting connect timeout to " << connectTimeout << std::endl;
-    curl_easy_setopt( _curl_handle, CURLOPT_CONNECTTIMEOUT, connectTimeout );
-
-    _initialized = true;
-}
-
-HTTPClient::~HTTPClient()
-{
-    if (_curl_handle) curl_easy_cleanup( _curl_handle );
-    _curl_handle = 0;
-}
-
-void
-HTTPClient::setProxySettings( const ProxySettings& proxySettings )
-{
-    s_proxySettings = proxySettings;
-}
-
-const std::string& HTTPClient::getUserAgent()
-{
-    return s_userAgent;
-}
-
-void  HTTPClient::setUserAgent(const std::string& userAgent)
-{
-    s_userAgent = userAgent;
-}
-
-long HTTPClient::getTimeout()
-{
-    return s_timeout;
-}
-
-void HTTPClient::setTimeout( long timeout )
-{
-    s_timeout = timeout;
-}
-
-long HTTPClient::getConnectTimeout()
-{
-    return s_connectTimeout;
-}
-
-void HTTPClient::setConnectTimeout( long timeout )
-{
-    s_connectTimeout = timeout;
-}
-URLRewriter* HTTPClient::getURLRewriter()
-{
-    return s_rewriter.get();
-}
-
-void HTTPClient::setURLRewriter( URLRewriter* rewriter )
-{
-    s_rewriter = rewriter;
-}
-
-CurlConfigHandler* HTTPClient::getCurlConfigHandler()
-{
-    return s_curlConfigHandler.get();
-}
-
-void HTTPClient::setCurlConfighandler(CurlConfigHandler* handler)
-{
-    s_curlConfigHandler = handler;
-}
-
-void
-HTTPClient::globalInit()
-{
-    curl_global_init(CURL_GLOBAL_ALL);
-}
-
-void
-HTTPClient::readOptions(const osgDB::Options* options, std::string& proxy_host, std::string& proxy_port) const
-{
-    // try to set proxy host/port by reading the CURL proxy options
-    if ( options )
-    {
-        std::istringstream iss( options->getOptionString() );
-        std::string opt;
-        while( iss >> opt )
-        {
-            int index = opt.find( "=" );
-            if( opt.substr( 0, index ) == "OSG_CURL_PROXY" )
-            {
-                proxy_host = opt.substr( index+1 );
-            }
-            else if ( opt.substr( 0, index ) == "OSG_CURL_PROXYPORT" )
-            {
-                proxy_port = opt.substr( index+1 );
-            }
-        }
-    }
-}
-
-bool
-HTTPClient::decodeMultipartStream(const std::string&   boundary,
-                                  HTTPResponse::Part*  input,
-                                  HTTPResponse::Parts& output) const
-{
-    std::string bstr = std::string("--") + boundary;
-    std::string line;
-    char tempbuf[256];
-
-    // first thing in the stream should be the boundary.
-    input->_stream.read( tempbuf, bstr.length() );
-    tempbuf[bstr.length()] = 0;
-    line = tempbuf;
-    if ( line != bstr )
-    {
-        OE_INFO << LC 
-            << "decodeMultipartStream: protocol violation; "
-            << "expecting boundary; instead got: \"" 
-            << line
-            << "\"" << std::endl;
-        return false;
-    }
-
-    for( bool done=false; !done; )
-    {
-        osg::ref_ptr<HTTPResponse::Part> next_part = new HTTPResponse::Part();
-
-        // first finish off the boundary.
-        std::getline( input->_stream, line );
-        if ( line == "--" )
-        {
-            done = true;
-        }
-        else
-        {
-            // read all headers. this ends with a blank line.
-            line = " ";
-            while( line.length() > 0 && !done )
-            {
-                std::getline( input->_stream, line );
-
-                // check for EOS:
-                if ( line == "--" )
-                {
-                    done = true;
-                }
-                else
-                {                    
-                    StringTokenizer tok(":");
-                    StringVector tized;
-                    tok.tokenize(line, tized);            
-                    if ( tized.size() >= 2 )
-                        next_part->_headers[tized[0]] = tized[1];                        
-                }
-            }
-        }
-
-        if ( !done )
-        {
-            // read data until we reach the boundary
-            unsigned int bstr_ptr = 0;
-            std::string temp;
-            //unsigned int c = 0;
-            while( bstr_ptr < bstr.length() )
-            {
-                char b;
-                input->_stream.read( &b, 1 );
-                if ( b == bstr[bstr_ptr] )
-                {
-                    bstr_ptr++;
-                }
-                else
-                {
-                    for( unsigned int i=0; i<bstr_ptr; i++ )
-                    {
-                        next_part->_stream << bstr[i];
-                    }
-                    next_part->_stream << b;
-                    next_part->_size += bstr_ptr + 1;
-                    bstr_ptr = 0;
-                }
-            }
-            output.push_back( next_part.get() );
-        }
-    }
-
-    return true;
-}
-
-HTTPResponse
-HTTPClient::get( const HTTPRequest&    request,
-                 const osgDB::Options* options,
-                 ProgressCallback*     progress)
-{
-    return getClient().doGet( request, options, progress );
-}
-
-HTTPResponse 
-HTTPClient::get( const std::string&    url,
-                 const osgDB::Options* options,
-                 ProgressCallback*     progress)
-{
-    return getClient().doGet( url, options, progress);
-}
-
-ReadResult
-HTTPClient::readImage(const HTTPRequest&    request,
-                      const osgDB::Options* options,
-                      ProgressCallback*     progress)
-{
-    return getClient().doReadImage( request, options, progress );
-}
-
-ReadResult
-HTTPClient::readNode(const HTTPRequest&    request,
-                     const osgDB::Options* options,
-                     ProgressCallback*     progress)
-{
-    return getClient().doReadNode( request, options, progress );
-}
-
-ReadResult
-HTTPClient::readObject(const HTTPRequest&    request,
-                       const osgDB::Options* options,
-                       ProgressCallback*     progress)
-{
-    return getClient().doReadObject( request, options, progress );
-}
-
-ReadResult
-HTTPClient::readString(const HTTPRequest&    request,
-                       const osgDB::Options* options,
-                       ProgressCallback*     progress)
-{
-    return getClient().doReadString( request, options, progress );
-}
-
-bool
-HTTPClient::download(const std::string& uri,
-                     const std::string& localPath)
-{
-    return getClient().doDownload( uri, localPath );
-}
-
-HTTPResponse
-HTTPClient::doGet(const HTTPRequest&    request,
-                  const osgDB::Options* options, 
-                  ProgressCallback*     progress) const
-{    
-    initialize();
-
-    OE_START_TIMER(http_get);
-
-    const osgDB::AuthenticationMap* authenticationMap = (options && options->getAuthenticationMap()) ? 
-            options->getAuthenticationMap() :
-            osgDB::Registry::instance()->getAuthenticationMap();
-
-    std::string proxy_host;
-    std::string proxy_port = "8080";
-
-    std::string proxy_auth;
-
-    //TODO: don't do all this proxy setup on every GET. Just do it once per client, or only when 
-    // the proxy information changes.
-
-    //Try to get the proxy settings from the global settings
-    if (s_proxySettings.isSet())
-    {
-        proxy_host = s_proxySettings.get().hostName();
-        std::stringstream buf;
-        buf << s_proxySettings.get().port();
-        proxy_port = buf.str();
-
-        std::string proxy_username = s_proxySettings.get().userName();
-        std::string proxy_password = s_proxySettings.get().password();
-        if (!proxy_username.empty() && !proxy_password.empty())
-        {
-            proxy_auth = proxy_username + std::string(":") + proxy_password;
-        }
-    }
-
-    //Try to get the proxy settings from the local options that are passed in.
-    readOptions( options, proxy_host, proxy_port );
-
-    optional< ProxySettings > proxySettings;
-    ProxySettings::fromOptions( options, proxySettings );
-    if (proxySettings.isSet())
-    {       
-        proxy_host = proxySettings.get().hostName();
-        proxy_port = toString<int>(proxySettings.get().port());
-        OE_DEBUG << LC << "Read proxy settings from options " << proxy_host << " " << proxy_port << std::endl;
-    }
-
-    //Try to get the proxy settings from the environment variable
-    const char* proxyEnvAddress = getenv("OSG_CURL_PROXY");
-    if (proxyEnvAddress) //Env Proxy Settings
-    {
-        proxy_host = std::string(proxyEnvAddress);
-
-        const char* proxyEnvPort = getenv("OSG_CURL_PROXYPORT"); //Searching Proxy Port on Env
-        if (proxyEnvPort)
-        {
-            proxy_port = std::string( proxyEnvPort );
-        }
-    }
-
-    const char* proxyEnvAuth = getenv("OSGEARTH_CURL_PROXYAUTH");
-    if (proxyEnvAuth)
-    {
-        proxy_auth = std::string(proxyEnvAuth);
-    }
-
-    // Set up proxy server:
-    std::string proxy_addr;
-    if ( !proxy_host.empty() )
-    {
-        std::stringstream buf;
-        buf << proxy_host << ":" << proxy_port;
-        std::string bufStr;
-        bufStr = buf.str();
-        proxy_addr = bufStr;
-    
-        if ( s_HTTP_DEBUG )
-        {
-            OE_NOTICE << LC << "Using proxy: " << proxy_addr << std::endl;
-        }
-
-        //curl_easy_setopt( _curl_handle, CURLOPT_HTTPPROXYTUNNEL, 1 ); 
-        curl_easy_setopt( _curl_handle, CURLOPT_PROXY, proxy_addr.c_str() );
-
-        //Setup the proxy authentication if setup
-        if (!proxy_auth.empty())
-        {
-            if ( s_HTTP_DEBUG )
-            {
-                OE_NOTICE << LC << "Using proxy authentication " << proxy_auth << std::endl;
-            }
-
-            curl_easy_setopt( _curl_handle, CURLOPT_PROXYUSERPWD, proxy_auth.c_str());
-        }
-    }
-    else
-    {
-        OE_DEBUG << LC << "Removing proxy settings" << std::endl;
-        curl_easy_setopt( _curl_handle, CURLOPT_PROXY, 0 );
-    }
-
-    std::string url = request.getURL();
-    // Rewrite the url if the url rewriter is available  
-    osg::ref_ptr< URLRewriter > rewriter = getURLRewriter();
-    if ( rewriter.valid() )
-    {
-        std::string oldURL = url;
-        url = rewriter->rewrite( oldURL );
-        OE_INFO << LC << "Rewrote URL " << oldURL << " to " << url << std::endl;
-    }
-
-    const osgDB::AuthenticationDetails* details = authenticationMap ?
-        authenticationMap->getAuthenticationDetails( url ) :
-        0;
-
-    if (details)
-    {
-        const std::string colon(":");
-        std::string password(details->username + colon + details->password);
-        curl_easy_setopt(_curl_handle, CURLOPT_USERPWD, password.c_str());
-        const_cast<HTTPClient*>(this)->_previousPassword = password;
-
-        // use for https.
-        // curl_easy_setopt(_curl, CURLOPT_KEYPASSWD, password.c_str());
-
-#if LIBCURL_VERSION_NUM >= 0x070a07
-        if (details->httpAuthentication != _previousHttpAuthentication)
-        { 
-            curl_easy_setopt(_curl_handle, CURLOPT_HTTPAUTH, details->httpAuthentication); 
-            const_cast<HTTPClient*>(this)->_previousHttpAuthentication = details->httpAuthentication;
-        }
-#endif
-    }
-    else
-    {
-        if (!_previousPassword.empty())
-        {
-            curl_easy_setopt(_curl_handle, CURLOPT_USERPWD, 0);
-            const_cast<HTTPClient*>(this)->_previousPassword.clear();
-        }
-
-#if LIBCURL_VERSION_NUM >= 0x070a07
-        // need to reset if previously set.
-        if (_previousHttpAuthentication!=0)
-        {
-            curl_easy_setopt(_curl_handle, CURLOPT_HTTPAUTH, 0); 
-            const_cast<HTTPClient*>(this)->_previousHttpAuthentication = 0;
-        }
-#endif
-    }
-
-
-    // Set any headers
-    struct curl_slist *headers=NULL;
-    if (!request.getHeaders().empty())
-    {
-        for (HTTPRequest::Parameters::const_iterator itr = request.getHeaders().begin(); itr != request.getHeaders().end(); ++itr)
-        {
-            std::stringstream buf;
-            buf << itr->first << ": " << itr->second;
-            headers = curl_slist_append(headers, buf.str().c_str());
-        }
-    }    
-
-    // Disable the default Pragma: no-cache that curl adds by default.
-    headers = curl_slist_append(headers, "Pragma: ");
-    curl_easy_setopt(_curl_handle, CURLOPT_HTTPHEADER, headers);
-    
-    osg::ref_ptr<HTTPResponse::Part> part = new HTTPResponse::Part();
-    StreamObject sp( &part->_stream );
-
-    //Take a temporary ref to the callback (why? dangerous.)
-    //osg::ref_ptr<ProgressCallback> progressCallback = callback;
-    curl_easy_setopt( _curl_handle, CURLOPT_URL, url.c_str() );
-    if (progress)
-    {
-        curl_easy_setopt(_curl_handle, CURLOPT_PROGRESSDATA, progress);
-    }
-
-    CURLcode res;
-    long response_code = 0L;
-
-    OE_START_TIMER(get_duration);
-
-    if ( _simResponseCode < 0 )
-    {
-        char errorBuf[CURL_ERROR_SIZE];
-        errorBuf[0] = 0;
-        curl_easy_setopt( _curl_handle, CURLOPT_ERRORBUFFER, (void*)errorBuf );
-        curl_easy_setopt( _curl_handle, CURLOPT_WRITEDATA, (void*)&sp);
-        curl_easy_setopt( _curl_handle, CURLOPT_HEADERDATA, (void*)&sp);
-
-        //Disable peer certificate verification to allow us to access in https servers where the peer certificate cannot be verified.
-        curl_easy_setopt( _curl_handle, CURLOPT_SSL_VERIFYPEER, (void*)0 );
-        
-        osg::ref_ptr< CurlConfigHandler > curlConfigHandler = getCurlConfigHandler();
-        if (curlConfigHandler.valid()) {
-            curlConfigHandler->onGet(_curl_handle);
-        }
-
-        res = curl_easy_perform(_curl_handle);
-        curl_easy_setopt( _curl_handle, CURLOPT_WRITEDATA, (void*)0 );
-        curl_easy_setopt( _curl_handle, CURLOPT_PROGRESSDATA, (void*)0);
-
-        if (!proxy_addr.empty())
-        {
-            long connect_code = 0L;
-            CURLcode r = curl_easy_getinfo(_curl_handle, CURLINFO_HTTP_CONNECTCODE, &connect_code);
-            if ( r != CURLE_OK )
-            {
-                OE_WARN << LC << "Proxy connect error: " << curl_easy_strerror(r) << std::endl;
-                return HTTPResponse(0);
-            }
-        }
-
-        curl_easy_getinfo( _curl_handle, CURLINFO_RESPONSE_CODE, &response_code );        
-    }
-    else
-    {
-        // simulate failure with a custom response code
-        response_code = _simResponseCode;
-        res = response_code == 408 ? CURLE_OPERATION_TIMEDOUT : CURLE_COULDNT_CONNECT;
-    }
-
-    HTTPResponse response( response_code );    
-    
-    // read the response content type:
-    char* content_type_cp;
-
-    curl_easy_getinfo( _curl_handle, CURLINFO_CONTENT_TYPE, &content_type_cp );    
-
-    if ( content_type_cp != NULL )
-    {
-        response._mimeType = content_type_cp;    
-    } 
-
-    // upon success, parse the data:
-    if ( res != CURLE_ABORTED_BY_CALLBACK && res != CURLE_OPERATION_TIMEDOUT )
-    {        
-        // check for multipart content
-        if (response._mimeType.length() > 9 && 
-            ::strstr( response._mimeType.c_str(), "multipart" ) == response._mimeType.c_str() )
-        {
-            OE_DEBUG << LC << "detected multipart data; decoding..." << std::endl;
-
-            //TODO: parse out the "wcs" -- this is WCS-specific
-            if ( !decodeMultipartStream( "wcs", part.get(), response._parts ) )
-            {
-                // error decoding an invalid multipart stream.
-                // should we do anything, or just leave the response empty?
-            }
-        }
-        else
-        {            
-            for (Headers::iterator itr = sp._headers.begin(); itr != sp._headers.end(); ++itr)
-            {                
-                part->_headers[itr->first] = itr->second;                
-            }
-
-            // Write the headers to the metadata
-            response._parts.push_back( part.get() );
-        }
-    }
-    else  /*if (res == CURLE_ABORTED_BY_CALLBACK || res == CURLE_OPERATION_TIMEDOUT) */
-    {        
-        //If we were aborted by a callback, then it was cancelled by a user
-        response._cancelled = true;
-    }
-
-    response._duration_s = OE_STOP_TIMER(get_duration);
-
-    if ( progress )
-    {
-        progress->stats()["http_get_time"] += OE_STOP_TIMER(http_get);
-        progress->stats()["http_get_count"] += 1;
-        if ( response._cancelled )
-            progress->stats()["http_cancel_count"] += 1;
-    }
-
-    if ( s_HTTP_DEBUG )
-    {
-        TimeStamp filetime = getCurlFileTime(_curl_handle);
-
-        OE_NOTICE << LC 
-            << "GET(" << response_code << ", " << response._mimeType << ") : \"" 
-            << url << "\" (" << DateTime(filetime).asRFC1123() << ") t="
-            << std::setprecision(4) << response.getDuration() << "s" << std::endl;
-
-        {
-            Threading::ScopedMutexLock lock(s_HTTP_DEBUG_mutex);
-            s_HTTP_DEBUG_request_count++;
-            s_HTTP_DEBUG_total_duration += response.getDuration();
-
-            if ( s_HTTP_DEBUG_request_count % 60 == 0 )
-            {
-                OE_NOTICE << LC << "Average duration = " << s_HTTP_DEBUG_total_duration/(double)s_HTTP_DEBUG_request_count
-                    << std::endl;
-            }
-        }
-
-#if 0
-        // time details - almost 100% of the time is spent in
-        // STARTTRANSFER, which is the time until the first byte is received.
-        double td[7];
-
-        curl_easy_getinfo(_curl_handle, CURLINFO_TOTAL_TIME,         &td[0]);
-        curl_easy_getinfo(_curl_handle, CURLINFO_NAMELOOKUP_TIME,    &td[1]);
-        curl_easy_getinfo(_curl_handle, CURLINFO_CONNECT_TIME,       &td[2]);
-        curl_easy_getinfo(_curl_handle, CURLINFO_APPCONNECT_TIME,    &td[3]);
-        curl_easy_getinfo(_curl_handle, CURLINFO_PRETRANSFER_TIME,   &td[4]);
-        curl_easy_getinfo(_curl_handle, CURLINFO_STARTTRANSFER_TIME, &td[5]);
-        curl_easy_getinfo(_curl_handle, CURLINFO_REDIRECT_TIME,      &td[6]);
-
-        for(int i=0; i<7; ++i)
-        {
-            OE_NOTICE << LC
-                << std::setprecision(4)
-                << "TIMES: total=" <<td[0]
-                << ", lookup=" <<td[1]<<" ("<<(int)((td[1]/td[0])*100)<<"%)"
-                << ", connect=" <<td[2]<<" ("<<(int)((td[2]/td[0])*100)<<"%)"
-                << ", appconn=" <<td[3]<<" ("<<(int)((td[3]/td[0])*100)<<"%)"
-                << ", prexfer=" <<td[4]<<" ("<<(int)((td[4]/td[0])*100)<<"%)"
-                << ", startxfer=" <<td[5]<<" ("<<(int)((td[5]/td[0])*100)<<"%)"
-                << ", redir=" <<td[6]<<" ("<<(int)((td[6]/td[0])*100)<<"%)"
-                << std::endl;
-        }
-#endif
-
-        // Free the headers
-        if (headers)
-        {
-            curl_slist_free_all(headers);
-        }
-    }
-
-    return response;
-}
-
-bool
-HTTPClient::doDownload(const std::string& url, const std::string& filename)
-{
-    initialize();
-
-    // download the data
-    HTTPResponse response = this->doGet( HTTPRequest(url) );
-
-    if ( response.isOK() )
-    {
-        unsigned int part_num = response.getNumParts() > 1? 1 : 0;
-        std::istream& input_stream = response.getPartStream( part_num );
-
-        std::ofstream fout;
-        fout.open(filename.c_str(), std::ios::out | std::ios::binary);
-
-        input_stream.seekg (0, std::ios::end);
-        int length = input_stream.tellg();
-        input_stream.seekg (0, std::ios::beg);
-
-        char *buffer = new char[length];
-        input_stream.read(buffer, length);
-        fout.write(buffer, length);
-        delete[] buffer;
-        fout.close();
-        return true;
-    }
-    else
-    {
-        OE_WARN << LC << "Error downloading file " << filename
-            << " (" << response.getCode() << ")" << std::endl;
-        return false;
-    } 
-}
-
-namespace
-{
-    osgDB::ReaderWriter*
-    getReader( const std::string& url, const HTTPResponse& response )
-    {        
-        osgDB::ReaderWriter* reader = 0L;
-
-        // try extension first:
-        std::string ext = osgDB::getFileExtension( url );
-        if ( !ext.empty() )
-        {
-            reader = osgDB::Registry::instance()->getReaderWriterForExtension( ext );
-        }
-
-        if ( !reader )
-        {
-            // try to look up a reader by mime-type first:
-            std::string mimeType = response.getMimeType();
-            if ( !mimeType.empty() )
-            {
-                reader = osgDB::Registry::instance()->getReaderWriterForMimeType(mimeType);
-            }
-        }
-
-        if ( !reader && s_HTTP_DEBUG )
-        {
-            OE_WARN << LC << "Cannot find an OSG plugin to read response data (ext="
-                << ext << "; mime-type=" << response.getMimeType()
-                << ")" << std::endl;
-
-            if ( endsWith(response.getMimeType(), "xml", false) )
-            {
-                OE_WARN << LC << "Content:\n" << response.getPartAsString(0) << "\n";
-            }
-        }
-
-        return reader;
-    }
-}
-
-ReadResult
-HTTPClient::doReadImage(const HTTPRequest&    request,
-                        const osgDB::Options* options,
-                        ProgressCallback*     callback)
-{
-    initialize();
-
-    ReadResult result;
-
-    HTTPResponse response = this->doGet(request, options, callback);
-
-    if (response.isOK())
-    {
-        osgDB::ReaderWriter* reader = getReader(request.getURL(), response);
-        if (!reader)
-        {            
-            result = ReadResult(ReadResult::RESULT_NO_READER);
-        }
-
-        else 
-        {
-            osgDB::ReaderWriter::ReadResult rr = reader->readImage(response.getPartStream(0), options);
-            if ( rr.validImage() )
-            {
-                result = ReadResult(rr.takeImage());
-            }
-            else 
-            {
-                if ( s_HTTP_DEBUG )
-                {
-                    OE_WARN << LC << reader->className() 
-                        << " failed to read image from " << request.getURL() 
-                        << "; message = " << rr.message()
-                        <<  std::endl;
-                }
-                result = ReadResult(ReadResult::RESULT_READER_ERROR);
-                result.setErrorDetail( rr.message() );
-            }
-        }
-        
-        // last-modified (file time)
-        result.setLastModifiedTime( getCurlFileTime(_curl_handle) );
-        
-        // Time of query
-        result.setDuration( response.getDuration() );
-    }
-    else
-    {
-        result = ReadResult(
-            response.isCancelled()                           ? ReadResult::RESULT_CANCELED :
-            response.getCode() == HTTPResponse::NOT_FOUND    ? ReadResult::RESULT_NOT_FOUND :
-            response.getCode() == HTTPResponse::SERVER_ERROR ? ReadResult::RESULT_SERVER_ERROR :
-            response.getCode() == HTTPResponse::NOT_MODIFIED ? ReadResult::RESULT_NOT_MODIFIED :
-                                                               ReadResult::RESULT_UNKNOWN_ERROR );
-
-        //If we have an error but it's recoverable, like a server error or timeout then set the callback to retry.
-        if (HTTPClient::isRecoverable( result.code() ) )
-        {            
-            if (callback)
-            {
-                if ( s_HTTP_DEBUG )
-                {
-                    OE_NOTICE << LC << "Error in HTTPClient for " << request.getURL() << " but it's recoverable" << std::endl;
-                }
-                callback->setNeedsRetry( true );
-            }
-        }        
-    }
-
-    // encode headers
-    result.setMetadata( response.getHeadersAsConfig() );
-
-    // set the source name
-    if ( result.getImage() )
-        result.getImage()->setName( request.getURL() );
-
-    return result;
-}
-
-ReadResult
-HTTPClient::doReadNode(const HTTPRequest&    request,
-                       const osgDB::Options* options,
-                       ProgressCallback*     callback)
-{
-    initialize();
-
-    ReadResult result;
-
-    HTTPResponse response = this->doGet(request, options, callback);
-
-    if (response.isOK())
-    {
-        osgDB::ReaderWriter* reader = getReader(request.getURL(), response);
-        if (!reader)
-        {
-            result = ReadResult(ReadResult::RESULT_NO_READER);
-        }
-
-        else 
-        {
-            osgDB::ReaderWriter::ReadResult rr = reader->readNode(response.getPartStream(0), options);
-            if ( rr.validNode() )
-            {
-                result = ReadResult(rr.takeNode());
-            }
-            else 
-            {
-                if ( s_HTTP_DEBUG )
-                {
-                    OE_WARN << LC << reader->className() 
-                        << " failed to read node from " << request.getURL() 
-                        << "; message = " << rr.message()
-                        <<  std::endl;
-                }
-                result = ReadResult(ReadResult::RESULT_READER_ERROR);
-                result.setErrorDetail( rr.message() );
-            }
-        }
-        
-        // last-modified (file time)
-        result.setLastModifiedTime( getCurlFileTime(_curl_handle) );
-    }
-    else
-    {
-        result = ReadResult(
-            response.isCancelled()                           ? ReadResult::RESULT_CANCELED :
-            response.getCode() == HTTPResponse::NOT_FOUND    ? ReadResult::RESULT_NOT_FOUND :
-            response.getCode() == HTTPResponse::SERVER_ERROR ? ReadResult::RESULT_SERVER_ERROR :
-            response.getCode() == HTTPResponse::NOT_MODIFIED ? ReadResult::RESULT_NOT_MODIFIED :
-                                                               ReadResult::RESULT_UNKNOWN_ERROR );
-
-        //If we have an error but it's recoverable, like a server error or timeout then set the callback to retry.
-        if (HTTPClient::isRecoverable( result.code() ) )
-        {
-            if (callback)
-            {
-                if ( s_HTTP_DEBUG )
-                {
-                    OE_NOTICE << LC << "Error in HTTPClient for " << request.getURL() << " but it's recoverable" << std::endl;
-                }
-                callback->setNeedsRetry( true );
-            }
-        }
-    }
-
-    // encode headers
-    result.setMetadata( response.getHeadersAsConfig() );
-
-    return result;
-}
-
-ReadResult
-HTTPClient::doReadObject(const HTTPRequest&    request,
-                         const osgDB::Options* options,
-                         ProgressCallback*     callback)
-{
-    initialize();
-
-    ReadResult result;
-
-    HTTPResponse response = this->doGet(request, options, callback);
-
-    if (response.isOK())
-    {
-        osgDB::ReaderWriter* reader = getReader(request.getURL(), response);
-        if (!reader)
-        {
-            result = ReadResult(ReadResult::RESULT_NO_READER);
-        }
-
-        else 
-        {
-            osgDB::ReaderWriter::ReadResult rr = reader->readObject(response.getPartStream(0), options);
-            if ( rr.validObject() )
-            {
-                result = ReadResult(rr.takeObject());
-            }
-            else 
-            {
-                if ( s_HTTP_DEBUG )
-                {
-                    OE_WARN << LC << reader->className() 
-                        << " failed to read object from " << request.getURL() 
-                        << "; message = " << rr.message()
-                        <<  std::endl;
-                }
-                result = ReadResult(ReadResult::RESULT_READER_ERROR);
-                result.setErrorDetail( rr.message() );
-            }
-        }
-        
-        // last-modified (file time)
-        result.setLastModifiedTime( getCurlFileTime(_curl_handle) );
-    }
-    else
-    {
-        result = ReadResult(
-            response.isCancelled() ? ReadResult::RESULT_CANCELED :
-            response.getCode() == HTTPResponse::NOT_FOUND ? ReadResult::RESULT_NOT_FOUND :
-            response.getCode() == HTTPResponse::SERVER_ERROR ? ReadResult::RESULT_SERVER_ERROR :
-            response.getCode() == HTTPResponse::NOT_MODIFIED ? ReadResult::RESULT_NOT_MODIFIED :
-            ReadResult::RESULT_UNKNOWN_ERROR );
-
-        //If we have an error but it's recoverable, like a server error or timeout then set the callback to retry.
-        if (HTTPClient::isRecoverable( result.code() ) )
-        {
-            if (callback)
-            {
-                if ( s_HTTP_DEBUG )
-                {
-                    OE_NOTICE << LC << "Error in HTTPClient for " << request.getURL() << " but it's recoverable" << std::endl;
-                }
-                callback->setNeedsRetry( true );
-            }
-        }
-    }
-
-    result.setMetadata( response.getHeadersAsConfig() );
-
-    return result;
-}
-
-
-ReadResult
-HTTPClient::doReadString(const HTTPRequest&    request,
-                         const osgDB::Options* options,
-                         ProgressCallback*     callback )
-{
-    initialize();
-
-    ReadResult result;
-
-    HTTPResponse response = this->doGet( request, options, callback );
-    if ( response.isOK() )
-    {
-        result = ReadResult( new StringObject(response.getPartAsString(0)) );
-    }
-
-    else if ( response.getCode() >= 400 && response.getCode() < 500 && response.getCode() != 404 )
-    {
-        // for request errors, return an error result with the part data intact
-        // so the user can parse it as needed. We only do this for readString.
-        result = ReadResult( 
-            ReadResult::RESULT_SERVER_ERROR,
-            new StringObject(response.getPartAsString(0)) );
-    }
-
-    else
-    {
-        result = ReadResult(
-            response.isCancelled() ?                           ReadResult::RESULT_CANCELED :
-            response.getCode() == HTTPResponse::NOT_FOUND    ? ReadResult::RESULT_NOT_FOUND :
-            response.getCode() == HTTPResponse::SERVER_ERROR ? ReadResult::RESULT_SERVER_ERROR :
-            response.getCode() == HTTPResponse::NOT_MODIFIED ? ReadResult::RESULT_NOT_MODIFIED :
-                                                               ReadResult::RESULT_UNKNOWN_ERROR );
-
-        //If we have an error but it's recoverable, like a server error or timeout then set the callback to retry.
-        if (HTTPClient::isRecoverable( result.code() ) )
-        {            
-            if (callback)
-            {
-                if ( s_HTTP_DEBUG )
-                {
-                    OE_NOTICE << LC << "Error in HTTPClient for " << request.getURL() << " but it's recoverable" << std::endl;
-                }
-                callback->setNeedsRetry( true );
-            }
-        }
-    }
-
-    // encode headers
-    result.setMetadata( response.getHeadersAsConfig() );
-
-    // last-modified (file time)
-    result.setLastModifiedTime( getCurlFileTime(_curl_handle) );
-
-    return result;
-}
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/HTTPClient>
+#include <osgEarth/ImageDecoder>
+#include <osgEarth/Registry>
+#include <osgEarth/Version>
+#include <osgEarth/Progress>
+#include <osgEarth/StringUtils>
+#include <osgEarth/Profiler>
+#include <osgEarth/FileUtils>
+#include <osgDB/ReadFile>
+#include <osgDB/Registry>
+#include <osgDB/FileNameUtils>
+#include <osg/Notify>
+#include <osg/Math>
+#include <osg/Timer>
+#include <OpenThreads/Condition>
+#include <OpenThreads/Thread>
+#include <string.h>
+#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <list>
+#include <cstdio>
+#include <curl/curl.h>
+
+#define LC "[HTTPClient] "
+
+//#define OE_TEST OE_NOTICE
+#define OE_TEST OE_NULL
+
+using namespace osgEarth;
+
+//----------------------------------------------------------------------------
+
+ProxySettings::ProxySettings( const Config& conf )
+{
+    mergeConfig( conf );
+}
+
+ProxySettings::ProxySettings( const std::string& host, int port ) :
+_hostName(host),
+_port(port)
+{
+    //nop
+}
+
+void
+ProxySettings::mergeConfig( const Config& conf )
+{
+    _hostName = conf.value<std::string>( "host", "" );
+    _port = conf.value<int>( "port", 8080 );
+    _userName = conf.value<std::string>( "username", "" );
+    _password = conf.value<std::string>( "password", "" );
+}
+
+Config
+ProxySettings::getConfig() const
+{
+    Config conf( "proxy" );
+    conf.add( "host", _hostName );
+    conf.add( "port", toString(_port) );
+    conf.add( "username", _userName);
+    conf.add( "password", _password);
+
+    return conf;
+}
+
+bool
+ProxySettings::fromOptions( const osgDB::Options* dbOptions, optional<ProxySettings>& out )
+{
+    if ( dbOptions )
+    {
+        std::string jsonString = dbOptions->getPluginStringData( "osgEarth::ProxySettings" );
+        if ( !jsonString.empty() )
+        {
+            Config conf;
+            conf.fromJSON( jsonString );
+            out = ProxySettings( conf );
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+ProxySettings::apply( osgDB::Options* dbOptions ) const
+{
+    if ( dbOptions )
+    {
+        Config conf = getConfig();
+        dbOptions->setPluginStringData( "osgEarth::ProxySettings", conf.toJSON() );
+    }
+}
+
+HTTPConnectionSettings::HTTPConnectionSettings( const Config& conf ) :
+_http2                ( true ),
+_maxConnectionsPerHost( 6u ),
+_maxStreamsPerHost    ( 100u ),
+_compression          ( true )
+{
+    mergeConfig( conf );
+}
+
+void
+HTTPConnectionSettings::mergeConfig( const Config& conf )
+{
+    conf.getIfSet( "http2",                    _http2 );
+    conf.getIfSet( "max_connections_per_host", _maxConnectionsPerHost );
+    conf.getIfSet( "max_streams_per_host",     _maxStreamsPerHost );
+    conf.getIfSet( "compression",              _compression );
+}
+
+Config
+HTTPConnectionSettings::getConfig() const
+{
+    Config conf( "http" );
+    conf.updateIfSet( "http2",                    _http2 );
+    conf.updateIfSet( "max_connections_per_host", _maxConnectionsPerHost );
+    conf.updateIfSet( "max_streams_per_host",     _maxStreamsPerHost );
+    conf.updateIfSet( "compression",              _compression );
+    return conf;
+}
+
+unsigned
+HTTPConnectionSettings::getMaxRequestsPerHost() const
+{
+    unsigned connections = _maxConnectionsPerHost.get();
+    if ( connections == 0u )
+        return 0u;
+
+    if ( _http2 == true )
+    {
+        unsigned streams = _maxStreamsPerHost.get();
+        return streams == 0u ? 0u : connections * streams;
+    }
+
+    return connections;
+}
+
+HTTPReplaySettings::HTTPReplaySettings( const Config& conf ) :
+_mode              ( MODE_OFF ),
+_useRecordedLatency( true ),
+_latencyScale      ( 1.0 ),
+_latencyMS         ( 0.0 ),
+_jitterMS          ( 0.0 ),
+_bandwidthKBps     ( 0.0 ),
+_errorRate         ( 0.0 ),
+_errorCode         ( 503u ),
+_seed              ( 0u ),
+_networkFallback   ( false ),
+_asyncConcurrency  ( 8u )
+{
+    mergeConfig( conf );
+}
+
+void
+HTTPReplaySettings::mergeConfig( const Config& conf )
+{
+    conf.getIfSet( "mode", "off",    _mode, MODE_OFF );
+    conf.getIfSet( "mode", "record", _mode, MODE_RECORD );
+    conf.getIfSet( "mode", "replay", _mode, MODE_REPLAY );
+    conf.getIfSet( "path",                 _path );
+    conf.getIfSet( "use_recorded_latency", _useRecordedLatency );
+    conf.getIfSet( "latency_scale",        _latencyScale );
+    conf.getIfSet( "latency_ms",           _latencyMS );
+    conf.getIfSet( "jitter_ms",            _jitterMS );
+    conf.getIfSet( "bandwidth_kbps",       _bandwidthKBps );
+    conf.getIfSet( "error_rate",           _errorRate );
+    conf.getIfSet( "error_code",           _errorCode );
+    conf.getIfSet( "seed",                 _seed );
+    conf.getIfSet( "network_fallback",     _networkFallback );
+    conf.getIfSet( "async_concurrency",    _asyncConcurrency );
+}
+
+Config
+HTTPReplaySettings::getConfig() const
+{
+    Config conf( "http_replay" );
+    conf.updateIfSet( "mode", "off",    _mode, MODE_OFF );
+    conf.updateIfSet( "mode", "record", _mode, MODE_RECORD );
+    conf.updateIfSet( "mode", "replay", _mode, MODE_REPLAY );
+    conf.updateIfSet( "path",                 _path );
+    conf.updateIfSet( "use_recorded_latency", _useRecordedLatency );
+    conf.updateIfSet( "latency_scale",        _latencyScale );
+    conf.updateIfSet( "latency_ms",           _latencyMS );
+    conf.updateIfSet( "jitter_ms",            _jitterMS );
+    conf.updateIfSet( "bandwidth_kbps",       _bandwidthKBps );
+    conf.updateIfSet( "error_rate",           _errorRate );
+    conf.updateIfSet( "error_code",           _errorCode );
+    conf.updateIfSet( "seed",                 _seed );
+    conf.updateIfSet( "network_fallback",     _networkFallback );
+    conf.updateIfSet( "async_concurrency",    _asyncConcurrency );
+    return conf;
+}
+
+/****************************************************************************/
+   
+namespace osgEarth
+{
+    struct StreamObject
+    {
+        StreamObject(std::ostream* stream) : _stream(stream) { }
+
+        void write(const char* ptr, size_t realsize)
+        {
+            if (_stream) _stream->write(ptr, realsize);
+        }
+
+        void writeHeader(const char* ptr, size_t realsize)
+        {            
+            // split on the first colon only; values like Last-Modified contain
+            // colons of their own, and ETags must keep their quotes.
+            std::string header(ptr, realsize);
+            std::string::size_type colon = header.find(':');
+            if ( colon != std::string::npos && colon > 0 )
+                _headers[trim(header.substr(0, colon))] = trim(header.substr(colon+1));
+        }
+
+        std::ostream* _stream;
+        Headers _headers;
+        std::string     _resultMimeType;
+    };
+
+    static size_t
+    StreamObjectReadCallback(void* ptr, size_t size, size_t nmemb, void* data)
+    {
+        size_t realsize = size* nmemb;
+        StreamObject* sp = (StreamObject*)data;
+        sp->write((const char*)ptr, realsize);
+        return realsize;
+    }
+
+    static size_t
+    StreamObjectHeaderCallback(void* ptr, size_t size, size_t nmemb, void* data)
+    {
+        size_t realsize = size* nmemb;
+        StreamObject* sp = (StreamObject*)data;                
+        sp->writeHeader((const char*)ptr, realsize);        
+        return realsize;
+    }
+
+    TimeStamp
+    getCurlFileTime(void* curl)
+    {
+        long filetime;
+        if (CURLE_OK != curl_easy_getinfo(curl, CURLINFO_FILETIME, &filetime))
+            return TimeStamp(0);
+        else if (filetime < 0)
+            return TimeStamp(0);
+        else
+            return TimeStamp(filetime);
+    }
+}
+
+static int CurlProgressCallback(void *clientp,double dltotal,double dlnow,double ultotal,double ulnow)
+{
+    ProgressCallback* callback = (ProgressCallback*)clientp;
+    bool cancelled = false;
+    if (callback)
+    {
+        cancelled = callback->isCanceled() || callback->reportProgress(dlnow, dltotal);
+    }
+    return cancelled;
+}
+
+/****************************************************************************/
+
+HTTPRequest::HTTPRequest( const std::string& url )
+: _url( url )
+{
+    //NOP
+}
+
+HTTPRequest::HTTPRequest( const HTTPRequest& rhs ) :
+_parameters( rhs._parameters ),
+_headers(rhs._headers),
+_url( rhs._url )
+{
+    //nop
+}
+
+void
+HTTPRequest::addParameter( const std::string& name, const std::string& value )
+{
+    _parameters[name] = value;
+}
+
+void
+HTTPRequest::addParameter( const std::string& name, int value )
+{
+    std::stringstream buf;
+    buf << value;
+     std::string bufStr;
+    bufStr = buf.str();
+    _parameters[name] = bufStr;
+}
+
+void
+HTTPRequest::addParameter( const std::string& name, double value )
+{
+    std::stringstream buf;
+    buf << value;
+     std::string bufStr;
+    bufStr = buf.str();
+    _parameters[name] = bufStr;
+}
+
+const HTTPRequest::Parameters&
+HTTPRequest::getParameters() const
+{
+    return _parameters; 
+}
+
+void
+HTTPRequest::addHeader( const std::string& name, const std::string& value )
+{
+    _headers[name] = value;
+}
+
+const Headers&
+HTTPRequest::getHeaders() const
+{
+    return _headers; 
+}
+
+void HTTPRequest::setLastModified( const DateTime &lastModified)
+{    
+    addHeader("If-Modified-Since", lastModified.asRFC1123());
+}
+
+void HTTPRequest::setETag( const std::string& etag )
+{
+    if ( etag.empty() )
+        return;
+
+    // ETags are quoted strings; older cache records stored them unquoted.
+    if ( etag[0] == '"' || startsWith(etag, "W/") )
+        addHeader("If-None-Match", etag);
+    else
+        addHeader("If-None-Match", "\"" + etag + "\"");
+}
+
+
+std::string
+HTTPRequest::getURL() const
+{
+    if ( _parameters.size() == 0 )
+    {
+        return _url;
+    }
+    else
+    {
+        std::stringstream buf;
+        buf << _url;
+        for( Parameters::const_iterator i = _parameters.begin(); i != _parameters.end(); i++ )
+        {
+            buf << ( i == _parameters.begin() && _url.find( "?" ) == std::string::npos? "?" : "&" );
+            buf << i->first << "=" << i->second;
+        }
+         std::string bufStr;
+         bufStr = buf.str();
+        return bufStr;
+    }
+}
+
+/****************************************************************************/
+
+HTTPResponse::HTTPResponse( long _code )
+: _response_code( _code ),
+  _cancelled(false),
+  _duration_s(0.0),
+  _lastModified(0)
+{
+    _parts.reserve(1);
+}
+
+HTTPResponse::HTTPResponse( const HTTPResponse& rhs ) :
+_response_code( rhs._response_code ),
+_parts( rhs._parts ),
+_mimeType( rhs._mimeType ),
+_cancelled( rhs._cancelled ),
+_duration_s( rhs._duration_s ),
+_lastModified( rhs._lastModified )
+{
+    //nop
+}
+
+unsigned
+HTTPResponse::getCode() const {
+    return _response_code;
+}
+
+bool
+HTTPResponse::isOK() const {
+    return _response_code == 200L && !isCancelled();
+}
+
+bool
+HTTPResponse::isCancelled() const {
+    return _cancelled;
+}
+
+unsigned int
+HTTPResponse::getNumParts() const {
+    return _parts.size();
+}
+
+unsigned int
+HTTPResponse::getPartSize( unsigned int n ) const {
+    return _parts[n]->_size;
+}
+
+const std::string&
+HTTPResponse::getPartHeader( unsigned int n, const std::string& name ) const {
+    return _parts[n]->_headers[name];
+}
+
+std::istream&
+HTTPResponse::getPartStream( unsigned int n ) const {
+    return _parts[n]->_stream;
+}
+
+std::string
+HTTPResponse::getPartAsString( unsigned int n ) const {
+     std::string streamStr;
+     streamStr = _parts[n]->_stream.str();
+    return streamStr;
+}
+
+const std::string&
+HTTPResponse::getMimeType() const {
+    return _mimeType;
+}
+
+Config
+HTTPResponse::getHeadersAsConfig() const
+{
+    Config conf;
+    if ( _parts.size() > 0 )
+    {
+        for( Headers::const_iterator i = _parts[0]->_headers.begin(); i != _parts[0]->_headers.end(); ++i )
+        {
+            conf.set(i->first, i->second);
+        }
+    }
+    return conf;
+}
+
+/****************************************************************************/
+
+#define QUOTE_(X) #X
+#define QUOTE(X) QUOTE_(X)
+#define USER_AGENT "osgearth" QUOTE(OSGEARTH_MAJOR_VERSION) "." QUOTE(OSGEARTH_MINOR_VERSION)
+
+
+namespace
+{
+    // TODO: consider moving this stuff into the osgEarth::Registry;
+    // don't like it here in the global scope
+    // per-thread client map (must be global scope)
+    static Threading::PerThread<HTTPClient> s_clientPerThread;
+
+    static optional<ProxySettings>     s_proxySettings;
+
+    static std::string                 s_userAgent = USER_AGENT;
+
+    static long                        s_timeout = 0;
+    static long                        s_connectTimeout = 0;
+
+    // HTTP debugging.
+    static bool                        s_HTTP_DEBUG = false;
+    static Threading::Mutex            s_HTTP_DEBUG_mutex;
+    static int                         s_HTTP_DEBUG_request_count;
+    static double                      s_HTTP_DEBUG_total_duration;
+
+    static osg::ref_ptr< URLRewriter > s_rewriter;
+
+    static osg::ref_ptr< CurlConfigHandler > s_curlConfigHandler;
+
+    static unsigned                    s_numAsyncThreads = 2;
+
+    static HTTPStatistics              s_stats;
+    static Threading::Mutex            s_statsMutex;
+
+    void recordTransfer( const HTTPResponse& response )
+    {
+        unsigned long long bytes = 0ull;
+        for( unsigned i = 0; i < response.getNumParts(); ++i )
+            bytes += response.getPartSize( i );
+
+        bool failed =
+            !response.isOK() &&
+            !response.isCancelled() &&
+            response.getCode() != HTTPResponse::NOT_MODIFIED;
+
+        Threading::ScopedMutexLock lock( s_statsMutex );
+        s_stats._numRequests++;
+        if ( failed )
+            s_stats._numFailed++;
+        s_stats._bytesReceived += bytes;
+        s_stats._totalTime_s   += response.getDuration();
+    }
+
+    static HTTPConnectionSettings      s_connectionSettings;
+    static unsigned                    s_connectionSettingsRevision = 0;
+    static Threading::Mutex            s_connectionSettingsMutex;
+
+    HTTPConnectionSettings readConnectionSettings( unsigned* revision =0L )
+    {
+        Threading::ScopedMutexLock lock( s_connectionSettingsMutex );
+        if ( revision )
+            *revision = s_connectionSettingsRevision;
+        return s_connectionSettings;
+    }
+
+    // Record/replay state. The mode is checked on every request, so it lives
+    // in a plain flag (-1 until the environment has been read).
+    static HTTPReplaySettings              s_replaySettings;
+    static volatile int                    s_replayMode = -1;
+    static Threading::Mutex                s_replayMutex;
+    static std::map<std::string, unsigned> s_replayAttempts;
+
+    HTTPReplaySettings::Mode readReplayMode()
+    {
+        if ( s_replayMode < 0 )
+        {
+            Threading::ScopedMutexLock lock( s_replayMutex );
+            if ( s_replayMode < 0 )
+            {
+                const char* record = ::getenv("OSGEARTH_HTTP_RECORD");
+                const char* replay = ::getenv("OSGEARTH_HTTP_REPLAY");
+                if ( replay && *replay )
+                {
+                    s_replaySettings.mode() = HTTPReplaySettings::MODE_REPLAY;
+                    s_replaySettings.path() = std::string(replay);
+                }
+                else if ( record && *record )
+                {
+                    s_replaySettings.mode() = HTTPReplaySettings::MODE_RECORD;
+                    s_replaySettings.path() = std::string(record);
+                }
+
+                // "name=value name=value ..."
+                const char* options = ::getenv("OSGEARTH_HTTP_REPLAY_OPTIONS");
+                if ( options )
+                {
+                    Config conf;
+                    StringVector pairs;
+                    StringTokenizer( options, pairs, " ,;", "", false, true );
+                    for( StringVector::const_iterator i = pairs.begin(); i != pairs.end(); ++i )
+                    {
+                        std::string::size_type eq = i->find('=');
+                        if ( eq != std::string::npos )
+                            conf.add( trim(i->substr(0, eq)), trim(i->substr(eq+1)) );
+                    }
+                    s_replaySettings.mergeConfig( conf );
+                }
+
+                if ( s_replaySettings.mode() != HTTPReplaySettings::MODE_OFF )
+                {
+                    OE_WARN << LC << (s_replaySettings.mode() == HTTPReplaySettings::MODE_RECORD ? "Recording" : "Replaying")
+                        << " HTTP responses in \"" << s_replaySettings.path().get() << "\"" << std::endl;
+                }
+
+                s_replayMode = (int)s_replaySettings.mode().get();
+            }
+        }
+        return (HTTPReplaySettings::Mode)s_replayMode;
+    }
+
+    HTTPReplaySettings readReplaySettings()
+    {
+        readReplayMode();
+        Threading::ScopedMutexLock lock( s_replayMutex );
+        return s_replaySettings;
+    }
+
+    // 64-bit FNV-1a; names the record file of a URL.
+    unsigned long long hashURL( const std::string& url, unsigned long long h =14695981039346656037ull )
+    {
+        for( std::string::const_iterator c = url.begin(); c != url.end(); ++c )
+        {
+            h ^= (unsigned char)(*c);
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    std::string getReplayFileName( const HTTPReplaySettings& settings, const std::string& url )
+    {
+        std::stringstream buf;
+        buf << std::hex << std::setw(16) << std::setfill('0') << hashURL(url) << ".http";
+        return osgDB::concatPaths( settings.path().get(), buf.str() );
+    }
+
+    // Repeatable value in [0..1) for the nth request of a URL, so that a
+    // replay with the same seed injects the same errors and jitter.
+    double replayRandom( const std::string& url, unsigned seed, unsigned attempt, unsigned salt )
+    {
+        unsigned long long h = hashURL( url );
+        h = (h ^ (((unsigned long long)seed << 32) | attempt)) * 1099511628211ull;
+        h = (h ^ salt) * 1099511628211ull;
+        h ^= h >> 33;
+        return (double)(h >> 11) / 9007199254740992.0;
+    }
+
+    bool readReplayLine( std::istream& in, const std::string& key, std::string& value )
+    {
+        std::string line;
+        if ( !std::getline(in, line) || line.compare(0, key.length()+1, key + " ") != 0 )
+            return false;
+        value = line.substr( key.length()+1 );
+        return true;
+    }
+
+    // "scheme://host:port" part of a URL; requests are queued and limited per host key.
+    std::string getHostKey( const std::string& url )
+    {
+        std::string::size_type start = url.find( "://" );
+        start = start == std::string::npos ? 0 : start + 3;
+        std::string::size_type end = url.find_first_of( "/?#", start );
+        return toLower( url.substr(0, end) );
+    }
+
+    // Options every curl handle gets, whether it belongs to a per-thread
+    // client or to the asynchronous handle pool.
+    void applyDefaultOptions(void* handle)
+    {
+        //Get the user agent
+        std::string userAgent = s_userAgent;
+        const char* userAgentEnv = getenv("OSGEARTH_USERAGENT");
+        if (userAgentEnv)
+        {
+            userAgent = std::string(userAgentEnv);
+        }
+
+        OE_DEBUG << LC << "HTTPClient setting userAgent=" << userAgent << std::endl;
+
+        curl_easy_setopt( handle, CURLOPT_USERAGENT, userAgent.c_str() );
+        curl_easy_setopt( handle, CURLOPT_WRITEFUNCTION, osgEarth::StreamObjectReadCallback );
+        curl_easy_setopt( handle, CURLOPT_HEADERFUNCTION, osgEarth::StreamObjectHeaderCallback );
+        curl_easy_setopt( handle, CURLOPT_FOLLOWLOCATION, (void*)1 );
+        curl_easy_setopt( handle, CURLOPT_MAXREDIRS, (void*)5 );
+        curl_easy_setopt( handle, CURLOPT_PROGRESSFUNCTION, &CurlProgressCallback);
+        curl_easy_setopt( handle, CURLOPT_NOPROGRESS, (void*)0 ); //0=enable.
+        curl_easy_setopt( handle, CURLOPT_FILETIME, true );
+
+        if ( readConnectionSettings().compression() == true )
+        {
+            // an empty list advertises every encoding libcurl supports, and
+            // libcurl inflates the body before it reaches the write callback.
+#if LIBCURL_VERSION_NUM >= 0x071506
+            curl_easy_setopt( handle, CURLOPT_ACCEPT_ENCODING, "" );
+#else
+            curl_easy_setopt( handle, CURLOPT_ENCODING, "" );
+#endif
+        }
+
+#if LIBCURL_VERSION_NUM >= 0x072f00
+        if ( readConnectionSettings().http2() == true )
+        {
+            // HTTP/2 over TLS where the server offers it, HTTP/1.1 otherwise
+            curl_easy_setopt( handle, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS );
+        }
+#endif
+
+        osg::ref_ptr< CurlConfigHandler > curlConfigHandler = HTTPClient::getCurlConfigHandler();
+        if (curlConfigHandler.valid()) {
+            curlConfigHandler->onInitialize(handle);
+        }
+
+        long timeout = s_timeout;
+        const char* timeoutEnv = getenv("OSGEARTH_HTTP_TIMEOUT");
+        if (timeoutEnv)
+        {
+            timeout = osgEarth::as<long>(std::string(timeoutEnv), 0);
+        }
+        OE_DEBUG << LC << "Setting timeout to " << timeout << std::endl;
+        curl_easy_setopt( handle, CURLOPT_TIMEOUT, timeout );
+        long connectTimeout = s_connectTimeout;
+        const char* connectTimeoutEnv = getenv("OSGEARTH_HTTP_CONNECTTIMEOUT");
+        if (connectTimeoutEnv)
+        {
+            connectTimeout = osgEarth::as<long>(std::string(connectTimeoutEnv), 0);
+        }
+        OE_DEBUG << LC << "Setting connect timeout to " << connectTimeout << std::endl;
+        curl_easy_setopt( handle, CURLOPT_CONNECTTIMEOUT, connectTimeout );
+    }
+}
+
+HTTPClient&
+HTTPClient::getClient()
+{
+    return s_clientPerThread.get();
+}
+
+HTTPClient::HTTPClient() :
+_initialized    ( false ),
+_curl_handle    ( 0L ),
+_simResponseCode( -1L )
+{
+    //nop
+    //do no CURL calls here.
+}
+
+void
+HTTPClient::initialize() const
+{
+    if ( !_initialized )
+    {
+        const_cast<HTTPClient*>(this)->initializeImpl();
+    }
+}
+
+void
+HTTPClient::initializeImpl()
+{
+    _previousHttpAuthentication = 0;
+    _curl_handle = curl_easy_init();
+
+    //Check for a response-code simulation (for testing)
+    const char* simCode = getenv("OSGEARTH_SIMULATE_HTTP_RESPONSE_CODE");
+    if ( simCode )
+    {
+        _simResponseCode = osgEarth::as<long>(std::string(simCode), 404L);
+        OE_WARN << LC << "Simulating a network error with Response Code = " << _simResponseCode << std::endl;
+    }
+
+    // Dumps out HTTP request/response info
+    if ( ::getenv("OSGEARTH_HTTP_DEBUG") )
+    {
+        s_HTTP_DEBUG = true;
+        OE_WARN << LC << "HTTP debugging enabled" << std::endl;
+    }
+
+    applyDefaultOptions( _curl_handle );
+
+    _initialized = true;
+}
+
+HTTPClient::~HTTPClient()
+{
+    if (_curl_handle) curl_easy_cleanup( _curl_handle );
+    _curl_handle = 0;
+}
+
+void
+HTTPClient::setConnectionSettings( const HTTPConnectionSettings& settings )
+{
+    Threading::ScopedMutexLock lock( s_connectionSettingsMutex );
+    s_connectionSettings = settings;
+    ++s_connectionSettingsRevision;
+}
+
+HTTPConnectionSettings
+HTTPClient::getConnectionSettings()
+{
+    return readConnectionSettings();
+}
+
+void
+HTTPClient::setReplaySettings( const HTTPReplaySettings& settings )
+{
+    readReplayMode();
+    Threading::ScopedMutexLock lock( s_replayMutex );
+    s_replaySettings = settings;
+    s_replayAttempts.clear();
+    s_replayMode = (int)settings.mode().get();
+}
+
+HTTPReplaySettings
+HTTPClient::getReplaySettings()
+{
+    return readReplaySettings();
+}
+
+bool
+HTTPClient::replayResponse(const std::string& url,
+                           ProgressCallback*  progress,
+                           HTTPResponse&      response)
+{
+    if ( readReplayMode() != HTTPReplaySettings::MODE_REPLAY )
+        return false;
+
+    HTTPReplaySettings settings = readReplaySettings();
+    OE_START_TIMER(replay);
+
+    unsigned attempt;
+    {
+        Threading::ScopedMutexLock lock( s_replayMutex );
+        attempt = s_replayAttempts[url]++;
+    }
+
+    std::ifstream in( getReplayFileName(settings, url).c_str(), std::ios::binary );
+
+    std::string value;
+    if ( !in.is_open() || !readReplayLine(in, "url", value) || value != url )
+    {
+        if ( settings.networkFallback() == true )
+            return false;
+
+        OE_DEBUG << LC << "No recorded response for " << url << std::endl;
+        response = HTTPResponse( HTTPResponse::NOT_FOUND );
+        return true;
+    }
+
+    HTTPResponse recorded;
+    std::string code, duration, modified, parts;
+    bool ok =
+        readReplayLine(in, "code",     code) &&
+        readReplayLine(in, "duration", duration) &&
+        readReplayLine(in, "mime",     recorded._mimeType) &&
+        readReplayLine(in, "modified", modified) &&
+        readReplayLine(in, "parts",    parts);
+
+    recorded._response_code = as<long>(code, 0L);
+    recorded._lastModified  = as<TimeStamp>(modified, 0);
+    double recordedDuration = as<double>(duration, 0.0);
+    unsigned numParts       = as<unsigned>(parts, 0u);
+
+    unsigned long long bytes = 0ull;
+    for( unsigned p = 0; ok && p < numParts; ++p )
+    {
+        StringVector tokens;
+        ok = readReplayLine(in, "part", value);
+        if ( ok )
+        {
+            StringTokenizer( value, tokens, " ", "", false, true );
+            ok = tokens.size() == 2;
+        }
+        if ( !ok )
+            break;
+
+        osg::ref_ptr<HTTPResponse::Part> part = new HTTPResponse::Part();
+        part->_size = as<unsigned>(tokens[0], 0u);
+
+        unsigned numHeaders = as<unsigned>(tokens[1], 0u);
+        for( unsigned h = 0; ok && h < numHeaders; ++h )
+        {
+            std::string line;
+            ok = std::getline(in, line).good();
+            std::string::size_type colon = line.find(':');
+            if ( ok && colon != std::string::npos )
+                part->_headers[line.substr(0, colon)] = trim(line.substr(colon+1));
+        }
+
+        if ( ok && part->_size > 0u )
+        {
+            std::vector<char> data( part->_size );
+            ok = in.read( &data[0], data.size() ).good();
+            part->_stream.write( &data[0], data.size() );
+        }
+        in.ignore( 1 ); // trailing newline
+
+        bytes += part->_size;
+        recorded._parts.push_back( part );
+    }
+
+    if ( !ok )
+    {
+        OE_WARN << LC << "Corrupt recorded response for " << url << std::endl;
+        response = HTTPResponse( HTTPResponse::NOT_FOUND );
+        return true;
+    }
+
+    // simulated network conditions
+    double errorRate = settings.errorRate().get();
+    bool fail = errorRate > 0.0 && replayRandom(url, settings.seed().get(), attempt, 1u) < errorRate;
+
+    double delay_s = settings.latencyMS().get() * 0.001;
+    if ( settings.jitterMS().get() > 0.0 )
+        delay_s += settings.jitterMS().get() * 0.001 * replayRandom(url, settings.seed().get(), attempt, 2u);
+    if ( settings.useRecordedLatency() == true )
+        delay_s += recordedDuration * settings.latencyScale().get();
+    if ( !fail && settings.bandwidthKBps().get() > 0.0 )
+        delay_s += (double)bytes / (settings.bandwidthKBps().get() * 1024.0);
+
+    // sleep in short slices so cancelation stays responsive.
+    bool cancelled = false;
+    while( !cancelled && OE_STOP_TIMER(replay) < delay_s )
+    {
+        double remaining_s = delay_s - OE_STOP_TIMER(replay);
+        OpenThreads::Thread::microSleep( (unsigned)(osg::minimum(remaining_s, 0.01) * 1.0e6) + 1u );
+        cancelled = progress && progress->isCanceled();
+    }
+
+    if ( cancelled )
+    {
+        response = HTTPResponse( 0L );
+        response._cancelled = true;
+    }
+    else if ( fail )
+    {
+        response = HTTPResponse( (long)settings.errorCode().get() );
+    }
+    else
+    {
+        response = recorded;
+    }
+
+    response._duration_s = OE_STOP_TIMER(replay);
+    return true;
+}
+
+void
+HTTPClient::recordResponse(const std::string&  url,
+                           const HTTPResponse& response)
+{
+    // cancelations and transport failures say nothing about the server.
+    if ( readReplayMode() != HTTPReplaySettings::MODE_RECORD || response.isCancelled() || response.getCode() == 0u )
+        return;
+
+    HTTPReplaySettings settings = readReplaySettings();
+    std::string filename = getReplayFileName( settings, url );
+    std::string temp     = Stringify() << filename << "." << Threading::getCurrentThreadId() << ".tmp";
+
+    if ( !makeDirectoryForFile(filename) )
+    {
+        OE_WARN << LC << "Failed to create record folder \"" << settings.path().get() << "\"" << std::endl;
+        return;
+    }
+
+    {
+        std::ofstream out( temp.c_str(), std::ios::binary );
+        if ( !out.is_open() )
+            return;
+
+        out << "url "      << url << "\n"
+            << "code "     << response.getCode() << "\n"
+            << "duration " << std::setprecision(9) << response.getDuration() << "\n"
+            << "mime "     << response.getMimeType() << "\n"
+            << "modified " << response.getLastModifiedTime() << "\n"
+            << "parts "    << response.getNumParts() << "\n";
+
+        for( unsigned p = 0; p < response.getNumParts(); ++p )
+        {
+            const HTTPResponse::Part* part = response._parts[p].get();
+            out << "part " << part->_size << " " << part->_headers.size() << "\n";
+            for( Headers::const_iterator h = part->_headers.begin(); h != part->_headers.end(); ++h )
+                out << h->first << ": " << h->second << "\n";
+            out << part->_stream.str() << "\n";
+        }
+    }
+
+#ifdef _WIN32
+    // rename() won't replace an existing file on Windows.
+    ::remove( filename.c_str() );
+#endif
+
+    if ( ::rename(temp.c_str(), filename.c_str()) != 0 )
+    {
+        OE_WARN << LC << "Failed to record response for " << url << std::endl;
+        ::remove( temp.c_str() );
+    }
+}
+
+void
+HTTPClient::setProxySettings( const ProxySettings& proxySettings )
+{
+    s_proxySettings = proxySettings;
+}
+
+const std::string& HTTPClient::getUserAgent()
+{
+    return s_userAgent;
+}
+
+void  HTTPClient::setUserAgent(const std::string& userAgent)
+{
+    s_userAgent = userAgent;
+}
+
+long HTTPClient::getTimeout()
+{
+    return s_timeout;
+}
+
+void HTTPClient::setTimeout( long timeout )
+{
+    s_timeout = timeout;
+}
+
+long HTTPClient::getConnectTimeout()
+{
+    return s_connectTimeout;
+}
+
+void HTTPClient::setConnectTimeout( long timeout )
+{
+    s_connectTimeout = timeout;
+}
+URLRewriter* HTTPClient::getURLRewriter()
+{
+    return s_rewriter.get();
+}
+
+void HTTPClient::setURLRewriter( URLRewriter* rewriter )
+{
+    s_rewriter = rewriter;
+}
+
+CurlConfigHandler* HTTPClient::getCurlConfigHandler()
+{
+    return s_curlConfigHandler.get();
+}
+
+void HTTPClient::setCurlConfighandler(CurlConfigHandler* handler)
+{
+    s_curlConfigHandler = handler;
+}
+
+void
+HTTPClient::globalInit()
+{
+    curl_global_init(CURL_GLOBAL_ALL);
+}
+
+void
+HTTPClient::readOptions(const osgDB::Options* options, std::string& proxy_host, std::string& proxy_port) const
+{
+    // try to set proxy host/port by reading the CURL proxy options
+    if ( options )
+    {
+        std::istringstream iss( options->getOptionString() );
+        std::string opt;
+        while( iss >> opt )
+        {
+            int index = opt.find( "=" );
+            if( opt.substr( 0, index ) == "OSG_CURL_PROXY" )
+            {
+                proxy_host = opt.substr( index+1 );
+            }
+            else if ( opt.substr( 0, index ) == "OSG_CURL_PROXYPORT" )
+            {
+                proxy_port = opt.substr( index+1 );
+            }
+        }
+    }
+}
+
+void
+HTTPClient::resolveProxy(const osgDB::Options* options, std::string& proxy_addr, std::string& proxy_auth) const
+{
+    //TODO: don't do all this proxy setup on every GET. Just do it once per client, or only when 
+    // the proxy information changes.
+
+    proxy_addr.clear();
+    proxy_auth.clear();
+
+    std::string proxy_host;
+    std::string proxy_port = "8080";
+
+    //Try to get the proxy settings from the global settings
+    if (s_proxySettings.isSet())
+    {
+        proxy_host = s_proxySettings.get().hostName();
+        std::stringstream buf;
+        buf << s_proxySettings.get().port();
+        proxy_port = buf.str();
+
+        std::string proxy_username = s_proxySettings.get().userName();
+        std::string proxy_password = s_proxySettings.get().password();
+        if (!proxy_username.empty() && !proxy_password.empty())
+        {
+            proxy_auth = proxy_username + std::string(":") + proxy_password;
+        }
+    }
+
+    //Try to get the proxy settings from the local options that are passed in.
+    readOptions( options, proxy_host, proxy_port );
+
+    optional< ProxySettings > proxySettings;
+    ProxySettings::fromOptions( options, proxySettings );
+    if (proxySettings.isSet())
+    {       
+        proxy_host = proxySettings.get().hostName();
+        proxy_port = toString<int>(proxySettings.get().port());
+        OE_DEBUG << LC << "Read proxy settings from options " << proxy_host << " " << proxy_port << std::endl;
+    }
+
+    //Try to get the proxy settings from the environment variable
+    const char* proxyEnvAddress = getenv("OSG_CURL_PROXY");
+    if (proxyEnvAddress) //Env Proxy Settings
+    {
+        proxy_host = std::string(proxyEnvAddress);
+
+        const char* proxyEnvPort = getenv("OSG_CURL_PROXYPORT"); //Searching Proxy Port on Env
+        if (proxyEnvPort)
+        {
+            proxy_port = std::string( proxyEnvPort );
+        }
+    }
+
+    const char* proxyEnvAuth = getenv("OSGEARTH_CURL_PROXYAUTH");
+    if (proxyEnvAuth)
+    {
+        proxy_auth = std::string(proxyEnvAuth);
+    }
+
+    if ( !proxy_host.empty() )
+    {
+        std::stringstream buf;
+        buf << proxy_host << ":" << proxy_port;
+        proxy_addr = buf.str();
+
+        if ( s_HTTP_DEBUG )
+        {
+            OE_NOTICE << LC << "Using proxy: " << proxy_addr << std::endl;
+
+            if ( !proxy_auth.empty() )
+            {
+                OE_NOTICE << LC << "Using proxy authentication " << proxy_auth << std::endl;
+            }
+        }
+    }
+}
+
+bool
+HTTPClient::decodeMultipartStream(const std::string&   boundary,
+                                  HTTPResponse::Part*  input,
+                                  HTTPResponse::Parts& output) const
+{
+    std::string bstr = std::string("--") + boundary;
+    std::string line;
+    char tempbuf[256];
+
+    // first thing in the stream should be the boundary.
+    input->_stream.read( tempbuf, bstr.length() );
+    tempbuf[bstr.length()] = 0;
+    line = tempbuf;
+    if ( line != bstr )
+    {
+        OE_INFO << LC 
+            << "decodeMultipartStream: protocol violation; "
+            << "expecting boundary; instead got: \"" 
+            << line
+            << "\"" << std::endl;
+        return false;
+    }
+
+    for( bool done=false; !done; )
+    {
+        osg::ref_ptr<HTTPResponse::Part> next_part = new HTTPResponse::Part();
+
+        // first finish off the boundary.
+        std::getline( input->_stream, line );
+        if ( line == "--" )
+        {
+            done = true;
+        }
+        else
+        {
+            // read all headers. this ends with a blank line.
+            line = " ";
+            while( line.length() > 0 && !done )
+            {
+                std::getline( input->_stream, line );
+
+                // check for EOS:
+                if ( line == "--" )
+                {
+                    done = true;
+                }
+                else
+                {                    
+                    StringTokenizer tok(":");
+                    StringVector tized;
+                    tok.tokenize(line, tized);            
+                    if ( tized.size() >= 2 )
+                        next_part->_headers[tized[0]] = tized[1];                        
+                }
+            }
+        }
+
+        if ( !done )
+        {
+            // read data until we reach the boundary
+            unsigned int bstr_ptr = 0;
+            std::string temp;
+            //unsigned int c = 0;
+            while( bstr_ptr < bstr.length() )
+            {
+                char b;
+                input->_stream.read( &b, 1 );
+                if ( b == bstr[bstr_ptr] )
+                {
+                    bstr_ptr++;
+                }
+                else
+                {
+                    for( unsigned int i=0; i<bstr_ptr; i++ )
+                    {
+                        next_part->_stream << bstr[i];
+                    }
+                    next_part->_stream << b;
+                    next_part->_size += bstr_ptr + 1;
+                    bstr_ptr = 0;
+                }
+            }
+            output.push_back( next_part.get() );
+        }
+    }
+
+    return true;
+}
+
+void
+HTTPClient::assembleResponse(void*               handle,
+                             int                 curlResult,
+                             HTTPResponse::Part* part,
+                             const Headers&      headers,
+                             HTTPResponse&       response) const
+{
+    // read the response content type:
+    char* content_type_cp = 0L;
+
+    curl_easy_getinfo( handle, CURLINFO_CONTENT_TYPE, &content_type_cp );    
+
+    if ( content_type_cp != NULL )
+    {
+        response._mimeType = content_type_cp;    
+    } 
+
+    // upon success, parse the data:
+    if ( curlResult != CURLE_ABORTED_BY_CALLBACK && curlResult != CURLE_OPERATION_TIMEDOUT )
+    {        
+        // check for multipart content
+        if (response._mimeType.length() > 9 && 
+            ::strstr( response._mimeType.c_str(), "multipart" ) == response._mimeType.c_str() )
+        {
+            OE_DEBUG << LC << "detected multipart data; decoding..." << std::endl;
+
+            //TODO: parse out the "wcs" -- this is WCS-specific
+            if ( !decodeMultipartStream( "wcs", part, response._parts ) )
+            {
+                // error decoding an invalid multipart stream.
+                // should we do anything, or just leave the response empty?
+            }
+        }
+        else
+        {            
+            // libcurl already decoded a compressed transfer, so the encoding
+            // header no longer describes the stored payload.
+            bool decoded = readConnectionSettings().compression() == true;
+
+            for (Headers::const_iterator itr = headers.begin(); itr != headers.end(); ++itr)
+            {                
+                if ( decoded && ciEquals(itr->first, "Content-Encoding") )
+                    continue;
+
+                part->_headers[itr->first] = itr->second;                
+            }
+
+            // Write the headers to the metadata
+            response._parts.push_back( part );
+        }
+    }
+    else  /*if (res == CURLE_ABORTED_BY_CALLBACK || res == CURLE_OPERATION_TIMEDOUT) */
+    {        
+        //If we were aborted by a callback, then it was cancelled by a user
+        response._cancelled = true;
+    }
+
+    // last-modified (file time)
+    response._lastModified = getCurlFileTime(handle);
+}
+
+HTTPResponse
+HTTPClient::get( const HTTPRequest&    request,
+                 const osgDB::Options* options,
+                 ProgressCallback*     progress)
+{
+    return getClient().doGet( request, options, progress );
+}
+
+HTTPResponse 
+HTTPClient::get( const std::string&    url,
+                 const osgDB::Options* options,
+                 ProgressCallback*     progress)
+{
+    return getClient().doGet( url, options, progress);
+}
+
+ReadResult
+HTTPClient::readImage(const HTTPRequest&    request,
+                      const osgDB::Options* options,
+                      ProgressCallback*     progress)
+{
+    return getClient().doReadImage( request, options, progress );
+}
+
+ReadResult
+HTTPClient::readNode(const HTTPRequest&    request,
+                     const osgDB::Options* options,
+                     ProgressCallback*     progress)
+{
+    return getClient().doReadNode( request, options, progress );
+}
+
+ReadResult
+HTTPClient::readObject(const HTTPRequest&    request,
+                       const osgDB::Options* options,
+                       ProgressCallback*     progress)
+{
+    return getClient().doReadObject( request, options, progress );
+}
+
+ReadResult
+HTTPClient::readString(const HTTPRequest&    request,
+                       const osgDB::Options* options,
+                       ProgressCallback*     progress)
+{
+    return getClient().doReadString( request, options, progress );
+}
+
+bool
+HTTPClient::download(const std::string& uri,
+                     const std::string& localPath)
+{
+    return getClient().doDownload( uri, localPath );
+}
+
+HTTPResponse
+HTTPClient::doGet(const HTTPRequest&    request,
+                  const osgDB::Options* options, 
+                  ProgressCallback*     progress) const
+{    
+    initialize();
+
+    OE_PROFILING_ZONE("HTTP GET");
+    OE_START_TIMER(http_get);
+
+    const osgDB::AuthenticationMap* authenticationMap = (options && options->getAuthenticationMap()) ? 
+            options->getAuthenticationMap() :
+            osgDB::Registry::instance()->getAuthenticationMap();
+
+    std::string proxy_addr;
+    std::string proxy_auth;
+    resolveProxy( options, proxy_addr, proxy_auth );
+
+    if ( !proxy_addr.empty() )
+    {
+        //curl_easy_setopt( _curl_handle, CURLOPT_HTTPPROXYTUNNEL, 1 ); 
+        curl_easy_setopt( _curl_handle, CURLOPT_PROXY, proxy_addr.c_str() );
+
+        //Setup the proxy authentication if setup
+        if (!proxy_auth.empty())
+        {
+            curl_easy_setopt( _curl_handle, CURLOPT_PROXYUSERPWD, proxy_auth.c_str());
+        }
+    }
+    else
+    {
+        OE_DEBUG << LC << "Removing proxy settings" << std::endl;
+        curl_easy_setopt( _curl_handle, CURLOPT_PROXY, 0 );
+    }
+
+    std::string url = request.getURL();
+    // Rewrite the url if the url rewriter is available  
+    osg::ref_ptr< URLRewriter > rewriter = getURLRewriter();
+    if ( rewriter.valid() )
+    {
+        std::string oldURL = url;
+        url = rewriter->rewrite( oldURL );
+        OE_INFO << LC << "Rewrote URL " << oldURL << " to " << url << std::endl;
+    }
+
+    HTTPResponse replayed;
+    if ( replayResponse(url, progress, replayed) )
+    {
+        recordTransfer( replayed );
+        if ( progress )
+        {
+            progress->stats()["http_get_time"] += OE_STOP_TIMER(http_get);
+            progress->stats()["http_get_count"] += 1;
+            if ( replayed._cancelled )
+                progress->stats()["http_cancel_count"] += 1;
+        }
+        return replayed;
+    }
+
+    const osgDB::AuthenticationDetails* details = authenticationMap ?
+        authenticationMap->getAuthenticationDetails( url ) :
+        0;
+
+    if (details)
+    {
+        const std::string colon(":");
+        std::string password(details->username + colon + details->password);
+        curl_easy_setopt(_curl_handle, CURLOPT_USERPWD, password.c_str());
+        const_cast<HTTPClient*>(this)->_previousPassword = password;
+
+        // use for https.
+        // curl_easy_setopt(_curl, CURLOPT_KEYPASSWD, password.c_str());
+
+#if LIBCURL_VERSION_NUM >= 0x070a07
+        if (details->httpAuthentication != _previousHttpAuthentication)
+        { 
+            curl_easy_setopt(_curl_handle, CURLOPT_HTTPAUTH, details->httpAuthentication); 
+            const_cast<HTTPClient*>(this)->_previousHttpAuthentication = details->httpAuthentication;
+        }
+#endif
+    }
+    else
+    {
+        if (!_previousPassword.empty())
+        {
+            curl_easy_setopt(_curl_handle, CURLOPT_USERPWD, 0);
+            const_cast<HTTPClient*>(this)->_previousPassword.clear();
+        }
+
+#if LIBCURL_VERSION_NUM >= 0x070a07
+        // need to reset if previously set.
+        if (_previousHttpAuthentication!=0)
+        {
+            curl_easy_setopt(_curl_handle, CURLOPT_HTTPAUTH, 0); 
+            const_cast<HTTPClient*>(this)->_previousHttpAuthentication = 0;
+        }
+#endif
+    }
+
+
+    // Set any headers
+    struct curl_slist *headers=NULL;
+    if (!request.getHeaders().empty())
+    {
+        for (HTTPRequest::Parameters::const_iterator itr = request.getHeaders().begin(); itr != request.getHeaders().end(); ++itr)
+        {
+            std::stringstream buf;
+            buf << itr->first << ": " << itr->second;
+            headers = curl_slist_append(headers, buf.str().c_str());
+        }
+    }    
+
+    // Disable the default Pragma: no-cache that curl adds by default.
+    headers = curl_slist_append(headers, "Pragma: ");
+    curl_easy_setopt(_curl_handle, CURLOPT_HTTPHEADER, headers);
+    
+    osg::ref_ptr<HTTPResponse::Part> part = new HTTPResponse::Part();
+    StreamObject sp( &part->_stream );
+
+    //Take a temporary ref to the callback (why? dangerous.)
+    //osg::ref_ptr<ProgressCallback> progressCallback = callback;
+    curl_easy_setopt( _curl_handle, CURLOPT_URL, url.c_str() );
+    if (progress)
+    {
+        curl_easy_setopt(_curl_handle, CURLOPT_PROGRESSDATA, progress);
+    }
+
+    CURLcode res;
+    long response_code = 0L;
+
+    OE_START_TIMER(get_duration);
+
+    if ( _simResponseCode < 0 )
+    {
+        char errorBuf[CURL_ERROR_SIZE];
+        errorBuf[0] = 0;
+        curl_easy_setopt( _curl_handle, CURLOPT_ERRORBUFFER, (void*)errorBuf );
+        curl_easy_setopt( _curl_handle, CURLOPT_WRITEDATA, (void*)&sp);
+        curl_easy_setopt( _curl_handle, CURLOPT_HEADERDATA, (void*)&sp);
+
+        //Disable peer certificate verification to allow us to access in https servers where the peer certificate cannot be verified.
+        curl_easy_setopt( _curl_handle, CURLOPT_SSL_VERIFYPEER, (void*)0 );
+        
+        osg::ref_ptr< CurlConfigHandler > curlConfigHandler = getCurlConfigHandler();
+        if (curlConfigHandler.valid()) {
+            curlConfigHandler->onGet(_curl_handle);
+        }
+
+        res = curl_easy_perform(_curl_handle);
+        curl_easy_setopt( _curl_handle, CURLOPT_WRITEDATA, (void*)0 );
+        curl_easy_setopt( _curl_handle, CURLOPT_PROGRESSDATA, (void*)0);
+
+        if (!proxy_addr.empty())
+        {
+            long connect_code = 0L;
+            CURLcode r = curl_easy_getinfo(_curl_handle, CURLINFO_HTTP_CONNECTCODE, &connect_code);
+            if ( r != CURLE_OK )
+            {
+                OE_WARN << LC << "Proxy connect error: " << curl_easy_strerror(r) << std::endl;
+                return HTTPResponse(0);
+            }
+        }
+
+        curl_easy_getinfo( _curl_handle, CURLINFO_RESPONSE_CODE, &response_code );        
+    }
+    else
+    {
+        // simulate failure with a custom response code
+        response_code = _simResponseCode;
+        res = response_code == 408 ? CURLE_OPERATION_TIMEDOUT : CURLE_COULDNT_CONNECT;
+    }
+
+    HTTPResponse response( response_code );    
+    assembleResponse( _curl_handle, res, part.get(), sp._headers, response );
+
+    response._duration_s = OE_STOP_TIMER(get_duration);
+    recordTransfer( response );
+    recordResponse( url, response );
+
+    if ( progress )
+    {
+        progress->stats()["http_get_time"] += OE_STOP_TIMER(http_get);
+        progress->stats()["http_get_count"] += 1;
+        if ( response._cancelled )
+            progress->stats()["http_cancel_count"] += 1;
+    }
+
+    if ( s_HTTP_DEBUG )
+    {
+        TimeStamp filetime = getCurlFileTime(_curl_handle);
+
+        OE_NOTICE << LC 
+            << "GET(" << response_code << ", " << response._mimeType << ") : \"" 
+            << url << "\" (" << DateTime(filetime).asRFC1123() << ") t="
+            << std::setprecision(4) << response.getDuration() << "s" << std::endl;
+
+        {
+            Threading::ScopedMutexLock lock(s_HTTP_DEBUG_mutex);
+            s_HTTP_DEBUG_request_count++;
+            s_HTTP_DEBUG_total_duration += response.getDuration();
+
+            if ( s_HTTP_DEBUG_request_count % 60 == 0 )
+            {
+                OE_NOTICE << LC << "Average duration = " << s_HTTP_DEBUG_total_duration/(double)s_HTTP_DEBUG_request_count
+                    << std::endl;
+            }
+        }
+
+#if 0
+        // time details - almost 100% of the time is spent in
+        // STARTTRANSFER, which is the time until the first byte is received.
+        double td[7];
+
+        curl_easy_getinfo(_curl_handle, CURLINFO_TOTAL_TIME,         &td[0]);
+        curl_easy_getinfo(_curl_handle, CURLINFO_NAMELOOKUP_TIME,    &td[1]);
+        curl_easy_getinfo(_curl_handle, CURLINFO_CONNECT_TIME,       &td[2]);
+        curl_easy_getinfo(_curl_handle, CURLINFO_APPCONNECT_TIME,    &td[3]);
+        curl_easy_getinfo(_curl_handle, CURLINFO_PRETRANSFER_TIME,   &td[4]);
+        curl_easy_getinfo(_curl_handle, CURLINFO_STARTTRANSFER_TIME, &td[5]);
+        curl_easy_getinfo(_curl_handle, CURLINFO_REDIRECT_TIME,      &td[6]);
+
+        for(int i=0; i<7; ++i)
+        {
+            OE_NOTICE << LC
+                << std::setprecision(4)
+                << "TIMES: total=" <<td[0]
+                << ", lookup=" <<td[1]<<" ("<<(int)((td[1]/td[0])*100)<<"%)"
+                << ", connect=" <<td[2]<<" ("<<(int)((td[2]/td[0])*100)<<"%)"
+                << ", appconn=" <<td[3]<<" ("<<(int)((td[3]/td[0])*100)<<"%)"
+                << ", prexfer=" <<td[4]<<" ("<<(int)((td[4]/td[0])*100)<<"%)"
+                << ", startxfer=" <<td[5]<<" ("<<(int)((td[5]/td[0])*100)<<"%)"
+                << ", redir=" <<td[6]<<" ("<<(int)((td[6]/td[0])*100)<<"%)"
+                << std::endl;
+        }
+#endif
+    }
+
+    // Free the headers
+    if (headers)
+    {
+        curl_slist_free_all(headers);
+    }
+
+    return response;
+}
+
+bool
+HTTPClient::doDownload(const std::string& url, const std::string& filename)
+{
+    initialize();
+
+    // download the data
+    HTTPResponse response = this->doGet( HTTPRequest(url) );
+
+    if ( response.isOK() )
+    {
+        unsigned int part_num = response.getNumParts() > 1? 1 : 0;
+        std::istream& input_stream = response.getPartStream( part_num );
+
+        std::ofstream fout;
+        fout.open(filename.c_str(), std::ios::out | std::ios::binary);
+
+        input_stream.seekg (0, std::ios::end);
+        int length = input_stream.tellg();
+        input_stream.seekg (0, std::ios::beg);
+
+        char *buffer = new char[length];
+        input_stream.read(buffer, length);
+        fout.write(buffer, length);
+        delete[] buffer;
+        fout.close();
+        return true;
+    }
+    else
+    {
+        OE_WARN << LC << "Error downloading file " << filename
+            << " (" << response.getCode() << ")" << std::endl;
+        return false;
+    } 
+}
+
+namespace
+{
+    osgDB::ReaderWriter*
+    getReader( const std::string& url, const HTTPResponse& response )
+    {        
+        osgDB::ReaderWriter* reader = 0L;
+
+        // try extension first:
+        std::string ext = osgDB::getFileExtension( url );
+        if ( !ext.empty() )
+        {
+            reader = osgDB::Registry::instance()->getReaderWriterForExtension( ext );
+        }
+
+        if ( !reader )
+        {
+            // try to look up a reader by mime-type first:
+            std::string mimeType = response.getMimeType();
+            if ( !mimeType.empty() )
+            {
+                reader = osgDB::Registry::instance()->getReaderWriterForMimeType(mimeType);
+            }
+        }
+
+        if ( !reader && s_HTTP_DEBUG )
+        {
+            OE_WARN << LC << "Cannot find an OSG plugin to read response data (ext="
+                << ext << "; mime-type=" << response.getMimeType()
+                << ")" << std::endl;
+
+            if ( endsWith(response.getMimeType(), "xml", false) )
+            {
+                OE_WARN << LC << "Content:\n" << response.getPartAsString(0) << "\n";
+            }
+        }
+
+        return reader;
+    }
+}
+
+ReadResult
+HTTPClient::doReadImage(const HTTPRequest&    request,
+                        const osgDB::Options* options,
+                        ProgressCallback*     callback)
+{
+    initialize();
+
+    HTTPResponse response = this->doGet(request, options, callback);
+
+    return decodeImage(request, response, options, callback);
+}
+
+ReadResult
+HTTPClient::decodeImage(const HTTPRequest&    request,
+                        const HTTPResponse&   response,
+                        const osgDB::Options* options,
+                        ProgressCallback*     callback)
+{
+    ReadResult result;
+
+    if (response.isOK())
+    {
+        // the decoder reads JPEG/PNG/WebP itself when it can, and falls
+        // back on the plugin for the URL's extension or mime-type.
+        osgDB::ReaderWriter* reader = getReader(request.getURL(), response);
+
+        OE_PROFILING_ZONE_BEGIN("Decode image");
+        result = ImageDecoder::instance()->decode( response.getPartAsString(0), reader, options );
+        OE_PROFILING_ZONE_END();
+
+        if ( result.code() == ReadResult::RESULT_READER_ERROR && s_HTTP_DEBUG )
+        {
+            OE_WARN << LC << (reader ? reader->className() : "ImageDecoder")
+                << " failed to read image from " << request.getURL() 
+                << "; message = " << result.errorDetail()
+                <<  std::endl;
+        }
+        
+        // last-modified (file time)
+        result.setLastModifiedTime( response.getLastModifiedTime() );
+        
+        // Time of query
+        result.setDuration( response.getDuration() );
+    }
+    else
+    {
+        result = ReadResult(
+            response.isCancelled()                           ? ReadResult::RESULT_CANCELED :
+            response.getCode() == HTTPResponse::NOT_FOUND    ? ReadResult::RESULT_NOT_FOUND :
+            response.getCode() == HTTPResponse::SERVER_ERROR ? ReadResult::RESULT_SERVER_ERROR :
+            response.getCode() == HTTPResponse::NOT_MODIFIED ? ReadResult::RESULT_NOT_MODIFIED :
+                                                               ReadResult::RESULT_UNKNOWN_ERROR );
+
+        //If we have an error but it's recoverable, like a server error or timeout then set the callback to retry.
+        if (HTTPClient::isRecoverable( result.code() ) )
+        {            
+            if (callback)
+            {
+                if ( s_HTTP_DEBUG )
+                {
+                    OE_NOTICE << LC << "Error in HTTPClient for " << request.getURL() << " but it's recoverable" << std::endl;
+                }
+                callback->setNeedsRetry( true );
+            }
+        }        
+    }
+
+    // encode headers
+    result.setMetadata( response.getHeadersAsConfig() );
+
+    // set the source name
+    if ( result.getImage() )
+        result.getImage()->setName( request.getURL() );
+
+    return result;
+}
+
+ReadResult
+HTTPClient::doReadNode(const HTTPRequest&    request,
+                       const osgDB::Options* options,
+                       ProgressCallback*     callback)
+{
+    initialize();
+
+    ReadResult result;
+
+    HTTPResponse response = this->doGet(request, options, callback);
+
+    if (response.isOK())
+    {
+        osgDB::ReaderWriter* reader = getReader(request.getURL(), response);
+        if (!reader)
+        {
+            result = ReadResult(ReadResult::RESULT_NO_READER);
+        }
+
+        else 
+        {
+            osgDB::ReaderWriter::ReadResult rr = reader->readNode(response.getPartStream(0), options);
+            if ( rr.validNode() )
+            {
+                result = ReadResult(rr.takeNode());
+            }
+            else 
+            {
+                if ( s_HTTP_DEBUG )
+                {
+                    OE_WARN << LC << reader->className() 
+                        << " failed to read node from " << request.getURL() 
+                        << "; message = " << rr.message()
+                        <<  std::endl;
+                }
+                result = ReadResult(ReadResult::RESULT_READER_ERROR);
+                result.setErrorDetail( rr.message() );
+            }
+        }
+        
+        // last-modified (file time)
+        result.setLastModifiedTime( getCurlFileTime(_curl_handle) );
+    }
+    else
+    {
+        result = ReadResult(
+            response.isCancelled()                           ? ReadResult::RESULT_CANCELED :
+            response.getCode() == HTTPResponse::NOT_FOUND    ? ReadResult::RESULT_NOT_FOUND :
+            response.getCode() == HTTPResponse::SERVER_ERROR ? ReadResult::RESULT_SERVER_ERROR :
+            response.getCode() == HTTPResponse::NOT_MODIFIED ? ReadResult::RESULT_NOT_MODIFIED :
+                                                               ReadResult::RESULT_UNKNOWN_ERROR );
+
+        //If we have an error but it's recoverable, like a server error or timeout then set the callback to retry.
+        if (HTTPClient::isRecoverable( result.code() ) )
+        {
+            if (callback)
+            {
+                if ( s_HTTP_DEBUG )
+                {
+                    OE_NOTICE << LC << "Error in HTTPClient for " << request.getURL() << " but it's recoverable" << std::endl;
+                }
+                callback->setNeedsRetry( true );
+            }
+        }
+    }
+
+    // encode headers
+    result.setMetadata( response.getHeadersAsConfig() );
+
+    return result;
+}
+
+ReadResult
+HTTPClient::doReadObject(const HTTPRequest&    request,
+                         const osgDB::Options* options,
+                         ProgressCallback*     callback)
+{
+    initialize();
+
+    ReadResult result;
+
+    HTTPResponse response = this->doGet(request, options, callback);
+
+    if (response.isOK())
+    {
+        osgDB::ReaderWriter* reader = getReader(request.getURL(), response);
+        if (!reader)
+        {
+            result = ReadResult(ReadResult::RESULT_NO_READER);
+        }
+
+        else 
+        {
+            osgDB::ReaderWriter::ReadResult rr = reader->readObject(response.getPartStream(0), options);
+            if ( rr.validObject() )
+            {
+                result = ReadResult(rr.takeObject());
+            }
+            else 
+            {
+                if ( s_HTTP_DEBUG )
+                {
+                    OE_WARN << LC << reader->className() 
+                        << " failed to read object from " << request.getURL() 
+                        << "; message = " << rr.message()
+                        <<  std::endl;
+                }
+                result = ReadResult(ReadResult::RESULT_READER_ERROR);
+                result.setErrorDetail( rr.message() );
+            }
+        }
+        
+        // last-modified (file time)
+        result.setLastModifiedTime( getCurlFileTime(_curl_handle) );
+    }
+    else
+    {
+        result = ReadResult(
+            response.isCancelled() ? ReadResult::RESULT_CANCELED :
+            response.getCode() == HTTPResponse::NOT_FOUND ? ReadResult::RESULT_NOT_FOUND :
+            response.getCode() == HTTPResponse::SERVER_ERROR ? ReadResult::RESULT_SERVER_ERROR :
+            response.getCode() == HTTPResponse::NOT_MODIFIED ? ReadResult::RESULT_NOT_MODIFIED :
+            ReadResult::RESULT_UNKNOWN_ERROR );
+
+        //If we have an error but it's recoverable, like a server error or timeout then set the callback to retry.
+        if (HTTPClient::isRecoverable( result.code() ) )
+        {
+            if (callback)
+            {
+                if ( s_HTTP_DEBUG )
+                {
+                    OE_NOTICE << LC << "Error in HTTPClient for " << request.getURL() << " but it's recoverable" << std::endl;
+                }
+                callback->setNeedsRetry( true );
+            }
+        }
+    }
+
+    result.setMetadata( response.getHeadersAsConfig() );
+
+    return result;
+}
+
+
+ReadResult
+HTTPClient::doReadString(const HTTPRequest&    request,
+                         const osgDB::Options* options,
+                         ProgressCallback*     callback )
+{
+    initialize();
+
+    HTTPResponse response = this->doGet( request, options, callback );
+
+    return decodeString( request, response, callback );
+}
+
+ReadResult
+HTTPClient::decodeString(const HTTPRequest&    request,
+                         const HTTPResponse&   response,
+                         ProgressCallback*     callback )
+{
+    ReadResult result;
+
+    if ( response.isOK() )
+    {
+        result = ReadResult( new StringObject(response.getPartAsString(0)) );
+    }
+
+    else if ( response.getCode() >= 400 && response.getCode() < 500 && response.getCode() != 404 )
+    {
+        // for request errors, return an error result with the part data intact
+        // so the user can parse it as needed. We only do this for readString.
+        result = ReadResult( 
+            ReadResult::RESULT_SERVER_ERROR,
+            new StringObject(response.getPartAsString(0)) );
+    }
+
+    else
+    {
+        result = ReadResult(
+            response.isCancelled() ?                           ReadResult::RESULT_CANCELED :
+            response.getCode() == HTTPResponse::NOT_FOUND    ? ReadResult::RESULT_NOT_FOUND :
+            response.getCode() == HTTPResponse::SERVER_ERROR ? ReadResult::RESULT_SERVER_ERROR :
+            response.getCode() == HTTPResponse::NOT_MODIFIED ? ReadResult::RESULT_NOT_MODIFIED :
+                                                               ReadResult::RESULT_UNKNOWN_ERROR );
+
+        //If we have an error but it's recoverable, like a server error or timeout then set the callback to retry.
+        if (HTTPClient::isRecoverable( result.code() ) )
+        {            
+            if (callback)
+            {
+                if ( s_HTTP_DEBUG )
+                {
+                    OE_NOTICE << LC << "Error in HTTPClient for " << request.getURL() << " but it's recoverable" << std::endl;
+                }
+                callback->setNeedsRetry( true );
+            }
+        }
+    }
+
+    // encode headers
+    result.setMetadata( response.getHeadersAsConfig() );
+
+    // last-modified (file time)
+    result.setLastModifiedTime( response.getLastModifiedTime() );
+
+    return result;
+}
+
+/****************************************************************************/
+
+namespace osgEarth
+{
+    /**
+     * Runs asynchronous transfers. Each network thread drives one curl
+     * multi-handle and recycles its easy handles between requests, so sockets
+     * stay open from one tile to the next instead of being torn down with a
+     * per-request handle. All threads share a single CURLSH: DNS results and
+     * SSL sessions (and, on libcurl 7.57+, the connection cache itself) are
+     * common to the whole pool.
+     *
+     * A given host is always served by the same thread, so its requests can
+     * be multiplexed over one HTTP/2 connection and its concurrency limit is
+     * enforced in one place. Within a thread, requests queue per host and
+     * are admitted round-robin across hosts (see HTTPConnectionSettings).
+     */
+    class HTTPAsyncService : public osg::Referenced
+    {
+    public:
+        static HTTPAsyncService* instance();
+
+        Future<HTTPAsyncResponse> get(
+            const HTTPRequest&    request,
+            const osgDB::Options* options,
+            ProgressCallback*     progress );
+
+        /** Worker pool that decodes completed string responses (images use the ImageDecoder's) */
+        TaskService* getDecodeService() const { return _decodeService.get(); }
+
+        /** Decodes an asynchronous response into an image. */
+        struct DecodeImageOperation : public FutureOperation<HTTPAsyncResponse, HTTPAsyncReadResult>
+        {
+            DecodeImageOperation( const HTTPRequest& request, const osgDB::Options* options, ProgressCallback* progress )
+                : _request(request), _options(options), _progress(progress) { }
+
+            HTTPAsyncReadResult* operator()( HTTPAsyncResponse* input, ProgressCallback* )
+            {
+                if ( !input )
+                    return new HTTPAsyncReadResult( ReadResult(ReadResult::RESULT_CANCELED) );
+
+                return new HTTPAsyncReadResult( HTTPClient::decodeImage(_request, input->_response, _options.get(), _progress.get()) );
+            }
+
+            HTTPRequest                        _request;
+            osg::ref_ptr<const osgDB::Options> _options;
+            osg::ref_ptr<ProgressCallback>     _progress;
+        };
+
+        /** Decodes an asynchronous response into a string. */
+        struct DecodeStringOperation : public FutureOperation<HTTPAsyncResponse, HTTPAsyncReadResult>
+        {
+            DecodeStringOperation( const HTTPRequest& request, ProgressCallback* progress )
+                : _request(request), _progress(progress) { }
+
+            HTTPAsyncReadResult* operator()( HTTPAsyncResponse* input, ProgressCallback* )
+            {
+                if ( !input )
+                    return new HTTPAsyncReadResult( ReadResult(ReadResult::RESULT_CANCELED) );
+
+                return new HTTPAsyncReadResult( HTTPClient::decodeString(_request, input->_response, _progress.get()) );
+            }
+
+            HTTPRequest                    _request;
+            osg::ref_ptr<ProgressCallback> _progress;
+        };
+
+    protected:
+        HTTPAsyncService( unsigned numThreads );
+        virtual ~HTTPAsyncService();
+
+        /**
+         * Answers an asynchronous request in replay mode. Replayed requests
+         * never reach the network threads; they run (and wait out their
+         * simulated latency) on a pool sized by HTTPReplaySettings::asyncConcurrency.
+         */
+        struct ReplayTask : public TaskRequest
+        {
+            ReplayTask( const HTTPRequest& request, const osgDB::Options* options, ProgressCallback* progress )
+                : _request(request), _options(options), _progress(progress) { }
+
+            void operator()( ProgressCallback* )
+            {
+                _promise.resolve( new HTTPAsyncResponse(
+                    HTTPClient::getClient().doGet(_request, _options.get(), _progress.get())) );
+            }
+
+            HTTPRequest                        _request;
+            osg::ref_ptr<const osgDB::Options> _options;
+            osg::ref_ptr<ProgressCallback>     _progress;
+            Promise<HTTPAsyncResponse>         _promise;
+        };
+
+        TaskService* getReplayService();
+
+    private:
+        struct Transfer : public osg::Referenced
+        {
+            Transfer( const HTTPRequest& request ) :
+                _request( request ),
+                _part   ( new HTTPResponse::Part() ),
+                _stream ( &_part->_stream ),
+                _headers( 0L ),
+                _start  ( 0 ) { _errorBuf[0] = 0; }
+
+            HTTPRequest                        _request;
+            std::string                        _host;
+            osg::ref_ptr<const osgDB::Options> _options;
+            osg::ref_ptr<ProgressCallback>     _progress;
+            Promise<HTTPAsyncResponse>         _promise;
+            osg::ref_ptr<HTTPResponse::Part>   _part;
+            StreamObject                       _stream;
+            struct curl_slist*                 _headers;
+            std::string                        _url;
+            std::string                        _proxyAddr;
+            std::string                        _proxyAuth;
+            std::string                        _userPwd;
+            char                               _errorBuf[CURL_ERROR_SIZE];
+            osg::Timer_t                       _start;
+        };
+
+        typedef std::list< osg::ref_ptr<Transfer> >      TransferQueue;
+        typedef std::map< CURL*, osg::ref_ptr<Transfer> > ActiveTransfers;
+        typedef std::map< std::string, TransferQueue >    HostQueues;
+        typedef std::map< std::string, unsigned >         HostCounts;
+
+        class IOThread : public OpenThreads::Thread
+        {
+        public:
+            IOThread( CURLSH* share ) : _share(share), _done(false), _revision(~0u), _maxRequestsPerHost(0u) { }
+
+            /** Queues a transfer; picked up on the next pass of the loop */
+            void add( Transfer* transfer );
+
+            /** Cancels outstanding transfers and exits the loop */
+            void setDone();
+
+            virtual void run();
+
+        private:
+            void applySettings( CURLM* multi );
+            void admitTransfers( CURLM* multi );
+            bool startTransfer( CURLM* multi, Transfer* transfer );
+            void finishTransfer( CURLM* multi, CURL* handle, CURLcode result );
+            void cancelTransfer( Transfer* transfer );
+
+            CURLSH*                 _share;
+            Threading::Mutex        _mutex;
+            OpenThreads::Condition  _workAvailable;
+            TransferQueue           _incoming;
+            bool                    _done;
+
+            // only touched by the network thread itself:
+            ActiveTransfers         _active;
+            HostQueues              _waiting;
+            HostCounts              _activePerHost;
+            std::vector<CURL*>      _idleHandles;
+            unsigned                _revision;
+            unsigned                _maxRequestsPerHost;
+        };
+
+        static void lockShare( CURL*, curl_lock_data data, curl_lock_access, void* userptr );
+        static void unlockShare( CURL*, curl_lock_data data, void* userptr );
+
+        CURLSH*                    _share;
+        Threading::Mutex           _shareMutex[CURL_LOCK_DATA_LAST];
+        std::vector<IOThread*>     _threads;
+        osg::ref_ptr<TaskService>  _decodeService;
+        osg::ref_ptr<TaskService>  _replayService;
+        Threading::Mutex           _replayServiceMutex;
+    };
+}
+
+namespace
+{
+    static osg::ref_ptr<HTTPAsyncService> s_asyncService;
+    static Threading::Mutex               s_asyncServiceMutex;
+}
+
+HTTPAsyncService*
+HTTPAsyncService::instance()
+{
+    Threading::ScopedMutexLock lock( s_asyncServiceMutex );
+    if ( !s_asyncService.valid() )
+    {
+        s_asyncService = new HTTPAsyncService( s_numAsyncThreads );
+    }
+    return s_asyncService.get();
+}
+
+HTTPAsyncService::HTTPAsyncService( unsigned numThreads )
+{
+    _share = curl_share_init();
+    curl_share_setopt( _share, CURLSHOPT_LOCKFUNC,   &HTTPAsyncService::lockShare );
+    curl_share_setopt( _share, CURLSHOPT_UNLOCKFUNC, &HTTPAsyncService::unlockShare );
+    curl_share_setopt( _share, CURLSHOPT_USERDATA,   this );
+    curl_share_setopt( _share, CURLSHOPT_SHARE,      CURL_LOCK_DATA_DNS );
+    curl_share_setopt( _share, CURLSHOPT_SHARE,      CURL_LOCK_DATA_SSL_SESSION );
+#if LIBCURL_VERSION_NUM >= 0x073900
+    curl_share_setopt( _share, CURLSHOPT_SHARE,      CURL_LOCK_DATA_CONNECT );
+#endif
+
+    numThreads = osg::maximum( numThreads, 1u );
+    for( unsigned i=0; i<numThreads; ++i )
+    {
+        IOThread* thread = new IOThread( _share );
+        thread->start();
+        _threads.push_back( thread );
+    }
+
+    _decodeService = new TaskService( "HTTP decode", numThreads );
+
+    OE_INFO << LC << "Started " << numThreads << " asynchronous HTTP threads" << std::endl;
+}
+
+HTTPAsyncService::~HTTPAsyncService()
+{
+    for( std::vector<IOThread*>::iterator i = _threads.begin(); i != _threads.end(); ++i )
+    {
+        (*i)->setDone();
+        (*i)->join();
+        delete *i;
+    }
+    _threads.clear();
+
+    curl_share_cleanup( _share );
+    _share = 0L;
+}
+
+void
+HTTPAsyncService::lockShare( CURL*, curl_lock_data data, curl_lock_access, void* userptr )
+{
+    static_cast<HTTPAsyncService*>(userptr)->_shareMutex[data].lock();
+}
+
+void
+HTTPAsyncService::unlockShare( CURL*, curl_lock_data data, void* userptr )
+{
+    static_cast<HTTPAsyncService*>(userptr)->_shareMutex[data].unlock();
+}
+
+Future<HTTPAsyncResponse>
+HTTPAsyncService::get(const HTTPRequest&    request,
+                      const osgDB::Options* options,
+                      ProgressCallback*     progress)
+{
+    if ( readReplayMode() == HTTPReplaySettings::MODE_REPLAY )
+    {
+        osg::ref_ptr<ReplayTask> task = new ReplayTask( request, options, progress );
+        Future<HTTPAsyncResponse> result = task->_promise.getFuture();
+        getReplayService()->add( task.get() );
+        return result;
+    }
+
+    osg::ref_ptr<Transfer> transfer = new Transfer( request );
+    transfer->_host     = getHostKey( request.getURL() );
+    transfer->_options  = options;
+    transfer->_progress = progress;
+
+    Future<HTTPAsyncResponse> result = transfer->_promise.getFuture();
+
+    // pin each host to one thread (and thus one multi-handle).
+    unsigned hash = 0u;
+    for( std::string::const_iterator c = transfer->_host.begin(); c != transfer->_host.end(); ++c )
+        hash = hash * 31u + (unsigned char)(*c);
+
+    _threads[hash % _threads.size()]->add( transfer.get() );
+
+    return result;
+}
+
+TaskService*
+HTTPAsyncService::getReplayService()
+{
+    Threading::ScopedMutexLock lock( _replayServiceMutex );
+    if ( !_replayService.valid() )
+    {
+        int numThreads = (int)osg::maximum( readReplaySettings().asyncConcurrency().get(), 1u );
+        _replayService = new TaskService( "HTTP replay", numThreads );
+    }
+    return _replayService.get();
+}
+
+void
+HTTPAsyncService::IOThread::add( Transfer* transfer )
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    if ( _done )
+    {
+        cancelTransfer( transfer );
+    }
+    else
+    {
+        _incoming.push_back( transfer );
+        _workAvailable.signal();
+    }
+}
+
+void
+HTTPAsyncService::IOThread::setDone()
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    _done = true;
+    _workAvailable.signal();
+}
+
+void
+HTTPAsyncService::IOThread::cancelTransfer( Transfer* transfer )
+{
+    HTTPResponse response( 0L );
+    response._cancelled = true;
+    transfer->_promise.resolve( new HTTPAsyncResponse(response) );
+}
+
+void
+HTTPAsyncService::IOThread::run()
+{
+    CURLM* multi = curl_multi_init();
+
+    while( true )
+    {
+        TransferQueue incoming;
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            while( !_done && _incoming.empty() && _active.empty() && _waiting.empty() )
+            {
+                _workAvailable.wait( &_mutex );
+            }
+
+            if ( _done )
+            {
+                break;
+            }
+
+            incoming.swap( _incoming );
+        }
+
+        for( TransferQueue::iterator i = incoming.begin(); i != incoming.end(); ++i )
+        {
+            _waiting[(*i)->_host].push_back( *i );
+        }
+
+        applySettings( multi );
+        admitTransfers( multi );
+
+        int running = 0;
+        curl_multi_perform( multi, &running );
+
+        CURLMsg* msg;
+        int      remaining;
+        while( (msg = curl_multi_info_read(multi, &remaining)) != 0L )
+        {
+            if ( msg->msg == CURLMSG_DONE )
+            {
+                finishTransfer( multi, msg->easy_handle, msg->data.result );
+            }
+        }
+
+        if ( !_active.empty() )
+        {
+#if LIBCURL_VERSION_NUM >= 0x071c00
+            curl_multi_wait( multi, 0L, 0, 10, 0L );
+#else
+            OpenThreads::Thread::microSleep( 1000 );
+#endif
+        }
+    }
+
+    // shutting down: anything still queued or on the wire is canceled.
+    for( ActiveTransfers::iterator i = _active.begin(); i != _active.end(); ++i )
+    {
+        curl_multi_remove_handle( multi, i->first );
+        if ( i->second->_headers )
+            curl_slist_free_all( i->second->_headers );
+        cancelTransfer( i->second.get() );
+        _idleHandles.push_back( i->first );
+    }
+    _active.clear();
+    _activePerHost.clear();
+
+    for( HostQueues::iterator q = _waiting.begin(); q != _waiting.end(); ++q )
+    {
+        for( TransferQueue::iterator i = q->second.begin(); i != q->second.end(); ++i )
+            cancelTransfer( i->get() );
+    }
+    _waiting.clear();
+
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        for( TransferQueue::iterator i = _incoming.begin(); i != _incoming.end(); ++i )
+            cancelTransfer( i->get() );
+        _incoming.clear();
+    }
+
+    for( std::vector<CURL*>::iterator i = _idleHandles.begin(); i != _idleHandles.end(); ++i )
+    {
+        curl_easy_cleanup( *i );
+    }
+    _idleHandles.clear();
+
+    curl_multi_cleanup( multi );
+}
+
+void
+HTTPAsyncService::IOThread::applySettings( CURLM* multi )
+{
+    unsigned revision;
+    HTTPConnectionSettings settings = readConnectionSettings( &revision );
+    if ( revision == _revision )
+        return;
+
+    _revision = revision;
+    _maxRequestsPerHost = settings.getMaxRequestsPerHost();
+
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    curl_multi_setopt( multi, CURLMOPT_PIPELINING, settings.http2() == true ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING );
+#endif
+#if LIBCURL_VERSION_NUM >= 0x071e00
+    curl_multi_setopt( multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)settings.maxConnectionsPerHost().get() );
+#endif
+#if LIBCURL_VERSION_NUM >= 0x074300
+    curl_multi_setopt( multi, CURLMOPT_MAX_CONCURRENT_STREAMS, (long)settings.maxStreamsPerHost().get() );
+#endif
+}
+
+void
+HTTPAsyncService::IOThread::admitTransfers( CURLM* multi )
+{
+    // One request per host per pass, so every waiting host gets its turn
+    // before any host gets a second one.
+    bool admitted = true;
+    while( admitted && !_waiting.empty() )
+    {
+        admitted = false;
+        for( HostQueues::iterator q = _waiting.begin(); q != _waiting.end(); )
+        {
+            unsigned& active = _activePerHost[q->first];
+            if ( _maxRequestsPerHost == 0u || active < _maxRequestsPerHost )
+            {
+                osg::ref_ptr<Transfer> t = q->second.front();
+                q->second.pop_front();
+                if ( startTransfer(multi, t.get()) )
+                    ++active;
+                admitted = true;
+            }
+
+            if ( active == 0u )
+                _activePerHost.erase( q->first );
+
+            if ( q->second.empty() )
+                _waiting.erase( q++ );
+            else
+                ++q;
+        }
+    }
+}
+
+bool
+HTTPAsyncService::IOThread::startTransfer( CURLM* multi, Transfer* t )
+{
+    if ( t->_progress.valid() && t->_progress->isCanceled() )
+    {
+        cancelTransfer( t );
+        return false;
+    }
+
+    CURL* handle;
+    if ( _idleHandles.empty() )
+    {
+        handle = curl_easy_init();
+    }
+    else
+    {
+        handle = _idleHandles.back();
+        _idleHandles.pop_back();
+        curl_easy_reset( handle );
+    }
+
+    applyDefaultOptions( handle );
+    curl_easy_setopt( handle, CURLOPT_SHARE, _share );
+
+    // the proxy and url logic match HTTPClient::doGet.
+    HTTPClient::getClient().resolveProxy( t->_options.get(), t->_proxyAddr, t->_proxyAuth );
+    if ( !t->_proxyAddr.empty() )
+    {
+        curl_easy_setopt( handle, CURLOPT_PROXY, t->_proxyAddr.c_str() );
+        if ( !t->_proxyAuth.empty() )
+        {
+            curl_easy_setopt( handle, CURLOPT_PROXYUSERPWD, t->_proxyAuth.c_str() );
+        }
+    }
+
+    t->_url = t->_request.getURL();
+    osg::ref_ptr< URLRewriter > rewriter = HTTPClient::getURLRewriter();
+    if ( rewriter.valid() )
+    {
+        std::string oldURL = t->_url;
+        t->_url = rewriter->rewrite( oldURL );
+        OE_INFO << LC << "Rewrote URL " << oldURL << " to " << t->_url << std::endl;
+    }
+
+    const osgDB::AuthenticationMap* authenticationMap = (t->_options.valid() && t->_options->getAuthenticationMap()) ? 
+            t->_options->getAuthenticationMap() :
+            osgDB::Registry::instance()->getAuthenticationMap();
+
+    const osgDB::AuthenticationDetails* details = authenticationMap ?
+        authenticationMap->getAuthenticationDetails( t->_url ) :
+        0;
+
+    if ( details )
+    {
+        t->_userPwd = details->username + std::string(":") + details->password;
+        curl_easy_setopt( handle, CURLOPT_USERPWD, t->_userPwd.c_str() );
+#if LIBCURL_VERSION_NUM >= 0x070a07
+        curl_easy_setopt( handle, CURLOPT_HTTPAUTH, details->httpAuthentication );
+#endif
+    }
+
+    for (HTTPRequest::Parameters::const_iterator itr = t->_request.getHeaders().begin(); itr != t->_request.getHeaders().end(); ++itr)
+    {
+        std::stringstream buf;
+        buf << itr->first << ": " << itr->second;
+        t->_headers = curl_slist_append( t->_headers, buf.str().c_str() );
+    }
+
+    // Disable the default Pragma: no-cache that curl adds by default.
+    t->_headers = curl_slist_append( t->_headers, "Pragma: " );
+    curl_easy_setopt( handle, CURLOPT_HTTPHEADER, t->_headers );
+
+    curl_easy_setopt( handle, CURLOPT_URL, t->_url.c_str() );
+    curl_easy_setopt( handle, CURLOPT_PROGRESSDATA, t->_progress.get() );
+    curl_easy_setopt( handle, CURLOPT_ERRORBUFFER, (void*)t->_errorBuf );
+    curl_easy_setopt( handle, CURLOPT_WRITEDATA, (void*)&t->_stream );
+    curl_easy_setopt( handle, CURLOPT_HEADERDATA, (void*)&t->_stream );
+    curl_easy_setopt( handle, CURLOPT_SSL_VERIFYPEER, (void*)0 );
+
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    // wait for an existing connection to offer multiplexing rather than
+    // opening a new one for every request to the same host.
+    curl_easy_setopt( handle, CURLOPT_PIPEWAIT, 1L );
+#endif
+
+    osg::ref_ptr< CurlConfigHandler > curlConfigHandler = HTTPClient::getCurlConfigHandler();
+    if (curlConfigHandler.valid()) {
+        curlConfigHandler->onGet(handle);
+    }
+
+    t->_start = osg::Timer::instance()->tick();
+    _active[handle] = t;
+    curl_multi_add_handle( multi, handle );
+    return true;
+}
+
+void
+HTTPAsyncService::IOThread::finishTransfer( CURLM* multi, CURL* handle, CURLcode result )
+{
+    curl_multi_remove_handle( multi, handle );
+
+    ActiveTransfers::iterator i = _active.find( handle );
+    if ( i == _active.end() )
+    {
+        _idleHandles.push_back( handle );
+        return;
+    }
+
+    osg::ref_ptr<Transfer> t = i->second;
+    _active.erase( i );
+
+    HostCounts::iterator count = _activePerHost.find( t->_host );
+    if ( count != _activePerHost.end() && --count->second == 0u )
+        _activePerHost.erase( count );
+
+    long response_code = 0L;
+    curl_easy_getinfo( handle, CURLINFO_RESPONSE_CODE, &response_code );
+
+    HTTPResponse response( response_code );
+    HTTPClient::getClient().assembleResponse( handle, result, t->_part.get(), t->_stream._headers, response );
+    response._duration_s = osg::Timer::instance()->delta_s( t->_start, osg::Timer::instance()->tick() );
+    recordTransfer( response );
+    HTTPClient::recordResponse( t->_url, response );
+
+    if ( t->_progress.valid() )
+    {
+        t->_progress->stats()["http_get_time"] += response._duration_s;
+        t->_progress->stats()["http_get_count"] += 1;
+        if ( response._cancelled )
+            t->_progress->stats()["http_cancel_count"] += 1;
+    }
+
+    if ( s_HTTP_DEBUG )
+    {
+        OE_NOTICE << LC 
+            << "GET(" << response_code << ", " << response._mimeType << ") : \"" 
+            << t->_url << "\" async t="
+            << std::setprecision(4) << response.getDuration() << "s" << std::endl;
+
+        if ( result != CURLE_OK && t->_errorBuf[0] )
+        {
+            OE_NOTICE << LC << "    " << t->_errorBuf << std::endl;
+        }
+    }
+
+    if ( t->_headers )
+    {
+        curl_slist_free_all( t->_headers );
+        t->_headers = 0L;
+    }
+
+    // keep the handle (and with it the connection) for the next request
+    _idleHandles.push_back( handle );
+
+    t->_promise.resolve( new HTTPAsyncResponse(response) );
+}
+
+/****************************************************************************/
+
+Future<HTTPAsyncResponse>
+HTTPClient::getAsync(const HTTPRequest&    request,
+                     const osgDB::Options* options,
+                     ProgressCallback*     progress)
+{
+    return HTTPAsyncService::instance()->get( request, options, progress );
+}
+
+Future<HTTPAsyncReadResult>
+HTTPClient::readImageAsync(const HTTPRequest&    request,
+                           const osgDB::Options* options,
+                           ProgressCallback*     progress)
+{
+    // images decode on the decoder's own pool, shared by all layers.
+    HTTPAsyncService* service = HTTPAsyncService::instance();
+    return service->get( request, options, progress ).then<HTTPAsyncReadResult>(
+        ImageDecoder::instance()->getTaskService(),
+        new HTTPAsyncService::DecodeImageOperation( request, options, progress ) );
+}
+
+Future<HTTPAsyncReadResult>
+HTTPClient::readStringAsync(const HTTPRequest&    request,
+                            const osgDB::Options* options,
+                            ProgressCallback*     progress)
+{
+    HTTPAsyncService* service = HTTPAsyncService::instance();
+    return service->get( request, options, progress ).then<HTTPAsyncReadResult>(
+        service->getDecodeService(),
+        new HTTPAsyncService::DecodeStringOperation( request, progress ) );
+}
+
+void
+HTTPClient::setNumAsyncThreads( unsigned num )
+{
+    s_numAsyncThreads = osg::maximum( num, 1u );
+}
+
+unsigned
+HTTPClient::getNumAsyncThreads()
+{
+    return s_numAsyncThreads;
+}
+
+void
+HTTPClient::getStatistics( HTTPStatistics& output )
+{
+    Threading::ScopedMutexLock lock( s_statsMutex );
+    output = s_stats;
+}
+
+void
+HTTPClient::resetStatistics()
+{
+    Threading::ScopedMutexLock lock( s_statsMutex );
+    s_stats = HTTPStatistics();
+}
@@ -23,9 +23,69 @@
 #include <osgEarth/CullingUtils>
 #include <osgEarth/ImageUtils>
 #include <osg/Notify>
+#include <vector>
 
 using namespace osgEarth;
 
+namespace
+{
+    /**
+     * Bilinear samples at fractional pixel positions. Mirrors the math of
+     * getHeightAtPixel(), but the degenerate (edge/exact) cases fall out of
+     * zero weights and the no-data test is a select, so the loop has no
+     * data-dependent branches.
+     */
+    void sampleBilinear(const osg::HeightField* hf,
+                        const double* c, const double* r, unsigned count,
+                        float* out)
+    {
+        const float* heights = &hf->getHeightList()[0];
+        const int    cols    = (int)hf->getNumColumns();
+        const int    rows    = (int)hf->getNumRows();
+
+        for( unsigned i=0; i<count; ++i )
+        {
+            int rowMin = osg::maximum((int)floor(r[i]), 0);
+            int rowMax = osg::maximum(osg::minimum((int)ceil(r[i]), rows-1), 0);
+            int colMin = osg::maximum((int)floor(c[i]), 0);
+            int colMax = osg::maximum(osg::minimum((int)ceil(c[i]), cols-1), 0);
+            rowMin = osg::minimum(rowMin, rowMax);
+            colMin = osg::minimum(colMin, colMax);
+
+            float llHeight = heights[colMin + rowMin*cols];
+            float lrHeight = heights[colMax + rowMin*cols];
+            float ulHeight = heights[colMin + rowMax*cols];
+            float urHeight = heights[colMax + rowMax*cols];
+
+            double fx = (c[i] - (double)colMin) * (double)(colMax != colMin);
+            double fy = (r[i] - (double)rowMin) * (double)(rowMax != rowMin);
+
+            float r1 = (1.0 - fx) * llHeight + fx * lrHeight;
+            float r2 = (1.0 - fx) * ulHeight + fx * urHeight;
+            float h  = (1.0 - fy) * r1 + fy * r2;
+
+            bool valid =
+                (llHeight != NO_DATA_VALUE) & (lrHeight != NO_DATA_VALUE) &
+                (ulHeight != NO_DATA_VALUE) & (urHeight != NO_DATA_VALUE);
+
+            out[i] = valid ? h : NO_DATA_VALUE;
+        }
+    }
+
+    void sampleNearest(const osg::HeightField* hf,
+                       const double* c, const double* r, unsigned count,
+                       float* out)
+    {
+        const float* heights = &hf->getHeightList()[0];
+        const int    cols    = (int)hf->getNumColumns();
+
+        for( unsigned i=0; i<count; ++i )
+        {
+            out[i] = heights[(unsigned)osg::round(c[i]) + (unsigned)osg::round(r[i])*cols];
+        }
+    }
+}
+
 float
 HeightFieldUtils::getHeightAtPixel(const osg::HeightField* hf, double c, double r, ElevationInterpolation interpolation)
 {
@@ -185,6 +245,31 @@ HeightFieldUtils::getHeightAtPixel(const osg::HeightField* hf, double c, double
     return result;
 }
 
+void
+HeightFieldUtils::getHeightsAtPixels(const osg::HeightField* hf,
+                                     const double* c, const double* r,
+                                     unsigned count,
+                                     float* out_heights,
+                                     ElevationInterpolation interpolation)
+{
+    if ( !hf || count == 0 )
+        return;
+
+    if ( interpolation == INTERP_BILINEAR )
+    {
+        sampleBilinear( hf, c, r, count, out_heights );
+    }
+    else if ( interpolation == INTERP_NEAREST )
+    {
+        sampleNearest( hf, c, r, count, out_heights );
+    }
+    else
+    {
+        for( unsigned i=0; i<count; ++i )
+            out_heights[i] = getHeightAtPixel( hf, c[i], r[i], interpolation );
+    }
+}
+
 bool
 HeightFieldUtils::getInterpolatedHeight(const osg::HeightField* hf, 
                                         unsigned c, unsigned r, 
@@ -237,6 +322,29 @@ HeightFieldUtils::getHeightAtNormalizedLocation(const osg::HeightField* input,
     return getHeightAtPixel( input, px, py, interp );
 }
 
+void
+HeightFieldUtils::getHeightsAtNormalizedLocations(const osg::HeightField* input,
+                                                  const double* nx, const double* ny,
+                                                  unsigned count,
+                                                  float* out_heights,
+                                                  ElevationInterpolation interp)
+{
+    if ( !input || count == 0 )
+        return;
+
+    double xcells = (double)(input->getNumColumns() - 1);
+    double ycells = (double)(input->getNumRows() - 1);
+
+    std::vector<double> px( count ), py( count );
+    for( unsigned i=0; i<count; ++i )
+    {
+        px[i] = osg::clampBetween(nx[i], 0.0, 1.0) * xcells;
+        py[i] = osg::clampBetween(ny[i], 0.0, 1.0) * ycells;
+    }
+
+    getHeightsAtPixels( input, &px[0], &py[0], count, out_heights, interp );
+}
+
 bool
 HeightFieldUtils::getHeightAtNormalizedLocation(const HeightFieldNeighborhood& hood,
                                                 double nx, double ny,
@@ -338,13 +446,17 @@ HeightFieldUtils::createSubSample(const osg::HeightField* input,
     double x, y;
     int col, row;
 
+    // pixel positions in the input; same as getHeightAtLocation() computes.
+    std::vector<double> px( numCols ), py( numCols );
     for( x = outputEx.xMin(), col=0; col < numCols; x += dx, col++ )
     {
-        for( y = outputEx.yMin(), row=0; row < numRows; y += dy, row++ )
-        {
-            float height = HeightFieldUtils::getHeightAtLocation( input, x, y, inputEx.xMin(), inputEx.yMin(), xInterval, yInterval, interpolation);
-            dest->setHeight( col, row, height );
-        }
+        px[col] = osg::clampBetween( (x - inputEx.xMin()) / xInterval, 0.0, (double)(numCols-1) );
+    }
+
+    for( y = outputEx.yMin(), row=0; row < numRows; y += dy, row++ )
+    {
+        py.assign( numCols, osg::clampBetween( (y - inputEx.yMin()) / yInterval, 0.0, (double)(numRows-1) ) );
+        getHeightsAtPixels( input, &px[0], &py[0], numCols, &dest->getHeightList()[row*numCols], interpolation );
     }
 
     osg::Vec3d orig( outputEx.xMin(), outputEx.yMin(), input->getOrigin().z() );
@@ -380,15 +492,16 @@ HeightFieldUtils::resampleHeightField(osg::HeightField*      input,
     output->setYInterval( stepY );
     output->setOrigin( origin );
     
+    std::vector<double> nx( newColumns ), ny( newColumns );
+    for( int x = 0; x < newColumns; ++x )
+    {
+        nx[x] = (double)x / (double)(newColumns-1);
+    }
+
     for( int y = 0; y < newRows; ++y )
     {
-        for( int x = 0; x < newColumns; ++x )
-        {
-            double nx = (double)x / (double)(newColumns-1);
-            double ny = (double)y / (double)(newRows-1);
-            float h = getHeightAtNormalizedLocation( input, nx, ny, interp );
-            output->setHeight( x, y, h );
-        }
+        ny.assign( newColumns, (double)y / (double)(newRows-1) );
+        getHeightsAtNormalizedLocations( input, &nx[0], &ny[0], newColumns, &output->getHeightList()[y*newColumns], interp );
     }
 
     return output;
@@ -19,6 +19,8 @@
 #include <osgEarth/Horizon>
 #include <osg/Transform>
 #include <osgEarth/Registry>
+#include <osgEarth/CullingUtils>
+#include <osg/FrameStamp>
 
 using namespace osgEarth;
 
@@ -161,6 +163,129 @@ Horizon::getPlane(osg::Plane& out_plane) const
 
 //........................................................................
 
+namespace
+{
+    // entries not used for this many frames are pruned (e.g., deleted cameras)
+    const unsigned MAX_IDLE_FRAMES = 60u;
+}
+
+bool
+HorizonCache::Key::operator < (const Key& rhs) const
+{
+    if ( _nv < rhs._nv ) return true;
+    if ( _nv > rhs._nv ) return false;
+    if ( _camera < rhs._camera ) return true;
+    if ( _camera > rhs._camera ) return false;
+    return _scale < rhs._scale;
+}
+
+HorizonCache::HorizonCache()
+{
+    //nop
+}
+
+bool
+HorizonCache::get(osg::NodeVisitor* nv,
+                  const Horizon&    prototype,
+                  Horizon&          out_horizon,
+                  osg::Matrix&      out_eyeToWorld)
+{
+    osgUtil::CullVisitor* cv = Culling::asCullVisitor(nv);
+    if ( !cv || !cv->getModelViewMatrix() )
+        return false;
+
+    // key on the visitor as well as the camera, since stereo rendering culls
+    // the same camera twice per frame with different views.
+    Key key;
+    key._nv     = nv;
+    key._camera = cv->getCurrentCamera();
+    key._scale  = prototype._scale;
+
+    unsigned frame = nv->getFrameStamp() ? nv->getFrameStamp()->getFrameNumber() : 0u;
+
+    // fast path: already computed for this camera this frame.
+    {
+        Threading::ScopedReadLock shared( _mutex );
+        Entries::const_iterator i = _entries.find( key );
+        if ( i != _entries.end() && i->second._frame == frame )
+        {
+            out_horizon    = i->second._horizon;
+            out_eyeToWorld = i->second._eyeToWorld;
+            return true;
+        }
+    }
+
+    // first query this frame: resolve the world frame from this node once.
+    osg::Matrix local2world = osg::computeLocalToWorld( nv->getNodePath() );
+
+    Entry entry;
+    entry._frame      = frame;
+    entry._horizon    = prototype;
+    entry._horizon.setEye( osg::Vec3d(nv->getViewPoint()) * local2world );
+    entry._eyeToWorld = osg::Matrix::inverse(*cv->getModelViewMatrix()) * local2world;
+
+    {
+        Threading::ScopedWriteLock exclusive( _mutex );
+        _entries[key] = entry;
+
+        for( Entries::iterator i = _entries.begin(); i != _entries.end(); )
+        {
+            if ( i->second._frame + MAX_IDLE_FRAMES < frame )
+                _entries.erase( i++ );
+            else
+                ++i;
+        }
+    }
+
+    out_horizon    = entry._horizon;
+    out_eyeToWorld = entry._eyeToWorld;
+    return true;
+}
+
+bool
+HorizonCache::occludes(osg::NodeVisitor*          nv,
+                       const Horizon&             prototype,
+                       const osg::BoundingSphere& localBound)
+{
+    Horizon     horizon;
+    osg::Matrix eyeToWorld;
+    if ( !localBound.valid() || !get(nv, prototype, horizon, eyeToWorld) )
+        return false;
+
+    osg::Matrix local2world = (*Culling::asCullVisitor(nv)->getModelViewMatrix()) * eyeToWorld;
+    return horizon.occludes( localBound.center() * local2world, localBound.radius() );
+}
+
+unsigned
+HorizonCache::occludes(osg::NodeVisitor*                       nv,
+                       const Horizon&                          prototype,
+                       const std::vector<osg::BoundingSphere>& localBounds,
+                       std::vector<bool>&                      out_occluded)
+{
+    out_occluded.assign( localBounds.size(), false );
+
+    Horizon     horizon;
+    osg::Matrix eyeToWorld;
+    if ( !get(nv, prototype, horizon, eyeToWorld) )
+        return 0u;
+
+    osg::Matrix local2world = (*Culling::asCullVisitor(nv)->getModelViewMatrix()) * eyeToWorld;
+
+    unsigned count = 0u;
+    for( unsigned i=0; i<localBounds.size(); ++i )
+    {
+        const osg::BoundingSphere& bs = localBounds[i];
+        if ( bs.valid() && horizon.occludes(bs.center() * local2world, bs.radius()) )
+        {
+            out_occluded[i] = true;
+            ++count;
+        }
+    }
+    return count;
+}
+
+//........................................................................
+
 HorizonCullCallback::HorizonCullCallback() :
 _enabled( true )
 {
@@ -181,15 +306,8 @@ HorizonCullCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
 
     if ( _enabled && node && nv && nv->getVisitorType() == nv->CULL_VISITOR )
     {
-        osg::Matrix local2world = osg::computeLocalToWorld(nv->getNodePath());
-
-        // make a local copy to support multi-threaded cull
-        Horizon horizon(_horizon);
-        horizon.setEye( osg::Vec3d(nv->getViewPoint()) * local2world );
-
-        const osg::BoundingSphere& bs = node->getBound();
-
-        visible = !horizon.occludes( bs.center() * local2world, bs.radius() );
+        // the shared cache sets up the eye once per camera per frame.
+        visible = !Registry::instance()->getHorizonCache()->occludes( nv, _horizon, node->getBound() );
     }
 
     if ( visible )
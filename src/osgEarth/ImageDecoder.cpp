@@ -0,0 +1,515 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/ImageDecoder>
+#include <osgEarth/Registry>
+#include <osgEarth/TaskService>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/Registry>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string.h>
+
+#ifdef OSGEARTH_HAVE_TURBOJPEG
+#   include <turbojpeg.h>
+#endif
+
+#ifdef OSGEARTH_HAVE_PNG
+#   include <png.h>
+#endif
+
+#ifdef OSGEARTH_HAVE_WEBP
+#   include <webp/decode.h>
+#endif
+
+#define LC "[ImageDecoder] "
+
+using namespace osgEarth;
+
+//------------------------------------------------------------------------
+
+namespace osgEarth
+{
+    /**
+     * Image whose data buffer belongs to an ImagePool. The buffer is set
+     * with NO_DELETE, so the osg::Image destructor leaves it alone and it
+     * goes back to the pool instead.
+     */
+    class PooledImage : public osg::Image
+    {
+    public:
+        PooledImage( ImagePool* pool, unsigned char* buffer, unsigned size ) :
+            _pool  ( pool ),
+            _buffer( buffer ),
+            _size  ( size ) { }
+
+    protected:
+        virtual ~PooledImage()
+        {
+            // even if the image's data was replaced since, the buffer is still ours.
+            _pool->release( _buffer, _size );
+        }
+
+        osg::ref_ptr<ImagePool> _pool;
+        unsigned char*          _buffer;
+        unsigned                _size;
+    };
+}
+
+ImagePool::ImagePool( unsigned maxBytes ) :
+_maxBytes   ( maxBytes ),
+_pooledBytes( 0u )
+{
+    //nop
+}
+
+ImagePool::~ImagePool()
+{
+    clear();
+}
+
+osg::Image*
+ImagePool::createImage( int s, int t, GLenum pixelFormat, GLenum dataType, int packing )
+{
+    unsigned size = osg::Image::computeImageSizeInBytes( s, t, 1, pixelFormat, dataType, packing );
+    unsigned char* buffer = acquire( size );
+
+    PooledImage* image = new PooledImage( this, buffer, size );
+    image->setImage( s, t, 1, pixelFormat, pixelFormat, dataType, buffer, osg::Image::NO_DELETE, packing );
+    return image;
+}
+
+void
+ImagePool::setMaxBytes( unsigned value )
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    _maxBytes = value;
+
+    // trim the largest buffers first.
+    for( FreeLists::reverse_iterator i = _free.rbegin(); i != _free.rend() && _pooledBytes > _maxBytes; ++i )
+    {
+        while( !i->second.empty() && _pooledBytes > _maxBytes )
+        {
+            delete [] i->second.back();
+            i->second.pop_back();
+            _pooledBytes -= i->first;
+        }
+    }
+}
+
+void
+ImagePool::clear()
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    for( FreeLists::iterator i = _free.begin(); i != _free.end(); ++i )
+    {
+        for( std::vector<unsigned char*>::iterator j = i->second.begin(); j != i->second.end(); ++j )
+            delete [] *j;
+    }
+    _free.clear();
+    _pooledBytes = 0u;
+}
+
+unsigned char*
+ImagePool::acquire( unsigned size )
+{
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        FreeLists::iterator i = _free.find( size );
+        if ( i != _free.end() && !i->second.empty() )
+        {
+            unsigned char* buffer = i->second.back();
+            i->second.pop_back();
+            _pooledBytes -= size;
+            return buffer;
+        }
+    }
+    return new unsigned char[size];
+}
+
+void
+ImagePool::release( unsigned char* buffer, unsigned size )
+{
+    if ( !buffer )
+        return;
+
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        if ( _pooledBytes + size <= _maxBytes )
+        {
+            _free[size].push_back( buffer );
+            _pooledBytes += size;
+            return;
+        }
+    }
+    delete [] buffer;
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    static osg::ref_ptr<ImageDecoder> s_decoder;
+    static Threading::Mutex           s_decoderMutex;
+    static unsigned                   s_numDecodeThreads = 4;
+
+    // keeps a few idle decompressors; more than that are destroyed on release.
+    const unsigned MAX_IDLE_JPEG_HANDLES = 16;
+
+    osgDB::ReaderWriter* getReaderForFormat( ImageDecoder::Format format )
+    {
+        const char* ext =
+            format == ImageDecoder::FORMAT_JPEG ? "jpg" :
+            format == ImageDecoder::FORMAT_PNG  ? "png" :
+            format == ImageDecoder::FORMAT_WEBP ? "webp" :
+            0L;
+
+        return ext ? osgDB::Registry::instance()->getReaderWriterForExtension( ext ) : 0L;
+    }
+}
+
+ImageDecoder*
+ImageDecoder::instance()
+{
+    Threading::ScopedMutexLock lock( s_decoderMutex );
+    if ( !s_decoder.valid() )
+    {
+        s_decoder = new ImageDecoder();
+    }
+    return s_decoder.get();
+}
+
+void
+ImageDecoder::setNumThreads( unsigned value )
+{
+    s_numDecodeThreads = osg::maximum( value, 1u );
+}
+
+unsigned
+ImageDecoder::getNumThreads()
+{
+    return s_numDecodeThreads;
+}
+
+ImageDecoder::ImageDecoder() :
+_pool( new ImagePool() )
+{
+    OE_INFO << LC << "Fast decoders:"
+        << (hasFastDecoder(FORMAT_JPEG) ? " jpeg" : "")
+        << (hasFastDecoder(FORMAT_PNG)  ? " png"  : "")
+        << (hasFastDecoder(FORMAT_WEBP) ? " webp" : "")
+        << (hasFastDecoder(FORMAT_JPEG) || hasFastDecoder(FORMAT_PNG) || hasFastDecoder(FORMAT_WEBP) ? "" : " none")
+        << std::endl;
+}
+
+ImageDecoder::~ImageDecoder()
+{
+#ifdef OSGEARTH_HAVE_TURBOJPEG
+    for( std::vector<void*>::iterator i = _jpegHandles.begin(); i != _jpegHandles.end(); ++i )
+        tjDestroy( (tjhandle)*i );
+#endif
+    _jpegHandles.clear();
+}
+
+TaskService*
+ImageDecoder::getTaskService()
+{
+    Threading::ScopedMutexLock lock( _serviceMutex );
+    if ( !_service.valid() )
+    {
+        _service = new TaskService( "Image decode", s_numDecodeThreads );
+        Registry::instance()->registerTaskService( _service.get() );
+    }
+    return _service.get();
+}
+
+ImageDecoder::Format
+ImageDecoder::getFormat( const char* data, unsigned size )
+{
+    const unsigned char* u = reinterpret_cast<const unsigned char*>( data );
+
+    if ( size >= 3 && u[0] == 0xFF && u[1] == 0xD8 && u[2] == 0xFF )
+        return FORMAT_JPEG;
+
+    if ( size >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0 )
+        return FORMAT_PNG;
+
+    if ( size >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data+8, "WEBP", 4) == 0 )
+        return FORMAT_WEBP;
+
+    return FORMAT_UNKNOWN;
+}
+
+ImageDecoder::Format
+ImageDecoder::getFormatForExtension( const std::string& ext )
+{
+    std::string lc = osgDB::convertToLowerCase( ext );
+    if ( lc == "jpg" || lc == "jpeg" || lc == "jpe" )
+        return FORMAT_JPEG;
+    if ( lc == "png" )
+        return FORMAT_PNG;
+    if ( lc == "webp" )
+        return FORMAT_WEBP;
+    return FORMAT_UNKNOWN;
+}
+
+bool
+ImageDecoder::hasFastDecoder( ImageDecoder::Format format )
+{
+    switch( format )
+    {
+#ifdef OSGEARTH_HAVE_TURBOJPEG
+    case FORMAT_JPEG: return true;
+#endif
+#ifdef OSGEARTH_HAVE_PNG
+    case FORMAT_PNG:  return true;
+#endif
+#ifdef OSGEARTH_HAVE_WEBP
+    case FORMAT_WEBP: return true;
+#endif
+    default:          return false;
+    }
+}
+
+ReadResult
+ImageDecoder::decode(const std::string&    data,
+                     osgDB::ReaderWriter*  reader,
+                     const osgDB::Options* options)
+{
+    Format format = getFormat( data.data(), data.size() );
+
+    osg::ref_ptr<osg::Image> image =
+        format == FORMAT_JPEG ? decodeJPEG( data.data(), data.size() ) :
+        format == FORMAT_PNG  ? decodePNG ( data.data(), data.size() ) :
+        format == FORMAT_WEBP ? decodeWebP( data.data(), data.size() ) :
+        0L;
+
+    if ( image.valid() )
+        return ReadResult( image.get() );
+
+    // no fast decoder, or one that passed on this image; use the plugin.
+    if ( !reader )
+        reader = getReaderForFormat( format );
+
+    if ( !reader )
+        return ReadResult( ReadResult::RESULT_NO_READER );
+
+    std::istringstream buf( data );
+    osgDB::ReaderWriter::ReadResult rr = reader->readImage( buf, options );
+    if ( rr.validImage() )
+        return ReadResult( rr.takeImage() );
+
+    ReadResult result( ReadResult::RESULT_READER_ERROR );
+    result.setErrorDetail( rr.message() );
+    return result;
+}
+
+bool
+ImageDecoder::readFile(const std::string&    filename,
+                       const osgDB::Options* options,
+                       ReadResult&           out_result)
+{
+    Format format = getFormatForExtension( osgDB::getFileExtension(filename) );
+    if ( !hasFastDecoder(format) )
+        return false;
+
+    // a read callback may redirect the file; let osgDB handle it.
+    if ( osgDB::Registry::instance()->getReadFileCallback() || (options && options->getReadFileCallback()) )
+        return false;
+
+    std::string path = osgDB::findDataFile( filename, options );
+    if ( path.empty() )
+        return false;
+
+    std::ifstream in( path.c_str(), std::ios::in | std::ios::binary );
+    if ( !in.is_open() )
+        return false;
+
+    std::string data( (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>() );
+
+    osg::ref_ptr<osg::Image> image =
+        format == FORMAT_JPEG ? decodeJPEG( data.data(), data.size() ) :
+        format == FORMAT_PNG  ? decodePNG ( data.data(), data.size() ) :
+        decodeWebP( data.data(), data.size() );
+
+    if ( !image.valid() )
+        return false;
+
+    image->setFileName( filename );
+    out_result = ReadResult( image.get() );
+    return true;
+}
+
+void*
+ImageDecoder::acquireJPEGHandle()
+{
+#ifdef OSGEARTH_HAVE_TURBOJPEG
+    {
+        Threading::ScopedMutexLock lock( _jpegHandlesMutex );
+        if ( !_jpegHandles.empty() )
+        {
+            void* handle = _jpegHandles.back();
+            _jpegHandles.pop_back();
+            return handle;
+        }
+    }
+    return tjInitDecompress();
+#else
+    return 0L;
+#endif
+}
+
+void
+ImageDecoder::releaseJPEGHandle( void* handle )
+{
+#ifdef OSGEARTH_HAVE_TURBOJPEG
+    if ( !handle )
+        return;
+
+    {
+        Threading::ScopedMutexLock lock( _jpegHandlesMutex );
+        if ( _jpegHandles.size() < MAX_IDLE_JPEG_HANDLES )
+        {
+            _jpegHandles.push_back( handle );
+            return;
+        }
+    }
+    tjDestroy( (tjhandle)handle );
+#endif
+}
+
+osg::Image*
+ImageDecoder::decodeJPEG( const char* data, unsigned size )
+{
+#ifdef OSGEARTH_HAVE_TURBOJPEG
+    tjhandle handle = (tjhandle)acquireJPEGHandle();
+    if ( !handle )
+        return 0L;
+
+    // older TurboJPEG headers take a non-const source buffer.
+    unsigned char* jpegBuf = reinterpret_cast<unsigned char*>( const_cast<char*>(data) );
+
+    osg::ref_ptr<osg::Image> image;
+    int width, height, subsamp, colorspace;
+
+    if ( tjDecompressHeader3(handle, jpegBuf, size, &width, &height, &subsamp, &colorspace) == 0 &&
+         colorspace != TJCS_CMYK &&
+         colorspace != TJCS_YCCK )
+    {
+        bool gray = colorspace == TJCS_GRAY;
+
+        image = _pool->createImage( width, height, gray ? GL_LUMINANCE : GL_RGB, GL_UNSIGNED_BYTE, 1 );
+
+        // OSG images are bottom-up.
+        if ( tjDecompress2(handle, jpegBuf, size, image->data(), width, 0, height,
+                           gray ? TJPF_GRAY : TJPF_RGB, TJFLAG_BOTTOMUP) != 0 )
+        {
+            image = 0L;
+        }
+    }
+
+    releaseJPEGHandle( handle );
+    return image.release();
+#else
+    return 0L;
+#endif
+}
+
+osg::Image*
+ImageDecoder::decodePNG( const char* data, unsigned size )
+{
+#ifdef OSGEARTH_HAVE_PNG
+    // the simplified API turns 16-bit samples into linear light, which would
+    // corrupt encoded data like elevation; leave those to the plugin.
+    // (The IHDR bit depth is at byte 24.)
+    if ( size < 33 || (unsigned char)data[24] > 8 )
+        return 0L;
+
+    png_image png;
+    memset( &png, 0, sizeof(png) );
+    png.version = PNG_IMAGE_VERSION;
+
+    if ( !png_image_begin_read_from_memory(&png, data, size) )
+        return 0L;
+
+    bool color = (png.format & PNG_FORMAT_FLAG_COLOR) != 0;
+    bool alpha = (png.format & PNG_FORMAT_FLAG_ALPHA) != 0;
+
+    GLenum pixelFormat;
+    if ( color )
+    {
+        png.format  = alpha ? PNG_FORMAT_RGBA : PNG_FORMAT_RGB;
+        pixelFormat = alpha ? GL_RGBA : GL_RGB;
+    }
+    else
+    {
+        png.format  = alpha ? PNG_FORMAT_GA : PNG_FORMAT_GRAY;
+        pixelFormat = alpha ? GL_LUMINANCE_ALPHA : GL_LUMINANCE;
+    }
+
+    osg::ref_ptr<osg::Image> image = _pool->createImage( png.width, png.height, pixelFormat, GL_UNSIGNED_BYTE, 1 );
+
+    // a negative row stride writes the rows bottom-up, the way OSG wants them.
+    int stride = PNG_IMAGE_ROW_STRIDE( png );
+    if ( !png_image_finish_read(&png, 0L, image->data(), -stride, 0L) )
+    {
+        png_image_free( &png );
+        return 0L;
+    }
+
+    return image.release();
+#else
+    return 0L;
+#endif
+}
+
+osg::Image*
+ImageDecoder::decodeWebP( const char* data, unsigned size )
+{
+#ifdef OSGEARTH_HAVE_WEBP
+    const uint8_t* webpBuf = reinterpret_cast<const uint8_t*>( data );
+
+    WebPDecoderConfig config;
+    if ( !WebPInitDecoderConfig(&config) )
+        return 0L;
+
+    if ( WebPGetFeatures(webpBuf, size, &config.input) != VP8_STATUS_OK )
+        return 0L;
+
+    bool alpha = config.input.has_alpha != 0;
+
+    osg::ref_ptr<osg::Image> image = _pool->createImage(
+        config.input.width, config.input.height, alpha ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, 1 );
+
+    config.options.flip              = 1; // bottom-up
+    config.output.colorspace         = alpha ? MODE_RGBA : MODE_RGB;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba        = image->data();
+    config.output.u.RGBA.stride      = image->getRowSizeInBytes();
+    config.output.u.RGBA.size        = image->getTotalSizeInBytes();
+
+    VP8StatusCode status = WebPDecode( webpBuf, size, &config );
+    WebPFreeDecBuffer( &config.output );
+
+    return status == VP8_STATUS_OK ? image.release() : 0L;
+#else
+    return 0L;
+#endif
+}
@@ -18,6 +18,7 @@
  */
 #include <osgEarth/ImageLayer>
 #include <osgEarth/ColorFilter>
+#include <osgEarth/FrameStats>
 #include <osgEarth/TileSource>
 #include <osgEarth/ImageMosaic>
 #include <osgEarth/ImageUtils>
@@ -28,6 +29,7 @@
 #include <osgEarth/MemCache>
 #include <osgEarth/Registry>
 #include <osgEarth/Capabilities>
+#include <osgEarth/TaskService>
 #include <osg/Version>
 #include <osgDB/WriteFile>
 #include <memory.h>
@@ -72,6 +74,8 @@ ImageLayerOptions::setDefaults()
     _texcomp.init( osg::Texture::USE_IMAGE_DATA_FORMAT ); // none
     _shared.init( false );
     _coverage.init( false );
+    _cacheGPUReady.init( false );
+    _virtualTexture.init( false );
 }
 
 void
@@ -92,6 +96,8 @@ ImageLayerOptions::fromConfig( const Config& conf )
     conf.getIfSet( "shared",         _shared );
     conf.getIfSet( "coverage",       _coverage );
     conf.getIfSet( "feather_pixels", _featherPixels);
+    conf.getIfSet( "cache_gpu_ready", _cacheGPUReady );
+    conf.getIfSet( "virtual_texture", _virtualTexture );
 
     if ( conf.hasValue( "transparent_color" ) )
         _transparentColor = stringToColor( conf.value( "transparent_color" ), osg::Vec4ub(0,0,0,0));
@@ -134,6 +140,8 @@ ImageLayerOptions::getConfig( bool isolate ) const
     conf.updateIfSet( "shared",         _shared );
     conf.updateIfSet( "coverage",       _coverage );
     conf.updateIfSet( "feather_pixels", _featherPixels );
+    conf.updateIfSet( "cache_gpu_ready", _cacheGPUReady );
+    conf.updateIfSet( "virtual_texture", _virtualTexture );
 
     if (_transparentColor.isSet())
         conf.update("transparent_color", colorToString( _transparentColor.value()));
@@ -192,6 +200,129 @@ namespace
             return equiv;
         }
     };
+
+    // Picks the FastDXT compression mode for an image's pixel format.
+    bool getFastDXTMode( const osg::Image* image, osg::Texture::InternalFormatMode& mode )
+    {
+        switch( image->getPixelFormat() )
+        {
+        case GL_RGB:             mode = osg::Texture::USE_S3TC_DXT1_COMPRESSION; return true;
+        case GL_RGBA:            mode = osg::Texture::USE_S3TC_DXT5_COMPRESSION; return true;
+        case GL_LUMINANCE:       mode = osg::Texture::USE_RGTC1_COMPRESSION;     return true;
+        case GL_LUMINANCE_ALPHA: mode = osg::Texture::USE_RGTC2_COMPRESSION;     return true;
+        default:                 return false;
+        }
+    }
+
+    /**
+     * Builds the GPU-ready version of a tile: the image with a full mipmap
+     * chain, each level compressed with FastDXT if requested (and possible).
+     * Returns NULL if the image doesn't lend itself to that.
+     */
+    osg::Image* createGPUReadyImage( const osg::Image* input, bool compress )
+    {
+        if (input->r() > 1 || input->isMipmap() ||
+            ImageUtils::isCompressed(input) ||
+            input->getDataType() != GL_UNSIGNED_BYTE )
+        {
+            return 0L;
+        }
+
+        osgDB::ImageProcessor* processor = 0L;
+        osg::Texture::InternalFormatMode mode;
+        if ( compress && getFastDXTMode(input, mode) )
+        {
+            processor = osgDB::Registry::instance()->getImageProcessorForExtension("fastdxt");
+        }
+
+        // mipmapping needs power-of-two levels.
+        osg::ref_ptr<osg::Image> level = const_cast<osg::Image*>( input );
+        if ( !ImageUtils::isPowerOfTwo(input) )
+        {
+            level = 0L;
+            if ( !ImageUtils::resizeImage(input,
+                osg::Image::computeNearestPowerOfTwo(input->s()),
+                osg::Image::computeNearestPowerOfTwo(input->t()),
+                level) )
+            {
+                return 0L;
+            }
+        }
+
+        std::vector< osg::ref_ptr<osg::Image> > levels;
+        while( level.valid() )
+        {
+            osg::ref_ptr<osg::Image> next;
+            if ( level->s() > 1 || level->t() > 1 )
+            {
+                if ( !ImageUtils::resizeImage(level.get(), osg::maximum(level->s()/2, 1), osg::maximum(level->t()/2, 1), next) )
+                    return 0L;
+            }
+
+            if ( processor )
+            {
+                // compressed levels are made of whole 4x4 blocks, so the smallest
+                // levels are compressed from an enlarged copy. Never compress the
+                // caller's image in place.
+                osg::ref_ptr<osg::Image> blocks = level.get();
+                if ( level->s() < 4 || level->t() < 4 )
+                {
+                    blocks = 0L;
+                    if ( !ImageUtils::resizeImage(level.get(), 4, 4, blocks) )
+                        return 0L;
+                }
+                else if ( level.get() == input )
+                {
+                    blocks = new osg::Image( *input, osg::CopyOp::DEEP_COPY_ALL );
+                }
+
+                processor->compress( *blocks.get(), mode, false, false, osgDB::ImageProcessor::USE_CPU, osgDB::ImageProcessor::FASTEST );
+                if ( !ImageUtils::isCompressed(blocks.get()) )
+                    return 0L;
+
+                levels.push_back( blocks.get() );
+            }
+            else
+            {
+                // all levels are uploaded with the first one's row alignment.
+                if ( !levels.empty() && level->getPacking() != levels[0]->getPacking() )
+                    return 0L;
+
+                levels.push_back( level.get() );
+            }
+
+            level = next.get();
+        }
+
+        unsigned totalSize = 0;
+        for( unsigned i=0; i<levels.size(); ++i )
+            totalSize += levels[i]->getTotalSizeInBytes();
+
+        unsigned char* data = new unsigned char[totalSize];
+        osg::Image::MipmapDataType offsets;
+        unsigned offset = 0;
+        for( unsigned i=0; i<levels.size(); ++i )
+        {
+            if ( i > 0 )
+                offsets.push_back( offset );
+            memcpy( data+offset, levels[i]->data(), levels[i]->getTotalSizeInBytes() );
+            offset += levels[i]->getTotalSizeInBytes();
+        }
+
+        const osg::Image* first = levels[0].get();
+        osg::Image* output = new osg::Image();
+        output->setImage(
+            first->s(), first->t(), 1,
+            first->getInternalTextureFormat(),
+            first->getPixelFormat(),
+            first->getDataType(),
+            data,
+            osg::Image::USE_NEW_DELETE,
+            first->getPacking() );
+        output->setMipmapLevels( offsets );
+
+        return output;
+    }
 }
 
 //------------------------------------------------------------------------
@@ -302,6 +433,8 @@ ImageLayer::init()
 
     _emptyImage = ImageUtils::createEmptyImage();
     //*((unsigned*)_emptyImage->data()) = 0x7F0000FF;
+
+    shareMemCache( "image" );
 }
 
 void
@@ -435,11 +568,107 @@ ImageLayer::getCacheBin( const Profile* profile)
 }
 
 
+bool
+ImageLayer::useGPUReadyCache() const
+{
+    return _runtimeOptions.cacheGPUReady() == true && !isCoverage();
+}
+
+
+CacheBin*
+ImageLayer::getGPUReadyCacheBin( const Profile* profile )
+{
+    std::string binId = *_runtimeOptions.cacheId() + "_" + profile->getHorizSignature() + "_gpu";
+    return TerrainLayer::getCacheBin( profile, binId );
+}
+
+
 GeoImage
 ImageLayer::createImage(const TileKey&    key,
                         ProgressCallback* progress)
 {
-    return createImageInKeyProfile( key, progress );
+    FrameStats::FetchTimer fetchTimer( getName() );
+
+    if ( !useGPUReadyCache() )
+    {
+        return createImageInKeyProfile( key, progress );
+    }
+
+    if ( !getEnabled() || !isKeyInRange(key) )
+    {
+        return GeoImage::INVALID;
+    }
+
+    CacheBin* bin = getGPUReadyCacheBin( key.getProfile() );
+
+    osg::ref_ptr<osg::Image> expiredImage;
+    GeoImage result = readGPUReadyImage( key, bin, expiredImage );
+    if ( result.valid() )
+    {
+        return result;
+    }
+
+    // the GPU-ready tile replaces the source-format one in the cache.
+    result = createImageInKeyProfile( key, progress, false );
+
+    return cacheGPUReadyImage( key, result, bin, expiredImage.get() );
+}
+
+
+GeoImage
+ImageLayer::readGPUReadyImage(const TileKey&            key,
+                              CacheBin*                 bin,
+                              osg::ref_ptr<osg::Image>& expiredImage)
+{
+    if ( bin && getCachePolicy().isCacheReadable() )
+    {
+        ReadResult r = bin->readImage( key.str() );
+        if ( r.succeeded() )
+        {
+            if ( !getCachePolicy().isExpired(r.lastModifiedTime()) )
+            {
+                OE_DEBUG << LC << "Got GPU-ready cached image for " << key.str() << std::endl;
+                return GeoImage( r.getImage(), key.getExtent() );
+            }
+            expiredImage = r.getImage();
+        }
+    }
+    return GeoImage::INVALID;
+}
+
+
+GeoImage
+ImageLayer::cacheGPUReadyImage(const TileKey&  key,
+                               const GeoImage& image,
+                               CacheBin*       bin,
+                               osg::Image*     expiredImage)
+{
+    if ( !image.valid() )
+    {
+        if ( expiredImage )
+        {
+            OE_DEBUG << LC << "Using GPU-ready cached but expired image for " << key.str() << std::endl;
+            return GeoImage( expiredImage, key.getExtent() );
+        }
+        return GeoImage::INVALID;
+    }
+
+    bool compress = _runtimeOptions.textureCompression() != osg::Texture::USE_IMAGE_DATA_FORMAT;
+
+    // a tile that can't be made GPU-ready is cached as is, since it didn't go
+    // to the source-format bin either.
+    osg::ref_ptr<osg::Image> ready = createGPUReadyImage( image.getImage(), compress );
+    if ( !ready.valid() )
+    {
+        ready = image.getImage();
+    }
+
+    if ( bin && getCachePolicy().isCacheWriteable() )
+    {
+        bin->write( key.str(), ready.get() );
+    }
+
+    return GeoImage( ready.get(), image.getExtent() );
 }
 
 
@@ -508,7 +737,8 @@ ImageLayer::createImageInNativeProfile(const TileKey&    key,
 
 GeoImage
 ImageLayer::createImageInKeyProfile(const TileKey&    key, 
-                                    ProgressCallback* progress)
+                                    ProgressCallback* progress,
+                                    bool              writeCache)
 {
     GeoImage result;
 
@@ -598,6 +828,18 @@ ImageLayer::createImageInKeyProfile(const TileKey&    key,
     // Get an image from the underlying TileSource.
     result = createImageFromTileSource( key, progress );
 
+    return cacheImage( key, result, writeCache ? cacheBin : 0L, cachedImage.get() );
+}
+
+
+GeoImage
+ImageLayer::cacheImage(const TileKey&  key,
+                       const GeoImage& image,
+                       CacheBin*       cacheBin,
+                       osg::Image*     expiredImage)
+{
+    GeoImage result = image;
+
     // Normalize the image if necessary
     if ( result.valid() )
     {
@@ -633,10 +875,10 @@ ImageLayer::createImageInKeyProfile(const TileKey&    key,
     {
         OE_DEBUG << LC << key.str() << "result INVALID" << std::endl;        
         // We couldn't get an image from the source.  So see if we have an expired cached image
-        if (cachedImage.valid())
+        if (expiredImage)
         {
             OE_DEBUG << LC << "Using cached but expired image for " << key.str() << std::endl;
-            result = GeoImage( cachedImage.get(), key.getExtent());
+            result = GeoImage( expiredImage, key.getExtent());
         }
     }
 
@@ -644,6 +886,145 @@ ImageLayer::createImageInKeyProfile(const TileKey&    key,
 }
 
 
+void
+ImageLayer::createImages(const std::vector<TileKey>& keys,
+                         std::vector<GeoImage>&      output,
+                         ProgressCallback*           progress)
+{
+    if ( !useGPUReadyCache() )
+    {
+        createImagesInKeyProfile( keys, output, progress );
+        return;
+    }
+
+    output.assign( keys.size(), GeoImage::INVALID );
+
+    // the keys that miss the GPU-ready cache go to the source together.
+    std::vector<TileKey>                    missKeys;
+    std::vector<unsigned>                   missIndices;
+    std::vector<CacheBin*>                  missBins;
+    std::vector< osg::ref_ptr<osg::Image> > expiredImages;
+
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        if ( !getEnabled() || !isKeyInRange(keys[i]) )
+            continue;
+
+        CacheBin* bin = getGPUReadyCacheBin( keys[i].getProfile() );
+
+        osg::ref_ptr<osg::Image> expiredImage;
+        output[i] = readGPUReadyImage( keys[i], bin, expiredImage );
+        if ( !output[i].valid() )
+        {
+            missKeys.push_back( keys[i] );
+            missIndices.push_back( i );
+            missBins.push_back( bin );
+            expiredImages.push_back( expiredImage.get() );
+        }
+    }
+
+    if ( missKeys.empty() )
+        return;
+
+    std::vector<GeoImage> images;
+    createImagesInKeyProfile( missKeys, images, progress, false );
+
+    for( unsigned j=0; j<missKeys.size(); ++j )
+    {
+        output[missIndices[j]] = cacheGPUReadyImage( missKeys[j], images[j], missBins[j], expiredImages[j].get() );
+    }
+}
+
+
+void
+ImageLayer::createImagesInKeyProfile(const std::vector<TileKey>& keys,
+                                     std::vector<GeoImage>&      output,
+                                     ProgressCallback*           progress,
+                                     bool                        writeCache)
+{
+    output.assign( keys.size(), GeoImage::INVALID );
+
+    TileSource* source = getTileSource();
+
+    // Batching only applies when we are going to the TileSource with keys that
+    // match its profile; everything else takes the normal single-key path.
+    bool canBatch =
+        getEnabled()    &&
+        source != 0L    &&
+        !isCacheOnly()  &&
+        getProfile() != 0L;
+
+    std::vector<TileKey>                    batchKeys;
+    std::vector<unsigned>                   batchIndices;
+    std::vector<CacheBin*>                  cacheBins( keys.size(), (CacheBin*)0L );
+    std::vector< osg::ref_ptr<osg::Image> > expiredImages( keys.size() );
+
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        const TileKey& key = keys[i];
+
+        if ( !canBatch || !isKeyInRange(key) || !key.getProfile()->isHorizEquivalentTo(getProfile()) )
+        {
+            output[i] = createImageInKeyProfile( key, progress, writeCache );
+            continue;
+        }
+
+        // Check the layer L2 cache first
+        if ( _memCache.valid() )
+        {
+            CacheBin* bin = _memCache->getOrCreateBin( key.getProfile()->getFullSignature() );
+            ReadResult r = bin->readObject( key.str() );
+            if ( r.succeeded() )
+            {
+                output[i] = GeoImage( static_cast<osg::Image*>(r.getObject()), key.getExtent() );
+                continue;
+            }
+        }
+
+        cacheBins[i] = getCacheBin( key.getProfile() );
+
+        if ( cacheBins[i] && getCachePolicy().isCacheReadable() )
+        {
+            ReadResult r = cacheBins[i]->readImage( key.str() );
+            if ( r.succeeded() )
+            {
+                osg::ref_ptr<osg::Image> cachedImage = r.getImage();
+                ImageUtils::normalizeImage( cachedImage.get() );
+                if ( !getCachePolicy().isExpired(r.lastModifiedTime()) )
+                {
+                    output[i] = GeoImage( cachedImage.get(), key.getExtent() );
+                    continue;
+                }
+                expiredImages[i] = cachedImage.get();
+            }
+        }
+
+        if ( source->getBlacklist()->contains(key) || !source->hasData(key) )
+        {
+            output[i] = cacheImage( key, GeoImage::INVALID, writeCache ? cacheBins[i] : 0L, expiredImages[i].get() );
+            continue;
+        }
+
+        batchKeys.push_back( key );
+        batchIndices.push_back( i );
+    }
+
+    if ( batchKeys.empty() )
+        return;
+
+    std::vector< osg::ref_ptr<osg::Image> > images;
+    source->createImages( batchKeys, images, _preCacheOp.get(), progress );
+
+    for( unsigned j=0; j<batchKeys.size(); ++j )
+    {
+        unsigned i = batchIndices[j];
+        osg::Image* image = j < images.size() ? images[j].get() : 0L;
+        GeoImage result = finishImageFromTileSource( batchKeys[j], image, progress );
+        output[i] = cacheImage( batchKeys[j], result, writeCache ? cacheBins[i] : 0L, expiredImages[i].get() );
+    }
+}
+
+
 
 GeoImage
 ImageLayer::createImageFromTileSource(const TileKey&    key,
@@ -678,6 +1059,17 @@ ImageLayer::createImageFromTileSource(const TileKey&    key,
     // create an image from the tile source.
     osg::ref_ptr<osg::Image> result = source->createImage( key, op.get(), progress );
 
+    return finishImageFromTileSource( key, result.get(), progress );
+}
+
+
+GeoImage
+ImageLayer::finishImageFromTileSource(const TileKey&    key,
+                                      osg::Image*       image,
+                                      ProgressCallback* progress)
+{
+    osg::ref_ptr<osg::Image> result = image;
+
     // Process images with full alpha to properly support MP blending.    
     if ( result.valid() && *_runtimeOptions.featherPixels())
     {
@@ -689,8 +1081,10 @@ ImageLayer::createImageFromTileSource(const TileKey&    key,
     // blacklist this tile for future requests.
     if (result == 0L)
     {
-        if ( progress == 0L ||
-             ( !progress->isCanceled() && !progress->needsRetry() ) )
+        TileSource* source = getTileSource();
+        if ( source && 
+             ( progress == 0L ||
+             ( !progress->isCanceled() && !progress->needsRetry() ) ) )
         {
             source->getBlacklist()->add( key );
         }
@@ -700,6 +1094,112 @@ ImageLayer::createImageFromTileSource(const TileKey&    key,
 }
 
 
+namespace
+{
+    // Make sure all images in mosaic are based on "RGBA - unsigned byte" pixels.
+    // This is not the smarter choice (in some case RGB would be sufficient) but
+    // it ensure consistency between all images / layers.
+    //
+    // The main drawback is probably the CPU memory foot-print which would be reduced by allocating RGB instead of RGBA images.
+    // On GPU side, this should not change anything because of data alignements : often RGB and RGBA textures have the same memory footprint
+    //
+    void normalizeForMosaic(GeoImage& image)
+    {
+        ImageUtils::normalizeImage(image.getImage());
+
+        if (   (image.getImage()->getDataType() != GL_UNSIGNED_BYTE)
+            || (image.getImage()->getPixelFormat() != GL_RGBA) )
+        {
+            osg::ref_ptr<osg::Image> convertedImg = ImageUtils::convertToRGBA8(image.getImage());
+            if (convertedImg.valid())
+            {
+                image = GeoImage(convertedImg, image.getExtent());
+            }
+        }
+    }
+
+    Threading::Mutex          s_mosaicServiceMutex;
+    osg::ref_ptr<TaskService> s_mosaicService;
+
+    TaskService* getMosaicService()
+    {
+        Threading::ScopedMutexLock lock( s_mosaicServiceMutex );
+        if ( !s_mosaicService.valid() )
+        {
+            s_mosaicService = new TaskService( "ImageLayer Mosaic", 4 );
+            Registry::instance()->registerTaskService( s_mosaicService.get() );
+        }
+        return s_mosaicService.get();
+    }
+}
+
+// Fetches (and normalizes) the source tiles of a mosaic concurrently. The
+// calling thread and the pool tasks all pull from the same work index, so the
+// caller never blocks on a task that is still sitting in the queue (which
+// would deadlock when mosaics nest, e.g. in a CompositeTileSource running on
+// a pool thread).
+struct ImageLayer::ParallelTileFetch : public osg::Referenced
+{
+    ParallelTileFetch(ImageLayer* layer, const std::vector<TileKey>& keys, ProgressCallback* progress) :
+        _layer   ( layer ),
+        _keys    ( keys ),
+        _results ( keys.size() ),
+        _progress( progress ),
+        _next    ( 0 ),
+        _numDone ( 0 ) { }
+
+    // fetches the next unclaimed tile; false if none are left.
+    bool runOne()
+    {
+        unsigned i = (++_next) - 1;
+        if ( i >= _keys.size() )
+            return false;
+
+        // once canceled, leave the rest empty; the caller will retry.
+        if ( !_progress || !_progress->isCanceled() )
+        {
+            _results[i] = _layer->createImageFromTileSource( _keys[i], _progress );
+            if ( _results[i].valid() )
+                normalizeForMosaic( _results[i] );
+        }
+
+        if ( (unsigned)(++_numDone) == _keys.size() )
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            _cond.broadcast();
+        }
+        return true;
+    }
+
+    void waitForAll()
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        while ( (unsigned)_numDone < _keys.size() )
+            _cond.wait( &_mutex );
+    }
+
+    struct Task : public TaskRequest
+    {
+        Task(ParallelTileFetch* fetch) : _fetch(fetch) { }
+
+        void operator()( ProgressCallback* progress )
+        {
+            while( _fetch->runOne() );
+        }
+
+        osg::ref_ptr<ParallelTileFetch> _fetch;
+    };
+
+    ImageLayer*            _layer; // only touched while the caller waits
+    std::vector<TileKey>   _keys;
+    std::vector<GeoImage>  _results;
+    ProgressCallback*      _progress;
+    OpenThreads::Atomic    _next;
+    OpenThreads::Atomic    _numDone;
+    Threading::Mutex       _mutex;
+    OpenThreads::Condition _cond;
+};
+
 GeoImage
 ImageLayer::assembleImageFromTileSource(const TileKey&    key,
                                         ProgressCallback* progress)
@@ -731,36 +1231,40 @@ ImageLayer::assembleImageFromTileSource(const TileKey&    key,
         // keep track of failed tiles.
         std::vector<TileKey> failedKeys;
 
-        for( std::vector<TileKey>::iterator k = intersectingKeys.begin(); k != intersectingKeys.end(); ++k )
+        // fetch the source tiles, in parallel when there is more than one:
+        std::vector<GeoImage> images;
+        if ( intersectingKeys.size() == 1 )
         {
-            GeoImage image = createImageFromTileSource( *k, progress );
+            images.push_back( createImageFromTileSource(intersectingKeys[0], progress) );
+            if ( images[0].valid() )
+                normalizeForMosaic( images[0] );
+        }
+        else
+        {
+            osg::ref_ptr<ParallelTileFetch> fetch = new ParallelTileFetch( this, intersectingKeys, progress );
+
+            TaskService* service = getMosaicService();
+            for( unsigned i=1; i<intersectingKeys.size(); ++i )
+                service->add( new ParallelTileFetch::Task(fetch.get()) );
+
+            while( fetch->runOne() );
+            fetch->waitForAll();
+
+            images.swap( fetch->_results );
+        }
+
+        for( unsigned i=0; i<intersectingKeys.size(); ++i )
+        {
+            const TileKey&  k     = intersectingKeys[i];
+            const GeoImage& image = images[i];
             if ( image.valid() )
             {
-                ImageUtils::normalizeImage(image.getImage());
-
-                // Make sure all images in mosaic are based on "RGBA - unsigned byte" pixels.
-                // This is not the smarter choice (in some case RGB would be sufficient) but
-                // it ensure consistency between all images / layers.
-                //
-                // The main drawback is probably the CPU memory foot-print which would be reduced by allocating RGB instead of RGBA images.
-                // On GPU side, this should not change anything because of data alignements : often RGB and RGBA textures have the same memory footprint
-                //
-                if (   (image.getImage()->getDataType() != GL_UNSIGNED_BYTE)
-                    || (image.getImage()->getPixelFormat() != GL_RGBA) )
-                {
-                    osg::ref_ptr<osg::Image> convertedImg = ImageUtils::convertToRGBA8(image.getImage());
-                    if (convertedImg.valid())
-                    {
-                        image = GeoImage(convertedImg, image.getExtent());
-                    }
-                }
-
-                mosaic.getImages().push_back( TileImage(image.getImage(), *k) );
+                mosaic.getImages().push_back( TileImage(image.getImage(), k) );
             }
             else
             {
                 // the tile source did not return a tile, so make a note of it.
-                failedKeys.push_back( *k );
+                failedKeys.push_back( k );
 
                 if (progress && (progress->isCanceled() || progress->needsRetry()))
                 {
@@ -791,16 +1295,7 @@ ImageLayer::assembleImageFromTileSource(const TileKey&    key,
                 image = createImageFromTileSource( parentKey, progress );
                 if ( image.valid() )
                 {
-                    ImageUtils::normalizeImage(image.getImage());
-                    if (   (image.getImage()->getDataType() != GL_UNSIGNED_BYTE)
-                        || (image.getImage()->getPixelFormat() != GL_RGBA) )
-                    {
-                        osg::ref_ptr<osg::Image> convertedImg = ImageUtils::convertToRGBA8(image.getImage());
-                        if (convertedImg.valid())
-                        {
-                            image = GeoImage(convertedImg, image.getExtent());
-                        }
-                    }
+                    normalizeForMosaic( image );
 
                     OE_DEBUG << LC << "Tile " << k->str() << " fell back on " << parentKey.str() << "\n";
                     
@@ -872,6 +1367,12 @@ ImageLayer::applyTextureCompressionMode(osg::Texture* tex) const
     }
 
 
+    // GPU-ready images are already in their final format.
+    else if ( tex->getImage(0) && ImageUtils::isCompressed(tex->getImage(0)) )
+    {
+        tex->setInternalFormatMode(osg::Texture::USE_IMAGE_DATA_FORMAT);
+    }
+
     else if ( _runtimeOptions.textureCompression() == (osg::Texture::InternalFormatMode)~0 )
     {
         // auto mode:
@@ -899,20 +1400,11 @@ ImageLayer::applyTextureCompressionMode(osg::Texture* tex) const
         osgDB::ImageProcessor* imageProcessor = osgDB::Registry::instance()->getImageProcessorForExtension("fastdxt");
         if (imageProcessor)
         {
+            // RGB uses DXT1, RGBA uses DXT5, LUMINANCE(_ALPHA) uses BC4/BC5 (LATC)
             osg::Texture::InternalFormatMode mode;
-            // RGB uses DXT1
-            if (tex->getImage(0)->getPixelFormat() == GL_RGB)
-            {
-                mode = osg::Texture::USE_S3TC_DXT1_COMPRESSION;
-            }
-            // RGBA uses DXT5
-            else if (tex->getImage(0)->getPixelFormat() == GL_RGBA)
-            {         
-                mode = osg::Texture::USE_S3TC_DXT5_COMPRESSION;
-            }
-            else
+            if ( !getFastDXTMode(tex->getImage(0), mode) )
             {
-                OE_INFO << "FastDXT only works on GL_RGBA or GL_RGB images" << std::endl;
+                OE_INFO << "FastDXT only works on GL_RGBA, GL_RGB, GL_LUMINANCE or GL_LUMINANCE_ALPHA images" << std::endl;
                 return;
             }
 
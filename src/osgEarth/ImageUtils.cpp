@@ -30,6 +30,12 @@
 #include <string.h>
 #include <memory.h>
 
+// SSE2 is always available on x86-64; on 32-bit x86 only if the compiler targets it.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define OE_IMAGEUTILS_SSE2 1
+#   include <emmintrin.h>
+#endif
+
 #define LC "[ImageUtils] "
 
 
@@ -178,6 +184,319 @@ ImageUtils::createBumpMap(const osg::Image* input)
     return output;
 }
 
+//------------------------------------------------------------------------
+
+// Fast paths for 8-bit-per-channel images. These work directly on the bytes
+// with 8.8 fixed point math instead of going through a PixelReader/PixelWriter
+// and a Vec4 for every sample.
+namespace
+{
+    // Number of 8-bit channels in the image, or 0 if the fast paths don't apply.
+    unsigned getNumByteChannels(const osg::Image* image)
+    {
+        if ( image->getDataType() != GL_UNSIGNED_BYTE )
+            return 0;
+
+        switch( image->getPixelFormat() )
+        {
+        case GL_RGBA:
+        case GL_BGRA:            return 4;
+        case GL_RGB:
+        case GL_BGR:             return 3;
+        case GL_LUMINANCE_ALPHA: return 2;
+        case GL_LUMINANCE:
+        case GL_ALPHA:           return 1;
+        default:                 return 0;
+        }
+    }
+
+    // Horizontal sample for one output column: source columns and the
+    // weight of the second one (0..256).
+    struct Sample
+    {
+        unsigned _min, _max, _w;
+    };
+
+    // Mirrors the sampling math of the generic path in resizeImage().
+    void computeSamples(unsigned in_size, unsigned out_size, bool bilinear, std::vector<Sample>& samples)
+    {
+        samples.resize( out_size );
+        for( unsigned i=0; i<out_size; ++i )
+        {
+            float x = ((float)i/(float)out_size) * (float)in_size;
+            if ( x >= (float)in_size ) x = (float)(in_size-1);
+            else if ( x < 0.0f ) x = 0.0f;
+
+            Sample& sample = samples[i];
+            if ( bilinear )
+            {
+                int xmin = osg::maximum((int)floor(x), 0);
+                int xmax = osg::maximum(osg::minimum((int)ceil(x), (int)in_size-1), 0);
+                if ( xmin > xmax ) xmin = xmax;
+                sample._min = xmin;
+                sample._max = xmax;
+                sample._w   = xmin == xmax ? 0u : (unsigned)((x - (float)xmin) * 256.0f + 0.5f);
+            }
+            else
+            {
+                int nearest = (x-(int)x) <= (ceil(x)-x) ? (int)x : std::min( 1+(int)x, (int)in_size-1 );
+                sample._min = sample._max = nearest;
+                sample._w   = 0u;
+            }
+        }
+    }
+
+    inline unsigned char lerp8(unsigned a, unsigned b, unsigned w)
+    {
+        return (unsigned char)((a*(256u-w) + b*w + 128u) >> 8);
+    }
+
+    // Bilinear blend of four RGBA8 pixels; wx/wy are the 0..256 weights of the
+    // right/top samples. Returns the packed result.
+    inline unsigned bilinearRGBA8(unsigned ll, unsigned lr, unsigned ul, unsigned ur, unsigned wx, unsigned wy)
+    {
+#ifdef OE_IMAGEUTILS_SSE2
+        const __m128i zero  = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi16(128);
+
+        // 16-bit lanes: [left pixel x4 | right pixel x4]
+        __m128i bottom = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128((int)ll), _mm_cvtsi32_si128((int)lr)), zero);
+        __m128i top    = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128((int)ul), _mm_cvtsi32_si128((int)ur)), zero);
+        __m128i hw     = _mm_set_epi16( (short)wx, (short)wx, (short)wx, (short)wx,
+                                        (short)(256-wx), (short)(256-wx), (short)(256-wx), (short)(256-wx) );
+
+        bottom = _mm_mullo_epi16(bottom, hw);
+        top    = _mm_mullo_epi16(top,    hw);
+        bottom = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(bottom, _mm_srli_si128(bottom, 8)), round), 8);
+        top    = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(top,    _mm_srli_si128(top,    8)), round), 8);
+
+        __m128i v = _mm_add_epi16(
+            _mm_add_epi16(
+                _mm_mullo_epi16(bottom, _mm_set1_epi16((short)(256-wy))),
+                _mm_mullo_epi16(top,    _mm_set1_epi16((short)wy))),
+            round);
+        v = _mm_srli_epi16(v, 8);
+
+        return (unsigned)_mm_cvtsi128_si32(_mm_packus_epi16(v, zero));
+#else
+        unsigned result = 0;
+        for( unsigned c=0; c<32; c+=8 )
+        {
+            unsigned bottom = lerp8((ll>>c)&0xFF, (lr>>c)&0xFF, wx);
+            unsigned top    = lerp8((ul>>c)&0xFF, (ur>>c)&0xFF, wx);
+            result |= (unsigned)lerp8(bottom, top, wy) << c;
+        }
+        return result;
+#endif
+    }
+
+    /**
+     * Resizes an 8-bit image into an output of the same format. Returns false
+     * if the images aren't eligible, in which case the caller falls back on
+     * the generic path.
+     */
+    bool resizeImageBytes(const osg::Image* input, osg::Image* output,
+                          unsigned out_s, unsigned out_t,
+                          unsigned mipmapLevel, bool bilinear)
+    {
+        unsigned channels = getNumByteChannels(input);
+        if ( channels == 0 ||
+             output->getPixelFormat() != input->getPixelFormat() ||
+             output->getDataType()    != input->getDataType() )
+        {
+            return false;
+        }
+
+        ImageUtils::PixelReader read( input );
+        ImageUtils::PixelWriter write( output );
+
+        std::vector<Sample> cols, rows;
+        computeSamples( input->s(), out_s, bilinear, cols );
+        computeSamples( input->t(), out_t, bilinear, rows );
+
+        for( int layer=0; layer<input->r(); ++layer )
+        {
+            for( unsigned output_row=0; output_row < out_t; ++output_row )
+            {
+                const Sample&        row       = rows[output_row];
+                const unsigned char* bottomRow = read.data(0, row._min, layer);
+                const unsigned char* topRow    = read.data(0, row._max, layer);
+                unsigned char*       out       = write.data(0, output_row, layer, mipmapLevel);
+
+                if ( !bilinear )
+                {
+                    for( unsigned output_col=0; output_col < out_s; ++output_col, out += channels )
+                    {
+                        const unsigned char* in = bottomRow + cols[output_col]._min * channels;
+                        for( unsigned c=0; c<channels; ++c )
+                            out[c] = in[c];
+                    }
+                }
+                else if ( channels == 4 )
+                {
+                    for( unsigned output_col=0; output_col < out_s; ++output_col, out += 4 )
+                    {
+                        const Sample& col = cols[output_col];
+                        unsigned ll, lr, ul, ur;
+                        memcpy( &ll, bottomRow + col._min*4, 4 );
+                        memcpy( &lr, bottomRow + col._max*4, 4 );
+                        memcpy( &ul, topRow    + col._min*4, 4 );
+                        memcpy( &ur, topRow    + col._max*4, 4 );
+                        unsigned p = bilinearRGBA8( ll, lr, ul, ur, col._w, row._w );
+                        memcpy( out, &p, 4 );
+                    }
+                }
+                else
+                {
+                    for( unsigned output_col=0; output_col < out_s; ++output_col, out += channels )
+                    {
+                        const Sample& col = cols[output_col];
+                        const unsigned char* ll = bottomRow + col._min*channels;
+                        const unsigned char* lr = bottomRow + col._max*channels;
+                        const unsigned char* ul = topRow    + col._min*channels;
+                        const unsigned char* ur = topRow    + col._max*channels;
+                        for( unsigned c=0; c<channels; ++c )
+                        {
+                            out[c] = lerp8( lerp8(ll[c], lr[c], col._w), lerp8(ul[c], ur[c], col._w), row._w );
+                        }
+                    }
+                }
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Mixes an RGBA8 source into an RGBA8 destination with the same result as
+     * the MixImage visitor below, in fixed point.
+     */
+    bool mixImageBytes(osg::Image* dest, const osg::Image* src, float a)
+    {
+        if ( src->getDataType()     != GL_UNSIGNED_BYTE || src->getPixelFormat()  != GL_RGBA ||
+             dest->getDataType()    != GL_UNSIGNED_BYTE || dest->getPixelFormat() != GL_RGBA )
+        {
+            return false;
+        }
+
+        ImageUtils::PixelReader read( src );
+        ImageUtils::PixelWriter write( dest );
+
+        const unsigned A = (unsigned)(a * 256.0f + 0.5f);
+
+#ifdef OE_IMAGEUTILS_SSE2
+        const __m128i zero   = _mm_setzero_si128();
+        const __m128i round  = _mm_set1_epi16(128);
+        const __m128i A16    = _mm_set1_epi16((short)A);
+        const __m128i w256   = _mm_set1_epi16(256);
+        const __m128i aMask  = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+#endif
+
+        for( int layer=0; layer<src->r(); ++layer )
+        {
+            for( int t=0; t<src->t(); ++t )
+            {
+                const unsigned char* in  = read.data(0, t, layer);
+                unsigned char*       out = write.data(0, t, layer);
+                int s = 0;
+
+#ifdef OE_IMAGEUTILS_SSE2
+                // two pixels at a time in 16-bit lanes.
+                for( ; s+2 <= src->s(); s += 2, in += 8, out += 8 )
+                {
+                    __m128i sp = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)in), zero);
+                    __m128i dp = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)out), zero);
+
+                    // source alpha broadcast to each pixel's lanes, scaled by "a".
+                    __m128i sa = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sp, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+                    sa = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(sa, A16), round), 8);
+                    __m128i w = _mm_add_epi16(sa, _mm_srli_epi16(sa, 7));
+
+                    __m128i rgb = _mm_add_epi16(
+                        _mm_add_epi16(_mm_mullo_epi16(dp, _mm_sub_epi16(w256, w)), _mm_mullo_epi16(sp, w)),
+                        round);
+                    rgb = _mm_srli_epi16(rgb, 8);
+
+                    __m128i alpha = _mm_max_epi16(sa, dp);
+                    __m128i result = _mm_or_si128(_mm_andnot_si128(aMask, rgb), _mm_and_si128(aMask, alpha));
+
+                    _mm_storel_epi64((__m128i*)out, _mm_packus_epi16(result, zero));
+                }
+#endif
+                for( ; s < src->s(); ++s, in += 4, out += 4 )
+                {
+                    unsigned sa = (A * in[3] + 128u) >> 8;
+                    unsigned w  = sa + (sa >> 7);
+                    out[0] = lerp8(out[0], in[0], w);
+                    out[1] = lerp8(out[1], in[1], w);
+                    out[2] = lerp8(out[2], in[2], w);
+                    out[3] = (unsigned char)osg::maximum(sa, (unsigned)out[3]);
+                }
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Converts between 8-bit RGBA, RGB and LUMINANCE images. Returns NULL if the
+     * conversion isn't one of those, so the caller can use the generic path.
+     */
+    osg::Image* convertImageBytes(const osg::Image* image, GLenum pixelFormat, GLenum dataType)
+    {
+        if ( dataType != GL_UNSIGNED_BYTE || image->getDataType() != GL_UNSIGNED_BYTE )
+            return 0L;
+
+        GLenum inFormat = image->getPixelFormat();
+        bool rgbaToRGB = inFormat == GL_RGBA      && pixelFormat == GL_RGB;
+        bool lumToRGBA = inFormat == GL_LUMINANCE && pixelFormat == GL_RGBA;
+        bool lumToRGB  = inFormat == GL_LUMINANCE && pixelFormat == GL_RGB;
+        if ( !rgbaToRGB && !lumToRGBA && !lumToRGB )
+            return 0L;
+
+        osg::Image* result = new osg::Image();
+        result->allocateImage(image->s(), image->t(), image->r(), pixelFormat, GL_UNSIGNED_BYTE);
+        result->setInternalTextureFormat( pixelFormat == GL_RGB ? GL_RGB8_INTERNAL : GL_RGB8A_INTERNAL );
+
+        ImageUtils::PixelReader read( image );
+        ImageUtils::PixelWriter write( result );
+
+        for( int layer=0; layer<image->r(); ++layer )
+        {
+            for( int t=0; t<image->t(); ++t )
+            {
+                const unsigned char* in  = read.data(0, t, layer);
+                unsigned char*       out = write.data(0, t, layer);
+
+                if ( rgbaToRGB )
+                {
+                    for( int s=0; s<image->s(); ++s, in += 4, out += 3 )
+                    {
+                        out[0] = in[0]; out[1] = in[1]; out[2] = in[2];
+                    }
+                }
+                else if ( lumToRGBA )
+                {
+                    for( int s=0; s<image->s(); ++s, ++in, out += 4 )
+                    {
+                        out[0] = out[1] = out[2] = in[0];
+                        out[3] = 0xFF;
+                    }
+                }
+                else // lumToRGB
+                {
+                    for( int s=0; s<image->s(); ++s, ++in, out += 3 )
+                    {
+                        out[0] = out[1] = out[2] = in[0];
+                    }
+                }
+            }
+        }
+
+        return result;
+    }
+}
+
 bool
 ImageUtils::resizeImage(const osg::Image* input,
                         unsigned int out_s, unsigned int out_t,
@@ -229,6 +548,10 @@ ImageUtils::resizeImage(const osg::Image* input,
     {
         memcpy( output->data(), input->data(), input->getTotalSizeInBytes() );
     }
+    else if ( resizeImageBytes(input, output.get(), out_s, out_t, mipmapLevel, bilinear) )
+    {
+        // done; took the 8-bit fast path.
+    }
     else
     {
         PixelReader read( input );
@@ -495,6 +818,9 @@ ImageUtils::mix(osg::Image* dest, const osg::Image* src, float a)
         return false;
     }
     
+    if ( mixImageBytes(dest, src, osg::clampBetween(a, 0.0f, 1.0f)) )
+        return true;
+
     PixelVisitor<MixImage> mixer;
     mixer._a = osg::clampBetween( a, 0.0f, 1.0f );
     mixer._srcHasAlpha = src->getPixelSizeInBits() == 32;
@@ -942,6 +1268,11 @@ ImageUtils::convert(const osg::Image* image, GLenum pixelFormat, GLenum dataType
         return result;
     }
 
+    // Fast conversions between the other common 8-bit formats
+    osg::Image* fast = convertImageBytes(image, pixelFormat, dataType);
+    if ( fast )
+        return fast;
+
     // Test if generic conversion is possible
     if ( !canConvert(image, pixelFormat, dataType) )
         return 0L;
@@ -975,6 +1306,56 @@ ImageUtils::convertToRGBA8(const osg::Image* image)
     return convert( image, GL_RGBA, GL_UNSIGNED_BYTE );
 }
 
+osg::Image*
+ImageUtils::convertTo16Bit(const osg::Image* image)
+{
+    if ( !image ||
+         image->getDataType() != GL_UNSIGNED_BYTE ||
+         (image->getPixelFormat() != GL_RGB && image->getPixelFormat() != GL_RGBA) ||
+         image->isMipmap() )
+    {
+        return 0L;
+    }
+
+    bool   alpha  = image->getPixelFormat() == GL_RGBA && hasTransparency(image);
+    GLenum format = alpha ? GL_RGBA : GL_RGB;
+
+    osg::Image* result = new osg::Image();
+    result->allocateImage( image->s(), image->t(), image->r(),
+        format, alpha ? GL_UNSIGNED_SHORT_4_4_4_4 : GL_UNSIGNED_SHORT_5_6_5 );
+    result->setInternalTextureFormat( format );
+
+    PixelReader read(image);
+    for( int r=0; r<image->r(); ++r )
+    {
+        for( int t=0; t<image->t(); ++t )
+        {
+            GLushort* out = (GLushort*)result->data(0, t, r);
+            for( int s=0; s<image->s(); ++s, ++out )
+            {
+                osg::Vec4f c = read(s, t, r);
+                if ( alpha )
+                {
+                    *out =
+                        ((GLushort)(c.r()*15.0f + 0.5f) << 12) |
+                        ((GLushort)(c.g()*15.0f + 0.5f) << 8)  |
+                        ((GLushort)(c.b()*15.0f + 0.5f) << 4)  |
+                        ((GLushort)(c.a()*15.0f + 0.5f));
+                }
+                else
+                {
+                    *out =
+                        ((GLushort)(c.r()*31.0f + 0.5f) << 11) |
+                        ((GLushort)(c.g()*63.0f + 0.5f) << 5)  |
+                        ((GLushort)(c.b()*31.0f + 0.5f));
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
 bool 
 ImageUtils::areEquivalent(const osg::Image *lhs, const osg::Image *rhs)
 {
@@ -8,6 +8,39 @@
 
 uniform sampler2D oe_di_postex;
 uniform vec2 oe_di_postex_size;
+uniform vec4 oe_di_bound;      // model bounding sphere (center, radius)
+uniform float oe_di_maxRange;  // instance visibility range; 0 = unlimited
+
+// true if the instance's bounding sphere is out of range or outside the frustum.
+bool oe_di_isCulled(in mat4 instance)
+{
+    vec4 center = gl_ModelViewMatrix * (vec4(oe_di_bound.xyz, 1.0) * instance);
+    float scale = max(length(instance[0].xyz), max(length(instance[1].xyz), length(instance[2].xyz)));
+    float radius = oe_di_bound.w * scale;
+
+    if ( oe_di_maxRange > 0.0 && length(center.xyz) > oe_di_maxRange )
+        return true;
+
+    mat4 P = gl_ProjectionMatrix;
+    vec4 r0 = vec4(P[0][0], P[1][0], P[2][0], P[3][0]);
+    vec4 r1 = vec4(P[0][1], P[1][1], P[2][1], P[3][1]);
+    vec4 r2 = vec4(P[0][2], P[1][2], P[2][2], P[3][2]);
+    vec4 r3 = vec4(P[0][3], P[1][3], P[2][3], P[3][3]);
+
+    vec4 planes[5];
+    planes[0] = r3 + r0;
+    planes[1] = r3 - r0;
+    planes[2] = r3 + r1;
+    planes[3] = r3 - r1;
+    planes[4] = r3 + r2;
+
+    for(int i=0; i<5; ++i)
+    {
+        if ( dot(planes[i], center) < -radius * length(planes[i].xyz) )
+            return true;
+    }
+    return false;
+}
 
 void oe_di_setInstancePosition(inout vec4 VertexMODEL)
 { 
@@ -19,5 +52,8 @@ void oe_di_setInstancePosition(inout vec4 VertexMODEL)
     vec4 m1 = texture2D(oe_di_postex, vec2(s+step, t)); 
     vec4 m2 = texture2D(oe_di_postex, vec2(s+step+step, t)); 
     vec4 m3 = texture2D(oe_di_postex, vec2(s+step+step+step, t));
-    VertexMODEL = VertexMODEL * mat4(m0, m1, m2, m3);
+    mat4 instance = mat4(m0, m1, m2, m3);
+
+    // collapse culled instances so they don't rasterize.
+    VertexMODEL = oe_di_isCulled(instance) ? vec4(0.0) : VertexMODEL * instance;
 }
@@ -2725,6 +2725,405 @@ std::istream& operator>>( std::istream &sin, Value &root )
     return sin;
 }
 
+
+// Class EventReader
+// //////////////////////////////////////////////////////////////////
+
+namespace
+{
+   // keeps malformed or hostile documents from overflowing the stack
+   const int maxEventReaderDepth = 1000;
+
+   void appendUTF8( std::string &out, unsigned int cp )
+   {
+      if ( cp <= 0x7f )
+      {
+         out += static_cast<char>( cp );
+      }
+      else if ( cp <= 0x7ff )
+      {
+         out += static_cast<char>( 0xc0 | (cp >> 6) );
+         out += static_cast<char>( 0x80 | (cp & 0x3f) );
+      }
+      else if ( cp <= 0xffff )
+      {
+         out += static_cast<char>( 0xe0 | (cp >> 12) );
+         out += static_cast<char>( 0x80 | ((cp >> 6) & 0x3f) );
+         out += static_cast<char>( 0x80 | (cp & 0x3f) );
+      }
+      else
+      {
+         out += static_cast<char>( 0xf0 | (cp >> 18) );
+         out += static_cast<char>( 0x80 | ((cp >> 12) & 0x3f) );
+         out += static_cast<char>( 0x80 | ((cp >> 6) & 0x3f) );
+         out += static_cast<char>( 0x80 | (cp & 0x3f) );
+      }
+   }
+}
+
+EventReader::EventReader() :
+begin_( 0 ),
+end_( 0 ),
+current_( 0 ),
+errorLocation_( 0 )
+{
+}
+
+
+bool
+EventReader::parse( const std::string &document, EventHandler &handler )
+{
+   return parse( document.data(), document.data() + document.size(), handler );
+}
+
+
+bool
+EventReader::parse( const char *beginDoc, const char *endDoc, EventHandler &handler )
+{
+   begin_ = beginDoc;
+   end_ = endDoc;
+   current_ = begin_;
+   errorLocation_ = 0;
+   error_.clear();
+   return readValue( handler, 0 );
+}
+
+
+bool
+EventReader::readValue( EventHandler &handler, int depth )
+{
+   skipSpaces();
+   if ( current_ == end_ )
+      return addError( "Unexpected end of document." );
+
+   switch ( *current_ )
+   {
+   case '{':
+      return readObject( handler, depth );
+   case '[':
+      return readArray( handler, depth );
+   case '"':
+      {
+         std::string value;
+         return readString( value ) && report( handler.stringValue( value ) );
+      }
+   case 't':
+      return match( "true", 4 ) && report( handler.boolValue( true ) );
+   case 'f':
+      return match( "false", 5 ) && report( handler.boolValue( false ) );
+   case 'n':
+      return match( "null", 4 ) && report( handler.nullValue() );
+   default:
+      return readNumber( handler );
+   }
+}
+
+
+bool
+EventReader::readObject( EventHandler &handler, int depth )
+{
+   if ( depth >= maxEventReaderDepth )
+      return addError( "Document is nested too deeply." );
+
+   ++current_; // skip '{'
+   if ( !report( handler.objectBegin() ) )
+      return false;
+
+   skipSpaces();
+   if ( current_ != end_  &&  *current_ == '}' )
+   {
+      ++current_;
+      return report( handler.objectEnd() );
+   }
+
+   std::string name;
+   for (;;)
+   {
+      skipSpaces();
+      if ( current_ == end_  ||  *current_ != '"' )
+         return addError( "Missing '}' or object member name." );
+      if ( !readString( name ) )
+         return false;
+
+      skipSpaces();
+      if ( current_ == end_  ||  *current_ != ':' )
+         return addError( "Missing ':' after object member name." );
+      ++current_;
+
+      if ( !report( handler.memberName( name ) ) || !readValue( handler, depth+1 ) )
+         return false;
+
+      skipSpaces();
+      if ( current_ != end_  &&  *current_ == ',' )
+      {
+         ++current_;
+      }
+      else if ( current_ != end_  &&  *current_ == '}' )
+      {
+         ++current_;
+         return report( handler.objectEnd() );
+      }
+      else
+      {
+         return addError( "Missing ',' or '}' in object declaration." );
+      }
+   }
+}
+
+
+bool
+EventReader::readArray( EventHandler &handler, int depth )
+{
+   if ( depth >= maxEventReaderDepth )
+      return addError( "Document is nested too deeply." );
+
+   ++current_; // skip '['
+   if ( !report( handler.arrayBegin() ) )
+      return false;
+
+   skipSpaces();
+   if ( current_ != end_  &&  *current_ == ']' )
+   {
+      ++current_;
+      return report( handler.arrayEnd() );
+   }
+
+   for (;;)
+   {
+      if ( !readValue( handler, depth+1 ) )
+         return false;
+
+      skipSpaces();
+      if ( current_ != end_  &&  *current_ == ',' )
+      {
+         ++current_;
+      }
+      else if ( current_ != end_  &&  *current_ == ']' )
+      {
+         ++current_;
+         return report( handler.arrayEnd() );
+      }
+      else
+      {
+         return addError( "Missing ',' or ']' in array declaration." );
+      }
+   }
+}
+
+
+bool
+EventReader::readString( std::string &decoded )
+{
+   decoded.clear();
+   ++current_; // skip '"'
+   while ( current_ != end_ )
+   {
+      Char c = *current_++;
+      if ( c == '"' )
+         return true;
+
+      if ( c != '\\' )
+      {
+         decoded += c;
+         continue;
+      }
+
+      if ( current_ == end_ )
+         break;
+
+      Char escape = *current_++;
+      switch ( escape )
+      {
+      case '"': decoded += '"'; break;
+      case '/': decoded += '/'; break;
+      case '\\': decoded += '\\'; break;
+      case 'b': decoded += '\b'; break;
+      case 'f': decoded += '\f'; break;
+      case 'n': decoded += '\n'; break;
+      case 'r': decoded += '\r'; break;
+      case 't': decoded += '\t'; break;
+      case 'u':
+         {
+            unsigned int unicode;
+            if ( !readUnicodeEscape( unicode ) )
+               return false;
+
+            // combine a UTF-16 surrogate pair:
+            if ( unicode >= 0xd800  &&  unicode <= 0xdbff  &&
+                 end_ - current_ >= 6  &&  current_[0] == '\\'  &&  current_[1] == 'u' )
+            {
+               Location pairStart = current_;
+               current_ += 2;
+               unsigned int low;
+               if ( readUnicodeEscape( low )  &&  low >= 0xdc00  &&  low <= 0xdfff )
+                  unicode = 0x10000 + ((unicode - 0xd800) << 10) + (low - 0xdc00);
+               else
+                  current_ = pairStart;
+            }
+            appendUTF8( decoded, unicode );
+         }
+         break;
+      default:
+         return addError( "Bad escape sequence in string." );
+      }
+   }
+   return addError( "Missing '\"' at the end of a string." );
+}
+
+
+bool
+EventReader::readUnicodeEscape( unsigned int &unicode )
+{
+   if ( end_ - current_ < 4 )
+      return addError( "Bad unicode escape sequence in string: four digits expected." );
+   unicode = 0;
+   for ( int index =0; index < 4; ++index )
+   {
+      Char c = *current_++;
+      unicode *= 16;
+      if ( c >= '0'  &&  c <= '9' )
+         unicode += c - '0';
+      else if ( c >= 'a'  &&  c <= 'f' )
+         unicode += c - 'a' + 10;
+      else if ( c >= 'A'  &&  c <= 'F' )
+         unicode += c - 'A' + 10;
+      else
+         return addError( "Bad unicode escape sequence in string: hexadecimal digit expected." );
+   }
+   return true;
+}
+
+
+bool
+EventReader::readNumber( EventHandler &handler )
+{
+   Location start = current_;
+   bool isInteger = true;
+   while ( current_ != end_ )
+   {
+      Char c = *current_;
+      if ( c == '.'  ||  c == 'e'  ||  c == 'E'  ||  c == '+' )
+         isInteger = false;
+      else if ( !(c >= '0'  &&  c <= '9')  &&  c != '-' )
+         break;
+      ++current_;
+   }
+
+   int length = int(current_ - start);
+   if ( length == 0 )
+      return addError( "Syntax error: value, object or array expected." );
+
+   // the document isn't necessarily NULL-terminated, so copy the token.
+   const int bufferSize = 32;
+   char buffer[bufferSize+1];
+   std::string longBuffer;
+   const char *token = buffer;
+   if ( length <= bufferSize )
+   {
+      memcpy( buffer, start, length );
+      buffer[length] = 0;
+   }
+   else
+   {
+      longBuffer.assign( start, current_ );
+      token = longBuffer.c_str();
+   }
+
+   char *tokenEnd = 0;
+   double value = strtod( token, &tokenEnd );
+   if ( tokenEnd != token + length )
+   {
+      current_ = start;
+      return addError( std::string("'") + std::string( start, start + length ) + std::string("' is not a number.") );
+   }
+
+   return report( handler.numberValue( value, isInteger ) );
+}
+
+
+bool
+EventReader::match( const char *pattern, int patternLength )
+{
+   if ( end_ - current_ < patternLength  ||  strncmp( current_, pattern, patternLength ) != 0 )
+      return addError( "Syntax error: value, object or array expected." );
+   current_ += patternLength;
+   return true;
+}
+
+
+void
+EventReader::skipSpaces()
+{
+   while ( current_ != end_ )
+   {
+      Char c = *current_;
+      if ( c == ' '  ||  c == '\t'  ||  c == '\r'  ||  c == '\n' )
+      {
+         ++current_;
+      }
+      else if ( c == '/'  &&  end_ - current_ >= 2  &&  current_[1] == '/' )
+      {
+         while ( current_ != end_  &&  *current_ != '\n' )
+            ++current_;
+      }
+      else if ( c == '/'  &&  end_ - current_ >= 2  &&  current_[1] == '*' )
+      {
+         current_ += 2;
+         while ( current_ != end_  &&  !(*current_ == '*'  &&  end_ - current_ >= 2  &&  current_[1] == '/') )
+            ++current_;
+         current_ = current_ == end_ ? end_ : current_ + 2;
+      }
+      else
+      {
+         break;
+      }
+   }
+}
+
+
+bool
+EventReader::report( bool keepGoing )
+{
+   if ( !keepGoing  &&  error_.empty() )
+   {
+      error_ = "Read stopped by the handler.";
+      errorLocation_ = current_;
+   }
+   return keepGoing;
+}
+
+
+bool
+EventReader::addError( const std::string &message )
+{
+   error_ = message;
+   errorLocation_ = current_;
+   return false;
+}
+
+
+std::string
+EventReader::getFormatedErrorMessages() const
+{
+   if ( error_.empty() )
+      return std::string();
+
+   int line = 1;
+   Location lastLineStart = begin_;
+   for ( Location current = begin_; current < errorLocation_; ++current )
+   {
+      if ( *current == '\n' )
+      {
+         ++line;
+         lastLineStart = current + 1;
+      }
+   }
+   std::ostringstream buf;
+   buf << "* Line " << line << ", Column " << int(errorLocation_ - lastLineStart) + 1 << "\n"
+       << "  " << error_ << "\n";
+   return buf.str();
+}
+
 namespace osgEarth {
     namespace Json {
 
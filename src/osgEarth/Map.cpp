@@ -92,6 +92,8 @@ _dataModelRevision   ( 0 )
     // set up a callback that the Map will use to detect Elevation Layer
     // visibility changes
     _elevationLayerCB = new ElevationLayerCB(this);
+
+    publishSnapshot();
 }
 
 Map::~Map()
@@ -107,6 +109,7 @@ Map::notifyElevationLayerVisibleChanged(TerrainLayer* layer)
     {
         Threading::ScopedWriteLock lock( const_cast<Map*>(this)->_mapDataMutex );
         newRevision = ++_dataModelRevision;
+        publishSnapshot();
     }
 
     // a separate block b/c we don't need the mutex   
@@ -140,27 +143,29 @@ Map::setGlobalOptions( const osgDB::Options* options )
 Revision
 Map::getImageLayers( ImageLayerVector& out_list ) const
 {
-    out_list.reserve( _imageLayers.size() );
-
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    out_list.reserve( s->_imageLayers.size() );
+    for( ImageLayerVector::const_iterator i = s->_imageLayers.begin(); i != s->_imageLayers.end(); ++i )
         out_list.push_back( i->get() );
 
-    return _dataModelRevision;
+    return s->_revision;
 }
 
 int
 Map::getNumImageLayers() const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    return _imageLayers.size();
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    return s->_imageLayers.size();
 }
 
 ImageLayer*
 Map::getImageLayerByName( const std::string& name ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    for( ImageLayerVector::const_iterator i = s->_imageLayers.begin(); i != s->_imageLayers.end(); ++i )
         if ( i->get()->getName() == name )
             return i->get();
     return 0L;
@@ -169,8 +174,9 @@ Map::getImageLayerByName( const std::string& name ) const
 ImageLayer*
 Map::getImageLayerByUID( UID layerUID ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    for( ImageLayerVector::const_iterator i = s->_imageLayers.begin(); i != s->_imageLayers.end(); ++i )
         if ( i->get()->getUID() == layerUID )
             return i->get();
     return 0L;
@@ -179,9 +185,10 @@ Map::getImageLayerByUID( UID layerUID ) const
 ImageLayer*
 Map::getImageLayerAt( int index ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    if ( index >= 0 && index < (int)_imageLayers.size() )
-        return _imageLayers[index].get();
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    if ( index >= 0 && index < (int)s->_imageLayers.size() )
+        return s->_imageLayers[index].get();
     else
         return 0L;
 }
@@ -189,27 +196,29 @@ Map::getImageLayerAt( int index ) const
 Revision
 Map::getElevationLayers( ElevationLayerVector& out_list ) const
 {
-    out_list.reserve( _elevationLayers.size() );
-
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ElevationLayerVector::const_iterator i = _elevationLayers.begin(); i != _elevationLayers.end(); ++i )
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    out_list.reserve( s->_elevationLayers.size() );
+    for( ElevationLayerVector::const_iterator i = s->_elevationLayers.begin(); i != s->_elevationLayers.end(); ++i )
         out_list.push_back( i->get() );
 
-    return _dataModelRevision;
+    return s->_revision;
 }
 
 int
 Map::getNumElevationLayers() const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    return _elevationLayers.size();
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    return s->_elevationLayers.size();
 }
 
 ElevationLayer*
 Map::getElevationLayerByName( const std::string& name ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ElevationLayerVector::const_iterator i = _elevationLayers.begin(); i != _elevationLayers.end(); ++i )
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    for( ElevationLayerVector::const_iterator i = s->_elevationLayers.begin(); i != s->_elevationLayers.end(); ++i )
         if ( i->get()->getName() == name )
             return i->get();
     return 0L;
@@ -218,8 +227,9 @@ Map::getElevationLayerByName( const std::string& name ) const
 ElevationLayer*
 Map::getElevationLayerByUID( UID layerUID ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ElevationLayerVector::const_iterator i = _elevationLayers.begin(); i != _elevationLayers.end(); ++i )
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    for( ElevationLayerVector::const_iterator i = s->_elevationLayers.begin(); i != s->_elevationLayers.end(); ++i )
         if ( i->get()->getUID() == layerUID )
             return i->get();
     return 0L;
@@ -228,9 +238,10 @@ Map::getElevationLayerByUID( UID layerUID ) const
 ElevationLayer*
 Map::getElevationLayerAt( int index ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    if ( index >= 0 && index < (int)_elevationLayers.size() )
-        return _elevationLayers[index].get();
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    if ( index >= 0 && index < (int)s->_elevationLayers.size() )
+        return s->_elevationLayers[index].get();
     else
         return 0L;
 }
@@ -238,20 +249,21 @@ Map::getElevationLayerAt( int index ) const
 Revision
 Map::getModelLayers( ModelLayerVector& out_list ) const
 {
-    out_list.reserve( _modelLayers.size() );
-
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ModelLayerVector::const_iterator i = _modelLayers.begin(); i != _modelLayers.end(); ++i )
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    out_list.reserve( s->_modelLayers.size() );
+    for( ModelLayerVector::const_iterator i = s->_modelLayers.begin(); i != s->_modelLayers.end(); ++i )
         out_list.push_back( i->get() );
 
-    return _dataModelRevision;
+    return s->_revision;
 }
 
 ModelLayer*
 Map::getModelLayerByName( const std::string& name ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ModelLayerVector::const_iterator i = _modelLayers.begin(); i != _modelLayers.end(); ++i )
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    for( ModelLayerVector::const_iterator i = s->_modelLayers.begin(); i != s->_modelLayers.end(); ++i )
         if ( i->get()->getName() == name )
             return i->get();
     return 0L;
@@ -260,8 +272,9 @@ Map::getModelLayerByName( const std::string& name ) const
 ModelLayer*
 Map::getModelLayerByUID( UID layerUID ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ModelLayerVector::const_iterator i = _modelLayers.begin(); i != _modelLayers.end(); ++i )
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    for( ModelLayerVector::const_iterator i = s->_modelLayers.begin(); i != s->_modelLayers.end(); ++i )
         if ( i->get()->getUID() == layerUID )
             return i->get();
     return 0L;
@@ -271,9 +284,10 @@ Map::getModelLayerByUID( UID layerUID ) const
 ModelLayer*
 Map::getModelLayerAt( int index ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    if ( index >= 0 && index < (int)_modelLayers.size() )
-        return _modelLayers[index].get();
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    if ( index >= 0 && index < (int)s->_modelLayers.size() )
+        return s->_modelLayers[index].get();
     else
         return 0L;
 }
@@ -281,20 +295,21 @@ Map::getModelLayerAt( int index ) const
 int
 Map::getNumModelLayers() const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    return _modelLayers.size();
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    return s->_modelLayers.size();
 }
 
 int
 Map::getTerrainMaskLayers( MaskLayerVector& out_list ) const
 {
-    out_list.reserve( _terrainMaskLayers.size() );
-
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    for( MaskLayerVector::const_iterator i = _terrainMaskLayers.begin(); i != _terrainMaskLayers.end(); ++i )
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
+    out_list.reserve( s->_maskLayers.size() );
+    for( MaskLayerVector::const_iterator i = s->_maskLayers.begin(); i != s->_maskLayers.end(); ++i )
         out_list.push_back( i->get() );
 
-    return _dataModelRevision;
+    return s->_revision;
 }
 
 void
@@ -305,8 +320,40 @@ Map::setName( const std::string& name ) {
 Revision
 Map::getDataModelRevision() const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    return _dataModelRevision;
+    return (int)(unsigned)_publishedRevision;
+}
+
+void
+Map::getLayerSnapshot( osg::ref_ptr<const LayerSnapshot>& out_snapshot ) const
+{
+    // C++03 has no atomic shared pointer, and an unguarded load could race
+    // with the last unref of a retired snapshot; so copy the pointer under
+    // a mutex that is never held for longer than that.
+    Threading::ScopedMutexLock lock( _snapshotMutex );
+    out_snapshot = _snapshot.get();
+}
+
+void
+Map::publishSnapshot()
+{
+    // caller holds the write lock (or is the constructor).
+    osg::ref_ptr<LayerSnapshot> s = new LayerSnapshot();
+    s->_revision        = _dataModelRevision;
+    s->_imageLayers     = _imageLayers;
+    s->_elevationLayers = _elevationLayers;
+    s->_modelLayers     = _modelLayers;
+    s->_maskLayers      = _terrainMaskLayers;
+
+    if ( _mapOptions.elevationTileSize().isSet() )
+        s->_elevationLayers.setExpressTileSize( *_mapOptions.elevationTileSize() );
+
+    {
+        Threading::ScopedMutexLock lock( _snapshotMutex );
+        _snapshot = s.get();
+    }
+
+    // publish the revision last, so a reader that sees it also sees the snapshot.
+    _publishedRevision.exchange( (unsigned)(int)_dataModelRevision );
 }
 
 const Profile*
@@ -436,6 +483,7 @@ Map::addImageLayer( ImageLayer* layer )
             _imageLayers.push_back( layer );
             index = _imageLayers.size() - 1;
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // a separate block b/c we don't need the mutex   
@@ -476,6 +524,7 @@ Map::insertImageLayer( ImageLayer* layer, unsigned int index )
                 _imageLayers.insert( _imageLayers.begin() + index, layer );
 
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // a separate block b/c we don't need the mutex   
@@ -513,6 +562,7 @@ Map::addElevationLayer( ElevationLayer* layer )
             _elevationLayers.push_back( layer );
             index = _elevationLayers.size() - 1;
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // listen for changes in the layer.
@@ -546,6 +596,7 @@ Map::removeImageLayer( ImageLayer* layer )
             {
                 _imageLayers.erase( i );
                 newRevision = ++_dataModelRevision;
+                publishSnapshot();
                 break;
             }
         }
@@ -582,6 +633,7 @@ Map::removeElevationLayer( ElevationLayer* layer )
             {
                 _elevationLayers.erase( i );
                 newRevision = ++_dataModelRevision;
+                publishSnapshot();
                 break;
             }
         }
@@ -634,6 +686,7 @@ Map::moveImageLayer( ImageLayer* layer, unsigned int newIndex )
         _imageLayers.insert( _imageLayers.begin() + newIndex, layerToMove.get() );
 
         newRevision = ++_dataModelRevision;
+        publishSnapshot();
     }
 
     // a separate block b/c we don't need the mutex
@@ -681,6 +734,7 @@ Map::moveElevationLayer( ElevationLayer* layer, unsigned int newIndex )
         _elevationLayers.insert( _elevationLayers.begin() + newIndex, layerToMove.get() );
 
         newRevision = ++_dataModelRevision;
+        publishSnapshot();
     }
 
     // a separate block b/c we don't need the mutex
@@ -707,6 +761,7 @@ Map::addModelLayer( ModelLayer* layer )
             _modelLayers.push_back( layer );
             index = _modelLayers.size() - 1;
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // initialize the model layer
@@ -731,6 +786,7 @@ Map::insertModelLayer( ModelLayer* layer, unsigned int index )
             Threading::ScopedWriteLock lock( _mapDataMutex );
             _modelLayers.insert( _modelLayers.begin() + index, layer );
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // initialize the model layer
@@ -762,6 +818,7 @@ Map::removeModelLayer( ModelLayer* layer )
                 {
                     _modelLayers.erase( i );
                     newRevision = ++_dataModelRevision;
+                    publishSnapshot();
                     break;
                 }
             }
@@ -809,6 +866,7 @@ Map::moveModelLayer( ModelLayer* layer, unsigned int newIndex )
         _modelLayers.insert( _modelLayers.begin() + newIndex, layerToMove.get() );
 
         newRevision = ++_dataModelRevision;
+        publishSnapshot();
     }
 
     // a separate block b/c we don't need the mutex
@@ -832,6 +890,7 @@ Map::addTerrainMaskLayer( MaskLayer* layer )
             Threading::ScopedWriteLock lock( _mapDataMutex );
             _terrainMaskLayers.push_back(layer);
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         layer->initialize( _dbOptions.get(), this );
@@ -861,6 +920,7 @@ Map::removeTerrainMaskLayer( MaskLayer* layer )
                 {
                     _terrainMaskLayers.erase( i );
                     newRevision = ++_dataModelRevision;
+                    publishSnapshot();
                     break;
                 }
             }
@@ -894,6 +954,7 @@ Map::clear()
 
         // calculate a new revision.
         newRevision = ++_dataModelRevision;
+        publishSnapshot();
     }
     
     // a separate block b/c we don't need the mutex   
@@ -1119,7 +1180,9 @@ Map::populateHeightField(osg::ref_ptr<osg::HeightField>& hf,
                          ElevationSamplePolicy           samplePolicy, // deprecated (unused)
                          ProgressCallback*               progress) const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
+    // sample from the snapshot so no lock is held during the layer reads.
+    osg::ref_ptr<const LayerSnapshot> s;
+    getLayerSnapshot( s );
 
     ElevationInterpolation interp = getMapOptions().elevationInterpolation().get();    
 
@@ -1128,7 +1191,7 @@ Map::populateHeightField(osg::ref_ptr<osg::HeightField>& hf,
         hf = createReferenceHeightField(key, convertToHAE);
     }
 
-    return _elevationLayers.populateHeightField(
+    return s->_elevationLayers.populateHeightField(
         hf.get(),
         key,
         convertToHAE ? _profileNoVDatum.get() : 0L,
@@ -1145,49 +1208,18 @@ Map::getWorldSRS() const
 bool
 Map::sync( MapFrame& frame ) const
 {
-    bool result = false;
-
-    if ( frame._mapDataModelRevision != _dataModelRevision || !frame._initialized )
-    {
-        // hold the read lock while copying the layer lists.
-        Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
+    // fast path: one atomic load, no locks.
+    if ( frame._initialized && frame._mapDataModelRevision == (int)(unsigned)_publishedRevision )
+        return false;
 
-        if ( frame._parts & IMAGE_LAYERS )
-        {
-            if ( !frame._initialized )
-                frame._imageLayers.reserve( _imageLayers.size() );
-            frame._imageLayers.clear();
-            std::copy( _imageLayers.begin(), _imageLayers.end(), std::back_inserter(frame._imageLayers) );
-        }
+    osg::ref_ptr<const LayerSnapshot> snapshot;
+    getLayerSnapshot( snapshot );
 
-        if ( frame._parts & ELEVATION_LAYERS )
-        {
-            frame._elevationLayers = _elevationLayers;
-            if ( _mapOptions.elevationTileSize().isSet() )
-                frame._elevationLayers.setExpressTileSize( *_mapOptions.elevationTileSize() );
-        }
-
-        if ( frame._parts & MODEL_LAYERS )
-        {
-            if ( !frame._initialized )
-                frame._modelLayers.reserve( _modelLayers.size() );
-            frame._modelLayers.clear();
-            std::copy( _modelLayers.begin(), _modelLayers.end(), std::back_inserter(frame._modelLayers) );
-        }
-
-        if ( frame._parts & MASK_LAYERS )
-        {
-          if ( !frame._initialized )
-              frame._maskLayers.reserve( _terrainMaskLayers.size() );
-          frame._maskLayers.clear();
-          std::copy( _terrainMaskLayers.begin(), _terrainMaskLayers.end(), std::back_inserter(frame._maskLayers) );
-        }
+    if ( frame._initialized && frame._mapDataModelRevision == snapshot->_revision )
+        return false;
 
-        // sync the revision numbers.
-        frame._initialized = true;
-        frame._mapDataModelRevision = _dataModelRevision;
-            
-        result = true;
-    }    
-    return result;
+    frame.setSnapshot( snapshot.get() );
+    frame._initialized = true;
+    frame._mapDataModelRevision = snapshot->_revision;
+    return true;
 }
@@ -22,6 +22,15 @@ using namespace osgEarth;
 
 #define LC "[MapFrame] "
 
+namespace
+{
+    // what a frame sees for the parts it does not sync
+    const ImageLayerVector     s_noImageLayers;
+    const ElevationLayerVector s_noElevationLayers;
+    const ModelLayerVector     s_noModelLayers;
+    const MaskLayerVector      s_noMaskLayers;
+}
+
 
 MapFrame::MapFrame( const Map* map, Map::ModelParts parts, const std::string& name ) :
 _initialized    ( false ),
@@ -31,6 +40,7 @@ _mapInfo        ( map ),
 _parts          ( parts ),
 _highestMinLevel( 0 )
 {
+    setSnapshot( 0L );
     sync();
 }
 
@@ -43,12 +53,13 @@ _mapInfo             ( src._mapInfo ),
 _parts               ( src._parts ),
 _highestMinLevel     ( src._highestMinLevel ),
 _mapDataModelRevision( src._mapDataModelRevision ),
+_snapshot            ( src._snapshot ),
 _imageLayers         ( src._imageLayers ),
 _elevationLayers     ( src._elevationLayers ),
 _modelLayers         ( src._modelLayers ),
 _maskLayers          ( src._maskLayers )
 {
-    //no sync required here; we copied the arrays etc
+    //no sync required here; we share the source's snapshot
 }
 
 
@@ -68,15 +79,23 @@ MapFrame::sync()
     }
     else
     {
-        _imageLayers.clear();
-        _elevationLayers.clear();
-        _modelLayers.clear();
-        _maskLayers.clear();
+        setSnapshot( 0L );
     }
 
     return changed;
 }
 
+void
+MapFrame::setSnapshot( const Map::LayerSnapshot* snapshot )
+{
+    _snapshot = snapshot;
+
+    _imageLayers     = snapshot && (_parts & Map::IMAGE_LAYERS)     ? &snapshot->_imageLayers     : &s_noImageLayers;
+    _elevationLayers = snapshot && (_parts & Map::ELEVATION_LAYERS) ? &snapshot->_elevationLayers : &s_noElevationLayers;
+    _modelLayers     = snapshot && (_parts & Map::MODEL_LAYERS)     ? &snapshot->_modelLayers     : &s_noModelLayers;
+    _maskLayers      = snapshot && (_parts & Map::MASK_LAYERS)      ? &snapshot->_maskLayers      : &s_noMaskLayers;
+}
+
 
 bool
 MapFrame::needsSync() const
@@ -98,8 +117,8 @@ MapFrame::refreshComputedValues()
     // cache the min LOD based on all image/elev layers
     _highestMinLevel = 0;
 
-    for(ImageLayerVector::const_iterator i = _imageLayers.begin(); 
-        i != _imageLayers.end();
+    for(ImageLayerVector::const_iterator i = _imageLayers->begin(); 
+        i != _imageLayers->end();
         ++i)
     {
         const optional<unsigned>& minLevel = i->get()->getTerrainLayerRuntimeOptions().minLevel();
@@ -107,8 +126,8 @@ MapFrame::refreshComputedValues()
             _highestMinLevel = minLevel.value();
     }
 
-    for(ElevationLayerVector::const_iterator i = _elevationLayers.begin(); 
-        i != _elevationLayers.end();
+    for(ElevationLayerVector::const_iterator i = _elevationLayers->begin(); 
+        i != _elevationLayers->end();
         ++i)
     {
         const optional<unsigned>& minLevel = i->get()->getTerrainLayerRuntimeOptions().minLevel();
@@ -134,7 +153,7 @@ MapFrame::populateHeightField(osg::ref_ptr<osg::HeightField>& hf,
         hf = _map->createReferenceHeightField(key, convertToHAE);
     }
 
-    return _elevationLayers.populateHeightField(
+    return _elevationLayers->populateHeightField(
         hf.get(),
         key,
         convertToHAE ? _map->getProfileNoVDatum() : 0L,
@@ -146,31 +165,31 @@ MapFrame::populateHeightField(osg::ref_ptr<osg::HeightField>& hf,
 int
 MapFrame::indexOf( ImageLayer* layer ) const
 {
-    ImageLayerVector::const_iterator i = std::find( _imageLayers.begin(), _imageLayers.end(), layer );
-    return i != _imageLayers.end() ? i - _imageLayers.begin() : -1;
+    ImageLayerVector::const_iterator i = std::find( _imageLayers->begin(), _imageLayers->end(), layer );
+    return i != _imageLayers->end() ? i - _imageLayers->begin() : -1;
 }
 
 
 int
 MapFrame::indexOf( ElevationLayer* layer ) const
 {
-    ElevationLayerVector::const_iterator i = std::find( _elevationLayers.begin(), _elevationLayers.end(), layer );
-    return i != _elevationLayers.end() ? i - _elevationLayers.begin() : -1;
+    ElevationLayerVector::const_iterator i = std::find( _elevationLayers->begin(), _elevationLayers->end(), layer );
+    return i != _elevationLayers->end() ? i - _elevationLayers->begin() : -1;
 }
 
 
 int
 MapFrame::indexOf( ModelLayer* layer ) const
 {
-    ModelLayerVector::const_iterator i = std::find( _modelLayers.begin(), _modelLayers.end(), layer );
-    return i != _modelLayers.end() ? i - _modelLayers.begin() : -1;
+    ModelLayerVector::const_iterator i = std::find( _modelLayers->begin(), _modelLayers->end(), layer );
+    return i != _modelLayers->end() ? i - _modelLayers->begin() : -1;
 }
 
 
 ImageLayer*
 MapFrame::getImageLayerByUID( UID uid ) const
 {
-    for(ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
+    for(ImageLayerVector::const_iterator i = _imageLayers->begin(); i != _imageLayers->end(); ++i )
         if ( i->get()->getUID() == uid )
             return i->get();
     return 0L;
@@ -180,7 +199,7 @@ MapFrame::getImageLayerByUID( UID uid ) const
 ImageLayer*
 MapFrame::getImageLayerByName( const std::string& name ) const
 {
-    for(ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
+    for(ImageLayerVector::const_iterator i = _imageLayers->begin(); i != _imageLayers->end(); ++i )
         if ( i->get()->getName() == name )
             return i->get();
     return 0L;
@@ -34,9 +34,14 @@
 #include <osgEarth/TerrainEngineNode>
 #include <osgEarth/TextureCompositor>
 #include <osgEarth/ShaderGenerator>
+#include <osgEarth/TaskService>
 #include <osgEarth/URI>
 #include <osg/ArgumentParser>
+#include <osg/DisplaySettings>
 #include <osg/PagedLOD>
+#include <algorithm>
+#include <iomanip>
+#include <map>
 
 using namespace osgEarth;
 
@@ -60,6 +65,12 @@ namespace
         void onModelLayerMoved( ModelLayer* layer, unsigned int oldIndex, unsigned int newIndex ) {
             _node->onModelLayerMoved( layer, oldIndex, newIndex);
         }
+        void onImageLayerAdded( ImageLayer* layer, unsigned int index ) {
+            _node->onTerrainLayerAdded( layer );
+        }
+        void onElevationLayerAdded( ElevationLayer* layer, unsigned int index ) {
+            _node->onTerrainLayerAdded( layer );
+        }
 
         osg::observer_ptr<MapNode> _node;
     };
@@ -83,6 +94,99 @@ namespace
     };
 
     typedef std::vector< osg::ref_ptr<Extension> > Extensions;
+
+    // Loads the driver plugins for the terrain engine and all the map's layers
+    // up front, so they don't each probe the plugin path on first use.
+    void preloadDrivers( const Map* map, const TerrainOptions& terrainOptions )
+    {
+        std::vector<std::string> extensions;
+
+        std::string engine = terrainOptions.getDriver();
+        if ( engine.empty() )
+            engine = Registry::instance()->getDefaultTerrainEngineDriverName();
+        extensions.push_back( "osgearth_engine_" + engine );
+
+        ImageLayerVector imageLayers;
+        map->getImageLayers( imageLayers );
+        for( ImageLayerVector::const_iterator i = imageLayers.begin(); i != imageLayers.end(); ++i )
+        {
+            const optional<TileSourceOptions>& driver = i->get()->getTerrainLayerRuntimeOptions().driver();
+            if ( driver.isSet() && !driver->getDriver().empty() )
+                extensions.push_back( "osgearth_" + driver->getDriver() );
+        }
+
+        ElevationLayerVector elevationLayers;
+        map->getElevationLayers( elevationLayers );
+        for( ElevationLayerVector::const_iterator i = elevationLayers.begin(); i != elevationLayers.end(); ++i )
+        {
+            const optional<TileSourceOptions>& driver = i->get()->getTerrainLayerRuntimeOptions().driver();
+            if ( driver.isSet() && !driver->getDriver().empty() )
+                extensions.push_back( "osgearth_" + driver->getDriver() );
+        }
+
+        ModelLayerVector modelLayers;
+        map->getModelLayers( modelLayers );
+        for( ModelLayerVector::const_iterator i = modelLayers.begin(); i != modelLayers.end(); ++i )
+        {
+            const optional<ModelSourceOptions>& driver = i->get()->getModelLayerOptions().driver();
+            if ( driver.isSet() && !driver->getDriver().empty() )
+                extensions.push_back( "osgearth_model_" + driver->getDriver() );
+        }
+
+        Registry::instance()->preloadDrivers( extensions );
+    }
+
+    // opens a terrain layer's tile source (see openTerrainLayers)
+    struct OpenTerrainLayer
+    {
+        void execute()
+        {
+            _layer->getTileSource();
+        }
+
+        osg::ref_ptr<TerrainLayer> _layer;
+    };
+
+    // Opens all the image and elevation layers in a map at once. Each layer
+    // opens lazily on first use anyway, but the terrain engine would touch them
+    // one after another, serializing any network capability probes.
+    void openTerrainLayers( const Map* map, unsigned numThreads )
+    {
+        std::vector< osg::ref_ptr<TerrainLayer> > layers;
+        ImageLayerVector imageLayers;
+        map->getImageLayers( imageLayers );
+        layers.insert( layers.end(), imageLayers.begin(), imageLayers.end() );
+        ElevationLayerVector elevationLayers;
+        map->getElevationLayers( elevationLayers );
+        layers.insert( layers.end(), elevationLayers.begin(), elevationLayers.end() );
+
+        if ( numThreads < 2 || layers.size() < 2 )
+            return;
+
+        numThreads = osg::minimum( numThreads, (unsigned)layers.size() );
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+
+        osg::ref_ptr<TaskService> service = new TaskService( "Layer open", numThreads );
+        Threading::MultiEvent semaphore( (int)layers.size() );
+        for( unsigned i = 0; i < layers.size(); ++i )
+        {
+            ParallelTask<OpenTerrainLayer>* task = new ParallelTask<OpenTerrainLayer>( &semaphore );
+            task->_layer = layers[i].get();
+            service->add( task );
+        }
+        semaphore.wait();
+
+        // report the time-to-ready of each layer, slowest first.
+        std::multimap<double, std::string> times;
+        for( unsigned i = 0; i < layers.size(); ++i )
+            times.insert( std::make_pair(-layers[i]->getTimeToReady(), layers[i]->getName()) );
+
+        OE_INFO << LC << "Opened " << layers.size() << " layers on " << numThreads << " threads in "
+            << osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) << " s" << std::endl;
+        for( std::multimap<double, std::string>::const_iterator i = times.begin(); i != times.end(); ++i )
+            OE_INFO << LC << "    " << std::setw(8) << -i->first << " s : " << i->second << std::endl;
+    }
 }
 
 //---------------------------------------------------------------------------
@@ -231,6 +335,11 @@ MapNode::init()
         HTTPClient::setProxySettings( _mapNodeOptions.proxySettings().get() );
     }
 
+    if ( _mapNodeOptions.httpConnectionSettings().isSet() )
+    {
+        HTTPClient::setConnectionSettings( _mapNodeOptions.httpConnectionSettings().get() );
+    }
+
     // establish global driver options. These are OSG reader-writer options that
     // will make their way to any read* calls down the pipe
     const osgDB::Options* global_options = _map->getGlobalOptions();
@@ -250,9 +359,23 @@ MapNode::init()
     // TODO: not sure why we call this here
     _map->setGlobalOptions( local_options.get() );
 
+    // low-memory profile: fewer pager threads, since each one holds tiles in
+    // flight. This only reaches pagers created after this point, and an
+    // explicit OSG_NUM_*DATABASE_THREADS environment setting wins.
+    if ( _mapNodeOptions.lowMemory() == true )
+    {
+        osg::DisplaySettings* ds = osg::DisplaySettings::instance().get();
+        if ( !::getenv("OSG_NUM_DATABASE_THREADS") )
+            ds->setNumOfDatabaseThreadsHint( std::min(ds->getNumOfDatabaseThreadsHint(), 2u) );
+        if ( !::getenv("OSG_NUM_HTTP_DATABASE_THREADS") )
+            ds->setNumOfHttpDatabaseThreadsHint( std::min(ds->getNumOfHttpDatabaseThreadsHint(), 1u) );
+    }
+
     // load and attach the terrain engine, but don't initialize it until we need it
     const TerrainOptions& terrainOptions = _mapNodeOptions.getTerrainOptions();
 
+    preloadDrivers( _map.get(), terrainOptions );
+
     _terrainEngine = TerrainEngineNodeFactory::create( _map.get(), terrainOptions );
     _terrainEngineInitialized = false;
 
@@ -313,12 +436,18 @@ MapNode::init()
             draping->setTextureSize( as<int>(envOverlayTextureSize, 1024) );
         else if ( _mapNodeOptions.overlayTextureSize().isSet() )
             draping->setTextureSize( *_mapNodeOptions.overlayTextureSize() );
+        else if ( _mapNodeOptions.lowMemory() == true )
+            draping->setTextureSize( 1024 );
         if ( _mapNodeOptions.overlayMipMapping().isSet() )
             draping->setMipMapping( *_mapNodeOptions.overlayMipMapping() );
         if ( _mapNodeOptions.overlayAttachStencil().isSet() )
             draping->setAttachStencil( *_mapNodeOptions.overlayAttachStencil() );
         if ( _mapNodeOptions.overlayResolutionRatio().isSet() )
             draping->setResolutionRatio( *_mapNodeOptions.overlayResolutionRatio() );
+        if ( _mapNodeOptions.overlayCascades().isSet() )
+            draping->setNumCascades( *_mapNodeOptions.overlayCascades() );
+        if ( _mapNodeOptions.overlayDirtyTracking().isSet() )
+            draping->setDirtyTracking( *_mapNodeOptions.overlayDirtyTracking() );
 
         _overlayDecorator->addTechnique( draping );
     }
@@ -340,6 +469,21 @@ MapNode::init()
         onModelLayerAdded( k->get(), modelLayerIndex );
     }
 
+    // apply the per-layer settings to the pre-existing image and elevation layers:
+    ImageLayerVector imageLayers;
+    _map->getImageLayers( imageLayers );
+    for( ImageLayerVector::const_iterator i = imageLayers.begin(); i != imageLayers.end(); ++i )
+    {
+        onTerrainLayerAdded( i->get() );
+    }
+
+    ElevationLayerVector elevationLayers;
+    _map->getElevationLayers( elevationLayers );
+    for( ElevationLayerVector::const_iterator i = elevationLayers.begin(); i != elevationLayers.end(); ++i )
+    {
+        onTerrainLayerAdded( i->get() );
+    }
+
     _mapCallback = new MapNodeMapCallbackProxy(this);
     // install a layer callback for processing further map actions:
     _map->addMapCallback( _mapCallback.get()  );
@@ -428,6 +572,11 @@ MapNode::getTerrainEngine() const
 {
     if ( !_terrainEngineInitialized && _terrainEngine )
     {
+        unsigned openThreads = *getMapNodeOptions().layerOpenThreads();
+        if ( getMapNodeOptions().lowMemory() == true && !getMapNodeOptions().layerOpenThreads().isSet() )
+            openThreads = std::min( openThreads, 2u );
+
+        openTerrainLayers( _map.get(), openThreads );
         _terrainEngine->postInitialize( _map.get(), getMapNodeOptions().getTerrainOptions() );
         MapNode* me = const_cast< MapNode* >(this);
         me->_terrainEngineInitialized = true;
@@ -577,6 +726,16 @@ MapNode::onModelLayerAdded( ModelLayer* layer, unsigned int index )
     }
 }
 
+void
+MapNode::onTerrainLayerAdded( TerrainLayer* layer )
+{
+    // the low-memory profile keeps the layers' in-memory tile caches small.
+    if ( layer && _mapNodeOptions.lowMemory() == true )
+    {
+        layer->limitMemCache( 8u * 1024u * 1024u, 0.1f );
+    }
+}
+
 void
 MapNode::onModelLayerRemoved( ModelLayer* layer )
 {
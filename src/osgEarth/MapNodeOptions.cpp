@@ -33,6 +33,7 @@ static TerrainOptions s_defaultTerrainOptions;
 MapNodeOptions::MapNodeOptions( const Config& conf ) :
 ConfigOptions          ( conf ),
 _proxySettings         ( ProxySettings() ),
+_httpConnectionSettings( HTTPConnectionSettings() ),
 _cacheOnly             ( false ),
 _enableLighting        ( true ),
 _overlayBlending       ( true ),
@@ -40,13 +41,16 @@ _overlayMipMapping     ( false ),
 _overlayTextureSize    ( 4096 ),
 _terrainOptions        ( 0L ),
 _overlayAttachStencil  ( false ),
-_overlayResolutionRatio( 3.0f )
+_overlayResolutionRatio( 3.0f ),
+_layerOpenThreads      ( 8 ),
+_lowMemory             ( false )
 {
     mergeConfig( conf );
 }
 
 MapNodeOptions::MapNodeOptions( const TerrainOptions& to ) :
 _proxySettings         ( ProxySettings() ),
+_httpConnectionSettings( HTTPConnectionSettings() ),
 _cacheOnly             ( false ),
 _enableLighting        ( true ),
 _overlayBlending       ( true ),
@@ -54,13 +58,16 @@ _overlayTextureSize    ( 4096 ),
 _overlayMipMapping     ( false ),
 _overlayAttachStencil  ( false ),
 _overlayResolutionRatio( 3.0f ),
-_terrainOptions        ( 0L )
+_terrainOptions        ( 0L ),
+_layerOpenThreads      ( 8 ),
+_lowMemory             ( false )
 {
     setTerrainOptions( to );
 }
 
 MapNodeOptions::MapNodeOptions( const MapNodeOptions& rhs ) :
 _proxySettings         ( ProxySettings() ),
+_httpConnectionSettings( HTTPConnectionSettings() ),
 _cacheOnly             ( false ),
 _enableLighting        ( true ),
 _overlayBlending       ( true ),
@@ -68,7 +75,9 @@ _overlayTextureSize    ( 4096 ),
 _overlayMipMapping     ( false ),
 _overlayAttachStencil  ( false ),
 _overlayResolutionRatio( 3.0f ),
-_terrainOptions        ( 0L )
+_terrainOptions        ( 0L ),
+_layerOpenThreads      ( 8 ),
+_lowMemory             ( false )
 {
     mergeConfig( rhs.getConfig() );
 }
@@ -90,6 +99,7 @@ MapNodeOptions::getConfig() const
     conf.key() = "options";
 
     conf.updateObjIfSet( "proxy",                    _proxySettings );
+    conf.updateObjIfSet( "http",                     _httpConnectionSettings );
     conf.updateIfSet   ( "cache_only",               _cacheOnly );
     conf.updateIfSet   ( "lighting",                 _enableLighting );
     conf.updateIfSet   ( "terrain",                  _terrainOptionsConf );
@@ -99,6 +109,10 @@ MapNodeOptions::getConfig() const
     conf.updateIfSet   ( "overlay_mipmapping",       _overlayMipMapping );
     conf.updateIfSet   ( "overlay_attach_stencil",   _overlayAttachStencil );
     conf.updateIfSet   ( "overlay_resolution_ratio", _overlayResolutionRatio );
+    conf.updateIfSet   ( "overlay_cascades",         _overlayCascades );
+    conf.updateIfSet   ( "overlay_dirty_tracking",   _overlayDirtyTracking );
+    conf.updateIfSet   ( "layer_open_threads",       _layerOpenThreads );
+    conf.updateIfSet   ( "low_memory",               _lowMemory );
 
     return conf;
 }
@@ -109,6 +123,7 @@ MapNodeOptions::mergeConfig( const Config& conf )
     ConfigOptions::mergeConfig( conf );
 
     conf.getObjIfSet( "proxy",                    _proxySettings );
+    conf.getObjIfSet( "http",                     _httpConnectionSettings );
     conf.getIfSet   ( "cache_only",               _cacheOnly );
     conf.getIfSet   ( "lighting",                 _enableLighting );
     conf.getIfSet   ( "overlay_warping",          _overlayVertexWarping );
@@ -117,6 +132,10 @@ MapNodeOptions::mergeConfig( const Config& conf )
     conf.getIfSet   ( "overlay_mipmapping",       _overlayMipMapping );
     conf.getIfSet   ( "overlay_attach_stencil",   _overlayAttachStencil );
     conf.getIfSet   ( "overlay_resolution_ratio", _overlayResolutionRatio );
+    conf.getIfSet   ( "overlay_cascades",         _overlayCascades );
+    conf.getIfSet   ( "overlay_dirty_tracking",   _overlayDirtyTracking );
+    conf.getIfSet   ( "layer_open_threads",       _layerOpenThreads );
+    conf.getIfSet   ( "low_memory",               _lowMemory );
 
     if ( conf.hasChild( "terrain" ) )
     {
@@ -127,6 +146,28 @@ MapNodeOptions::mergeConfig( const Config& conf )
             _terrainOptions = 0L;
         }
     }
+
+    applyLowMemoryProfile();
+}
+
+void
+MapNodeOptions::applyLowMemoryProfile()
+{
+    if ( _lowMemory != true )
+        return;
+
+    // hand the profile down to the terrain, unless it explicitly says otherwise.
+    Config terrainConf = _terrainOptionsConf.isSet() ? _terrainOptionsConf.value() : Config("terrain");
+    if ( !terrainConf.hasValue("low_memory") )
+    {
+        terrainConf.update( "low_memory", "true" );
+        _terrainOptionsConf = terrainConf;
+        if ( _terrainOptions )
+        {
+            delete _terrainOptions;
+            _terrainOptions = 0L;
+        }
+    }
 }
 
 void
@@ -138,6 +179,8 @@ MapNodeOptions::setTerrainOptions( const TerrainOptions& options )
         delete _terrainOptions;
         _terrainOptions = 0L;
     }
+
+    applyLowMemoryProfile();
 }
 
 const TerrainOptions&
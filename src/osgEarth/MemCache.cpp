@@ -20,6 +20,14 @@
 #include <osgEarth/StringUtils>
 #include <osgEarth/ThreadingUtils>
 #include <osgEarth/Containers>
+#include <osgEarth/IOTypes>
+#include <osgEarth/QuantizedHeightField>
+#include <osg/Image>
+#include <osg/Shape>
+#include <osg/Timer>
+#include <list>
+#include <map>
+#include <algorithm>
 
 using namespace osgEarth;
 
@@ -29,36 +37,122 @@ using namespace osgEarth;
 
 namespace
 {
-    typedef std::pair<osg::ref_ptr<const osg::Object>, Config> MemCacheEntry;
-    typedef LRUCache<std::string, MemCacheEntry> MemCacheLRU;
+    struct MemCacheBin;
+
+    /**
+     * Byte budget shared by all the bins of one MemCache.
+     */
+    struct MemCacheBudget : public osg::Referenced
+    {
+        MemCacheBudget() : _maxBytes(0), _hfPrecision(0.0f), _bytes(0) { }
+
+        void add( size_t bytes ) {
+            Threading::ScopedMutexLock lock( _bytesMutex );
+            _bytes += bytes;
+        }
+
+        void subtract( size_t bytes ) {
+            Threading::ScopedMutexLock lock( _bytesMutex );
+            _bytes = bytes < _bytes ? _bytes - bytes : 0;
+        }
+
+        size_t getBytes() const {
+            Threading::ScopedMutexLock lock( _bytesMutex );
+            return _bytes;
+        }
+
+        bool overBudget() const {
+            return _maxBytes > 0 && getBytes() > _maxBytes;
+        }
+
+        void addBin( MemCacheBin* bin ) {
+            Threading::ScopedMutexLock lock( _binsMutex );
+            _bins.push_back( bin );
+        }
+
+        void removeBin( MemCacheBin* bin ) {
+            Threading::ScopedMutexLock lock( _binsMutex );
+            _bins.erase( std::remove(_bins.begin(), _bins.end(), bin), _bins.end() );
+        }
+
+        // evicts the globally oldest entries until we are back under budget.
+        void enforce();
+
+        volatile size_t            _maxBytes;
+        volatile float             _hfPrecision; // shared by all bins; 0 = store floats
+        size_t                     _bytes;
+        mutable Threading::Mutex   _bytesMutex;
+        std::vector<MemCacheBin*>  _bins;
+        Threading::Mutex           _binsMutex;  // always taken before a bin's mutex
+    };
+
+    /** approximate memory footprint of one cache entry */
+    size_t entrySize( const std::string& key, const osg::Object* object )
+    {
+        return sizeof(std::string) * 2 + key.size() * 2 + 64 + MemCache::getObjectSizeInBytes( object );
+    }
 
     struct MemCacheBin : public CacheBin
     {
-        MemCacheBin( const std::string& id, unsigned maxSize )
+        struct Entry
+        {
+            osg::ref_ptr<const osg::Object>  _object;
+            Config                           _meta;
+            size_t                           _bytes;
+            osg::Timer_t                     _lastUsed;
+            std::list<std::string>::iterator _lru;
+        };
+        typedef std::map<std::string, Entry> EntryMap;
+
+        MemCacheBin( const std::string& id, unsigned maxSize, MemCacheBudget* budget )
             : CacheBin( id ),
-              _lru    ( true /* MT-safe */, maxSize )
+              _maxSize( maxSize ),
+              _budget ( budget ),
+              _bytes  ( 0 ),
+              _queries( 0 ),
+              _hits   ( 0 )
         {
-            //nop
+            _budget->addBin( this );
+        }
+
+        virtual ~MemCacheBin()
+        {
+            _budget->removeBin( this );
+            _budget->subtract( _bytes );
         }
 
         ReadResult readObject(const std::string& key )
         {
-            MemCacheLRU::Record rec;
-            _lru.get(key, rec);
+            osg::ref_ptr<const osg::Object> object;
+            Config meta;
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                ++_queries;
+                EntryMap::iterator i = _entries.find( key );
+                if ( i != _entries.end() )
+                {
+                    ++_hits;
+                    touch( i->second );
+                    object = i->second._object.get();
+                    meta   = i->second._meta;
+                }
+            }
 
             // clone required since the cache is in memory
 
-            if ( rec.valid() )
+            const QuantizedHeightField* qhf = dynamic_cast<const QuantizedHeightField*>( object.get() );
+            if ( qhf )
+            {
+                return ReadResult( qhf->decode(), meta );
+            }
+            else if ( object.valid() )
             {
-                //OE_INFO << LC << "hits: " << _lru.getStats()._hitRatio*100.0f << "%" << std::endl;
-
                 return ReadResult( 
-                   osg::clone(rec.value().first.get(), osg::CopyOp::DEEP_COPY_ALL),
-                   rec.value().second );
+                   osg::clone(object.get(), osg::CopyOp::DEEP_COPY_ALL),
+                   meta );
             }
             else
             {
-                //OE_INFO << LC << "hits: " << _lru.getStats()._hitRatio*100.0f << "%" << std::endl;
                 return ReadResult();
             }
         }
@@ -75,43 +169,183 @@ namespace
 
         bool write( const std::string& key, const osg::Object* object, const Config& meta )
         {
-            if ( object ) 
+            if ( !object ) 
+                return false;
+
+            // store heightfields in compact form if so configured.
+            osg::ref_ptr<const osg::Object> stored = object;
+            float precision = _budget->_hfPrecision;
+            if ( precision > 0.0f )
             {
-                _lru.insert( key, std::make_pair(object, meta) );
-                return true;
+                const osg::HeightField* hf = dynamic_cast<const osg::HeightField*>( object );
+                if ( hf )
+                {
+                    QuantizedHeightField* qhf = QuantizedHeightField::encode( hf, precision );
+                    if ( qhf )
+                        stored = qhf;
+                }
             }
-            else
-                return false;
+
+            size_t bytes = entrySize( key, stored.get() );
+            size_t added = 0, removed = 0;
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                removed += erase( key );
+
+                _lru.push_back( key );
+                Entry& e = _entries[key];
+                e._object   = stored.get();
+                e._meta     = meta;
+                e._bytes    = bytes;
+                e._lastUsed = osg::Timer::instance()->tick();
+                e._lru      = --_lru.end();
+                _bytes     += bytes;
+                added       = bytes;
+
+                while( _entries.size() > _maxSize )
+                    removed += evictOldest_unlocked();
+            }
+
+            _budget->add( added );
+            _budget->subtract( removed );
+
+            if ( _budget->overBudget() )
+                _budget->enforce();
+
+            return true;
         }
 
         bool remove(const std::string& key)
         {
-            _lru.erase(key);
+            size_t removed = 0;
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                removed = erase( key );
+            }
+            _budget->subtract( removed );
             return true;
         }
 
         bool touch(const std::string& key)
         {
-            // just doing a get will put it at the front of the LRU list
-            MemCacheLRU::Record dummy;
-            return _lru.get(key, dummy);
+            Threading::ScopedMutexLock lock( _mutex );
+            EntryMap::iterator i = _entries.find( key );
+            if ( i == _entries.end() )
+                return false;
+            touch( i->second );
+            return true;
         }
 
         RecordStatus getRecordStatus( const std::string& key )
         {
             // ignore minTime; MemCache does not support expiration
-            return _lru.has(key) ? STATUS_OK : STATUS_NOT_FOUND;
+            Threading::ScopedMutexLock lock( _mutex );
+            return _entries.find(key) != _entries.end() ? STATUS_OK : STATUS_NOT_FOUND;
         }
 
         bool purge()
         {
-            _lru.clear();
+            size_t removed = 0;
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                removed = _bytes;
+                _entries.clear();
+                _lru.clear();
+                _bytes = 0;
+                _queries = 0;
+                _hits = 0;
+            }
+            _budget->subtract( removed );
             return true;
         }
 
-        MemCacheLRU _lru;
+        CacheStats getStats() const
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            return CacheStats(
+                _entries.size(), _maxSize, _queries, _queries > 0 ? (float)_hits/(float)_queries : 0.0f );
+        }
+
+        /** Timestamp of the least-recently-used entry; false if the bin is empty. */
+        bool getOldest( osg::Timer_t& out ) const
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            if ( _lru.empty() )
+                return false;
+            out = _entries.find( _lru.front() )->second._lastUsed;
+            return true;
+        }
+
+        /** Evicts the least-recently-used entry, returning the bytes freed. */
+        size_t evictOldest()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            return evictOldest_unlocked();
+        }
+
+    private:
+
+        void touch( Entry& e )
+        {
+            _lru.splice( _lru.end(), _lru, e._lru );
+            e._lastUsed = osg::Timer::instance()->tick();
+        }
+
+        size_t erase( const std::string& key )
+        {
+            EntryMap::iterator i = _entries.find( key );
+            if ( i == _entries.end() )
+                return 0;
+            size_t bytes = i->second._bytes;
+            _lru.erase( i->second._lru );
+            _entries.erase( i );
+            _bytes -= bytes;
+            return bytes;
+        }
+
+        size_t evictOldest_unlocked()
+        {
+            if ( _lru.empty() )
+                return 0;
+            std::string key = _lru.front();
+            return erase( key );
+        }
+
+        EntryMap                 _entries;
+        std::list<std::string>   _lru;
+        unsigned                 _maxSize;
+        osg::ref_ptr<MemCacheBudget> _budget;
+        size_t                   _bytes;
+        unsigned                 _queries;
+        unsigned                 _hits;
+        mutable Threading::Mutex _mutex;
     };
-    
+
+    void
+    MemCacheBudget::enforce()
+    {
+        Threading::ScopedMutexLock lock( _binsMutex );
+
+        while( overBudget() )
+        {
+            MemCacheBin* victim = 0L;
+            osg::Timer_t oldest = 0;
+            for( std::vector<MemCacheBin*>::iterator i = _bins.begin(); i != _bins.end(); ++i )
+            {
+                osg::Timer_t t;
+                if ( (*i)->getOldest(t) && (victim == 0L || t < oldest) )
+                {
+                    victim = *i;
+                    oldest = t;
+                }
+            }
+
+            if ( !victim )
+                break;
+
+            subtract( victim->evictOldest() );
+        }
+    }
 
     static Threading::Mutex s_defaultBinMutex;
 }
@@ -121,13 +355,81 @@ namespace
 MemCache::MemCache( unsigned maxBinSize ) :
 _maxBinSize( std::max(maxBinSize, 1u) )
 {
-    //nop
+    _budget = new MemCacheBudget();
+}
+
+MemCache::MemCache( const MemCache& rhs, const osg::CopyOp& op ) :
+Cache      ( rhs, op ),
+_maxBinSize( rhs._maxBinSize )
+{
+    _budget = new MemCacheBudget();
+    setMaxSizeInBytes( rhs.getMaxSizeInBytes() );
+    setHeightFieldPrecision( rhs.getHeightFieldPrecision() );
+}
+
+void
+MemCache::setMaxSizeInBytes( size_t value )
+{
+    MemCacheBudget* budget = static_cast<MemCacheBudget*>( _budget.get() );
+    budget->_maxBytes = value;
+    if ( budget->overBudget() )
+        budget->enforce();
+}
+
+size_t
+MemCache::getMaxSizeInBytes() const
+{
+    return static_cast<const MemCacheBudget*>( _budget.get() )->_maxBytes;
+}
+
+size_t
+MemCache::getSizeInBytes() const
+{
+    return static_cast<const MemCacheBudget*>( _budget.get() )->getBytes();
+}
+
+size_t
+MemCache::getObjectSizeInBytes( const osg::Object* object )
+{
+    if ( !object )
+        return 0;
+
+    const osg::Image* image = dynamic_cast<const osg::Image*>( object );
+    if ( image )
+        return sizeof(osg::Image) + image->getTotalSizeInBytesIncludingMipmaps();
+
+    const osg::HeightField* hf = dynamic_cast<const osg::HeightField*>( object );
+    if ( hf )
+        return sizeof(osg::HeightField) + hf->getNumColumns() * hf->getNumRows() * sizeof(float);
+
+    const QuantizedHeightField* qhf = dynamic_cast<const QuantizedHeightField*>( object );
+    if ( qhf )
+        return qhf->getSizeInBytes();
+
+    const StringObject* str = dynamic_cast<const StringObject*>( object );
+    if ( str )
+        return sizeof(StringObject) + str->getString().size();
+
+    // unknown type; count a nominal amount so that it still has a cost.
+    return 1024;
+}
+
+void
+MemCache::setHeightFieldPrecision( float value )
+{
+    static_cast<MemCacheBudget*>( _budget.get() )->_hfPrecision = osg::maximum( value, 0.0f );
+}
+
+float
+MemCache::getHeightFieldPrecision() const
+{
+    return static_cast<const MemCacheBudget*>( _budget.get() )->_hfPrecision;
 }
 
 CacheBin*
 MemCache::addBin( const std::string& binID )
 {
-    return _bins.getOrCreate( binID, new MemCacheBin(binID, _maxBinSize) );
+    return _bins.getOrCreate( binID, new MemCacheBin(binID, _maxBinSize, static_cast<MemCacheBudget*>(_budget.get())) );
 }
 
 CacheBin*
@@ -148,7 +450,7 @@ MemCache::getOrCreateDefaultBin()
         // double check
         if ( !_defaultBin.valid() )
         {
-            _defaultBin = new MemCacheBin("__default", _maxBinSize);
+            _defaultBin = new MemCacheBin("__default", _maxBinSize, static_cast<MemCacheBudget*>(_budget.get()));
         }
     }
 
@@ -156,10 +458,41 @@ MemCache::getOrCreateDefaultBin()
 }
 
 
+namespace
+{
+    typedef std::map< std::string, osg::observer_ptr<MemCache> > SharedMemCaches;
+    SharedMemCaches  s_sharedMemCaches;
+    Threading::Mutex s_sharedMemCachesMutex;
+}
+
+osg::ref_ptr<MemCache>
+MemCache::getOrCreateShared( const std::string& key, unsigned maxBinSize )
+{
+    Threading::ScopedMutexLock lock( s_sharedMemCachesMutex );
+
+    osg::ref_ptr<MemCache> cache;
+    SharedMemCaches::iterator i = s_sharedMemCaches.find( key );
+    if ( i != s_sharedMemCaches.end() && i->second.lock(cache) )
+        return cache;
+
+    // prune expired entries while we're here.
+    for( SharedMemCaches::iterator j = s_sharedMemCaches.begin(); j != s_sharedMemCaches.end(); )
+    {
+        if ( !j->second.valid() )
+            s_sharedMemCaches.erase( j++ );
+        else
+            ++j;
+    }
+
+    cache = new MemCache( maxBinSize );
+    s_sharedMemCaches[key] = cache.get();
+    return cache;
+}
+
 void
 MemCache::dumpStats(const std::string& binID)
 {
     MemCacheBin* bin = static_cast<MemCacheBin*>(getBin(binID));
-    CacheStats stats = bin->_lru.getStats();
-    OE_INFO << LC << "hit ratio = " << stats._hitRatio << std::endl;
+    CacheStats stats = bin->getStats();
+    OE_INFO << LC << "hit ratio = " << stats._hitRatio << ", bytes = " << getSizeInBytes() << std::endl;
 }
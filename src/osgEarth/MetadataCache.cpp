@@ -0,0 +1,155 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarth/MetadataCache>
+#include <osgEarth/Cache>
+#include <osgEarth/CacheBin>
+#include <osgEarth/Registry>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <set>
+
+#define LC "[MetadataCache] "
+
+using namespace osgEarth;
+
+#define METADATA_BIN_NAME "_metadata"
+
+namespace
+{
+    volatile TimeSpan s_defaultTTL = 24*60*60;
+
+    Threading::Mutex          s_mutex;
+    osg::ref_ptr<TaskService> s_refreshService;
+    std::set<std::string>     s_refreshing;
+
+    CacheBin* getMetadataBin( const osgDB::Options* dbOptions )
+    {
+        Cache* cache = Cache::get( dbOptions );
+        if ( !cache )
+            cache = Registry::instance()->getCache();
+        if ( !cache || !cache->isOK() )
+            return 0L;
+
+        // layers open concurrently, so don't race to create the bin.
+        Threading::ScopedMutexLock lock( s_mutex );
+        CacheBin* bin = cache->getBin( METADATA_BIN_NAME );
+        if ( !bin )
+            bin = cache->addBin( METADATA_BIN_NAME );
+        return bin;
+    }
+
+    // Options that make URI read through the metadata bin, treating records
+    // older than the TTL as expired (and revalidating them).
+    osgDB::Options* makeBinOptions( const osgDB::Options* dbOptions, CacheBin* bin, const CachePolicy& cp, TimeSpan ttl )
+    {
+        osgDB::Options* options = Registry::instance()->cloneOrCreateOptions( dbOptions );
+        bin->apply( options );
+        CachePolicy policy = cp;
+        policy.maxAge() = ttl;
+        policy.apply( options );
+        return options;
+    }
+
+    // Revalidates an expired document off the calling thread.
+    struct RefreshTask : public TaskRequest
+    {
+        void operator()( ProgressCallback* progress )
+        {
+            ReadResult r = _uri.readString( _options.get(), progress );
+            if ( r.failed() )
+            {
+                OE_INFO << LC << "Failed to refresh " << _uri.full() << "; keeping the cached copy" << std::endl;
+            }
+
+            Threading::ScopedMutexLock lock( s_mutex );
+            s_refreshing.erase( _uri.cacheKey() );
+        }
+
+        URI                                _uri;
+        osg::ref_ptr<const osgDB::Options> _options;
+    };
+
+    void refreshInBackground( const URI& uri, const osgDB::Options* options )
+    {
+        Threading::ScopedMutexLock lock( s_mutex );
+
+        if ( !s_refreshing.insert(uri.cacheKey()).second )
+            return;
+
+        if ( !s_refreshService.valid() )
+        {
+            s_refreshService = new TaskService( "Metadata refresh", 2 );
+            Registry::instance()->registerTaskService( s_refreshService.get() );
+        }
+
+        RefreshTask* task = new RefreshTask();
+        task->_uri     = uri;
+        task->_options = options;
+        s_refreshService->add( task );
+    }
+}
+
+void
+MetadataCache::setDefaultTimeToLive( TimeSpan seconds )
+{
+    s_defaultTTL = seconds;
+}
+
+TimeSpan
+MetadataCache::getDefaultTimeToLive()
+{
+    return s_defaultTTL;
+}
+
+ReadResult
+MetadataCache::readString( const URI& uri, const osgDB::Options* dbOptions, ProgressCallback* progress )
+{
+    optional<CachePolicy> cp;
+    CachePolicy::fromOptions( dbOptions, cp );
+    Registry::instance()->resolveCachePolicy( cp );
+
+    CacheBin* bin = 0L;
+    if ( uri.isRemote() && cp->usage() != CachePolicy::USAGE_NO_CACHE )
+        bin = getMetadataBin( dbOptions );
+
+    if ( !bin )
+        return uri.readString( dbOptions, progress );
+
+    TimeSpan ttl = cp->maxAge().isSet() ? *cp->maxAge() : s_defaultTTL;
+    osg::ref_ptr<osgDB::Options> binOptions = makeBinOptions( dbOptions, bin, *cp, ttl );
+
+    // a cached copy answers right away; refresh it for next time if it's stale.
+    if ( cp->isCacheReadable() )
+    {
+        ReadResult r = bin->readString( uri.cacheKey() );
+        if ( r.succeeded() )
+        {
+            bool stale = DateTime().asTimeStamp() - r.lastModifiedTime() > ttl;
+            if ( stale && cp->usage() != CachePolicy::USAGE_CACHE_ONLY && cp->isCacheWriteable() )
+            {
+                OE_DEBUG << LC << "Refreshing " << uri.full() << " in the background" << std::endl;
+                refreshInBackground( uri, binOptions.get() );
+            }
+            return r;
+        }
+    }
+
+    // cold cache: read it now (URI writes it to the bin).
+    return uri.readString( binOptions.get(), progress );
+}
@@ -0,0 +1,520 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarth/MultiLineSegmentIntersector>
+#include <osgEarth/Utils>
+#include <osg/Geometry>
+#include <osg/KdTree>
+#include <osg/TriangleFunctor>
+#include <algorithm>
+
+using namespace osgEarth;
+
+namespace
+{
+    // Clips the parametric segment s + d*t, t in [0..1], to a box.
+    bool clipToBox(const osg::Vec3d& s, const osg::Vec3d& d, const osg::BoundingBox& bbox,
+                   double& t0, double& t1)
+    {
+        t0 = 0.0;
+        t1 = 1.0;
+        if ( !bbox.valid() )
+            return true;
+
+        for( int a = 0; a < 3; ++a )
+        {
+            double lo = bbox._min[a], hi = bbox._max[a];
+            if ( d[a] == 0.0 )
+            {
+                if ( s[a] < lo || s[a] > hi )
+                    return false;
+            }
+            else
+            {
+                double inv = 1.0/d[a];
+                double ta = (lo - s[a]) * inv;
+                double tb = (hi - s[a]) * inv;
+                if ( ta > tb ) std::swap( ta, tb );
+                if ( ta > t0 ) t0 = ta;
+                if ( tb < t1 ) t1 = tb;
+                if ( t0 > t1 )
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // A segment that reached a drawable, and its range inside the drawable's box.
+    struct Candidate
+    {
+        unsigned   _slot;   // position in the segment set
+        osg::Vec3d _s, _d;
+        double     _t0, _t1;
+    };
+
+    struct TriangleHit
+    {
+        unsigned         _candidate;
+        double           _ratio;
+        unsigned         _index;
+        osg::Vec3d       _normal;
+        double           _r1, _r2, _r3;
+        const osg::Vec3* _v1;
+        const osg::Vec3* _v2;
+        const osg::Vec3* _v3;
+    };
+
+    /**
+     * Tests each triangle against every candidate segment, so a triangle's
+     * vertices are fetched and its edges computed only once per drawable.
+     */
+    struct MultiSegmentTriangleIntersector
+    {
+        const std::vector<Candidate>* _candidates;
+        std::vector<TriangleHit>      _hits;
+        unsigned                      _index;
+
+        MultiSegmentTriangleIntersector() : _candidates(0L), _index(0) { }
+
+        inline void operator () (const osg::Vec3& v1, const osg::Vec3& v2, const osg::Vec3& v3, bool treatVertexDataAsTemporary)
+        {
+            ++_index;
+
+            if (v1==v2 || v2==v3 || v1==v3) return;
+
+            osg::Vec3d v1d(v1), v2d(v2), v3d(v3);
+            osg::Vec3d e1 = v2d - v1d;
+            osg::Vec3d e2 = v3d - v1d;
+            osg::Vec3d normal;
+            bool       haveNormal = false;
+
+            for( unsigned c = 0; c < _candidates->size(); ++c )
+            {
+                const Candidate& seg = (*_candidates)[c];
+
+                // Moller-Trumbore, with t measured along the whole segment.
+                osg::Vec3d p = seg._d ^ e2;
+                double det = e1 * p;
+                if ( det == 0.0 ) continue; // parallel
+
+                double inv = 1.0/det;
+                osg::Vec3d tv = seg._s - v1d;
+                double u = (tv * p) * inv;
+                if ( u < 0.0 || u > 1.0 ) continue;
+
+                osg::Vec3d q = tv ^ e1;
+                double v = (seg._d * q) * inv;
+                if ( v < 0.0 || u + v > 1.0 ) continue;
+
+                double t = (e2 * q) * inv;
+                if ( t < seg._t0 || t > seg._t1 ) continue;
+
+                if ( !haveNormal )
+                {
+                    normal = e1 ^ e2;
+                    normal.normalize();
+                    haveNormal = true;
+                }
+
+                TriangleHit hit;
+                hit._candidate = c;
+                hit._ratio     = t;
+                hit._index     = _index-1;
+                hit._normal    = normal;
+                hit._r1        = 1.0 - u - v;
+                hit._r2        = u;
+                hit._r3        = v;
+                hit._v1        = treatVertexDataAsTemporary ? 0L : &v1;
+                hit._v2        = treatVertexDataAsTemporary ? 0L : &v2;
+                hit._v3        = treatVertexDataAsTemporary ? 0L : &v3;
+                _hits.push_back( hit );
+            }
+        }
+    };
+}
+
+//----------------------------------------------------------------------------
+
+void
+MultiLineSegmentIntersector::SegmentSet::push(unsigned index, const osg::Vec3d& start, const osg::Vec3d& end)
+{
+    osg::Vec3d d = end - start;
+    double len2 = d.length2();
+    _index.push_back( index );
+    _sx.push_back( start.x() ); _sy.push_back( start.y() ); _sz.push_back( start.z() );
+    _dx.push_back( d.x() );     _dy.push_back( d.y() );     _dz.push_back( d.z() );
+    _invLength2.push_back( len2 > 0.0 ? 1.0/len2 : 0.0 );
+}
+
+void
+MultiLineSegmentIntersector::SegmentSet::push(const SegmentSet& from, unsigned i)
+{
+    _index.push_back( from._index[i] );
+    _sx.push_back( from._sx[i] ); _sy.push_back( from._sy[i] ); _sz.push_back( from._sz[i] );
+    _dx.push_back( from._dx[i] ); _dy.push_back( from._dy[i] ); _dz.push_back( from._dz[i] );
+    _invLength2.push_back( from._invLength2[i] );
+}
+
+void
+MultiLineSegmentIntersector::SegmentSet::clear()
+{
+    _index.clear();
+    _sx.clear(); _sy.clear(); _sz.clear();
+    _dx.clear(); _dy.clear(); _dz.clear();
+    _invLength2.clear();
+}
+
+//----------------------------------------------------------------------------
+
+MultiLineSegmentIntersector::MultiLineSegmentIntersector(CoordinateFrame cf) :
+osgUtil::Intersector( cf ),
+_parent             ( 0L ),
+_stack              ( 1 )
+{
+    //nop
+}
+
+unsigned
+MultiLineSegmentIntersector::addSegment(const osg::Vec3d& start, const osg::Vec3d& end)
+{
+    unsigned index = _starts.size();
+    _starts.push_back( start );
+    _ends.push_back( end );
+    _intersections.push_back( Intersections() );
+    _done.push_back( 0 );
+    _stack.front().push( index, start, end );
+    return index;
+}
+
+osgUtil::Intersector*
+MultiLineSegmentIntersector::clone(osgUtil::IntersectionVisitor& iv)
+{
+    osg::ref_ptr<MultiLineSegmentIntersector> mi = new MultiLineSegmentIntersector( MODEL );
+    mi->_parent = root();
+    mi->_intersectionLimit = this->_intersectionLimit;
+
+    const SegmentSet& segments = _stack.back();
+
+    if (_coordinateFrame==MODEL && iv.getModelMatrix()==0)
+    {
+        mi->_stack.front() = segments;
+        return mi.release();
+    }
+
+    // compute the matrix that takes this Intersector from its CoordinateFrame into the local MODEL coordinate frame
+    // that geometry in the scene graph will always be in.
+    osg::Matrix matrix;
+    switch (_coordinateFrame)
+    {
+    case(WINDOW):
+        if (iv.getWindowMatrix()) matrix.preMult( *iv.getWindowMatrix() );
+        if (iv.getProjectionMatrix()) matrix.preMult( *iv.getProjectionMatrix() );
+        if (iv.getViewMatrix()) matrix.preMult( *iv.getViewMatrix() );
+        if (iv.getModelMatrix()) matrix.preMult( *iv.getModelMatrix() );
+        break;
+    case(PROJECTION):
+        if (iv.getProjectionMatrix()) matrix.preMult( *iv.getProjectionMatrix() );
+        if (iv.getViewMatrix()) matrix.preMult( *iv.getViewMatrix() );
+        if (iv.getModelMatrix()) matrix.preMult( *iv.getModelMatrix() );
+        break;
+    case(VIEW):
+        if (iv.getViewMatrix()) matrix.preMult( *iv.getViewMatrix() );
+        if (iv.getModelMatrix()) matrix.preMult( *iv.getModelMatrix() );
+        break;
+    case(MODEL):
+        if (iv.getModelMatrix()) matrix = *iv.getModelMatrix();
+        break;
+    }
+
+    osg::Matrix inverse;
+    inverse.invert(matrix);
+
+    for( unsigned i = 0; i < segments.size(); ++i )
+    {
+        osg::Vec3d s( segments._sx[i], segments._sy[i], segments._sz[i] );
+        osg::Vec3d e = s + osg::Vec3d( segments._dx[i], segments._dy[i], segments._dz[i] );
+        mi->_stack.front().push( segments._index[i], s * inverse, e * inverse );
+    }
+
+    return mi.release();
+}
+
+bool
+MultiLineSegmentIntersector::enter(const osg::Node& node)
+{
+    unsigned level = _stack.size();
+    _stack.resize( level+1 );
+
+    const SegmentSet& in  = _stack[level-1];
+    SegmentSet&       out = _stack[level];
+    const std::vector<char>& done = root()->_done;
+
+    const osg::BoundingSphere& bs = node.getBound();
+    const unsigned n = in.size();
+
+    if ( n > 0 && node.isCullingActive() && bs.valid() )
+    {
+        // closest approach of each segment to the sphere center. The loop is
+        // branch-free over contiguous arrays so the compiler can vectorize it.
+        _mask.resize( n );
+        const double cx = bs.center().x(), cy = bs.center().y(), cz = bs.center().z();
+        const double r2 = bs.radius() * bs.radius();
+        const double* sx = &in._sx[0];
+        const double* sy = &in._sy[0];
+        const double* sz = &in._sz[0];
+        const double* dx = &in._dx[0];
+        const double* dy = &in._dy[0];
+        const double* dz = &in._dz[0];
+        const double* il = &in._invLength2[0];
+        char*         mask = &_mask[0];
+
+        for( unsigned i = 0; i < n; ++i )
+        {
+            double t = ((cx-sx[i])*dx[i] + (cy-sy[i])*dy[i] + (cz-sz[i])*dz[i]) * il[i];
+            t = t < 0.0 ? 0.0 : t > 1.0 ? 1.0 : t;
+            double px = sx[i] + dx[i]*t - cx;
+            double py = sy[i] + dy[i]*t - cy;
+            double pz = sz[i] + dz[i]*t - cz;
+            mask[i] = (px*px + py*py + pz*pz) <= r2;
+        }
+
+        for( unsigned i = 0; i < n; ++i )
+        {
+            if ( mask[i] && !done[in._index[i]] )
+                out.push( in, i );
+        }
+    }
+    else
+    {
+        for( unsigned i = 0; i < n; ++i )
+        {
+            if ( !done[in._index[i]] )
+                out.push( in, i );
+        }
+    }
+
+    if ( out.size() == 0 )
+    {
+        _stack.pop_back();
+        return false;
+    }
+
+    return true;
+}
+
+void
+MultiLineSegmentIntersector::leave()
+{
+    if ( _stack.size() > 1 )
+        _stack.pop_back();
+}
+
+void
+MultiLineSegmentIntersector::intersect(osgUtil::IntersectionVisitor& iv, osg::Drawable* drawable)
+{
+    const SegmentSet& segments = _stack.back();
+    const std::vector<char>& done = root()->_done;
+    osg::BoundingBox bbox = Utils::getBoundingBox(drawable);
+
+    std::vector<Candidate> candidates;
+    for( unsigned i = 0; i < segments.size(); ++i )
+    {
+        if ( done[segments._index[i]] )
+            continue;
+
+        Candidate c;
+        c._slot = i;
+        c._s.set( segments._sx[i], segments._sy[i], segments._sz[i] );
+        c._d.set( segments._dx[i], segments._dy[i], segments._dz[i] );
+        if ( clipToBox(c._s, c._d, bbox, c._t0, c._t1) )
+            candidates.push_back( c );
+    }
+
+    if ( candidates.empty() )
+        return;
+
+    if (iv.getDoDummyTraversal()) return;
+
+    bool onePerDrawable =
+        _intersectionLimit == LIMIT_ONE_PER_DRAWABLE ||
+        _intersectionLimit == LIMIT_ONE ||
+        _intersectionLimit == LIMIT_NEAREST;
+
+    osg::KdTree* kdTree = iv.getUseKdTreeWhenAvailable() ? dynamic_cast<osg::KdTree*>(drawable->getShape()) : 0;
+    if (kdTree)
+    {
+        osg::KdTree::LineSegmentIntersections intersections;
+        for( unsigned c = 0; c < candidates.size(); ++c )
+        {
+            const Candidate& seg = candidates[c];
+            osg::Vec3d s = seg._s + seg._d*seg._t0;
+            osg::Vec3d e = seg._s + seg._d*seg._t1;
+
+            intersections.clear();
+            if ( !kdTree->intersect(s, e, intersections) )
+                continue;
+
+            for(osg::KdTree::LineSegmentIntersections::iterator itr = intersections.begin();
+                itr != intersections.end();
+                ++itr)
+            {
+                osg::KdTree::LineSegmentIntersection& lsi = *(itr);
+
+                // remap ratio into the whole segment's range
+                double ratio = seg._t0 + lsi.ratio * (seg._t1 - seg._t0);
+
+                Intersection hit;
+                hit.ratio = ratio;
+                hit.matrix = iv.getModelMatrix();
+                hit.nodePath = iv.getNodePath();
+                hit.drawable = drawable;
+                hit.primitiveIndex = lsi.primitiveIndex;
+                hit.localIntersectionPoint = seg._s + seg._d*ratio;
+                hit.localIntersectionNormal = lsi.intersectionNormal;
+
+                hit.indexList.reserve(3);
+                hit.ratioList.reserve(3);
+                if (lsi.r0!=0.0f)
+                {
+                    hit.indexList.push_back(lsi.p0);
+                    hit.ratioList.push_back(lsi.r0);
+                }
+                if (lsi.r1!=0.0f)
+                {
+                    hit.indexList.push_back(lsi.p1);
+                    hit.ratioList.push_back(lsi.r1);
+                }
+                if (lsi.r2!=0.0f)
+                {
+                    hit.indexList.push_back(lsi.p2);
+                    hit.ratioList.push_back(lsi.r2);
+                }
+
+                insertIntersection( segments._index[seg._slot], hit );
+            }
+        }
+        return;
+    }
+
+    osg::TriangleFunctor<MultiSegmentTriangleIntersector> ti;
+    ti._candidates = &candidates;
+    drawable->accept(ti);
+
+    if ( ti._hits.empty() )
+        return;
+
+    // with a limit, only the nearest hit on each segment matters.
+    std::vector<int> nearest;
+    if ( onePerDrawable )
+    {
+        nearest.assign( candidates.size(), -1 );
+        for( unsigned h = 0; h < ti._hits.size(); ++h )
+        {
+            int& n = nearest[ti._hits[h]._candidate];
+            if ( n < 0 || ti._hits[h]._ratio < ti._hits[n]._ratio )
+                n = h;
+        }
+    }
+
+    osg::Geometry* geometry = drawable->asGeometry();
+    osg::Vec3Array* vertices = geometry ? dynamic_cast<osg::Vec3Array*>(geometry->getVertexArray()) : 0L;
+    const osg::Vec3* first = vertices && !vertices->empty() ? &(vertices->front()) : 0L;
+
+    for( unsigned h = 0; h < ti._hits.size(); ++h )
+    {
+        const TriangleHit& triHit = ti._hits[h];
+        if ( onePerDrawable && nearest[triHit._candidate] != (int)h )
+            continue;
+
+        const Candidate& seg = candidates[triHit._candidate];
+
+        Intersection hit;
+        hit.ratio = triHit._ratio;
+        hit.matrix = iv.getModelMatrix();
+        hit.nodePath = iv.getNodePath();
+        hit.drawable = drawable;
+        hit.primitiveIndex = triHit._index;
+        hit.localIntersectionPoint = seg._s + seg._d*triHit._ratio;
+        hit.localIntersectionNormal = triHit._normal;
+
+        if (first)
+        {
+            if (triHit._v1)
+            {
+                hit.indexList.push_back(triHit._v1-first);
+                hit.ratioList.push_back(triHit._r1);
+            }
+            if (triHit._v2)
+            {
+                hit.indexList.push_back(triHit._v2-first);
+                hit.ratioList.push_back(triHit._r2);
+            }
+            if (triHit._v3)
+            {
+                hit.indexList.push_back(triHit._v3-first);
+                hit.ratioList.push_back(triHit._r3);
+            }
+        }
+
+        insertIntersection( segments._index[seg._slot], hit );
+    }
+}
+
+void
+MultiLineSegmentIntersector::insertIntersection(unsigned segment, const Intersection& hit)
+{
+    MultiLineSegmentIntersector* r = root();
+    Intersections& hits = r->_intersections[segment];
+
+    if ( _intersectionLimit == LIMIT_NEAREST && !hits.empty() )
+    {
+        if ( hit.ratio >= hits.begin()->ratio )
+            return;
+        hits.clear();
+    }
+
+    hits.insert( hit );
+
+    if ( _intersectionLimit == LIMIT_ONE )
+        r->_done[segment] = 1;
+}
+
+void
+MultiLineSegmentIntersector::reset()
+{
+    osgUtil::Intersector::reset();
+
+    _stack.resize( 1 );
+    for( unsigned i = 0; i < _intersections.size(); ++i )
+    {
+        _intersections[i].clear();
+        _done[i] = 0;
+    }
+}
+
+bool
+MultiLineSegmentIntersector::containsIntersections()
+{
+    MultiLineSegmentIntersector* r = root();
+    for( unsigned i = 0; i < r->_intersections.size(); ++i )
+    {
+        if ( !r->_intersections[i].empty() )
+            return true;
+    }
+    return false;
+}
@@ -33,6 +33,8 @@ using namespace osgEarth;
  * OpenSceneGraph Public License for more details.
 */
 #include <osgEarth/Notify>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Thread>
 #include <string>
 #include <stdlib.h>
 #include <iostream>
@@ -40,6 +42,12 @@ using namespace osgEarth;
 #include <cctype>
 #include <iomanip>
 
+#if defined(_MSC_VER)
+#  define OE_NOTIFY_THREAD_LOCAL __declspec(thread)
+#else
+#  define OE_NOTIFY_THREAD_LOCAL __thread
+#endif
+
 using namespace std;
 
 osg::NotifySeverity osgearth_g_NotifyLevel = osg::NOTICE;
@@ -103,11 +111,8 @@ osgEarth::initNotifyLevel()
 
 }
 
-bool
-osgEarth::isNotifyEnabled( osg::NotifySeverity severity )
-{
-    return severity<=getNotifyLevel();
-}
+// isNotifyEnabled() reads the level directly, so apply the environment up front.
+static bool s_notifyLevelInit = osgEarth::initNotifyLevel();
 
 class NullStreamBuffer : public std::streambuf
 {
@@ -131,6 +136,237 @@ struct NullStream : public std::ostream
     }
 };
 
+//------------------------------------------------------------------------
+
+namespace
+{
+    // messages queued before new ones are dropped (a power of two)
+    const unsigned RING_SIZE = 4096u;
+
+    // headroom for threads that pass the "ring is full" check at the same time
+    const unsigned MAX_WRITERS = 64u;
+
+    struct Message
+    {
+        Message(osg::NotifySeverity severity, const std::string& text) : _severity(severity), _text(text) { }
+        osg::NotifySeverity _severity;
+        std::string         _text;
+    };
+
+    /**
+     * Multi-producer, single-consumer ring of messages, drained to the
+     * console by its own thread. Producers claim a slot with an atomic
+     * increment and publish into it with a pointer compare-and-swap, so
+     * they never take a lock; if the ring is full they drop the message.
+     */
+    class AsyncWriter : public OpenThreads::Thread
+    {
+    public:
+        AsyncWriter() : _done(false), _started(false) { }
+
+        virtual ~AsyncWriter()
+        {
+            stop();
+        }
+
+        void start()
+        {
+            if ( !_started )
+            {
+                _started = true;
+                startThread();
+            }
+        }
+
+        void stop()
+        {
+            if ( _started )
+            {
+                _done = true;
+                join();
+                _started = false;
+                _done = false;
+            }
+        }
+
+        void push(Message* msg)
+        {
+            if ( (unsigned)_head - (unsigned)_tail >= RING_SIZE - MAX_WRITERS )
+            {
+                ++_dropped;
+                delete msg;
+                return;
+            }
+
+            unsigned ticket = (++_head) - 1u;
+            OpenThreads::AtomicPtr& slot = _slots[ticket & (RING_SIZE-1u)];
+
+            // only waits if more than MAX_WRITERS threads raced past the check above
+            while( !slot.assign(msg, 0L) )
+                OpenThreads::Thread::YieldCurrentThread();
+        }
+
+        /** Waits until everything queued so far is written. */
+        void flush()
+        {
+            while( _started && (unsigned)_tail != (unsigned)_head )
+                OpenThreads::Thread::microSleep( 1000 );
+        }
+
+        void run()
+        {
+            while( !_done || (unsigned)_tail != (unsigned)_head )
+            {
+                if ( !drain() )
+                    OpenThreads::Thread::microSleep( 5000 );
+            }
+        }
+
+    private:
+        bool drain()
+        {
+            bool wrote = false;
+            for(;;)
+            {
+                OpenThreads::AtomicPtr& slot = _slots[(unsigned)_tail & (RING_SIZE-1u)];
+                Message* msg = static_cast<Message*>( slot.get() );
+                if ( !msg )
+                    break;
+
+                slot.assign( 0L, msg );
+                ++_tail;
+
+                std::ostream& out = msg->_severity <= osg::WARN ? std::cerr : std::cout;
+                out << msg->_text;
+                delete msg;
+                wrote = true;
+            }
+
+            if ( wrote )
+                std::cout.flush();
+
+            unsigned dropped = _dropped.exchange( 0u );
+            if ( dropped > 0u )
+                std::cerr << "[osgEarth]* " << dropped << " log messages dropped; the log queue was full" << std::endl;
+
+            return wrote;
+        }
+
+        OpenThreads::AtomicPtr _slots[RING_SIZE];
+        OpenThreads::Atomic    _head;
+        OpenThreads::Atomic    _tail;
+        OpenThreads::Atomic    _dropped;
+        volatile bool          _done;
+        volatile bool          _started;
+    };
+
+    AsyncWriter   s_asyncWriter;
+    volatile bool s_async = false;
+
+    /** Collects one thread's message until it ends, then queues it. */
+    class MessageBuffer : public std::streambuf
+    {
+    public:
+        MessageBuffer() : _severity(osg::NOTICE) { }
+
+        void setSeverity(osg::NotifySeverity severity)
+        {
+            if ( severity != _severity )
+            {
+                sync();
+                _severity = severity;
+            }
+        }
+
+    protected:
+        virtual int_type overflow(int_type c)
+        {
+            if ( c != traits_type::eof() )
+                _text.push_back( (char)c );
+            return traits_type::not_eof(c);
+        }
+
+        virtual streamsize xsputn(const char_type* s, streamsize n)
+        {
+            _text.append( s, (size_t)n );
+            return n;
+        }
+
+        virtual int sync()
+        {
+            if ( !_text.empty() )
+            {
+                s_asyncWriter.push( new Message(_severity, _text) );
+                _text.clear();
+            }
+            return 0;
+        }
+
+    private:
+        osg::NotifySeverity _severity;
+        std::string         _text;
+    };
+
+    struct MessageStream : public std::ostream
+    {
+        MessageStream() : std::ostream(new MessageBuffer)
+        {
+            (*this) << std::setprecision(8);
+        }
+
+        MessageBuffer* buffer() { return static_cast<MessageBuffer*>(rdbuf()); }
+    };
+
+    // never freed: a thread may still be writing to it while the process exits.
+    OE_NOTIFY_THREAD_LOCAL MessageStream* s_threadStream = 0L;
+
+    struct AsyncInit
+    {
+        AsyncInit()
+        {
+            const char* value = ::getenv("OSGEARTH_NOTIFY_ASYNC");
+            if ( value && *value && std::string(value) != "0" )
+                osgEarth::setNotifyAsync( true );
+        }
+
+        ~AsyncInit()
+        {
+            s_async = false;
+            s_asyncWriter.stop();
+        }
+    };
+    AsyncInit s_asyncInit;
+}
+
+void
+osgEarth::setNotifyAsync(bool value)
+{
+    if ( value )
+    {
+        s_asyncWriter.start();
+        s_async = true;
+    }
+    else
+    {
+        s_async = false;
+        s_asyncWriter.flush();
+    }
+}
+
+bool
+osgEarth::isNotifyAsync()
+{
+    return s_async;
+}
+
+void
+osgEarth::flushNotify()
+{
+    if ( s_threadStream )
+        s_threadStream->flush();
+    s_asyncWriter.flush();
+}
+
 std::ostream&
 osgEarth::notify(const osg::NotifySeverity severity)
 {
@@ -147,6 +383,14 @@ osgEarth::notify(const osg::NotifySeverity severity)
 
     if (severity<=osgearth_g_NotifyLevel)
     {
+        if ( s_async )
+        {
+            if ( !s_threadStream )
+                s_threadStream = new MessageStream();
+            s_threadStream->buffer()->setSeverity( severity );
+            return *s_threadStream;
+        }
+
         std::ostream* out = severity <= osg::WARN ? &std::cerr : &std::cout;
         (*out) << std::setprecision(8);
         return *out;
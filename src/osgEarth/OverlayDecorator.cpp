@@ -18,6 +18,7 @@
 */
 #include <osgEarth/OverlayDecorator>
 #include <osgEarth/DrapingTechnique>
+#include <osgEarth/FrameStats>
 #include <osgEarth/MapInfo>
 #include <osgEarth/NodeUtils>
 #include <osgEarth/Registry>
@@ -830,6 +831,7 @@ OverlayDecorator::traverse( osg::NodeVisitor& nv )
                 cullTerrainAndCalculateRTTParams( cv, pvd );
 
                 // prep and traverse the RTT camera(s):
+                FrameStats::CullTimer cullTimer( nv, FrameStats::CULL_OVERLAY );
                 for(unsigned i=0; i<_techniques.size(); ++i)
                 {
                     TechRTTParams& params = pvd._techParams[i];
@@ -295,6 +295,8 @@ osg::Referenced( true )
     _numTilesWideAtLod0 = numTilesWideAtLod0 != 0? numTilesWideAtLod0 : srs->isGeographic()? 2 : 1;
     _numTilesHighAtLod0 = numTilesHighAtLod0 != 0? numTilesHighAtLod0 : 1;
 
+    initLODTables();
+
     // automatically calculate the lat/long extents:
     _latlong_extent = srs->isGeographic()?
         _extent :
@@ -320,6 +322,8 @@ osg::Referenced( true )
     _numTilesWideAtLod0 = numTilesWideAtLod0 != 0? numTilesWideAtLod0 : srs->isGeographic()? 2 : 1;
     _numTilesHighAtLod0 = numTilesHighAtLod0 != 0? numTilesHighAtLod0 : 1;
 
+    initLODTables();
+
     _latlong_extent = GeoExtent( 
         srs->getGeographicSRS(),
         geo_xmin, geo_ymin, geo_xmax, geo_ymax );
@@ -334,6 +338,21 @@ osg::Referenced( true )
     _horizSignature = Stringify() << std::hex << hashString( temp.getConfig().toJSON() );
 }
 
+void
+Profile::initLODTables()
+{
+    double width  = (_extent.xMax() - _extent.xMin()) / (double)_numTilesWideAtLod0;
+    double height = (_extent.yMax() - _extent.yMin()) / (double)_numTilesHighAtLod0;
+
+    for(unsigned lod = 0; lod < NUM_CACHED_LODS; ++lod)
+    {
+        _tileWidths[lod]  = width;
+        _tileHeights[lod] = height;
+        width  /= 2.0;
+        height /= 2.0;
+    }
+}
+
 Profile::ProfileType
 Profile::getProfileType() const
 {
@@ -428,13 +447,8 @@ Profile::getAllKeysAtLOD( unsigned lod, std::vector<TileKey>& out_keys ) const
 GeoExtent
 Profile::calculateExtent( unsigned int lod, unsigned int tileX, unsigned int tileY )
 {
-    double width, height;
-    getTileDimensions(lod, width, height);
-
-    double xmin = getExtent().xMin() + (width * (double)tileX);
-    double ymax = getExtent().yMax() - (height * (double)tileY);
-    double xmax = xmin + width;
-    double ymin = ymax - height;
+    double xmin, ymin, xmax, ymax;
+    getTileBounds(lod, tileX, tileY, xmin, ymin, xmax, ymax);
 
     return GeoExtent( getSRS(), xmin, ymin, xmax, ymax );
 }
@@ -466,27 +480,43 @@ Profile::isHorizEquivalentTo( const Profile* rhs ) const
 void
 Profile::getTileDimensions(unsigned int lod, double& out_width, double& out_height) const
 {
-    out_width  = (_extent.xMax() - _extent.xMin()) / (double)_numTilesWideAtLod0;
-    out_height = (_extent.yMax() - _extent.yMin()) / (double)_numTilesHighAtLod0;
-
-    for (unsigned int i = 0; i < lod; ++i)
+    if ( lod < NUM_CACHED_LODS )
     {
-        out_width /= 2.0;
-        out_height /= 2.0;
+        out_width  = _tileWidths[lod];
+        out_height = _tileHeights[lod];
+    }
+    else
+    {
+        out_width  = _tileWidths[NUM_CACHED_LODS-1];
+        out_height = _tileHeights[NUM_CACHED_LODS-1];
+
+        for (unsigned int i = NUM_CACHED_LODS-1; i < lod; ++i)
+        {
+            out_width /= 2.0;
+            out_height /= 2.0;
+        }
     }
 }
 
 void
-Profile::getNumTiles(unsigned int lod, unsigned int& out_tiles_wide, unsigned int& out_tiles_high) const
+Profile::getTileBounds(unsigned int lod, unsigned int tileX, unsigned int tileY,
+                       double& out_xmin, double& out_ymin, double& out_xmax, double& out_ymax) const
 {
-    out_tiles_wide = _numTilesWideAtLod0;
-    out_tiles_high = _numTilesHighAtLod0;
+    double width, height;
+    getTileDimensions(lod, width, height);
 
-    for (unsigned int i = 0; i < lod; ++i)
-    {
-        out_tiles_wide *= 2;
-        out_tiles_high *= 2;
-    }
+    out_xmin = _extent.xMin() + (width * (double)tileX);
+    out_ymax = _extent.yMax() - (height * (double)tileY);
+    out_xmax = out_xmin + width;
+    out_ymin = out_ymax - height;
+}
+
+void
+Profile::getNumTiles(unsigned int lod, unsigned int& out_tiles_wide, unsigned int& out_tiles_high) const
+{
+    // the counts wrap to zero past the width of an unsigned, as repeated doubling would
+    out_tiles_wide = lod < NUM_CACHED_LODS ? _numTilesWideAtLod0 << lod : 0u;
+    out_tiles_high = lod < NUM_CACHED_LODS ? _numTilesHighAtLod0 << lod : 0u;
 }
 
 unsigned int
@@ -509,11 +539,12 @@ Profile::createTileKey( double x, double y, unsigned int level ) const
 {
     if ( _extent.contains( x, y ) )
     {
-        unsigned int tilesX = (unsigned int)_numTilesWideAtLod0 * (1 << (unsigned int)level);
-        unsigned int tilesY = (unsigned int)_numTilesHighAtLod0 * (1 << (unsigned int)level);
+        unsigned int tilesX, tilesY;
+        getNumTiles( level, tilesX, tilesY );
 
-        if (((_numTilesWideAtLod0 != 0) && ((tilesX / _numTilesWideAtLod0) != (1 << (unsigned int) level))) ||
-            ((_numTilesHighAtLod0 != 0) && ((tilesY / _numTilesHighAtLod0) != (1 << (unsigned int) level))))
+        if ( level >= NUM_CACHED_LODS ||
+             (tilesX >> level) != _numTilesWideAtLod0 ||
+             (tilesY >> level) != _numTilesHighAtLod0 )
         {	// check for overflow condition
             return (TileKey::INVALID);
         }
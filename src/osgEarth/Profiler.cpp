@@ -18,58 +18,292 @@
  */
 
 #include <osgEarth/Profiler>
+#include <osgEarth/ThreadingUtils>
 
+#include <OpenThreads/ScopedLock>
 #include <map>
-#include <osg/Timer>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <cstdlib>
+
+#if defined(_WIN32)
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h>
+#elif defined(__APPLE__)
+#  include <mach/mach_time.h>
+#else
+#  include <time.h>
+#endif
+
+#if defined(_MSC_VER)
+#  define OE_PROFILER_THREAD_LOCAL __declspec(thread)
+#else
+#  define OE_PROFILER_THREAD_LOCAL __thread
+#endif
+
+#define LC "[Profiler] "
 
 using namespace osgEarth;
 
-typedef std::map< std::string, osg::Timer_t > StartTimeMap;
-static StartTimeMap S_START_TIMES;
+namespace
+{
+    // zones kept per thread before the oldest are overwritten
+    const unsigned RING_SIZE = 65536u;
+
+    // deepest nesting tracked; deeper zones are counted but not recorded
+    const unsigned MAX_DEPTH = 64u;
+
+    struct ZoneRecord
+    {
+        const char*        _name;
+        unsigned long long _start;
+        unsigned long long _end;
+        unsigned           _depth;
+    };
+
+    struct ThreadBuffer
+    {
+        ThreadBuffer(unsigned tid) : _tid(tid), _next(0u), _wrapped(false), _depth(0u)
+        {
+            _ring.resize(RING_SIZE);
+        }
+
+        unsigned                _tid;
+        std::vector<ZoneRecord> _ring;
+        unsigned                _next;
+        bool                    _wrapped;
+
+        // stack of open zones
+        const char*             _openName[MAX_DEPTH];
+        unsigned long long      _openStart[MAX_DEPTH];
+        unsigned                _depth;
+    };
+
+    /**
+     * Owns every thread's buffer. Buffers are never freed: threads may
+     * still be recording while the process exits.
+     */
+    struct Tracer
+    {
+        Tracer() : _enabled(false)
+        {
+            const char* output = ::getenv("OSGEARTH_PROFILER_OUTPUT");
+            if ( output && *output )
+            {
+                _output  = output;
+                _enabled = true;
+            }
+            _epoch = Profiler::now();
+        }
+
+        ~Tracer()
+        {
+            if ( !_output.empty() )
+                Profiler::writeChromeTrace( _output );
+        }
 
-typedef std::map< std::string, double > ElapsedTimeMap;
-static ElapsedTimeMap S_ELAPSED_TIMES;
+        ThreadBuffer* registerThread()
+        {
+            ThreadBuffer* buf = new ThreadBuffer( Threading::getCurrentThreadId() );
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            _buffers.push_back( buf );
+            return buf;
+        }
 
-typedef std::map< std::string, unsigned int > CallMap;
-static CallMap S_CALL_COUNT;
+        volatile bool              _enabled;
+        unsigned long long         _epoch;
+        std::string                _output;
+        OpenThreads::Mutex         _mutex;
+        std::vector<ThreadBuffer*> _buffers;
+    };
 
-void Profiler::start(const std::string& name)
+    Tracer s_tracer;
+
+    OE_PROFILER_THREAD_LOCAL ThreadBuffer* s_threadBuffer = 0L;
+
+    inline ThreadBuffer* threadBuffer()
+    {
+        if ( !s_threadBuffer )
+            s_threadBuffer = s_tracer.registerThread();
+        return s_threadBuffer;
+    }
+
+    void writeEscaped(std::ostream& out, const char* s)
+    {
+        for( ; s && *s; ++s )
+        {
+            if      ( *s == '"' || *s == '\\' ) out << '\\' << *s;
+            else if ( (unsigned char)*s < 0x20 ) out << ' ';
+            else                                 out << *s;
+        }
+    }
+
+    struct ZoneStats
+    {
+        ZoneStats() : _calls(0u), _total(0ull) { }
+        unsigned           _calls;
+        unsigned long long _total;
+    };
+}
+
+
+unsigned long long
+Profiler::now()
 {
-    S_START_TIMES[name] = osg::Timer::instance()->tick();
+#if defined(_WIN32)
+    static LARGE_INTEGER freq;
+    if ( freq.QuadPart == 0 )
+        QueryPerformanceFrequency( &freq );
+    LARGE_INTEGER t;
+    QueryPerformanceCounter( &t );
+    return (unsigned long long)( (double)t.QuadPart * (1.0e9 / (double)freq.QuadPart) );
+#elif defined(__APPLE__)
+    static mach_timebase_info_data_t tb;
+    if ( tb.denom == 0 )
+        mach_timebase_info( &tb );
+    return mach_absolute_time() * tb.numer / tb.denom;
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+#endif
 }
 
-void Profiler::end(const std::string& name)
+void
+Profiler::begin(const char* name)
 {
-    osg::Timer_t end = osg::Timer::instance()->tick();
-    StartTimeMap::iterator startItr = S_START_TIMES.find(name);
-    if (startItr == S_START_TIMES.end())
+    ThreadBuffer* buf = threadBuffer();
+    if ( buf->_depth < MAX_DEPTH )
     {
-        OE_WARN << "Can't find start time " << name << std::endl;
+        buf->_openName [buf->_depth] = name;
+        buf->_openStart[buf->_depth] = now();
+    }
+    ++buf->_depth;
+}
+
+void
+Profiler::end()
+{
+    ThreadBuffer* buf = threadBuffer();
+    if ( buf->_depth == 0u )
+        return;
+
+    --buf->_depth;
+    if ( buf->_depth >= MAX_DEPTH )
         return;
+
+    ZoneRecord& rec = buf->_ring[buf->_next];
+    rec._name  = buf->_openName [buf->_depth];
+    rec._start = buf->_openStart[buf->_depth];
+    rec._end   = now();
+    rec._depth = buf->_depth;
+
+    if ( ++buf->_next == RING_SIZE )
+    {
+        buf->_next    = 0u;
+        buf->_wrapped = true;
     }
+}
+
+void
+Profiler::setEnabled(bool value)
+{
+    s_tracer._enabled = value;
+}
+
+bool
+Profiler::isEnabled()
+{
+    return s_tracer._enabled;
+}
 
-    double dt = osg::Timer::instance()->delta_s(startItr->second, end);
-    ElapsedTimeMap::iterator elapsedItr = S_ELAPSED_TIMES.find(name);
-    if (elapsedItr == S_ELAPSED_TIMES.end())
+bool
+Profiler::writeChromeTrace(const std::string& filename)
+{
+    std::ofstream out( filename.c_str() );
+    if ( !out.is_open() )
     {
-        S_ELAPSED_TIMES[name] = 0.0;
+        OE_WARN << LC << "Failed to open trace file \"" << filename << "\"" << std::endl;
+        return false;
     }
-    S_ELAPSED_TIMES[name] += dt;
 
-    // Increment the number of calls for the task
-    CallMap::iterator callItr = S_CALL_COUNT.find(name);
-    if (callItr == S_CALL_COUNT.end())
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out << std::fixed << std::setprecision(3);
+
+    unsigned count = 0u;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( s_tracer._mutex );
+    for( std::vector<ThreadBuffer*>::const_iterator b = s_tracer._buffers.begin(); b != s_tracer._buffers.end(); ++b )
     {
-        S_CALL_COUNT[name] = 0;
+        const ThreadBuffer* buf = *b;
+        unsigned size  = buf->_wrapped ? RING_SIZE : buf->_next;
+        unsigned first = buf->_wrapped ? buf->_next : 0u;
+
+        for( unsigned i = 0; i < size; ++i )
+        {
+            const ZoneRecord& rec = buf->_ring[(first + i) % RING_SIZE];
+            if ( !rec._name || rec._start < s_tracer._epoch )
+                continue;
+
+            // chrome trace timestamps are microseconds; keep ns as the fraction.
+            if ( count++ > 0u ) out << ",\n";
+            out << "{\"name\":\"";
+            writeEscaped( out, rec._name );
+            out << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buf->_tid
+                << ",\"ts\":"  << (double)(rec._start - s_tracer._epoch) * 1.0e-3
+                << ",\"dur\":" << (double)(rec._end - rec._start) * 1.0e-3
+                << ",\"args\":{\"depth\":" << rec._depth << "}}";
+        }
     }
-    S_CALL_COUNT[name] += 1;
 
+    out << "\n]}\n";
+    out.close();
+
+    OE_INFO << LC << "Wrote " << count << " zones to \"" << filename << "\"" << std::endl;
+    return true;
 }
 
-void Profiler::dump()
+void
+Profiler::dump()
 {
-    for (ElapsedTimeMap::iterator itr = S_ELAPSED_TIMES.begin(); itr != S_ELAPSED_TIMES.end(); ++itr)
+    typedef std::map<std::string, ZoneStats> StatsMap;
+    StatsMap stats;
+
     {
-        OE_NOTICE << itr->first << ": calls=" << S_CALL_COUNT[itr->first] << "  time=" << itr->second << "s" << std::endl;
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( s_tracer._mutex );
+        for( std::vector<ThreadBuffer*>::const_iterator b = s_tracer._buffers.begin(); b != s_tracer._buffers.end(); ++b )
+        {
+            const ThreadBuffer* buf = *b;
+            unsigned size = buf->_wrapped ? RING_SIZE : buf->_next;
+            for( unsigned i = 0; i < size; ++i )
+            {
+                const ZoneRecord& rec = buf->_ring[i];
+                if ( !rec._name || rec._start < s_tracer._epoch )
+                    continue;
+                ZoneStats& s = stats[rec._name];
+                s._calls++;
+                s._total += rec._end - rec._start;
+            }
+        }
     }
-}
\ No newline at end of file
+
+    for( StatsMap::const_iterator i = stats.begin(); i != stats.end(); ++i )
+    {
+        double totalMs = (double)i->second._total * 1.0e-6;
+        OE_NOTICE << i->first
+            << ": calls=" << i->second._calls
+            << "  time="  << totalMs << "ms"
+            << "  mean="  << totalMs/(double)i->second._calls << "ms"
+            << std::endl;
+    }
+}
+
+void
+Profiler::clear()
+{
+    // Move the epoch forward rather than touching other threads' buffers;
+    // anything recorded before it is ignored.
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( s_tracer._mutex );
+    s_tracer._epoch = now();
+}
@@ -0,0 +1,234 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarth/ProgramBinaryCache>
+#include <osgEarth/Cache>
+#include <osgEarth/CacheBin>
+#include <osgEarth/Capabilities>
+#include <osgEarth/IOTypes>
+#include <osgEarth/Registry>
+#include <osgEarth/StringUtils>
+#include <osg/Version>
+
+using namespace osgEarth;
+
+#define LC "[ProgramBinaryCache] "
+
+#define PROGRAM_BINARY_BIN_ID "osgEarth_program_binaries"
+
+namespace
+{
+    // second, independent string hash so that key collisions are negligible
+    unsigned hashString2(const std::string& input)
+    {
+        unsigned h = 5381u;
+        for(std::string::const_iterator i = input.begin(); i != input.end(); ++i)
+            h = ((h << 5) + h) + (unsigned char)(*i);
+        return h;
+    }
+
+    osg::Program::PerContextProgram* getPCP(osg::Program* program, osg::State& state)
+    {
+#if OSG_VERSION_GREATER_OR_EQUAL(3,3,4)
+        return program->getPCP( state );
+#else
+        return program->getPCP( state.getContextID() );
+#endif
+    }
+}
+
+ProgramBinaryCache::ProgramBinaryCache() :
+_binResolved( false )
+{
+    //nop
+}
+
+void
+ProgramBinaryCache::setCacheBin(CacheBin* bin)
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    _bin         = bin;
+    _binResolved = true;
+}
+
+CacheBin*
+ProgramBinaryCache::getCacheBin() const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    if ( !_binResolved )
+    {
+        _binResolved = true;
+
+        Cache* cache = Registry::instance()->getCache();
+        if ( cache && cache->isOK() )
+        {
+            optional<CachePolicy> cp;
+            Registry::instance()->resolveCachePolicy( cp );
+            if ( !cp.isSet() || cp->isCacheReadable() )
+            {
+                _bin = cache->getBin( PROGRAM_BINARY_BIN_ID );
+                if ( !_bin.valid() )
+                    _bin = cache->addBin( PROGRAM_BINARY_BIN_ID );
+            }
+        }
+
+        if ( _bin.valid() )
+        {
+            OE_INFO << LC << "Caching program binaries in bin \"" << _bin->getID() << "\"" << std::endl;
+        }
+    }
+    return _bin.get();
+}
+
+bool
+ProgramBinaryCache::isEnabled() const
+{
+    return
+        Registry::capabilities().supportsProgramBinary() &&
+        getCacheBin() != 0L;
+}
+
+std::string
+ProgramBinaryCache::makeKey(const osg::Program* program) const
+{
+    std::stringstream buf;
+
+    // the driver: a binary is only valid for the driver that made it.
+    const Capabilities& caps = Registry::capabilities();
+    buf << caps.getVendor() << ";" << caps.getRenderer() << ";" << caps.getVersion() << "\n";
+
+    for(unsigned i=0; i<program->getNumShaders(); ++i)
+    {
+        const osg::Shader* shader = program->getShader(i);
+        buf << "#" << (int)shader->getType() << "\n" << shader->getShaderSource() << "\n";
+    }
+
+    const osg::Program::AttribBindingList& abl = program->getAttribBindingList();
+    for(osg::Program::AttribBindingList::const_iterator i = abl.begin(); i != abl.end(); ++i)
+        buf << "a:" << i->first << "=" << i->second << "\n";
+
+    const osg::Program::FragDataBindingList& fbl = program->getFragDataBindingList();
+    for(osg::Program::FragDataBindingList::const_iterator i = fbl.begin(); i != fbl.end(); ++i)
+        buf << "f:" << i->first << "=" << i->second << "\n";
+
+    std::string text = buf.str();
+
+    return Stringify()
+        << std::hex << hashString(text) << "_" << hashString2(text)
+        << "_" << text.size();
+}
+
+bool
+ProgramBinaryCache::read(osg::Program* program)
+{
+    if ( !program || program->getProgramBinary() )
+        return false;
+
+    CacheBin* bin = getCacheBin();
+    if ( !bin )
+        return false;
+
+    ReadResult r = bin->readString( makeKey(program) );
+    if ( !r.succeeded() )
+        return false;
+
+    // record layout: 4-byte binary format, then the binary itself.
+    const std::string& data = r.getString();
+    if ( data.size() <= 4 )
+        return false;
+
+    GLenum format =
+        ((GLenum)(unsigned char)data[0])       |
+        ((GLenum)(unsigned char)data[1] << 8)  |
+        ((GLenum)(unsigned char)data[2] << 16) |
+        ((GLenum)(unsigned char)data[3] << 24);
+
+    osg::ref_ptr<osg::Program::ProgramBinary> binary = new osg::Program::ProgramBinary();
+    binary->assign( data.size()-4, reinterpret_cast<const unsigned char*>(data.data()) + 4 );
+    binary->setFormat( format );
+    program->setProgramBinary( binary.get() );
+
+    OE_DEBUG << LC << "Loaded binary for program \"" << program->getName() << "\"" << std::endl;
+    return true;
+}
+
+void
+ProgramBinaryCache::write(osg::Program* program, osg::State& state)
+{
+    // came from the cache; nothing new to save.
+    if ( !program || program->getProgramBinary() )
+        return;
+
+    CacheBin* bin = getCacheBin();
+    if ( !bin )
+        return;
+
+    std::string key = makeKey(program);
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        if ( !_written.insert(key).second )
+            return;
+    }
+
+    // The program is already linked, so this just fetches the binary.
+    osg::Program::PerContextProgram* pcp = getPCP(program, state);
+    if ( !pcp || !pcp->isLinked() )
+        return;
+
+    osg::ref_ptr<osg::Program::ProgramBinary> binary = pcp->compileProgramBinary( state );
+    if ( !binary.valid() || binary->getSize() == 0 )
+        return;
+
+    GLenum format = binary->getFormat();
+    std::string data;
+    data.reserve( binary->getSize() + 4 );
+    data.push_back( (char)( format        & 0xff) );
+    data.push_back( (char)((format >> 8)  & 0xff) );
+    data.push_back( (char)((format >> 16) & 0xff) );
+    data.push_back( (char)((format >> 24) & 0xff) );
+    data.append( reinterpret_cast<const char*>(binary->getData()), binary->getSize() );
+
+    osg::ref_ptr<StringObject> record = new StringObject( data );
+    if ( bin->write(key, record.get()) )
+    {
+        OE_DEBUG << LC << "Saved binary for program \"" << program->getName() << "\"" << std::endl;
+    }
+}
+
+void
+ProgramBinaryCache::discard(osg::Program* program)
+{
+    if ( !program || !program->getProgramBinary() )
+        return;
+
+    OE_INFO << LC << "Driver rejected the cached binary for program \"" << program->getName() << "\"; relinking" << std::endl;
+
+    CacheBin* bin = getCacheBin();
+    std::string key = makeKey(program);
+    if ( bin )
+        bin->remove( key );
+
+    {
+        // allow the relinked program to be saved again.
+        Threading::ScopedMutexLock lock( _mutex );
+        _written.erase( key );
+    }
+
+    program->setProgramBinary( 0L );
+    program->dirtyProgram();
+}
@@ -0,0 +1,149 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/QuantizedHeightField>
+#include <osgEarth/GeoCommon>
+#include <osgEarth/Notify>
+#include <algorithm>
+#include <limits>
+
+using namespace osgEarth;
+
+#define LC "[QuantizedHeightField] "
+
+namespace
+{
+    // reserved step for posts that hold NO_DATA_VALUE
+    const unsigned short NO_DATA_STEP  = 0xFFFF;
+    const unsigned       MAX_NUM_STEPS = 0xFFFE;
+}
+
+QuantizedHeightField::QuantizedHeightField() :
+_numColumns ( 0 ),
+_numRows    ( 0 ),
+_xInterval  ( 1.0f ),
+_yInterval  ( 1.0f ),
+_skirtHeight( 0.0f ),
+_borderWidth( 0 ),
+_offset     ( 0.0f ),
+_scale      ( 1.0f )
+{
+    //nop
+}
+
+QuantizedHeightField::QuantizedHeightField(const QuantizedHeightField& rhs, const osg::CopyOp& op) :
+osg::Object ( rhs, op ),
+_numColumns ( rhs._numColumns ),
+_numRows    ( rhs._numRows ),
+_origin     ( rhs._origin ),
+_xInterval  ( rhs._xInterval ),
+_yInterval  ( rhs._yInterval ),
+_skirtHeight( rhs._skirtHeight ),
+_borderWidth( rhs._borderWidth ),
+_offset     ( rhs._offset ),
+_scale      ( rhs._scale ),
+_posts      ( rhs._posts )
+{
+    //nop
+}
+
+QuantizedHeightField*
+QuantizedHeightField::encode(const osg::HeightField* hf, float precision)
+{
+    if ( !hf || precision <= 0.0f || hf->getHeightList().empty() )
+        return 0L;
+
+    const osg::HeightField::HeightList& heights = hf->getHeightList();
+
+    // range of the valid heights:
+    float minHeight =  std::numeric_limits<float>::max();
+    float maxHeight = -std::numeric_limits<float>::max();
+    for( osg::HeightField::HeightList::const_iterator i = heights.begin(); i != heights.end(); ++i )
+    {
+        if ( *i != NO_DATA_VALUE )
+        {
+            minHeight = std::min( minHeight, *i );
+            maxHeight = std::max( maxHeight, *i );
+        }
+    }
+
+    if ( minHeight > maxHeight )
+    {
+        // all no-data.
+        minHeight = maxHeight = 0.0f;
+    }
+
+    // Use the full 16-bit range for the best precision, but give up if even
+    // that does not meet the requested precision.
+    double range = (double)maxHeight - (double)minHeight;
+    double scale = range > 0.0 ? range / (double)MAX_NUM_STEPS : (double)precision;
+    if ( scale > (double)precision )
+    {
+        OE_DEBUG << LC << "Height range " << range << " too large for precision " << precision << std::endl;
+        return 0L;
+    }
+
+    QuantizedHeightField* qhf = new QuantizedHeightField();
+    qhf->_numColumns  = hf->getNumColumns();
+    qhf->_numRows     = hf->getNumRows();
+    qhf->_origin      = hf->getOrigin();
+    qhf->_xInterval   = hf->getXInterval();
+    qhf->_yInterval   = hf->getYInterval();
+    qhf->_skirtHeight = hf->getSkirtHeight();
+    qhf->_borderWidth = hf->getBorderWidth();
+    qhf->_offset      = minHeight;
+    qhf->_scale       = (float)scale;
+
+    qhf->_posts.resize( heights.size() );
+    double invScale = 1.0/scale;
+    for( unsigned i=0; i<heights.size(); ++i )
+    {
+        float h = heights[i];
+        qhf->_posts[i] = h == NO_DATA_VALUE ?
+            NO_DATA_STEP :
+            (unsigned short)osg::minimum( (unsigned)(((double)h - (double)minHeight) * invScale + 0.5), MAX_NUM_STEPS );
+    }
+
+    return qhf;
+}
+
+float
+QuantizedHeightField::decode(unsigned short step) const
+{
+    return step == NO_DATA_STEP ? NO_DATA_VALUE : _offset + (float)step * _scale;
+}
+
+osg::HeightField*
+QuantizedHeightField::decode() const
+{
+    osg::HeightField* hf = new osg::HeightField();
+    hf->allocate( _numColumns, _numRows );
+    hf->setOrigin( _origin );
+    hf->setXInterval( _xInterval );
+    hf->setYInterval( _yInterval );
+    hf->setSkirtHeight( _skirtHeight );
+    hf->setBorderWidth( _borderWidth );
+
+    osg::HeightField::HeightList& heights = hf->getHeightList();
+    for( unsigned i=0; i<_posts.size(); ++i )
+    {
+        heights[i] = decode( _posts[i] );
+    }
+
+    return hf;
+}
@@ -26,16 +26,25 @@
 #include <osgEarth/IOTypes>
 #include <osgEarth/ColorFilter>
 #include <osgEarth/StateSetCache>
+#include <osgEarth/Horizon>
+#include <osgEarth/ProgramBinaryCache>
 #include <osgEarth/HTTPClient>
 #include <osgEarth/StringUtils>
 #include <osgEarth/TerrainEngineNode>
 #include <osg/Notify>
 #include <osg/Version>
+#include <osg/Timer>
 #include <osgDB/Registry>
+#include <osgDB/DynamicLibrary>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <fstream>
+#include <sstream>
 #include <gdal_priv.h>
 #include <ogr_api.h>
 #include <stdlib.h>
 #include <locale>
+#include <algorithm>
 
 using namespace osgEarth;
 using namespace OpenThreads;
@@ -55,6 +64,7 @@ _gdal_registered    ( false ),
 _numGdalMutexGets   ( 0 ),
 _uidGen             ( 0 ),
 _caps               ( 0L ),
+_driverIndexLoaded  ( false ),
 _defaultFont        ( 0L ),
 _terrainEngineDriver( "mp" ),
 _cacheDriver        ( "filesystem" )
@@ -83,6 +93,12 @@ _cacheDriver        ( "filesystem" )
     // performance boost
     _stateSetCache = new StateSetCache();
 
+    // per-camera horizons shared by all horizon-culling nodes
+    _horizonCache = new HorizonCache();
+
+    // linked program binaries persisted across runs
+    _programBinaryCache = new ProgramBinaryCache();
+
     // Default unref-after apply policy:
     _unRefImageDataAfterApply = true;
 
@@ -475,6 +491,225 @@ Registry::createUID()
     return (UID)( _uidGen++ );
 }
 
+void
+Registry::registerTaskService( TaskService* service )
+{
+    if ( !service )
+        return;
+
+    Threading::ScopedMutexLock lock( _taskServicesMutex );
+
+    // prune dead entries while we're here.
+    for( std::vector< osg::observer_ptr<TaskService> >::iterator i = _taskServices.begin(); i != _taskServices.end(); )
+    {
+        if ( !i->valid() )
+            i = _taskServices.erase( i );
+        else if ( i->get() == service )
+            return;
+        else
+            ++i;
+    }
+
+    _taskServices.push_back( service );
+}
+
+void
+Registry::getTaskServiceMetrics( std::vector<TaskServiceMetrics>& output )
+{
+    std::vector< osg::ref_ptr<TaskService> > services;
+    if ( _taskServiceManager.valid() )
+    {
+        _taskServiceManager->getTaskServices( services );
+    }
+
+    {
+        Threading::ScopedMutexLock lock( _taskServicesMutex );
+        for( std::vector< osg::observer_ptr<TaskService> >::const_iterator i = _taskServices.begin(); i != _taskServices.end(); ++i )
+        {
+            osg::ref_ptr<TaskService> service;
+            if ( i->lock(service) && std::find(services.begin(), services.end(), service) == services.end() )
+                services.push_back( service.get() );
+        }
+    }
+
+    for( std::vector< osg::ref_ptr<TaskService> >::const_iterator i = services.begin(); i != services.end(); ++i )
+    {
+        output.push_back( TaskServiceMetrics() );
+        (*i)->getMetrics( output.back() );
+    }
+}
+
+void
+Registry::dumpTaskServiceMetrics( std::ostream& out )
+{
+    std::vector<TaskServiceMetrics> metrics;
+    getTaskServiceMetrics( metrics );
+    for( std::vector<TaskServiceMetrics>::const_iterator i = metrics.begin(); i != metrics.end(); ++i )
+    {
+        i->dump( out );
+    }
+}
+
+namespace
+{
+    // maps a driver library into the process (see Registry::preloadDrivers)
+    struct LoadDriverLibrary
+    {
+        void execute()
+        {
+            _library = osgDB::DynamicLibrary::loadLibrary( _path );
+        }
+
+        std::string                         _path;
+        osg::ref_ptr<osgDB::DynamicLibrary> _library;
+    };
+}
+
+void
+Registry::loadDriverIndex()
+{
+    // caller holds _driverIndexMutex.
+    _driverIndexLoaded = true;
+
+    std::string indexFile;
+    const char* envIndex = ::getenv(OSGEARTH_ENV_DRIVER_INDEX);
+    if ( envIndex )
+        indexFile = std::string(envIndex);
+    else
+        indexFile = osgDB::findLibraryFile( OSGEARTH_DRIVER_INDEX_FILENAME );
+
+    if ( indexFile.empty() )
+    {
+        OE_DEBUG << LC << "No driver index found; plugins will load on demand" << std::endl;
+        return;
+    }
+
+    std::ifstream in( indexFile.c_str() );
+    if ( !in.is_open() )
+    {
+        OE_WARN << LC << "Failed to open driver index \"" << indexFile << "\"" << std::endl;
+        return;
+    }
+
+    // each line is "<extension> <library>"; relative library names are
+    // relative to the index file itself.
+    std::string indexPath = osgDB::getFilePath( indexFile );
+    std::string line;
+    while( std::getline(in, line) )
+    {
+        line = trim( line );
+        if ( line.empty() || line[0] == '#' )
+            continue;
+
+        std::istringstream buf( line );
+        std::string extension, library;
+        buf >> extension;
+        std::getline( buf, library );
+        library = trim( library );
+        if ( extension.empty() || library.empty() )
+            continue;
+
+        if ( osgDB::getFilePath(library).empty() )
+            library = osgDB::concatPaths( indexPath, library );
+
+        _driverIndex[toLower(extension)] = library;
+    }
+
+    OE_INFO << LC << "Read " << _driverIndex.size() << " entries from driver index " << indexFile << std::endl;
+}
+
+std::string
+Registry::getDriverLibrary( const std::string& extension )
+{
+    Threading::ScopedMutexLock lock( _driverIndexMutex );
+    if ( !_driverIndexLoaded )
+        loadDriverIndex();
+
+    DriverIndex::const_iterator i = _driverIndex.find( toLower(extension) );
+    return i != _driverIndex.end() ? i->second : std::string();
+}
+
+void
+Registry::preloadDrivers( const std::vector<std::string>& extensions )
+{
+    Threading::ScopedMutexLock lock( _driverIndexMutex );
+    if ( !_driverIndexLoaded )
+        loadDriverIndex();
+
+    if ( _driverIndex.empty() )
+        return;
+
+    // resolve the libraries that still need loading.
+    std::vector<LoadDriverLibrary> loads;
+    StringSet paths;
+    for( std::vector<std::string>::const_iterator i = extensions.begin(); i != extensions.end(); ++i )
+    {
+        std::string extension = toLower( *i );
+        if ( _preloadedDrivers.find(extension) != _preloadedDrivers.end() )
+            continue;
+        _preloadedDrivers.insert( extension );
+
+        DriverIndex::const_iterator entry = _driverIndex.find( extension );
+        if ( entry == _driverIndex.end() )
+            continue;
+
+        const std::string& path = entry->second;
+        if ( paths.find(path) != paths.end() || osgDB::Registry::instance()->getLibrary(path) )
+            continue;
+        paths.insert( path );
+
+        loads.push_back( LoadDriverLibrary() );
+        loads.back()._path = path;
+    }
+
+    if ( loads.empty() )
+        return;
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    // map the libraries in parallel; this is where the file system time goes.
+    if ( loads.size() == 1 )
+    {
+        loads[0].execute();
+    }
+    else
+    {
+        unsigned numThreads = osg::minimum( 8u, (unsigned)loads.size() );
+        osg::ref_ptr<TaskService> service = new TaskService( "Driver preload", numThreads );
+        Threading::MultiEvent semaphore( (int)loads.size() );
+        std::vector< osg::ref_ptr< ParallelTask<LoadDriverLibrary> > > tasks;
+        for( unsigned i = 0; i < loads.size(); ++i )
+        {
+            ParallelTask<LoadDriverLibrary>* task = new ParallelTask<LoadDriverLibrary>( &semaphore );
+            task->_path = loads[i]._path;
+            tasks.push_back( task );
+            service->add( task );
+        }
+        semaphore.wait();
+
+        for( unsigned i = 0; i < loads.size(); ++i )
+            loads[i]._library = tasks[i]->_library.get();
+    }
+
+    // hand each library over to the osgDB registry, which keeps it loaded for
+    // the life of the process. The library is already mapped, so this is cheap.
+    unsigned numLoaded = 0;
+    for( std::vector<LoadDriverLibrary>::const_iterator i = loads.begin(); i != loads.end(); ++i )
+    {
+        if ( !i->_library.valid() )
+        {
+            OE_WARN << LC << "Failed to preload driver library " << i->_path << std::endl;
+            continue;
+        }
+
+        if ( osgDB::Registry::instance()->loadLibrary(i->_path) != osgDB::Registry::NOT_LOADED )
+            ++numLoaded;
+    }
+
+    OE_INFO << LC << "Preloaded " << numLoaded << " driver libraries in "
+        << osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) << " s" << std::endl;
+}
+
 osgDB::Options*
 Registry::cloneOrCreateOptions(const osgDB::Options* input)
 {
@@ -540,6 +775,24 @@ Registry::getStateSetCache() const
     return _stateSetCache.get();
 }
 
+HorizonCache*
+Registry::getHorizonCache() const
+{
+    return _horizonCache.get();
+}
+
+void
+Registry::setProgramBinaryCache( ProgramBinaryCache* cache )
+{
+    _programBinaryCache = cache;
+}
+
+ProgramBinaryCache*
+Registry::getProgramBinaryCache() const
+{
+    return _programBinaryCache.get();
+}
+
 ProgramSharedRepo*
 Registry::getProgramSharedRepo()
 {
@@ -305,25 +305,16 @@ ShaderFactory::createColorFilterChainFragmentShader(const std::string&      func
         "#version " GLSL_VERSION_STR "\n"
         GLSL_DEFAULT_PRECISION_FLOAT "\n";
 
-    // write out the shader function prototypes:
-    for( ColorFilterChain::const_iterator i = chain.begin(); i != chain.end(); ++i )
-    {
-        ColorFilter* filter = i->get();
-        buf << "void " << filter->getEntryPointFunctionName() << "(inout vec4 color);\n";
-    }
-
-    // write out the main function:
-    buf << "void " << function << "(inout vec4 color) \n"
-        << "{ \n";
-
-    // write out the function calls. if there are none, it's a NOP.
-    for( ColorFilterChain::const_iterator i = chain.begin(); i != chain.end(); ++i )
-    {
-        ColorFilter* filter = i->get();
-        buf << INDENT << filter->getEntryPointFunctionName() << "(color);\n";
-    }
-        
-    buf << "} \n";
+    // fuse the chain into one function body. if there are no filters, it's a NOP.
+    std::string head, body;
+    ColorFilterChainCompiler::compile( chain, head, body, INDENT );
+
+    // write out the declarations and the main function:
+    buf << head
+        << "void " << function << "(inout vec4 color) \n"
+        << "{ \n"
+        << body
+        << "} \n";
 
     std::string bufstr;
     bufstr = buf.str();
@@ -47,6 +47,8 @@
 #include <osgDB/ReadFile>
 #include <osgText/Text>
 #include <osgSim/LightPointNode>
+#include <algorithm>
+#include <typeinfo>
 
 #define LC "[ShaderGenerator] "
 
@@ -91,6 +93,9 @@ using namespace osgEarth;
 // other stuff
 #define INDENT "    "
 
+// how long a pager thread may spend sharing the state of a paged-in graph
+#define PAGED_STATE_SHARING_BUDGET_S 0.010
+
 //------------------------------------------------------------------------
 
 struct OSGEarthShaderGenPseudoLoader : public osgDB::ReaderWriter
@@ -130,7 +135,9 @@ struct OSGEarthShaderGenPseudoLoader : public osgDB::ReaderWriter
             osgEarth::Registry::shaderGenerator().run(
                 node.get(),
                 osgDB::getSimpleFileName(stripped),
-                Registry::stateSetCache() );
+                0L );
+
+            Registry::stateSetCache()->optimize( node.get(), PAGED_STATE_SHARING_BUDGET_S );
         }
 
         return node.valid() ? ReadResult(node.release()) : ReadResult::ERROR_IN_READING_FILE;
@@ -141,6 +148,28 @@ REGISTER_OSGPLUGIN(SHADERGEN_PL_EXTENSION, OSGEarthShaderGenPseudoLoader)
 
 //------------------------------------------------------------------------
 
+osgDB::ReaderWriter::ReadResult
+ShaderGenReadFileCallback::readNode(const std::string& filename, const osgDB::Options* options)
+{
+    osgDB::ReaderWriter::ReadResult r;
+    if (osgDB::Registry::instance()->getReadFileCallback()) r = osgDB::Registry::instance()->getReadFileCallback()->readNode(filename, options);
+    else r = osgDB::Registry::instance()->readNodeImplementation(filename, options);
+
+    if ( r.validNode() && Registry::capabilities().supportsGLSL() )
+    {
+        osgEarth::Registry::shaderGenerator().run(
+            r.getNode(),
+            osgDB::getSimpleFileName(filename),
+            0L );
+
+        Registry::stateSetCache()->optimize( r.getNode(), PAGED_STATE_SHARING_BUDGET_S );
+    }
+
+    return r;
+}
+
+//------------------------------------------------------------------------
+
 namespace
 {
     struct ActiveAttributeCollector : public osg::StateAttribute::ModeUsage
@@ -280,6 +309,27 @@ namespace
         }
     };
 
+    // Identifies a generated result: the stateset we started from (null if
+    // none) and a fingerprint of the state accumulated above it.
+    struct ResultKey
+    {
+        ResultKey(const osg::StateSet* original, const std::string& fingerprint)
+            : _original(original), _fingerprint(fingerprint) { }
+
+        osg::ref_ptr<const osg::StateSet> _original;
+        std::string                       _fingerprint;
+
+        bool operator < (const ResultKey& rhs) const {
+            if ( _original.get() != rhs._original.get() ) return _original.get() < rhs._original.get();
+            return _fingerprint < rhs._fingerprint;
+        }
+    };
+
+    // Shared by all generators, since the Registry hands out a new one per run.
+    // A null value records that no replacement was necessary.
+    typedef LRUCache< ResultKey, osg::ref_ptr<osg::StateSet> > ResultCache;
+    ResultCache s_results( true, 4096 );
+
     // if the node has a stateset, clone it and replace it with the clone.
     // otherwise, just create a new stateset on the node.
     osg::StateSet* cloneOrCreateStateSet(osg::Node* node)
@@ -370,6 +420,80 @@ ShaderGenerator::ignore(const osg::Object* object)
     return object && object->getUserValue(SHADERGEN_HINT_IGNORE, value) && value;
 }
 
+void
+ShaderGenerator::clearCache()
+{
+    s_results.clear();
+}
+
+bool
+ShaderGenerator::isCacheable() const
+{
+    // Subclasses and accept callbacks can change the output in ways the
+    // fingerprint doesn't capture.
+    return
+        typeid(*this) == typeid(ShaderGenerator) &&
+        _acceptCallbacks.empty();
+}
+
+std::string
+ShaderGenerator::getGeometryFingerprint(const osg::StateSet* original, osg::StateSet* current) const
+{
+    std::stringstream buf;
+    buf << "geom;" << _name << ";";
+
+    if ( original && original->getMode(GL_LIGHTING) != osg::StateAttribute::INHERIT )
+    {
+        buf << "L" << current->getMode(GL_LIGHTING) << ";";
+    }
+
+    // mirrors the texture unit loop in processGeometry.
+    unsigned numUnits = std::min(
+        (unsigned)current->getTextureAttributeList().size(),
+        (unsigned)Registry::capabilities().getMaxGPUTextureUnits() );
+
+    for( unsigned unit = 0; unit < numUnits; ++unit )
+    {
+        osg::Texture* tex = dynamic_cast<osg::Texture*>( current->getTextureAttribute(unit, osg::StateAttribute::TEXTURE) );
+        if ( !accept(tex) || ImageUtils::isFloatingPointInternalFormat(tex->getInternalFormat()) )
+            continue;
+
+        buf << "u" << unit << ":" << tex->className();
+
+        osg::TexGen* texgen = dynamic_cast<osg::TexGen*>(current->getTextureAttribute(unit, osg::StateAttribute::TEXGEN));
+        if ( accept(texgen) )
+            buf << ",g" << texgen->getMode();
+
+        osg::TexEnv* texenv = dynamic_cast<osg::TexEnv*>(current->getTextureAttribute(unit, osg::StateAttribute::TEXENV));
+        if ( accept(texenv) )
+        {
+            buf << ",e" << texenv->getMode();
+            if ( texenv->getMode() == osg::TexEnv::BLEND )
+            {
+                const osg::Vec4& c = texenv->getColor();
+                buf << "(" << c.r() << " " << c.g() << " " << c.b() << " " << c.a() << ")";
+            }
+        }
+
+        osg::TexMat* texmat = dynamic_cast<osg::TexMat*>(current->getTextureAttribute(unit, osg::StateAttribute::TEXMAT));
+        if ( accept(texmat) )
+        {
+            buf << ",m(";
+            const osg::Matrix::value_type* m = texmat->getMatrix().ptr();
+            for(unsigned i=0; i<16; ++i)
+                buf << m[i] << " ";
+            buf << ")";
+        }
+
+        if ( current->getTextureAttribute(unit, osg::StateAttribute::POINTSPRITE) )
+            buf << ",s";
+
+        buf << ";";
+    }
+
+    return buf.str();
+}
+
 void
 ShaderGenerator::setDuplicateSharedSubgraphs(bool value)
 {
@@ -736,6 +860,19 @@ ShaderGenerator::processText(const osg::StateSet* ss, osg::ref_ptr<osg::StateSet
     if ( dynamic_cast<osg::Program*>(program) != 0L )
         return false;
 
+    // the text program only depends on the original stateset.
+    bool cacheable = isCacheable();
+    ResultKey key( ss, Stringify() << "text;" << _name );
+    if ( cacheable )
+    {
+        ResultCache::Record rec;
+        if ( s_results.get(key, rec) )
+        {
+            replacement = rec.value().get();
+            return replacement.valid();
+        }
+    }
+
     // New state set. We never modify existing statesets.
     replacement = ss ? osg::clone(ss, osg::CopyOp::SHALLOW_COPY) : new osg::StateSet();
 
@@ -770,6 +907,11 @@ ShaderGenerator::processText(const osg::StateSet* ss, osg::ref_ptr<osg::StateSet
     vp->setFunction( FRAGMENT_FUNCTION, fragSrc, ShaderComp::LOCATION_FRAGMENT_COLORING, 0.5f );
     replacement->getOrCreateUniform( SAMPLER_TEXT, osg::Uniform::SAMPLER_2D )->set( 0 );
 
+    if ( cacheable )
+    {
+        s_results.insert( key, replacement.get() );
+    }
+
     return replacement.valid();
 }
 
@@ -792,6 +934,20 @@ ShaderGenerator::processGeometry(const osg::StateSet*         original,
     if ( dynamic_cast<osg::Program*>(program) != 0L )
         return false;
 
+    // reuse the result from an earlier pass over the same stateset in an
+    // equivalent state, if there is one.
+    bool cacheable = isCacheable();
+    ResultKey key( original, cacheable ? getGeometryFingerprint(original, current.get()) : "" );
+    if ( cacheable )
+    {
+        ResultCache::Record rec;
+        if ( s_results.get(key, rec) )
+        {
+            replacement = rec.value().get();
+            return replacement.valid();
+        }
+    }
+
     // Copy or create a new stateset (that we may or may not use depending on
     // what we find). Never modify an existing stateset!
     osg::ref_ptr<osg::StateSet> newStateSet =
@@ -913,6 +1069,12 @@ ShaderGenerator::processGeometry(const osg::StateSet*         original,
     {
         replacement = newStateSet.get();
     }
+
+    if ( cacheable )
+    {
+        s_results.insert( key, replacement.get() );
+    }
+
     return replacement.valid();
 }
 
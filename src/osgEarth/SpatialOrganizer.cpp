@@ -0,0 +1,361 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/SpatialOrganizer>
+#include <osgEarth/Notify>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <osg/Geode>
+#include <osg/Group>
+#include <osg/BoundingBox>
+#include <OpenThreads/Thread>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#define LC "[SpatialOrganizer] "
+
+using namespace osgEarth;
+
+namespace
+{
+    // deep enough to cover any realistic spread of features
+    const unsigned MAX_DEPTH = 16u;
+
+    // below this many items, building in parallel is not worth the threads.
+    const unsigned MIN_ITEMS_FOR_PARALLEL_BUILD = 4096u;
+
+    struct Entry
+    {
+        osg::Vec3d _center;
+        unsigned   _item;
+    };
+    typedef std::vector<Entry> Entries;
+
+    struct Below
+    {
+        Below(int axis, double value) : _axis(axis), _value(value) { }
+        bool operator()(const Entry& e) const { return e._center[_axis] < _value; }
+        int    _axis;
+        double _value;
+    };
+
+    unsigned partition(Entries& entries, unsigned begin, unsigned end, int axis, double value)
+    {
+        return std::partition( entries.begin()+begin, entries.begin()+end, Below(axis, value) ) - entries.begin();
+    }
+
+    // Splits entries [begin, end) about the middle of their centers. Octant i
+    // lands in [bounds[i], bounds[i+1]). Returns false if all the centers
+    // coincide and there is nothing to split.
+    bool splitOctants(Entries& entries, unsigned begin, unsigned end, unsigned* bounds)
+    {
+        osg::BoundingBoxd box;
+        for( unsigned i = begin; i < end; ++i )
+            box.expandBy( entries[i]._center );
+
+        if ( box.xMax() <= box.xMin() && box.yMax() <= box.yMin() && box.zMax() <= box.zMin() )
+            return false;
+
+        const osg::Vec3d mid = box.center();
+        bounds[0] = begin;
+        bounds[8] = end;
+        bounds[4] = partition( entries, bounds[0], bounds[8], 0, mid.x() );
+        bounds[2] = partition( entries, bounds[0], bounds[4], 1, mid.y() );
+        bounds[6] = partition( entries, bounds[4], bounds[8], 1, mid.y() );
+        bounds[1] = partition( entries, bounds[0], bounds[2], 2, mid.z() );
+        bounds[3] = partition( entries, bounds[2], bounds[4], 2, mid.z() );
+        bounds[5] = partition( entries, bounds[4], bounds[6], 2, mid.z() );
+        bounds[7] = partition( entries, bounds[6], bounds[8], 2, mid.z() );
+        return true;
+    }
+
+    typedef std::vector< osg::ref_ptr<osg::Node> >     NodeList;
+    typedef std::vector< osg::ref_ptr<osg::Drawable> > DrawableList;
+
+    /**
+     * Builds an octree over either a list of nodes (leaf cells are Groups)
+     * or a list of drawables (leaf cells are Geodes). Subtrees over disjoint
+     * entry ranges share nothing, so they can be built concurrently.
+     */
+    struct Builder
+    {
+        Builder() : _nodes(0L), _drawables(0L), _threshold(64u) { }
+
+        Entries*            _entries;
+        const NodeList*     _nodes;
+        const DrawableList* _drawables;
+        unsigned            _threshold;
+
+        osg::Node* build(unsigned begin, unsigned end, unsigned depth) const
+        {
+            unsigned bounds[9];
+            if ( end - begin <= _threshold || depth >= MAX_DEPTH || !splitOctants(*_entries, begin, end, bounds) )
+                return makeLeaf( begin, end );
+
+            osg::Group* cell = new osg::Group();
+            for( unsigned o = 0; o < 8; ++o )
+            {
+                if ( bounds[o+1] > bounds[o] )
+                    cell->addChild( build(bounds[o], bounds[o+1], depth+1) );
+            }
+            return cell;
+        }
+
+        osg::Node* makeLeaf(unsigned begin, unsigned end) const
+        {
+            if ( _drawables )
+            {
+                osg::Geode* geode = new osg::Geode();
+                for( unsigned i = begin; i < end; ++i )
+                    geode->addDrawable( (*_drawables)[(*_entries)[i]._item].get() );
+                return geode;
+            }
+            else
+            {
+                osg::Group* group = new osg::Group();
+                for( unsigned i = begin; i < end; ++i )
+                    group->addChild( (*_nodes)[(*_entries)[i]._item].get() );
+                return group;
+            }
+        }
+    };
+
+    // builds the subtree for one top-level octant
+    struct BuildOctant
+    {
+        const Builder*          _builder;
+        unsigned                _begin, _end;
+        osg::ref_ptr<osg::Node> _subtree;
+
+        void execute()
+        {
+            _subtree = _builder->build( _begin, _end, 1u );
+        }
+    };
+
+    /**
+     * Builds the tree and moves the top cell's children under "target".
+     */
+    void buildInto(osg::Group* target, const Builder& builder, unsigned numThreads)
+    {
+        Entries& entries = *builder._entries;
+        unsigned count = entries.size();
+        if ( count == 0 )
+            return;
+
+        unsigned bounds[9];
+        if ( !splitOctants(entries, 0, count, bounds) )
+        {
+            osg::ref_ptr<osg::Node> leaf = builder.makeLeaf( 0, count );
+            target->addChild( leaf.get() );
+            return;
+        }
+
+        std::vector< osg::ref_ptr<osg::Node> > octants(8);
+
+        if ( numThreads == 1u || count < MIN_ITEMS_FOR_PARALLEL_BUILD )
+        {
+            for( unsigned o = 0; o < 8; ++o )
+            {
+                if ( bounds[o+1] > bounds[o] )
+                    octants[o] = builder.build( bounds[o], bounds[o+1], 1u );
+            }
+        }
+        else
+        {
+            unsigned numTasks = 0;
+            for( unsigned o = 0; o < 8; ++o )
+                if ( bounds[o+1] > bounds[o] )
+                    ++numTasks;
+
+            osg::ref_ptr<TaskService> service = new TaskService( "Spatial organizer", (int)std::min(numThreads, numTasks) );
+
+            Threading::MultiEvent semaphore( (int)numTasks );
+            std::vector< osg::ref_ptr< ParallelTask<BuildOctant> > > tasks(8);
+            for( unsigned o = 0; o < 8; ++o )
+            {
+                if ( bounds[o+1] > bounds[o] )
+                {
+                    ParallelTask<BuildOctant>* task = new ParallelTask<BuildOctant>( &semaphore );
+                    task->_builder = &builder;
+                    task->_begin   = bounds[o];
+                    task->_end     = bounds[o+1];
+                    tasks[o] = task;
+                    service->add( task );
+                }
+            }
+
+            semaphore.wait();
+
+            for( unsigned o = 0; o < 8; ++o )
+            {
+                if ( tasks[o].valid() )
+                    octants[o] = tasks[o]->_subtree.get();
+            }
+        }
+
+        for( unsigned o = 0; o < 8; ++o )
+        {
+            if ( octants[o].valid() )
+                target->addChild( octants[o].get() );
+        }
+    }
+
+    // Finds the flat groups and geodes worth organizing, innermost first.
+    struct FindFlatGroups : public osg::NodeVisitor
+    {
+        FindFlatGroups(unsigned threshold) :
+            osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ),
+            _threshold      ( threshold ) { }
+
+        void apply(osg::Group& group)
+        {
+            traverse( group );
+            if ( strcmp(group.className(), "Group") == 0 && group.getNumChildren() > _threshold )
+                _groups.push_back( &group );
+        }
+
+        void apply(osg::Geode& geode)
+        {
+            // the geode gets replaced, so it must carry nothing but drawables and state.
+            if ( strcmp(geode.className(), "Geode") == 0 &&
+                 geode.getNumDrawables() > _threshold &&
+                 geode.getNumParents() > 0 &&
+                 geode.getUserData() == 0L &&
+                 geode.getUpdateCallback() == 0L &&
+                 geode.getEventCallback() == 0L &&
+                 geode.getCullCallback() == 0L )
+            {
+                _geodes.push_back( &geode );
+            }
+        }
+
+        unsigned                                 _threshold;
+        std::vector< osg::ref_ptr<osg::Group> >  _groups;
+        std::vector< osg::ref_ptr<osg::Geode> >  _geodes;
+    };
+}
+
+//------------------------------------------------------------------------
+
+SpatialOrganizer::SpatialOrganizer() :
+_splitThreshold( 64u ),
+_numThreads    ( 0u )
+{
+    //nop
+}
+
+void
+SpatialOrganizer::run(osg::Node* root)
+{
+    if ( !root || _splitThreshold == 0u )
+        return;
+
+    unsigned numThreads = _numThreads > 0u ? _numThreads : (unsigned)std::max( OpenThreads::GetNumberOfProcessors(), 1 );
+
+    FindFlatGroups finder( _splitThreshold );
+    root->accept( finder );
+
+    // Bounds are computed up front, on this thread: children may share
+    // subgraphs, and lazy bound computation is not thread-safe.
+    for( std::vector< osg::ref_ptr<osg::Geode> >::iterator g = finder._geodes.begin(); g != finder._geodes.end(); ++g )
+    {
+        osg::Geode* geode = g->get();
+
+        DrawableList drawables( geode->getNumDrawables() );
+        Entries entries;
+        entries.reserve( drawables.size() );
+
+        osg::ref_ptr<osg::Geode> loose = new osg::Geode();
+        for( unsigned i = 0; i < drawables.size(); ++i )
+        {
+            drawables[i] = geode->getDrawable(i);
+            if ( drawables[i]->getBound().valid() )
+            {
+                Entry e;
+                e._center = drawables[i]->getBound().center();
+                e._item   = i;
+                entries.push_back( e );
+            }
+            else
+            {
+                loose->addDrawable( drawables[i].get() );
+            }
+        }
+        geode->removeDrawables( 0, geode->getNumDrawables() );
+
+        // the replacement group inherits the geode's state.
+        osg::ref_ptr<osg::Group> replacement = new osg::Group();
+        replacement->setName     ( geode->getName() );
+        replacement->setNodeMask ( geode->getNodeMask() );
+        replacement->setStateSet ( geode->getStateSet() );
+
+        Builder builder;
+        builder._entries   = &entries;
+        builder._drawables = &drawables;
+        builder._threshold = _splitThreshold;
+        buildInto( replacement.get(), builder, numThreads );
+
+        if ( loose->getNumDrawables() > 0 )
+            replacement->addChild( loose.get() );
+
+        osg::Node::ParentList parents = geode->getParents();
+        for( osg::Node::ParentList::iterator p = parents.begin(); p != parents.end(); ++p )
+            (*p)->replaceChild( geode, replacement.get() );
+    }
+
+    for( std::vector< osg::ref_ptr<osg::Group> >::iterator g = finder._groups.begin(); g != finder._groups.end(); ++g )
+    {
+        osg::Group* group = g->get();
+
+        NodeList nodes( group->getNumChildren() );
+        Entries entries;
+        entries.reserve( nodes.size() );
+
+        NodeList loose;
+        for( unsigned i = 0; i < nodes.size(); ++i )
+        {
+            nodes[i] = group->getChild(i);
+            if ( nodes[i]->getBound().valid() )
+            {
+                Entry e;
+                e._center = nodes[i]->getBound().center();
+                e._item   = i;
+                entries.push_back( e );
+            }
+            else
+            {
+                loose.push_back( nodes[i] );
+            }
+        }
+        group->removeChildren( 0, group->getNumChildren() );
+
+        Builder builder;
+        builder._entries   = &entries;
+        builder._nodes     = &nodes;
+        builder._threshold = _splitThreshold;
+        buildInto( group, builder, numThreads );
+
+        for( NodeList::iterator i = loose.begin(); i != loose.end(); ++i )
+            group->addChild( i->get() );
+    }
+
+    OE_DEBUG << LC << "Organized " << finder._groups.size() << " groups and "
+        << finder._geodes.size() << " geodes" << std::endl;
+}
@@ -91,14 +91,8 @@ namespace
 
     void geodeticToECEF(std::vector<osg::Vec3d>& points, const osg::EllipsoidModel* em)
     {
-        for( unsigned i=0; i<points.size(); ++i )
-        {
-            double x, y, z;
-            em->convertLatLongHeightToXYZ(
-                osg::DegreesToRadians( points[i].y() ), osg::DegreesToRadians( points[i].x() ), points[i].z(),
-                x, y, z );
-            points[i].set( x, y, z );
-        }
+        if ( !points.empty() )
+            ECEF::geodeticToECEF( em, &points[0], points.size() );
     }
 
     void ECEFtoGeodetic(std::vector<osg::Vec3d>& points, const osg::EllipsoidModel* em)
@@ -419,9 +413,21 @@ SpatialReference::~SpatialReference()
     {
         GDAL_SCOPED_LOCK;
 
-        for (TransformHandleCache::iterator itr = _transformHandleCache.begin(); itr != _transformHandleCache.end(); ++itr)
+        TransformHandleCache* handles = static_cast<TransformHandleCache*>( _transformHandles.get() );
+        if ( handles )
         {
-            OCTDestroyCoordinateTransformation(itr->second);
+            for (TransformHandleCache::iterator itr = handles->begin(); itr != handles->end(); ++itr)
+            {
+                if ( itr->second )
+                    OCTDestroyCoordinateTransformation(itr->second);
+            }
+            delete handles;
+        }
+
+        // (the retired maps only hold handles that are also in the current one)
+        for (unsigned i = 0; i < _retiredTransformHandles.size(); ++i)
+        {
+            delete _retiredTransformHandles[i];
         }
 
         if ( _owns_handle )
@@ -1127,22 +1133,8 @@ SpatialReference::transformXYPointArrays(double*  x,
                                          unsigned count,
                                          const SpatialReference* out_srs) const
 {  
-    // Transform the X and Y values inside an exclusive GDAL/OGR lock
-    GDAL_SCOPED_LOCK;
-
-    void* xform_handle = NULL;
-    TransformHandleCache::const_iterator itr = _transformHandleCache.find(out_srs->getWKT());
-    if (itr != _transformHandleCache.end())
-    {
-        //OE_DEBUG << LC << "using cached transform handle" << std::endl;
-        xform_handle = itr->second;
-    }
-    else
-    {
-        OE_DEBUG << LC << "allocating new OCT Transform" << std::endl;
-        xform_handle = OCTNewCoordinateTransformation( _handle, out_srs->_handle);
-        const_cast<SpatialReference*>(this)->_transformHandleCache[out_srs->getWKT()] = xform_handle;
-    }
+    // The handle belongs to this thread, so the transform itself needs no lock.
+    void* xform_handle = getTransformHandle( out_srs );
 
     if ( !xform_handle )
     {
@@ -1157,6 +1149,48 @@ SpatialReference::transformXYPointArrays(double*  x,
 }
 
 
+void*
+SpatialReference::getTransformHandle(const SpatialReference* out_srs) const
+{
+    TransformHandleKey key( Threading::getCurrentThreadId(), out_srs->getWKT() );
+
+    // fast path: no lock.
+    const TransformHandleCache* handles = static_cast<const TransformHandleCache*>( _transformHandles.get() );
+    if ( handles )
+    {
+        TransformHandleCache::const_iterator itr = handles->find( key );
+        if ( itr != handles->end() )
+            return itr->second;
+    }
+
+    // Creating handles (and replacing the map) happens inside the exclusive
+    // GDAL/OGR lock, so there's one writer at a time.
+    GDAL_SCOPED_LOCK;
+
+    SpatialReference* self = const_cast<SpatialReference*>(this);
+
+    TransformHandleCache* current = static_cast<TransformHandleCache*>( self->_transformHandles.get() );
+    if ( current )
+    {
+        // another thread can't have added our key, but check anyway.
+        TransformHandleCache::const_iterator itr = current->find( key );
+        if ( itr != current->end() )
+            return itr->second;
+    }
+
+    OE_DEBUG << LC << "allocating new OCT Transform" << std::endl;
+    void* xform_handle = OCTNewCoordinateTransformation( _handle, out_srs->_handle );
+
+    TransformHandleCache* next = current ? new TransformHandleCache( *current ) : new TransformHandleCache();
+    (*next)[key] = xform_handle;
+
+    self->_transformHandles.assign( next, current );
+    if ( current )
+        self->_retiredTransformHandles.push_back( current );
+
+    return xform_handle;
+}
+
 bool
 SpatialReference::transformZ(std::vector<osg::Vec3d>& points,
                              const SpatialReference*  outputSRS,
@@ -1244,6 +1278,25 @@ SpatialReference::transformToWorld(const osg::Vec3d& input,
     }
 }
 
+bool
+SpatialReference::transformToWorld(std::vector<osg::Vec3d>& points) const
+{
+    if ( (isGeographic() && !isPlateCarre()) || isCube() )
+    {
+        return transform(points, getECEF());
+    }
+    else if ( _vdatum.valid() && !points.empty() )
+    {
+        std::vector<osg::Vec3d> geo( points );
+        if ( !transform(geo, getGeographicSRS()) )
+            return false;
+
+        for( unsigned i=0; i<points.size(); ++i )
+            points[i].z() = _vdatum->msl2hae( geo[i].y(), geo[i].x(), points[i].z() );
+    }
+    return true;
+}
+
 bool 
 SpatialReference::transformFromWorld(const osg::Vec3d& world,
                                      osg::Vec3d&       output,
@@ -1455,6 +1508,255 @@ bool SpatialReference::transformExtentPoints(const SpatialReference* to_srs,
     return false;
 }
 
+//------------------------------------------------------------------------
+
+namespace
+{
+    // bounds the number of approximations each SRS keeps.
+    const unsigned MAX_TRANSFORM_GRIDS = 64;
+
+    // building a grid takes at least a few hundred exact transforms, so
+    // smaller batches only use a grid that's already cached.
+    const unsigned MIN_POINTS_TO_BUILD_TRANSFORM_GRID = 1024;
+}
+
+/**
+ * Approximation of the transform from one SRS to another over an extent:
+ * the exact transform at a grid of control points, bilinearly interpolated
+ * in between.
+ */
+struct SpatialReference::TransformGrid : public osg::Referenced
+{
+    osg::ref_ptr<const SpatialReference> _toSRS;
+    double              _xmin, _ymin, _xmax, _ymax;
+    double              _tolerance;
+    unsigned            _cells; // cells on a side; 0 if no grid met the tolerance
+    std::vector<double> _x, _y; // control points, column-major like transformExtentPoints
+
+    bool matches(const SpatialReference* toSRS, double xmin, double ymin, double xmax, double ymax, double tolerance) const
+    {
+        return
+            _toSRS.get() == toSRS &&
+            _xmin == xmin && _ymin == ymin && _xmax == xmax && _ymax == ymax &&
+            _tolerance == tolerance;
+    }
+
+    bool valid() const { return _cells > 0; }
+
+    bool contains(double x, double y) const
+    {
+        return x >= _xmin && x <= _xmax && y >= _ymin && y <= _ymax;
+    }
+
+    // interpolates the transform of a point in the extent.
+    void interpolate(double x, double y, double& out_x, double& out_y) const
+    {
+        double   u  = (x - _xmin) / (_xmax - _xmin) * (double)_cells;
+        double   v  = (y - _ymin) / (_ymax - _ymin) * (double)_cells;
+        unsigned i  = osg::minimum( (unsigned)osg::maximum(u, 0.0), _cells - 1 );
+        unsigned j  = osg::minimum( (unsigned)osg::maximum(v, 0.0), _cells - 1 );
+        double   fu = u - (double)i;
+        double   fv = v - (double)j;
+
+        unsigned n = _cells + 1;
+        unsigned k = i*n + j;
+
+        out_x =
+            (1.0-fu) * ((1.0-fv)*_x[k]   + fv*_x[k+1]) +
+            fu       * ((1.0-fv)*_x[k+n] + fv*_x[k+n+1]);
+        out_y =
+            (1.0-fu) * ((1.0-fv)*_y[k]   + fv*_y[k+1]) +
+            fu       * ((1.0-fv)*_y[k+n] + fv*_y[k+n+1]);
+    }
+
+    // builds finer and finer grids until one stays within the tolerance of the
+    // exact transform at the center of every cell (where a bilinear
+    // approximation of a smooth transform is at its worst).
+    void build(const SpatialReference* fromSRS)
+    {
+        _cells = 0;
+
+        for(unsigned cells = 8; cells <= 64; cells *= 2)
+        {
+            unsigned n = cells + 1;
+            std::vector<double> gx(n*n), gy(n*n);
+            if ( !fromSRS->transformExtentPoints(_toSRS.get(), _xmin, _ymin, _xmax, _ymax, &gx[0], &gy[0], n, n) )
+                return;
+
+            double hx = 0.5 * (_xmax - _xmin) / (double)cells;
+            double hy = 0.5 * (_ymax - _ymin) / (double)cells;
+            std::vector<double> cx(cells*cells), cy(cells*cells);
+            if ( !fromSRS->transformExtentPoints(_toSRS.get(), _xmin+hx, _ymin+hy, _xmax-hx, _ymax-hy, &cx[0], &cy[0], cells, cells) )
+                return;
+
+            bool ok = true;
+            for(unsigned i=0; i<cells && ok; ++i)
+            {
+                for(unsigned j=0; j<cells && ok; ++j)
+                {
+                    unsigned k = i*n + j;
+                    double ix = 0.25 * (gx[k] + gx[k+1] + gx[k+n] + gx[k+n+1]);
+                    double iy = 0.25 * (gy[k] + gy[k+1] + gy[k+n] + gy[k+n+1]);
+
+                    // (written so that a NaN fails too)
+                    ok =
+                        fabs(ix - cx[i*cells+j]) <= _tolerance &&
+                        fabs(iy - cy[i*cells+j]) <= _tolerance;
+                }
+            }
+
+            if ( ok )
+            {
+                _cells = cells;
+                _x.swap( gx );
+                _y.swap( gy );
+                return;
+            }
+        }
+    }
+};
+
+bool
+SpatialReference::canApproximateTransform(const SpatialReference* to_srs) const
+{
+    return
+        to_srs                   &&
+        isContiguous()           &&
+        to_srs->isContiguous()   &&
+        !isECEF()                &&
+        !to_srs->isECEF()        &&
+        isVertEquivalentTo(to_srs);
+}
+
+osg::ref_ptr<SpatialReference::TransformGrid>
+SpatialReference::getTransformGrid(const SpatialReference* to_srs,
+                                   double xmin, double ymin,
+                                   double xmax, double ymax,
+                                   double tolerance,
+                                   unsigned numPoints) const
+{
+    {
+        Threading::ScopedMutexLock lock( _transformGridsMutex );
+        for(TransformGridCache::iterator i = _transformGrids.begin(); i != _transformGrids.end(); ++i)
+        {
+            if ( (*i)->matches(to_srs, xmin, ymin, xmax, ymax, tolerance) )
+            {
+                osg::ref_ptr<TransformGrid> grid = i->get();
+                _transformGrids.erase( i );
+                _transformGrids.push_front( grid.get() );
+                return grid;
+            }
+        }
+    }
+
+    if ( numPoints < MIN_POINTS_TO_BUILD_TRANSFORM_GRID )
+        return 0L;
+
+    // build it outside the lock; two threads may race to build the same
+    // grid, which only wastes a little work.
+    osg::ref_ptr<TransformGrid> grid = new TransformGrid();
+    grid->_toSRS     = to_srs;
+    grid->_xmin      = xmin;
+    grid->_ymin      = ymin;
+    grid->_xmax      = xmax;
+    grid->_ymax      = ymax;
+    grid->_tolerance = tolerance;
+    grid->build( this );
+
+    if ( !grid->valid() )
+    {
+        OE_DEBUG << LC << "No transform grid within " << tolerance << " of the exact transform from "
+            << getName() << " to " << to_srs->getName() << std::endl;
+    }
+
+    Threading::ScopedMutexLock lock( _transformGridsMutex );
+    _transformGrids.push_front( grid.get() );
+    if ( _transformGrids.size() > MAX_TRANSFORM_GRIDS )
+        _transformGrids.pop_back();
+
+    return grid;
+}
+
+bool
+SpatialReference::transformExtentPointsApprox(const SpatialReference* to_srs,
+                                              double in_xmin, double in_ymin,
+                                              double in_xmax, double in_ymax,
+                                              double* x, double* y,
+                                              unsigned numx, unsigned numy,
+                                              double tolerance ) const
+{
+    if (numx < 2 || numy < 2 || in_xmax <= in_xmin || in_ymax <= in_ymin ||
+        !canApproximateTransform(to_srs) || isEquivalentTo(to_srs) )
+        return transformExtentPoints( to_srs, in_xmin, in_ymin, in_xmax, in_ymax, x, y, numx, numy );
+
+    osg::ref_ptr<TransformGrid> grid = getTransformGrid( to_srs, in_xmin, in_ymin, in_xmax, in_ymax, tolerance, numx*numy );
+    if ( !grid.valid() || !grid->valid() )
+        return transformExtentPoints( to_srs, in_xmin, in_ymin, in_xmax, in_ymax, x, y, numx, numy );
+
+    const double dx = (in_xmax - in_xmin) / (numx - 1);
+    const double dy = (in_ymax - in_ymin) / (numy - 1);
+
+    unsigned pixel = 0;
+    for(unsigned c = 0; c < numx; ++c)
+    {
+        double px = in_xmin + (double)c * dx;
+        for(unsigned r = 0; r < numy; ++r, ++pixel)
+        {
+            grid->interpolate( px, in_ymin + (double)r * dy, x[pixel], y[pixel] );
+        }
+    }
+    return true;
+}
+
+bool
+SpatialReference::transformApprox(std::vector<osg::Vec3d>& points,
+                                  const SpatialReference*  to_srs,
+                                  double xmin, double ymin,
+                                  double xmax, double ymax,
+                                  double tolerance ) const
+{
+    if ( xmax <= xmin || ymax <= ymin || !canApproximateTransform(to_srs) )
+        return transform( points, to_srs );
+
+    if ( isEquivalentTo(to_srs) )
+        return true;
+
+    osg::ref_ptr<TransformGrid> grid = getTransformGrid( to_srs, xmin, ymin, xmax, ymax, tolerance, points.size() );
+    if ( !grid.valid() || !grid->valid() )
+        return transform( points, to_srs );
+
+    // points outside the grid get the exact treatment, in one batch.
+    std::vector<unsigned>   outside;
+    std::vector<osg::Vec3d> outsidePoints;
+
+    for(unsigned i=0; i<points.size(); ++i)
+    {
+        osg::Vec3d& p = points[i];
+        if ( grid->contains(p.x(), p.y()) )
+        {
+            double x, y;
+            grid->interpolate( p.x(), p.y(), x, y );
+            p.set( x, y, p.z() );
+        }
+        else
+        {
+            outside.push_back( i );
+            outsidePoints.push_back( p );
+        }
+    }
+
+    if ( outsidePoints.empty() )
+        return true;
+
+    bool ok = transform( outsidePoints, to_srs );
+    for(unsigned i=0; i<outside.size(); ++i)
+        points[outside[i]] = outsidePoints[i];
+
+    return ok;
+}
+
+//------------------------------------------------------------------------
+
 void
 SpatialReference::init()
 {
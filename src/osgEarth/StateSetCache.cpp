@@ -20,6 +20,7 @@
 #include <osg/NodeVisitor>
 #include <osg/Geode>
 #include <osg/BufferIndexBinding>
+#include <osg/Timer>
 
 #define LC "[StateSetCache] "
 
@@ -35,6 +36,86 @@ using namespace osgEarth;
 
 namespace
 {
+    // FNV-1a pieces for fingerprinting.
+    inline void hashInt(unsigned& h, unsigned v)
+    {
+        for(unsigned b=0; b<4; ++b, v >>= 8)
+        {
+            h ^= (v & 0xff);
+            h *= 16777619u;
+        }
+    }
+
+    inline void hashString(unsigned& h, const char* s)
+    {
+        for( ; s && *s; ++s )
+        {
+            h ^= (unsigned char)(*s);
+            h *= 16777619u;
+        }
+    }
+
+    // Fingerprint of an attribute. Attributes that compare() as equal
+    // always have the same fingerprint.
+    unsigned fingerprint(const osg::StateAttribute* attr)
+    {
+        unsigned h = 2166136261u;
+        hashInt( h, (unsigned)attr->getType() );
+        hashInt( h, attr->getMember() );
+        hashString( h, attr->className() );
+        return h;
+    }
+
+    void hashAttributes(unsigned& h, const osg::StateSet::AttributeList& attrs)
+    {
+        hashInt( h, attrs.size() );
+        for( osg::StateSet::AttributeList::const_iterator i = attrs.begin(); i != attrs.end(); ++i )
+        {
+            hashInt( h, fingerprint(i->second.first.get()) );
+            hashInt( h, i->second.second );
+        }
+    }
+
+    void hashModes(unsigned& h, const osg::StateSet::ModeList& modes)
+    {
+        hashInt( h, modes.size() );
+        for( osg::StateSet::ModeList::const_iterator i = modes.begin(); i != modes.end(); ++i )
+        {
+            hashInt( h, i->first );
+            hashInt( h, i->second );
+        }
+    }
+
+    // Fingerprint of a stateset, built from its modes, the kinds of
+    // attributes it holds and the names of its uniforms. State sets that
+    // compare() as equal always have the same fingerprint.
+    unsigned fingerprint(const osg::StateSet* stateSet)
+    {
+        unsigned h = 2166136261u;
+
+        hashModes( h, stateSet->getModeList() );
+        hashAttributes( h, stateSet->getAttributeList() );
+
+        const osg::StateSet::TextureModeList& texModes = stateSet->getTextureModeList();
+        hashInt( h, texModes.size() );
+        for( unsigned i = 0; i < texModes.size(); ++i )
+            hashModes( h, texModes[i] );
+
+        const osg::StateSet::TextureAttributeList& texAttrs = stateSet->getTextureAttributeList();
+        hashInt( h, texAttrs.size() );
+        for( unsigned i = 0; i < texAttrs.size(); ++i )
+            hashAttributes( h, texAttrs[i] );
+
+        const osg::StateSet::UniformList& uniforms = stateSet->getUniformList();
+        hashInt( h, uniforms.size() );
+        for( osg::StateSet::UniformList::const_iterator i = uniforms.begin(); i != uniforms.end(); ++i )
+        {
+            hashString( h, i->first.c_str() );
+        }
+
+        return h;
+    }
+
     bool isEligible(osg::StateAttribute* attr)
     {
         if ( !attr )
@@ -242,12 +323,93 @@ namespace
             apply((osg::Node&)geode);
         }
     };
+
+
+    /**
+     * Visitor that shares attributes and then statesets as it goes, and
+     * stops once its time budget is spent.
+     */
+    struct ShareStateWithinBudget : public osg::NodeVisitor
+    {
+        ShareStateAttributes _attrs;
+        StateSetCache*       _cache;
+        osg::Timer_t         _start;
+        double               _maxSeconds;
+        bool                 _complete;
+
+        ShareStateWithinBudget(StateSetCache* cache, double maxSeconds)
+            : _attrs     ( cache ),
+              _cache     ( cache ),
+              _start     ( osg::Timer::instance()->tick() ),
+              _maxSeconds( maxSeconds ),
+              _complete  ( true )
+        {
+            setTraversalMode( TRAVERSE_ALL_CHILDREN );
+            setNodeMaskOverride( ~0 );
+        }
+
+        bool expired()
+        {
+            if ( _complete && osg::Timer::instance()->delta_s(_start, osg::Timer::instance()->tick()) > _maxSeconds )
+                _complete = false;
+            return !_complete;
+        }
+
+        // returns the stateset to use in place of the input, or NULL to keep it.
+        osg::StateSet* share(osg::StateSet* input)
+        {
+            osg::ref_ptr<osg::StateSet> stateset = input;
+            if ( !stateset.valid() || stateset->getDataVariance() == osg::Object::DYNAMIC )
+                return 0L;
+
+            _attrs.applyStateSet( stateset.get() );
+
+#ifdef STATESET_SHARING_SUPPORTED
+            osg::ref_ptr<osg::StateSet> shared;
+            if ( isEligible(stateset.get()) && _cache->share(stateset, shared) )
+                return shared.release();
+#endif
+            return 0L;
+        }
+
+        void apply(osg::Node& node)
+        {
+            if ( expired() )
+                return;
+
+            if ( node.getStateSet() )
+            {
+                osg::ref_ptr<osg::StateSet> shared = share( node.getStateSet() );
+                if ( shared.valid() )
+                    node.setStateSet( shared.get() );
+            }
+            traverse(node);
+        }
+
+        void apply(osg::Geode& geode)
+        {
+            if ( expired() )
+                return;
+
+            unsigned numDrawables = geode.getNumDrawables();
+            for( unsigned i=0; i<numDrawables; ++i )
+            {
+                osg::Drawable* d = geode.getDrawable(i);
+                if ( d && d->getStateSet() )
+                {
+                    osg::ref_ptr<osg::StateSet> shared = share( d->getStateSet() );
+                    if ( shared.valid() )
+                        d->setStateSet( shared.get() );
+                }
+            }
+            apply((osg::Node&)geode);
+        }
+    };
 }
 
 //------------------------------------------------------------------------
 
 StateSetCache::StateSetCache() :
-_pruneCount       ( 0 ),
 _maxSize          ( DEFAULT_PRUNE_ACCESS_COUNT ),
 _attrShareAttempts( 0 ),
 _attrsIneligible  ( 0 ),
@@ -259,18 +421,34 @@ _attrShareMisses  ( 0 )
 
 StateSetCache::~StateSetCache()
 {
-    Threading::ScopedMutexLock lock( _mutex );
-    prune();
+    for(unsigned s=0; s<NUM_SHARDS; ++s)
+    {
+        Threading::ScopedMutexLock lock( _shards[s]._mutex );
+        prune( _shards[s] );
+    }
 }
 
 void
 StateSetCache::setMaxSize(unsigned value)
 {
     _maxSize = value;
+    for(unsigned s=0; s<NUM_SHARDS; ++s)
+    {
+        Threading::ScopedMutexLock lock( _shards[s]._mutex );
+        pruneIfNecessary( _shards[s] );
+    }
+}
+
+unsigned
+StateSetCache::size() const
+{
+    unsigned total = 0;
+    for(unsigned s=0; s<NUM_SHARDS; ++s)
     {
-        Threading::ScopedMutexLock lock( _mutex );
-        pruneIfNecessary();
+        Threading::ScopedMutexLock lock( _shards[s]._mutex );
+        total += _shards[s]._stateSetCache.size();
     }
+    return total;
 }
 
 void
@@ -305,6 +483,22 @@ StateSetCache::optimize(osg::Node* node)
     }
 }
 
+bool
+StateSetCache::optimize(osg::Node* node, double maxSeconds)
+{
+    if ( !node )
+        return true;
+
+    ShareStateWithinBudget v( this, maxSeconds );
+    node->accept( v );
+
+    if ( !v._complete )
+    {
+        OE_DEBUG << LC << "State sharing ran out of time (" << maxSeconds << "s); rest of graph left as is" << std::endl;
+    }
+    return v._complete;
+}
+
 
 bool
 StateSetCache::eligible(osg::StateSet* stateSet) const
@@ -326,28 +520,28 @@ StateSetCache::share(osg::ref_ptr<osg::StateSet>& input,
                      bool                         checkEligible)
 {
     bool shared     = false;
-    //bool shareattrs = true;
 
     if ( !checkEligible || eligible(input.get()) )
     {
-        Threading::ScopedMutexLock lock( _mutex );
+        // fingerprint outside the lock.
+        unsigned fp = fingerprint( input.get() );
+        Shard& shard = _shards[fp % NUM_SHARDS];
 
-        pruneIfNecessary();
+        Threading::ScopedMutexLock lock( shard._mutex );
 
-        //shareattrs = false;
+        pruneIfNecessary( shard );
 
-        std::pair<StateSetSet::iterator,bool> result = _stateSetCache.insert( input );
+        std::pair<StateSetSet::iterator,bool> result = shard._stateSetCache.insert( Entry<osg::StateSet>(fp, input.get()) );
         if ( result.second )
         {
             // first use
             output = input.get();
-            //shareattrs = true;
             shared = false;
         }
         else
         {
             // found a share!
-            output = result.first->get();
+            output = result.first->_value.get();
             shared = true;
         }
     }
@@ -357,13 +551,6 @@ StateSetCache::share(osg::ref_ptr<osg::StateSet>& input,
         shared = false;
     }
 
-    // OBE.
-    //if ( shareattrs )
-    //{
-    //    ShareStateAttributes sa(this);
-    //    sa.applyStateSet( input.get() );
-    //}
-
     return shared;
 }
 
@@ -374,63 +561,66 @@ StateSetCache::share(osg::ref_ptr<osg::StateAttribute>& input,
                      osg::ref_ptr<osg::StateAttribute>& output,
                      bool                               checkEligible)
 {
-    _attrShareAttempts++;
+    ++_attrShareAttempts;
 
     if ( !checkEligible || eligible(input.get()) )
     {
-        Threading::ScopedMutexLock lock( _mutex );
+        unsigned fp = fingerprint( input.get() );
+        Shard& shard = _shards[fp % NUM_SHARDS];
+
+        Threading::ScopedMutexLock lock( shard._mutex );
 
-        pruneIfNecessary();
+        pruneIfNecessary( shard );
 
-        std::pair<StateAttributeSet::iterator,bool> result = _stateAttributeCache.insert( input );
+        std::pair<StateAttributeSet::iterator,bool> result = shard._stateAttributeCache.insert( Entry<osg::StateAttribute>(fp, input.get()) );
         if ( result.second )
         {
             // first use
             output = input.get();
-            _attrShareMisses++;
+            ++_attrShareMisses;
             return false;
         }
         else
         {
             // found a share!
-            output = result.first->get();
-            _attrShareHits++;
+            output = result.first->_value.get();
+            ++_attrShareHits;
             return true;
         }
     }
     else
     {
-        _attrsIneligible++;
+        ++_attrsIneligible;
         output = input.get();
         return false;
     }
 }
 
 void
-StateSetCache::pruneIfNecessary()
+StateSetCache::pruneIfNecessary(Shard& shard)
 {
     // assume an exclusve mutex is taken
-    if ( _pruneCount++ >= _maxSize )
+    if ( shard._pruneCount++ >= _maxSize )
     {
-        prune();
-        _pruneCount = 0;
+        prune( shard );
+        shard._pruneCount = 0;
     }
 }
 
 void
-StateSetCache::prune()
+StateSetCache::prune(Shard& shard)
 {
     // assume an exclusive mutex is taken.
 
     unsigned ss_count = 0, sa_count = 0;
 
-    for( StateSetSet::iterator i = _stateSetCache.begin(); i != _stateSetCache.end(); )
+    for( StateSetSet::iterator i = shard._stateSetCache.begin(); i != shard._stateSetCache.end(); )
     {
-        if ( i->get()->referenceCount() <= 1 )
+        if ( i->_value->referenceCount() <= 1 )
         {
             // do not call releaseGLObjects since the attrs themselves might still be shared
             // TODO: review this.
-            _stateSetCache.erase( i++ );
+            shard._stateSetCache.erase( i++ );
             ss_count++;
         }
         else
@@ -439,12 +629,12 @@ StateSetCache::prune()
         }
     }
 
-    for( StateAttributeSet::iterator i = _stateAttributeCache.begin(); i != _stateAttributeCache.end(); )
+    for( StateAttributeSet::iterator i = shard._stateAttributeCache.begin(); i != shard._stateAttributeCache.end(); )
     {
-        if ( i->get()->referenceCount() <= 1 )
+        if ( i->_value->referenceCount() <= 1 )
         {
-            i->get()->releaseGLObjects( 0L );
-            _stateAttributeCache.erase( i++ );
+            i->_value->releaseGLObjects( 0L );
+            shard._stateAttributeCache.erase( i++ );
             sa_count++;
         }
         else
@@ -459,21 +649,21 @@ StateSetCache::prune()
 void
 StateSetCache::clear()
 {
-    Threading::ScopedMutexLock lock( _mutex );
-
-    _stateAttributeCache.clear();
-    _stateSetCache.clear();
+    for(unsigned s=0; s<NUM_SHARDS; ++s)
+    {
+        Threading::ScopedMutexLock lock( _shards[s]._mutex );
+        _shards[s]._stateAttributeCache.clear();
+        _shards[s]._stateSetCache.clear();
+    }
 }
 
 
 void
 StateSetCache::dumpStats()
 {
-    Threading::ScopedMutexLock lock( _mutex );
-
     OE_NOTICE << LC << "StateSetCache Dump:" << std::endl
-        << "    attr attempts     = " << _attrShareAttempts << std::endl
-        << "    ineligibles attrs = " << _attrsIneligible << std::endl
-        << "    attr share hits   = " << _attrShareHits << std::endl
-        << "    attr share misses = " << _attrShareMisses << std::endl;
+        << "    attr attempts     = " << (unsigned)_attrShareAttempts << std::endl
+        << "    ineligibles attrs = " << (unsigned)_attrsIneligible << std::endl
+        << "    attr share hits   = " << (unsigned)_attrShareHits << std::endl
+        << "    attr share misses = " << (unsigned)_attrShareMisses << std::endl;
 }
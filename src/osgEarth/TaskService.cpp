@@ -19,6 +19,7 @@
 #include <osgEarth/TaskService>
 #include <osg/Notify>
 #include <osg/Math>
+#include <cfloat>
 
 using namespace osgEarth;
 using namespace OpenThreads;
@@ -30,7 +31,12 @@ using namespace OpenThreads;
 TaskRequest::TaskRequest( float priority ) :
 osg::Referenced( true ),
 _priority( priority ),
-_state( STATE_IDLE )
+_state( STATE_IDLE ),
+_stamp( 0 ),
+_enqueueTime( 0 ),
+_startTime( 0 ),
+_endTime( 0 ),
+_completedEvent( 0L )
 {
     _progress = new ProgressCallback();
 }
@@ -68,10 +74,57 @@ TaskRequest::wasCanceled() const
 TaskRequestQueue::TaskRequestQueue(unsigned int maxSize) :
 osg::Referenced( true ),
 _done( false ),
-_maxSize( maxSize )
+_maxSize( maxSize ),
+_stamp( 0 ),
+_maxStampAge( 0 )
 {
 }
 
+unsigned
+TaskRequestQueue::reprioritize( TaskRequestPriorityMap& requests )
+{
+    osg::ref_ptr<TaskRequestPriorityFunctor> functor = _priorityFunctor.get();
+    unsigned numDropped = 0;
+
+    TaskRequestPriorityMap rebuilt;
+    for (TaskRequestPriorityMap::iterator it = requests.begin(); it != requests.end(); ++it)
+    {
+        TaskRequest* request = it->second.get();
+
+        if ( _maxStampAge > 0 && _stamp - request->getStamp() > _maxStampAge )
+        {
+            request->cancel();
+            ++numDropped;
+            continue;
+        }
+
+        if ( functor.valid() )
+        {
+            request->setPriority( (*functor.get())(request) );
+        }
+
+        rebuilt.insert( std::make_pair(request->getPriority(), it->second) );
+    }
+
+    requests.swap( rebuilt );
+    return numDropped;
+}
+
+unsigned
+TaskRequestQueue::reprioritize()
+{
+    unsigned numDropped = 0;
+    {
+        ScopedLock<Mutex> lock(_mutex);
+        numDropped = reprioritize( _requests );
+    }
+
+    if ( numDropped > 0 )
+        _notFull.signal();
+
+    return numDropped;
+}
+
 void
 TaskRequestQueue::clear()
 {
@@ -112,6 +165,7 @@ void
 TaskRequestQueue::add( TaskRequest* request )
 {
     request->setState( TaskRequest::STATE_PENDING );
+    request->setEnqueueTime( osg::Timer::instance()->tick() );
 
     // install a progress callback if one isn't already installed
     if ( !request->getProgressCallback() )
@@ -192,13 +246,318 @@ TaskRequestQueue::setDone()
 
 //------------------------------------------------------------------------
 
-TaskThread::TaskThread( TaskRequestQueue* queue ) :
+WorkStealingTaskRequestQueue::WorkStealingTaskRequestQueue(unsigned int numQueues,
+                                                           unsigned int maxSize,
+                                                           float        priorityBand) :
+TaskRequestQueue( maxSize ),
+_priorityBand   ( priorityBand )
+{
+    numQueues = osg::maximum( numQueues, 1u );
+    _slots.reserve( numQueues );
+    for(unsigned i=0; i<numQueues; ++i)
+        _slots.push_back( new Slot() );
+}
+
+WorkStealingTaskRequestQueue::~WorkStealingTaskRequestQueue()
+{
+    for(Slots::iterator i = _slots.begin(); i != _slots.end(); ++i)
+        delete *i;
+}
+
+bool
+WorkStealingTaskRequestQueue::isFull() const
+{
+    return _maxSize > 0 && (unsigned)_count >= _maxSize;
+}
+
+bool
+WorkStealingTaskRequestQueue::isEmpty() const
+{
+    return !_done && (unsigned)_count == 0;
+}
+
+unsigned int
+WorkStealingTaskRequestQueue::getNumRequests() const
+{
+    return (unsigned)_count;
+}
+
+void
+WorkStealingTaskRequestQueue::add( TaskRequest* request )
+{
+    request->setState( TaskRequest::STATE_PENDING );
+    request->setEnqueueTime( osg::Timer::instance()->tick() );
+
+    if ( !request->getProgressCallback() )
+        request->setProgressCallback( new ProgressCallback() );
+
+    if ( _maxSize > 0 )
+    {
+        ScopedLock<Mutex> lock( _waitMutex );
+        while( isFull() && !_done )
+        {
+            _notFull.wait( &_waitMutex );
+        }
+    }
+
+    // distribute incoming requests round-robin; workers will rebalance by stealing.
+    Slot* slot = _slots[ (++_next) % _slots.size() ];
+    {
+        ScopedLock<Mutex> lock( slot->_mutex );
+        slot->_requests.insert( std::make_pair(request->getPriority(), osg::ref_ptr<TaskRequest>(request)) );
+        slot->_top = slot->_requests.begin()->first;
+        ++slot->_size;
+    }
+
+    ++_count;
+
+    // only touch the wait mutex if somebody is actually sleeping.
+    if ( (unsigned)_numWaiting > 0 )
+    {
+        ScopedLock<Mutex> lock( _waitMutex );
+        _notEmpty.signal();
+    }
+}
+
+TaskRequest*
+WorkStealingTaskRequestQueue::pop( Slot* slot )
+{
+    osg::ref_ptr<TaskRequest> next;
+    {
+        ScopedLock<Mutex> lock( slot->_mutex );
+        if ( slot->_requests.empty() )
+            return 0L;
+
+        next = slot->_requests.begin()->second.get();
+        slot->_requests.erase( slot->_requests.begin() );
+        if ( !slot->_requests.empty() )
+            slot->_top = slot->_requests.begin()->first;
+        --slot->_size;
+    }
+
+    --_count;
+
+    if ( _maxSize > 0 )
+    {
+        ScopedLock<Mutex> lock( _waitMutex );
+        _notFull.signal();
+    }
+
+    return next.release();
+}
+
+TaskRequest*
+WorkStealingTaskRequestQueue::get()
+{
+    const unsigned numSlots = _slots.size();
+    Slot* home = _slots[ Threading::getCurrentThreadId() % numSlots ];
+
+    while( !_done )
+    {
+        // find the slot with the best (lowest) leading priority. The reads are
+        // unlocked, so this is only a hint; pop() re-checks under the slot lock.
+        Slot* best = 0L;
+        for(unsigned i=0; i<numSlots; ++i)
+        {
+            Slot* slot = _slots[i];
+            if ( (unsigned)slot->_size > 0 && (best == 0L || slot->_top < best->_top) )
+                best = slot;
+        }
+
+        if ( best )
+        {
+            // stay at home unless the other queue is better by more than the band.
+            Slot* target = 
+                (unsigned)home->_size > 0 && home->_top <= best->_top + _priorityBand ? home : best;
+
+            TaskRequest* request = pop( target );
+            if ( request )
+                return request;
+
+            // lost a race; rescan.
+            continue;
+        }
+
+        // nothing anywhere; sleep until an add() wakes us.
+        ScopedLock<Mutex> lock( _waitMutex );
+        ++_numWaiting;
+        while( isEmpty() )
+        {
+            _notEmpty.wait( &_waitMutex );
+        }
+        --_numWaiting;
+    }
+
+    return 0L;
+}
+
+unsigned
+WorkStealingTaskRequestQueue::reprioritize()
+{
+    unsigned numDropped = 0;
+    for(Slots::iterator i = _slots.begin(); i != _slots.end(); ++i)
+    {
+        Slot* slot = *i;
+        ScopedLock<Mutex> lock( slot->_mutex );
+        unsigned n = TaskRequestQueue::reprioritize( slot->_requests );
+        for(unsigned k=0; k<n; ++k)
+        {
+            --slot->_size;
+            --_count;
+        }
+        if ( !slot->_requests.empty() )
+            slot->_top = slot->_requests.begin()->first;
+        numDropped += n;
+    }
+
+    if ( numDropped > 0 && _maxSize > 0 )
+    {
+        ScopedLock<Mutex> lock( _waitMutex );
+        _notFull.broadcast();
+    }
+
+    return numDropped;
+}
+
+void
+WorkStealingTaskRequestQueue::clearSlot( Slot* slot, bool cancel )
+{
+    ScopedLock<Mutex> lock( slot->_mutex );
+    for (TaskRequestPriorityMap::iterator it = slot->_requests.begin(); it != slot->_requests.end(); ++it)
+    {
+        if ( cancel )
+            it->second->cancel();
+        --slot->_size;
+        --_count;
+    }
+    slot->_requests.clear();
+}
+
+void
+WorkStealingTaskRequestQueue::clear()
+{
+    for(Slots::iterator i = _slots.begin(); i != _slots.end(); ++i)
+        clearSlot( *i, false );
+
+    ScopedLock<Mutex> lock( _waitMutex );
+    _notFull.broadcast();
+}
+
+void
+WorkStealingTaskRequestQueue::cancel()
+{
+    for(Slots::iterator i = _slots.begin(); i != _slots.end(); ++i)
+        clearSlot( *i, true );
+
+    ScopedLock<Mutex> lock( _waitMutex );
+    _notFull.broadcast();
+}
+
+void
+WorkStealingTaskRequestQueue::setDone()
+{
+    ScopedLock<Mutex> lock( _waitMutex );
+
+    _done = true;
+
+    // alternative to buggy win32 broadcast (OSG pre-r10457 on windows)
+    for(int i=0; i<128; i++) {
+        _notFull.signal();
+        _notEmpty.signal();
+    }
+}
+
+//------------------------------------------------------------------------
+
+void
+TaskTimeHistogram::clear()
+{
+    for(unsigned i=0; i<NUM_BUCKETS; ++i)
+        _buckets[i] = 0;
+    _count = 0;
+    _total = 0.0;
+    _max   = 0.0;
+}
+
+double
+TaskTimeHistogram::getBucketUpperBound( unsigned bucket )
+{
+    return bucket+1 >= NUM_BUCKETS ? DBL_MAX : 0.0001 * (double)(1u << bucket);
+}
+
+void
+TaskTimeHistogram::add( double seconds )
+{
+    unsigned bucket = 0;
+    while( bucket+1 < NUM_BUCKETS && seconds >= getBucketUpperBound(bucket) )
+        ++bucket;
+
+    _buckets[bucket]++;
+    _count++;
+    _total += seconds;
+    if ( seconds > _max )
+        _max = seconds;
+}
+
+namespace
+{
+    void dumpHistogram( std::ostream& out, const char* title, const TaskTimeHistogram& h )
+    {
+        out << "    " << title << ": n=" << h._count
+            << " mean=" << (h.getMean()*1000.0) << "ms"
+            << " max=" << (h._max*1000.0) << "ms" << std::endl;
+
+        for(unsigned i=0; i<TaskTimeHistogram::NUM_BUCKETS; ++i)
+        {
+            if ( h._buckets[i] > 0 )
+            {
+                out << "      ";
+                if ( i+1 < TaskTimeHistogram::NUM_BUCKETS )
+                    out << "< " << (TaskTimeHistogram::getBucketUpperBound(i)*1000.0) << "ms";
+                else
+                    out << ">= " << (TaskTimeHistogram::getBucketUpperBound(i-1)*1000.0) << "ms";
+                out << " : " << h._buckets[i] << std::endl;
+            }
+        }
+    }
+}
+
+void
+TaskServiceMetrics::dump( std::ostream& out ) const
+{
+    out << "TaskService [" << _name << "]" << std::endl
+        << "    queue depth: " << _queueDepth
+        << ", completed: "     << _numCompleted
+        << ", canceled: "      << _numCanceled << std::endl;
+
+    dumpHistogram( out, "wait time", _waitTime );
+    dumpHistogram( out, "run time",  _runTime );
+
+    out << "    thread utilization:";
+    for(unsigned i=0; i<_threadUtilization.size(); ++i)
+        out << " " << (int)(_threadUtilization[i]*100.0) << "%";
+    out << std::endl;
+}
+
+//------------------------------------------------------------------------
+
+TaskThread::TaskThread( TaskRequestQueue* queue, TaskService* service ) :
 _queue( queue ),
-_done( false )
+_service( service ),
+_done( false ),
+_startTick( osg::Timer::instance()->tick() ),
+_busyTime( 0.0 )
 {
     //nop
 }
 
+double
+TaskThread::getUtilization() const
+{
+    double life = osg::Timer::instance()->delta_s( _startTick, osg::Timer::instance()->tick() );
+    return life > 0.0 ? osg::clampBetween( _busyTime/life, 0.0, 1.0 ) : 0.0;
+}
+
 void
 TaskThread::run()
 {
@@ -221,6 +580,8 @@ TaskThread::run()
             }
             
 
+            bool ran = false;
+
             // discard a completed or canceled request:
             if ( _request->getState() != TaskRequest::STATE_PENDING )
             {
@@ -234,6 +595,8 @@ TaskThread::run()
 
                 _request->setState( TaskRequest::STATE_IN_PROGRESS );
                 _request->run();
+                ran = true;
+                _busyTime += _request->runTime();
 
                 //OE_INFO << LC << "Task \"" << _request->getName() << "\" runtime = " << _request->runTime() << " s." << std::endl;
             }
@@ -244,6 +607,9 @@ TaskThread::run()
             
             _request->setState( TaskRequest::STATE_COMPLETED );
 
+            if ( _service )
+                _service->recordTask( _request.get(), ran );
+
             // signal the completion of a request.
             if ( _request->getProgressCallback() )
                 _request->getProgressCallback()->onCompleted();
@@ -277,13 +643,25 @@ TaskThread::cancel()
 
 //------------------------------------------------------------------------
 
-TaskService::TaskService( const std::string& name, int numThreads, unsigned int maxSize ):
+TaskService::TaskService( const std::string& name, int numThreads, unsigned int maxSize, Scheduler scheduler ):
 osg::Referenced( true ),
 _lastRemoveFinishedThreadsStamp(0),
 _name(name),
-_numThreads( 0 )
+_numThreads( 0 ),
+_scheduler( scheduler )
 {
-    _queue = new TaskRequestQueue( maxSize );
+    _metrics._name = name;
+
+    if ( _scheduler == SCHEDULER_WORK_STEALING )
+    {
+        unsigned numQueues = osg::maximum( numThreads, OpenThreads::GetNumberOfProcessors() );
+        _queue = new WorkStealingTaskRequestQueue( numQueues, maxSize );
+    }
+    else
+    {
+        _queue = new TaskRequestQueue( maxSize );
+    }
+
     setNumThreads( numThreads );
 }
 
@@ -347,6 +725,12 @@ void
 TaskService::setStamp( int stamp )
 {
     _queue->setStamp( stamp );
+
+    if ( _queue->getPriorityFunctor() || _queue->getMaxStampAge() > 0 )
+    {
+        reprioritize();
+    }
+
     //Remove finished threads every 60 frames
     if (stamp - _lastRemoveFinishedThreadsStamp > 60)
     {
@@ -355,6 +739,41 @@ TaskService::setStamp( int stamp )
     }
 }
 
+void
+TaskService::setPriorityFunctor( TaskRequestPriorityFunctor* functor )
+{
+    _queue->setPriorityFunctor( functor );
+}
+
+TaskRequestPriorityFunctor*
+TaskService::getPriorityFunctor() const
+{
+    return _queue->getPriorityFunctor();
+}
+
+void
+TaskService::setMaxStampAge( int frames )
+{
+    _queue->setMaxStampAge( frames );
+}
+
+int
+TaskService::getMaxStampAge() const
+{
+    return _queue->getMaxStampAge();
+}
+
+unsigned
+TaskService::reprioritize()
+{
+    unsigned numDropped = _queue->reprioritize();
+    if ( numDropped > 0 )
+    {
+        OE_DEBUG << LC << "TaskService [" << _name << "] dropped " << numDropped << " stale requests" << std::endl;
+    }
+    return numDropped;
+}
+
 int
 TaskService::getNumThreads() const
 {
@@ -389,7 +808,7 @@ TaskService::adjustThreadCount()
         //We need to add some threads
         for (int i = 0; i < diff; ++i)
         {
-            TaskThread* thread = new TaskThread( _queue.get() );
+            TaskThread* thread = new TaskThread( _queue.get(), this );
             _threads.push_back( thread );
             thread->start();
         }       
@@ -438,6 +857,51 @@ TaskService::removeFinishedThreads()
     }
 }
 
+void
+TaskService::recordTask( const TaskRequest* request, bool ran )
+{
+    Threading::ScopedMutexLock lock( _metricsMutex );
+    if ( ran )
+    {
+        const osg::Timer* timer = osg::Timer::instance();
+        _metrics._waitTime.add( timer->delta_s(request->enqueueTime(), request->startTime()) );
+        _metrics._runTime.add( request->runTime() );
+        _metrics._numCompleted++;
+    }
+    else
+    {
+        _metrics._numCanceled++;
+    }
+}
+
+void
+TaskService::getMetrics( TaskServiceMetrics& output ) const
+{
+    {
+        Threading::ScopedMutexLock lock( _metricsMutex );
+        output = _metrics;
+    }
+
+    output._name = _name;
+    output._queueDepth = getNumRequests();
+    output._threadUtilization.clear();
+
+    OpenThreads::ScopedLock<OpenThreads::ReentrantMutex> lock( const_cast<TaskService*>(this)->_threadMutex );
+    for( TaskThreads::const_iterator i = _threads.begin(); i != _threads.end(); ++i )
+    {
+        if ( !(*i)->getDone() )
+            output._threadUtilization.push_back( (*i)->getUtilization() );
+    }
+}
+
+void
+TaskService::resetMetrics()
+{
+    Threading::ScopedMutexLock lock( _metricsMutex );
+    _metrics = TaskServiceMetrics();
+    _metrics._name = _name;
+}
+
 void
 TaskService::cancelAll()
 {
@@ -452,6 +916,75 @@ TaskService::cancelAll()
 
 //------------------------------------------------------------------------
 
+FutureState::FutureState() :
+osg::Referenced( true ),
+_resolved( false )
+{
+    //nop
+}
+
+void
+FutureState::wait()
+{
+    while( !_resolved )
+    {
+        _event.wait();
+    }
+}
+
+bool
+FutureState::resolve( osg::Referenced* value )
+{
+    std::vector< osg::ref_ptr<Callback> > callbacks;
+    {
+        ScopedLock<Mutex> lock( _mutex );
+        if ( _resolved )
+            return false;
+
+        _value = value;
+        _resolved = true;
+        callbacks.swap( _callbacks );
+    }
+
+    _event.set();
+
+    // fire the callbacks outside the lock, since they may well schedule more work.
+    for( std::vector< osg::ref_ptr<Callback> >::iterator i = callbacks.begin(); i != callbacks.end(); ++i )
+    {
+        (*i)->onResolved( value );
+    }
+
+    return true;
+}
+
+void
+FutureState::addCallback( Callback* callback )
+{
+    osg::ref_ptr<Callback> cb = callback;
+    {
+        ScopedLock<Mutex> lock( _mutex );
+        if ( !_resolved )
+        {
+            _callbacks.push_back( cb.get() );
+            return;
+        }
+    }
+
+    cb->onResolved( _value.get() );
+}
+
+void
+Threading::ScheduleTaskCallback::onResolved( osg::Referenced* value )
+{
+    if ( _service.valid() && _task.valid() )
+    {
+        _service->add( _task.get() );
+    }
+    _task = 0L;
+}
+
+//------------------------------------------------------------------------
+
 TaskServiceManager::TaskServiceManager( int numThreads ) :
 _numThreads( 0 ),
 _targetNumThreads( numThreads )
@@ -549,6 +1082,16 @@ TaskServiceManager::setWeight( TaskService* service, float weight )
     }    
 }
 
+void
+TaskServiceManager::getTaskServices( std::vector< osg::ref_ptr<TaskService> >& output ) const
+{
+    ScopedLock<Mutex> lock( const_cast<TaskServiceManager*>(this)->_taskServiceMgrMutex );
+    for( TaskServiceMap::const_iterator i = _services.begin(); i != _services.end(); ++i )
+    {
+        output.push_back( i->second.first.get() );
+    }
+}
+
 void
 TaskServiceManager::reallocate( int numThreads )
 {
@@ -19,6 +19,7 @@
 #include <osgEarth/TerrainEngineNode>
 #include <osgEarth/Capabilities>
 #include <osgEarth/CullingUtils>
+#include <osgEarth/FrameStats>
 #include <osgEarth/Registry>
 #include <osgEarth/TextureCompositor>
 #include <osgEarth/NodeUtils>
@@ -120,6 +121,8 @@ _requireParentTextures   ( false )
 {
     // register for event traversals so we can properly reset the dirtyCount
     ADJUST_EVENT_TRAV_COUNT( this, 1 );
+
+    _residency = new TileResidencyManager();
 }
 
 
@@ -196,6 +199,20 @@ TerrainEngineNode::preInitialize( const Map* map, const TerrainOptions& options
     osg::StateSet* set = getOrCreateStateSet();
     set->setMode( GL_CULL_FACE, 1 );
 
+    // memory budgets for the resident tiles; the residency manager needs
+    // update traversals to enforce them.
+    _residency->setBudgets(
+        options.tileRAMBudget().get()  * 1024u * 1024u,
+        options.tileVRAMBudget().get() * 1024u * 1024u );
+
+    if ( _residency->isEnabled() )
+    {
+        ADJUST_UPDATE_TRAV_COUNT( this, 1 );
+        OE_INFO << LC << "Tile memory budget: "
+            << options.tileRAMBudget().get() << " MB RAM, "
+            << options.tileVRAMBudget().get() << " MB VRAM (0 = no limit)" << std::endl;
+    }
+
     if ( options.enableMercatorFastPath().isSet() )
     {
         OE_INFO 
@@ -291,6 +308,8 @@ namespace
 void
 TerrainEngineNode::traverse( osg::NodeVisitor& nv )
 {
+    FrameStats::CullTimer cullTimer( nv, FrameStats::CULL_TERRAIN );
+
     if ( nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR )
     {
         // see if we need to set up the Terrain object with an update ops queue.
@@ -323,6 +342,17 @@ TerrainEngineNode::traverse( osg::NodeVisitor& nv )
         _dirtyCount = 0;
     }
 
+    else if ( nv.getVisitorType() == osg::NodeVisitor::UPDATE_VISITOR )
+    {
+        if ( _residency->isEnabled() && nv.getFrameStamp() )
+        {
+            std::vector<TileKey> parentKeys;
+            _residency->update( nv.getFrameStamp()->getFrameNumber(), parentKeys );
+            if ( !parentKeys.empty() )
+                onEvictTiles( parentKeys );
+        }
+    }
+
     osg::CoordinateSystemNode::traverse( nv );
 }
 
@@ -24,8 +24,10 @@
 #include <osgEarth/URI>
 #include <osgEarth/MemCache>
 #include <osgEarth/CacheBin>
+#include <osgEarth/WriteBehindCacheBin>
 #include <osgDB/WriteFile>
 #include <osg/Version>
+#include <osg/Timer>
 #include <OpenThreads/ScopedLock>
 #include <memory.h>
 
@@ -34,6 +36,22 @@ using namespace OpenThreads;
 
 #define LC "[TerrainLayer] \"" << getName() << "\": "
 
+namespace
+{
+    // Optional memory cap on an l2 cache, in megabytes.
+    void applyL2CacheLimits( MemCache* memCache )
+    {
+        char const* l2mbEnv = ::getenv( "OSGEARTH_L2_CACHE_MAX_MB" );
+        if ( l2mbEnv )
+        {
+            memCache->setMaxSizeInBytes( (size_t)(as<double>( std::string(l2mbEnv), 0.0 ) * 1048576.0) );
+        }
+    }
+
+    // cache bin record holding the tile source blacklist between sessions.
+    const std::string BLACKLIST_CACHE_KEY = "_blacklist";
+}
+
 //------------------------------------------------------------------------
 
 TerrainLayerOptions::TerrainLayerOptions( const ConfigOptions& options ) :
@@ -170,6 +188,8 @@ TerrainLayer::~TerrainLayer()
 {
     if ( _cache.valid() )
     {
+        storeBlacklist();
+
         Threading::ScopedWriteLock exclusive( _cacheBinsMutex );
         for( CacheBinInfoMap::iterator i = _cacheBins.begin(); i != _cacheBins.end(); ++i )
         {
@@ -188,6 +208,7 @@ TerrainLayer::init()
     _tileSourceInitAttempted = false;
     _tileSourceInitFailed    = false;
     _tileSize                = 256;
+    _timeToReady             = -1.0;
     _dbOptions               = Registry::instance()->cloneOrCreateOptions();
     
     initializeCachePolicy( _dbOptions.get() );
@@ -205,13 +226,46 @@ TerrainLayer::init()
         OE_INFO << LC << "L2 cache size set from environment = " << l2CacheSize << "\n";
     }
 
+    _l2CacheSize = (unsigned)osg::maximum( l2CacheSize, 0 );
+
     // Initialize the l2 cache if it's size is > 0
     if ( l2CacheSize > 0 )
     {
         _memCache = new MemCache( l2CacheSize );
+        applyL2CacheLimits( _memCache.get() );
     }
 }
 
+void
+TerrainLayer::shareMemCache( const std::string& layerType )
+{
+    // a layer built around a programmatic tile source can't be identified
+    // by its configuration, so it keeps its private cache.
+    if ( !_memCache.valid() || _tileSource.valid() )
+        return;
+
+    // hash everything that affects the tile data, and nothing else.
+    Config layerConf = _runtimeOptions->getConfig( true );
+    layerConf.remove( "name" );
+    layerConf.remove( "visible" );
+    layerConf.remove( "opacity" );
+    layerConf.remove( "cache_only" );
+    layerConf.remove( "cache_enabled" );
+    layerConf.remove( "cache_policy" );
+    layerConf.remove( "cacheid" );
+
+    Config driverConf = _runtimeOptions->driver()->getConfig();
+    driverConf.remove( "l2_cache_size" );
+
+    std::string key = Stringify()
+        << layerType << "_"
+        << std::hex << osgEarth::hashString(layerConf.toJSON()) << "_"
+        << osgEarth::hashString(driverConf.toJSON());
+
+    _memCache = MemCache::getOrCreateShared( key, _l2CacheSize );
+    applyL2CacheLimits( _memCache.get() );
+}
+
 void
 TerrainLayer::setCache( Cache* cache )
 {
@@ -348,6 +402,8 @@ TerrainLayer::getTileSource() const
         {
             TerrainLayer* this_nc = const_cast<TerrainLayer*>(this);
 
+            osg::Timer_t start = osg::Timer::instance()->tick();
+
             // Initialize the tile source once.
             this_nc->initTileSource();
 
@@ -372,6 +428,9 @@ TerrainLayer::getTileSource() const
                 }
                 OE_INFO << LC << "cache policy = " << getCachePolicy().usageString() << std::endl;
             }
+
+            this_nc->_timeToReady = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+            OE_INFO << LC << "ready in " << _timeToReady << " s" << std::endl;
         }
     }
 
@@ -409,6 +468,20 @@ TerrainLayer::isDynamic() const
     return ts ? ts->isDynamic() : false;
 }
 
+void
+TerrainLayer::limitMemCache( size_t maxBytes, float heightFieldPrecision )
+{
+    if ( !_memCache.valid() )
+        return;
+
+    size_t current = _memCache->getMaxSizeInBytes();
+    if ( maxBytes > 0 && (current == 0 || maxBytes < current) )
+        _memCache->setMaxSizeInBytes( maxBytes );
+
+    if ( heightFieldPrecision > 0.0f && _memCache->getHeightFieldPrecision() < heightFieldPrecision )
+        _memCache->setHeightFieldPrecision( heightFieldPrecision );
+}
+
 CacheBin*
 TerrainLayer::getCacheBin(const Profile* profile)
 {
@@ -535,6 +608,13 @@ TerrainLayer::getCacheBin(const Profile* profile, const std::string& binId)
                 }
             }
 
+            // optionally queue writes so they don't stall the paging threads.
+            const CacheOptions& cacheOptions = _cache->getCacheOptions();
+            if ( cacheOptions.writeBehind() == true )
+            {
+                newBin = new WriteBehindCacheBin( newBin.get(), *cacheOptions.writeBehindQueueSize() );
+            }
+
             // store the bin.
             CacheBinInfo& newInfo = _cacheBins[binId];
             newInfo._metadata = meta;
@@ -543,6 +623,13 @@ TerrainLayer::getCacheBin(const Profile* profile, const std::string& binId)
             OE_INFO << LC <<
                 "Opened cache bin [" << binId << "]" << std::endl;
 
+            // The bin in the layer's own profile carries the tile source's
+            // blacklist from previous sessions.
+            if ( tileSource && getProfile() && profile->isHorizEquivalentTo(getProfile()) )
+            {
+                loadBlacklist( newBin.get() );
+            }
+
             // If we loaded a profile from the cache metadata, apply the overrides:
             applyProfileOverrides();
         }
@@ -557,6 +644,53 @@ TerrainLayer::getCacheBin(const Profile* profile, const std::string& binId)
     }
 }
 
+void
+TerrainLayer::loadBlacklist( CacheBin* bin )
+{
+    // caller holds the cache bins lock.
+    if ( !getCachePolicy().isCacheReadable() )
+        return;
+
+    ReadResult rr = bin->readString( BLACKLIST_CACHE_KEY );
+    if ( !rr.succeeded() || getCachePolicy().isExpired(rr.lastModifiedTime()) )
+        return;
+
+    std::istringstream in( rr.getString() );
+    osg::ref_ptr<TileBlacklist> stored = TileBlacklist::read( in );
+    if ( stored.valid() && stored->size() > 0 )
+    {
+        // merging leaves the blacklist dirty, but the union is what we want
+        // to write back anyway.
+        _tileSource->getBlacklist()->merge( *stored.get() );
+        OE_INFO << LC << "Read " << stored->size() << " blacklisted tiles from the cache" << std::endl;
+    }
+}
+
+void
+TerrainLayer::storeBlacklist()
+{
+    if ( !_tileSource.valid() || !_profile.valid() || !_tileSource->getBlacklist()->isDirty() )
+        return;
+
+    if ( !getCachePolicy().isCacheWriteable() )
+        return;
+
+    std::string binId = *_runtimeOptions->cacheId() + std::string("_") + _profile->getFullSignature();
+
+    Threading::ScopedReadLock shared( _cacheBinsMutex );
+    CacheBinInfoMap::iterator i = _cacheBins.find( binId );
+    if ( i != _cacheBins.end() && i->second._bin.valid() )
+    {
+        std::stringstream buf;
+        _tileSource->getBlacklist()->write( buf );
+
+        osg::ref_ptr<StringObject> so = new StringObject();
+        so->setString( buf.str() );
+        i->second._bin->write( BLACKLIST_CACHE_KEY, so.get() );
+        OE_DEBUG << LC << "Wrote blacklist to cache bin [" << binId << "]" << std::endl;
+    }
+}
+
 bool
 TerrainLayer::getCacheBinMetadata( const Profile* profile, CacheBinMetadata& output )
 {
@@ -48,7 +48,12 @@ _magFilter( osg::Texture::LINEAR),
 _primaryTraversalMask  ( 0xFFFFFFFF ),
 _secondaryTraversalMask( 0x80000000 ),
 _minNormalMapLOD( 0u ),
-_debug( false )
+_debug( false ),
+_tileRAMBudget( 0u ),
+_tileVRAMBudget( 0u ),
+_compactVertices( false ),
+_compactTextures( false ),
+_lowMemory( false )
 {
     fromConfig( _conf );
 }
@@ -82,6 +87,11 @@ TerrainOptions::getConfig() const
     conf.updateIfSet( "secondary_traversal_mask", _secondaryTraversalMask );
     conf.updateIfSet( "min_normal_map_lod", _minNormalMapLOD );
     conf.updateIfSet( "debug", _debug );
+    conf.updateIfSet( "tile_ram_budget_mb", _tileRAMBudget );
+    conf.updateIfSet( "tile_vram_budget_mb", _tileVRAMBudget );
+    conf.updateIfSet( "compact_vertices", _compactVertices );
+    conf.updateIfSet( "compact_textures", _compactTextures );
+    conf.updateIfSet( "low_memory", _lowMemory );
 
     //Save the filter settings
 	conf.updateIfSet("mag_filter","LINEAR",                _magFilter,osg::Texture::LINEAR);
@@ -126,6 +136,22 @@ TerrainOptions::fromConfig( const Config& conf )
     conf.getIfSet( "secondary_traversal_mask", _secondaryTraversalMask );
     conf.getIfSet( "min_normal_map_lod", _minNormalMapLOD );
     conf.getIfSet( "debug", _debug );
+    conf.getIfSet( "tile_ram_budget_mb", _tileRAMBudget );
+    conf.getIfSet( "tile_vram_budget_mb", _tileVRAMBudget );
+    conf.getIfSet( "compact_vertices", _compactVertices );
+    conf.getIfSet( "compact_textures", _compactTextures );
+    conf.getIfSet( "low_memory", _lowMemory );
+
+    // the low-memory profile only changes the defaults, so anything set
+    // explicitly still wins (and the profile isn't written back out).
+    if ( _lowMemory == true )
+    {
+        if ( !_tileSize.isSet() )        _tileSize.init( 9 );
+        if ( !_tileRAMBudget.isSet() )   _tileRAMBudget.init( 128u );
+        if ( !_tileVRAMBudget.isSet() )  _tileVRAMBudget.init( 96u );
+        if ( !_compactVertices.isSet() ) _compactVertices.init( true );
+        if ( !_compactTextures.isSet() ) _compactTextures.init( true );
+    }
 
     //Load the filter settings
 	conf.getIfSet("mag_filter","LINEAR",                _magFilter,osg::Texture::LINEAR);
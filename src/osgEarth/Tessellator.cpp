@@ -220,103 +220,91 @@ Tessellator::tessellatePrimitive(osg::PrimitiveSet* primitive, osg::Vec3Array* v
     return 0L;
 }
 
+
 osg::PrimitiveSet*
 Tessellator::tessellatePrimitive(unsigned int first, unsigned int last, osg::Vec3Array* vertices)
 {
-    std::vector<unsigned int> activeVerts;
-    activeVerts.reserve( last-first+1 );
-    for (unsigned int i=first; i < last; i++)
+    // degenerate rings produce no triangles
+    if ( last <= first || last - first < 3 )
+        return new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES, 0);
+
+    // Build the active ring. Indices are relative to "first" so the scratch
+    // buffers only ever grow to the size of the largest ring we've seen.
+    unsigned int count = last - first;
+    _prev.resize( count );
+    _next.resize( count );
+    for (unsigned int i=0; i < count; i++)
     {
-        activeVerts.push_back(i);
+        _prev[i] = i == 0 ? count - 1 : i - 1;
+        _next[i] = i == count - 1 ? 0 : i + 1;
     }
 
-    TriList tris;
-    tris.reserve( activeVerts.size() );
+    // an n-gon always produces n-2 triangles, so size the output once.
+    osg::ref_ptr<osg::DrawElementsUInt> triElements = new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES, 0);
+    triElements->reserve( (count - 2) * 3 );
 
     bool success = true;
     unsigned int cursor = 0;
     unsigned int cursor_start = 0;
     unsigned int tradCursor = UINT_MAX;
-    while (activeVerts.size() > 3)
+    while (count > 3)
     {
-        if (isConvex(*vertices, activeVerts, cursor))
+        unsigned int ear = UINT_MAX;
+
+        if (isConvex(*vertices, first, cursor))
         {
             bool tradEar = tradCursor != UINT_MAX;
-            if (isEar(*vertices, activeVerts, cursor, tradEar))
+            if (isEar(*vertices, first, cursor, tradEar))
             {
-                unsigned int prev = cursor == 0 ? activeVerts.size() - 1 : cursor - 1;
-                unsigned int next = cursor == activeVerts.size() - 1 ? 0 : cursor + 1;
-
-                tris.push_back(TriIndices(activeVerts[prev], activeVerts[cursor], activeVerts[next]));
-              
-                activeVerts.erase(activeVerts.begin() + cursor);
-                if (cursor >= activeVerts.size())
-                    cursor = 0;
-
-                cursor_start = cursor;
-                tradCursor = UINT_MAX;
-
-                continue;
+                ear = cursor;
             }
-            
-            if (tradEar && tradCursor == UINT_MAX)
+            else if (tradEar && tradCursor == UINT_MAX)
             {
                 tradCursor = cursor;
             }
         }
 
-        cursor++;
-        if (cursor >= activeVerts.size())
-            cursor = 0;
-
-        if (cursor == cursor_start)
+        if (ear == UINT_MAX)
         {
-            if (tradCursor != UINT_MAX)
-            {
-                // No ear was found with circumcircle test, use first traditional ear found
-
-                cursor = tradCursor;
-
-                unsigned int prev = cursor == 0 ? activeVerts.size() - 1 : cursor - 1;
-                unsigned int next = cursor == activeVerts.size() - 1 ? 0 : cursor + 1;
-
-                tris.push_back(TriIndices(activeVerts[prev], activeVerts[cursor], activeVerts[next]));
-                  
-                activeVerts.erase(activeVerts.begin() + cursor);
-                if (cursor >= activeVerts.size())
-                    cursor = 0;
-
-                cursor_start = cursor;
-                tradCursor = UINT_MAX;
-
+            cursor = _next[cursor];
+            if (cursor != cursor_start)
                 continue;
-            }
-            else
+
+            if (tradCursor == UINT_MAX)
             {
                 success = false;
                 break;
             }
+
+            // No ear was found with circumcircle test, use first traditional ear found
+            ear = tradCursor;
         }
+
+        // clip the ear and unlink it from the ring.
+        unsigned int prev = _prev[ear];
+        unsigned int next = _next[ear];
+
+        triElements->push_back(first + prev);
+        triElements->push_back(first + ear);
+        triElements->push_back(first + next);
+
+        _next[prev] = next;
+        _prev[next] = prev;
+        --count;
+
+        cursor = next;
+        cursor_start = cursor;
+        tradCursor = UINT_MAX;
     }
 
     if (success)
     {
-        if (activeVerts.size() == 3)
-        {
-            // add last tri
-            tris.push_back(TriIndices(activeVerts[0], activeVerts[1], activeVerts[2]));
-        }
+        // add last tri
+        triElements->push_back(first + _prev[cursor]);
+        triElements->push_back(first + cursor);
+        triElements->push_back(first + _next[cursor]);
 
-        osg::DrawElementsUInt* triElements = new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES, 0);
-        triElements->reserve( tris.size() * 3 );
-        for (TriList::const_iterator it = tris.begin(); it != tris.end(); ++it)
-        {
-            triElements->push_back(it->a);
-            triElements->push_back(it->b);
-            triElements->push_back(it->c);
-        }
-
-        return triElements;
+        return triElements.release();
     }
     else
     {
@@ -329,73 +317,62 @@ Tessellator::tessellatePrimitive(unsigned int first, unsigned int last, osg::Vec
 
 
 bool
-Tessellator::isConvex(const osg::Vec3Array &vertices, const std::vector<unsigned int> &activeVerts, unsigned int cursor)
+Tessellator::isConvex(const osg::Vec3Array &vertices, unsigned int first, unsigned int cursor) const
 {
-    unsigned int prev = cursor == 0 ? activeVerts.size() - 1 : cursor - 1;
-    unsigned int next = cursor == activeVerts.size() - 1 ? 0 : cursor + 1;
-
-    unsigned int a = activeVerts[prev];
-    unsigned int b = activeVerts[cursor];
-    unsigned int c = activeVerts[next];
-
-    osg::Vec3d dataA;
-    dataA._v[0] = vertices[a][0];
-    dataA._v[1] = vertices[a][1];
-    dataA._v[2] = vertices[a][2];
-
-    osg::Vec3d dataB;
-    dataB._v[0] = vertices[b][0];
-    dataB._v[1] = vertices[b][1];
-    dataB._v[2] = vertices[b][2];
-
-    osg::Vec3d dataC;
-    dataC._v[0] = vertices[c][0];
-    dataC._v[1] = vertices[c][1];
-    dataC._v[2] = vertices[c][2];
+    const osg::Vec3& a = vertices[first + _prev[cursor]];
+    const osg::Vec3& b = vertices[first + cursor];
+    const osg::Vec3& c = vertices[first + _next[cursor]];
 
     //http://www.gamedev.net/topic/542870-determine-which-side-of-a-line-a-point-is/#entry4500667
     //(Bx - Ax) * (Cy - Ay) - (By - Ay) * (Cx - Ax)
 
-    return (dataB.x() - dataA.x()) * (dataC.y() - dataA.y()) - (dataB.y() - dataA.y()) * (dataC.x() - dataA.x()) > 0.0;
+    return ((double)b.x() - (double)a.x()) * ((double)c.y() - (double)a.y()) -
+           ((double)b.y() - (double)a.y()) * ((double)c.x() - (double)a.x()) > 0.0;
 }
 
 bool
-Tessellator::isEar(const osg::Vec3Array &vertices, const std::vector<unsigned int> &activeVerts, unsigned int cursor, bool &tradEar)
+Tessellator::isEar(const osg::Vec3Array &vertices, unsigned int first, unsigned int cursor, bool &tradEar) const
 {
-    unsigned int prev = cursor == 0 ? activeVerts.size() - 1 : cursor - 1;
-    unsigned int next = cursor == activeVerts.size() - 1 ? 0 : cursor + 1;
+    unsigned int prev = _prev[cursor];
+    unsigned int next = _next[cursor];
+
+    const osg::Vec3& a = vertices[first + prev];
+    const osg::Vec3& b = vertices[first + cursor];
+    const osg::Vec3& c = vertices[first + next];
 
-    osg::Vec3d cc(compute_circumcircle(vertices[activeVerts[prev]], vertices[activeVerts[cursor]], vertices[activeVerts[next]]));
+    osg::Vec3d cc(compute_circumcircle(a, b, c));
 
-    unsigned int nextNext = next == activeVerts.size() - 1 ? 0 : next + 1;
+    // The candidate is strictly convex (see isConvex), so any point inside
+    // the triangle is also inside its bounding box; use that as a cheap
+    // rejection before the orientation tests.
+    double xmin = osg::minimum(a.x(), osg::minimum(b.x(), c.x()));
+    double xmax = osg::maximum(a.x(), osg::maximum(b.x(), c.x()));
+    double ymin = osg::minimum(a.y(), osg::minimum(b.y(), c.y()));
+    double ymax = osg::maximum(a.y(), osg::maximum(b.y(), c.y()));
 
-		// Check every point not part of the ear
+    // Check every point not part of the ear
     bool circEar = true;
-		while( nextNext != prev )
-		{
-        unsigned int p = activeVerts[nextNext];
+    for (unsigned int i = _next[next]; i != prev; i = _next[i])
+    {
+        const osg::Vec3& p = vertices[first + i];
 
-        if (circEar && point_in_circle(vertices[p], cc))
+        if (circEar && point_in_circle(p, cc))
         {
             circEar = false;
 
             if (tradEar)
-              return false;
+                return false;
         }
 
         if (!tradEar &&
-            point_in_tri(vertices[p].x(), vertices[p].y(),
-                         vertices[activeVerts[prev]].x(), vertices[activeVerts[prev]].y(),
-                         vertices[activeVerts[cursor]].x(), vertices[activeVerts[cursor]].y(),
-                         vertices[activeVerts[next]].x(), vertices[activeVerts[next]].y()))
-			  {
+            p.x() >= xmin && p.x() <= xmax && p.y() >= ymin && p.y() <= ymax &&
+            point_in_tri(p.x(), p.y(), a.x(), a.y(), b.x(), b.y(), c.x(), c.y()))
+        {
             return false;
-			  }
-
-			  nextNext = nextNext == activeVerts.size() - 1 ? 0 : nextNext + 1;
-		}
+        }
+    }
 
     tradEar = true;
 
-		return circEar;
-}
\ No newline at end of file
+    return circEar;
+}
@@ -28,6 +28,24 @@ TileKey TileKey::INVALID( 0, 0, 0, 0L );
 
 //------------------------------------------------------------------------
 
+namespace
+{
+    // Writes the decimal digits of a value at p and returns the end.
+    char* writeUnsigned(char* p, unsigned value)
+    {
+        char digits[10];
+        int n = 0;
+        do {
+            digits[n++] = (char)('0' + value % 10u);
+            value /= 10u;
+        } while( value > 0u );
+
+        while( n > 0 )
+            *p++ = digits[--n];
+        return p;
+    }
+}
+
 TileKey::TileKey(unsigned int lod, unsigned int tile_x, unsigned int tile_y, const Profile* profile)
 {
     _x = tile_x;
@@ -35,19 +53,22 @@ TileKey::TileKey(unsigned int lod, unsigned int tile_x, unsigned int tile_y, con
     _lod = lod;
     _profile = profile;
 
-    double width, height;
     if ( _profile.valid() )
     {
-        _profile->getTileDimensions(lod, width, height);
-
-        double xmin = _profile->getExtent().xMin() + (width * (double)_x);
-        double ymax = _profile->getExtent().yMax() - (height * (double)_y);
-        double xmax = xmin + width;
-        double ymin = ymax - height;
+        double xmin, ymin, xmax, ymax;
+        _profile->getTileBounds(lod, _x, _y, xmin, ymin, xmax, ymax);
 
         _extent = GeoExtent( _profile->getSRS(), xmin, ymin, xmax, ymax );
 
-        _key = Stringify() << _lod << "/" << _x << "/" << _y;
+        // "lod/x/y"; formatted by hand since keys are made far too often
+        // to pay for a stringstream each time.
+        char buf[34];
+        char* p = writeUnsigned(buf, _lod);
+        *p++ = '/';
+        p = writeUnsigned(p, _x);
+        *p++ = '/';
+        p = writeUnsigned(p, _y);
+        _key.assign(buf, p);
     }
     else
     {
@@ -0,0 +1,348 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarth/TileResidencyManager>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Texture>
+#include <osg/Shape>
+#include <osg/NodeVisitor>
+#include <algorithm>
+
+#define LC "[TileResidencyManager] "
+
+using namespace osgEarth;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // Adds the geometry and textures found in a subgraph to a Usage.
+    struct UsageVisitor : public osg::NodeVisitor
+    {
+        TileResidencyManager::Usage& _usage;
+
+        UsageVisitor(TileResidencyManager::Usage& usage) : _usage(usage)
+        {
+            setTraversalMode( TRAVERSE_ALL_CHILDREN );
+            setNodeMaskOverride( ~0 );
+        }
+
+        void apply(osg::Node& node)
+        {
+            _usage.add( node.getStateSet() );
+            traverse( node );
+        }
+
+        void apply(osg::Geode& geode)
+        {
+            _usage.add( geode.getStateSet() );
+            for( unsigned i=0; i<geode.getNumDrawables(); ++i )
+                _usage.add( geode.getDrawable(i) );
+            traverse( geode );
+        }
+    };
+
+    unsigned sizeOf(const osg::Array* array)
+    {
+        return array ? array->getTotalDataSize() : 0u;
+    }
+
+    // one family = the resident children of one tile, which page out together.
+    struct Family
+    {
+        Family() : _cpuBytes(0), _gpuBytes(0), _lastFrame(0), _protected(false) { }
+        TileKey  _parentKey;
+        unsigned _cpuBytes;
+        unsigned _gpuBytes;
+        unsigned _lastFrame;
+        bool     _protected;
+    };
+
+    bool olderThan(const Family* lhs, const Family* rhs)
+    {
+        return lhs->_lastFrame < rhs->_lastFrame;
+    }
+}
+
+//------------------------------------------------------------------------
+
+TileResidencyManager::Usage::Usage() :
+_cpuBytes( 0 ),
+_gpuBytes( 0 )
+{
+    //nop
+}
+
+bool
+TileResidencyManager::Usage::first(const osg::Referenced* obj)
+{
+    return obj && _counted.insert(obj).second;
+}
+
+void
+TileResidencyManager::Usage::add(const osg::Node* node)
+{
+    if ( first(node) )
+    {
+        UsageVisitor visitor( *this );
+        const_cast<osg::Node*>(node)->accept( visitor );
+    }
+}
+
+void
+TileResidencyManager::Usage::add(const osg::StateSet* stateSet)
+{
+    if ( !first(stateSet) )
+        return;
+
+    const osg::StateSet::TextureAttributeList& units = stateSet->getTextureAttributeList();
+    for( unsigned u=0; u<units.size(); ++u )
+    {
+        const osg::StateSet::AttributeList& attrs = units[u];
+        for( osg::StateSet::AttributeList::const_iterator i = attrs.begin(); i != attrs.end(); ++i )
+        {
+            const osg::StateAttribute* sa = i->second.first.get();
+            if ( sa )
+                add( sa->asTexture() );
+        }
+    }
+}
+
+void
+TileResidencyManager::Usage::add(const osg::Texture* texture)
+{
+    if ( !first(texture) )
+        return;
+
+    for( unsigned i=0; i<texture->getNumImages(); ++i )
+    {
+        const osg::Image* image = texture->getImage(i);
+        if ( first(image) )
+        {
+            unsigned bytes = image->getTotalSizeInBytesIncludingMipmaps();
+            _gpuBytes += bytes;
+            if ( !texture->getUnRefImageDataAfterApply() )
+                _cpuBytes += bytes;
+        }
+    }
+}
+
+void
+TileResidencyManager::Usage::add(const osg::HeightField* hf)
+{
+    if ( first(hf) )
+    {
+        _cpuBytes += hf->getNumColumns() * hf->getNumRows() * sizeof(float);
+    }
+}
+
+void
+TileResidencyManager::Usage::add(const osg::Referenced* owner, unsigned cpuBytes, unsigned gpuBytes)
+{
+    if ( first(owner) )
+    {
+        _cpuBytes += cpuBytes;
+        _gpuBytes += gpuBytes;
+    }
+}
+
+void
+TileResidencyManager::Usage::add(const osg::Drawable* drawable)
+{
+    if ( !first(drawable) )
+        return;
+
+    add( drawable->getStateSet() );
+
+    const osg::Geometry* geom = drawable->asGeometry();
+    if ( !geom )
+        return;
+
+    unsigned bytes =
+        sizeOf( geom->getVertexArray() ) +
+        sizeOf( geom->getNormalArray() ) +
+        sizeOf( geom->getColorArray() ) +
+        sizeOf( geom->getSecondaryColorArray() ) +
+        sizeOf( geom->getFogCoordArray() );
+
+    for( unsigned i=0; i<geom->getNumTexCoordArrays(); ++i )
+        bytes += sizeOf( geom->getTexCoordArray(i) );
+
+    for( unsigned i=0; i<geom->getNumVertexAttribArrays(); ++i )
+        bytes += sizeOf( geom->getVertexAttribArray(i) );
+
+    for( unsigned i=0; i<geom->getNumPrimitiveSets(); ++i )
+    {
+        // element buffers shared between tiles only count once.
+        const osg::PrimitiveSet* prim = geom->getPrimitiveSet(i);
+        if ( first(prim) )
+            bytes += prim->getTotalDataSize();
+    }
+
+    _cpuBytes += bytes;
+    if ( geom->getUseVertexBufferObjects() )
+        _gpuBytes += bytes;
+}
+
+//------------------------------------------------------------------------
+
+TileResidencyManager::Entry::Entry(const TileKey& key,
+                                   const Usage&   usage,
+                                   unsigned       frame) :
+_key      ( key ),
+_cpuBytes ( usage.getCPUBytes() ),
+_gpuBytes ( usage.getGPUBytes() ),
+_lastFrame( frame )
+{
+    //nop
+}
+
+//------------------------------------------------------------------------
+
+TileResidencyManager::TileResidencyManager() :
+_cpuTotal     ( 0 ),
+_gpuTotal     ( 0 ),
+_cpuBudget    ( 0 ),
+_gpuBudget    ( 0 ),
+_minIdleFrames( 30 ),
+_frame        ( 0 )
+{
+    //nop
+}
+
+void
+TileResidencyManager::setBudgets(unsigned cpuBytes, unsigned gpuBytes)
+{
+    _cpuBudget = cpuBytes;
+    _gpuBudget = gpuBytes;
+}
+
+TileResidencyManager::Entry*
+TileResidencyManager::add(const TileKey& key, const Usage& usage)
+{
+    Threading::ScopedMutexLock lock( _mutex );
+
+    // a new tile counts as just seen, so it isn't evicted before it's drawn.
+    osg::ref_ptr<Entry>& entry = _entries[key];
+    if ( entry.valid() )
+    {
+        _cpuTotal -= entry->_cpuBytes;
+        _gpuTotal -= entry->_gpuBytes;
+    }
+    entry = new Entry( key, usage, _frame );
+
+    _cpuTotal += entry->_cpuBytes;
+    _gpuTotal += entry->_gpuBytes;
+    return entry.get();
+}
+
+void
+TileResidencyManager::remove(const TileKey& key)
+{
+    Threading::ScopedMutexLock lock( _mutex );
+
+    EntryMap::iterator i = _entries.find( key );
+    if ( i != _entries.end() )
+    {
+        _cpuTotal -= i->second->_cpuBytes;
+        _gpuTotal -= i->second->_gpuBytes;
+        _entries.erase( i );
+    }
+}
+
+unsigned
+TileResidencyManager::size() const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    return _entries.size();
+}
+
+bool
+TileResidencyManager::isOverBudget(unsigned cpuBytes, unsigned gpuBytes) const
+{
+    return
+        (_cpuBudget > 0 && cpuBytes > _cpuBudget) ||
+        (_gpuBudget > 0 && gpuBytes > _gpuBudget);
+}
+
+void
+TileResidencyManager::update(unsigned frame, std::vector<TileKey>& out_parentKeys)
+{
+    Threading::ScopedMutexLock lock( _mutex );
+
+    _frame = frame;
+
+    if ( !isOverBudget(_cpuTotal, _gpuTotal) )
+        return;
+
+    // group the tiles by parent. A tile without a resident parent is a root
+    // tile, which the engine doesn't page, so it never leaves.
+    typedef std::map<TileKey, Family> FamilyMap;
+    FamilyMap families;
+
+    for( EntryMap::const_iterator i = _entries.begin(); i != _entries.end(); ++i )
+    {
+        const Entry* entry = i->second.get();
+        if ( entry->_key.getLOD() == 0 )
+            continue;
+
+        TileKey parentKey = entry->_key.createParentKey();
+        if ( _entries.find(parentKey) == _entries.end() )
+            continue;
+
+        Family& f = families[parentKey];
+        f._parentKey  = parentKey;
+        f._cpuBytes  += entry->_cpuBytes;
+        f._gpuBytes  += entry->_gpuBytes;
+        f._lastFrame  = std::max( f._lastFrame, (unsigned)entry->_lastFrame );
+    }
+
+    // a family with resident grandchildren would take them along; protect it
+    // until they go first.
+    for( FamilyMap::const_iterator i = families.begin(); i != families.end(); ++i )
+    {
+        if ( i->first.getLOD() == 0 )
+            continue;
+
+        FamilyMap::iterator parent = families.find( i->first.createParentKey() );
+        if ( parent != families.end() )
+            parent->second._protected = true;
+    }
+
+    std::vector<const Family*> candidates;
+    for( FamilyMap::const_iterator i = families.begin(); i != families.end(); ++i )
+    {
+        const Family& f = i->second;
+        if ( !f._protected && (int)frame - (int)f._lastFrame > (int)_minIdleFrames )
+            candidates.push_back( &f );
+    }
+
+    std::sort( candidates.begin(), candidates.end(), olderThan );
+
+    unsigned cpu = _cpuTotal, gpu = _gpuTotal;
+    for( unsigned i=0; i<candidates.size() && isOverBudget(cpu, gpu); ++i )
+    {
+        out_parentKeys.push_back( candidates[i]->_parentKey );
+        cpu -= candidates[i]->_cpuBytes;
+        gpu -= candidates[i]->_gpuBytes;
+    }
+
+    OE_DEBUG << LC << "Over budget (" << _cpuTotal << " RAM, " << _gpuTotal << " VRAM); evicting "
+        << out_parentKeys.size() << " of " << candidates.size() << " candidates" << std::endl;
+}
@@ -25,6 +25,8 @@
 #include <osgEarth/Registry>
 #include <osgEarth/ThreadingUtils>
 #include <osgEarth/MemCache>
+#include <osgEarth/Progress>
+#include <osgEarth/Profiler>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
 #include <osgDB/ReadFile>
@@ -39,24 +41,104 @@ using namespace osgEarth;
 
 //------------------------------------------------------------------------
 
-TileBlacklist::TileBlacklist()
+namespace
+{
+    // 2^20 bits (128K) with 3 probes keeps false positives around 1% up to
+    // ~100K blacklisted tiles. Past that the filter only gets less selective;
+    // contains() stays exact because a hit is always confirmed in the set.
+    const unsigned BLOOM_BITS   = 1u << 20;
+    const unsigned BLOOM_WORDS  = BLOOM_BITS / 32u;
+    const unsigned BLOOM_PROBES = 3u;
+
+    inline unsigned mixBits(unsigned h)
+    {
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        return h;
+    }
+
+    inline void bloomHashes(const PackedTileKey& tile, unsigned& h1, unsigned& h2)
+    {
+        h1 = (unsigned)tile.hash();
+        h2 = mixBits( h1 ^ 0x27d4eb2fu ) | 1u;
+    }
+}
+
+TileBlacklist::TileBlacklist() :
+_bloom( 0L ),
+_dirty( 0 )
 {
     //NOP
 }
 
+TileBlacklist::~TileBlacklist()
+{
+    delete [] static_cast<OpenThreads::Atomic*>(_bloom.get());
+}
+
+void
+TileBlacklist::addToBloom(const PackedTileKey& tile)
+{
+    // caller holds the write lock.
+    OpenThreads::Atomic* bits = static_cast<OpenThreads::Atomic*>(_bloom.get());
+    if ( !bits )
+    {
+        bits = new OpenThreads::Atomic[BLOOM_WORDS];
+        _bloom.assign( bits, 0L );
+    }
+
+    unsigned h1, h2;
+    bloomHashes( tile, h1, h2 );
+    for(unsigned i=0; i<BLOOM_PROBES; ++i)
+    {
+        unsigned bit = (h1 + i*h2) & (BLOOM_BITS-1);
+        bits[bit >> 5].OR( 1u << (bit & 31u) );
+    }
+}
+
+bool
+TileBlacklist::maybeInBloom(const PackedTileKey& tile) const
+{
+    const OpenThreads::Atomic* bits = static_cast<const OpenThreads::Atomic*>(_bloom.get());
+    if ( !bits )
+        return false;
+
+    unsigned h1, h2;
+    bloomHashes( tile, h1, h2 );
+    for(unsigned i=0; i<BLOOM_PROBES; ++i)
+    {
+        unsigned bit = (h1 + i*h2) & (BLOOM_BITS-1);
+        if ( ((unsigned)bits[bit >> 5] & (1u << (bit & 31u))) == 0u )
+            return false;
+    }
+    return true;
+}
+
 void
 TileBlacklist::add(const TileKey& key)
 {
+    // keys read from a file have no profile, so pack the fields directly.
+    PackedTileKey tile( key.getLOD(), key.getTileX(), key.getTileY() );
     Threading::ScopedWriteLock lock(_mutex);
-    _tiles.insert(key);
+    if ( _tiles.insert(tile).second )
+    {
+        addToBloom( tile );
+        _dirty.exchange( 1 );
+    }
     OE_DEBUG << "Added " << key.str() << " to blacklist" << std::endl;
 }
 
 void
 TileBlacklist::remove(const TileKey& key)
 {
+    // Bloom bits are shared and cannot be cleared; a stale hit just falls
+    // through to the exact set.
     Threading::ScopedWriteLock lock(_mutex);
-    _tiles.erase(key);
+    if ( _tiles.erase( PackedTileKey(key.getLOD(), key.getTileX(), key.getTileY()) ) > 0 )
+        _dirty.exchange( 1 );
     OE_DEBUG << "Removed " << key.str() << " from blacklist" << std::endl;
 }
 
@@ -65,14 +147,45 @@ TileBlacklist::clear()
 {
     Threading::ScopedWriteLock lock(_mutex);
     _tiles.clear();
+    OpenThreads::Atomic* bits = static_cast<OpenThreads::Atomic*>(_bloom.get());
+    if ( bits )
+    {
+        for(unsigned i=0; i<BLOOM_WORDS; ++i)
+            bits[i].exchange( 0u );
+    }
+    _dirty.exchange( 1 );
     OE_DEBUG << "Cleared blacklist" << std::endl;
 }
 
 bool
 TileBlacklist::contains(const TileKey& key) const
 {
+    PackedTileKey tile( key.getLOD(), key.getTileX(), key.getTileY() );
+
+    // lock-free fast path: most keys are not blacklisted.
+    if ( !maybeInBloom(tile) )
+        return false;
+
     Threading::ScopedReadLock lock(_mutex);
-    return _tiles.find(key) != _tiles.end();
+    return _tiles.find(tile) != _tiles.end();
+}
+
+void
+TileBlacklist::merge(const TileBlacklist& rhs)
+{
+    if ( &rhs == this )
+        return;
+
+    Threading::ScopedReadLock  readLock(rhs._mutex);
+    Threading::ScopedWriteLock writeLock(_mutex);
+    for (BlacklistedTiles::const_iterator itr = rhs._tiles.begin(); itr != rhs._tiles.end(); ++itr)
+    {
+        if ( _tiles.insert(*itr).second )
+        {
+            addToBloom( *itr );
+            _dirty.exchange( 1 );
+        }
+    }
 }
 
 unsigned int
@@ -102,6 +215,7 @@ TileBlacklist::read(std::istream &in)
         }
     }
 
+    result->_dirty.exchange( 0 );
     return result.release();
 }
 
@@ -137,6 +251,180 @@ TileBlacklist::write(std::ostream &output) const
     {
         output << itr->getLOD() << " " << itr->getTileX() << " " << itr->getTileY() << std::endl;
     }
+    _dirty.exchange( 0 );
+}
+
+//------------------------------------------------------------------------
+
+TileExistenceIndex::TileExistenceIndex() :
+_dirty( false )
+{
+    //NOP
+}
+
+void
+TileExistenceIndex::add(const TileKey& key)
+{
+    add( key.getLOD(), key.getTileX(), key.getTileY() );
+}
+
+void
+TileExistenceIndex::add(unsigned lod, unsigned x, unsigned y)
+{
+    Threading::ScopedWriteLock lock(_mutex);
+
+    if ( _levels.size() <= lod )
+        _levels.resize( lod+1 );
+
+    // Walk up the tree marking ancestors; stop as soon as one is already
+    // present since everything above it is then marked too.
+    for(int level = (int)lod; level >= 0; --level)
+    {
+        if ( !_levels[level].insert( TileXY(x, y) ).second )
+            break;
+        x >>= 1;
+        y >>= 1;
+    }
+
+    _dirty = true;
+}
+
+bool
+TileExistenceIndex::mayHaveData(const TileKey& key) const
+{
+    return mayHaveData( key.getLOD(), key.getTileX(), key.getTileY() );
+}
+
+bool
+TileExistenceIndex::mayHaveData(unsigned lod, unsigned x, unsigned y) const
+{
+    Threading::ScopedReadLock lock(_mutex);
+
+    if ( _levels.empty() )
+        return true;
+
+    // Past the deepest indexed level, test the ancestor at that level.
+    unsigned maxLevel = _levels.size()-1;
+    if ( lod > maxLevel )
+    {
+        x >>= (lod - maxLevel);
+        y >>= (lod - maxLevel);
+        lod = maxLevel;
+    }
+
+    const TileSet& tiles = _levels[lod];
+    return tiles.find( TileXY(x, y) ) != tiles.end();
+}
+
+void
+TileExistenceIndex::clear()
+{
+    Threading::ScopedWriteLock lock(_mutex);
+    _levels.clear();
+    _dirty = true;
+}
+
+bool
+TileExistenceIndex::empty() const
+{
+    Threading::ScopedReadLock lock(_mutex);
+    return _levels.empty();
+}
+
+unsigned int
+TileExistenceIndex::size() const
+{
+    Threading::ScopedReadLock lock(_mutex);
+    unsigned int count = 0;
+    for(LevelTiles::const_iterator i = _levels.begin(); i != _levels.end(); ++i)
+        count += i->size();
+    return count;
+}
+
+unsigned
+TileExistenceIndex::getMaxLevel() const
+{
+    Threading::ScopedReadLock lock(_mutex);
+    return _levels.empty() ? 0 : _levels.size()-1;
+}
+
+TileExistenceIndex*
+TileExistenceIndex::read(std::istream &in)
+{
+    osg::ref_ptr< TileExistenceIndex > result = new TileExistenceIndex();
+
+    while (!in.eof())
+    {
+        std::string line;
+        std::getline(in, line);
+        if (!line.empty())
+        {
+            unsigned z, x, y;
+            if (sscanf(line.c_str(), "%u %u %u", &z, &x, &y) == 3)
+            {
+                result->add(z, x, y);
+            }
+        }
+    }
+
+    result->_dirty = false;
+    return result.release();
+}
+
+TileExistenceIndex*
+TileExistenceIndex::read(const std::string &filename)
+{
+    if (osgDB::fileExists(filename) && (osgDB::fileType(filename) == osgDB::REGULAR_FILE))
+    {
+        std::ifstream in( filename.c_str() );
+        return read( in );
+    }
+    return NULL;
+}
+
+void
+TileExistenceIndex::write(const std::string &filename) const
+{
+    std::string path = osgDB::getFilePath(filename);
+    if (!path.empty() && !osgDB::fileExists(path) && !osgDB::makeDirectory(path))
+    {
+        OE_NOTICE << "Couldn't create path " << path << std::endl;
+        return;
+    }
+    std::ofstream out(filename.c_str());
+    write(out);
+}
+
+void
+TileExistenceIndex::write(std::ostream &output) const
+{
+    Threading::ScopedReadLock lock(_mutex);
+
+    // Ancestors are implied on read, so only write the tiles that have
+    // no indexed children.
+    for(unsigned lod = 0; lod < _levels.size(); ++lod)
+    {
+        const TileSet& tiles = _levels[lod];
+        const TileSet* children = lod+1 < _levels.size() ? &_levels[lod+1] : 0L;
+
+        for(TileSet::const_iterator i = tiles.begin(); i != tiles.end(); ++i)
+        {
+            if ( children )
+            {
+                unsigned cx = i->first << 1, cy = i->second << 1;
+                if (children->find(TileXY(cx,   cy  )) != children->end() ||
+                    children->find(TileXY(cx+1, cy  )) != children->end() ||
+                    children->find(TileXY(cx,   cy+1)) != children->end() ||
+                    children->find(TileXY(cx+1, cy+1)) != children->end())
+                {
+                    continue;
+                }
+            }
+            output << lod << " " << i->first << " " << i->second << std::endl;
+        }
+    }
+
+    _dirty = false;
 }
 
 
@@ -167,6 +455,7 @@ TileSourceOptions::getConfig() const
     conf.updateIfSet( "max_valid_value", _maxValidValue );
     conf.updateIfSet( "nodata_max", _maxValidValue ); // backcompat
     conf.updateIfSet( "blacklist_filename", _blacklistFilename);
+    conf.updateIfSet( "tile_index_filename", _tileIndexFilename);
     conf.updateIfSet( "l2_cache_size", _L2CacheSize );
     conf.updateIfSet( "bilinear_reprojection", _bilinearReprojection );
     conf.updateIfSet( "max_data_level", _maxDataLevel );
@@ -191,6 +480,7 @@ TileSourceOptions::fromConfig( const Config& conf )
     conf.getIfSet( "nodata_min", _minValidValue );
     conf.getIfSet( "nodata_max", _maxValidValue );
     conf.getIfSet( "blacklist_filename", _blacklistFilename);
+    conf.getIfSet( "tile_index_filename", _tileIndexFilename);
     conf.getIfSet( "l2_cache_size", _L2CacheSize );
     conf.getIfSet( "bilinear_reprojection", _bilinearReprojection );
     conf.getIfSet( "max_data_level", _maxDataLevel );
@@ -232,6 +522,13 @@ _mode   ( 0 )
     if ( l2CacheSize > 0 )
     {
         _memCache = new MemCache( l2CacheSize );
+
+        // Optional memory cap on the l2 cache, in megabytes.
+        char const* l2mbEnv = ::getenv( "OSGEARTH_L2_CACHE_MAX_MB" );
+        if ( l2mbEnv )
+        {
+            _memCache->setMaxSizeInBytes( (size_t)(as<double>( std::string(l2mbEnv), 0.0 ) * 1048576.0) );
+        }
     }
 
     if (_options.blacklistFilename().isSet())
@@ -254,6 +551,16 @@ _mode   ( 0 )
         //Initialize the blacklist if we couldn't read it.
         _blacklist = new TileBlacklist();
     }
+
+    if (_options.tileIndexFilename().isSet())
+    {
+        _tileIndex = TileExistenceIndex::read(_options.tileIndexFilename().value());
+        if (_tileIndex.valid())
+        {
+            OE_INFO << LC << "Read tile index (" << _tileIndex->size() << " tiles) from file "
+                << _options.tileIndexFilename().value() << std::endl;
+        }
+    }
 }
 
 TileSource::~TileSource()
@@ -262,6 +569,11 @@ TileSource::~TileSource()
     {
         _blacklist->write(_blacklistFilename);
     }
+
+    if (_tileIndex.valid() && _tileIndex->isDirty() && _options.tileIndexFilename().isSet())
+    {
+        _tileIndex->write(_options.tileIndexFilename().value());
+    }
 }
 
 void
@@ -353,6 +665,8 @@ TileSource::createImage(const TileKey&        key,
     if ( _status != STATUS_OK )
         return 0L;
 
+    OE_PROFILING_ZONE("TileSource::createImage");
+
     // Try to get it from the memcache fist
     if (_memCache.valid())
     {
@@ -383,6 +697,8 @@ TileSource::createHeightField(const TileKey&        key,
     if ( _status != STATUS_OK )
         return 0L;
 
+    OE_PROFILING_ZONE("TileSource::createHeightField");
+
     // Try to get it from the memcache first:
     if (_memCache.valid())
     {
@@ -405,6 +721,116 @@ TileSource::createHeightField(const TileKey&        key,
     return newHF.valid() ? new osg::HeightField( *newHF.get() ) : 0L;
 }
 
+void
+TileSource::createImages(const std::vector<TileKey>&              keys,
+                         std::vector< osg::ref_ptr<osg::Image> >& output,
+                         ImageOperation*                          prepOp,
+                         ProgressCallback*                        progress )
+{
+    output.assign( keys.size(), 0L );
+
+    if ( _status != STATUS_OK )
+        return;
+
+    // Satisfy what we can from the memcache, and collect the rest so the
+    // driver can fetch them in one go.
+    std::vector<TileKey>  missingKeys;
+    std::vector<unsigned> missingIndices;
+
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        if (_memCache.valid())
+        {
+            ReadResult r = _memCache->getOrCreateDefaultBin()->readImage( keys[i].str() );
+            if ( r.succeeded() )
+            {
+                output[i] = r.getImage();
+                continue;
+            }
+        }
+        missingKeys.push_back( keys[i] );
+        missingIndices.push_back( i );
+    }
+
+    if ( missingKeys.empty() )
+        return;
+
+    std::vector< osg::ref_ptr<osg::Image> > newImages;
+    createImages( missingKeys, newImages, progress );
+
+    for( unsigned j=0; j<missingKeys.size() && j<newImages.size(); ++j )
+    {
+        osg::ref_ptr<osg::Image>& newImage = newImages[j];
+
+        if ( prepOp )
+            (*prepOp)( newImage );
+
+        if ( newImage.valid() && _memCache.valid() )
+        {
+            _memCache->getOrCreateDefaultBin()->write( missingKeys[j].str(), newImage.get() );
+        }
+
+        output[missingIndices[j]] = newImage.get();
+    }
+}
+
+void
+TileSource::createHeightFields(const std::vector<TileKey>&                    keys,
+                               std::vector< osg::ref_ptr<osg::HeightField> >& output,
+                               HeightFieldOperation*                          prepOp,
+                               ProgressCallback*                              progress )
+{
+    output.assign( keys.size(), 0L );
+
+    if ( _status != STATUS_OK )
+        return;
+
+    std::vector<TileKey>  missingKeys;
+    std::vector<unsigned> missingIndices;
+
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        if (_memCache.valid())
+        {
+            ReadResult r = _memCache->getOrCreateDefaultBin()->readObject( keys[i].str() );
+            if ( r.succeeded() )
+            {
+                osg::HeightField* hf = r.get<osg::HeightField>();
+                if ( hf )
+                {
+                    // copy, since the memcache holds on to the original.
+                    output[i] = new osg::HeightField( *hf );
+                    continue;
+                }
+            }
+        }
+        missingKeys.push_back( keys[i] );
+        missingIndices.push_back( i );
+    }
+
+    if ( missingKeys.empty() )
+        return;
+
+    std::vector< osg::ref_ptr<osg::HeightField> > newHFs;
+    createHeightFields( missingKeys, newHFs, progress );
+
+    for( unsigned j=0; j<missingKeys.size() && j<newHFs.size(); ++j )
+    {
+        osg::ref_ptr<osg::HeightField>& newHF = newHFs[j];
+
+        if ( prepOp )
+            (*prepOp)( newHF );
+
+        if ( newHF.valid() && _memCache.valid() )
+        {
+            _memCache->getOrCreateDefaultBin()->write( missingKeys[j].str(), newHF.get() );
+            newHF = new osg::HeightField( *newHF.get() );
+        }
+
+        output[missingIndices[j]] = newHF.get();
+    }
+}
+
 osg::Image*
 TileSource::createImage(const TileKey&    key,
                         ProgressCallback* progress)
@@ -412,6 +838,34 @@ TileSource::createImage(const TileKey&    key,
     return 0L;
 }
 
+void
+TileSource::createImages(const std::vector<TileKey>&              keys,
+                         std::vector< osg::ref_ptr<osg::Image> >& output,
+                         ProgressCallback*                        progress)
+{
+    output.resize( keys.size() );
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        if ( progress && progress->isCanceled() )
+            break;
+        output[i] = createImage( keys[i], progress );
+    }
+}
+
+void
+TileSource::createHeightFields(const std::vector<TileKey>&                    keys,
+                               std::vector< osg::ref_ptr<osg::HeightField> >& output,
+                               ProgressCallback*                              progress)
+{
+    output.resize( keys.size() );
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        if ( progress && progress->isCanceled() )
+            break;
+        output[i] = createHeightField( keys[i], progress );
+    }
+}
+
 osg::HeightField*
 TileSource::createHeightField(const TileKey&        key,
                               ProgressCallback*     progress)
@@ -446,6 +900,40 @@ TileSource::storeHeightField(const TileKey&     key,
     return false;
 }
 
+bool
+TileSource::storeImages(const std::vector<TileKey>&                    keys,
+                        const std::vector< osg::ref_ptr<osg::Image> >& images,
+                        ProgressCallback*                              progress)
+{
+    bool ok = true;
+    for( unsigned i=0; i<keys.size() && i<images.size(); ++i )
+    {
+        if ( progress && progress->isCanceled() )
+            return false;
+        if ( !images[i].valid() || !storeImage(keys[i], images[i].get(), progress) )
+            ok = false;
+    }
+    return ok;
+}
+
+bool
+TileSource::storeHeightFields(const std::vector<TileKey>&                          keys,
+                              const std::vector< osg::ref_ptr<osg::HeightField> >& hfs,
+                              ProgressCallback*                                    progress)
+{
+    if ( _status != STATUS_OK )
+        return false;
+
+    ImageToHeightFieldConverter conv;
+    std::vector< osg::ref_ptr<osg::Image> > images( hfs.size() );
+    for( unsigned i=0; i<hfs.size(); ++i )
+    {
+        if ( hfs[i].valid() )
+            images[i] = conv.convert(hfs[i].get(), 32);
+    }
+    return storeImages(keys, images, progress);
+}
+
 bool
 TileSource::isOK() const 
 {
@@ -547,6 +1035,15 @@ TileSource::hasData(const osgEarth::TileKey& key) const
 {
     //sematics: "might have data"
 
+    // If we have a tile index in our own profile, it can rule out the key
+    // outright; a positive answer still has to pass the checks below.
+    if (_tileIndex.valid() && _profile.valid() &&
+        key.getProfile()->isHorizEquivalentTo(_profile.get()) &&
+        !_tileIndex->mayHaveData(key))
+    {
+        return false;
+    }
+
     // If no data extents are provided, and there's no data level override,
     // return true because there might be data but there's no way to tell.
     if (_dataExtents.size() == 0 && !_options.maxDataLevel().isSet())
@@ -696,6 +1193,24 @@ TileSource::getBlacklist() const
     return _blacklist.get();
 }
 
+TileExistenceIndex*
+TileSource::getTileIndex()
+{
+    return _tileIndex.get();
+}
+
+const TileExistenceIndex*
+TileSource::getTileIndex() const
+{
+    return _tileIndex.get();
+}
+
+void
+TileSource::setTileIndex(TileExistenceIndex* index)
+{
+    _tileIndex = index;
+}
+
 //------------------------------------------------------------------------
 
 #undef  LC
@@ -19,6 +19,12 @@
 #include <osgEarth/TileVisitor>
 #include <osgEarth/CacheEstimator>
 #include <osgEarth/FileUtils>
+#include <osgEarth/Registry>
+#include <osgEarth/DateTime>
+#include <osgDB/FileUtils>
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
 
 using namespace osgEarth;
 
@@ -246,6 +252,7 @@ void MultithreadedTileVisitor::run(const Profile* mapProfile)
     // Start up the task service
     OE_INFO << "Starting " << _numThreads << std::endl;
     _taskService = new TaskService( "MTTileHandler", _numThreads, 1000 );
+    Registry::instance()->registerTaskService( _taskService.get() );
 
     // Produce the tiles
     TileVisitor::run( mapProfile );
@@ -361,6 +368,7 @@ void MultiprocessTileVisitor::run(const Profile* mapProfile)
 {                             
     // Start up the task service          
     _taskService = new TaskService( "MPTileHandler", _numProcesses, 1000 );
+    Registry::instance()->registerTaskService( _taskService.get() );
     
     // Produce the tiles
     TileVisitor::run( mapProfile );
@@ -472,6 +480,374 @@ void MultiprocessTileVisitor::processBatch()
 }
 
 
+/*****************************************************************************************/
+
+namespace
+{
+    // Lists the plain files in a directory, sorted by name.
+    std::vector< std::string > listFiles( const std::string& path )
+    {
+        std::vector< std::string > files;
+        osgDB::DirectoryContents contents = osgDB::getDirectoryContents( path );
+        for (unsigned int i = 0; i < contents.size(); i++)
+        {
+            if (contents[i] != "." && contents[i] != ".." && osgDB::fileType( path + "/" + contents[i] ) == osgDB::REGULAR_FILE)
+            {
+                files.push_back( contents[i] );
+            }
+        }
+        std::sort( files.begin(), files.end() );
+        return files;
+    }
+
+    unsigned int countLines( const std::string& filename )
+    {
+        std::ifstream in( filename.c_str(), std::ios::in );
+        unsigned int count = 0;
+        std::string line;
+        while (getline(in, line))
+        {
+            if (!line.empty()) ++count;
+        }
+        return count;
+    }
+
+    void sleepSeconds( double seconds )
+    {
+        OpenThreads::Thread::microSleep( (unsigned int)(seconds * 1000000.0) );
+    }
+}
+
+DistributedTileVisitor::DistributedTileVisitor():
+_role(ROLE_WORKER),
+_batchSize(100),
+_leaseTimeout(600.0),
+_reportInterval(10.0),
+_jobNumber(0),
+_numBatches(0),
+_numQueued(0)
+{
+    std::stringstream buf;
+    buf << "worker_" << std::hex << osg::Timer::instance()->tick();
+    _workerName = buf.str();
+}
+
+DistributedTileVisitor::DistributedTileVisitor( TileHandler* handler ):
+TileVisitor( handler ),
+_role(ROLE_WORKER),
+_batchSize(100),
+_leaseTimeout(600.0),
+_reportInterval(10.0),
+_jobNumber(0),
+_numBatches(0),
+_numQueued(0)
+{
+    std::stringstream buf;
+    buf << "worker_" << std::hex << osg::Timer::instance()->tick();
+    _workerName = buf.str();
+}
+
+void DistributedTileVisitor::setWorkerName( const std::string& name )
+{
+    // The name becomes part of the lease file name, after the first dot.
+    _workerName = name;
+    std::replace( _workerName.begin(), _workerName.end(), '.', '_' );
+    std::replace( _workerName.begin(), _workerName.end(), '/', '_' );
+    std::replace( _workerName.begin(), _workerName.end(), '\\', '_' );
+}
+
+std::string DistributedTileVisitor::jobPath( const std::string& subdir ) const
+{
+    std::stringstream buf;
+    buf << _queuePath << "/job_" << std::setw(3) << std::setfill('0') << _jobNumber;
+    if (!subdir.empty())
+        buf << "/" << subdir;
+    return buf.str();
+}
+
+void DistributedTileVisitor::run(const Profile* mapProfile)
+{
+    _profile = mapProfile;
+
+    if (_queuePath.empty())
+    {
+        OE_WARN << "[DistributedTileVisitor] No queue path set" << std::endl;
+        return;
+    }
+
+    makeDirectory( jobPath("pending") );
+    makeDirectory( jobPath("leased") );
+    makeDirectory( jobPath("done") );
+
+    if (_role == ROLE_COORDINATOR)
+        runCoordinator();
+    else
+        runWorker();
+
+    ++_jobNumber;
+}
+
+void DistributedTileVisitor::runCoordinator()
+{
+    std::string readyFile = jobPath("ready");
+
+    if (osgDB::fileExists(readyFile))
+    {
+        std::ifstream in( readyFile.c_str() );
+        in >> _numQueued >> _numBatches;
+        OE_NOTICE << "[DistributedTileVisitor] Resuming " << jobPath("") << " with " << _numQueued << " tiles in " << _numBatches << " batches" << std::endl;
+    }
+    else
+    {
+        // Clear out any batches from an enumeration that didn't finish.
+        std::vector< std::string > stale = listFiles( jobPath("pending") );
+        for (unsigned int i = 0; i < stale.size(); i++)
+        {
+            remove( (jobPath("pending") + "/" + stale[i]).c_str() );
+        }
+
+        _numBatches = 0;
+        _numQueued = 0;
+        _batch.clear();
+
+        // Produce the tiles
+        TileVisitor::run( _profile.get() );
+
+        // Queue any remaining tiles in the final batch
+        queueBatch();
+
+        if (_progress && _progress->isCanceled())
+        {
+            return;
+        }
+
+        // Workers start once the job is marked as ready.
+        std::ofstream out( readyFile.c_str() );
+        out << _numQueued << " " << _numBatches << std::endl;
+        out.close();
+
+        OE_NOTICE << "[DistributedTileVisitor] Queued " << _numQueued << " tiles in " << _numBatches << " batches to " << jobPath("") << std::endl;
+    }
+
+    _total = _numQueued;
+
+    // Monitor the job until every batch is done.
+    std::map< std::string, unsigned int > doneCounts;
+    unsigned int doneAtStart = 0;
+    bool first = true;
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    while (true)
+    {
+        reclaimExpiredLeases();
+
+        std::vector< std::string > done = listFiles( jobPath("done") );
+        unsigned int doneTiles = 0;
+        for (unsigned int i = 0; i < done.size(); i++)
+        {
+            std::map< std::string, unsigned int >::iterator itr = doneCounts.find( done[i] );
+            if (itr == doneCounts.end())
+            {
+                itr = doneCounts.insert( std::make_pair(done[i], countLines(jobPath("done") + "/" + done[i])) ).first;
+            }
+            doneTiles += itr->second;
+        }
+
+        if (first)
+        {
+            doneAtStart = doneTiles;
+            first = false;
+        }
+
+        unsigned int numPending = listFiles( jobPath("pending") ).size();
+        unsigned int numLeased  = listFiles( jobPath("leased") ).size();
+
+        double elapsed = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+        double rate = elapsed > 0.0 ? (double)(doneTiles - doneAtStart) / elapsed : 0.0;
+
+        OE_NOTICE << "[DistributedTileVisitor] " << doneTiles << " of " << _numQueued << " tiles done, "
+            << numLeased << " batches leased, " << numPending << " pending, "
+            << std::fixed << std::setprecision(1) << rate << " tiles/s" << std::endl;
+
+        _processed = doneTiles;
+        if (_progress.valid() && _progress->reportProgress( _processed, _total ))
+        {
+            _progress->cancel();
+        }
+
+        if ((numPending == 0 && numLeased == 0) || (_progress && _progress->isCanceled()))
+        {
+            break;
+        }
+
+        sleepSeconds( _reportInterval );
+    }
+}
+
+bool DistributedTileVisitor::handleTile( const TileKey& key )
+{
+    _batch.push_back( key );
+    ++_numQueued;
+
+    if (_batch.size() >= _batchSize)
+    {
+        queueBatch();
+    }
+    return true;
+}
+
+void DistributedTileVisitor::queueBatch()
+{
+    if (_batch.empty())
+        return;
+
+    TaskList tasks( 0 );
+    tasks.getKeys() = _batch;
+    _batch.clear();
+
+    std::stringstream name;
+    name << "batch_" << std::setw(8) << std::setfill('0') << _numBatches++;
+
+    // Write next to the queue and then move it in, so workers never see a partial file.
+    std::string tmpFile = jobPath( name.str() + ".tmp" );
+    tasks.save( tmpFile );
+    if (rename( tmpFile.c_str(), (jobPath("pending") + "/" + name.str()).c_str() ) != 0)
+    {
+        OE_WARN << "[DistributedTileVisitor] Failed to queue " << name.str() << std::endl;
+    }
+}
+
+void DistributedTileVisitor::runWorker()
+{
+    std::string readyFile = jobPath("ready");
+
+    // Wait for the coordinator to finish queueing the job.
+    bool waiting = false;
+    while (!osgDB::fileExists(readyFile))
+    {
+        if (_progress && _progress->isCanceled())
+            return;
+
+        if (!waiting)
+        {
+            OE_NOTICE << "[DistributedTileVisitor] Waiting for the coordinator to queue " << jobPath("") << std::endl;
+            waiting = true;
+        }
+        sleepSeconds( 1.0 );
+    }
+
+    {
+        std::ifstream in( readyFile.c_str() );
+        in >> _numQueued >> _numBatches;
+        _total = _numQueued;
+        _processed = 0;
+    }
+
+    while (!(_progress && _progress->isCanceled()))
+    {
+        std::string batch, leaseFile;
+        if (claimBatch( batch, leaseFile ))
+        {
+            processBatch( batch, leaseFile );
+            continue;
+        }
+
+        if (reclaimExpiredLeases() > 0)
+            continue;
+
+        // Nothing pending; stick around while other workers still hold leases, in
+        // case one of them dies and its batch comes back.
+        if (listFiles( jobPath("leased") ).empty())
+            break;
+
+        sleepSeconds( 1.0 );
+    }
+}
+
+bool DistributedTileVisitor::claimBatch( std::string& out_batch, std::string& out_leaseFile )
+{
+    std::vector< std::string > pending = listFiles( jobPath("pending") );
+    for (unsigned int i = 0; i < pending.size(); i++)
+    {
+        std::string pendingFile = jobPath("pending") + "/" + pending[i];
+        std::string leaseFile = jobPath("leased") + "/" + pending[i] + "." + _workerName;
+
+        // The rename is atomic, so only one worker wins each batch. Touch first so
+        // the lease doesn't look expired before it is renewed.
+        touchFile( pendingFile );
+        if (rename( pendingFile.c_str(), leaseFile.c_str() ) == 0)
+        {
+            touchFile( leaseFile );
+            out_batch = pending[i];
+            out_leaseFile = leaseFile;
+            return true;
+        }
+    }
+    return false;
+}
+
+void DistributedTileVisitor::processBatch( const std::string& batch, const std::string& leaseFile )
+{
+    TaskList tasks( _profile.get() );
+    tasks.load( leaseFile );
+
+    OE_INFO << "[DistributedTileVisitor] " << _workerName << " processing " << batch << " (" << tasks.getKeys().size() << " tiles)" << std::endl;
+
+    osg::Timer_t renewed = osg::Timer::instance()->tick();
+
+    for (TileKeyList::iterator itr = tasks.getKeys().begin(); itr != tasks.getKeys().end(); ++itr)
+    {
+        if (_progress && _progress->isCanceled())
+        {
+            // Give the batch back right away instead of waiting for the lease to expire.
+            rename( leaseFile.c_str(), (jobPath("pending") + "/" + batch).c_str() );
+            return;
+        }
+
+        if (_tileHandler.valid())
+        {
+            _tileHandler->handleTile( *itr, *this );
+        }
+        incrementProgress( 1 );
+
+        if (osg::Timer::instance()->delta_s( renewed, osg::Timer::instance()->tick() ) > _leaseTimeout * 0.25)
+        {
+            touchFile( leaseFile );
+            renewed = osg::Timer::instance()->tick();
+        }
+    }
+
+    // Checkpoint the batch.
+    if (rename( leaseFile.c_str(), (jobPath("done") + "/" + batch).c_str() ) != 0)
+    {
+        OE_WARN << "[DistributedTileVisitor] Lease on " << batch << " expired before it finished; it may be processed twice" << std::endl;
+    }
+}
+
+unsigned int DistributedTileVisitor::reclaimExpiredLeases()
+{
+    unsigned int count = 0;
+    TimeStamp now = DateTime().asTimeStamp();
+
+    std::vector< std::string > leased = listFiles( jobPath("leased") );
+    for (unsigned int i = 0; i < leased.size(); i++)
+    {
+        std::string leaseFile = jobPath("leased") + "/" + leased[i];
+        TimeStamp modified = getLastModifiedTime( leaseFile );
+        if (modified > 0 && (double)(now - modified) > _leaseTimeout)
+        {
+            std::string batch = leased[i].substr( 0, leased[i].find('.') );
+            if (rename( leaseFile.c_str(), (jobPath("pending") + "/" + batch).c_str() ) == 0)
+            {
+                OE_NOTICE << "[DistributedTileVisitor] Reclaimed abandoned lease " << leased[i] << std::endl;
+                ++count;
+            }
+        }
+    }
+    return count;
+}
+
+
 /*****************************************************************************************/
 TileKeyListVisitor::TileKeyListVisitor()
 {
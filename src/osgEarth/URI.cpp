@@ -20,15 +20,21 @@
 #include <osgEarth/Cache>
 #include <osgEarth/CacheBin>
 #include <osgEarth/HTTPClient>
+#include <osgEarth/ImageDecoder>
 #include <osgEarth/Registry>
 #include <osgEarth/Progress>
 #include <osgEarth/FileUtils>
+#include <osgEarth/Profiler>
 #include <osgDB/FileNameUtils>
 #include <osgDB/ReadFile>
 #include <osgDB/ReaderWriter>
 #include <osgDB/Archive>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Condition>
+#include <OpenThreads/Thread>
 #include <fstream>
 #include <sstream>
+#include <typeinfo>
 
 #define LC "[URI] "
 
@@ -41,6 +47,14 @@ using namespace osgEarth;
 
 namespace
 {
+    // process-wide read counters (see URIStatistics)
+    OpenThreads::Atomic s_numMemCacheHits;
+    OpenThreads::Atomic s_numCacheHits;
+    OpenThreads::Atomic s_numCacheMisses;
+    OpenThreads::Atomic s_numCacheExpired;
+    OpenThreads::Atomic s_numRemoteReads;
+    OpenThreads::Atomic s_numLocalReads;
+
     /**
      * "Fixes" the osgDB options by disabling the automatic archive caching. Archive caching
      * screws up our URI resolution because with it on, osgDB remembers every archive file
@@ -289,6 +303,176 @@ namespace
     }
 
 
+    //--------------------------------------------------------------------
+    // Coalescing of concurrent remote reads
+
+    // Shared state for one in-progress read.
+    struct InFlightEntry : public osg::Referenced
+    {
+        InFlightEntry() : _done(false), _fromCallback(false), _leader(OpenThreads::Thread::CurrentThread()) { }
+        Threading::Mutex       _mutex;
+        OpenThreads::Condition _cond;
+        bool                   _done;
+        ReadResult             _result;
+        bool                   _fromCallback;
+        OpenThreads::Thread*   _leader;
+    };
+
+    typedef std::map<std::string, osg::ref_ptr<InFlightEntry> > InFlightTable;
+
+    static InFlightTable    s_inFlight;
+    static Threading::Mutex s_inFlightMutex;
+
+    // Reads only coalesce when they would do exactly the same work:
+    // same kind of object, same URL, same cache bin and caching policy.
+    std::string makeInFlightKey( const char* type, const URI& uri, const CachePolicy& cp, CacheBin* bin )
+    {
+        std::stringstream buf;
+        buf << type << "|" << (int)cp.usage().get() << "|" << (void*)bin << "|" << uri.full();
+        return buf.str();
+    }
+
+    /**
+     * Scoped registration in the in-flight table. The first reader of a key
+     * becomes the leader and must publish() its result; later readers of the
+     * same key block in the constructor until it does, then take a copy (which
+     * shares the leader's decoded object). If the leader was canceled, a
+     * follower that still wants the data retries as the new leader.
+     */
+    class InFlightRead
+    {
+    public:
+        InFlightRead( const std::string& key, ProgressCallback* progress ) :
+            _key         ( key ),
+            _follower    ( false ),
+            _fromCallback( false )
+        {
+            while( true )
+            {
+                {
+                    Threading::ScopedMutexLock lock( s_inFlightMutex );
+                    InFlightTable::iterator i = s_inFlight.find( key );
+                    if ( i == s_inFlight.end() )
+                    {
+                        _entry = new InFlightEntry();
+                        s_inFlight[key] = _entry.get();
+                        return;
+                    }
+                    if ( i->second->_leader && i->second->_leader == OpenThreads::Thread::CurrentThread() )
+                    {
+                        // a nested read of the same resource by the leader itself;
+                        // waiting would deadlock, so read independently.
+                        return;
+                    }
+                    _entry = i->second.get();
+                }
+
+                _follower = true;
+                Threading::ScopedMutexLock lock( _entry->_mutex );
+                while( !_entry->_done )
+                {
+                    if ( progress && progress->isCanceled() )
+                    {
+                        _result = ReadResult( ReadResult::RESULT_CANCELED );
+                        return;
+                    }
+                    _entry->_cond.wait( &_entry->_mutex, 50 );
+                }
+
+                if ( _entry->_result.code() != ReadResult::RESULT_CANCELED || (progress && progress->isCanceled()) )
+                {
+                    _result       = _entry->_result;
+                    _fromCallback = _entry->_fromCallback;
+                    return;
+                }
+
+                // the leader gave up; take another turn.
+                _follower = false;
+            }
+        }
+
+        ~InFlightRead()
+        {
+            if ( !_follower )
+            {
+                // in case the leader never published (e.g. an exception).
+                publish( ReadResult(), false );
+            }
+        }
+
+        bool isFollower() const { return _follower; }
+
+        const ReadResult& getResult() const { return _result; }
+
+        bool getResultFromCallback() const { return _fromCallback; }
+
+        void publish( const ReadResult& result, bool fromCallback )
+        {
+            if ( _follower || !_entry.valid() )
+                return;
+
+            {
+                Threading::ScopedMutexLock lock( s_inFlightMutex );
+                InFlightTable::iterator i = s_inFlight.find( _key );
+                if ( i != s_inFlight.end() && i->second.get() == _entry.get() )
+                    s_inFlight.erase( i );
+            }
+
+            Threading::ScopedMutexLock lock( _entry->_mutex );
+            _entry->_result       = result;
+            _entry->_fromCallback = fromCallback;
+            _entry->_done         = true;
+            _entry->_cond.broadcast();
+            _entry = 0L;
+        }
+
+    private:
+        std::string                 _key;
+        bool                        _follower;
+        osg::ref_ptr<InFlightEntry> _entry;
+        ReadResult                  _result;
+        bool                        _fromCallback;
+    };
+
+    //--------------------------------------------------------------------
+    // Conditional revalidation of cached remote data
+
+    // Finds an HTTP header in a cache record's metadata. Header names are
+    // case-insensitive (and HTTP/2 servers send them in lower case).
+    std::string getCachedHeader( const Config& meta, const std::string& name )
+    {
+        for( ConfigSet::const_iterator i = meta.children().begin(); i != meta.children().end(); ++i )
+        {
+            if ( ciEquals(i->key(), name) )
+                return i->value();
+        }
+        return std::string();
+    }
+
+    // Builds a request for a URI that, if we hold a (possibly expired) cached
+    // copy, asks the server to answer 304 unless the resource has changed.
+    HTTPRequest makeConditionalRequest( const std::string& uri, const ReadResult& cached )
+    {
+        HTTPRequest req(uri);
+        if ( cached.succeeded() )
+        {
+            req.setETag( getCachedHeader(cached.metadata(), "ETag") );
+
+            // echo the server's own Last-Modified when we have it, since
+            // servers compare that string exactly.
+            std::string lastModified = getCachedHeader(cached.metadata(), "Last-Modified");
+            if ( !lastModified.empty() )
+            {
+                req.addHeader("If-Modified-Since", lastModified);
+            }
+            else if ( cached.lastModifiedTime() > 0 )
+            {
+                req.setLastModified(cached.lastModifiedTime());
+            }
+        }
+        return req;
+    }
+
     //--------------------------------------------------------------------
     // Read functors (used by the doRead method)
 
@@ -297,13 +481,9 @@ namespace
         bool callbackRequestsCaching( URIReadCallback* cb ) const { return !cb || ((cb->cachingSupport() & URIReadCallback::CACHE_OBJECTS) != 0); }
         ReadResult fromCallback( URIReadCallback* cb, const std::string& uri, const osgDB::Options* opt ) { return cb->readObject(uri, opt); }
         ReadResult fromCache( CacheBin* bin, const std::string& key) { return bin->readObject(key); }
-        ReadResult fromHTTP( const std::string& uri, const osgDB::Options* opt, ProgressCallback* p, TimeStamp lastModified )
+        ReadResult fromHTTP( const std::string& uri, const osgDB::Options* opt, ProgressCallback* p, const ReadResult& cached )
         {
-            HTTPRequest req(uri);            
-            if (lastModified > 0)
-            {
-                req.setLastModified(lastModified);
-            }
+            HTTPRequest req = makeConditionalRequest(uri, cached);
             return HTTPClient::readObject(req, opt, p);
         }
         ReadResult fromFile( const std::string& uri, const osgDB::Options* opt ) { return ReadResult(osgDB::readObjectFile(uri, opt)); }
@@ -314,13 +494,9 @@ namespace
         bool callbackRequestsCaching( URIReadCallback* cb ) const { return !cb || ((cb->cachingSupport() & URIReadCallback::CACHE_NODES) != 0); }
         ReadResult fromCallback( URIReadCallback* cb, const std::string& uri, const osgDB::Options* opt ) { return cb->readNode(uri, opt); }
         ReadResult fromCache( CacheBin* bin, const std::string& key ) { return bin->readObject(key); }
-        ReadResult fromHTTP( const std::string& uri, const osgDB::Options* opt, ProgressCallback* p, TimeStamp lastModified )
+        ReadResult fromHTTP( const std::string& uri, const osgDB::Options* opt, ProgressCallback* p, const ReadResult& cached )
         {
-            HTTPRequest req(uri);            
-            if (lastModified > 0)
-            {
-                req.setLastModified(lastModified);
-            }
+            HTTPRequest req = makeConditionalRequest(uri, cached);
             return HTTPClient::readNode(req, opt, p);
         }
         ReadResult fromFile( const std::string& uri, const osgDB::Options* opt ) { return ReadResult(osgDB::readNodeFile(uri, opt)); }
@@ -341,18 +517,16 @@ namespace
             if ( r.getImage() ) r.getImage()->setFileName( key );
             return r;
         }
-        ReadResult fromHTTP( const std::string& uri, const osgDB::Options* opt, ProgressCallback* p, TimeStamp lastModified ) { 
-            HTTPRequest req(uri);            
-            if (lastModified > 0)
-            {
-                req.setLastModified(lastModified);
-            }
+        ReadResult fromHTTP( const std::string& uri, const osgDB::Options* opt, ProgressCallback* p, const ReadResult& cached ) { 
+            HTTPRequest req = makeConditionalRequest(uri, cached);
             ReadResult r = HTTPClient::readImage(req, opt, p);
             if ( r.getImage() ) r.getImage()->setFileName( uri );
             return r;
         }
         ReadResult fromFile( const std::string& uri, const osgDB::Options* opt ) { 
-            ReadResult r = ReadResult(osgDB::readImageFile(uri, opt));
+            ReadResult r;
+            if ( !ImageDecoder::instance()->readFile(uri, opt, r) )
+                r = ReadResult(osgDB::readImageFile(uri, opt));
             if ( r.getImage() ) r.getImage()->setFileName( uri );
             return r;
         }
@@ -363,13 +537,9 @@ namespace
         bool callbackRequestsCaching( URIReadCallback* cb ) const { return !cb || ((cb->cachingSupport() & URIReadCallback::CACHE_STRINGS) != 0); }
         ReadResult fromCallback( URIReadCallback* cb, const std::string& uri, const osgDB::Options* opt ) { return cb->readString(uri, opt); }
         ReadResult fromCache( CacheBin* bin, const std::string& key) { return bin->readString(key); }
-        ReadResult fromHTTP( const std::string& uri, const osgDB::Options* opt, ProgressCallback* p, TimeStamp lastModified )
+        ReadResult fromHTTP( const std::string& uri, const osgDB::Options* opt, ProgressCallback* p, const ReadResult& cached )
         {
-            HTTPRequest req(uri);            
-            if (lastModified > 0)
-            {
-                req.setLastModified(lastModified);
-            }
+            HTTPRequest req = makeConditionalRequest(uri, cached);
             return HTTPClient::readString(req, opt, p);
         }
         ReadResult fromFile( const std::string& uri, const osgDB::Options* opt ) { return readStringFile(uri, opt); }
@@ -424,6 +594,7 @@ namespace
                 if ( memCache->get(uri, rec) )
                 {
                     result = rec.value();
+                    ++s_numMemCacheHits;
                 }
             }
 
@@ -452,6 +623,7 @@ namespace
                     {
                         // no callback, just read from a local file.
                         result = reader.fromFile( uri.full(), localOptions );
+                        ++s_numLocalReads;
                     }
                 }
 
@@ -473,67 +645,94 @@ namespace
                     }                    
 
 
-                    bool expired = false;
-                    // first try to go to the cache if there is one:
-                    if ( bin && cp->isCacheReadable() )
-                    {                                                
-                        result = reader.fromCache( bin, uri.cacheKey() );                        
-                        if ( result.succeeded() )
-                        {                                        
-                            expired = cp->isExpired(result.lastModifiedTime());
-                            result.setIsFromCache(true);
-                        }
+                    // concurrent misses on the same resource share one read: the
+                    // first caller (the leader) goes to the cache and the server,
+                    // the rest wait for its result.
+                    InFlightRead inFlight( makeInFlightKey(typeid(READ_FUNCTOR).name(), uri, cp.get(), bin), progress );
+                    if ( inFlight.isFollower() )
+                    {
+                        result = inFlight.getResult();
+                        gotResultFromCallback = inFlight.getResultFromCallback();
                     }
+                    else
+                    {
+                        bool expired = false;
+                        // first try to go to the cache if there is one:
+                        if ( bin && cp->isCacheReadable() )
+                        {                                                
+                            OE_PROFILING_ZONE_BEGIN("Cache read");
+                            result = reader.fromCache( bin, uri.cacheKey() );                        
+                            OE_PROFILING_ZONE_END();
+                            if ( result.succeeded() )
+                            {                                        
+                                expired = cp->isExpired(result.lastModifiedTime());
+                                result.setIsFromCache(true);
+                                ++s_numCacheHits;
+                                if ( expired )
+                                    ++s_numCacheExpired;
+                            }
+                            else
+                            {
+                                ++s_numCacheMisses;
+                            }
+                        }
 
-                    // If it's not cached, or it is cached but is expired then try to hit the server.                    
-                    if ( result.empty() || expired )
-                    {                        
-                        // Need to do this to support nested PLODs and Proxynodes.
-                        osg::ref_ptr<osgDB::Options> remoteOptions =
-                            Registry::instance()->cloneOrCreateOptions( localOptions );
-                        remoteOptions->getDatabasePathList().push_front( osgDB::getFilePath(uri.full()) );
+                        // If it's not cached, or it is cached but is expired then try to hit the server.                    
+                        if ( result.empty() || expired )
+                        {                        
+                            // Need to do this to support nested PLODs and Proxynodes.
+                            osg::ref_ptr<osgDB::Options> remoteOptions =
+                                Registry::instance()->cloneOrCreateOptions( localOptions );
+                            remoteOptions->getDatabasePathList().push_front( osgDB::getFilePath(uri.full()) );
 
-                        // Store the existing object from the cache if there is one.
-                        osg::ref_ptr< osg::Object > object = result.getObject();
+                            // Store the existing object from the cache if there is one.
+                            osg::ref_ptr< osg::Object > object = result.getObject();
 
-                        // try to use the callback if it's set. Callback ignores the caching policy.
-                        if ( cb )
-                        {                
-                            result = reader.fromCallback( cb, uri.full(), remoteOptions.get() );
+                            // try to use the callback if it's set. Callback ignores the caching policy.
+                            if ( cb )
+                            {                
+                                result = reader.fromCallback( cb, uri.full(), remoteOptions.get() );
+                                ++s_numRemoteReads;
 
-                            if ( result.code() != ReadResult::RESULT_NOT_IMPLEMENTED )
-                            {
-                                // "not implemented" is the only excuse for falling back
-                                gotResultFromCallback = true;
+                                if ( result.code() != ReadResult::RESULT_NOT_IMPLEMENTED )
+                                {
+                                    // "not implemented" is the only excuse for falling back
+                                    gotResultFromCallback = true;
+                                }
                             }
-                        }
 
-                        if ( !gotResultFromCallback )
-                        {                            
-                            // still no data, go to the source:
-                            if ( (result.empty() || expired) && cp->usage() != CachePolicy::USAGE_CACHE_ONLY )
-                            {                                
-                                ReadResult remoteResult = reader.fromHTTP( uri.full(), remoteOptions.get(), progress, result.lastModifiedTime() );
-                                if (remoteResult.code() == ReadResult::RESULT_NOT_MODIFIED)
-                                {                                    
-                                    OE_DEBUG << LC << uri.full() << " not modified, using cached result" << std::endl;
-                                    // Touch the cached item to update it's last modified timestamp so it doesn't expire again immediately.
-                                    bin->touch( uri.cacheKey() );
+                            if ( !gotResultFromCallback )
+                            {                            
+                                // still no data, go to the source:
+                                if ( (result.empty() || expired) && cp->usage() != CachePolicy::USAGE_CACHE_ONLY )
+                                {                                
+                                    ReadResult remoteResult = reader.fromHTTP( uri.full(), remoteOptions.get(), progress, result );
+                                    if ( !cb )
+                                        ++s_numRemoteReads;
+                                    if (remoteResult.code() == ReadResult::RESULT_NOT_MODIFIED)
+                                    {                                    
+                                        OE_DEBUG << LC << uri.full() << " not modified, using cached result" << std::endl;
+                                        // Touch the cached item to update it's last modified timestamp so it doesn't expire again immediately.
+                                        bin->touch( uri.cacheKey() );
+                                    }
+                                    else
+                                    {
+                                        OE_DEBUG << LC << "Got remote result for " << uri.full() << std::endl;
+                                        result = remoteResult;                                    
+                                    }
                                 }
-                                else
+
+                                // write the result to the cache if possible:
+                                if ( result.succeeded() && !result.isFromCache() && bin && cp->isCacheWriteable() )
                                 {
-                                    OE_DEBUG << LC << "Got remote result for " << uri.full() << std::endl;
-                                    result = remoteResult;                                    
+                                    OE_DEBUG << LC << "Writing " << uri.cacheKey() << " to cache" << std::endl;
+                                    OE_PROFILING_ZONE("Cache write");
+                                    bin->write( uri.cacheKey(), result.getObject(), result.metadata() );
                                 }
                             }
-
-                            // write the result to the cache if possible:
-                            if ( result.succeeded() && !result.isFromCache() && bin && cp->isCacheWriteable() )
-                            {
-                                OE_DEBUG << LC << "Writing " << uri.cacheKey() << " to cache" << std::endl;
-                                bin->write( uri.cacheKey(), result.getObject(), result.metadata() );
-                            }
                         }
+
+                        inFlight.publish( result, gotResultFromCallback );
                     }
 
                     OE_TEST << LC 
@@ -568,6 +767,28 @@ namespace
     }
 }
 
+void
+URI::getStatistics(URIStatistics& output)
+{
+    output._memCacheHits = s_numMemCacheHits;
+    output._cacheHits    = s_numCacheHits;
+    output._cacheMisses  = s_numCacheMisses;
+    output._cacheExpired = s_numCacheExpired;
+    output._remoteReads  = s_numRemoteReads;
+    output._localReads   = s_numLocalReads;
+}
+
+void
+URI::resetStatistics()
+{
+    s_numMemCacheHits.exchange( 0 );
+    s_numCacheHits.exchange( 0 );
+    s_numCacheMisses.exchange( 0 );
+    s_numCacheExpired.exchange( 0 );
+    s_numRemoteReads.exchange( 0 );
+    s_numLocalReads.exchange( 0 );
+}
+
 ReadResult
 URI::readObject(const osgDB::Options* dbOptions,
                 ProgressCallback*     progress ) const
@@ -0,0 +1,228 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/URLTemplate>
+
+using namespace osgEarth;
+
+namespace
+{
+    struct TokenName
+    {
+        const char* _name;
+        unsigned    _length;
+        int         _type;
+    };
+}
+
+URLTemplate::URLTemplate() :
+_reserve ( 0 ),
+_rotation( 0u )
+{
+    //nop
+}
+
+URLTemplate::URLTemplate(const std::string& pattern) :
+_pattern ( pattern ),
+_reserve ( 0 ),
+_rotation( 0u )
+{
+    parse();
+}
+
+URLTemplate::URLTemplate(const URLTemplate& rhs) :
+_pattern ( rhs._pattern ),
+_tokens  ( rhs._tokens ),
+_choices ( rhs._choices ),
+_reserve ( rhs._reserve ),
+_rotation( 0u )
+{
+    //nop
+}
+
+URLTemplate&
+URLTemplate::operator = (const URLTemplate& rhs)
+{
+    _pattern = rhs._pattern;
+    _tokens  = rhs._tokens;
+    _choices = rhs._choices;
+    _reserve = rhs._reserve;
+    return *this;
+}
+
+void
+URLTemplate::parse()
+{
+    static const TokenName names[] = {
+        { "${x}",   4, TOKEN_X },   { "{x}",   3, TOKEN_X },
+        { "${y}",   4, TOKEN_Y },   { "{y}",   3, TOKEN_Y },
+        { "${z}",   4, TOKEN_Z },   { "{z}",   3, TOKEN_Z },
+        { "${key}", 6, TOKEN_KEY }, { "{key}", 5, TOKEN_KEY }
+    };
+    static const unsigned numNames = sizeof(names)/sizeof(names[0]);
+
+    _tokens.clear();
+    _choices.clear();
+
+    std::string literal;
+    bool rotationFound = false;
+
+    for( std::string::size_type i = 0; i < _pattern.size(); )
+    {
+        int type = TOKEN_LITERAL;
+        std::string::size_type length = 0;
+
+        for( unsigned n = 0; n < numNames && type == TOKEN_LITERAL; ++n )
+        {
+            if ( _pattern.compare(i, names[n]._length, names[n]._name) == 0 )
+            {
+                type   = names[n]._type;
+                length = names[n]._length;
+            }
+        }
+
+        // only the first [...] group rotates, and it needs at least one choice.
+        if ( type == TOKEN_LITERAL && !rotationFound && _pattern[i] == '[' )
+        {
+            std::string::size_type end = _pattern.find(']', i);
+            if ( end != std::string::npos && end-i > 1 )
+            {
+                type   = TOKEN_ROTATE;
+                length = end-i+1;
+                _choices = _pattern.substr(i+1, end-i-1);
+                rotationFound = true;
+            }
+        }
+
+        if ( type == TOKEN_LITERAL )
+        {
+            literal += _pattern[i++];
+            continue;
+        }
+
+        if ( !literal.empty() )
+        {
+            Token t;
+            t._type = TOKEN_LITERAL;
+            t._text.swap( literal );
+            _tokens.push_back( t );
+        }
+
+        Token t;
+        t._type = (TokenType)type;
+        t._text = _pattern.substr(i, length);
+        _tokens.push_back( t );
+        i += length;
+    }
+
+    if ( !literal.empty() )
+    {
+        Token t;
+        t._type = TOKEN_LITERAL;
+        t._text.swap( literal );
+        _tokens.push_back( t );
+    }
+
+    // room for the literals plus the longest values the tokens can produce.
+    _reserve = 0;
+    for( std::vector<Token>::const_iterator t = _tokens.begin(); t != _tokens.end(); ++t )
+    {
+        _reserve +=
+            t->_type == TOKEN_LITERAL ? t->_text.size() :
+            t->_type == TOKEN_KEY     ? 32 :
+            t->_type == TOKEN_ROTATE  ? t->_text.size() :
+            10;
+    }
+}
+
+void
+URLTemplate::appendUnsigned(std::string& out, unsigned value)
+{
+    char buf[16];
+    char* p = buf + sizeof(buf);
+    do {
+        *--p = (char)('0' + value % 10u);
+        value /= 10u;
+    } while( value > 0u );
+    out.append( p, buf + sizeof(buf) - p );
+}
+
+void
+URLTemplate::appendQuadKey(std::string& out, unsigned x, unsigned y, unsigned z)
+{
+    for( unsigned i = z+1; i > 0; i-- )
+    {
+        char digit = '0';
+        unsigned mask = 1 << (i-1);
+        if ( (x & mask) != 0 )
+        {
+            digit++;
+        }
+        if ( (y & mask) != 0 )
+        {
+            digit += 2;
+        }
+        out += digit;
+    }
+}
+
+void
+URLTemplate::append(std::string& out, const Token& token, unsigned x, unsigned y, unsigned z, char choice) const
+{
+    switch( token._type )
+    {
+    case TOKEN_X:      appendUnsigned( out, x ); break;
+    case TOKEN_Y:      appendUnsigned( out, y ); break;
+    case TOKEN_Z:      appendUnsigned( out, z ); break;
+    case TOKEN_KEY:    appendQuadKey( out, x, y, z ); break;
+    case TOKEN_ROTATE: if ( choice ) out += choice; else out += token._text; break;
+    default:           out += token._text; break;
+    }
+}
+
+void
+URLTemplate::expand(unsigned     x,
+                    unsigned     y,
+                    unsigned     z,
+                    std::string& out,
+                    std::string* out_cacheKey) const
+{
+    bool wantCacheKey = out_cacheKey && rotates();
+
+    out.clear();
+    out.reserve( _reserve );
+    if ( wantCacheKey )
+    {
+        out_cacheKey->clear();
+        out_cacheKey->reserve( _reserve );
+    }
+
+    char choice = 0;
+    if ( rotates() )
+    {
+        unsigned index = (++_rotation) % _choices.size();
+        choice = _choices[index];
+    }
+
+    for( std::vector<Token>::const_iterator t = _tokens.begin(); t != _tokens.end(); ++t )
+    {
+        append( out, *t, x, y, z, choice );
+        if ( wantCacheKey )
+            append( *out_cacheKey, *t, x, y, z, 0 );
+    }
+}
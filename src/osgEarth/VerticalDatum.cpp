@@ -24,6 +24,9 @@
 
 #include <osgDB/ReadFile>
 #include <osgDB/ReaderWriter>
+#include <osg/Math>
+#include <vector>
+#include <cmath>
 
 using namespace osgEarth;
 
@@ -37,6 +40,25 @@ namespace
     typedef std::map<std::string, osg::ref_ptr<VerticalDatum> > VDatumCache;
     VDatumCache      _vdatumCache;
     Threading::Mutex _vdataCacheMutex;
+
+    // grid spacing (degrees) of a datum's geoid, or 0 if it has none.
+    double geoidInterval(const VerticalDatum* vdatum)
+    {
+        const Geoid* geoid = vdatum ? vdatum->getGeoid() : 0L;
+        const osg::HeightField* hf = geoid && geoid->isValid() ? geoid->getHeightField() : 0L;
+        return hf ? osg::minimum(hf->getXInterval(), hf->getYInterval()) : 0.0;
+    }
+
+    // number of samples needed to follow the geoid across "span" degrees (two
+    // per geoid cell, since the samples don't line up with the geoid posts),
+    // never more than the number of posts.
+    unsigned geoidSamples(double span, double interval, unsigned posts)
+    {
+        if ( posts < 2u || interval <= 0.0 )
+            return osg::minimum(posts, 2u);
+        unsigned n = (unsigned)ceil(2.0*span/interval) + 1u;
+        return osg::clampBetween(n, 2u, posts);
+    }
 } 
 
 VerticalDatum*
@@ -136,35 +158,114 @@ VerticalDatum::transform(const VerticalDatum* from,
     if ( from == to )
         return true;
 
+    if ( !hf )
+        return false;
+
     unsigned cols = hf->getNumColumns();
     unsigned rows = hf->getNumRows();
+    if ( cols == 0u || rows == 0u )
+        return true;
     
     osg::Vec3d sw(extent.west(), extent.south(), 0.0);
     osg::Vec3d ne(extent.east(), extent.north(), 0.0);
-    
-    double xstep = abs(extent.east() - extent.west()) / double(cols-1);
-    double ystep = abs(extent.north() - extent.south()) / double(rows-1);
 
     if ( !extent.getSRS()->isGeographic() )
     {
         const SpatialReference* geoSRS = extent.getSRS()->getGeographicSRS();
         extent.getSRS()->transform(sw, geoSRS, sw);
         extent.getSRS()->transform(ne, geoSRS, ne);
-        xstep = (ne.x()-sw.x()) / double(cols-1);
-        ystep = (ne.y()-sw.y()) / double(rows-1);
     }
 
-    for( unsigned c=0; c<cols; ++c)
+    // Every post maps as z' = z*scale + offset(lat,lon), where the offset
+    // combines both geoids and the scale is the linear unit conversion.
+    Units fromUnits = from ? from->getUnits() : Units::METERS;
+    Units toUnits = to ? to->getUnits() : fromUnits;
+    double scale = fromUnits.convertTo(toUnits, 1.0);
+
+    // Sample the offset on a grid that follows the finer of the two geoids;
+    // a tile spanning fewer geoid cells than posts needs far fewer lookups.
+    double fromInterval = geoidInterval(from), toInterval = geoidInterval(to);
+    double interval = fromInterval > 0.0 && toInterval > 0.0 ?
+        osg::minimum(fromInterval, toInterval) :
+        osg::maximum(fromInterval, toInterval);
+
+    unsigned scols = geoidSamples(fabs(ne.x()-sw.x()), interval, cols);
+    unsigned srows = geoidSamples(fabs(ne.y()-sw.y()), interval, rows);
+
+    std::vector<float> samples(scols*srows);
+    for( unsigned sr=0; sr<srows; ++sr )
     {
-        double lon = sw.x() + xstep*double(c);
-        for( unsigned r=0; r<rows; ++r)
+        double lat = srows > 1u ? sw.y() + (ne.y()-sw.y())*double(sr)/double(srows-1) : sw.y();
+        for( unsigned sc=0; sc<scols; ++sc )
         {
-            double lat = sw.y() + ystep*double(r);
-            float& h = hf->getHeight(c, r);
-            VerticalDatum::transform( from, to, lat, lon, h );
+            double lon = scols > 1u ? sw.x() + (ne.x()-sw.x())*double(sc)/double(scols-1) : sw.x();
+            double offset = 0.0;
+            if ( from ) offset += from->msl2hae(lat, lon, 0.0) * scale;
+            if ( to )   offset += to->hae2msl(lat, lon, 0.0);
+            samples[sr*scols + sc] = (float)offset;
         }
     }
 
+    // Column interpolation weights are the same for every row.
+    std::vector<unsigned> col0(cols);
+    std::vector<float>    colT(cols);
+    for( unsigned c=0; c<cols; ++c )
+    {
+        double x = cols > 1u ? double(c)*double(scols-1)/double(cols-1) : 0.0;
+        col0[c] = osg::minimum((unsigned)x, scols > 1u ? scols-2u : 0u);
+        colT[c] = scols > 1u ? (float)(x - double(col0[c])) : 0.0f;
+    }
+
+    std::vector<float> rowSamples(scols);
+    std::vector<float> rowOffsets(cols);
+    const float fscale = (float)scale;
+    float* heights = &hf->getHeightList()[0];
+
+    for( unsigned r=0; r<rows; ++r )
+    {
+        double y = rows > 1u ? double(r)*double(srows-1)/double(rows-1) : 0.0;
+        unsigned r0 = osg::minimum((unsigned)y, srows > 1u ? srows-2u : 0u);
+        float ty = srows > 1u ? (float)(y - double(r0)) : 0.0f;
+        const float* s0 = &samples[r0*scols];
+        const float* s1 = srows > 1u ? s0 + scols : s0;
+
+        for( unsigned sc=0; sc<scols; ++sc )
+            rowSamples[sc] = s0[sc] + (s1[sc]-s0[sc])*ty;
+
+        for( unsigned c=0; c<cols; ++c )
+        {
+            const float* s = &rowSamples[col0[c]];
+            rowOffsets[c] = scols > 1u ? s[0] + (s[1]-s[0])*colT[c] : s[0];
+        }
+
+        // straight-line loop over the row so the compiler can vectorize it.
+        float*       h   = heights + r*cols;
+        const float* off = &rowOffsets[0];
+        for( unsigned c=0; c<cols; ++c )
+        {
+            h[c] = h[c] != NO_DATA_VALUE ? h[c]*fscale + off[c] : h[c];
+        }
+    }
+
+    return true;
+}
+
+bool
+VerticalDatum::transform(const VerticalDatum* from,
+                         const VerticalDatum* to,
+                         GeoHeightField&      hf)
+{
+    if ( !hf.valid() )
+        return false;
+
+    if ( from == to )
+        return true;
+
+    if ( !transform(from, to, hf.getExtent(), hf.getHeightField()) )
+        return false;
+
+    // rebuild so the recorded min/max heights match the new values.
+    hf = GeoHeightField( hf.getHeightField(), hf.getExtent() );
     return true;
 }
 
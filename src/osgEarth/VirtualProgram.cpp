@@ -23,6 +23,7 @@
 #include <osgEarth/ShaderFactory>
 #include <osgEarth/ShaderUtils>
 #include <osgEarth/Containers>
+#include <osgEarth/ProgramBinaryCache>
 #include <osg/Shader>
 #include <osg/Program>
 #include <osg/State>
@@ -527,6 +528,35 @@ VirtualProgram::ShaderEntry::operator < (const VirtualProgram::ShaderEntry& rhs)
 
 //------------------------------------------------------------------------
 
+void
+VirtualProgram::ProgramKey::computeHash()
+{
+    // sort by identity so that accumulation order doesn't matter.
+    std::sort( _shaders.begin(), _shaders.end() );
+
+    // FNV-1a over the shader pointers.
+    _hash = 2166136261u;
+    for(ShaderVector::const_iterator i = _shaders.begin(); i != _shaders.end(); ++i)
+    {
+        size_t p = (size_t)i->get();
+        for(unsigned b=0; b<sizeof(size_t); ++b, p >>= 8)
+        {
+            _hash ^= (unsigned)(p & 0xff);
+            _hash *= 16777619u;
+        }
+    }
+}
+
+bool
+VirtualProgram::ProgramKey::operator < (const VirtualProgram::ProgramKey& rhs) const
+{
+    if ( _hash != rhs._hash ) return _hash < rhs._hash;
+    if ( _shaders.size() != rhs._shaders.size() ) return _shaders.size() < rhs._shaders.size();
+    return _shaders < rhs._shaders;
+}
+
+//------------------------------------------------------------------------
+
 // same type as PROGRAM (for proper state sorting)
 const osg::StateAttribute::Type VirtualProgram::SA_TYPE = osg::StateAttribute::PROGRAM;
 
@@ -734,30 +764,69 @@ VirtualProgram::compileGLObjects(osg::State& state) const
 void
 VirtualProgram::resizeGLObjectBuffers(unsigned maxSize)
 {
-    Threading::ScopedWriteLock exclusive( _programCacheMutex );
-
     //  OE_WARN << LC << "Resize VP " << getName() << std::endl;
 
-    for (ProgramMap::iterator i = _programCache.begin(); i != _programCache.end(); ++i)
+    for (unsigned c = 0; c < _programCache.size(); ++c)
     {
-        i->second._program->resizeGLObjectBuffers(maxSize);
+        ProgramCache* cache = _programCache[c].get();
+        if ( cache )
+        {
+            Threading::ScopedMutexLock lock( cache->_mutex );
+            for (ProgramMap::iterator i = cache->_programs.begin(); i != cache->_programs.end(); ++i)
+            {
+                i->second._program->resizeGLObjectBuffers(maxSize);
+            }
+        }
     }
+
+    _programCache.resize(maxSize);
 }
 
 void
 VirtualProgram::releaseGLObjects(osg::State* state) const
 {
-    Threading::ScopedWriteLock exclusive( _programCacheMutex );
-
     //  OE_WARN << LC << "Release VP " << getName() << std::endl;
 
-    for (ProgramMap::const_iterator i = _programCache.begin(); i != _programCache.end(); ++i)
+    for (unsigned c = 0; c < _programCache.size(); ++c)
     {
-        //if ( i->second->referenceCount() == 1 )
-            i->second._program->releaseGLObjects(state);
+        // programs are per-context, but a shared program may still hold
+        // objects in other contexts, so release them all the same way as before.
+        ProgramCache* cache = _programCache[c].get();
+        if ( cache )
+        {
+            Threading::ScopedMutexLock lock( cache->_mutex );
+            for (ProgramMap::const_iterator i = cache->_programs.begin(); i != cache->_programs.end(); ++i)
+            {
+                //if ( i->second->referenceCount() == 1 )
+                    i->second._program->releaseGLObjects(state);
+            }
+            cache->_programs.clear();
+        }
     }
+}
 
-    _programCache.clear();
+VirtualProgram::ProgramCache*
+VirtualProgram::getProgramCache(unsigned contextID) const
+{
+    // Only the draw thread of this context creates its slot.
+    osg::ref_ptr<ProgramCache>& cache = _programCache[contextID];
+    if ( !cache.valid() )
+        cache = new ProgramCache();
+    return cache.get();
+}
+
+void
+VirtualProgram::clearProgramCaches()
+{
+    for (unsigned c = 0; c < _programCache.size(); ++c)
+    {
+        ProgramCache* cache = _programCache[c].get();
+        if ( cache )
+        {
+            Threading::ScopedMutexLock lock( cache->_mutex );
+            cache->_programs.clear();
+        }
+    }
 }
 
 osg::Shader*
@@ -984,10 +1053,7 @@ VirtualProgram::setInheritShaders( bool value )
         _inherit = value;
 
         // clear the program cache please
-        {
-            Threading::ScopedWriteLock exclusive(_programCacheMutex);
-            _programCache.clear();
-        }
+        clearProgramCaches();
 
         _inheritSet = true;
     }
@@ -1093,24 +1159,28 @@ VirtualProgram::apply( osg::State& state ) const
         // attribute bindings. Technically it should, but in practice this might not be an
         // issue; it is unlikely one would have two identical shader programs with different
         // bindings.)
-        ShaderVector vec;
-        vec.reserve( accumShaderMap.size() );
+        ProgramKey key;
+        key._shaders.reserve( accumShaderMap.size() );
         for( ShaderMap::iterator i = accumShaderMap.begin(); i != accumShaderMap.end(); ++i )
         {
             ShaderEntry& entry = i->second;
             //if ( i->second.accept(state) ) // no need; already did this earlier
             {
-                vec.push_back( entry._shader.get() );
+                key._shaders.push_back( entry._shader.get() );
             }
         }
+        key.computeHash();
 
         // current frame number, for shader program expiry.
         unsigned frameNumber = state.getFrameStamp() ? state.getFrameStamp()->getFrameNumber() : 0;
 
+        // this context's program cache.
+        ProgramCache& cache = *getProgramCache( contextID );
+
         // look up the program:
         {
-            Threading::ScopedReadLock shared( _programCacheMutex );
-            const_cast<VirtualProgram*>(this)->readProgramCache(vec, frameNumber, program);
+            Threading::ScopedMutexLock lock( cache._mutex );
+            readProgramCache(cache, key, frameNumber, program);
         }
 
         // if not found, lock and build it:
@@ -1123,13 +1193,14 @@ VirtualProgram::apply( osg::State& state ) const
             // now double-check the program cache, and failing that, build the
             // new shader Program.
             {
-                Threading::ScopedWriteLock exclusive( _programCacheMutex );
+                Threading::ScopedMutexLock lock( cache._mutex );
 
                 // double-check: look again to negate race conditions
-                const_cast<VirtualProgram*>(this)->readProgramCache(vec, frameNumber, program);
+                readProgramCache(cache, key, frameNumber, program);
                 if ( !program.valid() )
                 {
-                    ShaderVector keyVector;
+                    ProgramKey builtKey;
+                    ShaderVector& keyVector = builtKey._shaders;
 
                     //OE_NOTICE << LC << "Building new Program for VP " << getName() << std::endl;
 
@@ -1171,16 +1242,24 @@ VirtualProgram::apply( osg::State& state ) const
                         }
                     }
 
+                    // reuse the binary linked for this program in an earlier run, if any.
+                    ProgramBinaryCache* binaries = Registry::programBinaryCache();
+                    if ( program.valid() && binaries && binaries->isEnabled() )
+                    {
+                        binaries->read( program.get() );
+                    }
+
                     // global sharing.
                     Registry::programSharedRepo()->share( program );
 
                     // finally, put own new program in the cache.
-                    ProgramEntry& pe = _programCache[keyVector];
+                    builtKey.computeHash();
+                    ProgramEntry& pe = cache._programs[builtKey];
                     pe._program = program.get();
                     pe._frameLastUsed = frameNumber;
 
                     // purge expired programs.
-                    const_cast<VirtualProgram*>(this)->removeExpiredProgramsFromCache(state, frameNumber);
+                    removeExpiredProgramsFromCache(cache, state, frameNumber);
                 }
             }
         }
@@ -1242,8 +1321,27 @@ VirtualProgram::apply( osg::State& state ) const
         if ( useProgram )
         {
             if( pcp->needsLink() )
+            {
                 program->compileGLObjects( state );
 
+                ProgramBinaryCache* binaries = Registry::programBinaryCache();
+                if ( binaries && binaries->isEnabled() )
+                {
+                    if ( pcp->isLinked() )
+                    {
+                        // save it for the next run.
+                        binaries->write( program.get(), state );
+                    }
+                    else if ( program->getProgramBinary() )
+                    {
+                        // the driver refused the cached binary (e.g. after a
+                        // driver update), so relink from the sources.
+                        binaries->discard( program.get() );
+                        program->compileGLObjects( state );
+                    }
+                }
+            }
+
             if( pcp->isLinked() )
             {
                 if( osg::isNotifyEnabled(osg::INFO) )
@@ -1274,12 +1372,12 @@ VirtualProgram::apply( osg::State& state ) const
 }
 
 void
-VirtualProgram::removeExpiredProgramsFromCache(osg::State& state, unsigned frameNumber)
+VirtualProgram::removeExpiredProgramsFromCache(ProgramCache& cache, osg::State& state, unsigned frameNumber) const
 {
     if ( frameNumber > 0 )
     {
         // ASSUME a mutex lock on the cache.
-        for(ProgramMap::iterator k=_programCache.begin(); k!=_programCache.end(); )
+        for(ProgramMap::iterator k=cache._programs.begin(); k!=cache._programs.end(); )
         {
             if ( frameNumber - k->second._frameLastUsed > 2 )
             {
@@ -1287,7 +1385,7 @@ VirtualProgram::removeExpiredProgramsFromCache(osg::State& state, unsigned frame
                 {
                     k->second._program->releaseGLObjects(&state);
                 }
-                k = _programCache.erase(k);
+                cache._programs.erase(k++);
             }
             else
             {
@@ -1298,10 +1396,10 @@ VirtualProgram::removeExpiredProgramsFromCache(osg::State& state, unsigned frame
 }
 
 bool
-VirtualProgram::readProgramCache(const ShaderVector& vec, unsigned frameNumber, osg::ref_ptr<osg::Program>& program)
+VirtualProgram::readProgramCache(ProgramCache& cache, const ProgramKey& key, unsigned frameNumber, osg::ref_ptr<osg::Program>& program) const
 {
-    ProgramMap::iterator p = _programCache.find( vec );
-    if ( p != _programCache.end() )
+    ProgramMap::iterator p = cache._programs.find( key );
+    if ( p != cache._programs.end() )
     {
         //OE_NOTICE << "found. fn=" << frameNumber << ", flu=" << p->second._frameLastUsed << std::endl;
 
@@ -1315,7 +1413,7 @@ VirtualProgram::readProgramCache(const ShaderVector& vec, unsigned frameNumber,
         else
         {
             // remove it; it's too old.
-            _programCache.erase( p );
+            cache._programs.erase( p );
         }
     }
     return program.valid();
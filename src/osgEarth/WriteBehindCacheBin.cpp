@@ -0,0 +1,380 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/WriteBehindCacheBin>
+#include <osgEarth/StringUtils>
+#include <osg/Image>
+#include <osg/Math>
+
+using namespace osgEarth;
+using namespace osgEarth::Threading;
+
+#define LC "[WriteBehindCacheBin] "
+
+//------------------------------------------------------------------------
+
+void
+WriteBehindCacheBin::IOThread::run()
+{
+    _bin->commitPending();
+}
+
+//------------------------------------------------------------------------
+
+WriteBehindCacheBin::WriteBehindCacheBin( CacheBin* bin, unsigned maxQueueSize ) :
+CacheBin     ( bin ? bin->getID() : std::string() ),
+_bin         ( bin ),
+_maxQueueSize( osg::maximum(maxQueueSize, 1u) ),
+_done        ( false ),
+_thread      ( 0L )
+{
+    if ( _bin.valid() )
+    {
+        setHashKeys( _bin->getHashKeys() );
+
+        _thread = new IOThread( this );
+        _thread->start();
+    }
+}
+
+WriteBehindCacheBin::~WriteBehindCacheBin()
+{
+    if ( _thread )
+    {
+        {
+            ScopedMutexLock lock( _mutex );
+            _done = true;
+            _workAvailable.broadcast();
+        }
+
+        // the thread drains the queue before exiting.
+        _thread->join();
+        delete _thread;
+        _thread = 0L;
+    }
+}
+
+void
+WriteBehindCacheBin::commitPending()
+{
+    std::list<std::string> order;
+
+    for(;;)
+    {
+        {
+            ScopedMutexLock lock( _mutex );
+
+            while( _pending.empty() && !_done )
+                _workAvailable.wait( &_mutex );
+
+            if ( _pending.empty() )
+                break;
+
+            // pick up everything queued so far in one go; anything written
+            // from here on queues up behind this batch.
+            _inFlight.swap( _pending );
+            order.swap( _order );
+            _spaceAvailable.broadcast();
+        }
+
+        // _inFlight only changes on this thread, so we can read it unlocked.
+        RecordVector batch;
+        batch.reserve( order.size() );
+        for( std::list<std::string>::const_iterator i = order.begin(); i != order.end(); ++i )
+        {
+            PendingMap::const_iterator p = _inFlight.find( *i );
+            batch.push_back( Record(*i, p->second._object.get(), p->second._meta) );
+        }
+        order.clear();
+
+        if ( !_bin->writeBatch(batch) )
+        {
+            OE_DEBUG << LC << "Some deferred writes to bin " << getID() << " failed" << std::endl;
+        }
+
+        {
+            ScopedMutexLock lock( _mutex );
+            _inFlight.clear();
+            _idle.broadcast();
+        }
+    }
+}
+
+bool
+WriteBehindCacheBin::findPending( const std::string& key, Pending& output ) const
+{
+    ScopedMutexLock lock( _mutex );
+
+    PendingMap::const_iterator i = _pending.find( key );
+    if ( i != _pending.end() )
+    {
+        output = i->second;
+        return true;
+    }
+
+    i = _inFlight.find( key );
+    if ( i != _inFlight.end() )
+    {
+        output = i->second;
+        return true;
+    }
+
+    return false;
+}
+
+void
+WriteBehindCacheBin::waitForKey( const std::string& key )
+{
+    // caller must hold _mutex.
+    while( _inFlight.find(key) != _inFlight.end() )
+        _idle.wait( &_mutex );
+}
+
+unsigned
+WriteBehindCacheBin::getNumPendingWrites() const
+{
+    ScopedMutexLock lock( _mutex );
+    return _pending.size() + _inFlight.size();
+}
+
+void
+WriteBehindCacheBin::flush()
+{
+    ScopedMutexLock lock( _mutex );
+    while( !_pending.empty() || !_inFlight.empty() )
+        _idle.wait( &_mutex );
+}
+
+ReadResult
+WriteBehindCacheBin::readObject(const std::string& key)
+{
+    Pending record;
+    if ( findPending(key, record) )
+    {
+        ReadResult rr( const_cast<osg::Object*>(record._object.get()), record._meta );
+        rr.setLastModifiedTime( record._time );
+        return rr;
+    }
+
+    return _bin.valid() ? _bin->readObject(key) : ReadResult();
+}
+
+ReadResult
+WriteBehindCacheBin::readImage(const std::string& key)
+{
+    Pending record;
+    if ( findPending(key, record) )
+    {
+        const osg::Image* image = dynamic_cast<const osg::Image*>( record._object.get() );
+        if ( !image )
+            return ReadResult();
+
+        ReadResult rr( const_cast<osg::Image*>(image), record._meta );
+        rr.setLastModifiedTime( record._time );
+        return rr;
+    }
+
+    return _bin.valid() ? _bin->readImage(key) : ReadResult();
+}
+
+ReadResult
+WriteBehindCacheBin::readString(const std::string& key)
+{
+    Pending record;
+    if ( findPending(key, record) )
+    {
+        const StringObject* str = dynamic_cast<const StringObject*>( record._object.get() );
+        if ( !str )
+            return ReadResult();
+
+        ReadResult rr( const_cast<StringObject*>(str), record._meta );
+        rr.setLastModifiedTime( record._time );
+        return rr;
+    }
+
+    return _bin.valid() ? _bin->readString(key) : ReadResult();
+}
+
+bool
+WriteBehindCacheBin::write(const std::string& key, const osg::Object* object, const Config& meta)
+{
+    if ( !_bin.valid() || !object )
+        return false;
+
+    ScopedMutexLock lock( _mutex );
+
+    PendingMap::iterator i = _pending.find( key );
+    if ( i == _pending.end() )
+    {
+        // back-pressure: block until the I/O thread makes room.
+        while( _pending.size() >= _maxQueueSize && !_done )
+            _spaceAvailable.wait( &_mutex );
+
+        i = _pending.insert( PendingMap::value_type(key, Pending()) ).first;
+        _order.push_back( key );
+    }
+
+    // a repeated write to a queued key simply replaces it.
+    Pending& record = i->second;
+    record._object = object;
+    record._meta   = meta;
+    record._time   = DateTime().asTimeStamp();
+
+    _workAvailable.signal();
+    return true;
+}
+
+void
+WriteBehindCacheBin::readMany(const std::vector<std::string>& keys, std::vector<ReadResult>& output)
+{
+    if ( !_bin.valid() )
+        return;
+
+    // answer what we can from the queue and batch the rest through to the bin.
+    std::vector<ReadResult>  results( keys.size() );
+    std::vector<std::string> missKeys;
+    std::vector<unsigned>    missSlots;
+
+    for( unsigned i = 0; i < keys.size(); ++i )
+    {
+        Pending record;
+        if ( findPending(keys[i], record) )
+        {
+            results[i] = ReadResult( const_cast<osg::Object*>(record._object.get()), record._meta );
+            results[i].setLastModifiedTime( record._time );
+        }
+        else
+        {
+            missKeys.push_back( keys[i] );
+            missSlots.push_back( i );
+        }
+    }
+
+    if ( !missKeys.empty() )
+    {
+        std::vector<ReadResult> missResults;
+        _bin->readMany( missKeys, missResults );
+        for( unsigned i = 0; i < missSlots.size() && i < missResults.size(); ++i )
+            results[missSlots[i]] = missResults[i];
+    }
+
+    output.insert( output.end(), results.begin(), results.end() );
+}
+
+CacheBin::RecordStatus
+WriteBehindCacheBin::getRecordStatus(const std::string& key)
+{
+    Pending record;
+    if ( findPending(key, record) )
+        return STATUS_OK;
+
+    return _bin.valid() ? _bin->getRecordStatus(key) : STATUS_NOT_FOUND;
+}
+
+bool
+WriteBehindCacheBin::remove(const std::string& key)
+{
+    if ( !_bin.valid() )
+        return false;
+
+    bool removed = false;
+    {
+        ScopedMutexLock lock( _mutex );
+
+        if ( _pending.erase(key) > 0 )
+        {
+            _order.remove( key );
+            _spaceAvailable.broadcast();
+            removed = true;
+        }
+
+        // don't let an in-flight write land after the removal.
+        waitForKey( key );
+    }
+
+    return _bin->remove(key) || removed;
+}
+
+bool
+WriteBehindCacheBin::touch(const std::string& key)
+{
+    if ( !_bin.valid() )
+        return false;
+
+    {
+        ScopedMutexLock lock( _mutex );
+
+        PendingMap::iterator i = _pending.find( key );
+        if ( i != _pending.end() )
+        {
+            i->second._time = DateTime().asTimeStamp();
+            return true;
+        }
+
+        waitForKey( key );
+    }
+
+    return _bin->touch(key);
+}
+
+Config
+WriteBehindCacheBin::readMetadata()
+{
+    return _bin.valid() ? _bin->readMetadata() : Config();
+}
+
+bool
+WriteBehindCacheBin::writeMetadata( const Config& meta )
+{
+    return _bin.valid() ? _bin->writeMetadata(meta) : false;
+}
+
+bool
+WriteBehindCacheBin::clear()
+{
+    if ( !_bin.valid() )
+        return false;
+
+    {
+        ScopedMutexLock lock( _mutex );
+        _pending.clear();
+        _order.clear();
+        _spaceAvailable.broadcast();
+
+        while( !_inFlight.empty() )
+            _idle.wait( &_mutex );
+    }
+
+    return _bin->clear();
+}
+
+bool
+WriteBehindCacheBin::compact()
+{
+    if ( !_bin.valid() )
+        return false;
+
+    flush();
+    return _bin->compact();
+}
+
+unsigned
+WriteBehindCacheBin::getStorageSize()
+{
+    return _bin.valid() ? _bin->getStorageSize() : 0u;
+}
@@ -22,9 +22,18 @@
 #include <osgEarthAnnotation/AnnotationUtils>
 
 #include <osgEarth/DepthOffset>
+#include <osgEarth/FrameStats>
 #include <osgEarth/MapNode>
 #include <osgEarth/NodeUtils>
 #include <osgEarth/TerrainEngineNode>
+#include <osgEarth/ThreadingUtils>
+#include <algorithm>
+
+#define LC "[AnnotationNode] "
+
+// resolution of the auto-clamp index grid laid over the terrain profile.
+#define INDEX_COLS 64
+#define INDEX_ROWS 32
 
 using namespace osgEarth;
 using namespace osgEarth::Annotation;
@@ -33,19 +42,144 @@ using namespace osgEarth::Annotation;
 
 namespace osgEarth { namespace Annotation
 {
+    /**
+     * One of these is installed per Terrain. It indexes the auto-clamped
+     * annotations by their map extent so that an incoming tile only visits
+     * the annotations it overlaps, and queues a reclamp on each of them.
+     */
     struct AutoClampCallback : public TerrainCallback
     {
-        AutoClampCallback( AnnotationNode* annotation):
-        _annotation( annotation )
+        AutoClampCallback( const Terrain* terrain ) :
+        _extent( terrain->getProfile()->getExtent() ),
+        _cells ( INDEX_COLS*INDEX_ROWS )
+        {
+        }
+
+        /** Finds the callback installed on a terrain, installing it if necessary. */
+        static AutoClampCallback* get( Terrain* terrain )
+        {
+            static Threading::Mutex s_mutex;
+            static std::map<const Terrain*, osg::observer_ptr<AutoClampCallback> > s_callbacks;
+
+            Threading::ScopedMutexLock lock( s_mutex );
+            osg::ref_ptr<AutoClampCallback> cb;
+            if ( !s_callbacks[terrain].lock(cb) )
+            {
+                cb = new AutoClampCallback( terrain );
+                s_callbacks[terrain] = cb.get();
+                terrain->addTerrainCallback( cb.get() );
+            }
+            return cb.get();
+        }
+
+        /** Adds or re-indexes an annotation; an invalid extent means "everywhere". */
+        void insert( AnnotationNode* annotation, const GeoExtent& extent )
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            removeImpl( annotation );
+
+            Entry& entry = _entries[annotation];
+            entry._extent = extent.isValid() ? extent.transform(_extent.getSRS()) : GeoExtent::INVALID;
+            if ( entry._extent.isValid() )
+            {
+                getCells( entry._extent, entry._c0, entry._r0, entry._c1, entry._r1 );
+                for( unsigned r = entry._r0; r <= entry._r1; ++r )
+                    for( unsigned c = entry._c0; c <= entry._c1; ++c )
+                        _cells[r*INDEX_COLS+c].push_back( annotation );
+            }
+            else
+            {
+                _global.push_back( annotation );
+            }
+        }
+
+        void remove( AnnotationNode* annotation )
         {
+            Threading::ScopedMutexLock lock( _mutex );
+            removeImpl( annotation );
         }
 
         void onTileAdded( const TileKey& key, osg::Node* tile, TerrainCallbackContext& context )
         {
-            _annotation->reclamp( key, tile, context.getTerrain() );
+            Threading::ScopedMutexLock lock( _mutex );
+
+            const GeoExtent& tileExtent = key.getExtent();
+
+            std::vector<AnnotationNode*> hits( _global );
+            unsigned c0, r0, c1, r1;
+            getCells( tileExtent, c0, r0, c1, r1 );
+            for( unsigned r = r0; r <= r1; ++r )
+            {
+                for( unsigned c = c0; c <= c1; ++c )
+                {
+                    const Bucket& bucket = _cells[r*INDEX_COLS+c];
+                    for( Bucket::const_iterator i = bucket.begin(); i != bucket.end(); ++i )
+                    {
+                        if ( _entries[*i]._extent.intersects(tileExtent, false) )
+                            hits.push_back( *i );
+                    }
+                }
+            }
+
+            // an annotation spanning several cells shows up once per cell.
+            std::sort( hits.begin(), hits.end() );
+            hits.erase( std::unique(hits.begin(), hits.end()), hits.end() );
+
+            for( std::vector<AnnotationNode*>::iterator i = hits.begin(); i != hits.end(); ++i )
+            {
+                (*i)->queueReclamp( key, tile );
+            }
+        }
+
+    private:
+        typedef std::vector<AnnotationNode*> Bucket;
+
+        struct Entry
+        {
+            Entry() : _c0(0u), _r0(0u), _c1(0u), _r1(0u) { }
+            GeoExtent _extent;
+            unsigned  _c0, _r0, _c1, _r1;
+        };
+
+        void getCells( const GeoExtent& e, unsigned& c0, unsigned& r0, unsigned& c1, unsigned& r1 ) const
+        {
+            double cw = _extent.width()/(double)INDEX_COLS, ch = _extent.height()/(double)INDEX_ROWS;
+            c0 = (unsigned)osg::clampBetween( (int)floor((e.xMin()-_extent.xMin())/cw), 0, INDEX_COLS-1 );
+            c1 = (unsigned)osg::clampBetween( (int)floor((e.xMax()-_extent.xMin())/cw), 0, INDEX_COLS-1 );
+            r0 = (unsigned)osg::clampBetween( (int)floor((e.yMin()-_extent.yMin())/ch), 0, INDEX_ROWS-1 );
+            r1 = (unsigned)osg::clampBetween( (int)floor((e.yMax()-_extent.yMin())/ch), 0, INDEX_ROWS-1 );
+        }
+
+        void removeImpl( AnnotationNode* annotation )
+        {
+            std::map<AnnotationNode*, Entry>::iterator i = _entries.find( annotation );
+            if ( i == _entries.end() )
+                return;
+
+            const Entry& entry = i->second;
+            if ( entry._extent.isValid() )
+            {
+                for( unsigned r = entry._r0; r <= entry._r1; ++r )
+                {
+                    for( unsigned c = entry._c0; c <= entry._c1; ++c )
+                    {
+                        Bucket& bucket = _cells[r*INDEX_COLS+c];
+                        bucket.erase( std::remove(bucket.begin(), bucket.end(), annotation), bucket.end() );
+                    }
+                }
+            }
+            else
+            {
+                _global.erase( std::remove(_global.begin(), _global.end(), annotation), _global.end() );
+            }
+            _entries.erase( i );
         }
 
-        AnnotationNode* _annotation;
+        GeoExtent                        _extent;
+        std::vector<Bucket>              _cells;
+        Bucket                           _global;
+        std::map<AnnotationNode*, Entry> _entries;
+        Threading::Mutex                 _mutex;
     };
 }  }
 
@@ -108,6 +242,10 @@ _activeDs   ( 0L )
 AnnotationNode::~AnnotationNode()
 {
     setMapNode( 0L );
+
+    // in case the map node went away before we did:
+    if ( _autoClampCallback.valid() )
+        static_cast<AutoClampCallback*>(_autoClampCallback.get())->remove( this );
 }
 
 void
@@ -132,16 +270,19 @@ AnnotationNode::setMapNode( MapNode* mapNode )
         osg::ref_ptr<MapNode> oldMapNode = _mapNode.get();
         if ( oldMapNode.valid() )
         {
-            if ( _autoClampCallback )
+            if ( _autoClampCallback.valid() )
             {
-                oldMapNode->getTerrain()->removeTerrainCallback( _autoClampCallback.get() );
+                static_cast<AutoClampCallback*>(_autoClampCallback.get())->remove( this );
+                _autoClampCallback = 0L;
                 if ( mapNode )
-                    mapNode->getTerrain()->addTerrainCallback( _autoClampCallback.get() );
+                    _autoClampCallback = AutoClampCallback::get( mapNode->getTerrain() );
             }
         }		
 
         _mapNode = mapNode;
 
+        updateReclampIndex();
+
 		applyStyle( this->getStyle() );
     }
 }
@@ -179,17 +320,19 @@ AnnotationNode::setCPUAutoClamping( bool value )
 
             if ( AnnotationSettings::getContinuousClamping() )
             {
-                _autoClampCallback = new AutoClampCallback( this );
-                getMapNode()->getTerrain()->addTerrainCallback( _autoClampCallback.get() );
+                _autoClampCallback = AutoClampCallback::get( getMapNode()->getTerrain() );
             }
         }
         else if ( _autoclamp && !value && _autoClampCallback.valid())
         {
-            getMapNode()->getTerrain()->removeTerrainCallback( _autoClampCallback );
+            static_cast<AutoClampCallback*>(_autoClampCallback.get())->remove( this );
             _autoClampCallback = 0;
         }
 
         _autoclamp = value;
+
+        // re-index on every call, since this is how position changes reach us.
+        updateReclampIndex();
         
         if ( _autoclamp && AnnotationSettings::getApplyDepthOffsetToClampedLines() )
         {
@@ -215,6 +358,122 @@ AnnotationNode::setCPUAutoClamping( bool value )
     }
 }
 
+void
+AnnotationNode::updateReclampIndex()
+{
+    if ( _autoClampCallback.valid() )
+    {
+        GeoExtent extent;
+        if ( !getReclampExtent(extent) )
+            extent = GeoExtent::INVALID;
+
+        static_cast<AutoClampCallback*>(_autoClampCallback.get())->insert( this, extent );
+    }
+}
+
+void
+AnnotationNode::queueReclamp( const TileKey& key, osg::Node* tile )
+{
+    // reclamping waits for the next update traversal, so that all the tiles
+    // arriving in one frame cost a single reclamp.
+    if ( _pendingReclamps.empty() )
+    {
+        ADJUST_UPDATE_TRAV_COUNT( this, 1 );
+    }
+
+    ReclampTile rt;
+    rt._key  = key;
+    rt._tile = tile;
+    _pendingReclamps.push_back( rt );
+}
+
+void
+AnnotationNode::reclampTiles( const ReclampTiles& tiles, const Terrain* terrain )
+{
+    for( ReclampTiles::const_iterator i = tiles.begin(); i != tiles.end(); ++i )
+    {
+        reclamp( i->_key, i->_tile.get(), terrain );
+    }
+}
+
+bool
+AnnotationNode::getReclampPatch(const ReclampTiles&      tiles,
+                                const osg::Polytope&     footprint,
+                                osg::ref_ptr<osg::Node>& out_patch)
+{
+    osg::ref_ptr<osg::Group> group;
+
+    for( ReclampTiles::const_iterator i = tiles.begin(); i != tiles.end(); ++i )
+    {
+        if ( footprint.contains(i->_tile->getBound()) ) // intersects, actually
+        {
+            if ( !out_patch.valid() )
+            {
+                out_patch = i->_tile.get();
+            }
+            else
+            {
+                if ( !group.valid() )
+                {
+                    group = new osg::Group();
+                    group->addChild( out_patch.get() );
+                    out_patch = group.get();
+                }
+                group->addChild( i->_tile.get() );
+            }
+        }
+    }
+
+    return out_patch.valid();
+}
+
+const AnnotationNode::ReclampTile*
+AnnotationNode::getReclampTile(const ReclampTiles& tiles,
+                               const GeoPoint&     mapPoint)
+{
+    const ReclampTile* best = 0L;
+
+    for( ReclampTiles::const_iterator i = tiles.begin(); i != tiles.end(); ++i )
+    {
+        if ( (!best || i->_key.getLOD() > best->_key.getLOD()) &&
+             i->_key.getExtent().contains(mapPoint.x(), mapPoint.y()) )
+        {
+            best = &(*i);
+        }
+    }
+
+    return best;
+}
+
+void
+AnnotationNode::traverse( osg::NodeVisitor& nv )
+{
+    FrameStats::CullTimer cullTimer( nv, FrameStats::CULL_ANNOTATIONS );
+
+    if ( nv.getVisitorType() == nv.UPDATE_VISITOR && !_pendingReclamps.empty() )
+    {
+        ReclampTiles tiles;
+        tiles.swap( _pendingReclamps );
+        ADJUST_UPDATE_TRAV_COUNT( this, -1 );
+
+        // skip tiles that have already left the scene graph.
+        for( ReclampTiles::iterator i = tiles.begin(); i != tiles.end(); )
+        {
+            if ( i->_tile->getNumParents() == 0 )
+                i = tiles.erase( i );
+            else
+                ++i;
+        }
+
+        if ( !tiles.empty() && getMapNode() )
+        {
+            reclampTiles( tiles, getMapNode()->getTerrain() );
+        }
+    }
+
+    osg::Group::traverse( nv );
+}
+
 void
 AnnotationNode::setDepthAdjustment( bool enable )
 {
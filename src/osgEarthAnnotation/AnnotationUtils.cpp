@@ -37,6 +37,36 @@
 using namespace osgEarth;
 using namespace osgEarth::Annotation;
 
+namespace
+{
+    // Fonts shared by all text drawables, so that every label using a given
+    // font draws from the same glyph textures and state set.
+    typedef std::map<std::string, osg::ref_ptr<osgText::Font> > FontCache;
+
+    Threading::Mutex s_fontCacheMutex;
+    FontCache        s_fontCache;
+
+    osgText::Font* getSharedFont(const std::string& name)
+    {
+        Threading::ScopedMutexLock lock( s_fontCacheMutex );
+
+        FontCache::iterator i = s_fontCache.find( name );
+        if ( i != s_fontCache.end() )
+            return i->second.get();
+
+        osgText::Font* font = osgText::readFontFile( name );
+        // mitigates mipmapping issues that cause rendering artifacts for some fonts/placement
+        if ( font )
+            font->setGlyphImageMargin( 2 );
+
+        // remember failures too, so we don't search for a missing font again.
+        s_fontCache[name] = font;
+        return font;
+    }
+}
+
+//---------------------------------------------------------------------------
+
 const std::string&
 AnnotationUtils::PROGRAM_NAME()
 {
@@ -88,15 +118,10 @@ AnnotationUtils::createTextDrawable(const std::string& text,
                                     const osg::Vec3&   positionOffset )
                                     
 {
+    // Note: every osgText setter re-computes the glyph layout, so we configure
+    // the drawable while it's still empty and assign the text last; that way the
+    // layout is computed only once.
     osgText::Text* t = new osgText::Text();
-    
-    osgText::String::Encoding text_encoding = osgText::String::ENCODING_UNDEFINED;
-    if ( symbol && symbol->encoding().isSet() )
-    {
-        text_encoding = convertTextSymbolEncoding(symbol->encoding().value());
-    }
-
-    t->setText( text, text_encoding );
 
     // osgText::Text turns on depth writing by default, even if you turned it off.
     t->setEnableDepthWrites( false );
@@ -136,10 +161,7 @@ AnnotationUtils::createTextDrawable(const std::string& text,
     osgText::Font* font = 0L;
     if ( symbol && symbol->font().isSet() )
     {
-        font = osgText::readFontFile( *symbol->font() );
-        // mitigates mipmapping issues that cause rendering artifacts for some fonts/placement
-        if ( font )
-          font->setGlyphImageMargin( 2 );
+        font = getSharedFont( *symbol->font() );
     }
     if ( !font )
         font = Registry::instance()->getDefaultFont();
@@ -177,6 +199,14 @@ AnnotationUtils::createTextDrawable(const std::string& text,
     if ( t->getStateSet() )
       t->getStateSet()->setRenderBinToInherit();
 
+    osgText::String::Encoding text_encoding = osgText::String::ENCODING_UNDEFINED;
+    if ( symbol && symbol->encoding().isSet() )
+    {
+        text_encoding = convertTextSymbolEncoding(symbol->encoding().value());
+    }
+
+    t->setText( text, text_encoding );
+
     return t;
 }
 
@@ -0,0 +1,449 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthAnnotation/ClusterNode>
+#include <osgEarthAnnotation/LabelNode>
+#include <osgEarthAnnotation/PlaceNode>
+#include <osgEarth/CullingUtils>
+#include <osgEarth/StringUtils>
+#include <osgUtil/CullVisitor>
+#include <cfloat>
+
+#define LC "[ClusterNode] "
+
+using namespace osgEarth;
+using namespace osgEarth::Annotation;
+
+//------------------------------------------------------------------------
+
+ClusterNode::DefaultNodeFactory::DefaultNodeFactory(MapNode* mapNode, const Style& clusterStyle) :
+_mapNode     ( mapNode ),
+_clusterStyle( clusterStyle )
+{
+    //nop
+}
+
+osg::Node*
+ClusterNode::DefaultNodeFactory::createPlacemark(const Placemark& placemark)
+{
+    return new PlaceNode( _mapNode.get(), placemark._position, placemark._name, placemark._style );
+}
+
+osg::Node*
+ClusterNode::DefaultNodeFactory::createCluster(const GeoPoint& center, unsigned count)
+{
+    return new LabelNode( _mapNode.get(), center, Stringify() << count, _clusterStyle );
+}
+
+//------------------------------------------------------------------------
+
+ClusterNode::ClusterNode(MapNode* mapNode, NodeFactory* factory) :
+_mapNode           ( mapNode ),
+_factory           ( factory ),
+_root              ( 0L ),
+_dirty             ( false ),
+_clusterPixelRadius( 64.0f ),
+_maxPerCell        ( 16u ),
+_maxInactiveFrames ( 300u ),
+_maxCreatesPerFrame( 64u ),
+_numActiveNodes    ( 0u )
+{
+    if ( !_factory.valid() )
+        _factory = new DefaultNodeFactory( mapNode );
+
+    // we page nodes in and out during the update traversal.
+    setNumChildrenRequiringUpdateTraversal( 1 );
+}
+
+ClusterNode::~ClusterNode()
+{
+    destroy( _root );
+}
+
+void
+ClusterNode::add(const Placemark& placemark)
+{
+    if ( !placemark._position.isValid() )
+        return;
+
+    _placemarks.push_back( placemark );
+    _prebuiltNodes.push_back( 0L );
+    _dirty = true;
+    dirtyBound();
+}
+
+void
+ClusterNode::add(const GeoPoint& position, osg::Node* node)
+{
+    if ( !position.isValid() || !node )
+        return;
+
+    Placemark placemark;
+    placemark._position = position;
+    _placemarks.push_back( placemark );
+    _prebuiltNodes.push_back( node );
+    _dirty = true;
+    dirtyBound();
+}
+
+void
+ClusterNode::clear()
+{
+    Threading::ScopedMutexLock lock( _buildMutex );
+    destroy( _root );
+    _root = 0L;
+    _placemarks.clear();
+    _prebuiltNodes.clear();
+    _active.clear();
+    _numActiveNodes = 0u;
+    {
+        Threading::ScopedMutexLock lock( _requestsMutex );
+        _requests.clear();
+    }
+    _dirty = false;
+    dirtyBound();
+}
+
+void
+ClusterNode::setClusterPixelRadius(float value)
+{
+    _clusterPixelRadius = osg::maximum( value, 1.0f );
+}
+
+void
+ClusterNode::setMaxPlacemarksPerCell(unsigned value)
+{
+    _maxPerCell = osg::maximum( value, 1u );
+    _dirty = true;
+}
+
+void
+ClusterNode::destroy(Cell* cell)
+{
+    if ( cell )
+    {
+        for( std::vector<Cell*>::iterator i = cell->_children.begin(); i != cell->_children.end(); ++i )
+            destroy( *i );
+        delete cell;
+    }
+}
+
+void
+ClusterNode::build()
+{
+    destroy( _root );
+    _root = 0L;
+    _active.clear();
+    _numActiveNodes = 0u;
+    {
+        Threading::ScopedMutexLock lock( _requestsMutex );
+        _requests.clear();
+    }
+
+    if ( _placemarks.empty() )
+        return;
+
+    _geoSRS = _placemarks.front()._position.getSRS()->getGeographicSRS();
+
+    std::vector<Entry> entries;
+    entries.reserve( _placemarks.size() );
+
+    double xmin = DBL_MAX, ymin = DBL_MAX, xmax = -DBL_MAX, ymax = -DBL_MAX;
+
+    for( unsigned i = 0; i < _placemarks.size(); ++i )
+    {
+        const GeoPoint& p = _placemarks[i]._position;
+
+        GeoPoint geo;
+        if ( !p.transform(_geoSRS.get(), geo) )
+            continue;
+
+        Entry e;
+        e._placemark = i;
+        e._geo.set( geo.x(), geo.y() );
+        e._prebuilt  = _prebuiltNodes[i].valid();
+        e._node      = _prebuiltNodes[i].get();
+        p.toWorld( e._world );
+        entries.push_back( e );
+
+        xmin = osg::minimum(xmin, geo.x()); xmax = osg::maximum(xmax, geo.x());
+        ymin = osg::minimum(ymin, geo.y()); ymax = osg::maximum(ymax, geo.y());
+    }
+
+    if ( !entries.empty() )
+    {
+        _root = buildCell( entries, xmin, ymin, xmax, ymax, 0u );
+    }
+
+    OE_DEBUG << LC << "Clustered " << _placemarks.size() << " placemarks" << std::endl;
+}
+
+ClusterNode::Cell*
+ClusterNode::buildCell(std::vector<Entry>& entries,
+                       double xmin, double ymin, double xmax, double ymax,
+                       unsigned depth)
+{
+    Cell* cell = new Cell();
+    cell->_count = entries.size();
+
+    double cx = 0.0, cy = 0.0;
+    for( std::vector<Entry>::const_iterator e = entries.begin(); e != entries.end(); ++e )
+    {
+        cell->_bound.expandBy( e->_world );
+        cx += e->_geo.x();
+        cy += e->_geo.y();
+    }
+    cell->_center = GeoPoint( _geoSRS.get(), cx/(double)cell->_count, cy/(double)cell->_count, 0.0, ALTMODE_RELATIVE );
+
+    // small enough (or too many coincident points to split): make a leaf.
+    if ( cell->_count <= _maxPerCell || depth >= 24u )
+    {
+        cell->_entries.swap( entries );
+
+        for( std::vector<Entry>::const_iterator e = cell->_entries.begin(); e != cell->_entries.end(); ++e )
+        {
+            if ( e->_prebuilt )
+            {
+                _active.insert( cell );
+                break;
+            }
+        }
+        return cell;
+    }
+
+    // otherwise split into quadrants.
+    double mx = 0.5*(xmin+xmax), my = 0.5*(ymin+ymax);
+    std::vector<Entry> quads[4];
+    for( std::vector<Entry>::const_iterator e = entries.begin(); e != entries.end(); ++e )
+    {
+        int q = (e->_geo.x() < mx ? 0 : 1) + (e->_geo.y() < my ? 0 : 2);
+        quads[q].push_back( *e );
+    }
+    std::vector<Entry>().swap( entries );
+
+    for( int q = 0; q < 4; ++q )
+    {
+        if ( !quads[q].empty() )
+        {
+            cell->_children.push_back( buildCell(
+                quads[q],
+                (q & 1) ? mx : xmin, (q & 2) ? my : ymin,
+                (q & 1) ? xmax : mx, (q & 2) ? ymax : my,
+                depth+1u ) );
+        }
+    }
+
+    return cell;
+}
+
+void
+ClusterNode::request(Cell* cell, bool marker)
+{
+    Threading::ScopedMutexLock lock( _requestsMutex );
+    _requests.push_back( std::make_pair(cell, marker) );
+}
+
+void
+ClusterNode::cull(Cell* cell, osgUtil::CullVisitor* cv, unsigned frame)
+{
+    if ( cv->isCulled(cell->_bound) )
+        return;
+
+    cell->_visitedFrame = frame;
+
+    // a cell that's small on screen is drawn as one cluster marker.
+    if ( cell->_count > 1u && cv->clampedPixelSize(cell->_bound) <= _clusterPixelRadius )
+    {
+        if ( cell->_marker.valid() )
+            cell->_marker->accept( *cv );
+        else
+            request( cell, true );
+        return;
+    }
+
+    if ( cell->_children.empty() )
+    {
+        bool missing = false;
+        for( std::vector<Entry>::iterator e = cell->_entries.begin(); e != cell->_entries.end(); ++e )
+        {
+            if ( e->_node.valid() )
+                e->_node->accept( *cv );
+            else
+                missing = true;
+        }
+        if ( missing )
+            request( cell, false );
+    }
+    else
+    {
+        for( std::vector<Cell*>::iterator i = cell->_children.begin(); i != cell->_children.end(); ++i )
+            cull( *i, cv, frame );
+    }
+}
+
+void
+ClusterNode::update(unsigned frame)
+{
+    std::vector<std::pair<Cell*, bool> > requests;
+    {
+        Threading::ScopedMutexLock lock( _requestsMutex );
+        requests.swap( _requests );
+    }
+
+    // page in the nodes requested by the last cull.
+    unsigned created = 0u;
+    for( unsigned i = 0; i < requests.size() && created < _maxCreatesPerFrame; ++i )
+    {
+        Cell* cell = requests[i].first;
+
+        if ( requests[i].second )
+        {
+            if ( !cell->_marker.valid() )
+            {
+                cell->_marker = _factory->createCluster( cell->_center, cell->_count );
+                if ( cell->_marker.valid() )
+                {
+                    ++created;
+                    ++_numActiveNodes;
+                }
+            }
+        }
+        else
+        {
+            for( std::vector<Entry>::iterator e = cell->_entries.begin(); e != cell->_entries.end(); ++e )
+            {
+                if ( !e->_node.valid() )
+                {
+                    e->_node = _factory->createPlacemark( _placemarks[e->_placemark] );
+                    if ( e->_node.valid() )
+                    {
+                        ++created;
+                        ++_numActiveNodes;
+                    }
+                }
+            }
+        }
+
+        cell->_visitedFrame = frame;
+        _active.insert( cell );
+    }
+
+    // page out the nodes nobody has seen in a while.
+    for( std::set<Cell*>::iterator i = _active.begin(); i != _active.end(); )
+    {
+        Cell* cell = *i;
+        if ( cell->_visitedFrame + _maxInactiveFrames < frame )
+        {
+            bool keep = false;
+
+            if ( cell->_marker.valid() )
+            {
+                cell->_marker = 0L;
+                --_numActiveNodes;
+            }
+
+            for( std::vector<Entry>::iterator e = cell->_entries.begin(); e != cell->_entries.end(); ++e )
+            {
+                if ( e->_prebuilt )
+                {
+                    keep = true;
+                }
+                else if ( e->_node.valid() )
+                {
+                    e->_node = 0L;
+                    --_numActiveNodes;
+                }
+            }
+
+            if ( !keep )
+            {
+                _active.erase( i++ );
+                continue;
+            }
+        }
+        ++i;
+    }
+}
+
+void
+ClusterNode::traverseActive(osg::NodeVisitor& nv)
+{
+    for( std::set<Cell*>::iterator i = _active.begin(); i != _active.end(); ++i )
+    {
+        Cell* cell = *i;
+        if ( cell->_marker.valid() )
+            cell->_marker->accept( nv );
+
+        for( std::vector<Entry>::iterator e = cell->_entries.begin(); e != cell->_entries.end(); ++e )
+        {
+            if ( e->_node.valid() )
+                e->_node->accept( nv );
+        }
+    }
+}
+
+void
+ClusterNode::traverse(osg::NodeVisitor& nv)
+{
+    if ( _dirty )
+    {
+        Threading::ScopedMutexLock lock( _buildMutex );
+        if ( _dirty )
+        {
+            build();
+            _dirty = false;
+        }
+    }
+
+    if ( !_root )
+        return;
+
+    unsigned frame = nv.getFrameStamp() ? nv.getFrameStamp()->getFrameNumber() : 0u;
+
+    if ( nv.getVisitorType() == nv.CULL_VISITOR )
+    {
+        osgUtil::CullVisitor* cv = Culling::asCullVisitor( nv );
+        if ( cv )
+            cull( _root, cv, frame );
+    }
+
+    else if ( nv.getVisitorType() == nv.UPDATE_VISITOR )
+    {
+        update( frame );
+        traverseActive( nv );
+    }
+
+    else
+    {
+        // everything else (intersections, etc.) sees whatever is in memory.
+        traverseActive( nv );
+    }
+}
+
+osg::BoundingSphere
+ClusterNode::computeBound() const
+{
+    osg::BoundingSphere bs;
+    for( std::vector<Placemark>::const_iterator i = _placemarks.begin(); i != _placemarks.end(); ++i )
+    {
+        osg::Vec3d world;
+        if ( i->_position.toWorld(world) )
+            bs.expandBy( world );
+    }
+    return bs;
+}
@@ -233,12 +233,36 @@ FeatureNode::reclamp( const TileKey& key, osg::Node* tile, const Terrain* terrai
 {
     if ( _featurePolytope.contains( tile->getBound() ) )
     {
-        clampMesh( tile );
+        clampMesh( tile, tile->getBound() );
     }
 }
 
+// Called by AnnotationNode with all the tiles that came in since the last update.
 void
-FeatureNode::clampMesh( osg::Node* terrainModel )
+FeatureNode::reclampTiles( const ReclampTiles& tiles, const Terrain* terrain )
+{
+    // one pass over the mesh, touching only the vertices the new tiles cover.
+    osg::ref_ptr<osg::Node> patch;
+    if ( getReclampPatch(tiles, _featurePolytope, patch) )
+    {
+        clampMesh( patch.get(), patch->getBound() );
+    }
+}
+
+bool
+FeatureNode::getReclampExtent( GeoExtent& out_extent ) const
+{
+    if ( _feature.valid() && _feature->getGeometry() && _feature->getSRS() && getMapNode() )
+    {
+        GeoExtent extent( _feature->getSRS(), _feature->getGeometry()->getBounds() );
+        out_extent = extent.transform( getMapNode()->getMapSRS() );
+        return out_extent.isValid();
+    }
+    return false;
+}
+
+void
+FeatureNode::clampMesh( osg::Node* terrainModel, const osg::BoundingSphere& scope )
 {
     if ( getMapNode() )
     {
@@ -256,6 +280,7 @@ FeatureNode::clampMesh( osg::Node* terrainModel )
         }
 
         MeshClamper clamper( terrainModel, getMapNode()->getMapSRS(), getMapNode()->isGeocentric(), relative, scale, offset );
+        clamper.setScope( scope );
         getAttachPoint()->accept( clamper );
 
         this->dirtyBound();
@@ -26,6 +26,9 @@
 #include <osgEarth/NodeUtils>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/DrapeableNode>
+#include <osgEarth/DrapingTechnique>
+#include <osgEarth/OverlayDecorator>
+#include <osgEarth/CullingUtils>
 #include <osgEarth/VirtualProgram>
 #include <osgEarth/Registry>
 #include <osgEarth/Capabilities>
@@ -52,6 +55,28 @@ namespace
     {
         l.y() = osg::clampBetween( l.y(), -90.0, 90.0);
     }
+
+    // tiles don't stay resident longer than this after they were last in view:
+    const unsigned TILE_EXPIRY_FRAMES = 120;
+
+    // new tiles built per frame; coarser tiles stand in for the rest.
+    const unsigned MAX_TILE_BUILDS_PER_FRAME = 4;
+
+    inline unsigned long long makeTileID(unsigned lod, unsigned x, unsigned y) {
+        return ((unsigned long long)lod << 56) | ((unsigned long long)x << 28) | (unsigned long long)y;
+    }
+    inline unsigned tileLOD(unsigned long long id) { return (unsigned)(id >> 56); }
+    inline unsigned tileX  (unsigned long long id) { return (unsigned)((id >> 28) & 0xfffffff); }
+    inline unsigned tileY  (unsigned long long id) { return (unsigned)(id & 0xfffffff); }
+
+    inline unsigned long long parentTileID(unsigned long long id) {
+        return makeTileID(tileLOD(id)-1, tileX(id)>>1, tileY(id)>>1);
+    }
+
+    // coarser tiles first, so they're built before the tiles they stand in for.
+    bool coarserTile(unsigned long long lhs, unsigned long long rhs) {
+        return tileLOD(lhs) < tileLOD(rhs) || (tileLOD(lhs) == tileLOD(rhs) && lhs < rhs);
+    }
 }
 
 //---------------------------------------------------------------------------
@@ -68,7 +93,12 @@ _dirty        (false),
 _alpha        (1.0f),
 _minFilter    (osg::Texture::LINEAR_MIPMAP_LINEAR),
 _magFilter    (osg::Texture::LINEAR),
-_texture      (0)
+_texture      (0),
+_tiled        (false),
+_tileSize     (512),
+_useTiles     (false),
+_maxTileLevel (0),
+_tileSelectionChanged(false)
 {
     conf.getIfSet( "url",   _imageURI );
     if ( _imageURI.isSet() )
@@ -77,6 +107,8 @@ _texture      (0)
     }
 
     conf.getIfSet( "alpha", _alpha );
+    conf.getIfSet( "tiled", _tiled );
+    conf.getIfSet( "tile_size", _tileSize );
     
     osg::ref_ptr<Geometry> geom;
     if ( conf.hasChild("geometry") )
@@ -133,6 +165,8 @@ ImageOverlay::getConfig() const
     }
 
     conf.addIfSet("alpha", _alpha);
+    conf.addIfSet("tiled", _tiled);
+    conf.addIfSet("tile_size", _tileSize);
 
     osg::ref_ptr<Geometry> g = new Polygon();
     g->push_back( osg::Vec3d(_lowerLeft.x(),  _lowerLeft.y(), 0) );
@@ -175,11 +209,21 @@ _dirty        (false),
 _alpha        (1.0f),
 _minFilter    (osg::Texture::LINEAR_MIPMAP_LINEAR),
 _magFilter    (osg::Texture::LINEAR),
-_texture      (0)
+_texture      (0),
+_tiled        (false),
+_tileSize     (512),
+_useTiles     (false),
+_maxTileLevel (0),
+_tileSelectionChanged(false)
 {        
     postCTOR();
 }
 
+ImageOverlay::~ImageOverlay()
+{
+    //nop
+}
+
 void
 ImageOverlay::postCTOR()
 {
@@ -194,6 +238,10 @@ ImageOverlay::postCTOR()
 
     d->addChild( _transform );
 
+    // holds the tiles in use in tiled mode:
+    _tileGroup = new osg::Group();
+    d->addChild( _tileGroup.get() );
+
     init();
 
     ADJUST_UPDATE_TRAV_COUNT( this, 1 );
@@ -206,6 +254,29 @@ ImageOverlay::init()
 
     _geode->removeDrawables(0, _geode->getNumDrawables() );
 
+    // tile geometry depends on the corners; the tile textures only on the image.
+    _useTiles = useTiles();
+    _tileGroup->removeChildren(0, _tileGroup->getNumChildren());
+    for(TileMap::iterator i = _tiles.begin(); i != _tiles.end(); ++i)
+        i->second._node = 0L;
+    if ( !_useTiles )
+        _tiles.clear();
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock(_tileMutex);
+        _tileBounds.clear();
+        _selectedTiles.clear();
+        _tileSelectionChanged = true;
+    }
+
+    if ( _useTiles )
+    {
+        // deepest level is where a tile covers no more image texels than it holds.
+        unsigned size = (unsigned)osg::maximum(_image->s(), _image->t());
+        _maxTileLevel = 0;
+        while( (size >> _maxTileLevel) > *_tileSize && _maxTileLevel < 20 )
+            ++_maxTileLevel;
+    }
+
     if ( getMapNode() )
     {
         double height = 0;
@@ -227,19 +298,16 @@ ImageOverlay::init()
         f->getWorldBoundingPolytope( getMapNode()->getMapSRS(), _boundingPolytope );
 
         // next, convert to world coords and create the geometry:
+        std::vector<osg::Vec3d> world( g->asVector() );
+        f->getSRS()->transform( world, mapSRS );
+        mapSRS->transformToWorld( world );
+
         osg::Vec3Array* verts = new osg::Vec3Array();
         verts->reserve(4);
-        osg::Vec3d anchor;
-        for( Geometry::iterator i = g->begin(); i != g->end(); ++i )
-        {        
-            osg::Vec3d map, world;        
-            f->getSRS()->transform( *i, mapSRS, map);
-            mapSRS->transformToWorld( map, world );
-            if (i == g->begin())
-            {
-                anchor = world;
-            }
-            verts->push_back( world - anchor );
+        osg::Vec3d anchor = world.front();
+        for( std::vector<osg::Vec3d>::const_iterator i = world.begin(); i != world.end(); ++i )
+        {
+            verts->push_back( *i - anchor );
         }
         
         _transform->setMatrix( osg::Matrixd::translate( anchor ) );
@@ -262,7 +330,7 @@ ImageOverlay::init()
         geometry->addPrimitiveSet(new osg::DrawElementsUShort( GL_TRIANGLES, 6, tris ) );
 
         bool flip = false;
-        if (_image.valid())
+        if (_image.valid() && !_useTiles)
         {
             //Create the texture
             _texture = new osg::Texture2D(_image.get());     
@@ -289,7 +357,9 @@ ImageOverlay::init()
             ms.run(*geometry, osg::DegreesToRadians(5.0), GEOINTERP_RHUMB_LINE);
         }
 
-        _geode->addDrawable( geometry );
+        // in tiled mode the geometry only serves for clamping and bounds.
+        if ( !_useTiles )
+            _geode->addDrawable( geometry );
 
         _geometry = geometry;
 
@@ -345,10 +415,37 @@ void ImageOverlay::setImage( osg::Image* image )
     if (_image != image)
     {
         _image = image;
+        _tiles.clear();
         dirty();        
     }
 }
 
+void
+ImageOverlay::setTiled( bool tiled )
+{
+    if ( tiled != *_tiled )
+    {
+        _tiled = tiled;
+        dirty();
+    }
+}
+
+void
+ImageOverlay::setTileSize( unsigned size )
+{
+    // tile textures are mipmapped, so keep them a power of two.
+    unsigned pot = 64;
+    while( pot < size && pot < 8192 )
+        pot <<= 1;
+
+    if ( pot != *_tileSize )
+    {
+        _tileSize = pot;
+        _tiles.clear();
+        dirty();
+    }
+}
+
 osg::Texture::FilterMode
     ImageOverlay::getMinFilter() const
 {
@@ -379,6 +476,21 @@ void
 ImageOverlay::updateFilters()
 {
     if (_texture)
+    {
+        updateFilters( _texture, _image.get() );
+    }
+
+    for(TileMap::iterator i = _tiles.begin(); i != _tiles.end(); ++i)
+    {
+        if ( i->second._texture.valid() )
+            updateFilters( i->second._texture.get(), i->second._texture->getImage() );
+    }
+}
+
+void
+ImageOverlay::updateFilters(osg::Texture* _texture, const osg::Image* _image)
+{
+    if (_texture && _image)
     {
         _texture->setFilter(osg::Texture::MAG_FILTER, *_magFilter);
 
@@ -681,6 +793,32 @@ ImageOverlay::traverse(osg::NodeVisitor &nv)
     {
         init();        
     }
+
+    if ( _useTiles )
+    {
+        if ( nv.getVisitorType() == osg::NodeVisitor::UPDATE_VISITOR )
+        {
+            updateTiles( nv.getFrameStamp() ? nv.getFrameStamp()->getFrameNumber() : 0u );
+        }
+        else if ( nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR )
+        {
+            // pick tiles for the main camera; the draping camera renders them.
+            osgUtil::CullVisitor* cv = Culling::asCullVisitor(nv);
+            if ( cv )
+            {
+                std::vector<TileID> selected;
+                selectTiles( cv, makeTileID(0,0,0), selected );
+
+                OpenThreads::ScopedLock< OpenThreads::Mutex > lock(_tileMutex);
+                if ( selected != _selectedTiles )
+                {
+                    _selectedTiles.swap( selected );
+                    _tileSelectionChanged = true;
+                }
+            }
+        }
+    }
+
     AnnotationNode::traverse(nv);
 }
 
@@ -715,18 +853,318 @@ ImageOverlay::removeCallback( ImageOverlayCallback* cb )
 }
 
 
+//---------------------------------------------------------------------------
+// Tiled mode
+
+bool
+ImageOverlay::useTiles() const
+{
+    if ( !_image.valid() || !getMapNode() )
+        return false;
+
+    int maxSize = Registry::capabilities().getMaxTextureSize();
+    bool tooBig = maxSize > 0 && (_image->s() > maxSize || _image->t() > maxSize);
+
+    if ( (*_tiled || tooBig) && !ImageUtils::PixelReader::supports(_image.get()) )
+    {
+        OE_WARN << LC << "Cannot tile an image of this format; using a single texture" << std::endl;
+        return false;
+    }
+
+    return *_tiled || tooBig;
+}
+
+osg::Vec3d
+ImageOverlay::tileCornerToWorld(double u, double v) const
+{
+    osg::Vec2d p =
+        (_lowerLeft*(1.0-u) + _lowerRight*u)*(1.0-v) +
+        (_upperLeft*(1.0-u) + _upperRight*u)*v;
+
+    const SpatialReference* mapSRS = getMapNode()->getMapSRS();
+    osg::Vec3d world;
+    mapSRS->getGeodeticSRS()->transform( osg::Vec3d(p.x(), p.y(), 0.0), mapSRS, world );
+    mapSRS->transformToWorld( world, world );
+    return world;
+}
+
+osg::BoundingSphere
+ImageOverlay::getTileBound(TileID id)
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock(_tileMutex);
+
+    TileBoundMap::const_iterator i = _tileBounds.find(id);
+    if ( i != _tileBounds.end() )
+        return i->second;
+
+    double n  = (double)(1u << tileLOD(id));
+    double u0 = (double)tileX(id)/n, u1 = (double)(tileX(id)+1)/n;
+    double v0 = (double)tileY(id)/n, v1 = (double)(tileY(id)+1)/n;
+
+    // corners, edge midpoints and center, to account for curvature:
+    osg::BoundingSphere bs;
+    for(unsigned r = 0; r < 3; ++r)
+        for(unsigned c = 0; c < 3; ++c)
+            bs.expandBy( tileCornerToWorld(u0 + 0.5*c*(u1-u0), v0 + 0.5*r*(v1-v0)) );
+
+    _tileBounds[id] = bs;
+    return bs;
+}
+
+void
+ImageOverlay::selectTiles(osgUtil::CullVisitor* cv, TileID id, std::vector<TileID>& output)
+{
+    osg::BoundingSphere bs = getTileBound(id);
+    if ( cv->isCulled(bs) )
+        return;
+
+    // refine while a tile would cover more pixels on screen than it has texels.
+    float pixels = 2.0f * cv->clampedPixelSize(bs);
+    if ( tileLOD(id) < _maxTileLevel && pixels > (float)(*_tileSize) )
+    {
+        unsigned lod = tileLOD(id)+1, x = tileX(id)*2, y = tileY(id)*2;
+        selectTiles( cv, makeTileID(lod, x,   y  ), output );
+        selectTiles( cv, makeTileID(lod, x+1, y  ), output );
+        selectTiles( cv, makeTileID(lod, x,   y+1), output );
+        selectTiles( cv, makeTileID(lod, x+1, y+1), output );
+    }
+    else
+    {
+        output.push_back( id );
+    }
+}
+
+osg::Image*
+ImageOverlay::createTileImage(TileID id) const
+{
+    unsigned size = *_tileSize;
+
+    osg::Image* out = new osg::Image();
+    out->allocateImage( size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+    out->setInternalTextureFormat( GL_RGBA8 );
+
+    ImageUtils::PixelReader read ( _image.get() );
+    ImageUtils::PixelWriter write( out );
+
+    int    w    = _image->s();
+    int    h    = _image->t();
+    bool   flip = _image->getOrigin() == osg::Image::TOP_LEFT;
+    double n    = (double)(1u << tileLOD(id));
+    double u0   = (double)tileX(id)/n;
+    double v0   = (double)tileY(id)/n;
+    double du   = 1.0/(n*(double)size);   // one output texel, in overlay [0..1] space
+
+    // box-filter the source texels under each output texel (up to 4x4 samples):
+    double step = du * (double)osg::maximum(w, h);
+    int    k    = osg::clampBetween( (int)ceil(step), 1, 4 );
+    float  norm = 1.0f/(float)(k*k);
+
+    for(unsigned t = 0; t < size; ++t)
+    {
+        for(unsigned s = 0; s < size; ++s)
+        {
+            osg::Vec4 sum(0,0,0,0);
+            for(int b = 0; b < k; ++b)
+            {
+                double v  = v0 + du*((double)t + ((double)b+0.5)/(double)k);
+                int    st = osg::clampBetween( (int)((flip ? 1.0-v : v) * (double)h), 0, h-1 );
+                for(int a = 0; a < k; ++a)
+                {
+                    double u  = u0 + du*((double)s + ((double)a+0.5)/(double)k);
+                    int    ss = osg::clampBetween( (int)(u * (double)w), 0, w-1 );
+                    sum += read( ss, st );
+                }
+            }
+            write( sum*norm, s, t );
+        }
+    }
+
+    return out;
+}
+
+osg::Node*
+ImageOverlay::createTileNode(TileID id, osg::Texture2D* texture) const
+{
+    double n  = (double)(1u << tileLOD(id));
+    double u0 = (double)tileX(id)/n, u1 = (double)(tileX(id)+1)/n;
+    double v0 = (double)tileY(id)/n, v1 = (double)(tileY(id)+1)/n;
+
+    osg::Vec3d world[4] = {
+        tileCornerToWorld(u0, v0),
+        tileCornerToWorld(u1, v0),
+        tileCornerToWorld(u1, v1),
+        tileCornerToWorld(u0, v1) };
+
+    osg::MatrixTransform* xform = new osg::MatrixTransform( osg::Matrixd::translate(world[0]) );
+
+    osg::Geometry* geometry = new osg::Geometry();
+    geometry->setUseVertexBufferObjects(true);
+
+    osg::Vec3Array* verts = new osg::Vec3Array(4);
+    for(unsigned i = 0; i < 4; ++i)
+        (*verts)[i] = world[i] - world[0];
+    geometry->setVertexArray( verts );
+
+    osg::Vec4Array* colors = new osg::Vec4Array(1);
+    (*colors)[0] = osg::Vec4(1,1,1,*_alpha);
+    geometry->setColorArray( colors );
+    geometry->setColorBinding( osg::Geometry::BIND_OVERALL );
+
+    // tile images are always bottom-up (see createTileImage).
+    osg::Vec2Array* texcoords = new osg::Vec2Array(4);
+    (*texcoords)[0].set(0.0f, 0.0f);
+    (*texcoords)[1].set(1.0f, 0.0f);
+    (*texcoords)[2].set(1.0f, 1.0f);
+    (*texcoords)[3].set(0.0f, 1.0f);
+    geometry->setTexCoordArray(0, texcoords);
+
+    GLushort tris[6] = { 0, 1, 2, 0, 2, 3 };
+    geometry->addPrimitiveSet(new osg::DrawElementsUShort( GL_TRIANGLES, 6, tris ) );
+
+    if (getMapNode()->getMap()->isGeocentric())
+    {
+        MeshSubdivider ms(osg::Matrixd::inverse(xform->getMatrix()), xform->getMatrix());
+        ms.run(*geometry, osg::DegreesToRadians(5.0), GEOINTERP_RHUMB_LINE);
+    }
+
+    osg::Geode* geode = new osg::Geode();
+    geode->addDrawable( geometry );
+    xform->addChild( geode );
+
+    // finer tiles draw over the coarser ones standing in around them.
+    osg::StateSet* ss = geode->getOrCreateStateSet();
+    ss->setTextureAttributeAndModes(0, texture, osg::StateAttribute::ON);
+    ss->setRenderBinDetails( tileLOD(id), "RenderBin" );
+
+    if ( Registry::capabilities().supportsGLSL() )
+    {
+        Registry::shaderGenerator().run( geode, "osgEarth.ImageOverlay" );
+    }
+
+    return xform;
+}
+
+void
+ImageOverlay::updateTiles(unsigned frame)
+{
+    std::vector<TileID> selected;
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock(_tileMutex);
+        if ( _selectedTiles.empty() )
+            _selectedTiles.push_back( makeTileID(0,0,0) );
+        selected = _selectedTiles;
+    }
+
+    std::sort( selected.begin(), selected.end(), coarserTile );
+
+    // the tiles to draw: each selected tile, or its nearest built ancestor
+    // while it waits for its turn to be built.
+    std::vector<TileID> active;
+    unsigned builds = 0;
+    bool     changed = false;
+
+    for(std::vector<TileID>::const_iterator i = selected.begin(); i != selected.end(); ++i)
+    {
+        TileID id = *i;
+        Tile&  tile = _tiles[id];
+
+        if ( !tile._node.valid() && (builds < MAX_TILE_BUILDS_PER_FRAME || tileLOD(id) == 0) )
+        {
+            if ( !tile._texture.valid() )
+            {
+                osg::Image* image = createTileImage(id);
+                tile._texture = new osg::Texture2D( image );
+                tile._texture->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+                tile._texture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+                tile._texture->setResizeNonPowerOfTwoHint(false);
+                updateFilters( tile._texture.get(), image );
+            }
+
+            tile._node = createTileNode(id, tile._texture.get());
+            clampMesh( getMapNode()->getTerrain()->getGraph(), osg::BoundingSphere(), tile._node.get() );
+            ++builds;
+            changed = true;
+        }
+
+        while( !_tiles[id]._node.valid() && tileLOD(id) > 0 )
+            id = parentTileID(id);
+
+        _tiles[id]._lastFrame = frame;
+        if ( std::find(active.begin(), active.end(), id) == active.end() )
+            active.push_back( id );
+    }
+
+    // still waiting on some tiles; keep the selection pending.
+    bool pending = builds >= MAX_TILE_BUILDS_PER_FRAME;
+
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock(_tileMutex);
+        if ( !_tileSelectionChanged && !changed )
+            return;
+        _tileSelectionChanged = pending;
+    }
+
+    _tileGroup->removeChildren( 0, _tileGroup->getNumChildren() );
+    for(std::vector<TileID>::const_iterator i = active.begin(); i != active.end(); ++i)
+    {
+        _tileGroup->addChild( _tiles[*i]._node.get() );
+    }
+
+    // release the textures of tiles that left the view a while ago. The root
+    // stays, since it stands in for everything else.
+    for(TileMap::iterator i = _tiles.begin(); i != _tiles.end(); )
+    {
+        if ( tileLOD(i->first) > 0 && i->second._lastFrame + TILE_EXPIRY_FRAMES < frame )
+            _tiles.erase( i++ );
+        else
+            ++i;
+    }
+
+    // the draped texture needs to re-render with the new tiles.
+    if ( getMapNode() )
+    {
+        DrapingTechnique* draping = getMapNode()->getOverlayDecorator()->getTechnique<DrapingTechnique>();
+        if ( draping )
+            draping->dirty();
+    }
+}
+
+//---------------------------------------------------------------------------
+
 void
 ImageOverlay::reclamp( const TileKey& key, osg::Node* tile, const Terrain* )
 {
     if ( _boundingPolytope.contains( tile->getBound() ) ) // intersects, actually
     {
-        clampMesh( tile );
+        clampMesh( tile, tile->getBound() );
         OE_DEBUG << LC << "Clamped overlay mesh, tile radius = " << tile->getBound().radius() << std::endl;
     }
 }
 
 void
-ImageOverlay::clampMesh( osg::Node* terrainModel )
+ImageOverlay::reclampTiles( const ReclampTiles& tiles, const Terrain* )
+{
+    osg::ref_ptr<osg::Node> patch;
+    if ( getReclampPatch(tiles, _boundingPolytope, patch) )
+    {
+        clampMesh( patch.get(), patch->getBound() );
+    }
+}
+
+bool
+ImageOverlay::getReclampExtent( GeoExtent& out_extent ) const
+{
+    if ( getMapNode() )
+    {
+        // the corners are geographic.
+        out_extent = GeoExtent( getMapNode()->getMapSRS()->getGeographicSRS(), getBounds() );
+        return out_extent.isValid();
+    }
+    return false;
+}
+
+void
+ImageOverlay::clampMesh( osg::Node* terrainModel, const osg::BoundingSphere& scope, osg::Node* target )
 {
     double scale  = 1.0;
     double offset = 0.0;
@@ -744,7 +1182,11 @@ ImageOverlay::clampMesh( osg::Node* terrainModel )
     }
 
     MeshClamper clamper( terrainModel, getMapNode()->getMapSRS(), getMapNode()->isGeocentric(), relative, scale, offset );
-    this->accept( clamper );
+    clamper.setScope( scope );
+    if ( target )
+        target->accept( clamper );
+    else
+        this->accept( clamper );
 
     this->dirtyBound();
 }
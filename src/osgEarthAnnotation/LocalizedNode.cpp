@@ -233,6 +233,27 @@ LocalizedNode::reclamp( const TileKey& key, osg::Node* tile, const Terrain* terr
     }
 }
 
+void
+LocalizedNode::reclampTiles( const ReclampTiles& tiles, const Terrain* terrain )
+{
+    // only the best tile under the control position matters.
+    const ReclampTile* best = getReclampTile( tiles, _mapPosition );
+    if ( best )
+    {
+        updateTransform( _mapPosition, best->_tile.get() );
+    }
+}
+
+bool
+LocalizedNode::getReclampExtent( GeoExtent& out_extent ) const
+{
+    if ( !_mapPosition.isValid() )
+        return false;
+
+    out_extent = GeoExtent( _mapPosition.getSRS(), _mapPosition.x(), _mapPosition.y(), _mapPosition.x(), _mapPosition.y() );
+    return true;
+}
+
 
 osg::Node*
 LocalizedNode::applyAltitudePolicy(osg::Node* node, const Style& style)
@@ -407,3 +407,24 @@ OrthoNode::reclamp( const TileKey& key, osg::Node* tile, const Terrain* terrain
         updateTransforms( _mapPosition, tile );
     }
 }
+
+void
+OrthoNode::reclampTiles( const ReclampTiles& tiles, const Terrain* terrain )
+{
+    // only the best tile under the label position matters.
+    const ReclampTile* best = getReclampTile( tiles, _mapPosition );
+    if ( best )
+    {
+        updateTransforms( _mapPosition, best->_tile.get() );
+    }
+}
+
+bool
+OrthoNode::getReclampExtent( GeoExtent& out_extent ) const
+{
+    if ( !_mapPosition.isValid() )
+        return false;
+
+    out_extent = GeoExtent( _mapPosition.getSRS(), _mapPosition.x(), _mapPosition.y(), _mapPosition.x(), _mapPosition.y() );
+    return true;
+}
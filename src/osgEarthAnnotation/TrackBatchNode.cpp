@@ -0,0 +1,544 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarthAnnotation/TrackBatchNode>
+#include <osgEarthAnnotation/AnnotationUtils>
+#include <osgEarth/CullingUtils>
+#include <osgEarth/ImageUtils>
+#include <osgEarth/NodeUtils>
+#include <osgEarth/Registry>
+#include <osgEarth/ShaderGenerator>
+#include <osgEarth/VirtualProgram>
+#include <osg/Depth>
+#include <osgUtil/CullVisitor>
+
+#define LC "[TrackBatchNode] "
+
+using namespace osgEarth;
+using namespace osgEarth::Annotation;
+using namespace osgEarth::Symbology;
+
+// texture image units for the icon atlas and the per-track data.
+#define ICON_TEXTURE_UNIT 0
+#define DATA_TEXTURE_UNIT 1
+
+// data texture width in texels; each track uses two texels.
+#define DATA_WIDTH     1024
+#define DATA_WIDTH_STR "1024"
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // positions each icon instance from the data texture.
+    const char* iconViewSource =
+        "#version 120\n"
+        "#extension GL_EXT_gpu_shader4 : enable\n"
+        "#extension GL_ARB_draw_instanced : enable\n"
+        "uniform sampler2D oe_trackbatch_data; \n"
+        "uniform float oe_trackbatch_iconSize; \n"
+        "uniform float oe_trackbatch_numIcons; \n"
+        "varying vec2 oe_trackbatch_corner; \n"
+        "varying vec2 oe_trackbatch_uv; \n"
+        "void oe_trackbatch_iconView(inout vec4 VertexVIEW) \n"
+        "{ \n"
+        "    int i = 2*gl_InstanceID; \n"
+        "    ivec2 c = ivec2(i % " DATA_WIDTH_STR ", i / " DATA_WIDTH_STR "); \n"
+        "    vec4 p = texelFetch2D(oe_trackbatch_data, c, 0); \n"
+        "    vec4 a = texelFetch2D(oe_trackbatch_data, c+ivec2(1,0), 0); \n"
+        "    vec2 v = gl_Vertex.xy; \n"
+        "    float s = sin(p.w), k = cos(p.w); \n"
+        "    oe_trackbatch_uv = vec2((a.x + v.x + 0.5)/oe_trackbatch_numIcons, v.y + 0.5); \n"
+        "    oe_trackbatch_corner = oe_trackbatch_iconSize * vec2(k*v.x - s*v.y, s*v.x + k*v.y); \n"
+        "    // collapse hidden tracks so they don't rasterize. \n"
+        "    VertexVIEW = a.y > 0.5 ? gl_ModelViewMatrix * vec4(p.xyz, 1.0) : vec4(0.0); \n"
+        "} \n";
+
+    // expands the icon quad in screen space.
+    const char* iconClipSource =
+        "#version 120\n"
+        "uniform vec2 oe_trackbatch_viewport; \n"
+        "varying vec2 oe_trackbatch_corner; \n"
+        "void oe_trackbatch_iconClip(inout vec4 VertexCLIP) \n"
+        "{ \n"
+        "    VertexCLIP.xy += 2.0*oe_trackbatch_corner/oe_trackbatch_viewport * VertexCLIP.w; \n"
+        "} \n";
+
+    const char* iconFragSource =
+        "#version 120\n"
+        "uniform sampler2D oe_trackbatch_icons; \n"
+        "varying vec2 oe_trackbatch_uv; \n"
+        "void oe_trackbatch_iconFrag(inout vec4 color) \n"
+        "{ \n"
+        "    color *= texture2D(oe_trackbatch_icons, oe_trackbatch_uv); \n"
+        "    if ( color.a < 0.01 ) discard; \n"
+        "} \n";
+
+    // applies a field's pixel offset to its screen-aligned text.
+    const char* fieldClipSource =
+        "#version 120\n"
+        "uniform vec2 oe_trackbatch_viewport; \n"
+        "uniform vec2 oe_trackbatch_offset; \n"
+        "void oe_trackbatch_fieldClip(inout vec4 VertexCLIP) \n"
+        "{ \n"
+        "    VertexCLIP.xy += 2.0*oe_trackbatch_offset/oe_trackbatch_viewport * VertexCLIP.w; \n"
+        "} \n";
+}
+
+//------------------------------------------------------------------------
+
+TrackBatchNode::TrackBatchNode(MapNode*                    mapNode,
+                               const TrackNodeFieldSchema& fieldSchema) :
+_mapNode  ( mapNode ),
+_hasAnchor( false ),
+_iconSize ( 32u ),
+_dataDirty( false )
+{
+    init( fieldSchema );
+}
+
+void
+TrackBatchNode::init(const TrackNodeFieldSchema& schema)
+{
+    // all tracks are stored relative to an anchor point to preserve precision.
+    _xform = new osg::MatrixTransform();
+    addChild( _xform.get() );
+
+    // same rendering state as a TrackNode: no lighting, and
+    // depth testing always passes with no depth buffer writes.
+    osg::StateSet* stateSet = getOrCreateStateSet();
+    stateSet->setAttributeAndModes( new osg::Depth(osg::Depth::ALWAYS, 0, 1, false), 1 );
+    stateSet->setMode( GL_LIGHTING, osg::StateAttribute::OFF | osg::StateAttribute::PROTECTED );
+    stateSet->setMode( GL_BLEND, 1 );
+
+    // the icons: one unit quad, drawn once per track.
+    _iconGeom = new osg::Geometry();
+    _iconGeom->setUseVertexBufferObjects( true );
+    _iconGeom->setUseDisplayList( false );
+    _iconGeom->setDataVariance( osg::Object::DYNAMIC );
+
+    osg::Vec3Array* verts = new osg::Vec3Array(4);
+    (*verts)[0].set( -0.5f, -0.5f, 0.0f );
+    (*verts)[1].set(  0.5f, -0.5f, 0.0f );
+    (*verts)[2].set(  0.5f,  0.5f, 0.0f );
+    (*verts)[3].set( -0.5f,  0.5f, 0.0f );
+    _iconGeom->setVertexArray( verts );
+
+    osg::Vec4Array* colors = new osg::Vec4Array(1);
+    (*colors)[0].set( 1.0f, 1.0f, 1.0f, 1.0f );
+    _iconGeom->setColorArray( colors );
+    _iconGeom->setColorBinding( osg::Geometry::BIND_OVERALL );
+
+    _iconDraw = new osg::DrawArrays( GL_QUADS, 0, 4, 0 );
+    _iconGeom->addPrimitiveSet( _iconDraw.get() );
+
+    _iconGeode = new osg::Geode();
+    _iconGeode->addDrawable( _iconGeom.get() );
+    _iconGeode->setNodeMask( 0 ); // until there's something to draw
+    _xform->addChild( _iconGeode.get() );
+
+    osg::StateSet* iconSS = _iconGeode->getOrCreateStateSet();
+    VirtualProgram* vp = VirtualProgram::getOrCreate( iconSS );
+    vp->setName( "osgEarth.TrackBatchNode.icons" );
+    vp->setFunction( "oe_trackbatch_iconView", iconViewSource, ShaderComp::LOCATION_VERTEX_VIEW );
+    vp->setFunction( "oe_trackbatch_iconClip", iconClipSource, ShaderComp::LOCATION_VERTEX_CLIP );
+    vp->setFunction( "oe_trackbatch_iconFrag", iconFragSource, ShaderComp::LOCATION_FRAGMENT_COLORING );
+
+    iconSS->getOrCreateUniform( "oe_trackbatch_icons", osg::Uniform::SAMPLER_2D )->set( ICON_TEXTURE_UNIT );
+    iconSS->getOrCreateUniform( "oe_trackbatch_data",  osg::Uniform::SAMPLER_2D )->set( DATA_TEXTURE_UNIT );
+    iconSS->getOrCreateUniform( "oe_trackbatch_iconSize", osg::Uniform::FLOAT )->set( (float)_iconSize );
+    iconSS->getOrCreateUniform( "oe_trackbatch_numIcons", osg::Uniform::FLOAT )->set( 1.0f );
+
+    // the fields: one geode of text drawables per schema entry.
+    for( TrackNodeFieldSchema::const_iterator i = schema.begin(); i != schema.end(); ++i )
+    {
+        if ( !i->second._symbol.valid() )
+            continue;
+
+        _fields.push_back( Field() );
+        Field& field = _fields.back();
+        field._name    = i->first;
+        field._symbol  = i->second._symbol.get();
+        field._dynamic = i->second._dynamic;
+        field._geode   = new osg::Geode();
+
+        osg::Vec2f offset( 0.0f, 0.0f );
+        if ( field._symbol->pixelOffset().isSet() )
+            offset.set( field._symbol->pixelOffset()->x(), field._symbol->pixelOffset()->y() );
+
+        osg::StateSet* fieldSS = field._geode->getOrCreateStateSet();
+        VirtualProgram* fvp = VirtualProgram::getOrCreate( fieldSS );
+        fvp->setName( "osgEarth.TrackBatchNode.fields" );
+        fvp->setFunction( "oe_trackbatch_fieldClip", fieldClipSource, ShaderComp::LOCATION_VERTEX_CLIP );
+        fieldSS->getOrCreateUniform( "oe_trackbatch_offset", osg::Uniform::FLOAT_VEC2 )->set( offset );
+
+        _xform->addChild( field._geode.get() );
+    }
+
+    // we upload track data and generate text shaders in the update traversal.
+    ADJUST_UPDATE_TRAV_COUNT( this, 1 );
+}
+
+void
+TrackBatchNode::setIconSize(unsigned pixels)
+{
+    _iconSize = osg::maximum( pixels, 1u );
+    _iconGeode->getOrCreateStateSet()->getOrCreateUniform( "oe_trackbatch_iconSize", osg::Uniform::FLOAT )->set( (float)_iconSize );
+    if ( !_iconImages.empty() )
+        rebuildIconAtlas();
+}
+
+unsigned
+TrackBatchNode::addIcon(osg::Image* image)
+{
+    if ( !image )
+        return 0u;
+
+    _iconImages.push_back( image );
+    rebuildIconAtlas();
+    return _iconImages.size()-1;
+}
+
+void
+TrackBatchNode::rebuildIconAtlas()
+{
+    // pack all the icons side by side into one image, so they share a texture.
+    osg::ref_ptr<osg::Image> atlas = new osg::Image();
+    atlas->allocateImage( _iconSize*_iconImages.size(), _iconSize, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+    atlas->setInternalTextureFormat( GL_RGBA8 );
+    ::memset( atlas->data(), 0, atlas->getTotalSizeInBytes() );
+
+    for( unsigned i = 0; i < _iconImages.size(); ++i )
+    {
+        osg::ref_ptr<osg::Image> rgba = ImageUtils::convertToRGBA8( _iconImages[i].get() );
+        osg::ref_ptr<osg::Image> resized;
+        if ( rgba.valid() && ImageUtils::resizeImage(rgba.get(), _iconSize, _iconSize, resized) )
+        {
+            ImageUtils::copyAsSubImage( resized.get(), atlas.get(), i*_iconSize, 0 );
+        }
+        else
+        {
+            OE_WARN << LC << "Failed to prepare icon " << i << std::endl;
+        }
+    }
+
+    // replace the texture (rather than the image) since the size changes.
+    osg::Texture2D* tex = new osg::Texture2D( atlas.get() );
+    tex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR );
+    tex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
+    tex->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    tex->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+    tex->setResizeNonPowerOfTwoHint( false );
+    tex->setUnRefImageDataAfterApply( true );
+
+    osg::StateSet* iconSS = _iconGeode->getOrCreateStateSet();
+    iconSS->setTextureAttribute( ICON_TEXTURE_UNIT, tex, 1 );
+    iconSS->getOrCreateUniform( "oe_trackbatch_numIcons", osg::Uniform::FLOAT )->set( (float)_iconImages.size() );
+}
+
+void
+TrackBatchNode::reserveData(unsigned numTracks)
+{
+    const unsigned perRow = DATA_WIDTH/2;
+    unsigned rows = _data.valid() ? _data->t() : 0u;
+    if ( rows*perRow >= numTracks )
+        return;
+
+    // grow in powers of two so adding tracks one at a time stays cheap.
+    unsigned newRows = osg::maximum( rows, 1u );
+    while( newRows*perRow < numTracks )
+        newRows *= 2u;
+
+    osg::ref_ptr<osg::Image> data = new osg::Image();
+    data->allocateImage( DATA_WIDTH, newRows, 1, GL_RGBA, GL_FLOAT );
+    data->setInternalTextureFormat( GL_RGBA32F_ARB );
+    ::memset( data->data(), 0, data->getTotalSizeInBytes() );
+    if ( _data.valid() )
+        ::memcpy( data->data(), _data->data(), _data->getTotalSizeInBytes() );
+    _data = data.get();
+
+    // replace the texture (rather than the image) since the size changes.
+    _dataTex = new osg::Texture2D( _data.get() );
+    _dataTex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+    _dataTex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
+    _dataTex->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    _dataTex->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+    _dataTex->setResizeNonPowerOfTwoHint( false );
+    _dataTex->setDataVariance( osg::Object::DYNAMIC );
+
+    _iconGeode->getOrCreateStateSet()->setTextureAttribute( DATA_TEXTURE_UNIT, _dataTex.get(), 1 );
+}
+
+void
+TrackBatchNode::writeData(unsigned track)
+{
+    GLfloat* ptr = reinterpret_cast<GLfloat*>( _data->data() ) + 8*track;
+    const osg::Vec3f& p = _local[track];
+    *ptr++ = p.x();
+    *ptr++ = p.y();
+    *ptr++ = p.z();
+    *ptr++ = osg::DegreesToRadians( _headings[track] );
+    *ptr++ = (GLfloat)_icons[track];
+    *ptr++ = _visible[track] ? 1.0f : 0.0f;
+    *ptr++ = 0.0f;
+    *ptr++ = 0.0f;
+    _dataDirty = true;
+}
+
+void
+TrackBatchNode::moveTo(unsigned track, const GeoPoint& position)
+{
+    osg::Vec3d world;
+    if ( !position.toWorld(world) )
+        return;
+
+    if ( !_hasAnchor )
+    {
+        _anchor = world;
+        _xform->setMatrix( osg::Matrix::translate(_anchor) );
+        _hasAnchor = true;
+    }
+
+    _positions[track] = position;
+    _local[track] = world - _anchor;
+    _localBound.expandBy( _local[track] );
+
+    for( std::vector<Field>::iterator f = _fields.begin(); f != _fields.end(); ++f )
+    {
+        osgText::Text* text = f->_texts[track].get();
+        if ( text )
+            text->setPosition( _local[track] );
+    }
+}
+
+unsigned
+TrackBatchNode::addTrack(const GeoPoint& position, unsigned icon, float heading)
+{
+    unsigned track = _positions.size();
+
+    _positions.push_back( position );
+    _local.push_back( osg::Vec3f() );
+    _headings.push_back( heading );
+    _icons.push_back( icon );
+    _visible.push_back( true );
+
+    for( std::vector<Field>::iterator f = _fields.begin(); f != _fields.end(); ++f )
+    {
+        f->_texts.push_back( 0L );
+
+        // start a field with its symbol's content, as TrackNode does.
+        if ( f->_symbol->content().isSet() && !f->_symbol->content()->expr().empty() )
+            createFieldText( *f, track )->setText( f->_symbol->content()->expr() );
+    }
+
+    moveTo( track, position );
+
+    reserveData( _positions.size() );
+    writeData( track );
+
+    _iconDraw->setNumInstances( _positions.size() );
+    _iconGeode->setNodeMask( ~0 );
+
+    return track;
+}
+
+osgText::Text*
+TrackBatchNode::createFieldText(Field& field, unsigned track)
+{
+    osgText::Text* text = dynamic_cast<osgText::Text*>(
+        AnnotationUtils::createTextDrawable("", field._symbol.get(), osg::Vec3(0,0,0)) );
+
+    // screen-aligned and screen-sized text at the track's location; the field's
+    // pixel offset is applied in the shader.
+    text->setPosition( _local.size() > track ? _local[track] : osg::Vec3f() );
+    text->setAxisAlignment( osgText::Text::SCREEN );
+    text->setCharacterSizeMode( osgText::Text::SCREEN_COORDS );
+
+    // if the user intends to change the label later, make it dynamic
+    // since osgText updates are not thread-safe
+    text->setDataVariance( field._dynamic ? osg::Object::DYNAMIC : osg::Object::STATIC );
+
+    field._texts[track] = text;
+    field._geode->addDrawable( text );
+    _newTexts.push_back( text );
+    return text;
+}
+
+void
+TrackBatchNode::setPosition(unsigned track, const GeoPoint& position)
+{
+    if ( track < _positions.size() )
+    {
+        moveTo( track, position );
+        writeData( track );
+    }
+}
+
+void
+TrackBatchNode::setHeading(unsigned track, float heading)
+{
+    if ( track < _positions.size() )
+    {
+        _headings[track] = heading;
+        writeData( track );
+    }
+}
+
+void
+TrackBatchNode::setIcon(unsigned track, unsigned icon)
+{
+    if ( track < _positions.size() )
+    {
+        _icons[track] = icon;
+        writeData( track );
+    }
+}
+
+void
+TrackBatchNode::setVisible(unsigned track, bool value)
+{
+    if ( track < _positions.size() && _visible[track] != value )
+    {
+        _visible[track] = value;
+        writeData( track );
+
+        for( std::vector<Field>::iterator f = _fields.begin(); f != _fields.end(); ++f )
+        {
+            osgText::Text* text = f->_texts[track].get();
+            if ( text )
+            {
+                if ( value && text->getNumParents() == 0 )
+                    f->_geode->addDrawable( text );
+                else if ( !value )
+                    f->_geode->removeDrawable( text );
+            }
+        }
+    }
+}
+
+void
+TrackBatchNode::setFieldValue(unsigned track, const std::string& name, const osgText::String& value)
+{
+    if ( track >= _positions.size() )
+        return;
+
+    for( std::vector<Field>::iterator f = _fields.begin(); f != _fields.end(); ++f )
+    {
+        if ( f->_name == name )
+        {
+            osgText::Text* text = f->_texts[track].get();
+            if ( !text )
+            {
+                text = createFieldText( *f, track );
+                if ( !_visible[track] )
+                    f->_geode->removeDrawable( text );
+            }
+            else if ( text->getDataVariance() != osg::Object::DYNAMIC && getNumParents() > 0 )
+            {
+                OE_WARN << LC 
+                    << "Illegal: attempt to modify a TrackBatchNode field value that is not marked as dynamic"
+                    << std::endl;
+                return;
+            }
+
+            // btw, setText checks for assigning an equal value, so we don't have to
+            text->setText( value );
+            return;
+        }
+    }
+}
+
+void
+TrackBatchNode::update(const Updates& updates)
+{
+    for( Updates::const_iterator u = updates.begin(); u != updates.end(); ++u )
+    {
+        if ( u->_track < _positions.size() )
+        {
+            moveTo( u->_track, u->_position );
+            _headings[u->_track] = u->_heading;
+            writeData( u->_track );
+        }
+    }
+}
+
+void
+TrackBatchNode::generateShaders()
+{
+    // run the shader generator over just the new text drawables; the
+    // temporary geode keeps us from touching the ones already processed.
+    osg::ref_ptr<osg::Geode> temp = new osg::Geode();
+    for( unsigned i = 0; i < _newTexts.size(); ++i )
+        temp->addDrawable( _newTexts[i].get() );
+
+    Registry::shaderGenerator().run(
+        temp.get(),
+        "osgEarth.TrackBatchNode",
+        Registry::stateSetCache() );
+
+    temp->removeDrawables( 0, temp->getNumDrawables() );
+    _newTexts.clear();
+}
+
+void
+TrackBatchNode::traverse(osg::NodeVisitor& nv)
+{
+    if ( nv.getVisitorType() == nv.UPDATE_VISITOR )
+    {
+        if ( !_newTexts.empty() )
+        {
+            generateShaders();
+        }
+
+        if ( _dataDirty )
+        {
+            // one upload per frame, no matter how many tracks moved.
+            _data->dirty();
+            _iconGeom->setInitialBound( _localBound );
+            _iconGeom->dirtyBound();
+            _dataDirty = false;
+        }
+
+        osg::Group::traverse( nv );
+    }
+
+    else if ( nv.getVisitorType() == nv.CULL_VISITOR )
+    {
+        osgUtil::CullVisitor* cv = Culling::asCullVisitor( nv );
+        const osg::Viewport* vp = cv ? cv->getViewport() : 0L;
+        if ( vp )
+        {
+            // icon sizes and field offsets are in pixels.
+            osg::ref_ptr<osg::StateSet> ss = new osg::StateSet();
+            ss->addUniform( new osg::Uniform("oe_trackbatch_viewport", osg::Vec2f(vp->width(), vp->height())) );
+            cv->pushStateSet( ss.get() );
+            osg::Group::traverse( nv );
+            cv->popStateSet();
+        }
+        else
+        {
+            osg::Group::traverse( nv );
+        }
+    }
+
+    else
+    {
+        osg::Group::traverse( nv );
+    }
+}
@@ -27,6 +27,9 @@
 #include <osgEarth/Registry>
 #include <osgEarth/FileUtils>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/Containers>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
 
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
@@ -40,6 +43,7 @@
 #include <sstream>
 #include <OpenThreads/Mutex>
 #include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
 
 #define LC "[AGGLite] "
 
@@ -107,11 +111,70 @@ public:
         double xf, yf;
     };
 
+    // A cropped geometry ready to rasterize, in draw order.
+    struct RenderItem {
+        osg::ref_ptr<Geometry> geometry;
+        Bounds                 bounds;
+        osg::Vec4              color;
+    };
+    typedef std::vector<RenderItem> RenderItems;
+
+    // Identifies a feature's prepared geometry at one LOD. The point count
+    // guards against sources that do not issue unique FIDs.
+    struct GeometryKey {
+        unsigned  lod;
+        FeatureID fid;
+        int       numPoints;
+        double    lineWidth; // 0 for polygons
+
+        bool operator < (const GeometryKey& rhs) const {
+            if ( lod < rhs.lod ) return true;
+            if ( lod > rhs.lod ) return false;
+            if ( fid < rhs.fid ) return true;
+            if ( fid > rhs.fid ) return false;
+            if ( numPoints < rhs.numPoints ) return true;
+            if ( numPoints > rhs.numPoints ) return false;
+            return lineWidth < rhs.lineWidth;
+        }
+    };
+
+    struct GeometryKeyHash {
+        unsigned operator()(const GeometryKey& key) const {
+            return LRUHash<unsigned>()( (unsigned)key.fid ^ (key.lod << 24) ^ (unsigned)key.numPoints );
+        }
+    };
+
+    typedef ShardedLRUCache<GeometryKey, osg::ref_ptr<Geometry>, GeometryKeyHash> GeometryCache;
+
+    // maps a feature sent through the filters back to its slot in the bin.
+    typedef std::map<const Feature*, unsigned> MissIndices;
+
+    // Rasterizes one horizontal band of a tile.
+    struct RenderBand
+    {
+        const AGGLiteRasterizerTileSource* _source;
+        const RenderItems*                 _items;
+        const RenderFrame*                 _frame;
+        osg::Image*                        _image;
+        int                                _row, _numRows;
+
+        void execute() {
+            _source->renderBand( *_items, *_frame, _image, _row, _numRows );
+        }
+    };
+    typedef ParallelTask<RenderBand> RenderBandTask;
+
 public:
     AGGLiteRasterizerTileSource( const TileSourceOptions& options ) : FeatureTileSource( options ),
-        _options( options )
+        _options   ( options ),
+        _geomCache ( osg::maximum(_options.geometryCacheSize().get(), 1u) )
     {
-        //nop
+        _numBands = _options.numThreads().get();
+        if ( _numBands == 0 )
+            _numBands = (unsigned)OpenThreads::GetNumberOfProcessors();
+
+        if ( _numBands > 1 )
+            _bandService = new TaskService( "AGGLite", _numBands );
     }
 
     //override
@@ -170,11 +233,75 @@ public:
         frame.xf   = (double)image->s() / imageExtent.width();
         frame.yf   = (double)image->t() / imageExtent.height();
 
+        // prepared geometry is only reusable by tiles of the same resolution:
+        unsigned lod = getProfile()->getLevelOfDetailForHorizResolution(
+            imageExtent.width() / (double)image->s(), image->s() );
+
+        // We are buffering in the features native extent, so we need to use the
+        // transformed extent to get the proper "resolution" for the image
+        const SpatialReference* featureSRS = context.profile()->getSRS();
+
+        double lineWidth = 1.0;
         if ( lines.size() > 0 )
         {
-            // We are buffering in the features native extent, so we need to use the
-            // transformed extent to get the proper "resolution" for the image
-            const SpatialReference* featureSRS = context.profile()->getSRS();
+            if ( masterLine && masterLine->stroke()->width().isSet() )
+            {
+                lineWidth = masterLine->stroke()->width().value();
+
+                GeoExtent imageExtentInFeatureSRS = imageExtent.transform(featureSRS);
+                double pixelWidth = imageExtentInFeatureSRS.width() / (double)image->s();
+
+                // if the width units are specified, process them:
+                if (masterLine->stroke()->widthUnits().isSet() &&
+                    masterLine->stroke()->widthUnits().get() != Units::PIXELS)
+                {
+                    const Units& featureUnits = featureSRS->getUnits();
+                    const Units& strokeUnits  = masterLine->stroke()->widthUnits().value();
+
+                    // if the units are different than those of the feature data, we need to
+                    // do a units conversion.
+                    if ( featureUnits != strokeUnits )
+                    {
+                        if ( Units::canConvert(strokeUnits, featureUnits) )
+                        {
+                            // linear to linear, no problem
+                            lineWidth = strokeUnits.convertTo( featureUnits, lineWidth );
+                        }
+                        else if ( strokeUnits.isLinear() && featureUnits.isAngular() )
+                        {
+                            // linear to angular? approximate degrees per meter at the 
+                            // latitude of the tile's centroid.
+                            double lineWidthM = masterLine->stroke()->widthUnits()->convertTo(Units::METERS, lineWidth);
+                            double mPerDegAtEquatorInv = 360.0/(featureSRS->getEllipsoid()->getRadiusEquator() * 2.0 * osg::PI);
+                            double lon, lat;
+                            imageExtent.getCentroid(lon, lat);
+                            lineWidth = lineWidthM * mPerDegAtEquatorInv * cos(osg::DegreesToRadians(lat));
+                        }
+                    }
+
+                    // enfore a minimum width of one pixel.
+                    float minPixels = masterLine->stroke()->minPixels().getOrUse( 1.0f );
+                    lineWidth = osg::clampAbove(lineWidth, pixelWidth*minPixels);
+                }
+
+                else // pixels
+                {
+                    lineWidth *= pixelWidth;
+                }
+            }
+        }
+
+        // Reuse the geometry that neighbouring tiles at this LOD already prepared;
+        // only the misses go through the filters.
+        std::vector< osg::ref_ptr<Geometry> > polygonGeoms, lineGeoms;
+        FeatureList newPolygons, newLines;
+        std::vector<GeometryKey> polygonKeys, lineKeys;
+        MissIndices polygonMisses, lineMisses;
+        getCachedGeometry( polygons, lod, 0.0,       true,  polygonGeoms, polygonKeys, newPolygons, polygonMisses );
+        getCachedGeometry( lines,    lod, lineWidth, false, lineGeoms,    lineKeys,    newLines,    lineMisses );
+
+        if ( newLines.size() > 0 )
+        {
             GeoExtent transformedExtent = imageExtent.transform(featureSRS);
 
             double trans_xf = (double)image->s() / transformedExtent.width();
@@ -191,82 +318,30 @@ public:
             {
                 ResampleFilter resample;
                 resample.minLength() = osg::minimum( xres, yres );
-                context = resample.push( lines, context );
+                context = resample.push( newLines, context );
             }
 
             // now run the buffer operation on all lines:
             BufferFilter buffer;
-            double lineWidth = 1.0;
             if ( masterLine )
             {
                 buffer.capStyle() = masterLine->stroke()->lineCap().value();
-
-                if ( masterLine->stroke()->width().isSet() )
-                {
-                    lineWidth = masterLine->stroke()->width().value();
-
-                    GeoExtent imageExtentInFeatureSRS = imageExtent.transform(featureSRS);
-                    double pixelWidth = imageExtentInFeatureSRS.width() / (double)image->s();
-
-                    // if the width units are specified, process them:
-                    if (masterLine->stroke()->widthUnits().isSet() &&
-                        masterLine->stroke()->widthUnits().get() != Units::PIXELS)
-                    {
-                        const Units& featureUnits = featureSRS->getUnits();
-                        const Units& strokeUnits  = masterLine->stroke()->widthUnits().value();
-
-                        // if the units are different than those of the feature data, we need to
-                        // do a units conversion.
-                        if ( featureUnits != strokeUnits )
-                        {
-                            if ( Units::canConvert(strokeUnits, featureUnits) )
-                            {
-                                // linear to linear, no problem
-                                lineWidth = strokeUnits.convertTo( featureUnits, lineWidth );
-                            }
-                            else if ( strokeUnits.isLinear() && featureUnits.isAngular() )
-                            {
-                                // linear to angular? approximate degrees per meter at the 
-                                // latitude of the tile's centroid.
-                                double lineWidthM = masterLine->stroke()->widthUnits()->convertTo(Units::METERS, lineWidth);
-                                double mPerDegAtEquatorInv = 360.0/(featureSRS->getEllipsoid()->getRadiusEquator() * 2.0 * osg::PI);
-                                double lon, lat;
-                                imageExtent.getCentroid(lon, lat);
-                                lineWidth = lineWidthM * mPerDegAtEquatorInv * cos(osg::DegreesToRadians(lat));
-                            }
-                        }
-
-                        // enfore a minimum width of one pixel.
-                        float minPixels = masterLine->stroke()->minPixels().getOrUse( 1.0f );
-                        lineWidth = osg::clampAbove(lineWidth, pixelWidth*minPixels);
-                    }
-
-                    else // pixels
-                    {
-                        lineWidth *= pixelWidth;
-                    }
-                }
             }
 
             buffer.distance() = lineWidth * 0.5;   // since the distance is for one side
-            buffer.push( lines, context );
+            buffer.push( newLines, context );
         }
 
         // Transform the features into the map's SRS:
         TransformFilter xform( imageExtent.getSRS() );
         xform.setLocalizeCoordinates( false );
-        FilterContext polysContext = xform.push( polygons, context );
-        FilterContext linesContext = xform.push( lines, context );
+        xform.push( newPolygons, context );
+        xform.push( newLines, context );
 
-        // set up the AGG renderer:
-        agg::rendering_buffer rbuf( image->data(), image->s(), image->t(), image->s()*4 );
-
-        // Create the renderer and the rasterizer
-        agg::rasterizer ras;
-
-        // Setup the rasterizer
-        ras.gamma(_options.gamma().get());
-        ras.filling_rule(agg::fill_even_odd);
+        // drop sub-pixel detail; it costs rasterization time but can't be seen.
+        double tolerance = 0.5 * osg::minimum( 1.0/frame.xf, 1.0/frame.yf );
+        putCachedGeometry( newPolygons, polygonMisses, polygonKeys, tolerance, polygonGeoms );
+        putCachedGeometry( newLines,    lineMisses,    lineKeys,    tolerance, lineGeoms );
 
         // construct an extent for cropping the geometry to our tile.
         // extend just outside the actual extents so we don't get edge artifacts:
@@ -279,40 +354,82 @@ public:
         cropPoly->push_back( osg::Vec3d( cropExtent.xMax(), cropExtent.yMax(), 0 ));
         cropPoly->push_back( osg::Vec3d( cropExtent.xMin(), cropExtent.yMax(), 0 ));
 
-        // render the polygons
-        for(FeatureList::iterator i = polygons.begin(); i != polygons.end(); i++)
+        RenderItems items;
+        items.reserve( polygons.size() + lines.size() );
+
+        // crop the polygons
+        unsigned index = 0;
+        for(FeatureList::iterator i = polygons.begin(); i != polygons.end(); ++i, ++index)
         {
             Feature*  feature  = i->get();
-            Geometry* geometry = feature->getGeometry();
+            Geometry* geometry = polygonGeoms[index].get();
 
-            osg::ref_ptr<Geometry> croppedGeometry;
-            if ( geometry->crop( cropPoly.get(), croppedGeometry ) )
+            RenderItem item;
+            if ( geometry && geometry->crop( cropPoly.get(), item.geometry ) && item.geometry.valid() )
             {
                 const PolygonSymbol* poly =
                     feature->style().isSet() && feature->style()->has<PolygonSymbol>() ? feature->style()->get<PolygonSymbol>() :
                     masterPoly;
                 
-                const osg::Vec4 color = poly ? static_cast<osg::Vec4>(poly->fill()->color()) : osg::Vec4(1,1,1,1);
-                rasterize(croppedGeometry.get(), color, frame, ras, rbuf);
+                item.color  = poly ? static_cast<osg::Vec4>(poly->fill()->color()) : osg::Vec4(1,1,1,1);
+                item.bounds = item.geometry->getBounds();
+                items.push_back( item );
             }
         }
 
-        // render the lines
-        for(FeatureList::iterator i = lines.begin(); i != lines.end(); i++)
+        // crop the lines
+        index = 0;
+        for(FeatureList::iterator i = lines.begin(); i != lines.end(); ++i, ++index)
         {
             Feature*  feature  = i->get();
-            Geometry* geometry = feature->getGeometry();
+            Geometry* geometry = lineGeoms[index].get();
 
-            osg::ref_ptr<Geometry> croppedGeometry;
-            if ( geometry->crop( cropPoly.get(), croppedGeometry ) )
+            RenderItem item;
+            if ( geometry && geometry->crop( cropPoly.get(), item.geometry ) && item.geometry.valid() )
             {
                 const LineSymbol* line =
                     feature->style().isSet() && feature->style()->has<LineSymbol>() ? feature->style()->get<LineSymbol>() :
                     masterLine;
                 
-                const osg::Vec4 color = line ? static_cast<osg::Vec4>(line->stroke()->color()) : osg::Vec4(1,1,1,1);
-                rasterize(croppedGeometry.get(), color, frame, ras, rbuf);
+                item.color  = line ? static_cast<osg::Vec4>(line->stroke()->color()) : osg::Vec4(1,1,1,1);
+                item.bounds = item.geometry->getBounds();
+                items.push_back( item );
+            }
+        }
+
+        if ( items.empty() )
+            return true;
+
+        // render the tile in horizontal bands. Each band has its own rasterizer
+        // and writes only its own rows, so the result matches a serial render.
+        unsigned numBands = _bandService.valid() ?
+            osg::minimum( _numBands, (unsigned)osg::maximum(image->t()/32, 1) ) : 1u;
+
+        if ( numBands <= 1 )
+        {
+            renderBand( items, frame, image, 0, image->t() );
+        }
+        else
+        {
+            int bandRows = image->t() / numBands;
+
+            std::vector< osg::ref_ptr<RenderBandTask> > tasks;
+            tasks.reserve( numBands );
+
+            Threading::MultiEvent semaphore( (int)numBands );
+            for(unsigned b=0; b<numBands; ++b)
+            {
+                RenderBandTask* task = new RenderBandTask( &semaphore );
+                task->_source  = this;
+                task->_items   = &items;
+                task->_frame   = &frame;
+                task->_image   = image;
+                task->_row     = b * bandRows;
+                task->_numRows = b == numBands-1 ? image->t() - task->_row : bandRows;
+                tasks.push_back( task );
+                _bandService->add( task );
             }
+            semaphore.wait();
         }
 
         return true;
@@ -332,9 +449,132 @@ public:
         return true;
     }
 
+    // finds the prepared geometry for each feature, collecting the misses
+    // (as copies, if they'll be cached, so source features stay untouched).
+    void getCachedGeometry(const FeatureList&                     features,
+                           unsigned                               lod,
+                           double                                 lineWidth,
+                           bool                                   copyMisses,
+                           std::vector< osg::ref_ptr<Geometry> >& out_geoms,
+                           std::vector<GeometryKey>&              out_keys,
+                           FeatureList&                           out_misses,
+                           MissIndices&                           out_missIndices)
+    {
+        bool useCache = _options.geometryCacheSize().get() > 0;
+
+        out_geoms.resize( features.size() );
+        out_keys.resize( features.size() );
+
+        unsigned index = 0;
+        for(FeatureList::const_iterator f = features.begin(); f != features.end(); ++f, ++index)
+        {
+            Feature* feature = f->get();
+
+            GeometryKey& key = out_keys[index];
+            key.lod       = lod;
+            key.fid       = feature->getFID();
+            key.numPoints = feature->getGeometry()->getTotalPointCount();
+            key.lineWidth = lineWidth;
+
+            GeometryCache::Record rec;
+            if ( useCache && _geomCache.get(key, rec) )
+            {
+                out_geoms[index] = rec.value().get();
+            }
+            else
+            {
+                Feature* miss = useCache && copyMisses ? new Feature(*feature) : feature;
+                out_missIndices[miss] = index;
+                out_misses.push_back( miss );
+            }
+        }
+    }
+
+    // simplifies the processed misses and stores them, in both the cache and
+    // the per-feature geometry list. Filters may have dropped some misses.
+    void putCachedGeometry(const FeatureList&                     misses,
+                           const MissIndices&                     missIndices,
+                           const std::vector<GeometryKey>&        keys,
+                           double                                 tolerance,
+                           std::vector< osg::ref_ptr<Geometry> >& out_geoms)
+    {
+        bool useCache = _options.geometryCacheSize().get() > 0;
+
+        for(FeatureList::const_iterator f = misses.begin(); f != misses.end(); ++f)
+        {
+            Geometry* geometry = f->get()->getGeometry();
+            MissIndices::const_iterator m = missIndices.find( f->get() );
+            if ( !geometry || m == missIndices.end() )
+                continue;
+
+            unsigned index = m->second;
+
+            decimate( geometry, tolerance );
+            out_geoms[index] = geometry;
+
+            if ( useCache )
+                _geomCache.insert( keys[index], geometry );
+        }
+    }
+
+    // removes consecutive points closer together than the tolerance.
+    static void decimate(Geometry* geometry, double tolerance)
+    {
+        double tolerance2 = tolerance*tolerance;
+
+        GeometryIterator gi( geometry, true );
+        while( gi.hasMore() )
+        {
+            Geometry* part = gi.next();
+            std::vector<osg::Vec3d>& points = part->asVector();
+
+            unsigned minPoints = part->getType() == Geometry::TYPE_LINESTRING ? 2 : 3;
+            if ( points.size() <= minPoints )
+                continue;
+
+            unsigned n = 1;
+            for(unsigned i=1; i<points.size(); ++i)
+            {
+                if ( i == points.size()-1 || (points[i]-points[n-1]).length2() >= tolerance2 )
+                    points[n++] = points[i];
+            }
+
+            if ( n >= minPoints )
+                points.resize( n );
+        }
+    }
+
+    // rasterizes the items that overlap a band of rows of the image.
+    void renderBand(const RenderItems& items, const RenderFrame& frame, osg::Image* image,
+                    int row, int numRows) const
+    {
+        agg::rendering_buffer rbuf( image->data(0, row), image->s(), numRows, image->s()*4 );
+
+        // Create the renderer and the rasterizer
+        agg::rasterizer ras;
+
+        // Setup the rasterizer
+        ras.gamma(_options.gamma().get());
+        ras.filling_rule(agg::fill_even_odd);
+
+        // shift the frame so the band's first row is row 0:
+        RenderFrame bandFrame = frame;
+        bandFrame.ymin = frame.ymin + (double)row / frame.yf;
+        double bandMaxY = frame.ymin + (double)(row + numRows + 1) / frame.yf;
+        double bandMinY = frame.ymin + (double)(row - 1) / frame.yf;
+
+        for(RenderItems::const_iterator i = items.begin(); i != items.end(); ++i)
+        {
+            if ( i->bounds.yMax() >= bandMinY && i->bounds.yMin() <= bandMaxY )
+            {
+                rasterize( i->geometry.get(), i->color, bandFrame, ras, rbuf );
+            }
+        }
+    }
+
     // rasterizes a geometry.
-    void rasterize(const Geometry* geometry, const osg::Vec4& color, RenderFrame& frame, 
-                   agg::rasterizer& ras, agg::rendering_buffer& buffer)
+    void rasterize(const Geometry* geometry, const osg::Vec4& color, const RenderFrame& frame, 
+                   agg::rasterizer& ras, agg::rendering_buffer& buffer) const
     {
         osg::Vec4 c = color;
         unsigned int a = (unsigned int)(127.0f+(c.a()*255.0f)/2.0f); // scale alpha up
@@ -379,8 +619,11 @@ public:
     }
 
 private:
-    const AGGLiteOptions _options;
-    std::string _configPath;
+    const AGGLiteOptions      _options;
+    std::string               _configPath;
+    GeometryCache             _geomCache;
+    unsigned                  _numBands;
+    osg::ref_ptr<TaskService> _bandService;
 };
 
 
@@ -1,6 +1,7 @@
 #include "MapService.h"
 #include <osgEarth/JsonUtils>
 #include <osgEarth/Registry>
+#include <osgEarth/MetadataCache>
 #include <osg/Notify>
 #include <sstream>
 #include <limits.h>
@@ -133,7 +134,7 @@ MapService::init( const URI& _uri, const osgDB::ReaderWriter::Options* options )
     std::string sep = uri.full().find( "?" ) == std::string::npos ? "?" : "&";
     std::string json_url = uri.full() + sep + std::string("f=pjson");  // request the data in JSON format
 
-    ReadResult r = URI(json_url).readString( options );
+    ReadResult r = MetadataCache::readString( URI(json_url), options );
     if ( r.failed() )
         return setError( "Unable to read metadata from ArcGIS service" );
 
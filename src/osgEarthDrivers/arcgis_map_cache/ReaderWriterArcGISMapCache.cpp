@@ -20,6 +20,7 @@
 #include <osgEarth/TileSource>
 #include <osgEarth/Registry>
 #include <osgEarth/URI>
+#include <osgEarth/Containers>
 
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
@@ -30,13 +31,223 @@
 
 #include <sstream>
 #include <iomanip>
+#include <streambuf>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#else
+#   include <unistd.h>
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#endif
 
 using namespace osgEarth;
 
+#define LC "[ArcGISMapCache] "
+
 #define PROPERTY_URL        "url"
 #define PROPERTY_MAP        "map"
 #define PROPERTY_LAYER      "layer"
 #define PROPERTY_FORMAT     "format"
+#define PROPERTY_COMPACT    "compact"
+#define PROPERTY_BUNDLES    "max_open_bundles"
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    /**
+     * Read-only memory mapping of a whole file.
+     */
+    class FileMapping : public osg::Referenced
+    {
+    public:
+        FileMapping( const std::string& path ) :
+        _data( 0L ),
+        _size( 0ull )
+        {
+#ifdef _WIN32
+            _map  = 0L;
+            _file = ::CreateFileA(
+                path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                0L, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0L );
+
+            LARGE_INTEGER fileSize;
+            if ( _file != INVALID_HANDLE_VALUE && ::GetFileSizeEx(_file, &fileSize) && fileSize.QuadPart > 0 )
+            {
+                _map = ::CreateFileMappingA( _file, 0L, PAGE_READONLY, 0, 0, 0L );
+                if ( _map )
+                {
+                    _data = static_cast<const unsigned char*>( ::MapViewOfFile(_map, FILE_MAP_READ, 0, 0, 0) );
+                    if ( _data )
+                        _size = (unsigned long long)fileSize.QuadPart;
+                }
+            }
+#else
+            _fd = ::open( path.c_str(), O_RDONLY );
+
+            struct stat s;
+            if ( _fd >= 0 && ::fstat(_fd, &s) == 0 && s.st_size > 0 && (unsigned long long)s.st_size <= (unsigned long long)(~(std::size_t)0) )
+            {
+                void* ptr = ::mmap( 0L, (std::size_t)s.st_size, PROT_READ, MAP_SHARED, _fd, 0 );
+                if ( ptr != MAP_FAILED )
+                {
+                    _data = static_cast<const unsigned char*>(ptr);
+                    _size = (unsigned long long)s.st_size;
+                }
+            }
+#endif
+        }
+
+        bool valid() const { return _data != 0L; }
+
+        const unsigned char* data() const { return _data; }
+
+        unsigned long long size() const { return _size; }
+
+    protected:
+        virtual ~FileMapping()
+        {
+#ifdef _WIN32
+            if ( _data )
+                ::UnmapViewOfFile( _data );
+            if ( _map )
+                ::CloseHandle( _map );
+            if ( _file != INVALID_HANDLE_VALUE )
+                ::CloseHandle( _file );
+#else
+            if ( _data )
+                ::munmap( const_cast<unsigned char*>(_data), (std::size_t)_size );
+            if ( _fd >= 0 )
+                ::close( _fd );
+#endif
+        }
+
+        const unsigned char* _data;
+        unsigned long long   _size;
+#ifdef _WIN32
+        HANDLE               _file;
+        HANDLE               _map;
+#else
+        int                  _fd;
+#endif
+    };
+
+    /** Reads an unsigned little-endian integer of the given width. */
+    unsigned long long readLE(const unsigned char* p, unsigned bytes)
+    {
+        unsigned long long value = 0ull;
+        for( unsigned i = bytes; i > 0; --i )
+            value = (value << 8) | p[i-1];
+        return value;
+    }
+
+    /** Read-only stream over a block of memory, so tiles decode in place. */
+    struct MemoryStreamBuf : public std::streambuf
+    {
+        MemoryStreamBuf(const unsigned char* data, std::size_t size)
+        {
+            char* p = reinterpret_cast<char*>( const_cast<unsigned char*>(data) );
+            setg( p, p, p + size );
+        }
+    };
+
+    /**
+     * One file of an ArcGIS compact cache, covering a square of
+     * BUNDLE_DIM x BUNDLE_DIM tiles. Reads both layouts:
+     *
+     *   Compact V1 (ArcGIS 10.0-10.2): R####C####.bundlx is the index, a
+     *   16-byte header and a 5-byte offset per tile (column-major) into
+     *   R####C####.bundle, where each tile is a 4-byte size and its data.
+     *
+     *   Compact V2 (ArcGIS 10.3+): R####C####.bundle alone, with a 64-byte
+     *   header followed by an 8-byte entry per tile (row-major) holding the
+     *   data offset in the low 40 bits and the size in the high 24.
+     *
+     * Both files are memory-mapped, so a tile read is an index lookup.
+     */
+    class Bundle : public osg::Referenced
+    {
+    public:
+        enum { BUNDLE_DIM = 128 };
+
+        /** Opens the bundle at basePath (no extension); returns NULL if it can't. */
+        static Bundle* open(const std::string& basePath, unsigned row0, unsigned col0)
+        {
+            osg::ref_ptr<Bundle> bundle = new Bundle( row0, col0 );
+
+            bundle->_data = new FileMapping( basePath + ".bundle" );
+            if ( !bundle->_data->valid() )
+                return 0L;
+
+            std::string indexPath = basePath + ".bundlx";
+            if ( osgDB::fileExists(indexPath) )
+            {
+                bundle->_index = new FileMapping( indexPath );
+                if ( !bundle->_index->valid() || bundle->_index->size() < V1_INDEX_HEADER + V1_ENTRY*BUNDLE_DIM*BUNDLE_DIM )
+                    return 0L;
+            }
+            else if ( bundle->_data->size() < V2_INDEX_OFFSET + V2_ENTRY*BUNDLE_DIM*BUNDLE_DIM )
+            {
+                return 0L;
+            }
+
+            return bundle.release();
+        }
+
+        /**
+         * Finds a tile in the bundle. Returns false if the bundle holds no
+         * tile at that row and column.
+         */
+        bool getTile(unsigned row, unsigned col, const unsigned char*& out_data, unsigned& out_size) const
+        {
+            if ( row < _row0 || row >= _row0 + BUNDLE_DIM || col < _col0 || col >= _col0 + BUNDLE_DIM )
+                return false;
+
+            unsigned long long offset, size;
+
+            if ( _index.valid() )
+            {
+                unsigned entry = BUNDLE_DIM*(col - _col0) + (row - _row0);
+                offset = readLE( _index->data() + V1_INDEX_HEADER + V1_ENTRY*entry, V1_ENTRY );
+                if ( offset + 4u > _data->size() )
+                    return false;
+                size = readLE( _data->data() + offset, 4u );
+                offset += 4u;
+            }
+            else
+            {
+                unsigned entry = BUNDLE_DIM*(row - _row0) + (col - _col0);
+                unsigned long long value = readLE( _data->data() + V2_INDEX_OFFSET + V2_ENTRY*entry, V2_ENTRY );
+                offset = value & 0xFFFFFFFFFFull;
+                size   = value >> 40;
+            }
+
+            if ( size == 0u || offset + size > _data->size() )
+                return false;
+
+            out_data = _data->data() + offset;
+            out_size = (unsigned)size;
+            return true;
+        }
+
+    protected:
+        Bundle(unsigned row0, unsigned col0) : _row0(row0), _col0(col0) { }
+
+        static const unsigned V1_INDEX_HEADER = 16u;
+        static const unsigned V1_ENTRY        = 5u;
+        static const unsigned V2_INDEX_OFFSET = 64u;
+        static const unsigned V2_ENTRY        = 8u;
+
+        osg::ref_ptr<FileMapping> _data;
+        osg::ref_ptr<FileMapping> _index;   // V1 only
+        unsigned                  _row0, _col0;
+    };
+}
+
+//------------------------------------------------------------------------
 
 class AGSMapCacheSource : public TileSource
 {
@@ -65,6 +276,13 @@ public:
 
         if ( _format.empty() )
             _format = "png";
+
+        // the cache storage: exploded (a file per tile) or compact (bundles);
+        // detected from the cache itself unless set.
+        _compact = conf.value<bool>( PROPERTY_COMPACT, false );
+        _compactIsSet = conf.hasValue( PROPERTY_COMPACT );
+
+        _bundles.setMaxSize( conf.value<unsigned>( PROPERTY_BUNDLES, 64u ) );
     }
 
     Status initialize( const osgDB::Options* dbOptions )
@@ -74,6 +292,28 @@ public:
         //Set the profile to global geodetic.
         setProfile(osgEarth::Registry::instance()->getGlobalGeodeticProfile());
 
+        std::string layerPath = _url + "/" + _map + "/Layers/" + _layer;
+
+        if ( !_compactIsSet && !osgDB::containsServerAddress(layerPath) )
+        {
+            // a compact cache keeps just bundles in its level folders:
+            osgDB::DirectoryContents files = osgDB::getDirectoryContents( layerPath + "/L00" );
+            for( osgDB::DirectoryContents::const_iterator i = files.begin(); i != files.end() && !_compact; ++i )
+            {
+                if ( osgDB::getLowerCaseFileExtension(*i) == "bundle" )
+                    _compact = true;
+            }
+        }
+
+        if ( _compact )
+        {
+            if ( osgDB::containsServerAddress(layerPath) )
+            {
+                return Status::Error( "Compact caches must be local, since bundles are memory-mapped" );
+            }
+            OE_INFO << LC << "Reading compact cache at " << layerPath << std::endl;
+        }
+
         return STATUS_OK;
     }
 
@@ -87,6 +327,9 @@ public:
         unsigned int tile_x, tile_y;
         key.getTileXY( tile_x, tile_y );
 
+        if ( _compact )
+            return createImageFromBundle( level, tile_y, tile_x );
+
         std::string bufStr = Stringify()
             << _url << "/" << _map 
             << "/Layers/" << _layer
@@ -99,6 +342,54 @@ public:
         return URI(bufStr).getImage( _dbOptions.get(), progress );
     }
 
+    osg::Image* createImageFromBundle( int level, unsigned row, unsigned col )
+    {
+        if ( level < 0 )
+            return 0L;
+
+        unsigned row0 = row - (row % Bundle::BUNDLE_DIM);
+        unsigned col0 = col - (col % Bundle::BUNDLE_DIM);
+
+        std::string basePath = Stringify()
+            << _url << "/" << _map 
+            << "/Layers/" << _layer
+            << "/L" << std::dec << std::setw(2) << std::setfill('0') << level
+            << "/R" << std::hex << std::setw(4) << std::setfill('0') << row0
+            << "C"  << std::hex << std::setw(4) << std::setfill('0') << col0;
+
+        osg::ref_ptr<Bundle> bundle;
+        BundleCache::Record rec;
+        if ( _bundles.get(basePath, rec) )
+        {
+            bundle = rec.value().get();
+        }
+        else
+        {
+            // a missing bundle is cached as NULL, so its empty area costs nothing either
+            bundle = Bundle::open( basePath, row0, col0 );
+            _bundles.insert( basePath, bundle.get() );
+        }
+
+        const unsigned char* data;
+        unsigned size;
+        if ( !bundle.valid() || !bundle->getTile(row, col, data, size) )
+            return 0L;
+
+        // tiles are PNG or JPEG; a "mixed" cache holds both
+        std::string ext = size >= 2u && data[0] == 0xFF && data[1] == 0xD8 ? "jpg" : "png";
+        osgDB::ReaderWriter* reader = osgDB::Registry::instance()->getReaderWriterForExtension( ext );
+        if ( !reader )
+        {
+            OE_WARN << LC << "No reader for \"" << ext << "\"" << std::endl;
+            return 0L;
+        }
+
+        MemoryStreamBuf buf( data, size );
+        std::istream in( &buf );
+        osgDB::ReaderWriter::ReadResult result = reader->readImage( in, _dbOptions.get() );
+        return result.success() ? result.takeImage() : 0L;
+    }
+
     // override
     osg::HeightField* createHeightField( const TileKey& key, ProgressCallback* progress)
     {
@@ -117,7 +408,13 @@ private:
     std::string _map;
     std::string _layer;
     std::string _format;
+    bool        _compact;
+    bool        _compactIsSet;
     osg::ref_ptr<osgDB::Options> _dbOptions;
+
+    // open bundles, keyed by path; the least recently used get unmapped
+    typedef ShardedLRUCache<std::string, osg::ref_ptr<Bundle> > BundleCache;
+    BundleCache _bundles;
 };
 
 
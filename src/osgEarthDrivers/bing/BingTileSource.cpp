@@ -4,7 +4,7 @@
 #include <osgEarth/Registry>
 #include <osgEarth/URI>
 #include <osgEarth/StringUtils>
-#include <osgEarth/Random>
+#include <osgEarth/URLTemplate>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/Containers>
 
@@ -46,7 +46,9 @@ class BingTileSource : public TileSource
 private:
     osgEarth::Drivers::BingOptions _options;
     osg::ref_ptr<osgDB::Options>   _dbOptions;
-    Random                         _prng;
+    URLTemplate                    _directTemplate;
+    std::string                    _requestPrefix;
+    std::string                    _requestSuffix;
     bool                           _debugDirect;
     osg::ref_ptr<Geometry>         _geom;
     osg::ref_ptr<osgText::Font>    _font;
@@ -106,6 +108,18 @@ public:
 
         setProfile( profile );
 
+        // The parts of the REST API request that are the same for every tile.
+        // Docs are here: http://msdn.microsoft.com/en-us/library/ff701716.aspx
+        _requestPrefix = Stringify()
+            << _options.imageryMetadataAPI().get()     // base REST API
+            << "/" << _options.imagerySet().get()      // imagery set to use
+            << "/";
+        _requestSuffix = Stringify()
+            << "&o=json"                               // response format
+            << "&key=" << _options.key().get();        // API key
+
+        _directTemplate = URLTemplate( "http://ecn.t[0123].tiles.virtualearth.net/tiles/h{key}.jpeg?g=1236" );
+
         return STATUS_OK;
     }
     
@@ -143,18 +157,12 @@ public:
                 getProfile()->getSRS()->getGeographicSRS(),
                 geo );
 
-            // contact the REST API. Docs are here:
-            // http://msdn.microsoft.com/en-us/library/ff701716.aspx
-
             // construct the request URI:
-            std::string request = Stringify()
-                << std::setprecision(12)
-                << _options.imageryMetadataAPI().get()     // base REST API
-                << "/"    << _options.imagerySet().get()   // imagery set to use
-                << "/"    << geo.y() << "," << geo.x()     // center point in lat/long
-                << "?zl=" << key.getLOD() + 1              // zoom level
-                << "&o=json"                               // response format
-                << "&key=" << _options.key().get();        // API key
+            std::string request( _requestPrefix );
+            request += Stringify() << std::setprecision(12) << geo.y() << "," << geo.x(); // center point in lat/long
+            request += "?zl=";
+            URLTemplate::appendUnsigned( request, key.getLOD() + 1 );                     // zoom level
+            request += _requestSuffix;
 
             // check the URI cache.
             URI                  location;
@@ -246,38 +254,11 @@ public:
 
 private:
 
-    std::string getQuadKey(const TileKey& key)
-    {
-        unsigned int tile_x, tile_y;
-        key.getTileXY(tile_x, tile_y);
-        unsigned int lod = key.getLevelOfDetail();
-
-        std::stringstream ss;
-        for( unsigned i = (int)lod+1; i > 0; i-- )
-        {
-            char digit = '0';
-            unsigned mask = 1 << (i-1);
-            if ( (tile_x & mask) != 0 )
-            {
-                digit++;
-            }
-            if ( (tile_y & mask) != 0 )
-            {
-                digit += 2;
-            }
-            ss << digit;
-        }
-        return ss.str();
-    }
-
     std::string getDirectURI(const TileKey& key)
     {
-        return Stringify()
-            << "http://ecn.t"
-            << _prng.next(4)
-            << ".tiles.virtualearth.net/tiles/h"
-            << getQuadKey(key)
-            << ".jpeg?g=1236";
+        std::string uri;
+        _directTemplate.expand( key.getTileX(), key.getTileY(), key.getLevelOfDetail(), uri );
+        return uri;
     }
 };
 
@@ -23,19 +23,27 @@
 #include <osgEarth/XmlUtils>
 #include <osgEarth/URI>
 #include <osgEarth/FileUtils>
+#include <osgEarth/DateTime>
 #include <osgEarth/StringUtils>
 #include <osgEarth/Registry>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
+#include <osg/Image>
 #include <fstream>
+#include <cstdio>
+#include <cstring>
 #include <sys/stat.h>
 
 using namespace osgEarth;
 using namespace osgEarth::Drivers;
 using namespace osgEarth::Threading;
 
-#ifndef _WIN32
+#ifdef _WIN32
+#   include <windows.h>
+#else
 #   include <unistd.h>
+#   include <fcntl.h>
+#   include <sys/mman.h>
 #endif
 
 namespace
@@ -67,7 +75,11 @@ namespace
 
         void init();
 
+        CacheBin* createBin( const std::string& binID );
+
         std::string _rootPath;
+        bool        _packed;
+        bool        _rawImages;
     };
 
     /** 
@@ -121,6 +133,134 @@ namespace
         Threading::ReadWriteMutex         _rwmutex;
     };
 
+    /** Byte offset within a pack file; packs may grow beyond 4GB. */
+    typedef unsigned long long PackOffset;
+
+    /**
+     * Copy-on-write memory mapping of a pack file. Readers hold a reference
+     * to the mapping while they deserialize from it, so a bin can replace its
+     * mapping (after the pack grows) without pulling memory out from under
+     * a concurrent read. Changes to mapped memory never reach the file.
+     */
+    class PackMapping : public osg::Referenced
+    {
+    public:
+        PackMapping( const std::string& path );
+
+        bool valid() const { return _data != 0L; }
+
+        char* data() const { return _data; }
+
+        PackOffset size() const { return _size; }
+
+    protected:
+        virtual ~PackMapping();
+
+        char*       _data;
+        PackOffset  _size;
+#ifdef _WIN32
+        HANDLE      _file;
+        HANDLE      _map;
+#else
+        int         _fd;
+#endif
+    };
+
+    /**
+     * Image whose pixels live in a pack mapping rather than on the heap. It
+     * holds a reference to the mapping so the pixels stay valid for the life
+     * of the image, however long that outlives the read.
+     */
+    class MappedImage : public osg::Image
+    {
+    public:
+        MappedImage( PackMapping* mapping ) : _mapping( mapping ) { }
+
+    protected:
+        virtual ~MappedImage() { }
+
+        osg::ref_ptr<PackMapping> _mapping;
+    };
+
+    /**
+     * Cache bin that stores all of its records in one append-only pack file
+     * plus a key index, instead of one file per record. Records are read
+     * straight out of a memory mapping of the pack where the platform allows
+     * it. Overwritten and removed records leave dead space behind them in
+     * the pack; compact() rewrites the pack to reclaim it.
+     */
+    class PackedFileSystemCacheBin : public FileSystemCacheBin
+    {
+    public:
+        PackedFileSystemCacheBin( const std::string& name, const std::string& rootPath, bool rawImages );
+
+    public: // CacheBin interface
+
+        ReadResult readObject(const std::string& key);
+
+        ReadResult readImage(const std::string& key);
+
+        ReadResult readNode(const std::string& key);
+
+        bool write(const std::string& key, const osg::Object* object, const Config& meta);
+
+        bool remove(const std::string& key);
+
+        bool touch(const std::string& key);
+
+        RecordStatus getRecordStatus(const std::string& key);
+
+        bool clear();
+
+        bool compact();
+
+        unsigned getStorageSize();
+
+    protected:
+        enum ObjectType
+        {
+            TYPE_OBJECT,
+            TYPE_IMAGE,
+            TYPE_NODE
+        };
+
+        struct IndexEntry
+        {
+            PackOffset _offset;    // offset of the serialized data in the pack
+            unsigned   _dataSize;  // size of the serialized data
+            unsigned   _metaSize;  // size of the JSON metadata following the data
+            TimeStamp  _time;      // time of the last write or touch
+        };
+        typedef std::map<std::string, IndexEntry> Index;
+
+        bool indexValidForReading();
+
+        bool indexValidForWriting();
+
+        void loadIndex();
+
+        bool rebuildIndex();
+
+        bool appendIndexRecord(std::ostream& out, const std::string& key, const IndexEntry& entry, bool removed);
+
+        bool appendPackRecord(std::ostream& out, PackOffset& packSize, const std::string& key, const char* payload, IndexEntry& entry);
+
+        PackMapping* getMapping(PackOffset requiredSize);
+
+        void releaseMapping();
+
+        ReadResult read(const std::string& key, ObjectType type);
+
+        bool                              _rawImages;
+        volatile bool                     _indexLoaded;
+        std::string                       _packPath;       // full path to the pack holding the records
+        std::string                       _indexPath;      // full path to the pack's key index
+        Index                             _index;
+        PackOffset                        _packSize;
+        osg::ref_ptr<PackMapping>         _mapping;
+        Threading::Mutex                  _mappingMutex;
+    };
+
     void writeMeta( const std::string& fullPath, const Config& meta )
     {
         std::ofstream outmeta( fullPath.c_str() );
@@ -172,6 +312,8 @@ namespace
         }
 
         _rootPath = URI( *fsco.rootPath(), options.referrer() ).full();
+        _packed    = fsco.packed().get();
+        _rawImages = fsco.rawImages().get();
         init();
     }
 
@@ -184,7 +326,7 @@ namespace
     CacheBin*
     FileSystemCache::addBin( const std::string& name )
     {
-        return _bins.getOrCreate( name, new FileSystemCacheBin( name, _rootPath ) );
+        return _bins.getOrCreate( name, createBin(name) );
     }
 
     CacheBin*
@@ -196,12 +338,21 @@ namespace
             Threading::ScopedMutexLock lock( s_defaultBinMutex );
             if ( !_defaultBin.valid() ) // double-check
             {
-                _defaultBin = new FileSystemCacheBin( "__default", _rootPath );
+                _defaultBin = createBin( "__default" );
             }
         }
         return _defaultBin.get();
     }
 
+    CacheBin*
+    FileSystemCache::createBin( const std::string& name )
+    {
+        if ( _packed )
+            return new PackedFileSystemCacheBin( name, _rootPath, _rawImages );
+        else
+            return new FileSystemCacheBin( name, _rootPath );
+    }
+
     //------------------------------------------------------------------------
 
     std::string
@@ -582,6 +733,782 @@ namespace
         }
         return false;
     }
+
+    //------------------------------------------------------------------------
+
+    // Leading word of every record in a pack file; lets rebuildIndex() resync.
+    const unsigned PACK_RECORD_MAGIC = 0x4B50454F; // "OEPK"
+
+    // Size of a pack record header: magic, key size, data size, meta size.
+    const unsigned PACK_RECORD_HEADER_SIZE = 4 * sizeof(unsigned);
+
+    // Data size written to the index to mark a removed record.
+    const unsigned INDEX_TOMBSTONE = ~0u;
+
+    // Record payloads start on this boundary so mapped pixels are aligned.
+    const unsigned PACK_ALIGNMENT = 16;
+
+    // Leading word of a raw image payload (as opposed to an OSGB stream).
+    const unsigned RAW_IMAGE_MAGIC = 0x5249454F; // "OEIR"
+
+    /**
+     * Header of a raw image payload. It is followed by the mipmap offsets,
+     * padding up to _headerSize, and then the pixel data itself.
+     */
+    struct RawImageHeader
+    {
+        unsigned _magic;
+        int      _s, _t, _r;
+        int      _internalFormat;
+        unsigned _pixelFormat;
+        unsigned _dataType;
+        unsigned _packing;
+        int      _origin;
+        unsigned _numMipmapOffsets;
+        unsigned _headerSize;
+    };
+
+    template<typename T>
+    inline void writePOD( std::ostream& out, const T& value )
+    {
+        out.write( reinterpret_cast<const char*>(&value), sizeof(T) );
+    }
+
+    template<typename T>
+    inline bool readPOD( std::istream& in, T& value )
+    {
+        in.read( reinterpret_cast<char*>(&value), sizeof(T) );
+        return in.gcount() == sizeof(T);
+    }
+
+    /**
+     * Read-only stream buffer over a block of memory, so the ReaderWriter
+     * can deserialize directly from a pack mapping without copying it.
+     */
+    class MemoryStreamBuf : public std::streambuf
+    {
+    public:
+        MemoryStreamBuf( const char* data, std::size_t size )
+        {
+            char* begin = const_cast<char*>(data);
+            setg( begin, begin, begin + size );
+        }
+
+    protected:
+        pos_type seekoff( off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which )
+        {
+            char* target =
+                dir == std::ios_base::beg ? eback() + off :
+                dir == std::ios_base::cur ? gptr()  + off :
+                                            egptr() + off;
+
+            if ( target < eback() || target > egptr() )
+                return pos_type(off_type(-1));
+
+            setg( eback(), target, egptr() );
+            return pos_type( target - eback() );
+        }
+
+        pos_type seekpos( pos_type pos, std::ios_base::openmode which )
+        {
+            return seekoff( off_type(pos), std::ios_base::beg, which );
+        }
+    };
+
+    /** Serializes an image as a raw (uncompressed, directly mappable) payload. */
+    bool encodeRawImage( const osg::Image* image, std::string& output )
+    {
+        if ( !image || !image->data() )
+            return false;
+
+        const osg::Image::MipmapDataType& mipmaps = image->getMipmapLevels();
+
+        RawImageHeader h;
+        h._magic            = RAW_IMAGE_MAGIC;
+        h._s                = image->s();
+        h._t                = image->t();
+        h._r                = image->r();
+        h._internalFormat   = image->getInternalTextureFormat();
+        h._pixelFormat      = image->getPixelFormat();
+        h._dataType         = image->getDataType();
+        h._packing          = image->getPacking();
+        h._origin           = (int)image->getOrigin();
+        h._numMipmapOffsets = mipmaps.size();
+
+        unsigned headerSize = sizeof(RawImageHeader) + mipmaps.size() * sizeof(unsigned);
+        h._headerSize = ((headerSize + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT) * PACK_ALIGNMENT;
+
+        unsigned pixelSize = image->getTotalSizeInBytesIncludingMipmaps();
+
+        output.reserve( h._headerSize + pixelSize );
+        output.append( reinterpret_cast<const char*>(&h), sizeof(RawImageHeader) );
+        for( unsigned i = 0; i < mipmaps.size(); ++i )
+            output.append( reinterpret_cast<const char*>(&mipmaps[i]), sizeof(unsigned) );
+        output.resize( h._headerSize, '\0' );
+        output.append( reinterpret_cast<const char*>(image->data()), pixelSize );
+        return true;
+    }
+
+    /** Whether the payload holds a raw image written by encodeRawImage. */
+    bool isRawImage( const char* payload, unsigned size )
+    {
+        unsigned magic;
+        if ( size < sizeof(RawImageHeader) )
+            return false;
+        ::memcpy( &magic, payload, sizeof(unsigned) );
+        return magic == RAW_IMAGE_MAGIC;
+    }
+
+    /**
+     * Rebuilds an image from a raw payload. If a mapping is passed in, the
+     * image references the pixels in place; otherwise it gets its own copy.
+     */
+    osg::Image* decodeRawImage( char* payload, unsigned size, PackMapping* mapping )
+    {
+        RawImageHeader h;
+        ::memcpy( &h, payload, sizeof(RawImageHeader) );
+
+        if ( h._headerSize > size || sizeof(RawImageHeader) + h._numMipmapOffsets * sizeof(unsigned) > h._headerSize )
+            return 0L;
+
+        unsigned       pixelSize = size - h._headerSize;
+        unsigned char* pixels    = reinterpret_cast<unsigned char*>(payload + h._headerSize);
+
+        osg::ref_ptr<osg::Image> image;
+        if ( mapping )
+        {
+            image = new MappedImage( mapping );
+            image->setImage(
+                h._s, h._t, h._r, h._internalFormat, h._pixelFormat, h._dataType,
+                pixels, osg::Image::NO_DELETE, h._packing );
+        }
+        else
+        {
+            unsigned char* copy = new unsigned char[pixelSize];
+            ::memcpy( copy, pixels, pixelSize );
+            image = new osg::Image();
+            image->setImage(
+                h._s, h._t, h._r, h._internalFormat, h._pixelFormat, h._dataType,
+                copy, osg::Image::USE_NEW_DELETE, h._packing );
+        }
+
+        osg::Image::MipmapDataType mipmaps( h._numMipmapOffsets );
+        if ( h._numMipmapOffsets > 0 )
+            ::memcpy( &mipmaps[0], payload + sizeof(RawImageHeader), h._numMipmapOffsets * sizeof(unsigned) );
+        image->setMipmapLevels( mipmaps );
+        image->setOrigin( (osg::Image::Origin)h._origin );
+
+        // guard against a truncated or corrupt record.
+        if ( image->getTotalSizeInBytesIncludingMipmaps() > pixelSize )
+            return 0L;
+
+        return image.release();
+    }
+
+    PackMapping::PackMapping( const std::string& path ) :
+    _data( 0L ),
+    _size( 0 )
+    {
+#ifdef _WIN32
+        _map  = 0L;
+        _file = ::CreateFileA(
+            path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            0L, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0L );
+
+        LARGE_INTEGER fileSize;
+        if ( _file != INVALID_HANDLE_VALUE && ::GetFileSizeEx(_file, &fileSize) && fileSize.QuadPart > 0 )
+        {
+            _map = ::CreateFileMappingA( _file, 0L, PAGE_WRITECOPY, 0, 0, 0L );
+            if ( _map )
+            {
+                _data = static_cast<char*>( ::MapViewOfFile(_map, FILE_MAP_COPY, 0, 0, 0) );
+                if ( _data )
+                    _size = (PackOffset)fileSize.QuadPart;
+            }
+        }
+#else
+        _fd = ::open( path.c_str(), O_RDONLY );
+
+        struct stat s;
+        if ( _fd >= 0 && ::fstat(_fd, &s) == 0 && s.st_size > 0 && (PackOffset)s.st_size <= (PackOffset)(~(std::size_t)0) )
+        {
+            void* ptr = ::mmap( 0L, (std::size_t)s.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, _fd, 0 );
+            if ( ptr != MAP_FAILED )
+            {
+                _data = static_cast<char*>(ptr);
+                _size = (PackOffset)s.st_size;
+            }
+        }
+#endif
+    }
+
+    PackMapping::~PackMapping()
+    {
+#ifdef _WIN32
+        if ( _data )
+            ::UnmapViewOfFile( _data );
+        if ( _map )
+            ::CloseHandle( _map );
+        if ( _file != INVALID_HANDLE_VALUE )
+            ::CloseHandle( _file );
+#else
+        if ( _data )
+            ::munmap( _data, (std::size_t)_size );
+        if ( _fd >= 0 )
+            ::close( _fd );
+#endif
+    }
+
+    //------------------------------------------------------------------------
+
+    PackedFileSystemCacheBin::PackedFileSystemCacheBin(const std::string& binID,
+                                                       const std::string& rootPath,
+                                                       bool               rawImages) :
+    FileSystemCacheBin( binID, rootPath ),
+    _rawImages        ( rawImages ),
+    _indexLoaded      ( false ),
+    _packSize         ( 0 )
+    {
+        _packPath  = osgDB::concatPaths( _binPath, "osgearth_cache.pack" );
+        _indexPath = osgDB::concatPaths( _binPath, "osgearth_cache.index" );
+    }
+
+    bool
+    PackedFileSystemCacheBin::indexValidForReading()
+    {
+        if ( !binValidForReading() )
+            return false;
+
+        if ( !_indexLoaded )
+        {
+            ScopedWriteLock exclusiveLock( _rwmutex );
+            if ( !_indexLoaded ) // double-check
+                loadIndex();
+        }
+        return true;
+    }
+
+    bool
+    PackedFileSystemCacheBin::indexValidForWriting()
+    {
+        if ( !binValidForWriting() )
+            return false;
+
+        if ( !_indexLoaded )
+        {
+            ScopedWriteLock exclusiveLock( _rwmutex );
+            if ( !_indexLoaded ) // double-check
+                loadIndex();
+        }
+        return true;
+    }
+
+    void
+    PackedFileSystemCacheBin::loadIndex()
+    {
+        // caller must hold an exclusive lock.
+        _index.clear();
+        _packSize = 0;
+
+        std::ifstream pack( _packPath.c_str(), std::ios_base::in | std::ios_base::binary );
+        if ( pack.is_open() )
+        {
+            pack.seekg( 0, std::ios_base::end );
+            _packSize = (PackOffset)pack.tellg();
+        }
+        pack.close();
+
+        std::ifstream in( _indexPath.c_str(), std::ios_base::in | std::ios_base::binary );
+        if ( in.is_open() )
+        {
+            // replay the index journal; later records supersede earlier ones
+            // and a partial record at the tail (from an interrupted write) is ignored.
+            unsigned keySize;
+            while( readPOD(in, keySize) )
+            {
+                std::string key( keySize, '\0' );
+                if ( keySize > 0 )
+                {
+                    in.read( &key[0], keySize );
+                    if ( (unsigned)in.gcount() != keySize )
+                        break;
+                }
+
+                IndexEntry entry;
+                long long  time;
+                if ( !readPOD(in, entry._offset) || !readPOD(in, entry._dataSize) ||
+                     !readPOD(in, entry._metaSize) || !readPOD(in, time) )
+                    break;
+
+                entry._time = (TimeStamp)time;
+
+                if ( entry._dataSize == INDEX_TOMBSTONE )
+                    _index.erase( key );
+                else if ( entry._offset + entry._dataSize + entry._metaSize <= _packSize )
+                    _index[key] = entry;
+            }
+        }
+        else if ( _packSize > 0 )
+        {
+            OE_INFO << LC << "Rebuilding missing index for cache bin " << getID() << std::endl;
+            rebuildIndex();
+        }
+
+        _indexLoaded = true;
+
+        OE_DEBUG << LC << "Loaded " << _index.size() << " records for packed cache bin " << getID() << std::endl;
+    }
+
+    bool
+    PackedFileSystemCacheBin::rebuildIndex()
+    {
+        // caller must hold an exclusive lock.
+        std::ifstream pack( _packPath.c_str(), std::ios_base::in | std::ios_base::binary );
+        if ( !pack.is_open() )
+            return false;
+
+        TimeStamp  packTime = osgEarth::getLastModifiedTime( _packPath );
+        PackOffset pos      = 0;
+
+        unsigned magic, keySize, skipped = 0;
+        IndexEntry entry;
+        while( readPOD(pack, magic) )
+        {
+            if ( magic != PACK_RECORD_MAGIC )
+            {
+                // step over the alignment padding in front of a record.
+                if ( ++skipped >= PACK_ALIGNMENT )
+                    break;
+                pack.seekg( (std::streamoff)(++pos), std::ios_base::beg );
+                continue;
+            }
+            skipped = 0;
+
+            if ( !readPOD(pack, keySize) || !readPOD(pack, entry._dataSize) || !readPOD(pack, entry._metaSize) )
+                break;
+
+            std::string key( keySize, '\0' );
+            if ( keySize > 0 )
+            {
+                pack.read( &key[0], keySize );
+                if ( (unsigned)pack.gcount() != keySize )
+                    break;
+            }
+
+            entry._offset = pos + PACK_RECORD_HEADER_SIZE + keySize;
+            entry._time   = packTime;
+
+            PackOffset next = entry._offset + entry._dataSize + entry._metaSize;
+            if ( next > _packSize )
+                break;
+
+            _index[key] = entry;
+            pos = next;
+            pack.seekg( (std::streamoff)pos, std::ios_base::beg );
+        }
+        pack.close();
+
+        std::ofstream out( _indexPath.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
+        if ( !out.is_open() )
+            return false;
+
+        for( Index::const_iterator i = _index.begin(); i != _index.end(); ++i )
+            appendIndexRecord( out, i->first, i->second, false );
+
+        return out.good();
+    }
+
+    bool
+    PackedFileSystemCacheBin::appendIndexRecord(std::ostream& out, const std::string& key, const IndexEntry& entry, bool removed)
+    {
+        writePOD( out, (unsigned)key.size() );
+        out.write( key.data(), key.size() );
+        writePOD( out, entry._offset );
+        writePOD( out, removed ? INDEX_TOMBSTONE : entry._dataSize );
+        writePOD( out, entry._metaSize );
+        writePOD( out, (long long)entry._time );
+        return out.good();
+    }
+
+    bool
+    PackedFileSystemCacheBin::appendPackRecord(std::ostream& out, PackOffset& packSize, const std::string& key, const char* payload, IndexEntry& entry)
+    {
+        // pad in front of the record so that its payload lands on an
+        // aligned offset; rebuildIndex() knows to skip the padding.
+        PackOffset start = packSize + PACK_RECORD_HEADER_SIZE + key.size();
+        unsigned   pad   = (unsigned)((PACK_ALIGNMENT - start % PACK_ALIGNMENT) % PACK_ALIGNMENT);
+        for( unsigned i = 0; i < pad; ++i )
+            out.put( '\0' );
+
+        writePOD( out, PACK_RECORD_MAGIC );
+        writePOD( out, (unsigned)key.size() );
+        writePOD( out, entry._dataSize );
+        writePOD( out, entry._metaSize );
+        out.write( key.data(), key.size() );
+        out.write( payload, (std::streamsize)entry._dataSize + entry._metaSize );
+
+        entry._offset = start + pad;
+        packSize      = entry._offset + entry._dataSize + entry._metaSize;
+        return out.good();
+    }
+
+    PackMapping*
+    PackedFileSystemCacheBin::getMapping(PackOffset requiredSize)
+    {
+        ScopedMutexLock lock( _mappingMutex );
+
+        // the pack only grows between compactions, so remap only when a
+        // record lies past the end of the current mapping.
+        if ( !_mapping.valid() || _mapping->size() < requiredSize )
+        {
+            osg::ref_ptr<PackMapping> mapping = new PackMapping( _packPath );
+            _mapping = mapping->valid() ? mapping.get() : 0L;
+        }
+        return _mapping.get();
+    }
+
+    void
+    PackedFileSystemCacheBin::releaseMapping()
+    {
+        ScopedMutexLock lock( _mappingMutex );
+        _mapping = 0L;
+    }
+
+    ReadResult
+    PackedFileSystemCacheBin::read(const std::string& key, ObjectType type)
+    {
+        if ( !indexValidForReading() )
+            return ReadResult(ReadResult::RESULT_NOT_FOUND);
+
+        ScopedReadLock sharedLock( _rwmutex );
+
+        Index::const_iterator i = _index.find( key );
+        if ( i == _index.end() )
+            return ReadResult(ReadResult::RESULT_NOT_FOUND);
+
+        const IndexEntry& entry = i->second;
+        PackOffset end = entry._offset + entry._dataSize + entry._metaSize;
+
+        // hold a reference to the mapping for the duration of the read.
+        osg::ref_ptr<PackMapping> mapping = getMapping( end );
+
+        char*       data = 0L;
+        std::string buffer;
+
+        if ( mapping.valid() && mapping->size() >= end )
+        {
+            data = mapping->data() + entry._offset;
+        }
+        else
+        {
+            // no mapping available (e.g. the pack exceeds the address space);
+            // fall back on a regular file read.
+            std::ifstream pack( _packPath.c_str(), std::ios_base::in | std::ios_base::binary );
+            if ( !pack.is_open() )
+                return ReadResult();
+
+            buffer.resize( entry._dataSize + entry._metaSize );
+            pack.seekg( (std::streamoff)entry._offset, std::ios_base::beg );
+            pack.read( &buffer[0], buffer.size() );
+            if ( (std::size_t)pack.gcount() != buffer.size() )
+                return ReadResult();
+
+            data = &buffer[0];
+            mapping = 0L;
+        }
+
+        Config meta;
+        if ( entry._metaSize > 0 )
+            meta.fromJSON( std::string(data + entry._dataSize, entry._metaSize) );
+
+        // raw images come straight out of the mapping with no copy at all.
+        if ( type != TYPE_NODE && isRawImage(data, entry._dataSize) )
+        {
+            osg::ref_ptr<osg::Image> image = decodeRawImage( data, entry._dataSize, mapping.get() );
+            if ( !image.valid() )
+                return ReadResult();
+
+            ReadResult rr( image.get(), meta );
+            rr.setLastModifiedTime( entry._time );
+            return rr;
+        }
+
+        MemoryStreamBuf streamBuf( data, entry._dataSize );
+        std::istream in( &streamBuf );
+
+        osgDB::ReaderWriter::ReadResult r =
+            type == TYPE_IMAGE ? _rw->readImage ( in, _rwOptions.get() ) :
+            type == TYPE_NODE  ? _rw->readNode  ( in, _rwOptions.get() ) :
+                                 _rw->readObject( in, _rwOptions.get() );
+
+        if ( !r.success() )
+            return ReadResult();
+
+        ReadResult rr(
+            type == TYPE_IMAGE ? (osg::Object*)r.getImage() :
+            type == TYPE_NODE  ? (osg::Object*)r.getNode()  :
+                                 r.getObject(),
+            meta );
+
+        rr.setLastModifiedTime( entry._time );
+        return rr;
+    }
+
+    ReadResult
+    PackedFileSystemCacheBin::readImage(const std::string& key)
+    {
+        return read( key, TYPE_IMAGE );
+    }
+
+    ReadResult
+    PackedFileSystemCacheBin::readObject(const std::string& key)
+    {
+        return read( key, TYPE_OBJECT );
+    }
+
+    ReadResult
+    PackedFileSystemCacheBin::readNode(const std::string& key)
+    {
+        return read( key, TYPE_NODE );
+    }
+
+    bool
+    PackedFileSystemCacheBin::write( const std::string& key, const osg::Object* object, const Config& meta )
+    {
+        if ( !indexValidForWriting() || !object )
+            return false;
+
+        // serialize (and compress) outside the lock so that concurrent
+        // writers only contend on the append itself.
+        std::string data;
+        const osg::Image* image = dynamic_cast<const osg::Image*>(object);
+
+        if ( !(_rawImages && encodeRawImage(image, data)) )
+        {
+            std::stringstream buf;
+            osgDB::ReaderWriter::WriteResult r;
+
+            if ( image )
+                r = _rw->writeImage( *image, buf, _rwOptions.get() );
+            else if ( dynamic_cast<const osg::Node*>(object) )
+                r = _rw->writeNode( *static_cast<const osg::Node*>(object), buf, _rwOptions.get() );
+            else
+                r = _rw->writeObject( *object, buf );
+
+            if ( !r.success() )
+            {
+                OE_WARN << LC << "FAILED to write \"" << key << "\" to cache bin " << getID()
+                    << "; msg = \"" << r.message() << "\"" << std::endl;
+                return false;
+            }
+
+            data = buf.str();
+        }
+
+        IndexEntry entry;
+        entry._dataSize = data.size();
+
+        // the metadata follows the data in the same payload.
+        if ( !meta.empty() )
+            data.append( meta.toJSON() );
+        entry._metaSize = data.size() - entry._dataSize;
+
+        {
+            // prevent cache contention:
+            ScopedWriteLock exclusiveLock( _rwmutex );
+
+            std::ofstream pack( _packPath.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::app );
+            std::ofstream index( _indexPath.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::app );
+            if ( !pack.is_open() || !index.is_open() )
+            {
+                OE_WARN << LC << "FAILED to open pack for cache bin " << getID() << std::endl;
+                return false;
+            }
+
+            entry._time = DateTime().asTimeStamp();
+
+            PackOffset packSize = _packSize;
+            appendPackRecord( pack, packSize, key, data.data(), entry );
+            pack.flush();
+
+            if ( !pack.good() )
+            {
+                // resync the pack size; the partial record is dead space.
+                pack.close();
+                loadIndex();
+                OE_WARN << LC << "FAILED to append \"" << key << "\" to cache bin " << getID() << std::endl;
+                return false;
+            }
+
+            _packSize = packSize;
+
+            // the data is safely in the pack before the index refers to it.
+            appendIndexRecord( index, key, entry, false );
+            _index[key] = entry;
+        }
+
+        OE_DEBUG << LC << "Wrote \"" << key << "\" to cache bin " << getID() << std::endl;
+        return true;
+    }
+
+    CacheBin::RecordStatus
+    PackedFileSystemCacheBin::getRecordStatus(const std::string& key)
+    {
+        if ( !indexValidForReading() )
+            return STATUS_NOT_FOUND;
+
+        ScopedReadLock sharedLock( _rwmutex );
+        return _index.find(key) != _index.end() ? STATUS_OK : STATUS_NOT_FOUND;
+    }
+
+    bool
+    PackedFileSystemCacheBin::remove(const std::string& key)
+    {
+        if ( !indexValidForReading() )
+            return false;
+
+        ScopedWriteLock exclusiveLock( _rwmutex );
+
+        Index::iterator i = _index.find( key );
+        if ( i == _index.end() )
+            return false;
+
+        std::ofstream index( _indexPath.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::app );
+        if ( !index.is_open() || !appendIndexRecord(index, key, i->second, true) )
+            return false;
+
+        _index.erase( i );
+        return true;
+    }
+
+    bool
+    PackedFileSystemCacheBin::touch(const std::string& key)
+    {
+        if ( !indexValidForReading() )
+            return false;
+
+        ScopedWriteLock exclusiveLock( _rwmutex );
+
+        Index::iterator i = _index.find( key );
+        if ( i == _index.end() )
+            return false;
+
+        IndexEntry entry = i->second;
+        entry._time = DateTime().asTimeStamp();
+
+        std::ofstream index( _indexPath.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::app );
+        if ( !index.is_open() || !appendIndexRecord(index, key, entry, false) )
+            return false;
+
+        i->second = entry;
+        return true;
+    }
+
+    bool
+    PackedFileSystemCacheBin::clear()
+    {
+        if ( !binValidForReading() )
+            return false;
+
+        releaseMapping();
+
+        // purges the pack and index along with everything else in the bin folder.
+        bool ok = FileSystemCacheBin::clear();
+
+        ScopedWriteLock exclusiveLock( _rwmutex );
+        _index.clear();
+        _packSize = 0;
+        _indexLoaded = true;
+        return ok;
+    }
+
+    bool
+    PackedFileSystemCacheBin::compact()
+    {
+        if ( !indexValidForWriting() )
+            return false;
+
+        ScopedWriteLock exclusiveLock( _rwmutex );
+
+        std::string packTemp  = _packPath + ".tmp";
+        std::string indexTemp = _indexPath + ".tmp";
+
+        Index      newIndex;
+        PackOffset newSize = 0;
+        {
+            std::ifstream in( _packPath.c_str(), std::ios_base::in | std::ios_base::binary );
+            std::ofstream pack( packTemp.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
+            std::ofstream index( indexTemp.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
+            if ( !pack.is_open() || !index.is_open() || (!in.is_open() && !_index.empty()) )
+                return false;
+
+            // copy only the live records into a fresh pack.
+            std::vector<char> record;
+            for( Index::const_iterator i = _index.begin(); i != _index.end(); ++i )
+            {
+                const std::string& key   = i->first;
+                const IndexEntry&  entry = i->second;
+
+                record.resize( entry._dataSize + entry._metaSize );
+                in.seekg( (std::streamoff)entry._offset, std::ios_base::beg );
+                if ( !record.empty() )
+                {
+                    in.read( &record[0], record.size() );
+                    if ( (std::size_t)in.gcount() != record.size() )
+                        return false;
+                }
+
+                IndexEntry newEntry = entry;
+                appendPackRecord( pack, newSize, key, record.empty() ? "" : &record[0], newEntry );
+                appendIndexRecord( index, key, newEntry, false );
+
+                newIndex[key] = newEntry;
+            }
+
+            if ( !pack.good() || !index.good() )
+            {
+                pack.close();
+                index.close();
+                ::remove( packTemp.c_str() );
+                ::remove( indexTemp.c_str() );
+                return false;
+            }
+        }
+
+        // no reader can hold the mapping while we have the exclusive lock.
+        releaseMapping();
+
+#ifdef _WIN32
+        // rename() won't replace an existing file on Windows.
+        ::remove( _packPath.c_str() );
+        ::remove( _indexPath.c_str() );
+#endif
+
+        if ( ::rename(packTemp.c_str(), _packPath.c_str()) != 0 ||
+             ::rename(indexTemp.c_str(), _indexPath.c_str()) != 0 )
+        {
+            OE_WARN << LC << "FAILED to replace pack for cache bin " << getID() << std::endl;
+            loadIndex();
+            return false;
+        }
+
+        OE_INFO << LC << "Compacted cache bin " << getID() << " from "
+            << _packSize << " to " << newSize << " bytes" << std::endl;
+
+        _index.swap( newIndex );
+        _packSize = newSize;
+        return true;
+    }
+
+    unsigned
+    PackedFileSystemCacheBin::getStorageSize()
+    {
+        if ( !indexValidForReading() )
+            return 0u;
+
+        ScopedReadLock sharedLock( _rwmutex );
+        return (unsigned)_packSize;
+    }
 }
 
 //------------------------------------------------------------------------
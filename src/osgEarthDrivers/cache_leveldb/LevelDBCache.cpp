@@ -24,6 +24,8 @@
 #include <osgDB/ReaderWriter>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
+#include <leveldb/cache.h>
+#include <leveldb/filter_policy.h>
 
 #include <sys/stat.h>
 #ifndef _WIN32
@@ -43,7 +45,11 @@ using namespace osgEarth::Drivers::LevelDBCache;
 LevelDBCacheImpl::LevelDBCacheImpl( const CacheOptions& options ) :
 osgEarth::Cache( options ),
 _options       ( options ),
-_active        ( true )
+_active        ( true ),
+_db            ( 0L ),
+_filterPolicy  ( 0L ),
+_blockCache    ( 0L ),
+_maintenance   ( 0L )
 {
     if ( _options.rootPath().isSet() )
     {
@@ -96,6 +102,18 @@ _active        ( true )
 
 LevelDBCacheImpl::~LevelDBCacheImpl()
 {
+    if ( _maintenance )
+    {
+        _tracker->setMaintenanceActive( false );
+        _tracker->requestShutdown();
+        _maintenance->join();
+        delete _maintenance;
+        _maintenance = 0L;
+    }
+
+    // Note: the filter policy and block cache must outlive the DB, which
+    // is not deleted (see below), so they are not deleted either.
+
     if ( _db )
     {
         // problem. This destructor causes a lockup sometimes. Perhaps try
@@ -128,18 +146,87 @@ LevelDBCacheImpl::init()
         _tracker->calcSize();
     }
 
+    // Start the thread that purges and compacts in the background.
+    if ( _db && _options.backgroundMaintenance() == true )
+    {
+        _maintenance = new MaintenanceThread( this );
+        _tracker->setMaintenanceActive( true );
+        _maintenance->start();
+    }
+
     if ( _active )
     {
         OE_INFO << LC << "Opened DB at " << _rootPath << std::endl;
     }
 }
 
+void
+LevelDBCacheImpl::MaintenanceThread::run()
+{
+    Tracker* tracker = _cache->_tracker.get();
+    bool purge, compact;
+
+    while( tracker->waitForRequest(purge, compact) )
+    {
+        if ( purge && tracker->isOverLimit() )
+        {
+            // purging deletes the oldest records of every bin, so any bin will do.
+            LevelDBCacheBin* bin = static_cast<LevelDBCacheBin*>( _cache->getOrCreateDefaultBin() );
+            if ( bin )
+            {
+                bin->purgeOldest( tracker->numToPurge(), _cache->_options.maxPurgeRate().value() );
+                tracker->calcSize();
+            }
+        }
+
+        if ( compact )
+        {
+            _cache->compactInSlices();
+        }
+    }
+}
+
+void
+LevelDBCacheImpl::compactInSlices()
+{
+    // Every key starts with a one-letter record type (see LevelDBCacheBin),
+    // so compacting each type as its own range bounds how long any one
+    // compaction holds up the reads.
+    const char* prefixes[] = { "b", "d", "m", "t" };
+    for( unsigned i=0; i<4; ++i )
+    {
+        std::string begin = std::string(prefixes[i]);
+        std::string end   = begin + "\xff";
+        leveldb::Slice b(begin), e(end);
+        _db->CompactRange( &b, &e );
+    }
+    OE_INFO << LC << "Compaction complete" << std::endl;
+}
+
 void
 LevelDBCacheImpl::open()
 {
     leveldb::Options options;
     options.create_if_missing = true;
     options.block_size        = _options.blockSize().value();
+    options.compression       = _options.compression() == true ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+
+    if ( _options.writeBufferSizeMB().isSet() )
+    {
+        options.write_buffer_size = (size_t)_options.writeBufferSizeMB().value() * 1048576;
+    }
+
+    if ( _options.blockCacheSizeMB().isSet() )
+    {
+        _blockCache = leveldb::NewLRUCache( (size_t)_options.blockCacheSizeMB().value() * 1048576 );
+        options.block_cache = _blockCache;
+    }
+
+    if ( _options.bloomFilterBits().value() > 0 )
+    {
+        _filterPolicy = leveldb::NewBloomFilterPolicy( (int)_options.bloomFilterBits().value() );
+        options.filter_policy = _filterPolicy;
+    }
 
     leveldb::Status status;
         
@@ -206,7 +293,10 @@ LevelDBCacheImpl::compact()
     if ( !_db )
         return false;
 
-    _db->CompactRange(0L, 0L);
+    if ( _tracker->isMaintenanceActive() )
+        _tracker->requestCompact();
+    else
+        _db->CompactRange(0L, 0L);
 
     return true;
 }
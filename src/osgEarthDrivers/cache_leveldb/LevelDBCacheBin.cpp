@@ -21,6 +21,8 @@
 #include <osgEarth/Registry>
 #include <osgEarth/Random>
 #include <osgDB/Registry>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
 #include <leveldb/write_batch.h>
 #include <string>
 
@@ -240,7 +242,7 @@ LevelDBCacheBin::readNode(const std::string& key)
 }
 
 ReadResult
-LevelDBCacheBin::read(const std::string& key, const Reader& reader)
+LevelDBCacheBin::read(const std::string& key, const Reader& reader, const leveldb::ReadOptions& ro)
 {
     if ( !binValidForReading() ) 
         return ReadResult(ReadResult::RESULT_NOT_FOUND);
@@ -249,7 +251,6 @@ LevelDBCacheBin::read(const std::string& key, const Reader& reader)
 
     Config metadata;
     leveldb::Status status;
-    leveldb::ReadOptions ro;
 
     // first read the metadata record.
     std::string metavalue;
@@ -327,11 +328,8 @@ LevelDBCacheBin::readString(const std::string& key)
 }
 
 bool
-LevelDBCacheBin::write(const std::string& key, const osg::Object* object, const Config& meta)
+LevelDBCacheBin::encode(const std::string& key, const osg::Object* object, const Config& meta, const DateTime& now, leveldb::WriteBatch& batch)
 {
-    if ( !binValidForWriting() || !object ) 
-        return false;
-        
     osgDB::ReaderWriter::WriteResult r;
     bool objWriteOK = false;
 
@@ -369,50 +367,131 @@ LevelDBCacheBin::write(const std::string& key, const osg::Object* object, const
         objWriteOK = r.success();
     }
 
-    if (objWriteOK)
+    if ( !objWriteOK )
     {
-        DateTime now;
-        leveldb::WriteBatch batch;
+        OE_WARN << LC << "Bin " << getID() << ": FAILED to write (" << key << "); msg = \"" 
+            << r.message() << "\"\n";
+        return false;
+    }
 
-        // write the data:
-        data = datastream.str();
-        if ( _tracker->seed().isSet() )
-            blend(data, _tracker->seed().value());
-        batch.Put( dataKey(key), data );
+    // write the data:
+    data = datastream.str();
+    if ( _tracker->seed().isSet() )
+        blend(data, _tracker->seed().value());
+    batch.Put( dataKey(key), data );
 
-        // write the timestamp index:
-        batch.Put( timeKey(now, key), binDataKeyTuple(key) );
+    // write the timestamp index:
+    batch.Put( timeKey(now, key), binDataKeyTuple(key) );
 
-        // write the metadata:
-        Config metadata(meta);
-        metadata.set( TIME_FIELD, now.asCompactISO8601() );
-        encodeMeta( metadata, data );
-        batch.Put( metaKey(key), data );
+    // write the metadata:
+    Config metadata(meta);
+    metadata.set( TIME_FIELD, now.asCompactISO8601() );
+    encodeMeta( metadata, data );
+    batch.Put( metaKey(key), data );
 
-        objWriteOK = _db->Write( leveldb::WriteOptions(), &batch ).ok();
+    return true;
+}
+
+bool
+LevelDBCacheBin::write(const std::string& key, const osg::Object* object, const Config& meta)
+{
+    if ( !binValidForWriting() || !object ) 
+        return false;
+
+    DateTime now;
+    leveldb::WriteBatch batch;
 
-        if ( objWriteOK )
+    if ( !encode(key, object, meta, now, batch) )
+        return false;
+
+    bool objWriteOK = _db->Write( leveldb::WriteOptions(), &batch ).ok();
+
+    if ( objWriteOK )
+    {
+        ++_tracker->writes;
+        postWrite();
+
+        if ( _debug )
         {
-            ++_tracker->writes;
-            postWrite();
-            
-            if ( _debug )
-            {
-                OE_NOTICE << LC << "Bin " << getID() << ": wrote (" << key << ")\n";
-            }
+            OE_NOTICE << LC << "Bin " << getID() << ": wrote (" << key << ")\n";
         }
     }
-
-        
-    if ( !objWriteOK )
+    else
     {
-        OE_WARN << LC << "Bin " << getID() << ": FAILED to write (" << key << "); msg = \"" 
-            << r.message() << "\"\n";
+        OE_WARN << LC << "Bin " << getID() << ": FAILED to write (" << key << ")\n";
     }
 
     return objWriteOK;
 }
 
+void
+LevelDBCacheBin::readMany(const std::vector<std::string>& keys, std::vector<ReadResult>& output)
+{
+    if ( !binValidForReading() )
+    {
+        output.resize( output.size() + keys.size(), ReadResult(ReadResult::RESULT_NOT_FOUND) );
+        return;
+    }
+
+    // read every key from a single snapshot so the batch sees a consistent view.
+    leveldb::ReadOptions ro;
+    ro.snapshot = _db->GetSnapshot();
+
+    ObjectReader reader( _rw.get(), _rwOptions.get() );
+
+    output.reserve( output.size() + keys.size() );
+    for( std::vector<std::string>::const_iterator i = keys.begin(); i != keys.end(); ++i )
+    {
+        output.push_back( read(*i, reader, ro) );
+    }
+
+    _db->ReleaseSnapshot( ro.snapshot );
+}
+
+bool
+LevelDBCacheBin::writeBatch(const RecordVector& records)
+{
+    if ( !binValidForWriting() ) 
+        return false;
+
+    // serialize everything into one WriteBatch so the whole set commits
+    // in a single log write.
+    DateTime            now;
+    leveldb::WriteBatch batch;
+    unsigned            count = 0;
+    bool                ok    = true;
+
+    for( RecordVector::const_iterator i = records.begin(); i != records.end(); ++i )
+    {
+        if ( i->_object.valid() && encode(i->_key, i->_object.get(), i->_meta, now, batch) )
+            ++count;
+        else
+            ok = false;
+    }
+
+    if ( count == 0 )
+        return ok;
+
+    if ( !_db->Write(leveldb::WriteOptions(), &batch).ok() )
+    {
+        OE_WARN << LC << "Bin " << getID() << ": FAILED to write batch of " << count << " records\n";
+        return false;
+    }
+
+    for( unsigned i = 0; i < count; ++i )
+    {
+        ++_tracker->writes;
+        postWrite();
+    }
+
+    if ( _debug )
+    {
+        OE_NOTICE << LC << "Bin " << getID() << ": wrote batch of " << count << " records\n";
+    }
+
+    return ok;
+}
+
 void
 LevelDBCacheBin::postWrite()
 {
@@ -420,7 +499,11 @@ LevelDBCacheBin::postWrite()
     {
         if ( _tracker->isOverLimit() )
         {
-            if ( _tracker->isTimeToPurge() )
+            if ( _tracker->isTimeToPurge() && _tracker->isMaintenanceActive() )
+            {
+                _tracker->requestPurge();
+            }
+            else if ( _tracker->isTimeToPurge() )
             {
                 this->purgeOldest(_tracker->numToPurge());
 
@@ -580,6 +663,13 @@ LevelDBCacheBin::compact()
     if ( !binValidForWriting() )
         return false;
 
+    // Hand it to the maintenance thread if there is one.
+    if ( _tracker->isMaintenanceActive() )
+    {
+        _tracker->requestCompact();
+        return true;
+    }
+
     // This could take a while.
     _db->CompactRange(0L, 0L);
 
@@ -648,12 +738,13 @@ LevelDBCacheBin::writeMetadata(const Config& conf)
 }
 
 bool
-LevelDBCacheBin::purgeOldest(unsigned maxnum)
+LevelDBCacheBin::purgeOldest(unsigned maxnum, unsigned maxPerSecond)
 {
     if ( !binValidForWriting() )
         return false;
 
     leveldb::Iterator* it = _db->NewIterator(leveldb::ReadOptions());
+    osg::Timer_t start = osg::Timer::instance()->tick();
 
     unsigned count = 0;
     std::string limit = timeEndGlobal();
@@ -674,6 +765,14 @@ LevelDBCacheBin::purgeOldest(unsigned maxnum)
         _db->Delete( wo, dataKeyFromTuple(tuple) );
         _db->Delete( wo, metaKeyFromTuple(tuple) );
         _db->Delete( wo, it->key() );
+
+        // rate limit: if we're ahead of schedule, wait for it to catch up.
+        if ( maxPerSecond > 0 && (count+1) % 100 == 0 )
+        {
+            double ahead = (double)(count+1)/(double)maxPerSecond - osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+            if ( ahead > 0.0 )
+                OpenThreads::Thread::microSleep( (unsigned)(ahead * 1.0e6) );
+        }
     }
 
     delete it;
@@ -0,0 +1,268 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "Sqlite3CacheBin"
+#include <osgEarth/Registry>
+#include <osgEarth/ImageUtils>
+#include <osgEarth/StringUtils>
+#include <osgDB/Registry>
+#include <sstream>
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers::Sqlite3Cache;
+
+#define LC "[Sqlite3CacheBin] "
+
+namespace
+{
+    void encodeMeta(const Config& meta, std::string& out)
+    {
+        out = Stringify() << meta.toJSON(false);
+    }
+
+    void decodeMeta(const std::string& in, Config& meta)
+    {
+        if ( !in.empty() )
+            meta.fromJSON( in );
+    }
+}
+
+Sqlite3CacheBin::Sqlite3CacheBin(const std::string&  binID,
+                                 Sqlite3CacheImpl*   cache) :
+osgEarth::CacheBin( binID ),
+_cache            ( cache ),
+_debug            ( false )
+{
+    // reader to parse data:
+    _rw = osgDB::Registry::instance()->getReaderWriterForExtension( "osgb" );
+    _rwOptions = osgEarth::Registry::instance()->cloneOrCreateOptions();    
+    
+    if ( ::getenv("OSGEARTH_CACHE_DEBUG") )
+        _debug = true;
+}
+
+Sqlite3CacheBin::~Sqlite3CacheBin()
+{
+    // nop
+}
+
+ReadResult
+Sqlite3CacheBin::readImage(const std::string& key)
+{
+    return read(key, ImageReader(_rw.get(), _rwOptions.get()));    
+}
+
+ReadResult
+Sqlite3CacheBin::readObject(const std::string& key)
+{
+    return read(key, ObjectReader(_rw.get(), _rwOptions.get()));
+}
+
+ReadResult
+Sqlite3CacheBin::read(const std::string& key, const Reader& reader)
+{
+    std::string data, metavalue;
+    TimeStamp   lastModified = 0;
+
+    if ( !_cache->read(getID(), key, data, metavalue, lastModified) )
+        return ReadResult(ReadResult::RESULT_NOT_FOUND);
+
+    // decode the OSGB stream into an object.
+    std::istringstream datastream(data);
+    osgDB::ReaderWriter::ReadResult r = reader.read(datastream);
+    if ( !r.success() )
+    {
+        OE_WARN << LC << "Cache read failure for (" << key << "): " << r.message() << std::endl;
+        return ReadResult(ReadResult::RESULT_READER_ERROR);
+    }
+
+    if ( _debug )
+    {
+        OE_NOTICE << LC << "Bin " << getID() << ": read (" << key << ")\n";
+    }
+
+    // with a size limit, the record's age decides when it's purged.
+    if ( _cache->options().maxSize().value() > 0 )
+    {
+        _cache->touch( getID(), key );
+    }
+
+    Config metadata;
+    decodeMeta( metavalue, metadata );
+
+    ReadResult rr(r.getObject(), metadata);
+    rr.setLastModifiedTime(lastModified);
+    return rr;
+}
+
+ReadResult
+Sqlite3CacheBin::readString(const std::string& key)
+{
+    ReadResult r = readObject(key);
+    if ( r.succeeded() )
+    {
+        if ( r.get<StringObject>() )
+            return r;
+        else
+            return ReadResult();
+    }
+    else
+    {
+        return r;
+    }
+}
+
+void
+Sqlite3CacheBin::readMany(const std::vector<std::string>& keys, std::vector<ReadResult>& output)
+{
+    ObjectReader reader( _rw.get(), _rwOptions.get() );
+
+    output.reserve( output.size() + keys.size() );
+    for( std::vector<std::string>::const_iterator i = keys.begin(); i != keys.end(); ++i )
+    {
+        output.push_back( read(*i, reader) );
+    }
+}
+
+bool
+Sqlite3CacheBin::encode(const std::string& key, const osg::Object* object, std::string& data)
+{
+    osgDB::ReaderWriter::WriteResult r;
+    std::stringstream datastream;
+
+    const osg::Image* image = dynamic_cast<const osg::Image*>(object);
+    if ( image )
+    {
+        if ( _cache->options().skipEmptyTiles() == true && ImageUtils::isEmptyImage(image) )
+        {
+            if ( _debug )
+            {
+                OE_NOTICE << LC << "Bin " << getID() << ": skipped empty (" << key << ")\n";
+            }
+            return false;
+        }
+        r = _rw->writeImage( *image, datastream, _rwOptions.get() );
+    }
+    else if ( dynamic_cast<const osg::Node*>(object) )
+    {
+        r = _rw->writeNode( *static_cast<const osg::Node*>(object), datastream, _rwOptions.get() );
+    }
+    else
+    {
+        r = _rw->writeObject( *object, datastream );
+    }
+
+    if ( !r.success() )
+    {
+        OE_WARN << LC << "Bin " << getID() << ": FAILED to write (" << key << "); msg = \"" 
+            << r.message() << "\"\n";
+        return false;
+    }
+
+    data = datastream.str();
+    return true;
+}
+
+bool
+Sqlite3CacheBin::write(const std::string& key, const osg::Object* object, const Config& meta)
+{
+    if ( !object ) 
+        return false;
+
+    std::string data;
+    if ( !encode(key, object, data) )
+    {
+        // a skipped empty tile isn't a failure.
+        return _cache->options().skipEmptyTiles() == true && dynamic_cast<const osg::Image*>(object) != 0L;
+    }
+
+    std::string metavalue;
+    encodeMeta( meta, metavalue );
+
+    bool ok = _cache->write( getID(), key, data, metavalue );
+
+    if ( ok && _debug )
+    {
+        OE_NOTICE << LC << "Bin " << getID() << ": wrote (" << key << ")\n";
+    }
+
+    return ok;
+}
+
+bool
+Sqlite3CacheBin::writeBatch(const RecordVector& records)
+{
+    // every write joins the cache's queue, which commits in batches anyway.
+    bool ok = true;
+    for( RecordVector::const_iterator i = records.begin(); i != records.end(); ++i )
+    {
+        if ( !i->_object.valid() || !write(i->_key, i->_object.get(), i->_meta) )
+            ok = false;
+    }
+    return ok;
+}
+
+CacheBin::RecordStatus
+Sqlite3CacheBin::getRecordStatus(const std::string& key)
+{
+    return _cache->exists(getID(), key) ? STATUS_OK : STATUS_NOT_FOUND;
+}
+
+bool
+Sqlite3CacheBin::remove(const std::string& key)
+{
+    return _cache->remove(getID(), key);
+}
+
+bool
+Sqlite3CacheBin::touch(const std::string& key)
+{
+    return _cache->touch(getID(), key);
+}
+
+bool
+Sqlite3CacheBin::clear()
+{
+    return _cache->clearBin(getID());
+}
+
+bool
+Sqlite3CacheBin::compact()
+{
+    return _cache->compact();
+}
+
+Config
+Sqlite3CacheBin::readMetadata()
+{
+    std::string metavalue;
+    if ( !_cache->readBinMetadata(getID(), metavalue) )
+        return Config();
+
+    Config binMetadata;
+    decodeMeta( metavalue, binMetadata );
+    return binMetadata;
+}
+
+bool
+Sqlite3CacheBin::writeMetadata(const Config& conf)
+{
+    std::string metavalue;
+    encodeMeta( conf, metavalue );
+    return _cache->writeBinMetadata(getID(), metavalue);
+}
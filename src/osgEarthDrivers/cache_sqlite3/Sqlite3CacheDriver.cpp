@@ -0,0 +1,53 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "Sqlite3Cache"
+#include <osgEarth/Cache>
+#include <osgDB/Registry>
+#include <osgDB/FileNameUtils>
+
+namespace osgEarth { namespace Drivers { namespace Sqlite3Cache
+{
+    /**
+     * Plugin that creates a Sqlite3CacheImpl from the cache options.
+     */
+    class Sqlite3CacheDriver : public osgEarth::CacheDriver
+    {
+    public:
+        Sqlite3CacheDriver()
+        {
+            supportsExtension( "osgearth_cache_sqlite3", "sqlite3 cache for osgEarth" );
+        }
+
+        virtual const char* className()
+        {
+            return "sqlite3 cache for osgEarth";
+        }
+
+        virtual ReadResult readObject(const std::string& file_name, const Options* options) const
+        {
+            if ( !acceptsExtension(osgDB::getLowerCaseFileExtension( file_name )))
+                return ReadResult::FILE_NOT_HANDLED;
+
+            return ReadResult( new Sqlite3CacheImpl( getCacheOptions(options) ) );
+        }
+    };
+
+    REGISTER_OSGPLUGIN(osgearth_cache_sqlite3, Sqlite3CacheDriver);
+
+} } } // namespace osgEarth::Drivers::Sqlite3Cache
@@ -62,6 +62,7 @@ EarthFileSerializer1::deserialize( const Config& conf, const std::string& refere
         }
         else if (
             child.key() == "proxy" ||
+            child.key() == "http" ||
             child.key() == "cache_only" )
         {
             mapNodeOptionsConf.add( child );
@@ -0,0 +1,86 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "CameraPredictor"
+#include <osgUtil/CullVisitor>
+
+using namespace osgEarth::Drivers::MPTerrainEngine;
+using namespace osgEarth;
+
+#define LC "[CameraPredictor] "
+
+// frames without a cull after which a camera's motion history is stale
+#define MAX_FRAME_GAP 10u
+
+//----------------------------------------------------------------------------
+
+CameraPredictor::CameraPredictor() :
+_lookAhead( 0 )
+{
+    //nop
+}
+
+void
+CameraPredictor::update(osgUtil::CullVisitor* cv)
+{
+    if ( !isEnabled() || !cv || !cv->getCurrentCamera() || !cv->getFrameStamp() )
+        return;
+
+    unsigned   frame = cv->getFrameStamp()->getFrameNumber();
+    osg::Vec3d eye   = cv->getViewPointLocal();
+
+    Threading::ScopedMutexLock lock( _mutex );
+
+    Motion& m = _motion[cv->getCurrentCamera()];
+
+    // several culls in one frame (e.g. RTT passes) see the same eye.
+    if ( m._hasEye && m._frame == frame )
+        return;
+
+    if ( m._hasEye && frame > m._frame && frame - m._frame <= MAX_FRAME_GAP )
+    {
+        osg::Vec3d v = (eye - m._eye) / (double)(frame - m._frame);
+        m._velocity = m._velocity*0.5 + v*0.5;
+    }
+    else
+    {
+        m._velocity.set( 0.0, 0.0, 0.0 );
+    }
+
+    m._eye    = eye;
+    m._frame  = frame;
+    m._hasEye = true;
+    m._offset = m._velocity * (double)_lookAhead;
+
+    // ignore drift; a prediction under a meter won't change any LOD decision.
+    m._moving = m._offset.length2() > 1.0;
+}
+
+bool
+CameraPredictor::getPredictedOffset(const osg::Camera* camera,
+                                    osg::Vec3d&        out_offset) const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+
+    MotionMap::const_iterator i = _motion.find( camera );
+    if ( i == _motion.end() || !i->second._moving )
+        return false;
+
+    out_offset = i->second._offset;
+    return true;
+}
@@ -0,0 +1,314 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "GeometryPool"
+#include "MPGeometry"
+
+using namespace osgEarth::Drivers::MPTerrainEngine;
+using namespace osgEarth;
+
+#define LC "[GeometryPool] "
+
+// maximum number of idle arrays to keep per type and size.
+#define MAX_ARRAYS_PER_BUCKET 64
+
+
+GeometryPool::GeometryPool() :
+_numReused   ( 0 ),
+_numAllocated( 0 )
+{
+    //nop
+}
+
+template<typename T>
+T*
+GeometryPool::create(Buckets<T>& buckets, unsigned size)
+{
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+
+        // registering the size here lets recycle() know which arrays to accept.
+        std::vector< osg::ref_ptr<T> >& bucket = buckets[size];
+        if ( !bucket.empty() )
+        {
+            osg::ref_ptr<T> result = bucket.back();
+            bucket.pop_back();
+            ++_numReused;
+            return result.release();
+        }
+    }
+
+    ++_numAllocated;
+    T* result = new T();
+    result->reserve( size );
+    return result;
+}
+
+template<typename T>
+bool
+GeometryPool::recycle(Buckets<T>& buckets, osg::Array* array)
+{
+    T* typed = dynamic_cast<T*>( array );
+    if ( !typed )
+        return false;
+
+    Threading::ScopedMutexLock lock( _mutex );
+
+    typename Buckets<T>::iterator i = buckets.find( typed->capacity() );
+    if ( i != buckets.end() && i->second.size() < MAX_ARRAYS_PER_BUCKET )
+    {
+        // detach from the old tile's VBO; the next geometry will assign its own.
+        typed->clear();
+        typed->setVertexBufferObject( 0L );
+        typed->dirty();
+        i->second.push_back( typed );
+    }
+    return true;
+}
+
+osg::Vec2Array*
+GeometryPool::createVec2Array(unsigned size)
+{
+    return create( _vec2Arrays, size );
+}
+
+osg::Vec3Array*
+GeometryPool::createVec3Array(unsigned size)
+{
+    return create( _vec3Arrays, size );
+}
+
+osg::Vec4Array*
+GeometryPool::createVec4Array(unsigned size)
+{
+    return create( _vec4Arrays, size );
+}
+
+osg::FloatArray*
+GeometryPool::createFloatArray(unsigned size)
+{
+    return create( _floatArrays, size );
+}
+
+void
+GeometryPool::recycle(osg::Array* array)
+{
+    // only take arrays that nothing but the caller's owner is still using.
+    if ( !array || array->referenceCount() != 1 )
+        return;
+
+    recycle( _vec3Arrays,  array ) ||
+    recycle( _vec4Arrays,  array ) ||
+    recycle( _vec2Arrays,  array ) ||
+    recycle( _floatArrays, array );
+}
+
+void
+GeometryPool::recycle(MPGeometry* geom)
+{
+    // if the draw thread (or anyone else) still holds the geometry, leave it alone.
+    if ( !geom || geom->referenceCount() > 1 )
+        return;
+
+    // drop the extra references the MPGeometry keeps to its texture coordinates
+    // so that the arrays are only held by the osg::Geometry lists.
+    geom->_tileCoords = 0L;
+    for( unsigned i=0; i<geom->_layers.size(); ++i )
+        geom->_layers[i]._texCoords = 0L;
+
+    recycle( geom->getVertexArray() );
+    recycle( geom->getNormalArray() );
+    recycle( geom->getVertexAttribArray(osg::Drawable::ATTRIBUTE_6) );
+    recycle( geom->getVertexAttribArray(osg::Drawable::ATTRIBUTE_7) );
+
+    for( unsigned i=0; i<geom->getNumTexCoordArrays(); ++i )
+        recycle( geom->getTexCoordArray(i) );
+}
+
+namespace
+{
+    osg::DrawElements* newSharedElements(GLenum mode, bool useUInt, unsigned size)
+    {
+        osg::DrawElements* de = 0L;
+        if ( useUInt )
+            de = new osg::DrawElementsUInt(mode);
+        else
+            de = new osg::DrawElementsUShort(mode);
+        de->setName("TMC");
+        de->reserveElements( size );
+
+        // Note: anything shared must have its own buffer object. No sharing!
+        de->setElementBufferObject( new osg::ElementBufferObject() );
+        return de;
+    }
+}
+
+osg::DrawElements*
+GeometryPool::getSurfaceElements(unsigned numCols, unsigned numRows,
+                                 bool swapOrientation, bool altDiagonal, bool useUInt)
+{
+    ElementsKey key;
+    key._cols = numCols;
+    key._rows = numRows;
+    key._swap = swapOrientation;
+    key._alt  = altDiagonal;
+    key._uint = useUInt;
+
+    Threading::ScopedMutexLock lock( _mutex );
+
+    osg::ref_ptr<osg::DrawElements>& elements = _surfaceElements[key];
+    if ( !elements.valid() )
+    {
+        // same winding and quad split as TileModelCompiler's tessellation.
+        elements = newSharedElements( GL_TRIANGLES, useUInt, (numRows-1) * (numCols-1) * 6 );
+
+        for(unsigned j=0; j<numRows-1; ++j)
+        {
+            for(unsigned i=0; i<numCols-1; ++i)
+            {
+                unsigned i00, i01;
+                if ( swapOrientation )
+                {
+                    i01 = j*numCols + i;
+                    i00 = i01+numCols;
+                }
+                else
+                {
+                    i00 = j*numCols + i;
+                    i01 = i00+numCols;
+                }
+                unsigned i10 = i00+1;
+                unsigned i11 = i01+1;
+
+                if ( !altDiagonal )
+                {
+                    elements->addElement(i01);
+                    elements->addElement(i00);
+                    elements->addElement(i11);
+
+                    elements->addElement(i00);
+                    elements->addElement(i10);
+                    elements->addElement(i11);
+                }
+                else
+                {
+                    elements->addElement(i01);
+                    elements->addElement(i00);
+                    elements->addElement(i10);
+
+                    elements->addElement(i01);
+                    elements->addElement(i10);
+                    elements->addElement(i11);
+                }
+            }
+        }
+    }
+
+    return elements.get();
+}
+
+osg::DrawElements*
+GeometryPool::getSkirtElements(unsigned numCols, unsigned numRows, bool useUInt)
+{
+    ElementsKey key;
+    key._cols = numCols;
+    key._rows = numRows;
+    key._swap = false;
+    key._alt  = false;
+    key._uint = useUInt;
+
+    Threading::ScopedMutexLock lock( _mutex );
+
+    osg::ref_ptr<osg::DrawElements>& elements = _skirtElements[key];
+    if ( !elements.valid() )
+    {
+        // one strip around the tile: bottom, right, top, left; each surface
+        // edge vert pairs with the skirt vert appended after the surface.
+        elements = newSharedElements( GL_TRIANGLE_STRIP, useUInt, 4*(numCols+numRows) );
+
+        unsigned skirt = numCols*numRows;
+
+        for( unsigned c=0; c<numCols-1; ++c )
+        {
+            elements->addElement( c );
+            elements->addElement( skirt++ );
+        }
+
+        for( unsigned r=0; r<numRows-1; ++r )
+        {
+            elements->addElement( r*numCols+(numCols-1) );
+            elements->addElement( skirt++ );
+        }
+
+        for( int c=numCols-1; c>0; --c )
+        {
+            elements->addElement( (numRows-1)*numCols+c );
+            elements->addElement( skirt++ );
+        }
+
+        for( int r=numRows-1; r>=0; --r )
+        {
+            elements->addElement( r*numCols );
+            elements->addElement( skirt++ );
+        }
+    }
+
+    return elements.get();
+}
+
+osg::Vec2Array*
+GeometryPool::getUnitTexCoords(unsigned numCols, unsigned numRows, bool withSkirt)
+{
+    ElementsKey key;
+    key._cols = numCols;
+    key._rows = numRows;
+    key._swap = withSkirt; // (reused as the skirt flag)
+    key._alt  = false;
+    key._uint = false;
+
+    Threading::ScopedMutexLock lock( _mutex );
+
+    osg::ref_ptr<osg::Vec2Array>& tc = _unitTexCoords[key];
+    if ( !tc.valid() )
+    {
+        // Note: anything shared must have its own buffer object. No sharing!
+        tc = new osg::Vec2Array();
+        tc->setVertexBufferObject( new osg::VertexBufferObject() );
+        tc->reserve( numCols*numRows + (withSkirt ? 2*(numCols+numRows) : 0) );
+
+        // same arithmetic as the compiler, so the values match bit for bit.
+        for(unsigned j=0; j<numRows; ++j)
+            for(unsigned i=0; i<numCols; ++i)
+                tc->push_back( osg::Vec2(((double)i)/(double)(numCols-1), ((double)j)/(double)(numRows-1)) );
+
+        if ( withSkirt )
+        {
+            // skirt verts copy the coords of their surface verts, in strip order.
+            for( unsigned c=0; c<numCols-1; ++c )
+                tc->push_back( osg::Vec2((*tc)[c]) );
+            for( unsigned r=0; r<numRows-1; ++r )
+                tc->push_back( osg::Vec2((*tc)[r*numCols+(numCols-1)]) );
+            for( int c=numCols-1; c>0; --c )
+                tc->push_back( osg::Vec2((*tc)[(numRows-1)*numCols+c]) );
+            for( int r=numRows-1; r>=0; --r )
+                tc->push_back( osg::Vec2((*tc)[r*numCols]) );
+        }
+    }
+
+    return tc.get();
+}
@@ -17,6 +17,7 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include "HeightFieldCache"
+#include <osgEarth/StringUtils>
 
 using namespace osgEarth::Drivers::MPTerrainEngine;
 using namespace osgEarth;
@@ -46,22 +47,175 @@ HeightFieldCache::getOrCreateHeightField(const MapFrame&                 frame,
     if (progress)
         progress->stats()["hfcache_try_count"] += 1;
 
-    bool hit = false;
-    LRUCache<HFKey,HFValue>::Record rec;
-    if ( _cache.get(cachekey, rec) )
+    while( true )
     {
-        out_hf = rec.value()._hf.get();
-        out_isFallback = rec.value()._isFallback;
+        if ( getFromCache(cachekey, out_hf, out_isFallback) )
+        {
+            if (progress)
+            {
+                progress->stats()["hfcache_hit_count"] += 1;
+                progress->stats()["hfcache_hit_rate"] = progress->stats()["hfcache_hit_count"]/progress->stats()["hfcache_try_count"];
+            }
+            return true;
+        }
+
+        // Not cached. Build it ourselves unless another thread already is.
+        osg::ref_ptr<InFlight> inFlight;
+        bool leader = false;
+        {
+            Threading::ScopedMutexLock lock( _inFlightMutex );
+            InFlightMap::iterator i = _inFlight.find( cachekey );
+            if ( i == _inFlight.end() )
+            {
+                inFlight = new InFlight();
+                _inFlight[cachekey] = inFlight.get();
+                leader = true;
+            }
+            else
+            {
+                inFlight = i->second.get();
+            }
+        }
+
+        if ( leader )
+        {
+            // the previous leader may have finished between our cache check and now.
+            bool ok = getFromCache(cachekey, out_hf, out_isFallback);
+            if ( !ok )
+            {
+                ++_misses;
+                if (progress)
+                    progress->stats()["hfcache_miss_count"] += 1;
 
+                ok = createHeightField(frame, key, cachekey, parent_hf, out_hf, out_isFallback, interp, progress);
+            }
+
+            {
+                Threading::ScopedMutexLock lock( _inFlightMutex );
+                _inFlight.erase( cachekey );
+            }
+            {
+                Threading::ScopedMutexLock lock( inFlight->_mutex );
+                inFlight->_done = true;
+                inFlight->_cond.broadcast();
+            }
+            return ok;
+        }
+
+        // wait for the other build, then look in the cache again. If that build
+        // failed, the next pass makes us the leader.
+        ++_waits;
         if (progress)
+            progress->stats()["hfcache_wait_count"] += 1;
+
+        Threading::ScopedMutexLock lock( inFlight->_mutex );
+        while( !inFlight->_done )
         {
-            progress->stats()["hfcache_hit_count"] += 1;
-            progress->stats()["hfcache_hit_rate"] = progress->stats()["hfcache_hit_count"]/progress->stats()["hfcache_try_count"];
+            if ( progress && progress->isCanceled() )
+                return false;
+            inFlight->_cond.wait( &inFlight->_mutex, 50 );
         }
+    }
+}
+
+bool
+HeightFieldCache::getFromCache(const HFKey&                    cachekey,
+                               osg::ref_ptr<osg::HeightField>& out_hf,
+                               bool&                           out_isFallback) const
+{
+    HFCache::Record rec;
+    if ( !_cache.get(cachekey, rec) )
+        return false;
 
-        return true;
+    if ( rec.value()._qhf.valid() )
+        out_hf = rec.value()._qhf->decode();
+    else
+        out_hf = rec.value()._hf.get();
+    out_isFallback = rec.value()._isFallback;
+    return true;
+}
+
+bool
+HeightFieldCache::createHeightField(const MapFrame&                 frame,
+                                    const TileKey&                  key,
+                                    const HFKey&                    cachekey,
+                                    const osg::HeightField*         parent_hf,
+                                    osg::ref_ptr<osg::HeightField>& out_hf,
+                                    bool&                           out_isFallback,
+                                    ElevationInterpolation          interp,
+                                    ProgressCallback*               progress)
+{
+    // try the persistent cache first; it holds fully composited heightfields.
+    std::string binKey;
+    if ( _bin.valid() )
+        binKey = getBinKey(frame, key, cachekey, interp);
+
+    bool populated = false;
+    bool fromBin   = false;
+
+    if ( !binKey.empty() && _binPolicy.isCacheReadable() )
+    {
+        ReadResult r = _bin->readObject( binKey );
+        if ( r.succeeded() )
+        {
+            osg::ref_ptr<osg::HeightField> hf = r.release<osg::HeightField>();
+            if ( hf.valid() )
+            {
+                out_hf    = hf.get();
+                fromBin   = true;
+                populated = r.metadata().value("fallback") != "true";
+                if (progress)
+                    progress->stats()["hfcache_bin_hit_count"] += 1;
+            }
+        }
     }
 
+    if ( !fromBin )
+    {
+        if ( !buildHeightField(frame, key, cachekey, parent_hf, out_hf, populated, interp, progress) )
+            return false;
+
+        if ( !binKey.empty() && _binPolicy.isCacheWriteable() )
+        {
+            Config meta;
+            meta.set( "fallback", populated ? "false" : "true" );
+            _bin->write( binKey, out_hf.get(), meta );
+        }
+    }
+
+    // cache it.
+    HFValue cacheval;
+    cacheval._isFallback = !populated;
+
+    if ( _precision > 0.0f )
+        cacheval._qhf = QuantizedHeightField::encode( out_hf.get(), _precision );
+
+    if ( cacheval._qhf.valid() )
+    {
+        // hand out the decoded version so hits and misses yield the same heights.
+        out_hf = cacheval._qhf->decode();
+    }
+    else
+    {
+        cacheval._hf = out_hf.get();
+    }
+
+    _cache.insert( cachekey, cacheval );
+
+    out_isFallback = !populated;
+    return true;
+}
+
+bool
+HeightFieldCache::buildHeightField(const MapFrame&                 frame,
+                                   const TileKey&                  key,
+                                   const HFKey&                    cachekey,
+                                   const osg::HeightField*         parent_hf,
+                                   osg::ref_ptr<osg::HeightField>& out_hf,
+                                   bool&                           out_populated,
+                                   ElevationInterpolation          interp,
+                                   ProgressCallback*               progress)
+{
     // Find the parent tile and start with its heightfield.
     if ( parent_hf )
     {
@@ -91,11 +245,11 @@ HeightFieldCache::getOrCreateHeightField(const MapFrame&                 frame,
             key.getExtent(), _tileSize, _tileSize, true );
     }
 
-    bool populated = frame.populateHeightField(
+    out_populated = frame.populateHeightField(
         out_hf,
         key,
         true, // convertToHAE
-        samplePolicy,
+        cachekey._samplePolicy,
         progress );
 
     // Treat Plate Carre specially by scaling the height values. (There is no need
@@ -106,12 +260,36 @@ HeightFieldCache::getOrCreateHeightField(const MapFrame&                 frame,
         HeightFieldUtils::scaleHeightFieldToDegrees( out_hf.get() );
     }
 
-    // cache it.
-    HFValue cacheval;
-    cacheval._hf = out_hf.get();
-    cacheval._isFallback = !populated;
-    _cache.insert( cachekey, cacheval );
-
-    out_isFallback = !populated;
     return true;
 }
+
+std::string
+HeightFieldCache::getBinKey(const MapFrame&        frame,
+                            const TileKey&         key,
+                            const HFKey&           cachekey,
+                            ElevationInterpolation interp) const
+{
+    // the result depends on every active elevation layer, so each one needs a
+    // stable identity. Without it, there is no safe persistent key.
+    std::string ids;
+    const ElevationLayerVector& layers = frame.elevationLayers();
+    for( ElevationLayerVector::const_iterator i = layers.begin(); i != layers.end(); ++i )
+    {
+        const ElevationLayer* layer = i->get();
+        if ( !layer->getVisible() )
+            continue;
+
+        const optional<std::string>& cacheId = layer->getTerrainLayerRuntimeOptions().cacheId();
+        if ( !cacheId.isSet() || cacheId->empty() )
+            return "";
+
+        ids += *cacheId + ";";
+    }
+
+    return Stringify()
+        << key.str()
+        << "_" << _tileSize
+        << "_" << (int)cachekey._samplePolicy
+        << "_" << (int)interp
+        << "_" << std::hex << hashString(ids);
+}
@@ -5,6 +5,7 @@ $GLSL_DEFAULT_PRECISION_FLOAT
 #pragma vp_location   "fragment_coloring"
 #pragma vp_order      "0.5"
 #pragma vp_define     "MP_USE_BLENDING"
+#pragma vp_define     "MP_MERCATOR_WARP"
 
 uniform vec4 oe_terrain_color;
 uniform sampler2D oe_layer_tex;
@@ -12,17 +13,53 @@ uniform int oe_layer_uid;
 uniform int oe_layer_order;
 uniform float oe_layer_opacity;
 
+// (s offset, t offset, s scale, t scale) of the layer's page in its
+// virtual texture, or (0,0,1,1) for a layer with a texture of its own.
+uniform vec4 oe_layer_vtregion;
+
 varying vec4 oe_layer_texc;
 varying float oe_terrain_rangeOpacity;
 
 uniform float m;
 
+#ifdef MP_MERCATOR_WARP
+// (lat0, latSpan, scale, bias) of a layer in its native Mercator profile,
+// or zero if the layer needs no warp.
+uniform vec4 oe_layer_merc;
+varying vec4 oe_layer_tilec;
+
+vec2 oe_mp_mercatorTexCoord(in vec2 texc)
+{
+    if ( oe_layer_merc.y == 0.0 )
+        return texc;
+
+    // Mercator y difference between the tile's south edge and the fragment,
+    // atanh(sin(lat)) - atanh(sin(lat0)), formed from the latitude difference
+    // so it keeps its precision in deep tiles.
+    float lat0 = oe_layer_merc.x;
+    float dlat = oe_layer_merc.y * oe_layer_tilec.t;
+    float x    = 2.0*cos(lat0 + 0.5*dlat)*sin(0.5*dlat) / (1.0 - sin(lat0 + dlat)*sin(lat0));
+    float dy   = abs(x) < 0.1 ? x*(1.0 + x*x*(1.0/3.0 + x*x*0.2)) : 0.5*log((1.0+x)/(1.0-x));
+
+    return vec2(texc.s, oe_layer_merc.w + oe_layer_merc.z*dy);
+}
+#endif
+
 void oe_mp_apply_coloring(inout vec4 color)
 {
     color = oe_terrain_color.a >= 0.0 ? oe_terrain_color : color;
 
     float applyImagery = oe_layer_uid >= 0 ? 1.0 : 0.0;
-    vec4 texel = mix(color, texture2D(oe_layer_tex, oe_layer_texc.st), applyImagery);
+
+#ifdef MP_MERCATOR_WARP
+    vec2 texc = oe_mp_mercatorTexCoord(oe_layer_texc.st);
+#else
+    vec2 texc = oe_layer_texc.st;
+#endif
+
+    texc = oe_layer_vtregion.xy + texc*oe_layer_vtregion.zw;
+
+    vec4 texel = mix(color, texture2D(oe_layer_tex, texc), applyImagery);
     texel.a = mix(texel.a, texel.a*oe_layer_opacity*oe_terrain_rangeOpacity, applyImagery);
 
 #ifdef MP_USE_BLENDING
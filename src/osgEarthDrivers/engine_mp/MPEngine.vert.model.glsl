@@ -5,11 +5,17 @@ $GLSL_DEFAULT_PRECISION_FLOAT
 #pragma vp_location   "vertex_model"
 #pragma vp_order      "-FLT_MAX"
 
+// (s offset, t offset, s scale, t scale) into the layer's texture of the
+// layer's texture coordinates; a tile drawing its parent's texture passes
+// its own tile coordinates with this. (0,0,1,1) for other layers.
+uniform vec4 oe_layer_texscalebias;
+
 varying vec4 oe_layer_texc;
 varying vec4 oe_layer_tilec;
 
 void oe_mp_vertModel(inout vec4 vertexModel)
 {
     oe_layer_texc  = gl_MultiTexCoord$MP_PRIMARY_UNIT;
+    oe_layer_texc.st = oe_layer_texscalebias.xy + oe_layer_texc.st*oe_layer_texscalebias.zw;
     oe_layer_tilec = gl_MultiTexCoord$MP_SECONDARY_UNIT;
 }
@@ -58,6 +58,9 @@ _imageUnit       ( imageUnit )
     _texMatParentUniformNameID = osg::Uniform::getNameID( "oe_layer_parent_texmat" );
     _minRangeUniformNameID     = osg::Uniform::getNameID( "oe_layer_minRange" );
     _maxRangeUniformNameID     = osg::Uniform::getNameID( "oe_layer_maxRange" );
+    _mercWarpUniformNameID     = osg::Uniform::getNameID( "oe_layer_merc" );
+    _vtRegionUniformNameID     = osg::Uniform::getNameID( "oe_layer_vtregion" );
+    _texScaleBiasUniformNameID = osg::Uniform::getNameID( "oe_layer_texscalebias" );
 
     // we will set these later (in TileModelCompiler)
     this->setUseDisplayList(false);
@@ -65,6 +68,33 @@ _imageUnit       ( imageUnit )
 }
 
 
+MPGeometry::MPGeometry(const MPGeometry& rhs, const osg::CopyOp& cop) :
+osg::Geometry              ( rhs, cop ),
+_frame                     ( rhs._frame ),
+_layers                    ( rhs._layers ),
+_uidUniformNameID          ( rhs._uidUniformNameID ),
+_birthTimeUniformNameID    ( rhs._birthTimeUniformNameID ),
+_orderUniformNameID        ( rhs._orderUniformNameID ),
+_opacityUniformNameID      ( rhs._opacityUniformNameID ),
+_texMatParentUniformNameID ( rhs._texMatParentUniformNameID ),
+_tileKeyUniformNameID      ( rhs._tileKeyUniformNameID ),
+_minRangeUniformNameID     ( rhs._minRangeUniformNameID ),
+_maxRangeUniformNameID     ( rhs._maxRangeUniformNameID ),
+_mercWarpUniformNameID     ( rhs._mercWarpUniformNameID ),
+_vtRegionUniformNameID     ( rhs._vtRegionUniformNameID ),
+_texScaleBiasUniformNameID ( rhs._texScaleBiasUniformNameID ),
+_tileKeyValue              ( rhs._tileKeyValue ),
+_tileCoords                ( rhs._tileCoords ),
+_imageUnit                 ( rhs._imageUnit ),
+_imageUnitParent           ( rhs._imageUnitParent ),
+_elevUnit                  ( rhs._elevUnit ),
+_supportsGLSL              ( rhs._supportsGLSL ),
+_elevTex                   ( rhs._elevTex )
+{
+    //nop
+}
+
+
 void
 MPGeometry::renderPrimitiveSets(osg::State& state,
                                 bool        renderColor,
@@ -127,17 +157,41 @@ MPGeometry::renderPrimitiveSets(osg::State& state,
     GLint texMatParentLocation  = -1;
     GLint minRangeLocation      = -1;
     GLint maxRangeLocation      = -1;
+    GLint mercWarpLocation      = -1;
+    GLint vtRegionLocation      = -1;
+    GLint texScaleBiasLocation  = -1;
 
-    // The PCP can change (especially in a VirtualProgram environment). So we do need to
-    // requery the uni locations each time unfortunately. TODO: explore optimizations.
+    // The PCP can change (especially in a VirtualProgram environment), so we
+    // remember which program the locations came from and only requery them
+    // when it differs from the last draw in this GC.
     if ( pcp )
     {
-        tileKeyLocation      = pcp->getUniformLocation( _tileKeyUniformNameID );
-        birthTimeLocation    = pcp->getUniformLocation( _birthTimeUniformNameID );
-        opacityLocation      = pcp->getUniformLocation( _opacityUniformNameID );
-        uidLocation          = pcp->getUniformLocation( _uidUniformNameID );
-        orderLocation        = pcp->getUniformLocation( _orderUniformNameID );
-        texMatParentLocation = pcp->getUniformLocation( _texMatParentUniformNameID );
+        UniformLocations& loc = _pcd[contextID].locations;
+        if ( loc.pcp.get() != pcp )
+        {
+            loc.pcp          = pcp;
+            loc.tileKey      = pcp->getUniformLocation( _tileKeyUniformNameID );
+            loc.birthTime    = pcp->getUniformLocation( _birthTimeUniformNameID );
+            loc.opacity      = pcp->getUniformLocation( _opacityUniformNameID );
+            loc.uid          = pcp->getUniformLocation( _uidUniformNameID );
+            loc.order        = pcp->getUniformLocation( _orderUniformNameID );
+            loc.texMatParent = pcp->getUniformLocation( _texMatParentUniformNameID );
+            loc.minRange     = pcp->getUniformLocation( _minRangeUniformNameID );
+            loc.maxRange     = pcp->getUniformLocation( _maxRangeUniformNameID );
+            loc.mercWarp     = pcp->getUniformLocation( _mercWarpUniformNameID );
+            loc.vtRegion     = pcp->getUniformLocation( _vtRegionUniformNameID );
+            loc.texScaleBias = pcp->getUniformLocation( _texScaleBiasUniformNameID );
+        }
+
+        tileKeyLocation      = loc.tileKey;
+        birthTimeLocation    = loc.birthTime;
+        opacityLocation      = loc.opacity;
+        uidLocation          = loc.uid;
+        orderLocation        = loc.order;
+        texMatParentLocation = loc.texMatParent;
+        mercWarpLocation     = loc.mercWarp;
+        vtRegionLocation     = loc.vtRegion;
+        texScaleBiasLocation = loc.texScaleBias;
     }
     
     // apply the tilekey uniform once.
@@ -197,6 +251,16 @@ MPGeometry::renderPrimitiveSets(osg::State& state,
     {
         float prev_opacity        = -1.0f;
         float prev_alphaThreshold = -1.0f;
+        float prev_minRange       = -1.0f;
+        float prev_maxRange       = -1.0f;
+        osg::Vec4f prev_vtRegion( -1.0f, -1.0f, -1.0f, -1.0f );
+        osg::Vec4f prev_texScaleBias( -1.0f, -1.0f, -1.0f, -1.0f );
+        unsigned frameNumber = state.getFrameStamp() ? state.getFrameStamp()->getFrameNumber() : 0u;
+
+        // layers often share one texture coordinate array (and parent textures
+        // are often shared too), so skip re-binding when nothing changed.
+        const osg::Vec2Array* prev_texCoords = 0L;
+        const osg::Texture*   prev_texParent = 0L;
 
         // first bind any shared layers. We still have to do this even if we are
         // in !renderColor mode b/c these textures could be used by vertex shaders
@@ -246,16 +310,16 @@ MPGeometry::renderPrimitiveSets(osg::State& state,
             }
         }
 
-        // look up the minRange uniform if necessary
+        // use the minRange uniform if necessary
         if ( useMinVisibleRange && pcp )
         {
-            minRangeLocation = pcp->getUniformLocation( _minRangeUniformNameID );
+            minRangeLocation = _pcd[contextID].locations.minRange;
         }
         
-        // look up the maxRange uniform if necessary
+        // use the maxRange uniform if necessary
         if ( useMaxVisibleRange && pcp )
         {
-            maxRangeLocation = pcp->getUniformLocation( _maxRangeUniformNameID );
+            maxRangeLocation = _pcd[contextID].locations.maxRange;
         }
 
         if (renderColor)
@@ -280,6 +344,15 @@ MPGeometry::renderPrimitiveSets(osg::State& state,
 
                 if ( layer._imageLayer->getVisible() && layer._imageLayer->getOpacity() > 0.0f )
                 {       
+                    // a virtual texture layer draws from whichever page holds its tile
+                    // (or an ancestor's) right now. Resolving it first means the texture
+                    // apply below uploads a newly claimed page before the draw.
+                    osg::Vec4f vtRegion( 0.0f, 0.0f, 1.0f, 1.0f );
+                    if ( layer._virtualTile.valid() && !layer._virtualTile->resolve(frameNumber, vtRegion) )
+                    {
+                        continue;
+                    }
+
                     // activate the visible unit if necessary:
                     if ( activeImageUnit != _imageUnit )
                     {
@@ -297,18 +370,23 @@ MPGeometry::renderPrimitiveSets(osg::State& state,
                     }
 
                     // if we're using a parent texture for blending, activate that now
-                    if ( texMatParentLocation >= 0 && layer._texParent.valid() )
+                    if ( texMatParentLocation >= 0 && layer._texParent.valid() && layer._texParent.get() != prev_texParent )
                     {
                         state.setActiveTextureUnit( _imageUnitParent );
                         activeImageUnit = _imageUnitParent;
                         layer._texParent->apply( state );
                         usedTexParent = true;
+                        prev_texParent = layer._texParent.get();
                     }
 
                     // bind the texture coordinates for this layer.
-                    // TODO: can probably optimize this by sharing or using texture matrixes.
-                    // State::setTexCoordPointer does some redundant work under the hood.
-                    state.setTexCoordPointer( _imageUnit, layer._texCoords.get() );
+                    // State::setTexCoordPointer does some redundant work under the hood,
+                    // so only call it when the array actually changes.
+                    if ( layer._texCoords.get() != prev_texCoords )
+                    {
+                        state.setTexCoordPointer( _imageUnit, layer._texCoords.get() );
+                        prev_texCoords = layer._texCoords.get();
+                    }
 
                     // apply uniform values:
                     if ( pcp )
@@ -342,16 +420,47 @@ MPGeometry::renderPrimitiveSets(osg::State& state,
                             ext->glUniformMatrix4fv( texMatParentLocation, 1, GL_FALSE, layer._texMatParent.ptr() );
                         }
 
+                        // assign the Mercator warp (zero for layers that don't need it)
+                        if ( mercWarpLocation >= 0 )
+                        {
+                            ext->glUniform4fv( mercWarpLocation, 1, layer._mercWarp.ptr() );
+                        }
+
+                        // assign the virtual texture page region ((0,0,1,1) for other layers)
+                        if ( vtRegionLocation >= 0 && vtRegion != prev_vtRegion )
+                        {
+                            ext->glUniform4fv( vtRegionLocation, 1, vtRegion.ptr() );
+                            prev_vtRegion = vtRegion;
+                        }
+
+                        // assign the texture scale/bias: a tile drawing its parent's
+                        // texture maps its own tile coordinates into it on the GPU.
+                        if ( texScaleBiasLocation >= 0 && layer._texScaleBias != prev_texScaleBias )
+                        {
+                            ext->glUniform4fv( texScaleBiasLocation, 1, layer._texScaleBias.ptr() );
+                            prev_texScaleBias = layer._texScaleBias;
+                        }
+
                         // assign the min range
                         if ( minRangeLocation >= 0 )
                         {
-                            ext->glUniform1f( minRangeLocation, layer._imageLayer->getImageLayerOptions().minVisibleRange().get() );
+                            float minRange = layer._imageLayer->getImageLayerOptions().minVisibleRange().get();
+                            if ( minRange != prev_minRange )
+                            {
+                                ext->glUniform1f( minRangeLocation, minRange );
+                                prev_minRange = minRange;
+                            }
                         }
 
                         // assign the max range
                         if ( maxRangeLocation >= 0 )
                         {
-                            ext->glUniform1f( maxRangeLocation, layer._imageLayer->getImageLayerOptions().maxVisibleRange().get() );
+                            float maxRange = layer._imageLayer->getImageLayerOptions().maxVisibleRange().get();
+                            if ( maxRange != prev_maxRange )
+                            {
+                                ext->glUniform1f( maxRangeLocation, maxRange );
+                                prev_maxRange = maxRange;
+                            }
                         }
                     }
 
@@ -529,12 +638,17 @@ MPGeometry::compileGLObjects( osg::RenderInfo& renderInfo ) const
 {
     State& state = *renderInfo.getState();
     
-    // compile the image textures:
+    // compile the image textures, and the parent textures used for
+    // LOD blending, so the first draw in this context doesn't upload them.
+    // Contexts that share GL objects share a context ID, so apply() is a
+    // no-op for a texture already compiled elsewhere in the share group.
     for(unsigned i=0; i<_layers.size(); ++i)
     {
         const Layer& layer = _layers[i];
         if ( layer._tex.valid() )
             layer._tex->apply( state );
+        if ( layer._texParent.valid() && layer._texParent != layer._tex )
+            layer._texParent->apply( state );
     }
 
     // compile the elevation texture:
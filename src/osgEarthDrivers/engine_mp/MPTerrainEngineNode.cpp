@@ -31,9 +31,14 @@
 #include <osgEarth/VirtualProgram>
 #include <osgEarth/ShaderFactory>
 #include <osgEarth/MapModelChange>
+#include <osgEarth/NodeUtils>
+#include <osgEarth/CullingUtils>
+#include <osgEarth/FrameStats>
 #include <osgEarth/Progress>
 #include <osgEarth/ShaderLoader>
 #include <osgEarth/Utils>
+#include <osgEarth/Cache>
+#include <osgEarth/StringUtils>
 
 #include <osg/TexEnv>
 #include <osg/TexEnvCombine>
@@ -44,6 +49,7 @@
 #include <osgDB/DatabasePager>
 #include <osgUtil/RenderBin>
 #include <osgUtil/RenderLeaf>
+#include <set>
 
 #define LC "[MPTerrainEngineNode] "
 
@@ -97,6 +103,13 @@ namespace
             osgUtil::RenderBin(rhs, copy)
         {
         }
+
+        void drawImplementation(osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& previous)
+        {
+            FrameStats::beginGPU( FrameStats::GPU_TERRAIN, renderInfo );
+            osgUtil::RenderBin::drawImplementation( renderInfo, previous );
+            FrameStats::endGPU( FrameStats::GPU_TERRAIN, renderInfo );
+        }
     };
 
 
@@ -263,7 +276,9 @@ MPTerrainEngineNode::postInitialize( const Map* map, const TerrainOptions& optio
     // themselves if necessary.
     _liveTiles = new TileNodeRegistry("live");
     _liveTiles->setRevisioningEnabled( _terrainOptions.incrementalUpdate() == true );
+    _liveTiles->setDirtyBudget( _terrainOptions.dirtyTilesPerFrame().get() );
     _liveTiles->setMapRevision( _update_mapf->getRevision() );
+    _liveTiles->setResidencyManager( getResidencyManager() );
 
     // set up a registry for quick release:
     if ( _terrainOptions.quickReleaseGLObjects() == true )
@@ -287,6 +302,60 @@ MPTerrainEngineNode::postInitialize( const Map* map, const TerrainOptions& optio
     // initialize the model factory:
     _tileModelFactory = new TileModelFactory(_liveTiles.get(), _terrainOptions, this);
 
+    // persistent tile cache: keeps composited elevation data in the map's cache.
+    if ( _terrainOptions.tileCache() == true )
+    {
+        Cache* cache = getMap()->getCache();
+        const optional<CachePolicy>& cp = getMap()->getMapOptions().cachePolicy();
+        CachePolicy policy = cp.isSet() ? cp.get() : CachePolicy::DEFAULT;
+
+        if ( cache && policy != CachePolicy::NO_CACHE )
+        {
+            std::string binId = Stringify()
+                << "mp_tiles_" << std::hex << hashString(getMap()->getProfile()->getFullSignature());
+
+            CacheBin* bin = cache->addBin( binId );
+            if ( bin )
+            {
+                _tileModelFactory->setCacheBin( bin, policy );
+                OE_INFO << LC << "Tile cache enabled (bin " << binId << ")" << std::endl;
+            }
+        }
+        else
+        {
+            OE_INFO << LC << "Tile cache requested, but the map has no cache" << std::endl;
+        }
+    }
+
+    // recycled tile arrays and shared element buffers, across all compilers:
+    _geometryPool = new GeometryPool();
+
+    // threads that help the compilers with the vertex work of large tiles:
+    _compileService = new TaskService( "MP Tile Compiler", 2 );
+    Registry::instance()->registerTaskService( _compileService.get() );
+
+    // reads and compiles paged tiles in stages, off the paging threads:
+    if ( _terrainOptions.pipelineIOThreads().get() > 0 )
+    {
+        _pipeline = new TilePipeline(
+            _terrainOptions.pipelineIOThreads().get(),
+            _terrainOptions.pipelineCPUThreads().get(),
+            _terrainOptions.pipelineQueueSize().get() );
+    }
+
+    // paces the merging of paged tiles; needs an update traversal to run.
+    _mergeQueue = new TileMergeQueue();
+    _mergeQueue->setMaxMergesPerFrame( _terrainOptions.mergesPerFrame().get() );
+    _mergeQueue->setMaxMergeTimePerFrame( _terrainOptions.mergeTimePerFrame().get() );
+    if ( _mergeQueue->isEnabled() )
+    {
+        ADJUST_UPDATE_TRAV_COUNT( this, 1 );
+    }
+
+    // extrapolates camera motion for predictive tile requests:
+    _cameraPredictor = new CameraPredictor();
+    _cameraPredictor->setLookAheadFrames( _terrainOptions.prefetchFrames().get() );
+
     // handle an already-established map profile:
     if ( _update_mapf->getProfile() )
     {
@@ -416,7 +485,7 @@ namespace
                 i != tiles.end();
                 ++i)
             {
-                _cb->operator()(i->first, i->second.get());
+                _cb->operator()(i->second->getKey(), i->second.get());
             }
         }
     };
@@ -443,6 +512,41 @@ MPTerrainEngineNode::dirty()
     refresh();
 }
 
+void
+MPTerrainEngineNode::onEvictTiles(const std::vector<TileKey>& parentKeys)
+{
+    // each tile's children hang off the TilePagedLOD that holds the tile.
+    unsigned count = 0;
+    for( std::vector<TileKey>::const_iterator i = parentKeys.begin(); i != parentKeys.end(); ++i )
+    {
+        osg::ref_ptr<TileNode> tile;
+        if ( _liveTiles->get(*i, tile) && tile->getNumParents() > 0 )
+        {
+            TilePagedLOD* plod = dynamic_cast<TilePagedLOD*>( tile->getParent(0) );
+            if ( plod && plod->evictChildren() )
+                ++count;
+        }
+    }
+
+    OE_DEBUG << LC << "Evicted the children of " << count << " tiles" << std::endl;
+}
+
+/**
+ * Builds one root tile on a root tile service thread, with that thread's
+ * own key node factory.
+ */
+struct MPTerrainEngineNode::BuildRootTile
+{
+    MPTerrainEngineNode*    _engine;
+    TileKey                 _key;
+    osg::ref_ptr<osg::Node> _node;
+
+    void execute()
+    {
+        _node = _engine->getKeyNodeFactory()->createNode( _key, true, true, 0L );
+    }
+};
+
 void
 MPTerrainEngineNode::createTerrain()
 {
@@ -469,9 +573,6 @@ MPTerrainEngineNode::createTerrain()
 #endif
 
     this->addChild( _terrain );
-
-    // Factory to create the root keys:
-    KeyNodeFactory* factory = getKeyNodeFactory();
     
     // Build the first level of the terrain.
     // Collect the tile keys comprising the root tiles of the terrain.
@@ -486,13 +587,54 @@ MPTerrainEngineNode::createTerrain()
 
     osg::ref_ptr<osgDB::Options> dbOptions = Registry::instance()->cloneOrCreateOptions();
 
+    // Build the root tiles in parallel; they're independent of each other, and
+    // at a first LOD of 2 or 3 there are dozens of them. The threads stay
+    // around (with their key node factories) for the next createTerrain.
+    typedef ParallelTask<BuildRootTile> BuildRootTileTask;
+    std::vector< osg::ref_ptr<BuildRootTileTask> > tasks( keys.size() );
+
+    unsigned numThreads = osg::minimum(
+        (unsigned)keys.size(),
+        (unsigned)Registry::capabilities().getNumProcessors() );
+
+    if ( numThreads > 1 )
+    {
+        if ( !_rootTileService.valid() )
+        {
+            _rootTileService = new TaskService( "MP Root Tiles", numThreads );
+        }
+
+        Threading::MultiEvent semaphore( keys.size() );
+
+        for( unsigned i=0; i<keys.size(); ++i )
+        {
+            tasks[i] = new BuildRootTileTask( &semaphore );
+            tasks[i]->_engine = this;
+            tasks[i]->_key    = keys[i];
+            _rootTileService->add( tasks[i].get() );
+        }
+
+        semaphore.wait();
+    }
+    else
+    {
+        for( unsigned i=0; i<keys.size(); ++i )
+        {
+            tasks[i] = new BuildRootTileTask();
+            tasks[i]->_engine = this;
+            tasks[i]->_key    = keys[i];
+            tasks[i]->execute();
+        }
+    }
+
+    // attach them in key order, so the root is the same either way.
     unsigned child = 0;
     for( unsigned i=0; i<keys.size(); ++i )
     {
-        osg::ref_ptr<osg::Node> node = factory->createNode( keys[i], true, true, 0L );
-        if ( node.valid() )
+        osg::Node* node = tasks[i]->_node.get();
+        if ( node )
         {
-            root->addChild( node.get() );
+            root->addChild( node );
             root->setRange( child++, 0.0f, FLT_MAX );
             root->setCenter( node->getBound().center() );
             root->setNumChildrenThatCannotBeExpired( child );
@@ -558,6 +700,24 @@ MPTerrainEngineNode::traverse(osg::NodeVisitor& nv)
         if ( _liveTiles.valid() && nv.getFrameStamp() )
         {
             _liveTiles->setTraversalFrame( nv.getFrameStamp()->getFrameNumber() );
+
+            // mark the next batch of tiles from any invalidated regions.
+            _liveTiles->processDirtyTiles();
+        }
+
+        // record the eye so the tiles can see where the camera is heading.
+        if ( _cameraPredictor.valid() && _cameraPredictor->isEnabled() )
+        {
+            _cameraPredictor->update( Culling::asCullVisitor(nv) );
+        }
+    }
+
+    else if ( nv.getVisitorType() == nv.UPDATE_VISITOR )
+    {
+        // merge the paged tiles that fit in this frame's budget.
+        if ( _mergeQueue.valid() )
+        {
+            _mergeQueue->merge();
         }
     }
 
@@ -590,7 +750,9 @@ MPTerrainEngineNode::getKeyNodeFactory()
             _update_mapf->modelLayers(),
             _primaryUnit,
             optimizeTriangleOrientation,
-            _terrainOptions );
+            _terrainOptions,
+            _geometryPool.get(),
+            _compileService.get() );
 
         // initialize a key node factory.
         knf = new SingleKeyNodeFactory(
@@ -601,7 +763,10 @@ MPTerrainEngineNode::getKeyNodeFactory()
             _deadTiles.get(),
             _terrainOptions,
             _uid,
-            this );
+            this,
+            _mergeQueue.get(),
+            _cameraPredictor.get(),
+            _pipeline.get() );
     }
 
     return knf.get();
@@ -696,7 +861,9 @@ MPTerrainEngineNode::createTile( const TileKey& key )
             _update_mapf->modelLayers(),
             _primaryUnit,
             optimizeTriangleOrientation,
-            _terrainOptions );
+            _terrainOptions,
+            _geometryPool.get(),
+            _compileService.get() );
 
     return compiler->compile(model.get(), *_update_mapf, 0L);
 }
@@ -726,7 +893,14 @@ MPTerrainEngineNode::onMapModelChanged( const MapModelChange& change )
         // update the thread-safe map model copy:
         if ( _update_mapf->sync() )
         {
-            _liveTiles->setMapRevision( _update_mapf->getRevision() );
+            // image layer changes leave the tile geometry intact, so tiles can
+            // update just their layers.
+            bool geometryChanged =
+                change.getAction() != MapModelChange::ADD_IMAGE_LAYER    &&
+                change.getAction() != MapModelChange::REMOVE_IMAGE_LAYER &&
+                change.getAction() != MapModelChange::MOVE_IMAGE_LAYER;
+
+            _liveTiles->setMapRevision( _update_mapf->getRevision(), false, geometryChanged );
         }
 
         // dispatch the change handler
@@ -905,6 +1079,7 @@ MPTerrainEngineNode::updateState()
             package.replace( "$MP_SECONDARY_UNIT", Stringify() << (_secondaryUnit>=0?_secondaryUnit:0) );
 
             package.define( "MP_USE_BLENDING", (_terrainOptions.enableBlending() == true) );
+            package.define( "MP_MERCATOR_WARP", (_terrainOptions.mercatorShaderWarp() == true) );
 
             package.loadFunction( vp, package.VertexModel );
             package.loadFunction( vp, package.VertexView );
@@ -932,6 +1107,7 @@ MPTerrainEngineNode::updateState()
 
                 std::stringstream cf_head;
                 std::stringstream cf_body;
+                std::set<std::string> cf_declared;
                 const char* I = "    ";
 
                 // second, install the per-layer color filter functions AND shared layer bindings.
@@ -950,13 +1126,20 @@ MPTerrainEngineNode::updateState()
                             if ( ifStarted ) cf_body << I << "else if ";
                             else             cf_body << I << "if ";
                             cf_body << "(oe_layer_uid == " << layer->getUID() << ") {\n";
-                            for( ColorFilterChain::const_iterator j = chain.begin(); j != chain.end(); ++j )
+                            std::string head, body;
+                            ColorFilterChainCompiler::compile( chain, head, body, std::string(I) + I );
+                            cf_body << body;
+
+                            // layers can share filters, so declare each line only once:
+                            std::stringstream headLines(head);
+                            std::string line;
+                            while( std::getline(headLines, line) )
                             {
-                                const ColorFilter* filter = j->get();
-                                cf_head << "void " << filter->getEntryPointFunctionName() << "(inout vec4 color);\n";
-                                cf_body << I << I << filter->getEntryPointFunctionName() << "(color);\n";
-                                filter->install( terrainStateSet );
+                                if ( cf_declared.insert(line).second )
+                                    cf_head << line << "\n";
                             }
+
+                            ColorFilterChainCompiler::install( chain, terrainStateSet );
                             cf_body << I << "}\n";
                             ifStarted = true;
                         }
@@ -1019,6 +1202,12 @@ MPTerrainEngineNode::updateState()
             terrainStateSet->getOrCreateUniform(
                 "oe_layer_order", osg::Uniform::INT )->set( 0 );
 
+            // default virtual texture page region: the whole texture.
+            terrainStateSet->addUniform( new osg::Uniform("oe_layer_vtregion", osg::Vec4f(0.0f, 0.0f, 1.0f, 1.0f)) );
+
+            // default texture scale/bias: texture coordinates used as is.
+            terrainStateSet->addUniform( new osg::Uniform("oe_layer_texscalebias", osg::Vec4f(0.0f, 0.0f, 1.0f, 1.0f)) );
+
             // default min/max range uniforms.
             terrainStateSet->addUniform( new osg::Uniform("oe_layer_minRange", 0.0f) );
             terrainStateSet->addUniform( new osg::Uniform("oe_layer_maxRange", FLT_MAX) );
@@ -49,8 +49,10 @@ namespace
     {
         Horizon    _horizonPrototype;
         osg::Vec3d _points[4];
+        bool       _useCache;
 
-        HorizonTileCuller(const SpatialReference* srs, const osg::BoundingBox& bbox, const osg::Matrix& m)
+        HorizonTileCuller(const SpatialReference* srs, const osg::BoundingBox& bbox, const osg::Matrix& m) :
+            _useCache( true )
         {
             _horizonPrototype.setEllipsoid(*srs->getEllipsoid());
 
@@ -64,6 +66,9 @@ namespace
                 _horizonPrototype.setEllipsoid(osg::EllipsoidModel(
                     srs->getEllipsoid()->getRadiusEquator() + zMin,
                     srs->getEllipsoid()->getRadiusPolar()   + zMin));
+
+                // a per-tile ellipsoid gains nothing from the shared cache.
+                _useCache = false;
             }
             
 
@@ -80,10 +85,15 @@ namespace
             // Clone the horizon object to support multiple cull threads
             // (since we call setEye with the current node visitor eye point)
             Horizon horizon(_horizonPrototype);
+            osg::Matrix eyeToWorld;
 
-            // Since each terrain tile has an aboslute reference frame, 
+            // Tiles on the map ellipsoid share one per-camera horizon; otherwise,
+            // since each terrain tile has an aboslute reference frame, 
             // there is no need to transform the eyepoint:
-            horizon.setEye(nv->getViewPoint()); // * osg::computeLocalToWorld(nv->getNodePath()));
+            if ( !_useCache || !Registry::instance()->getHorizonCache()->get(nv, _horizonPrototype, horizon, eyeToWorld) )
+            {
+                horizon.setEye(nv->getViewPoint());
+            }
             
             for(unsigned i=0; i<4; ++i)
             {                   
@@ -105,7 +115,10 @@ SingleKeyNodeFactory::SingleKeyNodeFactory(const Map*                    map,
                                            TileNodeRegistry*             deadTiles,
                                            const MPTerrainEngineOptions& options,
                                            UID                           engineUID,
-                                           TerrainTileNodeBroker*        tileNodeBroker ) :
+                                           TerrainTileNodeBroker*        tileNodeBroker,
+                                           TileMergeQueue*               mergeQueue,
+                                           CameraPredictor*              predictor,
+                                           TilePipeline*                 pipeline ) :
 _frame           ( map ),
 _modelFactory    ( modelFactory ),
 _modelCompiler   ( modelCompiler ),
@@ -113,7 +126,10 @@ _liveTiles       ( liveTiles ),
 _deadTiles       ( deadTiles ),
 _options         ( options ),
 _engineUID       ( engineUID ),
-_tileNodeBroker  ( tileNodeBroker )
+_tileNodeBroker  ( tileNodeBroker ),
+_mergeQueue      ( mergeQueue ),
+_predictor       ( predictor ),
+_pipeline        ( pipeline )
 {
     //nop
 }
@@ -174,7 +190,7 @@ SingleKeyNodeFactory::createTile(TileModel*        model,
     if ( prepareForChildren )
     {
         osg::BoundingSphere bs = tileNode->getBound();
-        TilePagedLOD* plod = new TilePagedLOD( _engineUID, _liveTiles, _deadTiles );
+        TilePagedLOD* plod = new TilePagedLOD( _engineUID, _liveTiles, _deadTiles, _mergeQueue.get(), _predictor.get() );
         plod->setCenter  ( bs.center() );
         plod->addChild   ( tileNode );
         plod->setFileName( 1, Stringify() << tileNode->getKey().str() << "." << _engineUID << ".osgearth_engine_mp_tile" );
@@ -254,6 +270,86 @@ SingleKeyNodeFactory::createTile(TileModel*        model,
 }
 
 
+osg::Group*
+SingleKeyNodeFactory::createLayerUpdate(const TileKey&    key,
+                                        ProgressCallback* progress)
+{
+    Revision geometryRevision = _liveTiles->getGeometryRevision();
+
+    // all four existing tiles must be current except for their image layers.
+    osg::ref_ptr<TileNode> sources[4];
+    for(unsigned q=0; q<4; ++q)
+    {
+        if (!_liveTiles->get(key.createChildKey(q), sources[q]) ||
+            !sources[q]->isValid()                               ||
+            sources[q]->isDirty()                                ||
+            !sources[q]->getTileModel()                          ||
+            sources[q]->getTileModel()->getGeometryRevision() < geometryRevision )
+        {
+            return 0L;
+        }
+    }
+
+    OE_START_TIMER(update_layers);
+
+    osg::ref_ptr<TileNode> tiles[4];
+    for(unsigned q=0; q<4; ++q)
+    {
+        osg::ref_ptr<TileModel> model;
+        _modelFactory->createLayerModel( sources[q]->getKey(), _frame, sources[q]->getTileModel(), model, progress );
+        if ( !model.valid() )
+            return 0L;
+
+        tiles[q] = _modelCompiler->compileLayers( model.get(), sources[q].get(), progress );
+        if ( !tiles[q].valid() )
+            return 0L;
+
+        tiles[q]->setEngineUID( _engineUID );
+    }
+
+    osg::Group* quad = new TileGroup(key, _engineUID, _liveTiles.get(), _deadTiles.get());
+    for(unsigned q=0; q<4; ++q)
+    {
+        _tileNodeBroker->notifyOfTerrainTileNodeCreation( tiles[q]->getKey(), tiles[q].get() );
+        quad->addChild( tiles[q].get() );
+    }
+
+    if (progress)
+        progress->stats()["update_layers_time"] += OE_STOP_TIMER(update_layers);
+
+    OE_DEBUG << LC << "Updated layers of " << key.str() << " without rebuilding geometry" << std::endl;
+
+    return quad;
+}
+
+
+struct SingleKeyNodeFactory::QuadJob : public TilePipeline::Job
+{
+    QuadJob(SingleKeyNodeFactory* factory, const TileKey& key, bool accumulate, bool setupChildren) :
+        _factory      ( factory ),
+        _key          ( key ),
+        _accumulate   ( accumulate ),
+        _setupChildren( setupChildren ) { }
+
+    bool runIOStage(ProgressCallback* progress)
+    {
+        return _factory->createModels( _key, _accumulate, _models, progress );
+    }
+
+    osg::Node* runCPUStage(ProgressCallback* progress)
+    {
+        return _factory->createQuad( _key, _models, _setupChildren, progress );
+    }
+
+    // the factory outlives the job, since its thread waits for the result.
+    SingleKeyNodeFactory*   _factory;
+    TileKey                 _key;
+    bool                    _accumulate;
+    bool                    _setupChildren;
+    osg::ref_ptr<TileModel> _models[4];
+};
+
+
 osg::Node*
 SingleKeyNodeFactory::createNode(const TileKey&    key, 
                                  bool              accumulate,
@@ -264,30 +360,78 @@ SingleKeyNodeFactory::createNode(const TileKey&    key,
         return 0L;
 
     _frame.sync();
-    
-    OE_START_TIMER(create_model);
 
-    osg::ref_ptr<TileModel> model[4];
-    for(unsigned q=0; q<4; ++q)
+    // An incremental update of tiles whose elevation data is still current
+    // (e.g. after an image layer change) keeps their geometry.
+    if ( !setupChildren && _options.incrementalUpdate() == true )
     {
+        osg::ref_ptr<osg::Group> quad = createLayerUpdate( key, progress );
+        if ( quad.valid() )
+            return quad.release();
+
         if ( progress && progress->isCanceled() )
             return 0L;
-        
-        TileKey child = key.createChildKey(q);
-        _modelFactory->createTileModel( child, _frame, accumulate, model[q], progress );
+    }
+
+    if ( _pipeline.valid() )
+    {
+        osg::ref_ptr<QuadJob> job = new QuadJob( this, key, accumulate, setupChildren );
+        return _pipeline->run( job.get(), progress );
+    }
+
+    osg::ref_ptr<TileModel> model[4];
+    if ( !createModels(key, accumulate, model, progress) )
+        return 0L;
+
+    return createQuad( key, model, setupChildren, progress );
+}
+
+
+bool
+SingleKeyNodeFactory::createModels(const TileKey&           key,
+                                   bool                     accumulate,
+                                   osg::ref_ptr<TileModel>* model,
+                                   ProgressCallback*        progress)
+{
+    OE_START_TIMER(create_model);
+
+    // build all four children together so their imagery can be fetched in batches.
+    std::vector<TileKey> childKeys;
+    for(unsigned q=0; q<4; ++q)
+        childKeys.push_back( key.createChildKey(q) );
+
+    std::vector< osg::ref_ptr<TileModel> > childModels;
+    _modelFactory->createTileModels( childKeys, _frame, accumulate, childModels, progress );
+
+    if ( progress && progress->isCanceled() )
+        return false;
+
+    for(unsigned q=0; q<4; ++q)
+    {
+        model[q] = childModels[q];
 
         // if any one of the TileModel creations fail, we will be unable to build
         // this quadtile. So goodbye.
         if ( !model[q].valid() )
         {
             OE_DEBUG << LC << "Bailed on key " << key.str() << " due to a NULL model." << std::endl;
-            return 0L;
+            return false;
         }
     }
 
     if (progress)
         progress->stats()["create_tilemodel_time"] += OE_STOP_TIMER(create_model);
 
+    return true;
+}
+
+
+osg::Node*
+SingleKeyNodeFactory::createQuad(const TileKey&           key,
+                                 osg::ref_ptr<TileModel>* model,
+                                 bool                     setupChildren,
+                                 ProgressCallback*        progress)
+{
     bool makeTile;
 
     // If this is a request for a root tile, make it no matter what.
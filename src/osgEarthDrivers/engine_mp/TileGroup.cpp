@@ -126,13 +126,17 @@ TileGroup::applyUpdate(osg::Node* node)
 
             osg::ref_ptr<TileNode> oldTileNode = 0L;
 
+            // A tile that shares GL objects with the one it replaces (a layer-only
+            // update) must not send the old one off for a GL release.
+            TileNodeRegistry* retired = newTileNode->getSharesGLObjects() ? 0L : _dead.get();
+
             TilePagedLOD* plod = dynamic_cast<TilePagedLOD*>(_children[i].get());
             if ( plod )
             {
                 oldTileNode = plod->getTileNode();
                 plod->setTileNode( newTileNode );
                 if ( _live.valid() )
-                    _live->move( oldTileNode.get(), _dead.get() );
+                    _live->move( oldTileNode.get(), retired );
             }
             else
             {
@@ -146,7 +150,7 @@ TileGroup::applyUpdate(osg::Node* node)
 
                 this->setChild( i, newTileNode );
                 if ( _live.valid() )
-                    _live->move( oldTileNode.get(), _dead.get() );
+                    _live->move( oldTileNode.get(), retired );
             }
 
             if ( _live.valid() )
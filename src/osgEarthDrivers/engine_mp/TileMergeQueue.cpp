@@ -0,0 +1,124 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "TileMergeQueue"
+#include "TilePagedLOD"
+#include <osg/Timer>
+#include <algorithm>
+
+using namespace osgEarth::Drivers::MPTerrainEngine;
+using namespace osgEarth;
+
+#define LC "[TileMergeQueue] "
+
+namespace
+{
+    struct Candidate
+    {
+        osg::ref_ptr<TilePagedLOD> _plod;
+        float                      _priority;
+
+        bool operator < (const Candidate& rhs) const {
+            return _priority > rhs._priority; // highest first
+        }
+    };
+}
+
+//----------------------------------------------------------------------------
+
+TileMergeQueue::TileMergeQueue() :
+_maxMerges   ( 0 ),
+_maxMergeTime( 0.0 )
+{
+    //nop
+}
+
+TileMergeQueue::~TileMergeQueue()
+{
+    //nop
+}
+
+void
+TileMergeQueue::add(TilePagedLOD* plod)
+{
+    if ( plod )
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        _queue.push_back( plod );
+    }
+}
+
+unsigned
+TileMergeQueue::size() const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    return _queue.size();
+}
+
+void
+TileMergeQueue::merge()
+{
+    // take a snapshot of the live entries, ranked by priority:
+    std::vector<Candidate> candidates;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        if ( _queue.empty() )
+            return;
+
+        candidates.reserve( _queue.size() );
+        for( Queue::iterator i = _queue.begin(); i != _queue.end(); ++i )
+        {
+            Candidate c;
+            if ( i->lock(c._plod) )
+            {
+                c._priority = c._plod->getMergePriority();
+                candidates.push_back( c );
+            }
+        }
+        _queue.clear();
+    }
+
+    std::sort( candidates.begin(), candidates.end() );
+
+    const osg::Timer* timer = osg::Timer::instance();
+    osg::Timer_t start = timer->tick();
+
+    unsigned merged = 0;
+    std::vector<Candidate>::iterator c = candidates.begin();
+    for( ; c != candidates.end(); ++c )
+    {
+        if ( _maxMerges > 0 && merged >= _maxMerges )
+            break;
+
+        if ( _maxMergeTime > 0.0 && merged > 0 && timer->delta_m(start, timer->tick()) >= _maxMergeTime )
+            break;
+
+        if ( c->_plod->mergePendingChild() )
+            ++merged;
+    }
+
+    // whatever didn't fit waits for the next frame:
+    if ( c != candidates.end() )
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        for( ; c != candidates.end(); ++c )
+            _queue.push_back( c->_plod.get() );
+
+        OE_DEBUG << LC << "Merged " << merged << ", deferred " << _queue.size() << std::endl;
+    }
+}
@@ -148,12 +148,37 @@ TileModel::ColorData::ColorData(const osgEarth::ImageLayer* layer,
                                 unsigned                    order,
                                 osg::Image*                 image,
                                 GeoLocator*                 locator,
-                                bool                        fallbackData) :
+                                bool                        fallbackData,
+                                TileTextureAtlas*           atlas,
+                                TileVirtualTexture::Tile*   virtualTile) :
 _layer       ( layer ),
 _order       ( order ),
 _locator     ( locator ),
-_fallbackData( fallbackData )
+_fallbackData( fallbackData ),
+_texRegion   ( 0, 0, 1, 1 )
 {
+    _hasAlpha = image && ImageUtils::hasTransparency(image);
+
+    // a virtual texture tile draws out of the shared physical texture.
+    if ( virtualTile )
+    {
+        _virtualTile = virtualTile;
+        _texture     = virtualTile->getTexture();
+        return;
+    }
+
+    // small images can share an atlas page instead of making a texture.
+    if ( atlas )
+    {
+        _atlasSlot = atlas->allocate( layer, image );
+        if ( _atlasSlot.valid() )
+        {
+            _texture   = _atlasSlot->getTexture();
+            _texRegion = _atlasSlot->getRegion();
+            return;
+        }
+    }
+
     osg::Texture::FilterMode minFilter = layer->getImageLayerOptions().minFilter().get();
     osg::Texture::FilterMode magFilter = layer->getImageLayerOptions().magFilter().get();
 
@@ -235,8 +260,6 @@ _fallbackData( fallbackData )
         }    
     }
 
-    _hasAlpha = image && ImageUtils::hasTransparency(image);
-
     layer->applyTextureCompressionMode( _texture.get() );    
 }
 
@@ -246,7 +269,10 @@ _locator     ( rhs._locator.get() ),
 _texture     ( rhs._texture.get() ),
 _fallbackData( rhs._fallbackData ),
 _order       ( rhs._order ),
-_hasAlpha    ( rhs._hasAlpha )
+_hasAlpha    ( rhs._hasAlpha ),
+_atlasSlot   ( rhs._atlasSlot.get() ),
+_texRegion   ( rhs._texRegion ),
+_virtualTile ( rhs._virtualTile.get() )
 {
     //nop
 }
@@ -274,6 +300,7 @@ TileModel::ColorData::releaseGLObjects(osg::State* state) const
 TileModel::TileModel(const TileModel& rhs) :
 _mapInfo         ( rhs._mapInfo ),
 _revision        ( rhs._revision ),
+_geometryRevision( rhs._geometryRevision ),
 _tileKey         ( rhs._tileKey ),
 _tileLocator     ( rhs._tileLocator.get() ),
 _colorData       ( rhs._colorData ),
@@ -18,6 +18,7 @@
 */
 #include "TileModelCompiler"
 #include "MPGeometry"
+#include "GeometryPool"
 
 #include <osgEarth/Locators>
 #include <osgEarth/Registry>
@@ -27,6 +28,9 @@
 #include <osgEarth/ImageUtils>
 #include <osgEarth/Utils>
 #include <osgEarth/ECEF>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <osgEarth/Profiler>
 #include <osgEarthSymbology/Geometry>
 #include <osgEarthSymbology/MeshConsolidator>
 
@@ -40,6 +44,10 @@
 #include <osgUtil/MeshOptimizers>
 #include <osgText/Text>
 
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Condition>
+#include <algorithm>
+
 using namespace osgEarth::Drivers::MPTerrainEngine;
 using namespace osgEarth;
 using namespace osgEarth::Drivers;
@@ -73,6 +81,17 @@ CompilerCache::TexCoordArrayCache::get(const osg::Vec4d& mat,
     return this->back().second;
 }
 
+bool
+CompilerCache::MaskGeometryKey::operator < (const CompilerCache::MaskGeometryKey& rhs) const
+{
+    if ( _tileKey < rhs._tileKey ) return true;
+    if ( rhs._tileKey < _tileKey ) return false;
+    if ( _cols != rhs._cols ) return _cols < rhs._cols;
+    if ( _rows != rhs._rows ) return _rows < rhs._rows;
+    if ( _elevationHash != rhs._elevationHash ) return _elevationHash < rhs._elevationHash;
+    return _boundaries < rhs._boundaries;
+}
+
 namespace
 {
     struct AllocateBufferObjectsVisitor : public osg::NodeVisitor
@@ -114,9 +133,13 @@ namespace
         osg::ref_ptr<const GeoLocator> _locator;
         osg::ref_ptr<osg::Vec2Array>   _texCoords;
         osg::ref_ptr<osg::Vec2Array>   _stitchTexCoords;
+        osg::Vec4f                     _texScaleBias;
         bool _ownsTexCoords;
+        bool _useTileCoords;
         RenderLayer() : 
-            _ownsTexCoords( false ) { }
+            _texScaleBias ( 0.0f, 0.0f, 1.0f, 1.0f ),
+            _ownsTexCoords( false ),
+            _useTileCoords( false ) { }
     };
 
     typedef std::vector< RenderLayer > RenderLayerVector;
@@ -126,17 +149,22 @@ namespace
     struct MaskRecord
     {
         osg::ref_ptr<osg::Vec3dArray> _boundary;
+        osg::ref_ptr<Polygon>         _local;     // boundary in tile-local coords
         osg::Vec3d                    _ndcMin, _ndcMax;
         osg::ref_ptr<MPGeometry>      _geom;
         osg::ref_ptr<osg::Vec3Array>  _internal;
 
-        MaskRecord(osg::Vec3dArray* boundary, osg::Vec3d& ndcMin, osg::Vec3d& ndcMax, MPGeometry* geom) 
-            : _boundary(boundary), _ndcMin(ndcMin), _ndcMax(ndcMax), _geom(geom), _internal(new osg::Vec3Array()) { }
+        MaskRecord(osg::Vec3dArray* boundary, Polygon* local, osg::Vec3d& ndcMin, osg::Vec3d& ndcMax, MPGeometry* geom) 
+            : _boundary(boundary), _local(local), _ndcMin(ndcMin), _ndcMax(ndcMax), _geom(geom), _internal(new osg::Vec3Array()) { }
     };
 
     typedef std::vector<MaskRecord> MaskRecordVector;
     typedef std::vector<int> Indices;
 
+    // Data::indices entry of a post that an adaptive tile leaves out; the
+    // skirts pass over it (unlike a missing or masked post, which ends them).
+    const int POST_DROPPED = -3;
+
 
     struct Data
     {
@@ -162,7 +190,13 @@ namespace
             renderTileCoords = 0L;
             ownsTileCoords   = false;
             stitchTileCoords = 0L;
+            maskCoversTile   = false;
             installParentData = false;
+            pool             = 0L;
+            shareElements    = false;
+            service          = 0L;
+            parallel         = false;
+            numAdaptivePosts = 0;
         }
 
         osg::Matrixd local2world, world2local;
@@ -200,6 +234,11 @@ namespace
         Indices                       indices;
         osg::BoundingSphere           surfaceBound;
 
+        // an adaptive tile's triangles (vertex indices) and the number of posts
+        // they use; empty for a regular grid.
+        std::vector<unsigned>         adaptiveTriangles;
+        unsigned                      numAdaptivePosts;
+
         // skirt data:
         unsigned                 numVerticesInSkirt;
         bool                     createSkirt;
@@ -216,8 +255,42 @@ namespace
         
         // for masking/stitching:
         MaskRecordVector         maskRecords;
+        bool                     maskCoversTile;                // a mask hides the whole tile
         //MPGeometry*              stitchGeom;
 
+        // recycled arrays and shared element buffers, if available:
+        GeometryPool*            pool;
+        bool                     shareElements;
+
+        // threads for splitting up the per-vertex work on large tiles:
+        TaskService*             service;
+        bool                     parallel;
+
+        osg::Vec2Array* newVec2Array(unsigned size) {
+            if ( pool ) return pool->createVec2Array(size);
+            osg::Vec2Array* a = new osg::Vec2Array();
+            a->reserve(size);
+            return a;
+        }
+        osg::Vec3Array* newVec3Array(unsigned size) {
+            if ( pool ) return pool->createVec3Array(size);
+            osg::Vec3Array* a = new osg::Vec3Array();
+            a->reserve(size);
+            return a;
+        }
+        osg::Vec4Array* newVec4Array(unsigned size) {
+            if ( pool ) return pool->createVec4Array(size);
+            osg::Vec4Array* a = new osg::Vec4Array();
+            a->reserve(size);
+            return a;
+        }
+        osg::FloatArray* newFloatArray(unsigned size) {
+            if ( pool ) return pool->createFloatArray(size);
+            osg::FloatArray* a = new osg::FloatArray();
+            a->reserve(size);
+            return a;
+        }
+
         bool useUInt;
         osg::DrawElements* newDrawElements(GLenum mode) {
             osg::DrawElements* de = 0L;
@@ -231,6 +304,78 @@ namespace
     };
 
 
+    enum MaskCoverage
+    {
+        MASK_MISSES_TILE,
+        MASK_CROSSES_TILE,
+        MASK_COVERS_TILE
+    };
+
+    inline double cross2D(const osg::Vec3d& o, const osg::Vec3d& a, const osg::Vec3d& b)
+    {
+        return (a.x()-o.x())*(b.y()-o.y()) - (a.y()-o.y())*(b.x()-o.x());
+    }
+
+    // true if segments p1p2 and q1q2 intersect or touch. Collinear cases
+    // fall back on an extent test, which errs toward "touching".
+    bool segmentsTouch(const osg::Vec3d& p1, const osg::Vec3d& p2, const osg::Vec3d& q1, const osg::Vec3d& q2)
+    {
+        double d1 = cross2D(q1, q2, p1);
+        double d2 = cross2D(q1, q2, p2);
+        double d3 = cross2D(p1, p2, q1);
+        double d4 = cross2D(p1, p2, q2);
+
+        if ( ((d1 > 0.0 && d2 < 0.0) || (d1 < 0.0 && d2 > 0.0)) &&
+             ((d3 > 0.0 && d4 < 0.0) || (d3 < 0.0 && d4 > 0.0)) )
+        {
+            return true;
+        }
+
+        if ( d1 == 0.0 || d2 == 0.0 || d3 == 0.0 || d4 == 0.0 )
+        {
+            return
+                std::min(p1.x(), p2.x()) <= std::max(q1.x(), q2.x()) &&
+                std::min(q1.x(), q2.x()) <= std::max(p1.x(), p2.x()) &&
+                std::min(p1.y(), p2.y()) <= std::max(q1.y(), q2.y()) &&
+                std::min(q1.y(), q2.y()) <= std::max(p1.y(), p2.y());
+        }
+
+        return false;
+    }
+
+    /**
+     * Classifies a tile-local mask polygon against the unit tile. The
+     * extent test in setupMaskRecord only says the boxes overlap; this
+     * tells whether the tile actually needs stitching.
+     */
+    MaskCoverage classifyMask(const Polygon* poly)
+    {
+        if ( poly->size() < 3 )
+            return MASK_MISSES_TILE;
+
+        for( Polygon::const_iterator p = poly->begin(); p != poly->end(); ++p )
+        {
+            if ( p->x() >= 0.0 && p->x() <= 1.0 && p->y() >= 0.0 && p->y() <= 1.0 )
+                return MASK_CROSSES_TILE;
+        }
+
+        const osg::Vec3d corners[4] = {
+            osg::Vec3d(0,0,0), osg::Vec3d(1,0,0), osg::Vec3d(1,1,0), osg::Vec3d(0,1,0) };
+
+        for( unsigned a = 0, b = poly->size()-1; a < poly->size(); b = a++ )
+        {
+            for( unsigned c = 0; c < 4; ++c )
+            {
+                if ( segmentsTouch((*poly)[a], (*poly)[b], corners[c], corners[(c+1)%4]) )
+                    return MASK_CROSSES_TILE;
+            }
+        }
+
+        // no vertex inside and no crossing edge: the tile is entirely on one side.
+        return poly->contains2D(0.5, 0.5) ? MASK_COVERS_TILE : MASK_MISSES_TILE;
+    }
+
+
     /**
      * Set up an single masking geometry. Called by setupMaskRecords
      */
@@ -270,9 +415,27 @@ namespace
 
             if (x_match && y_match)
             {
+                osg::ref_ptr<Polygon> local = new Polygon();
+                local->reserve( boundary->size() );
+                for (osg::Vec3dArray::iterator it = boundary->begin(); it != boundary->end(); ++it)
+                {
+                    osg::Vec3d p;
+                    d.geoLocator->convertModelToLocal(*it, p);
+                    local->push_back(p);
+                }
+
+                // A tile the polygon misses takes the unmasked path; one it
+                // covers is masked out without any triangulation.
+                MaskCoverage coverage = classifyMask( local.get() );
+                if ( coverage == MASK_MISSES_TILE )
+                    return;
+
+                if ( coverage == MASK_COVERS_TILE )
+                    d.maskCoversTile = true;
+
                 MPGeometry* stitchGeom = new MPGeometry( d.model->_tileKey, d.frame, d.textureImageUnit );
                 stitchGeom->setName("stitchGeom");
-                d.maskRecords.push_back( MaskRecord(boundary, min_ndc, max_ndc, stitchGeom) );
+                d.maskRecords.push_back( MaskRecord(boundary, local.get(), min_ndc, max_ndc, stitchGeom) );
             }
         }
     }
@@ -364,34 +527,29 @@ namespace
         d.numVerticesInSurface = d.numCols * d.numRows + d.numVerticesInSkirt;
 
         // allocate and assign vertices
-        d.surfaceVerts = new osg::Vec3Array();
-        d.surfaceVerts->reserve( d.numVerticesInSurface );
+        d.surfaceVerts = d.newVec3Array( d.numVerticesInSurface );
         d.surface->setVertexArray( d.surfaceVerts );
 
         // allocate and assign normals
-        d.normals = new osg::Vec3Array();
-        d.normals->reserve( d.numVerticesInSurface );
+        d.normals = d.newVec3Array( d.numVerticesInSurface );
         d.surface->setNormalArray( d.normals );
         d.surface->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
 
         // vertex attribution
         // for each vertex, a vec4 containing a unit extrusion vector in [0..2] and the raw elevation in [3]
-        d.surfaceAttribs = new osg::Vec4Array();
-        d.surfaceAttribs->reserve( d.numVerticesInSurface );
+        d.surfaceAttribs = d.newVec4Array( d.numVerticesInSurface );
         d.surface->setVertexAttribArray( osg::Drawable::ATTRIBUTE_6, d.surfaceAttribs );
         d.surface->setVertexAttribBinding( osg::Drawable::ATTRIBUTE_6, osg::Geometry::BIND_PER_VERTEX );
         d.surface->setVertexAttribNormalize( osg::Drawable::ATTRIBUTE_6, false );
 
         // for each vertex, index 0 holds the interpolated elevation from the lower lod (for morphing)
-        d.surfaceAttribs2 = new osg::Vec4Array();
-        d.surfaceAttribs2->reserve( d.numVerticesInSurface );
+        d.surfaceAttribs2 = d.newVec4Array( d.numVerticesInSurface );
         d.surface->setVertexAttribArray( osg::Drawable::ATTRIBUTE_7, d.surfaceAttribs2 );
         d.surface->setVertexAttribBinding( osg::Drawable::ATTRIBUTE_7, osg::Geometry::BIND_PER_VERTEX );
         d.surface->setVertexAttribNormalize( osg::Drawable::ATTRIBUTE_7, false );
         
         // temporary data structures for triangulation support
-        d.elevations = new osg::FloatArray();
-        d.elevations->reserve( d.numVerticesInSurface );
+        d.elevations = d.newFloatArray( d.numVerticesInSurface );
         d.indices.resize( d.numVerticesInSurface, -1 );
 
         // Uint required?
@@ -399,6 +557,154 @@ namespace
     }
 
 
+    /**
+     * Maps a layer's unit texture coordinates into the part of its texture
+     * that holds its image (which is all of it unless it's in an atlas).
+     */
+    inline osg::Vec2 toTextureRegion( const osg::Vec4f& region, double s, double t )
+    {
+        return osg::Vec2( region.x() + region.z()*s, region.y() + region.w()*t );
+    }
+
+    inline bool isFullTexture( const osg::Vec4f& region )
+    {
+        return region == osg::Vec4f(0.0f, 0.0f, 1.0f, 1.0f);
+    }
+
+    /**
+     * Scale/bias matrix of a texture region.
+     */
+    inline osg::Matrixd regionMatrix( const osg::Vec4f& region )
+    {
+        return
+            osg::Matrixd::scale( region.z(), region.w(), 1.0 ) *
+            osg::Matrixd::translate( region.x(), region.y(), 0.0 );
+    }
+
+#define MERC_MAX_LAT 85.084059050110383
+
+    // Mercator y of a latitude, in the units MercatorLocator uses.
+    inline double mercatorY( double lat )
+    {
+        double sin_lat = sin( osg::DegreesToRadians( osg::clampBetween(lat, -MERC_MAX_LAT, MERC_MAX_LAT) ) );
+        return 0.5 * log( (1.0+sin_lat) / (1.0-sin_lat) );
+    }
+
+    /**
+     * Parameters (lat0, latSpan, scale, bias) with which the terrain shader
+     * recomputes the t coordinate of a layer kept in its native Mercator
+     * profile for each fragment, as MercatorLocator does for each vertex.
+     * Zero if the layer needs no warp.
+     */
+    osg::Vec4f mercatorWarp( const TileModel* model, const TileModel::ColorData& color )
+    {
+        const GeoExtent& tile = model->_tileKey.getExtent();
+
+        if (dynamic_cast<const MercatorLocator*>( color.getLocator() ) == 0L ||
+            !tile.getSRS()->isGeographic() ||
+            tile.yMin() < -MERC_MAX_LAT ||
+            tile.yMax() >  MERC_MAX_LAT )
+        {
+            return osg::Vec4f(0.0f, 0.0f, 0.0f, 0.0f);
+        }
+
+        GeoExtent data = color.getLocator()->getDataExtent();
+        data = data.transform( data.getSRS()->getGeographicSRS() );
+
+        double ymin  = mercatorY( data.yMin() );
+        double yspan = mercatorY( data.yMax() ) - ymin;
+        if ( yspan <= 0.0 )
+        {
+            return osg::Vec4f(0.0f, 0.0f, 0.0f, 0.0f);
+        }
+
+        // the bias is relative to the tile's south edge, so that the shader
+        // only deals in differences and keeps its precision in deep tiles.
+        double scale = 1.0 / yspan;
+        double bias  = (mercatorY( tile.yMin() ) - ymin) / yspan;
+
+        const osg::Vec4f& region = color.getTextureRegion();
+
+        return osg::Vec4f(
+            osg::DegreesToRadians( tile.yMin() ),
+            osg::DegreesToRadians( tile.height() ),
+            region.w() * scale,
+            region.y() + region.w() * bias );
+    }
+
+    /**
+     * Scale/bias (s offset, t offset, s scale, t scale) that maps the tile's
+     * unit coordinates into the texture of a layer that fell back on an
+     * ancestor's data. With it the tile draws the ancestor's texture through
+     * the tile coordinates it already has, instead of a texture coordinate
+     * array of its own. Returns false if the layer has data of its own or
+     * can't be mapped that way.
+     */
+    bool fallbackScaleBias( const TileModel* model, const TileModel::ColorData& color, osg::Vec4f& out )
+    {
+        const GeoLocator* locator = color.getLocator();
+
+        // shared layers publish their texture coordinates to other shaders,
+        // and virtual texture pages move, so those keep the general path.
+        if (!color.isFallbackData()                     ||
+            !locator                                    ||
+            !locator->isLinear()                        ||
+            color.getVirtualTile()                      ||
+            !color.getMapLayer()                        ||
+            color.getMapLayer()->isShared()             ||
+            !locator->getDataExtent().getSRS()->isHorizEquivalentTo( model->_tileKey.getExtent().getSRS() ) )
+        {
+            return false;
+        }
+
+        const GeoExtent& locex = locator->getDataExtent();
+        const GeoExtent& keyex = model->_tileKey.getExtent();
+        if ( locex.width() <= 0.0 || locex.height() <= 0.0 )
+            return false;
+
+        double s0 = (keyex.xMin() - locex.xMin())/locex.width();
+        double t0 = (keyex.yMin() - locex.yMin())/locex.height();
+        double ss = keyex.width() / locex.width();
+        double ts = keyex.height() / locex.height();
+
+        // fold in the atlas region, if any.
+        const osg::Vec4f& region = color.getTextureRegion();
+        out.set(
+            region.x() + region.z()*s0,
+            region.y() + region.w()*t0,
+            region.z()*ss,
+            region.w()*ts );
+
+        return true;
+    }
+
+    /**
+     * Finds the color data to use for parent texture blending of a layer.
+     */
+    void getParentColorData( const TileModel*            parentModel,
+                             const TileModel::ColorData& layer,
+                             TileModel::ColorData&       out_layerParent )
+    {
+        if ( parentModel )
+        {                    
+            if (!parentModel->getColorData( layer.getUID(), out_layerParent ))
+            {
+                // If we can't get the color data from the parent that means it doesn't exist, perhaps b/c of a min level setting
+                // So we create a false layer parent with a transparent image so it will fade into the real data.
+                out_layerParent = layer;
+                out_layerParent._texture = new osg::Texture2D(ImageUtils::createEmptyImage());
+                out_layerParent._hasAlpha = true;
+                out_layerParent._atlasSlot = 0L;
+                out_layerParent._texRegion.set(0.0f, 0.0f, 1.0f, 1.0f);
+            }
+        }
+        else
+        {
+            out_layerParent = layer;
+        }
+    }
+
+
     /**
      * Generates the texture coordinate arrays for each layer.
      */
@@ -436,8 +742,7 @@ namespace
         d.renderTileCoords = tileCoords.get();
 
 #else // not USE_TEXCOORD_CACHE
-        d.renderTileCoords = new osg::Vec2Array();
-        d.renderTileCoords->reserve( d.numVerticesInSurface );
+        d.renderTileCoords = d.newVec2Array( d.numVerticesInSurface );
         d.ownsTileCoords = true;
 #endif
 
@@ -453,8 +758,15 @@ namespace
             const GeoLocator* locator = r._layer.getLocator();
             if ( locator )
             {
+                // a layer drawing an ancestor's texture reads it through the tile
+                // coordinates and a scale/bias, and needs no coordinates of its own.
+                if ( d.maskLayers.size() == 0 && fallbackScaleBias(d.model.get(), colorLayer, r._texScaleBias) )
+                {
+                    r._useTileCoords = true;
+                }
+
                 // if we have no mask records, we can use the texture coordinate array cache.
-                if ( d.maskLayers.size() == 0 && locator->isLinear() )
+                else if ( d.maskLayers.size() == 0 && locator->isLinear() )
                 {
                     const GeoExtent& locex = locator->getDataExtent();
                     const GeoExtent& keyex = d.model->_tileKey.getExtent();
@@ -465,6 +777,14 @@ namespace
                     mat[2] = (keyex.width() / locex.width());
                     mat[3] = (keyex.height() / locex.height());
 
+                    // fold in the atlas region, if any.
+                    const osg::Vec4f& region = colorLayer.getTextureRegion();
+                    mat.set(
+                        region.x() + region.z()*mat[0],
+                        region.y() + region.w()*mat[1],
+                        region.z()*mat[2],
+                        region.w()*mat[3] );
+
                     //OE_DEBUG << "key=" << d.model->_tileKey.str() << ": off=[" <<mat[0]<< ", " <<mat[1] << "] scale=["
                     //    << mat[2]<< ", " << mat[3] << "]" << std::endl;
 
@@ -481,8 +801,7 @@ namespace
                     r._texCoords = surfaceTexCoords.get();
 
 #else // not USE_TEXCOORD_CACHE
-                    r._texCoords = new osg::Vec2Array();
-                    r._texCoords->reserve( d.numVerticesInSurface );
+                    r._texCoords = d.newVec2Array( d.numVerticesInSurface );
                     r._ownsTexCoords = true;
 #endif
                 }
@@ -490,8 +809,7 @@ namespace
                 else
                 {
                     // cannot use the tex coord array cache if there are masking records.
-                    r._texCoords = new osg::Vec2Array();
-                    r._texCoords->reserve( d.numVerticesInSurface );
+                    r._texCoords = d.newVec2Array( d.numVerticesInSurface );
                     r._ownsTexCoords = true;
 
                     if ( d.maskRecords.size() > 0 )
@@ -510,205 +828,603 @@ namespace
                 // install the parent color data layer if necessary.
                 if ( d.installParentData )
                 {
-                    if ( d.parentModel.valid() )
-                    {                    
-                        if (!d.parentModel->getColorData( r._layer.getUID(), r._layerParent ))
+                    getParentColorData( d.parentModel.get(), r._layer, r._layerParent );
+                }
+
+                d.renderLayers.push_back( r );
+
+                // Note that we don't actually assign the tex coord arrays to the geometry yet.
+                // That must wait until the end. See the comments in assignTextureArrays()
+                // to understand why.
+            }
+            else
+            {
+                OE_WARN << LC << "Found a Locator, but it wasn't a GeoLocator." << std::endl;
+            }
+        }
+    }
+
+
+    /**
+     * A stage of the tile build that runs independently for each element of a
+     * range, so it can be split across threads.
+     */
+    struct RangeStage
+    {
+        virtual void run( unsigned begin, unsigned end ) =0;
+    };
+
+    // Splits a RangeStage into chunks. The calling thread and the pool tasks all
+    // claim chunks from the same counter, so the caller never waits on a task
+    // that is still queued; tasks that start after the work is gone just exit.
+    struct ParallelStage : public osg::Referenced
+    {
+        ParallelStage( RangeStage* stage, unsigned count, unsigned numChunks ) :
+            _stage    ( stage ),
+            _count    ( count ),
+            _numChunks( numChunks ),
+            _next     ( 0 ),
+            _numDone  ( 0 ) { }
+
+        bool runOne()
+        {
+            unsigned c = (++_next) - 1;
+            if ( c >= _numChunks )
+                return false;
+
+            _stage->run( (_count*c)/_numChunks, (_count*(c+1))/_numChunks );
+
+            if ( (unsigned)(++_numDone) == _numChunks )
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                _cond.broadcast();
+            }
+            return true;
+        }
+
+        void waitForAll()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            while( (unsigned)_numDone < _numChunks )
+                _cond.wait( &_mutex );
+        }
+
+        RangeStage*            _stage; // only touched while the caller waits
+        unsigned               _count;
+        unsigned               _numChunks;
+        OpenThreads::Atomic    _next;
+        OpenThreads::Atomic    _numDone;
+        Threading::Mutex       _mutex;
+        OpenThreads::Condition _cond;
+    };
+
+    struct ParallelStageTask : public TaskRequest
+    {
+        ParallelStageTask( ParallelStage* stage ) : _stage(stage) { }
+
+        void operator()( ProgressCallback* progress )
+        {
+            while( _stage->runOne() );
+        }
+
+        osg::ref_ptr<ParallelStage> _stage;
+    };
+
+    /**
+     * Runs a stage over [0, count), in parallel if the tile is large enough.
+     */
+    void runStage( Data& d, RangeStage& stage, unsigned count )
+    {
+        if ( d.parallel && count > 1 )
+        {
+            unsigned numTasks  = d.service->getNumThreads();
+            unsigned numChunks = std::min( count, 4 * (numTasks + 1) );
+
+            osg::ref_ptr<ParallelStage> ps = new ParallelStage( &stage, count, numChunks );
+            for( unsigned i=0; i<numTasks; ++i )
+                d.service->add( new ParallelStageTask(ps.get()) );
+
+            while( ps->runOne() );
+            ps->waitForAll();
+        }
+        else
+        {
+            stage.run( 0, count );
+        }
+    }
+
+    // Samples the raw height at each post of the grid.
+    struct SampleHeightsStage : public RangeStage
+    {
+        Data&               _d;
+        std::vector<float>& _heights;
+        std::vector<char>&  _valid;
+
+        SampleHeightsStage( Data& d, std::vector<float>& heights, std::vector<char>& valid )
+            : _d(d), _heights(heights), _valid(valid) { }
+
+        void run( unsigned begin, unsigned end )
+        {
+            osg::HeightField* hf = _d.model->_elevationData.getHeightField();
+
+            for( unsigned iv=begin; iv<end; ++iv )
+            {
+                unsigned i = iv % _d.numCols;
+                unsigned j = iv / _d.numCols;
+                osg::Vec3d ndc( ((double)i)/(double)(_d.numCols-1), ((double)j)/(double)(_d.numRows-1), 0.0);
+
+                float heightValue = 0.0f;
+                bool  validValue  = true;
+
+                if ( hf )
+                {
+                    validValue = _d.model->_elevationData.getHeight( ndc, _d.model->_tileLocator, heightValue, INTERP_TRIANGULATE );
+                }
+
+                _heights[iv] = heightValue;
+                _valid[iv]   = validValue ? 1 : 0;
+            }
+        }
+    };
+
+    // Computes the position, up vector, texture coordinates and attributes of
+    // each surface vertex; the arrays are already sized.
+    struct BuildVerticesStage : public RangeStage
+    {
+        Data&                          _d;
+        const std::vector<osg::Vec3d>& _ndcs;
+        const std::vector<float>&      _heights;
+
+        BuildVerticesStage( Data& d, const std::vector<osg::Vec3d>& ndcs, const std::vector<float>& heights )
+            : _d(d), _ndcs(ndcs), _heights(heights) { }
+
+        void run( unsigned begin, unsigned end )
+        {
+            Data& d = _d;
+
+            // Calculate and store the "old height", i.e the height value from
+            // the parent LOD. This only works if the tile size is an odd number
+            // in both directions.
+            bool useParent =
+                d.model->_tileKey.getLOD() > 0 && (d.numCols&1) && (d.numRows&1) && d.parentModel.valid();
+
+            for( unsigned v=begin; v<end; ++v )
+            {
+                const osg::Vec3d& ndc = _ndcs[v];
+                float heightValue = _heights[v];
+
+                osg::Vec3d model;
+                d.model->_tileLocator->unitToModel( ndc, model );
+                osg::Vec3d modelLTP = model * d.world2local;
+                (*d.surfaceVerts)[v] = modelLTP;
+
+                // the separate texture space requires separate transformed texcoords for each layer.
+                for( RenderLayerVector::const_iterator r = d.renderLayers.begin(); r != d.renderLayers.end(); ++r )
+                {
+                    if ( r->_ownsTexCoords )
+                    {
+                        const osg::Vec4f& region = r->_layer.getTextureRegion();
+                        if ( !r->_locator->isEquivalentTo( *d.geoLocator.get() ) )
+                        {
+                            osg::Vec3d color_ndc;
+                            osgTerrain::Locator::convertLocalCoordBetween( *d.geoLocator.get(), ndc, *r->_locator.get(), color_ndc );
+                            (*r->_texCoords)[v] = toTextureRegion( region, color_ndc.x(), color_ndc.y() );
+                        }
+                        else
                         {
-                            // If we can't get the color data from the parent that means it doesn't exist, perhaps b/c of a min level setting
-                            // So we create a false layer parent with a transparent image so it will fade into the real data.
-                            r._layerParent = r._layer;
-                            r._layerParent._texture = new osg::Texture2D(ImageUtils::createEmptyImage());
-                            r._layerParent._hasAlpha = true;
+                            (*r->_texCoords)[v] = toTextureRegion( region, ndc.x(), ndc.y() );
                         }
                     }
-                    else
+                }
+
+                if ( d.ownsTileCoords )
+                {
+                    (*d.renderTileCoords)[v].set( ndc.x(), ndc.y() );
+                }
+
+                // record the raw elevation value in our float array for later
+                (*d.elevations)[v] = ndc.z();
+
+                // compute the local normal (up vector)
+                osg::Vec3d ndc_plus_one(ndc.x(), ndc.y(), ndc.z() + 1.0);
+                osg::Vec3d model_up;
+                d.model->_tileLocator->unitToModel(ndc_plus_one, model_up);
+                model_up = (model_up*d.world2local) - modelLTP;
+                model_up.normalize();
+                (*d.normals)[v] = model_up;
+
+                float     oldHeightValue = heightValue;
+                osg::Vec3 oldNormal;
+
+                if ( useParent )
+                {
+                    d.parentModel->_elevationData.getHeight( ndc, d.model->_tileLocator.get(), oldHeightValue, INTERP_TRIANGULATE );
+                    d.parentModel->_elevationData.getNormal( ndc, d.model->_tileLocator.get(), oldNormal, INTERP_TRIANGULATE );
+                }
+                else
+                {
+                    d.model->_elevationData.getNormal(ndc, d.model->_tileLocator.get(), oldNormal, INTERP_TRIANGULATE );
+                }
+
+                // first attribute set has the unit extrusion vector and the
+                // raw height value.
+                (*d.surfaceAttribs)[v].set(
+                    model_up.x(),
+                    model_up.y(),
+                    model_up.z(),
+                    heightValue );
+
+                // second attribute set has the old height value in "w"
+                (*d.surfaceAttribs2)[v].set(
+                    oldNormal.x(),
+                    oldNormal.y(),
+                    oldNormal.z(),
+                    oldHeightValue );
+            }
+        }
+    };
+
+
+    /**
+     * Iterate over the sampling grid and calculate the vertex positions and normals
+     * for each sampling point. The sampling and the per-vertex work run as
+     * stages (see runStage); only the vertex numbering is serial.
+     */
+    void createSurfaceGeometry( Data& d )
+    {
+        d.surfaceBound.init();
+
+        unsigned numPosts = d.numCols * d.numRows;
+
+        // sample the raw heights:
+        std::vector<float> postHeights( numPosts );
+        std::vector<char>  postValid  ( numPosts );
+        SampleHeightsStage sampleHeights( d, postHeights, postValid );
+        runStage( d, sampleHeights, numPosts );
+
+        // the union of the masks' bounding boxes:
+        double minndcx = 0.0, minndcy = 0.0, maxndcx = 0.0, maxndcy = 0.0;
+        if ( d.maskRecords.size() > 0 )
+        {
+            minndcx = d.maskRecords[0]._ndcMin.x();
+            minndcy = d.maskRecords[0]._ndcMin.y();
+            maxndcx = d.maskRecords[0]._ndcMax.x();
+            maxndcy = d.maskRecords[0]._ndcMax.y();
+            for (unsigned mrs = 1; mrs < d.maskRecords.size(); ++mrs)
+            {
+                minndcx = std::min( minndcx, d.maskRecords[mrs]._ndcMin.x() );
+                minndcy = std::min( minndcy, d.maskRecords[mrs]._ndcMin.y() );
+                maxndcx = std::max( maxndcx, d.maskRecords[mrs]._ndcMax.x() );
+                maxndcy = std::max( maxndcy, d.maskRecords[mrs]._ndcMax.y() );
+            }
+        }
+
+        // number the vertices that survive:
+        std::vector<osg::Vec3d> ndcs;
+        std::vector<float>      heights;
+        ndcs.reserve( numPosts );
+        heights.reserve( numPosts );
+
+        for(unsigned j=0; j < d.numRows; ++j)
+        {
+            for(unsigned i=0; i < d.numCols; ++i)
+            {
+                unsigned int iv = j*d.numCols + i;
+                osg::Vec3d ndc( ((double)i)/(double)(d.numCols-1), ((double)j)/(double)(d.numRows-1), 0.0);
+
+                float heightValue = postHeights[iv];
+                bool  validValue  = postValid[iv] != 0;
+
+                ndc.z() = heightValue * d.heightScale + d.heightOffset;
+
+                if ( !validValue )
+                {
+                    d.indices[iv] = -1;
+                }
+
+                // First check whether the sampling point falls within a mask's bounding box.
+                // If so, skip the sampling and mark it as a mask location
+                if ( validValue && d.maskRecords.size() > 0 )
+                {
+                    if(ndc.x() >= (minndcx) && ndc.x() <= (maxndcx) &&
+                       ndc.y() >= (minndcy) && ndc.y() <= (maxndcy))
                     {
-                        r._layerParent = r._layer;
+                        validValue = false;
+                        d.indices[iv] = -2;
                     }
                 }
 
-                d.renderLayers.push_back( r );
+                if ( validValue )
+                {
+                    d.indices[iv] = ndcs.size();
+                    ndcs.push_back( ndc );
+                    heights.push_back( heightValue );
+                }
+            }
+        }
 
-                // Note that we don't actually assign the tex coord arrays to the geometry yet.
-                // That must wait until the end. See the comments in assignTextureArrays()
-                // to understand why.
+        // size the arrays, then fill them in:
+        unsigned numVerts = ndcs.size();
+        d.surfaceVerts->resize( numVerts );
+        d.normals->resize( numVerts );
+        d.surfaceAttribs->resize( numVerts );
+        d.surfaceAttribs2->resize( numVerts );
+        d.elevations->resize( numVerts );
+
+        for( RenderLayerVector::const_iterator r = d.renderLayers.begin(); r != d.renderLayers.end(); ++r )
+        {
+            if ( r->_ownsTexCoords )
+                r->_texCoords->resize( numVerts );
+        }
+
+        if ( d.ownsTileCoords )
+        {
+            d.renderTileCoords->resize( numVerts );
+        }
+
+        BuildVerticesStage buildVertices( d, ndcs, heights );
+        runStage( d, buildVertices, numVerts );
+
+        // grow the bounding sphere:
+        for( unsigned v=0; v<numVerts; ++v )
+        {
+            d.surfaceBound.expandBy( (*d.surfaceVerts)[v] );
+        }
+    }
+
+
+    /**
+     * Emits the right triangle (a, b, c), with its right angle at c, or its two
+     * halves if the post in the middle of its long edge is out of tolerance.
+     */
+    void addRTINTriangle(const std::vector<float>& errors, unsigned size, float maxError,
+                         unsigned ax, unsigned ay, unsigned bx, unsigned by, unsigned cx, unsigned cy,
+                         std::vector<unsigned>& out)
+    {
+        unsigned mx = (ax + bx) >> 1;
+        unsigned my = (ay + by) >> 1;
+
+        unsigned legs = (ax > cx ? ax-cx : cx-ax) + (ay > cy ? ay-cy : cy-ay);
+
+        if ( legs > 1 && errors[my*size + mx] > maxError )
+        {
+            addRTINTriangle( errors, size, maxError, cx, cy, ax, ay, mx, my, out );
+            addRTINTriangle( errors, size, maxError, bx, by, cx, cy, mx, my, out );
+        }
+        else
+        {
+            out.push_back( ay*size + ax );
+            out.push_back( by*size + bx );
+            out.push_back( cy*size + cx );
+        }
+    }
+
+    /**
+     * Packs the entries of a per-vertex array that an adaptive tile keeps.
+     */
+    template<typename ARRAY>
+    void packVertexArray( ARRAY* a, const std::vector<int>& remap, unsigned numKept )
+    {
+        for( unsigned v=0; v<remap.size(); ++v )
+        {
+            if ( remap[v] >= 0 )
+                (*a)[remap[v]] = (*a)[v];
+        }
+        a->resize( numKept );
+    }
+
+    /**
+     * Thins the grid of an unmasked 2^n+1 tile into a right-triangulated
+     * irregular network (RTIN): starting from the tile's two halves, a right
+     * triangle is split at the middle of its long edge only if the vertex there
+     * lies further than maxError from that edge. Each post's error is the most
+     * of its own and those of the posts below it in the hierarchy, so a split
+     * always splits the neighbor across the long edge too and the mesh has no
+     * T-junctions. The posts no triangle uses are dropped from the vertex
+     * arrays; the triangles go in d.adaptiveTriangles.
+     */
+    void simplifySurfaceGeometry( Data& d, float maxError )
+    {
+        const unsigned size     = d.numCols;
+        const unsigned n        = size-1;
+        const unsigned numPosts = size*size;
+
+        if (d.numRows != size || n < 2 || (n & (n-1)) != 0 ||
+            d.maskRecords.size() > 0 ||
+            d.surfaceVerts->size() != numPosts ||
+            !d.ownsTileCoords )
+        {
+            return;
+        }
+
+        for( RenderLayerVector::const_iterator r = d.renderLayers.begin(); r != d.renderLayers.end(); ++r )
+        {
+            if ( !r->_ownsTexCoords && !r->_useTileCoords )
+                return;
+        }
+
+        const osg::Vec3Array& verts = *d.surfaceVerts;
+
+        // error of each post: the distance of its vertex from the middle of the
+        // long edge it splits. Measured in the tile's local frame, so that the
+        // curvature of the globe counts as well as the relief.
+        std::vector<float> errors( numPosts, 0.0f );
+
+        // without skirts nothing hides a seam, so every edge post stays and
+        // each neighbor meets the tile at the same vertices.
+        if ( !d.createSkirt )
+        {
+            for( unsigned k=0; k<size; ++k )
+            {
+                errors[k] = errors[n*size + k] = errors[k*size] = errors[k*size + n] = FLT_MAX;
+            }
+        }
+
+        // triangle i (id i+2) has children 2*id and 2*id+1; walk them bottom-up.
+        const unsigned numTriangles       = n*n*2 - 2;
+        const unsigned numParentTriangles = numTriangles - n*n;
+
+        for( int i = (int)numTriangles-1; i >= 0; --i )
+        {
+            unsigned id = i + 2;
+            unsigned ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+            if ( id & 1 )
+            {
+                bx = by = cx = n;
             }
             else
             {
-                OE_WARN << LC << "Found a Locator, but it wasn't a GeoLocator." << std::endl;
+                ax = ay = cy = n;
+            }
+            while ( (id >>= 1) > 1 )
+            {
+                unsigned mx = (ax + bx) >> 1;
+                unsigned my = (ay + by) >> 1;
+                if ( id & 1 )
+                {
+                    bx = ax; by = ay;
+                    ax = cx; ay = cy;
+                }
+                else
+                {
+                    ax = bx; ay = by;
+                    bx = cx; by = cy;
+                }
+                cx = mx; cy = my;
+            }
+
+            unsigned mx = (ax + bx) >> 1;
+            unsigned my = (ay + by) >> 1;
+            unsigned middle = my*size + mx;
+
+            osg::Vec3f edgeMiddle = (verts[ay*size + ax] + verts[by*size + bx]) * 0.5f;
+            float error = std::max( errors[middle], (verts[middle] - edgeMiddle).length() );
+
+            if ( (unsigned)i < numParentTriangles )
+            {
+                unsigned rx = mx + my - ay;
+                unsigned ry = my + ax - mx;
+                error = std::max( error, errors[((ay + ry) >> 1)*size + ((ax + rx) >> 1)] );
+                error = std::max( error, errors[((by + ry) >> 1)*size + ((bx + rx) >> 1)] );
             }
+            errors[middle] = error;
         }
-    }
 
+        std::vector<unsigned> triangles;
+        addRTINTriangle( errors, size, maxError, 0, 0, n, n, n, 0, triangles );
+        addRTINTriangle( errors, size, maxError, n, n, 0, 0, 0, n, triangles );
 
-    /**
-     * Iterate over the sampling grid and calculate the vertex positions and normals
-     * for each sampling point.
-     */
-    void createSurfaceGeometry( Data& d )
-    {
-        d.surfaceBound.init();
+        // number the posts the triangles use, in grid order.
+        std::vector<int> remap( numPosts, -1 );
+        for( unsigned t=0; t<triangles.size(); ++t )
+            remap[triangles[t]] = 0;
 
-        //osgTerrain::HeightFieldLayer* elevationLayer = d.model->_elevationData.getHFLayer();
+        unsigned numKept = 0;
+        for( unsigned v=0; v<numPosts; ++v )
+        {
+            if ( remap[v] == 0 )
+                remap[v] = numKept++;
+        }
 
-        osg::HeightField* hf            = d.model->_elevationData.getHeightField();
-        GeoLocator*       hfLocator     = d.model->_elevationData.getLocator();
+        // nothing to drop: stay a regular grid, which can share its buffers.
+        if ( numKept == numPosts )
+            return;
 
-        // populate vertex and tex coord arrays    
-        for(unsigned j=0; j < d.numRows; ++j)
-        {
-            for(unsigned i=0; i < d.numCols; ++i)
-            {
-                unsigned int iv = j*d.numCols + i;
-                osg::Vec3d ndc( ((double)i)/(double)(d.numCols-1), ((double)j)/(double)(d.numRows-1), 0.0);
+        // same winding as the grid triangles.
+        bool swapOrientation = !(d.model->_tileLocator->orientationOpenGL());
 
-                // raw height:
-                float heightValue = 0.0f;
-                bool  validValue  = true;
+        int s = (int)size;
 
-                if ( hf )
-                {
-                    validValue = d.model->_elevationData.getHeight( ndc, d.model->_tileLocator, heightValue, INTERP_TRIANGULATE );
-                }
+        d.adaptiveTriangles.reserve( triangles.size() );
+        for( unsigned t=0; t+2<triangles.size(); t+=3 )
+        {
+            int i0 = triangles[t], i1 = triangles[t+1], i2 = triangles[t+2];
+            int cross =
+                (i1%s - i0%s) * (i2/s - i0/s) -
+                (i1/s - i0/s) * (i2%s - i0%s);
+            if ( (cross > 0) == swapOrientation )
+                std::swap( i1, i2 );
+
+            d.adaptiveTriangles.push_back( remap[i0] );
+            d.adaptiveTriangles.push_back( remap[i1] );
+            d.adaptiveTriangles.push_back( remap[i2] );
+        }
 
-                ndc.z() = heightValue * d.heightScale + d.heightOffset;
+        packVertexArray( d.surfaceVerts,           remap, numKept );
+        packVertexArray( d.normals,                remap, numKept );
+        packVertexArray( d.surfaceAttribs,         remap, numKept );
+        packVertexArray( d.surfaceAttribs2,        remap, numKept );
+        packVertexArray( d.elevations.get(),       remap, numKept );
+        packVertexArray( d.renderTileCoords.get(), remap, numKept );
 
-                if ( !validValue )
-                {
-                    d.indices[iv] = -1;
-                }
+        for( RenderLayerVector::iterator r = d.renderLayers.begin(); r != d.renderLayers.end(); ++r )
+        {
+            if ( r->_ownsTexCoords )
+                packVertexArray( r->_texCoords.get(), remap, numKept );
+        }
 
-                // First check whether the sampling point falls within a mask's bounding box.
-                // If so, skip the sampling and mark it as a mask location
-                if ( validValue && d.maskRecords.size() > 0 )
-                {
-					double minndcx = d.maskRecords[0]._ndcMin.x();
-					double minndcy = d.maskRecords[0]._ndcMin.y();
-					double maxndcx = d.maskRecords[0]._ndcMax.x();
-					double maxndcy = d.maskRecords[0]._ndcMax.y();
-					for (int mrs = 1; mrs < d.maskRecords.size(); ++mrs)
-					{
-						if ( d.maskRecords[mrs]._ndcMin.x()< minndcx)
-						{
-							minndcx = d.maskRecords[mrs]._ndcMin.x();
-						}
-						if ( d.maskRecords[mrs]._ndcMin.y()< minndcy)
-						{
-							minndcy = d.maskRecords[mrs]._ndcMin.y();
-						}
-						if ( d.maskRecords[mrs]._ndcMax.x()> maxndcx)
-						{
-							maxndcx = d.maskRecords[mrs]._ndcMax.x();
-						}
-						if ( d.maskRecords[mrs]._ndcMax.y()> maxndcy)
-						{
-							maxndcy = d.maskRecords[mrs]._ndcMax.y();
-						}
-
-
-					}
-					if(ndc.x() >= (minndcx) && ndc.x() <= (maxndcx) &&
-						        ndc.y() >= (minndcy) && ndc.y() <= (maxndcy))
-				    {
-				        validValue = false;
-				        d.indices[iv] = -2;
-				    
-				    }
-                }
-                
-                if ( validValue )
-                {
-                    d.indices[iv] = d.surfaceVerts->size();
+        for( unsigned v=0; v<numPosts; ++v )
+        {
+            d.indices[v] = remap[v] >= 0 ? remap[v] : POST_DROPPED;
+        }
 
-                    osg::Vec3d model;
-                    d.model->_tileLocator->unitToModel( ndc, model );
-                    osg::Vec3d modelLTP = model * d.world2local;
-                    (*d.surfaceVerts).push_back(modelLTP);
+        d.numAdaptivePosts = numKept;
+    }
 
-                    // grow the bounding sphere:
-                    d.surfaceBound.expandBy( (*d.surfaceVerts).back() );
 
-                    // the separate texture space requires separate transformed texcoords for each layer.
-                    for( RenderLayerVector::const_iterator r = d.renderLayers.begin(); r != d.renderLayers.end(); ++r )
-                    {
-                        if ( r->_ownsTexCoords )
-                        {
-                            if ( !r->_locator->isEquivalentTo( *d.geoLocator.get() ) )
-                            {
-                                osg::Vec3d color_ndc;
-                                osgTerrain::Locator::convertLocalCoordBetween( *d.geoLocator.get(), ndc, *r->_locator.get(), color_ndc );
-                                r->_texCoords->push_back( osg::Vec2( color_ndc.x(), color_ndc.y() ) );
-                            }
-                            else
-                            {
-                                r->_texCoords->push_back( osg::Vec2( ndc.x(), ndc.y() ) );
-                            }
-                        }
-                    }
+    /**
+     * Flags the grid posts in the masking bounding box that lie strictly inside
+     * a mask polygon. They would only feed triangles that removeInternalTriangles
+     * throws away, so leaving them out keeps the triangulation proportional to
+     * the stitched area rather than the masked one. One scanline per grid row.
+     */
+    void flagInternalPosts(const Polygon* poly, int min_i, int min_j, int num_i, int num_j,
+                           const Data& d, std::vector<char>& dropped)
+    {
+        std::vector<double> xs;
+        for (int j = 0; j < num_j; ++j)
+        {
+            double y = ((double)(j+min_j))/(double)(d.numRows-1);
 
-                    if ( d.ownsTileCoords )
-                    {
-                        d.renderTileCoords->push_back( osg::Vec2(ndc.x(), ndc.y()) );
-                    }
+            xs.clear();
+            for (unsigned a = 0, b = poly->size()-1; a < poly->size(); b = a++)
+            {
+                const osg::Vec3d& p = (*poly)[a];
+                const osg::Vec3d& q = (*poly)[b];
+                if ( (p.y() <= y && y < q.y()) || (q.y() <= y && y < p.y()) )
+                    xs.push_back( p.x() + (y-p.y()) * (q.x()-p.x()) / (q.y()-p.y()) );
+            }
 
-                    // record the raw elevation value in our float array for later
-                    (*d.elevations).push_back(ndc.z());
+            if ( xs.size() < 2 )
+                continue;
 
-                    // compute the local normal (up vector)
-                    osg::Vec3d ndc_plus_one(ndc.x(), ndc.y(), ndc.z() + 1.0);
-                    osg::Vec3d model_up;
-                    d.model->_tileLocator->unitToModel(ndc_plus_one, model_up);
-                    model_up = (model_up*d.world2local) - modelLTP;
-                    model_up.normalize();
-                    (*d.normals).push_back(model_up);
+            std::sort( xs.begin(), xs.end() );
 
-                    // Calculate and store the "old height", i.e the height value from
-                    // the parent LOD.
-                    float     oldHeightValue = heightValue;
-                    osg::Vec3 oldNormal;
+            for (int i = 0; i < num_i; ++i)
+            {
+                double x = ((double)(i+min_i))/(double)(d.numCols-1);
 
-                    // This only works if the tile size is an odd number in both directions.
-                    if (d.model->_tileKey.getLOD() > 0 && (d.numCols&1) && (d.numRows&1) && d.parentModel.valid())
-                    {
-                        d.parentModel->_elevationData.getHeight( ndc, d.model->_tileLocator.get(), oldHeightValue, INTERP_TRIANGULATE );
-                        d.parentModel->_elevationData.getNormal( ndc, d.model->_tileLocator.get(), oldNormal, INTERP_TRIANGULATE );
-                    }
-                    else
-                    {
-                        d.model->_elevationData.getNormal(ndc, d.model->_tileLocator.get(), oldNormal, INTERP_TRIANGULATE );
-                    }
+                // inside if an odd number of crossings lie to the left; posts on
+                // the boundary itself stay, since they may anchor a constraint.
+                unsigned left = std::lower_bound( xs.begin(), xs.end(), x ) - xs.begin();
+                if ( (left & 1u) == 0u )
+                    continue;
+                if ( x - xs[left-1] < MATCH_TOLERANCE || (left < xs.size() && xs[left] - x < MATCH_TOLERANCE) )
+                    continue;
 
-                    // first attribute set has the unit extrusion vector and the
-                    // raw height value.
-                    (*d.surfaceAttribs).push_back( osg::Vec4f(
-                        model_up.x(),
-                        model_up.y(),
-                        model_up.z(),
-                        heightValue) );
-
-                    // second attribute set has the old height value in "w"
-                    (*d.surfaceAttribs2).push_back( osg::Vec4f(
-                        oldNormal.x(),
-                        oldNormal.y(),
-                        oldNormal.z(),
-                        oldHeightValue ) );
-                }
+                dropped[j*num_i + i] = 1;
             }
         }
-
-        //if ( d.renderLayers[0]._texCoords->size() < d.surfaceVerts->size() )
-        //{
-        //    OE_WARN << LC << "not good. mask error." << std::endl;
-        //}
     }
 
 
     /**
-     * If there are masking records, calculate the vertices to bound the masked area
-     * and the internal verticies to populate it. Then build a triangulation of the
-     * area inside the masking bounding box and add this to the surface geode.
+     * Calculates the vertices that bound the masked area and the internal
+     * vertices that populate it, then triangulates the area inside the masking
+     * bounding box. Outputs the points in tile-local coordinates and the
+     * triangles that index them; returns false if there is nothing to build.
      */
-    void createMaskGeometry( Data& d )
+    bool triangulateMask( Data& d, osg::ref_ptr<osg::Vec3Array>& points, osg::ref_ptr<osg::DrawElementsUInt>& triangles )
     {
         bool hasElev = d.model->hasElevation();
 
@@ -828,6 +1544,13 @@ namespace
                 }
             }
 
+            // posts to leave out of the triangulation, indexed like coordsArray:
+            std::vector<char> dropped( num_i * num_j, 0 );
+            for (MaskRecordVector::iterator mr = d.maskRecords.begin();mr != d.maskRecords.end();mr++)
+            {
+                flagInternalPosts( mr->_local.get(), min_i, min_j, num_i, num_j, d, dropped );
+            }
+
             for (int j = 0; j < num_j; j++)
             {
                 for (int i = 0; i < num_i; i++)
@@ -837,7 +1560,7 @@ namespace
                         osg::Vec3d ndc( ((double)(i + min_i))/(double)(d.numCols-1), ((double)(j+min_j))/(double)(d.numRows-1), 0.0);
 
                         //if (elevationLayer)
-                        if ( hasElev )
+                        if ( hasElev && !dropped[j*num_i + i] )
                         {
                             float value = 0.0f;
                             if ( d.model->_elevationData.getHeight( ndc, d.model->_tileLocator.get(), value, INTERP_BILINEAR ) )
@@ -856,14 +1579,8 @@ namespace
 
                 // Add the outter stitching bounds to the collection of vertices to be used for triangulation
                 //	coordsArray->insert(coordsArray->end(), (*mr)._internal->begin(), (*mr)._internal->end());
-                //Create local polygon representing mask
-                osg::ref_ptr<Polygon> maskPoly = new Polygon();
-                for (osg::Vec3dArray::iterator it = (*mr)._boundary->begin(); it != (*mr)._boundary->end(); ++it)
-                {
-                    osg::Vec3d local;
-                    d.geoLocator->convertModelToLocal(*it, local);
-                    maskPoly->push_back(local);
-                }
+                //Local polygon representing mask
+                Polygon* maskPoly = (*mr)._local.get();
                 // Add mask bounds as a triangulation constraint
 
                 osg::ref_ptr<osgUtil::DelaunayConstraint> newdc=new osgUtil::DelaunayConstraint;
@@ -873,6 +1590,8 @@ namespace
                 //Crop the mask to the stitching poly (for case where mask crosses tile edge)
                 osg::ref_ptr<Geometry> maskCrop;
                 maskPoly->crop(maskSkirtPoly.get(), maskCrop);
+                if ( !maskCrop.valid() )
+                    continue;
 
                 GeometryIterator i( maskCrop.get(), false );
                 while( i.hasMore() )
@@ -903,15 +1622,11 @@ namespace
                             (*it).z() = (*mit).z();
                             zSet += 1;
 
-                            // Remove duplicate point from coordsArray to avoid duplicate point warnings
-                            osg::Vec3Array::iterator caIt;
-                            for (caIt = coordsArray->begin(); caIt != coordsArray->end(); ++caIt)
-                            {
-                                if (osg::absolute((*caIt).x() - (*it).x()) < MATCH_TOLERANCE && osg::absolute((*caIt).y() - (*it).y()) < MATCH_TOLERANCE)
-                                    break;
-                            }
-                            if (caIt != coordsArray->end())
-                                coordsArray->erase(caIt);
+                            // Skirt verts are grid posts; drop the duplicate post to avoid duplicate point warnings
+                            int ci = (int)floor((*it).x() * (double)(d.numCols-1) + 0.5) - min_i;
+                            int cj = (int)floor((*it).y() * (double)(d.numRows-1) + 0.5) - min_j;
+                            if (ci >= 0 && ci < num_i && cj >= 0 && cj < num_j)
+                                dropped[cj*num_i + ci] = 1;
 
                             break;
                         }
@@ -1013,6 +1728,15 @@ namespace
             }
 
 
+            // compact the posts that survived:
+            unsigned kept = 0;
+            for (unsigned k = 0; k < coordsArray->size(); ++k)
+            {
+                if ( !dropped[k] )
+                    (*coordsArray)[kept++] = (*coordsArray)[k];
+            }
+            coordsArray->resize( kept );
+
             //coordsArray->insert(coordsArray->end(),maskSkirtPoly->begin(),maskSkirtPoly->end());
             trig->setInputPointArray(coordsArray.get());
 
@@ -1036,13 +1760,92 @@ namespace
             }             
 
 
+            points    = trig->getInputPointArray();
+            triangles = trig->getTriangles();
+            return points.valid() && points->size() > 0;
+        }
+
+        return false;
+    }
+
+
+    /**
+     * Hashes the tile's elevation samples, so a cached mask triangulation is
+     * only reused over the same terrain.
+     */
+    unsigned hashElevation( const Data& d )
+    {
+        const osg::HeightField* hf = d.model->hasElevation() ? d.model->_elevationData.getHeightField() : 0L;
+        if ( !hf )
+            return 0u;
+
+        // FNV-1a
+        unsigned hash = 2166136261u;
+        const osg::FloatArray* heights = hf->getFloatArray();
+        if ( heights && heights->size() > 0 )
+        {
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>( &heights->front() );
+            unsigned numBytes = heights->size() * sizeof(float);
+            for( unsigned b = 0; b < numBytes; ++b )
+            {
+                hash ^= bytes[b];
+                hash *= 16777619u;
+            }
+        }
+        return hash;
+    }
+
+
+    /**
+     * If there are masking records, build (or fetch from the cache) the
+     * triangulation of the area inside the masking bounding box and add it
+     * to the surface geode.
+     */
+    void createMaskGeometry( Data& d, CompilerCache& cache )
+    {
+        // a mask covers the whole tile: there is nothing left to stitch.
+        if ( d.maskCoversTile )
+            return;
+
+        osg::ref_ptr<osg::Vec3Array>        points;
+        osg::ref_ptr<osg::DrawElementsUInt> tris;
+
+        CompilerCache::MaskGeometryKey key;
+        key._tileKey       = d.model->_tileKey;
+        key._cols          = d.numCols;
+        key._rows          = d.numRows;
+        key._elevationHash = hashElevation( d );
+        for (MaskRecordVector::const_iterator mr = d.maskRecords.begin(); mr != d.maskRecords.end(); ++mr)
+            key._boundaries.push_back( mr->_boundary.get() );
+
+        CompilerCache::MaskGeometryCache::Record rec;
+        if ( cache._maskGeometry.get(key, rec) )
+        {
+            // the cached copy is shared, so the new geometry gets its own elements.
+            points = rec.value()._points.get();
+            if ( rec.value()._triangles.valid() )
+                tris = new osg::DrawElementsUInt( *rec.value()._triangles.get() );
+        }
+        else
+        {
+            if ( !triangulateMask(d, points, tris) )
+                return;
+
+            CompilerCache::MaskGeometry entry;
+            entry._points = points.get();
+            if ( tris.valid() )
+                entry._triangles = new osg::DrawElementsUInt( *tris.get() );
+            cache._maskGeometry.insert( key, entry );
+        }
+
+        {
             MaskRecordVector::iterator mr = d.maskRecords.begin();
             // Set up new arrays to hold final vertices and normals
             osg::Geometry* stitch_geom = (*mr)._geom;
             osg::Vec3Array* stitch_verts = new osg::Vec3Array();
-            stitch_verts->reserve(trig->getInputPointArray()->size());
+            stitch_verts->reserve(points->size());
             stitch_geom->setVertexArray(stitch_verts);
-            osg::Vec3Array* stitch_norms = new osg::Vec3Array(trig->getInputPointArray()->size());
+            osg::Vec3Array* stitch_norms = new osg::Vec3Array(points->size());
             stitch_geom->setNormalArray( stitch_norms );
             stitch_geom->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
 
@@ -1052,14 +1855,14 @@ namespace
             {
                 for (unsigned int i = 0; i < d.renderLayers.size(); ++i)
                 {
-                    d.renderLayers[i]._stitchTexCoords->reserve(trig->getInputPointArray()->size());
+                    d.renderLayers[i]._stitchTexCoords->reserve(points->size());
                 }
             }
-            d.stitchTileCoords->reserve(trig->getInputPointArray()->size());
+            d.stitchTileCoords->reserve(points->size());
 
             // Iterate through point to convert to model coords, calculate normals, and set up tex coords
             int norm_i = -1;
-            for (osg::Vec3Array::iterator it = trig->getInputPointArray()->begin(); it != trig->getInputPointArray()->end(); ++it)
+            for (osg::Vec3Array::const_iterator it = points->begin(); it != points->end(); ++it)
             {
                 // get model coords
                 osg::Vec3d model;
@@ -1082,15 +1885,16 @@ namespace
                 {
                     for (unsigned int i = 0; i < d.renderLayers.size(); ++i)
                     {
+                        const osg::Vec4f& region = d.renderLayers[i]._layer.getTextureRegion();
                         if (!d.renderLayers[i]._locator->isEquivalentTo( *d.geoLocator.get() )) //*masterTextureLocator.get()))
                         {
                             osg::Vec3d color_ndc;
                             osgTerrain::Locator::convertLocalCoordBetween(*d.geoLocator.get(), (*it), *d.renderLayers[i]._locator.get(), color_ndc);
-                            d.renderLayers[i]._stitchTexCoords->push_back(osg::Vec2(color_ndc.x(), color_ndc.y()));
+                            d.renderLayers[i]._stitchTexCoords->push_back(toTextureRegion(region, color_ndc.x(), color_ndc.y()));
                         }
                         else
                         {
-                            d.renderLayers[i]._stitchTexCoords->push_back(osg::Vec2((*it).x(), (*it).y()));
+                            d.renderLayers[i]._stitchTexCoords->push_back(toTextureRegion(region, (*it).x(), (*it).y()));
                         }
                     }
                 }
@@ -1098,11 +1902,10 @@ namespace
             }
 
 
-            // Get triangles from triangulator and add as primative set to the geometry
-            osg::DrawElementsUInt* tris = trig->getTriangles();
-            if ( tris && tris->getNumIndices() >= 3 )
+            // Add the triangles as primative set to the geometry
+            if ( tris.valid() && tris->getNumIndices() >= 3 )
             {
-                stitch_geom->addPrimitiveSet(tris);
+                stitch_geom->addPrimitiveSet(tris.get());
             }
 
             // Finally, add it to the geode.
@@ -1134,12 +1937,15 @@ namespace
         osg::Vec4Array* skirtAttribs = static_cast<osg::Vec4Array*>(d.surface->getVertexAttribArray(osg::Drawable::ATTRIBUTE_6)); //new osg::Vec4Array();
         osg::Vec4Array* skirtAttribs2 = static_cast<osg::Vec4Array*>(d.surface->getVertexAttribArray(osg::Drawable::ATTRIBUTE_7)); //new osg::Vec4Array();
 
-        osg::ref_ptr<osg::DrawElements> elements = d.newDrawElements(GL_TRIANGLE_STRIP);
+        // an unmasked grid always yields the same strip, so use the shared one.
+        osg::ref_ptr<osg::DrawElements> elements = d.shareElements ? 0L : d.newDrawElements(GL_TRIANGLE_STRIP);
 
         // bottom:
         for( unsigned int c=0; c<d.numCols-1; ++c )
         {
             int orig_i = d.indices[c];
+            if (orig_i == POST_DROPPED)
+                continue;
 
             if (orig_i < 0)
             {
@@ -1178,8 +1984,11 @@ namespace
                 const osg::Vec2& tilec = (*d.renderTileCoords.get())[orig_i];
                 d.renderTileCoords->push_back( tilec );
 
-                elements->addElement(orig_i);
-                elements->addElement(skirtVerts->size()-1);
+                if ( elements.valid() )
+                {
+                    elements->addElement(orig_i);
+                    elements->addElement(skirtVerts->size()-1);
+                }
             }
         }
 
@@ -1187,6 +1996,8 @@ namespace
         for( unsigned int r=0; r<d.numRows-1; ++r )
         {
             int orig_i = d.indices[r*d.numCols+(d.numCols-1)];
+            if (orig_i == POST_DROPPED)
+                continue;
             if (orig_i < 0)
             {
                 if ( elements->getNumIndices() > 0 )
@@ -1224,8 +2035,11 @@ namespace
                 const osg::Vec2& tilec = (*d.renderTileCoords.get())[orig_i];
                 d.renderTileCoords->push_back( tilec );
 
-                elements->addElement(orig_i);
-                elements->addElement(skirtVerts->size()-1);
+                if ( elements.valid() )
+                {
+                    elements->addElement(orig_i);
+                    elements->addElement(skirtVerts->size()-1);
+                }
             }
         }
 
@@ -1233,6 +2047,8 @@ namespace
         for( int c=d.numCols-1; c>0; --c )
         {
             int orig_i = d.indices[(d.numRows-1)*d.numCols+c];
+            if (orig_i == POST_DROPPED)
+                continue;
             if (orig_i < 0)
             {
                 if ( elements->getNumIndices() > 0 )
@@ -1270,8 +2086,11 @@ namespace
                 const osg::Vec2& tilec = (*d.renderTileCoords.get())[orig_i];
                 d.renderTileCoords->push_back( tilec );
 
-                elements->addElement(orig_i);
-                elements->addElement(skirtVerts->size()-1);
+                if ( elements.valid() )
+                {
+                    elements->addElement(orig_i);
+                    elements->addElement(skirtVerts->size()-1);
+                }
             }
         }
 
@@ -1279,6 +2098,8 @@ namespace
         for( int r=d.numRows-1; r>=0; --r )
         {
             int orig_i = d.indices[r*d.numCols];
+            if (orig_i == POST_DROPPED)
+                continue;
             if (orig_i < 0)
             {
                 if ( elements->getNumIndices() > 0 )
@@ -1316,13 +2137,20 @@ namespace
                 const osg::Vec2& tilec = (*d.renderTileCoords.get())[orig_i];
                 d.renderTileCoords->push_back( tilec );
 
-                elements->addElement(orig_i);
-                elements->addElement(skirtVerts->size()-1);
+                if ( elements.valid() )
+                {
+                    elements->addElement(orig_i);
+                    elements->addElement(skirtVerts->size()-1);
+                }
             }
         }
 
         // add the final prim set.
-        if ( elements->getNumIndices() > 0 )
+        if ( d.shareElements )
+        {
+            d.surface->addPrimitiveSet( d.pool->getSkirtElements(d.numCols, d.numRows, d.useUInt) );
+        }
+        else if ( elements->getNumIndices() > 0 )
         {
             d.surface->addPrimitiveSet( elements.get() );
         }
@@ -1330,6 +2158,39 @@ namespace
 
 
 
+    /**
+     * Swaps the tile's own unit texture coordinates for the copy shared by all
+     * unmasked tiles of this size, so they are uploaded only once.
+     */
+    void shareTextureCoordinates( Data& d )
+    {
+        osg::Vec2Array* shared = d.pool->getUnitTexCoords( d.numCols, d.numRows, d.createSkirt );
+
+        if ( d.ownsTileCoords && d.renderTileCoords->size() == shared->size() )
+        {
+            osg::ref_ptr<osg::Vec2Array> old = d.renderTileCoords.get();
+            d.renderTileCoords = shared;
+            d.ownsTileCoords   = false;
+            d.pool->recycle( old.get() );
+        }
+
+        // layers in the tile's own texture space hold the same coordinates.
+        for( RenderLayerVector::iterator r = d.renderLayers.begin(); r != d.renderLayers.end(); ++r )
+        {
+            if (r->_ownsTexCoords &&
+                r->_locator->isEquivalentTo( *d.geoLocator.get() ) &&
+                isFullTexture( r->_layer.getTextureRegion() ) &&
+                r->_texCoords->size() == shared->size() )
+            {
+                osg::ref_ptr<osg::Vec2Array> old = r->_texCoords.get();
+                r->_texCoords     = shared;
+                r->_ownsTexCoords = false;
+                d.pool->recycle( old.get() );
+            }
+        }
+    }
+
+
     /**
      * Builds triangles for the surface geometry, and recalculates the surface normals
      * to be optimized for slope.
@@ -1342,10 +2203,48 @@ namespace
             d.model->hasElevation() && 
             !d.model->hasNormalMap();
 
-        unsigned numSurfaceNormals = d.numRows * d.numCols;
+        unsigned numSurfaceNormals = d.adaptiveTriangles.empty() ? d.numRows * d.numCols : d.numAdaptivePosts;
+
+        // An unmasked grid can use a shared element buffer, as long as every
+        // quad is split along the same diagonal.
+        bool useSharedElements = d.shareElements;
+        bool altDiagonal       = false;
 
-        osg::DrawElements* elements = d.newDrawElements(GL_TRIANGLES);
-        elements->reserveElements((d.numRows-1) * (d.numCols-1) * 6);
+        if ( useSharedElements && optimizeTriangleOrientation )
+        {
+            for(unsigned j=0; j<d.numRows-1 && useSharedElements; ++j)
+            {
+                for(unsigned i=0; i<d.numCols-1 && useSharedElements; ++i)
+                {
+                    // same corner assignment as the main loop below:
+                    unsigned i00 = j*d.numCols + i;
+                    unsigned i01 = i00 + d.numCols;
+                    if ( swapOrientation )
+                        std::swap( i00, i01 );
+
+                    float e00 = (*d.elevations)[i00];
+                    float e10 = (*d.elevations)[i00+1];
+                    float e01 = (*d.elevations)[i01];
+                    float e11 = (*d.elevations)[i01+1];
+
+                    bool alt = !(fabsf(e00-e11)<fabsf(e01-e10));
+                    if ( i == 0 && j == 0 )
+                        altDiagonal = alt;
+                    else if ( alt != altDiagonal )
+                        useSharedElements = false;
+                }
+            }
+        }
+
+        osg::ref_ptr<osg::DrawElements> elements;
+        if ( !useSharedElements )
+        {
+            elements = d.newDrawElements(GL_TRIANGLES);
+            elements->reserveElements((d.numRows-1) * (d.numCols-1) * 6);
+        }
+
+        // an adaptive tile brings its own triangles instead of the grid's quads.
+        unsigned numQuadRows = d.adaptiveTriangles.empty() ? d.numRows-1 : 0;
 
         if ( recalcNormals )
         {
@@ -1358,7 +2257,27 @@ namespace
             }
         }
 
-        for(unsigned j=0; j<d.numRows-1; ++j)
+        for(unsigned t=0; t+2<d.adaptiveTriangles.size(); t+=3)
+        {
+            unsigned i0 = d.adaptiveTriangles[t];
+            unsigned i1 = d.adaptiveTriangles[t+1];
+            unsigned i2 = d.adaptiveTriangles[t+2];
+
+            elements->addElement(i0);
+            elements->addElement(i1);
+            elements->addElement(i2);
+
+            if (recalcNormals)
+            {
+                const osg::Vec3f& v0 = (*d.surfaceVerts)[i0];
+                osg::Vec3 normal = ((*d.surfaceVerts)[i1]-v0) ^ ((*d.surfaceVerts)[i2]-v0);
+                (*d.normals)[i0] += normal;
+                (*d.normals)[i1] += normal;
+                (*d.normals)[i2] += normal;
+            }
+        }
+
+        for(unsigned j=0; j<numQuadRows; ++j)
         {
             for(unsigned i=0; i<d.numCols-1; ++i)
             {
@@ -1421,13 +2340,16 @@ namespace
 
                         if (!optimizeTriangleOrientation || fabsf(e00-e11)<fabsf(e01-e10))
                         {
-                            elements->addElement(i01);
-                            elements->addElement(i00);
-                            elements->addElement(i11);
+                            if ( elements.valid() )
+                            {
+                                elements->addElement(i01);
+                                elements->addElement(i00);
+                                elements->addElement(i11);
 
-                            elements->addElement(i00);
-                            elements->addElement(i10);
-                            elements->addElement(i11);
+                                elements->addElement(i00);
+                                elements->addElement(i10);
+                                elements->addElement(i11);
+                            }
 
                             if (recalcNormals)
                             {                        
@@ -1444,13 +2366,16 @@ namespace
                         }
                         else
                         {
-                            elements->addElement(i01);
-                            elements->addElement(i00);
-                            elements->addElement(i10);
+                            if ( elements.valid() )
+                            {
+                                elements->addElement(i01);
+                                elements->addElement(i00);
+                                elements->addElement(i10);
 
-                            elements->addElement(i01);
-                            elements->addElement(i10);
-                            elements->addElement(i11);
+                                elements->addElement(i01);
+                                elements->addElement(i10);
+                                elements->addElement(i11);
+                            }
 
                             if (recalcNormals)
                             {                       
@@ -1845,10 +2770,93 @@ namespace
             }       
         }
 
+        if ( useSharedElements )
+        {
+            d.surface->insertPrimitiveSet(0, d.pool->getSurfaceElements(
+                d.numCols, d.numRows, swapOrientation, altDiagonal, d.useUInt) );
+        }
+
         // in the case of full-masking, this will be empty
-        if ( elements->getNumIndices() > 0 )
+        else if ( elements->getNumIndices() > 0 )
+        {
+            d.surface->insertPrimitiveSet(0, elements.get()); // because we always want this first.
+        }
+    }
+
+
+    /**
+     * Fills in the render data for one layer, less its texture coordinates.
+     */
+    void setupLayer( const TileModel*            model,
+                     const TileModel::ColorData& color,
+                     const TileModel::ColorData& colorParent,
+                     MPGeometry::Layer&          layer )
+    {
+        layer._layerID        = color.getUID();
+        layer._imageLayer     = color.getMapLayer();
+        layer._tex            = color.getTexture();
+        layer._texParent      = colorParent.getTexture();
+        layer._texRegion      = color.getTextureRegion();
+        layer._mercWarp       = mercatorWarp( model, color );
+        layer._virtualTile    = color.getVirtualTile();
+
+        // a virtual texture tile's page changes from draw to draw, so no matrix
+        // can map it to its parent's: no LOD blending for those layers.
+        if ( layer._virtualTile.valid() )
+            layer._texParent = 0L;
+
+        // cache stock opacity. Disable if a color filter is installed, since
+        // it can modify the alpha.
+        layer._opaque =
+            (color.getMapLayer()->getColorFilters().size() == 0 ) &&
+            (layer._tex.valid() && !color.hasAlpha()) &&
+            (!layer._texParent.valid() || !colorParent.hasAlpha()) &&
+            (layer._imageLayer.valid() && layer._imageLayer->getMinVisibleRange() == 0.0f) &&
+            (layer._imageLayer.valid() && layer._imageLayer->getMaxVisibleRange() == FLT_MAX);
+
+        // texture matrix: scale/bias matrix of the texture. Currently we don't use
+        // this for rendering because the scale/bias is already baked into the 
+        // texture coordinates. BUT we still need it for sampling shared rasters etc.
+        if ( color._locator.valid() )
         {
-            d.surface->insertPrimitiveSet(0, elements); // because we always want this first.
+            osg::Matrixd sbmatrix;
+
+            color._locator->createScaleBiasMatrix(
+                model->_tileLocator->getDataExtent(),
+                sbmatrix );
+
+            layer._texMat = sbmatrix;
+
+            // a shared layer needs access to a static uniform name.
+            if ( layer._imageLayer->isShared() )
+            {
+                layer._texMatUniformID = osg::Uniform::getNameID( layer._imageLayer->shareTexMatUniformName().get() );
+            }
+        }
+
+        // parent texture matrix: it's a scale/bias matrix encoding the difference
+        // between the two locators.
+        if ( colorParent.getLocator() )
+        {
+            osg::Matrixd sbmatrix;
+
+            colorParent.getLocator()->createScaleBiasMatrix(
+                color.getLocator()->getDataExtent(),
+                sbmatrix );
+
+            // both textures may be atlas regions: undo the tile's region,
+            // then apply the parent's.
+            const osg::Vec4f& region       = color.getTextureRegion();
+            const osg::Vec4f& parentRegion = colorParent.getTextureRegion();
+            if ( !isFullTexture(region) || !isFullTexture(parentRegion) )
+            {
+                sbmatrix =
+                    osg::Matrixd::inverse( regionMatrix(region) ) *
+                    sbmatrix *
+                    regionMatrix( parentRegion );
+            }
+
+            layer._texMatParent = sbmatrix;
         }
     }
 
@@ -1875,55 +2883,19 @@ namespace
             unsigned order = r->_layer.getOrder();
 
             MPGeometry::Layer layer;
-            layer._layerID        = r->_layer.getUID();
-            layer._imageLayer     = r->_layer.getMapLayer();
-            layer._tex            = r->_layer.getTexture();
-            layer._texParent      = r->_layerParent.getTexture();
-
-            // cache stock opacity. Disable if a color filter is installed, since
-            // it can modify the alpha.
-            layer._opaque =
-                (r->_layer.getMapLayer()->getColorFilters().size() == 0 ) &&
-                (layer._tex.valid() && !r->_layer.hasAlpha()) &&
-                (!layer._texParent.valid() || !r->_layerParent.hasAlpha()) &&
-                (layer._imageLayer.valid() && layer._imageLayer->getMinVisibleRange() == 0.0f) &&
-                (layer._imageLayer.valid() && layer._imageLayer->getMaxVisibleRange() == FLT_MAX);
-
-            // texture matrix: scale/bias matrix of the texture. Currently we don't use
-            // this for rendering because the scale/bias is already baked into the 
-            // texture coordinates. BUT we still need it for sampling shared rasters etc.
-            if ( r->_layer._locator.valid() )
-            {
-                osg::Matrixd sbmatrix;
-
-                r->_layer._locator->createScaleBiasMatrix(
-                    d.model->_tileLocator->getDataExtent(),
-                    sbmatrix );
-
-                layer._texMat = sbmatrix;
-
-                // a shared layer needs access to a static uniform name.
-                if ( layer._imageLayer->isShared() )
-                {
-                    layer._texMatUniformID = osg::Uniform::getNameID( layer._imageLayer->shareTexMatUniformName().get() );
-                }
-            }
+            setupLayer( d.model.get(), r->_layer, r->_layerParent, layer );
 
-            // parent texture matrix: it's a scale/bias matrix encoding the difference
-            // between the two locators.
-            if ( r->_layerParent.getLocator() )
+            // the texture coords:
+            if ( r->_useTileCoords )
             {
-                osg::Matrixd sbmatrix;
-
-                r->_layerParent.getLocator()->createScaleBiasMatrix(
-                    r->_layer.getLocator()->getDataExtent(),
-                    sbmatrix );
-
-                layer._texMatParent = sbmatrix;
+                layer._texCoords    = d.surface->_tileCoords.get();
+                layer._texScaleBias = r->_texScaleBias;
+            }
+            else
+            {
+                layer._texCoords  = r->_texCoords.get();
             }
 
-            // the texture coords:
-            layer._texCoords  = r->_texCoords.get();
             if ( r->_texCoords.valid() )
             {
                 int index = d.surface->getTexCoordArrayList().size();
@@ -1952,6 +2924,37 @@ namespace
     }
 
 
+    inline short toNormalShort( float v )
+    {
+        return (short)osg::clampBetween( v * 32767.0f + (v < 0.0f ? -0.5f : 0.5f), -32767.0f, 32767.0f );
+    }
+
+    // Replaces the surface's float normals with 16-bit ones. GL normalizes
+    // short normals itself, so the shaders see the same unit vectors for half
+    // the memory. Runs last, since the build steps all work on the floats.
+    void compactNormals( Data& d )
+    {
+        osg::ref_ptr<osg::Vec3Array> normals = dynamic_cast<osg::Vec3Array*>( d.surface->getNormalArray() );
+        if ( !normals.valid() || normals->empty() )
+            return;
+
+        osg::Vec3sArray* compact = new osg::Vec3sArray( normals->size() );
+        for( unsigned i=0; i<normals->size(); ++i )
+        {
+            osg::Vec3f n = (*normals)[i];
+            n.normalize();
+            (*compact)[i].set( toNormalShort(n.x()), toNormalShort(n.y()), toNormalShort(n.z()) );
+        }
+
+        d.surface->setNormalArray( compact );
+        d.surface->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+        d.normals = 0L;
+
+        if ( d.pool )
+            d.pool->recycle( normals.get() );
+    }
+
+
     // Optimize the data. Convert all modes to GL_TRIANGLES and run the
     // critical vertex cache optimizations.
     void optimize( Data& d, bool runMeshOptimizers, ProgressCallback* progress )
@@ -2051,12 +3054,16 @@ TileModelCompiler::TileModelCompiler(const MaskLayerVector&              maskLay
                                      const ModelLayerVector&             modelLayers,
                                      int                                 texImageUnit,
                                      bool                                optimizeTriOrientation,
-                                     const MPTerrainEngineOptions& options) :
+                                     const MPTerrainEngineOptions&       options,
+                                     GeometryPool*                       pool,
+                                     TaskService*                        service) :
 _maskLayers            ( maskLayers ),
 _modelLayers           ( modelLayers ),
 _optimizeTriOrientation( optimizeTriOrientation ),
 _options               ( options ),
-_textureImageUnit      ( texImageUnit )
+_textureImageUnit      ( texImageUnit ),
+_pool                  ( pool ),
+_service               ( service )
 {
     _cullByTraversalMask = new CullByTraversalMask(*options.secondaryTraversalMask());
     _debug =
@@ -2070,10 +3077,13 @@ TileModelCompiler::compile(TileModel*        model,
                            const MapFrame&   frame,
                            ProgressCallback* progress)
 {
+    OE_PROFILING_ZONE("TileModelCompiler::compile");
 
     // Working data for the build.
     Data d(model, frame, _maskLayers, _modelLayers);
     d.textureImageUnit = _textureImageUnit;
+    d.pool             = _pool.get();
+    d.service          = _service.get();
 
     GeoPoint centroid;
     model->_tileKey.getExtent().getCentroid(centroid);
@@ -2082,6 +3092,7 @@ TileModelCompiler::compile(TileModel*        model,
     d.world2local.invert(d.local2world);
 
     TileNode* tile = new TileNode( model->_tileKey, model, d.local2world );
+    tile->setGeometryPool( _pool.get() );
 
     d.installParentData = model->useParentData();
     d.parentModel = model->getParentTileModel();
@@ -2113,15 +3124,34 @@ TileModelCompiler::compile(TileModel*        model,
     // allocate all the vertex, normal, and color arrays.
     setupGeometryAttributes( d, _options.tileSize().get() );
 
+    // only split up the vertex work when the grid is big enough to pay for it.
+    d.parallel =
+        d.service != 0L &&
+        d.numCols * d.numRows >= _options.parallelCompileThreshold().get();
+
     // set up the list of layers to render and their shared arrays.
     setupTextureAttributes( d, _cache );
 
     // calculate the vertex and normals for the surface geometry.
     createSurfaceGeometry( d );
 
+    // thin out the grid where the terrain allows it.
+    if ( _options.adaptiveMeshError().get() > 0.0f )
+        simplifySurfaceGeometry( d, _options.adaptiveMeshError().get() );
+
+    // With no masking and no missing posts, the grid topology depends only on
+    // its dimensions; such tiles can share element buffers. (The mesh optimizer
+    // rewrites the elements, so it rules this out.)
+    d.shareElements =
+        d.pool != 0L &&
+        _options.shareTileBuffers() == true &&
+        d.maskRecords.empty() &&
+        _options.optimizeTiles() != true &&
+        d.surfaceVerts->size() == d.numCols * d.numRows;
+
     // build geometry for the masked areas, if applicable
     if ( d.maskRecords.size() > 0 )
-        createMaskGeometry( d );
+        createMaskGeometry( d, _cache );
 
     // build the skirts.
     if ( d.createSkirt )
@@ -2137,11 +3167,19 @@ TileModelCompiler::compile(TileModel*        model,
         tessellateSurfaceGeometry( d, _optimizeTriOrientation, *_options.normalizeEdges() );
     }
 
+    // unmasked tiles can all use the same unit texture coordinates.
+    if ( d.shareElements )
+        shareTextureCoordinates( d );
+
     // installs the per-layer rendering data into the Geometry objects.
     installRenderData( d );
 
     // performance optimizations.
     optimize( d, _options.optimizeTiles() == true, progress );
+
+    // 16-bit normals, if requested.
+    if ( _options.compactVertices() == true )
+        compactNormals( d );
     
     // install a KdTree index if necessary
     if (osgDB::Registry::instance()->getBuildKdTreesHint()==osgDB::ReaderWriter::Options::BUILD_KDTREES &&
@@ -2174,5 +3212,149 @@ TileModelCompiler::compile(TileModel*        model,
         tile->addChild( makeBBox(d) );
     }
 
+    // the elevations were scratch space; let the next tile have them.
+    if ( d.pool )
+        d.pool->recycle( d.elevations.get() );
+
     return tile;
 }
+
+
+TileNode*
+TileModelCompiler::compileLayers(TileModel*        model,
+                                 const TileNode*   source,
+                                 ProgressCallback* progress)
+{
+    // masking cuts the geometry differently per tile; those need a full compile.
+    if ( !model || !source || _maskLayers.size() > 0 || _modelLayers.size() > 0 )
+        return 0L;
+
+    if ( progress && progress->isCanceled() )
+        return 0L;
+
+    // find the surface geometry of the source tile.
+    const osg::Geode* sourceGeode   = 0L;
+    const MPGeometry* sourceSurface = 0L;
+    for( unsigned i=0; i<source->getNumChildren() && !sourceSurface; ++i )
+    {
+        const osg::Geode* geode = dynamic_cast<const osg::Geode*>( source->getChild(i) );
+        if ( geode && geode->getNumDrawables() == 1 )
+        {
+            sourceGeode   = geode;
+            sourceSurface = dynamic_cast<const MPGeometry*>( geode->getDrawable(0) );
+        }
+    }
+
+    if ( !sourceSurface || !sourceSurface->_tileCoords.valid() )
+        return 0L;
+
+    // share the vertex data, elements and unit texture coordinates of the source.
+    // The lock keeps the draw thread from reordering the layers while we copy them.
+    osg::ref_ptr<MPGeometry> surface;
+    {
+        Threading::ScopedMutexLock lock( sourceSurface->_frameSyncMutex );
+        surface = new MPGeometry( *sourceSurface, osg::CopyOp::SHALLOW_COPY );
+    }
+
+    osg::ref_ptr<const GeoLocator> geoLocator = model->_tileLocator->getCoordinateSystemType() == GeoLocator::GEOCENTRIC ? 
+        model->_tileLocator->getGeographicFromGeocentric() :
+        model->_tileLocator.get();
+
+    const osg::Vec2Array& tileCoords = *surface->_tileCoords.get();
+
+    std::vector<MPGeometry::Layer> layers( model->_colorData.size() );
+
+    for( TileModel::ColorDataByUID::const_iterator i = model->_colorData.begin(); i != model->_colorData.end(); ++i )
+    {
+        const TileModel::ColorData& color = i->second;
+        unsigned order = color.getOrder();
+        if ( order >= layers.size() || !color.getLocator() )
+            return 0L;
+
+        // a layer whose data didn't change keeps its render data as is.
+        std::vector<MPGeometry::Layer>::const_iterator existing = std::find(
+            surface->_layers.begin(), surface->_layers.end(), color.getUID() );
+
+        if (existing != surface->_layers.end() &&
+            existing->_tex.get() == color.getTexture() &&
+            existing->_texRegion == color.getTextureRegion() &&
+            existing->_virtualTile.get() == color.getVirtualTile() )
+        {
+            layers[order] = *existing;
+            continue;
+        }
+
+        TileModel::ColorData colorParent;
+        if ( model->useParentData() )
+        {
+            getParentColorData( model->getParentTileModel(), color, colorParent );
+        }
+
+        MPGeometry::Layer& layer = layers[order];
+        setupLayer( model, color, colorParent, layer );
+
+        osg::ref_ptr<const GeoLocator> locator = color.getLocator();
+        if ( locator->getCoordinateSystemType() == osgTerrain::Locator::GEOCENTRIC )
+        {
+            locator = locator->getGeographicFromGeocentric();
+        }
+
+        // the unit tile coordinates are the tile's NDC, so a layer in a different
+        // texture space can be mapped from them without revisiting the vertices.
+        const osg::Vec4f& region = color.getTextureRegion();
+        bool sameSpace = locator->isEquivalentTo( *geoLocator.get() );
+
+        if ( sameSpace && isFullTexture(region) )
+        {
+            layer._texCoords = surface->_tileCoords.get();
+        }
+        else if ( fallbackScaleBias(model, color, layer._texScaleBias) )
+        {
+            layer._texCoords = surface->_tileCoords.get();
+        }
+        else
+        {
+            osg::Vec2Array* texCoords = new osg::Vec2Array( tileCoords.size() );
+            for( unsigned v=0; v<tileCoords.size(); ++v )
+            {
+                osg::Vec3d ndc( tileCoords[v].x(), tileCoords[v].y(), 0.0 );
+                osg::Vec3d color_ndc = ndc;
+                if ( !sameSpace )
+                    osgTerrain::Locator::convertLocalCoordBetween( *geoLocator.get(), ndc, *locator.get(), color_ndc );
+                (*texCoords)[v] = toTextureRegion( region, color_ndc.x(), color_ndc.y() );
+            }
+            layer._texCoords = texCoords;
+        }
+    }
+
+    surface->_layers.swap( layers );
+
+    // reassign the texture coordinate arrays: one per layer, then the tile coordinates.
+    unsigned index = 0;
+    for( unsigned i=0; i<surface->_layers.size(); ++i )
+    {
+        if ( surface->_layers[i]._texCoords.valid() )
+            surface->setTexCoordArray( index++, surface->_layers[i]._texCoords.get() );
+    }
+    surface->setTexCoordArray( index++, surface->_tileCoords.get() );
+    surface->getTexCoordArrayList().resize( index );
+
+    surface->_elevTex = model->_elevationTexture.get();
+
+    osg::ref_ptr<TileNode> tile = new TileNode( model->_tileKey, model, source->getMatrix() );
+    tile->setGeometryPool( _pool.get() );
+    tile->setTerrainBoundingBox( source->getTerrainBoundingBox() );
+
+    // the new tile holds the GL objects of the one it replaces.
+    tile->setSharesGLObjects( true );
+
+    osg::Geode* geode = new osg::Geode();
+    geode->setNodeMask( sourceGeode->getNodeMask() );
+    geode->addDrawable( surface.get() );
+    tile->addChild( geode );
+
+    SetDataVarianceVisitor sdv( osg::Object::DYNAMIC );
+    tile->accept( sdv );
+
+    return tile.release();
+}
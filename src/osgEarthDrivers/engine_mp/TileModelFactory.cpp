@@ -22,6 +22,7 @@
 #include <osgEarth/ImageUtils>
 #include <osgEarth/HeightFieldUtils>
 #include <osgEarth/Progress>
+#include <osgEarth/Profiler>
 #include <osgEarth/TerrainEngineNode>
 
 using namespace osgEarth::Drivers::MPTerrainEngine;
@@ -43,40 +44,36 @@ namespace
                    const MapInfo&                      mapInfo,
                    const MPTerrainEngineOptions&       opt, 
                    TileNodeRegistry*                   tiles,
-                   TileModel*                          model)
+                   TileModel*                          model,
+                   TileTextureAtlas*                   atlas,
+                   TileVirtualTexture*                 vt,
+                   const GeoImage*                     prefetched =0L)
         {
-            _key      = key;
-            _layer    = layer;
-            _order    = order;
-            _mapInfo  = &mapInfo;
-            _opt      = &opt;
-            _tiles    = tiles;
-            _model    = model;
+            _key        = key;
+            _layer      = layer;
+            _order      = order;
+            _mapInfo    = &mapInfo;
+            _opt        = &opt;
+            _tiles      = tiles;
+            _model      = model;
+            _atlas      = atlas;
+            _vt         = vt;
+            _prefetched = prefetched;
         }
 
-        bool execute(ProgressCallback* progress)
+        // The "fast path" preserves mercator tiles without reprojection.
+        bool useMercatorFastPath() const
         {
-            bool ok = false;
-
-            // This will only go true if we are requesting a ROOT TILE but we have to
-            // fall back on lower resolution data to create it.
-            bool isFallback = false;
-
-            GeoImage geoImage;
-
-            // The "fast path" preserves mercator tiles without reprojection.
-            bool useMercatorFastPath =
+            return
                 _opt->enableMercatorFastPath() != false &&
                 _mapInfo->isGeocentric()                &&
                 _layer->getProfile()                    &&
                 _layer->getProfile()->getSRS()->isSphericalMercator();
+        }
 
-            // If this is a ROOT tile, we will try to fall back on lower-resolution
-            // data if we can't find something at the optimal LOD.
-            bool isRootKey =
-                (_key.getLOD() == 0) || // should never be
-                (_key.getLOD()-1 == _opt->firstLOD().value());
-
+        // Whether execute() will request an image for the key at all.
+        bool wantsImage() const
+        {
             TileSource*    tileSource   = _layer->getTileSource();
             const Profile* layerProfile = _layer->getProfile();
 
@@ -91,13 +88,48 @@ namespace
                 }
                 hasDataInExtent = tileSource->hasDataInExtent( ext );
             }
+
+            return hasDataInExtent && _layer->isKeyInRange(_key);
+        }
+
+        // Whether the image execute() wants is what ImageLayer::createImages() returns
+        // for the key, so it can be fetched ahead of time in a batch.
+        bool canPrefetch() const
+        {
+            if ( !wantsImage() )
+                return false;
+
+            // in the fast path, only keys already in the layer profile go straight
+            // to the layer; others are mosaicked from native tiles.
+            return
+                !useMercatorFastPath() ||
+                _key.getProfile()->isHorizEquivalentTo( _layer->getProfile() );
+        }
+
+        bool execute(ProgressCallback* progress)
+        {
+            bool ok = false;
+
+            // This will only go true if we are requesting a ROOT TILE but we have to
+            // fall back on lower resolution data to create it.
+            bool isFallback = false;
+
+            GeoImage geoImage;
+
+            bool useMercatorFastPath = this->useMercatorFastPath();
+
+            // If this is a ROOT tile, we will try to fall back on lower-resolution
+            // data if we can't find something at the optimal LOD.
+            bool isRootKey =
+                (_key.getLOD() == 0) || // should never be
+                (_key.getLOD()-1 == _opt->firstLOD().value());
             
             // fetch the image from the layer.
-            if (hasDataInExtent && _layer->isKeyInRange(_key))
+            if ( wantsImage() )
             {
                 if ( useMercatorFastPath )
                 {
-                    geoImage = _layer->createImageInNativeProfile( _key, progress );
+                    geoImage = _prefetched ? *_prefetched : _layer->createImageInNativeProfile( _key, progress );
 
                     // If this is a root tile, try to find lower-resolution data to
                     // fulfill the request.
@@ -122,7 +154,7 @@ namespace
                 }
                 else
                 {
-                    geoImage = _layer->createImage( _key, progress );
+                    geoImage = _prefetched ? *_prefetched : _layer->createImage( _key, progress );
 
                     // If this is a root tile, try to find lower-resolution data to
                     // fulfill the request.
@@ -156,13 +188,30 @@ namespace
                 else
                     locator = GeoLocator::createForExtent(geoImage.getExtent(), *_mapInfo);
 
+                // page the image through the layer's virtual texture if it has one.
+                osg::ref_ptr<TileVirtualTexture::Tile> virtualTile;
+                if ( _vt )
+                    virtualTile = _vt->createTile( geoImage.getImage(), geoImage.getExtent(), getParentVirtualTile() );
+
+                // keep uncompressed imagery at 16 bits per pixel if requested. (Coverages
+                // hold raw values, and the virtual texture has a fixed format.)
+                osg::ref_ptr<osg::Image> image = geoImage.getImage();
+                if ( _opt->compactTextures() == true && !_vt && !_layer->isCoverage() )
+                {
+                    osg::Image* packed = ImageUtils::convertTo16Bit( image.get() );
+                    if ( packed )
+                        image = packed;
+                }
+
                 // add the color layer to the repo.
                 _model->_colorData[_layer->getUID()] = TileModel::ColorData(
                     _layer,
                     _order,
-                    geoImage.getImage(),
+                    image.get(),
                     locator,
-                    isFallback ); // isFallbackData
+                    isFallback,   // isFallbackData
+                    _atlas,
+                    virtualTile.get() );
 
                 ok = true;
             }
@@ -194,6 +243,24 @@ namespace
             return ok;
         }
 
+        // the parent tile's virtual texture tile, for a fallback while this one has no page.
+        const TileVirtualTexture::Tile* getParentVirtualTile() const
+        {
+            if ( _key.getLOD() == 0 )
+                return 0L;
+
+            osg::ref_ptr<TileNode> parentNode;
+            _tiles->get( _key.createParentKey(), parentNode );
+            if ( !parentNode.valid() || !parentNode->getTileModel() )
+                return 0L;
+
+            TileModel::ColorData parentColorData;
+            if ( !parentNode->getTileModel()->getColorData(_layer->getUID(), parentColorData) )
+                return 0L;
+
+            return parentColorData.getVirtualTile();
+        }
+
         TileKey           _key;
         const MapInfo*    _mapInfo;
         TileNodeRegistry* _tiles;
@@ -201,6 +268,9 @@ namespace
         unsigned          _order;
         TileModel*        _model;
         const MPTerrainEngineOptions* _opt;
+        TileTextureAtlas* _atlas;
+        TileVirtualTexture* _vt;
+        const GeoImage*   _prefetched;
     };
 }
 
@@ -218,6 +288,32 @@ _terrainReqs   ( terrainReqs )
 
     _normalHFCache = new HeightFieldCache(liveTiles, terrainOptions);
     _normalHFCache->setTileSize( 257 );
+
+    if ( terrainOptions.atlasMaxImageSize() > 0 )
+    {
+        _atlas = new TileTextureAtlas(
+            terrainOptions.atlasMaxImageSize().get(),
+            terrainOptions.atlasPageSize().get() );
+    }
+}
+
+osg::ref_ptr<TileVirtualTexture>
+TileModelFactory::getVirtualTexture(const ImageLayer* layer)
+{
+    // shared layers are bound to their own samplers by name.
+    if ( layer->getImageLayerOptions().virtualTexture() != true || layer->isShared() )
+        return 0L;
+
+    Threading::ScopedMutexLock lock( _virtualTexturesMutex );
+
+    osg::ref_ptr<TileVirtualTexture> vt;
+    osg::observer_ptr<TileVirtualTexture>& slot = _virtualTextures[layer->getUID()];
+    if ( !slot.lock(vt) )
+    {
+        vt = new TileVirtualTexture( layer, _terrainOptions.virtualTextureSize().get() );
+        slot = vt.get();
+    }
+    return vt;
 }
 
 void
@@ -227,6 +323,13 @@ TileModelFactory::clearCaches()
     _normalHFCache->clear();
 }
 
+void
+TileModelFactory::setCacheBin(CacheBin* bin, const CachePolicy& policy)
+{
+    _meshHFCache->setCacheBin( bin, policy );
+    _normalHFCache->setCacheBin( bin, policy );
+}
+
 void
 TileModelFactory::buildElevation(const TileKey&    key,
                                  const MapFrame&   frame,
@@ -416,6 +519,141 @@ TileModelFactory::createTileModel(const TileKey&           key,
                                   osg::ref_ptr<TileModel>& out_model,
                                   ProgressCallback*        progress)
 {
+    createTileModel( key, frame, accumulate, out_model, 0L, progress );
+}
+
+
+void
+TileModelFactory::createTileModels(const std::vector<TileKey>&             keys,
+                                   const MapFrame&                         frame,
+                                   bool                                    accumulate,
+                                   std::vector< osg::ref_ptr<TileModel> >& out_models,
+                                   ProgressCallback*                       progress)
+{
+    out_models.assign( keys.size(), 0L );
+
+    std::vector<ImagesByLayer> prefetched( keys.size() );
+
+    OE_START_TIMER(fetch_imagery);
+
+    // Request the imagery for all the keys from each layer in a single batch.
+    for( ImageLayerVector::const_iterator i = frame.imageLayers().begin(); i != frame.imageLayers().end(); ++i )
+    {
+        ImageLayer* layer = i->get();
+        if ( !layer->getEnabled() )
+            continue;
+
+        std::vector<TileKey>  batchKeys;
+        std::vector<unsigned> batchIndices;
+
+        for( unsigned k=0; k<keys.size(); ++k )
+        {
+            BuildColorData probe;
+            probe.init( keys[k], layer, 0, frame.getMapInfo(), _terrainOptions, _liveTiles.get(), 0L, 0L, 0L );
+            if ( probe.canPrefetch() )
+            {
+                batchKeys.push_back( keys[k] );
+                batchIndices.push_back( k );
+            }
+        }
+
+        // nothing to gain from a batch of one.
+        if ( batchKeys.size() < 2 )
+            continue;
+
+        std::vector<GeoImage> images;
+        layer->createImages( batchKeys, images, progress );
+
+        for( unsigned j=0; j<batchKeys.size() && j<images.size(); ++j )
+        {
+            prefetched[batchIndices[j]][layer->getUID()] = images[j];
+        }
+    }
+
+    if (progress)
+        progress->stats()["fetch_imagery_time"] += OE_STOP_TIMER(fetch_imagery);
+
+    for( unsigned k=0; k<keys.size(); ++k )
+    {
+        if ( progress && progress->isCanceled() )
+            return;
+
+        createTileModel( keys[k], frame, accumulate, out_models[k], &prefetched[k], progress );
+    }
+}
+
+
+void
+TileModelFactory::createLayerModel(const TileKey&           key,
+                                   const MapFrame&          frame,
+                                   const TileModel*         source,
+                                   osg::ref_ptr<TileModel>& out_model,
+                                   ProgressCallback*        progress)
+{
+    if ( !source )
+        return;
+
+    osg::ref_ptr<TileModel> model = new TileModel( *source );
+    model->_revision         = frame.getRevision();
+    model->_normalData       = source->_normalData;
+    model->_elevationTexture = source->_elevationTexture.get();
+    model->_normalTexture    = source->_normalTexture.get();
+    model->_colorData.clear();
+
+    OE_START_TIMER(fetch_imagery);
+
+    // same ordering rules as createTileModel, but existing layers are reused.
+    unsigned order = 0;
+    for( ImageLayerVector::const_iterator i = frame.imageLayers().begin(); i != frame.imageLayers().end(); ++i )
+    {
+        ImageLayer* layer = i->get();
+
+        if ( layer->getEnabled() && layer->isKeyInRange(key) )
+        {
+            TileModel::ColorData existing;
+            if ( source->getColorData(layer->getUID(), existing) )
+            {
+                existing._order = order++;
+                model->_colorData[layer->getUID()] = existing;
+            }
+            else
+            {
+                osg::ref_ptr<TileVirtualTexture> vt = getVirtualTexture( layer );
+                BuildColorData build;
+                build.init( key, layer, order, frame.getMapInfo(), _terrainOptions, _liveTiles.get(), model.get(), _atlas.get(), vt.get() );
+
+                if ( build.execute(progress) )
+                    order++;
+            }
+        }
+    }
+
+    if (progress)
+        progress->stats()["fetch_imagery_time"] += OE_STOP_TIMER(fetch_imagery);
+
+    if ( progress && progress->isCanceled() )
+        return;
+
+    // look up the parent model and cache it.
+    osg::ref_ptr<TileNode> parentTile;
+    if ( _liveTiles->get(key.createParentKey(), parentTile) )
+    {
+        model->_parentModel = parentTile->getTileModel();
+    }
+
+    out_model = model.release();
+}
+
+
+void
+TileModelFactory::createTileModel(const TileKey&           key, 
+                                  const MapFrame&          frame,
+                                  bool                     accumulate,
+                                  osg::ref_ptr<TileModel>& out_model,
+                                  const ImagesByLayer*     prefetched,
+                                  ProgressCallback*        progress)
+{
+    OE_PROFILING_ZONE("TileModelFactory::createTileModel");
 
     osg::ref_ptr<TileModel> model = new TileModel( frame.getRevision(), frame.getMapInfo() );
 
@@ -435,8 +673,17 @@ TileModelFactory::createTileModel(const TileKey&           key,
 
         if ( layer->getEnabled() && layer->isKeyInRange(key) )
         {
+            const GeoImage* prefetchedImage = 0L;
+            if ( prefetched )
+            {
+                ImagesByLayer::const_iterator p = prefetched->find( layer->getUID() );
+                if ( p != prefetched->end() )
+                    prefetchedImage = &p->second;
+            }
+
+            osg::ref_ptr<TileVirtualTexture> vt = getVirtualTexture( layer );
             BuildColorData build;
-            build.init( key, layer, order, frame.getMapInfo(), _terrainOptions, _liveTiles.get(), model.get() );
+            build.init( key, layer, order, frame.getMapInfo(), _terrainOptions, _liveTiles.get(), model.get(), _atlas.get(), vt.get(), prefetchedImage );
 
             bool addedToModel = build.execute(progress);
             if ( addedToModel )
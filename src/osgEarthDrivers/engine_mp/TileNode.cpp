@@ -17,8 +17,10 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include "TileNode"
+#include "MPGeometry"
 
 #include <osg/ClusterCullingCallback>
+#include <osg/Geode>
 #include <osg/NodeCallback>
 #include <osg/NodeVisitor>
 #include <osg/Uniform>
@@ -42,7 +44,8 @@ _key               ( key ),
 _model             ( model ),
 _lastTraversalFrame( 0 ),
 _dirty             ( false ),
-_outOfDate         ( false )
+_outOfDate         ( false ),
+_sharesGLObjects   ( false )
 {
     this->setName( key.str() );
     this->setMatrix( matrix );
@@ -102,6 +105,28 @@ _outOfDate         ( false )
     }
 }
 
+TileNode::~TileNode()
+{
+    // hand the geometry arrays back for reuse, unless something else
+    // (e.g. a draw thread) still holds on to them.
+    if ( _pool.valid() )
+    {
+        for( unsigned i=0; i<getNumChildren(); ++i )
+        {
+            osg::Geode* geode = dynamic_cast<osg::Geode*>( getChild(i) );
+            if ( geode && geode->referenceCount() == 1 )
+            {
+                for( unsigned j=0; j<geode->getNumDrawables(); ++j )
+                {
+                    MPGeometry* geom = dynamic_cast<MPGeometry*>( geode->getDrawable(j) );
+                    if ( geom )
+                        _pool->recycle( geom );
+                }
+            }
+        }
+    }
+}
+
 osg::Texture*
 TileNode::getElevationTexture() const
 {
@@ -159,9 +184,42 @@ TileNode::getOrCreatePayloadGroup()
     return _payload.get();
 }
 
+void
+TileNode::getUsage(TileResidencyManager::Usage& usage) const
+{
+    usage.add( this );
+
+    if ( _model.valid() )
+    {
+        for( TileModel::ColorDataByUID::const_iterator i = _model->_colorData.begin(); i != _model->_colorData.end(); ++i )
+        {
+            // an atlased layer only holds its cell of the shared page.
+            const TileTextureAtlas::Slot* slot = i->second.getAtlasSlot();
+            // a virtual texture tile keeps its image; the physical texture is fixed.
+            const TileVirtualTexture::Tile* virtualTile = i->second.getVirtualTile();
+            if ( slot )
+                usage.add( slot, slot->getSizeInBytes(), slot->getSizeInBytes() );
+            else if ( virtualTile )
+                usage.add( virtualTile, virtualTile->getSizeInBytes(), 0u );
+            else
+                usage.add( i->second.getTexture() );
+        }
+
+        usage.add( _model->_elevationTexture.get() );
+        usage.add( _model->_normalTexture.get() );
+        usage.add( _model->_elevationData.getHeightField() );
+        usage.add( _model->_normalData.getHeightField() );
+    }
+}
+
 void
 TileNode::traverse( osg::NodeVisitor& nv )
 {
+    if ( _residency.valid() && nv.getVisitorType() == nv.CULL_VISITOR && nv.getFrameStamp() )
+    {
+        _residency->touch( nv.getFrameStamp()->getFrameNumber() );
+    }
+
     if ( _model.valid() )
     {
         if ( nv.getVisitorType() == nv.CULL_VISITOR )
@@ -17,6 +17,9 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include "TileNodeRegistry"
+#include <osgEarth/Profile>
+#include <osg/Math>
+#include <cmath>
 
 using namespace osgEarth::Drivers::MPTerrainEngine;
 using namespace osgEarth;
@@ -32,7 +35,9 @@ using namespace osgEarth;
 TileNodeRegistry::TileNodeRegistry(const std::string& name) :
 _name              ( name ),
 _revisioningEnabled( false ),
-_frameNumber       ( 0u )
+_frameNumber       ( 0u ),
+_dirtyBudget       ( 0u ),
+_dirtyFrame        ( ~0u )
 {
     //nop
 }
@@ -47,7 +52,8 @@ TileNodeRegistry::setRevisioningEnabled(bool value)
 
 void
 TileNodeRegistry::setMapRevision(const Revision& rev,
-                                 bool            setToDirty)
+                                 bool            setToDirty,
+                                 bool            geometryChanged)
 {
     if ( _revisioningEnabled )
     {
@@ -58,6 +64,8 @@ TileNodeRegistry::setMapRevision(const Revision& rev,
             if ( _maprev != rev || setToDirty )
             {
                 _maprev = rev;
+                if ( geometryChanged )
+                    _geomrev = rev;
 
                 for( TileNodeMap::iterator i = _tiles.begin(); i != _tiles.end(); ++i )
                 {
@@ -71,6 +79,14 @@ TileNodeRegistry::setMapRevision(const Revision& rev,
 }
 
 
+Revision
+TileNodeRegistry::getGeometryRevision() const
+{
+    Threading::ScopedReadLock shared( _tilesMutex );
+    return _geomrev;
+}
+
+
 //NOTE: this method assumes the input extent is the same SRS as
 // the terrain profile SRS.
 void
@@ -78,19 +94,120 @@ TileNodeRegistry::setDirty(const GeoExtent& extent,
                            unsigned         minLevel,
                            unsigned         maxLevel)
 {
-    Threading::ScopedWriteLock exclusive( _tilesMutex );
-    
-    bool checkSRS = false;
-    for( TileNodeMap::iterator i = _tiles.begin(); i != _tiles.end(); ++i )
+    TileKeyVector keys;
     {
-        const TileKey& key = i->first;
-        if (minLevel <= key.getLOD() && 
-            maxLevel >= key.getLOD() &&
-            extent.intersects(i->first.getExtent(), checkSRS) )
+        // marking a tile only sets a flag, so a shared lock is enough.
+        Threading::ScopedReadLock shared( _tilesMutex );
+
+        if ( _tiles.empty() )
+            return;
+
+        unsigned maxLOD = std::min( maxLevel, _tiles.rbegin()->first.getLOD() );
+        for( unsigned lod = minLevel; lod <= maxLOD; ++lod )
         {
-            i->second->setDirty();
+            findTiles( extent, lod, keys );
+        }
+
+        if ( _dirtyBudget == 0 )
+        {
+            for( TileKeyVector::const_iterator k = keys.begin(); k != keys.end(); ++k )
+            {
+                TileNodeMap::const_iterator i = _tiles.find( *k );
+                if ( i != _tiles.end() )
+                    i->second->setDirty();
+            }
+            return;
         }
     }
+
+    Threading::ScopedMutexLock lock( _dirtyMutex );
+    _dirtyQueue.insert( _dirtyQueue.end(), keys.begin(), keys.end() );
+    OE_TEST << LC << _name << ": queued " << keys.size() << " dirty tiles" << std::endl;
+}
+
+
+// Collects the keys at one LOD whose extents intersect "extent." The map is
+// ordered by LOD and then by Morton code, so every tile in the extent's tile
+// range lies between the codes of the range's two corners; we walk just that
+// run and drop the few tiles that fall outside the range.
+void
+TileNodeRegistry::findTiles(const GeoExtent& extent,
+                            unsigned         lod,
+                            TileKeyVector&   out_keys) const
+{
+    const Profile* profile = _tiles.begin()->second->getKey().getProfile();
+    if ( !profile )
+        return;
+
+    unsigned tilesWide, tilesHigh;
+    profile->getNumTiles( lod, tilesWide, tilesHigh );
+    if ( tilesWide == 0 || tilesHigh == 0 )
+        return;
+
+    double tileWidth, tileHeight;
+    profile->getTileDimensions( lod, tileWidth, tileHeight );
+    const GeoExtent& pex = profile->getExtent();
+
+    // tile range covering the extent, padded by one to absorb edge round-off;
+    // the exact intersection test below has the final say.
+    int x0 = 0, x1 = (int)tilesWide-1;
+    if ( !extent.crossesAntimeridian() )
+    {
+        x0 = (int)::floor( (extent.xMin() - pex.xMin()) / tileWidth ) - 1;
+        x1 = (int)::floor( (extent.xMax() - pex.xMin()) / tileWidth ) + 1;
+    }
+    int y0 = (int)::floor( (pex.yMax() - extent.yMax()) / tileHeight ) - 1;
+    int y1 = (int)::floor( (pex.yMax() - extent.yMin()) / tileHeight ) + 1;
+
+    x0 = osg::clampBetween( x0, 0, (int)tilesWide-1 );
+    x1 = osg::clampBetween( x1, 0, (int)tilesWide-1 );
+    y0 = osg::clampBetween( y0, 0, (int)tilesHigh-1 );
+    y1 = osg::clampBetween( y1, 0, (int)tilesHigh-1 );
+    if ( x0 > x1 || y0 > y1 )
+        return;
+
+    bool checkSRS = false;
+    PackedTileKey last( lod, x1, y1 );
+    for( TileNodeMap::const_iterator i = _tiles.lower_bound( PackedTileKey(lod, x0, y0) );
+         i != _tiles.end() && !(last < i->first);
+         ++i )
+    {
+        int x = (int)i->first.getTileX();
+        int y = (int)i->first.getTileY();
+        if ( x < x0 || x > x1 || y < y0 || y > y1 )
+            continue;
+
+        if ( extent.intersects(i->second->getKey().getExtent(), checkSRS) )
+            out_keys.push_back( i->first );
+    }
+}
+
+
+void
+TileNodeRegistry::processDirtyTiles()
+{
+    Threading::ScopedMutexLock lock( _dirtyMutex );
+
+    if ( _dirtyQueue.empty() )
+        return;
+
+    // only once per frame, even with several cull traversals.
+    unsigned frame = _frameNumber;
+    if ( frame == _dirtyFrame )
+        return;
+    _dirtyFrame = frame;
+
+    Threading::ScopedReadLock shared( _tilesMutex );
+
+    unsigned budget = _dirtyBudget > 0 ? _dirtyBudget : _dirtyQueue.size();
+    for( unsigned n = 0; n < budget && !_dirtyQueue.empty(); ++n )
+    {
+        // tiles that left the registry in the meantime are simply skipped.
+        TileNodeMap::const_iterator i = _tiles.find( _dirtyQueue.front() );
+        if ( i != _tiles.end() )
+            i->second->setDirty();
+        _dirtyQueue.pop_front();
+    }
 }
 
 
@@ -99,6 +216,14 @@ TileNodeRegistry::add( TileNode* tile )
 {
     if ( tile )
     {
+        // add up the tile's memory outside the lock.
+        if ( _residency.valid() && _residency->isEnabled() )
+        {
+            TileResidencyManager::Usage usage;
+            tile->getUsage( usage );
+            tile->setResidencyEntry( _residency->add(tile->getKey(), usage) );
+        }
+
         Threading::ScopedWriteLock exclusive( _tilesMutex );
         _tiles[ tile->getKey() ] = tile;
         if ( _revisioningEnabled )
@@ -113,7 +238,7 @@ TileNodeRegistry::add( TileNode* tile )
             TileKeyVector& waiters = i->second;
             for(unsigned j=0; j<waiters.size(); )
             {
-                TileKey& waiter = waiters[j];
+                PackedTileKey& waiter = waiters[j];
                 TileNodeMap::iterator k = _tiles.find(waiter);
                 if ( k != _tiles.end() )
                 {
@@ -142,6 +267,9 @@ TileNodeRegistry::remove( TileNode* tile )
         Threading::ScopedWriteLock exclusive( _tilesMutex );
         _tiles.erase( tile->getKey() );
         OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+
+        if ( _residency.valid() )
+            _residency->remove( tile->getKey() );
     }
 }
 
@@ -186,6 +314,9 @@ TileNodeRegistry::take( const TileKey& key, osg::ref_ptr<TileNode>& out_tile )
         out_tile = i->second.get();
         _tiles.erase( i );
         OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+
+        if ( _residency.valid() )
+            _residency->remove( key );
         return true;
     }
     return false;
@@ -31,6 +31,9 @@ using namespace osgEarth;
 //#define OE_TEST OE_INFO
 #define OE_TEST OE_NULL
 
+// ranks prefetch requests below everything the current view needs
+#define PREFETCH_PRIORITY_OFFSET -10.0f
+
 namespace
 {
     // traverses a node graph and moves any TileNodes from the LIVE
@@ -75,9 +78,25 @@ TilePagedLOD::MyProgressCallback::isCanceled()
         cancel();
         stats().clear();
     }
+
+    // a prefetch the camera no longer predicts is abandoned the same way.
+    if (!ProgressCallback::isCanceled() &&
+        _predictive &&
+        ((int)_tiles->getTraversalFrame() - (int)_frameOfLastRequest > 2))
+    {
+        cancel();
+        stats().clear();
+    }
     return ProgressCallback::isCanceled();
 }
 
+void
+TilePagedLOD::MyProgressCallback::request(unsigned frame, bool predictive)
+{
+    _frameOfLastRequest = frame;
+    _predictive         = predictive;
+}
+
 void
 TilePagedLOD::MyProgressCallback::update(unsigned frame)
 {
@@ -97,16 +116,23 @@ TilePagedLOD::MyProgressCallback::update(unsigned frame)
 
 TilePagedLOD::TilePagedLOD(const UID&        engineUID,
                            TileNodeRegistry* live,
-                           TileNodeRegistry* dead) :
+                           TileNodeRegistry* dead,
+                           TileMergeQueue*   mergeQueue,
+                           CameraPredictor*  predictor) :
 osg::PagedLOD(),
-_engineUID( engineUID ),
-_live     ( live ),
-_dead     ( dead )
+_engineUID    ( engineUID ),
+_live         ( live ),
+_dead         ( dead ),
+_mergeQueue   ( mergeQueue ),
+_mergePriority( 0.0f ),
+_predictor    ( predictor )
 {
     if ( live )
     {
         _progress = new MyProgressCallback();
         _progress->_frameOfLastCull = 0;
+        _progress->_frameOfLastRequest = 0;
+        _progress->_predictive = false;
         _progress->_tiles = live;
         osgDB::Options* options = Registry::instance()->cloneOrCreateOptions();
         options->setUserData( _progress.get() );
@@ -121,6 +147,10 @@ TilePagedLOD::~TilePagedLOD()
     // so we still need to process the live/dead list.
     ExpirationCollector collector( _live.get(), _dead.get() );
     this->accept( collector );
+
+    // a child still waiting to merge has live tiles too.
+    if ( _pendingChild.valid() )
+        _pendingChild->accept( collector );
 }
 
 osgDB::Options*
@@ -140,6 +170,55 @@ TilePagedLOD::setChildBoundingBoxAndMatrix(int                     childNum,
     _childBBoxes[childNum] = bbox;
     _childBBoxMatrices.resize(childNum+1);
     _childBBoxMatrices[childNum] = matrix;
+
+    _childBBoxCorners.resize(childNum+1);
+    _childBBoxCorners[childNum].clear();
+    if ( bbox.valid() )
+    {
+        for(unsigned i=0; i<8; ++i)
+            _childBBoxCorners[childNum].push_back( osg::Vec3d(bbox.corner(i)) * matrix );
+    }
+}
+
+// Tests a child's tile-aligned box against the current view frustum, with the
+// eye optionally moved by "eyeOffset". This uses the box corners precomputed in
+// this node's frame, which is much cheaper than pushing a modelview matrix and
+// calling isCulled (that rebuilds the whole culling set). Like any child test,
+// it skips the planes this node's bound is already known to be inside of.
+bool
+TilePagedLOD::isChildCulled(osgUtil::CullVisitor* cv,
+                            unsigned              childNum,
+                            const osg::Vec3d&     eyeOffset) const
+{
+    if ( !cv || childNum >= _childBBoxCorners.size() || _childBBoxCorners[childNum].empty() )
+        return false;
+
+    const osg::Polytope& frustum = cv->getCurrentCullingSet().getFrustum();
+    osg::Polytope::ClippingMask mask = frustum.getCurrentMask();
+    if ( mask == 0 )
+        return false;
+
+    const std::vector<osg::Vec3d>& corners = _childBBoxCorners[childNum];
+    const osg::Polytope::PlaneList& planes = frustum.getPlaneList();
+
+    osg::Polytope::ClippingMask selector = 1;
+    for( osg::Polytope::PlaneList::const_iterator p = planes.begin(); p != planes.end(); ++p, selector <<= 1 )
+    {
+        if ( (mask & selector) == 0 )
+            continue;
+
+        bool allOutside = true;
+        for( unsigned c=0; c<corners.size() && allOutside; ++c )
+        {
+            if ( p->distance(corners[c] - eyeOffset) >= 0.0 )
+                allOutside = false;
+        }
+
+        if ( allOutside )
+            return true;
+    }
+
+    return false;
 }
 
 TileNode*
@@ -190,6 +269,15 @@ TilePagedLOD::addChild(osg::Node* node)
             _live->listenFor( key.createNeighborKey(0, 1), tilenode );
         }
 
+        // Anything else is a subtile set from the pager; if there's a merge
+        // budget, let the queue decide when it goes in.
+        else if ( _mergeQueue.valid() && _mergeQueue->isEnabled() && !_pendingChild.valid() )
+        {
+            _pendingChild = node;
+            _mergeQueue->add( this );
+            return true;
+        }
+
         return osg::PagedLOD::addChild( node );
     }
 
@@ -197,6 +285,114 @@ TilePagedLOD::addChild(osg::Node* node)
 }
 
 
+bool
+TilePagedLOD::mergePendingChild()
+{
+    if ( !_pendingChild.valid() )
+        return false;
+
+    osg::ref_ptr<osg::Node> child = _pendingChild.get();
+    _pendingChild = 0L;
+    return osg::PagedLOD::addChild( child.get() );
+}
+
+
+// Ranks a pending child for the merge queue: tiles that are large on screen
+// and near the center of the view go first.
+float
+TilePagedLOD::computeMergePriority(osg::NodeVisitor& nv) const
+{
+    osgUtil::CullVisitor* cv = Culling::asCullVisitor( nv );
+    if ( !cv || !cv->getModelViewMatrix() || !cv->getProjectionMatrix() )
+        return 0.0f;
+
+    const osg::BoundingSphere& bs = getBound();
+
+    float pixelSize = cv->clampedPixelSize( bs );
+
+    osg::Matrix mvp = (*cv->getModelViewMatrix()) * (*cv->getProjectionMatrix());
+    osg::Vec3d ndc = bs.center() * mvp;
+    double offCenter = osg::Vec2d(ndc.x(), ndc.y()).length();
+
+    return pixelSize / (float)(1.0 + offCenter);
+}
+
+
+// Requests the next (unloaded) child, at low priority, if the LOD test would
+// pass at the eye position the CameraPredictor expects a few frames from now.
+// Nothing has to cancel a wrong guess explicitly: the pager drops requests
+// that aren't renewed, and MyProgressCallback cancels a predictive build once
+// it stops being requested.
+void
+TilePagedLOD::prefetchChild(osg::NodeVisitor& nv)
+{
+    unsigned numChildren = _children.size();
+    if (_disableExternalChildrenPaging ||
+        !nv.getDatabaseRequestHandler() ||
+        numChildren >= _perRangeDataList.size() ||
+        numChildren >= _rangeList.size())
+    {
+        return;
+    }
+
+    osgUtil::CullVisitor* cv = Culling::asCullVisitor( nv );
+    if ( !cv || !cv->getCurrentCamera() || !cv->getModelViewMatrix() )
+        return;
+
+    osg::Vec3d offset;
+    if ( !_predictor->getPredictedOffset(cv->getCurrentCamera(), offset) )
+        return;
+
+    // the LOD metric at the predicted eye:
+    osg::Vec3d eye = cv->getViewPointLocal();
+    double currentDistance   = (osg::Vec3d(getCenter()) - eye).length();
+    double predictedDistance = (osg::Vec3d(getCenter()) - (eye + offset)).length();
+
+    float required_range = 0.0f;
+    if (_rangeMode==DISTANCE_FROM_EYE_POINT)
+    {
+        required_range = (float)predictedDistance * cv->getLODScale();
+    }
+    else
+    {
+        if ( cv->getLODScale() <= 0.0f || predictedDistance <= 0.0 )
+            return;
+
+        // screen size goes inversely with distance.
+        required_range =
+            cv->clampedPixelSize(getBound()) / cv->getLODScale() *
+            (float)(currentDistance / predictedDistance);
+    }
+
+    if (required_range <  _rangeList[numChildren].first ||
+        required_range >= _rangeList[numChildren].second)
+    {
+        return;
+    }
+
+    // check visibility against the frustum moved to the predicted eye.
+    if ( isChildCulled(cv, numChildren, offset) )
+        return;
+
+    float priority = (_rangeList[numChildren].second-required_range)/(_rangeList[numChildren].second-_rangeList[numChildren].first);
+    if(_rangeMode==PIXEL_SIZE_ON_SCREEN)
+    {
+        priority = -priority;
+    }
+    priority = _perRangeDataList[numChildren]._priorityOffset + priority * _perRangeDataList[numChildren]._priorityScale;
+    priority += PREFETCH_PRIORITY_OFFSET;
+
+    if ( _progress.valid() && nv.getFrameStamp() )
+        _progress->request( nv.getFrameStamp()->getFrameNumber(), true );
+
+    std::string filename = _databasePath.empty() ?
+        _perRangeDataList[numChildren]._filename :
+        _databasePath + _perRangeDataList[numChildren]._filename;
+
+    nv.getDatabaseRequestHandler()->requestNodeFile(filename, nv.getNodePath(), priority, nv.getFrameStamp(), _perRangeDataList[numChildren]._databaseRequest, _databaseOptions.get());
+}
+
+
 // MOST of this is copied and pasted from OSG's osg::PagedLOD::traverse,
 // except where otherwise noted with an "osgEarth" comment.
 void
@@ -289,8 +485,15 @@ TilePagedLOD::traverse(osg::NodeVisitor& nv)
                     _children[numChildren-1]->accept(nv);
                 }
 
+                // osgEarth: if the child already arrived and is waiting to merge,
+                // don't request it again; just rank it for the merge queue.
+                if (_pendingChild.valid())
+                {
+                    _mergePriority = computeMergePriority(nv);
+                }
+
                 // now request the loading of the next unloaded child.
-                if (!_disableExternalChildrenPaging &&
+                else if (!_disableExternalChildrenPaging &&
                     nv.getDatabaseRequestHandler() &&
                     numChildren<_perRangeDataList.size())
                 {
@@ -298,21 +501,16 @@ TilePagedLOD::traverse(osg::NodeVisitor& nv)
                     // Intersect the tile's earth-aligned bounding box with the current culling frustum.
                     bool tileIsVisible = true;
 
-                    if (nv.getVisitorType() == nv.CULL_VISITOR &&
-                        numChildren < _childBBoxes.size() &&
-                        _childBBoxes[numChildren].valid())
+                    if (nv.getVisitorType() == nv.CULL_VISITOR)
                     {
-                        osgUtil::CullVisitor* cv = Culling::asCullVisitor( nv );
-                        // wish that CullStack::createOrReuseRefMatrix() was public
-                        osg::ref_ptr<osg::RefMatrix> mvm = new osg::RefMatrix(*cv->getModelViewMatrix());
-                        mvm->preMult( _childBBoxMatrices[numChildren] );
-                        cv->pushModelViewMatrix( mvm.get(), osg::Transform::RELATIVE_RF );
-                        tileIsVisible = !cv->isCulled( _childBBoxes[numChildren] );
-                        cv->popModelViewMatrix();
+                        tileIsVisible = !isChildCulled( Culling::asCullVisitor(nv), numChildren, osg::Vec3d(0,0,0) );
                     }
 
                     if ( tileIsVisible )
                     {
+                        if ( _progress.valid() )
+                            _progress->request( frameNumber, false );
+
                         // [end:osgEarth]
 
                         // compute priority from where abouts in the required range the distance falls.
@@ -340,6 +538,13 @@ TilePagedLOD::traverse(osg::NodeVisitor& nv)
                 }
             }
 
+            // osgEarth: if the camera is heading towards this tile, get the next
+            // child started early.
+            else if (_predictor.valid() && _predictor->isEnabled() && !_pendingChild.valid())
+            {
+                prefetchChild(nv);
+            }
+
            break;
         }
         default:
@@ -374,16 +579,39 @@ TilePagedLOD::removeExpiredChildren(double         expiryTime,
             _perRangeDataList[cindex]._timeStamp   + minExpiryTime   < expiryTime &&
             _perRangeDataList[cindex]._frameNumber + minExpiryFrames < expiryFrame)
         {
-            osg::Node* nodeToRemove = _children[cindex].get();
-            removedChildren.push_back(nodeToRemove);
-
-            ExpirationCollector collector( _live.get(), _dead.get() );
-            nodeToRemove->accept( collector );
-
-            OE_DEBUG << LC << "Expired " << collector._count << std::endl;
+            expireChild( cindex, removedChildren );
+            return true;
+        }
+    }
+    return false;
+}
 
-            return Group::removeChildren(cindex,1);
+bool
+TilePagedLOD::evictChildren()
+{
+    if (_children.size() > _numChildrenThatCannotBeExpired)
+    {
+        unsigned cindex = _children.size() - 1;
+        if ( !_perRangeDataList[cindex]._filename.empty() )
+        {
+            osg::NodeList removedChildren;
+            expireChild( cindex, removedChildren );
+            return true;
         }
     }
     return false;
 }
+
+void
+TilePagedLOD::expireChild(unsigned cindex, osg::NodeList& removedChildren)
+{
+    osg::Node* nodeToRemove = _children[cindex].get();
+    removedChildren.push_back(nodeToRemove);
+
+    ExpirationCollector collector( _live.get(), _dead.get() );
+    nodeToRemove->accept( collector );
+
+    OE_DEBUG << LC << "Expired " << collector._count << std::endl;
+
+    Group::removeChildren(cindex,1);
+}
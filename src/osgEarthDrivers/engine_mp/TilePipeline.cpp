@@ -0,0 +1,140 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "TilePipeline"
+#include <osgEarth/Registry>
+#include <algorithm>
+
+using namespace osgEarth::Drivers::MPTerrainEngine;
+using namespace osgEarth;
+
+#define LC "[TilePipeline] "
+
+namespace
+{
+    typedef TilePipeline::Job Job;
+
+    /** Output of the CPU stage; wraps the node, which may be NULL. */
+    struct JobResult : public osg::Referenced
+    {
+        osg::ref_ptr<osg::Node> _node;
+    };
+
+    /**
+     * Runs the I/O stage of a job and resolves with the job itself, or with
+     * NULL if the job stopped or was canceled.
+     */
+    struct IOStageTask : public TaskRequest
+    {
+        IOStageTask( Job* job, ProgressCallback* progress ) : _job( job ), _progress( progress )
+        {
+            // lets the service drop the task without running it once canceled:
+            setProgressCallback( progress );
+        }
+
+        void operator()( ProgressCallback* )
+        {
+            bool ok =
+                !(_progress.valid() && _progress->isCanceled()) &&
+                _job->runIOStage( _progress.get() );
+
+            _promise.resolve( ok ? _job.get() : 0L );
+        }
+
+        // a task dropped from the queue never runs; resolve with NULL so
+        // the waiting caller does not wait forever.
+        virtual ~IOStageTask() { _promise.resolve( 0L ); }
+
+        osg::ref_ptr<Job>              _job;
+        osg::ref_ptr<ProgressCallback> _progress;
+        Promise<Job>                   _promise;
+    };
+
+    /**
+     * Runs the CPU stage of a job that made it through the I/O stage.
+     */
+    struct CPUStageOperation : public FutureOperation<Job, JobResult>
+    {
+        CPUStageOperation( ProgressCallback* progress ) : _progress( progress ) { }
+
+        JobResult* operator()( Job* job, ProgressCallback* )
+        {
+            if ( !job || (_progress.valid() && _progress->isCanceled()) )
+                return 0L;
+
+            JobResult* result = new JobResult();
+            result->_node = job->runCPUStage( _progress.get() );
+            return result;
+        }
+
+        osg::ref_ptr<ProgressCallback> _progress;
+    };
+}
+
+//------------------------------------------------------------------------
+
+TilePipeline::TilePipeline(unsigned ioThreads,
+                           unsigned cpuThreads,
+                           unsigned queueSize)
+{
+    _ioService = new TaskService( "MP Tile IO", std::max(ioThreads, 1u), queueSize );
+    Registry::instance()->registerTaskService( _ioService.get() );
+
+    _cpuService = new TaskService( "MP Tile CPU", std::max(cpuThreads, 1u), queueSize );
+    Registry::instance()->registerTaskService( _cpuService.get() );
+
+    OE_INFO << LC << "Tile pipeline: "
+        << _ioService->getNumThreads() << " I/O threads, "
+        << _cpuService->getNumThreads() << " CPU threads, queue size "
+        << queueSize << std::endl;
+}
+
+osg::Node*
+TilePipeline::run(Job* job, ProgressCallback* progress)
+{
+    if ( !job || (progress && progress->isCanceled()) )
+        return 0L;
+
+    Future<JobResult> result;
+    {
+        // only the I/O queue may hold the task; once it runs or gets dropped,
+        // its destructor has to be free to resolve the chain.
+        osg::ref_ptr<IOStageTask> task = new IOStageTask( job, progress );
+
+        result = task->_promise.getFuture().then<JobResult>(
+            _cpuService.get(),
+            new CPUStageOperation( progress ) );
+
+        // blocks while the I/O stage is full:
+        _ioService->add( task.get() );
+    }
+
+    osg::ref_ptr<JobResult> output = result.get();
+    return output.valid() ? output->_node.release() : 0L;
+}
+
+void
+TilePipeline::dumpMetrics(std::ostream& out) const
+{
+    TaskServiceMetrics io, cpu;
+    _ioService->getMetrics( io );
+    _cpuService->getMetrics( cpu );
+
+    io.dump( out );
+    cpu.dump( out );
+}
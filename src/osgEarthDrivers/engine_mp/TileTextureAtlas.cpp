@@ -0,0 +1,261 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "TileTextureAtlas"
+#include <osgEarth/ImageUtils>
+#include <osgEarth/Registry>
+
+using namespace osgEarth::Drivers::MPTerrainEngine;
+using namespace osgEarth;
+
+#define LC "[TileTextureAtlas] "
+
+//----------------------------------------------------------------------------
+
+namespace
+{
+    // atlas pages don't mipmap, so strip the mipmap part of a min filter.
+    osg::Texture::FilterMode noMipmap(osg::Texture::FilterMode mode)
+    {
+        return
+            mode == osg::Texture::NEAREST ||
+            mode == osg::Texture::NEAREST_MIPMAP_NEAREST ||
+            mode == osg::Texture::NEAREST_MIPMAP_LINEAR ?
+            osg::Texture::NEAREST :
+            osg::Texture::LINEAR;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+TileTextureAtlas::Slot::Slot(Page*             page,
+                             unsigned          cell,
+                             const osg::Vec4f& region,
+                             unsigned          bytes) :
+_page  ( page ),
+_cell  ( cell ),
+_region( region ),
+_bytes ( bytes )
+{
+    //nop
+}
+
+TileTextureAtlas::Slot::~Slot()
+{
+    _page->release( _cell );
+}
+
+osg::Texture*
+TileTextureAtlas::Slot::getTexture() const
+{
+    return _page->_texture.get();
+}
+
+void
+TileTextureAtlas::Page::release(unsigned cell)
+{
+    // the stale pixels stay in the page until the cell is reused.
+    Threading::ScopedMutexLock lock( _mutex );
+    _freeCells.push_back( cell );
+}
+
+//----------------------------------------------------------------------------
+
+bool
+TileTextureAtlas::PageKey::operator < (const PageKey& rhs) const
+{
+    if ( _s              != rhs._s )              return _s              < rhs._s;
+    if ( _t              != rhs._t )              return _t              < rhs._t;
+    if ( _internalFormat != rhs._internalFormat ) return _internalFormat < rhs._internalFormat;
+    if ( _pixelFormat    != rhs._pixelFormat )    return _pixelFormat    < rhs._pixelFormat;
+    if ( _dataType       != rhs._dataType )       return _dataType       < rhs._dataType;
+    if ( _minFilter      != rhs._minFilter )      return _minFilter      < rhs._minFilter;
+    if ( _magFilter      != rhs._magFilter )      return _magFilter      < rhs._magFilter;
+    if ( _compression    != rhs._compression )    return _compression    < rhs._compression;
+    return _coverage < rhs._coverage;
+}
+
+//----------------------------------------------------------------------------
+
+TileTextureAtlas::TileTextureAtlas(unsigned maxImageSize,
+                                   unsigned pageSize) :
+_maxImageSize( maxImageSize ),
+_pageSize    ( osg::maximum(pageSize, maxImageSize) )
+{
+    //nop
+}
+
+unsigned
+TileTextureAtlas::getNumPages() const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    unsigned count = 0;
+    for(PageMap::const_iterator i = _pages.begin(); i != _pages.end(); ++i)
+        count += i->second.size();
+    return count;
+}
+
+TileTextureAtlas::Page*
+TileTextureAtlas::createPage(const PageKey&     key,
+                             const ImageLayer*  layer,
+                             const osg::Image*  image) const
+{
+    Page* page = new Page();
+    page->_cellS = image->s();
+    page->_cellT = image->t();
+    page->_cols  = osg::maximum(1u, _pageSize / page->_cellS);
+    page->_rows  = osg::maximum(1u, _pageSize / page->_cellT);
+
+    page->_image = new osg::Image();
+    page->_image->allocateImage(
+        page->_cols * page->_cellS,
+        page->_rows * page->_cellT,
+        1,
+        image->getPixelFormat(),
+        image->getDataType(),
+        image->getPacking() );
+    page->_image->setInternalTextureFormat( image->getInternalTextureFormat() );
+    ::memset( page->_image->data(), 0, page->_image->getTotalSizeInBytes() );
+
+    // fill cells from the front of the page.
+    unsigned numCells = page->_cols * page->_rows;
+    page->_freeCells.reserve( numCells );
+    for(unsigned i = numCells; i > 0; --i)
+        page->_freeCells.push_back( i-1 );
+
+    osg::Texture2D* tex = new osg::Texture2D( page->_image.get() );
+
+    // the page image is updated in place as cells come and go.
+    tex->setUnRefImageDataAfterApply( false );
+    tex->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    tex->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+    tex->setResizeNonPowerOfTwoHint( false );
+
+    if ( key._coverage )
+    {
+        tex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+        tex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
+        tex->setMaxAnisotropy( 1.0f );
+    }
+    else
+    {
+        tex->setFilter( osg::Texture::MIN_FILTER, (osg::Texture::FilterMode)key._minFilter );
+        tex->setFilter( osg::Texture::MAG_FILTER, (osg::Texture::FilterMode)key._magFilter );
+        tex->setMaxAnisotropy( 4.0f );
+    }
+
+    layer->applyTextureCompressionMode( tex );
+
+    page->_texture = tex;
+
+    OE_DEBUG << LC << "New " << page->_image->s() << "x" << page->_image->t()
+        << " page for " << page->_cellS << "x" << page->_cellT << " images" << std::endl;
+
+    return page;
+}
+
+TileTextureAtlas::Slot*
+TileTextureAtlas::allocate(const ImageLayer* layer, const osg::Image* image)
+{
+    if ( !layer || !image || !image->data() )
+        return 0L;
+
+    // shared layers are bound to their own samplers by name.
+    if ( layer->isShared() )
+        return 0L;
+
+    if (image->r() > 1 ||
+        image->s() < 2 || image->t() < 2 ||
+        (unsigned)image->s() > _maxImageSize ||
+        (unsigned)image->t() > _maxImageSize ||
+        image->isMipmap() ||
+        ImageUtils::isCompressed(image) )
+    {
+        return 0L;
+    }
+
+    const ImageLayerOptions& options = layer->getImageLayerOptions();
+
+    // "fastdxt" compresses the texture's image in place, which a page can't take.
+    if ( options.textureCompression() == (osg::Texture::InternalFormatMode)(~0 - 1) )
+        return 0L;
+
+    PageKey key;
+    key._s              = image->s();
+    key._t              = image->t();
+    key._internalFormat = image->getInternalTextureFormat();
+    key._pixelFormat    = image->getPixelFormat();
+    key._dataType       = image->getDataType();
+    key._coverage       = layer->isCoverage();
+    key._minFilter      = key._coverage ? osg::Texture::NEAREST : noMipmap(options.minFilter().get());
+    key._magFilter      = key._coverage ? osg::Texture::NEAREST : options.magFilter().get();
+    key._compression    = options.textureCompression().isSet() ? (int)options.textureCompression().get() : -1;
+
+    osg::ref_ptr<Page> page;
+    unsigned cell = 0;
+
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+
+        std::vector< osg::ref_ptr<Page> >& pages = _pages[key];
+        for(unsigned i = 0; i < pages.size() && !page.valid(); ++i)
+        {
+            Threading::ScopedMutexLock pageLock( pages[i]->_mutex );
+            if ( !pages[i]->_freeCells.empty() )
+            {
+                page = pages[i].get();
+                cell = page->_freeCells.back();
+                page->_freeCells.pop_back();
+            }
+        }
+
+        if ( !page.valid() )
+        {
+            page = createPage( key, layer, image );
+            cell = page->_freeCells.back();
+            page->_freeCells.pop_back();
+            pages.push_back( page.get() );
+        }
+    }
+
+    unsigned col = (cell % page->_cols) * page->_cellS;
+    unsigned row = (cell / page->_cols) * page->_cellT;
+
+    {
+        // the whole page uploads again on the next apply; several new
+        // tiles in one frame still cost a single upload.
+        Threading::ScopedMutexLock pageLock( page->_mutex );
+        if ( !ImageUtils::copyAsSubImage(image, page->_image.get(), col, row) )
+        {
+            page->_freeCells.push_back( cell );
+            return 0L;
+        }
+        page->_image->dirty();
+    }
+
+    // inset by half a texel so linear filtering never reaches the neighbors.
+    float W = (float)page->_image->s();
+    float H = (float)page->_image->t();
+    osg::Vec4f region(
+        ((float)col + 0.5f) / W,
+        ((float)row + 0.5f) / H,
+        ((float)page->_cellS - 1.0f) / W,
+        ((float)page->_cellT - 1.0f) / H );
+
+    return new Slot( page.get(), cell, region, image->getTotalSizeInBytes() );
+}
@@ -0,0 +1,333 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "TileVirtualTexture"
+#include <osgEarth/ImageUtils>
+#include <osg/FrameStamp>
+#include <osg/GL>
+
+using namespace osgEarth::Drivers::MPTerrainEngine;
+using namespace osgEarth;
+
+#define LC "[TileVirtualTexture] "
+
+//----------------------------------------------------------------------------
+
+namespace
+{
+    // pages don't mipmap, so strip the mipmap part of a min filter.
+    osg::Texture::FilterMode noMipmap(osg::Texture::FilterMode mode)
+    {
+        return
+            mode == osg::Texture::NEAREST ||
+            mode == osg::Texture::NEAREST_MIPMAP_NEAREST ||
+            mode == osg::Texture::NEAREST_MIPMAP_LINEAR ?
+            osg::Texture::NEAREST :
+            osg::Texture::LINEAR;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+/**
+ * Allocates the physical texture when it is first applied in a GC, and
+ * uploads the pages claimed since the last apply on every apply after that.
+ */
+struct TileVirtualTexture::Subload : public osg::Texture2D::SubloadCallback
+{
+    Subload(TileVirtualTexture* vt) : _vt(vt) { }
+
+    void load(const osg::Texture2D& texture, osg::State& state) const
+    {
+        osg::ref_ptr<TileVirtualTexture> vt;
+        if ( _vt.lock(vt) )
+            vt->upload( state, true );
+    }
+
+    void subload(const osg::Texture2D& texture, osg::State& state) const
+    {
+        osg::ref_ptr<TileVirtualTexture> vt;
+        if ( _vt.lock(vt) )
+            vt->upload( state, false );
+    }
+
+    osg::observer_ptr<TileVirtualTexture> _vt;
+};
+
+//----------------------------------------------------------------------------
+
+TileVirtualTexture::Tile::Tile(TileVirtualTexture* vt,
+                               const osg::Image*   image,
+                               const osg::Vec4d&   bounds,
+                               const Tile*         parent) :
+_vt    ( vt ),
+_image ( image ),
+_bounds( bounds ),
+_parent( parent ),
+_page  ( -1 )
+{
+    //nop
+}
+
+TileVirtualTexture::Tile::~Tile()
+{
+    _vt->release( this );
+}
+
+bool
+TileVirtualTexture::Tile::resolve(unsigned frameNumber, osg::Vec4f& out_region) const
+{
+    return _vt->resolve( this, frameNumber, out_region );
+}
+
+//----------------------------------------------------------------------------
+
+TileVirtualTexture::TileVirtualTexture(const ImageLayer* layer,
+                                       unsigned          textureSize) :
+_textureSize   ( textureSize ),
+_pageS         ( 0 ),
+_pageT         ( 0 ),
+_internalFormat( 0 ),
+_pixelFormat   ( 0 ),
+_dataType      ( 0 ),
+_cols          ( 0 ),
+_rows          ( 0 ),
+_revision      ( 0 )
+{
+    const ImageLayerOptions& options = layer->getImageLayerOptions();
+    _coverage  = layer->isCoverage();
+    _minFilter = _coverage ? osg::Texture::NEAREST : noMipmap(options.minFilter().get());
+    _magFilter = _coverage ? osg::Texture::NEAREST : options.magFilter().get();
+
+    _texture = new osg::Texture2D();
+    _texture->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    _texture->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+    _texture->setResizeNonPowerOfTwoHint( false );
+    _texture->setFilter( osg::Texture::MIN_FILTER, _minFilter );
+    _texture->setFilter( osg::Texture::MAG_FILTER, _magFilter );
+    _texture->setMaxAnisotropy( _coverage ? 1.0f : 4.0f );
+    _texture->setSubloadCallback( new Subload(this) );
+}
+
+unsigned
+TileVirtualTexture::getNumPages() const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    return _pages.size();
+}
+
+TileVirtualTexture::Tile*
+TileVirtualTexture::createTile(const osg::Image* image,
+                               const GeoExtent&  extent,
+                               const Tile*       parent)
+{
+    if ( !image || !image->data() || !extent.isValid() )
+        return 0L;
+
+    if (image->r() > 1 ||
+        image->s() < 2 || image->t() < 2 ||
+        image->isMipmap() ||
+        ImageUtils::isCompressed(image) )
+    {
+        return 0L;
+    }
+
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+
+        // the first tile sets the page size and format.
+        if ( _pages.empty() )
+        {
+            _pageS          = image->s();
+            _pageT          = image->t();
+            _internalFormat = image->getInternalTextureFormat();
+            _pixelFormat    = image->getPixelFormat();
+            _dataType       = image->getDataType();
+            _cols           = osg::maximum(1u, _textureSize / (unsigned)_pageS);
+            _rows           = osg::maximum(1u, _textureSize / (unsigned)_pageT);
+
+            unsigned numPages = _cols * _rows;
+            _pages.resize( numPages );
+            _freePages.reserve( numPages );
+            for(unsigned i = numPages; i > 0; --i)
+                _freePages.push_back( i-1 );
+
+            _texture->setTextureSize( _cols * _pageS, _rows * _pageT );
+            _texture->setInternalFormat( _internalFormat );
+            _texture->setSourceFormat( _pixelFormat );
+            _texture->setSourceType( _dataType );
+
+            OE_INFO << LC << "Paging " << _pageS << "x" << _pageT << " tiles through a "
+                << _cols * _pageS << "x" << _rows * _pageT << " texture ("
+                << numPages << " pages)" << std::endl;
+        }
+
+        if (image->s() != _pageS ||
+            image->t() != _pageT ||
+            image->getInternalTextureFormat() != _internalFormat ||
+            image->getPixelFormat() != _pixelFormat ||
+            image->getDataType() != _dataType )
+        {
+            return 0L;
+        }
+    }
+
+    // only a parent paged through this texture can stand in for the tile.
+    if ( parent && parent->_vt.get() != this )
+        parent = 0L;
+
+    osg::Vec4d bounds( extent.xMin(), extent.yMin(), extent.width(), extent.height() );
+    return new Tile( this, image, bounds, parent );
+}
+
+osg::Vec4f
+TileVirtualTexture::getPageRegion(unsigned page) const
+{
+    // inset by half a texel so linear filtering never reaches the neighbors.
+    float W = (float)(_cols * _pageS);
+    float H = (float)(_rows * _pageT);
+    unsigned col = (page % _cols) * _pageS;
+    unsigned row = (page / _cols) * _pageT;
+    return osg::Vec4f(
+        ((float)col + 0.5f) / W,
+        ((float)row + 0.5f) / H,
+        ((float)_pageS - 1.0f) / W,
+        ((float)_pageT - 1.0f) / H );
+}
+
+bool
+TileVirtualTexture::claimPage(const Tile* tile, unsigned frameNumber)
+{
+    unsigned page;
+    if ( !_freePages.empty() )
+    {
+        page = _freePages.back();
+        _freePages.pop_back();
+    }
+    else
+    {
+        // take over the page drawn longest ago, but never one drawn this
+        // frame: that tile would only claim a page of its own again.
+        unsigned oldest = ~0u;
+        for(unsigned i = 0; i < _pages.size(); ++i)
+        {
+            if ( _pages[i]._lastFrame < frameNumber && (oldest == ~0u || _pages[i]._lastFrame < _pages[oldest]._lastFrame) )
+                oldest = i;
+        }
+        if ( oldest == ~0u )
+            return false;
+
+        page = oldest;
+        _pages[page]._tile->_page = -1;
+    }
+
+    Page& p = _pages[page];
+    p._tile      = tile;
+    p._lastFrame = frameNumber;
+    p._revision  = ++_revision;
+    tile->_page  = (int)page;
+    return true;
+}
+
+bool
+TileVirtualTexture::resolve(const Tile* tile, unsigned frameNumber, osg::Vec4f& out_region)
+{
+    Threading::ScopedMutexLock lock( _mutex );
+
+    if ( tile->_page < 0 )
+        claimPage( tile, frameNumber );
+
+    for(const Tile* t = tile; t != 0L; t = t->_parent.get())
+    {
+        if ( t->_page >= 0 )
+        {
+            _pages[t->_page]._lastFrame = frameNumber;
+            out_region = getPageRegion( t->_page );
+
+            // an ancestor's page holds the tile in a part of its image.
+            if ( t != tile && t->_bounds.z() > 0.0 && t->_bounds.w() > 0.0 )
+            {
+                float s0 = (float)((tile->_bounds.x() - t->_bounds.x()) / t->_bounds.z());
+                float t0 = (float)((tile->_bounds.y() - t->_bounds.y()) / t->_bounds.w());
+                float ss = (float)(tile->_bounds.z() / t->_bounds.z());
+                float ts = (float)(tile->_bounds.w() / t->_bounds.w());
+                out_region.set(
+                    out_region.x() + s0*out_region.z(),
+                    out_region.y() + t0*out_region.w(),
+                    ss*out_region.z(),
+                    ts*out_region.w() );
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+TileVirtualTexture::release(const Tile* tile)
+{
+    // the stale pixels stay in the page until it is claimed again.
+    Threading::ScopedMutexLock lock( _mutex );
+    if ( tile->_page >= 0 )
+    {
+        Page& p = _pages[tile->_page];
+        p._tile      = 0L;
+        p._lastFrame = 0;
+        _freePages.push_back( (unsigned)tile->_page );
+        tile->_page = -1;
+    }
+}
+
+void
+TileVirtualTexture::upload(osg::State& state, bool allocate) const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+
+    unsigned& uploaded = _uploaded[state.getContextID()];
+
+    if ( allocate )
+    {
+        glTexImage2D(
+            GL_TEXTURE_2D, 0, _internalFormat,
+            _cols * _pageS, _rows * _pageT, 0,
+            _pixelFormat, _dataType, 0L );
+        uploaded = 0;
+    }
+
+    if ( uploaded == _revision )
+        return;
+
+    for(unsigned i = 0; i < _pages.size(); ++i)
+    {
+        const Page& p = _pages[i];
+        if ( p._tile && p._revision > uploaded )
+        {
+            const osg::Image* image = p._tile->_image.get();
+            glPixelStorei( GL_UNPACK_ALIGNMENT, image->getPacking() );
+            glTexSubImage2D(
+                GL_TEXTURE_2D, 0,
+                (i % _cols) * _pageS, (i / _cols) * _pageT,
+                _pageS, _pageT,
+                _pixelFormat, _dataType,
+                image->data() );
+        }
+    }
+
+    uploaded = _revision;
+}
@@ -899,12 +899,8 @@ OSGTerrainEngineNode::updateTextureCombining()
                 // install the wrapper function that calls all the filters in turn:
                 vp->setShader( layerFilterFunc, sf->createColorFilterChainFragmentShader(layerFilterFunc, chain) );
 
-                // install each of the filter entry points:
-                for( ColorFilterChain::const_iterator j = chain.begin(); j != chain.end(); ++j )
-                {
-                    const ColorFilter* filter = j->get();
-                    filter->install( terrainStateSet );
-                }
+                // install the bindings (and any entry points) the filters need:
+                ColorFilterChainCompiler::install( chain, terrainStateSet );
             }
         }
 
@@ -109,3 +109,19 @@ CustomPagedLOD::removeChildren(unsigned pos, unsigned numChildrenToRemove)
     }
     return osg::PagedLOD::removeChildren( pos, numChildrenToRemove );
 }
+
+
+bool
+CustomPagedLOD::evictChildren()
+{
+    // like PagedLOD::removeExpiredChildren, this keeps the range data so the
+    // pager can load the children again. The tiles leave the registry as their
+    // paged LODs destruct.
+    if ( _children.size() > _numChildrenThatCannotBeExpired )
+    {
+        unsigned cindex = _children.size() - 1;
+        if ( !_perRangeDataList[cindex]._filename.empty() )
+            return Group::removeChildren( cindex, 1 );
+    }
+    return false;
+}
@@ -18,9 +18,11 @@
 */
 #include "QuadTreeTerrainEngineNode"
 #include "SerialKeyNodeFactory"
+#include "ParallelKeyNodeFactory"
 #include "TerrainNode"
 #include "TileModelFactory"
 #include "TileModelCompiler"
+#include "CustomPagedLOD"
 
 #include <osgEarth/HeightFieldUtils>
 #include <osgEarth/ImageUtils>
@@ -171,6 +173,7 @@ QuadTreeTerrainEngineNode::postInitialize( const Map* map, const TerrainOptions&
 
     // a shared registry for tile nodes in the scene graph.
     _liveTiles = new TileNodeRegistry("live");
+    _liveTiles->setResidencyManager( getResidencyManager() );
 
     // set up a registry for quick release:
     if ( _terrainOptions.quickReleaseGLObjects() == true )
@@ -181,6 +184,17 @@ QuadTreeTerrainEngineNode::postInitialize( const Map* map, const TerrainOptions&
     // initialize the model factory:
     _tileModelFactory = new TileModelFactory(getMap(), _liveTiles.get(), _terrainOptions );
 
+    // a thread pool for building child tiles concurrently:
+    if ( _terrainOptions.parallelTileBuild() == true )
+    {
+        unsigned num = *_terrainOptions.numTileBuildThreads();
+        if ( num == 0 )
+            num = 2 * OpenThreads::GetNumberOfProcessors();
+
+        _tileBuildService = new TaskService( "QuadTreeTileBuilder", num );
+        OE_INFO << LC << "Building child tiles in parallel on " << num << " threads" << std::endl;
+    }
+
 
     // handle an already-established map profile:
     if ( _update_mapf->getProfile() )
@@ -337,15 +351,31 @@ QuadTreeTerrainEngineNode::getKeyNodeFactory()
             _terrainOptions );
 
         // initialize a key node factory.
-        knf = new SerialKeyNodeFactory( 
-            _tileModelFactory.get(),
-            compiler,
-            _liveTiles.get(),
-            _deadTiles.get(),
-            _terrainOptions, 
-            MapInfo( getMap() ),
-            _terrain, 
-            _uid );
+        if ( _tileBuildService.valid() )
+        {
+            knf = new ParallelKeyNodeFactory(
+                _tileModelFactory.get(),
+                compiler,
+                _liveTiles.get(),
+                _deadTiles.get(),
+                _terrainOptions,
+                MapInfo( getMap() ),
+                _terrain,
+                _uid,
+                _tileBuildService.get() );
+        }
+        else
+        {
+            knf = new SerialKeyNodeFactory( 
+                _tileModelFactory.get(),
+                compiler,
+                _liveTiles.get(),
+                _deadTiles.get(),
+                _terrainOptions, 
+                MapInfo( getMap() ),
+                _terrain, 
+                _uid );
+        }
     }
 
     return knf.get();
@@ -577,12 +607,8 @@ QuadTreeTerrainEngineNode::updateTextureCombining()
                 // install the wrapper function that calls all the color filters in turn:
                 vp->setShader( layerFilterFunc, sf->createColorFilterChainFragmentShader(layerFilterFunc, chain) );
 
-                // install each of the filter entry points:
-                for( ColorFilterChain::const_iterator j = chain.begin(); j != chain.end(); ++j )
-                {
-                    const ColorFilter* filter = j->get();
-                    filter->install( terrainStateSet );
-                }
+                // install the bindings (and any entry points) the filters need:
+                ColorFilterChainCompiler::install( chain, terrainStateSet );
             }
         }
 
@@ -627,3 +653,19 @@ QuadTreeTerrainEngineNode::onVerticalScaleChanged()
     UpdateElevationVisitor visitor( getKeyNodeFactory()->getCompiler() );
     this->accept(visitor);
 }
+
+void
+QuadTreeTerrainEngineNode::onEvictTiles(const std::vector<TileKey>& parentKeys)
+{
+    // each tile's children hang off the CustomPagedLOD that holds the tile.
+    for( std::vector<TileKey>::const_iterator i = parentKeys.begin(); i != parentKeys.end(); ++i )
+    {
+        osg::ref_ptr<TileNode> tile;
+        if ( _liveTiles->get(*i, tile) && tile->getNumParents() > 0 )
+        {
+            CustomPagedLOD* plod = dynamic_cast<CustomPagedLOD*>( tile->getParent(0) );
+            if ( plod )
+                plod->evictChildren();
+        }
+    }
+}
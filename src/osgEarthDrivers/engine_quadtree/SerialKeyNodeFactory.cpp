@@ -189,14 +189,26 @@ SerialKeyNodeFactory::createNode( const TileKey& parentKey )
     osg::ref_ptr<TileModel> models[4];
     bool                   realData[4];
     bool                   lodBlending[4];
-    bool                   tileHasAnyRealData = false;
 
     for( unsigned i = 0; i < 4; ++i )
     {
         TileKey child = parentKey.createChildKey( i );
 
         _modelFactory->createTileModel( child, models[i], realData[i], lodBlending[i] );
+    }
+
+    return assembleNode( parentKey, models, realData, lodBlending );
+}
 
+osg::Node*
+SerialKeyNodeFactory::assembleNode(const TileKey&          parentKey,
+                                   osg::ref_ptr<TileModel> models[4],
+                                   bool                    realData[4],
+                                   bool                    lodBlending[4] )
+{
+    bool tileHasAnyRealData = false;
+    for( unsigned i = 0; i < 4; ++i )
+    {
         if ( models[i].valid() && realData[i] )
         {
             tileHasAnyRealData = true;
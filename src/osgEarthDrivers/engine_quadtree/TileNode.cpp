@@ -93,6 +93,9 @@ TileNode::traverse( osg::NodeVisitor& nv )
             if (ccc->cull(&nv,0,static_cast<osg::State *>(0))) return;
         }
 
+        if ( _residency.valid() && nv.getFrameStamp() )
+            _residency->touch( nv.getFrameStamp()->getFrameNumber() );
+
         float bt;
         _born->get( bt );
         if ( bt < 0.0f )
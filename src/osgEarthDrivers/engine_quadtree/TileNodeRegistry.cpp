@@ -41,6 +41,8 @@ TileNodeRegistry::add( TileNode* tile )
 {
     if ( tile )
     {
+        addResidency( tile );
+
         Threading::ScopedWriteLock exclusive( _tilesMutex );
         _tiles[ tile->getKey() ] = tile;
         OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
@@ -53,6 +55,9 @@ TileNodeRegistry::add( const TileNodeVector& tiles )
 {
     if ( tiles.size() > 0 )
     {
+        for( TileNodeVector::const_iterator i = tiles.begin(); i != tiles.end(); ++i )
+            addResidency( i->get() );
+
         Threading::ScopedWriteLock exclusive( _tilesMutex );
         for( TileNodeVector::const_iterator i = tiles.begin(); i != tiles.end(); ++i )
         {
@@ -71,6 +76,21 @@ TileNodeRegistry::remove( TileNode* tile )
         Threading::ScopedWriteLock exclusive( _tilesMutex );
         _tiles.erase( tile->getKey() );
         OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+
+        if ( _residency.valid() )
+            _residency->remove( tile->getKey() );
+    }
+}
+
+
+void
+TileNodeRegistry::addResidency( TileNode* tile )
+{
+    if ( _residency.valid() && _residency->isEnabled() )
+    {
+        TileResidencyManager::Usage usage;
+        usage.add( tile );
+        tile->setResidencyEntry( _residency->add(tile->getKey(), usage) );
     }
 }
 
@@ -101,6 +121,9 @@ TileNodeRegistry::take( const TileKey& key, osg::ref_ptr<TileNode>& out_tile )
         out_tile = i->second.get();
         _tiles.erase( i );
         OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+
+        if ( _residency.valid() )
+            _residency->remove( key );
         return true;
     }
     return false;
@@ -132,6 +132,7 @@ void Patch::Data::setGeometryAttributes(Geometry* geom)
 
 void Patch::init()
 {
+    _patchSet->poolVertexData(_data.get());
     for (int res = 0; res < 2; ++res)
     {
         for (int trile = 0; trile < 4; ++trile)
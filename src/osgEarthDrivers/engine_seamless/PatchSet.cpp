@@ -23,6 +23,8 @@
 #include <osg/Math>
 #include <osg/MatrixTransform>
 
+#include <OpenThreads/ScopedLock>
+
 #include "Patch"
 #include "PatchGroup"
 
@@ -33,11 +35,11 @@ using namespace osgEarth;
 
 PatchSet::PatchSet()
     : _maxLevel(16), _patchOptionsPrototype(new PatchOptions), _mapf(0),
-      _resolution(128), _verticalScale(1.0f)
+      _resolution(128), _verticalScale(1.0f), _vboPoolBytes(0)
 {
     setPrecisionFactor(4);
     initPrimitiveSets();
-
+    initPatchService();
 }
 
 PatchSet::PatchSet(const Drivers::SeamlessOptions& options,
@@ -45,18 +47,21 @@ PatchSet::PatchSet(const Drivers::SeamlessOptions& options,
     :  _maxLevel(16),
        _patchOptionsPrototype(poptionsPrototype ? poptionsPrototype
                               : new PatchOptions),
-       _mapf(0), _options(options)
+       _vboPoolBytes(0), _mapf(0), _options(options)
 {
     _resolution = options.resolution().value();
     _verticalScale = options.verticalScale().value();
     setPrecisionFactor(4);
     initPrimitiveSets();
+    initPatchService();
 }
 
 PatchSet::PatchSet(const PatchSet& rhs, const CopyOp& copyop)
     : _precisionFactor(rhs._precisionFactor), _resolution(rhs._resolution),
       _maxLevel(rhs._maxLevel), _verticalScale(rhs._verticalScale),
       _patchOptionsPrototype(static_cast<PatchOptions*>(copyop(rhs._patchOptionsPrototype.get()))),
+      _sharedEBO(rhs._sharedEBO), _vboPoolBytes(0),
+      _patchService(rhs._patchService),
       _map(static_cast<Map*>(copyop(rhs._map.get())))
 {
     _patchOptionsPrototype
@@ -145,6 +150,96 @@ Transform* PatchSet::createPatch(const std::string& filename, PatchOptions* popt
     return transform;
 }
 
+namespace
+{
+// Vertex arrays are added to a pooled VBO until it holds this many
+// bytes. Adding an array to a buffer that is already on the GPU
+// re-uploads the whole buffer, so the pools are kept modest.
+const unsigned maxVBOPoolBytes = 4 * 1024 * 1024;
+
+struct CreateChild
+{
+    void init(PatchSet* patchSet, const PatchOptions* parentOptions,
+              int childNum)
+    {
+        _patchSet = patchSet;
+        _parentOptions = parentOptions;
+        _childNum = childNum;
+    }
+    void execute()
+    {
+        _child = _patchSet->createChild(_parentOptions.get(), _childNum);
+    }
+    ref_ptr<PatchSet> _patchSet;
+    ref_ptr<const PatchOptions> _parentOptions;
+    int _childNum;
+    ref_ptr<Node> _child;
+};
+}
+
+void PatchSet::initPatchService()
+{
+    int serviceThreads = computeLoadingThreads(_options.loadingPolicy().get());
+    _patchService = new TaskService("Seamless Patch Service", serviceThreads);
+}
+
+Group* PatchSet::createChildren(const PatchOptions* parentOptions)
+{
+    ref_ptr<Group> result = new Group;
+    // Build child 0 on this thread and the other 3 on the patch service.
+    Threading::MultiEvent semaphore(3);
+    ref_ptr<ParallelTask<CreateChild> > tasks[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        tasks[i] = new ParallelTask<CreateChild>(&semaphore);
+        tasks[i]->init(this, parentOptions, i + 1);
+        tasks[i]->setPriority(-static_cast<float>(parentOptions->getPatchLevel()));
+        _patchService->add(tasks[i].get());
+    }
+    ref_ptr<Node> first = createChild(parentOptions, 0);
+    semaphore.wait();
+    result->addChild(first.get());
+    for (int i = 0; i < 3; ++i)
+        result->addChild(tasks[i]->_child.get());
+    return result.release();
+}
+
+void PatchSet::poolVertexData(Patch::Data* data)
+{
+    // Only per-vertex arrays go in the pool; overall normals and
+    // colors are not drawn from buffers.
+    std::vector<Array*> arrays;
+    if (data->vertexData.array.valid())
+        arrays.push_back(data->vertexData.array.get());
+    if (data->normalData.array.valid()
+        && data->normalData.binding == Geometry::BIND_PER_VERTEX)
+        arrays.push_back(data->normalData.array.get());
+    if (data->colorData.array.valid()
+        && data->colorData.binding == Geometry::BIND_PER_VERTEX)
+        arrays.push_back(data->colorData.array.get());
+    for (Geometry::ArrayDataList::iterator itr = data->texCoordList.begin(),
+             end = data->texCoordList.end();
+         itr != end;
+         ++itr)
+        if (itr->array.valid())
+            arrays.push_back(itr->array.get());
+
+    unsigned bytes = 0;
+    for (size_t i = 0; i < arrays.size(); ++i)
+        bytes += arrays[i]->getTotalDataSize();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_vboPoolMutex);
+    if (!_vboPool.valid() || _vboPoolBytes + bytes > maxVBOPoolBytes)
+    {
+        _vboPool = new VertexBufferObject;
+        _vboPoolBytes = 0;
+    }
+    _vboPoolBytes += bytes;
+    for (size_t i = 0; i < arrays.size(); ++i)
+        if (!arrays[i]->getVertexBufferObject())
+            arrays[i]->setVertexBufferObject(_vboPool.get());
+}
+
 Node* PatchSet::createPatchSetGraph(const std::string& filename)
 {
     PatchOptions* poptions = osg::clone(_patchOptionsPrototype.get());
@@ -323,6 +418,15 @@ void PatchSet::initPrimitiveSets()
                 stripPset[i][j]->push_back(rotateIndex(*itr));
         }
     }
+    // Every patch draws with these same index patterns, so put them
+    // all in one element buffer that is uploaded once.
+    _sharedEBO = new ElementBufferObject;
+    for (int j = 0; j < 2; ++j)
+        for (int i = 0; i < 4; ++i)
+            trilePset[j][i]->setElementBufferObject(_sharedEBO.get());
+    for (int j = 0; j < 4; ++j)
+        for (int i = 0; i < 4; ++i)
+            stripPset[j][i]->setElementBufferObject(_sharedEBO.get());
 }
 
 osg::Node* PatchSet::createChild(const PatchOptions* parentOptions, int childNum)
@@ -80,10 +80,7 @@ public:
                 return osgDB::ReaderWriter::ReadResult::ERROR_IN_READING_FILE;
             }
             PatchSet* pset = poptions->getPatchSet();
-            Group* result = new Group;
-            for (int i = 0; i < 4; ++i)
-                result->addChild(pset->createChild(poptions, i));
-            return result;
+            return pset->createChildren(poptions);
 
         }
         else
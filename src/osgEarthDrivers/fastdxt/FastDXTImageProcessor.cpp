@@ -21,13 +21,57 @@
 #include <osgDB/Registry>
 #include <osg/Notify>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <OpenThreads/Thread>
 #include <stdlib.h>
 #include "libdxt.h"
 #include <string.h>
 
+#ifndef GL_COMPRESSED_RED_RGTC1_EXT
+#define GL_COMPRESSED_RED_RGTC1_EXT              0x8DBB
+#define GL_COMPRESSED_RED_GREEN_RGTC2_EXT        0x8DBD
+#endif
+
+#ifndef GL_COMPRESSED_LUMINANCE_LATC1_EXT
+#define GL_COMPRESSED_LUMINANCE_LATC1_EXT        0x8C70
+#define GL_COMPRESSED_LUMINANCE_ALPHA_LATC2_EXT  0x8C72
+#endif
+
+// Images with fewer block rows than this are compressed in one piece.
+#define MIN_BLOCK_ROWS_PER_BAND 16
+
+namespace
+{
+    /**
+     * Compresses a band of block rows. Blocks are stored row by row, so the
+     * bands of an image compress independently into consecutive output.
+     */
+    struct CompressBand
+    {
+        const unsigned char* _in;
+        unsigned char*       _out;
+        int                  _width, _height, _format;
+        int                  _outputBytes;
+
+        void execute()
+        {
+            _outputBytes = CompressDXT(_in, _out, _width, _height, _format);
+        }
+    };
+
+    typedef osgEarth::ParallelTask<CompressBand> CompressBandTask;
+}
+
 class FastDXTProcessor : public osgDB::ImageProcessor
 {
 public:
+    FastDXTProcessor()
+    {
+        // registered at load time, so stay away from the osgEarth registry here.
+        _numThreads = osg::maximum( 1, OpenThreads::GetNumberOfProcessors() );
+    }
+
     virtual void compress(osg::Image& image, osg::Texture::InternalFormatMode compressedFormat, bool generateMipMap, bool resizeToPowerOfTwo, CompressionMethod method, CompressionQuality quality)
     {
         //Resize the image to the nearest power of two
@@ -51,6 +95,10 @@ public:
             sourceImage = rgba.get();
         }
 
+        bool luminance =
+            image.getPixelFormat() == GL_LUMINANCE ||
+            image.getPixelFormat() == GL_LUMINANCE_ALPHA;
+
         int format;
         GLint pixelFormat;
         switch (compressedFormat)
@@ -65,6 +113,16 @@ public:
             pixelFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
             OE_INFO << "FastDXT dxt5 format" << std::endl;
             break;
+        case osg::Texture::USE_RGTC1_COMPRESSION:
+            // the LATC formats hold the same blocks but sample as luminance(-alpha),
+            // just like the uncompressed image.
+            format = FORMAT_BC4;
+            pixelFormat = luminance ? GL_COMPRESSED_LUMINANCE_LATC1_EXT : GL_COMPRESSED_RED_RGTC1_EXT;
+            break;
+        case osg::Texture::USE_RGTC2_COMPRESSION:
+            format = luminance ? FORMAT_BC5LA : FORMAT_BC5;
+            pixelFormat = luminance ? GL_COMPRESSED_LUMINANCE_ALPHA_LATC2_EXT : GL_COMPRESSED_RED_GREEN_RGTC2_EXT;
+            break;
         default:
             OSG_WARN << "Unhandled compressed format" << compressedFormat << std::endl;
             return;
@@ -83,7 +141,7 @@ public:
         memset(out, 0, image.s()*image.t()*4);
 
         osg::Timer_t start = osg::Timer::instance()->tick();
-        int outputBytes = CompressDXT(in, out, sourceImage->s(), sourceImage->t(), format);
+        int outputBytes = compressBands(in, out, sourceImage->s(), sourceImage->t(), format);
         osg::Timer_t end = osg::Timer::instance()->tick();
         OE_INFO << "compression took" << osg::Timer::instance()->delta_m(start, end) << std::endl;
 
@@ -99,6 +157,73 @@ public:
     {
         OSG_WARN << "FastDXT: generateMipMap not implemented" << std::endl;
     }
+
+private:
+    /**
+     * Compresses an RGBA image, splitting it into bands of block rows that
+     * run on a pool shared by all the threads calling compress().
+     */
+    int compressBands(const unsigned char* in, unsigned char* out, int width, int height, int format)
+    {
+        int blockRows = height/4;
+        int numBands  = osg::minimum( _numThreads, blockRows/MIN_BLOCK_ROWS_PER_BAND );
+
+        if ( numBands <= 1 )
+        {
+            return CompressDXT(in, out, width, height, format);
+        }
+
+        osgEarth::TaskService* service = getService();
+
+        int rowBytesIn  = width*4*4;
+        int rowBytesOut = (width/4)*DXTBlockSize(format);
+
+        std::vector< osg::ref_ptr<CompressBandTask> > bands( numBands );
+        osgEarth::Threading::MultiEvent semaphore( numBands-1 );
+
+        int firstRow = 0;
+        for( int i=0; i<numBands; ++i )
+        {
+            int numRows = blockRows/numBands + (i < blockRows%numBands ? 1 : 0);
+
+            // the last band runs in the calling thread.
+            bands[i] = i < numBands-1 ? new CompressBandTask( &semaphore ) : new CompressBandTask();
+            bands[i]->_in          = in  + firstRow*rowBytesIn;
+            bands[i]->_out         = out + firstRow*rowBytesOut;
+            bands[i]->_width       = width;
+            bands[i]->_height      = numRows*4;
+            bands[i]->_format      = format;
+            bands[i]->_outputBytes = 0;
+
+            if ( i < numBands-1 )
+                service->add( bands[i].get() );
+
+            firstRow += numRows;
+        }
+
+        bands[numBands-1]->execute();
+        semaphore.wait();
+
+        int outputBytes = 0;
+        for( int i=0; i<numBands; ++i )
+            outputBytes += bands[i]->_outputBytes;
+
+        return outputBytes;
+    }
+
+    osgEarth::TaskService* getService()
+    {
+        osgEarth::Threading::ScopedMutexLock lock( _serviceMutex );
+        if ( !_service.valid() )
+        {
+            _service = new osgEarth::TaskService( "FastDXT", _numThreads-1 );
+        }
+        return _service.get();
+    }
+
+    int                                  _numThreads;
+    osg::ref_ptr<osgEarth::TaskService>  _service;
+    osgEarth::Threading::Mutex           _serviceMutex;
 };
 
 REGISTER_OSGIMAGEPROCESSOR(fastdxt, FastDXTProcessor)
@@ -36,6 +36,9 @@ void EmitAlphaIndices( const byte *colorBlock, const byte minAlpha, const byte m
 void EmitAlphaIndicesFast( const byte *colorBlock, const byte minAlpha, const byte maxAlpha, byte *&outData);
 void EmitAlphaIndices_Intrinsics( const byte *colorBlock, const byte minAlpha, const byte maxAlpha, byte *&outData);
 
+// Emit a BC4 block for one channel
+void EmitChannelBlock( const byte *colorBlock, int channel, byte *&outData );
+
 
 void CompressImageDXT1( const byte *inBuf, byte *outBuf,
 			int width, int height, int &outputBytes )
@@ -173,6 +176,40 @@ void CompressImageDXT5( const byte *inBuf, byte *outBuf, int width, int height,
 
 
 
+void CompressImageBC4( const byte *inBuf, byte *outBuf, int width, int height,
+                       int channel, int &outputBytes )
+{
+  ALIGN16( byte *outData );
+  ALIGN16( byte block[64] );
+
+  outData = outBuf;
+  for ( int j = 0; j < height; j += 4, inBuf += width * 4*4 ) {
+    for ( int i = 0; i < width; i += 4 ) {
+      ExtractBlock( inBuf + i * 4, width, block );
+      EmitChannelBlock( block, channel, outData );
+    }
+  }
+  outputBytes = int( outData - outBuf );
+}
+
+void CompressImageBC5( const byte *inBuf, byte *outBuf, int width, int height,
+                       int channel1, int channel2, int &outputBytes )
+{
+  ALIGN16( byte *outData );
+  ALIGN16( byte block[64] );
+
+  outData = outBuf;
+  for ( int j = 0; j < height; j += 4, inBuf += width * 4*4 ) {
+    for ( int i = 0; i < width; i += 4 ) {
+      ExtractBlock( inBuf + i * 4, width, block );
+      EmitChannelBlock( block, channel1, outData );
+      EmitChannelBlock( block, channel2, outData );
+    }
+  }
+  outputBytes = int( outData - outBuf );
+}
+
+
 void ExtractBlock( const byte *inPtr, int width, byte *colorBlock )
 {
   for ( int j = 0; j < 4; j++ ) {
@@ -468,6 +505,29 @@ void EmitAlphaIndices( const byte *colorBlock, const byte minAlpha, const byte m
 }
 
 
+//
+// A BC4 block has the layout of a DXT5 alpha block, so move the channel
+// into the alpha slots and emit it the same way.
+//
+void EmitChannelBlock( const byte *colorBlock, int channel, byte *&outData )
+{
+  ALIGN16( byte block[64] );
+  byte minValue = 255;
+  byte maxValue = 0;
+
+  for ( int i = 0; i < 16; i++ ) {
+    byte v = colorBlock[i*4 + channel];
+    block[i*4 + 3] = v;
+    if ( v < minValue ) minValue = v;
+    if ( v > maxValue ) maxValue = v;
+  }
+
+  EmitByte( maxValue, outData );
+  EmitByte( minValue, outData );
+  EmitAlphaIndicesFast( block, minValue, maxValue, outData );
+}
+
+
 void EmitAlphaIndicesFast( const byte *colorBlock, const byte minAlpha, const byte maxAlpha, byte *&outData )
 {
   //assert( maxAlpha > minAlpha );
@@ -64,5 +64,11 @@ void CompressImageDXT5( const byte *inBuf, byte *outBuf, int width, int height,
 // Compress to DXT5 format, first convert to YCoCg color space
 void CompressImageDXT5YCoCg( const byte *inBuf, byte *outBuf, int width, int height, int &outputBytes );
 
+// Compress one channel of an RGBA image to BC4 (RGTC1/LATC1) format
+void CompressImageBC4( const byte *inBuf, byte *outBuf, int width, int height, int channel, int &outputBytes );
+
+// Compress two channels of an RGBA image to BC5 (RGTC2/LATC2) format
+void CompressImageBC5( const byte *inBuf, byte *outBuf, int width, int height, int channel1, int channel2, int &outputBytes );
+
 // Compute error between two images
 double ComputeError( const byte *original, const byte *dxt, int width, int height);
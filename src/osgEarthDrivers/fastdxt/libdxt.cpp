@@ -65,6 +65,38 @@ void *slave5ycocg(void *arg)
 	return NULL;
 }
 
+void *slavebc4(void *arg)
+{
+	work_t *param = (work_t*) arg;
+	int nbbytes = 0;
+	CompressImageBC4( param->in, param->out, param->width, param->height, 0, nbbytes);
+	param->nbb = nbbytes;
+	return NULL;
+}
+
+void *slavebc5(void *arg)
+{
+	work_t *param = (work_t*) arg;
+	int nbbytes = 0;
+	CompressImageBC5( param->in, param->out, param->width, param->height, 0, 1, nbbytes);
+	param->nbb = nbbytes;
+	return NULL;
+}
+
+void *slavebc5la(void *arg)
+{
+	work_t *param = (work_t*) arg;
+	int nbbytes = 0;
+	CompressImageBC5( param->in, param->out, param->width, param->height, 0, 3, nbbytes);
+	param->nbb = nbbytes;
+	return NULL;
+}
+
+int DXTBlockSize(int format)
+{
+  return (format == FORMAT_DXT1 || format == FORMAT_BC4) ? 8 : 16;
+}
+
 int CompressDXT(const byte *in, byte *out, int width, int height, int format)
 { 
   int        nbbytes;
@@ -87,6 +119,15 @@ int CompressDXT(const byte *in, byte *out, int width, int height, int format)
       case FORMAT_DXT5YCOCG:
           slave5ycocg(&job);
           break;
+      case FORMAT_BC4:
+          slavebc4(&job);
+          break;
+      case FORMAT_BC5:
+          slavebc5(&job);
+          break;
+      case FORMAT_BC5LA:
+          slavebc5la(&job);
+          break;
   }
 
   // Join all the threads
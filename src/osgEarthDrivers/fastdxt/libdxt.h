@@ -28,6 +28,12 @@
 #define FORMAT_DXT1      1
 #define FORMAT_DXT5      2
 #define FORMAT_DXT5YCOCG 3
+#define FORMAT_BC4       4  // red (or luminance) only
+#define FORMAT_BC5       5  // red and green
+#define FORMAT_BC5LA     6  // luminance and alpha
+
+// Size in bytes of one compressed 4x4 block
+int DXTBlockSize(int format);
 
 
 int CompressDXT(const byte *in, byte *out, int width, int height, int format);
@@ -0,0 +1,207 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "OEVTFeatureOptions"
+#include <osgEarthFeatures/FeatureSource>
+#include <osgEarthFeatures/FeatureCursor>
+#include <osgEarthFeatures/Filter>
+#include <osgEarthUtil/VectorTiles>
+#include <osgDB/FileNameUtils>
+
+#define LC "[OEVT FeatureSource] "
+
+using namespace osgEarth;
+using namespace osgEarth::Util;
+using namespace osgEarth::Features;
+using namespace osgEarth::Drivers;
+
+/**
+ * A FeatureSource that reads pre-tiled features out of a memory-mapped
+ * osgEarth vector tile file (written by osgearth_oevt).
+ */
+class OEVTFeatureSource : public FeatureSource
+{
+public:
+    OEVTFeatureSource(const OEVTFeatureOptions& options ) :
+      FeatureSource( options ),
+      _options     ( options )
+    {
+        //nop
+    }
+
+    /** Destruct the object, unmapping the file. */
+    virtual ~OEVTFeatureSource()
+    {
+        //nop
+    }
+
+    //override
+    void initialize( const osgDB::Options* dbOptions )
+    {
+        if ( !_options.url().isSet() )
+        {
+            OE_WARN << LC << "No URL specified" << std::endl;
+            return;
+        }
+
+        std::string path = _options.url()->full();
+        if ( osgDB::containsServerAddress(path) )
+        {
+            OE_WARN << LC << "Vector tile files must be local, since they are memory-mapped: " << path << std::endl;
+            return;
+        }
+
+        _file = VectorTileFile::open( path );
+    }
+
+    /** Called once at startup to create the profile for this feature set. Successful profile
+        creation implies that the datasource opened succesfully. */
+    const FeatureProfile* createFeatureProfile()
+    {
+        FeatureProfile* result = NULL;
+        if ( _file.valid() )
+        {
+            result = new FeatureProfile( _file->getExtent() );
+            result->setTiled( true );
+            result->setFirstLevel( _file->getFirstLevel() );
+            result->setMaxLevel( _file->getMaxLevel() );
+            result->setProfile( _file->getProfile() );
+        }
+        return result;
+    }
+
+    /**
+     * Answers a query that isn't for a single tile with every first-level
+     * tile it touches.
+     */
+    bool readTiles( const Symbology::Query& query, FeatureList& features )
+    {
+        const FeatureProfile* fp = getFeatureProfile();
+        if ( !fp || !fp->getProfile() )
+            return false;
+
+        GeoExtent extent = query.bounds().isSet() ?
+            GeoExtent(fp->getSRS(), query.bounds().get()) :
+            fp->getExtent();
+
+        std::vector<TileKey> keys;
+        fp->getProfile()->getIntersectingTiles( extent, fp->getFirstLevel(), keys );
+
+        bool dataOK = false;
+        for( unsigned i = 0; i < keys.size(); ++i )
+        {
+            if ( _file->readTile(keys[i], features) )
+                dataOK = true;
+        }
+        return dataOK;
+    }
+
+    FeatureCursor* createFeatureCursor( const Symbology::Query& query )
+    {
+        if ( !_file.valid() )
+            return 0L;
+
+        FeatureList features;
+        bool dataOK = query.tileKey().isSet() ?
+            _file->readTile( query.tileKey().get(), features ) :
+            readTiles( query, features );
+
+        if ( !dataOK )
+            return 0L;
+
+        for( FeatureList::iterator i = features.begin(); i != features.end(); )
+        {
+            if ( isBlacklisted(i->get()->getFID()) )
+                i = features.erase( i );
+            else
+                ++i;
+        }
+
+        OE_DEBUG << LC << "Read " << features.size() << " features" << std::endl;
+
+        //If we have any filters, process them here before the cursor is created
+        if ( !_options.filters().empty() && !features.empty() )
+        {
+            FilterContext cx;
+            cx.setProfile( getFeatureProfile() );
+
+            for( FeatureFilterList::const_iterator i = _options.filters().begin(); i != _options.filters().end(); ++i )
+            {
+                FeatureFilter* filter = i->get();
+                cx = filter->push( features, cx );
+            }
+        }
+
+        return new FeatureListCursor( features );
+    }
+
+    /**
+    * Gets the Feature with the given FID
+    * @returns
+    *     The Feature with the given FID or NULL if not found.
+    */
+    virtual Feature* getFeature( FeatureID fid )
+    {
+        return 0;
+    }
+
+    virtual bool isWritable() const
+    {
+        return false;
+    }
+
+    virtual const FeatureSchema& getSchema() const
+    {
+        return _file.valid() ? _file->getSchema() : _schema;
+    }
+
+    virtual osgEarth::Symbology::Geometry::Type getGeometryType() const
+    {
+        return Geometry::TYPE_UNKNOWN;
+    }
+
+private:
+    const OEVTFeatureOptions        _options;
+    FeatureSchema                   _schema;
+    osg::ref_ptr<VectorTileFile>    _file;
+};
+
+
+class OEVTFeatureSourceFactory : public FeatureSourceDriver
+{
+public:
+    OEVTFeatureSourceFactory()
+    {
+        supportsExtension( "osgearth_feature_oevt", "osgEarth vector tile feature driver" );
+    }
+
+    virtual const char* className()
+    {
+        return "osgEarth Vector Tile Feature Reader";
+    }
+
+    virtual ReadResult readObject(const std::string& file_name, const Options* options) const
+    {
+        if ( !acceptsExtension(osgDB::getLowerCaseFileExtension( file_name )))
+            return ReadResult::FILE_NOT_HANDLED;
+
+        return ReadResult( new OEVTFeatureSource( getFeatureSourceOptions(options) ) );
+    }
+};
+
+REGISTER_OSGPLUGIN(osgearth_feature_oevt, OEVTFeatureSourceFactory)
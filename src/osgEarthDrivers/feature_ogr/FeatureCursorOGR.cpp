@@ -20,6 +20,7 @@
 #include <osgEarthFeatures/OgrUtils>
 #include <osgEarthFeatures/Feature>
 #include <osgEarth/Registry>
+#include <osgEarth/StringUtils>
 #include <algorithm>
 
 #define LC "[FeatureCursorOGR] "
@@ -61,13 +62,109 @@ namespace
     }
 }
 
+//---------------------------------------------------------------------------
 
-FeatureCursorOGR::FeatureCursorOGR(OGRDataSourceH           dsHandle,
+OGRDataSourcePool::OGRDataSourcePool(const std::string& source,
+                                     const std::string& layer) :
+_source( source ),
+_layer ( layer )
+{
+    //nop
+}
+
+OGRDataSourcePool::~OGRDataSourcePool()
+{
+    clear();
+}
+
+OGRLayerH
+OGRDataSourcePool::openLayer(OGRDataSourceH dsHandle, const std::string& layer)
+{
+    OGRLayerH h = OGR_DS_GetLayerByName(dsHandle, layer.c_str());
+    if ( !h )
+    {
+        unsigned index = osgEarth::as<unsigned>(layer, 0);
+        h = OGR_DS_GetLayer(dsHandle, index);
+    }
+    return h;
+}
+
+bool
+OGRDataSourcePool::acquire(OGRDataSourceH& dsHandle, OGRLayerH& layerHandle)
+{
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        if ( !_idle.empty() )
+        {
+            dsHandle    = _idle.back().first;
+            layerHandle = _idle.back().second;
+            _idle.pop_back();
+            return true;
+        }
+    }
+
+    // opening a datasource can touch driver-global state, so it stays under the
+    // global lock. It happens once per handle, not once per cursor.
+    OGR_SCOPED_LOCK;
+
+    // not OGROpenShared: a shared handle may be handed to another thread too.
+    dsHandle = OGROpen( _source.c_str(), 0, 0L );
+    if ( !dsHandle )
+        return false;
+
+    layerHandle = openLayer( dsHandle, _layer );
+    if ( !layerHandle )
+    {
+        OGRReleaseDataSource( dsHandle );
+        dsHandle = 0L;
+        return false;
+    }
+
+    return true;
+}
+
+void
+OGRDataSourcePool::release(OGRDataSourceH dsHandle, OGRLayerH layerHandle)
+{
+    if ( !dsHandle )
+        return;
+
+    // the handle is still exclusively ours here; rewind it for the next user.
+    if ( layerHandle )
+        OGR_L_ResetReading( layerHandle );
+
+    Threading::ScopedMutexLock lock( _mutex );
+    _idle.push_back( Handles(dsHandle, layerHandle) );
+}
+
+void
+OGRDataSourcePool::clear()
+{
+    std::vector<Handles> idle;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        idle.swap( _idle );
+    }
+
+    if ( !idle.empty() )
+    {
+        OGR_SCOPED_LOCK;
+        for( std::vector<Handles>::iterator i = idle.begin(); i != idle.end(); ++i )
+            OGRReleaseDataSource( i->first );
+    }
+}
+
+//---------------------------------------------------------------------------
+
+
+FeatureCursorOGR::FeatureCursorOGR(OGRDataSourcePool*       pool,
+                                   OGRDataSourceH           dsHandle,
                                    OGRLayerH                layerHandle,
                                    const FeatureSource*     source,
                                    const FeatureProfile*    profile,
                                    const Symbology::Query&  query,
                                    const FeatureFilterList& filters ) :
+_pool             ( pool ),
 _source           ( source ),
 _dsHandle         ( dsHandle ),
 _layerHandle      ( layerHandle ),
@@ -77,11 +174,13 @@ _query            ( query ),
 _chunkSize        ( 500 ),
 _nextHandleToQueue( 0L ),
 _profile          ( profile ),
-_filters          ( filters )
+_filters          ( filters ),
+_nextFid          ( 0 ),
+_readByFid        ( false )
 {
+    // the handles are checked out to this cursor alone, so no OGR lock is
+    // needed from here on.
     {
-        OGR_SCOPED_LOCK;
-
         std::string expr;
         std::string from = OGR_FD_GetName( OGR_L_GetLayerDefn( _layerHandle ));        
         
@@ -159,8 +258,30 @@ _filters          ( filters )
         }
 
 
-        OE_DEBUG << LC << "SQL: " << expr << std::endl;
-        _resultSetHandle = OGR_DS_ExecuteSQL( _dsHandle, expr.c_str(), _spatialFilter, 0L );
+        // A plain WHERE clause (or no expression) with no ORDER BY goes straight
+        // to the layer as attribute and spatial filters. The driver can then use
+        // its own indexes (or the database's) and skips the OGR SQL engine.
+        // Anything the layer rejects still goes through ExecuteSQL below.
+        std::string where = query.expression().isSet() ? trim(query.expression().get()) : "";
+        if ( !query.orderby().isSet() && osgEarth::toLower(where).find("select") != 0 )
+        {
+            if ( OGR_L_SetAttributeFilter( _layerHandle, where.empty() ? 0L : where.c_str() ) == OGRERR_NONE )
+            {
+                OGR_L_SetSpatialFilter( _layerHandle, _spatialFilter );
+                _resultSetHandle = _layerHandle;
+                OE_DEBUG << LC << "Layer filter: " << (where.empty() ? "(none)" : where) << std::endl;
+            }
+            else
+            {
+                OGR_L_SetAttributeFilter( _layerHandle, 0L );
+            }
+        }
+
+        if ( !_resultSetHandle )
+        {
+            OE_DEBUG << LC << "SQL: " << expr << std::endl;
+            _resultSetHandle = OGR_DS_ExecuteSQL( _dsHandle, expr.c_str(), _spatialFilter, 0L );
+        }
 
         if ( _resultSetHandle )
         {
@@ -171,26 +292,58 @@ _filters          ( filters )
     readChunk();
 }
 
-FeatureCursorOGR::~FeatureCursorOGR()
+FeatureCursorOGR::FeatureCursorOGR(OGRDataSourcePool*       pool,
+                                   OGRDataSourceH           dsHandle,
+                                   OGRLayerH                layerHandle,
+                                   const FeatureSource*     source,
+                                   const FeatureProfile*    profile,
+                                   std::vector<FeatureID>&  fids,
+                                   const FeatureFilterList& filters ) :
+_pool             ( pool ),
+_source           ( source ),
+_dsHandle         ( dsHandle ),
+_layerHandle      ( layerHandle ),
+_resultSetHandle  ( 0L ),
+_spatialFilter    ( 0L ),
+_chunkSize        ( 500 ),
+_nextHandleToQueue( 0L ),
+_profile          ( profile ),
+_filters          ( filters ),
+_nextFid          ( 0 ),
+_readByFid        ( true )
 {
-    OGR_SCOPED_LOCK;
+    _fids.swap( fids );
+    readChunkByFid();
+}
 
+FeatureCursorOGR::~FeatureCursorOGR()
+{
     if ( _nextHandleToQueue )
         OGR_F_Destroy( _nextHandleToQueue );
 
-    if ( _resultSetHandle != _layerHandle )
+    if ( _resultSetHandle && _resultSetHandle != _layerHandle )
         OGR_DS_ReleaseResultSet( _dsHandle, _resultSetHandle );
 
+    // filters set directly on the layer must not leak to its next user.
+    if ( _resultSetHandle && _resultSetHandle == _layerHandle )
+    {
+        OGR_L_SetAttributeFilter( _layerHandle, 0L );
+        OGR_L_SetSpatialFilter( _layerHandle, 0L );
+    }
+
     if ( _spatialFilter )
         OGR_G_DestroyGeometry( _spatialFilter );
 
-    if ( _dsHandle )
-        OGRReleaseDataSource( _dsHandle );
+    if ( _pool.valid() )
+        _pool->release( _dsHandle, _layerHandle );
 }
 
 bool
 FeatureCursorOGR::hasMore() const
 {
+    if ( _readByFid )
+        return _queue.size() > 0 || _nextFid < _fids.size();
+
     return _resultSetHandle && ( _queue.size() > 0 || _nextHandleToQueue != 0L );
 }
 
@@ -200,8 +353,19 @@ FeatureCursorOGR::nextFeature()
     if ( !hasMore() )
         return 0L;
 
-    if ( _queue.size() == 0 && _nextHandleToQueue )
+    if ( _readByFid )
+    {
+        if ( _queue.size() == 0 )
+            readChunkByFid();
+
+        // every remaining ID may have been blacklisted or invalid.
+        if ( _queue.size() == 0 )
+            return 0L;
+    }
+    else if ( _queue.size() == 0 && _nextHandleToQueue )
+    {
         readChunk();
+    }
 
     // do this in order to hold a reference to the feature we return, so the caller
     // doesn't have to. This lets us avoid requiring the caller to use a ref_ptr when 
@@ -214,7 +378,6 @@ FeatureCursorOGR::nextFeature()
 
 
 // reads a chunk of features into a memory cache; do this for performance
-// and to avoid needing the OGR Mutex every time
 void
 FeatureCursorOGR::readChunk()
 {
@@ -222,8 +385,6 @@ FeatureCursorOGR::readChunk()
         return;
     
     FeatureList preProcessList;
-    
-    OGR_SCOPED_LOCK;
 
     if ( _nextHandleToQueue )
     {
@@ -300,3 +461,54 @@ FeatureCursorOGR::readChunk()
     //OE_NOTICE << "read " << _queue.size() << " features ... " << std::endl;
 }
 
+
+// reads the next chunk of features from the ID list, skipping any that turn
+// out to be invalid, until the queue has something in it or the list is done.
+void
+FeatureCursorOGR::readChunkByFid()
+{
+    while( _queue.size() == 0 && _nextFid < _fids.size() )
+    {
+        FeatureList preProcessList;
+
+        for( unsigned i=0; i<_chunkSize && _nextFid < _fids.size(); ++i, ++_nextFid )
+        {
+            FeatureID fid = _fids[_nextFid];
+            if ( _source->isBlacklisted(fid) )
+                continue;
+
+            OGRFeatureH handle = OGR_L_GetFeature( _layerHandle, fid );
+            if ( handle )
+            {
+                osg::ref_ptr<Feature> f = OgrUtils::createFeature( handle, _profile->getSRS() );
+                if ( f.valid() )
+                {
+                    if ( isGeometryValid( f->getGeometry() ) )
+                    {
+                        _queue.push( f );
+
+                        if ( _filters.size() > 0 )
+                            preProcessList.push_back( f.release() );
+                    }
+                    else
+                    {
+                        OE_INFO << LC << "Skipping feature with invalid geometry: " << f->getGeoJSON() << std::endl;
+                    }
+                }
+                OGR_F_Destroy( handle );
+            }
+        }
+
+        if ( preProcessList.size() > 0 )
+        {
+            FilterContext cx;
+            cx.setProfile( _profile.get() );
+
+            for( FeatureFilterList::const_iterator i = _filters.begin(); i != _filters.end(); ++i )
+            {
+                FeatureFilter* filter = i->get();
+                cx = filter->push( preProcessList, cx );
+            }
+        }
+    }
+}
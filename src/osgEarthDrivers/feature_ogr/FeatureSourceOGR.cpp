@@ -21,6 +21,7 @@
 #include <osgEarth/FileUtils>
 #include <osgEarth/StringUtils>
 #include <osgEarthFeatures/FeatureSource>
+#include <osgEarthFeatures/FeatureSpatialIndex>
 #include <osgEarthFeatures/Filter>
 #include <osgEarthFeatures/BufferFilter>
 #include <osgEarthFeatures/ScaleFilter>
@@ -29,9 +30,11 @@
 #include "FeatureCursorOGR"
 #include <osgEarthFeatures/OgrUtils>
 #include <osg/Notify>
+#include <OpenThreads/Atomic>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <list>
+#include <algorithm>
 #include <ogr_api.h>
 #include <cpl_error.h>
 
@@ -43,21 +46,6 @@ using namespace osgEarth::Drivers;
 
 #define OGR_SCOPED_LOCK GDAL_SCOPED_LOCK
 
-namespace
-{
-    // helper function.
-    OGRLayerH openLayer(OGRDataSourceH ds, const std::string& layer)
-    {
-        OGRLayerH h = OGR_DS_GetLayerByName(ds, layer.c_str());
-        if ( !h )
-        {
-            unsigned index = osgEarth::as<unsigned>(layer, 0);
-            h = OGR_DS_GetLayer(ds, index);
-        }
-        return h;
-    }
-}
-
 
 /**
  * A FeatureSource that reads features from an OGR driver.
@@ -74,7 +62,8 @@ public:
       _options( options ),
       _featureCount(-1),
       _needsSync(false),
-      _writable(false)
+      _writable(false),
+      _useLocalIndex(false)
     {
         //nop
     }
@@ -178,10 +167,13 @@ public:
             {
                 if (openMode == 1) _writable = true;
                 
-                _layerHandle = openLayer(_dsHandle, _options.layer().value());
+                _layerHandle = OGRDataSourcePool::openLayer(_dsHandle, _options.layer().value());
 
                 if ( _layerHandle )
                 {                                     
+                    // read-only handles for the cursors, so they don't contend on the OGR lock.
+                    _pool = new OGRDataSourcePool( _source, _options.layer().value() );
+
                     GeoExtent extent;
 
                     // if the user provided a profile, user that:
@@ -230,6 +222,15 @@ public:
                         {
                             OE_INFO << LC << "Use existing spatial index for " << getName() << std::endl;
                         }
+
+                        // some formats (GeoJSON, GPX, ...) cannot hold a native index; if the
+                        // layer can read by FID, index it in memory instead.
+                        if ( OGR_L_TestCapability(_layerHandle, OLCFastSpatialFilter) == 0 &&
+                             OGR_L_TestCapability(_layerHandle, OLCRandomRead) != 0 )
+                        {
+                            OE_INFO << LC << "No native spatial index for " << getName() << "; using an in-memory index" << std::endl;
+                            _useLocalIndex = true;
+                        }
                     }
 
                     //Get the feature count
@@ -305,40 +306,44 @@ public:
             OGRDataSourceH dsHandle = 0L;
             OGRLayerH layerHandle = 0L;
 
-            // open the handles safely:
-            {
-                OGR_SCOPED_LOCK;
-
-                // Each cursor requires its own DS handle so that multi-threaded access will work.
-                // The cursor impl will dispose of the new DS handle.
-                dsHandle = OGROpenShared( _source.c_str(), 0, &_ogrDriverHandle );
-                if ( dsHandle )
-                {
-                    layerHandle = openLayer(dsHandle, _options.layer().get());
-                }
-            }
+            // Each cursor requires its own DS handle so that multi-threaded access will work.
+            // The cursor returns the handle to the pool when it's done.
+            if ( !_pool.valid() || !_pool->acquire(dsHandle, layerHandle) )
+                return 0L;
 
-            if ( dsHandle && layerHandle )
+            // a plain bounded query can be answered from the in-memory index.
+            if ( _useLocalIndex &&
+                 query.bounds().isSet() && !query.expression().isSet() && !query.orderby().isSet() )
             {
-                // cursor is responsible for the OGR handles.
-                return new FeatureCursorOGR( 
-                    dsHandle,
-                    layerHandle, 
-                    this,
-                    getFeatureProfile(),
-                    query, 
-                    _options.filters() );
-            }
-            else
-            {
-                if ( dsHandle )
+                osg::ref_ptr<FeatureSpatialIndex> index = getLocalIndex();
+                if ( index.valid() )
                 {
-                    OGR_SCOPED_LOCK;
-                    OGRReleaseDataSource( dsHandle );
+                    std::vector<FeatureID> fids;
+                    index->query( query.bounds().get(), fids );
+
+                    // read in FID order, which is file order for most drivers.
+                    std::sort( fids.begin(), fids.end() );
+
+                    return new FeatureCursorOGR(
+                        _pool.get(),
+                        dsHandle,
+                        layerHandle,
+                        this,
+                        getFeatureProfile(),
+                        fids,
+                        _options.filters() );
                 }
-
-                return 0L;
             }
+
+            // cursor is responsible for the OGR handles.
+            return new FeatureCursorOGR( 
+                _pool.get(),
+                dsHandle,
+                layerHandle, 
+                this,
+                getFeatureProfile(),
+                query, 
+                _options.filters() );
         }
     }
 
@@ -350,6 +355,8 @@ public:
             if (OGR_L_DeleteFeature( _layerHandle, fid ) == OGRERR_NONE)
             {
                 _needsSync = true;
+                dirtyLocalIndex();
+                _pool->clear();
                 return true;
             }            
         }
@@ -367,14 +374,35 @@ public:
 
         if ( !isBlacklisted(fid) )
         {
-            OGR_SCOPED_LOCK;
-            OGRFeatureH handle = OGR_L_GetFeature( _layerHandle, fid);
-            if (handle)
+            const FeatureProfile* p = getFeatureProfile();
+            const SpatialReference* srs = p ? p->getSRS() : 0L;
+
+            // writes go through the main handle and may not be synced yet,
+            // so a writable source reads through it as well.
+            if ( _writable )
+            {
+                OGR_SCOPED_LOCK;
+                OGRFeatureH handle = OGR_L_GetFeature( _layerHandle, fid);
+                if (handle)
+                {
+                    result = OgrUtils::createFeature( handle, srs );
+                    OGR_F_Destroy( handle );
+                }
+            }
+            else
             {
-                const FeatureProfile* p = getFeatureProfile();
-                const SpatialReference* srs = p ? p->getSRS() : 0L;
-                result = OgrUtils::createFeature( handle, srs );
-                OGR_F_Destroy( handle );
+                OGRDataSourceH dsHandle = 0L;
+                OGRLayerH layerHandle = 0L;
+                if ( _pool.valid() && _pool->acquire(dsHandle, layerHandle) )
+                {
+                    OGRFeatureH handle = OGR_L_GetFeature( layerHandle, fid);
+                    if (handle)
+                    {
+                        result = OgrUtils::createFeature( handle, srs );
+                        OGR_F_Destroy( handle );
+                    }
+                    _pool->release( dsHandle, layerHandle );
+                }
             }
         }
         return result;
@@ -446,6 +474,9 @@ public:
 
             // clean up the feature
             OGR_F_Destroy( feature_handle );
+
+            dirtyLocalIndex();
+            _pool->clear();
         }
         else
         {
@@ -484,6 +515,55 @@ protected:
         return 0L;
     }
 
+    // builds the in-memory spatial index on first use by scanning the layer's
+    // feature envelopes once.
+    FeatureSpatialIndex* getLocalIndex()
+    {
+        Threading::ScopedMutexLock lock( _localIndexMutex );
+
+        if ( _localIndexStale.exchange(0) != 0 )
+            _localIndex = 0L;
+
+        OGRDataSourceH dsHandle = 0L;
+        OGRLayerH layerHandle = 0L;
+
+        if ( !_localIndex.valid() && _pool.valid() && _pool->acquire(dsHandle, layerHandle) )
+        {
+            FeatureSpatialIndex::EntryVector entries;
+            {
+                if ( _featureCount > 0 )
+                    entries.reserve( _featureCount );
+
+                OGRFeatureH handle;
+                while( (handle = OGR_L_GetNextFeature(layerHandle)) != 0L )
+                {
+                    OGRGeometryH geom = OGR_F_GetGeometryRef( handle );
+                    if ( geom )
+                    {
+                        OGREnvelope env;
+                        OGR_G_GetEnvelope( geom, &env );
+                        entries.push_back( FeatureSpatialIndex::Entry(
+                            OGR_F_GetFID(handle), env.MinX, env.MinY, env.MaxX, env.MaxY) );
+                    }
+                    OGR_F_Destroy( handle );
+                }
+                _pool->release( dsHandle, layerHandle );
+            }
+
+            OE_INFO << LC << "Indexed " << entries.size() << " features for " << getName() << std::endl;
+            _localIndex = new FeatureSpatialIndex( entries );
+        }
+
+        return _localIndex.get();
+    }
+
+    // callers may hold the OGR lock, so this only flags the index; it's
+    // discarded by the next getLocalIndex().
+    void dirtyLocalIndex()
+    {
+        _localIndexStale.exchange( 1 );
+    }
+
     void initSchema()
     {
         OGRFeatureDefnH layerDef =  OGR_L_GetLayerDefn( _layerHandle );
@@ -506,6 +586,7 @@ private:
     OGRDataSourceH _dsHandle;
     OGRLayerH _layerHandle;
     OGRSFDriverH _ogrDriverHandle;
+    osg::ref_ptr<OGRDataSourcePool> _pool;
     osg::ref_ptr<Symbology::Geometry> _geometry; // explicit geometry.
     const OGRFeatureOptions _options;
     int _featureCount;
@@ -513,6 +594,10 @@ private:
     bool _writable;
     FeatureSchema _schema;
     Geometry::Type _geometryType;
+    bool _useLocalIndex;
+    osg::ref_ptr<FeatureSpatialIndex> _localIndex;
+    Threading::Mutex _localIndexMutex;
+    OpenThreads::Atomic _localIndexStale;
 };
 
 
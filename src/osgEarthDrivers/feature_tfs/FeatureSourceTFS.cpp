@@ -21,13 +21,16 @@
 #include <osgEarth/Registry>
 #include <osgEarth/XmlUtils>
 #include <osgEarth/FileUtils>
+#include <osgEarth/TaskService>
 #include <osgEarthFeatures/FeatureSource>
 #include <osgEarthFeatures/Filter>
 #include <osgEarthFeatures/BufferFilter>
 #include <osgEarthFeatures/ScaleFilter>
 #include <osgEarthFeatures/OgrUtils>
+#include <osgEarthFeatures/GeoJSONReader>
 #include <osgEarthUtil/TFS>
 #include <osg/Notify>
+#include <osg/Math>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <list>
@@ -49,6 +52,9 @@ using namespace osgEarth::Drivers;
 
 #define OGR_SCOPED_LOCK GDAL_SCOPED_LOCK
 
+// most tiles an untiled query will read
+#define MAX_TILES_PER_QUERY 256u
+
 /**
  * A FeatureSource that reads features from a TFS layer
  * 
@@ -108,6 +114,14 @@ public:
         {
             OE_INFO << LC <<  "Read layer TFS " << _layer.getTitle() << " " << _layer.getAbstract() << " " << _layer.getFirstLevel() << " " << _layer.getMaxLevel() << " " << _layer.getExtent().toString() << std::endl;
         }
+
+        // untiled queries fetch several tiles at once:
+        if ( _options.maxConcurrentRequests().get() > 1u )
+        {
+            _fetchService = new TaskService(
+                "TFS fetch",
+                osg::minimum(_options.maxConcurrentRequests().get(), 16u) );
+        }
     }
 
 
@@ -130,6 +144,12 @@ public:
 
     bool getFeatures( const std::string& buffer, const std::string& mimeType, FeatureList& features )
     {        
+        // GeoJSON is read straight into features, without OGR building a JSON tree first.
+        if ( isJSON(mimeType) )
+        {
+            return getFeaturesFromJSON( buffer, features );
+        }
+
         // find the right driver for the given mime type
         OGR_SCOPED_LOCK;
                 
@@ -168,7 +188,7 @@ public:
                 if ( feat_handle )
                 {
                     osg::ref_ptr<Feature> f = OgrUtils::createFeature( feat_handle, srs );
-                    if ( f.valid() && !isBlacklisted(f->getFID()) )
+                    if ( f.valid() )
                     {
                         features.push_back( f.release() );
                     }
@@ -183,6 +203,16 @@ public:
         return true;
     }
 
+    bool getFeaturesFromJSON( const std::string& buffer, FeatureList& features )
+    {
+        if ( !GeoJSONReader(_layer.getSRS()).read(buffer, features) )
+        {
+            OE_WARN << LC << "Error reading TFS response" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
     
     std::string getExtensionForMimeType(const std::string& mime)
     {
@@ -228,32 +258,29 @@ public:
             (mime.compare("text/x-json") == 0);
     }
 
-    std::string createURL(const Symbology::Query& query)
+    std::string createURL(const TileKey& key)
     {     
-        if (query.tileKey().isSet())
-        {
-            std::stringstream buf;
-            std::string path = osgDB::getFilePath(_options.url()->full());
-            buf << path << "/" << query.tileKey().get().getLevelOfDetail() << "/"
-                               << query.tileKey().get().getTileX() << "/"
-                               << query.tileKey().get().getTileY()
-                               << "." << _options.format().get();            
-            OE_DEBUG << "TFS url " << buf.str() << std::endl;
-            return buf.str();
-        }
-        return "";                       
+        std::stringstream buf;
+        std::string path = osgDB::getFilePath(_options.url()->full());
+        buf << path << "/" << key.getLevelOfDetail() << "/"
+                           << key.getTileX() << "/"
+                           << key.getTileY()
+                           << "." << _options.format().get();            
+        OE_DEBUG << "TFS url " << buf.str() << std::endl;
+        return buf.str();
     }
 
-    FeatureCursor* createFeatureCursor( const Symbology::Query& query )
+    /**
+     * Reads and parses one tile. Responses go through the layer's cache bin,
+     * so each tile is cached on its own.
+     */
+    bool readTile( const TileKey& key, FeatureList& features )
     {
-        FeatureCursor* result = 0L;
-
-        std::string url = createURL( query );
-        if (url.empty()) return 0;
+        std::string url = createURL( key );
 
         // check the blacklist:
         if ( Registry::instance()->isBlacklisted(url) )
-            return 0L;
+            return false;
 
         OE_DEBUG << LC << url << std::endl;
         URI uri(url);
@@ -262,11 +289,9 @@ public:
         ReadResult r = uri.readString( _dbOptions.get() );
 
         const std::string& buffer = r.getString();
-        const Config&      meta   = r.metadata();
 
         bool dataOK = false;
 
-        FeatureList features;
         if ( !buffer.empty() )
         {
             // Get the mime-type from the metadata record if possible
@@ -280,8 +305,99 @@ public:
             dataOK = getFeatures( buffer, mimeType, features );
         }
 
+        if ( !dataOK )
+            Registry::instance()->blacklist( url );
+
+        return dataOK;
+    }
+
+    /** One tile of an untiled query; several run at once on the fetch service. */
+    struct ReadTile
+    {
+        ReadTile() : _source(0L), _ok(false) { }
+        void execute() { _ok = _source->readTile(_key, _features); }
+
+        TFSFeatureSource* _source;
+        TileKey           _key;
+        FeatureList       _features;
+        bool              _ok;
+    };
+    typedef ParallelTask<ReadTile> ReadTileTask;
+
+    /**
+     * Answers a query that isn't for a single tile by reading every first-level
+     * tile it touches, several at a time.
+     */
+    bool readTiles( const Symbology::Query& query, FeatureList& features )
+    {
+        const FeatureProfile* fp = getFeatureProfile();
+        if ( !fp || !fp->getProfile() )
+            return false;
+
+        GeoExtent extent = query.bounds().isSet() ?
+            GeoExtent(fp->getSRS(), query.bounds().get()) :
+            fp->getExtent();
+
+        std::vector<TileKey> keys;
+        fp->getProfile()->getIntersectingTiles( extent, fp->getFirstLevel(), keys );
+        if ( keys.empty() )
+            return false;
+
+        if ( keys.size() > MAX_TILES_PER_QUERY )
+        {
+            OE_WARN << LC << "Query touches " << keys.size() << " tiles; refusing to read more than "
+                << MAX_TILES_PER_QUERY << std::endl;
+            return false;
+        }
+
+        std::vector< osg::ref_ptr<ReadTileTask> > tiles( keys.size() );
+        Threading::MultiEvent semaphore( (int)keys.size() );
+        for( unsigned i = 0; i < keys.size(); ++i )
+        {
+            tiles[i] = new ReadTileTask( &semaphore );
+            tiles[i]->_source = this;
+            tiles[i]->_key    = keys[i];
+            if ( _fetchService.valid() )
+                _fetchService->add( tiles[i].get() );
+            else
+                (*tiles[i])( 0L );
+        }
+        semaphore.wait();
+
+        bool dataOK = false;
+        for( unsigned i = 0; i < tiles.size(); ++i )
+        {
+            if ( tiles[i]->_ok )
+            {
+                features.insert( features.end(), tiles[i]->_features.begin(), tiles[i]->_features.end() );
+                dataOK = true;
+            }
+        }
+        return dataOK;
+    }
+
+    FeatureCursor* createFeatureCursor( const Symbology::Query& query )
+    {
+        FeatureCursor* result = 0L;
+
+        if ( !_layerValid )
+            return 0L;
+
+        FeatureList features;
+        bool dataOK = query.tileKey().isSet() ?
+            readTile( query.tileKey().get(), features ) :
+            readTiles( query, features );
+
         if ( dataOK )
         {
+            for( FeatureList::iterator i = features.begin(); i != features.end(); )
+            {
+                if ( isBlacklisted(i->get()->getFID()) )
+                    i = features.erase( i );
+                else
+                    ++i;
+            }
+
             OE_DEBUG << LC << "Read " << features.size() << " features" << std::endl;
         }
 
@@ -305,9 +421,6 @@ public:
         //result = new FeatureListCursor(features);
         result = dataOK ? new FeatureListCursor( features ) : 0L;
 
-        if ( !result )
-            Registry::instance()->blacklist( url );
-
         return result;
     }
 
@@ -346,6 +459,7 @@ private:
     osg::ref_ptr<osgDB::Options>    _dbOptions;    
     TFSLayer                        _layer;
     bool                            _layerValid;
+    osg::ref_ptr<TaskService>       _fetchService;
 };
 
 
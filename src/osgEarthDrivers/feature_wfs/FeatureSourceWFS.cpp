@@ -20,13 +20,16 @@
 
 #include <osgEarth/Registry>
 #include <osgEarth/FileUtils>
+#include <osgEarth/TaskService>
 #include <osgEarthFeatures/FeatureSource>
 #include <osgEarthFeatures/Filter>
 #include <osgEarthFeatures/BufferFilter>
 #include <osgEarthFeatures/ScaleFilter>
 #include <osgEarthUtil/WFS>
 #include <osgEarthFeatures/OgrUtils>
+#include <osgEarthFeatures/GeoJSONReader>
 #include <osg/Notify>
+#include <osg/Math>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <list>
@@ -59,7 +62,8 @@ class WFSFeatureSource : public FeatureSource
 public:
     WFSFeatureSource(const WFSFeatureOptions& options ) :
       FeatureSource( options ),
-      _options     ( options )
+      _options     ( options ),
+      _serverTiled ( false )
     {        
     }
 
@@ -121,6 +125,14 @@ public:
         {
             OE_INFO << "[osgEarth::WFS] Got capabilities from " << capUrl << std::endl;
         }
+
+        // paged queries fetch several pages at once:
+        if ( _options.pageSize().isSet() && _options.maxConcurrentRequests().get() > 1u )
+        {
+            _fetchService = new TaskService(
+                "WFS fetch",
+                osg::minimum(_options.maxConcurrentRequests().get(), 16u) );
+        }
     }
 
     void saveResponse(const std::string buffer, const std::string& filename)
@@ -163,6 +175,7 @@ public:
                                 result->setFirstLevel( featureType->getFirstLevel() );
                                 result->setMaxLevel( featureType->getMaxLevel() );
                                 result->setProfile( osgEarth::Profile::create(osgEarth::SpatialReference::create("epsg:4326"), featureType->getExtent().xMin(), featureType->getExtent().yMin(), featureType->getExtent().xMax(), featureType->getExtent().yMax(), 1, 1) );
+                                _serverTiled = true;
                             }
                         }
                     }
@@ -172,6 +185,16 @@ public:
                 {
                     result = new FeatureProfile(GeoExtent(SpatialReference::create( "epsg:4326" ), -180, -90, 180, 90));
                 }
+
+                // client-side tiling: the graph queries one tile (BBOX) at a time.
+                if ( !result->getTiled() && _options.tileLevel().isSet() )
+                {
+                    const GeoExtent& e = result->getExtent();
+                    result->setTiled( true );
+                    result->setFirstLevel( _options.tileLevel().get() );
+                    result->setMaxLevel( _options.tileLevel().get() );
+                    result->setProfile( osgEarth::Profile::create(e.getSRS(), e.xMin(), e.yMin(), e.xMax(), e.yMax(), 1, 1) );
+                }
                 
                 _featureProfile = result;
             }
@@ -191,6 +214,12 @@ public:
 
     bool getFeatures( const std::string& buffer, const std::string& mimeType, FeatureList& features )
     {
+        // GeoJSON is read straight into features, without OGR building a JSON tree first.
+        if ( isJSON(mimeType) )
+        {
+            return getFeaturesFromJSON( buffer, features );
+        }
+
         OGR_SCOPED_LOCK;        
 
         bool json = isJSON( mimeType );
@@ -250,7 +279,7 @@ public:
                 if ( feat_handle )
                 {
                     osg::ref_ptr<Feature> f = OgrUtils::createFeature( feat_handle, srs );
-                    if ( f.valid() && !isBlacklisted(f->getFID()) )
+                    if ( f.valid() )
                     {
                         features.push_back( f.release() );
                     }
@@ -271,6 +300,19 @@ public:
         return true;
     }
 
+    bool getFeaturesFromJSON( const std::string& buffer, FeatureList& features )
+    {
+        FeatureProfile* fp = getFeatureProfile();
+        const SpatialReference* srs = fp ? fp->getSRS() : 0L;
+
+        if ( !GeoJSONReader(srs).read(buffer, features) )
+        {
+            OE_WARN << LC << "Error reading WFS response" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
     
     std::string getExtensionForMimeType(const std::string& mime)
     {
@@ -305,7 +347,7 @@ public:
             startsWith(mime, "text/x-json");
     }
 
-    std::string createURL(const Symbology::Query& query)
+    std::string createURL(const Symbology::Query& query, unsigned startIndex =0u)
     {
         std::stringstream buf;
         buf << _options.url()->full() << "?SERVICE=WFS&VERSION=1.0.0&REQUEST=GetFeature";
@@ -315,12 +357,27 @@ public:
         if (_options.outputFormat().isSet()) outputFormat = _options.outputFormat().get();
         buf << "&OUTPUTFORMAT=" << outputFormat;
 
-        if (_options.maxFeatures().isSet())
+        if (_options.pageSize().isSet())
+        {
+            buf << "&MAXFEATURES=" << _options.pageSize().get()
+                << "&STARTINDEX=" << startIndex;
+        }
+        else if (_options.maxFeatures().isSet())
         {
             buf << "&MAXFEATURES=" << _options.maxFeatures().get();
         }
 
-        if (query.tileKey().isSet())
+        if (query.tileKey().isSet() && !_serverTiled)
+        {
+            const GeoExtent& e = query.tileKey().get().getExtent();
+            double buffer = *_options.buffer();
+            buf << "&BBOX=" << std::setprecision(16)
+                            << e.xMin() - buffer << ","
+                            << e.yMin() - buffer << ","
+                            << e.xMax() + buffer << ","
+                            << e.yMax() + buffer;
+        }
+        else if (query.tileKey().isSet())
         {
             buf << "&Z=" << query.tileKey().get().getLevelOfDetail() << 
                    "&X=" << query.tileKey().get().getTileX() <<
@@ -340,15 +397,15 @@ public:
         return str;
     }
 
-    FeatureCursor* createFeatureCursor( const Symbology::Query& query )
+    /**
+     * Reads and parses one GetFeature response. Responses go through the
+     * layer's cache bin, so each tile and page is cached on its own.
+     */
+    bool readFeatures( const std::string& url, FeatureList& features, unsigned* out_hash =0L )
     {
-        FeatureCursor* result = 0L;
-
-        std::string url = createURL( query );        
-
         // check the blacklist:
         if ( Registry::instance()->isBlacklisted(url) )
-            return 0L;
+            return false;
 
         OE_DEBUG << LC << url << std::endl;
         URI uri(url);
@@ -357,20 +414,134 @@ public:
         ReadResult r = uri.readString( _dbOptions.get() );
 
         const std::string& buffer = r.getString();
-        const Config&      meta   = r.metadata();
 
         bool dataOK = false;
 
-        FeatureList features;
         if ( !buffer.empty() )
         {
             // Get the mime-type from the metadata record if possible
             const std::string& mimeType = r.metadata().value( IOMetadata::CONTENT_TYPE );
             dataOK = getFeatures( buffer, mimeType, features );
+            if ( out_hash )
+                *out_hash = hashString( buffer );
         }
 
+        if ( !dataOK )
+            Registry::instance()->blacklist( url );
+
+        return dataOK;
+    }
+
+    /** One page of a paged query; several run at once on the fetch service. */
+    struct ReadPage
+    {
+        ReadPage() : _source(0L), _ok(false), _hash(0u) { }
+        void execute() { _ok = _source->readFeatures(_url, _features, &_hash); }
+
+        WFSFeatureSource* _source;
+        std::string       _url;
+        FeatureList       _features;
+        bool              _ok;
+        unsigned          _hash;
+    };
+    typedef ParallelTask<ReadPage> ReadPageTask;
+
+    /**
+     * Reads a query a page at a time, several pages per round, until a page
+     * comes back short.
+     */
+    bool readPages( const Symbology::Query& query, FeatureList& features )
+    {
+        unsigned pageSize = osg::maximum(_options.pageSize().get(), 1u);
+        unsigned perRound = _fetchService.valid() ? osg::maximum(_options.maxConcurrentRequests().get(), 1u) : 1u;
+        unsigned limit    = _options.maxFeatures().isSet() ? _options.maxFeatures().get() : ~0u;
+        unsigned firstHash = 0u;
+
+        for( unsigned start = 0u; start < limit; start += pageSize*perRound )
+        {
+            std::vector< osg::ref_ptr<ReadPageTask> > pages( perRound );
+            Threading::MultiEvent semaphore( (int)perRound );
+            for( unsigned i = 0; i < perRound; ++i )
+            {
+                pages[i] = new ReadPageTask( &semaphore );
+                pages[i]->_source = this;
+                pages[i]->_url    = createURL( query, start + i*pageSize );
+                if ( _fetchService.valid() )
+                    _fetchService->add( pages[i].get() );
+                else
+                    (*pages[i])( 0L );
+            }
+            semaphore.wait();
+
+            for( unsigned i = 0; i < perRound; ++i )
+            {
+                ReadPage& page = *pages[i];
+                bool first = (start == 0u && i == 0u);
+
+                if ( !page._ok )
+                    return !first;
+
+                if ( first )
+                {
+                    firstHash = page._hash;
+                }
+                else if ( page._hash == firstHash )
+                {
+                    OE_WARN << LC << "Service ignores STARTINDEX; paging disabled for this query" << std::endl;
+                    return true;
+                }
+
+                features.insert( features.end(), page._features.begin(), page._features.end() );
+                if ( features.size() >= limit )
+                {
+                    features.resize( limit );
+                    return true;
+                }
+
+                if ( page._features.size() < pageSize )
+                    return true;
+            }
+        }
+        return true;
+    }
+
+    /** With client-side tiling, keeps the features whose bounds center falls in the tile */
+    void cropToTile( const TileKey& key, FeatureList& features )
+    {
+        const GeoExtent& e = key.getExtent();
+        for( FeatureList::iterator i = features.begin(); i != features.end(); )
+        {
+            Geometry* geom = i->get()->getGeometry();
+            osg::Vec3d c = geom ? geom->getBounds().center() : osg::Vec3d();
+            if ( geom && (c.x() < e.xMin() || c.x() >= e.xMax() || c.y() < e.yMin() || c.y() >= e.yMax()) )
+                i = features.erase( i );
+            else
+                ++i;
+        }
+    }
+
+    FeatureCursor* createFeatureCursor( const Symbology::Query& query )
+    {
+        FeatureCursor* result = 0L;
+
+        FeatureList features;
+        bool dataOK = _options.pageSize().isSet() ?
+            readPages( query, features ) :
+            readFeatures( createURL(query), features );
+
         if ( dataOK )
         {
+            if ( query.tileKey().isSet() && !_serverTiled )
+                cropToTile( query.tileKey().get(), features );
+
+            for( FeatureList::iterator i = features.begin(); i != features.end(); )
+            {
+                if ( isBlacklisted(i->get()->getFID()) )
+                    i = features.erase( i );
+                else
+                    ++i;
+            }
+
             OE_DEBUG << LC << "Read " << features.size() << " features" << std::endl;
         }
 
@@ -394,9 +565,6 @@ public:
         //result = new FeatureListCursor(features);
         result = dataOK ? new FeatureListCursor( features ) : 0L;
 
-        if ( !result )
-            Registry::instance()->blacklist( url );
-
         return result;
     }
 
@@ -435,6 +603,8 @@ private:
     FeatureSchema                   _schema;
     osg::ref_ptr<CacheBin>          _cacheBin;
     osg::ref_ptr<osgDB::Options>    _dbOptions;    
+    osg::ref_ptr<TaskService>       _fetchService;
+    bool                            _serverTiled;
 };
 
 
@@ -23,6 +23,11 @@
 #include <osgEarth/ImageUtils>
 #include <osgEarth/URI>
 #include <osgEarth/HeightFieldUtils>
+#include <osgEarth/ThreadingUtils>
+#include <osgEarth/TaskService>
+
+#include <OpenThreads/Condition>
+#include <OpenThreads/Thread>
 
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
@@ -115,17 +120,25 @@ typedef struct
     double                 noDataValue;
 } BandProperty;
 
+// Collects the files under "file". If "latest" is non-NULL, it receives the most recent
+// modification time of any directory visited (adding or removing a file touches its directory).
 static void
-getFiles(const std::string &file, const std::vector<std::string> &exts, const std::vector<std::string> &blackExts, std::vector<std::string> &files)
+getFiles(const std::string &file, const std::vector<std::string> &exts, const std::vector<std::string> &blackExts, std::vector<std::string> &files, TimeStamp* latest =0L)
 {
     if (osgDB::fileType(file) == osgDB::DIRECTORY)
     {
+        if (latest)
+        {
+            TimeStamp t = osgEarth::getLastModifiedTime(file);
+            if (t > *latest) *latest = t;
+        }
+
         osgDB::DirectoryContents contents = osgDB::getDirectoryContents(file);
         for (osgDB::DirectoryContents::iterator itr = contents.begin(); itr != contents.end(); ++itr)
         {
             if (*itr == "." || *itr == "..") continue;
             std::string f = osgDB::concatPaths(file, *itr);
-            getFiles(f, exts, blackExts, files);
+            getFiles(f, exts, blackExts, files, latest);
         }
     }
     else
@@ -167,6 +180,123 @@ getFiles(const std::string &file, const std::vector<std::string> &exts, const st
     }
 }
 
+// Header information for one input file of build_vrt(), gathered in parallel.
+struct ScannedDataset
+{
+    ScannedDataset() : isOpen(false), isRotated(false), isPositiveNS(false), hasProj(false), nBands(0)
+    {
+        memset(&props, 0, sizeof(props));
+    }
+
+    bool                      isOpen;
+    bool                      isRotated;
+    bool                      isPositiveNS;
+    DatasetProperty           props;
+    std::string               proj;
+    bool                      hasProj;
+    int                       nBands;
+    std::vector<BandProperty> bands;      // colorTable is a clone (or 0); caller frees it
+    std::vector<int>          colorCounts;
+};
+
+// Opens one input file and reads what build_vrt() needs from its header.
+struct ScanDatasetHeader
+{
+    void execute()
+    {
+        ScannedDataset& out = *_result;
+        out.props.isFileOK = FALSE;
+
+        GDALDatasetH hDS = GDALOpen(_fileName.c_str(), GA_ReadOnly );
+        if (!hDS)
+            return;
+
+        out.isOpen = true;
+
+        const char* proj = GDALGetProjectionRef(hDS);
+        out.hasProj = proj && strlen(proj) > 0;
+        if (out.hasProj)
+        {
+            out.proj = proj;
+        }
+        else
+        {
+            std::string prjLocation = osgDB::getNameLessExtension( _fileName ) + std::string(".prj");
+            ReadResult r = URI(prjLocation).readString();
+            if ( r.succeeded() )
+            {
+                out.proj = r.getString();
+                out.hasProj = true;
+            }
+        }
+
+        GDALGetGeoTransform(hDS, out.props.adfGeoTransform);
+        out.isRotated =
+            out.props.adfGeoTransform[GEOTRSFRM_ROTATION_PARAM1] != 0 ||
+            out.props.adfGeoTransform[GEOTRSFRM_ROTATION_PARAM2] != 0;
+        out.isPositiveNS = out.props.adfGeoTransform[GEOTRSFRM_NS_RES] >= 0;
+
+        out.props.nRasterXSize = GDALGetRasterXSize(hDS);
+        out.props.nRasterYSize = GDALGetRasterYSize(hDS);
+
+        out.nBands = GDALGetRasterCount(hDS);
+        if (out.nBands > 0)
+        {
+            GDALGetBlockSize(GDALGetRasterBand( hDS, 1 ),
+                             &out.props.nBlockXSize,
+                             &out.props.nBlockYSize);
+        }
+
+        out.bands.resize(out.nBands);
+        out.colorCounts.resize(out.nBands, 0);
+        for(int j=0; j<out.nBands; j++)
+        {
+            GDALRasterBandH hRasterBand = GDALGetRasterBand( hDS, j+1 );
+            BandProperty& band = out.bands[j];
+            band.colorInterpretation = GDALGetRasterColorInterpretation(hRasterBand);
+            band.dataType = GDALGetRasterDataType(hRasterBand);
+            band.colorTable = 0;
+            GDALColorTableH colorTable = GDALGetRasterColorTable( hRasterBand );
+            if (colorTable)
+            {
+                out.colorCounts[j] = GDALGetColorEntryCount(colorTable);
+                if (band.colorInterpretation == GCI_PaletteIndex)
+                    band.colorTable = GDALCloneColorTable(colorTable);
+            }
+            band.noDataValue = GDALGetRasterNoDataValue(hRasterBand, &band.bHasNoData);
+        }
+
+        GDALClose(hDS);
+    }
+
+    std::string     _fileName;
+    ScannedDataset* _result;
+};
+
+// Reads the headers of all the files in parallel.
+static void
+scanDatasetHeaders(const std::vector<std::string>& files, std::vector<ScannedDataset>& out)
+{
+    out.clear();
+    out.resize(files.size());
+    if (files.empty())
+        return;
+
+    int numThreads = osg::clampBetween(OpenThreads::GetNumberOfProcessors(), 1, 16);
+    osg::ref_ptr<TaskService> service = new TaskService("GDAL header scan", numThreads);
+
+    Threading::MultiEvent semaphore( (int)files.size() );
+    for(unsigned i=0; i<files.size(); ++i)
+    {
+        ParallelTask<ScanDatasetHeader>* task = new ParallelTask<ScanDatasetHeader>( &semaphore );
+        task->_fileName = files[i];
+        task->_result   = &out[i];
+        service->add( task );
+    }
+
+    semaphore.wait();
+}
+
 // "build_vrt()" is adapted from the gdalbuildvrt application. Following is
 // the copyright notice from the source. The original code can be found at
 // http://trac.osgeo.org/gdal/browser/trunk/gdal/apps/gdalbuildvrt.cpp
@@ -195,8 +325,6 @@ getFiles(const std::string &file, const std::vector<std::string> &exts, const st
 static GDALDatasetH
 build_vrt(std::vector<std::string> &files, ResolutionStrategy resolutionStrategy)
 {
-    GDAL_SCOPED_LOCK;
-
     char* projectionRef = NULL;
     int nBands = 0;
     BandProperty* bandProperties = NULL;
@@ -212,59 +340,49 @@ build_vrt(std::vector<std::string> &files, ResolutionStrategy resolutionStrategy
 
     int nInputFiles = files.size();
 
+    // Opening thousands of files one at a time is what makes this slow, so read
+    // all the headers in parallel first (without the global lock, since each
+    // task has its own dataset handle).
+    std::vector<ScannedDataset> scanned;
+    scanDatasetHeaders(files, scanned);
+
+    GDAL_SCOPED_LOCK;
+
     DatasetProperty* psDatasetProperties =
             (DatasetProperty*) CPLMalloc(nInputFiles*sizeof(DatasetProperty));
 
     for(i=0;i<nInputFiles;i++)
     {
         const char* dsFileName = files[i].c_str();
+        ScannedDataset& scan = scanned[i];
 
         GDALTermProgress( 1.0 * (i+1) / nInputFiles, NULL, NULL);
 
-        GDALDatasetH hDS = GDALOpen(dsFileName, GA_ReadOnly );
+        psDatasetProperties[i] = scan.props;
         psDatasetProperties[i].isFileOK = FALSE;
 
-        if (hDS)
+        if (scan.isOpen)
         {
-            const char* proj = GDALGetProjectionRef(hDS);
-            if (!proj || strlen(proj) == 0)
-            {
-                std::string prjLocation = osgDB::getNameLessExtension( std::string(dsFileName) ) + std::string(".prj");
-                ReadResult r = URI(prjLocation).readString();
-                if ( r.succeeded() )
-                {
-                    proj = CPLStrdup( r.getString().c_str() );
-                }
-            }
+            const char* proj = scan.hasProj ? scan.proj.c_str() : NULL;
 
-            GDALGetGeoTransform(hDS, psDatasetProperties[i].adfGeoTransform);
-            if (psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_ROTATION_PARAM1] != 0 ||
-                psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_ROTATION_PARAM2] != 0)
+            if (scan.isRotated)
             {
                 fprintf( stderr, "GDAL Driver does not support rotated geo transforms. Skipping %s\n",
                              dsFileName);
-                GDALClose(hDS);
                 continue;
             }
-            if (psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_NS_RES] >= 0)
+            if (scan.isPositiveNS)
             {
                 fprintf( stderr, "GDAL Driver does not support positive NS resolution. Skipping %s\n",
                              dsFileName);
-                GDALClose(hDS);
                 continue;
             }
-            psDatasetProperties[i].nRasterXSize = GDALGetRasterXSize(hDS);
-            psDatasetProperties[i].nRasterYSize = GDALGetRasterYSize(hDS);
             double product_minX = psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_TOPLEFT_X];
             double product_maxY = psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_TOPLEFT_Y];
             double product_maxX = product_minX +
-                        GDALGetRasterXSize(hDS) * psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_WE_RES];
+                        psDatasetProperties[i].nRasterXSize * psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_WE_RES];
             double product_minY = product_maxY +
-                        GDALGetRasterYSize(hDS) * psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_NS_RES];
-
-            GDALGetBlockSize(GDALGetRasterBand( hDS, 1 ),
-                             &psDatasetProperties[i].nBlockXSize,
-                             &psDatasetProperties[i].nBlockYSize);
+                        psDatasetProperties[i].nRasterYSize * psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_NS_RES];
 
             if (bFirst)
             {
@@ -274,24 +392,13 @@ build_vrt(std::vector<std::string> &files, ResolutionStrategy resolutionStrategy
                 minY = product_minY;
                 maxX = product_maxX;
                 maxY = product_maxY;
-                nBands = GDALGetRasterCount(hDS);
+                nBands = scan.nBands;
                 bandProperties = (BandProperty*)CPLMalloc(nBands*sizeof(BandProperty));
                 for(j=0;j<nBands;j++)
                 {
-                    GDALRasterBandH hRasterBand = GDALGetRasterBand( hDS, j+1 );
-                    bandProperties[j].colorInterpretation = GDALGetRasterColorInterpretation(hRasterBand);
-                    bandProperties[j].dataType = GDALGetRasterDataType(hRasterBand);
-                    if (bandProperties[j].colorInterpretation == GCI_PaletteIndex)
-                    {
-                        bandProperties[j].colorTable = GDALGetRasterColorTable( hRasterBand );
-                        if (bandProperties[j].colorTable)
-                        {
-                            bandProperties[j].colorTable = GDALCloneColorTable(bandProperties[j].colorTable);
-                        }
-                    }
-                    else
-                        bandProperties[j].colorTable = 0;
-                    bandProperties[j].noDataValue = GDALGetRasterNoDataValue(hRasterBand, &bandProperties[j].bHasNoData);
+                    // take ownership of the cloned color table.
+                    bandProperties[j] = scan.bands[j];
+                    scan.bands[j].colorTable = 0;
                 }
             }
             else
@@ -301,36 +408,30 @@ build_vrt(std::vector<std::string> &files, ResolutionStrategy resolutionStrategy
                     (proj != NULL && projectionRef != NULL && EQUAL(proj, projectionRef) == FALSE))
                 {
                     fprintf( stderr, "gdalbuildvrt does not support heterogenous projection. Skipping %s\n",dsFileName);
-                    GDALClose(hDS);
                     continue;
                 }
-                int _nBands = GDALGetRasterCount(hDS);
-                if (nBands != _nBands)
+                if (nBands != scan.nBands)
                 {
                     fprintf( stderr, "gdalbuildvrt does not support heterogenous band numbers. Skipping %s\n",
                              dsFileName);
-                    GDALClose(hDS);
                     continue;
                 }
                 for(j=0;j<nBands;j++)
                 {
-                    GDALRasterBandH hRasterBand = GDALGetRasterBand( hDS, j+1 );
-                    if (bandProperties[j].colorInterpretation != GDALGetRasterColorInterpretation(hRasterBand) ||
-                        bandProperties[j].dataType != GDALGetRasterDataType(hRasterBand))
+                    if (bandProperties[j].colorInterpretation != scan.bands[j].colorInterpretation ||
+                        bandProperties[j].dataType != scan.bands[j].dataType)
                     {
                         fprintf( stderr, "gdalbuildvrt does not support heterogenous band characteristics. Skipping %s\n",
                              dsFileName);
-                        GDALClose(hDS);
+                        break;
                     }
                     if (bandProperties[j].colorTable)
                     {
-                        GDALColorTableH colorTable = GDALGetRasterColorTable( hRasterBand );
-                        if (colorTable == NULL ||
-                            GDALGetColorEntryCount(colorTable) != GDALGetColorEntryCount(bandProperties[j].colorTable))
+                        if (scan.colorCounts[j] == 0 ||
+                            scan.colorCounts[j] != GDALGetColorEntryCount(bandProperties[j].colorTable))
                         {
                             fprintf( stderr, "gdalbuildvrt does not support heterogenous band characteristics. Skipping %s\n",
                              dsFileName);
-                            GDALClose(hDS);
                             break;
                         }
                         /* We should check that the palette are the same too ! */
@@ -372,7 +473,6 @@ build_vrt(std::vector<std::string> &files, ResolutionStrategy resolutionStrategy
             psDatasetProperties[i].isFileOK = 1;
             nCount ++;
             bFirst = FALSE;
-            GDALClose(hDS);
         }
         else
         {
@@ -380,6 +480,16 @@ build_vrt(std::vector<std::string> &files, ResolutionStrategy resolutionStrategy
         }
     }
 
+    // free the color tables we didn't keep.
+    for(i=0;i<nInputFiles;i++)
+    {
+        for(j=0;j<(int)scanned[i].bands.size();j++)
+        {
+            if (scanned[i].bands[j].colorTable)
+                GDALDestroyColorTable(scanned[i].bands[j].colorTable);
+        }
+    }
+
     if (nCount == 0)
         goto end;
 
@@ -620,6 +730,239 @@ GDALDatasetH GDALAutoCreateWarpedVRTforPolarStereographic(
 }
 
 
+/**
+ * A bounded pool of GDAL dataset handles on the same source. A GDALDataset
+ * is not thread-safe, but separate handles on the same file can be read
+ * concurrently, so each reader checks out a handle of its own. New handles
+ * are opened on demand up to a maximum; handles that go unused for a while
+ * are closed the next time one is returned, to keep the number of open
+ * files down.
+ */
+class GDALDatasetPool : public osg::Referenced
+{
+public:
+    struct Handle
+    {
+        Handle() : _srcDS(NULL), _warpedDS(NULL), _lastUsed(0.0) { }
+        GDALDataset* _srcDS;
+        GDALDataset* _warpedDS;
+        double       _lastUsed;
+    };
+
+    /** Everything needed to open another handle like the original one */
+    struct Source
+    {
+        Source() : _warp(false), _polar(false) { }
+        std::string _name;      // file name, subdataset name, or VRT XML
+        bool        _warp;      // whether to wrap the dataset in a warped VRT
+        bool        _polar;     // use the polar stereographic warper
+        std::string _srcWKT;
+        std::string _destWKT;
+    };
+
+    /**
+     * Constructs a pool. The primary handle is the one the tile source opened
+     * itself; the pool hands it out but never closes it.
+     */
+    GDALDatasetPool(const Source& source, const Handle& primary, unsigned maxHandles) :
+      _source    ( source ),
+      _primary   ( primary ),
+      _maxHandles( osg::maximum(maxHandles, 1u) ),
+      _numOpen   ( 1 )
+    {
+        _idle.push_back( primary );
+    }
+
+    /** Checks out a handle, waiting for one if the pool is at capacity. */
+    Handle acquire()
+    {
+        _mutex.lock();
+        for(;;)
+        {
+            if ( !_idle.empty() )
+            {
+                Handle handle = _idle.back();
+                _idle.pop_back();
+                _mutex.unlock();
+                return handle;
+            }
+
+            if ( _numOpen < _maxHandles )
+            {
+                ++_numOpen;
+                _mutex.unlock();
+
+                Handle handle;
+                if ( open(handle) )
+                    return handle;
+
+                // Couldn't open another handle; make do with the ones we have.
+                _mutex.lock();
+                --_numOpen;
+                _maxHandles = _numOpen;
+                OE_WARN << LC << "Failed to open an additional dataset handle; limiting pool to "
+                    << _maxHandles << std::endl;
+                continue;
+            }
+
+            _available.wait( &_mutex );
+        }
+    }
+
+    /** Returns a handle to the pool, and closes any that have been idle too long. */
+    void release(const Handle& handle)
+    {
+        std::vector<Handle> expired;
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+
+            double now = osg::Timer::instance()->time_s();
+            for( std::vector<Handle>::iterator i = _idle.begin(); i != _idle.end(); )
+            {
+                if ( i->_srcDS != _primary._srcDS && now - i->_lastUsed > IDLE_TIMEOUT_S )
+                {
+                    expired.push_back( *i );
+                    i = _idle.erase( i );
+                    --_numOpen;
+                }
+                else ++i;
+            }
+
+            _idle.push_back( handle );
+            _idle.back()._lastUsed = now;
+            _available.signal();
+        }
+
+        for( std::vector<Handle>::iterator i = expired.begin(); i != expired.end(); ++i )
+        {
+            close( *i );
+        }
+    }
+
+protected:
+
+    virtual ~GDALDatasetPool()
+    {
+        for( std::vector<Handle>::iterator i = _idle.begin(); i != _idle.end(); ++i )
+        {
+            if ( i->_srcDS != _primary._srcDS )
+                close( *i );
+        }
+    }
+
+private:
+
+    bool open(Handle& handle)
+    {
+        GDAL_SCOPED_LOCK;
+
+        handle._srcDS = (GDALDataset*)GDALOpen( _source._name.c_str(), GA_ReadOnly );
+        if ( !handle._srcDS )
+            return false;
+
+        if ( _source._warp )
+        {
+            if ( _source._polar )
+            {
+                handle._warpedDS = (GDALDataset*)GDALAutoCreateWarpedVRTforPolarStereographic(
+                    handle._srcDS,
+                    _source._srcWKT.c_str(),
+                    _source._destWKT.c_str(),
+                    GRA_NearestNeighbour,
+                    5.0,
+                    NULL);
+            }
+            else
+            {
+                handle._warpedDS = (GDALDataset*)GDALAutoCreateWarpedVRT(
+                    handle._srcDS,
+                    _source._srcWKT.c_str(),
+                    _source._destWKT.c_str(),
+                    GRA_NearestNeighbour,
+                    5.0,
+                    0);
+            }
+
+            if ( !handle._warpedDS )
+            {
+                GDALClose( handle._srcDS );
+                handle._srcDS = NULL;
+                return false;
+            }
+        }
+        else
+        {
+            handle._warpedDS = handle._srcDS;
+        }
+
+        return true;
+    }
+
+    void close(Handle& handle)
+    {
+        GDAL_SCOPED_LOCK;
+
+        if ( handle._warpedDS && handle._warpedDS != handle._srcDS )
+            GDALClose( handle._warpedDS );
+        if ( handle._srcDS )
+            GDALClose( handle._srcDS );
+
+        handle._srcDS = handle._warpedDS = NULL;
+    }
+
+    static const double IDLE_TIMEOUT_S;
+
+    Source              _source;
+    Handle              _primary;
+    unsigned            _maxHandles;
+    unsigned            _numOpen;
+    std::vector<Handle> _idle;
+    Threading::Mutex    _mutex;
+    OpenThreads::Condition _available;
+};
+
+const double GDALDatasetPool::IDLE_TIMEOUT_S = 60.0;
+
+
+/**
+ * Gives the current scope exclusive use of a dataset handle. Without a pool,
+ * this falls back on the shared handle under the global GDAL lock.
+ */
+class ScopedGDALDataset
+{
+public:
+    ScopedGDALDataset(GDALDatasetPool* pool, GDALDataset* srcDS, GDALDataset* warpedDS) :
+      _pool( pool )
+    {
+        if ( _pool.valid() )
+        {
+            _handle = _pool->acquire();
+        }
+        else
+        {
+            Registry::instance()->getGDALMutex().lock();
+            _handle._srcDS    = srcDS;
+            _handle._warpedDS = warpedDS;
+        }
+    }
+
+    ~ScopedGDALDataset()
+    {
+        if ( _pool.valid() )
+            _pool->release( _handle );
+        else
+            Registry::instance()->getGDALMutex().unlock();
+    }
+
+    /** The (possibly warped) dataset to read from */
+    GDALDataset* get() const { return _handle._warpedDS; }
+
+private:
+    osg::ref_ptr<GDALDatasetPool> _pool;
+    GDALDatasetPool::Handle       _handle;
+};
+
+
 class GDALTileSource : public TileSource
 {
 public:
@@ -634,6 +977,9 @@ public:
 
     virtual ~GDALTileSource()
     {
+        // close any additional handles before the primary ones.
+        _pool = 0L;
+
         GDAL_SCOPED_LOCK;
 
         // Close the _warpedDS dataset if :
@@ -723,9 +1069,14 @@ public:
 
         //URI uri = _options.url().value();
 
+        // how to open more handles on the same dataset (for the read pool).
+        // Stays empty for external datasets, which we can't reopen.
+        GDALDatasetPool::Source poolSource;
+
         if (useExternalDataset == false)
         {
             std::vector<std::string> files;
+            TimeStamp sourceModified = 0;
 
             if ( _options.url().isSet() )
             {
@@ -747,7 +1098,7 @@ public:
 					OE_DEBUG << LC << "Blacklisting Extension: " << blackExts[i] << std::endl;
 				}
 
-                getFiles(source, exts, blackExts, files);
+                getFiles(source, exts, blackExts, files, &sourceModified);
 
                 OE_INFO << LC << "Driver found " << files.size() << " files:" << std::endl;
                 for (unsigned int i = 0; i < files.size(); ++i)
@@ -769,7 +1120,9 @@ public:
             //If we found more than one file, try to combine them into a single logical dataset
             if (files.size() > 1)
             {
-                std::string vrtKey = "combined.vrt";
+                // Key the cached VRT on the file count and the latest directory modification
+                // time, so that adding or removing files will force a rebuild.
+                std::string vrtKey = Stringify() << "combined_" << files.size() << "_" << sourceModified << ".vrt";
 
                 //Get the GDAL VRT driver
                 GDALDriver* vrtDriver = (GDALDriver*)GDALGetDriverByName("VRT");
@@ -784,6 +1137,7 @@ public:
                         if (_srcDS)
                         {
                             OE_INFO << LC << INDENT << "Read VRT from cache!" << std::endl;
+                            poolSource._name = result.getString();
                         }
                     }
                 }
@@ -799,6 +1153,13 @@ public:
 
                     if (_srcDS)
                     {
+                        // the XML description lets us open more handles on the VRT.
+                        char** vrtXML = _srcDS->GetMetadata("xml:VRT");
+                        if ( vrtXML && vrtXML[0] )
+                        {
+                            poolSource._name = vrtXML[0];
+                        }
+
                         //Cache the VRT so we don't have to build it next time.
                         if (_cacheBin)
                         {
@@ -842,6 +1203,7 @@ public:
 
                 if (_srcDS)
                 {
+                    poolSource._name = files[0];
 
                     char **subDatasets = _srcDS->GetMetadata( "SUBDATASETS");
                     int numSubDatasets = CSLCount( subDatasets );
@@ -856,6 +1218,7 @@ public:
                         char *pszSubdatasetName = CPLStrdup( CSLFetchNameValue( subDatasets, buf.str().c_str() ) );
                         GDALClose( _srcDS );
                         _srcDS = (GDALDataset*)GDALOpen( pszSubdatasetName, GA_ReadOnly ) ;
+                        poolSource._name = pszSubdatasetName;
                         CPLFree( pszSubdatasetName );
                     }
                 }
@@ -974,8 +1337,13 @@ public:
         {
             std::string destWKT = profile ? profile->getSRS()->getWKT() : src_srs->getWKT();
 
+            poolSource._warp    = true;
+            poolSource._srcWKT  = src_srs->getWKT();
+            poolSource._destWKT = destWKT;
+
             if ( profile && profile->getSRS()->isGeographic() && (src_srs->isNorthPolar() || src_srs->isSouthPolar()) )
             {
+                poolSource._polar = true;
                 _warpedDS = (GDALDataset*)GDALAutoCreateWarpedVRTforPolarStereographic(
                     _srcDS,
                     src_srs->getWKT().c_str(),
@@ -1115,6 +1483,15 @@ public:
         //Set the profile
         setProfile( profile );
 
+        // Set up the handle pool so reads don't have to share the one dataset.
+        if ( !poolSource._name.empty() && _warpedDS && _options.maxOpenDatasets().value() > 1 )
+        {
+            GDALDatasetPool::Handle primary;
+            primary._srcDS    = _srcDS;
+            primary._warpedDS = _warpedDS;
+            _pool = new GDALDatasetPool( poolSource, primary, _options.maxOpenDatasets().value() );
+        }
+
         return STATUS_OK;
     }
 
@@ -1124,8 +1501,6 @@ public:
     */
     static GDALRasterBand* findBandByColorInterp(GDALDataset *ds, GDALColorInterp colorInterp)
     {
-        GDAL_SCOPED_LOCK;
-
         for (int i = 1; i <= ds->GetRasterCount(); ++i)
         {
             if (ds->GetRasterBand(i)->GetColorInterpretation() == colorInterp) return ds->GetRasterBand(i);
@@ -1135,8 +1510,6 @@ public:
 
     static GDALRasterBand* findBandByDataType(GDALDataset *ds, GDALDataType dataType)
     {
-        GDAL_SCOPED_LOCK;
-
         for (int i = 1; i <= ds->GetRasterCount(); ++i)
         {
             if (ds->GetRasterBand(i)->GetRasterDataType() == dataType) return ds->GetRasterBand(i);
@@ -1242,6 +1615,102 @@ public:
 
     }
 
+    /**
+     * Finds the overview of a band that is closest to the resolution needed to
+     * read a window of the full-resolution band into a buffer of the given size,
+     * without being any coarser. Returns the band itself if no overview fits.
+     */
+    static GDALRasterBand* selectOverview(GDALRasterBand* band, int width, int height, int bufWidth, int bufHeight)
+    {
+        GDALRasterBand* best = band;
+        int bestXSize = band->GetXSize();
+
+        for( int i = 0; i < band->GetOverviewCount(); ++i )
+        {
+            GDALRasterBand* overview = band->GetOverview( i );
+            if ( !overview || overview->GetXSize() <= 0 || overview->GetYSize() <= 0 )
+                continue;
+
+            double sx = (double)band->GetXSize() / (double)overview->GetXSize();
+            double sy = (double)band->GetYSize() / (double)overview->GetYSize();
+
+            // the window must still have at least as many pixels as the buffer.
+            if ( (double)width / sx >= (double)bufWidth && (double)height / sy >= (double)bufHeight )
+            {
+                if ( overview->GetXSize() < bestXSize )
+                {
+                    best = overview;
+                    bestXSize = overview->GetXSize();
+                }
+            }
+        }
+        return best;
+    }
+
+    /**
+     * Reads a window of a full-resolution band into a buffer, reading from the
+     * overview that best matches the buffer resolution. The kernel picks the
+     * resampling method GDAL uses (GDAL 2.0+; older versions always use nearest).
+     */
+    bool readWindow(GDALRasterBand* band, int off_x, int off_y, int width, int height,
+                    void* buffer, int bufWidth, int bufHeight, GDALDataType type,
+                    ElevationInterpolation kernel)
+    {
+        GDALRasterBand* source = band;
+        double sx = 1.0, sy = 1.0;
+
+        if ( width > bufWidth || height > bufHeight )
+        {
+            source = selectOverview( band, width, height, bufWidth, bufHeight );
+            sx = (double)band->GetXSize() / (double)source->GetXSize();
+            sy = (double)band->GetYSize() / (double)source->GetYSize();
+        }
+
+        // the window in the pixel space of the band we are reading from
+        double dfXOff  = (double)off_x / sx;
+        double dfYOff  = (double)off_y / sy;
+        double dfXSize = (double)width / sx;
+        double dfYSize = (double)height / sy;
+
+        int ov_off_x = osg::clampBetween( (int)floor(dfXOff), 0, source->GetXSize()-1 );
+        int ov_off_y = osg::clampBetween( (int)floor(dfYOff), 0, source->GetYSize()-1 );
+        int ov_width  = osg::clampBetween( (int)ceil(dfXOff + dfXSize) - ov_off_x, 1, source->GetXSize() - ov_off_x );
+        int ov_height = osg::clampBetween( (int)ceil(dfYOff + dfYSize) - ov_off_y, 1, source->GetYSize() - ov_off_y );
+
+        if ( source != band )
+        {
+            OE_DEBUG << LC << "Reading " << width << "x" << height << " window from "
+                << source->GetXSize() << "x" << source->GetYSize() << " overview" << std::endl;
+        }
+
+        CPLErr err;
+
+#if GDAL_VERSION_MAJOR >= 2
+        GDALRasterIOExtraArg extra;
+        INIT_RASTERIO_EXTRA_ARG( extra );
+        extra.eResampleAlg =
+            kernel == INTERP_AVERAGE  ? GRIORA_Average :
+            kernel == INTERP_BILINEAR ? GRIORA_Bilinear :
+            GRIORA_NearestNeighbour;
+
+        if ( source != band )
+        {
+            // read exactly the footprint of the original window.
+            extra.bFloatingPointWindowValidity = TRUE;
+            extra.dfXOff  = dfXOff;
+            extra.dfYOff  = dfYOff;
+            extra.dfXSize = dfXSize;
+            extra.dfYSize = dfYSize;
+        }
+
+        err = source->RasterIO(GF_Read, ov_off_x, ov_off_y, ov_width, ov_height, buffer, bufWidth, bufHeight, type, 0, 0, &extra);
+#else
+        err = source->RasterIO(GF_Read, ov_off_x, ov_off_y, ov_width, ov_height, buffer, bufWidth, bufHeight, type, 0, 0);
+#endif
+
+        return err == CE_None;
+    }
+
     osg::Image* createImage( const TileKey&        key,
                              ProgressCallback*     progress)
     {
@@ -1252,7 +1721,9 @@ public:
             return NULL;
         }
 
-        GDAL_SCOPED_LOCK;
+        // take a dataset handle of our own for the duration of the read.
+        ScopedGDALDataset scopedDS( _pool.get(), _srcDS, _warpedDS );
+        GDALDataset* warpedDS = scopedDS.get();
 
         int tileSize = _options.tileSize().value();
 
@@ -1284,8 +1755,8 @@ public:
             int height = (int)(src_max_y - src_min_y);
 
 
-            int rasterWidth = _warpedDS->GetRasterXSize();
-            int rasterHeight = _warpedDS->GetRasterYSize();
+            int rasterWidth = warpedDS->GetRasterXSize();
+            int rasterHeight = warpedDS->GetRasterYSize();
             if (off_x + width > rasterWidth || off_y + height > rasterHeight)
             {
                 OE_WARN << LC << "Read window outside of bounds of dataset.  Source Dimensions=" << rasterWidth << "x" << rasterHeight << " Read Window=" << off_x << ", " << off_y << " " << width << "x" << height << std::endl;
@@ -1319,44 +1790,44 @@ public:
 
 
 
-            GDALRasterBand* bandRed = findBandByColorInterp(_warpedDS, GCI_RedBand);
-            GDALRasterBand* bandGreen = findBandByColorInterp(_warpedDS, GCI_GreenBand);
-            GDALRasterBand* bandBlue = findBandByColorInterp(_warpedDS, GCI_BlueBand);
-            GDALRasterBand* bandAlpha = findBandByColorInterp(_warpedDS, GCI_AlphaBand);
+            GDALRasterBand* bandRed = findBandByColorInterp(warpedDS, GCI_RedBand);
+            GDALRasterBand* bandGreen = findBandByColorInterp(warpedDS, GCI_GreenBand);
+            GDALRasterBand* bandBlue = findBandByColorInterp(warpedDS, GCI_BlueBand);
+            GDALRasterBand* bandAlpha = findBandByColorInterp(warpedDS, GCI_AlphaBand);
 
-            GDALRasterBand* bandGray = findBandByColorInterp(_warpedDS, GCI_GrayIndex);
+            GDALRasterBand* bandGray = findBandByColorInterp(warpedDS, GCI_GrayIndex);
 
-            GDALRasterBand* bandPalette = findBandByColorInterp(_warpedDS, GCI_PaletteIndex);
+            GDALRasterBand* bandPalette = findBandByColorInterp(warpedDS, GCI_PaletteIndex);
 
             if (!bandRed && !bandGreen && !bandBlue && !bandAlpha && !bandGray && !bandPalette)
             {
                 OE_DEBUG << LC << "Could not determine bands based on color interpretation, using band count" << std::endl;
                 //We couldn't find any valid bands based on the color interp, so just make an educated guess based on the number of bands in the file
                 //RGB = 3 bands
-                if (_warpedDS->GetRasterCount() == 3)
+                if (warpedDS->GetRasterCount() == 3)
                 {
-                    bandRed   = _warpedDS->GetRasterBand( 1 );
-                    bandGreen = _warpedDS->GetRasterBand( 2 );
-                    bandBlue  = _warpedDS->GetRasterBand( 3 );
+                    bandRed   = warpedDS->GetRasterBand( 1 );
+                    bandGreen = warpedDS->GetRasterBand( 2 );
+                    bandBlue  = warpedDS->GetRasterBand( 3 );
                 }
                 //RGBA = 4 bands
-                else if (_warpedDS->GetRasterCount() == 4)
+                else if (warpedDS->GetRasterCount() == 4)
                 {
-                    bandRed   = _warpedDS->GetRasterBand( 1 );
-                    bandGreen = _warpedDS->GetRasterBand( 2 );
-                    bandBlue  = _warpedDS->GetRasterBand( 3 );
-                    bandAlpha = _warpedDS->GetRasterBand( 4 );
+                    bandRed   = warpedDS->GetRasterBand( 1 );
+                    bandGreen = warpedDS->GetRasterBand( 2 );
+                    bandBlue  = warpedDS->GetRasterBand( 3 );
+                    bandAlpha = warpedDS->GetRasterBand( 4 );
                 }
                 //Gray = 1 band
-                else if (_warpedDS->GetRasterCount() == 1)
+                else if (warpedDS->GetRasterCount() == 1)
                 {
-                    bandGray = _warpedDS->GetRasterBand( 1 );
+                    bandGray = warpedDS->GetRasterBand( 1 );
                 }
                 //Gray + alpha = 2 bands
-                else if (_warpedDS->GetRasterCount() == 2)
+                else if (warpedDS->GetRasterCount() == 2)
                 {
-                    bandGray  = _warpedDS->GetRasterBand( 1 );
-                    bandAlpha = _warpedDS->GetRasterBand( 2 );
+                    bandGray  = warpedDS->GetRasterBand( 1 );
+                    bandAlpha = warpedDS->GetRasterBand( 2 );
                 }
             }
 
@@ -1365,6 +1836,12 @@ public:
             //The pixel format is always RGBA to support transparency
             GLenum pixelFormat = GL_RGBA;
 
+            // When the read window is larger than the tile, we are reading from an overview.
+            bool downsampling = width > target_width || height > target_height;
+
+            // Resampling method for window reads.
+            ElevationInterpolation kernel = *_options.interpolateImagery() ? *_options.interpolation() : INTERP_NEAREST;
+
 
             if (bandRed && bandGreen && bandBlue)
             {
@@ -1381,15 +1858,17 @@ public:
                 memset(image->data(), 0, image->getImageSizeInBytes());
 
                 //Nearest interpolation just uses RasterIO to sample the imagery and should be very fast.
-                if (!*_options.interpolateImagery() || _options.interpolation() == INTERP_NEAREST)
+                //So does downsampling, which reads from an overview with the requested kernel instead
+                //of sampling the full resolution data point by point.
+                if (!*_options.interpolateImagery() || _options.interpolation() == INTERP_NEAREST || downsampling)
                 {
-                    bandRed->RasterIO(GF_Read, off_x, off_y, width, height, red, target_width, target_height, GDT_Byte, 0, 0);
-                    bandGreen->RasterIO(GF_Read, off_x, off_y, width, height, green, target_width, target_height, GDT_Byte, 0, 0);
-                    bandBlue->RasterIO(GF_Read, off_x, off_y, width, height, blue, target_width, target_height, GDT_Byte, 0, 0);
+                    readWindow(bandRed, off_x, off_y, width, height, red, target_width, target_height, GDT_Byte, kernel);
+                    readWindow(bandGreen, off_x, off_y, width, height, green, target_width, target_height, GDT_Byte, kernel);
+                    readWindow(bandBlue, off_x, off_y, width, height, blue, target_width, target_height, GDT_Byte, kernel);
 
                     if (bandAlpha)
                     {
-                        bandAlpha->RasterIO(GF_Read, off_x, off_y, width, height, alpha, target_width, target_height, GDT_Byte, 0, 0);
+                        readWindow(bandAlpha, off_x, off_y, width, height, alpha, target_width, target_height, GDT_Byte, kernel);
                     }
 
                     for (int src_row = 0, dst_row = tile_offset_top;
@@ -1458,13 +1937,13 @@ public:
                 memset(image->data(), 0, image->getImageSizeInBytes());
 
 
-                if (!*_options.interpolateImagery() || _options.interpolation() == INTERP_NEAREST)
+                if (!*_options.interpolateImagery() || _options.interpolation() == INTERP_NEAREST || downsampling)
                 {
-                    bandGray->RasterIO(GF_Read, off_x, off_y, width, height, gray, target_width, target_height, GDT_Byte, 0, 0);
+                    readWindow(bandGray, off_x, off_y, width, height, gray, target_width, target_height, GDT_Byte, kernel);
 
                     if (bandAlpha)
                     {
-                        bandAlpha->RasterIO(GF_Read, off_x, off_y, width, height, alpha, target_width, target_height, GDT_Byte, 0, 0);
+                        readWindow(bandAlpha, off_x, off_y, width, height, alpha, target_width, target_height, GDT_Byte, kernel);
                     }
 
                     for (int src_row = 0, dst_row = tile_offset_top;
@@ -1527,7 +2006,7 @@ public:
                 image->allocateImage(tileSize, tileSize, 1, pixelFormat, GL_UNSIGNED_BYTE);
                 memset(image->data(), 0, image->getImageSizeInBytes());
 
-                bandPalette->RasterIO(GF_Read, off_x, off_y, width, height, palette, target_width, target_height, GDT_Byte, 0, 0);
+                readWindow(bandPalette, off_x, off_y, width, height, palette, target_width, target_height, GDT_Byte, INTERP_NEAREST);
 
                 for (int src_row = 0, dst_row = tile_offset_top;
                     src_row < target_height;
@@ -1585,8 +2064,6 @@ public:
 
     bool isValidValue(float v, GDALRasterBand* band)
     {
-        GDAL_SCOPED_LOCK;
-
         float bandNoData = -32767.0f;
         int success;
         float value = band->GetNoDataValue(&success);
@@ -1747,7 +2224,9 @@ public:
             return NULL;
         }
 
-        GDAL_SCOPED_LOCK;
+        // take a dataset handle of our own for the duration of the read.
+        ScopedGDALDataset scopedDS( _pool.get(), _srcDS, _warpedDS );
+        GDALDataset* warpedDS = scopedDS.get();
 
         int tileSize = _options.tileSize().value();
 
@@ -1762,11 +2241,11 @@ public:
             key.getExtent().getBounds(xmin, ymin, xmax, ymax);
 
             // Try to find a FLOAT band
-            GDALRasterBand* band = findBandByDataType(_warpedDS, GDT_Float32);
+            GDALRasterBand* band = findBandByDataType(warpedDS, GDT_Float32);
             if (band == NULL)
             {
                 // Just get first band
-                band = _warpedDS->GetRasterBand(1);
+                band = warpedDS->GetRasterBand(1);
             }
 
             double dx = (xmax - xmin) / (tileSize-1);
@@ -1828,7 +2307,9 @@ public:
             return NULL;
         }
 
-        GDAL_SCOPED_LOCK;
+        // take a dataset handle of our own for the duration of the read.
+        ScopedGDALDataset scopedDS( _pool.get(), _srcDS, _warpedDS );
+        GDALDataset* warpedDS = scopedDS.get();
 
         int tileSize = _options.tileSize().value();
 
@@ -1852,8 +2333,8 @@ public:
             geoToPixel( intersection.xMin(), intersection.yMax(), src_min_x, src_min_y);
             geoToPixel( intersection.xMax(), intersection.yMin(), src_max_x, src_max_y);
 
-            int rasterWidth = _warpedDS->GetRasterXSize();
-            int rasterHeight = _warpedDS->GetRasterYSize();
+            int rasterWidth = warpedDS->GetRasterXSize();
+            int rasterHeight = warpedDS->GetRasterYSize();
 
             // Convert the doubles to integers.  We floor the mins and ceil the maximums to give the widest window possible.
             src_min_x = osg::round(src_min_x);
@@ -2016,11 +2497,11 @@ public:
             OE_DEBUG << LC << "Read extents " << read_min_x << ", " << read_min_y << " to " << read_max_x << ", " << read_max_y << std::endl;
 
             // Try to find a FLOAT band
-            GDALRasterBand* band = findBandByDataType(_warpedDS, GDT_Float32);
+            GDALRasterBand* band = findBandByDataType(warpedDS, GDT_Float32);
             if (band == NULL)
             {
                 // Just get first band
-                band = _warpedDS->GetRasterBand(1);
+                band = warpedDS->GetRasterBand(1);
             }
 
             float *heights = new float[target_width * target_height];
@@ -2028,7 +2509,7 @@ public:
             {
                 heights[i] = NO_DATA_VALUE;
             }
-            band->RasterIO(GF_Read, src_min_x, src_min_y, width, height, heights, target_width, target_height, GDT_Float32, 0, 0);
+            readWindow(band, src_min_x, src_min_y, width, height, heights, target_width, target_height, GDT_Float32, INTERP_NEAREST);
 
             // Now create a GeoHeightField that we can sample from.  This heightfield only contains the portion that was actually read from the dataset
             osg::ref_ptr< osg::HeightField > readHF = new osg::HeightField();
@@ -2093,6 +2574,7 @@ private:
 
     GDALDataset* _srcDS;
     GDALDataset* _warpedDS;
+    osg::ref_ptr<GDALDatasetPool> _pool;
     double       _geotransform[6];
     double       _invtransform[6];
 
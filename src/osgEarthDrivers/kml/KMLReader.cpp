@@ -24,12 +24,86 @@
 #include <osgEarth/XmlUtils>
 #include <osgEarth/VirtualProgram>
 #include <osgEarth/Decluttering>
+#include <osgEarth/TaskService>
 #include <stack>
 #include <iterator>
 
 using namespace osgEarth_kml;
 using namespace osgEarth;
 
+namespace
+{
+    Threading::Mutex          s_progressiveServiceMutex;
+    osg::ref_ptr<TaskService> s_progressiveService;
+
+    TaskService* getProgressiveService()
+    {
+        Threading::ScopedMutexLock lock( s_progressiveServiceMutex );
+        if ( !s_progressiveService.valid() )
+        {
+            s_progressiveService = new TaskService( "KML Progressive", 1 );
+            Registry::instance()->registerTaskService( s_progressiveService.get() );
+        }
+        return s_progressiveService.get();
+    }
+
+    // Parses and builds a KML document off the calling thread. The document
+    // text and the options are private copies, since the caller's go away.
+    struct ProgressiveBuildTask : public TaskRequest
+    {
+        void operator()( ProgressCallback* progress )
+        {
+            osg::ref_ptr<osg::Group> root;
+            osg::ref_ptr<MapNode>    mapNode;
+            if ( _root.lock(root) && _mapNode.lock(mapNode) )
+            {
+                try
+                {
+                    xml_document<> doc;
+                    doc.parse<0>( &_xmlStr[0] );
+
+                    KMLReader reader( mapNode.get(), &_options );
+                    reader.build( doc, _dbOptions.get(), root.get(), _queue.get() );
+                }
+                catch( const rapidxml::parse_error& e )
+                {
+                    OE_WARN << LC << "Failed to parse " << root->getName() << ": " << e.what() << std::endl;
+                }
+            }
+
+            _queue->setDone();
+        }
+
+        std::string                        _xmlStr;
+        KMLOptions                         _options;
+        osg::ref_ptr<const osgDB::Options> _dbOptions;
+        osg::observer_ptr<osg::Group>      _root;
+        osg::observer_ptr<MapNode>         _mapNode;
+        osg::ref_ptr<KMLAttachQueue>       _queue;
+    };
+
+    // Moves the results of a progressive build into the scene graph, and
+    // removes itself once the build is done.
+    struct ApplyAttachQueueCallback : public osg::NodeCallback
+    {
+        ApplyAttachQueueCallback( KMLAttachQueue* queue ) : _queue(queue) { }
+
+        void operator()( osg::Node* node, osg::NodeVisitor* nv )
+        {
+            osg::ref_ptr<osg::NodeCallback> hold = this;
+
+            bool done = _queue->isDone();
+            _queue->apply();
+            if ( done )
+                node->setUpdateCallback( 0L );
+
+            traverse( node, nv );
+        }
+
+        osg::ref_ptr<KMLAttachQueue> _queue;
+    };
+}
+
 
 KMLReader::KMLReader( MapNode* mapNode, const KMLOptions* options ) :
 _mapNode( mapNode ),
@@ -44,12 +118,17 @@ KMLReader::read( std::istream& in, const osgDB::Options* dbOptions )
     // pull the URI context out of the DB options:
     URIContext context(dbOptions);
 
-	// Load the XML
+	// Load the XML, straight from the stream into the string rapidxml parses in place.
     osg::Timer_t start = osg::Timer::instance()->tick();
-	std::stringstream buffer;
-    buffer << in.rdbuf();
-    std::string xmlStr;
-    xmlStr = buffer.str();
+    std::string xmlStr( (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>() );
+
+    if ( _options && _options->progressive() == true )
+    {
+        osg::Node* node = readProgressive( xmlStr, dbOptions );
+        node->setName( context.referrer() );
+        return node;
+    }
+
 	xml_document<> doc;
 	doc.parse<0>(&xmlStr[0]);
     osg::Timer_t end = osg::Timer::instance()->tick();
@@ -64,6 +143,34 @@ KMLReader::read( std::istream& in, const osgDB::Options* dbOptions )
 	return node;
 }
 
+osg::Node*
+KMLReader::readProgressive( std::string& xmlStr, const osgDB::Options* dbOptions )
+{
+    osg::Group* root = new osg::Group();
+
+    if ( _options->iconAndLabelGroup().valid() && _options->declutter() == true )
+    {
+        Decluttering::setEnabled( _options->iconAndLabelGroup()->getOrCreateStateSet(), true );
+    }
+
+    // Make sure the KML gets rendered after the terrain.
+    root->getOrCreateStateSet()->setRenderBinDetails(2, "RenderBin");
+
+    ProgressiveBuildTask* task = new ProgressiveBuildTask();
+    task->_xmlStr.swap( xmlStr );
+    task->_options   = *_options;
+    task->_dbOptions = dbOptions;
+    task->_root      = root;
+    task->_mapNode   = _mapNode;
+    task->_queue     = new KMLAttachQueue();
+
+    root->setUpdateCallback( new ApplyAttachQueueCallback(task->_queue.get()) );
+
+    getProgressiveService()->add( task );
+
+    return root;
+}
+
 osg::Node*
 KMLReader::read( xml_document<>& doc, const osgDB::Options* dbOptions )
 {
@@ -74,6 +181,19 @@ KMLReader::read( xml_document<>& doc, const osgDB::Options* dbOptions )
 
 	root->setName( context.referrer() );
 
+    build( doc, dbOptions, root, 0L );
+
+    // Make sure the KML gets rendered after the terrain.
+    root->getOrCreateStateSet()->setRenderBinDetails(2, "RenderBin");
+
+    return root;
+}
+
+void
+KMLReader::build( xml_document<>& doc, const osgDB::Options* dbOptions, osg::Group* root, KMLAttachQueue* queue )
+{
+    URIContext context(dbOptions);
+
     KMLContext cx;
     cx._mapNode   = _mapNode;
     cx._sheet     = new StyleSheet();
@@ -83,6 +203,7 @@ KMLReader::read( xml_document<>& doc, const osgDB::Options* dbOptions )
     cx._srs = _mapNode->getMapSRS()->getGeographicSRS();
     cx._referrer = context.referrer();
     cx._groupStack.push( root );
+    cx._attachQueue = queue;
 
 
     // clone the dbOptions, and install a resource cache if there isn't one already:
@@ -103,7 +224,7 @@ KMLReader::read( xml_document<>& doc, const osgDB::Options* dbOptions )
     if ( cx._options == 0L )
         cx._options = &blankOptions;
 
-    if ( cx._options->iconAndLabelGroup().valid() && cx._options->declutter() == true )
+    if ( !queue && cx._options->iconAndLabelGroup().valid() && cx._options->declutter() == true )
     {
         Decluttering::setEnabled( cx._options->iconAndLabelGroup()->getOrCreateStateSet(), true );
     }
@@ -134,9 +255,4 @@ KMLReader::read( xml_document<>& doc, const osgDB::Options* dbOptions )
     URIResultCache* cacheUsed = URIResultCache::from(cx._dbOptions.get());
     CacheStats stats = cacheUsed->getStats();
     OE_INFO << LC << "URI Cache: " << stats._queries << " reads, " << (stats._hitRatio*100.0) << "% hits" << std::endl;
-
-    // Make sure the KML gets rendered after the terrain.
-    root->getOrCreateStateSet()->setRenderBinDetails(2, "RenderBin");
-
-    return root;
 }
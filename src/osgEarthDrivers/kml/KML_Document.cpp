@@ -48,11 +48,12 @@ KML_Document::build( xml_node<>* node, KMLContext& cx )
 {
     // creates an empty group and pushes it on the stack.
     osg::Group* group = new osg::Group();
-    cx._groupStack.top()->addChild( group );
+    KML_Container::build(node, cx, group);
+
+    cx.attach( group );
     cx._groupStack.push( group );
 
-    KML_Container::build(node, cx, group);
-    for_features(build, node, cx);
+    build_features(node, cx);
 
     cx._groupStack.pop();
 }
@@ -67,7 +67,6 @@ KML_GroundOverlay::build( xml_node<>* node, KMLContext& cx )
 
         im = new ImageOverlay( cx._mapNode, image.get() );
         im->setBoundsAndRotation( Bounds(west, south, east, north), rotation );
-        cx._groupStack.top()->addChild( im );
     }
 
     else if ( llq )
@@ -91,7 +90,6 @@ KML_GroundOverlay::build( xml_node<>* node, KMLContext& cx )
                 osg::Vec2d( p[1].x(), p[1].y() ),
                 osg::Vec2d( p[3].x(), p[3].y() ),
                 osg::Vec2d( p[2].x(), p[2].y() ) );
-            cx._groupStack.top()->addChild( im );
         }
     }
 
@@ -103,4 +101,8 @@ KML_GroundOverlay::build( xml_node<>* node, KMLContext& cx )
 
     // superclass build always called last
     KML_Overlay::build( node, cx, im );
+
+    // attach once fully built, since a progressive build hands it to the live graph.
+    if ( im )
+        cx.attach( im );
 }
@@ -28,6 +28,39 @@
 
 using namespace osgEarth_kml;
 
+namespace
+{
+    // Drops the children of a ProxyNode every so often, so the database pager
+    // fetches the link again (KML refreshMode "onInterval").
+    struct RefreshOnIntervalCallback : public osg::NodeCallback
+    {
+        RefreshOnIntervalCallback( double interval ) : _interval(interval), _lastRefresh(-1.0) { }
+
+        void operator()( osg::Node* node, osg::NodeVisitor* nv )
+        {
+            const osg::FrameStamp* fs = nv->getFrameStamp();
+            osg::Group* group = node->asGroup();
+            if ( fs && group )
+            {
+                double now = fs->getReferenceTime();
+                if ( _lastRefresh < 0.0 || group->getNumChildren() == 0 )
+                {
+                    _lastRefresh = now;
+                }
+                else if ( now - _lastRefresh >= _interval )
+                {
+                    group->removeChildren( 0, group->getNumChildren() );
+                    _lastRefresh = now;
+                }
+            }
+            traverse( node, nv );
+        }
+
+        double _interval;
+        double _lastRefresh;
+    };
+}
+
 void
 KML_NetworkLink::build( xml_node<>* node, KMLContext& cx )
 {
@@ -41,6 +74,21 @@ KML_NetworkLink::build( xml_node<>* node, KMLContext& cx )
     // "open" determines whether to load it immediately
     bool open = as<bool>(getValue(node, "open"), false);
 
+    // refresh modes. Region-bound links page in and out by view (viewRefreshMode
+    // "onRegion"); the others load once, or reload on an interval.
+    xml_node<>* link = node->first_node("link", 0, false);
+    if ( !link )
+        link = node->first_node("url", 0, false);
+    std::string refreshMode     = link ? getValue(link, "refreshmode") : "";
+    double      refreshInterval = link ? as<double>(getValue(link, "refreshinterval"), 4.0) : 4.0;
+    std::string viewRefreshMode = link ? getValue(link, "viewrefreshmode") : "";
+
+    if ( viewRefreshMode == "onStop" || viewRefreshMode == "onRequest" )
+    {
+        OE_DEBUG << LC << "viewRefreshMode \"" << viewRefreshMode << "\" is not supported; loading \""
+            << href << "\" once" << std::endl;
+    }
+
     // if it's region-bound, parse it as a paged LOD:
     xml_node<>* region = node->first_node("region", 0, false);
     if ( region )
@@ -100,7 +148,7 @@ KML_NetworkLink::build( xml_node<>* node, KMLContext& cx )
         OE_DEBUG << LC << 
             "PLOD: radius = " << d << ", minRange=" << minRange << ", maxRange=" << maxRange << std::endl;
 
-        cx._groupStack.top()->addChild( plod );
+        cx.attach( plod );
     }
 
     else 
@@ -112,7 +160,12 @@ KML_NetworkLink::build( xml_node<>* node, KMLContext& cx )
         options->setPluginData( "osgEarth::MapNode", cx._mapNode );
         proxy->setDatabaseOptions( options );
 
-        cx._groupStack.top()->addChild( proxy );
+        if ( refreshMode == "onInterval" && refreshInterval > 0.0 )
+        {
+            proxy->setUpdateCallback( new RefreshOnIntervalCallback(refreshInterval) );
+        }
+
+        cx.attach( proxy );
     }
 
 }
@@ -29,6 +29,8 @@
 
 #include <osg/Depth>
 #include <osgDB/WriteFile>
+#include <osgEarth/Registry>
+#include <osgEarth/TaskService>
 
 using namespace osgEarth_kml;
 using namespace osgEarth::Features;
@@ -52,10 +54,11 @@ KML_Placemark::build( xml_node<>* node, KMLContext& cx )
 
 	xml_node<>* style = node->first_node("style", 0, false);
 	if ( style )
-	{	// process an "inline" style
-		KML_Style kmlStyle;
-		kmlStyle.scan(style, cx);
-		masterStyle = masterStyle.combineWith(cx._activeStyle);
+	{	// process an "inline" style. The scan pass already added it to the
+		// style sheet, so just parse it here (the sheet is shared by parallel builds).
+		Style inlineStyle( getValue(style, "id") );
+		KML_Style::parse(style, inlineStyle, cx);
+		masterStyle = masterStyle.combineWith(inlineStyle);
 	}
 
     // parse the geometry. the placemark must have geometry to be valid. The 
@@ -95,8 +98,14 @@ KML_Placemark::build( xml_node<>* node, KMLContext& cx )
                 IconSymbol*     icon  = style.get<IconSymbol>();
                 TextSymbol*     text  = style.get<TextSymbol>();
 
+                // take a private copy of the default text symbol, since we set its
+                // content below and placemarks may be building in parallel.
+                osg::ref_ptr<TextSymbol> defaultText;
                 if ( !text && cx._options->defaultTextSymbol().valid() )
-                    text = cx._options->defaultTextSymbol().get();
+                {
+                    defaultText = new TextSymbol( *cx._options->defaultTextSymbol().get() );
+                    text = defaultText.get();
+                }
 
                 // the annotation name:
                 std::string name = getValue(node, "name");
@@ -191,8 +200,6 @@ KML_Placemark::build( xml_node<>* node, KMLContext& cx )
                     if ( modelNode )
                         group->addChild( modelNode );
 
-                    cx._groupStack.top()->addChild( group );
-
                     if ( iconNode && cx._options->declutter() == true )
                     {
                         Decluttering::setEnabled( iconNode->getOrCreateStateSet(), true );
@@ -204,38 +211,133 @@ KML_Placemark::build( xml_node<>* node, KMLContext& cx )
                         KML_Feature::build( node, cx, modelNode );
                     if ( featureNode )
                         KML_Feature::build( node, cx, featureNode );
+
+                    cx.attach( group );
                 }
 
                 else
                 {
                     if ( iconNode )
                     {
-                        if ( cx._options->iconAndLabelGroup().valid() )
-                        {
-                            cx._options->iconAndLabelGroup()->addChild( iconNode );
-                        }
-                        else
+                        osg::Group* iconAndLabelGroup = cx._options->iconAndLabelGroup().get();
+                        if ( !iconAndLabelGroup && cx._options->declutter() == true )
                         {
-                            cx._groupStack.top()->addChild( iconNode );
-                            if ( cx._options->declutter() == true )
-                            {
-                                Decluttering::setEnabled( iconNode->getOrCreateStateSet(), true );
-                            }
+                            Decluttering::setEnabled( iconNode->getOrCreateStateSet(), true );
                         }
                         KML_Feature::build( node, cx, iconNode );
+
+                        if ( iconAndLabelGroup )
+                            cx.attach( iconAndLabelGroup, iconNode );
+                        else
+                            cx.attach( iconNode );
                     }
                     if ( modelNode )
                     {
-                        cx._groupStack.top()->addChild( modelNode );
                         KML_Feature::build( node, cx, modelNode );
+                        cx.attach( modelNode );
                     }
                     if ( featureNode )
                     {
-                        cx._groupStack.top()->addChild( featureNode );
                         KML_Feature::build( node, cx, featureNode );
+                        cx.attach( featureNode );
                     }
                 }
             }
         }
     }
 }
+
+namespace
+{
+    Threading::Mutex          s_buildServiceMutex;
+    osg::ref_ptr<TaskService> s_buildService;
+
+    TaskService* getBuildService( unsigned numThreads )
+    {
+        Threading::ScopedMutexLock lock( s_buildServiceMutex );
+        if ( !s_buildService.valid() )
+        {
+            s_buildService = new TaskService( "KML Build", numThreads );
+            Registry::instance()->registerTaskService( s_buildService.get() );
+        }
+        return s_buildService.get();
+    }
+
+    // Builds a run of placemarks against a private copy of the context. The
+    // results are queued and attached by the calling thread once all the
+    // batches finish, so the output keeps the document order.
+    struct BuildPlacemarks
+    {
+        void execute()
+        {
+            for( std::vector<xml_node<>*>::const_iterator i = _nodes.begin(); i != _nodes.end(); ++i )
+            {
+                KML_Placemark instance;
+                instance.build( *i, _cx );
+            }
+        }
+
+        std::vector<xml_node<>*> _nodes;
+        KMLContext               _cx;
+    };
+}
+
+void
+KML_Placemark::buildAll( xml_node<>* parent, KMLContext& cx )
+{
+    if ( !parent )
+        return;
+
+    std::vector<xml_node<>*> nodes;
+    for( xml_node<>* n = parent->first_node("Placemark", 0, false); n; n = n->next_sibling("Placemark", 0, false) )
+        nodes.push_back( n );
+
+    unsigned batchSize = osg::maximum( *cx._options->buildBatchSize(), 1u );
+
+    unsigned numThreads = *cx._options->numBuildThreads();
+    if ( numThreads == 0 )
+        numThreads = osg::clampBetween( OpenThreads::GetNumberOfProcessors(), 1, 16 );
+
+    // small runs aren't worth the overhead.
+    if ( nodes.size() <= batchSize || numThreads < 2 )
+    {
+        for( std::vector<xml_node<>*>::const_iterator i = nodes.begin(); i != nodes.end(); ++i )
+        {
+            KML_Placemark instance;
+            instance.build( *i, cx );
+        }
+        return;
+    }
+
+    unsigned numBatches = (nodes.size() + batchSize - 1) / batchSize;
+
+    OE_DEBUG << LC << "Building " << nodes.size() << " placemarks in "
+        << numBatches << " batches" << std::endl;
+
+    TaskService* service = getBuildService( numThreads );
+
+    Threading::MultiEvent semaphore( (int)numBatches );
+    std::vector< osg::ref_ptr< ParallelTask<BuildPlacemarks> > > tasks;
+    tasks.reserve( numBatches );
+
+    for( unsigned b = 0; b < numBatches; ++b )
+    {
+        ParallelTask<BuildPlacemarks>* task = new ParallelTask<BuildPlacemarks>( &semaphore );
+        task->_nodes.assign(
+            nodes.begin() + b*batchSize,
+            nodes.begin() + osg::minimum( (unsigned)nodes.size(), (b+1)*batchSize ) );
+        task->_cx = cx;
+        task->_cx._attachQueue = new KMLAttachQueue();
+        tasks.push_back( task );
+        service->add( task );
+    }
+
+    semaphore.wait();
+
+    // attach the results in document order (forwarding them if this is
+    // itself a progressive build).
+    for( unsigned b = 0; b < numBatches; ++b )
+    {
+        tasks[b]->_cx._attachQueue->apply( cx._attachQueue.get() );
+    }
+}
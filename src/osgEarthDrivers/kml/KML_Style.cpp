@@ -28,7 +28,16 @@ void
 KML_Style::scan( xml_node<>* node, KMLContext& cx )
 {
     Style style( getValue(node, "id") );
+    parse( node, style, cx );
 
+    cx._sheet->addStyle( style );
+
+    cx._activeStyle = style;
+}
+
+void
+KML_Style::parse( xml_node<>* node, Style& style, KMLContext& cx )
+{
     KML_IconStyle icon;
     icon.scan( node->first_node("iconstyle", 0, false), style, cx );
 
@@ -40,8 +49,4 @@ KML_Style::scan( xml_node<>* node, KMLContext& cx )
 
     KML_PolyStyle poly;
     poly.scan( node->first_node("polystyle", 0, false), style, cx );
-
-    cx._sheet->addStyle( style );
-
-    cx._activeStyle = style;
 }
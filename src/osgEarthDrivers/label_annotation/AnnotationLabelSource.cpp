@@ -65,7 +65,16 @@ public:
         NumericExpression iconScaleExpr   ( icon ? *icon->scale()    : NumericExpression() );
         NumericExpression iconHeadingExpr ( icon ? *icon->heading()  : NumericExpression() );
 
-        for( FeatureList::const_iterator i = input.begin(); i != input.end(); ++i )
+        // evaluate the label text for all features at once, unless a symbol
+        // script might change the attributes along the way.
+        std::vector<std::string> textContents;
+        if ( text && text->content().isSet() && !text->script().isSet() && !(icon && icon->script().isSet()) )
+        {
+            Feature::evalBatch( textContentExpr, input, textContents, &context );
+        }
+
+        unsigned featureIndex = 0;
+        for( FeatureList::const_iterator i = input.begin(); i != input.end(); ++i, ++featureIndex )
         {
             const Feature* feature = i->get();
             if ( !feature )
@@ -98,7 +107,8 @@ public:
             if ( text )
             {
                 if ( text->content().isSet() )
-                    tempStyle.get<TextSymbol>()->content()->setLiteral( feature->eval( textContentExpr, &context ) );
+                    tempStyle.get<TextSymbol>()->content()->setLiteral( !textContents.empty() ?
+                        textContents[featureIndex] : feature->eval( textContentExpr, &context ) );
 
                 if ( text->size().isSet() )
                     tempStyle.get<TextSymbol>()->size()->setLiteral( feature->eval(textSizeExpr, &context) );
@@ -21,11 +21,14 @@
 
 #include <osgEarth/Registry>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/Progress>
 #include <osgDB/FileUtils>
 
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
+#include <map>
+#include <set>
 
 #include <sqlite3.h>
 
@@ -50,6 +53,32 @@ namespace
         }
         return rw;
     }
+
+    // 'GPKG' and version 1.2, per the GeoPackage spec.
+    const int GPKG_APPLICATION_ID = 0x47504B47;
+    const int GPKG_USER_VERSION   = 10200;
+
+    // srs_id under which a profile's SRS is registered in a GeoPackage.
+    int getGeoPackageSRSID(const SpatialReference* srs)
+    {
+        if ( srs->isSphericalMercator() )
+            return 3857;
+        if ( srs->isGeographic() && srs->isHorizEquivalentTo(SpatialReference::get("wgs84")) )
+            return 4326;
+        return 100000;
+    }
+
+    bool exec(sqlite3* db, const std::string& query)
+    {
+        char* errorMsg = 0L;
+        if ( SQLITE_OK != sqlite3_exec(db, query.c_str(), 0L, 0L, &errorMsg) )
+        {
+            OE_WARN << LC << "Failed query: " << query << "; " << (errorMsg ? errorMsg : "") << std::endl;
+            sqlite3_free( errorMsg );
+            return false;
+        }
+        return true;
+    }
 }
 
 //......................................................................
@@ -60,11 +89,27 @@ _options  ( options ),
 _database ( NULL ),
 _minLevel ( 0 ),
 _maxLevel ( 20 ),
-_forceRGB ( false )
+_forceRGB ( false ),
+_geopackage( false ),
+_tableName( "tiles" )
 {
     //nop
 }
 
+MBTilesTileSource::~MBTilesTileSource()
+{
+    for( unsigned i=0; i<_connections.size(); ++i )
+    {
+        closeConnection( *_connections[i], true );
+        delete _connections[i];
+    }
+
+    closeConnection( _main, false );
+
+    if ( _database )
+        sqlite3_close( _database );
+}
+
 TileSource::Status
 MBTilesTileSource::initialize(const osgDB::Options* dbOptions)
 {    
@@ -75,6 +120,16 @@ MBTilesTileSource::initialize(const osgDB::Options* dbOptions)
     std::string fullFilename = _options.filename()->full();   
     bool isNewDatabase = readWrite && !osgDB::fileExists(fullFilename);
 
+    _geopackage = _options.geopackage().isSet() ?
+        _options.geopackage().value() :
+        osgEarth::endsWith(fullFilename, ".gpkg", false);
+
+    if ( _geopackage )
+    {
+        _tableName = _options.table().value();
+        OE_INFO << LC << "Using GeoPackage tile table \"" << _tableName << "\"" << std::endl;
+    }
+
     if ( isNewDatabase )
     {
         // For a NEW database, the profile MUST be set prior to initialization.
@@ -109,6 +164,11 @@ MBTilesTileSource::initialize(const osgDB::Options* dbOptions)
         return Status::Error( Stringify()
             << "Database \"" << fullFilename << "\": " << sqlite3_errmsg(_database) );
     }
+
+    _main._db = _database;
+
+    if ( !readWrite )
+        setMemoryMap( _database );
     
     // New database setup:
     if ( isNewDatabase )
@@ -116,6 +176,9 @@ MBTilesTileSource::initialize(const osgDB::Options* dbOptions)
         // create necessary db tables:
         createTables();
 
+        if ( _geopackage && !createGeoPackageTables() )
+            return Status::Error("Failed to create the GeoPackage tables");
+
         // write profile to metadata:
         std::string profileJSON = getProfile()->toProfileOptions().getConfig().toJSON(false);
         putMetaData("profile", profileJSON);
@@ -123,8 +186,12 @@ MBTilesTileSource::initialize(const osgDB::Options* dbOptions)
         // write format to metadata:
         putMetaData("format", _tileFormat);
 
-        // compression?
-        if ( _options.compress().isSetTo(true) )
+        // compression? (GeoPackage tile data must be plain PNG or JPEG.)
+        if ( _options.compress().isSetTo(true) && _geopackage )
+        {
+            OE_WARN << LC << "Compression is not supported in a GeoPackage; ignoring" << std::endl;
+        }
+        else if ( _options.compress().isSetTo(true) )
         {
             _compressor = osgDB::Registry::instance()->getObjectWrapperManager()->findCompressor("zlib");
             if ( _compressor.valid() )
@@ -157,6 +224,12 @@ MBTilesTileSource::initialize(const osgDB::Options* dbOptions)
             }
         }
 
+        // A GeoPackage from elsewhere won't have our metadata; look at the data.
+        if ( _tileFormat.empty() && _geopackage )
+        {
+            _tileFormat = readTileFormat();
+        }
+
         // By this point, we require a valid tile format.
         if ( _tileFormat.empty() )
             return Status::Error("Required format not in metadata, nor specified in the options.");
@@ -221,6 +294,15 @@ MBTilesTileSource::initialize(const osgDB::Options* dbOptions)
                     return Status::Error( Stringify() << "Profile not recognized: " << profileStr );
                 }
             }
+            else if ( _geopackage )
+            {
+                profile = readGeoPackageProfile();
+                if ( !profile )
+                {
+                    return Status::Error( "No tile matrix set found for table \"" + _tableName + "\"" );
+                }
+                profileStr = profile->toString();
+            }
             else
             {
                 // Spherical mercator is the MBTiles default.
@@ -235,6 +317,11 @@ MBTilesTileSource::initialize(const osgDB::Options* dbOptions)
         {
             computeLevels();
         }
+
+        if ( _options.indexTiles() == true && !readWrite && !getTileIndex() )
+        {
+            computeTileIndex();
+        }
     }
 
     // do we require RGB? for jpeg?
@@ -267,8 +354,6 @@ osg::Image*
 MBTilesTileSource::createImage(const TileKey&    key,
                                ProgressCallback* progress)
 {
-    Threading::ScopedMutexLock exclusiveLock(_mutex);
-
     int z = key.getLevelOfDetail();
     int x = key.getTileX();
     int y = key.getTileY();
@@ -284,83 +369,168 @@ MBTilesTileSource::createImage(const TileKey&    key,
         return NULL;
     }
 
-    unsigned int numRows, numCols;
-    key.getProfile()->getNumTiles(key.getLevelOfDetail(), numCols, numRows);
-    y  = numRows - y - 1;
-
-    //Get the image
-    sqlite3_stmt* select = NULL;
-    std::string query = "SELECT tile_data from tiles where zoom_level = ? AND tile_column = ? AND tile_row = ?";
-    int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &select, 0L );
-    if ( rc != SQLITE_OK )
+    if ( isFlippedY() )
     {
-        OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
-        return NULL;
+        unsigned int numRows, numCols;
+        key.getProfile()->getNumTiles(key.getLevelOfDetail(), numCols, numRows);
+        y  = numRows - y - 1;
     }
 
-    bool valid = true;        
+    ScopedConnection conn( this );
+
+    //Get the image
+    std::string query = "SELECT tile_data from " + tilesTable() + " where zoom_level = ? AND tile_column = ? AND tile_row = ?";
+    sqlite3_stmt* select = prepare( conn->_db, conn->_selectTile, query );
+    if ( !select )
+        return NULL;
 
     sqlite3_bind_int( select, 1, z );
     sqlite3_bind_int( select, 2, x );
     sqlite3_bind_int( select, 3, y );
 
     osg::Image* result = NULL;
-    rc = sqlite3_step( select );
+    int rc = sqlite3_step( select );
     if ( rc == SQLITE_ROW)
     {                     
         // the pointer returned from _blob gets freed internally by sqlite, supposedly
         const char* data = (const char*)sqlite3_column_blob( select, 0 );
         int dataLen = sqlite3_column_bytes( select, 0 );
 
-        std::string dataBuffer( data, dataLen );
+        result = decodeTileData( data, dataLen );
+    }
+    else
+    {
+        OE_DEBUG << LC << "SQL QUERY failed for " << query << ": " << std::endl;
+    }
+
+    sqlite3_reset( select );
+    return result;
+}
 
-        // decompress if necessary:
-        if ( _compressor.valid() )
+void
+MBTilesTileSource::createImages(const std::vector<TileKey>&              keys,
+                                std::vector< osg::ref_ptr<osg::Image> >& output,
+                                ProgressCallback*                        progress)
+{
+    output.assign( keys.size(), 0L );
+
+    // group the requests by level so that each level costs a single query.
+    typedef std::pair<int, int>                      ColRow;
+    typedef std::map<ColRow, std::vector<unsigned> > ColRowIndices;
+    std::map<int, ColRowIndices> levels;
+
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        const TileKey& key = keys[i];
+        int z = key.getLevelOfDetail();
+
+        if (z < (int)_minLevel)
         {
-            std::istringstream inputStream(dataBuffer);
-            std::string value;
-            if ( !_compressor->decompress(inputStream, value) )
-            {
-                OE_WARN << LC << "Decompression failed" << std::endl;
-                valid = false;
-            }
-            else
-            {
-                dataBuffer = value;
-            }
+            output[i] = _emptyImage.get();
         }
-
-        // decode the raw image data:
-        if ( valid )
+        else if (z <= (int)_maxLevel)
         {
-            std::istringstream inputStream(dataBuffer);
-            osgDB::ReaderWriter::ReadResult rr = _rw->readImage( inputStream );
-            if (rr.validImage())
+            int y = key.getTileY();
+            if ( isFlippedY() )
             {
-                result = rr.takeImage();                
+                unsigned int numRows, numCols;
+                key.getProfile()->getNumTiles(key.getLevelOfDetail(), numCols, numRows);
+                y = numRows - y - 1;
             }
+            levels[z][ColRow(key.getTileX(), y)].push_back( i );
         }
     }
-    else
+
+    ScopedConnection conn( this );
+
+    for( std::map<int, ColRowIndices>::const_iterator level = levels.begin(); level != levels.end(); ++level )
     {
-        OE_DEBUG << LC << "SQL QUERY failed for " << query << ": " << std::endl;
-        valid = false;
-    }
+        const ColRowIndices& tiles = level->second;
 
-    sqlite3_finalize( select );
-    return result;
+        std::set<int> cols, rows;
+        for( ColRowIndices::const_iterator t = tiles.begin(); t != tiles.end(); ++t )
+        {
+            cols.insert( t->first.first );
+            rows.insert( t->first.second );
+        }
+
+        // The IN lists may select a few extra tiles (the cross product of the
+        // columns and rows); those rows are simply ignored below.
+        std::stringstream buf;
+        buf << "SELECT tile_column, tile_row, tile_data from " << tilesTable() << " where zoom_level = ? AND tile_column IN (";
+        for( unsigned c=0; c<cols.size(); ++c )
+            buf << (c > 0 ? ",?" : "?");
+        buf << ") AND tile_row IN (";
+        for( unsigned r=0; r<rows.size(); ++r )
+            buf << (r > 0 ? ",?" : "?");
+        buf << ")";
+        std::string query = buf.str();
+
+        sqlite3_stmt* select = NULL;
+        int rc = sqlite3_prepare_v2( conn->_db, query.c_str(), -1, &select, 0L );
+        if ( rc != SQLITE_OK )
+        {
+            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(conn->_db) << std::endl;
+            continue;
+        }
+
+        int param = 1;
+        sqlite3_bind_int( select, param++, level->first );
+        for( std::set<int>::const_iterator c = cols.begin(); c != cols.end(); ++c )
+            sqlite3_bind_int( select, param++, *c );
+        for( std::set<int>::const_iterator r = rows.begin(); r != rows.end(); ++r )
+            sqlite3_bind_int( select, param++, *r );
+
+        while( sqlite3_step(select) == SQLITE_ROW )
+        {
+            ColRow colRow( sqlite3_column_int(select, 0), sqlite3_column_int(select, 1) );
+            ColRowIndices::const_iterator t = tiles.find( colRow );
+            if ( t == tiles.end() )
+                continue;
+
+            const char* data = (const char*)sqlite3_column_blob( select, 2 );
+            int dataLen = sqlite3_column_bytes( select, 2 );
+
+            osg::ref_ptr<osg::Image> image = decodeTileData( data, dataLen );
+            for( std::vector<unsigned>::const_iterator i = t->second.begin(); i != t->second.end(); ++i )
+                output[*i] = image.get();
+        }
+
+        sqlite3_finalize( select );
+    }
 }
 
-bool 
-MBTilesTileSource::storeImage(const TileKey&    key,
-                              osg::Image*       image,
-                              ProgressCallback* progress)
+osg::Image*
+MBTilesTileSource::decodeTileData(const char* data, int dataLen)
 {
-    if ( (getMode() & MODE_WRITE) == 0 )
-        return false;
+    std::string dataBuffer( data, dataLen );
 
-    Threading::ScopedMutexLock exclusiveLock(_mutex);
+    // decompress if necessary:
+    if ( _compressor.valid() )
+    {
+        std::istringstream inputStream(dataBuffer);
+        std::string value;
+        if ( !_compressor->decompress(inputStream, value) )
+        {
+            OE_WARN << LC << "Decompression failed" << std::endl;
+            return NULL;
+        }
+        dataBuffer = value;
+    }
+
+    // decode the raw image data:
+    std::istringstream inputStream(dataBuffer);
+    osgDB::ReaderWriter::ReadResult rr = _rw->readImage( inputStream );
+    if (rr.validImage())
+    {
+        return rr.takeImage();
+    }
+    return NULL;
+}
 
+bool
+MBTilesTileSource::encodeTileData(osg::Image* image, std::string& value)
+{
     // encode the data stream:
     std::stringstream buf;
     osgDB::ReaderWriter::WriteResult wr;
@@ -380,7 +550,7 @@ MBTilesTileSource::storeImage(const TileKey&    key,
         return false;
     }
 
-    std::string value = buf.str();
+    value = buf.str();
     
     // compress if necessary:
     if ( _compressor.valid() )
@@ -394,23 +564,24 @@ MBTilesTileSource::storeImage(const TileKey&    key,
         value = output.str();
     }
 
+    return true;
+}
+
+bool
+MBTilesTileSource::insertTile(sqlite3_stmt*      insert,
+                              const TileKey&     key,
+                              const std::string& value)
+{
     int z = key.getLOD();
     int x = key.getTileX();
     int y = key.getTileY();
 
     // flip Y axis
-    unsigned int numRows, numCols;
-    key.getProfile()->getNumTiles(key.getLevelOfDetail(), numCols, numRows);
-    y  = numRows - y - 1;
-
-    // Prep the insert statement:
-    sqlite3_stmt* insert = NULL;
-    std::string query = "INSERT OR REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data) VALUES (?, ?, ?, ?)";
-    int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &insert, 0L );
-    if ( rc != SQLITE_OK )
+    if ( isFlippedY() )
     {
-        OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
-        return NULL;
+        unsigned int numRows, numCols;
+        key.getProfile()->getNumTiles(key.getLevelOfDetail(), numCols, numRows);
+        y  = numRows - y - 1;
     }
 
     // bind parameters:
@@ -423,6 +594,7 @@ MBTilesTileSource::storeImage(const TileKey&    key,
 
     // run the sql.
     bool ok = true;
+    int rc;
     int tries = 0;
     do {
         rc = sqlite3_step(insert);
@@ -432,18 +604,219 @@ MBTilesTileSource::storeImage(const TileKey&    key,
     if (SQLITE_OK != rc && SQLITE_DONE != rc)
     {
 #if SQLITE_VERSION_NUMBER >= 3007015
-        OE_WARN << LC << "Failed query: " << query << "(" << rc << ")" << sqlite3_errstr(rc) << "; " << sqlite3_errmsg(_database) << std::endl;
+        OE_WARN << LC << "Failed query: " << sqlite3_sql(insert) << "(" << rc << ")" << sqlite3_errstr(rc) << "; " << sqlite3_errmsg(_database) << std::endl;
 #else
-        OE_WARN << LC << "Failed query: " << query << "(" << rc << ")" << rc << "; " << sqlite3_errmsg(_database) << std::endl;
+        OE_WARN << LC << "Failed query: " << sqlite3_sql(insert) << "(" << rc << ")" << rc << "; " << sqlite3_errmsg(_database) << std::endl;
 #endif        
         ok = false;
     }
 
-    sqlite3_finalize( insert );
+    sqlite3_reset( insert );
+    sqlite3_clear_bindings( insert );
 
     return ok;
 }
 
+bool 
+MBTilesTileSource::storeImage(const TileKey&    key,
+                              osg::Image*       image,
+                              ProgressCallback* progress)
+{
+    if ( (getMode() & MODE_WRITE) == 0 )
+        return false;
+
+    Threading::ScopedMutexLock exclusiveLock(_mutex);
+
+    std::string value;
+    if ( !encodeTileData(image, value) )
+        return false;
+
+    if ( _geopackage && !putTileMatrix(key.getLOD(), image) )
+        return false;
+
+    // Prep the insert statement:
+    std::string query = "INSERT OR REPLACE INTO " + tilesTable() + " (zoom_level, tile_column, tile_row, tile_data) VALUES (?, ?, ?, ?)";
+    sqlite3_stmt* insert = prepare( _database, _main._insertTile, query );
+    if ( !insert )
+        return false;
+
+    return insertTile( insert, key, value );
+}
+
+bool
+MBTilesTileSource::storeImages(const std::vector<TileKey>&                    keys,
+                               const std::vector< osg::ref_ptr<osg::Image> >& images,
+                               ProgressCallback*                              progress)
+{
+    if ( (getMode() & MODE_WRITE) == 0 )
+        return false;
+
+    // Encoding is the expensive part and needs no database access, so do it
+    // before taking the lock.
+    std::vector<std::string> values( keys.size() );
+    std::vector<bool>        encoded( keys.size(), false );
+    bool ok = true;
+
+    for( unsigned i=0; i<keys.size() && i<images.size(); ++i )
+    {
+        if ( progress && progress->isCanceled() )
+            return false;
+
+        encoded[i] = images[i].valid() && encodeTileData( images[i].get(), values[i] );
+        if ( !encoded[i] )
+            ok = false;
+    }
+
+    Threading::ScopedMutexLock exclusiveLock(_mutex);
+
+    // One transaction for the whole batch; otherwise SQLite commits (and
+    // syncs to disk) once per row.
+    if ( !exec(_database, "BEGIN TRANSACTION") )
+        return false;
+
+    std::string query = "INSERT OR REPLACE INTO " + tilesTable() + " (zoom_level, tile_column, tile_row, tile_data) VALUES (?, ?, ?, ?)";
+    sqlite3_stmt* insert = prepare( _database, _main._insertTile, query );
+    if ( !insert )
+    {
+        exec(_database, "ROLLBACK");
+        return false;
+    }
+
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        if ( !encoded[i] )
+            continue;
+
+        if ( _geopackage && !putTileMatrix(keys[i].getLOD(), images[i].get()) )
+        {
+            ok = false;
+            continue;
+        }
+
+        if ( !insertTile(insert, keys[i], values[i]) )
+            ok = false;
+    }
+
+    if ( !exec(_database, "COMMIT") )
+    {
+        exec(_database, "ROLLBACK");
+        return false;
+    }
+
+    return ok;
+}
+
+MBTilesTileSource::ScopedConnection::ScopedConnection(MBTilesTileSource* source) :
+_source( source ),
+_conn  ( 0L ),
+_pooled( false )
+{
+    if ( (source->getMode() & MODE_WRITE) == 0 )
+    {
+        _conn   = source->acquireReadConnection();
+        _pooled = _conn != 0L;
+    }
+
+    // writable database, or no more connections to be had: share the main one.
+    if ( !_pooled )
+    {
+        source->_mutex.lock();
+        _conn = &source->_main;
+    }
+}
+
+MBTilesTileSource::ScopedConnection::~ScopedConnection()
+{
+    if ( _pooled )
+        _source->releaseReadConnection( _conn );
+    else
+        _source->_mutex.unlock();
+}
+
+MBTilesTileSource::Connection*
+MBTilesTileSource::acquireReadConnection()
+{
+    {
+        Threading::ScopedMutexLock lock(_poolMutex);
+        if ( !_pool.empty() )
+        {
+            Connection* conn = _pool.back();
+            _pool.pop_back();
+            return conn;
+        }
+    }
+
+    // None free; open another. SQLITE_OPEN_NOMUTEX is safe because a connection
+    // is only used by one thread at a time. (We don't use the shared cache:
+    // it serializes readers on a table lock, and with mmap the OS page cache
+    // is shared among the connections anyway.)
+    sqlite3* db = 0L;
+    int rc = sqlite3_open_v2( _options.filename()->full().c_str(), &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, 0L );
+    if ( rc != SQLITE_OK )
+    {
+        OE_WARN << LC << "Failed to open a read connection: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_close( db );
+        return 0L;
+    }
+
+    setMemoryMap( db );
+
+    Connection* conn = new Connection();
+    conn->_db = db;
+
+    Threading::ScopedMutexLock lock(_poolMutex);
+    _connections.push_back( conn );
+    OE_DEBUG << LC << "Opened read connection " << _connections.size() << std::endl;
+    return conn;
+}
+
+void
+MBTilesTileSource::releaseReadConnection(Connection* conn)
+{
+    Threading::ScopedMutexLock lock(_poolMutex);
+    _pool.push_back( conn );
+}
+
+sqlite3_stmt*
+MBTilesTileSource::prepare(sqlite3* db, sqlite3_stmt*& cached, const std::string& query)
+{
+    if ( cached == 0L )
+    {
+        if ( SQLITE_OK != sqlite3_prepare_v2(db, query.c_str(), -1, &cached, 0L) )
+        {
+            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(db) << std::endl;
+            cached = 0L;
+        }
+    }
+    return cached;
+}
+
+void
+MBTilesTileSource::closeConnection(Connection& conn, bool closeDB)
+{
+    if ( conn._selectTile )
+        sqlite3_finalize( conn._selectTile );
+    if ( conn._insertTile )
+        sqlite3_finalize( conn._insertTile );
+    conn._selectTile = 0L;
+    conn._insertTile = 0L;
+
+    if ( closeDB && conn._db )
+        sqlite3_close( conn._db );
+    conn._db = 0L;
+}
+
+void
+MBTilesTileSource::setMemoryMap(sqlite3* db)
+{
+    unsigned mb = _options.mmapSizeMB().value();
+    if ( mb > 0 )
+    {
+        exec(db, Stringify() << std::fixed << std::setprecision(0)
+            << "PRAGMA mmap_size = " << (double)mb * 1048576.0);
+    }
+}
+
 bool
 MBTilesTileSource::getMetaData(const std::string& key, std::string& value)
 {
@@ -523,7 +896,7 @@ MBTilesTileSource::computeLevels()
 
     osg::Timer_t startTime = osg::Timer::instance()->tick();
     sqlite3_stmt* select = NULL;
-    std::string query = "SELECT min(zoom_level), max(zoom_level) from tiles";
+    std::string query = "SELECT min(zoom_level), max(zoom_level) from " + tilesTable();
     int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &select, 0L );
     if ( rc != SQLITE_OK )
     {
@@ -546,6 +919,49 @@ MBTilesTileSource::computeLevels()
     OE_DEBUG << LC << "Computing levels took " << osg::Timer::instance()->delta_s(startTime, endTime ) << " s" << std::endl;
 }
 
+void
+MBTilesTileSource::computeTileIndex()
+{
+    Threading::ScopedMutexLock exclusiveLock(_mutex);
+
+    osg::Timer_t startTime = osg::Timer::instance()->tick();
+    sqlite3_stmt* select = NULL;
+    std::string query = "SELECT zoom_level, tile_column, tile_row from " + tilesTable();
+    int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &select, 0L );
+    if ( rc != SQLITE_OK )
+    {
+        OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+        return;
+    }
+
+    osg::ref_ptr<TileExistenceIndex> index = new TileExistenceIndex();
+    const Profile* profile = getProfile();
+
+    while( sqlite3_step(select) == SQLITE_ROW )
+    {
+        unsigned z = (unsigned)sqlite3_column_int( select, 0 );
+        unsigned x = (unsigned)sqlite3_column_int( select, 1 );
+        unsigned y = (unsigned)sqlite3_column_int( select, 2 );
+
+        // MBTiles rows count from the bottom; flip into TileKey space.
+        unsigned numCols, numRows;
+        profile->getNumTiles( z, numCols, numRows );
+        if ( y < numRows )
+        {
+            index->add( z, x, isFlippedY() ? numRows - y - 1 : y );
+        }
+    }
+    sqlite3_finalize( select );
+
+    if ( !index->empty() )
+    {
+        setTileIndex( index.get() );
+    }
+
+    osg::Timer_t endTime = osg::Timer::instance()->tick();
+    OE_INFO << LC << "Indexed " << index->size() << " tiles in " << osg::Timer::instance()->delta_s(startTime, endTime ) << " s" << std::endl;
+}
+
 bool
 MBTilesTileSource::createTables()
 {
@@ -564,6 +980,10 @@ MBTilesTileSource::createTables()
         return false;
     }
 
+    // a GeoPackage tile table has a different layout; see createGeoPackageTables().
+    if ( _geopackage )
+        return true;
+
     query = 
         "CREATE TABLE IF NOT EXISTS tiles ("
         " zoom_level integer,"
@@ -598,6 +1018,223 @@ MBTilesTileSource::createTables()
     return true;
 }
 
+bool
+MBTilesTileSource::createGeoPackageTables()
+{
+    Threading::ScopedMutexLock exclusiveLock(_mutex);
+
+    // http://www.geopackage.org/spec/ (tiles option). The "metadata" table
+    // from createTables() stays alongside as a user table so that osgEarth
+    // can restore the profile and format exactly.
+
+    const Profile*          profile = getProfile();
+    const SpatialReference* srs     = profile->getSRS();
+    const GeoExtent&        extent  = profile->getExtent();
+    int                     srsID   = getGeoPackageSRSID(srs);
+
+    exec(_database, Stringify() << "PRAGMA application_id = " << GPKG_APPLICATION_ID);
+    exec(_database, Stringify() << "PRAGMA user_version = " << GPKG_USER_VERSION);
+
+    bool ok =
+        exec(_database,
+            "CREATE TABLE IF NOT EXISTS gpkg_spatial_ref_sys ("
+            " srs_name TEXT NOT NULL,"
+            " srs_id INTEGER NOT NULL PRIMARY KEY,"
+            " organization TEXT NOT NULL,"
+            " organization_coordsys_id INTEGER NOT NULL,"
+            " definition TEXT NOT NULL,"
+            " description TEXT)") &&
+        exec(_database,
+            "CREATE TABLE IF NOT EXISTS gpkg_contents ("
+            " table_name TEXT NOT NULL PRIMARY KEY,"
+            " data_type TEXT NOT NULL,"
+            " identifier TEXT UNIQUE,"
+            " description TEXT DEFAULT '',"
+            " last_change DATETIME NOT NULL DEFAULT (strftime('%Y-%m-%dT%H:%M:%fZ','now')),"
+            " min_x DOUBLE, min_y DOUBLE, max_x DOUBLE, max_y DOUBLE,"
+            " srs_id INTEGER,"
+            " CONSTRAINT fk_gc_r_srs_id FOREIGN KEY (srs_id) REFERENCES gpkg_spatial_ref_sys(srs_id))") &&
+        exec(_database,
+            "CREATE TABLE IF NOT EXISTS gpkg_tile_matrix_set ("
+            " table_name TEXT NOT NULL PRIMARY KEY,"
+            " srs_id INTEGER NOT NULL,"
+            " min_x DOUBLE NOT NULL, min_y DOUBLE NOT NULL, max_x DOUBLE NOT NULL, max_y DOUBLE NOT NULL,"
+            " CONSTRAINT fk_gtms_table_name FOREIGN KEY (table_name) REFERENCES gpkg_contents(table_name),"
+            " CONSTRAINT fk_gtms_srs FOREIGN KEY (srs_id) REFERENCES gpkg_spatial_ref_sys (srs_id))") &&
+        exec(_database,
+            "CREATE TABLE IF NOT EXISTS gpkg_tile_matrix ("
+            " table_name TEXT NOT NULL,"
+            " zoom_level INTEGER NOT NULL,"
+            " matrix_width INTEGER NOT NULL, matrix_height INTEGER NOT NULL,"
+            " tile_width INTEGER NOT NULL, tile_height INTEGER NOT NULL,"
+            " pixel_x_size DOUBLE NOT NULL, pixel_y_size DOUBLE NOT NULL,"
+            " CONSTRAINT pk_ttm PRIMARY KEY (table_name, zoom_level),"
+            " CONSTRAINT fk_tmm_table_name FOREIGN KEY (table_name) REFERENCES gpkg_contents(table_name))") &&
+        exec(_database, Stringify() <<
+            "CREATE TABLE IF NOT EXISTS " << tilesTable() << " ("
+            " id INTEGER PRIMARY KEY AUTOINCREMENT,"
+            " zoom_level INTEGER NOT NULL,"
+            " tile_column INTEGER NOT NULL,"
+            " tile_row INTEGER NOT NULL,"
+            " tile_data BLOB NOT NULL,"
+            " UNIQUE (zoom_level, tile_column, tile_row))");
+
+    if ( !ok )
+        return false;
+
+    // The three SRS rows every GeoPackage must have, plus the profile's own.
+    exec(_database,
+        "INSERT OR IGNORE INTO gpkg_spatial_ref_sys VALUES"
+        " ('Undefined cartesian SRS', -1, 'NONE', -1, 'undefined', NULL),"
+        " ('Undefined geographic SRS', 0, 'NONE', 0, 'undefined', NULL)");
+
+    sqlite3_stmt* insert = 0L;
+    std::string query = "INSERT OR IGNORE INTO gpkg_spatial_ref_sys VALUES (?, ?, ?, ?, ?, NULL)";
+    if ( SQLITE_OK != sqlite3_prepare_v2(_database, query.c_str(), -1, &insert, 0L) )
+    {
+        OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+        return false;
+    }
+
+    const SpatialReference* wgs84 = SpatialReference::get("wgs84");
+    const SpatialReference* srsList[2] = { wgs84, srs };
+    for( unsigned i=0; i<2; ++i )
+    {
+        int         id   = getGeoPackageSRSID(srsList[i]);
+        std::string name = srsList[i]->getName();
+        std::string org  = id == 100000 ? "NONE" : "EPSG";
+        std::string wkt  = srsList[i]->getWKT();
+        sqlite3_bind_text( insert, 1, name.c_str(), name.length(), SQLITE_STATIC );
+        sqlite3_bind_int ( insert, 2, id );
+        sqlite3_bind_text( insert, 3, org.c_str(), org.length(), SQLITE_STATIC );
+        sqlite3_bind_int ( insert, 4, id );
+        sqlite3_bind_text( insert, 5, wkt.c_str(), wkt.length(), SQLITE_STATIC );
+        sqlite3_step ( insert );
+        sqlite3_reset( insert );
+    }
+    sqlite3_finalize( insert );
+
+    // Register the tile table and its tile matrix set (the profile extent).
+    ok =
+        exec(_database, Stringify() << std::setprecision(17)
+            << "INSERT OR REPLACE INTO gpkg_contents (table_name, data_type, identifier, min_x, min_y, max_x, max_y, srs_id) VALUES ("
+            << "'" << _tableName << "', 'tiles', '" << _tableName << "', "
+            << extent.xMin() << ", " << extent.yMin() << ", " << extent.xMax() << ", " << extent.yMax() << ", "
+            << srsID << ")") &&
+        exec(_database, Stringify() << std::setprecision(17)
+            << "INSERT OR REPLACE INTO gpkg_tile_matrix_set VALUES ("
+            << "'" << _tableName << "', " << srsID << ", "
+            << extent.xMin() << ", " << extent.yMin() << ", " << extent.xMax() << ", " << extent.yMax() << ")");
+
+    return ok;
+}
+
+bool
+MBTilesTileSource::putTileMatrix(int z, const osg::Image* image)
+{
+    // called with _mutex held.
+    if ( _tileMatrixLevels.find(z) != _tileMatrixLevels.end() )
+        return true;
+
+    const Profile*   profile = getProfile();
+    const GeoExtent& extent  = profile->getExtent();
+
+    unsigned numCols, numRows;
+    profile->getNumTiles( z, numCols, numRows );
+
+    bool ok = exec(_database, Stringify() << std::setprecision(17)
+        << "INSERT OR IGNORE INTO gpkg_tile_matrix VALUES ("
+        << "'" << _tableName << "', " << z << ", "
+        << numCols << ", " << numRows << ", "
+        << image->s() << ", " << image->t() << ", "
+        << extent.width()  / (double)(numCols * image->s()) << ", "
+        << extent.height() / (double)(numRows * image->t()) << ")");
+
+    if ( ok )
+        _tileMatrixLevels.insert( z );
+
+    return ok;
+}
+
+const Profile*
+MBTilesTileSource::readGeoPackageProfile()
+{
+    Threading::ScopedMutexLock exclusiveLock(_mutex);
+
+    sqlite3_stmt* select = 0L;
+    std::string query =
+        "SELECT s.min_x, s.min_y, s.max_x, s.max_y, r.organization, r.organization_coordsys_id, r.definition"
+        " FROM gpkg_tile_matrix_set s JOIN gpkg_spatial_ref_sys r ON s.srs_id = r.srs_id"
+        " WHERE s.table_name = ?";
+    if ( SQLITE_OK != sqlite3_prepare_v2(_database, query.c_str(), -1, &select, 0L) )
+    {
+        OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+        return 0L;
+    }
+
+    sqlite3_bind_text( select, 1, _tableName.c_str(), _tableName.length(), SQLITE_STATIC );
+
+    double xmin = 0.0, ymin = 0.0, xmax = 0.0, ymax = 0.0;
+    std::string srsString;
+    if ( sqlite3_step(select) == SQLITE_ROW )
+    {
+        xmin = sqlite3_column_double( select, 0 );
+        ymin = sqlite3_column_double( select, 1 );
+        xmax = sqlite3_column_double( select, 2 );
+        ymax = sqlite3_column_double( select, 3 );
+
+        std::string org = (const char*)sqlite3_column_text( select, 4 );
+        if ( osgEarth::ciEquals(org, "EPSG") )
+            srsString = Stringify() << "epsg:" << sqlite3_column_int( select, 5 );
+        else
+            srsString = (const char*)sqlite3_column_text( select, 6 );
+    }
+    sqlite3_finalize( select );
+
+    if ( srsString.empty() )
+        return 0L;
+
+    // The tile matrices may not start at level 0; derive its size from the first one.
+    unsigned numTilesWide = 0, numTilesHigh = 0;
+    query = "SELECT zoom_level, matrix_width, matrix_height FROM gpkg_tile_matrix WHERE table_name = ? ORDER BY zoom_level LIMIT 1";
+    if ( SQLITE_OK == sqlite3_prepare_v2(_database, query.c_str(), -1, &select, 0L) )
+    {
+        sqlite3_bind_text( select, 1, _tableName.c_str(), _tableName.length(), SQLITE_STATIC );
+        if ( sqlite3_step(select) == SQLITE_ROW )
+        {
+            int z = sqlite3_column_int( select, 0 );
+            numTilesWide = osg::maximum( 1u, (unsigned)sqlite3_column_int(select, 1) >> z );
+            numTilesHigh = osg::maximum( 1u, (unsigned)sqlite3_column_int(select, 2) >> z );
+        }
+        sqlite3_finalize( select );
+    }
+
+    return Profile::create( srsString, xmin, ymin, xmax, ymax, "", numTilesWide, numTilesHigh );
+}
+
+std::string
+MBTilesTileSource::readTileFormat()
+{
+    Threading::ScopedMutexLock exclusiveLock(_mutex);
+
+    std::string format;
+    sqlite3_stmt* select = 0L;
+    std::string query = "SELECT tile_data FROM " + tilesTable() + " LIMIT 1";
+    if ( SQLITE_OK == sqlite3_prepare_v2(_database, query.c_str(), -1, &select, 0L) )
+    {
+        if ( sqlite3_step(select) == SQLITE_ROW && sqlite3_column_bytes(select, 0) >= 2 )
+        {
+            const unsigned char* data = (const unsigned char*)sqlite3_column_blob( select, 0 );
+            if ( data[0] == 0xFF && data[1] == 0xD8 )
+                format = "jpg";
+            else if ( data[0] == 0x89 && data[1] == 'P' )
+                format = "png";
+        }
+        sqlite3_finalize( select );
+    }
+    return format;
+}
+
 std::string
 MBTilesTileSource::getExtension() const 
 {
@@ -41,6 +41,7 @@
 #include <OpenThreads/ScopedLock>
 
 #include "FeatureStencilModelOptions"
+#include "ScreenSpaceDecal"
 
 using namespace osgEarth;
 using namespace osgEarth::Features;
@@ -98,18 +99,37 @@ namespace
         return proj;
     }
 
+    /** Color to fill a style's features with. */
+    osg::Vec4f getStyleColor( const Style& style )
+    {
+        osg::Vec4f color = osg::Vec4(1,1,0,1);
+
+        if (/*hasLines &&*/ style.getSymbol<LineSymbol>())
+        {
+            const LineSymbol* line = style.getSymbol<LineSymbol>();
+            color = line->stroke()->color();
+        } 
+        else
+        {
+            const PolygonSymbol* poly = style.getSymbol<PolygonSymbol>();
+            if (poly)
+                color = poly->fill()->color();
+        }
+        return color;
+    }
+
     struct BuildData // : public osg::Referenced
     {
         //BuildData() { }
         BuildData( int renderBinStart ) : _renderBin( renderBinStart ) { }
 
-        typedef std::pair<std::string, osg::ref_ptr<StencilVolumeNode> > StyleGroup;
+        typedef std::pair<std::string, osg::ref_ptr<osg::Group> > StyleGroup;
         int                       _renderBin;
         Threading::ReadWriteMutex _mutex;
         std::vector<StyleGroup>   _styleGroups;  // NOTE: DO NOT ACCESS without a mutex!
 
 
-        bool getStyleNode( const std::string& styleName, StencilVolumeNode*& out_svn, bool useLock )
+        bool getStyleNode( const std::string& styleName, osg::Group*& out_svn, bool useLock )
         {
             if ( useLock )
             {
@@ -123,7 +143,7 @@ namespace
         }
 
     private:
-        bool getStyleNodeWithoutLocking( const std::string& styleName, StencilVolumeNode*& out_svn )
+        bool getStyleNodeWithoutLocking( const std::string& styleName, osg::Group*& out_svn )
         {
             for(std::vector<StyleGroup>::iterator i = _styleGroups.begin(); i != _styleGroups.end(); ++i )
             {
@@ -143,13 +163,27 @@ namespace
         const FeatureStencilModelOptions _options;
         int                              _renderBinStart;
         BuildData                        _buildData;
+        bool                             _useDecals;
 
     public:
-        StencilVolumeNodeFactory( const FeatureStencilModelOptions& options, int renderBinStart )
+        StencilVolumeNodeFactory( const FeatureStencilModelOptions& options, int renderBinStart, bool useDecals )
             : _options(options),
-              _buildData( renderBinStart )
+              _buildData( renderBinStart ),
+              _useDecals( useDecals )
         { }
 
+        /** Applies an LOD if required. */
+        osg::Node* applyRange( osg::Node* node ) const
+        {
+            if ( _options.minRange().isSet() || _options.maxRange().isSet() )
+            {
+                osg::LOD* lod = new osg::LOD();
+                lod->addChild( node, _options.minRange().value(), _options.maxRange().value() );
+                return lod;
+            }
+            return node;
+        }
+
         //override
         bool createOrUpdateNode(
             FeatureCursor*            cursor,
@@ -201,6 +235,26 @@ namespace
                 }
             }
 
+            // Rasterise the features into screen-space decals instead of volumes:
+            if ( _useDecals )
+            {
+                const SpatialReference* mapSRS = mi.getProfile()->getSRS();
+                for( FeatureList::iterator i = featureList.begin(); i != featureList.end(); ++i )
+                    i->get()->transform( mapSRS );
+
+                DecalBuilder builder( mapSRS, mi.isGeocentric(), *_options.decalResolution() );
+                osg::Node* decals = builder.build( featureList );
+                if ( decals )
+                {
+                    DecalGroup* group = dynamic_cast<DecalGroup*>( getOrCreateStyleGroup(style, cx.getSession()) );
+                    if ( group )
+                        group->addDecals( applyRange(decals) );
+                }
+
+                node = 0L; // always return null, since we added our geom to the style group.
+                return decals != 0L;
+            }
+
             // Extrude and cap the geometry in both directions to build a stencil volume:
 
             Style bs;
@@ -218,13 +272,7 @@ namespace
 
             if ( volumes )
             {
-                // Apply an LOD if required:
-                if ( _options.minRange().isSet() || _options.maxRange().isSet() )
-                {
-                    osg::LOD* lod = new osg::LOD();
-                    lod->addChild( volumes, _options.minRange().value(), _options.maxRange().value() );
-                    volumes = lod;
-                }
+                volumes = applyRange( volumes );
 
                 // Add the volumes to the appropriate style group.
                 osg::Group* styleGroup = getOrCreateStyleGroup( style, cx.getSession() );
@@ -242,13 +290,13 @@ namespace
         //override
         osg::Group* getOrCreateStyleGroup( const Style& style, Session* session )
         {
-            if ( _options.showVolumes() == true )
+            if ( _options.showVolumes() == true && !_useDecals )
             {
                 return new osg::Group();
             }
             else
             {
-                StencilVolumeNode* styleNode = 0L;
+                osg::Group* styleNode = 0L;
                 if ( !_buildData.getStyleNode(style.getName(), styleNode, true) )
                 {
                     // did not find; write-lock it and try again (double-check pattern)
@@ -258,33 +306,31 @@ namespace
                     {
                         OE_INFO << LC << "Create style group \"" << style.getName() << "\"" << std::endl;
 
-                        styleNode = new StencilVolumeNode( *_options.mask(), *_options.inverted() );
-
-                        if ( _options.mask() == false )
+                        if ( _useDecals )
                         {
-                            osg::Vec4f maskColor = osg::Vec4(1,1,0,1);
+                            DecalGroup* decalGroup = new DecalGroup( getStyleColor(style) );
+                            _buildData._renderBin = decalGroup->setBaseRenderBin( _buildData._renderBin );
+                            styleNode = decalGroup;
+                        }
+                        else
+                        {
+                            StencilVolumeNode* svNode = new StencilVolumeNode( *_options.mask(), *_options.inverted() );
 
-                            if (/*hasLines &&*/ style.getSymbol<LineSymbol>())
-                            {
-                                const LineSymbol* line = style.getSymbol<LineSymbol>();
-                                maskColor = line->stroke()->color();
-                            } 
-                            else
+                            if ( _options.mask() == false )
                             {
-                                const PolygonSymbol* poly = style.getSymbol<PolygonSymbol>();
-                                if (poly)
-                                    maskColor = poly->fill()->color();
+                                svNode->addChild( createColorNode(getStyleColor(style)) );
+
+                                osg::StateSet* ss = svNode->getOrCreateStateSet();
+
+                                ss->setMode( GL_LIGHTING, _options.enableLighting() == true?
+                                     osg::StateAttribute::ON | osg::StateAttribute::PROTECTED :
+                                     osg::StateAttribute::OFF | osg::StateAttribute::PROTECTED );
                             }
-                            styleNode->addChild( createColorNode(maskColor) );
-                            
-                            osg::StateSet* ss = styleNode->getOrCreateStateSet();
 
-                            ss->setMode( GL_LIGHTING, _options.enableLighting() == true?
-                                 osg::StateAttribute::ON | osg::StateAttribute::PROTECTED :
-                                 osg::StateAttribute::OFF | osg::StateAttribute::PROTECTED );
+                            _buildData._renderBin = svNode->setBaseRenderBin( _buildData._renderBin );
+                            styleNode = svNode;
                         }
 
-                        _buildData._renderBin = styleNode->setBaseRenderBin( _buildData._renderBin );
                         _buildData._styleGroups.push_back( BuildData::StyleGroup(style.getName(), styleNode) );
                     }
                 }
@@ -301,12 +347,26 @@ namespace
         FeatureStencilModelSource( const ModelSourceOptions& options, int renderBinStart ) :
             FeatureModelSource( options ),
             _options( options ),
-            _renderBinStart( renderBinStart )
+            _renderBinStart( renderBinStart ),
+            _useDecals( false )
         {
+            if ( _options.technique() == FeatureStencilModelOptions::TECHNIQUE_DECAL )
+            {
+                if ( _options.mask() == true || _options.inverted() == true )
+                {
+                    OE_WARN << LC << "The decal technique does not support \"mask\" or \"inverted\"; "
+                        << "using stencil volumes instead" << std::endl;
+                }
+                else
+                {
+                    _useDecals = true;
+                }
+            }
+
             // make sure we have stencil bits. Note, this only works before
             // a viewer gets created. You may need to allocate stencil bits
             // yourself if you make this object after realizing a viewer.
-            if ( osg::DisplaySettings::instance()->getMinimumNumStencilBits() < 8 )
+            if ( !_useDecals && osg::DisplaySettings::instance()->getMinimumNumStencilBits() < 8 )
             {
                 osg::DisplaySettings::instance()->setMinimumNumStencilBits( 8 );
             }
@@ -326,12 +386,13 @@ namespace
 
         FeatureNodeFactory* createFeatureNodeFactory()
         {
-            return new StencilVolumeNodeFactory( _options, _renderBinStart );
+            return new StencilVolumeNodeFactory( _options, _renderBinStart, _useDecals );
         }
 
     protected:
         int _renderBinStart;
         const FeatureStencilModelOptions _options;
+        bool _useDecals;
     };
 }
 
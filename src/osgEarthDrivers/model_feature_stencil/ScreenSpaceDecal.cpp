@@ -0,0 +1,517 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "ScreenSpaceDecal"
+#include <osgEarth/VirtualProgram>
+#include <osgEarth/ShaderUtils>
+#include <osgEarth/CullingUtils>
+#include <osgEarth/GeoData>
+#include <osgEarthSymbology/GeometryRasterizer>
+#include <osgEarthSymbology/PolygonSymbol>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/BlendFunc>
+#include <osg/CullFace>
+#include <osg/Depth>
+#include <osg/Viewport>
+#include <osg/Math>
+#include <osgUtil/CullVisitor>
+#include <cmath>
+#include <cfloat>
+
+#define LC "[ScreenSpaceDecal] "
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+// texture image units used by the decal pass (which has no other textures)
+#define DEPTH_UNIT 0
+#define MASK_UNIT  1
+
+// largest cell on a geocentric map, in degrees
+#define MAX_CELL_DEGREES 10.0
+
+// how far the decal box reaches below and above the cell's tangent plane,
+// on top of the ellipsoid's curvature (meters)
+#define BOX_DEPTH  12000.0
+#define BOX_HEIGHT 10000.0
+
+namespace
+{
+    const char* DecalFragmentShader =
+        "#version " GLSL_VERSION_STR "\n"
+        GLSL_DEFAULT_PRECISION_FLOAT "\n"
+
+        "uniform sampler2D oe_decal_depth; \n"
+        "uniform sampler2D oe_decal_mask; \n"
+        "uniform vec4      oe_decal_viewport; \n"     // x, y, width, height
+        "uniform mat4      oe_decal_viewToLocal; \n"
+        "uniform vec4      oe_decal_extent; \n"       // xmin, ymin, xmax, ymax of the mask
+        "uniform vec4      oe_decal_color; \n"
+
+        "void oe_decal_fragment( inout vec4 color ) \n"
+        "{ \n"
+        "    vec2 uv = (gl_FragCoord.xy - oe_decal_viewport.xy) / oe_decal_viewport.zw; \n"
+        "    float depth = texture2D(oe_decal_depth, uv).r; \n"
+        "    if ( depth >= 1.0 ) \n"
+        "        discard; \n"
+
+        // rebuild the view-space position of the surface under this pixel:
+        "    vec3 ndc = vec3(uv, depth) * 2.0 - 1.0; \n"
+        "    mat4 P = gl_ProjectionMatrix; \n"
+        "    vec4 view = vec4(0.0, 0.0, 0.0, 1.0); \n"
+        "    if ( P[2][3] != 0.0 ) \n" // perspective
+        "    { \n"
+        "        view.z = -P[3][2] / (ndc.z + P[2][2]); \n"
+        "        view.x = -view.z * (ndc.x + P[2][0]) / P[0][0]; \n"
+        "        view.y = -view.z * (ndc.y + P[2][1]) / P[1][1]; \n"
+        "    } \n"
+        "    else \n" // orthographic
+        "    { \n"
+        "        view.z = (ndc.z - P[3][2]) / P[2][2]; \n"
+        "        view.x = (ndc.x - P[3][0]) / P[0][0]; \n"
+        "        view.y = (ndc.y - P[3][1]) / P[1][1]; \n"
+        "    } \n"
+
+        "    vec2 local = (oe_decal_viewToLocal * view).xy; \n"
+        "    vec2 st = (local - oe_decal_extent.xy) / (oe_decal_extent.zw - oe_decal_extent.xy); \n"
+        "    if ( any(lessThan(st, vec2(0.0))) || any(greaterThan(st, vec2(1.0))) ) \n"
+        "        discard; \n"
+
+        "    float coverage = texture2D(oe_decal_mask, st).r; \n"
+        "    if ( coverage <= 0.0 ) \n"
+        "        discard; \n"
+
+        "    color = vec4(oe_decal_color.rgb, oe_decal_color.a * coverage); \n"
+        "} \n";
+
+
+    /** Copies the current viewport's depth buffer into a texture. */
+    class DepthCapture : public osg::Drawable
+    {
+    public:
+        DepthCapture( osg::Texture2D* texture =0L ) : _texture( texture )
+        {
+            setSupportsDisplayList( false );
+            setUseDisplayList( false );
+        }
+
+        DepthCapture( const DepthCapture& rhs, const osg::CopyOp& op =osg::CopyOp::SHALLOW_COPY ) :
+            osg::Drawable( rhs, op ),
+            _texture     ( rhs._texture.get() ) { }
+
+        META_Object( osgEarth, DepthCapture );
+
+        void drawImplementation( osg::RenderInfo& ri ) const
+        {
+            const osg::Camera*   camera   = ri.getCurrentCamera();
+            const osg::Viewport* viewport = camera ? camera->getViewport() : 0L;
+            if ( !viewport || !_texture.valid() )
+                return;
+
+            osg::State& state = *ri.getState();
+            int x = (int)viewport->x(), y = (int)viewport->y();
+            int w = (int)viewport->width(), h = (int)viewport->height();
+
+            if (_texture->getTextureObject(state.getContextID()) &&
+                _texture->getTextureWidth()  == w &&
+                _texture->getTextureHeight() == h )
+            {
+                _texture->copyTexSubImage2D( state, 0, 0, x, y, w, h );
+            }
+            else
+            {
+                _texture->copyTexImage2D( state, x, y, w, h );
+            }
+
+            // the copy bound the texture behind the state's back:
+            state.haveAppliedTextureAttribute( state.getActiveTextureUnit(), _texture.get() );
+        }
+
+    protected:
+        osg::ref_ptr<osg::Texture2D> _texture;
+    };
+
+
+    /** Builds the box around a cell, wound so that the back faces are the inside. */
+    osg::Geometry* createBox( const osg::BoundingBoxd& box )
+    {
+        osg::Geometry* geom = new osg::Geometry();
+        geom->setUseVertexBufferObjects( true );
+
+        osg::Vec3Array* verts = new osg::Vec3Array( 8 );
+        for( unsigned i = 0; i < 8; ++i )
+            (*verts)[i] = box.corner( i );
+        geom->setVertexArray( verts );
+
+        // BoundingBox::corner() bits are x=1, y=2, z=4; faces wind CCW from the outside.
+        static const GLushort faces[24] = {
+            0, 2, 3, 1,    // -z
+            4, 5, 7, 6,    // +z
+            0, 1, 5, 4,    // -y
+            3, 2, 6, 7,    // +y
+            0, 4, 6, 2,    // -x
+            1, 3, 7, 5 };  // +x
+        geom->addPrimitiveSet( new osg::DrawElementsUShort(osg::PrimitiveSet::QUADS, 24, faces) );
+
+        return geom;
+    }
+
+
+    /** Clips a ring to an axis-aligned rectangle (Sutherland-Hodgman). */
+    void clipRing( const Vec3dVector& in, const Bounds& r, Vec3dVector& out )
+    {
+        out = in;
+        for( unsigned edge = 0; edge < 4 && !out.empty(); ++edge )
+        {
+            Vec3dVector input;
+            input.swap( out );
+
+            for( unsigned i = 0; i < input.size(); ++i )
+            {
+                const osg::Vec3d& a = input[i];
+                const osg::Vec3d& b = input[(i+1) % input.size()];
+
+                double da, db;
+                switch( edge )
+                {
+                case 0: da = a.x() - r.xMin(); db = b.x() - r.xMin(); break;
+                case 1: da = r.xMax() - a.x(); db = r.xMax() - b.x(); break;
+                case 2: da = a.y() - r.yMin(); db = b.y() - r.yMin(); break;
+                default: da = r.yMax() - a.y(); db = r.yMax() - b.y(); break;
+                }
+
+                if ( da >= 0.0 )
+                    out.push_back( a );
+
+                if ( (da >= 0.0) != (db >= 0.0) )
+                    out.push_back( a + (b - a) * (da / (da - db)) );
+            }
+        }
+    }
+
+    /** Adds points to a closed ring so that no segment is longer than maxStep. */
+    void densifyRing( Vec3dVector& ring, double maxStep )
+    {
+        Vec3dVector out;
+        for( unsigned i = 0; i < ring.size(); ++i )
+        {
+            const osg::Vec3d& a = ring[i];
+            const osg::Vec3d& b = ring[(i+1) % ring.size()];
+            out.push_back( a );
+
+            unsigned steps = (unsigned)ceil( (b - a).length() / maxStep );
+            for( unsigned s = 1; s < steps; ++s )
+                out.push_back( a + (b - a) * ((double)s / (double)steps) );
+        }
+        ring.swap( out );
+    }
+}
+
+//------------------------------------------------------------------------
+
+DecalGroup::DecalGroup( const osg::Vec4f& color )
+{
+    osg::Texture2D* depth = new osg::Texture2D();
+    depth->setInternalFormat( GL_DEPTH_COMPONENT );
+    depth->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+    depth->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
+    depth->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    depth->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+    depth->setResizeNonPowerOfTwoHint( false );
+
+    // the capture draws no pixels; keep it from ever being culled:
+    osg::Geode* captureGeode = new osg::Geode();
+    captureGeode->addDrawable( new DepthCapture(depth) );
+    captureGeode->setCullingActive( false );
+
+    _captureGroup = new osg::Group();
+    _captureGroup->addChild( captureGeode );
+    this->addChild( _captureGroup.get() );
+
+    _decalGroup = new osg::Group();
+    this->addChild( _decalGroup.get() );
+
+    osg::StateSet* ss = _decalGroup->getOrCreateStateSet();
+
+    VirtualProgram* vp = new VirtualProgram();
+    vp->setName( "ScreenSpaceDecal" );
+    vp->setFunction( "oe_decal_fragment", DecalFragmentShader, ShaderComp::LOCATION_FRAGMENT_COLORING );
+    ss->setAttributeAndModes( vp, osg::StateAttribute::ON );
+
+    ss->setTextureAttribute( DEPTH_UNIT, depth, osg::StateAttribute::ON );
+    ss->addUniform( new osg::Uniform("oe_decal_depth", DEPTH_UNIT) );
+    ss->addUniform( new osg::Uniform("oe_decal_mask",  MASK_UNIT) );
+    ss->addUniform( new osg::Uniform("oe_decal_color", color) );
+
+    // draw only the far side of each box, so every covered pixel is drawn
+    // once even when the camera is inside the box:
+    ss->setAttributeAndModes( new osg::CullFace(osg::CullFace::FRONT), osg::StateAttribute::ON | osg::StateAttribute::PROTECTED );
+    ss->setAttributeAndModes( new osg::Depth(osg::Depth::ALWAYS, 0.0, 1.0, false), osg::StateAttribute::ON | osg::StateAttribute::PROTECTED );
+    ss->setMode( GL_DEPTH_TEST, osg::StateAttribute::OFF | osg::StateAttribute::PROTECTED );
+    ss->setMode( GL_LIGHTING, osg::StateAttribute::OFF | osg::StateAttribute::PROTECTED );
+    ss->setAttributeAndModes( new osg::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA), osg::StateAttribute::ON );
+}
+
+int
+DecalGroup::setBaseRenderBin( int bin )
+{
+    _captureGroup->getOrCreateStateSet()->setRenderBinDetails( bin++, "RenderBin" );
+    _decalGroup->getOrCreateStateSet()->setRenderBinDetails( bin++, "RenderBin" );
+    return bin;
+}
+
+void
+DecalGroup::addDecals( osg::Node* node )
+{
+    _decalGroup->addChild( node );
+}
+
+//------------------------------------------------------------------------
+
+DecalNode::DecalNode(const osg::Matrixd&      localToWorld,
+                     const osg::BoundingBoxd& box,
+                     osg::Image*              mask)
+{
+    setMatrix( localToWorld );
+
+    osg::Geode* geode = new osg::Geode();
+    geode->addDrawable( createBox(box) );
+    addChild( geode );
+
+    osg::Texture2D* tex = new osg::Texture2D( mask );
+    tex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR );
+    tex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
+    tex->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    tex->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+    tex->setResizeNonPowerOfTwoHint( false );
+    tex->setUnRefImageDataAfterApply( true );
+
+    osg::StateSet* ss = getOrCreateStateSet();
+    ss->setTextureAttribute( MASK_UNIT, tex, osg::StateAttribute::ON );
+    ss->addUniform( new osg::Uniform("oe_decal_extent", osg::Vec4f(box.xMin(), box.yMin(), box.xMax(), box.yMax())) );
+}
+
+void
+DecalNode::traverse( osg::NodeVisitor& nv )
+{
+    if ( nv.getVisitorType() == nv.CULL_VISITOR )
+    {
+        osgUtil::CullVisitor* cv = Culling::asCullVisitor(nv);
+        PerViewData& data = _perViewData.get(cv);
+        if ( !data._stateSet.valid() )
+        {
+            data._viewToLocal = new osg::Uniform(osg::Uniform::FLOAT_MAT4, "oe_decal_viewToLocal");
+            data._viewport    = new osg::Uniform(osg::Uniform::FLOAT_VEC4, "oe_decal_viewport");
+            data._stateSet = new osg::StateSet();
+            data._stateSet->addUniform( data._viewToLocal.get() );
+            data._stateSet->addUniform( data._viewport.get() );
+        }
+
+        // inverted in double precision; the result only spans camera-to-cell distances.
+        osg::Matrixd viewToLocal = osg::Matrixd::inverse( *cv->getModelViewMatrix() );
+        data._viewToLocal->set( osg::Matrixf(viewToLocal) );
+
+        const osg::Viewport* vp = cv->getViewport();
+        if ( vp )
+            data._viewport->set( osg::Vec4f(vp->x(), vp->y(), vp->width(), vp->height()) );
+
+        cv->pushStateSet( data._stateSet.get() );
+        osg::MatrixTransform::traverse( nv );
+        cv->popStateSet();
+    }
+    else
+    {
+        osg::MatrixTransform::traverse( nv );
+    }
+}
+
+//------------------------------------------------------------------------
+
+DecalBuilder::DecalBuilder(const SpatialReference* mapSRS,
+                           bool                    geocentric,
+                           unsigned                resolution) :
+_mapSRS    ( mapSRS ),
+_geocentric( geocentric ),
+_resolution( osg::maximum(resolution, 16u) )
+{
+    //nop
+}
+
+osg::Node*
+DecalBuilder::build( const FeatureList& features ) const
+{
+    Bounds extent;
+    for( FeatureList::const_iterator f = features.begin(); f != features.end(); ++f )
+    {
+        if ( f->valid() && f->get()->getGeometry() )
+            extent.expandBy( f->get()->getGeometry()->getBounds() );
+    }
+    if ( !extent.valid() || extent.width() <= 0.0 || extent.height() <= 0.0 )
+        return 0L;
+
+    // a projected map has one flat frame; on the globe, keep each cell small
+    // enough that its tangent plane is a fair stand-in for the ellipsoid.
+    unsigned cols = 1, rows = 1;
+    if ( _geocentric )
+    {
+        cols = (unsigned)ceil( extent.width()  / MAX_CELL_DEGREES );
+        rows = (unsigned)ceil( extent.height() / MAX_CELL_DEGREES );
+    }
+
+    double cw = extent.width()  / (double)cols;
+    double ch = extent.height() / (double)rows;
+
+    osg::ref_ptr<osg::Group> group = new osg::Group();
+
+    for( unsigned r = 0; r < rows; ++r )
+    {
+        for( unsigned c = 0; c < cols; ++c )
+        {
+            Bounds cell(
+                extent.xMin() + cw*(double)c,     extent.yMin() + ch*(double)r,
+                extent.xMin() + cw*(double)(c+1), extent.yMin() + ch*(double)(r+1) );
+
+            osg::Node* decal = buildCell( features, cell );
+            if ( decal )
+                group->addChild( decal );
+        }
+    }
+
+    if ( group->getNumChildren() == 0 )
+        return 0L;
+
+    OE_DEBUG << LC << "Built " << group->getNumChildren() << " decals" << std::endl;
+
+    return group->getNumChildren() == 1 ? group->getChild(0) : group.release();
+}
+
+osg::Node*
+DecalBuilder::buildCell( const FeatureList& features, const Bounds& cell ) const
+{
+    // the cell's local frame:
+    osg::Vec3d center( 0.5*(cell.xMin()+cell.xMax()), 0.5*(cell.yMin()+cell.yMax()), 0.0 );
+    osg::Matrixd localToWorld;
+    if ( !GeoPoint(_mapSRS.get(), center, ALTMODE_ABSOLUTE).createLocalToWorld(localToWorld) )
+        return 0L;
+    osg::Matrixd worldToLocal = osg::Matrixd::inverse( localToWorld );
+
+    // box around the cell's surface, sampled along its edges to cover the curvature:
+    osg::BoundingBoxd box;
+    for( unsigned j = 0; j <= 4; ++j )
+    {
+        for( unsigned i = 0; i <= 4; ++i )
+        {
+            osg::Vec3d p(
+                cell.xMin() + cell.width()  * 0.25 * (double)i,
+                cell.yMin() + cell.height() * 0.25 * (double)j,
+                0.0 );
+            osg::Vec3d world;
+            if ( _mapSRS->transformToWorld(p, world) )
+                box.expandBy( world * worldToLocal );
+        }
+    }
+    if ( !box.valid() || box.xMax() <= box.xMin() || box.yMax() <= box.yMin() )
+        return 0L;
+
+    box.zMin() -= BOX_DEPTH;
+    box.zMax() = osg::maximum( box.zMax(), 0.0 ) + BOX_HEIGHT;
+
+    // segments get bent when they go from map coordinates into the local frame:
+    double maxStep = _geocentric ? osg::minimum(cell.width(), cell.height()) / 32.0 : DBL_MAX;
+
+    double sx = (double)_resolution / (box.xMax() - box.xMin());
+    double sy = (double)_resolution / (box.yMax() - box.yMin());
+
+    Style maskStyle;
+    maskStyle.getOrCreate<PolygonSymbol>()->fill()->color() = Color::White;
+    GeometryRasterizer rasterizer( _resolution, _resolution, maskStyle );
+
+    bool drawn = false;
+
+    for( FeatureList::const_iterator f = features.begin(); f != features.end(); ++f )
+    {
+        const Geometry* geom = f->valid() ? f->get()->getGeometry() : 0L;
+        if ( !geom )
+            continue;
+
+        Bounds b = geom->getBounds();
+        if ( b.xMin() > cell.xMax() || b.xMax() < cell.xMin() || b.yMin() > cell.yMax() || b.yMax() < cell.yMin() )
+            continue;
+
+        // gather the feature's rings into one shape, so that holes cancel out:
+        osg::ref_ptr<MultiGeometry> shape = new MultiGeometry();
+
+        ConstGeometryIterator parts( geom, true );
+        while( parts.hasMore() )
+        {
+            const Geometry* part = parts.next();
+            if ( part->getType() != Geometry::TYPE_POLYGON && part->getType() != Geometry::TYPE_RING )
+                continue;
+
+            osg::ref_ptr<Ring> ring = new Ring();
+            clipRing( part->asVector(), cell, ring->asVector() );
+            if ( ring->size() < 3 )
+                continue;
+
+            if ( _geocentric )
+                densifyRing( ring->asVector(), maxStep );
+
+            for( Vec3dVector::iterator p = ring->begin(); p != ring->end(); ++p )
+            {
+                osg::Vec3d world;
+                _mapSRS->transformToWorld( osg::Vec3d(p->x(), p->y(), 0.0), world );
+                osg::Vec3d local = world * worldToLocal;
+                p->set( (local.x()-box.xMin())*sx, (local.y()-box.yMin())*sy, 0.0 );
+            }
+
+            shape->getComponents().push_back( ring.get() );
+        }
+
+        if ( !shape->getComponents().empty() )
+        {
+            rasterizer.draw( shape.get() );
+            drawn = true;
+        }
+    }
+
+    if ( !drawn )
+        return 0L;
+
+    // keep just the coverage:
+    osg::ref_ptr<osg::Image> rgba = rasterizer.finalize();
+    osg::ref_ptr<osg::Image> mask = new osg::Image();
+    mask->allocateImage( _resolution, _resolution, 1, GL_LUMINANCE, GL_UNSIGNED_BYTE );
+    mask->setInternalTextureFormat( GL_LUMINANCE );
+
+    bool covered = false;
+    const unsigned char* src = rgba->data();
+    unsigned char*       dst = mask->data();
+    for( unsigned i = 0; i < _resolution*_resolution; ++i, src += 4, ++dst )
+    {
+        *dst = src[3];
+        covered = covered || (*dst > 0);
+    }
+
+    if ( !covered )
+        return 0L;
+
+    return new DecalNode( localToWorld, box, mask.get() );
+}
@@ -24,13 +24,21 @@
 #include <osgEarth/ShaderGenerator>
 #include <osgEarth/FileUtils>
 #include <osgEarth/StateSetCache>
+#include <osgEarth/ThreadingUtils>
 #include <osg/CullStack>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Observer>
+#include <osg/Texture>
 #include <osg/LOD>
 #include <osg/ProxyNode>
 #include <osg/Notify>
 #include <osg/MatrixTransform>
 #include <osg/io_utils>
 #include <osgDB/FileNameUtils>
+#include <osgDB/Registry>
+#include <map>
+#include <set>
 
 using namespace osgEarth;
 using namespace osgEarth::Drivers;
@@ -109,11 +117,13 @@ namespace
         osg::ref_ptr<osgDB::Options> _dbOptions;
 
     public:
-        SetDBOptionsVisitor(const osgDB::Options* dbOptions)
+        SetDBOptionsVisitor(const osgDB::Options* dbOptions, bool clone =true)
         {
             setTraversalMode( TRAVERSE_ALL_CHILDREN );
             setNodeMaskOverride( ~0 );
-            _dbOptions = Registry::cloneOrCreateOptions( dbOptions );                
+            _dbOptions = clone ?
+                Registry::cloneOrCreateOptions( dbOptions ) :
+                const_cast<osgDB::Options*>( dbOptions );
         }
 
     public: // osg::NodeVisitor
@@ -130,6 +140,254 @@ namespace
             traverse(node);
         }
     };
+
+    /**
+     * Rough size of the geometry and texture data under a node, for the
+     * paging budget.
+     */
+    class EstimateMemoryVisitor : public osg::NodeVisitor
+    {
+    public:
+        EstimateMemoryVisitor()
+            : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+            , _bytes(0)
+        {
+            setNodeMaskOverride( ~0 );
+        }
+
+        void apply(osg::Node& node)
+        {
+            applyStateSet( node.getStateSet() );
+            traverse(node);
+        }
+
+        void apply(osg::Geode& geode)
+        {
+            applyStateSet( geode.getStateSet() );
+            for(unsigned i = 0; i < geode.getNumDrawables(); ++i)
+            {
+                osg::Drawable* d = geode.getDrawable(i);
+                applyStateSet( d->getStateSet() );
+
+                osg::Geometry* geom = d->asGeometry();
+                if ( geom )
+                {
+                    add( geom->getVertexArray() );
+                    add( geom->getNormalArray() );
+                    add( geom->getColorArray() );
+                    for(unsigned t = 0; t < geom->getNumTexCoordArrays(); ++t)
+                        add( geom->getTexCoordArray(t) );
+                    for(unsigned p = 0; p < geom->getNumPrimitiveSets(); ++p)
+                    {
+                        osg::DrawElements* de = geom->getPrimitiveSet(p)->getDrawElements();
+                        if ( de )
+                            _bytes += de->getTotalDataSize();
+                    }
+                }
+            }
+        }
+
+        void applyStateSet(osg::StateSet* ss)
+        {
+            if ( !ss ) return;
+            for(unsigned u = 0; u < ss->getTextureAttributeList().size(); ++u)
+            {
+                osg::Texture* tex = dynamic_cast<osg::Texture*>(
+                    ss->getTextureAttribute(u, osg::StateAttribute::TEXTURE) );
+                if ( tex )
+                {
+                    for(unsigned i = 0; i < tex->getNumImages(); ++i)
+                    {
+                        if ( tex->getImage(i) && _images.insert(tex->getImage(i)).second )
+                            _bytes += tex->getImage(i)->getTotalSizeInBytes();
+                    }
+                }
+            }
+        }
+
+        void add(const osg::Array* array)
+        {
+            if ( array )
+                _bytes += array->getTotalDataSize();
+        }
+
+        unsigned long long        _bytes;
+        std::set<const osg::Image*> _images;
+    };
+
+    /**
+     * Tracks how much paged model data is resident. Each loaded node is
+     * charged when it arrives and refunded when it's deleted.
+     */
+    class PagingBudget : public osg::Referenced, public osg::Observer
+    {
+    public:
+        PagingBudget(unsigned long long maxBytes) : _maxBytes(maxBytes), _bytes(0) { }
+
+        /** Whether the resident data has reached the budget. */
+        bool isFull() const
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            return _maxBytes > 0 && _bytes >= _maxBytes;
+        }
+
+        /** Charges a newly loaded node against the budget. */
+        void charge(osg::Node* node)
+        {
+            EstimateMemoryVisitor v;
+            node->accept( v );
+
+            Threading::ScopedMutexLock lock( _mutex );
+            if ( _nodes.find(node) == _nodes.end() )
+            {
+                _nodes[node] = v._bytes;
+                _bytes += v._bytes;
+                node->addObserver( this );
+            }
+        }
+
+    public: // osg::Observer
+
+        void objectDeleted(void* ptr)
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            std::map<void*, unsigned long long>::iterator i = _nodes.find(ptr);
+            if ( i != _nodes.end() )
+            {
+                _bytes -= i->second;
+                _nodes.erase( i );
+            }
+        }
+
+    protected:
+        virtual ~PagingBudget()
+        {
+            // detach from any nodes that outlive the layer's options.
+            Threading::ScopedMutexLock lock( _mutex );
+            for(std::map<void*, unsigned long long>::iterator i = _nodes.begin(); i != _nodes.end(); ++i)
+                static_cast<osg::Node*>(i->first)->removeObserver( this );
+        }
+
+        unsigned long long                  _maxBytes;
+        unsigned long long                  _bytes;
+        std::map<void*, unsigned long long> _nodes;
+        mutable Threading::Mutex            _mutex;
+    };
+
+    /**
+     * Read callback installed on the options of deferred loads (the async
+     * model and any PagedLOD tiles). It runs in the pager thread and prepares
+     * each loaded node the way the synchronous path prepares the whole model:
+     * loading priorities, shader generation and database options for nested
+     * tiles. It also enforces the paging budget by declining tile loads while
+     * the budget is full; the pager expires unseen tiles in the meantime, and
+     * declined tiles are requested again on later frames by distance.
+     */
+    class DeferredLoadCallback : public osgDB::ReadFileCallback
+    {
+    public:
+        DeferredLoadCallback(const SimpleModelOptions& options, const std::string& rootFile)
+            : _options(options), _rootFile(rootFile)
+        {
+            if ( _options.pagingMemoryBudget().isSet() && *_options.pagingMemoryBudget() > 0.0f )
+                _budget = new PagingBudget( (unsigned long long)(*_options.pagingMemoryBudget() * 1048576.0f) );
+        }
+
+        virtual osgDB::ReaderWriter::ReadResult readNode(const std::string& filename, const osgDB::Options* options)
+        {
+            // never decline the model itself, only its tiles.
+            if ( _budget.valid() && _budget->isFull() && filename != _rootFile )
+                return osgDB::ReaderWriter::ReadResult::INSUFFICIENT_MEMORY_TO_LOAD;
+
+            osgDB::ReaderWriter::ReadResult rr = osgDB::Registry::instance()->readNodeImplementation( filename, options );
+
+            osg::Node* node = rr.getNode();
+            if ( node )
+            {
+                if(_options.loadingPriorityScale().isSet() || _options.loadingPriorityOffset().isSet())
+                {
+                    SetLoadPriorityVisitor slpv(_options.loadingPriorityScale().value(), _options.loadingPriorityOffset().value());
+                    node->accept(slpv);
+                }
+
+                if ( _options.shaderPolicy() == SHADERPOLICY_GENERATE )
+                {
+                    osg::ref_ptr<StateSetCache> cache = new StateSetCache();
+                    Registry::shaderGenerator().run( node, filename, cache.get() );
+                }
+
+                // nested tiles load with these same options (and this callback).
+                if ( options )
+                {
+                    SetDBOptionsVisitor setDBO( options, false );
+                    node->accept( setDBO );
+                }
+
+                if ( _budget.valid() )
+                    _budget->charge( node );
+            }
+
+            return rr;
+        }
+
+    protected:
+        virtual ~DeferredLoadCallback() { }
+
+        const SimpleModelOptions   _options;
+        std::string                _rootFile;
+        osg::ref_ptr<PagingBudget> _budget;
+    };
+
+    /**
+     * Group that shows a placeholder and asks the database pager to load the
+     * real model in the background the first time it's culled. The pager
+     * merges the model in as a second child, which then replaces the
+     * placeholder. Requests closer to the eye are served first.
+     */
+    class AsyncModelNode : public osg::Group
+    {
+    public:
+        AsyncModelNode(const std::string& filename, osgDB::Options* dbOptions, osg::Node* placeholder,
+                       float priorityScale, float priorityOffset)
+            : _filename(filename)
+            , _dbOptions(dbOptions)
+            , _priorityScale(priorityScale)
+            , _priorityOffset(priorityOffset)
+        {
+            addChild( placeholder ? placeholder : new osg::Group() );
+        }
+
+        virtual void traverse(osg::NodeVisitor& nv)
+        {
+            if ( getNumChildren() > 1 )
+            {
+                // loaded; skip the placeholder.
+                for(unsigned i = 1; i < getNumChildren(); ++i)
+                    getChild(i)->accept( nv );
+                return;
+            }
+
+            if ( nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR && nv.getDatabaseRequestHandler() )
+            {
+                float distance = nv.getDistanceToViewPoint( osg::Vec3(0,0,0), true );
+                float priority = _priorityOffset + _priorityScale / (1.0f + std::max(distance, 0.0f));
+
+                nv.getDatabaseRequestHandler()->requestNodeFile(
+                    _filename, nv.getNodePath(), priority, nv.getFrameStamp(), _databaseRequest, _dbOptions.get() );
+            }
+
+            osg::Group::traverse( nv );
+        }
+
+    protected:
+        virtual ~AsyncModelNode() { }
+
+        std::string                   _filename;
+        osg::ref_ptr<osgDB::Options>  _dbOptions;
+        float                         _priorityScale;
+        float                         _priorityOffset;
+        osg::ref_ptr<osg::Referenced> _databaseRequest;
+    };
 }
 
 //--------------------------------------------------------------------------
@@ -162,11 +420,35 @@ public:
         // Only support paging if they've enabled it and provided a min/max range
         bool usePagedLOD = *_options.paged() &&
                           (_options.minRange().isSet() || _options.maxRange().isSet());
+
+        // Load through the pager in the background, unless the paged LOD already
+        // defers it or we need the model up front to find its bounds.
+        bool useAsync = *_options.async() && _options.node() == NULL &&
+                        !(usePagedLOD && !_options.location().isSet());
         
         if (_options.node() != NULL)
         {
             result = _options.node();
         }
+        else if (useAsync)
+        {
+            osg::ref_ptr<osg::Node> placeholder;
+            if ( _options.placeholder().isSet() )
+                placeholder = _options.placeholder()->getNode( localDBOptions.get(), progress );
+
+            localDBOptions->setReadFileCallback( new DeferredLoadCallback(_options, _options.url()->full()) );
+
+            osg::Node* async = new AsyncModelNode(
+                _options.url()->full(),
+                localDBOptions.get(),
+                placeholder.get(),
+                *_options.loadingPriorityScale(),
+                *_options.loadingPriorityOffset() );
+
+            // a paged LOD would load the model a second time; a plain LOD will do.
+            usePagedLOD = false;
+            result = async;
+        }
         else
         {
             // Only load the model if it's not paged or we don't have a location set.
@@ -176,6 +458,12 @@ public:
             }
         }
 
+        // Tiles (and the paged model itself) load in the pager with these options.
+        if ( usePagedLOD && !localDBOptions->getReadFileCallback() )
+        {
+            localDBOptions->setReadFileCallback( new DeferredLoadCallback(_options, _options.url()->full()) );
+        }
+
         // Always create a matrix transform
         osg::MatrixTransform* mt = new osg::MatrixTransform;        
 
@@ -283,7 +571,7 @@ public:
 
             // apply the DB options if there are any, so that deferred nodes like PagedLOD et al
             // will inherit the loading options.
-            if ( _dbOptions.valid() )
+            if ( _dbOptions.valid() || localDBOptions->getReadFileCallback() )
             {
                 SetDBOptionsVisitor setDBO( localDBOptions.get() );
                 result->accept( setDBO );
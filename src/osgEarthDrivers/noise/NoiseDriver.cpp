@@ -66,12 +66,6 @@ namespace osgEarth { namespace Drivers { namespace Noise
             return STATUS_OK;
         }
     
-        /** Tell the terrain engine not to cache tiles form this source by default. */
-        CachePolicy getCachePolicyHint(const Profile*) const
-        {
-            return CachePolicy::NO_CACHE;
-        }
-
         inline double sample(double x, double y, double z)
         {
             return _noise.getValue(x, y, z);
@@ -82,6 +76,36 @@ namespace osgEarth { namespace Drivers { namespace Noise
             return _noise.getValue(v.x(), v.y(), v.z());
         }
 
+        /**
+         * Samples the noise at a row of points in one call. Geographic points
+         * are transformed to ECEF together (and optionally normalized) first.
+         */
+        void sampleRow(std::vector<osg::Vec3d>& points, const SpatialReference* srs, bool normalize, std::vector<double>& out)
+        {
+            if ( srs->isGeographic() )
+            {
+                srs->transform(points, srs->getECEF());
+                if ( normalize )
+                {
+                    for(unsigned i=0; i<points.size(); ++i)
+                        points[i].normalize();
+                }
+            }
+
+            unsigned count = points.size();
+            std::vector<double> x(count), y(count), z(count);
+            for(unsigned i=0; i<count; ++i)
+            {
+                x[i] = points[i].x();
+                y[i] = points[i].y();
+                z[i] = points[i].z();
+            }
+
+            out.resize(count);
+            if ( count > 0 )
+                _noise.getValues(&x[0], &y[0], &z[0], count, &out[0]);
+        }
+
         inline double turbulence(const osg::Vec3d& v, double f)
         {
             double t = -0.5;
@@ -122,34 +146,34 @@ namespace osgEarth { namespace Drivers { namespace Noise
                 double dy = key.getExtent().height() / (double)(image->t()-1);
 
                 ImageUtils::PixelWriter write(image);
-                for(int s=0; s<image->s(); ++s)
+
+                // generate a row at a time so the noise and the SRS transforms run in bulk.
+                std::vector<osg::Vec3d> row(image->s());
+                std::vector<double>     values;
+
+                for(int t=0; t<image->t(); ++t)
                 {
-                    for(int t=0; t<image->t(); ++t)
+                    double y = key.getExtent().yMin() + (double)t * dy;
+
+                    for(int s=0; s<image->s(); ++s)
                     {
                         double x = key.getExtent().xMin() + (double)s * dx;
-                        double y = key.getExtent().yMin() + (double)t * dy;
-                        
-                        osg::Vec3d world(x, y, 0.0);
 
                         if ( srs->isGeographic() )
-                        {
-                            srs->transform(world, srs->getECEF(), world);
-                            world.normalize();
-                        }
+                            row[s].set(x, y, 0.0);
                         else
-                        {
-                            world.x() *= projNormX;
-                            world.y() *= projNormY;
-                            world.z()  = 0.0;
-                        }
+                            row[s].set(x*projNormX, y*projNormY, 0.0);
+                    }
 
-                        double n = sample(world); //world.x(), world.y(), world.z());
+                    sampleRow(row, srs, true, values);
+
+                    for(int s=0; s<image->s(); ++s)
+                    {
                         //double n = 0.1 * stripes(world.x() + 2.0*turbulence(noise, world, 1.0), 1.6);
                         //double n = -.10 * turbulence(noise, world, 0.2);
-                        //n = turbulence(world, 1);
 
                         // scale and bias from[-1..1] to [0..1] for coloring.
-                        n = osg::clampBetween( n+0.5, 0.0, 1.0 );                        
+                        double n = osg::clampBetween( values[s]+0.5, 0.0, 1.0 );
 
                         write(osg::Vec4f(n,n,n,1), s, t);
                     }
@@ -174,26 +198,27 @@ namespace osgEarth { namespace Drivers { namespace Noise
             double bias  = _options.bias().get();
             double scale = _options.scale().get();
         
-            //Initialize the heightfield
-            for (unsigned int c = 0; c < hf->getNumColumns(); c++) 
+            std::vector<osg::Vec3d> row(hf->getNumColumns());
+            std::vector<double>     values;
+
+            //Initialize the heightfield, a row at a time
+            for (unsigned int r = 0; r < hf->getNumRows(); r++)
             {
-                for (unsigned int r = 0; r < hf->getNumRows(); r++)
-                {                
-                    double lon = key.getExtent().xMin() + (double)c * dx;
-                    double lat = key.getExtent().yMin() + (double)r * dy;
+                double lat = key.getExtent().yMin() + (double)r * dy;
 
-                    osg::Vec3d world(lon, lat, 0.0);
-                    if ( srs->isGeographic() )
-                    {
-                        srs->transform(world, srs->getECEF(), world);
-                        world.normalize();
-                    }
+                for (unsigned int c = 0; c < hf->getNumColumns(); c++) 
+                {
+                    double lon = key.getExtent().xMin() + (double)c * dx;
+                    row[c].set(lon, lat, 0.0);
+                }
 
-                    double n = sample( world );
+                sampleRow(row, srs, true, values);
 
+                for (unsigned int c = 0; c < hf->getNumColumns(); c++) 
+                {
                     // Scale the noise value.
                     double h = osg::clampBetween(
-                        (float)(bias + scale * n),
+                        (float)(bias + scale * values[c]),
                         *_options.minElevation(),
                         *_options.maxElevation() );
 
@@ -235,39 +260,41 @@ namespace osgEarth { namespace Drivers { namespace Noise
                 udy = srs->transformUnits(dy, ecef, ex.south()+0.5*dy);
             }
 
-            double z = 0.0;
-            std::vector<osg::Vec3d> v(4);
-            double samples[4];
+            // Each pixel's neighbors are the adjacent posts, so sample the noise
+            // once per post over the image plus a one-post border and share
+            // the heights between pixels.
+            int cols = image->s() + 2;
+            int rows = image->t() + 2;
+            std::vector<double> heights(cols*rows);
+
+            std::vector<osg::Vec3d> row(cols);
+            std::vector<double>     values;
 
-            for(int s=0; s<image->s(); ++s)
+            for(int t=0; t<rows; ++t)
             {
-                for(int t=0; t<image->t(); ++t)
+                double y = ex.yMin() + (double)(t-1) * dy;
+                for(int s=0; s<cols; ++s)
                 {
-                    double x = ex.xMin() + (double)s * dx;
-                    double y = ex.yMin() + (double)t * dy;
+                    row[s].set(ex.xMin() + (double)(s-1) * dx, y, 0.0);
+                }
 
-                    if ( isGeo )
-                    {
-                        v[0].set(x-dx, y, z);
-                        v[1].set(x+dx, y, z);
-                        v[2].set(x, y+dy, z);
-                        v[3].set(x, y-dy, z);
-                        srs->transform(v, ecef);
-                        for(int i=0; i<4; ++i )
-                            samples[i] = bias + scale * sample(v[i]);
-                    }
-                    else
-                    {
-                        samples[0] = bias + scale * sample(x-dx, y, z);
-                        samples[1] = bias + scale * sample(x+dx, y, z);
-                        samples[2] = bias + scale * sample(x, y+dy, z);
-                        samples[3] = bias + scale * sample(x, y-dy, z);
-                    }
+                sampleRow(row, srs, false, values);
 
-                    osg::Vec3d west (-udx,    0, samples[0]);
-                    osg::Vec3d east ( udx,    0, samples[1]);
-                    osg::Vec3d north(   0,  udy, samples[2]);
-                    osg::Vec3d south(   0, -udy, samples[3]);
+                for(int s=0; s<cols; ++s)
+                {
+                    heights[t*cols + s] = bias + scale * values[s];
+                }
+            }
+
+            for(int t=0; t<image->t(); ++t)
+            {
+                for(int s=0; s<image->s(); ++s)
+                {
+                    // (s,t) in the image is (s+1,t+1) in the height grid.
+                    osg::Vec3d west (-udx,    0, heights[(t+1)*cols + s    ]);
+                    osg::Vec3d east ( udx,    0, heights[(t+1)*cols + s + 2]);
+                    osg::Vec3d north(   0,  udy, heights[(t+2)*cols + s + 1]);
+                    osg::Vec3d south(   0, -udy, heights[(t  )*cols + s + 1]);
 
                     // calculate the normal at the center point.
                     osg::Vec3 normal = (east-west) ^ (north-south);
@@ -20,6 +20,7 @@
 #include "ElevationProxyImageLayer"
 #include "SimpleOceanShaders"
 #include <osgEarth/Map>
+#include <osgEarth/TerrainEngineNode>
 #include <osgEarth/ShaderFactory>
 #include <osgEarth/TextureCompositor>
 #include <osgEarth/ImageUtils>
@@ -96,11 +97,86 @@ _options      ( options )
 }
 
 
+SimpleOceanNode::~SimpleOceanNode()
+{
+    uninstallTerrainEffect();
+}
+
+
+osg::Texture2D*
+SimpleOceanNode::createSurfaceTexture() const
+{
+    osg::ref_ptr<osg::Image> surfaceImage;
+    if ( _options.textureURI().isSet() )
+    {
+        //TODO: enable cache support here?
+        surfaceImage = _options.textureURI()->getImage();
+    }
+
+    if ( !surfaceImage.valid() )
+    {
+        surfaceImage = createSurfaceImage();
+    }
+
+    osg::Texture2D* tex = 0L;
+    if ( surfaceImage.valid() )
+    {
+        tex = new osg::Texture2D( surfaceImage.get() );
+        tex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR_MIPMAP_LINEAR );
+        tex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
+        tex->setWrap  ( osg::Texture::WRAP_S, osg::Texture::REPEAT );
+        tex->setWrap  ( osg::Texture::WRAP_T, osg::Texture::REPEAT );
+    }
+    return tex;
+}
+
+
+void
+SimpleOceanNode::installTerrainEffect()
+{
+    if ( _parentMapNode.valid() && _parentMapNode->getTerrainEngine() )
+    {
+        if ( _options.maskLayer().isSet() )
+        {
+            OE_WARN << LC << "The mask layer is not used when the ocean is a terrain effect" << std::endl;
+        }
+
+        _effect = new SimpleOceanTerrainEffect( _options, createSurfaceTexture() );
+        _parentMapNode->getTerrainEngine()->addEffect( _effect.get() );
+        setSeaLevel( *_options.seaLevel() );
+    }
+}
+
+
+void
+SimpleOceanNode::uninstallTerrainEffect()
+{
+    if ( _effect.valid() )
+    {
+        osg::ref_ptr<MapNode> mapNode;
+        if ( _parentMapNode.lock(mapNode) && mapNode->getTerrainEngine() )
+        {
+            mapNode->getTerrainEngine()->removeEffect( _effect.get() );
+        }
+        _effect = 0L;
+    }
+}
+
+
 void
 SimpleOceanNode::rebuild()
 {
     this->removeChildren( 0, this->getNumChildren() );
 
+    uninstallTerrainEffect();
+
+    // draw the ocean in the map's own tiles; no ocean terrain of our own.
+    if ( _options.terrainEffect() == true )
+    {
+        installTerrainEffect();
+        return;
+    }
+
     if ( _parentMapNode.valid() )
     {
         const MapOptions&     parentMapOptions     = _parentMapNode->getMap()->getMapOptions();
@@ -209,27 +285,10 @@ SimpleOceanNode::rebuild()
         ss->setRenderBinDetails( 15, "RenderBin" );
 
         // load up a surface texture
-        osg::ref_ptr<osg::Image> surfaceImage;
         ss->getOrCreateUniform( "ocean_has_surface_tex", osg::Uniform::BOOL )->set( false );
-        if ( _options.textureURI().isSet() )
-        {
-            //TODO: enable cache support here?
-            surfaceImage = _options.textureURI()->getImage();
-        }
-
-        if ( !surfaceImage.valid() )
-        {
-            surfaceImage = createSurfaceImage();
-        }
-
-        if ( surfaceImage.valid() )
+        osg::Texture2D* tex = createSurfaceTexture();
+        if ( tex )
         {
-            osg::Texture2D* tex = new osg::Texture2D( surfaceImage.get() );
-            tex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR_MIPMAP_LINEAR );
-            tex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
-            tex->setWrap  ( osg::Texture::WRAP_S, osg::Texture::REPEAT );
-            tex->setWrap  ( osg::Texture::WRAP_T, osg::Texture::REPEAT );
-
             ss->setTextureAttributeAndModes( 2, tex, 1 );
             ss->getOrCreateUniform( "ocean_surface_tex", osg::Uniform::SAMPLER_2D )->set( 2 );
             ss->getOrCreateUniform( "ocean_has_surface_tex", osg::Uniform::BOOL )->set( true );
@@ -260,6 +319,10 @@ SimpleOceanNode::applyOptions()
 {
     setSeaLevel( *_options.seaLevel() );
 
+    // the terrain effect takes its options when it's created.
+    if ( _effect.valid() )
+        return;
+
     _lowFeather->set( *_options.lowFeatherOffset() );
     _highFeather->set( *_options.highFeatherOffset() );
     _baseColor->set( *_options.baseColor() );
@@ -271,5 +334,8 @@ SimpleOceanNode::applyOptions()
 void
 SimpleOceanNode::onSetSeaLevel()
 {
-    _seaLevel->set( getSeaLevel() );
+    if ( _effect.valid() )
+        _effect->setSeaLevel( getSeaLevel() );
+    else if ( _seaLevel.valid() )
+        _seaLevel->set( getSeaLevel() );
 }
@@ -0,0 +1,126 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "SimpleOceanTerrainEffect"
+#include "SimpleOceanShaders"
+#include <osgEarth/TerrainEngineNode>
+#include <osgEarth/TextureCompositor>
+#include <osgEarth/VirtualProgram>
+
+#define LC "[SimpleOceanTerrainEffect] "
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers::SimpleOcean;
+
+
+SimpleOceanTerrainEffect::SimpleOceanTerrainEffect(const SimpleOceanOptions& options,
+                                                   osg::Texture2D*           surfaceTexture) :
+TerrainEffect  (),
+_unit          ( -1 ),
+_surfaceTexture( surfaceTexture )
+{
+    _seaLevel = new osg::Uniform(osg::Uniform::FLOAT, "ocean_seaLevel");
+    _seaLevel->set( *options.seaLevel() );
+    _uniforms.push_back( _seaLevel.get() );
+
+    _uniforms.push_back( new osg::Uniform("ocean_lowFeather",  *options.lowFeatherOffset()) );
+    _uniforms.push_back( new osg::Uniform("ocean_highFeather", *options.highFeatherOffset()) );
+    _uniforms.push_back( new osg::Uniform("ocean_baseColor",   osg::Vec4f(*options.baseColor())) );
+    _uniforms.push_back( new osg::Uniform("ocean_max_range",   *options.maxRange()) );
+    _uniforms.push_back( new osg::Uniform("ocean_fade_range",  *options.fadeRange()) );
+
+    _surfaceSampler = new osg::Uniform(osg::Uniform::SAMPLER_2D, "ocean_surface_tex");
+}
+
+
+void
+SimpleOceanTerrainEffect::setSeaLevel(float value)
+{
+    _seaLevel->set( value );
+}
+
+
+void
+SimpleOceanTerrainEffect::onInstall(TerrainEngineNode* engine)
+{
+    if ( engine )
+    {
+        osg::StateSet* stateset = engine->getOrCreateStateSet();
+
+        for(unsigned i=0; i<_uniforms.size(); ++i)
+            stateset->addUniform( _uniforms[i].get() );
+
+        bool hasSurfaceTex = false;
+        if ( _surfaceTexture.valid() )
+        {
+            if ( engine->getResources()->reserveTextureImageUnit(_unit, "SimpleOcean") )
+            {
+                stateset->setTextureAttributeAndModes( _unit, _surfaceTexture.get(), osg::StateAttribute::ON );
+                stateset->addUniform( _surfaceSampler.get() );
+                _surfaceSampler->set( _unit );
+                hasSurfaceTex = true;
+            }
+            else
+            {
+                OE_WARN << LC << "Failed to reserve a texture image unit; no surface texture." << std::endl;
+            }
+        }
+        stateset->getOrCreateUniform( "ocean_has_surface_tex", osg::Uniform::BOOL )->set( hasSurfaceTex );
+
+        // the coloring runs after the terrain's image layers.
+        VirtualProgram* vp = VirtualProgram::getOrCreate(stateset);
+        vp->setFunction( "oe_ocean_terrain_model",    source_vertTerrainModel, ShaderComp::LOCATION_VERTEX_MODEL, 0.5f );
+        vp->setFunction( "oe_ocean_terrain_view",     source_vertTerrainView,  ShaderComp::LOCATION_VERTEX_VIEW, 0.5f );
+        vp->setFunction( "oe_ocean_terrain_fragment", source_fragTerrain,      ShaderComp::LOCATION_FRAGMENT_COLORING, 0.6f );
+    }
+}
+
+
+void
+SimpleOceanTerrainEffect::onUninstall(TerrainEngineNode* engine)
+{
+    if ( engine )
+    {
+        osg::StateSet* stateset = engine->getStateSet();
+        if ( stateset )
+        {
+            for(unsigned i=0; i<_uniforms.size(); ++i)
+                stateset->removeUniform( _uniforms[i].get() );
+
+            stateset->removeUniform( _surfaceSampler.get() );
+            stateset->removeUniform( "ocean_has_surface_tex" );
+
+            if ( _unit >= 0 )
+                stateset->removeTextureAttribute( _unit, osg::StateAttribute::TEXTURE );
+
+            VirtualProgram* vp = VirtualProgram::get(stateset);
+            if ( vp )
+            {
+                vp->removeShader( "oe_ocean_terrain_model" );
+                vp->removeShader( "oe_ocean_terrain_view" );
+                vp->removeShader( "oe_ocean_terrain_fragment" );
+            }
+        }
+
+        if ( _unit >= 0 )
+        {
+            engine->getResources()->releaseTextureImageUnit( _unit );
+            _unit = -1;
+        }
+    }
+}
@@ -21,6 +21,7 @@
 #include <osgEarth/FileUtils>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/Registry>
+#include <osgEarth/URLTemplate>
 
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
@@ -47,7 +48,7 @@ class QuadKeySource : public TileSource
 {
 public:
     QuadKeySource(const TileSourceOptions& options) : 
-      TileSource(options), _options(options), _rotate_iter(0u)
+      TileSource(options), _options(options)
     {
         //nop
     }
@@ -74,15 +75,8 @@ public:
 
 
         
-        _template = uri.full();
-        
-        _rotateStart = _template.find("[");
-        _rotateEnd   = _template.find("]");
-        if ( _rotateStart != std::string::npos && _rotateEnd != std::string::npos && _rotateEnd-_rotateStart > 1 )
-        {
-            _rotateString  = _template.substr(_rotateStart, _rotateEnd-_rotateStart+1);
-            _rotateChoices = _template.substr(_rotateStart+1, _rotateEnd-_rotateStart-1);
-        }
+        // parse the template once; tile URLs are built from its tokens.
+        _template = URLTemplate( uri.full() );
 
         _format = _options.format().isSet() 
             ? *_options.format()
@@ -98,25 +92,8 @@ public:
         unsigned x, y;
         key.getTileXY( x, y );
 
-        std::string location = _template;
-
-        std::string quadkey = getQuadKey(key);
-
-        // support OpenLayers template style:
-        replaceIn( location, "${key}", quadkey );
-
-        // failing that, legacy osgearth style:
-        replaceIn( location, "{key}", quadkey );
-
-        std::string cacheKey;
-
-        if ( !_rotateChoices.empty() )
-        {
-            cacheKey = location;
-            unsigned index = (++_rotate_iter) % _rotateChoices.size();
-            replaceIn( location, _rotateString, Stringify() << _rotateChoices[index] );
-        }
-
+        std::string location, cacheKey;
+        _template.expand( x, y, key.getLevelOfDetail(), location, &cacheKey );
 
         URI uri( location, _options.url()->context() );
         if ( !cacheKey.empty() )
@@ -133,37 +110,9 @@ public:
     }
 
 private:
-    std::string getQuadKey(const TileKey& key)
-    {
-        unsigned int tile_x, tile_y;
-        key.getTileXY(tile_x, tile_y);
-        unsigned int lod = key.getLevelOfDetail();
-
-        std::stringstream ss;
-        for( unsigned i = (int)lod+1; i > 0; i-- )
-        {
-            char digit = '0';
-            unsigned mask = 1 << (i-1);
-            if ( (tile_x & mask) != 0 )
-            {
-                digit++;
-            }
-            if ( (tile_y & mask) != 0 )
-            {
-                digit += 2;
-            }
-            ss << digit;
-        }
-        return ss.str();
-    }
-
     const QuadKeyOptions   _options;
     std::string            _format;
-    std::string            _template;
-    std::string            _rotateChoices;
-    std::string            _rotateString;
-    std::string::size_type _rotateStart, _rotateEnd;
-    OpenThreads::Atomic    _rotate_iter;
+    URLTemplate            _template;
 
     osg::ref_ptr<osgDB::Options> _dbOptions;
 };
@@ -31,9 +31,12 @@
 #include <osg/ImageStream>
 #include <osg/ImageSequence>
 
+#include <OpenThreads/ScopedLock>
+
 #include <sstream>
 #include <iomanip>
 #include <string.h>
+#include <time.h>
 
 #include "RefreshOptions"
 
@@ -50,7 +53,8 @@ class LoadImageOperation : public osg::Operation
 public:
     LoadImageOperation(const std::string& filename):
       _filename(filename),
-          _done(false)
+          _done(false),
+          _hash(0u)
       {
       }
 
@@ -64,42 +68,106 @@ public:
               _image = osgDB::readImageFile( _filename );                                     
               if (_image.valid()) break;              
           }
+
+          // fingerprint the pixels so an unchanged reload doesn't touch any tiles.
+          if (_image.valid())
+          {
+              _hash = 2166136261u;
+              const unsigned char* data = _image->data();
+              for (unsigned int i = 0; i < _image->getTotalSizeInBytes(); ++i)
+              {
+                  _hash = (_hash ^ data[i]) * 16777619u;
+              }
+          }
           _done = true;
       }
 
       bool _done;
       osg::ref_ptr< osg::Image > _image;
       std::string _filename;
+      unsigned _hash;
 };
 
 
-
 /*
- * RefreshImage is a special ImageStream that reloads an image from a filename and
- * updates it's internal image data.
+ * RefreshLoader polls the source image for all the tiles of a refresh layer.
+ * Each refresh reads the source once no matter how many tiles are showing,
+ * a local file is only read again when its modification time changes, and
+ * the revision only advances when the pixels changed.
  */
-class RefreshImage : public osg::ImageStream
+class RefreshLoader : public osg::Referenced
 {
 public:
-
-    RefreshImage(const std::string& filename, double time):
+    RefreshLoader(const std::string& filename, double time):
       _filename(filename),
           _time(time),
           _lastUpdateTime(0),
-          osg::ImageStream()
-      {                    
-          osg::ref_ptr< osg::Image > image = osgDB::readImageFile( filename );
-          if (image.valid()) copyImage( image.get() );
-      }      
+          _lastFrame(~0u),
+          _revision(0u),
+          _hash(0u),
+          _loadedModTime(0),
+          _pendingModTime(0)
+      {
+      }
 
+      /** Current revision of the source image; starts at 1 once loaded. */
+      unsigned getRevision() const { return _revision; }
+
+      /** The most recently loaded source image, reading it now if necessary. */
+      osg::Image* getImage()
+      {
+          OpenThreads::ScopedLock< OpenThreads::Mutex > lock(_mutex);
+          if (!_image.valid())
+          {
+              osg::ref_ptr< LoadImageOperation > op = new LoadImageOperation(_filename);
+              (*op)(0L);
+              accept( op.get() );
+          }
+          return _image.get();
+      }
 
       /**
-       * Tell OpenSceneGraph that we require an update call
+       * Picks up a finished load and queues the next one when it's due.
+       * Every tile calls this from its update; only the first call per frame does anything.
        */
-      virtual bool requiresUpdateCall() const { return true; }
-
-      ~RefreshImage()
+      void update(const osg::FrameStamp* fs)
       {
+          if (fs)
+          {
+              if (fs->getFrameNumber() == _lastFrame)
+                  return;
+              _lastFrame = fs->getFrameNumber();
+          }
+
+          OpenThreads::ScopedLock< OpenThreads::Mutex > lock(_mutex);
+
+          if (_loadImageOp.valid() && _loadImageOp->_done)
+          {
+              _loadedModTime = _pendingModTime;
+              accept( _loadImageOp.get() );
+              _lastUpdateTime = osg::Timer::instance()->time_s();
+              _loadImageOp = 0;
+          }
+
+          double time = osg::Timer::instance()->time_s();
+          //If we've let enough time elapse and we're not waiting on an existing load image operation then add one to the queue
+          if (!_loadImageOp.valid() && (time - _lastUpdateTime > _time))
+          {
+              // skip the read if the file is untouched since the last one.
+              TimeStamp modTime = getLastModifiedTime( _filename );
+              if (modTime != 0 && modTime == _loadedModTime)
+              {
+                  _lastUpdateTime = time;
+                  return;
+              }
+
+              // a timestamp this recent could still change within the same second,
+              // so don't rely on it to skip the next read.
+              _pendingModTime = (modTime != 0 && ::time(0) - modTime > 1) ? modTime : 0;
+
+              _loadImageOp = new LoadImageOperation(_filename);
+              getOperationsThread()->add( _loadImageOp.get() );
+          }
       }
 
       static osg::OperationsThread* getOperationsThread() 
@@ -124,21 +192,60 @@ public:
 
       }
 
-      //If the loadImageOp is complete then update the contents of this image with the new pixels
-      void updateImage() 
+private:
+      // takes the result of a load; bumps the revision if the pixels changed. Call with _mutex held.
+      void accept(LoadImageOperation* op)
       {
-          if (_loadImageOp.valid() && _loadImageOp->_done)
-          {              
-              osg::ref_ptr< osg::Image > image = _loadImageOp->_image.get();
-              if (image.valid())
-              {
-                  copyImage( image.get() );
-              }
-              _lastUpdateTime = osg::Timer::instance()->time_s();
-              _loadImageOp = 0;
+          if (op->_image.valid() && (!_image.valid() || op->_hash != _hash))
+          {
+              _image = op->_image.get();
+              _hash = op->_hash;
+              ++_revision;
           }
       }
 
+      std::string _filename;
+      double _time;
+      double _lastUpdateTime;
+      unsigned _lastFrame;
+      volatile unsigned _revision;
+      unsigned _hash;
+      TimeStamp _loadedModTime;
+      TimeStamp _pendingModTime;
+      osg::ref_ptr< osg::Image > _image;
+      osg::ref_ptr< LoadImageOperation > _loadImageOp;
+      OpenThreads::Mutex _mutex;
+};
+
+
+
+/*
+ * RefreshImage is a special ImageStream that shows the image from its layer's
+ * RefreshLoader and updates its internal image data when the loader's revision changes.
+ */
+class RefreshImage : public osg::ImageStream
+{
+public:
+
+    RefreshImage(RefreshLoader* loader):
+      _loader(loader),
+          _revision(0),
+          osg::ImageStream()
+      {                    
+          osg::Image* image = _loader->getImage();
+          _revision = _loader->getRevision();
+          if (image) copyImage( image );
+      }      
+
+
+      /**
+       * Tell OpenSceneGraph that we require an update call
+       */
+      virtual bool requiresUpdateCall() const { return true; }
+
+      ~RefreshImage()
+      {
+      }
 
       /**
        * Copies the contents of the given image into this image.
@@ -156,23 +263,18 @@ public:
       /** update method for osg::Image subclasses that update themselves during the update traversal.*/
       virtual void update(osg::NodeVisitor* nv)
       {                               
-          updateImage();
-          double time = osg::Timer::instance()->time_s();
-          osg::Timer_t ticks = osg::Timer::instance()->tick();          
-          //If we've let enough time elapse and we're not waiting on an existing load image operation then add one to the queue
-          if (!_loadImageOp.valid() && (time - _lastUpdateTime > _time))
+          _loader->update( nv ? nv->getFrameStamp() : 0L );
+
+          // only re-upload when the source actually changed.
+          if (_loader->getRevision() != _revision)
           {
-              std::stringstream ss;
-              std::string file = ss.str();              
-              _loadImageOp = new LoadImageOperation(_filename);
-              getOperationsThread()->add( _loadImageOp.get() );
+              _revision = _loader->getRevision();
+              copyImage( _loader->getImage() );
           }
       }
 
-      std::string _filename;
-      double _time;
-      double _lastUpdateTime;
-      osg::ref_ptr< LoadImageOperation > _loadImageOp;      
+      osg::ref_ptr< RefreshLoader > _loader;
+      unsigned _revision;
 };
 
 
@@ -187,6 +289,7 @@ public:
     Status initialize(const osgDB::Options* dbOptions)
     {        
         setProfile( osgEarth::Registry::instance()->getGlobalGeodeticProfile() );
+        _loader = new RefreshLoader( _options.url()->full(), *_options.frequency() );
         return STATUS_OK;
     }
 
@@ -195,7 +298,7 @@ public:
         const TileKey&        key,
         ProgressCallback*     progress )
     {        
-        return new RefreshImage( _options.url()->full(), *_options.frequency());     
+        return new RefreshImage( _loader.get() );
     }
 
     bool isDynamic() const
@@ -216,6 +319,7 @@ public:
 
 private:
     const RefreshOptions      _options;
+    osg::ref_ptr<RefreshLoader> _loader;
     
 };
 
@@ -54,6 +54,104 @@ namespace
         return 0;
     }
 
+    // pushes the value of one attribute onto the stack.
+    void pushAttr(duk_context* ctx, const AttributeValue& value)
+    {
+        if ( !value.second.set )
+        {
+            duk_push_null(ctx);
+        }
+        else if ( value.first == ATTRTYPE_INT )
+        {
+            duk_push_number(ctx, (double)value.getInt());
+        }
+        else if ( value.first == ATTRTYPE_DOUBLE )
+        {
+            duk_push_number(ctx, value.getDouble());
+        }
+        else if ( value.first == ATTRTYPE_BOOL )
+        {
+            duk_push_boolean(ctx, value.getBool());
+        }
+        else
+        {
+            duk_push_string(ctx, value.getString().c_str());
+        }
+    }
+
+    // finds an attribute by its exact name, or else its lower-case name.
+    const AttributeValue* findAttr(const Feature* feature, const std::string& name)
+    {
+        const AttributeTable& attrs = feature->getAttrs();
+        AttributeTable::const_iterator i = attrs.find(name);
+        if ( i == attrs.end() )
+            i = attrs.find(osgEarth::toLower(name));
+        return i != attrs.end() ? &i->second : 0L;
+    }
+
+    // oe_duk_get_attr(ptr, name): value of one attribute, or undefined.
+    static duk_ret_t oe_duk_get_attr(duk_context* ctx)
+    {
+        const Feature* feature = reinterpret_cast<const Feature*>(duk_require_pointer(ctx, 0));
+        std::string name( duk_to_string(ctx, 1) );
+
+        const AttributeValue* value = findAttr(feature, name);
+        if ( value )
+            pushAttr(ctx, *value);
+        else
+            duk_push_undefined(ctx);
+        return 1;
+    }
+
+    // oe_duk_has_attr(ptr, name): whether the attribute exists.
+    static duk_ret_t oe_duk_has_attr(duk_context* ctx)
+    {
+        const Feature* feature = reinterpret_cast<const Feature*>(duk_require_pointer(ctx, 0));
+        std::string name( duk_to_string(ctx, 1) );
+        duk_push_boolean(ctx, findAttr(feature, name) != 0L);
+        return 1;
+    }
+
+    // oe_duk_get_attr_names(ptr): array of all attribute names.
+    static duk_ret_t oe_duk_get_attr_names(duk_context* ctx)
+    {
+        const Feature* feature = reinterpret_cast<const Feature*>(duk_require_pointer(ctx, 0));
+        const AttributeTable& attrs = feature->getAttrs();
+
+        duk_push_array(ctx);
+        duk_uarridx_t n = 0;
+        for( AttributeTable::const_iterator i = attrs.begin(); i != attrs.end(); ++i )
+        {
+            duk_push_string(ctx, i->first.c_str());
+            duk_put_prop_index(ctx, -2, n++);
+        }
+        return 1;
+    }
+
+    // oe_duk_get_attrs(ptr): object holding all the attributes (for engines without Proxy).
+    static duk_ret_t oe_duk_get_attrs(duk_context* ctx)
+    {
+        const Feature* feature = reinterpret_cast<const Feature*>(duk_require_pointer(ctx, 0));
+        const AttributeTable& attrs = feature->getAttrs();
+
+        duk_push_object(ctx);
+        for( AttributeTable::const_iterator i = attrs.begin(); i != attrs.end(); ++i )
+        {
+            pushAttr(ctx, i->second);
+            duk_put_prop_string(ctx, -2, i->first.c_str());
+        }
+        return 1;
+    }
+
+    // oe_duk_get_geometry(ptr): the feature geometry as a GeoJSON string.
+    static duk_ret_t oe_duk_get_geometry(duk_context* ctx)
+    {
+        const Feature* feature = reinterpret_cast<const Feature*>(duk_require_pointer(ctx, 0));
+        std::string json = GeometryUtils::geometryToGeoJSON( feature->getGeometry() );
+        duk_push_string(ctx, json.c_str());
+        return 1;
+    }
+
     static duk_ret_t oe_duk_save_feature(duk_context* ctx)
     {
         // stack: [ptr]
@@ -70,12 +168,13 @@ namespace
 
          // [ptr, global, feature]
 
-        if ( duk_get_prop_string(ctx, -1, "properties") && duk_is_object(ctx, -1) )
+        // only the properties the script assigned need saving:
+        if ( duk_get_prop_string(ctx, -1, "__changes") && duk_is_object(ctx, -1) )
         {
-            // [ptr, global, feature, props]
+            // [ptr, global, feature, changes]
             duk_enum(ctx, -1, 0);                       
         
-            // [ptr, global, feature, props, enum]
+            // [ptr, global, feature, changes, enum]
             while( duk_next(ctx, -1, 1/*get_value=true*/) )
             {
                 std::string key( duk_get_string(ctx, -2) );
@@ -107,8 +206,11 @@ namespace
             // [ptr, global, feature]
         }
 
-        // save the geometry, if set:
-        if ( duk_get_prop_string(ctx, -1, "geometry")&& duk_is_object(ctx, -1) )
+        // save the geometry, if the script loaded or replaced it:
+        bool geometryLoaded = duk_get_prop_string(ctx, -1, "__geometryLoaded") && duk_to_boolean(ctx, -1);
+        duk_pop(ctx);
+
+        if ( geometryLoaded && duk_get_prop_string(ctx, -1, "geometry") && duk_is_object(ctx, -1) )
         {
             // [ptr, global, feature, geometry]
             std::string json( duk_json_encode(ctx, -1) ); // [ptr, global, feature, json]
@@ -120,9 +222,11 @@ namespace
             duk_pop(ctx);
             // [ptr, global, feature]
         }
-        else
+        else if ( geometryLoaded )
         {
             // [ptr, global, feature, undefined]
+            duk_pop(ctx);
+            // [ptr, global, feature]
         }
         
         // [ptr, global, feature]
@@ -135,30 +239,74 @@ namespace
 
 namespace
 {
+    // Script that builds the global "feature" object around a native pointer.
+    // Attributes and geometry load from the native feature only when the script
+    // reads them; assignments collect in __changes for feature.save().
+    const char* s_bindFeatureScript =
+        "oe_duk_bind_feature = function(f) {"
+        "    var changes = {};"
+        "    Object.defineProperty(f, '__changes', {value:changes, writable:true});"
+        "    if ( typeof Proxy !== 'undefined' ) {"
+        "        f.properties = new Proxy(changes, {"
+        "            get: function(t, k) {"
+        "                return (k in t) ? t[k] : oe_duk_get_attr(f.__ptr, k); },"
+        "            has: function(t, k) {"
+        "                return (k in t) || oe_duk_has_attr(f.__ptr, k); },"
+        "            enumerate: function(t) {"
+        "                var names = oe_duk_get_attr_names(f.__ptr);"
+        "                for(var k in t) if (names.indexOf(k) < 0) names.push(k);"
+        "                return names; },"
+        "            ownKeys: function(t) {"
+        "                var names = oe_duk_get_attr_names(f.__ptr);"
+        "                for(var k in t) if (names.indexOf(k) < 0) names.push(k);"
+        "                return names; }"
+        "        });"
+        "    } else {"
+        "        f.properties = changes;"
+        "        var attrs = oe_duk_get_attrs(f.__ptr);"
+        "        for(var k in attrs) changes[k] = attrs[k];"
+        "    }"
+        "    Object.defineProperty(f, 'attributes', {get:function() {return f.properties;}});"
+        "    var setGeometry = function(g) {"
+        "        f.__geometryLoaded = true;"
+        "        Object.defineProperty(f, 'geometry', {value:g, writable:true, enumerable:true, configurable:true});"
+        "    };"
+        "    Object.defineProperty(f, 'geometry', {"
+        "        enumerable:true, configurable:true,"
+        "        get: function() {"
+        "            var g = oe_duk_bind_geometry_api(JSON.parse(oe_duk_get_geometry(f.__ptr)));"
+        "            setGeometry(g);"
+        "            return g; },"
+        "        set: setGeometry"
+        "    });"
+        "    f.save = function() {"
+        "        oe_duk_save_feature(this.__ptr);"
+        "    };"
+        "};";
+
     // Create a "feature" object in the global namespace.
     void setFeature(duk_context* ctx, Feature const* feature)
     {
-        std::string geojson = feature->getGeoJSON();
-        
         duk_push_global_object(ctx);                         // [global]
-        duk_push_string(ctx, geojson.c_str());               // [global, json]
-        duk_json_decode(ctx, -1);                            // [global, feature]
+        duk_push_object(ctx);                                // [global, feature]
+        duk_push_string(ctx, "Feature");                     // [global, feature, type]
+        duk_put_prop_string(ctx, -2, "type");                // [global, feature]
+        duk_push_number(ctx, (double)feature->getFID());     // [global, feature, id]
+        duk_put_prop_string(ctx, -2, "id");                  // [global, feature]
         duk_push_pointer(ctx, (void*)feature);               // [global, feature, ptr]
         duk_put_prop_string(ctx, -2, "__ptr");               // [global, feature]
-        duk_put_prop_string(ctx, -2, "feature");             // [global]
 
-        // add the save() function and the "attributes" alias.
-        duk_eval_string_noresult(ctx,
-            "feature.save = function() {"
-            "    oe_duk_save_feature(this.__ptr);"
-            "} ");
-
-        duk_eval_string_noresult(ctx,
-            "Object.defineProperty(feature, 'attributes', {get:function() {return feature.properties;}});");
-
-        GeometryAPI::bindToFeature(ctx);
+        // bind the lazy properties, geometry, and save() function:
+        duk_get_prop_string(ctx, -2, "oe_duk_bind_feature"); // [global, feature, func]
+        duk_dup(ctx, -2);                                    // [global, feature, func, feature]
+        if ( duk_pcall(ctx, 1) != 0 )                        // [global, feature, result]
+        {
+            OE_WARN << LC << duk_safe_to_string(ctx, -1) << std::endl;
+        }
+        duk_pop(ctx);                                        // [global, feature]
 
-        duk_pop(ctx); 
+        duk_put_prop_string(ctx, -2, "feature");             // [global]
+        duk_pop(ctx);                                        // []
     }
 }
 
@@ -200,9 +348,23 @@ DuktapeEngine::Context::initialize(const ScriptEngineOptions& options)
         duk_push_c_function(_ctx, oe_duk_save_feature, 1/*numargs*/); // [global, function]
         duk_put_prop_string(_ctx, -2, "oe_duk_save_feature");         // [global]
 
+        // lazy feature accessors
+        duk_push_c_function(_ctx, oe_duk_get_attr, 2);
+        duk_put_prop_string(_ctx, -2, "oe_duk_get_attr");
+        duk_push_c_function(_ctx, oe_duk_has_attr, 2);
+        duk_put_prop_string(_ctx, -2, "oe_duk_has_attr");
+        duk_push_c_function(_ctx, oe_duk_get_attr_names, 1);
+        duk_put_prop_string(_ctx, -2, "oe_duk_get_attr_names");
+        duk_push_c_function(_ctx, oe_duk_get_attrs, 1);
+        duk_put_prop_string(_ctx, -2, "oe_duk_get_attrs");
+        duk_push_c_function(_ctx, oe_duk_get_geometry, 1);
+        duk_put_prop_string(_ctx, -2, "oe_duk_get_geometry");
+
         GeometryAPI::install(_ctx);
 
         duk_pop(_ctx); // []
+
+        duk_eval_string_noresult(_ctx, s_bindFeatureScript);
     }
 }
 
@@ -275,3 +437,64 @@ DuktapeEngine::run(const std::string&   code,
         ScriptResult(resultString, true) :
         ScriptResult("", false, resultString);
 }
+
+void
+DuktapeEngine::run(const std::string&         code,
+                   const FeatureList&         features,
+                   std::vector<ScriptResult>& out_results,
+                   FilterContext const*       context)
+{
+    out_results.clear();
+    out_results.reserve( features.size() );
+
+    if (code.empty())
+    {
+        out_results.resize( features.size(), ScriptResult(EMPTY_STRING, false, "Script is empty.") );
+        return;
+    }
+
+#ifdef MAXIMUM_ISOLATION
+    // brand new context every time
+    Context c;
+    c.initialize( _options );
+    duk_context* ctx = c._ctx;
+#else
+    // cache the Context on a per-thread basis
+    Context& c = _contexts.get();
+    c.initialize( _options );
+    duk_context* ctx = c._ctx;
+#endif
+
+    // compile the snippet once, as eval code so each call returns the
+    // value of its last expression.
+    if ( duk_pcompile_string(ctx, DUK_COMPILE_EVAL, code.c_str()) != 0 ) // [ func ] or [ error ]
+    {
+        std::string error( duk_safe_to_string(ctx, -1) );
+        OE_WARN << LC << "Error: source =\n" << code << std::endl;
+        duk_pop(ctx); // []
+        out_results.resize( features.size(), ScriptResult("", false, error) );
+        return;
+    }
+
+    for( FeatureList::const_iterator f = features.begin(); f != features.end(); ++f )
+    {
+        if ( f->valid() )
+            setFeature(ctx, f->get());
+
+        duk_dup(ctx, -1);                                      // [ func, func ]
+        bool ok = (duk_pcall(ctx, 0) == 0);                    // [ func, "result" ]
+
+        std::string resultString;
+        const char* resultVal = duk_to_string(ctx, -1);
+        if ( resultVal )
+            resultString = resultVal;
+
+        duk_pop(ctx);                                          // [ func ]
+
+        out_results.push_back( ok ?
+            ScriptResult(resultString, true) :
+            ScriptResult("", false, resultString) );
+    }
+
+    duk_pop(ctx); // []
+}
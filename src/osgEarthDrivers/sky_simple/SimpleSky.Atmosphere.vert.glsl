@@ -24,6 +24,8 @@ uniform float atmos_fScaleDepth;      // The scale depth
 uniform float atmos_fScaleOverScaleDepth;     // fScale / fScaleDepth 	
 uniform int atmos_nSamples; 	
 uniform float atmos_fSamples; 				
+uniform bool atmos_useLUT;            // whether to read the optical depth from atmos_lut
+uniform sampler2D atmos_lut;          // optical depth: s=altitude, t=cos(angle from up)
 
 varying vec3 atmos_v3Direction; 
 varying vec3 atmos_mieColor; 
@@ -44,6 +46,19 @@ float atmos_scale(float fCos)
     return atmos_fScaleDepth * exp(-0.00287 + x*(0.459 + x*(3.83 + x*(-6.80 + x*5.25)))); 
 } 
 
+// Density ratio at a height (y) and the optical depth from there to the edge of
+// the atmosphere along a direction with the given cosine to the up vector (x).
+vec2 atmos_opticalDepth(in float fHeight, in float fCos)
+{
+    if ( atmos_useLUT )
+    {
+        vec2 uv = vec2(clamp((fHeight-atmos_fInnerRadius)*atmos_fScale, 0.0, 1.0), fCos*0.5+0.5);
+        return texture2DLod(atmos_lut, uv, 0.0).rg;
+    }
+    float fDepth = exp(atmos_fScaleOverScaleDepth * (atmos_fInnerRadius - fHeight));
+    return vec2(fDepth*atmos_scale(fCos), fDepth);
+}
+
 void atmos_SkyFromSpace(void) 
 { 
     // Get the ray from the camera to the vertex and its length (which is the far point of the ray passing through the atmosphere) 
@@ -63,8 +78,7 @@ void atmos_SkyFromSpace(void)
     vec3 v3Start = vVec + v3Ray * fNear; 			
     fFar -= fNear; 	
     float fStartAngle = dot(v3Ray, v3Start) / atmos_fOuterRadius; 			
-    float fStartDepth = exp(-1.0 / atmos_fScaleDepth); 
-    float fStartOffset = fStartDepth*atmos_scale(fStartAngle); 		
+    float fStartOffset = atmos_opticalDepth(atmos_fOuterRadius, fStartAngle).x; 		
 
     // Initialize the atmos_ing loop variables 	
     float fSampleLength = fFar / atmos_fSamples; 		
@@ -78,10 +92,12 @@ void atmos_SkyFromSpace(void)
     for(int i=0; i<atmos_nSamples; i++) 		
     { 
         float fHeight = length(v3SamplePoint); 			
-        float fDepth = exp(atmos_fScaleOverScaleDepth * (atmos_fInnerRadius - fHeight)); 
-        float fLightAngle = dot(atmos_v3LightDir, v3SamplePoint) / fHeight; 		
-        float fCameraAngle = dot(v3Ray, v3SamplePoint) / fHeight; 			
-        float fscatter = (fStartOffset + fDepth*(atmos_scale(fLightAngle) - atmos_scale(fCameraAngle))); 	
+        float fLightAngle = dot(atmos_v3LightDir, v3SamplePoint) / fHeight; 
+        float fCameraAngle = dot(v3Ray, v3SamplePoint) / fHeight; 
+        vec2 v2Light = atmos_opticalDepth(fHeight, fLightAngle); 
+        vec2 v2Camera = atmos_opticalDepth(fHeight, fCameraAngle); 
+        float fDepth = v2Light.y; 
+        float fscatter = fStartOffset + v2Light.x - v2Camera.x; 
         v3Attenuate = exp(-fscatter * (atmos_v3InvWavelength * atmos_fKr4PI + atmos_fKm4PI)); 	
         v3FrontColor += v3Attenuate * (fDepth * fScaledLength); 					
         v3SamplePoint += v3SampleRay; 		
@@ -106,9 +122,8 @@ void atmos_SkyFromAtmosphere(void)
     // Calculate the ray's starting position, then calculate its atmos_ing offset 
     vec3 v3Start = vVec; 
     float fHeight = length(v3Start); 		
-    float fDepth = exp(atmos_fScaleOverScaleDepth * (atmos_fInnerRadius - atmos_fCameraHeight)); 
     float fStartAngle = dot(v3Ray, v3Start) / fHeight; 	
-    float fStartOffset = fDepth*atmos_scale(fStartAngle); 
+    float fStartOffset = atmos_opticalDepth(atmos_fCameraHeight, fStartAngle).x; 
 
     // Initialize the atmos_ing loop variables 		
     float fSampleLength = fFar / atmos_fSamples; 			
@@ -122,10 +137,12 @@ void atmos_SkyFromAtmosphere(void)
     for(int i=0; i<atmos_nSamples; i++) 			
     { 	
         float fHeight = length(v3SamplePoint); 	
-        float fDepth = exp(atmos_fScaleOverScaleDepth * (atmos_fInnerRadius - fHeight)); 
         float fLightAngle = dot(atmos_v3LightDir, v3SamplePoint) / fHeight; 
-        float fCameraAngle = dot(v3Ray, v3SamplePoint) / fHeight; 	
-        float fscatter = (fStartOffset + fDepth*(atmos_scale(fLightAngle) - atmos_scale(fCameraAngle))); 	
+        float fCameraAngle = dot(v3Ray, v3SamplePoint) / fHeight; 
+        vec2 v2Light = atmos_opticalDepth(fHeight, fLightAngle); 
+        vec2 v2Camera = atmos_opticalDepth(fHeight, fCameraAngle); 
+        float fDepth = v2Light.y; 
+        float fscatter = fStartOffset + v2Light.x - v2Camera.x; 
         v3Attenuate = exp(-fscatter * (atmos_v3InvWavelength * atmos_fKr4PI + atmos_fKm4PI)); 	
         v3FrontColor += v3Attenuate * (fDepth * fScaledLength); 		
         v3SamplePoint += v3SampleRay; 		
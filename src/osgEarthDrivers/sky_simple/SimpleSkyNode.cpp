@@ -66,6 +66,9 @@ using namespace osgEarth::Drivers::SimpleSky;
 
 #define TWO_PI 6.283185307179586476925286766559
 
+// scale depth of the atmosphere (fraction of its thickness where the density is average)
+#define RAYLEIGH_SCALE_DEPTH 0.25f
+
 //---------------------------------------------------------------------------
 
 namespace
@@ -184,6 +187,49 @@ namespace
 
         return geom;
     }
+
+    // Precomputes the atmosphere's optical depth so the sky shader can look
+    // it up instead of evaluating it at every sample point. Indexed by the
+    // normalized altitude [0..1] (s) and the cosine of the angle from the up
+    // vector, remapped to [0..1] (t). Red holds the optical depth along the
+    // ray (O'Neil's scale function times the density); green holds the
+    // density ratio at the altitude.
+    osg::Texture2D* s_makeOpticalDepthLUT(float scaleDepth)
+    {
+        const int numHeights = 64;
+        const int numAngles  = 256;
+
+        osg::Image* image = new osg::Image();
+        image->allocateImage(numHeights, numAngles, 1, GL_RGBA, GL_FLOAT);
+        image->setInternalTextureFormat(GL_RGBA32F_ARB);
+
+        for(int t=0; t<numAngles; ++t)
+        {
+            double fCos = -1.0 + 2.0*(double)t/(double)(numAngles-1);
+            double x = 1.0 - fCos;
+            double fScale = scaleDepth * exp(-0.00287 + x*(0.459 + x*(3.83 + x*(-6.80 + x*5.25))));
+
+            float* ptr = (float*)image->data(0, t);
+            for(int s=0; s<numHeights; ++s)
+            {
+                double height = (double)s/(double)(numHeights-1);
+                double fDepth = exp(-height/scaleDepth);
+                *ptr++ = (float)(fDepth*fScale);
+                *ptr++ = (float)fDepth;
+                *ptr++ = 0.0f;
+                *ptr++ = 1.0f;
+            }
+        }
+
+        osg::Texture2D* tex = new osg::Texture2D(image);
+        tex->setResizeNonPowerOfTwoHint(false);
+        tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+        tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+        tex->setWrap  (osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+        tex->setWrap  (osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+        tex->setUnRefImageDataAfterApply(true);
+        return tex;
+    }
 }
 
 //---------------------------------------------------------------------------
@@ -441,7 +487,7 @@ SimpleSkyNode::makeSceneLighting()
     float Km4PI = Km * 4.0f * osg::PI;
     float ESun = 15.0f;
     float MPhase = -.095f;
-    float RayleighScaleDepth = 0.25f;
+    float RayleighScaleDepth = RAYLEIGH_SCALE_DEPTH;
     int   Samples = 2;
     float Weather = 1.0f;
 
@@ -502,6 +548,21 @@ SimpleSkyNode::makeAtmosphere(const osg::EllipsoidModel* em)
         Shaders pkg;
         pkg.loadFunction( vp, pkg.Atmosphere_Vert );
         pkg.loadFunction( vp, pkg.Atmosphere_Frag );
+
+        // precomputed optical depth, so the scattering loop is a few texture
+        // fetches instead of exponentials (requires texture2DLod on a float
+        // texture, so it stays off for GLES).
+        bool useLUT =
+            _options.atmosphereLUT() == true &&
+            !Registry::capabilities().isGLES() &&
+            Registry::capabilities().supportsTexture2DLod();
+
+        if ( useLUT )
+        {
+            atmosSet->setTextureAttributeAndModes( 0, s_makeOpticalDepthLUT(RAYLEIGH_SCALE_DEPTH), osg::StateAttribute::ON );
+            atmosSet->getOrCreateUniform( "atmos_lut", osg::Uniform::SAMPLER_2D )->set( 0 );
+        }
+        atmosSet->getOrCreateUniform( "atmos_useLUT", osg::Uniform::BOOL )->set( useLUT );
     }
 
     // A nested camera isolates the projection matrix calculations so the node won't 
@@ -54,6 +54,7 @@ public:
       _options( options ),
 	  _tileSourceCache( true )
     {
+        _tileSourceCache.setMaxSize( *_options.maxOpenFiles() );
     }
 
     Status initialize( const osgDB::Options* dbOptions )
@@ -76,7 +77,7 @@ public:
     {        
         osg::Timer_t start = osg::Timer::instance()->tick();
         std::vector< std::string > files;
-        _index->getFiles( key.getExtent(), files );        
+        _index->getFiles( key.getExtent(), files, getPixelsPerTile() );
         osg::Timer_t end = osg::Timer::instance()->tick();
         OE_DEBUG << "Got " << files.size() << " files in " << osg::Timer::instance()->delta_m( start, end) << " ms" << std::endl;
 
@@ -113,6 +114,7 @@ public:
                     else
                     {
                         OE_WARN << "Failed to open " << files[i] << std::endl;
+                        source = 0L;
                     }
                     end = osg::Timer::instance()->tick();
                     //OE_NOTICE << "init took " << osg::Timer::instance()->delta_m( start, end) << "ms" << std::endl;
@@ -121,6 +123,9 @@ public:
 
             
             
+            if ( !source.valid() )
+                continue;
+
             start = osg::Timer::instance()->tick();
             osg::ref_ptr< osg::Image > image = source->createImage( key);
             end = osg::Timer::instance()->tick();
@@ -130,6 +130,22 @@ TMSTileSource::initialize(const osgDB::Options* dbOptions)
         return Status::Error( Stringify() << "Failed to establish a profile for " << tmsURI.full() );
     }
 
+    // Pick up a tile index written by the TMS packager, unless one was
+    // configured explicitly.
+    if ( !getTileIndex() && !tmsURI.isRemote() && !osgEarth::isPathToArchivedFile(tmsURI.full()) )
+    {
+        std::string indexFilename = osgDB::concatPaths( osgDB::getFilePath(tmsURI.full()), "tileindex.txt" );
+        if ( osgDB::fileExists(indexFilename) )
+        {
+            osg::ref_ptr<TileExistenceIndex> index = TileExistenceIndex::read( indexFilename );
+            if ( index.valid() && !index->empty() )
+            {
+                setTileIndex( index.get() );
+                OE_INFO << LC << "Using tile index " << indexFilename << std::endl;
+            }
+        }
+    }
+
     // resolve the writer
     if ( !tmsURI.isRemote() && !resolveWriter() )
     {
@@ -21,6 +21,7 @@
 #include <osgEarth/TileSource>
 #include <osgEarth/FileUtils>
 #include <osgEarth/ThreadingUtils>
+#include <osgEarth/Containers>
 #include <osgEarth/URI>
 #include <osgEarth/HTTPClient>
 
@@ -148,7 +149,7 @@ public:
         _options( in_options ),
         //_directory_structure( FLAT_TASK_DIRECTORIES ),
         _profile( osgEarth::Registry::instance()->getGlobalGeodeticProfile() ),
-        _maxNumTilesInCache( in_options.terrainTileCacheSize().value() ),
+        _tileCache( osg::maximum(in_options.terrainTileCacheSize().value(), 4) ),
         _initialized( false )
     {
     }
@@ -344,32 +345,85 @@ public:
         int level = key.getLevelOfDetail();
         unsigned int tile_x, tile_y;
         key.getTileXY( tile_x, tile_y );
-        
-        //int max_x = (2 << level) - 1;
-        int max_y = (1 << level) - 1;
-        
-        tile_y = max_y - tile_y;
 
-        osgTerrain::TileID tileID(level, tile_x, tile_y);
+        // osgEarth counts rows down from the top of the profile, VPB counts up from the bottom.
+        unsigned int numWide, numHigh;
+        key.getProfile()->getNumTiles( level, numWide, numHigh );
+        tile_y = numHigh - 1 - tile_y;
 
-        findTile(tileID, false, out_tile);
-        if (out_tile.valid()) 
-            return;
+        osgTerrain::TileID tileID(level, tile_x, tile_y);
 
         std::string filename = createTileName(level, tile_x, tile_y);
-        
-        bool foundInBlacklist = false;
+
+        for(;;)
         {
-            Threading::ScopedReadLock sharedLock( _blacklistMutex );
-            foundInBlacklist = _blacklistedFilenames.count(filename) == 1;
+            if ( findTile(tileID, out_tile) )
+                return;
+
+            bool foundInBlacklist = false;
+            {
+                Threading::ScopedReadLock sharedLock( _blacklistMutex );
+                foundInBlacklist = _blacklistedFilenames.count(filename) == 1;
+            }
+            if ( foundInBlacklist )
+            {
+                OE_DEBUG << LC << "file has been found in black list : "<<filename<<std::endl;
+                insertTile(tileID, 0);
+                return;
+            }
+
+            // A VPB file holds four sibling tiles, which the engine usually asks for
+            // all at once. Only the first request reads the file; the others wait for
+            // it and then pick their tiles out of the cache. Reads of different files
+            // proceed in parallel.
+            osg::ref_ptr<PendingRead> pending;
+            bool isReader = false;
+            {
+                Threading::ScopedMutexLock lock( _pendingReadsMutex );
+                PendingReads::iterator i = _pendingReads.find( filename );
+                if ( i != _pendingReads.end() )
+                {
+                    pending = i->second.get();
+                }
+                else
+                {
+                    pending = new PendingRead();
+                    _pendingReads[filename] = pending.get();
+                    isReader = true;
+                }
+            }
+
+            if ( !isReader )
+            {
+                pending->_done.wait();
+                if ( progress && progress->isCanceled() )
+                    return;
+
+                // check the cache again; if the read failed, try it ourselves.
+                continue;
+            }
+
+            // the previous reader may have finished between our cache check and our claim.
+            if ( !findTile(tileID, out_tile) )
+            {
+                readTiles( filename, tileID, progress, out_tile );
+            }
+
+            {
+                Threading::ScopedMutexLock lock( _pendingReadsMutex );
+                _pendingReads.erase( filename );
+            }
+            pending->_done.set();
+            return;
         }
-        if ( foundInBlacklist )
-        {
-            OE_DEBUG << LC << "file has been found in black list : "<<filename<<std::endl;
-            insertTile(tileID, 0);
-            return; //return 0;
-        }        
+    }
 
+    /**
+     * Reads a VPB file, caches each of the (up to four) tiles in it, and
+     * returns the one matching tileID.
+     */
+    void readTiles( const std::string& filename, const osgTerrain::TileID& tileID, ProgressCallback* progress, osg::ref_ptr<osgTerrain::TerrainTile>& out_tile )
+    {
         osg::ref_ptr<osgDB::Options> localOptions = Registry::instance()->cloneOrCreateOptions();        
         localOptions->setPluginData("osgearth_vpb Plugin",(void*)(1));
 
@@ -378,12 +432,11 @@ public:
         {
             osg::Node* node = r.getNode();
 
-            //OE_INFO << LC << "Loaded model "<<filename<<std::endl;
             CollectTiles ct;
             node->accept(ct);
 
-            int base_x = (tile_x / 2) * 2;
-            int base_y = (tile_y / 2) * 2;
+            int base_x = (tileID.x / 2) * 2;
+            int base_y = (tileID.y / 2) * 2;
             
             double min_x, max_x, min_y, max_y;
             ct.getRange(min_x, min_y, max_x, max_y);
@@ -402,7 +455,7 @@ public:
                     
                     int local_x = base_x + ((projected.x() > center_x) ? 1 : 0);
                     int local_y = base_y + ((projected.y() > center_y) ? 1 : 0);
-                    osgTerrain::TileID local_tileID(level, local_x, local_y);
+                    osgTerrain::TileID local_tileID(tileID.level, local_x, local_y);
                     
                     tile->setTileID(local_tileID);
                     insertTile(local_tileID, tile);
@@ -410,9 +463,11 @@ public:
                     if ( local_tileID == tileID )
                         out_tile = tile;
                 }
-
             }
 
+            // remember that the file doesn't cover this tile, so we don't read it again.
+            if ( !out_tile.valid() )
+                insertTile(tileID, 0);
         }
         else
         {
@@ -423,57 +478,24 @@ public:
                 _blacklistedFilenames.insert( filename );
             }
         }
-        
-        //TODO: just return it instead...
-        //findTile(tileID, false, out_tile);
     }
     
+    /** Caches a tile; a NULL tile records that there is no data for the ID. */
     void insertTile(const osgTerrain::TileID& tileID, osgTerrain::TerrainTile* tile)
     {
-        Threading::ScopedWriteLock exclusiveLock( _tileMapMutex );
-
-        if ( _tileMap.find(tileID) == _tileMap.end() )
-        {
-            _tileMap[tileID] = tile;
-
-            _tileFIFO.push_back(tileID);
-
-            if (_tileFIFO.size() > _maxNumTilesInCache)
-            {
-                osgTerrain::TileID tileToRemove = _tileFIFO.front();
-                _tileFIFO.pop_front();
-                _tileMap.erase(tileToRemove);
-
-//                OE_DEBUG << LC << "Pruned tileID ("<<TileKey::getLOD(tileID)<<", "<<tileID.x<<", "<<tileID.y<<")"<<std::endl;
-            }
-
-            //OE_DEBUG << LC << "insertTile ("
-            //    << TileKey::getLOD(tileID)<<", "<<tileID.x<<", "<<tileID.y<<") " 
-            //    << " tileFIFO.size()=="<<_tileFIFO.size()<<std::endl;
-        }
-        else
-        {
-            //OE_DEBUG << LC << "insertTile ("
-            //    << TileKey::getLOD(tileID)<<", "<<tileID.x<<", "<<tileID.y<<") " 
-            //    << " ...already in cache!"<<std::endl;
-        }
+        _tileCache.insert( tileID, tile );
     }
 
-    void findTile(const osgTerrain::TileID& tileID, bool insertBlankTileIfNotFound, osg::ref_ptr<osgTerrain::TerrainTile>& out_tile)
+    /** Looks up a tile in the cache. Returns true if the ID is cached, even as a NULL tile. */
+    bool findTile(const osgTerrain::TileID& tileID, osg::ref_ptr<osgTerrain::TerrainTile>& out_tile)
     {
-        // read with a shared lock
+        TileCache::Record rec;
+        if ( _tileCache.get(tileID, rec) )
         {
-            Threading::ScopedReadLock sharedLock( _tileMapMutex );
-            TileMap::iterator itr = _tileMap.find(tileID);
-            if (itr != _tileMap.end())
-                out_tile = itr->second.get();
+            out_tile = rec.value().get();
+            return true;
         }
-
-        // upgrade lock and write:
-        if (insertBlankTileIfNotFound) 
-            insertTile(tileID, 0);
-
-        //return 0;
+        return false;
     }
 
     const VPBOptions _options;
@@ -486,14 +508,23 @@ public:
     osg::ref_ptr<const Profile> _profile;
     osg::ref_ptr<osg::Node> _rootNode;
     
-    unsigned int _maxNumTilesInCache;
-    
-    typedef std::map<osgTerrain::TileID, osg::ref_ptr<osgTerrain::TerrainTile> > TileMap;
-    TileMap _tileMap;
-    Threading::ReadWriteMutex _tileMapMutex;
-    
-    typedef std::list<osgTerrain::TileID> TileIDList;
-    TileIDList _tileFIFO;
+    struct TileIDHash {
+        unsigned operator()(const osgTerrain::TileID& id) const {
+            return LRUHash<unsigned>()( (unsigned)id.level * 73856093u ^ (unsigned)id.x * 19349663u ^ (unsigned)id.y );
+        }
+    };
+
+    // decoded tiles, shared by every request against this database
+    typedef ShardedLRUCache<osgTerrain::TileID, osg::ref_ptr<osgTerrain::TerrainTile>, TileIDHash> TileCache;
+    TileCache _tileCache;
+
+    // a file read in progress; requests for its other tiles wait on it
+    struct PendingRead : public osg::Referenced {
+        Threading::Event _done;
+    };
+    typedef std::map<std::string, osg::ref_ptr<PendingRead> > PendingReads;
+    PendingReads _pendingReads;
+    Threading::Mutex _pendingReadsMutex;
     
     typedef std::set<std::string> StringSet;
     StringSet _blacklistedFilenames;
@@ -23,9 +23,14 @@
 #include <osgEarth/URI>
 #include <osg/Notify>
 #include <osgDB/Registry>
+#include <osgEarth/StringUtils>
 #include <iostream>
+#include <algorithm>
+#include <string.h>
 #include <stdlib.h>
 
+#define LC "[osgEarth::WCS1.1] "
+
 using namespace osgEarth;
 
 
@@ -39,6 +44,11 @@ _options  ( options )
         _covFormat = "image/GeoTIFF";
 
     _osgFormat = "tif";
+
+    _blockSize = (unsigned)osg::clampBetween( _options.blockSize().value(), 1, 8 );
+
+    // room for the unrequested remainder of several blocks in flight:
+    _blockTiles.setMaxSize( 16 * _blockSize * _blockSize );
 }
 
 
@@ -64,13 +74,22 @@ osg::Image*
 WCS11Source::createImage(const TileKey&        key,
                          ProgressCallback*     progress)
 {
-    HTTPRequest request = createRequest( key );
+    if ( _blockSize > 1 )
+        return createImageFromBlock( key, progress );
 
-    OE_INFO << "[osgEarth::WCS1.1] Key=" << key.str() << " URL = " << request.getURL() << std::endl;
+    int samples = _options.tileSize().value();
+    HTTPRequest request = createRequest( key.getExtent(), samples, samples );
+
+    OE_INFO << LC << "Key=" << key.str() << " URL = " << request.getURL() << std::endl;
+
+    return fetchImage( request, progress );
+}
 
-    double lon0,lat0,lon1,lat1;
-    key.getExtent().getBounds( lon0, lat0, lon1, lat1 );
 
+osg::Image*
+WCS11Source::fetchImage(const HTTPRequest&    request,
+                        ProgressCallback*     progress)
+{
     // download the data. It's a multipart-mime stream, so we have to use HTTP directly.
     HTTPResponse response = HTTPClient::get( request, _dbOptions.get(), progress );
     if ( !response.isOK() )
@@ -99,10 +118,166 @@ WCS11Source::createImage(const TileKey&        key,
         return NULL;
     }
 
-    osg::Image* image = result.getImage();
-    //OE_NOTICE << "Returned grid is " << image->s() << "x" << image->t() << std::endl;
-    if ( image ) image->ref();
-    return image;
+    return result.takeImage();
+}
+
+
+osg::Image*
+WCS11Source::takeBlockTile(const TileKey& key)
+{
+    osg::ref_ptr<osg::Image> image;
+    {
+        ImageCache::Record rec;
+        if ( _blockTiles.get(key.str(), rec) )
+        {
+            image = rec.value().get();
+            _blockTiles.erase( key.str() );
+        }
+    }
+    return image.release();
+}
+
+
+osg::Image*
+WCS11Source::createImageFromBlock(const TileKey&    key,
+                                  ProgressCallback* progress)
+{
+    // the aligned block holding this key, clipped to the edges of the profile:
+    unsigned numWide, numHigh;
+    getProfile()->getNumTiles( key.getLOD(), numWide, numHigh );
+
+    unsigned bx0 = (key.getTileX() / _blockSize) * _blockSize;
+    unsigned by0 = (key.getTileY() / _blockSize) * _blockSize;
+    unsigned bw  = std::min( _blockSize, numWide - bx0 );
+    unsigned bh  = std::min( _blockSize, numHigh - by0 );
+
+    std::string blockName = Stringify() << key.getLOD() << "/" << bx0 << "/" << by0;
+
+    bool waited = false;
+    for(;;)
+    {
+        // a tile that came back with an earlier block is handed out once:
+        osg::Image* image = takeBlockTile( key );
+        if ( image )
+            return image;
+
+        // a block we waited on didn't cover this key; ask for it alone.
+        if ( waited )
+        {
+            int samples = _options.tileSize().value();
+            return fetchImage( createRequest(key.getExtent(), samples, samples), progress );
+        }
+
+        osg::ref_ptr<PendingBlock> pending;
+        bool isFetcher = false;
+        {
+            Threading::ScopedMutexLock lock( _pendingBlocksMutex );
+            PendingBlocks::iterator i = _pendingBlocks.find( blockName );
+            if ( i != _pendingBlocks.end() )
+            {
+                pending = i->second.get();
+            }
+            else
+            {
+                pending = new PendingBlock();
+                _pendingBlocks[blockName] = pending.get();
+                isFetcher = true;
+            }
+        }
+
+        if ( !isFetcher )
+        {
+            pending->_done.wait();
+            if ( progress && progress->isCanceled() )
+                return NULL;
+            waited = true;
+            continue;
+        }
+
+        // the previous fetch may have finished between our cache check and our claim.
+        image = takeBlockTile( key );
+        if ( !image )
+        {
+            image = fetchBlock( key, bx0, by0, bw, bh, progress );
+        }
+
+        {
+            Threading::ScopedMutexLock lock( _pendingBlocksMutex );
+            _pendingBlocks.erase( blockName );
+        }
+        pending->_done.set();
+        return image;
+    }
+}
+
+
+osg::Image*
+WCS11Source::fetchBlock(const TileKey&    key,
+                        unsigned bx0, unsigned by0, unsigned bw, unsigned bh,
+                        ProgressCallback* progress)
+{
+    const Profile* profile = getProfile();
+    unsigned lod = key.getLOD();
+
+    // Neighbouring tiles share their edge samples, so a block of bw x bh tiles
+    // of n samples each is sampled at exactly the same points as the tiles
+    // themselves when it's bw*(n-1)+1 by bh*(n-1)+1 samples. That keeps the
+    // server at the tiles' own resolution (GridOffsets, the WCS 1.1 analogue
+    // of RESX/RESY, stays the per-tile sample spacing).
+    int n = _options.tileSize().value();
+    int samplesX = (int)bw*(n-1) + 1;
+    int samplesY = (int)bh*(n-1) + 1;
+
+    double xmin, ymin, xmax, ymax, dummy0, dummy1;
+    profile->getTileBounds( lod, bx0, by0, xmin, dummy0, dummy1, ymax );
+    profile->getTileBounds( lod, bx0+bw-1, by0+bh-1, dummy0, ymin, xmax, dummy1 );
+    GeoExtent blockExtent( profile->getSRS(), xmin, ymin, xmax, ymax );
+
+    HTTPRequest request = createRequest( blockExtent, samplesX, samplesY );
+
+    OE_INFO << LC << "Key=" << key.str() << " block=" << bw << "x" << bh << " URL = " << request.getURL() << std::endl;
+
+    osg::ref_ptr<osg::Image> block = fetchImage( request, progress );
+    if ( !block.valid() )
+        return NULL;
+
+    if ( block->s() != samplesX || block->t() != samplesY || block->r() != 1 )
+    {
+        OE_WARN << LC << "Block response is " << block->s() << "x" << block->t()
+            << ", expected " << samplesX << "x" << samplesY << "; requesting " << key.str() << " alone" << std::endl;
+        return fetchImage( createRequest(key.getExtent(), n, n), progress );
+    }
+
+    osg::Image* result = 0L;
+    for( unsigned j = 0; j < bh; ++j )
+    {
+        for( unsigned i = 0; i < bw; ++i )
+        {
+            // tile rows run top-down, image rows bottom-up:
+            int col0 = (int)i * (n-1);
+            int row0 = (int)(bh-1-j) * (n-1);
+
+            osg::ref_ptr<osg::Image> tile = new osg::Image();
+            tile->allocateImage( n, n, 1, block->getPixelFormat(), block->getDataType() );
+            tile->setInternalTextureFormat( block->getInternalTextureFormat() );
+            for( int row = 0; row < n; ++row )
+            {
+                memcpy( tile->data(0, row), block->data(col0, row0 + row), tile->getRowSizeInBytes() );
+            }
+
+            TileKey tileKey( lod, bx0 + i, by0 + j, profile );
+            if ( tileKey == key )
+            {
+                result = tile.release();
+            }
+            else
+            {
+                _blockTiles.insert( tileKey.str(), tile.get() );
+            }
+        }
+    }
+
+    return result;
 }
 
 
@@ -141,15 +316,13 @@ http://server/ArcGIS/services/WorldElevation/MapServer/WCSServer
 
 
 HTTPRequest
-WCS11Source::createRequest( const TileKey& key ) const
+WCS11Source::createRequest( const GeoExtent& extent, int lon_samples, int lat_samples ) const
 {
     std::stringstream buf;
 
     double lon_min, lat_min, lon_max, lat_max;
-    key.getExtent().getBounds( lon_min, lat_min, lon_max, lat_max );
+    extent.getBounds( lon_min, lat_min, lon_max, lat_max );
 
-    int lon_samples = _options.tileSize().value();
-    int lat_samples = _options.tileSize().value();
     double lon_interval = (lon_max-lon_min)/(double)(lon_samples-1);
     double lat_interval = (lat_max-lat_min)/(double)(lat_samples-1);
 
@@ -23,6 +23,8 @@
 #include <osgEarth/TileKey>
 #include <osgEarth/TileSource>
 #include <osgEarth/HTTPClient>
+#include <osgEarth/Containers>
+#include <osgEarth/ThreadingUtils>
 #include <osg/Image>
 #include <osg/Shape>
 #include <osgDB/ReaderWriter>
@@ -57,7 +59,32 @@ private:
 
     osg::ref_ptr<osgDB::Options> _dbOptions;
 
-    HTTPRequest createRequest( const TileKey& key ) const;
+    // tiles split out of a block response that haven't been asked for yet
+    typedef ShardedLRUCache<std::string, osg::ref_ptr<osg::Image> > ImageCache;
+    ImageCache _blockTiles;
+
+    // a block request in progress; requests for its other tiles wait on it
+    struct PendingBlock : public osg::Referenced {
+        Threading::Event _done;
+    };
+    typedef std::map<std::string, osg::ref_ptr<PendingBlock> > PendingBlocks;
+    PendingBlocks _pendingBlocks;
+    Threading::Mutex _pendingBlocksMutex;
+
+    unsigned _blockSize;
+
+    HTTPRequest createRequest( const GeoExtent& extent, int samplesX, int samplesY ) const;
+
+    osg::Image* fetchImage( const HTTPRequest& request, ProgressCallback* progress );
+
+    osg::Image* createImageFromBlock( const TileKey& key, ProgressCallback* progress );
+
+    osg::Image* takeBlockTile( const TileKey& key );
+
+    osg::Image* fetchBlock(
+        const TileKey& key,
+        unsigned bx0, unsigned by0, unsigned bw, unsigned bh,
+        ProgressCallback* progress );
 };
 
 #endif // OSGEARTH_WCS_PLUGIN_WCS11SOURCE_H_
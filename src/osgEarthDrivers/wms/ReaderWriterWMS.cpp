@@ -23,6 +23,7 @@
 #include <osgEarth/TimeControl>
 #include <osgEarth/XmlUtils>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/TaskService>
 #include <osgEarthUtil/WMS>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
@@ -49,17 +50,86 @@ using namespace osgEarth::Drivers;
 
 namespace
 {
+    /**
+     * Playback state shared by every tile sequence of a WMS-T layer. The
+     * SequenceControl methods change it and each sequence picks it up in
+     * its next update, so changing frames never reloads a tile.
+     */
+    struct SequenceState : public osg::Referenced
+    {
+        SequenceState(unsigned numFrames, double secondsPerFrame)
+            : _playing(false), _restart(false), _pause(false), _frame(0u), _referenceTime(0.0),
+              _numFrames(numFrames), _secondsPerFrame(secondsPerFrame) { }
+
+        /** Frame that plays at the given simulation time. */
+        unsigned frameAt(double simTime) const
+        {
+            if ( _numFrames == 0u )
+                return 0u;
+            double len = _secondsPerFrame * (double)_numFrames;
+            double t   = fmod( simTime - _referenceTime, len ) / len;
+            if ( t < 0.0 )
+                t += 1.0;
+            return osg::minimum( (unsigned)(t * (double)_numFrames), _numFrames-1u );
+        }
+
+        volatile bool     _playing;
+        volatile bool     _restart;       // re-anchor playback at _frame on the next update
+        volatile bool     _pause;         // capture the playing frame into _frame on the next update
+        volatile unsigned _frame;         // frame to show while paused
+        volatile double   _referenceTime; // simulation time at which frame 0 plays
+        unsigned          _numFrames;
+        double            _secondsPerFrame;
+    };
+
     // All looping ImageSequences deriving from this class will be in sync due to
     // a shared reference time.
     struct SyncImageSequence : public osg::ImageSequence
     {
-        SyncImageSequence() : osg::ImageSequence() { }
+        SyncImageSequence(SequenceState* state) : osg::ImageSequence(), _state(state), _seekTime(-1.0) { }
 
         virtual void update(osg::NodeVisitor* nv)
         {
-            setReferenceTime( 0.0 );
+            const osg::FrameStamp* fs = nv ? nv->getFrameStamp() : 0L;
+            if ( _state->_playing )
+            {
+                if ( _state->_restart && fs )
+                {
+                    _state->_referenceTime = fs->getSimulationTime() - (double)_state->_frame * _state->_secondsPerFrame;
+                    _state->_restart = false;
+                }
+
+                if ( getStatus() != PLAYING )
+                    play();
+
+                setReferenceTime( _state->_referenceTime );
+                _seekTime = -1.0;
+            }
+            else
+            {
+                if ( _state->_pause && fs )
+                {
+                    _state->_frame = _state->frameAt( fs->getSimulationTime() );
+                    _state->_pause = false;
+                }
+
+                if ( getStatus() == PLAYING )
+                    pause();
+
+                // aim for the middle of the frame to stay clear of rounding at its edges.
+                double t = ((double)_state->_frame + 0.5) * _state->_secondsPerFrame;
+                if ( t != _seekTime )
+                {
+                    seek( t );
+                    _seekTime = t;
+                }
+            }
+
             osg::ImageSequence::update( nv );
         }
+
+        osg::ref_ptr<SequenceState> _state;
+        double                      _seekTime;
     };
 }
 
@@ -70,8 +140,6 @@ class WMSSource : public TileSource, public SequenceControl
 public:
 	WMSSource( const TileSourceOptions& options ) : TileSource( options ), _options(options)
     {
-        _isPlaying     = false;
-
         if ( _options.times().isSet() )
         {
             StringTokenizer( *_options.times(), _timesVec, ",", "", false, true );
@@ -84,6 +152,8 @@ public:
             }
         }
 
+        _seqState = new SequenceState( _timesVec.size(), _options.secondsPerFrame().value() );
+
         // localize it since we might override them:
         _formatToUse = _options.format().value();
         _srsToUse = _options.wmsVersion().value() == "1.3.0" ? _options.crs().value() : _options.srs().value();
@@ -273,6 +343,14 @@ public:
             // set up the cache options properly for a TileSource.
             _dbOptions = Registry::instance()->cloneOrCreateOptions( dbOptions );            
 
+            // WMS-T tiles fetch their time steps several at a time:
+            if ( _timesVec.size() > 1 && _options.maxConcurrentRequests().get() > 1u )
+            {
+                _fetchService = new TaskService(
+                    "WMS-T fetch",
+                    osg::minimum(_options.maxConcurrentRequests().get(), 16u) );
+            }
+
             return STATUS_OK;
         }
         else
@@ -413,25 +491,56 @@ public:
         return image.release();
     }
 
+    /** Fetches one time step of a tile; several run at once on the fetch service. */
+    struct FetchFrame
+    {
+        FetchFrame() : _source(0L), _key(0L), _progressCB(0L) { }
+        void execute()
+        {
+            ReadResult response;
+            _image = _source->fetchTileImage( *_key, _extraAttrs, _progressCB, response );
+        }
+
+        WMSSource*               _source;
+        const TileKey*           _key;
+        std::string              _extraAttrs;
+        ProgressCallback*        _progressCB;
+        osg::ref_ptr<osg::Image> _image;
+    };
+    typedef ParallelTask<FetchFrame> FetchFrameTask;
+
     /** creates a 3D image from timestamped data. */
     osg::Image* createImageSequence( const TileKey& key, ProgressCallback* progress )
     {
-        osg::ref_ptr< osg::ImageSequence > seq = new SyncImageSequence();
+        osg::ref_ptr< osg::ImageSequence > seq = new SyncImageSequence( _seqState.get() );
         
         seq->setLoopingMode( osg::ImageStream::LOOPING );
         seq->setLength( _options.secondsPerFrame().value() * (double)_timesVec.size() );
-        if ( this->isSequencePlaying() )
-            seq->play();
 
-        for( unsigned int r=0; r<_timesVec.size(); ++r )
+        // Fetch every time step up front, so the tile holds all its frames
+        // and playback or seeking never goes back to the server.
+        unsigned numFrames = _timesVec.size();
+        std::vector< osg::ref_ptr<FetchFrameTask> > frames( numFrames );
+        Threading::MultiEvent semaphore( (int)numFrames );
+        for( unsigned int r=0; r<numFrames; ++r )
         {
-            std::string extraAttrs = std::string("TIME=") + _timesVec[r];
+            frames[r] = new FetchFrameTask( &semaphore );
+            frames[r]->_source     = this;
+            frames[r]->_key        = &key;
+            frames[r]->_extraAttrs = std::string("TIME=") + _timesVec[r];
+            frames[r]->_progressCB = progress;
+            if ( _fetchService.valid() )
+                _fetchService->add( frames[r].get() );
+            else
+                (*frames[r])( 0L );
+        }
+        semaphore.wait();
 
-            ReadResult response;
-            osg::ref_ptr<osg::Image> image = fetchTileImage( key, extraAttrs, progress, response );
-            if ( image.get() )
+        for( unsigned int r=0; r<numFrames; ++r )
+        {
+            if ( frames[r]->_image.valid() )
             {
-                seq->addImage( image );
+                seq->addImage( frames[r]->_image.get() );
             }
         }
 
@@ -513,27 +622,42 @@ public: // SequenceControl
     /** Starts playback */
     void playSequence()
     {
-        //todo
-        _isPlaying = true;
+        if ( !_seqState->_playing )
+        {
+            // resume from the frame we paused on.
+            _seqState->_restart = true;
+            _seqState->_playing = true;
+        }
     }
 
     /** Stops playback */
     void pauseSequence()
     {
-        //todo
-        _isPlaying = false;
+        if ( _seqState->_playing )
+        {
+            // the next sequence update records the frame we stopped on.
+            _seqState->_pause   = !_seqState->_restart;
+            _seqState->_restart = false;
+            _seqState->_playing = false;
+        }
     }
 
     /** Seek to a specific frame */
     void seekToSequenceFrame(unsigned frame)
     {
-        //todo
+        if ( _timesVec.empty() )
+            return;
+
+        _seqState->_frame = osg::minimum( frame, (unsigned)_timesVec.size()-1u );
+        _seqState->_pause = false;
+        if ( _seqState->_playing )
+            _seqState->_restart = true;
     }
 
     /** Whether the object is in playback mode */
     bool isSequencePlaying() const
     {
-        return _isPlaying;
+        return _seqState->_playing;
     }
 
     /** Gets data about the current frame in the sequence */
@@ -548,12 +672,13 @@ public: // SequenceControl
         if ( _seqFrameInfoVec.size() == 0 )
             return 0;
 
-        double len = _options.secondsPerFrame().value() * (double)_timesVec.size();
-        double t   = fmod( fs->getSimulationTime(), len ) / len;
-        return osg::clampBetween(
-            (int)(t * (double)_seqFrameInfoVec.size()), 
-            (int)0, 
-            (int)_seqFrameInfoVec.size()-1);
+        if ( _seqState->_playing && !_seqState->_restart && fs )
+            return (int)_seqState->frameAt( fs->getSimulationTime() );
+
+        if ( _seqState->_pause && fs )
+            return (int)_seqState->frameAt( fs->getSimulationTime() );
+
+        return (int)_seqState->_frame;
     }
 
 
@@ -566,8 +691,9 @@ private:
     std::string                      _prototype;
     std::vector<std::string>         _timesVec;
     osg::ref_ptr<osgDB::Options>     _dbOptions;
-    bool                             _isPlaying;
     std::vector<SequenceFrameInfo>   _seqFrameInfoVec;
+    osg::ref_ptr<SequenceState>      _seqState;
+    osg::ref_ptr<TaskService>        _fetchService;
 
     mutable Threading::ThreadSafeObserverSet<osg::ImageSequence> _sequenceCache;
 };
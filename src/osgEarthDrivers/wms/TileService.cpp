@@ -20,6 +20,7 @@
 #include "TileService"
 
 #include <osgEarth/XmlUtils>
+#include <osgEarth/MetadataCache>
 
 #include <osg/io_utils>
 #include <osgDB/FileNameUtils>
@@ -212,7 +213,7 @@ TileServiceReader::read( const std::string &location, const osgDB::ReaderWriter:
 {
     TileService *tileService = NULL;
 
-    ReadResult r = URI(location).readString( options );
+    ReadResult r = MetadataCache::readString( URI(location), options );
     if ( r.succeeded() )
     {
         std::istringstream buf( r.getString() );
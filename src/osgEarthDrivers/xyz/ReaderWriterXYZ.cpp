@@ -21,6 +21,7 @@
 #include <osgEarth/FileUtils>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/Registry>
+#include <osgEarth/URLTemplate>
 
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
@@ -47,7 +48,7 @@ class XYZSource : public TileSource
 {
 public:
     XYZSource(const TileSourceOptions& options) : 
-      TileSource(options), _options(options), _rotate_iter(0u)
+      TileSource(options), _options(options)
     {
         //nop
     }
@@ -69,15 +70,8 @@ public:
             return Status::Error( "An explicit profile definition is required by the XYZ driver." );
         }
 
-        _template = xyzURI.full();
-        
-        _rotateStart = _template.find("[");
-        _rotateEnd   = _template.find("]");
-        if ( _rotateStart != std::string::npos && _rotateEnd != std::string::npos && _rotateEnd-_rotateStart > 1 )
-        {
-            _rotateString  = _template.substr(_rotateStart, _rotateEnd-_rotateStart+1);
-            _rotateChoices = _template.substr(_rotateStart+1, _rotateEnd-_rotateStart-1);
-        }
+        // parse the template once; tile URLs are built from its tokens.
+        _template = URLTemplate( xyzURI.full() );
 
         _format = _options.format().isSet() 
             ? *_options.format()
@@ -100,26 +94,8 @@ public:
             y = rows - y - 1;
         }
 
-        std::string location = _template;
-
-        // support OpenLayers template style:
-        replaceIn( location, "${x}", Stringify() << x );
-        replaceIn( location, "${y}", Stringify() << y );
-        replaceIn( location, "${z}", Stringify() << key.getLevelOfDetail() );
-
-        // failing that, legacy osgearth style:
-        replaceIn( location, "{x}", Stringify() << x );
-        replaceIn( location, "{y}", Stringify() << y );
-        replaceIn( location, "{z}", Stringify() << key.getLevelOfDetail() );
-
-        std::string cacheKey;
-
-        if ( !_rotateChoices.empty() )
-        {
-            cacheKey = location;
-            unsigned index = (++_rotate_iter) % _rotateChoices.size();
-            replaceIn( location, _rotateString, Stringify() << _rotateChoices[index] );
-        }
+        std::string location, cacheKey;
+        _template.expand( x, y, key.getLevelOfDetail(), location, &cacheKey );
 
 
         URI uri( location, _options.url()->context() );
@@ -139,11 +115,7 @@ public:
 private:
     const XYZOptions       _options;
     std::string            _format;
-    std::string            _template;
-    std::string            _rotateChoices;
-    std::string            _rotateString;
-    std::string::size_type _rotateStart, _rotateEnd;
-    OpenThreads::Atomic    _rotate_iter;
+    URLTemplate            _template;
 
     osg::ref_ptr<osgDB::Options> _dbOptions;
 };
@@ -249,6 +249,8 @@ BillboardExtension::connect(MapNode* mapNode)
 
         geode_ss->getOrCreateUniform("billboard_width", osg::Uniform::FLOAT)->set( bbWidth );
         geode_ss->getOrCreateUniform("billboard_height", osg::Uniform::FLOAT)->set( bbHeight );
+        geode_ss->getOrCreateUniform("billboard_falloff", osg::Uniform::FLOAT_VEC2)->set(
+            osg::Vec2f(_options.falloffStart().get(), _options.maxRange().get()) );
         geode_ss->setMode(GL_BLEND, osg::StateAttribute::ON);
 
         //for now just using an osg::Program
@@ -8,18 +8,28 @@ uniform float oe_graticule_resolution;
 uniform vec4  oe_graticule_color;
 
 varying vec2 oe_graticule_coord;
+varying float oe_graticule_active;
 
 void oe_graticule_fragment(inout vec4 color)
 {
+    // no lines in this tile
+    if ( oe_graticule_active < 0.5 )
+        return;
+
     // double the effective res for longitude since it has twice the span
     vec2 gr = vec2(0.5*oe_graticule_resolution, oe_graticule_resolution);
     vec2 distanceToLine = mod(oe_graticule_coord, gr);
+    distanceToLine = min(distanceToLine, gr-distanceToLine);
+
+    // size of a pixel in graticule coords:
     vec2 dx = abs(dFdx(oe_graticule_coord));
     vec2 dy = abs(dFdy(oe_graticule_coord));
-    vec2 dF = vec2(max(dx.s, dy.s), max(dx.t, dy.t)) * oe_graticule_lineWidth;
-        
-    if ( any(lessThan(distanceToLine, dF)) )
-    {
-        color.rgb = mix(color.rgb, oe_graticule_color.rgb, oe_graticule_color.a);
-    }
-}
\ No newline at end of file
+    vec2 pixel = max(vec2(max(dx.s, dy.s), max(dx.t, dy.t)), vec2(1e-12));
+
+    // analytic antialiasing: full coverage within half the line width of the
+    // line, falling off over one pixel.
+    vec2 halfWidth = 0.5 * pixel * oe_graticule_lineWidth;
+    vec2 coverage = 1.0 - smoothstep(halfWidth - 0.5*pixel, halfWidth + 0.5*pixel, distanceToLine);
+
+    color.rgb = mix(color.rgb, oe_graticule_color.rgb, oe_graticule_color.a * max(coverage.x, coverage.y));
+}
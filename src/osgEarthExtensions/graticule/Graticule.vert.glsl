@@ -4,13 +4,26 @@
 #pragma vp_order      "0.5"
 
 uniform vec4 oe_tile_key;
+uniform float oe_graticule_resolution;
 varying vec4 oe_layer_tilec;
 
 varying vec2 oe_graticule_coord;
+varying float oe_graticule_active;
 
 void oe_graticule_vertex(inout vec4 vertex)
 {
     // calculate long and lat from [0..1] across the profile:
-    vec2 r = (oe_tile_key.xy + oe_layer_tilec.xy)/exp2(oe_tile_key.z);
+    float scale = 1.0/exp2(oe_tile_key.z);
+    vec2 r = (oe_tile_key.xy + oe_layer_tilec.xy)*scale;
     oe_graticule_coord = vec2(0.5*r.x, r.y);
+
+    // Whether any grid line crosses this tile. It only depends on the tile
+    // key, so it's the same at every vertex of the tile; tiles between the
+    // lines skip the fragment work. Pad the extent so that lines along a tile
+    // edge still draw their full width on both sides.
+    vec2 gr = vec2(0.5*oe_graticule_resolution, oe_graticule_resolution);
+    vec2 size = vec2(0.5*scale, scale);
+    vec2 tileMin = vec2(0.5*oe_tile_key.x, oe_tile_key.y)*scale - size/64.0;
+    vec2 tileMax = tileMin + size*(1.0 + 2.0/64.0);
+    oe_graticule_active = any(greaterThanEqual(floor(tileMax/gr), ceil(tileMin/gr))) ? 1.0 : 0.0;
 }
@@ -2,6 +2,7 @@
 #pragma vp_entryPoint "oe_nmap_fragment"
 #pragma vp_location   "fragment_coloring"
 #pragma vp_order      "0.2"
+#pragma vp_define     "OE_NMAP_FROM_ELEVATION"
 
 // stage global:
 vec3 oe_global_Normal;
@@ -11,6 +12,39 @@ uniform sampler2D oe_nmap_normalTex;
 varying vec4 oe_nmap_normalCoords;
 varying mat3 oe_nmap_TBN;
 
+#ifdef OE_NMAP_FROM_ELEVATION
+
+// x = heightfield size, y,z = post spacing in meters
+uniform vec4 oe_nmap_elevParams;
+
+float oe_nmap_height(in vec2 uv)
+{
+    return texture2D(oe_nmap_normalTex, uv).r;
+}
+
+void oe_nmap_fragment(inout vec4 color)
+{
+    float size = oe_nmap_elevParams.x;
+    if ( size <= 1.0 )
+        return;
+
+    // sample on texel centers, one post apart:
+    vec2 uv = oe_nmap_normalCoords.st*((size-1.0)/size) + 0.5/size;
+    float step = 1.0/size;
+
+    float dzdx = oe_nmap_height(uv+vec2(step,0.0)) - oe_nmap_height(uv-vec2(step,0.0));
+    float dzdy = oe_nmap_height(uv+vec2(0.0,step)) - oe_nmap_height(uv-vec2(0.0,step));
+
+    vec3 normalTangent = normalize(vec3(
+        -dzdx/(2.0*oe_nmap_elevParams.y),
+        -dzdy/(2.0*oe_nmap_elevParams.z),
+        1.0));
+
+    oe_global_Normal = normalize(oe_nmap_TBN * normalTangent);
+}
+
+#else // OE_NMAP_FROM_ELEVATION
+
 void oe_nmap_fragment(inout vec4 color)
 {
     vec4 encodedNormal = texture2D(oe_nmap_normalTex, oe_nmap_normalCoords.st);
@@ -25,3 +59,5 @@ void oe_nmap_fragment(inout vec4 color)
     // visualize normals:
     //color.rgb = encodedNormal.xyz;
 }
+
+#endif // OE_NMAP_FROM_ELEVATION
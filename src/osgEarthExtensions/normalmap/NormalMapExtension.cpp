@@ -58,7 +58,7 @@ NormalMapExtension::connect(MapNode* mapNode)
         return false;
     }
 
-    _effect = new NormalMapTerrainEffect( _dbOptions.get() );
+    _effect = new NormalMapTerrainEffect( _options, _dbOptions.get() );
 
     mapNode->getTerrainEngine()->addEffect( _effect.get() );
     
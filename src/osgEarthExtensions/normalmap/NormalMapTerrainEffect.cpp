@@ -24,6 +24,7 @@
 #include <osgEarth/TerrainEngineNode>
 #include <osgEarth/TerrainTileNode>
 #include <osgEarth/ShaderLoader>
+#include <osg/Math>
 
 #include "NormalMapShaders"
 
@@ -31,6 +32,7 @@
 
 #define NORMAL_SAMPLER "oe_nmap_normalTex"
 #define NORMAL_MATRIX  "oe_nmap_normalTexMatrix"
+#define ELEV_PARAMS    "oe_nmap_elevParams"
 
 using namespace osgEarth;
 using namespace osgEarth::NormalMap;
@@ -76,10 +78,68 @@ namespace
         osg::observer_ptr<NormalMapTerrainEffect> _effect;
         int _unit;
     };
+
+    /**
+     * Binds the tile's elevation texture so the fragment shader can derive
+     * normals from it, along with the heightfield size and post spacing in
+     * meters needed to turn height differences into slopes.
+     */
+    class ElevationTexInstaller : public TerrainTileNodeCallback
+    {
+    public:
+        ElevationTexInstaller(NormalMapTerrainEffect* effect, int unit)
+            : _effect(effect), _unit(unit) { }
+
+    public: // TileNodeCallback
+        void operator()(const TileKey& key, osg::Node* node)
+        {
+            TerrainTileNode* tile = osgEarth::findTopMostNodeOfType<TerrainTileNode>(node);
+            if ( !tile )
+                return;
+
+            osg::StateSet* ss = node->getOrCreateStateSet();
+
+            osg::Texture2D*  tex = dynamic_cast<osg::Texture2D*>( tile->getElevationTexture() );
+            osg::RefMatrixf* mat = tile->getElevationTextureMatrix();
+            if ( !tex || !tex->getImage() || !mat )
+            {
+                // zero size tells the shader to keep the vertex normal.
+                ss->addUniform( new osg::Uniform(ELEV_PARAMS, osg::Vec4f(0,0,0,0)) );
+                return;
+            }
+
+            ss->setTextureAttribute(_unit, tex);
+            ss->addUniform( new osg::Uniform(NORMAL_MATRIX, osg::Matrixf(*mat)) );
+
+            // tile span in meters; approximate for geographic tiles.
+            const GeoExtent& extent = key.getExtent();
+            double w = extent.width(), h = extent.height();
+            if ( extent.getSRS()->isGeographic() )
+            {
+                double lat = osg::DegreesToRadians( 0.5*(extent.yMin()+extent.yMax()) );
+                w *= 111320.0 * cos(lat);
+                h *= 111320.0;
+            }
+
+            // the texture matrix scales the tile into the (possibly ancestral)
+            // heightfield, so account for that when computing the post spacing.
+            float size = (float)tex->getImage()->s();
+            float sx = (*mat)(0,0) > 0.0f ? (float)w / ((*mat)(0,0) * (size-1.0f)) : 1.0f;
+            float sy = (*mat)(1,1) > 0.0f ? (float)h / ((*mat)(1,1) * (size-1.0f)) : 1.0f;
+
+            ss->addUniform( new osg::Uniform(ELEV_PARAMS, osg::Vec4f(size, sx, sy, 0.0f)) );
+        }
+
+    private:
+        osg::observer_ptr<NormalMapTerrainEffect> _effect;
+        int _unit;
+    };
 }
 
 
-NormalMapTerrainEffect::NormalMapTerrainEffect(const osgDB::Options* dbOptions) :
+NormalMapTerrainEffect::NormalMapTerrainEffect(const NormalMapOptions& options,
+                                               const osgDB::Options*   dbOptions) :
+_options      ( options ),
 _normalMapUnit( -1 )
 {
     //nop
@@ -90,10 +150,21 @@ NormalMapTerrainEffect::onInstall(TerrainEngineNode* engine)
 {
     if ( engine )
     {
-        engine->requireNormalTextures();
-
         engine->getResources()->reserveTextureImageUnit(_normalMapUnit, "NormalMap");
-        engine->addTileNodeCallback( new NormalTexInstaller(this, _normalMapUnit) );
+
+        if ( derivesNormalsOnGPU() )
+        {
+            // only the elevation texture is needed, so the engine skips
+            // building a normal map for each tile.
+            engine->requireElevationTextures();
+            engine->addTileNodeCallback( new ElevationTexInstaller(this, _normalMapUnit) );
+            OE_INFO << LC << "Deriving normals from elevation on the GPU\n";
+        }
+        else
+        {
+            engine->requireNormalTextures();
+            engine->addTileNodeCallback( new NormalTexInstaller(this, _normalMapUnit) );
+        }
         
         // shader components
         osg::StateSet* stateset = engine->getTerrainStateSet();
@@ -101,6 +172,7 @@ NormalMapTerrainEffect::onInstall(TerrainEngineNode* engine)
 
         // configure shaders
         Shaders package;
+        package.define( "OE_NMAP_FROM_ELEVATION", derivesNormalsOnGPU() );
         package.loadFunction( vp, package.Vertex );
         package.loadFunction( vp, package.Fragment );
         
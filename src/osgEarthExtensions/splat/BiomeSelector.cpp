@@ -30,7 +30,8 @@ using namespace osgEarth::Splat;
 BiomeSelector::BiomeSelector(const BiomeVector&           biomes,
                              const SplatTextureDefVector& textureDefs,
                              osg::StateSet*               stateSet,
-                             int                          textureImageUnit) :
+                             int                          textureImageUnit,
+                             int                          renderInfoImageUnit) :
 _biomes( biomes )
 {
     for(unsigned i=0; i<_biomes.size(); ++i)
@@ -64,6 +65,10 @@ _biomes( biomes )
         // install his biome's texture set:
         biomeSS->setTextureAttribute(textureImageUnit, textureDef._texture.get());
 
+        // and its coverage-to-render-info lookup table:
+        if ( textureDef._renderInfoTex.valid() )
+            biomeSS->setTextureAttribute(renderInfoImageUnit, textureDef._renderInfoTex.get());
+
         // install this biome's sampling function. Use cloneOrCreate since each
         // stateset needs a different shader set in its VP.
         VirtualProgram* vp = VirtualProgram::cloneOrCreate( biomeSS );
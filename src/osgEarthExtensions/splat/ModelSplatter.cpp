@@ -45,6 +45,8 @@ namespace
         "uniform vec2 oe_trees_span; \n"
 
         "uniform vec4 oe_tile_key; \n"
+        "uniform vec2 oe_modelsplat_falloff; \n"      // start, end
+        "uniform vec2 oe_modelsplat_hfScaleBias; \n"
 
         "varying float oe_modelsplat_dist; \n"
         
@@ -67,12 +69,22 @@ namespace
         "    vec4 rc = oe_terrain_tex_matrix * vec4(rx, ry, 0.0, 1.0); \n"
      
         // scale and bias the tex coords for heightfield sampling:
-        // "17" is the tile size. Obviously this needs to be parameterized.
-        "    rc *= 16.0/17.0; \n"
-        "    rc += 0.5/17.0; \n"
+        "    rc.st = rc.st*oe_modelsplat_hfScaleBias.x + oe_modelsplat_hfScaleBias.y; \n"
 
         "    float h = texture2D(oe_terrain_tex, rc.st).r; \n"
         "    VertexMODEL.z += h; \n"
+
+        // distance falloff: a rejected instance collapses onto its anchor
+        // point, so its triangles are degenerate and rasterize nothing.
+        "    if ( oe_modelsplat_falloff.y > 0.0 ) \n"
+        "    { \n"
+        "        vec3 anchor = vec3(offset, h); \n"
+        "        float range = length((gl_ModelViewMatrix * vec4(anchor, 1.0)).xyz); \n"
+        "        float span = max(oe_modelsplat_falloff.y - oe_modelsplat_falloff.x, 1.0); \n"
+        "        float keep = 1.0 - clamp((range - oe_modelsplat_falloff.x)/span, 0.0, 1.0); \n"
+        "        if ( oe_modelsplat_rand(vec2(ry, fInstanceID)) >= keep ) \n"
+        "            VertexMODEL.xyz = anchor; \n"
+        "    } \n"
         "} \n";
 
     const char* fs =
@@ -90,7 +102,8 @@ _dirty( true ),
 _count( 128 ),
 _minLOD( 14 )
 {
-    //nop
+    _falloffUniform = new osg::Uniform("oe_modelsplat_falloff", osg::Vec2f(1000.0f, 3000.0f));
+    _elevationSamplerUniform = new osg::Uniform("oe_terrain_tex", 2);
 }
 
 ModelSplatter::~ModelSplatter()
@@ -119,6 +132,12 @@ ModelSplatter::setMinLOD(unsigned lod)
     _dirty = true;
 }
 
+void
+ModelSplatter::setDensityFalloff(float start, float end)
+{
+    _falloffUniform->set( osg::Vec2f(start, end) );
+}
+
 void
 ModelSplatter::establish()
 {
@@ -150,6 +169,9 @@ ModelSplatter::establish()
             VirtualProgram* vp = VirtualProgram::getOrCreate( _model->getOrCreateStateSet() );
 
             vp->setFunction("oe_modelsplat_vert_model", vs_model, ShaderComp::LOCATION_VERTEX_MODEL);
+
+            // shared by every tile, so changing it costs nothing per tile.
+            _model->getOrCreateStateSet()->addUniform( _falloffUniform.get() );
         }
     }
 }
@@ -196,9 +218,13 @@ ModelSplatter::operator()(const TileKey& key, osg::Node* node)
         float w = key.getExtent().width() * 111320.0f * cos(fabs(osg::DegreesToRadians(p.y())));
         ss->addUniform( new osg::Uniform("oe_trees_span", osg::Vec2f(w,h)) );
         
+        // texel-center scale and bias for the heightfield, from its size
+        float hfSize = elevationTex->getImage(0) ? (float)elevationTex->getImage(0)->s() : 17.0f;
+        ss->addUniform( new osg::Uniform("oe_modelsplat_hfScaleBias", osg::Vec2f((hfSize-1.0f)/hfSize, 0.5f/hfSize)) );
+
         // hack..
         ss->setTextureAttributeAndModes(2, tile->getElevationTexture(), 1);
-        ss->addUniform(new osg::Uniform("oe_terrain_tex", 2));
+        ss->addUniform( _elevationSamplerUniform.get() );
         ss->addUniform(new osg::Uniform("oe_terrain_tex_matrix", *elevationTexMat) );
     }
 }
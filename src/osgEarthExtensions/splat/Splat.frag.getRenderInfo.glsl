@@ -2,17 +2,22 @@
 
 #pragma include "Splat.types.glsl"
 
-// Samples the coverage data and returns main and detail indices.
+// Render info per coverage value, precomputed by SplatTerrainEffect:
+// 256 columns (one per coverage value), and per LOD band two rows holding
+// (primary, detail, brightness, contrast) and (threshold, minSlope, -, -).
+uniform sampler2D oe_splat_renderInfoTex;
+
+#define SPLAT_RANGE_COUNT $SPLAT_RANGE_COUNT
+
+// Looks up the main and detail indices for a coverage value.
 oe_SplatRenderInfo oe_splat_getRenderInfo(in float value, in oe_SplatEnv env)
 {
-    float primary = -1.0;   // primary texture index
-    float detail = -1.0;    // detail texture index
-    float brightness = 1.0; // default noise function brightness factor
-    float contrast = 1.0;   // default noise function contrast factor
-    float threshold = 0.0;  // default noise function threshold
-    float slope = 0.0;      // default minimum slope
+    float s  = (floor(value+0.5)+0.5)/256.0;
+    float t0 = (2.0*env.lodBand+0.5)/(2.0*float(SPLAT_RANGE_COUNT));
+    float t1 = t0 + 1.0/(2.0*float(SPLAT_RANGE_COUNT));
 
-    $CODE_INJECTION_POINT
+    vec4 a = texture2D(oe_splat_renderInfoTex, vec2(s, t0));
+    vec4 b = texture2D(oe_splat_renderInfoTex, vec2(s, t1));
 
-    return oe_SplatRenderInfo(primary, detail, brightness, contrast, threshold, slope);
+    return oe_SplatRenderInfo(a[0], a[1], a[2], a[3], b[0], b[1]);
 }
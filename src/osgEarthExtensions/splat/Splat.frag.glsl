@@ -112,9 +112,14 @@ vec4 oe_splat_nearest(in vec2 splat_tc, in oe_SplatEnv env)
     float coverageValue = 255.0 * texture2D(oe_splat_coverageTex, warped_tc).r;
     oe_SplatRenderInfo ri = oe_splat_getRenderInfo(coverageValue, env);
     vec4 primary = oe_splat_getTexel(ri.primaryIndex, splat_tc);
-    float detailToggle = ri.detailIndex >= 0 ? 1.0 : 0.0;
-    vec4 detail  = oe_splat_getDetailTexel(ri, splat_tc, env) * detailToggle;    
-    return vec4( mix(primary.rgb, detail.rgb, detail.a), 1.0 );
+
+    // skip the detail fetch entirely past the detail range.
+    if ( ri.detailIndex >= 0.0 && env.range < oe_splat_detailRange )
+    {
+        vec4 detail = oe_splat_getDetailTexel(ri, splat_tc, env);
+        primary.rgb = mix(primary.rgb, detail.rgb, detail.a);
+    }
+    return vec4( primary.rgb, 1.0 );
 }
 
 // Generates a texel using bilinear filtering on the coverage data.
@@ -176,14 +181,19 @@ vec4 oe_splat_bilinear(in vec2 splat_tc, in oe_SplatEnv env)
     vec3 ne_primary = oe_splat_getTexel(ri_ne.primaryIndex, splat_tc).rgb;
     vec3 nw_primary = oe_splat_getTexel(ri_nw.primaryIndex, splat_tc).rgb;
 
-    // Detail splat - weighting is in the alpha channel
-    // TODO: Pointless to have a detail range? -gw
-    // TODO: If noise is a texture, just try to single-sample it instead
-    float detailToggle = env.range < oe_splat_detailRange ? 1.0 : 0.0;
-    vec4 sw_detail = detailToggle * oe_splat_getDetailTexel(ri_sw, splat_tc, env);
-    vec4 se_detail = detailToggle * oe_splat_getDetailTexel(ri_se, splat_tc, env);
-    vec4 ne_detail = detailToggle * oe_splat_getDetailTexel(ri_ne, splat_tc, env);
-    vec4 nw_detail = detailToggle * oe_splat_getDetailTexel(ri_nw, splat_tc, env);   
+    // Detail splat - weighting is in the alpha channel. Past the detail range
+    // the four detail fetches are skipped, not just zeroed.
+    vec4 sw_detail = vec4(0.0);
+    vec4 se_detail = vec4(0.0);
+    vec4 ne_detail = vec4(0.0);
+    vec4 nw_detail = vec4(0.0);
+    if ( env.range < oe_splat_detailRange )
+    {
+        sw_detail = oe_splat_getDetailTexel(ri_sw, splat_tc, env);
+        se_detail = oe_splat_getDetailTexel(ri_se, splat_tc, env);
+        ne_detail = oe_splat_getDetailTexel(ri_ne, splat_tc, env);
+        nw_detail = oe_splat_getDetailTexel(ri_nw, splat_tc, env);
+    }
 
     // Combine everything based on weighting:
     texel.rgb =
@@ -257,11 +267,12 @@ void oe_splat_fragment(inout vec4 color)
     env.slope = oe_splat_getSlope();
     env.noise = oe_splat_getNoise(noiseCoords);
     env.elevation = 0.0; // usused atm. //texture2D(oe_terrain_tex, (oe_terrain_tex_matrix*oe_layer_tilec).st).r;
+    env.lodBand = 0.0;
 
-    // Mapping of view ranges to splat texture levels of detail.
-#define RANGE_COUNT 9
-    const float ranges[RANGE_COUNT] = float[](  250.0, 500.0, 1000.0, 4000.0, 30000.0, 150000.0, 300000.0, 1000000.0, 5000000.0 );
-    const float lods  [RANGE_COUNT] = float[](  18.0,  17.0,   16.0,   14.0,    12.0,     10.0,      8.0,       6.0,       4.0 );
+    // Mapping of view ranges to splat texture levels of detail (from SplatTerrainEffect).
+#define RANGE_COUNT $SPLAT_RANGE_COUNT
+    const float ranges[RANGE_COUNT] = float[]( $SPLAT_RANGES );
+    const float lods  [RANGE_COUNT] = float[]( $SPLAT_LODS );
 
     // Choose the best range based on distance to camera.
     float d = clamp(oe_splat_range, ranges[0], ranges[RANGE_COUNT-1]);
@@ -274,6 +285,7 @@ void oe_splat_fragment(inout vec4 color)
     {
         if ( d >= ranges[i] && d <= ranges[i+1] )
         {
+            env.lodBand = float(i);
             float lod0 = lods[i] + oe_splat_scaleOffsetInt;
             vec2 splat_tc0 = oe_splat_getSplatCoords(lod0);
             vec4 texel0 = oe_splat_useBilinear > 0.0?
@@ -281,6 +293,7 @@ void oe_splat_fragment(inout vec4 color)
                 oe_splat_nearest(splat_tc0, env);
             
 
+            env.lodBand = float(i+1);
             float lod1 = lods[i+1] + oe_splat_scaleOffsetInt;
             vec2 splat_tc1 = oe_splat_getSplatCoords(lod1);
             vec4 texel1 = oe_splat_useBilinear > 0.0?
@@ -6,6 +6,7 @@ struct oe_SplatEnv {
     float elevation;
     float slope;
     vec4 noise;
+    float lodBand; // index of the range band being sampled
 };
 
 // Rendering parameters for splat texture and noise-based detail texture.
@@ -195,6 +195,9 @@ SplatExtension::connect(MapNode* mapNode)
         if ( _options.scaleLevelOffset().isSet() )
             _effect->getScaleLevelOffsetUniform()->set( (float)_options.scaleLevelOffset().get() );
 
+        if ( _options.detailMaxRange().isSet() )
+            _effect->getDetailRangeUniform()->set( _options.detailMaxRange().get() );
+
         // add it to the terrain.
         mapNode->getTerrainEngine()->addEffect( _effect.get() );
     }
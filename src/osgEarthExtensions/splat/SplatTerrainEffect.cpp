@@ -29,6 +29,7 @@
 #include <osgEarthUtil/SimplexNoise>
 
 #include <osgDB/WriteFile>
+#include <iomanip>
 
 #include "SplatShaders"
 
@@ -37,10 +38,30 @@
 #define COVERAGE_SAMPLER "oe_splat_coverageTex"
 #define SPLAT_SAMPLER    "oe_splatTex"
 #define NOISE_SAMPLER    "oe_splat_noiseTex"
+#define RENDERINFO_SAMPLER "oe_splat_renderInfoTex"
 
 using namespace osgEarth;
 using namespace osgEarth::Splat;
 
+namespace
+{
+    // Camera ranges at which the fragment shader changes splat LOD, and the
+    // LOD at each. The shader blends between adjacent bands; the render info
+    // texture holds one set of rows per band.
+    const unsigned RANGE_COUNT = 9;
+    const float RANGES[RANGE_COUNT] = { 250.0f, 500.0f, 1000.0f, 4000.0f, 30000.0f, 150000.0f, 300000.0f, 1000000.0f, 5000000.0f };
+    const float LODS  [RANGE_COUNT] = {  18.0f,  17.0f,   16.0f,   14.0f,    12.0f,     10.0f,      8.0f,       6.0f,       4.0f };
+
+    std::string toGLSLArray(const float* values, unsigned count)
+    {
+        std::stringstream buf;
+        buf << std::fixed << std::setprecision(1);
+        for(unsigned i=0; i<count; ++i)
+            buf << (i > 0 ? ", " : "") << values[i];
+        return buf.str();
+    }
+}
+
 SplatTerrainEffect::SplatTerrainEffect(const BiomeVector&    biomes,
                                        SplatCoverageLegend*  legend,
                                        const osgDB::Options* dbOptions) :
@@ -48,6 +69,7 @@ _biomes     ( biomes ),
 _legend     ( legend ),
 _renderOrder( -1.0f ),
 _ok         ( false ),
+_renderInfoTexUnit( -1 ),
 _editMode   ( false ),
 _gpuNoise   ( false )
 {
@@ -100,6 +122,7 @@ _gpuNoise   ( false )
     _blurUniform           = new osg::Uniform("oe_splat_blur",             *def.coverageBlur());
     _useBilinearUniform    = new osg::Uniform("oe_splat_useBilinear",      (def.bilinearSampling()==true?1.0f:0.0f));
     _noiseScaleUniform     = new osg::Uniform("oe_splat_noiseScale",       12.0f);
+    _detailRangeUniform    = new osg::Uniform("oe_splat_detailRange",      *def.detailMaxRange());
 
     _editMode = (::getenv("OSGEARTH_SPLAT_EDIT") != 0L);
     _gpuNoise = (::getenv("OSGEARTH_SPLAT_GPU_NOISE") != 0L);
@@ -129,6 +152,20 @@ SplatTerrainEffect::onInstall(TerrainEngineNode* engine)
             _splatTexUniform->set( _splatTexUnit );
             stateset->setTextureAttribute( _splatTexUnit, _textureDefs[0]._texture.get() );
 
+            // render info lookup sampler; each biome supplies its own texture.
+            if ( engine->getResources()->reserveTextureImageUnit(_renderInfoTexUnit, "Splat Render Info") )
+            {
+                _renderInfoTexUniform = stateset->getOrCreateUniform( RENDERINFO_SAMPLER, osg::Uniform::SAMPLER_2D );
+                _renderInfoTexUniform->set( _renderInfoTexUnit );
+            }
+            else
+            {
+                OE_WARN << LC << "No texture image unit available for the render info table\n";
+                engine->getResources()->releaseTextureImageUnit( _splatTexUnit );
+                _splatTexUnit = -1;
+                return;
+            }
+
             // coverage sampler
             _coverageTexUniform = stateset->getOrCreateUniform( COVERAGE_SAMPLER, osg::Uniform::SAMPLER_2D );
             _coverageTexUniform->set( _coverageLayer->shareImageUnit().get() );
@@ -140,7 +177,7 @@ SplatTerrainEffect::onInstall(TerrainEngineNode* engine)
             stateset->addUniform( _noiseScaleUniform.get() );
             stateset->addUniform( _useBilinearUniform.get() );
 
-            stateset->addUniform(new osg::Uniform("oe_splat_detailRange",  1000000.0f));
+            stateset->addUniform( _detailRangeUniform.get() );
 
 
             Shaders package;
@@ -150,6 +187,9 @@ SplatTerrainEffect::onInstall(TerrainEngineNode* engine)
             package.define( "OE_USE_NORMAL_MAP", engine->normalTexturesRequired() );
 
             package.replace( "$COVERAGE_TEXMAT_UNIFORM", _coverageLayer->shareTexMatUniformName().get() );
+            package.replace( "$SPLAT_RANGE_COUNT", Stringify() << RANGE_COUNT );
+            package.replace( "$SPLAT_RANGES",      toGLSLArray(RANGES, RANGE_COUNT) );
+            package.replace( "$SPLAT_LODS",        toGLSLArray(LODS,   RANGE_COUNT) );
             
             VirtualProgram* vp = VirtualProgram::getOrCreate(stateset);
             package.loadFunction( vp, package.VertModel );
@@ -193,7 +233,8 @@ SplatTerrainEffect::onInstall(TerrainEngineNode* engine)
                 _biomes,
                 _textureDefs,
                 stateset,
-                _splatTexUnit );
+                _splatTexUnit,
+                _renderInfoTexUnit );
 
             engine->addCullCallback( _biomeSelector.get() );
         }
@@ -218,6 +259,12 @@ SplatTerrainEffect::onUninstall(TerrainEngineNode* engine)
             _splatTexUnit = -1;
         }
 
+        if ( _renderInfoTexUnit >= 0 )
+        {
+            engine->getResources()->releaseTextureImageUnit( _renderInfoTexUnit );
+            _renderInfoTexUnit = -1;
+        }
+
         if ( _biomeSelector.valid() )
         {
             engine->removeCullCallback( _biomeSelector.get() );
@@ -226,8 +273,6 @@ SplatTerrainEffect::onUninstall(TerrainEngineNode* engine)
     }
 }
 
-#define IND "    "
-
 void
 SplatTerrainEffect::installCoverageSamplingFunction(SplatTextureDef& textureDef)
 {
@@ -237,158 +282,113 @@ SplatTerrainEffect::installCoverageSamplingFunction(SplatTextureDef& textureDef)
         return;
     }
 
-    std::stringstream
-        weightBuf,
-        primaryBuf,
-        detailBuf,
-        brightnessBuf,
-        contrastBuf,
-        thresholdBuf,
-        slopeBuf;
-
-    unsigned
-        primaryCount    = 0,
-        detailCount     = 0,
-        brightnessCount = 0,
-        contrastCount   = 0,
-        thresholdCount  = 0,
-        slopeCount      = 0;
+    // The sampling function is a lookup into the render info texture; all the
+    // per-class logic is resolved ahead of time in createRenderInfoTexture().
+    createRenderInfoTexture( textureDef );
+
+    Shaders package;
+    std::string code = ShaderLoader::load(
+        package.FragGetRenderInfo,
+        package);
+
+    osgEarth::replaceIn(code, "$SPLAT_RANGE_COUNT", Stringify() << RANGE_COUNT);
+
+    textureDef._samplingFunction = code;
+
+    OE_DEBUG << LC << "Sampling function = \n" << code << "\n\n";
+}
+
+void
+SplatTerrainEffect::createRenderInfoTexture(SplatTextureDef& textureDef) const
+{
+    // One column per coverage value, and two rows per LOD band:
+    // (primary, detail, brightness, contrast) and (threshold, minSlope, 0, 0).
+    // A fragment then pays one pair of texel fetches per coverage sample
+    // instead of evaluating every legend entry.
+    const int width  = 256;
+    const int height = 2*RANGE_COUNT;
+
+    osg::Image* image = new osg::Image();
+    image->allocateImage(width, height, 1, GL_RGBA, GL_FLOAT);
+    image->setInternalTextureFormat( GL_RGBA32F_ARB );
+
+    osg::Vec4f* texels = reinterpret_cast<osg::Vec4f*>( image->data() );
+    for(int t=0; t<height; t+=2)
+    {
+        for(int s=0; s<width; ++s)
+        {
+            texels[ t   *width + s].set(-1.0f, -1.0f, 1.0f, 1.0f);
+            texels[(t+1)*width + s].set( 0.0f,  0.0f, 0.0f, 0.0f);
+        }
+    }
 
     const SplatCoverageLegend::Predicates& preds = _legend->getPredicates();
     for(SplatCoverageLegend::Predicates::const_iterator p = preds.begin(); p != preds.end(); ++p)
     {
         const CoverageValuePredicate* pred = p->get();
+        if ( !pred->_exactValue.isSet() )
+            continue;
 
-        if ( pred->_exactValue.isSet() )
+        int value = as<int>( pred->_exactValue.get(), -1 );
+        if ( value < 0 || value >= width )
         {
-            // Look up by class name:
-            const std::string& className = pred->_mappedClassName.get();
-            const SplatLUT::const_iterator i = textureDef._splatLUT.find(className);
-            if ( i != textureDef._splatLUT.end() )
-            {
-                // found it; loop over the range selectors:
-                int selectorCount = 0;
-                const SplatSelectorVector& selectors = i->second;
-
-                OE_DEBUG << LC << "Class " << className << " has " << selectors.size() << " selectors.\n";
-
-                for(SplatSelectorVector::const_iterator selector = selectors.begin();
-                    selector != selectors.end();
-                    ++selector)
-                {
-                    const std::string&    expression = selector->first;
-                    const SplatRangeData& rangeData  = selector->second;
-
-                    std::string val = pred->_exactValue.get();
-
-                    weightBuf
-                        << IND "float w" << val
-                        << " = (1.0-clamp(abs(value-" << val << ".0),0.0,1.0));\n";
-
-                    // Primary texture index:
-                    if ( primaryCount == 0 )
-                        primaryBuf << IND "primary += ";
-                    else
-                        primaryBuf << " + ";
-
-                    // the "+1" is because "primary" starts out at -1.
-                    primaryBuf << "w"<<val << "*" << (rangeData._textureIndex + 1) << ".0";
-                    primaryCount++;
-
-                    // Detail texture index:
-                    if ( rangeData._detail.isSet() )
-                    {
-                        if ( detailCount == 0 )
-                            detailBuf << IND "detail += ";
-                        else
-                            detailBuf << " + ";
-                        // the "+1" is because "detail" starts out at -1.
-                        detailBuf << "w"<<val << "*" << (rangeData._detail->_textureIndex + 1) << ".0";
-                        detailCount++;
-
-                        if ( rangeData._detail->_brightness.isSet() )
-                        {
-                            if ( brightnessCount == 0 )
-                                brightnessBuf << IND "brightness += ";
-                            else
-                                brightnessBuf << " + ";
-                            brightnessBuf << "w"<<val << "*" << rangeData._detail->_brightness.get();
-                            brightnessCount++;
-                        }
-
-                        if ( rangeData._detail->_contrast.isSet() )
-                        {
-                            if ( contrastCount == 0 )
-                                contrastBuf << IND "contrast += ";
-                            else
-                                contrastBuf << " + ";
-                            contrastBuf << "w"<<val << "*" << rangeData._detail->_contrast.get();
-                            contrastCount++;
-                        }
-
-                        if ( rangeData._detail->_threshold.isSet() )
-                        {
-                            if ( thresholdCount == 0 )
-                                thresholdBuf << IND "threshold += ";
-                            else
-                                thresholdBuf << " + ";
-                            thresholdBuf << "w"<<val << "*" << rangeData._detail->_threshold.get();
-                            thresholdCount++;
-                        }
-
-                        if ( rangeData._detail->_slope.isSet() )
-                        {
-                            if ( slopeCount == 0 )
-                                slopeBuf << IND "slope += ";
-                            else
-                                slopeBuf << " + ";
-                            slopeBuf << "w"<<val << "*" << rangeData._detail->_slope.get();
-                            slopeCount++;
-                        }
-                    }                    
-                }
-            }
+            OE_WARN << LC << "Coverage value \"" << pred->_exactValue.get() << "\" is out of range [0..255]; ignoring\n";
+            continue;
         }
-    }
-
-    if ( primaryCount > 0 )
-        primaryBuf << ";\n";
 
-    if ( detailCount > 0 )
-        detailBuf << ";\n";
+        // Look up by class name:
+        const std::string& className = pred->_mappedClassName.get();
+        const SplatLUT::const_iterator i = textureDef._splatLUT.find(className);
+        if ( i == textureDef._splatLUT.end() )
+            continue;
 
-    if ( brightnessCount > 0 )
-        brightnessBuf << ";\n";
+        const SplatSelectorVector& selectors = i->second;
 
-    if ( contrastCount > 0 )
-        contrastBuf << ";\n";
+        OE_DEBUG << LC << "Class " << className << " has " << selectors.size() << " selectors.\n";
 
-    if ( thresholdCount > 0 )
-        thresholdBuf << ";\n";
+        for(unsigned band = 0; band < RANGE_COUNT; ++band)
+        {
+            // first selector (in catalog order) whose minimum range the band meets:
+            const SplatRangeData* rangeData = 0L;
+            for(SplatSelectorVector::const_iterator selector = selectors.begin();
+                selector != selectors.end() && !rangeData;
+                ++selector)
+            {
+                const SplatRangeData& candidate = selector->second;
+                if ( !candidate._minRange.isSet() || RANGES[band] >= candidate._minRange.get() )
+                    rangeData = &candidate;
+            }
 
-    if ( slopeCount > 0 )
-        slopeBuf << ";\n";
+            if ( !rangeData )
+                continue;
 
-    Shaders package;
-    std::string code = ShaderLoader::load(
-        package.FragGetRenderInfo,
-        package);
+            osg::Vec4f& info0 = texels[(2*band)  *width + value];
+            osg::Vec4f& info1 = texels[(2*band+1)*width + value];
 
-    std::string codeToInject = Stringify()
-        << IND
-        << weightBuf.str()
-        << primaryBuf.str()
-        << detailBuf.str()
-        << brightnessBuf.str()
-        << contrastBuf.str()
-        << thresholdBuf.str()
-        << slopeBuf.str();
+            info0[0] = (float)rangeData->_textureIndex;
 
-    osgEarth::replaceIn(code, "$CODE_INJECTION_POINT", codeToInject);
+            if ( rangeData->_detail.isSet() )
+            {
+                const SplatDetailData& detail = rangeData->_detail.get();
+                info0[1] = (float)detail._textureIndex;
+                info0[2] = detail._brightness.getOrUse( 1.0f );
+                info0[3] = detail._contrast.getOrUse( 1.0f );
+                info1[0] = detail._threshold.getOrUse( 0.0f );
+                info1[1] = detail._slope.getOrUse( 0.0f );
+            }
+        }
+    }
 
-    textureDef._samplingFunction = code;
+    osg::Texture2D* tex = new osg::Texture2D( image );
+    tex->setFilter(tex->MIN_FILTER, tex->NEAREST);
+    tex->setFilter(tex->MAG_FILTER, tex->NEAREST);
+    tex->setWrap(tex->WRAP_S, tex->CLAMP_TO_EDGE);
+    tex->setWrap(tex->WRAP_T, tex->CLAMP_TO_EDGE);
+    tex->setResizeNonPowerOfTwoHint( false );
+    tex->setMaxAnisotropy( 1.0f );
+    tex->setUnRefImageDataAfterApply( true );
 
-    OE_DEBUG << LC << "Sampling function = \n" << code << "\n\n";
+    textureDef._renderInfoTex = tex;
 }
 
 osg::Texture*
@@ -425,14 +425,19 @@ SplatTerrainEffect::createNoiseTexture() const
         // write repeating noise to the image:
         ImageUtils::PixelReader read ( image );
         ImageUtils::PixelWriter write( image );
+
+        std::vector<double> rs(size), values(size);
+        for(int s=0; s<size; ++s)
+            rs[s] = (double)s/(double)size;
+
         for(int t=0; t<size; ++t)
         {
             double rt = (double)t/size;
+            noise.getTiledValues(&rs[0], rt, size, &values[0]);
+
             for(int s=0; s<size; ++s)
             {
-                double rs = (double)s/(double)size;
-
-                double n = noise.getTiledValue(rs, rt);
+                double n = values[s];
 
                 n = osg::clampBetween(n, 0.0, 1.0);
 
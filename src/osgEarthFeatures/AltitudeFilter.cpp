@@ -28,6 +28,27 @@ using namespace osgEarth::Symbology;
 
 //---------------------------------------------------------------------------
 
+namespace
+{
+    typedef std::vector<double, ArenaAllocator<double> > ZList;
+
+    // Z values of a geometry's points expressed in another SRS, from one
+    // batch transform. Falls back on the original Z's if it fails.
+    void getZsIn(const Geometry* geom, const SpatialReference* fromSRS, const SpatialReference* toSRS, Arena* arena, ZList& out_z)
+    {
+        ScratchPoints scratch( arena );
+        std::vector<osg::Vec3d>& temp = scratch.get();
+        temp.assign( geom->begin(), geom->end() );
+        bool ok = fromSRS->transform( temp, toSRS );
+
+        out_z.resize( geom->size() );
+        for( unsigned i=0; i<geom->size(); ++i )
+            out_z[i] = ok ? temp[i].z() : (*geom)[i].z();
+    }
+}
+
+//---------------------------------------------------------------------------
+
 AltitudeFilter::AltitudeFilter() :
 _maxRes ( 0.0f )
 {
@@ -135,6 +156,10 @@ AltitudeFilter::pushAndClamp( FeatureList& features, FilterContext& cx )
     // establish an elevation query interface based on the features' SRS.
     ElevationQuery eq( mapf );
 
+    // per-geometry temporaries come from the tile's scratch memory.
+    Arena* arena = cx.arena();
+    ArenaAllocator<double> zAlloc( arena );
+
     NumericExpression scaleExpr;
     if ( _altitude->verticalScale().isSet() )
         scaleExpr = *_altitude->verticalScale();
@@ -156,6 +181,11 @@ AltitudeFilter::pushAndClamp( FeatureList& features, FilterContext& cx )
     bool vertEquiv =
         featureSRS->isVertEquivalentTo( mapSRS );
 
+    // Gather the sample location of every vertex (or every geometry's centroid)
+    // in the whole list first. One bulk query then fetches each covering tile
+    // once and samples all of its points together, instead of a lookup per point.
+    std::vector<osg::Vec3d> samplePoints;
+
     for( FeatureList::iterator i = features.begin(); i != features.end(); ++i )
     {
         Feature* feature = i->get();
@@ -167,6 +197,35 @@ AltitudeFilter::pushAndClamp( FeatureList& features, FilterContext& cx )
             feature->eval( temp, &cx );
         }
 
+        GeometryIterator gi( feature->getGeometry() );
+        while( gi.hasMore() )
+        {
+            Geometry* geom = gi.next();
+            if ( perVertex )
+            {
+                for( Geometry::const_iterator g = geom->begin(); g != geom->end(); ++g )
+                    samplePoints.push_back( osg::Vec3d(g->x(), g->y(), 0.0) );
+            }
+            else
+            {
+                const osg::Vec2d& center = geom->getBounds().center2d();
+                samplePoints.push_back( osg::Vec3d(center.x(), center.y(), 0.0) );
+            }
+        }
+    }
+
+    std::vector<double> terrainZ;
+    std::vector<bool>   terrainValid;
+    eq.setNumBulkQueryThreads( 1 );
+    eq.getElevations( samplePoints, featureSRS, terrainZ, terrainValid, _maxRes );
+
+    // next entry in "terrainZ" (geometries are visited in the same order as above)
+    unsigned nextSample = 0;
+
+    for( FeatureList::iterator i = features.begin(); i != features.end(); ++i )
+    {
+        Feature* feature = i->get();
+        
         double maxTerrainZ  = -DBL_MAX;
         double minTerrainZ  =  DBL_MAX;
         double minHAT       =  DBL_MAX;
@@ -185,69 +244,65 @@ AltitudeFilter::pushAndClamp( FeatureList& features, FilterContext& cx )
         {
             Geometry* geom = gi.next();
 
+            // this geometry's terrain samples:
+            unsigned first = nextSample;
+            nextSample += perVertex ? geom->size() : 1;
+
             // Absolute heights in Z. Only need to collect the HATs; the geometry
             // remains unchanged.
             if ( _altitude->clamping() == AltitudeSymbol::CLAMP_ABSOLUTE )
             {
                 if ( perVertex )
                 {
-                    std::vector<double> elevations;
-                    elevations.reserve( geom->size() );
+                    // a vertex with no data uses 0, as a per-point query would.
+                    const double* elevations = geom->size() > 0 ? &terrainZ[first] : 0L;
 
-                    if ( eq.getElevations( geom->asVector(), featureSRS, elevations, _maxRes ) )
+                    for( Geometry::iterator p = geom->begin(); p != geom->end(); ++p )
                     {
-                        for( unsigned i=0; i<geom->size(); ++i )
-                        {
-                            osg::Vec3d& p = (*geom)[i];
-
-                            p.z() *= scaleZ;
-                            p.z() += offsetZ;
+                        p->z() *= scaleZ;
+                        p->z() += offsetZ;
+                    }
 
-                            double z = p.z();
+                    ZList geoZ( zAlloc );
+                    if ( !vertEquiv )
+                        getZsIn( geom, featureSRS, mapSRS->getGeographicSRS(), arena, geoZ );
 
-                            if ( !vertEquiv )
-                            {
-                                osg::Vec3d tempgeo;
-                                if ( !featureSRS->transform(p, mapSRS->getGeographicSRS(), tempgeo) )
-                                    z = tempgeo.z();
-                            }
+                    for( unsigned i=0; i<geom->size(); ++i )
+                    {
+                        double z = vertEquiv ? (*geom)[i].z() : geoZ[i];
 
-                            double hat = z - elevations[i];
+                        double hat = z - elevations[i];
 
-                            if ( hat > maxHAT )
-                                maxHAT = hat;
-                            if ( hat < minHAT )
-                                minHAT = hat;
+                        if ( hat > maxHAT )
+                            maxHAT = hat;
+                        if ( hat < minHAT )
+                            minHAT = hat;
 
-                            if ( elevations[i] > maxTerrainZ )
-                                maxTerrainZ = elevations[i];
-                            if ( elevations[i] < minTerrainZ )
-                                minTerrainZ = elevations[i];
-                        }
+                        if ( elevations[i] > maxTerrainZ )
+                            maxTerrainZ = elevations[i];
+                        if ( elevations[i] < minTerrainZ )
+                            minTerrainZ = elevations[i];
                     }
                 }
                 else // per centroid
                 {
-                    osgEarth::Bounds bounds = geom->getBounds();
-                    const osg::Vec2d& center = bounds.center2d();
-                    GeoPoint centroid(featureSRS, center.x(), center.y());
-                    double   centroidElevation;
+                    double centroidElevation = terrainZ[first];
 
-                    if ( eq.getElevation( centroid, centroidElevation, _maxRes ) )
+                    if ( terrainValid[first] )
                     {
-                        for( unsigned i=0; i<geom->size(); ++i )
+                        for( Geometry::iterator p = geom->begin(); p != geom->end(); ++p )
                         {
-                            osg::Vec3d& p = (*geom)[i];
-                            p.z() *= scaleZ;
-                            p.z() += offsetZ;
+                            p->z() *= scaleZ;
+                            p->z() += offsetZ;
+                        }
+
+                        ZList geoZ( zAlloc );
+                        if ( !vertEquiv )
+                            getZsIn( geom, featureSRS, mapSRS->getGeographicSRS(), arena, geoZ );
 
-                            double z = p.z();
-                            if ( !vertEquiv )
-                            {
-                                osg::Vec3d tempgeo;
-                                if ( !featureSRS->transform(p, mapSRS->getGeographicSRS(), tempgeo) )
-                                    z = tempgeo.z();
-                            }
+                        for( unsigned i=0; i<geom->size(); ++i )
+                        {
+                            double z = vertEquiv ? (*geom)[i].z() : geoZ[i];
 
                             double hat = z - centroidElevation;
 
@@ -274,48 +329,42 @@ AltitudeFilter::pushAndClamp( FeatureList& features, FilterContext& cx )
 
                 if ( perVertex )
                 {
-                    std::vector<double> elevations;
-                    elevations.reserve( geom->size() );
+                    // a vertex with no data uses 0, as a per-point query would.
+                    const double* elevations = geom->size() > 0 ? &terrainZ[first] : 0L;
 
-                    if ( eq.getElevations( geom->asVector(), featureSRS, elevations, _maxRes ) )
+                    for( unsigned i=0; i<geom->size(); ++i )
                     {
-                        for( unsigned i=0; i<geom->size(); ++i )
-                        {
-                            osg::Vec3d& p = (*geom)[i];
+                        osg::Vec3d& p = (*geom)[i];
 
-                            p.z() *= scaleZ;
-                            p.z() += offsetZ;
+                        p.z() *= scaleZ;
+                        p.z() += offsetZ;
 
-                            double hat = p.z();
-                            p.z() = elevations[i] + p.z();
+                        double hat = p.z();
+                        p.z() = elevations[i] + p.z();
 
-                            // if necessary, convert the Z value (which is now in the map's SRS) back to
-                            // the feature's SRS.
-                            if ( !vertEquiv )
-                            {
-                                featureSRSwithMapVertDatum->transform(p, featureSRS, p);
-                            }
+                        if ( hat > maxHAT )
+                            maxHAT = hat;
+                        if ( hat < minHAT )
+                            minHAT = hat;
 
-                            if ( hat > maxHAT )
-                                maxHAT = hat;
-                            if ( hat < minHAT )
-                                minHAT = hat;
+                        if ( elevations[i] > maxTerrainZ )
+                            maxTerrainZ = elevations[i];
+                        if ( elevations[i] < minTerrainZ )
+                            minTerrainZ = elevations[i];
+                    }
 
-                            if ( elevations[i] > maxTerrainZ )
-                                maxTerrainZ = elevations[i];
-                            if ( elevations[i] < minTerrainZ )
-                                minTerrainZ = elevations[i];
-                        }
+                    // if necessary, convert the Z values (which are now in the map's SRS) back to
+                    // the feature's SRS, all in one go.
+                    if ( !vertEquiv )
+                    {
+                        featureSRSwithMapVertDatum->transform( geom->asVector(), featureSRS );
                     }
                 }
                 else // per-centroid
                 {
-                    osgEarth::Bounds bounds = geom->getBounds();
-                    const osg::Vec2d& center = bounds.center2d();
-                    GeoPoint centroid(featureSRS, center.x(), center.y());
-                    double   centroidElevation;
+                    double centroidElevation = terrainZ[first];
 
-                    if ( eq.getElevation( centroid, centroidElevation, _maxRes ) )
+                    if ( terrainValid[first] )
                     {
                         for( unsigned i=0; i<geom->size(); ++i )
                         {
@@ -326,19 +375,19 @@ AltitudeFilter::pushAndClamp( FeatureList& features, FilterContext& cx )
                             double hat = p.z();
                             p.z() = centroidElevation + p.z();
 
-                            // if necessary, convert the Z value (which is now in the map's SRS) back to
-                            // the feature's SRS.
-                            if ( !vertEquiv )
-                            {
-                                featureSRSwithMapVertDatum->transform(p, featureSRS, p);
-                            }
-
                             if ( hat > maxHAT )
                                 maxHAT = hat;
                             if ( hat < minHAT )
                                 minHAT = hat;
                         }
 
+                        // if necessary, convert the Z values (which are now in the map's SRS) back to
+                        // the feature's SRS, all in one go.
+                        if ( !vertEquiv )
+                        {
+                            featureSRSwithMapVertDatum->transform( geom->asVector(), featureSRS );
+                        }
+
                         if ( centroidElevation > maxTerrainZ )
                             maxTerrainZ = centroidElevation;
                         if ( centroidElevation < minTerrainZ )
@@ -352,8 +401,12 @@ AltitudeFilter::pushAndClamp( FeatureList& features, FilterContext& cx )
             {
                 if ( perVertex )
                 {
-                    eq.getElevations( geom->asVector(), featureSRS, true, _maxRes );
-                    
+                    for( unsigned i=0; i<geom->size(); ++i )
+                    {
+                        if ( terrainValid[first+i] )
+                            (*geom)[i].z() = terrainZ[first+i];
+                    }
+
                     // if necessary, transform the Z values (which are now in the map SRS) back
                     // into the feature's SRS.
                     if ( !vertEquiv )
@@ -361,35 +414,27 @@ AltitudeFilter::pushAndClamp( FeatureList& features, FilterContext& cx )
                         osg::ref_ptr<const SpatialReference> featureSRSwithMapVertDatum =
                             SpatialReference::create(featureSRS->getHorizInitString(), mapSRS->getVertInitString());
 
-                        osg::Vec3d tempgeo;
-                        for( unsigned i=0; i<geom->size(); ++i )
-                        {
-                            osg::Vec3d& p = (*geom)[i];
-                            featureSRSwithMapVertDatum->transform(p, featureSRS, p);
-                        }
+                        featureSRSwithMapVertDatum->transform( geom->asVector(), featureSRS );
                     }
                 }
                 else // per-centroid
                 {
-                    osgEarth::Bounds bounds = geom->getBounds();
-                    const osg::Vec2d& center = bounds.center2d();
-                    GeoPoint centroid(featureSRS, center.x(), center.y());
-                    double   centroidElevation;
+                    double centroidElevation = terrainZ[first];
 
                     osg::ref_ptr<const SpatialReference> featureSRSWithMapVertDatum;
                     if ( !vertEquiv )
                         featureSRSWithMapVertDatum = SpatialReference::create(featureSRS->getHorizInitString(), mapSRS->getVertInitString());
 
-                    if ( eq.getElevation( centroid, centroidElevation, _maxRes ) )
+                    if ( terrainValid[first] )
                     {
-                        for( unsigned i=0; i<geom->size(); ++i )
+                        for( Geometry::iterator p = geom->begin(); p != geom->end(); ++p )
                         {
-                            osg::Vec3d& p = (*geom)[i];
-                            p.z() = centroidElevation;
-                            if ( !vertEquiv )
-                            {
-                                featureSRSWithMapVertDatum->transform(p, featureSRS, p);
-                            }
+                            p->z() = centroidElevation;
+                        }
+
+                        if ( !vertEquiv )
+                        {
+                            featureSRSWithMapVertDatum->transform( geom->asVector(), featureSRS );
                         }
                     }
                 }
@@ -24,9 +24,14 @@
 #include <osgEarthSymbology/PointSymbol>
 #include <osgEarthSymbology/LineSymbol>
 #include <osgEarthSymbology/PolygonSymbol>
+#include <osgEarthSymbology/MeshConsolidator>
 #include <osgEarthSymbology/MeshSubdivider>
 #include <osgEarthSymbology/ResourceCache>
+#include <osgEarth/Containers>
+#include <osgEarth/ECEF>
+#include <osgEarth/TaskService>
 #include <osgEarth/Tessellator>
+#include <osgEarth/ThreadingUtils>
 #include <osgEarth/Utils>
 #include <osg/Geode>
 #include <osg/Geometry>
@@ -44,6 +49,7 @@
 #include <osgDB/WriteFile>
 #include <osg/Version>
 #include <iterator>
+#include <cstring>
 
 #define LC "[BuildGeometryFilter] "
 
@@ -89,6 +95,232 @@ namespace
 
         return false;
     }
+
+    // Tessellates the polygons in a geometry, falling back on the OSG tessellator
+    // if the ear clipper fails. Returns true if the ear clipper succeeded, in which
+    // case the vertex array was not modified and the triangles are reusable.
+    bool tessellatePolygons(osgEarth::Tessellator& oeTess, osg::Geometry* osgGeom)
+    {
+        if (oeTess.tessellateGeometry(*osgGeom))
+            return true;
+
+        //fallback to osg tessellator
+        OE_DEBUG << LC << "Falling back on OSG tessellator (" << osgGeom->getName() << ")" << std::endl;
+
+        osgUtil::Tessellator tess;
+        tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
+        tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_POSITIVE );
+        tess.retessellatePolygons( *osgGeom );
+        return false;
+    }
+
+    // Identifies the triangulation of one feature part. Two independent 32-bit
+    // hashes of the source rings' XY coordinates (Z does not affect the
+    // triangulation, so re-clamped or re-extruded features still match), plus
+    // the point count and the number of vertices the part was built into.
+    struct TessKey
+    {
+        unsigned _h1, _h2;
+        unsigned _numPoints;
+        unsigned _numVerts;
+        bool     _ecef;
+
+        bool operator < (const TessKey& rhs) const {
+            if ( _h1 != rhs._h1 ) return _h1 < rhs._h1;
+            if ( _h2 != rhs._h2 ) return _h2 < rhs._h2;
+            if ( _numPoints != rhs._numPoints ) return _numPoints < rhs._numPoints;
+            if ( _numVerts != rhs._numVerts ) return _numVerts < rhs._numVerts;
+            return _ecef < rhs._ecef;
+        }
+    };
+
+    struct TessKeyHash {
+        unsigned operator()(const TessKey& key) const {
+            return key._h1;
+        }
+    };
+
+    void hashWord(unsigned w, unsigned& h1, unsigned& h2)
+    {
+        for(unsigned i=0; i<4; ++i, w >>= 8)
+        {
+            h1 = (h1 ^ (w & 0xff)) * 16777619u;   // FNV-1a
+            h2 = (h2 * 33u) ^ (w & 0xff);         // djb2a
+        }
+    }
+
+    // hashes the source rings; the caller fills in _numVerts after building.
+    TessKey makeTessKey(const Geometry* part, bool ecef)
+    {
+        TessKey key;
+        key._h1 = 2166136261u;
+        key._h2 = 5381u;
+        key._numPoints = 0;
+        key._numVerts = 0;
+        key._ecef = ecef;
+
+        ConstGeometryIterator rings( part, true );
+        while( rings.hasMore() )
+        {
+            const Geometry* ring = rings.next();
+            hashWord( ring->size(), key._h1, key._h2 );
+            for(Geometry::const_iterator p = ring->begin(); p != ring->end(); ++p)
+            {
+                double xy[2] = { p->x(), p->y() };
+                unsigned words[4];
+                ::memcpy( words, xy, sizeof(xy) );
+                for(unsigned w=0; w<4; ++w)
+                    hashWord( words[w], key._h1, key._h2 );
+            }
+            key._numPoints += ring->size();
+        }
+        return key;
+    }
+
+    // The triangle indices of each primitive set produced by the ear clipper.
+    struct Triangulation : public osg::Referenced
+    {
+        std::vector< std::vector<GLuint> > _primitives;
+    };
+
+    // Session-wide cache of polygon triangulations, so that re-styling or
+    // re-building the same features (e.g., at another LOD) skips tessellation.
+    struct TessellationCache : public osg::Referenced
+    {
+        TessellationCache() : _cache( 4096 ) { }
+        ShardedLRUCache<TessKey, osg::ref_ptr<Triangulation>, TessKeyHash> _cache;
+    };
+
+    struct CreateTessellationCache : public Session::CreateFunctor<TessellationCache> {
+        TessellationCache* operator()() const { return new TessellationCache(); }
+    };
+
+    // Replaces the primitive sets of a freshly built polygon geometry with a
+    // cached triangulation. Returns false if the triangulation does not fit.
+    bool applyTriangulation(const Triangulation* tri, osg::Geometry* osgGeom)
+    {
+        unsigned numVerts = osgGeom->getVertexArray()->getNumElements();
+        for(unsigned i=0; i<tri->_primitives.size(); ++i)
+        {
+            const std::vector<GLuint>& indices = tri->_primitives[i];
+            if ( indices.size() % 3 != 0 )
+                return false;
+            for(unsigned j=0; j<indices.size(); ++j)
+                if ( indices[j] >= numVerts )
+                    return false;
+        }
+
+        if ( osgGeom->getNumPrimitiveSets() )
+            osgGeom->removePrimitiveSet( 0, osgGeom->getNumPrimitiveSets() );
+
+        // new primitive sets every time; the mesh subdivider modifies them in place.
+        for(unsigned i=0; i<tri->_primitives.size(); ++i)
+        {
+            const std::vector<GLuint>& indices = tri->_primitives[i];
+            osgGeom->addPrimitiveSet( new osg::DrawElementsUInt(
+                osg::PrimitiveSet::TRIANGLES, indices.size(), indices.empty() ? 0L : &indices[0]) );
+        }
+        return true;
+    }
+
+    // Records the primitive sets produced by the ear clipper.
+    Triangulation* createTriangulation(const osg::Geometry* osgGeom)
+    {
+        osg::ref_ptr<Triangulation> tri = new Triangulation();
+        for(unsigned i=0; i<osgGeom->getNumPrimitiveSets(); ++i)
+        {
+            const osg::DrawElementsUInt* de = dynamic_cast<const osg::DrawElementsUInt*>(osgGeom->getPrimitiveSet(i));
+            if ( !de || de->getMode() != osg::PrimitiveSet::TRIANGLES )
+                return 0L;
+            tri->_primitives.push_back( std::vector<GLuint>(de->begin(), de->end()) );
+        }
+        return tri.release();
+    }
+
+    // A polygon part that has been built but not yet tessellated.
+    struct BuiltPart
+    {
+        osg::ref_ptr<osg::Geometry> _geom;
+        Feature*                    _input;
+        osg::Vec4f                  _color;
+        osg::Matrixd                _l2w;
+        TessKey                     _key;
+    };
+
+    // Tessellates a contiguous range of built polygon geometries.
+    struct TessellateRange
+    {
+        std::vector<osg::Geometry*>* _geoms;
+        std::vector<char>*           _reusable;
+        unsigned                     _begin, _end;
+
+        void execute() {
+            osgEarth::Tessellator oeTess;
+            for(unsigned i=_begin; i<_end; ++i)
+                (*_reusable)[i] = tessellatePolygons( oeTess, (*_geoms)[i] );
+        }
+    };
+
+    // Polygon tessellation is pure CPU work on independent geometries, so it
+    // runs on its own pool; callers block on it and never run on it.
+    TaskService* getTessellationService()
+    {
+        static Threading::Mutex            s_mutex;
+        static osg::ref_ptr<TaskService>   s_service;
+
+        Threading::ScopedMutexLock lock( s_mutex );
+        if ( !s_service.valid() )
+        {
+            int numThreads = osg::clampBetween(OpenThreads::GetNumberOfProcessors(), 1, 16);
+            s_service = new TaskService( "Polygon tessellation", numThreads );
+        }
+        return s_service.get();
+    }
+
+    // Below this many vertices, tessellating serially beats dispatching tasks.
+#define MIN_VERTS_FOR_PARALLEL_TESSELLATION 4096
+
+    // Tessellates each geometry, in parallel when there is enough work.
+    // reusable[i] is non-zero if geoms[i] was tessellated by the ear clipper.
+    void tessellateAll(std::vector<osg::Geometry*>& geoms, std::vector<char>& reusable)
+    {
+        reusable.assign( geoms.size(), 0 );
+
+        unsigned totalVerts = 0;
+        for(unsigned i=0; i<geoms.size(); ++i)
+            totalVerts += geoms[i]->getVertexArray()->getNumElements();
+
+        if ( geoms.size() < 2 || totalVerts < MIN_VERTS_FOR_PARALLEL_TESSELLATION )
+        {
+            TessellateRange serial;
+            serial._geoms = &geoms;
+            serial._reusable = &reusable;
+            serial._begin = 0;
+            serial._end = geoms.size();
+            serial.execute();
+            return;
+        }
+
+        TaskService* service = getTessellationService();
+
+        // a few ranges per thread to balance uneven polygon sizes.
+        unsigned numTasks = std::min( (unsigned)geoms.size(), (unsigned)service->getNumThreads() * 4u );
+        unsigned perTask  = (geoms.size() + numTasks - 1) / numTasks;
+        numTasks = (geoms.size() + perTask - 1) / perTask;
+
+        Threading::MultiEvent semaphore( (int)numTasks );
+        for(unsigned t=0; t<numTasks; ++t)
+        {
+            ParallelTask<TessellateRange>* task = new ParallelTask<TessellateRange>( &semaphore );
+            task->_geoms = &geoms;
+            task->_reusable = &reusable;
+            task->_begin = t * perTask;
+            task->_end = std::min( (unsigned)geoms.size(), (t+1) * perTask );
+            service->add( task );
+        }
+
+        semaphore.wait();
+    }
 }
 
 BuildGeometryFilter::BuildGeometryFilter( const Style& style ) :
@@ -104,6 +336,9 @@ BuildGeometryFilter::processPolygons(FeatureList& features, const FilterContext&
 {
     osg::Geode* geode = new osg::Geode();
 
+    // scratch memory for the per-part temporaries.
+    Arena* arena = context.arena();
+
     bool makeECEF = false;
     const SpatialReference* featureSRS = 0L;
     const SpatialReference* mapSRS = 0L;
@@ -116,6 +351,18 @@ BuildGeometryFilter::processPolygons(FeatureList& features, const FilterContext&
         mapSRS     = context.getSession()->getMapInfo().getProfile()->getSRS();
     }
 
+    // triangulations survive across compilations in the same session.
+    osg::ref_ptr<TessellationCache> tessCache;
+    // (the session's object store is thread-safe shared state, hence the cast.)
+    Session* session = const_cast<Session*>( context.getSession() );
+    if ( session )
+        session->getOrCreateObject( "BuildGeometryFilter::TessellationCache", tessCache, CreateTessellationCache() );
+
+    // Polygons are built in three passes: build each part's outline (serial,
+    // since it reprojects), tessellate all the parts (in parallel, since they
+    // are independent), then finish each part in feature order.
+    std::vector<BuiltPart> built;
+
     for( FeatureList::iterator f = features.begin(); f != features.end(); ++f )
     {
         Feature* input = f->get();
@@ -177,53 +424,94 @@ BuildGeometryFilter::processPolygons(FeatureList& features, const FilterContext&
             }
 
 
-            // build the geometry:
-            tileAndBuildPolygon(part, featureSRS, mapSRS, makeECEF, true, osgGeom, w2l);
+            // identify the triangulation before building touches the part:
+            TessKey key = makeTessKey( part, makeECEF );
+
+            // build the geometry (tessellated below):
+            tileAndBuildPolygon(part, featureSRS, mapSRS, makeECEF, false, osgGeom, w2l, arena);
             //buildPolygon(part, featureSRS, mapSRS, makeECEF, true, osgGeom, w2l);
 
             osg::Vec3Array* allPoints = static_cast<osg::Vec3Array*>(osgGeom->getVertexArray());
             if (allPoints && allPoints->size() > 0)
             {
-                // subdivide the mesh if necessary to conform to an ECEF globe:
-                if ( makeECEF )
-                {
+                built.push_back( BuiltPart() );
+                BuiltPart& b = built.back();
+                b._geom  = osgGeom.get();
+                b._input = input;
+                b._color = primaryColor;
+                b._l2w   = l2w;
+                b._key   = key;
+                b._key._numVerts = allPoints->size();
+            }
+        }
+    }
 
-                    //convert back to world coords
-                    for( osg::Vec3Array::iterator i = allPoints->begin(); i != allPoints->end(); ++i )
-                    {
-                        osg::Vec3d v(*i);
-                        v = v * l2w;
-                        v = v * _world2local;
+    // reuse cached triangulations, and tessellate the rest.
+    std::vector<osg::Geometry*> misses;
+    std::vector<unsigned>       missIndices;
+    for(unsigned i=0; i<built.size(); ++i)
+    {
+        ShardedLRUCache<TessKey, osg::ref_ptr<Triangulation>, TessKeyHash>::Record rec;
+        if ( tessCache.valid() && tessCache->_cache.get(built[i]._key, rec) && applyTriangulation(rec.value().get(), built[i]._geom.get()) )
+            continue;
 
-                        (*i)._v[0] = v[0];
-                        (*i)._v[1] = v[1];
-                        (*i)._v[2] = v[2];
-                    }
+        misses.push_back( built[i]._geom.get() );
+        missIndices.push_back( i );
+    }
 
-                    double threshold = osg::DegreesToRadians( *_maxAngle_deg );
-                    OE_DEBUG << "Running mesh subdivider with threshold " << *_maxAngle_deg << std::endl;
+    if ( !misses.empty() )
+    {
+        std::vector<char> reusable;
+        tessellateAll( misses, reusable );
 
-                    MeshSubdivider ms( _world2local, _local2world );
-                    if ( input->geoInterp().isSet() )
-                        ms.run( *osgGeom, threshold, *input->geoInterp() );
-                    else
-                        ms.run( *osgGeom, threshold, *_geoInterp );
-                }
+        if ( tessCache.valid() )
+        {
+            for(unsigned i=0; i<misses.size(); ++i)
+            {
+                if ( !reusable[i] )
+                    continue;
 
-                // assign the primary color array. PER_VERTEX required in order to support
-                // vertex optimization later
-                osg::Vec4Array* colors = new osg::Vec4Array;
-                colors->assign( osgGeom->getVertexArray()->getNumElements(), primaryColor );
-                osgGeom->setColorArray( colors );
-                osgGeom->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
+                osg::ref_ptr<Triangulation> tri = createTriangulation( misses[i] );
+                if ( tri.valid() )
+                    tessCache->_cache.insert( built[missIndices[i]]._key, tri.get() );
+            }
+        }
+    }
 
-                geode->addDrawable( osgGeom );
+    for(unsigned i=0; i<built.size(); ++i)
+    {
+        osg::Geometry* osgGeom = built[i]._geom.get();
+        Feature*       input   = built[i]._input;
 
-                // record the geometry's primitive set(s) in the index:
-                if ( context.featureIndex() )
-                    context.featureIndex()->tagPrimitiveSets( osgGeom, input );
-            }
+        // subdivide the mesh if necessary to conform to an ECEF globe:
+        if ( makeECEF )
+        {
+
+            //convert back to world coords
+            ECEF::transformPoints( built[i]._l2w * _world2local, static_cast<osg::Vec3Array*>(osgGeom->getVertexArray()) );
+
+            double threshold = osg::DegreesToRadians( *_maxAngle_deg );
+            OE_DEBUG << "Running mesh subdivider with threshold " << *_maxAngle_deg << std::endl;
+
+            MeshSubdivider ms( _world2local, _local2world );
+            if ( input->geoInterp().isSet() )
+                ms.run( *osgGeom, threshold, *input->geoInterp() );
+            else
+                ms.run( *osgGeom, threshold, *_geoInterp );
         }
+
+        // assign the primary color array. PER_VERTEX required in order to support
+        // vertex optimization later
+        osg::Vec4Array* colors = new osg::Vec4Array;
+        colors->assign( osgGeom->getVertexArray()->getNumElements(), built[i]._color );
+        osgGeom->setColorArray( colors );
+        osgGeom->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
+
+        geode->addDrawable( osgGeom );
+
+        // record the geometry's primitive set(s) in the index:
+        if ( context.featureIndex() )
+            context.featureIndex()->tagPrimitiveSets( osgGeom, input );
     }
     
     return geode;
@@ -237,6 +525,9 @@ BuildGeometryFilter::processPolygonizedLines(FeatureList&         features,
 {
     osg::Geode* geode = new osg::Geode();
 
+    // scratch memory for the per-part temporaries.
+    Arena* arena = context.arena();
+
     // establish some referencing
     bool                    makeECEF   = false;
     const SpatialReference* featureSRS = 0L;
@@ -293,7 +584,7 @@ BuildGeometryFilter::processPolygonizedLines(FeatureList&         features,
             // a local reference point.
             osg::ref_ptr<osg::Vec3Array> verts   = new osg::Vec3Array();
             osg::ref_ptr<osg::Vec3Array> normals = new osg::Vec3Array();
-            transformAndLocalize( part->asVector(), featureSRS, verts.get(), normals.get(), mapSRS, _world2local, makeECEF );
+            transformAndLocalize( part->asVector(), featureSRS, verts.get(), normals.get(), mapSRS, _world2local, makeECEF, arena );
 
             // turn the lines into polygons.
             osg::Geometry* geom = polygonizer( verts.get(), normals.get(), twosided );
@@ -313,11 +604,98 @@ BuildGeometryFilter::processPolygonizedLines(FeatureList&         features,
 }
 
 
+osg::Geode*
+BuildGeometryFilter::processGPULines(FeatureList&         features, 
+                                     const FilterContext& context)
+{
+    osg::Geode* geode = new osg::Geode();
+
+    // scratch memory for the per-part temporaries.
+    Arena* arena = context.arena();
+
+    // establish some referencing
+    bool                    makeECEF   = false;
+    const SpatialReference* featureSRS = 0L;
+    const SpatialReference* mapSRS     = 0L;
+
+    if ( context.isGeoreferenced() )
+    {
+        makeECEF   = context.getSession()->getMapInfo().isGeocentric();
+        featureSRS = context.extent()->getSRS();
+        mapSRS     = context.getSession()->getMapInfo().getProfile()->getSRS();
+    }
+
+    // iterate over all features.
+    for( FeatureList::iterator i = features.begin(); i != features.end(); ++i )
+    {
+        Feature* input = i->get();
+
+        // extract the required line symbol; bail out if not found.
+        const LineSymbol* line =
+            input->style().isSet() && input->style()->has<LineSymbol>() ? input->style()->get<LineSymbol>() :
+            _style.get<LineSymbol>();
+
+        if ( !line )
+            continue;
+
+        // run a symbol script if present.
+        if ( line->script().isSet() )
+        {
+            StringExpression temp( line->script().get() );
+            input->eval( temp, &context );
+        }
+
+        GPULinesOperator gpuLines( *line->stroke() );
+
+        // iterate over all the feature's geometry parts. We will treat
+        // them as lines strings.
+        GeometryIterator parts( input->getGeometry(), true );
+        while( parts.hasMore() )
+        {
+            Geometry* part = parts.next();
+
+            // if the underlying geometry is a ring (or a polygon), close it so the
+            // line will form a closed loop.
+            Ring* ring = dynamic_cast<Ring*>(part);
+            if ( ring )
+                ring->close();
+
+            // skip invalid geometry
+            if ( part->size() < 2 )
+                continue;
+
+            // transform the geometry into the target SRS and localize it about 
+            // a local reference point.
+            osg::ref_ptr<osg::Vec3Array> verts   = new osg::Vec3Array();
+            osg::ref_ptr<osg::Vec3Array> normals = new osg::Vec3Array();
+            transformAndLocalize( part->asVector(), featureSRS, verts.get(), normals.get(), mapSRS, _world2local, makeECEF, arena );
+
+            osg::Geometry* geom = gpuLines( verts.get(), normals.get() );
+            if ( geom )
+            {
+                geode->addDrawable( geom );
+
+                // record the geometry's primitive set(s) in the index:
+                if ( context.featureIndex() )
+                    context.featureIndex()->tagPrimitiveSets( geom, input );
+            }
+        }
+
+        // first stroke wins for the shared shader settings, as with polygonizing.
+        gpuLines.installShaders( geode );
+    }
+    return geode;
+}
+
+
 osg::Geode*
 BuildGeometryFilter::processLines(FeatureList& features, const FilterContext& context)
 {
     osg::Geode* geode = new osg::Geode();
 
+    // scratch memory for the per-part temporaries.
+    Arena* arena = context.arena();
+
     bool makeECEF = false;
     const SpatialReference* featureSRS = 0L;
     const SpatialReference* mapSRS = 0L;
@@ -379,7 +757,7 @@ BuildGeometryFilter::processLines(FeatureList& features, const FilterContext& co
             // build the geometry:
             osg::Vec3Array* allPoints = new osg::Vec3Array();
 
-            transformAndLocalize( part->asVector(), featureSRS, allPoints, mapSRS, _world2local, makeECEF );
+            transformAndLocalize( part->asVector(), featureSRS, allPoints, mapSRS, _world2local, makeECEF, arena );
 
             osgGeom->addPrimitiveSet( new osg::DrawArrays(primMode, 0, allPoints->getNumElements()) );
             osgGeom->setVertexArray( allPoints );
@@ -427,6 +805,9 @@ BuildGeometryFilter::processPoints(FeatureList& features, const FilterContext& c
 {
     osg::Geode* geode = new osg::Geode();
 
+    // scratch memory for the per-part temporaries.
+    Arena* arena = context.arena();
+
     bool makeECEF = false;
     const SpatialReference* featureSRS = 0L;
     const SpatialReference* mapSRS = 0L;
@@ -473,7 +854,7 @@ BuildGeometryFilter::processPoints(FeatureList& features, const FilterContext& c
             // build the geometry:
             osg::Vec3Array* allPoints = new osg::Vec3Array();
 
-            transformAndLocalize( part->asVector(), featureSRS, allPoints, mapSRS, _world2local, makeECEF );
+            transformAndLocalize( part->asVector(), featureSRS, allPoints, mapSRS, _world2local, makeECEF, arena );
 
             osgGeom->addPrimitiveSet( new osg::DrawArrays(GL_POINTS, 0, allPoints->getNumElements()) );
             osgGeom->setVertexArray( allPoints );
@@ -510,7 +891,8 @@ BuildGeometryFilter::tileAndBuildPolygon(Geometry*               ring,
                                          bool                    makeECEF,
                                          bool                    tessellate,
                                          osg::Geometry*          osgGeom,
-                                         const osg::Matrixd      &world2local)
+                                         const osg::Matrixd      &world2local,
+                                         Arena*                  arena)
 {
 #ifdef CROP_POLYS_BEFORE_TESSELLATING
 
@@ -529,93 +911,68 @@ BuildGeometryFilter::tileAndBuildPolygon(Geometry*               ring,
 
         OE_DEBUG << "Found " << count << " points; cropping to " << tx << " x " << ty << std::endl;
 
-        osg::ref_ptr<Polygon> poly = new Polygon;
-        poly->resize( 4 );
-
-        built = true;
+        std::vector< osg::ref_ptr<Polygon> > polys;
+        polys.reserve( (unsigned)(tx*ty) );
         for(int x=0; x<(int)tx; ++x)
         {
             for(int y=0; y<(int)ty; ++y)
             {
-                (*poly)[0].set( b.xMin() + tw*(double)x,     b.yMin() + th*(double)y,     0.0 );
-                (*poly)[1].set( b.xMin() + tw*(double)(x+1), b.yMin() + th*(double)y,     0.0 );
-                (*poly)[2].set( b.xMin() + tw*(double)(x+1), b.yMin() + th*(double)(y+1), 0.0 );
-                (*poly)[3].set( b.xMin() + tw*(double)x,     b.yMin() + th*(double)(y+1), 0.0 );
-                
-                osg::ref_ptr<Geometry> ringTile;
-                if ( ring->crop(poly.get(), ringTile) )
-                {
-                    // Use an iterator since crop could return a multi-polygon
-                    GeometryIterator gi( ringTile.get(), false );
-                    while( gi.hasMore() )
-                    {
-                        Geometry* geom = gi.next();
-                        buildPolygon(geom, featureSRS, mapSRS, makeECEF, tessellate, osgGeom, world2local);
-                    }
-                }
-                else 
-                {
-                    // If crop resulted in empty geometry (valid case) ringTile will still be valid,
-                    // otherwise we need to process the entire polygon without tiling.
-                    if (!ringTile.valid())
-                    {
-                        //clean up geometry
-                        osgGeom->setVertexArray(0L);
-                        if (osgGeom->getNumPrimitiveSets())
-                            osgGeom->removePrimitiveSet(0, osgGeom->getNumPrimitiveSets());
+                Polygon* poly = new Polygon( 4 );
+                poly->push_back( osg::Vec3d(b.xMin() + tw*(double)x,     b.yMin() + th*(double)y,     0.0) );
+                poly->push_back( osg::Vec3d(b.xMin() + tw*(double)(x+1), b.yMin() + th*(double)y,     0.0) );
+                poly->push_back( osg::Vec3d(b.xMin() + tw*(double)(x+1), b.yMin() + th*(double)(y+1), 0.0) );
+                poly->push_back( osg::Vec3d(b.xMin() + tw*(double)x,     b.yMin() + th*(double)(y+1), 0.0) );
+                polys.push_back( poly );
+            }
+        }
 
-                        OE_NOTICE << LC << "GEOS crop failed, tessellating feature without tiling." << std::endl;
+        // crop to all the tiles at once so the ring is only converted once.
+        // An empty tile is a valid result; a failed one means we need to
+        // process the entire polygon without tiling.
+        std::vector< osg::ref_ptr<Geometry> > ringTiles;
+        if ( ring->crop(polys, ringTiles) )
+        {
+            built = true;
+            for(unsigned t=0; t<ringTiles.size(); ++t)
+            {
+                if ( !ringTiles[t]->isValid() )
+                    continue;
 
-                        built = false;
-                        break;
-                    }
+                // Use an iterator since crop could return a multi-polygon
+                GeometryIterator gi( ringTiles[t].get(), false );
+                while( gi.hasMore() )
+                {
+                    Geometry* geom = gi.next();
+                    buildPolygon(geom, featureSRS, mapSRS, makeECEF, tessellate, osgGeom, world2local, arena);
                 }
             }
-
-            // GEOS failed 
-            if (!built)
-                break;
+        }
+        else
+        {
+            OE_NOTICE << LC << "GEOS crop failed, tessellating feature without tiling." << std::endl;
         }
     }
 
     if ( !built )
     {
-        buildPolygon(ring, featureSRS, mapSRS, makeECEF, tessellate, osgGeom, world2local);
+        buildPolygon(ring, featureSRS, mapSRS, makeECEF, tessellate, osgGeom, world2local, arena);
     }
     
 
     if ( tessellate )
     {
         osgEarth::Tessellator oeTess;
-        if (!oeTess.tessellateGeometry(*osgGeom))
-        {
-            //fallback to osg tessellator
-            OE_DEBUG << LC << "Falling back on OSG tessellator (" << osgGeom->getName() << ")" << std::endl;
-
-            osgUtil::Tessellator tess;
-            tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
-            tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_POSITIVE );
-            tess.retessellatePolygons( *osgGeom );
-        }
+        tessellatePolygons( oeTess, osgGeom );
     }
 
 #else
 
     // non-cropped way
-    buildPolygon(ring, featureSRS, mapSRS, makeECEF, tessellate, osgGeom, world2local);
+    buildPolygon(ring, featureSRS, mapSRS, makeECEF, tessellate, osgGeom, world2local, arena);
     if ( tessellate )
     {
         osgEarth::Tessellator oeTess;
-        if (!oeTess.tessellateGeometry(*osgGeom))
-        {
-            //fallback to osg tessellator
-            OE_INFO << LC << "OE Tessellation failed! Using OSG tessellator. (" << osgGeom->getName() << ")" << std::endl;
-
-            osgUtil::Tessellator tess;
-            tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
-            tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_POSITIVE );
-            tess.retessellatePolygons( *osgGeom );
-        }
+        tessellatePolygons( oeTess, osgGeom );
     }
 #endif
 }
@@ -628,7 +985,8 @@ BuildGeometryFilter::buildPolygon(Geometry*               ring,
                                   bool                    makeECEF,
                                   bool                    tessellate,
                                   osg::Geometry*          osgGeom,
-                                  const osg::Matrixd      &world2local)
+                                  const osg::Matrixd      &world2local,
+                                  Arena*                  arena)
 {
     if ( !ring->isValid() )
         return;
@@ -636,7 +994,7 @@ BuildGeometryFilter::buildPolygon(Geometry*               ring,
     ring->rewind(osgEarth::Symbology::Geometry::ORIENTATION_CCW);
 
     osg::ref_ptr<osg::Vec3Array> allPoints = new osg::Vec3Array();
-    transformAndLocalize( ring->asVector(), featureSRS, allPoints.get(), mapSRS, world2local, makeECEF );
+    transformAndLocalize( ring->asVector(), featureSRS, allPoints.get(), mapSRS, world2local, makeECEF, arena );
 
     Polygon* poly = dynamic_cast<Polygon*>(ring);
     if ( poly )
@@ -652,7 +1010,7 @@ BuildGeometryFilter::buildPolygon(Geometry*               ring,
                 hole->rewind(osgEarth::Symbology::Geometry::ORIENTATION_CW);
 
                 osg::ref_ptr<osg::Vec3Array> holePoints = new osg::Vec3Array();
-                transformAndLocalize( hole->asVector(), featureSRS, holePoints.get(), mapSRS, world2local, makeECEF );
+                transformAndLocalize( hole->asVector(), featureSRS, holePoints.get(), mapSRS, world2local, makeECEF, arena );
 
                 // find the point with the highest x value
                 unsigned int hCursor = 0;
@@ -904,6 +1262,11 @@ BuildGeometryFilter::push( FeatureList& input, FilterContext& context )
                     osgUtil::Optimizer::INDEX_MESH |
                     osgUtil::Optimizer::VERTEX_POSTTRANSFORM );
             }
+            else
+            {
+                // features are tagged by vertex range, which merging preserves.
+                MeshConsolidator::run( *geode );
+            }
             result->addChild( geode.get() );
         }
     }
@@ -912,6 +1275,46 @@ BuildGeometryFilter::push( FeatureList& input, FilterContext& context )
     {
         OE_TEST << LC << "Building " << polygonizedLines.size() << " polygonized lines." << std::endl;
         bool twosided = polygons.size() > 0 ? false : true;
+
+        // lines that ask for it are expanded on the GPU instead (always two-sided).
+        FeatureList gpuLines;
+        if ( twosided && GPULinesOperator::isSupported() )
+        {
+            FeatureList cpuLines;
+            for(FeatureList::iterator i = polygonizedLines.begin(); i != polygonizedLines.end(); ++i)
+            {
+                Feature* f = i->get();
+                const LineSymbol* fline =
+                    f->style().isSet() && f->style()->has<LineSymbol>() ? f->style()->get<LineSymbol>() : line;
+
+                if ( fline && fline->useGPU() == true )
+                    gpuLines.push_back( f );
+                else
+                    cpuLines.push_back( f );
+            }
+            polygonizedLines.swap( cpuLines );
+        }
+
+        if ( gpuLines.size() > 0 )
+        {
+            OE_TEST << LC << "Building " << gpuLines.size() << " GPU lines." << std::endl;
+            osg::ref_ptr<osg::Geode> geode = processGPULines(gpuLines, context);
+            if ( geode->getNumDrawables() > 0 )
+            {
+                if ( !context.featureIndex() )
+                {
+                    // only merge; the strips are already optimal for the shader.
+                    osgUtil::Optimizer o;
+                    o.optimize( geode.get(), osgUtil::Optimizer::MERGE_GEOMETRY );
+                }
+                result->addChild( geode.get() );
+            }
+        }
+    }
+
+    if ( polygonizedLines.size() > 0 )
+    {
+        bool twosided = polygons.size() > 0 ? false : true;
         osg::ref_ptr<osg::Geode> geode = processPolygonizedLines(polygonizedLines, twosided, context);
         if ( geode->getNumDrawables() > 0 )
         {
@@ -924,6 +1327,10 @@ BuildGeometryFilter::push( FeatureList& input, FilterContext& context )
                     osgUtil::Optimizer::INDEX_MESH |
                     osgUtil::Optimizer::VERTEX_POSTTRANSFORM );
             }
+            else
+            {
+                MeshConsolidator::run( *geode );
+            }
             result->addChild( geode.get() );
         }
     }
@@ -940,6 +1347,10 @@ BuildGeometryFilter::push( FeatureList& input, FilterContext& context )
                 o.optimize( geode.get(), 
                     osgUtil::Optimizer::MERGE_GEOMETRY );
             }
+            else
+            {
+                MeshConsolidator::run( *geode );
+            }
             applyLineSymbology( geode->getOrCreateStateSet(), line );
             result->addChild( geode.get() );
         }
@@ -957,6 +1368,10 @@ BuildGeometryFilter::push( FeatureList& input, FilterContext& context )
                 o.optimize( geode.get(), 
                     osgUtil::Optimizer::MERGE_GEOMETRY );
             }
+            else
+            {
+                MeshConsolidator::run( *geode );
+            }
             applyPointSymbology( geode->getOrCreateStateSet(), point );
             result->addChild( geode.get() );
         }
@@ -0,0 +1,590 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthFeatures/ColumnarFeatureSource>
+#include <osgEarthFeatures/FilterContext>
+#include <queue>
+
+#define LC "[ColumnarFeatureSource] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // part type for the holes that follow a polygon part.
+    const unsigned char PART_HOLE = 0xff;
+
+    const unsigned NO_STRING = ~0u;
+}
+
+namespace osgEarth { namespace Features
+{
+    /**
+     * Cursor over a precomputed list of rows. Materializes features a
+     * chunk at a time and runs the source's filters on each chunk.
+     */
+    class ColumnarFeatureCursor : public FeatureCursor
+    {
+    public:
+        ColumnarFeatureCursor(const ColumnarFeatureSource* source,
+                              std::vector<unsigned>&       rows) :
+        _source   ( source ),
+        _next     ( 0 ),
+        _chunkSize( 500 )
+        {
+            _rows.swap( rows );
+        }
+
+        bool hasMore() const
+        {
+            return !_queue.empty() || _next < _rows.size();
+        }
+
+        Feature* nextFeature()
+        {
+            if ( _queue.empty() )
+                readChunk();
+
+            if ( _queue.empty() )
+                return 0L;
+
+            // hold a reference so the caller doesn't have to.
+            _lastFeatureReturned = _queue.front();
+            _queue.pop();
+            return _lastFeatureReturned.get();
+        }
+
+    private:
+        void readChunk()
+        {
+            while( _queue.empty() && _next < _rows.size() )
+            {
+                FeatureList chunk;
+                {
+                    Threading::ScopedReadLock shared( _source->_mutex );
+                    for( unsigned i=0; i<_chunkSize && _next < _rows.size(); ++i, ++_next )
+                    {
+                        unsigned row = _rows[_next];
+                        if ( row < _source->_fids.size() && !_source->_deleted[row] )
+                            chunk.push_back( _source->createFeature(row) );
+                    }
+                }
+
+                const FeatureFilterList& filters = _source->getFilters();
+                if ( chunk.size() > 0 && filters.size() > 0 )
+                {
+                    FilterContext cx;
+                    cx.setProfile( _source->getFeatureProfile() );
+                    for( FeatureFilterList::const_iterator i = filters.begin(); i != filters.end(); ++i )
+                    {
+                        cx = i->get()->push( chunk, cx );
+                    }
+                }
+
+                for( FeatureList::iterator i = chunk.begin(); i != chunk.end(); ++i )
+                    _queue.push( i->get() );
+            }
+        }
+
+        osg::ref_ptr<const ColumnarFeatureSource> _source;
+        std::vector<unsigned>                     _rows;
+        unsigned                                  _next;
+        unsigned                                  _chunkSize;
+        std::queue< osg::ref_ptr<Feature> >       _queue;
+        osg::ref_ptr<Feature>                     _lastFeatureReturned;
+    };
+} }
+
+//------------------------------------------------------------------------
+
+ColumnarFeatureSource::ColumnarFeatureSource() :
+FeatureSource()
+{
+    _firstPart.push_back( 0 );
+}
+
+ColumnarFeatureSource::ColumnarFeatureSource(const GeoExtent& defaultExtent) :
+FeatureSource (),
+_defaultExtent( defaultExtent )
+{
+    _firstPart.push_back( 0 );
+}
+
+unsigned
+ColumnarFeatureSource::insertFeatures(FeatureCursor* cursor)
+{
+    unsigned count = 0;
+    while( cursor && cursor->hasMore() )
+    {
+        Feature* f = cursor->nextFeature();
+        if ( f && insertFeature(f) )
+            ++count;
+    }
+    return count;
+}
+
+int
+ColumnarFeatureSource::getOrCreateColumn(const std::string& name, AttributeType type)
+{
+    std::map<std::string, int>::const_iterator i = _columnIndex.find( name );
+    if ( i != _columnIndex.end() )
+        return i->second;
+
+    // A NULL attribute of unknown type gives us nothing to go on; store it
+    // as a string, which every value converts to.
+    if ( type == ATTRTYPE_UNSPECIFIED )
+        type = ATTRTYPE_STRING;
+
+    int index = _columns.size();
+    _columns.push_back( Column() );
+    Column& c = _columns.back();
+    c._name = name;
+    c._type = type;
+
+    // back-fill the existing rows with NULLs.
+    unsigned rows = _fids.size();
+    if ( type == ATTRTYPE_DOUBLE )
+        c._doubles.resize( rows, 0.0 );
+    else if ( type == ATTRTYPE_STRING )
+        c._strings.resize( rows, NO_STRING );
+    else
+        c._ints.resize( rows, 0 );
+    c._set.resize( rows, 0 );
+
+    _columnIndex[name] = index;
+    _schema[name] = type;
+    return index;
+}
+
+unsigned
+ColumnarFeatureSource::intern(const std::string& value)
+{
+    std::map<std::string, unsigned>::const_iterator i = _stringIndex.find( value );
+    if ( i != _stringIndex.end() )
+        return i->second;
+
+    unsigned id = _strings.size();
+    _strings.push_back( value );
+    _stringIndex[value] = id;
+    return id;
+}
+
+void
+ColumnarFeatureSource::appendGeometry(const Geometry* geom, Bounds& bounds)
+{
+    if ( !geom )
+        return;
+
+    if ( geom->getType() == Geometry::TYPE_MULTI )
+    {
+        const GeometryCollection& parts = static_cast<const MultiGeometry*>(geom)->getComponents();
+        for( GeometryCollection::const_iterator i = parts.begin(); i != parts.end(); ++i )
+            appendGeometry( i->get(), bounds );
+        return;
+    }
+
+    Part part;
+    part._begin = _coords.size();
+    part._type  = (unsigned char)geom->getType();
+    _parts.push_back( part );
+    for( Geometry::const_iterator i = geom->begin(); i != geom->end(); ++i )
+    {
+        _coords.push_back( *i );
+        bounds.expandBy( i->x(), i->y() );
+    }
+
+    if ( geom->getType() == Geometry::TYPE_POLYGON )
+    {
+        const RingCollection& holes = static_cast<const Polygon*>(geom)->getHoles();
+        for( RingCollection::const_iterator h = holes.begin(); h != holes.end(); ++h )
+        {
+            Part hole;
+            hole._begin = _coords.size();
+            hole._type  = PART_HOLE;
+            _parts.push_back( hole );
+            _coords.insert( _coords.end(), h->get()->begin(), h->get()->end() );
+        }
+    }
+}
+
+bool
+ColumnarFeatureSource::insertFeature(Feature* input)
+{
+    if ( !input )
+        return false;
+
+    Threading::ScopedWriteLock exclusive( _mutex );
+
+    osg::ref_ptr<Feature> feature = input;
+    if ( !_srs.valid() )
+    {
+        _srs = input->getSRS();
+    }
+    else if ( input->getSRS() && !input->getSRS()->isEquivalentTo(_srs.get()) )
+    {
+        feature = new Feature( *input, osg::CopyOp::DEEP_COPY_ALL );
+        feature->transform( _srs.get() );
+    }
+
+    // make sure every attribute has a column before adding the row, so
+    // that new columns are back-filled to the right length.
+    const AttributeTable& attrs = feature->getAttrs();
+    for( AttributeTable::const_iterator a = attrs.begin(); a != attrs.end(); ++a )
+    {
+        getOrCreateColumn( a->first, a->second.first );
+    }
+
+    unsigned row = _fids.size();
+    _fids.push_back( feature->getFID() );
+    _deleted.push_back( 0 );
+
+    // geometry:
+    Bounds bounds;
+    const Geometry* geom = feature->getGeometry();
+    _multi.push_back( geom && geom->getType() == Geometry::TYPE_MULTI ? 1 : 0 );
+    appendGeometry( geom, bounds );
+    _firstPart.push_back( _parts.size() );
+    if ( bounds.valid() )
+    {
+        _extents.push_back( bounds.xMin() );
+        _extents.push_back( bounds.yMin() );
+        _extents.push_back( bounds.xMax() );
+        _extents.push_back( bounds.yMax() );
+    }
+    else
+    {
+        _extents.push_back( 1.0 );
+        _extents.push_back( 1.0 );
+        _extents.push_back( -1.0 );
+        _extents.push_back( -1.0 );
+    }
+
+    // attributes: grow every column by one NULL, then fill in the values.
+    for( std::vector<Column>::iterator c = _columns.begin(); c != _columns.end(); ++c )
+    {
+        if ( c->_type == ATTRTYPE_DOUBLE )
+            c->_doubles.push_back( 0.0 );
+        else if ( c->_type == ATTRTYPE_STRING )
+            c->_strings.push_back( NO_STRING );
+        else
+            c->_ints.push_back( 0 );
+        c->_set.push_back( 0 );
+    }
+
+    for( AttributeTable::const_iterator a = attrs.begin(); a != attrs.end(); ++a )
+    {
+        if ( !a->second.second.set )
+            continue;
+
+        Column& c = _columns[ _columnIndex[a->first] ];
+        switch( c._type )
+        {
+        case ATTRTYPE_DOUBLE: c._doubles[row] = a->second.getDouble(); break;
+        case ATTRTYPE_INT:    c._ints[row]    = a->second.getInt(); break;
+        case ATTRTYPE_BOOL:   c._ints[row]    = a->second.getBool() ? 1 : 0; break;
+        default:              c._strings[row] = intern( a->second.getString() ); break;
+        }
+        c._set[row] = 1;
+    }
+
+    dirtyFeatureProfile();
+    dirty();
+    return true;
+}
+
+int
+ColumnarFeatureSource::findRow(FeatureID fid) const
+{
+    for( unsigned row = 0; row < _fids.size(); ++row )
+    {
+        if ( _fids[row] == fid && !_deleted[row] )
+            return (int)row;
+    }
+    return -1;
+}
+
+bool
+ColumnarFeatureSource::deleteFeature(FeatureID fid)
+{
+    Threading::ScopedWriteLock exclusive( _mutex );
+    int row = findRow( fid );
+    if ( row < 0 )
+        return false;
+
+    // rows are tombstoned; their storage is kept.
+    _deleted[row] = 1;
+    dirtyFeatureProfile();
+    dirty();
+    return true;
+}
+
+int
+ColumnarFeatureSource::getFeatureCount() const
+{
+    Threading::ScopedReadLock shared( _mutex );
+    int count = 0;
+    for( std::vector<char>::const_iterator i = _deleted.begin(); i != _deleted.end(); ++i )
+        if ( *i == 0 )
+            ++count;
+    return count;
+}
+
+Feature*
+ColumnarFeatureSource::getFeature(FeatureID fid)
+{
+    Threading::ScopedReadLock shared( _mutex );
+    int row = findRow( fid );
+    return row >= 0 ? createFeature( row ) : 0L;
+}
+
+int
+ColumnarFeatureSource::getColumn(const std::string& name) const
+{
+    std::map<std::string, int>::const_iterator i = _columnIndex.find( name );
+    return i != _columnIndex.end() ? i->second : -1;
+}
+
+bool
+ColumnarFeatureSource::isSet(int column, unsigned row) const
+{
+    return column >= 0 && _columns[column]._set[row] != 0;
+}
+
+double
+ColumnarFeatureSource::getDouble(int column, unsigned row, double defaultValue) const
+{
+    if ( !isSet(column, row) )
+        return defaultValue;
+    const Column& c = _columns[column];
+    switch( c._type )
+    {
+    case ATTRTYPE_DOUBLE: return c._doubles[row];
+    case ATTRTYPE_STRING: return as<double>( _strings[c._strings[row]], defaultValue );
+    default:              return (double)c._ints[row];
+    }
+}
+
+int
+ColumnarFeatureSource::getInt(int column, unsigned row, int defaultValue) const
+{
+    if ( !isSet(column, row) )
+        return defaultValue;
+    const Column& c = _columns[column];
+    switch( c._type )
+    {
+    case ATTRTYPE_DOUBLE: return (int)c._doubles[row];
+    case ATTRTYPE_STRING: return as<int>( _strings[c._strings[row]], defaultValue );
+    default:              return c._ints[row];
+    }
+}
+
+bool
+ColumnarFeatureSource::getBool(int column, unsigned row, bool defaultValue) const
+{
+    if ( !isSet(column, row) )
+        return defaultValue;
+    const Column& c = _columns[column];
+    switch( c._type )
+    {
+    case ATTRTYPE_DOUBLE: return c._doubles[row] != 0.0;
+    case ATTRTYPE_STRING: return as<bool>( _strings[c._strings[row]], defaultValue );
+    default:              return c._ints[row] != 0;
+    }
+}
+
+const std::string&
+ColumnarFeatureSource::getString(int column, unsigned row) const
+{
+    static const std::string empty;
+    unsigned id = getStringID( column, row );
+    return id != NO_STRING ? _strings[id] : empty;
+}
+
+unsigned
+ColumnarFeatureSource::getStringID(int column, unsigned row) const
+{
+    if ( !isSet(column, row) || _columns[column]._type != ATTRTYPE_STRING )
+        return NO_STRING;
+    return _columns[column]._strings[row];
+}
+
+unsigned
+ColumnarFeatureSource::findString(const std::string& value) const
+{
+    std::map<std::string, unsigned>::const_iterator i = _stringIndex.find( value );
+    return i != _stringIndex.end() ? i->second : NO_STRING;
+}
+
+Bounds
+ColumnarFeatureSource::getBounds(unsigned row) const
+{
+    const double* e = &_extents[row*4];
+    Bounds b;
+    if ( e[0] <= e[2] )
+        b.set( e[0], e[1], 0.0, e[2], e[3], 0.0 );
+    return b;
+}
+
+Geometry*
+ColumnarFeatureSource::createGeometry(unsigned row) const
+{
+    unsigned first = _firstPart[row];
+    unsigned last  = _firstPart[row+1];
+    if ( first == last )
+        return 0L;
+
+    std::vector< osg::ref_ptr<Geometry> > parts;
+    for( unsigned p = first; p < last; ++p )
+    {
+        const Part& part = _parts[p];
+        unsigned end = p+1 < _parts.size() ? _parts[p+1]._begin : _coords.size();
+
+        osg::ref_ptr<Geometry> geom;
+        switch( part._type )
+        {
+        case Geometry::TYPE_POINTSET:   geom = new PointSet(); break;
+        case Geometry::TYPE_LINESTRING: geom = new LineString(); break;
+        case Geometry::TYPE_RING:       geom = new Ring(); break;
+        case Geometry::TYPE_POLYGON:    geom = new Polygon(); break;
+        case PART_HOLE:                 geom = new Ring(); break;
+        default: continue;
+        }
+
+        geom->reserve( end - part._begin );
+        geom->insert( geom->end(), _coords.begin() + part._begin, _coords.begin() + end );
+
+        if ( part._type == PART_HOLE )
+        {
+            if ( !parts.empty() && parts.back()->getType() == Geometry::TYPE_POLYGON )
+                static_cast<Polygon*>(parts.back().get())->getHoles().push_back( static_cast<Ring*>(geom.get()) );
+        }
+        else
+        {
+            parts.push_back( geom.get() );
+        }
+    }
+
+    if ( parts.empty() )
+        return 0L;
+
+    if ( parts.size() == 1 && !_multi[row] )
+        return parts.front().release();
+
+    MultiGeometry* multi = new MultiGeometry();
+    for( unsigned i = 0; i < parts.size(); ++i )
+        multi->add( parts[i].get() );
+    return multi;
+}
+
+Feature*
+ColumnarFeatureSource::createFeature(unsigned row) const
+{
+    Feature* feature = new Feature( createGeometry(row), _srs.get(), Style(), _fids[row] );
+
+    for( unsigned i = 0; i < _columns.size(); ++i )
+    {
+        const Column& c = _columns[i];
+        if ( !c._set[row] )
+        {
+            feature->setNull( c._name, c._type );
+            continue;
+        }
+        switch( c._type )
+        {
+        case ATTRTYPE_DOUBLE: feature->set( c._name, c._doubles[row] ); break;
+        case ATTRTYPE_INT:    feature->set( c._name, c._ints[row] ); break;
+        case ATTRTYPE_BOOL:   feature->set( c._name, c._ints[row] != 0 ); break;
+        default:              feature->set( c._name, _strings[c._strings[row]] ); break;
+        }
+    }
+
+    return feature;
+}
+
+FeatureCursor*
+ColumnarFeatureSource::createFeatureCursor(const Symbology::Query& query)
+{
+    return createFeatureCursor( query, 0L );
+}
+
+FeatureCursor*
+ColumnarFeatureSource::createFeatureCursor(const Symbology::Query& query, const RowFilter* filter)
+{
+    Threading::ScopedReadLock shared( _mutex );
+
+    // Resolve the spatial part of the query against the row extents, so
+    // rows outside the query never become features.
+    Bounds queryBounds;
+    if ( query.bounds().isSet() )
+    {
+        queryBounds = query.bounds().get();
+    }
+    else if ( query.tileKey().isSet() && _srs.valid() )
+    {
+        GeoExtent extent = query.tileKey()->getExtent().transform( _srs.get() );
+        if ( extent.isValid() )
+            queryBounds = extent.bounds();
+    }
+
+    std::vector<unsigned> rows;
+    for( unsigned row = 0; row < _fids.size(); ++row )
+    {
+        if ( _deleted[row] || isBlacklisted(_fids[row]) )
+            continue;
+
+        if ( queryBounds.valid() )
+        {
+            const double* e = &_extents[row*4];
+            if (e[0] > e[2] ||
+                e[2] < queryBounds.xMin() || e[0] > queryBounds.xMax() ||
+                e[3] < queryBounds.yMin() || e[1] > queryBounds.yMax())
+            {
+                continue;
+            }
+        }
+
+        if ( filter && !filter->accept(*this, row) )
+            continue;
+
+        rows.push_back( row );
+    }
+
+    return new ColumnarFeatureCursor( this, rows );
+}
+
+const FeatureProfile*
+ColumnarFeatureSource::createFeatureProfile()
+{
+    Threading::ScopedReadLock shared( _mutex );
+
+    Bounds bounds;
+    for( unsigned row = 0; row < _fids.size(); ++row )
+    {
+        if ( !_deleted[row] )
+            bounds.expandBy( getBounds(row) );
+    }
+
+    if ( _srs.valid() && bounds.valid() )
+        return new FeatureProfile( GeoExtent(_srs.get(), bounds) );
+    else
+        return new FeatureProfile( _defaultExtent );
+}
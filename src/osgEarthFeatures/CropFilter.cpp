@@ -17,6 +17,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthFeatures/CropFilter>
+#include <osgEarthFeatures/Session>
+#include <osgEarthSymbology/GeometryCropCache>
+#include <iomanip>
+#include <sstream>
 
 #define LC "[CropFilter] "
 
@@ -24,6 +28,23 @@ using namespace osgEarth;
 using namespace osgEarth::Features;
 using namespace osgEarth::Symbology;
 
+namespace
+{
+    struct CreateCropCache : public Session::CreateFunctor<GeometryCropCache> {
+        GeometryCropCache* operator()() const { return new GeometryCropCache(); }
+    };
+
+    // identifies a feature's geometry across the tiles of a session.
+    std::string makeCropKey(const Feature* feature, const Geometry* geom, const Bounds& bounds)
+    {
+        std::stringstream buf;
+        buf << std::setprecision(12)
+            << feature->getFID() << ':' << geom->getTotalPointCount() << ':'
+            << bounds.xMin() << ',' << bounds.yMin() << ',' << bounds.xMax() << ',' << bounds.yMax();
+        return buf.str();
+    }
+}
+
 CropFilter::CropFilter( CropFilter::Method method ) :
 _method( method )
 {
@@ -79,6 +100,12 @@ CropFilter::push( FeatureList& input, FilterContext& context )
 
         // create the intersection polygon:
         osg::ref_ptr<Symbology::Polygon> poly;
+
+        // features crossing this tile's edge usually cross its neighbors' too,
+        // so keep their GEOS conversions around for the whole session.
+        osg::ref_ptr<GeometryCropCache> cropCache;
+        if ( context.getSession() )
+            context.getSession()->getOrCreateObject( "CropFilter::GeometryCropCache", cropCache, CreateCropCache() );
         
         for( FeatureList::iterator i = input.begin(); i != input.end();  )
         {
@@ -115,7 +142,11 @@ CropFilter::push( FeatureList& input, FilterContext& context )
                     }
 
                     osg::ref_ptr<Geometry> croppedGeometry;
-                    if ( featureGeom->crop( poly.get(), croppedGeometry ) )
+                    bool cropped = cropCache.valid() ?
+                        cropCache->crop( makeCropKey(feature, featureGeom, bounds), featureGeom, poly.get(), croppedGeometry ) :
+                        featureGeom->crop( poly.get(), croppedGeometry );
+
+                    if ( cropped )
                     {
                         if ( croppedGeometry->isValid() )
                         {
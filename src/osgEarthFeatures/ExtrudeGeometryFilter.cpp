@@ -32,7 +32,6 @@
 #include <osg/MatrixTransform>
 #include <osgUtil/Tessellator>
 #include <osgUtil/Optimizer>
-#include <osgUtil/SmoothingVisitor>
 #include <osg/LineWidth>
 #include <osg/PolygonOffset>
 
@@ -97,6 +96,7 @@ ExtrudeGeometryFilter::reset( const FilterContext& context )
 {
     _cosWallAngleThresh = cos( _wallAngleThresh_deg );
     _geodes.clear();
+    _wallGeometries.clear();
     
     if ( _styleDirty )
     {
@@ -488,10 +488,10 @@ ExtrudeGeometryFilter::buildWallGeometry(const Structure&     structure,
                                          const osg::Vec4&     wallBaseColor,
                                          const SkinResource*  wallSkin)
 {
-    bool madeGeom = true;
-
-    // 6 verts per face total (3 triangles)
-    unsigned numWallVerts = 6 * structure.getNumPoints();
+    // 6 verts per face total (2 triangles)
+    unsigned numWallVerts = structure.getNumPoints();
+    if ( numWallVerts == 0 )
+        return false;
 
     double texWidthM   = wallSkin ? *wallSkin->imageWidth()  : 1.0;
     double texHeightM  = wallSkin ? *wallSkin->imageHeight() : 1.0;
@@ -507,41 +507,58 @@ ExtrudeGeometryFilter::buildWallGeometry(const Structure&     structure,
         layer = (float)wallSkin->imageLayer().get();
     }
 
-    // create all the OSG geometry components
-    osg::Vec3Array* verts = new osg::Vec3Array( numWallVerts );
-    walls->setVertexArray( verts );
+    // create the OSG geometry components, or grow the ones already there
+    // (in a shared wall geometry) by exactly this structure's vertex count.
+    osg::Vec3Array* verts = static_cast<osg::Vec3Array*>( walls->getVertexArray() );
+    if ( !verts )
+    {
+        verts = new osg::Vec3Array();
+        walls->setVertexArray( verts );
+    }
+
+    unsigned first = verts->size();
+    verts->resize( first + numWallVerts );
+
+    osg::Vec3Array* normals = static_cast<osg::Vec3Array*>( walls->getNormalArray() );
+    if ( !normals )
+    {
+        normals = new osg::Vec3Array();
+        walls->setNormalArray( normals );
+        walls->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+    }
+    normals->resize( first + numWallVerts );
     
     osg::Vec3Array* tex = 0L;
     if ( wallSkin )
     { 
-        tex = new osg::Vec3Array( numWallVerts );
-        walls->setTexCoordArray( 0, tex );
+        tex = static_cast<osg::Vec3Array*>( walls->getTexCoordArray(0) );
+        if ( !tex )
+        {
+            tex = new osg::Vec3Array();
+            walls->setTexCoordArray( 0, tex );
+        }
+        tex->resize( first + numWallVerts );
     }
 
     osg::Vec4Array* colors = 0L;
     if ( useColor )
     {
         // per-vertex colors are necessary if we are going to use the MeshConsolidator -gw
-        colors = new osg::Vec4Array( numWallVerts );
-        walls->setColorArray( colors );
-        walls->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
+        colors = static_cast<osg::Vec4Array*>( walls->getColorArray() );
+        if ( !colors )
+        {
+            colors = new osg::Vec4Array();
+            walls->setColorArray( colors );
+            walls->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
+        }
+        colors->resize( first + numWallVerts );
     }
 
-    unsigned vertptr = 0;
+    unsigned vertptr = first;
     bool     tex_repeats_y = wallSkin && wallSkin->isTiled() == true;
 
     for(Elevations::const_iterator elev = structure.elevations.begin(); elev != structure.elevations.end(); ++elev)
     {
-        osg::DrawElements* de = 
-            numWallVerts > 0xFFFF ? (osg::DrawElements*) new osg::DrawElementsUInt  ( GL_TRIANGLES ) :
-            numWallVerts > 0xFF   ? (osg::DrawElements*) new osg::DrawElementsUShort( GL_TRIANGLES ) :
-                                    (osg::DrawElements*) new osg::DrawElementsUByte ( GL_TRIANGLES );
-
-        // pre-allocate for speed
-        de->reserveElements( numWallVerts );
-
-        walls->addPrimitiveSet( de );
-
         for(Faces::const_iterator f = elev->faces.begin(); f != elev->faces.end(); ++f, vertptr+=6)
         {
             // set the 6 wall verts.
@@ -552,6 +569,15 @@ ExtrudeGeometryFilter::buildWallGeometry(const Structure&     structure,
             (*verts)[vertptr+4] = f->right.roof;
             (*verts)[vertptr+5] = f->left.roof;
 
+            // No two faces share a vertex, so each triangle gets a flat normal.
+            // (This matches what a smoothing pass would compute here.)
+            osg::Vec3 n1 = ((*verts)[vertptr+1]-(*verts)[vertptr+0]) ^ ((*verts)[vertptr+2]-(*verts)[vertptr+0]);
+            osg::Vec3 n2 = ((*verts)[vertptr+4]-(*verts)[vertptr+3]) ^ ((*verts)[vertptr+5]-(*verts)[vertptr+3]);
+            n1.normalize();
+            n2.normalize();
+            (*normals)[vertptr+0] = (*normals)[vertptr+1] = (*normals)[vertptr+2] = n1;
+            (*normals)[vertptr+3] = (*normals)[vertptr+4] = (*normals)[vertptr+5] = n2;
+
             // Assign wall polygon colors.
             if (useColor)
             {
@@ -615,22 +641,31 @@ ExtrudeGeometryFilter::buildWallGeometry(const Structure&     structure,
                 (*tex)[vertptr+4].set( texRoofR.x(), texRoofR.y(), layer );
                 (*tex)[vertptr+5].set( texRoofL.x(), texRoofL.y(), layer );
             }
-
-            for(int i=0; i<6; ++i)
-                de->addElement( vertptr+i );
         }
     }
-    
-    // generate per-vertex normals, altering the geometry as necessary to avoid
-    // smoothing around sharp corners
 
-    // TODO: reconsider this, given the new Structure setup
-    // it won't actual smooth corners since we don't have shared edges.
-    osgUtil::SmoothingVisitor::smooth(
-        *walls,
-        osg::DegreesToRadians(_wallAngleThresh_deg) );
+    // the wall verts are laid out in triangle order, so no index list is needed.
+    walls->addPrimitiveSet( new osg::DrawArrays(GL_TRIANGLES, first, numWallVerts) );
 
-    return madeGeom;
+    return true;
+}
+
+osg::Geometry*
+ExtrudeGeometryFilter::getSharedWallGeometry(osg::StateSet*      stateSet,
+                                             const SkinResource* wallSkin)
+{
+    // walls can only share a geometry if they have the same vertex arrays.
+    bool     useColor = (!wallSkin || wallSkin->texEnvMode() != osg::TexEnv::DECAL) && !_makeStencilVolume;
+    unsigned layout   = (wallSkin ? 1u : 0u) | (useColor ? 2u : 0u);
+
+    osg::ref_ptr<osg::Geometry>& walls = _wallGeometries[WallGeometryKey(stateSet, layout)];
+    if ( !walls.valid() )
+    {
+        walls = new osg::Geometry();
+        walls->setUseVertexBufferObjects( _useVertexBufferObjects.get() );
+        addDrawable( walls.get(), stateSet, std::string(), 0L, 0L );
+    }
+    return walls.get();
 }
 
 
@@ -810,7 +845,26 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
     Random wallSkinPRNG( _wallSkinSymbol.valid()? *_wallSkinSymbol->randomSeed() : 0, Random::METHOD_FAST );
     Random roofSkinPRNG( _roofSkinSymbol.valid()? *_roofSkinSymbol->randomSeed() : 0, Random::METHOD_FAST );
 
-    for( FeatureList::iterator f = features.begin(); f != features.end(); ++f )
+    // with merging on (and no per-feature names), all walls go straight into
+    // shared geometries instead of one geometry per part.
+    bool shareWalls = _mergeGeometry == true && _featureNameExpr.empty();
+
+    FeatureSourceIndex* index = context.featureIndex();
+
+    // evaluate the height expressions for all features at once, unless a
+    // symbol script might change the attributes along the way.
+    std::vector<double> heights, offsets;
+    if ( !_extrusionSymbol->script().isSet() )
+    {
+        if ( !_heightCallback.valid() && _heightExpr.isSet() )
+            Feature::evalBatch( _heightExpr.get(), features, heights, &context );
+
+        if ( _heightOffsetExpr.isSet() )
+            Feature::evalBatch( _heightOffsetExpr.get(), features, offsets, &context );
+    }
+
+    unsigned featureIndex = 0;
+    for( FeatureList::iterator f = features.begin(); f != features.end(); ++f, ++featureIndex )
     {
         Feature* input = f->get();
 
@@ -827,9 +881,6 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
         {
             Geometry* part = iter.next();
 
-            osg::ref_ptr<osg::Geometry> walls = new osg::Geometry();
-            walls->setUseVertexBufferObjects( _useVertexBufferObjects.get() );
-            
             osg::ref_ptr<osg::Geometry> rooflines = 0L;
             osg::ref_ptr<osg::Geometry> baselines = 0L;
             osg::ref_ptr<osg::Geometry> outlines  = 0L;
@@ -866,7 +917,8 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
             }
             else if ( _heightExpr.isSet() )
             {
-                height = input->eval( _heightExpr.mutable_value(), &context );
+                height = !heights.empty() ? heights[featureIndex] :
+                    input->eval( _heightExpr.mutable_value(), &context );
             }
             else
             {
@@ -877,7 +929,8 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
             float offset = 0.0;
             if ( _heightOffsetExpr.isSet() )
             {
-                offset = input->eval( _heightOffsetExpr.mutable_value(), &context );
+                offset = !offsets.empty() ? offsets[featureIndex] :
+                    input->eval( _heightOffsetExpr.mutable_value(), &context );
             }
 
             osg::ref_ptr<osg::StateSet> wallStateSet;
@@ -930,8 +983,24 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
                 context);
 
             // Create the walls.
-            if ( walls.valid() )
+            osg::ref_ptr<osg::Geometry> walls;
             {
+                if ( wallSkin )
+                {
+                    // Get a stateset for the individual wall stateset
+                    context.resourceCache()->getOrCreateStateSet( wallSkin, wallStateSet );
+                }
+
+                if ( shareWalls )
+                {
+                    walls = getSharedWallGeometry( wallStateSet.get(), wallSkin );
+                }
+                else
+                {
+                    walls = new osg::Geometry();
+                    walls->setUseVertexBufferObjects( _useVertexBufferObjects.get() );
+                }
+
                 osg::Vec4f wallColor(1,1,1,1), wallBaseColor(1,1,1,1);
 
                 if ( _wallPolygonSymbol.valid() )
@@ -948,12 +1017,19 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
                     wallBaseColor = wallColor;
                 }
 
-                buildWallGeometry(structure, walls.get(), wallColor, wallBaseColor, wallSkin);
-
-                if ( wallSkin )
+                if ( buildWallGeometry(structure, walls.get(), wallColor, wallBaseColor, wallSkin) )
                 {
-                    // Get a stateset for the individual wall stateset
-                    context.resourceCache()->getOrCreateStateSet( wallSkin, wallStateSet );
+                    // a shared geometry is already in the graph; just tag this part's walls.
+                    if ( shareWalls )
+                    {
+                        if ( index )
+                            index->tagPrimitiveSet( walls->getPrimitiveSetList().back().get(), input );
+                        walls = 0L;
+                    }
+                }
+                else
+                {
+                    walls = 0L;
                 }
             }
 
@@ -1001,8 +1077,6 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
             if ( !_featureNameExpr.empty() )
                 name = input->eval( _featureNameExpr, &context );
 
-            FeatureSourceIndex* index = context.featureIndex();
-
             if ( walls.valid() )
             {
                 addDrawable( walls.get(), wallStateSet.get(), name, input, index );
@@ -1078,6 +1152,23 @@ ExtrudeGeometryFilter::push( FeatureList& input, FilterContext& context )
     // push all the features through the extruder.
     bool ok = process( input, context );
 
+    // A shared wall geometry holds its parts' verts back to back. Unless each
+    // part's primitive set carries a feature index tag, draw them all at once.
+    if ( !context.featureIndex() )
+    {
+        for( WallGeometryMap::iterator i = _wallGeometries.begin(); i != _wallGeometries.end(); ++i )
+        {
+            osg::Geometry* walls = i->second.get();
+            if ( walls->getVertexArray() && walls->getNumPrimitiveSets() > 1 )
+            {
+                unsigned count = walls->getVertexArray()->getNumElements();
+                walls->removePrimitiveSet( 0, walls->getNumPrimitiveSets() );
+                walls->addPrimitiveSet( new osg::DrawArrays(GL_TRIANGLES, 0, count) );
+            }
+        }
+    }
+    _wallGeometries.clear();
+
     // convert everything to triangles and combine drawables.
     if ( _mergeGeometry == true && _featureNameExpr.empty() )
     {
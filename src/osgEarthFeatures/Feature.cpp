@@ -364,6 +364,148 @@ Feature::eval( StringExpression& expr, FilterContext const* context ) const
 }
 
 
+void
+Feature::evalBatch(const NumericExpression& expr,
+                   const FeatureList&       features,
+                   std::vector<double>&     out_results,
+                   FilterContext const*     context)
+{
+    out_results.resize( features.size() );
+    if ( features.empty() )
+        return;
+
+    // resolve the variable names once:
+    const NumericExpression::Variables& vars = expr.variables();
+    unsigned numVars = vars.size();
+    std::vector<std::string> names( numVars );
+    for( unsigned v=0; v<numVars; ++v )
+        names[v] = toLower( vars[v].first );
+
+    ScriptEngine* engine =
+        context && context->getSession() ? context->getSession()->getScriptEngine() : 0L;
+
+    // gather a block of variable values, one row per feature. Variables that
+    // aren't attributes are scripts, which run in one batch per variable.
+    std::vector<double> values( numVars * features.size(), 0.0 );
+    std::vector<FeatureList> scripted( numVars );
+    std::vector< std::vector<unsigned> > scriptedRows( numVars );
+
+    unsigned row = 0;
+    for( FeatureList::const_iterator f = features.begin(); f != features.end(); ++f, ++row )
+    {
+        Feature* feature = f->get();
+        if ( !feature )
+            continue;
+
+        for( unsigned v=0; v<numVars; ++v )
+        {
+            AttributeTable::const_iterator ai = feature->_attrs.find( names[v] );
+            if ( ai != feature->_attrs.end() )
+            {
+                values[row*numVars + v] = ai->second.getDouble( 0.0 );
+            }
+            else if ( engine )
+            {
+                scripted[v].push_back( feature );
+                scriptedRows[v].push_back( row );
+            }
+        }
+    }
+
+    for( unsigned v=0; v<numVars; ++v )
+    {
+        if ( scripted[v].empty() )
+            continue;
+
+        std::vector<ScriptResult> results;
+        engine->run( vars[v].first, scripted[v], results, context );
+        for( unsigned r=0; r<results.size() && r<scriptedRows[v].size(); ++r )
+        {
+            if ( results[r].success() )
+                values[scriptedRows[v][r]*numVars + v] = results[r].asDouble();
+            else
+                OE_WARN << LC << "Feature Script error on '" << expr.expr() << "': " << results[r].message() << std::endl;
+        }
+    }
+
+    expr.eval( values.empty() ? 0L : &values[0], features.size(), &out_results[0] );
+}
+
+void
+Feature::evalBatch(const StringExpression&   expr,
+                   const FeatureList&        features,
+                   std::vector<std::string>& out_results,
+                   FilterContext const*      context)
+{
+    out_results.resize( features.size() );
+    if ( features.empty() )
+        return;
+
+    // resolve the variable names once:
+    const StringExpression::Variables& vars = expr.variables();
+    unsigned numVars = vars.size();
+    std::vector<std::string> names( numVars );
+    for( unsigned v=0; v<numVars; ++v )
+        names[v] = toLower( vars[v].first );
+
+    ScriptEngine* engine =
+        context && context->getSession() ? context->getSession()->getScriptEngine() : 0L;
+
+    // gather a block of variable values, one row per feature. Variables that
+    // aren't attributes are scripts, which run in one batch per variable.
+    std::vector<std::string> values( numVars * features.size() );
+    std::vector<FeatureList> scripted( numVars );
+    std::vector< std::vector<unsigned> > scriptedRows( numVars );
+
+    unsigned row = 0;
+    for( FeatureList::const_iterator f = features.begin(); f != features.end(); ++f, ++row )
+    {
+        Feature* feature = f->get();
+        if ( !feature )
+            continue;
+
+        for( unsigned v=0; v<numVars; ++v )
+        {
+            AttributeTable::const_iterator ai = feature->_attrs.find( names[v] );
+            if ( ai != feature->_attrs.end() )
+            {
+                values[row*numVars + v] = ai->second.getString();
+            }
+            else if ( engine )
+            {
+                scripted[v].push_back( feature );
+                scriptedRows[v].push_back( row );
+            }
+        }
+    }
+
+    for( unsigned v=0; v<numVars; ++v )
+    {
+        if ( scripted[v].empty() )
+            continue;
+
+        std::vector<ScriptResult> results;
+        engine->run( vars[v].first, scripted[v], results, context );
+        for( unsigned r=0; r<results.size() && r<scriptedRows[v].size(); ++r )
+        {
+            if ( results[r].success() )
+                values[scriptedRows[v][r]*numVars + v] = results[r].asString();
+            else
+                OE_WARN << LC << "Feature Script error on '" << expr.expr() << "': " << results[r].message() << std::endl;
+        }
+    }
+
+    row = 0;
+    for( FeatureList::const_iterator f = features.begin(); f != features.end(); ++f, ++row )
+    {
+        if ( f->valid() )
+            expr.eval( numVars > 0 ? &values[row*numVars] : 0L, out_results[row] );
+        else
+            out_results[row].clear();
+    }
+}
+
+
 bool
 Feature::getWorldBound(const SpatialReference* srs,
                        osg::BoundingSphered&   out_bound) const
@@ -372,19 +514,38 @@ Feature::getWorldBound(const SpatialReference* srs,
     {
         out_bound.init();
 
-        ConstGeometryIterator i( getGeometry(), false); 
+        // transform all the points at once.
+        std::vector<osg::Vec3d> world;
+        world.reserve( getGeometry()->getTotalPointCount() );
+        ConstGeometryIterator i( getGeometry(), false );
         while( i.hasMore() )
         {
             const Geometry* g = i.next();
-            for( Geometry::const_iterator p = g->begin(); p != g->end(); ++p )
+            world.insert( world.end(), g->begin(), g->end() );
+        }
+
+        if ( getSRS()->transform(world, srs) && srs->transformToWorld(world) )
+        {
+            for( std::vector<osg::Vec3d>::const_iterator p = world.begin(); p != world.end(); ++p )
+                out_bound.expandBy( *p );
+        }
+        else
+        {
+            // something failed; fall back on point-by-point so the good points still count.
+            ConstGeometryIterator j( getGeometry(), false );
+            while( j.hasMore() )
             {
-                GeoPoint point( getSRS(), *p, ALTMODE_ABSOLUTE );
-                GeoPoint srs_point;
-                if ( point.transform( srs, srs_point ) )
+                const Geometry* g = j.next();
+                for( Geometry::const_iterator p = g->begin(); p != g->end(); ++p )
                 {
-                    osg::Vec3d world;
-                    srs_point.toWorld(world);
-                    out_bound.expandBy( world );
+                    GeoPoint point( getSRS(), *p, ALTMODE_ABSOLUTE );
+                    GeoPoint srs_point;
+                    if ( point.transform( srs, srs_point ) )
+                    {
+                        osg::Vec3d w;
+                        srs_point.toWorld(w);
+                        out_bound.expandBy( w );
+                    }
                 }
             }
         }
@@ -17,6 +17,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthFeatures/FeatureCursor>
+#include <osgEarth/Registry>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <deque>
 
 using namespace osgEarth::Features;
 using namespace osgEarth::Symbology;
@@ -33,6 +37,22 @@ FeatureCursor::fill( FeatureList& list )
     }
 }
 
+unsigned
+FeatureCursor::fill( FeatureList& list, unsigned maxFeatures )
+{
+    unsigned count = 0;
+    while( count < maxFeatures && hasMore() )
+    {
+        Feature* f = nextFeature();
+        if ( f )
+        {
+            list.push_back( f );
+            ++count;
+        }
+    }
+    return count;
+}
+
 //---------------------------------------------------------------------------
 
 FeatureListCursor::FeatureListCursor( const FeatureList& features, bool clone ) :
@@ -96,3 +116,189 @@ GeometryFeatureCursor::nextFeature()
     }
     return _lastFeature.get();
 }
+
+//---------------------------------------------------------------------------
+
+namespace
+{
+    Threading::Mutex          s_prefetchServiceMutex;
+    osg::ref_ptr<TaskService> s_prefetchService;
+
+    TaskService* getPrefetchService()
+    {
+        Threading::ScopedMutexLock lock( s_prefetchServiceMutex );
+        if ( !s_prefetchService.valid() )
+        {
+            s_prefetchService = new TaskService( "FeatureCursor Prefetch", 4 );
+            Registry::instance()->registerTaskService( s_prefetchService.get() );
+        }
+        return s_prefetchService.get();
+    }
+
+    /**
+     * State shared by a PrefetchFeatureCursor and its reader task. Reads from
+     * the source are serialized by _readMutex, and a chunk is queued before
+     * that lock is released, so chunks come out in source order whichever
+     * thread read them.
+     */
+    struct Stream : public osg::Referenced
+    {
+        Stream(FeatureCursor* source, unsigned chunkSize, unsigned maxChunks) :
+            _source   ( source ),
+            _chunkSize( osg::maximum(chunkSize, 1u) ),
+            _maxChunks( osg::maximum(maxChunks, 1u) ),
+            _done     ( source == 0L || !source->hasMore() ),
+            _canceled ( false ) { }
+
+        // reader task: stay up to _maxChunks ahead of the consumer.
+        void readAhead()
+        {
+            for(;;)
+            {
+                {
+                    Threading::ScopedMutexLock lock( _queueMutex );
+                    while( _queue.size() >= _maxChunks && !_canceled && !_done )
+                        _cond.wait( &_queueMutex );
+                    if ( _canceled || _done )
+                        return;
+                }
+
+                Threading::ScopedMutexLock read( _readMutex );
+                FeatureList chunk;
+                if ( !readChunk(chunk) )
+                    return;
+            }
+        }
+
+        // consumer: take the next buffered chunk, or read it inline.
+        bool next(FeatureList& output)
+        {
+            if ( pop(output) )
+                return true;
+
+            Threading::ScopedMutexLock read( _readMutex );
+
+            // the reader may have queued a chunk while we waited for the lock.
+            if ( pop(output) )
+                return true;
+
+            FeatureList chunk;
+            return readChunk( chunk ) && pop( output );
+        }
+
+        // reads one chunk from the source and queues it; returns false if
+        // there was nothing left to read. Caller holds _readMutex.
+        bool readChunk(FeatureList& chunk)
+        {
+            {
+                Threading::ScopedMutexLock lock( _queueMutex );
+                if ( _done || _canceled )
+                    return false;
+            }
+
+            _source->fill( chunk, _chunkSize );
+            bool done = !_source->hasMore();
+
+            Threading::ScopedMutexLock lock( _queueMutex );
+            if ( !chunk.empty() )
+            {
+                _queue.push_back( FeatureList() );
+                _queue.back().swap( chunk );
+            }
+            _done = done;
+            _cond.broadcast();
+            return !_queue.empty();
+        }
+
+        bool pop(FeatureList& output)
+        {
+            Threading::ScopedMutexLock lock( _queueMutex );
+            if ( _queue.empty() )
+                return false;
+            output.splice( output.end(), _queue.front() );
+            _queue.pop_front();
+            _cond.broadcast();
+            return true;
+        }
+
+        bool hasMore()
+        {
+            Threading::ScopedMutexLock lock( _queueMutex );
+            return !_queue.empty() || !_done;
+        }
+
+        void cancel()
+        {
+            Threading::ScopedMutexLock lock( _queueMutex );
+            _canceled = true;
+            _cond.broadcast();
+        }
+
+        struct Task : public TaskRequest
+        {
+            Task(Stream* stream) : _stream(stream) { }
+
+            void operator()( ProgressCallback* progress )
+            {
+                _stream->readAhead();
+            }
+
+            osg::ref_ptr<Stream> _stream;
+        };
+
+        osg::ref_ptr<FeatureCursor> _source;
+        unsigned                    _chunkSize;
+        unsigned                    _maxChunks;
+        std::deque<FeatureList>     _queue;
+        bool                        _done;
+        bool                        _canceled;
+        Threading::Mutex            _readMutex;
+        Threading::Mutex            _queueMutex;
+        OpenThreads::Condition      _cond;
+    };
+}
+
+PrefetchFeatureCursor::PrefetchFeatureCursor(FeatureCursor* source,
+                                             unsigned       chunkSize,
+                                             unsigned       maxChunks)
+{
+    Stream* stream = new Stream( source, chunkSize, maxChunks );
+    _stream = stream;
+
+    if ( stream->hasMore() )
+        getPrefetchService()->add( new Stream::Task(stream) );
+}
+
+PrefetchFeatureCursor::~PrefetchFeatureCursor()
+{
+    // release the reader if it's waiting for room in the queue.
+    static_cast<Stream*>(_stream.get())->cancel();
+}
+
+bool
+PrefetchFeatureCursor::hasMore() const
+{
+    return !_chunk.empty() || static_cast<Stream*>(_stream.get())->hasMore();
+}
+
+Feature*
+PrefetchFeatureCursor::nextFeature()
+{
+    if ( _chunk.empty() && !nextChunk(_chunk) )
+        return 0L;
+
+    _lastFeature = _chunk.front();
+    _chunk.pop_front();
+    return _lastFeature.get();
+}
+
+bool
+PrefetchFeatureCursor::nextChunk(FeatureList& output)
+{
+    if ( !_chunk.empty() )
+    {
+        output.splice( output.end(), _chunk );
+        return true;
+    }
+    return static_cast<Stream*>(_stream.get())->next( output );
+}
@@ -71,6 +71,8 @@ _tileSizeFactor( 15.0f ),
 _minRange      ( 0.0f ),
 _maxRange      ( 0.0f ),
 _cropFeatures  ( false ),
+_simplify      ( SimplifyFilter::METHOD_NONE ),
+_simplifyPixelError( 1.0f ),
 _priorityOffset( 0.0f ),
 _priorityScale ( 1.0f )
 {
@@ -82,6 +84,10 @@ FeatureDisplayLayout::fromConfig( const Config& conf )
 {
     conf.getIfSet( "tile_size_factor", _tileSizeFactor );
     conf.getIfSet( "crop_features",    _cropFeatures );
+    conf.getIfSet( "simplify",         "none",            _simplify, SimplifyFilter::METHOD_NONE );
+    conf.getIfSet( "simplify",         "douglas_peucker", _simplify, SimplifyFilter::METHOD_DOUGLAS_PEUCKER );
+    conf.getIfSet( "simplify",         "visvalingam",     _simplify, SimplifyFilter::METHOD_VISVALINGAM );
+    conf.getIfSet( "simplify_pixel_error", _simplifyPixelError );
     conf.getIfSet( "priority_offset",  _priorityOffset );
     conf.getIfSet( "priority_scale",   _priorityScale );
     conf.getIfSet( "min_range",        _minRange );
@@ -97,6 +103,10 @@ FeatureDisplayLayout::getConfig() const
     Config conf( "layout" );
     conf.addIfSet( "tile_size_factor", _tileSizeFactor );
     conf.addIfSet( "crop_features",    _cropFeatures );
+    conf.addIfSet( "simplify",         "none",            _simplify, SimplifyFilter::METHOD_NONE );
+    conf.addIfSet( "simplify",         "douglas_peucker", _simplify, SimplifyFilter::METHOD_DOUGLAS_PEUCKER );
+    conf.addIfSet( "simplify",         "visvalingam",     _simplify, SimplifyFilter::METHOD_VISVALINGAM );
+    conf.addIfSet( "simplify_pixel_error", _simplifyPixelError );
     conf.addIfSet( "priority_offset",  _priorityOffset );
     conf.addIfSet( "priority_scale",   _priorityScale );
     conf.addIfSet( "min_range",        _minRange );
@@ -121,8 +121,17 @@ FeatureDrawSet::setVisible( bool visible )
         {
             DrawableSlice& slice = _slices[i];
             osg::Geometry* geom = slice.drawable->asGeometry();
+            slice.hidden.clear();
             for( PrimitiveSets::iterator p = slice.primSets.begin(); p != slice.primSets.end(); ++p )
-                geom->removePrimitiveSet( geom->getPrimitiveSetIndex(p->get()) );
+            {
+                // sets extracted from shared primitive sets aren't in the geometry.
+                unsigned index = geom->getPrimitiveSetIndex(p->get());
+                if ( index < geom->getNumPrimitiveSets() )
+                {
+                    geom->removePrimitiveSet( index );
+                    slice.hidden.push_back( p->get() );
+                }
+            }
         }
     }
 
@@ -138,8 +147,9 @@ FeatureDrawSet::setVisible( bool visible )
         {
             DrawableSlice& slice = _slices[i];
             osg::Geometry* geom = slice.drawable->asGeometry();
-            for( PrimitiveSets::iterator p = slice.primSets.begin(); p != slice.primSets.end(); ++p )
+            for( PrimitiveSets::iterator p = slice.hidden.begin(); p != slice.hidden.end(); ++p )
                 geom->addPrimitiveSet( p->get() );
+            slice.hidden.clear();
         }
     }
 
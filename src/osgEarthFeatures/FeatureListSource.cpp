@@ -17,6 +17,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthFeatures/FeatureListSource>
+#include <osgEarthFeatures/QueryEvaluator>
+#include <algorithm>
 
 using namespace osgEarth::Features;
 
@@ -36,17 +38,82 @@ _defaultExtent( defaultExtent )
 FeatureCursor*
 FeatureListSource::createFeatureCursor( const Symbology::Query& query )
 {
-    //Create a copy of all of the features before returning the cursor.
-    //The processing filters in osgEarth can modify the features as they are operating and we don't want our original data destroyed.
+    // Gather the features that pass the query, then copy them before returning the cursor.
+    // The processing filters in osgEarth can modify the features as they are operating and we don't want our original data destroyed.
+    FeatureList hitFeatures;
+
+    if ( query.bounds().isSet() )
+    {
+        // a bounded query only copies the features the index returns.
+        std::vector<FeatureID> hits;
+        {
+            Threading::ScopedMutexLock lock( _indexMutex );
+
+            // the list may have been changed through getFeatures() since
+            // the index was built.
+            if ( _index.valid() && _indexedFeatures.size() != _features.size() )
+                _index = 0L;
+
+            if ( !_index.valid() )
+            {
+                _indexedFeatures.assign( _features.begin(), _features.end() );
+
+                FeatureSpatialIndex::EntryVector entries;
+                entries.reserve( _indexedFeatures.size() );
+                for( unsigned i = 0; i < _indexedFeatures.size(); ++i )
+                {
+                    const Geometry* geom = _indexedFeatures[i]->getGeometry();
+                    if ( geom )
+                    {
+                        Bounds b = geom->getBounds();
+                        if ( b.isValid() )
+                            entries.push_back( FeatureSpatialIndex::Entry(i, b.xMin(), b.yMin(), b.xMax(), b.yMax()) );
+                    }
+                }
+                _index = new FeatureSpatialIndex( entries );
+            }
+
+            _index->query( query.bounds().get(), hits );
+
+            // keep the list order, which callers may rely on.
+            std::sort( hits.begin(), hits.end() );
+            for( std::vector<FeatureID>::const_iterator i = hits.begin(); i != hits.end(); ++i )
+                hitFeatures.push_back( _indexedFeatures[*i].get() );
+        }
+    }
+    else
+    {
+        hitFeatures.assign( _features.begin(), _features.end() );
+    }
+
+    // apply a simple attribute expression to the whole block at once, before
+    // paying for the copies. (The index already handled the bounds.)
+    if ( query.expression().isSet() )
+    {
+        Symbology::Query exprQuery;
+        exprQuery.expression() = query.expression().get();
+        QueryEvaluator evaluator( exprQuery );
+        if ( evaluator.isSimple() )
+            evaluator.filter( hitFeatures );
+    }
+
     FeatureList cursorFeatures;
-    for (FeatureList::iterator itr = _features.begin(); itr != _features.end(); ++itr)
+    for (FeatureList::iterator itr = hitFeatures.begin(); itr != hitFeatures.end(); ++itr)
     {
         Feature* feature = new osgEarth::Features::Feature(*(itr->get()), osg::CopyOp::DEEP_COPY_ALL);        
         cursorFeatures.push_back( feature );
-    }    
+    }
     return new FeatureListCursor( cursorFeatures );
 }
 
+void
+FeatureListSource::dirtyIndex()
+{
+    Threading::ScopedMutexLock lock( _indexMutex );
+    _index = 0L;
+    _indexedFeatures.clear();
+}
+
 const FeatureProfile*
 FeatureListSource::createFeatureProfile()
 {    
@@ -85,6 +152,7 @@ FeatureListSource::deleteFeature(FeatureID fid)
         if (itr->get()->getFID() == fid)
         {
             _features.erase( itr );
+            dirtyIndex();
             dirty();
             return true;
         }
@@ -109,6 +177,7 @@ bool FeatureListSource::insertFeature(Feature* feature)
 {
     dirtyFeatureProfile();
     _features.push_back( feature );
+    dirtyIndex();
     dirty();
     return true;
 }
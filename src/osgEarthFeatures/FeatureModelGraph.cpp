@@ -19,8 +19,10 @@
 
 #include <osgEarthFeatures/FeatureModelGraph>
 #include <osgEarthFeatures/CropFilter>
+#include <osgEarthFeatures/FeatureCursor>
 #include <osgEarthFeatures/FeatureSourceIndexNode>
 #include <osgEarthFeatures/Session>
+#include <osgEarthFeatures/SimplifyFilter>
 
 #include <osgEarth/Map>
 #include <osgEarth/Capabilities>
@@ -30,11 +32,18 @@
 #include <osgEarth/ElevationLOD>
 #include <osgEarth/ElevationQuery>
 #include <osgEarth/FadeEffect>
+#include <osgEarth/FrameStats>
 #include <osgEarth/NodeUtils>
+#include <osgEarth/Profiler>
 #include <osgEarth/Registry>
+#include <osgEarth/SpatialOrganizer>
+#include <osgEarth/TaskService>
 #include <osgEarth/ThreadingUtils>
+#include <osgEarthSymbology/MeshConsolidator>
 
 #include <osg/CullFace>
+#include <osg/Geode>
+#include <osg/MatrixTransform>
 #include <osg/PagedLOD>
 #include <osg/ProxyNode>
 #include <osgDB/FileNameUtils>
@@ -43,6 +52,7 @@
 #include <osgUtil/Optimizer>
 
 #include <algorithm>
+#include <deque>
 #include <iterator>
 
 #define LC "[FeatureModelGraph] "
@@ -71,6 +81,231 @@ namespace
 
 //---------------------------------------------------------------------------
 
+// parallel compilation of a tile's features in chunks.
+
+namespace
+{
+    Threading::Mutex          s_compileServiceMutex;
+    osg::ref_ptr<TaskService> s_compileService;
+
+    TaskService* getCompileService()
+    {
+        Threading::ScopedMutexLock lock( s_compileServiceMutex );
+        if ( !s_compileService.valid() )
+        {
+            int numThreads = osg::clampBetween( OpenThreads::GetNumberOfProcessors(), 1, 16 );
+            s_compileService = new TaskService( "FeatureModelGraph Compile", numThreads );
+            Registry::instance()->registerTaskService( s_compileService.get() );
+        }
+        return s_compileService.get();
+    }
+
+    /**
+     * Compiles chunks of a feature list into one node per chunk. Chunks can
+     * be added while earlier ones are compiling, so the features can be
+     * streamed in from a cursor. The caller and the pool tasks pull from the
+     * same work queue, so the caller never waits on a task that's still
+     * queued behind other tiles' work. A chunk's features are released as
+     * soon as it is compiled.
+     */
+    struct ChunkCompile : public osg::Referenced
+    {
+        ChunkCompile(FeatureNodeFactory*  factory,
+                     const Style&         style,
+                     const FilterContext& context) :
+            _factory( factory ),
+            _style  ( style ),
+            _context( context ),
+            _next   ( 0 ),
+            _numDone( 0 ) { }
+
+        // queues a chunk (consuming the list) and a task to compile it.
+        void add(FeatureList& chunk)
+        {
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                _chunks.push_back( FeatureList() );
+                _chunks.back().swap( chunk );
+                _nodes.push_back( 0L );
+            }
+            getCompileService()->add( new Task(this) );
+        }
+
+        // compiles the next unclaimed chunk; false if none are left.
+        bool runOne()
+        {
+            FeatureList* chunk;
+            osg::ref_ptr<osg::Node>* node;
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                if ( _next >= _chunks.size() )
+                    return false;
+                // deque elements stay put as others are added.
+                chunk = &_chunks[_next];
+                node  = &_nodes[_next];
+                ++_next;
+            }
+
+            // each chunk gets its own copy of the context, since filters
+            // modify it as they go.
+            FilterContext context( _context );
+            {
+                // this thread's scratch memory is free again once the chunk is done.
+                ArenaScope arenaScope( context.arena() );
+                osg::ref_ptr<FeatureCursor> cursor = new FeatureListCursor( *chunk );
+                _factory->createOrUpdateNode( cursor.get(), _style, context, *node );
+            }
+            chunk->clear();
+
+            Threading::ScopedMutexLock lock( _mutex );
+            ++_numDone;
+            _cond.broadcast();
+            return true;
+        }
+
+        // number of chunks not yet claimed by any thread.
+        unsigned numPending()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            return _chunks.size() - _next;
+        }
+
+        void waitForAll()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            while ( _numDone < _chunks.size() )
+                _cond.wait( &_mutex );
+        }
+
+        struct Task : public TaskRequest
+        {
+            Task(ChunkCompile* compile) : _compile(compile) { }
+
+            void operator()( ProgressCallback* progress )
+            {
+                while( _compile->runOne() );
+            }
+
+            osg::ref_ptr<ChunkCompile> _compile;
+        };
+
+        osg::ref_ptr<FeatureNodeFactory>       _factory;
+        const Style&                           _style;
+        FilterContext                          _context;
+        std::deque<FeatureList>                _chunks;
+        std::deque< osg::ref_ptr<osg::Node> >  _nodes;
+        unsigned                               _next;
+        unsigned                               _numDone;
+        Threading::Mutex                       _mutex;
+        OpenThreads::Condition                 _cond;
+    };
+
+    bool sameState(const osg::Node* a, const osg::Node* b)
+    {
+        const osg::StateSet* sa = a->getStateSet();
+        const osg::StateSet* sb = b->getStateSet();
+        if ( sa == sb )
+            return true;
+        return sa && sb && sa->compare(*sb, true) == 0;
+    }
+
+    // Whether two chunk subgraph nodes occupy the same place in the graph and
+    // can be merged: same kind, same state, same transform, no node tags.
+    bool mergeable(const osg::Node* a, const osg::Node* b)
+    {
+        if ( strcmp(a->className(), b->className()) != 0 )
+            return false;
+
+        if ( a->getUserData() || b->getUserData() || !sameState(a, b) )
+            return false;
+
+        const osg::MatrixTransform* ta = dynamic_cast<const osg::MatrixTransform*>(a);
+        if ( ta )
+            return ta->getMatrix() == static_cast<const osg::MatrixTransform*>(b)->getMatrix();
+
+        // not subclasses, e.g. a Billboard positions each drawable.
+        return
+            strcmp(a->className(), "Geode") == 0 ||
+            strcmp(a->className(), "Group") == 0;
+    }
+
+    /**
+     * Merges the subgraph compiled from one chunk into that of a previous
+     * chunk. Since every chunk is compiled with the same style and reference
+     * frame, the subgraphs have matching structure; geodes in matching spots
+     * pool their drawables, and anything else is appended as-is.
+     */
+    void mergeInto(osg::Group* dest, osg::Group* src, std::vector<osg::Geode*>& mergedGeodes)
+    {
+        for( unsigned i = 0; i < src->getNumChildren(); ++i )
+        {
+            osg::Node* s = src->getChild(i);
+            osg::Node* d = i < dest->getNumChildren() ? dest->getChild(i) : 0L;
+
+            if ( d && mergeable(d, s) )
+            {
+                if ( d->asGeode() )
+                {
+                    osg::Geode* dg = d->asGeode();
+                    osg::Geode* sg = s->asGeode();
+                    for( unsigned j = 0; j < sg->getNumDrawables(); ++j )
+                        dg->addDrawable( sg->getDrawable(j) );
+                    if ( std::find(mergedGeodes.begin(), mergedGeodes.end(), dg) == mergedGeodes.end() )
+                        mergedGeodes.push_back( dg );
+                }
+                else
+                {
+                    mergeInto( d->asGroup(), s->asGroup(), mergedGeodes );
+                }
+            }
+            else
+            {
+                dest->addChild( s );
+            }
+        }
+    }
+
+    /**
+     * Waits for a ChunkCompile to finish (helping out meanwhile) and merges
+     * the chunk subgraphs into the first one, in chunk order.
+     */
+    osg::Node* finishChunks(ChunkCompile* compile, bool consolidate)
+    {
+        while( compile->runOne() );
+        compile->waitForAll();
+
+        std::vector<osg::Geode*> mergedGeodes;
+        osg::ref_ptr<osg::Group> result = new osg::Group();
+        for( unsigned i = 0; i < compile->_nodes.size(); ++i )
+        {
+            osg::Node* chunkNode = compile->_nodes[i].get();
+            if ( !chunkNode )
+                continue;
+
+            osg::Node* first = result->getNumChildren() > 0 ? result->getChild(0) : 0L;
+            if ( first && first->asGroup() && chunkNode->asGroup() && mergeable(first, chunkNode) )
+                mergeInto( first->asGroup(), chunkNode->asGroup(), mergedGeodes );
+            else
+                result->addChild( chunkNode );
+        }
+
+        if ( consolidate )
+        {
+            // chunks cover the whole tile, so bucket them to keep the merged meshes cullable.
+            for( std::vector<osg::Geode*>::iterator i = mergedGeodes.begin(); i != mergedGeodes.end(); ++i )
+                MeshConsolidator::runBucketed( **i );
+        }
+
+        if ( result->getNumChildren() == 0 )
+            return 0L;
+        if ( result->getNumChildren() == 1 )
+            return result->getChild(0);
+        return result.release();
+    }
+}
+
+//---------------------------------------------------------------------------
+
 // pseudo-loader for paging in feature tiles for a FeatureModelGraph.
 
 namespace
@@ -314,6 +549,11 @@ FeatureModelGraph::ctor()
     {
         _session->setResourceCache( new ResourceCache(_session->getDBOptions()) );
     }
+
+    if ( _options.cacheCompiledTiles() == true )
+    {
+        initCompiledTileCache();
+    }
     
     // Calculate the usable extent (in both feature and map coordinates) and bounds.
     const Profile* mapProfile = _session->getMapInfo().getProfile();
@@ -755,6 +995,11 @@ FeatureModelGraph::buildSubTilePagedLODs(unsigned        parentLOD,
 osg::Group*
 FeatureModelGraph::buildLevel( const FeatureLevel& level, const GeoExtent& extent, const TileKey* key )
 {
+    OE_PROFILING_ZONE("FeatureModelGraph::buildLevel");
+
+    // temporaries allocated by the filters all go away with the tile.
+    ArenaScope arenaScope( _session.valid() ? _session->getArena() : 0L );
+
     // set up for feature indexing if appropriate:
     osg::ref_ptr<osg::Group> group;
     FeatureSourceIndexNode* index = 0L;
@@ -818,6 +1063,16 @@ FeatureModelGraph::buildLevel( const FeatureLevel& level, const GeoExtent& exten
 
     if ( group->getNumChildren() > 0 )
     {
+        // without paging, everything lands in one subgraph; organize it
+        // spatially so culling doesn't visit every feature.
+        if ( !extent.isValid() && !key )
+        {
+            SpatialOrganizer organizer;
+            organizer.setSplitThreshold( _options.spatialSplitThreshold().get() );
+            organizer.setNumThreads( _options.spatialBuildThreads().get() );
+            organizer.run( group.get() );
+        }
+
         // account for a min-range here. Do not address the max-range here; that happens
         // above when generating paged LOD nodes, etc.
         float minRange = level.minRange();
@@ -1069,18 +1324,21 @@ FeatureModelGraph::queryAndSortIntoStyleGroups(const Query&            query,
     // establish the working bounds and a context:
     Bounds bounds = query.bounds().isSet() ? *query.bounds() : extent.bounds();
     FilterContext context( _session.get(), featureProfile, GeoExtent(featureProfile->getSRS(), bounds), index );
-    StringExpression styleExprCopy( styleExpr );
 
-    // visit each feature and run the expression to sort it into a bin.
+    // run the expression on all the features at once (style expressions are
+    // usually scripts) and sort each feature into a bin by the result.
+    FeatureList features;
+    cursor->fill( features );
+
+    std::vector<std::string> styleStrings;
+    Feature::evalBatch( styleExpr, features, styleStrings, &context );
+
     std::map<std::string, FeatureList> styleBins;
-    while( cursor->hasMore() )
+    unsigned n = 0;
+    for( FeatureList::iterator f = features.begin(); f != features.end(); ++f, ++n )
     {
-        osg::ref_ptr<Feature> feature = cursor->nextFeature();
-        if ( feature.valid() )
-        {
-            const std::string& styleString = feature->eval( styleExprCopy, &context );
-            styleBins[styleString].push_back( feature.get() );
-        }
+        if ( f->valid() )
+            styleBins[styleStrings[n]].push_back( f->get() );
     }
 
     // next create a style group per bin.
@@ -1133,8 +1391,99 @@ FeatureModelGraph::createStyleGroup(const Style&         style,
 
     OE_DEBUG << LC << "Created style group \"" << style.getName() << "\"\n";
 
+    FilterContext context = cropFeatures( workingSet, contextPrototype );
+
+    // finally, compile the features into a node.
+    if ( workingSet.size() > 0 )
+    {
+        osg::ref_ptr<osg::Node> node;
+
+        if ( compileFeatures( workingSet, style, context, node ) )
+        {
+            if ( !styleGroup )
+                styleGroup = getOrCreateStyleGroupFromFactory( style );
+
+            // if it returned a node, add it. (it doesn't necessarily have to)
+            if ( node.valid() )
+                styleGroup->addChild( node.get() );
+        }
+    }
+
+    return styleGroup;
+}
+
+
+osg::Group*
+FeatureModelGraph::createStyleGroup(const Style&         style,
+                                    FeatureCursor*       cursor,
+                                    const FilterContext& contextPrototype)
+{
+    // Stream the features through in chunks: the prefetcher reads ahead on
+    // one thread while the chunks read so far compile on others, and only a
+    // bounded number of chunks are in memory at once.
+    unsigned chunkSize  = _options.compileChunkSize().get();
+    unsigned maxPending = (unsigned)getCompileService()->getNumThreads();
+
+    osg::ref_ptr<PrefetchFeatureCursor> stream = new PrefetchFeatureCursor( cursor, chunkSize );
+    osg::ref_ptr<ChunkCompile> compile;
+
+    FeatureList chunk;
+    while( stream->nextChunk(chunk) )
+    {
+        FilterContext context = cropFeatures( chunk, contextPrototype );
+        if ( chunk.empty() )
+            continue;
+
+        if ( !compile.valid() )
+            compile = new ChunkCompile( _factory.get(), style, context );
+
+        compile->add( chunk );
+
+        // rather than let unclaimed chunks pile up, compile one here.
+        while( compile->numPending() > maxPending && compile->runOne() );
+    }
+
+    if ( !compile.valid() )
+        return 0L;
+
+    osg::ref_ptr<osg::Node> node = finishChunks( compile.get(), _options.mergeGeometry() == true );
+    if ( !node.valid() )
+        return 0L;
+
+    osg::Group* styleGroup = getOrCreateStyleGroupFromFactory( style );
+    styleGroup->addChild( node.get() );
+    return styleGroup;
+}
+
+
+FilterContext
+FeatureModelGraph::cropFeatures(FeatureList&         workingSet,
+                                const FilterContext& contextPrototype)
+{
     FilterContext context(contextPrototype);
 
+    // simplify tiled levels of detail to what a tile's visibility range can resolve:
+    if ( _options.layout().isSet() &&
+         _options.layout()->simplify() != SimplifyFilter::METHOD_NONE &&
+         (_useTiledSource || !_lodmap.empty()) &&
+         context.extent().isSet() )
+    {
+        // Every tile's max range is its radius times the tile size factor, so at
+        // that range one pixel (of a nominal 1024-pixel-tall, 30 degree view)
+        // covers this much of the tile, in the units of the feature SRS. The
+        // tolerance is therefore the same for all tiles of a LOD, and the
+        // simplified features are shared across those tiles and across styles.
+        const GeoExtent& extent = *context.extent();
+        double tileRadius = 0.5 * sqrt( extent.width()*extent.width() + extent.height()*extent.height() );
+        double pixelSize  = tileRadius * _options.layout()->tileSizeFactor().get() * 2.0*tan(osg::DegreesToRadians(15.0)) / 1024.0;
+
+        SimplifyFilter simplify(
+            pixelSize * _options.layout()->simplifyPixelError().get(),
+            _options.layout()->simplify().get() );
+
+        context = simplify.push( workingSet, context );
+    }
+
     // first Crop the feature set to the working extent:
     CropFilter crop( 
         _options.layout().isSet() && _options.layout()->cropFeatures() == true ? 
@@ -1159,26 +1508,56 @@ FeatureModelGraph::createStyleGroup(const Style&         style,
         context = crop2.push( workingSet, context );
     }
 
-    // finally, compile the features into a node.
-    if ( workingSet.size() > 0 )
-    {
-        osg::ref_ptr<osg::Node> node;
-        osg::ref_ptr<FeatureCursor> newCursor = new FeatureListCursor(workingSet);
+    return context;
+}
 
-        if ( _factory->createOrUpdateNode( newCursor.get(), style, context, node ) )
-        {
-            if ( !styleGroup )
-                styleGroup = getOrCreateStyleGroupFromFactory( style );
 
-            // if it returned a node, add it. (it doesn't necessarily have to)
-            if ( node.valid() )
-                styleGroup->addChild( node.get() );
-        }
+void
+FeatureModelGraph::initCompiledTileCache()
+{
+    Cache* cache = Cache::get( _session->getDBOptions() );
+    if ( !cache )
+    {
+        OE_INFO << LC << "cache_compiled_tiles is set, but there is no cache" << std::endl;
+        return;
     }
 
-    return styleGroup;
+    optional<CachePolicy> cp;
+    CachePolicy::fromOptions( _session->getDBOptions(), cp );
+    if ( _options.cachePolicy().isSet() )
+        cp->mergeAndOverride( _options.cachePolicy() );
+    Registry::instance()->resolveCachePolicy( cp );
+
+    if ( !cp->isCacheReadable() && !cp->isCacheWriteable() )
+        return;
+
+    // The bin is specific to the complete set of model options, which
+    // includes the feature source options and the stylesheet.
+    std::string conf = _options.getConfig().toJSON( false );
+    std::string binId = Stringify() << "fmg_" << std::hex << hashString( conf );
+
+    _compiledTileBin = cache->addBin( binId );
+    if ( _compiledTileBin.valid() )
+    {
+        _compiledTilePolicy = cp.get();
+        OE_INFO << LC << "Caching compiled tiles in bin \"" << binId << "\"" << std::endl;
+    }
 }
 
+std::string
+FeatureModelGraph::getCompiledTileKey(const Style& style, const Query& query) const
+{
+    // The query carries the tile's bounds (and key, for tiled sources), so
+    // together with the style it identifies the compiled output. The source
+    // revision invalidates records when the features are edited.
+    Revision sourceRev;
+    _session->getFeatureSource()->sync( sourceRev );
+
+    std::string conf = query.getConfig().toJSON( false ) + style.getConfig().toJSON( false );
+    return Stringify()
+        << std::hex << hashString( conf )
+        << "_" << std::dec << (int)sourceRev;
+}
 
 osg::Group*
 FeatureModelGraph::createStyleGroup(const Style&        style, 
@@ -1187,6 +1566,33 @@ FeatureModelGraph::createStyleGroup(const Style&        style,
 {
     osg::Group* styleGroup = 0L;
 
+    // Check the compiled-tile cache. Indexed graphs are never cached since
+    // the feature tags do not survive serialization.
+    std::string cacheKey;
+    if ( _compiledTileBin.valid() && index == 0L )
+    {
+        cacheKey = getCompiledTileKey( style, query );
+
+        if ( _compiledTilePolicy.isCacheReadable() )
+        {
+            ReadResult rr = _compiledTileBin->readObject( cacheKey );
+            if ( rr.succeeded() && !_compiledTilePolicy.isExpired(rr.lastModifiedTime()) )
+            {
+                osg::ref_ptr<osg::Node> node = rr.getNode();
+                if ( node.valid() )
+                {
+                    // generated shaders don't serialize, so regenerate them.
+                    if ( Registry::capabilities().supportsGLSL() )
+                        Registry::shaderGenerator().run( node.get(), "osgEarth.FeatureModelGraph" );
+
+                    styleGroup = getOrCreateStyleGroupFromFactory( style );
+                    styleGroup->addChild( node.get() );
+                    return styleGroup;
+                }
+            }
+        }
+    }
+
     // the profile of the features
     const FeatureProfile* featureProfile = _session->getFeatureSource()->getFeatureProfile();
 
@@ -1206,10 +1612,27 @@ FeatureModelGraph::createStyleGroup(const Style&        style,
         // start by culling our feature list to the working extent. By default, this is done by
         // checking feature centroids. But the user can override this to crop feature geometry to
         // the cell boundaries.
-        FeatureList workingSet;
-        cursor->fill( workingSet );
+        if ( _options.compileChunkSize().get() > 0 && _factory->isThreadSafe() )
+        {
+            styleGroup = createStyleGroup(style, cursor.get(), context);
+        }
+        else
+        {
+            FeatureList workingSet;
+            cursor->fill( workingSet );
+
+            styleGroup = createStyleGroup(style, workingSet, context);
+        }
 
-        styleGroup = createStyleGroup(style, workingSet, context);
+        // store the compiled geometry (not the style group, which the
+        // factory may share) for next time.
+        if ( !cacheKey.empty() && styleGroup && _compiledTilePolicy.isCacheWriteable() )
+        {
+            osg::ref_ptr<osg::Group> compiled = new osg::Group();
+            for( unsigned i = 0; i < styleGroup->getNumChildren(); ++i )
+                compiled->addChild( styleGroup->getChild(i) );
+            _compiledTileBin->write( cacheKey, compiled.get() );
+        }
     }
 
 
@@ -1217,6 +1640,36 @@ FeatureModelGraph::createStyleGroup(const Style&        style,
 }
 
 
+bool
+FeatureModelGraph::compileFeatures(FeatureList&             workingSet,
+                                   const Style&             style,
+                                   const FilterContext&     context,
+                                   osg::ref_ptr<osg::Node>& node)
+{
+    unsigned chunkSize = _options.compileChunkSize().get();
+
+    if ( chunkSize == 0 || workingSet.size() <= chunkSize || !_factory->isThreadSafe() )
+    {
+        osg::ref_ptr<FeatureCursor> newCursor = new FeatureListCursor(workingSet);
+        return _factory->createOrUpdateNode( newCursor.get(), style, context, node );
+    }
+
+    // split the working set into chunks, preserving feature order. The
+    // features are released as their chunks compile.
+    osg::ref_ptr<ChunkCompile> compile = new ChunkCompile( _factory.get(), style, context );
+    while( !workingSet.empty() )
+    {
+        FeatureList chunk;
+        FeatureList::iterator end = workingSet.begin();
+        std::advance( end, std::min(chunkSize, (unsigned)workingSet.size()) );
+        chunk.splice( chunk.end(), workingSet, workingSet.begin(), end );
+        compile->add( chunk );
+    }
+
+    node = finishChunks( compile.get(), _options.mergeGeometry() == true );
+    return node.valid();
+}
+
 void
 FeatureModelGraph::checkForGlobalStyles( const Style& style )
 {
@@ -1301,6 +1754,8 @@ FeatureModelGraph::getOrCreateStyleGroupFromFactory(const Style& style)
 void
 FeatureModelGraph::traverse(osg::NodeVisitor& nv)
 {
+    FrameStats::CullTimer cullTimer( nv, FrameStats::CULL_FEATURES );
+
     if ( nv.getVisitorType() == nv.EVENT_VISITOR )
     {
         if (!_pendingUpdate && 
@@ -41,7 +41,11 @@ _mergeGeometry     ( false ),
 _clusterCulling    ( true ),
 _backfaceCulling   ( true ),
 _alphaBlending     ( true ),
-_sessionWideResourceCache( true )
+_sessionWideResourceCache( true ),
+_compileChunkSize  ( 1000 ),
+_cacheCompiledTiles( false ),
+_spatialSplitThreshold( 64 ),
+_spatialBuildThreads( 0 )
 {
     fromConfig( _conf );
 }
@@ -68,6 +72,10 @@ FeatureModelSourceOptions::fromConfig( const Config& conf )
     conf.getIfSet( "alpha_blending",   _alphaBlending );
     
     conf.getIfSet( "session_wide_resource_cache", _sessionWideResourceCache );
+    conf.getIfSet( "compile_chunk_size", _compileChunkSize );
+    conf.getIfSet( "cache_compiled_tiles", _cacheCompiledTiles );
+    conf.getIfSet( "spatial_split_threshold", _spatialSplitThreshold );
+    conf.getIfSet( "spatial_build_threads", _spatialBuildThreads );
 }
 
 Config
@@ -95,6 +103,10 @@ FeatureModelSourceOptions::getConfig() const
     conf.updateIfSet( "alpha_blending",   _alphaBlending );
     
     conf.updateIfSet( "session_wide_resource_cache", _sessionWideResourceCache );
+    conf.updateIfSet( "compile_chunk_size", _compileChunkSize );
+    conf.updateIfSet( "cache_compiled_tiles", _cacheCompiledTiles );
+    conf.updateIfSet( "spatial_split_threshold", _spatialSplitThreshold );
+    conf.updateIfSet( "spatial_build_threads", _spatialBuildThreads );
 
     return conf;
 }
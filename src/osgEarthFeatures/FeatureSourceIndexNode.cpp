@@ -17,11 +17,14 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthFeatures/FeatureSourceIndexNode>
+#include <osgEarthSymbology/VertexTagTable>
 #include <osg/MatrixTransform>
+#include <osg/Geometry>
 #include <algorithm>
 
 using namespace osgEarth;
 using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
 
 #define LC "[FeatureSourceIndexNode] "
 
@@ -30,13 +33,189 @@ using namespace osgEarth::Features;
 //#define OE_DEBUG OE_INFO
 
 
+//-----------------------------------------------------------------------------
+
+namespace
+{
+    // Pick IDs are rendered as 24-bit RGB colors, with 0 meaning "nothing".
+    const unsigned MAX_PICK_ID = 0xFFFFFFu;
+
+    /**
+     * Process-wide table of pick IDs, so that one ID buffer can cover
+     * every index in the scene.
+     */
+    struct PickRegistry
+    {
+        PickRegistry() : _next(1u) { }
+
+        typedef std::pair< osg::observer_ptr<FeatureSourceIndexNode>, FeatureID > Entry;
+        typedef std::map<unsigned, Entry> Entries;
+
+        unsigned add(FeatureSourceIndexNode* index, FeatureID fid)
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            if ( _entries.size() >= MAX_PICK_ID )
+                return 0u;
+
+            // skip IDs still in use after wrapping around
+            while( _entries.find(_next) != _entries.end() )
+                _next = _next >= MAX_PICK_ID ? 1u : _next+1u;
+
+            unsigned id = _next;
+            _entries[id] = Entry(index, fid);
+            _next = _next >= MAX_PICK_ID ? 1u : _next+1u;
+            return id;
+        }
+
+        void remove(unsigned id)
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            _entries.erase( id );
+        }
+
+        bool get(unsigned id, osg::ref_ptr<FeatureSourceIndexNode>& index, FeatureID& fid)
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            Entries::const_iterator i = _entries.find(id);
+            if ( i == _entries.end() || !i->second.first.lock(index) )
+                return false;
+            fid = i->second.second;
+            return true;
+        }
+
+        Threading::Mutex _mutex;
+        Entries          _entries;
+        unsigned         _next;
+    };
+
+    PickRegistry& getPickRegistry()
+    {
+        static PickRegistry s_registry;
+        return s_registry;
+    }
+
+    // number of indices per primitive for modes that split into
+    // independent primitives; 0 for connected modes (strips etc.)
+    unsigned indicesPerPrimitive(GLenum mode)
+    {
+        switch( mode )
+        {
+        case osg::PrimitiveSet::POINTS:    return 1u;
+        case osg::PrimitiveSet::LINES:     return 2u;
+        case osg::PrimitiveSet::TRIANGLES: return 3u;
+        case osg::PrimitiveSet::QUADS:     return 4u;
+        default:                           return 0u;
+        }
+    }
+
+    // vertex index at which the n'th primitive of a primitive set starts
+    unsigned firstVertexOfPrimitive(const osg::PrimitiveSet* pset, unsigned n)
+    {
+        unsigned k;
+        unsigned step = indicesPerPrimitive( pset->getMode() );
+        if ( step > 0u )
+            k = n * step;
+        else if ( pset->getMode() == osg::PrimitiveSet::QUAD_STRIP )
+            k = n * 2u;
+        else if ( pset->getMode() == osg::PrimitiveSet::POLYGON )
+            k = 0u;
+        else
+            k = n;
+
+        return pset->index( k < pset->getNumIndices() ? k : 0u );
+    }
+
+    // whether vertices [a, b] all fall in one of a sorted list of ranges
+    bool inRanges(unsigned a, unsigned b, const VertexTagTable::Ranges& ranges)
+    {
+        for( VertexTagTable::Ranges::const_iterator r = ranges.begin(); r != ranges.end() && r->_first <= a; ++r )
+        {
+            if ( b < r->_first + r->_count )
+                return true;
+        }
+        return false;
+    }
+
+    bool inRanges(unsigned v, const VertexTagTable::Ranges& ranges)
+    {
+        return inRanges( v, v, ranges );
+    }
+
+    // Collects the primitives of a primitive set that start inside the ranges.
+    // Connected primitives are kept or dropped whole.
+    void extractPrimitives(osg::PrimitiveSet*                 pset,
+                           const VertexTagTable::Ranges&      ranges,
+                           FeatureDrawSet::PrimitiveSets&     output)
+    {
+        unsigned numIndices = pset->getNumIndices();
+        if ( numIndices == 0u )
+            return;
+
+        unsigned step = indicesPerPrimitive( pset->getMode() );
+
+        if ( step == 0u )
+        {
+            if ( inRanges(pset->index(0), ranges) )
+                output.push_back( pset );
+            return;
+        }
+
+        // share a DrawArrays that lies entirely in the feature
+        if ( pset->getType() == osg::PrimitiveSet::DrawArraysPrimitiveType &&
+             inRanges(pset->index(0), pset->index(numIndices-1), ranges) )
+        {
+            output.push_back( pset );
+            return;
+        }
+
+        osg::ref_ptr<osg::DrawElementsUInt> de = new osg::DrawElementsUInt( pset->getMode() );
+        for( unsigned k = 0; k + step <= numIndices; k += step )
+        {
+            if ( inRanges(pset->index(k), ranges) )
+            {
+                for( unsigned j = 0; j < step; ++j )
+                    de->push_back( pset->index(k+j) );
+            }
+        }
+
+        if ( de->size() > 0 )
+            output.push_back( de.get() );
+    }
+
+    // gets the pick ID array on a geometry, creating it as needed
+    osg::FloatArray* getOrCreatePickIDArray(osg::Geometry* geom)
+    {
+        const int loc = FeatureSourceIndexNode::PICK_ID_ATTRIB_LOCATION;
+        unsigned numVerts = geom->getVertexArray()->getNumElements();
+
+        osg::FloatArray* ids = dynamic_cast<osg::FloatArray*>( geom->getVertexAttribArray(loc) );
+        if ( !ids )
+        {
+            ids = new osg::FloatArray( numVerts );
+            geom->setVertexAttribArray    ( loc, ids );
+            geom->setVertexAttribBinding  ( loc, osg::Geometry::BIND_PER_VERTEX );
+            geom->setVertexAttribNormalize( loc, false );
+
+            // a negative uniform tells the pick shader to read the attribute
+            geom->getOrCreateStateSet()->getOrCreateUniform( FeatureSourceIndexNode::PICK_ID_UNIFORM_NAME, osg::Uniform::FLOAT )->set( -1.0f );
+        }
+        else if ( ids->size() < numVerts )
+        {
+            ids->resize( numVerts, 0.0f );
+        }
+        return ids;
+    }
+}
+
 //-----------------------------------------------------------------------------
 
 
 FeatureSourceIndexOptions::FeatureSourceIndexOptions(const Config& conf) :
-_embedFeatures( false )
+_embedFeatures( false ),
+_gpuPicking   ( false )
 {
     conf.getIfSet( "embed_features", _embedFeatures );
+    conf.getIfSet( "gpu_picking",    _gpuPicking );
 }
 
 Config
@@ -44,18 +223,21 @@ FeatureSourceIndexOptions::getConfig() const
 {
     Config conf("feature_indexing");
     conf.addIfSet( "embed_features", _embedFeatures );
+    conf.addIfSet( "gpu_picking",    _gpuPicking );
     return conf;
 }
 
 
 //-----------------------------------------------------------------------------
 
-FeatureSourceIndexNode::Collect::Collect( FeatureIDDrawSetMap& index ) :
+FeatureSourceIndexNode::Collect::Collect( FeatureIDDrawSetMap& index, Geometries& rangeTagged ) :
 osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ),
 _index          ( index ),
+_rangeTagged    ( rangeTagged ),
 _psets          ( 0 )
 {
     _index.clear();
+    _rangeTagged.clear();
 }
 
 void
@@ -86,6 +268,10 @@ FeatureSourceIndexNode::Collect::apply( osg::Geode& geode )
             osg::Geometry* geom = dynamic_cast<osg::Geometry*>( geode.getDrawable(i) );
             if ( geom )
             {
+                const VertexTagTable* tags = VertexTagTable::get( geom );
+                if ( tags && !tags->empty() )
+                    _rangeTagged.push_back( geom );
+
                 osg::Geometry::PrimitiveSetList& psets = geom->getPrimitiveSetList();
                 for( unsigned p = 0; p < psets.size(); ++p )
                 {
@@ -115,17 +301,155 @@ _options      ( options )
     //nop
 }
 
+FeatureSourceIndexNode::~FeatureSourceIndexNode()
+{
+    for( PickIDMap::const_iterator i = _pickIDs.begin(); i != _pickIDs.end(); ++i )
+        getPickRegistry().remove( i->second );
+}
+
+const char* FeatureSourceIndexNode::PICK_ID_ATTRIB_NAME  = "oe_index_pickIDAttr";
+const char* FeatureSourceIndexNode::PICK_ID_UNIFORM_NAME = "oe_index_pickID";
+
+bool
+FeatureSourceIndexNode::getFeatureByPickID(unsigned                              pickID,
+                                           osg::ref_ptr<FeatureSourceIndexNode>& out_index,
+                                           FeatureID&                            out_fid)
+{
+    return pickID != 0u && getPickRegistry().get( pickID, out_index, out_fid );
+}
+
 
 // Rebuilds the feature index based on all the tagged primitive sets found in a graph
 void
 FeatureSourceIndexNode::reindex()
 {
     _drawSets.clear();
+    _rangesExpanded.clear();
 
-    Collect c(_drawSets);
+    Collect c(_drawSets, _rangeTagged);
     this->accept( c );
 
-    OE_DEBUG << LC << "Reindexed; draw sets = " << _drawSets.size() << std::endl;
+    if ( _options.gpuPicking() == true )
+    {
+        assignPickIDs();
+    }
+
+    OE_DEBUG << LC << "Reindexed; draw sets = " << _drawSets.size() << ", range-tagged geometries = " << _rangeTagged.size() << std::endl;
+}
+
+
+// Adds the primitives of a feature's vertex ranges to its draw set.
+void
+FeatureSourceIndexNode::expandRanges(const FeatureID& fid)
+{
+    for( Geometries::iterator g = _rangeTagged.begin(); g != _rangeTagged.end(); ++g )
+    {
+        osg::Geometry* geom = g->get();
+        const VertexTagTable* tags = VertexTagTable::get( geom );
+        if ( !tags )
+            continue;
+
+        VertexTagTable::Ranges ranges;
+        for( VertexTagTable::Ranges::const_iterator r = tags->getRanges().begin(); r != tags->getRanges().end(); ++r )
+        {
+            if ( r->_tag == fid )
+                ranges.push_back( *r );
+        }
+
+        if ( ranges.empty() )
+            continue;
+
+        FeatureDrawSet::PrimitiveSets& output = _drawSets[fid].getOrCreateSlice( geom );
+        for( unsigned p = 0; p < geom->getNumPrimitiveSets(); ++p )
+        {
+            osg::PrimitiveSet* pset = geom->getPrimitiveSet(p);
+            if ( pset->getUserData() == 0L )
+                extractPrimitives( pset, ranges, output );
+        }
+
+        if ( output.empty() )
+            _drawSets[fid].slices().pop_back();
+    }
+}
+
+
+// Returns the pick ID of a feature, registering one the first time (0 if
+// the registry is full).
+unsigned
+FeatureSourceIndexNode::getOrCreatePickID(const FeatureID& fid)
+{
+    unsigned& pickID = _pickIDs[fid];
+    if ( pickID == 0u )
+    {
+        pickID = getPickRegistry().add( this, fid );
+        if ( pickID == 0u )
+        {
+            OE_WARN << LC << "Out of pick IDs; feature " << fid << " will not be GPU-pickable" << std::endl;
+        }
+    }
+    return pickID;
+}
+
+
+// Writes a pick ID into the geometry of each indexed feature: a per-vertex
+// attribute for tagged vertex ranges and primitive sets, or a uniform for
+// tagged nodes.
+void
+FeatureSourceIndexNode::assignPickIDs()
+{
+    for( Geometries::iterator g = _rangeTagged.begin(); g != _rangeTagged.end(); ++g )
+    {
+        osg::Geometry* geom = g->get();
+        const VertexTagTable* tags = VertexTagTable::get( geom );
+        if ( !tags || !geom->getVertexArray() )
+            continue;
+
+        osg::FloatArray* ids = getOrCreatePickIDArray( geom );
+        for( VertexTagTable::Ranges::const_iterator r = tags->getRanges().begin(); r != tags->getRanges().end(); ++r )
+        {
+            float pickID = (float)getOrCreatePickID( r->_tag );
+            unsigned end = osg::minimum( r->_first + r->_count, (unsigned)ids->size() );
+            for( unsigned v = r->_first; v < end; ++v )
+                (*ids)[v] = pickID;
+        }
+        ids->dirty();
+    }
+
+    for( FeatureIDDrawSetMap::iterator i = _drawSets.begin(); i != _drawSets.end(); ++i )
+    {
+        unsigned pickID = getOrCreatePickID( i->first );
+        if ( pickID == 0u )
+            continue;
+
+        FeatureDrawSet& drawSet = i->second;
+
+        for( FeatureDrawSet::DrawableSlices::iterator d = drawSet.slices().begin(); d != drawSet.slices().end(); ++d )
+        {
+            osg::Geometry* geom = d->drawable.valid() ? d->drawable->asGeometry() : 0L;
+            if ( !geom || !geom->getVertexArray() )
+                continue;
+
+            osg::FloatArray* ids = getOrCreatePickIDArray( geom );
+            unsigned numVerts = ids->size();
+
+            for( FeatureDrawSet::PrimitiveSets::const_iterator p = d->primSets.begin(); p != d->primSets.end(); ++p )
+            {
+                const osg::PrimitiveSet* pset = p->get();
+                for( unsigned k = 0; k < pset->getNumIndices(); ++k )
+                {
+                    unsigned v = pset->index(k);
+                    if ( v < numVerts )
+                        (*ids)[v] = (float)pickID;
+                }
+            }
+            ids->dirty();
+        }
+
+        for( FeatureDrawSet::Nodes::iterator n = drawSet.nodes().begin(); n != drawSet.nodes().end(); ++n )
+        {
+            n->get()->getOrCreateStateSet()->getOrCreateUniform( PICK_ID_UNIFORM_NAME, osg::Uniform::FLOAT )->set( (float)pickID );
+        }
+    }
 }
 
 
@@ -140,21 +464,49 @@ FeatureSourceIndexNode::tagPrimitiveSets(osg::Drawable* drawable, Feature* featu
     if ( !geom )
         return;
 
-    RefFeatureID* rfid = 0L;
+    if ( geom->getNumPrimitiveSets() == 0 )
+        return;
 
-    osg::Geometry::PrimitiveSetList& plist = geom->getPrimitiveSetList();
-    for( osg::Geometry::PrimitiveSetList::iterator p = plist.begin(); p != plist.end(); ++p )
+    // one range covering the whole drawable; it stays valid if the
+    // geometry is later merged with others.
+    VertexTagTable* tags = geom->getVertexArray() ? VertexTagTable::getOrCreate( geom ) : 0L;
+    if ( tags )
     {
-        if ( !rfid )
-            rfid = new RefFeatureID(feature->getFID());
-
-        p->get()->setUserData( rfid );
-
-        if ( _options.embedFeatures() == true )
+        tags->clear();
+        tags->add( 0u, geom->getVertexArray()->getNumElements(), feature->getFID() );
+    }
+    else
+    {
+        // the geometry's user data is taken; tag the primitive sets instead.
+        osg::ref_ptr<RefFeatureID> rfid = new RefFeatureID(feature->getFID());
+        osg::Geometry::PrimitiveSetList& plist = geom->getPrimitiveSetList();
+        for( osg::Geometry::PrimitiveSetList::iterator p = plist.begin(); p != plist.end(); ++p )
         {
-            _features[feature->getFID()] = feature;
+            p->get()->setUserData( rfid.get() );
         }
     }
+
+    if ( _options.embedFeatures() == true )
+    {
+        Threading::ScopedMutexLock lock( _featuresMutex );
+        _features[feature->getFID()] = feature;
+    }
+}
+
+
+void
+FeatureSourceIndexNode::tagPrimitiveSet(osg::PrimitiveSet* primSet, Feature* feature) const
+{
+    if ( primSet == 0L )
+        return;
+
+    primSet->setUserData( new RefFeatureID(feature->getFID()) );
+
+    if ( _options.embedFeatures() == true )
+    {
+        Threading::ScopedMutexLock lock( _featuresMutex );
+        _features[feature->getFID()] = feature;
+    }
 }
 
 
@@ -165,6 +517,7 @@ FeatureSourceIndexNode::tagNode( osg::Node* node, Feature* feature ) const
 
     if ( _options.embedFeatures() == true )
     {
+        Threading::ScopedMutexLock lock( _featuresMutex );
         _features[feature->getFID()] = feature;
     }
 }
@@ -173,12 +526,35 @@ FeatureSourceIndexNode::tagNode( osg::Node* node, Feature* feature ) const
 bool
 FeatureSourceIndexNode::getAllFIDs(std::vector<FeatureID>& output) const
 {
-    output.reserve( _drawSets.size() );
     output.clear();
+
+    if ( _rangeTagged.empty() )
+    {
+        output.reserve( _drawSets.size() );
+        for(FeatureIDDrawSetMap::const_iterator i = _drawSets.begin(); i != _drawSets.end(); ++i )
+        {
+            output.push_back( i->first );
+        }
+        return true;
+    }
+
+    std::set<FeatureID> fids;
     for(FeatureIDDrawSetMap::const_iterator i = _drawSets.begin(); i != _drawSets.end(); ++i )
     {
-        output.push_back( i->first );
+        fids.insert( i->first );
+    }
+
+    for(Geometries::const_iterator g = _rangeTagged.begin(); g != _rangeTagged.end(); ++g )
+    {
+        const VertexTagTable* tags = VertexTagTable::get( g->get() );
+        if ( tags )
+        {
+            for( VertexTagTable::Ranges::const_iterator r = tags->getRanges().begin(); r != tags->getRanges().end(); ++r )
+                fids.insert( r->_tag );
+        }
     }
+
+    output.assign( fids.begin(), fids.end() );
     return true;
 }
 
@@ -204,6 +580,38 @@ FeatureSourceIndexNode::getFID(osg::Drawable* drawable, int primIndex, FeatureID
     if ( drawable == 0L || primIndex < 0 )
         return false;
 
+    // vertex-range tags: find the first vertex of the primitive.
+    const osg::Geometry* taggedGeom = drawable->asGeometry();
+    const VertexTagTable* tags = VertexTagTable::get( taggedGeom );
+    if ( tags )
+    {
+        unsigned encounteredPrims = 0;
+        const osg::Geometry::PrimitiveSetList& geomPrimSets = taggedGeom->getPrimitiveSetList();
+        for( osg::Geometry::PrimitiveSetList::const_iterator p = geomPrimSets.begin(); p != geomPrimSets.end(); ++p )
+        {
+            const osg::PrimitiveSet* pset = p->get();
+            unsigned numPrims = pset->getNumPrimitives();
+            if ( encounteredPrims + numPrims > (unsigned)primIndex )
+            {
+                const RefFeatureID* fid = dynamic_cast<const RefFeatureID*>( pset->getUserData() );
+                if ( fid )
+                {
+                    output = *fid;
+                    return true;
+                }
+
+                VertexTagTable::Tag tag;
+                if ( pset->getNumIndices() > 0 && tags->getTag(firstVertexOfPrimitive(pset, primIndex - encounteredPrims), tag) )
+                {
+                    output = tag;
+                    return true;
+                }
+                break;
+            }
+            encounteredPrims += numPrims;
+        }
+    }
+
     for( FeatureIDDrawSetMap::const_iterator i = _drawSets.begin(); i != _drawSets.end(); ++i )
     {
         const FeatureDrawSet& drawSet = i->second;
@@ -262,7 +670,17 @@ FeatureSourceIndexNode::getDrawSet(const FeatureID& fid )
 {
     static FeatureDrawSet s_empty;
 
+    if ( !_rangeTagged.empty() && _rangesExpanded.insert(fid).second )
+    {
+        expandRanges( fid );
+    }
+
     FeatureIDDrawSetMap::iterator i = _drawSets.find(fid);
+    if ( i != _drawSets.end() && i->second.empty() )
+    {
+        _drawSets.erase( i );
+        i = _drawSets.end();
+    }
     return i != _drawSets.end() ? i->second : s_empty;
 }
 
@@ -272,6 +690,7 @@ FeatureSourceIndexNode::getFeature(const FeatureID& fid, const Feature*& output)
 {
     if ( _options.embedFeatures() == true )
     {
+        Threading::ScopedMutexLock lock( _featuresMutex );
         FeatureMap::const_iterator f = _features.find(fid);
 
         if(f != _features.end())
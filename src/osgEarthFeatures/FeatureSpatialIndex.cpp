@@ -0,0 +1,251 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthFeatures/FeatureSpatialIndex>
+#include <osgEarthFeatures/FeatureSource>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+#define LC "[FeatureSpatialIndex] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // anything with a _box[4] (entries and nodes) sorts by box center.
+    template<typename T>
+    struct LessX {
+        bool operator()(const T& lhs, const T& rhs) const {
+            return lhs._box[0]+lhs._box[2] < rhs._box[0]+rhs._box[2]; }
+    };
+
+    template<typename T>
+    struct LessY {
+        bool operator()(const T& lhs, const T& rhs) const {
+            return lhs._box[1]+lhs._box[3] < rhs._box[1]+rhs._box[3]; }
+    };
+
+    /**
+     * Sort-Tile-Recursive ordering: sort by X, cut into vertical slices
+     * of (slices * capacity) items, and sort each slice by Y. Consecutive
+     * runs of "capacity" items then make well-packed, low-overlap nodes.
+     */
+    template<typename T>
+    void strSort(typename std::vector<T>::iterator begin,
+                 typename std::vector<T>::iterator end,
+                 unsigned                          capacity)
+    {
+        unsigned count  = end - begin;
+        unsigned pages  = (count + capacity - 1) / capacity;
+        unsigned slices = (unsigned)ceil( sqrt((double)pages) );
+        unsigned sliceSize = slices * capacity;
+
+        std::sort( begin, end, LessX<T>() );
+
+        for( unsigned s = 0; s < count; s += sliceSize )
+        {
+            unsigned e = std::min( s + sliceSize, count );
+            std::sort( begin + s, begin + e, LessY<T>() );
+        }
+    }
+
+    inline bool intersects(const double* a, const Bounds& b)
+    {
+        return
+            a[0] <= b.xMax() && a[2] >= b.xMin() &&
+            a[1] <= b.yMax() && a[3] >= b.yMin();
+    }
+
+    inline void expand(double* box, const double* rhs)
+    {
+        box[0] = std::min(box[0], rhs[0]);
+        box[1] = std::min(box[1], rhs[1]);
+        box[2] = std::max(box[2], rhs[2]);
+        box[3] = std::max(box[3], rhs[3]);
+    }
+}
+
+//------------------------------------------------------------------------
+
+FeatureSpatialIndex::FeatureSpatialIndex(EntryVector& entries) :
+_nodeCapacity( 16 )
+{
+    _entries.swap( entries );
+    build();
+}
+
+void
+FeatureSpatialIndex::build()
+{
+    _nodes.clear();
+    if ( _entries.empty() )
+        return;
+
+    // leaves:
+    strSort<Entry>( _entries.begin(), _entries.end(), _nodeCapacity );
+
+    for( unsigned i = 0; i < _entries.size(); i += _nodeCapacity )
+    {
+        Node leaf;
+        leaf._first = i;
+        leaf._count = std::min( _nodeCapacity, (unsigned)_entries.size() - i );
+        leaf._leaf  = true;
+        std::copy( _entries[i]._box, _entries[i]._box+4, leaf._box );
+        for( unsigned j = i+1; j < i + leaf._count; ++j )
+            expand( leaf._box, _entries[j]._box );
+        _nodes.push_back( leaf );
+    }
+
+    // pack each level into the next until one root remains. Every level
+    // is contiguous in _nodes, and reordering a level is safe because
+    // nothing references it until its parents are created.
+    unsigned levelBegin = 0;
+    unsigned levelEnd   = _nodes.size();
+    while( levelEnd - levelBegin > 1 )
+    {
+        strSort<Node>( _nodes.begin() + levelBegin, _nodes.begin() + levelEnd, _nodeCapacity );
+
+        for( unsigned i = levelBegin; i < levelEnd; i += _nodeCapacity )
+        {
+            Node parent;
+            parent._first = i;
+            parent._count = std::min( _nodeCapacity, levelEnd - i );
+            parent._leaf  = false;
+            std::copy( _nodes[i]._box, _nodes[i]._box+4, parent._box );
+            for( unsigned j = i+1; j < i + parent._count; ++j )
+                expand( parent._box, _nodes[j]._box );
+            _nodes.push_back( parent );
+        }
+
+        levelBegin = levelEnd;
+        levelEnd   = _nodes.size();
+    }
+}
+
+void
+FeatureSpatialIndex::query(const Bounds& bounds, std::vector<FeatureID>& output) const
+{
+    if ( _nodes.empty() || !bounds.isValid() )
+        return;
+
+    std::vector<unsigned> stack;
+    stack.push_back( _nodes.size()-1 );
+
+    while( !stack.empty() )
+    {
+        const Node& node = _nodes[stack.back()];
+        stack.pop_back();
+
+        if ( !intersects(node._box, bounds) )
+            continue;
+
+        if ( node._leaf )
+        {
+            for( unsigned i = node._first; i < node._first + node._count; ++i )
+            {
+                if ( intersects(_entries[i]._box, bounds) )
+                    output.push_back( _entries[i]._id );
+            }
+        }
+        else
+        {
+            for( unsigned i = node._first; i < node._first + node._count; ++i )
+                stack.push_back( i );
+        }
+    }
+}
+
+Bounds
+FeatureSpatialIndex::getBounds() const
+{
+    if ( _nodes.empty() )
+        return Bounds();
+
+    const double* box = _nodes.back()._box;
+    return Bounds( box[0], box[1], box[2], box[3] );
+}
+
+bool
+FeatureSpatialIndex::write(std::ostream& out) const
+{
+    out << std::setprecision(17) << _entries.size() << "\n";
+    for( EntryVector::const_iterator i = _entries.begin(); i != _entries.end(); ++i )
+    {
+        out << i->_id << " "
+            << i->_box[0] << " " << i->_box[1] << " " << i->_box[2] << " " << i->_box[3] << "\n";
+    }
+    return !out.fail();
+}
+
+FeatureSpatialIndex*
+FeatureSpatialIndex::read(std::istream& in)
+{
+    unsigned count = 0;
+    in >> count;
+    if ( in.fail() )
+        return 0L;
+
+    EntryVector entries;
+    entries.reserve( count );
+    for( unsigned i = 0; i < count; ++i )
+    {
+        Entry e;
+        in >> e._id >> e._box[0] >> e._box[1] >> e._box[2] >> e._box[3];
+        if ( in.fail() )
+        {
+            OE_WARN << LC << "Spatial index is truncated; discarding it" << std::endl;
+            return 0L;
+        }
+        entries.push_back( e );
+    }
+
+    return new FeatureSpatialIndex( entries );
+}
+
+FeatureSpatialIndex*
+FeatureSpatialIndex::create(FeatureSource* source)
+{
+    if ( !source )
+        return 0L;
+
+    EntryVector entries;
+    if ( source->getFeatureCount() > 0 )
+        entries.reserve( source->getFeatureCount() );
+
+    osg::ref_ptr<FeatureCursor> cursor = source->createFeatureCursor();
+    while( cursor.valid() && cursor->hasMore() )
+    {
+        Feature* f = cursor->nextFeature();
+        if ( f && f->getGeometry() )
+        {
+            Bounds b = f->getGeometry()->getBounds();
+            if ( b.isValid() )
+                entries.push_back( Entry(f->getFID(), b.xMin(), b.yMin(), b.xMax(), b.yMax()) );
+        }
+    }
+
+    if ( entries.empty() )
+        return 0L;
+
+    OE_DEBUG << LC << "Indexed " << entries.size() << " features" << std::endl;
+    return new FeatureSpatialIndex( entries );
+}
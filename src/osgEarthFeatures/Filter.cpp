@@ -137,29 +137,28 @@ FeaturesToNodeFilter::transformAndLocalize(const std::vector<osg::Vec3d>& input,
                                            osg::Vec3Array*                output,
                                            const SpatialReference*        outputSRS,
                                            const osg::Matrixd&            world2local,
-                                           bool                           toECEF )
+                                           bool                           toECEF,
+                                           Arena*                         arena )
 {
     output->reserve( output->size() + input.size() );
 
     if ( toECEF )
     {
-        ECEF::transformAndLocalize( input, inputSRS, output, outputSRS, world2local );
+        ECEF::transformAndLocalize( input, inputSRS, output, outputSRS, world2local, arena );
     }
-    else if ( inputSRS )
+    else
     {
-        std::vector<osg::Vec3d> temp( input );
-        inputSRS->transform( temp, outputSRS );
+        ScratchPoints scratch( arena );
+        std::vector<osg::Vec3d>& temp = scratch.get();
+        temp.assign( input.begin(), input.end() );
+        if ( inputSRS )
+            inputSRS->transform( temp, outputSRS );
+
+        ECEF::transformPoints( world2local, temp );
 
         for( std::vector<osg::Vec3d>::const_iterator i = temp.begin(); i != temp.end(); ++i )
         {
-            output->push_back( (*i) * world2local );
-        }
-    }
-    else
-    {
-        for( std::vector<osg::Vec3d>::const_iterator i = input.begin(); i != input.end(); ++i )
-        {
-            output->push_back( (*i) * world2local );
+            output->push_back( *i );
         }
     }
 }
@@ -173,7 +172,8 @@ FeaturesToNodeFilter::transformAndLocalize(const std::vector<osg::Vec3d>& input,
                                            osg::Vec3Array*                output_normals,
                                            const SpatialReference*        outputSRS,
                                            const osg::Matrixd&            world2local,
-                                           bool                           toECEF )
+                                           bool                           toECEF,
+                                           Arena*                         arena )
 {
     // pre-allocate enough space (performance)
     output_verts->reserve( output_verts->size() + input.size() );
@@ -183,25 +183,21 @@ FeaturesToNodeFilter::transformAndLocalize(const std::vector<osg::Vec3d>& input,
 
     if ( toECEF )
     {
-        ECEF::transformAndLocalize( input, inputSRS, output_verts, output_normals, outputSRS, world2local );
+        ECEF::transformAndLocalize( input, inputSRS, output_verts, output_normals, outputSRS, world2local, arena );
     }
-    else if ( inputSRS )
+    else
     {
-        std::vector<osg::Vec3d> temp( input );
-        inputSRS->transform( temp, outputSRS );
+        ScratchPoints scratch( arena );
+        std::vector<osg::Vec3d>& temp = scratch.get();
+        temp.assign( input.begin(), input.end() );
+        if ( inputSRS )
+            inputSRS->transform( temp, outputSRS );
+
+        ECEF::transformPoints( world2local, temp );
 
         for( std::vector<osg::Vec3d>::const_iterator i = temp.begin(); i != temp.end(); ++i )
         {
-            output_verts->push_back( (*i) * world2local );
-            if ( output_normals )
-                output_normals->push_back( osg::Vec3(0,0,1) );
-        }
-    }
-    else
-    {
-        for( std::vector<osg::Vec3d>::const_iterator i = input.begin(); i != input.end(); ++i )
-        {
-            output_verts->push_back( (*i) * world2local );
+            output_verts->push_back( *i );
             if ( output_normals )
                 output_normals->push_back( osg::Vec3(0,0,1) );
         }
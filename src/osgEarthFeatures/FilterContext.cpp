@@ -72,7 +72,8 @@ _referenceFrame       ( rhs._referenceFrame ),
 _inverseReferenceFrame( rhs._inverseReferenceFrame ),
 _resourceCache        ( rhs._resourceCache.get() ),
 _index                ( rhs._index ),
-_shaderPolicy         ( rhs._shaderPolicy )
+_shaderPolicy         ( rhs._shaderPolicy ),
+_arena                ( rhs._arena.get() )
 {
     //nop
 }
@@ -142,6 +143,16 @@ FilterContext::resourceCache()
     return _resourceCache.get();
 }
 
+Arena*
+FilterContext::arena() const
+{
+    if ( _arena.valid() )
+        return _arena.get();
+
+    // resolved on each call, since copies of a context run on other threads.
+    return _session.valid() ? _session->getArena() : 0L;
+}
+
 std::string
 FilterContext::toString() const
 {
@@ -0,0 +1,510 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthFeatures/GeoJSONReader>
+#include <osgEarth/JsonUtils>
+#include <osgEarth/StringUtils>
+
+#define LC "[GeoJSONReader] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+namespace
+{
+    /**
+     * Positions of a "coordinates" member, flattened as they stream in.
+     * Each innermost array becomes a point; the arrays of points and the
+     * arrays of those are recorded by where they end.
+     */
+    struct Coordinates
+    {
+        Coordinates() : _numValues(0) { }
+
+        std::vector<osg::Vec3d> _points;
+        std::vector<unsigned>   _lineEnds;    // end index (in _points) of each array of positions
+        std::vector<unsigned>   _polygonEnds; // end index (in _lineEnds) of each array of rings
+        double                  _values[3];
+        unsigned                _numValues;
+    };
+
+    /** An object that is a Feature, a FeatureCollection, or a geometry. */
+    struct ObjectFrame
+    {
+        enum Role
+        {
+            ROLE_ROOT,      // the document itself
+            ROLE_FEATURE,   // an element of "features"
+            ROLE_GEOMETRY,  // the "geometry" member of a feature
+            ROLE_PART       // an element of "geometries"
+        };
+
+        ObjectFrame( Role role ) : _role(role), _hasId(false), _id(0.0) { }
+
+        Role                                  _role;
+        std::string                           _type;
+        bool                                  _hasId;
+        double                                _id;
+        osg::ref_ptr<Geometry>                _geometry;
+        AttributeTable                        _attrs;
+        Coordinates                           _coords;
+        std::vector< osg::ref_ptr<Geometry> > _parts;
+    };
+
+    // same as OgrUtils::populate: reverse the winding and drop duplicate points.
+    void populate( const std::vector<osg::Vec3d>& points, unsigned begin, unsigned end, Geometry* target )
+    {
+        for( unsigned v = end; v > begin; --v )
+        {
+            const osg::Vec3d& p = points[v-1];
+            if ( target->size() == 0 || p != target->back() )
+                target->push_back( p );
+        }
+    }
+
+    Polygon* createPolygon( const Coordinates& c, unsigned firstLine, unsigned lastLine )
+    {
+        Polygon* output = 0L;
+        for( unsigned line = firstLine; line < lastLine; ++line )
+        {
+            unsigned begin = line > 0 ? c._lineEnds[line-1] : 0;
+            unsigned end   = c._lineEnds[line];
+            if ( line == firstLine )
+            {
+                output = new Polygon( end-begin );
+                populate( c._points, begin, end, output );
+                output->rewind( Ring::ORIENTATION_CCW );
+            }
+            else
+            {
+                Ring* hole = new Ring( end-begin );
+                populate( c._points, begin, end, hole );
+                hole->rewind( Ring::ORIENTATION_CW );
+                output->getHoles().push_back( hole );
+            }
+        }
+        return output;
+    }
+
+    Geometry* createGeometry( ObjectFrame& frame )
+    {
+        const Coordinates& c = frame._coords;
+        const std::string& type = frame._type;
+
+        if ( type == "Point" || type == "LineString" )
+        {
+            if ( c._points.empty() )
+                return 0L;
+            Geometry* output = type == "Point" ?
+                (Geometry*)new PointSet( c._points.size() ) :
+                (Geometry*)new LineString( c._points.size() );
+            populate( c._points, 0, c._points.size(), output );
+            return output;
+        }
+
+        else if ( type == "Polygon" )
+        {
+            return c._lineEnds.empty() ? 0L : createPolygon( c, 0, c._lineEnds.size() );
+        }
+
+        else if ( type == "MultiPoint" || type == "MultiLineString" || type == "MultiPolygon" || type == "GeometryCollection" )
+        {
+            MultiGeometry* multi = new MultiGeometry();
+
+            if ( type == "MultiPoint" )
+            {
+                for( unsigned i = 0; i < c._points.size(); ++i )
+                {
+                    PointSet* part = new PointSet( 1 );
+                    part->push_back( c._points[i] );
+                    multi->getComponents().push_back( part );
+                }
+            }
+            else if ( type == "MultiLineString" )
+            {
+                for( unsigned line = 0; line < c._lineEnds.size(); ++line )
+                {
+                    unsigned begin = line > 0 ? c._lineEnds[line-1] : 0;
+                    LineString* part = new LineString( c._lineEnds[line]-begin );
+                    populate( c._points, begin, c._lineEnds[line], part );
+                    multi->getComponents().push_back( part );
+                }
+            }
+            else if ( type == "MultiPolygon" )
+            {
+                for( unsigned poly = 0; poly < c._polygonEnds.size(); ++poly )
+                {
+                    unsigned begin = poly > 0 ? c._polygonEnds[poly-1] : 0;
+                    if ( c._polygonEnds[poly] > begin )
+                        multi->getComponents().push_back( createPolygon(c, begin, c._polygonEnds[poly]) );
+                }
+            }
+            else
+            {
+                multi->getComponents().insert( multi->getComponents().end(), frame._parts.begin(), frame._parts.end() );
+            }
+
+            return multi;
+        }
+
+        return 0L;
+    }
+
+    /**
+     * Turns the events of a GeoJSON document into Features.
+     */
+    class FeatureBuilder : public Json::EventHandler
+    {
+    public:
+        FeatureBuilder( const SpatialReference* srs, FeatureList& output ) :
+          _srs(srs), _output(output), _count(0) { }
+
+        bool objectBegin()
+        {
+            Context parent = _contexts.empty() ? CTX_NONE : _contexts.back();
+
+            if ( parent == CTX_NONE )
+                pushObject( ObjectFrame::ROLE_ROOT );
+            else if ( parent == CTX_OBJECT && _name == "geometry" )
+                pushObject( ObjectFrame::ROLE_GEOMETRY );
+            else if ( parent == CTX_OBJECT && _name == "properties" )
+                _contexts.push_back( CTX_PROPERTIES );
+            else if ( parent == CTX_FEATURES )
+                pushObject( ObjectFrame::ROLE_FEATURE );
+            else if ( parent == CTX_GEOMETRIES )
+                pushObject( ObjectFrame::ROLE_PART );
+            else if ( parent == CTX_PROPERTIES || parent == CTX_NESTED )
+                beginNested( Json::objectValue );
+            else
+                _contexts.push_back( CTX_SKIP );
+
+            return true;
+        }
+
+        bool objectEnd()
+        {
+            Context context = _contexts.back();
+            _contexts.pop_back();
+
+            if ( context == CTX_OBJECT )
+                endObject();
+            else if ( context == CTX_NESTED )
+                endNested();
+
+            return true;
+        }
+
+        bool arrayBegin()
+        {
+            Context parent = _contexts.empty() ? CTX_NONE : _contexts.back();
+
+            if ( parent == CTX_OBJECT && _name == "features" )
+            {
+                _contexts.push_back( CTX_FEATURES );
+            }
+            else if ( parent == CTX_OBJECT && _name == "geometries" )
+            {
+                _contexts.push_back( CTX_GEOMETRIES );
+            }
+            else if ( (parent == CTX_OBJECT && _name == "coordinates") || parent == CTX_COORDINATES )
+            {
+                _contexts.push_back( CTX_COORDINATES );
+                _heights.push_back( 0 );
+            }
+            else if ( parent == CTX_PROPERTIES || parent == CTX_NESTED )
+            {
+                beginNested( Json::arrayValue );
+            }
+            else
+            {
+                _contexts.push_back( CTX_SKIP );
+            }
+            return true;
+        }
+
+        bool arrayEnd()
+        {
+            Context context = _contexts.back();
+            _contexts.pop_back();
+
+            if ( context == CTX_COORDINATES )
+                endCoordinates();
+            else if ( context == CTX_NESTED )
+                endNested();
+
+            return true;
+        }
+
+        bool memberName( const std::string& name )
+        {
+            _name = name;
+            return true;
+        }
+
+        bool stringValue( const std::string& value )
+        {
+            Context context = _contexts.empty() ? CTX_NONE : _contexts.back();
+            if ( context == CTX_OBJECT && _name == "type" )
+                _objects.back()._type = value;
+            else if ( context == CTX_PROPERTIES )
+                setAttr( ATTRTYPE_STRING ).second.stringValue = value;
+            else if ( context == CTX_NESTED )
+                nestedSlot() = value;
+            return true;
+        }
+
+        bool numberValue( double value, bool isInteger )
+        {
+            Context context = _contexts.empty() ? CTX_NONE : _contexts.back();
+            if ( context == CTX_COORDINATES )
+            {
+                Coordinates& c = _objects.back()._coords;
+                if ( c._numValues < 3 )
+                    c._values[c._numValues++] = value;
+                _heights.back() = 1;
+            }
+            else if ( context == CTX_OBJECT && _name == "id" )
+            {
+                _objects.back()._hasId = true;
+                _objects.back()._id    = value;
+            }
+            else if ( context == CTX_PROPERTIES )
+            {
+                if ( isInteger && value >= -2147483648.0 && value <= 2147483647.0 )
+                    setAttr( ATTRTYPE_INT ).second.intValue = (int)value;
+                else
+                    setAttr( ATTRTYPE_DOUBLE ).second.doubleValue = value;
+            }
+            else if ( context == CTX_NESTED )
+            {
+                nestedSlot() = value;
+            }
+            return true;
+        }
+
+        bool boolValue( bool value )
+        {
+            Context context = _contexts.empty() ? CTX_NONE : _contexts.back();
+            if ( context == CTX_PROPERTIES )
+                setAttr( ATTRTYPE_BOOL ).second.boolValue = value;
+            else if ( context == CTX_NESTED )
+                nestedSlot() = value;
+            return true;
+        }
+
+        bool nullValue()
+        {
+            Context context = _contexts.empty() ? CTX_NONE : _contexts.back();
+            if ( context == CTX_PROPERTIES )
+                setAttr( ATTRTYPE_UNSPECIFIED ).second.set = false;
+            else if ( context == CTX_NESTED )
+                nestedSlot() = Json::Value();
+            return true;
+        }
+
+    private:
+        enum Context
+        {
+            CTX_NONE,
+            CTX_OBJECT,       // see ObjectFrame
+            CTX_FEATURES,     // the "features" array
+            CTX_GEOMETRIES,   // the "geometries" array
+            CTX_COORDINATES,  // an array in "coordinates"
+            CTX_PROPERTIES,   // the "properties" object
+            CTX_NESTED,       // an object or array within a property value
+            CTX_SKIP          // anything else
+        };
+
+        void pushObject( ObjectFrame::Role role )
+        {
+            _contexts.push_back( CTX_OBJECT );
+            _objects.push_back( ObjectFrame(role) );
+        }
+
+        void endObject()
+        {
+            ObjectFrame& frame = _objects.back();
+
+            if ( frame._type == "Feature" || frame._role == ObjectFrame::ROLE_FEATURE )
+            {
+                emit( frame, frame._geometry.get() );
+            }
+            else if ( frame._type != "FeatureCollection" )
+            {
+                osg::ref_ptr<Geometry> geom = createGeometry( frame );
+                if ( frame._role == ObjectFrame::ROLE_ROOT )
+                    emit( frame, geom.get() );
+                else if ( geom.valid() && _objects.size() > 1 )
+                {
+                    ObjectFrame& parent = _objects[_objects.size()-2];
+                    if ( frame._role == ObjectFrame::ROLE_GEOMETRY )
+                        parent._geometry = geom.get();
+                    else
+                        parent._parts.push_back( geom.get() );
+                }
+            }
+
+            _objects.pop_back();
+        }
+
+        void emit( ObjectFrame& frame, Geometry* geom )
+        {
+            FeatureID fid = frame._hasId && frame._id >= 0.0 ? (FeatureID)frame._id : _count;
+            ++_count;
+
+            Feature* feature = new Feature( geom, _srs, Style(), fid );
+            for( AttributeTable::const_iterator i = frame._attrs.begin(); i != frame._attrs.end(); ++i )
+            {
+                const AttributeValue& value = i->second;
+                if ( !value.second.set )
+                {
+                    if ( value.first == ATTRTYPE_UNSPECIFIED )
+                        feature->setNull( i->first );
+                    else
+                        feature->setNull( i->first, value.first );
+                    continue;
+                }
+                switch( value.first )
+                {
+                case ATTRTYPE_INT:    feature->set( i->first, value.second.intValue ); break;
+                case ATTRTYPE_DOUBLE: feature->set( i->first, value.second.doubleValue ); break;
+                case ATTRTYPE_BOOL:   feature->set( i->first, value.second.boolValue ); break;
+                default:              feature->set( i->first, value.second.stringValue ); break;
+                }
+            }
+            _output.push_back( feature );
+        }
+
+        // Starts a new property in the innermost object (i.e. the feature).
+        AttributeValue& setAttr( AttributeType type )
+        {
+            AttributeValue& value = _objects.back()._attrs[ toLower(_name) ];
+            value.first      = type;
+            value.second.set = true;
+            return value;
+        }
+
+        void endCoordinates()
+        {
+            int height = _heights.back();
+            _heights.pop_back();
+
+            Coordinates& c = _objects.back()._coords;
+            if ( height == 1 )
+            {
+                c._points.push_back( osg::Vec3d(
+                    c._numValues > 0 ? c._values[0] : 0.0,
+                    c._numValues > 1 ? c._values[1] : 0.0,
+                    c._numValues > 2 ? c._values[2] : 0.0) );
+                c._numValues = 0;
+            }
+            else if ( height == 2 )
+            {
+                c._lineEnds.push_back( c._points.size() );
+            }
+            else if ( height == 3 )
+            {
+                c._polygonEnds.push_back( c._lineEnds.size() );
+            }
+
+            if ( !_heights.empty() && height > 0 )
+                _heights.back() = osg::maximum( _heights.back(), height+1 );
+        }
+
+        // Property values that are objects or arrays become JSON strings, as
+        // they do with OGR.
+        void beginNested( Json::ValueType type )
+        {
+            if ( _contexts.back() == CTX_PROPERTIES )
+            {
+                _nestedName = _name;
+                _nestedRoot = Json::Value( type );
+                _nested.push_back( &_nestedRoot );
+            }
+            else
+            {
+                Json::Value& slot = nestedSlot();
+                slot = Json::Value( type );
+                _nested.push_back( &slot );
+            }
+            _contexts.push_back( CTX_NESTED );
+        }
+
+        void endNested()
+        {
+            _nested.pop_back();
+            if ( _nested.empty() )
+            {
+                std::string json = trim( Json::FastWriter().write(_nestedRoot) );
+                _name = _nestedName;
+                setAttr( ATTRTYPE_STRING ).second.stringValue = json;
+                _nestedRoot = Json::Value();
+            }
+        }
+
+        Json::Value& nestedSlot()
+        {
+            Json::Value* parent = _nested.back();
+            return parent->isArray() ? parent->append( Json::Value() ) : (*parent)[_name];
+        }
+
+        const SpatialReference*    _srs;
+        FeatureList&               _output;
+        FeatureID                  _count;
+        std::string                _name;
+        std::vector<Context>       _contexts;
+        std::vector<ObjectFrame>   _objects;
+        std::vector<int>           _heights;
+        std::string                _nestedName;
+        Json::Value                _nestedRoot;
+        std::vector<Json::Value*>  _nested;
+    };
+}
+
+GeoJSONReader::GeoJSONReader( const SpatialReference* srs ) :
+_srs( srs )
+{
+    //nop
+}
+
+bool
+GeoJSONReader::read( const std::string& buffer, FeatureList& output )
+{
+    return read( buffer.data(), buffer.data() + buffer.size(), output );
+}
+
+bool
+GeoJSONReader::read( const char* begin, const char* end, FeatureList& output )
+{
+    _error.clear();
+
+    FeatureList features;
+    FeatureBuilder builder( _srs.get(), features );
+
+    Json::EventReader reader;
+    if ( !reader.parse(begin, end, builder) )
+    {
+        _error = reader.getFormatedErrorMessages();
+        OE_WARN << LC << "Failed to read GeoJSON:\n" << _error << std::endl;
+        return false;
+    }
+
+    output.splice( output.end(), features );
+    return true;
+}
@@ -30,6 +30,7 @@
 #include <osgEarth/AutoScale>
 #include <osgEarth/CullingUtils>
 #include <osgEarth/Registry>
+#include <osgEarth/Profiler>
 #include <osgEarth/Capabilities>
 #include <osgEarth/ShaderGenerator>
 #include <osgEarth/ShaderUtils>
@@ -240,6 +241,8 @@ GeometryCompiler::compile(FeatureList&          workingSet,
                           const Style&          style,
                           const FilterContext&  context)
 {
+    OE_PROFILING_ZONE("GeometryCompiler::compile");
+
 #ifdef PROFILING
     osg::Timer_t p_start = osg::Timer::instance()->tick();
     unsigned p_features = workingSet.size();
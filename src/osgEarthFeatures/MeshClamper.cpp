@@ -116,6 +116,15 @@ MeshClamper::apply( osg::Geode& geode )
                 }
             }
 
+            // skip the whole geometry if it's out of scope (unless we still need to
+            // record its z-offsets, which requires visiting every vertex).
+            if ( _scope.valid() && !buildZOffsets )
+            {
+                osg::BoundingSphere gbs( geom->getBound() );
+                if ( ((gbs.center()*local2world) - _scope.center()).length() > gbs.radius() + _scope.radius() )
+                    continue;
+            }
+
             for( unsigned k=0; k<verts->size(); ++k )
             {
                 osg::Vec3d vw = (*verts)[k];
@@ -160,6 +169,10 @@ MeshClamper::apply( osg::Geode& geode )
                 }
 #endif
 
+                // leave out-of-scope vertices where they are.
+                if ( _scope.valid() && (vw - _scope.center()).length2() > _scope.radius2() )
+                    continue;
+
                 lsi->reset();
                 lsi->setStart( vw + n_vector*r*_scale );
                 lsi->setEnd( vw - n_vector*r );
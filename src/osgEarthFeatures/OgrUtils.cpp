@@ -140,6 +140,23 @@ OgrUtils::createGeometry( OGRGeometryH geomHandle )
     return output;
 }
 
+Symbology::GeometryBuffer*
+OgrUtils::createGeometryBuffer( OGRGeometryH geomHandle )
+{
+    if ( !geomHandle )
+        return 0L;
+
+    int size = OGR_G_WkbSize( geomHandle );
+    if ( size <= 0 )
+        return 0L;
+
+    std::vector<unsigned char> wkb( size );
+    if ( OGR_G_ExportToWkb( geomHandle, wkbNDR, &wkb[0] ) != OGRERR_NONE )
+        return 0L;
+
+    return Symbology::GeometryBuffer::createFromWKB( &wkb[0], wkb.size() );
+}
+
 OGRGeometryH
 OgrUtils::encodePart( const Geometry* geometry, OGRwkbGeometryType part_type )
 {
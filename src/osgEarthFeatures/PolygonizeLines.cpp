@@ -23,6 +23,8 @@
 #include <osgEarth/VirtualProgram>
 #include <osgEarth/Utils>
 #include <osgEarth/CullingUtils>
+#include <osgEarth/Registry>
+#include <osgEarth/Capabilities>
 
 #define LC "[PolygonizeLines] "
 
@@ -560,6 +562,168 @@ PolygonizeLinesOperator::installShaders(osg::Node* node) const
     stateset->setDataVariance(osg::Object::DYNAMIC);
 }
 
+//------------------------------------------------------------------------
+
+#define GPU_LINES_SHADER_NAME "osgEarth::GPULines"
+
+GPULinesOperator::GPULinesOperator(const Stroke& stroke) :
+_stroke( stroke )
+{
+    //nop
+}
+
+
+bool
+GPULinesOperator::isSupported()
+{
+    return Registry::capabilities().supportsGLSL();
+}
+
+
+osg::Geometry*
+GPULinesOperator::operator()(osg::Vec3Array* verts, osg::Vec3Array* normals) const
+{
+    // number of verts on the original line.
+    unsigned lineSize = verts->size();
+
+    // cannot generate a line with less than 2 verts.
+    if ( lineSize < 2 )
+        return 0L;
+
+    float width     = Distance(*_stroke.width(), *_stroke.widthUnits()).as(Units::METERS);
+    float halfWidth = 0.5f * width;
+
+    osg::Geometry* geom  = new osg::Geometry();
+    geom->setUseVertexBufferObjects( true );
+    geom->setUseDisplayList( false );
+
+    // Each line vertex becomes a left/right pair. The shader needs the
+    // neighbors to orient the offset; the ends get mirrored neighbors so
+    // they produce butt caps. The side and half-width ride in next.w.
+    osg::Vec3Array* pairVerts   = new osg::Vec3Array( lineSize*2 );
+    osg::Vec3Array* pairNormals = new osg::Vec3Array( lineSize*2 );
+    osg::Vec3Array* prevs       = new osg::Vec3Array( lineSize*2 );
+    osg::Vec4Array* nexts       = new osg::Vec4Array( lineSize*2 );
+    osg::Vec2Array* tverts      = new osg::Vec2Array( lineSize*2 );
+
+    float spineLen = 0.0f;
+    for( unsigned i=0; i<lineSize; ++i )
+    {
+        const osg::Vec3& p = (*verts)[i];
+        osg::Vec3 prev = i > 0 ? (*verts)[i-1] : p*2.0f - (*verts)[i+1];
+        osg::Vec3 next = i < lineSize-1 ? (*verts)[i+1] : p*2.0f - (*verts)[i-1];
+        osg::Vec3 normal = normals && i < normals->size() ? (*normals)[i] : osg::Vec3(0,0,1);
+
+        if ( i > 0 )
+            spineLen += (p - (*verts)[i-1]).length();
+
+        for( unsigned s=0; s<2; ++s )
+        {
+            unsigned k = i*2 + s;
+            (*pairVerts)[k]   = p;
+            (*pairNormals)[k] = normal;
+            (*prevs)[k]       = prev;
+            (*nexts)[k].set( next.x(), next.y(), next.z(), s == 0 ? -halfWidth : halfWidth );
+            (*tverts)[k].set( (float)s, width > 0.0f ? spineLen/width : 0.0f );
+        }
+    }
+
+    geom->setVertexArray( pairVerts );
+
+    geom->setNormalArray( pairNormals );
+    geom->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+
+    geom->setVertexAttribArray    ( osg::Drawable::ATTRIBUTE_6, prevs );
+    geom->setVertexAttribBinding  ( osg::Drawable::ATTRIBUTE_6, osg::Geometry::BIND_PER_VERTEX );
+    geom->setVertexAttribNormalize( osg::Drawable::ATTRIBUTE_6, false );
+
+    geom->setVertexAttribArray    ( osg::Drawable::ATTRIBUTE_7, nexts );
+    geom->setVertexAttribBinding  ( osg::Drawable::ATTRIBUTE_7, osg::Geometry::BIND_PER_VERTEX );
+    geom->setVertexAttribNormalize( osg::Drawable::ATTRIBUTE_7, false );
+
+    geom->setTexCoordArray( 0, tverts );
+
+    geom->addPrimitiveSet( new osg::DrawArrays(GL_TRIANGLE_STRIP, 0, pairVerts->size()) );
+
+    // the stroke color is the same for the whole line.
+    osg::Vec4Array* colors = new osg::Vec4Array( 1 );
+    (*colors)[0] = _stroke.color();
+    geom->setColorArray( colors );
+    geom->setColorBinding( osg::Geometry::BIND_OVERALL );
+
+    return geom;
+}
+
+
+void
+GPULinesOperator::installShaders(osg::Node* node) const
+{
+    if ( !node )
+        return;
+
+    osg::StateSet* stateset = node->getOrCreateStateSet();
+
+    VirtualProgram* vp = VirtualProgram::getOrCreate(stateset);
+
+    // bail if already installed.
+    if ( vp->getName().compare( GPU_LINES_SHADER_NAME ) == 0 )
+        return;
+
+    vp->setName( GPU_LINES_SHADER_NAME );
+
+    const char* vs =
+        "#version " GLSL_VERSION_STR "\n"
+        GLSL_DEFAULT_PRECISION_FLOAT "\n"
+        "attribute vec3 oe_GPULines_prev; \n"
+        "attribute vec4 oe_GPULines_next; \n"
+        "uniform float oe_GPULines_min_pixels; \n"
+        "uniform vec4 oe_PixelSizeVector; \n"
+
+        "void oe_GPULines_expand(inout vec4 vertex_model4) \n"
+        "{ \n"
+        "   const float epsilon = 0.0001; \n"
+
+        "   vec3 p  = vertex_model4.xyz; \n"
+        "   vec3 up = normalize(gl_Normal); \n"
+
+        // directions of the incoming and outgoing segments:
+        "   vec3 d0 = p - oe_GPULines_prev; \n"
+        "   vec3 d1 = oe_GPULines_next.xyz - p; \n"
+        "   d0 = length(d0) > epsilon ? normalize(d0) : d1; \n"
+        "   d1 = length(d1) > epsilon ? normalize(d1) : d0; \n"
+
+        // offset along the miter, limited to 4x the half width at sharp joins:
+        "   vec3 n0 = normalize(cross(d0, up)); \n"
+        "   vec3 n1 = normalize(cross(d1, up)); \n"
+        "   vec3 miter = n0 + n1; \n"
+        "   miter = length(miter) > epsilon ? normalize(miter) : n0; \n"
+        "   float len = 1.0/max(dot(miter, n0), 0.25); \n"
+
+        // enforce the minimum on-screen width:
+        "   float halfWidth = oe_GPULines_next.w; \n"
+        "   float pixels    = abs(2.0*halfWidth/dot(vec4(p,1.0), oe_PixelSizeVector)); \n"
+        "   float activate  = step(epsilon, oe_GPULines_min_pixels); \n"
+        "   float scale     = mix(1.0, max(oe_GPULines_min_pixels/max(pixels,epsilon), 1.0), activate); \n"
+
+        "   vertex_model4.xyz = p + miter*(halfWidth*len*scale); \n"
+        "} \n";
+
+    vp->setFunction( "oe_GPULines_expand", vs, ShaderComp::LOCATION_VERTEX_MODEL, 0.5f );
+    vp->addBindAttribLocation( "oe_GPULines_prev", osg::Drawable::ATTRIBUTE_6 );
+    vp->addBindAttribLocation( "oe_GPULines_next", osg::Drawable::ATTRIBUTE_7 );
+
+    osg::Uniform* minPixelsU = new osg::Uniform(osg::Uniform::FLOAT, "oe_GPULines_min_pixels");
+    minPixelsU->set( _stroke.minPixels().getOrUse( 0.0f ) );
+    stateset->addUniform( minPixelsU, 1 );
+
+    // this will install and update the oe_PixelSizeVector uniform.
+    node->addCullCallback( new PixelSizeVectorCullCallback(stateset) );
+
+    // the ribbons are expanded in both directions around the spine, so
+    // either face may point at the camera.
+    stateset->setMode( GL_CULL_FACE, osg::StateAttribute::OFF );
+}
+
 
 //------------------------------------------------------------------------
 
@@ -0,0 +1,496 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthFeatures/QueryEvaluator>
+#include <osgEarth/StringUtils>
+#include <cctype>
+#include <cstdlib>
+
+#define LC "[QueryEvaluator] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    enum TokenType { TOKEN_IDENT, TOKEN_STRING, TOKEN_NUMBER, TOKEN_OP, TOKEN_LPAREN, TOKEN_RPAREN, TOKEN_END };
+
+    struct Token
+    {
+        Token() : _type(TOKEN_END), _number(0.0) { }
+        TokenType   _type;
+        std::string _text;
+        double      _number;
+    };
+
+    // Splits a WHERE clause into tokens; returns false on anything outside
+    // the small grammar QueryEvaluator understands.
+    bool tokenize( const std::string& in, std::vector<Token>& out )
+    {
+        unsigned i = 0, n = in.length();
+        while( i < n )
+        {
+            char c = in[i];
+            if ( isspace(c) )
+            {
+                ++i;
+                continue;
+            }
+
+            Token t;
+            bool afterOp = !out.empty() && out.back()._type == TOKEN_OP;
+
+            if ( isalpha(c) || c == '_' )
+            {
+                unsigned s = i;
+                while( i < n && (isalnum(in[i]) || in[i] == '_') ) ++i;
+                t._type = TOKEN_IDENT;
+                t._text = in.substr(s, i-s);
+            }
+            else if ( c == '"' )
+            {
+                // quoted identifier
+                unsigned s = ++i;
+                while( i < n && in[i] != '"' ) ++i;
+                if ( i == n ) return false;
+                t._type = TOKEN_IDENT;
+                t._text = in.substr(s, i-s);
+                ++i;
+            }
+            else if ( c == '\'' )
+            {
+                // string literal; '' is an escaped quote
+                t._type = TOKEN_STRING;
+                ++i;
+                for( ;; )
+                {
+                    if ( i == n ) return false;
+                    if ( in[i] == '\'' )
+                    {
+                        if ( i+1 < n && in[i+1] == '\'' ) { t._text += '\''; i += 2; }
+                        else { ++i; break; }
+                    }
+                    else t._text += in[i++];
+                }
+            }
+            else if ( isdigit(c) || c == '.' ||
+                      ((c == '-' || c == '+') && afterOp && i+1 < n && (isdigit(in[i+1]) || in[i+1] == '.')) )
+            {
+                const char* start = in.c_str() + i;
+                char* end = 0L;
+                t._number = strtod( start, &end );
+                if ( end == start ) return false;
+                t._type = TOKEN_NUMBER;
+                i += (unsigned)(end - start);
+            }
+            else if ( c == '=' )
+            {
+                t._type = TOKEN_OP;
+                t._text = "=";
+                i += (i+1 < n && in[i+1] == '=') ? 2 : 1;
+            }
+            else if ( c == '!' || c == '<' || c == '>' )
+            {
+                t._type = TOKEN_OP;
+                t._text = c;
+                ++i;
+                if ( i < n && (in[i] == '=' || (c == '<' && in[i] == '>')) )
+                    t._text += in[i++];
+                if ( t._text == "!" ) return false;
+            }
+            else if ( c == '(' ) { t._type = TOKEN_LPAREN; ++i; }
+            else if ( c == ')' ) { t._type = TOKEN_RPAREN; ++i; }
+            else
+            {
+                return false;
+            }
+
+            out.push_back( t );
+        }
+
+        out.push_back( Token() );
+        return true;
+    }
+
+    bool isKeyword( const Token& t, const char* word )
+    {
+        return t._type == TOKEN_IDENT && ciEquals( t._text, word );
+    }
+}
+
+//------------------------------------------------------------------------
+
+// Recursive-descent parser: or := and (OR and)*, and := unary (AND unary)*,
+// unary := NOT unary | '(' or ')' | comparison.
+struct QueryEvaluator::Parser
+{
+    QueryEvaluator&           _qe;
+    const std::vector<Token>& _tokens;
+    unsigned                  _pos;
+
+    Parser( QueryEvaluator& qe, const std::vector<Token>& tokens ) : _qe(qe), _tokens(tokens), _pos(0) { }
+
+    const Token& peek() const { return _tokens[_pos]; }
+
+    int add( NodeType type )
+    {
+        QueryEvaluator::Node node;
+        node._type     = type;
+        node._op       = OP_EQ;
+        node._number   = 0.0;
+        node._isNumber = false;
+        _qe._nodes.push_back( node );
+        return (int)_qe._nodes.size() - 1;
+    }
+
+    int parse()
+    {
+        int root = parseOr();
+        return root >= 0 && peek()._type == TOKEN_END ? root : -1;
+    }
+
+    int parseOr()
+    {
+        int lhs = parseAnd();
+        if ( lhs < 0 || !isKeyword(peek(), "or") )
+            return lhs;
+
+        int node = add( NODE_OR );
+        _qe._nodes[node]._children.push_back( lhs );
+        while( isKeyword(peek(), "or") )
+        {
+            ++_pos;
+            int rhs = parseAnd();
+            if ( rhs < 0 ) return -1;
+            _qe._nodes[node]._children.push_back( rhs );
+        }
+        return node;
+    }
+
+    int parseAnd()
+    {
+        int lhs = parseUnary();
+        if ( lhs < 0 || !isKeyword(peek(), "and") )
+            return lhs;
+
+        int node = add( NODE_AND );
+        _qe._nodes[node]._children.push_back( lhs );
+        while( isKeyword(peek(), "and") )
+        {
+            ++_pos;
+            int rhs = parseUnary();
+            if ( rhs < 0 ) return -1;
+            _qe._nodes[node]._children.push_back( rhs );
+        }
+        return node;
+    }
+
+    int parseUnary()
+    {
+        if ( isKeyword(peek(), "not") )
+        {
+            ++_pos;
+            int child = parseUnary();
+            if ( child < 0 ) return -1;
+            int node = add( NODE_NOT );
+            _qe._nodes[node]._children.push_back( child );
+            return node;
+        }
+
+        if ( peek()._type == TOKEN_LPAREN )
+        {
+            ++_pos;
+            int node = parseOr();
+            if ( node < 0 || peek()._type != TOKEN_RPAREN ) return -1;
+            ++_pos;
+            return node;
+        }
+
+        return parseComparison();
+    }
+
+    static bool isReserved( const Token& t )
+    {
+        return isKeyword(t, "and") || isKeyword(t, "or") || isKeyword(t, "not") || isKeyword(t, "is") || isKeyword(t, "null");
+    }
+
+    static bool toOp( const std::string& text, bool mirror, Op& op )
+    {
+        if      ( text == "=" )                  op = OP_EQ;
+        else if ( text == "!=" || text == "<>" ) op = OP_NE;
+        else if ( text == "<" )                  op = mirror ? OP_GT : OP_LT;
+        else if ( text == "<=" )                 op = mirror ? OP_GE : OP_LE;
+        else if ( text == ">" )                  op = mirror ? OP_LT : OP_GT;
+        else if ( text == ">=" )                 op = mirror ? OP_LE : OP_GE;
+        else return false;
+        return true;
+    }
+
+    int parseComparison()
+    {
+        const Token& first = peek();
+        if ( first._type == TOKEN_END )
+            return -1;
+
+        // attr IS [NOT] NULL
+        if ( first._type == TOKEN_IDENT && !isReserved(first) && isKeyword(_tokens[_pos+1], "is") )
+        {
+            std::string attr = toLower(first._text);
+            _pos += 2;
+            bool negate = isKeyword(peek(), "not");
+            if ( negate ) ++_pos;
+            if ( !isKeyword(peek(), "null") ) return -1;
+            ++_pos;
+            int node = add( NODE_COMPARE );
+            _qe._nodes[node]._attr = attr;
+            _qe._nodes[node]._op   = negate ? OP_NOT_NULL : OP_NULL;
+            return node;
+        }
+
+        // attr op literal, or literal op attr
+        if ( _tokens[_pos+1]._type != TOKEN_OP || _tokens[_pos+2]._type == TOKEN_END )
+            return -1;
+
+        const Token& op     = _tokens[_pos+1];
+        const Token& second = _tokens[_pos+2];
+
+        bool mirror = first._type != TOKEN_IDENT;
+        const Token& attr    = mirror ? second : first;
+        const Token& literal = mirror ? first  : second;
+
+        if ( attr._type != TOKEN_IDENT || isReserved(attr) )
+            return -1;
+        if ( literal._type != TOKEN_STRING && literal._type != TOKEN_NUMBER )
+            return -1;
+
+        Op theOp;
+        if ( !toOp(op._text, mirror, theOp) )
+            return -1;
+
+        _pos += 3;
+        int node = add( NODE_COMPARE );
+        QueryEvaluator::Node& n = _qe._nodes[node];
+        n._attr     = toLower(attr._text);
+        n._op       = theOp;
+        n._isNumber = literal._type == TOKEN_NUMBER;
+        n._number   = literal._number;
+        n._string   = literal._text;
+        return node;
+    }
+};
+
+//------------------------------------------------------------------------
+
+QueryEvaluator::QueryEvaluator(const Query& query) :
+_bounds( query.bounds() ),
+_root  ( -1 ),
+_simple( true )
+{
+    if ( query.expression().isSet() && !trim(query.expression().get()).empty() )
+    {
+        std::vector<Token> tokens;
+        if ( tokenize(query.expression().get(), tokens) )
+        {
+            Parser parser( *this, tokens );
+            _root = parser.parse();
+        }
+
+        if ( _root < 0 )
+        {
+            _simple = false;
+            _nodes.clear();
+            OE_DEBUG << LC << "Not a simple expression: " << query.expression().get() << std::endl;
+        }
+    }
+}
+
+bool
+QueryEvaluator::compare(const Node& node, const Feature* feature) const
+{
+    const AttributeTable& attrs = feature->getAttrs();
+    AttributeTable::const_iterator a = attrs.find( node._attr );
+
+    if ( a == attrs.end() || !a->second.second.set )
+        return node._op == OP_NULL;
+
+    if ( node._op == OP_NULL )     return false;
+    if ( node._op == OP_NOT_NULL ) return true;
+
+    if ( node._isNumber )
+    {
+        double v = a->second.getDouble();
+        switch( node._op )
+        {
+        case OP_EQ: return v == node._number;
+        case OP_NE: return v != node._number;
+        case OP_LT: return v <  node._number;
+        case OP_LE: return v <= node._number;
+        case OP_GT: return v >  node._number;
+        case OP_GE: return v >= node._number;
+        default:    return false;
+        }
+    }
+    else
+    {
+        int c = a->second.getString().compare( node._string );
+        switch( node._op )
+        {
+        case OP_EQ: return c == 0;
+        case OP_NE: return c != 0;
+        case OP_LT: return c <  0;
+        case OP_LE: return c <= 0;
+        case OP_GT: return c >  0;
+        case OP_GE: return c >= 0;
+        default:    return false;
+        }
+    }
+}
+
+void
+QueryEvaluator::eval(int                                 index,
+                     const std::vector<const Feature*>& features,
+                     const std::vector<bool>&            active,
+                     std::vector<bool>&                  out) const
+{
+    const Node& node = _nodes[index];
+    unsigned n = features.size();
+
+    switch( node._type )
+    {
+    case NODE_COMPARE:
+        {
+            out.assign( n, false );
+            for( unsigned i = 0; i < n; ++i )
+                out[i] = active[i] && compare( node, features[i] );
+        }
+        break;
+
+    case NODE_AND:
+        {
+            // each term only tests what the previous terms kept.
+            out = active;
+            std::vector<bool> temp;
+            for( unsigned c = 0; c < node._children.size(); ++c )
+            {
+                eval( node._children[c], features, out, temp );
+                out.swap( temp );
+            }
+        }
+        break;
+
+    case NODE_OR:
+        {
+            // each term only tests what the previous terms rejected.
+            out.assign( n, false );
+            std::vector<bool> remaining = active, temp;
+            for( unsigned c = 0; c < node._children.size(); ++c )
+            {
+                eval( node._children[c], features, remaining, temp );
+                for( unsigned i = 0; i < n; ++i )
+                {
+                    if ( temp[i] )
+                    {
+                        out[i]       = true;
+                        remaining[i] = false;
+                    }
+                }
+            }
+        }
+        break;
+
+    case NODE_NOT:
+        {
+            std::vector<bool> temp;
+            eval( node._children[0], features, active, temp );
+            out.assign( n, false );
+            for( unsigned i = 0; i < n; ++i )
+                out[i] = active[i] && !temp[i];
+        }
+        break;
+    }
+}
+
+unsigned
+QueryEvaluator::evaluate(const FeatureList& features, std::vector<bool>& out_mask) const
+{
+    std::vector<const Feature*> block;
+    block.reserve( features.size() );
+    for( FeatureList::const_iterator i = features.begin(); i != features.end(); ++i )
+        block.push_back( i->get() );
+
+    // the bounds test seeds the set of features that the expression considers.
+    std::vector<bool> active( block.size(), false );
+    for( unsigned i = 0; i < block.size(); ++i )
+    {
+        const Feature* f = block[i];
+        if ( !f )
+            continue;
+
+        if ( _bounds.isSet() )
+        {
+            const Geometry* geom = f->getGeometry();
+            if ( !geom )
+                continue;
+
+            Bounds b = geom->getBounds();
+            if (!b.isValid() ||
+                b.xMax() < _bounds->xMin() || b.xMin() > _bounds->xMax() ||
+                b.yMax() < _bounds->yMin() || b.yMin() > _bounds->yMax())
+            {
+                continue;
+            }
+        }
+
+        active[i] = true;
+    }
+
+    if ( _root >= 0 )
+        eval( _root, block, active, out_mask );
+    else
+        out_mask.swap( active );
+
+    unsigned count = 0;
+    for( unsigned i = 0; i < out_mask.size(); ++i )
+        if ( out_mask[i] ) ++count;
+
+    return count;
+}
+
+unsigned
+QueryEvaluator::filter(FeatureList& features) const
+{
+    if ( isTrivial() )
+        return features.size();
+
+    std::vector<bool> mask;
+    evaluate( features, mask );
+
+    unsigned i = 0;
+    for( FeatureList::iterator f = features.begin(); f != features.end(); ++i )
+    {
+        if ( mask[i] )
+            ++f;
+        else
+            f = features.erase( f );
+    }
+
+    return features.size();
+}
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthFeatures/ScriptEngine>
+#include <osgEarthFeatures/Feature>
 #include <osgEarth/Notify>
 #include <osgEarth/Registry>
 #include <osgDB/ReadFile>
@@ -66,6 +67,22 @@ ScriptEngineOptions::getConfig() const
 
 //------------------------------------------------------------------------
 
+void
+ScriptEngine::run(const std::string&         code,
+                  const FeatureList&         features,
+                  std::vector<ScriptResult>& out_results,
+                  FilterContext const*       context)
+{
+    out_results.clear();
+    out_results.reserve( features.size() );
+    for( FeatureList::const_iterator f = features.begin(); f != features.end(); ++f )
+    {
+        out_results.push_back( run(code, f->get(), context) );
+    }
+}
+
+//------------------------------------------------------------------------
+
 #undef  LC
 #define LC "[ScriptEngineFactory] "
 #define SCRIPT_ENGINE_OPTIONS_TAG "__osgEarth::Features::ScriptEngineOptions"
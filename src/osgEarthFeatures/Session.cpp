@@ -81,6 +81,15 @@ Session::getResourceCache()
     return _resourceCache.get();
 }
 
+Arena*
+Session::getArena()
+{
+    osg::ref_ptr<Arena>& arena = _arenas.get(); // thread-safe get
+    if ( !arena.valid() )
+        arena = new Arena();
+    return arena.get();
+}
+
 MapFrame
 Session::createMapFrame( Map::ModelParts parts ) const
 {
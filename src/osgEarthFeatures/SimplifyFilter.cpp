@@ -0,0 +1,377 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthFeatures/SimplifyFilter>
+#include <osgEarthFeatures/Session>
+#include <osgEarth/Containers>
+#include <iomanip>
+#include <sstream>
+#include <queue>
+#include <vector>
+#include <cfloat>
+
+#define LC "[SimplifyFilter] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+OSGEARTH_REGISTER_SIMPLE_FEATUREFILTER(simplify, SimplifyFilter );
+
+namespace
+{
+    // Session-wide cache of simplified geometries, so that the same feature
+    // simplified to the same tolerance (for another style, or in another tile
+    // of the same LOD) is only simplified once.
+    struct SimplifyCache : public osg::Referenced
+    {
+        SimplifyCache() : _cache( 1024 ) { }
+        ShardedLRUCache<std::string, osg::ref_ptr<Geometry> > _cache;
+    };
+
+    struct CreateSimplifyCache : public Session::CreateFunctor<SimplifyCache> {
+        SimplifyCache* operator()() const { return new SimplifyCache(); }
+    };
+
+    std::string makeSimplifyKey(int method, double tolerance, const Feature* feature, const Geometry* geom)
+    {
+        const Bounds bounds = geom->getBounds();
+        std::stringstream buf;
+        buf << std::setprecision(12)
+            << method << ':' << tolerance << ':'
+            << feature->getFID() << ':' << geom->getTotalPointCount() << ':'
+            << bounds.xMin() << ',' << bounds.yMin() << ',' << bounds.xMax() << ',' << bounds.yMax();
+        return buf.str();
+    }
+
+    // 2D distance from p to the segment (a,b).
+    double distanceToSegment(const osg::Vec3d& p, const osg::Vec3d& a, const osg::Vec3d& b)
+    {
+        double dx = b.x()-a.x(), dy = b.y()-a.y();
+        double len2 = dx*dx + dy*dy;
+        double t = len2 > 0.0 ? ((p.x()-a.x())*dx + (p.y()-a.y())*dy) / len2 : 0.0;
+        t = osg::clampBetween( t, 0.0, 1.0 );
+        double ex = a.x() + t*dx - p.x(), ey = a.y() + t*dy - p.y();
+        return sqrt( ex*ex + ey*ey );
+    }
+
+    // 2D area of the triangle (a,b,c).
+    double triangleArea(const osg::Vec3d& a, const osg::Vec3d& b, const osg::Vec3d& c)
+    {
+        return 0.5 * fabs( (b.x()-a.x())*(c.y()-a.y()) - (c.x()-a.x())*(b.y()-a.y()) );
+    }
+
+    const osg::Vec3d& pointAt(const Geometry* geom, unsigned i)
+    {
+        return (*geom)[i % geom->size()];
+    }
+
+    // Flags the points to keep so that no dropped point lies farther than
+    // tolerance from the simplified line. A closed ring is walked as a line
+    // that returns to its first point.
+    void douglasPeucker(const Geometry* input, bool closed, double tolerance, std::vector<bool>& keep)
+    {
+        unsigned n = input->size();
+        unsigned last = closed ? n : n-1;
+        keep.assign( n, false );
+        keep[0] = true;
+        keep[last % n] = true;
+
+        std::vector< std::pair<unsigned,unsigned> > stack;
+        stack.push_back( std::make_pair(0u, last) );
+        while( !stack.empty() )
+        {
+            unsigned a = stack.back().first, b = stack.back().second;
+            stack.pop_back();
+
+            double   maxDist = -1.0;
+            unsigned maxIndex = a;
+            for(unsigned i=a+1; i<b; ++i)
+            {
+                double d = distanceToSegment( (*input)[i], pointAt(input, a), pointAt(input, b) );
+                if ( d > maxDist )
+                {
+                    maxDist  = d;
+                    maxIndex = i;
+                }
+            }
+
+            if ( maxIndex != a && maxDist > tolerance )
+            {
+                keep[maxIndex] = true;
+                stack.push_back( std::make_pair(a, maxIndex) );
+                stack.push_back( std::make_pair(maxIndex, b) );
+            }
+        }
+    }
+
+    // Flags the points to keep by repeatedly dropping the point with the
+    // smallest effective area (the triangle it forms with its neighbors)
+    // until every remaining point's area reaches minArea. The end points of
+    // an open line are never dropped.
+    void visvalingam(const Geometry* input, bool closed, double minArea, unsigned minPoints, std::vector<bool>& keep)
+    {
+        unsigned n = input->size();
+        keep.assign( n, true );
+
+        std::vector<unsigned> prev( n ), next( n );
+        std::vector<double>   area( n, DBL_MAX );
+        for(unsigned i=0; i<n; ++i)
+        {
+            prev[i] = (i+n-1) % n;
+            next[i] = (i+1) % n;
+        }
+
+        typedef std::pair<double,unsigned> Candidate;
+        std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > heap;
+        for(unsigned i=0; i<n; ++i)
+        {
+            if ( closed || (i > 0 && i < n-1) )
+            {
+                area[i] = triangleArea( (*input)[prev[i]], (*input)[i], (*input)[next[i]] );
+                heap.push( Candidate(area[i], i) );
+            }
+        }
+
+        unsigned remaining = n;
+        while( !heap.empty() && remaining > minPoints )
+        {
+            Candidate c = heap.top();
+            heap.pop();
+
+            unsigned i = c.second;
+            if ( !keep[i] || c.first != area[i] )
+                continue; // stale entry
+
+            if ( c.first >= minArea )
+                break;
+
+            keep[i] = false;
+            --remaining;
+
+            unsigned p = prev[i], q = next[i];
+            next[p] = q;
+            prev[q] = p;
+
+            unsigned neighbors[2] = { p, q };
+            for(unsigned k=0; k<2; ++k)
+            {
+                unsigned j = neighbors[k];
+                if ( closed || (j > 0 && j < n-1) )
+                {
+                    // never let a neighbor's area drop below the one just removed,
+                    // so points are removed in order of significance.
+                    area[j] = std::max( triangleArea((*input)[prev[j]], (*input)[j], (*input)[next[j]]), c.first );
+                    heap.push( Candidate(area[j], j) );
+                }
+            }
+        }
+    }
+
+    void simplifyPoints(const Geometry* input, bool closed, SimplifyFilter::Method method, double tolerance, Geometry* output)
+    {
+        unsigned minPoints = closed ? 3 : 2;
+        if ( input->size() <= minPoints )
+        {
+            output->insert( output->end(), input->begin(), input->end() );
+            return;
+        }
+
+        std::vector<bool> keep;
+        if ( method == SimplifyFilter::METHOD_VISVALINGAM )
+            visvalingam( input, closed, tolerance*tolerance, minPoints, keep );
+        else
+            douglasPeucker( input, closed, tolerance, keep );
+
+        for(unsigned i=0; i<input->size(); ++i)
+        {
+            if ( keep[i] )
+                output->push_back( (*input)[i] );
+        }
+    }
+
+    // Returns a simplified copy of the geometry, or NULL if nothing is left of it.
+    Geometry* simplifyGeometry(const Geometry* input, SimplifyFilter::Method method, double tolerance)
+    {
+        switch( input->getType() )
+        {
+        case Geometry::TYPE_MULTI:
+            {
+                const MultiGeometry* multi = static_cast<const MultiGeometry*>( input );
+                osg::ref_ptr<MultiGeometry> output = new MultiGeometry();
+                for( GeometryCollection::const_iterator i = multi->getComponents().begin(); i != multi->getComponents().end(); ++i )
+                {
+                    Geometry* part = simplifyGeometry( i->get(), method, tolerance );
+                    if ( part )
+                        output->getComponents().push_back( part );
+                }
+                return output->getComponents().empty() ? 0L : output.release();
+            }
+
+        case Geometry::TYPE_POLYGON:
+            {
+                const Polygon* poly = static_cast<const Polygon*>( input );
+                osg::ref_ptr<Polygon> output = new Polygon();
+                simplifyPoints( poly, true, method, tolerance, output.get() );
+                if ( output->size() < 3 )
+                {
+                    output->clear();
+                    output->insert( output->end(), poly->begin(), poly->end() );
+                }
+
+                for( RingCollection::const_iterator i = poly->getHoles().begin(); i != poly->getHoles().end(); ++i )
+                {
+                    osg::ref_ptr<Ring> hole = new Ring();
+                    simplifyPoints( i->get(), true, method, tolerance, hole.get() );
+                    if ( hole->size() >= 3 )
+                        output->getHoles().push_back( hole.get() );
+                }
+                return output.release();
+            }
+
+        case Geometry::TYPE_RING:
+            {
+                osg::ref_ptr<Ring> output = new Ring();
+                simplifyPoints( input, true, method, tolerance, output.get() );
+                if ( output->size() < 3 )
+                {
+                    output->clear();
+                    output->insert( output->end(), input->begin(), input->end() );
+                }
+                return output.release();
+            }
+
+        case Geometry::TYPE_LINESTRING:
+            {
+                osg::ref_ptr<LineString> output = new LineString();
+                simplifyPoints( input, false, method, tolerance, output.get() );
+                return output.release();
+            }
+
+        default:
+            return input->clone();
+        }
+    }
+}
+
+bool
+SimplifyFilter::isSupported()
+{
+    return true;
+}
+
+SimplifyFilter::SimplifyFilter() :
+_tolerance( 0.0 ),
+_method   ( METHOD_DOUGLAS_PEUCKER )
+{
+    //NOP
+}
+
+SimplifyFilter::SimplifyFilter( double tolerance, Method method ) :
+_tolerance( 0.0 ),
+_method   ( METHOD_DOUGLAS_PEUCKER )
+{
+    _tolerance = tolerance;
+    _method    = method;
+}
+
+SimplifyFilter::SimplifyFilter( const Config& conf ) :
+_tolerance( 0.0 ),
+_method   ( METHOD_DOUGLAS_PEUCKER )
+{
+    if (conf.key() == "simplify")
+    {
+        conf.getIfSet( "tolerance", _tolerance );
+        conf.getIfSet( "method", "douglas_peucker", _method, METHOD_DOUGLAS_PEUCKER );
+        conf.getIfSet( "method", "visvalingam",     _method, METHOD_VISVALINGAM );
+        conf.getIfSet( "method", "none",            _method, METHOD_NONE );
+    }
+}
+
+Config SimplifyFilter::getConfig() const
+{
+    Config config( "simplify" );
+    config.addIfSet( "tolerance", _tolerance );
+    config.addIfSet( "method", "douglas_peucker", _method, METHOD_DOUGLAS_PEUCKER );
+    config.addIfSet( "method", "visvalingam",     _method, METHOD_VISVALINGAM );
+    config.addIfSet( "method", "none",            _method, METHOD_NONE );
+    return config;
+}
+
+FilterContext
+SimplifyFilter::push( FeatureList& input, FilterContext& context )
+{
+    double tolerance = _tolerance.get();
+    Method method    = _method.get();
+    if ( method == METHOD_NONE || !(tolerance > 0.0) )
+        return context;
+
+    osg::ref_ptr<SimplifyCache> cache;
+    if ( context.getSession() )
+        context.getSession()->getOrCreateObject( "SimplifyFilter::Cache", cache, CreateSimplifyCache() );
+
+    unsigned pointsBefore = 0, pointsAfter = 0;
+
+    for( FeatureList::iterator i = input.begin(); i != input.end(); ++i )
+    {
+        Feature* feature = i->get();
+        Geometry* geom = feature->getGeometry();
+        if ( !geom || !geom->isValid() || geom->getComponentType() == Geometry::TYPE_POINTSET )
+            continue;
+
+        pointsBefore += geom->getTotalPointCount();
+
+        // downstream filters modify geometry in place, so features always
+        // get a copy of what's in the cache.
+        std::string key;
+        if ( cache.valid() )
+        {
+            key = makeSimplifyKey( (int)method, tolerance, feature, geom );
+            ShardedLRUCache<std::string, osg::ref_ptr<Geometry> >::Record rec;
+            if ( cache->_cache.get(key, rec) )
+            {
+                feature->setGeometry( rec.value()->clone() );
+                pointsAfter += rec.value()->getTotalPointCount();
+                continue;
+            }
+        }
+
+        osg::ref_ptr<Geometry> simplified = simplifyGeometry( geom, method, tolerance );
+        if ( !simplified.valid() || !simplified->isValid() )
+        {
+            pointsAfter += geom->getTotalPointCount();
+            continue;
+        }
+
+        pointsAfter += simplified->getTotalPointCount();
+
+        if ( cache.valid() )
+        {
+            cache->_cache.insert( key, simplified.get() );
+            feature->setGeometry( simplified->clone() );
+        }
+        else
+        {
+            feature->setGeometry( simplified.get() );
+        }
+    }
+
+    OE_DEBUG << LC << "Simplified " << pointsBefore << " points to " << pointsAfter << std::endl;
+
+    return context;
+}
@@ -207,7 +207,18 @@ SubstituteModelFilter::process(const FeatureList&           features,
         {
             // Always clone the cached instance so we're not processing data that's
             // already in the scene graph. -gw
-            context.resourceCache()->cloneOrCreateInstanceNode(instance.get(), model);
+            // For DrawInstanced, only the primitive sets change per tile; so share
+            // the vertex data (and its VBOs) across all tiles using this model.
+            osg::CopyOp copyop = _useDrawInstanced ?
+                osg::CopyOp(
+                    osg::CopyOp::DEEP_COPY_NODES      |
+                    osg::CopyOp::DEEP_COPY_DRAWABLES  |
+                    osg::CopyOp::DEEP_COPY_PRIMITIVES |
+                    osg::CopyOp::DEEP_COPY_STATESETS  |
+                    osg::CopyOp::DEEP_COPY_USERDATA ) :
+                osg::CopyOp(osg::CopyOp::DEEP_COPY_ALL);
+
+            context.resourceCache()->cloneOrCreateInstanceNode(instance.get(), model, copyop);
 
             // if icon decluttering is off, install an AutoTransform.
             if ( iconSymbol )
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthFeatures/TransformFilter>
+#include <osgEarth/ECEF>
 #include <osg/ClusterCullingCallback>
 
 #define LC "[TransformFilter] "
@@ -37,11 +38,7 @@ namespace
             GeometryIterator iter( input->getGeometry() );
             while( iter.hasMore() )
             {
-                Geometry* geom = iter.next();
-                for( unsigned int i=0; i<geom->size(); i++ )
-                {
-                    (*geom)[i] = (*geom)[i] * refFrame;
-                }
+                ECEF::transformPoints( refFrame, iter.next()->asVector() );
             }
         }
     }
@@ -94,8 +91,7 @@ TransformFilter::push( Feature* input, FilterContext& context )
         // pre-transform the point before doing an SRS transformation.
         if ( needsMatrixXform )
         {
-            for( unsigned i=0; i < geom->size(); ++i )
-                (*geom)[i] = (*geom)[i] * _mat;
+            ECEF::transformPoints( _mat, geom->asVector() );
         }
 
         // first transform the geometry to the output SRS:            
@@ -115,47 +115,47 @@ namespace osgEarth { namespace QtGui
 
     void onImageLayerAdded(ImageLayer* layer, unsigned int index)
     {
-      _manager->addImageLayerItem(layer, index);
+      _manager->queueChange(LayerManagerWidget::PendingChange::ADD, layer, -1, index);
     }
 
     void onImageLayerRemoved(ImageLayer* layer, unsigned int index)
     {
-      _manager->removeLayerItem(layer);
+      _manager->queueChange(LayerManagerWidget::PendingChange::REMOVE, layer, index, -1);
     }
 
     void onImageLayerMoved(ImageLayer* layer, unsigned int oldIndex, unsigned int newIndex)
     {
-      _manager->moveLayerItem(layer, oldIndex, newIndex);
+      _manager->queueChange(LayerManagerWidget::PendingChange::MOVE, layer, oldIndex, newIndex);
     }
 
     void onElevationLayerAdded(ElevationLayer* layer, unsigned int index)
     {
-      _manager->addElevationLayerItem(layer, index);
+      _manager->queueChange(LayerManagerWidget::PendingChange::ADD, layer, -1, index);
     }
 
     void onElevationLayerRemoved(ElevationLayer* layer, unsigned int index)
     {
-      _manager->removeLayerItem(layer);
+      _manager->queueChange(LayerManagerWidget::PendingChange::REMOVE, layer, index, -1);
     }
 
     void onElevationLayerMoved(ElevationLayer* layer, unsigned int oldIndex, unsigned int newIndex)
     {
-      _manager->moveLayerItem(layer, oldIndex, newIndex);
+      _manager->queueChange(LayerManagerWidget::PendingChange::MOVE, layer, oldIndex, newIndex);
     }
 
     void onModelLayerAdded(ModelLayer* layer, unsigned int index)
     {
-      _manager->addModelLayerItem(layer, index);
+      _manager->queueChange(LayerManagerWidget::PendingChange::ADD, layer, -1, index);
     }
 
     void onModelLayerRemoved(ModelLayer* layer)
     {
-      _manager->removeLayerItem(layer);
+      _manager->queueChange(LayerManagerWidget::PendingChange::REMOVE, layer, -1, -1);
     }
 
     void onModelLayerMoved(ModelLayer* layer, unsigned int oldIndex, unsigned int newIndex)
     {
-      _manager->moveLayerItem(layer, oldIndex, newIndex);
+      _manager->queueChange(LayerManagerWidget::PendingChange::MOVE, layer, oldIndex, newIndex);
     }
 
     //void onMaskLayerAdded( MaskLayer* mask ) { }
@@ -735,6 +735,66 @@ void LayerManagerWidget::onItemDoubleClicked()
     _manager->doAction(this, action);
 }
 
+void LayerManagerWidget::queueChange(PendingChange::Type type, osgEarth::Layer* layer, int oldIndex, int newIndex)
+{
+  PendingChange change;
+  change.type = type;
+  change.layer = layer;
+  change.oldIndex = oldIndex;
+  change.newIndex = newIndex;
+
+  bool first;
+  {
+    Threading::ScopedMutexLock lock(_pendingMutex);
+    first = _pendingChanges.empty();
+    _pendingChanges.push_back(change);
+  }
+
+  // one queued call drains everything that arrives before it runs
+  if (first)
+    QMetaObject::invokeMethod(this, "applyPendingChanges", Qt::QueuedConnection);
+}
+
+void LayerManagerWidget::applyPendingChanges()
+{
+  std::vector<PendingChange> changes;
+  {
+    Threading::ScopedMutexLock lock(_pendingMutex);
+    changes.swap(_pendingChanges);
+  }
+
+  if (changes.empty())
+    return;
+
+  // lay out and repaint once for the whole batch
+  setUpdatesEnabled(false);
+
+  for (std::vector<PendingChange>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+  {
+    osgEarth::Layer* layer = it->layer.get();
+
+    if (it->type == PendingChange::ADD)
+    {
+      if (dynamic_cast<osgEarth::ImageLayer*>(layer))
+        addImageLayerItem(static_cast<osgEarth::ImageLayer*>(layer), it->newIndex);
+      else if (dynamic_cast<osgEarth::ElevationLayer*>(layer))
+        addElevationLayerItem(static_cast<osgEarth::ElevationLayer*>(layer), it->newIndex);
+      else if (dynamic_cast<osgEarth::ModelLayer*>(layer))
+        addModelLayerItem(static_cast<osgEarth::ModelLayer*>(layer), it->newIndex);
+    }
+    else if (it->type == PendingChange::REMOVE)
+    {
+      removeLayerItem(layer);
+    }
+    else if (it->type == PendingChange::MOVE)
+    {
+      moveLayerItem(layer, it->oldIndex, it->newIndex);
+    }
+  }
+
+  setUpdatesEnabled(true);
+}
+
 void LayerManagerWidget::refresh()
 {
   //TODO: Clear all items in _stack?
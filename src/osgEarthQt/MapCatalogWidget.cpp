@@ -239,7 +239,7 @@ namespace osgEarth { namespace QtGui
       {
         Action* foundAction = dynamic_cast<ToggleNodeAction*>(action);
         if (foundAction)
-          _catalog->refreshAll();
+          _catalog->scheduleRefresh();
       }
     }
 
@@ -297,6 +297,7 @@ void MapCatalogWidget::initUi()
 {
   _hideEmptyGroups = false;
   _updating = false;
+  _refreshPending = false;
 
   _tree = new QTreeWidget();
   _tree->setColumnCount(1);
@@ -325,6 +326,23 @@ void MapCatalogWidget::initUi()
 
 void MapCatalogWidget::onMapChanged()
 {
+  scheduleRefresh();
+}
+
+void MapCatalogWidget::scheduleRefresh()
+{
+  // A burst of map changes (say, loading an earth file) would otherwise
+  // rebuild the tree once per change; coalesce them into one rebuild.
+  if (_refreshPending)
+    return;
+
+  _refreshPending = true;
+  QMetaObject::invokeMethod(this, "onDeferredRefresh", Qt::QueuedConnection);
+}
+
+void MapCatalogWidget::onDeferredRefresh()
+{
+  _refreshPending = false;
   refreshAll();
 }
 
@@ -388,6 +406,7 @@ void MapCatalogWidget::refreshAll()
     return;
 
   _updating = true;
+  _tree->setUpdatesEnabled(false);
 
   refreshElevationLayers();
   refreshImageLayers();
@@ -396,6 +415,7 @@ void MapCatalogWidget::refreshAll()
   refreshAnnotations();
   refreshViewpoints();
 
+  _tree->setUpdatesEnabled(true);
   _updating = false;
 }
 
@@ -0,0 +1,423 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthQt/OffscreenViewerWidget>
+
+#include <osgEarth/Notify>
+#include <osgEarthUtil/EarthManipulator>
+
+#include <osg/Timer>
+#include <osgGA/StateSetManipulator>
+#include <osgViewer/ViewerEventHandlers>
+#include <OpenThreads/Thread>
+
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QResizeEvent>
+#include <QWheelEvent>
+
+#define LC "[OffscreenViewerWidget] "
+
+using namespace osgEarth;
+using namespace osgEarth::QtGui;
+
+//---------------------------------------------------------------------------
+
+namespace
+{
+    int mapButton( Qt::MouseButton button )
+    {
+        switch( button )
+        {
+        case Qt::LeftButton:  return 1;
+        case Qt::MidButton:   return 2;
+        case Qt::RightButton: return 3;
+        default:              return 0;
+        }
+    }
+
+    int mapKey( QKeyEvent* e )
+    {
+        switch( e->key() )
+        {
+        case Qt::Key_Escape:    return osgGA::GUIEventAdapter::KEY_Escape;
+        case Qt::Key_Tab:       return osgGA::GUIEventAdapter::KEY_Tab;
+        case Qt::Key_Backspace: return osgGA::GUIEventAdapter::KEY_BackSpace;
+        case Qt::Key_Return:    return osgGA::GUIEventAdapter::KEY_Return;
+        case Qt::Key_Enter:     return osgGA::GUIEventAdapter::KEY_KP_Enter;
+        case Qt::Key_Insert:    return osgGA::GUIEventAdapter::KEY_Insert;
+        case Qt::Key_Delete:    return osgGA::GUIEventAdapter::KEY_Delete;
+        case Qt::Key_Home:      return osgGA::GUIEventAdapter::KEY_Home;
+        case Qt::Key_End:       return osgGA::GUIEventAdapter::KEY_End;
+        case Qt::Key_Left:      return osgGA::GUIEventAdapter::KEY_Left;
+        case Qt::Key_Up:        return osgGA::GUIEventAdapter::KEY_Up;
+        case Qt::Key_Right:     return osgGA::GUIEventAdapter::KEY_Right;
+        case Qt::Key_Down:      return osgGA::GUIEventAdapter::KEY_Down;
+        case Qt::Key_PageUp:    return osgGA::GUIEventAdapter::KEY_Page_Up;
+        case Qt::Key_PageDown:  return osgGA::GUIEventAdapter::KEY_Page_Down;
+        case Qt::Key_Shift:     return osgGA::GUIEventAdapter::KEY_Shift_L;
+        case Qt::Key_Control:   return osgGA::GUIEventAdapter::KEY_Control_L;
+        case Qt::Key_Alt:       return osgGA::GUIEventAdapter::KEY_Alt_L;
+        default:
+            if ( e->key() >= Qt::Key_F1 && e->key() <= Qt::Key_F12 )
+                return osgGA::GUIEventAdapter::KEY_F1 + (e->key() - Qt::Key_F1);
+            if ( !e->text().isEmpty() )
+                return (int)e->text().at(0).toLatin1();
+            return e->key();
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+
+/**
+ * Owns the offscreen context and runs the viewer's frames.
+ */
+class OffscreenViewerWidget::RenderThread : public OpenThreads::Thread
+{
+public:
+    RenderThread( OffscreenViewerWidget* widget, int width, int height ) :
+      _widget ( widget ),
+      _done   ( false ),
+      _width  ( width ),
+      _height ( height ),
+      _resized( true )
+    {
+        //nop
+    }
+
+    /** Called on the GUI thread; the render thread applies it before its next frame. */
+    void resize( int width, int height )
+    {
+        Threading::ScopedMutexLock lock( _sizeMutex );
+        _width   = width;
+        _height  = height;
+        _resized = true;
+    }
+
+    /** Asks the thread to exit after the current frame. */
+    void finish()
+    {
+        _done = true;
+    }
+
+    void run()
+    {
+        osgViewer::Viewer* viewer = _widget->_viewer.get();
+        osg::Camera* camera = viewer->getCamera();
+
+        // The pbuffer only provides a context; the camera draws to an FBO
+        // sized to the widget, so the pbuffer itself can stay tiny.
+        osg::ref_ptr<osg::GraphicsContext::Traits> traits = new osg::GraphicsContext::Traits( osg::DisplaySettings::instance().get() );
+        traits->readDISPLAY();
+        if (traits->displayNum<0) traits->displayNum = 0;
+        traits->x = 0;
+        traits->y = 0;
+        traits->width = 16;
+        traits->height = 16;
+        traits->windowDecoration = false;
+        traits->doubleBuffer = false;
+        traits->pbuffer = true;
+
+        osg::ref_ptr<osg::GraphicsContext> gc = osg::GraphicsContext::createGraphicsContext( traits.get() );
+        if ( !gc.valid() )
+        {
+            OE_WARN << LC << "Failed to create an offscreen graphics context; nothing will render" << std::endl;
+            return;
+        }
+
+        camera->setGraphicsContext( gc.get() );
+        camera->setRenderTargetImplementation( osg::Camera::FRAME_BUFFER_OBJECT );
+
+        _image = new osg::Image();
+
+        viewer->realize();
+
+        while( !_done && !viewer->done() )
+        {
+            osg::Timer_t start = osg::Timer::instance()->tick();
+
+            applyResize( camera );
+
+            if (viewer->getRunFrameScheme() == osgViewer::ViewerBase::CONTINUOUS || 
+                viewer->checkNeedToDoFrame() )
+            {
+                viewer->frame();
+                _widget->publishFrame( _image.get() );
+            }
+
+            double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+            int wait = _widget->_frameInterval - (int)ms;
+            if ( wait > 0 )
+                OpenThreads::Thread::microSleep( wait * 1000 );
+        }
+
+        // release the GL objects while their context is still around.
+        gc->close();
+        camera->setGraphicsContext( 0L );
+    }
+
+private:
+    void applyResize( osg::Camera* camera )
+    {
+        int width, height;
+        {
+            Threading::ScopedMutexLock lock( _sizeMutex );
+            if ( !_resized )
+                return;
+            width    = _width;
+            height   = _height;
+            _resized = false;
+        }
+
+        // GL_BGRA matches QImage::Format_RGB32 on little-endian hosts.
+        _image->allocateImage( width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE );
+        camera->detach( osg::Camera::COLOR_BUFFER );
+        camera->attach( osg::Camera::COLOR_BUFFER, _image.get() );
+        camera->setViewport( 0, 0, width, height );
+
+        double fovy, aspect, zNear, zFar;
+        if ( camera->getProjectionMatrixAsPerspective(fovy, aspect, zNear, zFar) )
+        {
+            camera->setProjectionMatrixAsPerspective( fovy, double(width)/double(height), zNear, zFar );
+        }
+
+        // forces the FBO to be rebuilt at the new size
+        camera->setRenderingCache( 0L );
+    }
+
+    OffscreenViewerWidget*   _widget;
+    volatile bool            _done;
+    osg::ref_ptr<osg::Image> _image;
+
+    Threading::Mutex         _sizeMutex;
+    int                      _width;
+    int                      _height;
+    bool                     _resized;
+};
+
+//---------------------------------------------------------------------------
+
+OffscreenViewerWidget::OffscreenViewerWidget(osg::Node* scene, QWidget* parent) :
+QWidget( parent ),
+_thread( 0L )
+{
+    // creates a simple basic viewer.
+    _ownedViewer = new osgViewer::Viewer();
+    _viewer = _ownedViewer.get();
+    _viewer->setCameraManipulator(new osgEarth::Util::EarthManipulator());
+    _viewer->addEventHandler(new osgViewer::StatsHandler());
+    _viewer->addEventHandler(new osgGA::StateSetManipulator());
+
+    // attach the scene graph provided by the user
+    if ( scene )
+    {
+        _viewer->setSceneData( scene );
+    }
+
+    init();
+}
+
+OffscreenViewerWidget::OffscreenViewerWidget(osgViewer::Viewer* viewer, QWidget* parent) :
+QWidget( parent ),
+_viewer( viewer ),
+_thread( 0L )
+{
+    if ( !_viewer.valid() )
+    {
+        // create a viewer if the user passed in NULL
+        _ownedViewer = new osgViewer::Viewer();
+        _ownedViewer->setCameraManipulator(new osgEarth::Util::EarthManipulator());
+        _viewer = _ownedViewer.get();
+    }
+
+    init();
+}
+
+OffscreenViewerWidget::~OffscreenViewerWidget()
+{
+    stopRendering();
+
+    OE_DEBUG << "OffscreenViewerWidget::DTOR" << std::endl;
+}
+
+void
+OffscreenViewerWidget::init()
+{
+    _frameInterval = 16;
+
+    setAttribute( Qt::WA_OpaquePaintEvent );
+    setFocusPolicy( Qt::StrongFocus );
+
+    // the render thread runs frames itself; no viewer threads.
+    _viewer->setThreadingModel(osgViewer::Viewer::SingleThreaded);
+    _viewer->setKeyEventSetsDone(0);
+    _viewer->setQuitEventSetsDone(false);
+
+    int w = osg::maximum( width(), 1 );
+    int h = osg::maximum( height(), 1 );
+
+    // events arrive in Qt's window coordinates.
+    osgGA::EventQueue* events = _viewer->getEventQueue();
+    events->getCurrentEventState()->setMouseYOrientation( osgGA::GUIEventAdapter::Y_INCREASING_DOWNWARDS );
+    events->windowResize( 0, 0, w, h );
+
+    osg::Camera* camera = _viewer->getCamera();
+    camera->setViewport( new osg::Viewport(0, 0, w, h) );
+    camera->setProjectionMatrixAsPerspective( 30.0f, double(w)/double(h), 1.0f, 10000.0f );
+
+    _thread = new RenderThread( this, w, h );
+    _thread->start();
+}
+
+void
+OffscreenViewerWidget::setFrameInterval(int milliseconds)
+{
+    _frameInterval = osg::maximum( milliseconds, 0 );
+}
+
+void
+OffscreenViewerWidget::stopRendering()
+{
+    if ( _thread )
+    {
+        _thread->finish();
+        _thread->join();
+        delete _thread;
+        _thread = 0L;
+    }
+}
+
+void
+OffscreenViewerWidget::publishFrame(const osg::Image* image)
+{
+    if ( !image || !image->data() )
+        return;
+
+    // GL rows run bottom to top; mirroring also gives the frame its own
+    // copy of the pixels, since the image is overwritten by the next frame.
+    QImage frame = QImage(
+        image->data(), image->s(), image->t(), image->getRowSizeInBytes(),
+        QImage::Format_RGB32 ).mirrored();
+
+    {
+        Threading::ScopedMutexLock lock( _frameMutex );
+        _frame = frame;
+    }
+
+    // Qt folds any update requests still pending into a single repaint.
+    QMetaObject::invokeMethod( this, "update", Qt::QueuedConnection );
+}
+
+void
+OffscreenViewerWidget::paintEvent(QPaintEvent* e)
+{
+    QImage frame;
+    {
+        Threading::ScopedMutexLock lock( _frameMutex );
+        frame = _frame;
+    }
+
+    QPainter painter( this );
+    if ( frame.isNull() )
+        painter.fillRect( rect(), Qt::black );
+    else
+        painter.drawImage( rect(), frame );
+}
+
+void
+OffscreenViewerWidget::resizeEvent(QResizeEvent* e)
+{
+    int w = osg::maximum( e->size().width(), 1 );
+    int h = osg::maximum( e->size().height(), 1 );
+
+    _viewer->getEventQueue()->windowResize( 0, 0, w, h );
+
+    if ( _thread )
+        _thread->resize( w, h );
+}
+
+void
+OffscreenViewerWidget::setModKeys(Qt::KeyboardModifiers modifiers)
+{
+    int mask = 0;
+    if ( modifiers & Qt::ShiftModifier )   mask |= osgGA::GUIEventAdapter::MODKEY_SHIFT;
+    if ( modifiers & Qt::ControlModifier ) mask |= osgGA::GUIEventAdapter::MODKEY_CTRL;
+    if ( modifiers & Qt::AltModifier )     mask |= osgGA::GUIEventAdapter::MODKEY_ALT;
+    if ( modifiers & Qt::MetaModifier )    mask |= osgGA::GUIEventAdapter::MODKEY_META;
+    _viewer->getEventQueue()->getCurrentEventState()->setModKeyMask( mask );
+}
+
+void
+OffscreenViewerWidget::mousePressEvent(QMouseEvent* e)
+{
+    setModKeys( e->modifiers() );
+    _viewer->getEventQueue()->mouseButtonPress( e->x(), e->y(), mapButton(e->button()) );
+}
+
+void
+OffscreenViewerWidget::mouseReleaseEvent(QMouseEvent* e)
+{
+    setModKeys( e->modifiers() );
+    _viewer->getEventQueue()->mouseButtonRelease( e->x(), e->y(), mapButton(e->button()) );
+}
+
+void
+OffscreenViewerWidget::mouseDoubleClickEvent(QMouseEvent* e)
+{
+    setModKeys( e->modifiers() );
+    _viewer->getEventQueue()->mouseDoubleButtonPress( e->x(), e->y(), mapButton(e->button()) );
+}
+
+void
+OffscreenViewerWidget::mouseMoveEvent(QMouseEvent* e)
+{
+    setModKeys( e->modifiers() );
+    _viewer->getEventQueue()->mouseMotion( e->x(), e->y() );
+}
+
+void
+OffscreenViewerWidget::wheelEvent(QWheelEvent* e)
+{
+    setModKeys( e->modifiers() );
+    _viewer->getEventQueue()->mouseScroll(
+        e->orientation() == Qt::Vertical ?
+            (e->delta() > 0 ? osgGA::GUIEventAdapter::SCROLL_UP : osgGA::GUIEventAdapter::SCROLL_DOWN) :
+            (e->delta() > 0 ? osgGA::GUIEventAdapter::SCROLL_LEFT : osgGA::GUIEventAdapter::SCROLL_RIGHT) );
+}
+
+void
+OffscreenViewerWidget::keyPressEvent(QKeyEvent* e)
+{
+    setModKeys( e->modifiers() );
+    _viewer->getEventQueue()->keyPress( mapKey(e) );
+}
+
+void
+OffscreenViewerWidget::keyReleaseEvent(QKeyEvent* e)
+{
+    if ( e->isAutoRepeat() )
+    {
+        e->ignore();
+        return;
+    }
+
+    setModKeys( e->modifiers() );
+    _viewer->getEventQueue()->keyRelease( mapKey(e) );
+}
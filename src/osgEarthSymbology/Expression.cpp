@@ -25,33 +25,42 @@ using namespace osgEarth::Symbology;
 
 #define LC "[Expression] "
 
+// evaluation stack depth that needs no heap allocation
+#define MAX_LOCAL_STACK_DEPTH 32
+
 NumericExpression::NumericExpression( const std::string& expr ) : 
-_src  ( expr ),
-_value( 0.0 ),
-_dirty( true )
+_src     ( expr ),
+_value   ( 0.0 ),
+_dirty   ( true ),
+_maxDepth( 0 )
 {
     init();
 }
 
 NumericExpression::NumericExpression( const NumericExpression& rhs ) :
-_src  ( rhs._src ),
-_rpn  ( rhs._rpn ),
-_vars ( rhs._vars ),
-_value( rhs._value ),
-_dirty( rhs._dirty )
+_src     ( rhs._src ),
+_rpn     ( rhs._rpn ),
+_vars    ( rhs._vars ),
+_value   ( rhs._value ),
+_dirty   ( rhs._dirty ),
+_maxDepth( rhs._maxDepth )
 {
     //nop
 }
 
 NumericExpression::NumericExpression( double staticValue ) :
-_value( staticValue ),
-_dirty( false )
+_value   ( staticValue ),
+_dirty   ( false ),
+_maxDepth( 0 )
 {
     _src = Stringify() << staticValue;
     init();
 }
 
-NumericExpression::NumericExpression( const Config& conf )
+NumericExpression::NumericExpression( const Config& conf ) :
+_value   ( 0.0 ),
+_dirty   ( true ),
+_maxDepth( 0 )
 {
     mergeConfig( conf );
     init();
@@ -252,6 +261,23 @@ NumericExpression::init()
         _rpn.push_back( s.top() );
         s.pop();
     }
+
+    // record the deepest the evaluation stack can get, so that
+    // eval() can run on a preallocated stack:
+    unsigned depth = 0;
+    _maxDepth = 0;
+    for( unsigned i=0; i<_rpn.size(); ++i )
+    {
+        if ( IS_OPERATOR(_rpn[i]) || _rpn[i].first == MIN || _rpn[i].first == MAX )
+        {
+            if ( depth >= 2 )
+                --depth;
+        }
+        else
+        {
+            _maxDepth = std::max( _maxDepth, ++depth );
+        }
+    }
 }
 
 void 
@@ -266,92 +292,96 @@ NumericExpression::set( const Variable& var, double value )
 }
 
 double
-NumericExpression::eval() const
+NumericExpression::evalRPN( const double* values, double* s ) const
 {
-    if ( _dirty )
+    unsigned top = 0;
+    unsigned var = 0;
+
+    for( unsigned i=0; i<_rpn.size(); ++i )
     {
-        std::stack<double> s;
+        const Atom& a = _rpn[i];
 
-        for( unsigned i=0; i<_rpn.size(); ++i )
+        if ( IS_OPERATOR(a) || a.first == MIN || a.first == MAX )
         {
-            const Atom& a = _rpn[i];
-
-            if ( a.first == ADD )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 + op2 );
-                }
-            }
-            else if ( a.first == SUB )
+            if ( top >= 2 )
             {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 - op2 );
-                }
-            }
-            else if ( a.first == MULT )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 * op2 );
-                }
-            }
-            else if ( a.first == DIV )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 / op2 );
-                }
-            }
-            else if ( a.first == MOD )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( fmod(op1, op2) );
-                }
-            }
-            else if ( a.first == MIN )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( std::min(op1, op2) );
-                }
-            }
-            else if ( a.first == MAX )
-            {
-                if ( s.size() >= 2 )
+                double  op2 = s[--top];
+                double& op1 = s[top-1];
+
+                switch( a.first )
                 {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( std::max(op1, op2) );
+                case ADD:  op1 = op1 + op2; break;
+                case SUB:  op1 = op1 - op2; break;
+                case MULT: op1 = op1 * op2; break;
+                case DIV:  op1 = op1 / op2; break;
+                case MOD:  op1 = fmod(op1, op2); break;
+                case MIN:  op1 = std::min(op1, op2); break;
+                default:   op1 = std::max(op1, op2); break;
                 }
             }
-            else // OPERAND or VARIABLE
-            {
-                s.push( a.second );
-            }
+        }
+        else if ( a.first == VARIABLE && values )
+        {
+            s[top++] = values[var++];
+        }
+        else // OPERAND or VARIABLE
+        {
+            s[top++] = a.second;
+        }
+    }
+
+    return top > 0 ? s[top-1] : 0.0;
+}
+
+double
+NumericExpression::eval() const
+{
+    if ( _dirty )
+    {
+        double local[MAX_LOCAL_STACK_DEPTH];
+        std::vector<double> heap;
+        double* s = local;
+        if ( _maxDepth > MAX_LOCAL_STACK_DEPTH )
+        {
+            heap.resize( _maxDepth );
+            s = &heap[0];
         }
 
-        const_cast<NumericExpression*>(this)->_value = s.size() > 0 ? s.top() : 0.0;
+        const_cast<NumericExpression*>(this)->_value = evalRPN( 0L, s );
         const_cast<NumericExpression*>(this)->_dirty = false;
     }
 
     return !osg::isNaN( _value ) ? _value : 0.0;
 }
 
+double
+NumericExpression::eval( const double* values ) const
+{
+    double result;
+    eval( values, 1, &result );
+    return result;
+}
+
+void
+NumericExpression::eval( const double* values, unsigned count, double* out ) const
+{
+    double local[MAX_LOCAL_STACK_DEPTH];
+    std::vector<double> heap;
+    double* s = local;
+    if ( _maxDepth > MAX_LOCAL_STACK_DEPTH )
+    {
+        heap.resize( _maxDepth );
+        s = &heap[0];
+    }
+
+    unsigned stride = _vars.size();
+    for( unsigned i=0; i<count; ++i )
+    {
+        double value = evalRPN( values + i*stride, s );
+        out[i] = !osg::isNaN( value ) ? value : 0.0;
+    }
+}
+
 //------------------------------------------------------------------------
 
 StringExpression::StringExpression( const std::string& expr ) : 
@@ -395,6 +425,10 @@ StringExpression::setLiteral( const std::string& expr )
     _src = "\"" + expr + "\"";
     _value = expr;
     _dirty = false;
+
+    _vars.clear();
+    _infix.clear();
+    _infix.push_back( Atom(OPERAND, expr) );
 }
 
 StringExpression::StringExpression( const Config& conf )
@@ -422,6 +456,9 @@ StringExpression::getConfig() const
 void
 StringExpression::init()
 {
+    _vars.clear();
+    _infix.clear();
+
     bool inQuotes = false;
     int inVar = 0;
     int startPos = 0;
@@ -532,13 +569,27 @@ StringExpression::eval() const
 {
     if ( _dirty )
     {
-        std::stringstream buf;
+        std::string& buf = const_cast<StringExpression*>(this)->_value;
+        buf.clear();
         for( AtomVector::const_iterator i = _infix.begin(); i != _infix.end(); ++i )
-            buf << i->second;
+            buf.append( i->second );
 
-        const_cast<StringExpression*>(this)->_value = buf.str();
         const_cast<StringExpression*>(this)->_dirty = false;
     }
 
     return _value;
 }
+
+void
+StringExpression::eval( const std::string* values, std::string& out ) const
+{
+    out.clear();
+    unsigned var = 0;
+    for( AtomVector::const_iterator i = _infix.begin(); i != _infix.end(); ++i )
+    {
+        if ( i->first == VARIABLE )
+            out.append( values[var++] );
+        else
+            out.append( i->second );
+    }
+}
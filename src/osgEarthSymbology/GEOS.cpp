@@ -20,6 +20,8 @@
 
 #include <osgEarthSymbology/GEOS>
 #include <osg/Notify>
+#include <algorithm>
+#include <iterator>
 
 #include <geos/geom/PrecisionModel.h>
 #include <geos/geom/GeometryFactory.h>
@@ -34,8 +36,11 @@
 #include <geos/geom/LineString.h>
 #include <geos/geom/MultiLineString.h>
 #include <geos/geom/LinearRing.h>
+#include <geos/geom/prep/PreparedGeometryFactory.h>
 #include <geos/operation/valid/IsValidOp.h>
+#include <geos/operation/overlay/OverlayOp.h>
 #include <geos/util/IllegalArgumentException.h>
+#include <geos/util/GEOSException.h>
 
 using namespace osgEarth;
 using namespace osgEarth::Symbology;
@@ -328,5 +333,167 @@ GEOSContext::disposeGeometry(geom::Geometry* input)
     }
 }
 
+
+bool
+GEOSContext::prepareCropInput(const Symbology::Geometry* input, PreparedCropInput& output)
+{
+    output = PreparedCropInput();
+
+    output._geom = importGeometry( input );
+    if ( !output._geom )
+        return false;
+
+    try
+    {
+        output._prepared = geom::prep::PreparedGeometryFactory::prepare( output._geom );
+
+        // index the parts of a multi-geometry so a crop only visits the ones it might hit.
+        if ( output._geom->getNumGeometries() > 1 )
+        {
+            output._parts = new index::strtree::STRtree();
+            for( std::size_t i=0; i<output._geom->getNumGeometries(); ++i )
+            {
+                const geom::Geometry* part = output._geom->getGeometryN(i);
+                output._parts->insert( part->getEnvelopeInternal(), const_cast<geom::Geometry*>(part) );
+            }
+
+            // build now, since query() would otherwise do it lazily (and not thread-safely)
+            output._parts->build();
+        }
+    }
+    catch(const geos::util::GEOSException& ex)
+    {
+        OE_NOTICE << "GEOS::prepareCropInput: "
+            << (ex.what()? ex.what() : " no error message")
+            << std::endl;
+        disposeCropInput( output );
+        return false;
+    }
+
+    return true;
+}
+
+
+void
+GEOSContext::disposeCropInput(PreparedCropInput& input)
+{
+    if ( input._parts )
+        delete input._parts;
+
+    if ( input._prepared )
+        geom::prep::PreparedGeometryFactory::destroy( input._prepared );
+
+    disposeGeometry( input._geom );
+
+    input = PreparedCropInput();
+}
+
+
+bool
+GEOSContext::crop(const PreparedCropInput&           input,
+                  const Symbology::Polygon*          cropPoly,
+                  osg::ref_ptr<Symbology::Geometry>& output)
+{
+    output = 0L;
+
+    if ( !input._geom || !input._prepared )
+        return false;
+
+    geom::Geometry* cropGeom = importGeometry( cropPoly );
+    if ( !cropGeom )
+        return false;
+
+    bool empty = false;
+
+    try
+    {
+        const geom::Envelope* inputEnv = input._geom->getEnvelopeInternal();
+        const geom::Envelope* cropEnv  = cropGeom->getEnvelopeInternal();
+
+        if ( !cropEnv->intersects(inputEnv) || !input._prepared->intersects(cropGeom) )
+        {
+            // trivial rejection
+            empty = true;
+        }
+
+        else if ( cropGeom->isRectangle() && cropEnv->covers(inputEnv) )
+        {
+            // trivial acceptance; no overlay required
+            output = exportGeometry( input._geom );
+        }
+
+        else if ( input._parts )
+        {
+            // only overlay the parts near the crop polygon
+            std::vector<void*> hits;
+            input._parts->query( cropEnv, hits );
+
+            Symbology::GeometryCollection parts;
+            for( unsigned i=0; i<hits.size(); ++i )
+            {
+                const geom::Geometry* part = static_cast<const geom::Geometry*>( hits[i] );
+                geom::Geometry* clipped = overlay::OverlayOp::overlayOp( part, cropGeom, overlay::OverlayOp::opINTERSECTION );
+                if ( clipped )
+                {
+                    osg::ref_ptr<Symbology::Geometry> result = exportGeometry( clipped );
+                    Symbology::MultiGeometry* multi = dynamic_cast<Symbology::MultiGeometry*>( result.get() );
+                    if ( multi )
+                        std::copy( multi->getComponents().begin(), multi->getComponents().end(), std::back_inserter(parts) );
+                    else if ( result.valid() )
+                        parts.push_back( result.get() );
+
+                    disposeGeometry( clipped );
+                }
+            }
+
+            if ( parts.size() == 1 )
+                output = parts.front().get();
+            else if ( parts.size() > 1 )
+                output = new Symbology::MultiGeometry( parts );
+            else
+                empty = true;
+        }
+
+        else
+        {
+            geom::Geometry* outGeom = overlay::OverlayOp::overlayOp( input._geom, cropGeom, overlay::OverlayOp::opINTERSECTION );
+            if ( outGeom )
+            {
+                output = exportGeometry( outGeom );
+                if ( !output.valid() && outGeom->getNumPoints() == 0 )
+                    empty = true;
+                disposeGeometry( outGeom );
+            }
+        }
+    }
+    catch(const geos::util::GEOSException& ex)
+    {
+        OE_NOTICE << "Crop(GEOS): "
+            << (ex.what()? ex.what() : " no error message")
+            << std::endl;
+        output = 0L;
+        empty  = false;
+    }
+
+    disposeGeometry( cropGeom );
+
+    if ( output.valid() )
+    {
+        if ( output->isValid() )
+            return true;
+
+        // GEOS result is invalid
+        output = 0L;
+    }
+    else if ( empty )
+    {
+        // set output to empty geometry to indicate the (valid) empty case,
+        // still returning false but allows for check.
+        output = new Symbology::Geometry();
+    }
+
+    return false;
+}
+
 #endif // OSGEARTH_HAVE_GEOS
 
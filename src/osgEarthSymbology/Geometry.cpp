@@ -299,6 +299,39 @@ Geometry::crop( const Polygon* cropPoly, osg::ref_ptr<Geometry>& output ) const
 #endif // OSGEARTH_HAVE_GEOS
 }
 
+bool
+Geometry::crop( const std::vector< osg::ref_ptr<Polygon> >& cropPolys, std::vector< osg::ref_ptr<Geometry> >& outputs ) const
+{
+    outputs.assign( cropPolys.size(), 0L );
+
+#ifdef OSGEARTH_HAVE_GEOS
+
+    GEOSContext gc;
+
+    // convert and index once for all the crops.
+    PreparedCropInput input;
+    if ( !gc.prepareCropInput( this, input ) )
+        return false;
+
+    bool success = true;
+    for( unsigned i=0; i<cropPolys.size(); ++i )
+    {
+        if ( !gc.crop( input, cropPolys[i].get(), outputs[i] ) && !outputs[i].valid() )
+            success = false;
+    }
+
+    gc.disposeCropInput( input );
+
+    return success;
+
+#else // OSGEARTH_HAVE_GEOS
+
+    OE_WARN << LC << "Crop failed - GEOS not available" << std::endl;
+    return false;
+
+#endif // OSGEARTH_HAVE_GEOS
+}
+
 bool
 Geometry::difference( const Polygon* diffPolygon, osg::ref_ptr<Geometry>& output ) const
 {
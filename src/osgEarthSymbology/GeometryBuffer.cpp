@@ -0,0 +1,490 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthSymbology/GeometryBuffer>
+#include <osgEarth/SpatialReference>
+#include <osg/Endian>
+#include <algorithm>
+#include <cstring>
+
+#define LC "[GeometryBuffer] "
+
+using namespace osgEarth;
+using namespace osgEarth::Symbology;
+
+//------------------------------------------------------------------------
+
+GeometryView::GeometryView() :
+_buffer  ( 0L ),
+_type    ( Geometry::TYPE_UNKNOWN ),
+_ring    ( 0 ),
+_begin   ( 0 ),
+_end     ( 0 ),
+_numHoles( 0 )
+{
+    //nop
+}
+
+const osg::Vec3d*
+GeometryView::begin() const
+{
+    return _buffer && !_buffer->_points.empty() ? &_buffer->_points[0] + _begin : 0L;
+}
+
+GeometryView
+GeometryView::getHole(unsigned i) const
+{
+    GeometryView hole;
+    if ( _buffer && i < _numHoles )
+    {
+        unsigned ring  = _ring + 1 + i;
+        hole._buffer   = _buffer;
+        hole._type     = Geometry::TYPE_RING;
+        hole._ring     = ring;
+        hole._begin    = _buffer->_ringOffsets[ring];
+        hole._end      = _buffer->_ringOffsets[ring+1];
+    }
+    return hole;
+}
+
+Bounds
+GeometryView::getBounds() const
+{
+    Bounds bounds;
+    for( const osg::Vec3d* p = begin(); p != end(); ++p )
+        bounds.expandBy( p->x(), p->y() );
+    return bounds;
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // WKB geometry codes
+    enum { WKB_POINT = 1, WKB_LINESTRING, WKB_POLYGON, WKB_MULTIPOINT, WKB_MULTILINESTRING, WKB_MULTIPOLYGON, WKB_COLLECTION };
+
+    const unsigned WKB_MAX_DEPTH = 32;
+
+    double signedArea2D( const Vec3dVector& ring )
+    {
+        double sum = 0.0;
+        for( unsigned i = 0, j = ring.size()-1; i < ring.size(); j = i++ )
+            sum += ring[j].x()*ring[i].y() - ring[i].x()*ring[j].y();
+        return 0.5*sum;
+    }
+
+    /** Cursor over a WKB byte stream. */
+    struct WKBReader
+    {
+        const unsigned char* _p;
+        const unsigned char* _end;
+        bool                 _swap;
+        Vec3dVector          _scratch; // reused for every ring
+
+        WKBReader( const unsigned char* wkb, unsigned size ) :
+            _p(wkb), _end(wkb+size), _swap(false) { }
+
+        bool readByte( unsigned char& out )
+        {
+            if ( _p + 1 > _end ) return false;
+            out = *_p++;
+            return true;
+        }
+
+        bool readUInt( unsigned& out )
+        {
+            if ( _p + 4 > _end ) return false;
+            ::memcpy( &out, _p, 4 );
+            if ( _swap ) osg::swapBytes4( (char*)&out );
+            _p += 4;
+            return true;
+        }
+
+        bool readDouble( double& out )
+        {
+            if ( _p + 8 > _end ) return false;
+            ::memcpy( &out, _p, 8 );
+            if ( _swap ) osg::swapBytes8( (char*)&out );
+            _p += 8;
+            return true;
+        }
+
+        // reads a run of points into the scratch vector, reversed and
+        // without repeated points, the way OgrUtils populates geometry.
+        bool readPoints( unsigned dims )
+        {
+            unsigned count;
+            if ( !readUInt(count) || (unsigned)(_end - _p) / (8*dims) < count )
+                return false;
+
+            _scratch.resize( count );
+            for( unsigned i = 0; i < count; ++i )
+            {
+                osg::Vec3d& p = _scratch[count-1-i];
+                double m;
+                if ( !readDouble(p.x()) || !readDouble(p.y()) ) return false;
+                p.z() = 0.0;
+                if ( dims > 2 && !readDouble(p.z()) ) return false;
+                if ( dims > 3 && !readDouble(m) ) return false;
+            }
+
+            _scratch.erase( std::unique(_scratch.begin(), _scratch.end()), _scratch.end() );
+            return true;
+        }
+
+        void appendScratch( GeometryBuffer* buffer )
+        {
+            for( Vec3dVector::const_iterator i = _scratch.begin(); i != _scratch.end(); ++i )
+                buffer->push_back( *i );
+        }
+
+        // opens the ring in the scratch vector and winds it CCW or CW.
+        void rewindScratch( bool ccw )
+        {
+            while( _scratch.size() > 2 && _scratch.front() == _scratch.back() )
+                _scratch.pop_back();
+            if ( _scratch.size() > 2 && (signedArea2D(_scratch) > 0.0) != ccw )
+                std::reverse( _scratch.begin(), _scratch.end() );
+        }
+
+        bool read( GeometryBuffer* buffer, unsigned depth )
+        {
+            if ( depth > WKB_MAX_DEPTH )
+                return false;
+
+            unsigned char order;
+            unsigned type;
+            if ( !readByte(order) )
+                return false;
+
+            // each (sub)geometry carries its own byte order.
+            _swap = (order == 1) != (osg::getCpuByteOrder() == osg::LittleEndian);
+            if ( !readUInt(type) )
+                return false;
+
+            // 2.5D and EWKB flags, then ISO dimension codes.
+            bool hasZ = (type & 0x80000000u) != 0;
+            bool hasM = (type & 0x40000000u) != 0;
+            bool hasSRID = (type & 0x20000000u) != 0;
+            type &= 0x0fffffffu;
+            if ( type >= 1000 )
+            {
+                unsigned dim = type / 1000;
+                type %= 1000;
+                hasZ = hasZ || dim == 1 || dim == 3;
+                hasM = hasM || dim == 2 || dim == 3;
+            }
+
+            unsigned srid;
+            if ( hasSRID && !readUInt(srid) )
+                return false;
+
+            unsigned dims = 2 + (hasZ ? 1 : 0) + (hasM ? 1 : 0);
+
+            if ( type == WKB_POINT )
+            {
+                osg::Vec3d p;
+                double m;
+                if ( !readDouble(p.x()) || !readDouble(p.y()) ) return false;
+                if ( dims > 2 && !readDouble(p.z()) ) return false;
+                if ( dims > 3 && !readDouble(m) ) return false;
+
+                // NaN coordinates encode an empty point.
+                if ( p.x() == p.x() && p.y() == p.y() )
+                {
+                    buffer->beginPart( Geometry::TYPE_POINTSET );
+                    buffer->push_back( p );
+                }
+                return true;
+            }
+
+            else if ( type == WKB_LINESTRING )
+            {
+                if ( !readPoints(dims) ) return false;
+                buffer->beginPart( Geometry::TYPE_LINESTRING );
+                appendScratch( buffer );
+                return true;
+            }
+
+            else if ( type == WKB_POLYGON )
+            {
+                unsigned numRings;
+                if ( !readUInt(numRings) ) return false;
+                for( unsigned r = 0; r < numRings; ++r )
+                {
+                    if ( !readPoints(dims) ) return false;
+                    rewindScratch( r == 0 );
+                    if ( r == 0 )
+                        buffer->beginPart( Geometry::TYPE_POLYGON );
+                    else
+                        buffer->beginHole();
+                    appendScratch( buffer );
+                }
+                return true;
+            }
+
+            else if ( type >= WKB_MULTIPOINT && type <= WKB_COLLECTION )
+            {
+                unsigned count;
+                if ( !readUInt(count) ) return false;
+                for( unsigned i = 0; i < count; ++i )
+                {
+                    if ( !read(buffer, depth+1) )
+                        return false;
+                }
+                return true;
+            }
+
+            return false;
+        }
+    };
+}
+
+//------------------------------------------------------------------------
+
+GeometryBuffer::GeometryBuffer()
+{
+    clear();
+}
+
+GeometryBuffer::GeometryBuffer(const Geometry* geom)
+{
+    clear();
+    if ( geom )
+        flatten( geom );
+}
+
+void
+GeometryBuffer::flatten(const Geometry* geom)
+{
+    if ( geom->getType() == Geometry::TYPE_MULTI )
+    {
+        const GeometryCollection& parts = static_cast<const MultiGeometry*>(geom)->getComponents();
+        for( GeometryCollection::const_iterator i = parts.begin(); i != parts.end(); ++i )
+        {
+            if ( i->valid() )
+                flatten( i->get() );
+        }
+    }
+    else
+    {
+        beginPart( geom->getType() );
+        _points.insert( _points.end(), geom->begin(), geom->end() );
+        _ringOffsets.back() = _points.size();
+
+        if ( geom->getType() == Geometry::TYPE_POLYGON )
+        {
+            const RingCollection& holes = static_cast<const Polygon*>(geom)->getHoles();
+            for( RingCollection::const_iterator h = holes.begin(); h != holes.end(); ++h )
+            {
+                if ( !h->valid() )
+                    continue;
+                beginHole();
+                _points.insert( _points.end(), h->get()->begin(), h->get()->end() );
+                _ringOffsets.back() = _points.size();
+            }
+        }
+    }
+}
+
+GeometryBuffer*
+GeometryBuffer::createFromWKB(const unsigned char* wkb, unsigned size)
+{
+    if ( !wkb || size == 0 )
+        return 0L;
+
+    osg::ref_ptr<GeometryBuffer> buffer = new GeometryBuffer();
+    WKBReader reader( wkb, size );
+    if ( !reader.read(buffer.get(), 0) )
+    {
+        OE_DEBUG << LC << "Malformed or unsupported WKB" << std::endl;
+        return 0L;
+    }
+    return buffer.release();
+}
+
+void
+GeometryBuffer::beginPart(Geometry::Type type)
+{
+    _partTypes.push_back( type );
+    _partOffsets.push_back( _partOffsets.back() + 1 );
+    _ringOffsets.push_back( _ringOffsets.back() );
+}
+
+void
+GeometryBuffer::beginHole()
+{
+    if ( _partTypes.empty() || _partTypes.back() != Geometry::TYPE_POLYGON )
+        return;
+
+    ++_partOffsets.back();
+    _ringOffsets.push_back( _ringOffsets.back() );
+}
+
+void
+GeometryBuffer::reserve(unsigned numPoints, unsigned numRings, unsigned numParts)
+{
+    _points.reserve( numPoints );
+    _ringOffsets.reserve( numRings+1 );
+    _partOffsets.reserve( numParts+1 );
+    _partTypes.reserve( numParts );
+}
+
+void
+GeometryBuffer::clear()
+{
+    _points.clear();
+    _ringOffsets.assign( 1, 0u );
+    _partOffsets.assign( 1, 0u );
+    _partTypes.clear();
+}
+
+GeometryView
+GeometryBuffer::getPart(unsigned part) const
+{
+    GeometryView view;
+    if ( part < _partTypes.size() )
+    {
+        unsigned ring  = _partOffsets[part];
+        view._buffer   = this;
+        view._type     = _partTypes[part];
+        view._ring     = ring;
+        view._begin    = _ringOffsets[ring];
+        view._end      = _ringOffsets[ring+1];
+        view._numHoles = _partOffsets[part+1] - ring - 1;
+    }
+    return view;
+}
+
+Bounds
+GeometryBuffer::getBounds() const
+{
+    Bounds bounds;
+    for( Vec3dVector::const_iterator p = _points.begin(); p != _points.end(); ++p )
+        bounds.expandBy( p->x(), p->y() );
+    return bounds;
+}
+
+bool
+GeometryBuffer::transform(const SpatialReference* fromSRS, const SpatialReference* toSRS)
+{
+    if ( !fromSRS || !toSRS )
+        return false;
+
+    if ( _points.empty() || fromSRS->isEquivalentTo(toSRS) )
+        return true;
+
+    return fromSRS->transform( _points, toSRS );
+}
+
+Geometry*
+GeometryBuffer::createGeometry() const
+{
+    osg::ref_ptr<MultiGeometry> multi = getNumParts() > 1 ? new MultiGeometry() : 0L;
+    Geometry* single = 0L;
+
+    for( unsigned part = 0; part < getNumParts(); ++part )
+    {
+        GeometryView view = getPart( part );
+
+        Geometry* geom = 0L;
+        switch( view.getType() )
+        {
+        case Geometry::TYPE_POINTSET:   geom = new PointSet( view.size() ); break;
+        case Geometry::TYPE_LINESTRING: geom = new LineString( view.size() ); break;
+        case Geometry::TYPE_RING:       geom = new Ring( view.size() ); break;
+        case Geometry::TYPE_POLYGON:    geom = new Polygon( view.size() ); break;
+        default: continue;
+        }
+
+        geom->insert( geom->end(), view.begin(), view.end() );
+
+        if ( view.getType() == Geometry::TYPE_POLYGON )
+        {
+            Polygon* poly = static_cast<Polygon*>(geom);
+            for( unsigned h = 0; h < view.getNumHoles(); ++h )
+            {
+                GeometryView hole = view.getHole( h );
+                Ring* ring = new Ring( hole.size() );
+                ring->insert( ring->end(), hole.begin(), hole.end() );
+                poly->getHoles().push_back( ring );
+            }
+        }
+
+        if ( multi.valid() )
+            multi->add( geom );
+        else
+            single = geom;
+    }
+
+    return multi.valid() ? multi.release() : single;
+}
+
+osg::Vec3Array*
+GeometryBuffer::createVec3Array(const osg::Vec3d& origin) const
+{
+    osg::Vec3Array* verts = new osg::Vec3Array( _points.size() );
+    for( unsigned i = 0; i < _points.size(); ++i )
+        (*verts)[i] = _points[i] - origin;
+    return verts;
+}
+
+//------------------------------------------------------------------------
+
+GeometryBufferIterator::GeometryBufferIterator(const GeometryBuffer* buffer,
+                                               bool                  traversePolygonHoles) :
+_buffer           ( buffer ),
+_traversePolyHoles( traversePolygonHoles ),
+_part             ( 0 ),
+_hole             ( 0 )
+{
+    fetchNext();
+}
+
+bool
+GeometryBufferIterator::hasMore() const
+{
+    return _current.valid();
+}
+
+GeometryView
+GeometryBufferIterator::next()
+{
+    GeometryView result = _current;
+    fetchNext();
+    return result;
+}
+
+void
+GeometryBufferIterator::fetchNext()
+{
+    if ( _traversePolyHoles && _partView.valid() && _hole < _partView.getNumHoles() )
+    {
+        _current = _partView.getHole( _hole++ );
+    }
+    else if ( _buffer && _part < _buffer->getNumParts() )
+    {
+        _partView = _buffer->getPart( _part++ );
+        _hole     = 0;
+        _current  = _partView;
+    }
+    else
+    {
+        _current = GeometryView();
+    }
+}
@@ -0,0 +1,129 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthSymbology/GeometryCropCache>
+#include <osgEarth/Containers>
+#include <osgEarth/ThreadingUtils>
+
+#ifdef OSGEARTH_HAVE_GEOS
+#  include <osgEarthSymbology/GEOS>
+#endif
+
+#define LC "[GeometryCropCache] "
+
+using namespace osgEarth;
+using namespace osgEarth::Symbology;
+
+//------------------------------------------------------------------------
+
+#ifdef OSGEARTH_HAVE_GEOS
+
+namespace
+{
+    // One converted geometry. Prepared geometries build their internal
+    // indexes lazily, so crops against the same entry are serialized.
+    struct Entry : public osg::Referenced
+    {
+        Entry() : _numPoints(0) { }
+
+        ~Entry() {
+            _gc.disposeCropInput( _input );
+        }
+
+        GEOSContext       _gc;
+        PreparedCropInput _input;
+        unsigned          _numPoints;
+        Threading::Mutex  _mutex;
+    };
+}
+
+struct GeometryCropCache::Impl
+{
+    Impl(unsigned maxSize) : _entries( maxSize ) { }
+    ShardedLRUCache<std::string, osg::ref_ptr<Entry> > _entries;
+};
+
+#else // OSGEARTH_HAVE_GEOS
+
+struct GeometryCropCache::Impl
+{
+    Impl(unsigned maxSize) { }
+};
+
+#endif // OSGEARTH_HAVE_GEOS
+
+//------------------------------------------------------------------------
+
+GeometryCropCache::GeometryCropCache(unsigned maxSize)
+{
+    _impl = new Impl( maxSize );
+}
+
+GeometryCropCache::~GeometryCropCache()
+{
+    delete _impl;
+}
+
+void
+GeometryCropCache::clear()
+{
+#ifdef OSGEARTH_HAVE_GEOS
+    _impl->_entries.clear();
+#endif
+}
+
+bool
+GeometryCropCache::crop(const std::string&      key,
+                        const Geometry*         input,
+                        const Polygon*          cropPolygon,
+                        osg::ref_ptr<Geometry>& output)
+{
+    if ( !input )
+        return false;
+
+#ifdef OSGEARTH_HAVE_GEOS
+
+    unsigned numPoints = input->getTotalPointCount();
+
+    osg::ref_ptr<Entry> entry;
+    ShardedLRUCache<std::string, osg::ref_ptr<Entry> >::Record rec;
+    if ( _impl->_entries.get(key, rec) && rec.value()->_numPoints == numPoints )
+    {
+        entry = rec.value().get();
+    }
+    else
+    {
+        entry = new Entry();
+        entry->_numPoints = numPoints;
+        if ( !entry->_gc.prepareCropInput(input, entry->_input) )
+        {
+            // could not convert; let the regular path report the problem.
+            return input->crop( cropPolygon, output );
+        }
+        _impl->_entries.insert( key, entry.get() );
+    }
+
+    Threading::ScopedMutexLock lock( entry->_mutex );
+    return entry->_gc.crop( entry->_input, cropPolygon, output );
+
+#else // OSGEARTH_HAVE_GEOS
+
+    return input->crop( cropPolygon, output );
+
+#endif // OSGEARTH_HAVE_GEOS
+}
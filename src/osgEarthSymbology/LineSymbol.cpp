@@ -28,7 +28,8 @@ LineSymbol::LineSymbol( const Config& conf ) :
 Symbol       ( conf ),
 _stroke      ( Stroke() ),
 _tessellation( 0 ),
-_creaseAngle ( 0.0f )
+_creaseAngle ( 0.0f ),
+_useGPU      ( false )
 {
     mergeConfig(conf);
 }
@@ -37,7 +38,8 @@ LineSymbol::LineSymbol(const LineSymbol& rhs,const osg::CopyOp& copyop):
 Symbol(rhs, copyop),
 _stroke(rhs._stroke),
 _tessellation(rhs._tessellation),
-_creaseAngle(rhs._creaseAngle)
+_creaseAngle(rhs._creaseAngle),
+_useGPU(rhs._useGPU)
 {
 }
 
@@ -49,6 +51,7 @@ LineSymbol::getConfig() const
     conf.addObjIfSet("stroke",       _stroke);
     conf.addIfSet   ("tessellation", _tessellation);
     conf.addIfSet   ("crease_angle", _creaseAngle);
+    conf.addIfSet   ("use_gpu",      _useGPU);
     return conf;
 }
 
@@ -58,6 +61,7 @@ LineSymbol::mergeConfig( const Config& conf )
     conf.getObjIfSet("stroke",       _stroke);
     conf.getIfSet   ("tessellation", _tessellation);
     conf.getIfSet   ("crease_angle", _creaseAngle);
+    conf.getIfSet   ("use_gpu",      _useGPU);
 }
 
 void
@@ -109,6 +113,9 @@ LineSymbol::parseSLD(const Config& c, Style& style)
     else if ( match(c.key(), "stroke-crease-angle") ) {
         style.getOrCreate<LineSymbol>()->creaseAngle() = as<float>(c.value(), 0.0);
     }
+    else if ( match(c.key(), "stroke-gpu") ) {
+        style.getOrCreate<LineSymbol>()->useGPU() = as<bool>(c.value(), false);
+    }
     else if ( match(c.key(), "stroke-script") ) {
         style.getOrCreate<LineSymbol>()->script() = StringExpression(c.value());
     }
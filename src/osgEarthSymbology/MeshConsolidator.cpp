@@ -18,7 +18,10 @@
 */
 
 #include <osgEarthSymbology/MeshConsolidator>
+#include <osgEarthSymbology/VertexTagTable>
 #include <osgEarth/StringUtils>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
 #include <osg/TriangleFunctor>
 #include <osg/TriangleIndexFunctor>
 #include <osgDB/WriteFile>
@@ -232,7 +235,8 @@ namespace
         unsigned                      numNormals,
         const std::vector<unsigned>&  texCoordArrayUnits,
         bool                          useVBOs,
-        DrawableList&                 results )
+        DrawableList&                 results,
+        bool                          mergeStateSets =true )
     {
         osg::Geometry::AttributeBinding newColorsBinding, newNormalsBinding;
 
@@ -300,20 +304,32 @@ namespace
 
         unsigned offset = 0;
         osg::Geometry::PrimitiveSetList newPrimSets;
+        {
+            unsigned numPrimSets = 0;
+            for( DrawableList::iterator i = start; i != end; ++i )
+                numPrimSets += i->get()->asGeometry()->getNumPrimitiveSets();
+            newPrimSets.reserve( numPrimSets );
+        }
 
         std::vector<osg::ref_ptr<osg::Geometry> > nonOptimizedGeoms;
 
         osg::StateSet* unifiedStateSet = 0L;
 
+        // vertex tags of all the inputs, shifted to their place in the output
+        osg::ref_ptr<VertexTagTable> newTags;
+
         for( DrawableList::iterator i = start; i != end; ++i )
         {
             osg::Geometry* geom = i->get()->asGeometry(); //geode.getDrawable(i)->asGeometry();
 
-            // merge in the stateset:
-            if ( unifiedStateSet == 0L )
-                unifiedStateSet = geom->getStateSet();
-            else if ( geom->getStateSet() )
-                unifiedStateSet->merge( *geom->getStateSet() );            
+            // merge in the stateset (unless the caller assigns a shared one):
+            if ( mergeStateSets )
+            {
+                if ( unifiedStateSet == 0L )
+                    unifiedStateSet = geom->getStateSet();
+                else if ( geom->getStateSet() && geom->getStateSet() != unifiedStateSet )
+                    unifiedStateSet->merge( *geom->getStateSet() );
+            }
 
             // copy over the verts:
             osg::Vec3Array* geomVerts = dynamic_cast<osg::Vec3Array*>( geom->getVertexArray() );
@@ -423,6 +439,14 @@ namespace
                     }
                 }
 
+                const VertexTagTable* tags = VertexTagTable::get( geom );
+                if ( tags )
+                {
+                    if ( !newTags.valid() )
+                        newTags = new VertexTagTable();
+                    newTags->append( *tags, offset );
+                }
+
                 offset += geomVerts->size();
             }
         }
@@ -454,11 +478,21 @@ namespace
         }
 
         newGeom->setPrimitiveSetList( newPrimSets );
-        newGeom->setStateSet( unifiedStateSet );
+        if ( mergeStateSets )
+            newGeom->setStateSet( unifiedStateSet );
 
         newGeom->setUseVertexBufferObjects( useVBOs );
         newGeom->setUseDisplayList( !useVBOs );
 
+        if ( newTags.valid() )
+        {
+            newGeom->setUserData( newTags.get() );
+
+            // tags live on the vertices, so untagged primitive sets can be
+            // pooled into as few as possible.
+            MeshConsolidator::convertToTriangles( *newGeom );
+        }
+
         results.push_back( newGeom );
 
         //GeometryValidator().apply( *newGeom );
@@ -560,3 +594,234 @@ MeshConsolidator::run( osg::Geode& geode )
     for( DrawableList::iterator i = dontConsolidate.begin(); i != dontConsolidate.end(); ++i )
         geode.addDrawable( i->get() );
 }
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // A spatial cell for one state set.
+    struct BucketKey
+    {
+        osg::StateSet* _stateSet;
+        int            _x, _y, _z;
+
+        bool operator < (const BucketKey& rhs) const {
+            if ( _stateSet != rhs._stateSet ) return _stateSet < rhs._stateSet;
+            if ( _x != rhs._x ) return _x < rhs._x;
+            if ( _y != rhs._y ) return _y < rhs._y;
+            return _z < rhs._z;
+        }
+    };
+
+    // A run of geometries that will become one merged geometry.
+    struct Batch
+    {
+        Batch() : _numVerts(0), _numColors(0), _numNormals(0), _stateSet(0L) { }
+        DrawableList   _geoms;
+        unsigned       _numVerts, _numColors, _numNormals;
+        osg::StateSet* _stateSet;
+        DrawableList   _results;
+    };
+
+    // Converts and merges a contiguous range of batches.
+    struct MergeBatches
+    {
+        std::vector<Batch>*          _batches;
+        const std::vector<unsigned>* _texCoordArrayUnits;
+        bool                         _useVBOs;
+        unsigned                     _begin, _end;
+
+        void execute()
+        {
+            for( unsigned b=_begin; b<_end; ++b )
+            {
+                Batch& batch = (*_batches)[b];
+                for( DrawableList::iterator i = batch._geoms.begin(); i != batch._geoms.end(); ++i )
+                    MeshConsolidator::convertToTriangles( *i->get()->asGeometry(), true );
+
+                DrawableList::iterator start = batch._geoms.begin();
+                DrawableList::iterator end   = batch._geoms.end();
+                merge( start, end, batch._numVerts, batch._numColors, batch._numNormals,
+                       *_texCoordArrayUnits, _useVBOs, batch._results, false );
+            }
+        }
+    };
+
+    // Merging only touches the geometries in each batch, so batches can run
+    // concurrently; callers block on this pool and never run on it.
+    TaskService* getConsolidationService()
+    {
+        static Threading::Mutex          s_mutex;
+        static osg::ref_ptr<TaskService> s_service;
+
+        Threading::ScopedMutexLock lock( s_mutex );
+        if ( !s_service.valid() )
+        {
+            int numThreads = osg::clampBetween(OpenThreads::GetNumberOfProcessors(), 1, 16);
+            s_service = new TaskService( "Mesh consolidation", numThreads );
+        }
+        return s_service.get();
+    }
+
+    // Below this many vertices, merging serially beats dispatching tasks.
+#define MIN_VERTS_FOR_PARALLEL_CONSOLIDATION 16384
+}
+
+
+void
+MeshConsolidator::runBucketed( osg::Geode& geode, double cellSize, unsigned maxVertsPerGeom )
+{
+    // trivial bailout:
+    if ( geode.getNumDrawables() <= 1 )
+        return;
+
+    if ( maxVertsPerGeom == 0 )
+        maxVertsPerGeom = 0xFFFF;
+
+    bool useVBOs = false;
+    std::vector<unsigned> texCoordArrayUnits;
+    DrawableList consolidate, dontConsolidate;
+
+    // sort the drawables, and find the extent of the consolidation set:
+    osg::BoundingBox centers;
+    for( unsigned i=0; i<geode.getNumDrawables(); ++i )
+    {
+        osg::Geometry* geom = geode.getDrawable(i)->asGeometry();
+        if ( geom )
+        {
+            if ( canOptimize(*geom) )
+            {
+                // NOTE!! tex/attrib array counts much already be equal.
+                if ( consolidate.empty() )
+                {
+                    for( unsigned u=0; u<32; ++u ) {
+                        if ( geom->getTexCoordArray(u) != 0L )
+                            texCoordArrayUnits.push_back( u );
+                    }
+
+                    if ( geom->getUseVertexBufferObjects() )
+                        useVBOs = true;
+                }
+
+                centers.expandBy( geom->getBound().center() );
+                consolidate.push_back(geom);
+            }
+            else
+            {
+                dontConsolidate.push_back(geom);
+            }
+        }
+    }
+
+    if ( consolidate.empty() )
+        return;
+
+    // default to roughly a 4x4x4 grid over the data.
+    if ( cellSize <= 0.0 )
+    {
+        double extent = osg::maximum( centers.xMax()-centers.xMin(), osg::maximum( centers.yMax()-centers.yMin(), centers.zMax()-centers.zMin() ) );
+        cellSize = extent > 0.0 ? extent / 4.0 : 1.0;
+    }
+
+    // bucket by state set and cell, then cut each bucket into size-bounded batches.
+    typedef std::map<BucketKey, DrawableList> Buckets;
+    Buckets buckets;
+
+    for( DrawableList::iterator i = consolidate.begin(); i != consolidate.end(); ++i )
+    {
+        osg::Geometry* geom = i->get()->asGeometry();
+        const osg::Vec3& c = geom->getBound().center();
+
+        BucketKey key;
+        key._stateSet = geom->getStateSet();
+        key._x = (int)floor( (c.x() - centers.xMin()) / cellSize );
+        key._y = (int)floor( (c.y() - centers.yMin()) / cellSize );
+        key._z = (int)floor( (c.z() - centers.zMin()) / cellSize );
+        buckets[key].push_back( geom );
+    }
+
+    std::vector<Batch> batches;
+    unsigned totalVerts = 0;
+
+    for( Buckets::iterator b = buckets.begin(); b != buckets.end(); ++b )
+    {
+        unsigned first = batches.size();
+        batches.push_back( Batch() );
+        batches.back()._stateSet = b->first._stateSet;
+
+        for( DrawableList::iterator i = b->second.begin(); i != b->second.end(); ++i )
+        {
+            osg::Geometry* geom = i->get()->asGeometry();
+            unsigned geomNumVerts = geom->getVertexArray()->getNumElements();
+
+            if ( batches.back()._numVerts > 0 && batches.back()._numVerts + geomNumVerts > maxVertsPerGeom )
+            {
+                batches.push_back( Batch() );
+                batches.back()._stateSet = b->first._stateSet;
+            }
+
+            Batch& batch = batches.back();
+            batch._geoms.push_back( geom );
+            batch._numVerts += geomNumVerts;
+            if ( geom->getColorArray() )
+                batch._numColors += geom->getColorArray()->getNumElements();
+            if ( geom->getNormalArray() )
+                batch._numNormals += geom->getNormalArray()->getNumElements();
+            totalVerts += geomNumVerts;
+        }
+
+        OE_DEBUG << LC << "Bucket with " << b->second.size() << " geoms -> " << (batches.size()-first) << " batches" << std::endl;
+    }
+
+    // merge the batches:
+    MergeBatches work;
+    work._batches = &batches;
+    work._texCoordArrayUnits = &texCoordArrayUnits;
+    work._useVBOs = useVBOs;
+
+    if ( batches.size() < 2 || totalVerts < MIN_VERTS_FOR_PARALLEL_CONSOLIDATION )
+    {
+        work._begin = 0;
+        work._end = batches.size();
+        work.execute();
+    }
+    else
+    {
+        TaskService* service = getConsolidationService();
+
+        // a few ranges per thread to balance uneven batches.
+        unsigned numTasks = std::min( (unsigned)batches.size(), (unsigned)service->getNumThreads() * 4u );
+        unsigned perTask  = (batches.size() + numTasks - 1) / numTasks;
+        numTasks = (batches.size() + perTask - 1) / perTask;
+
+        Threading::MultiEvent semaphore( (int)numTasks );
+        for( unsigned t=0; t<numTasks; ++t )
+        {
+            ParallelTask<MergeBatches>* task = new ParallelTask<MergeBatches>( &semaphore );
+            task->_batches = work._batches;
+            task->_texCoordArrayUnits = work._texCoordArrayUnits;
+            task->_useVBOs = work._useVBOs;
+            task->_begin = t * perTask;
+            task->_end = std::min( (unsigned)batches.size(), (t+1) * perTask );
+            service->add( task );
+        }
+
+        semaphore.wait();
+    }
+
+    // re-build the geode. State sets are assigned here, on one thread, since
+    // attaching one updates its parent list.
+    geode.removeDrawables( 0, geode.getNumDrawables() );
+
+    for( std::vector<Batch>::iterator b = batches.begin(); b != batches.end(); ++b )
+    {
+        for( DrawableList::iterator i = b->_results.begin(); i != b->_results.end(); ++i )
+        {
+            i->get()->setStateSet( b->_stateSet );
+            geode.addDrawable( i->get() );
+        }
+    }
+
+    for( DrawableList::iterator i = dontConsolidate.begin(); i != dontConsolidate.end(); ++i )
+        geode.addDrawable( i->get() );
+}
@@ -17,118 +17,488 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthSymbology/ResourceCache>
+#include <osg/NodeVisitor>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Texture>
+#include <OpenThreads/Atomic>
+#include <algorithm>
+#include <set>
 
 using namespace osgEarth;
 using namespace osgEarth::Symbology;
 
+#define NUM_SHARDS 16
 
-// internal thread-safety not required since we mutex it in this object.
-ResourceCache::ResourceCache(const osgDB::Options* dbOptions ) :
-_dbOptions    ( dbOptions ),
-_skinCache    ( false ),
-_instanceCache( false ),
-_resourceLibraryCache( false )
+namespace
 {
-    //nop
-}
-
-bool
-ResourceCache::getOrCreateStateSet(SkinResource*                skin,
-                                   osg::ref_ptr<osg::StateSet>& output)
-{
-    output = 0L;
-    //std::string key = skin->getConfig().toJSON(false);
+    // Activates VBOs on a cached node, so that copies sharing its arrays do
+    // not each try to assign buffer objects to them.
+    struct ActivateVBOs : public osg::NodeVisitor
+    {
+        ActivateVBOs() : osg::NodeVisitor(TRAVERSE_ALL_CHILDREN) { }
 
-    // Note: we use the imageURI as the basis for the caching key since 
-    // it's the only property used by Skin->createStateSet(). If that
-    // changes, we need to address it here. It might be better it SkinResource
-    // were to provide a unique key.
-    std::string key = skin->getUniqueID();
+        void apply(osg::Geode& geode)
+        {
+            for(unsigned i=0; i<geode.getNumDrawables(); ++i)
+            {
+                osg::Geometry* geom = geode.getDrawable(i)->asGeometry();
+                if ( geom )
+                {
+                    geom->setUseDisplayList( false );
+                    geom->setUseVertexBufferObjects( true );
+                }
+            }
+            traverse(geode);
+        }
+    };
 
-    // exclusive lock (since it's an LRU)
+    // Approximates the memory held by a node or state set: vertex data,
+    // primitive sets and texture images, each counted once.
+    struct ComputeBytes : public osg::NodeVisitor
     {
-        Threading::ScopedMutexLock exclusive( _skinMutex );
-            
-        // double check to avoid race condition
-        SkinCache::Record rec;       
-        if ( _skinCache.get(key, rec) && rec.value().valid() )
+        ComputeBytes() : osg::NodeVisitor(TRAVERSE_ALL_CHILDREN), _bytes(0) { }
+
+        void apply(osg::Node& node)
+        {
+            apply( node.getStateSet() );
+            traverse(node);
+        }
+
+        void apply(osg::Geode& geode)
         {
-            output = rec.value().get();
+            apply( geode.getStateSet() );
+            for(unsigned i=0; i<geode.getNumDrawables(); ++i)
+            {
+                osg::Drawable* d = geode.getDrawable(i);
+                apply( d->getStateSet() );
+
+                osg::Geometry* geom = d->asGeometry();
+                if ( geom )
+                {
+                    apply( geom->getVertexArray() );
+                    apply( geom->getNormalArray() );
+                    apply( geom->getColorArray() );
+                    for(unsigned t=0; t<geom->getNumTexCoordArrays(); ++t)
+                        apply( geom->getTexCoordArray(t) );
+                    for(unsigned a=0; a<geom->getNumVertexAttribArrays(); ++a)
+                        apply( geom->getVertexAttribArray(a) );
+                    for(unsigned p=0; p<geom->getNumPrimitiveSets(); ++p)
+                    {
+                        osg::DrawElements* de = geom->getPrimitiveSet(p)->getDrawElements();
+                        if ( de && _seen.insert(de).second )
+                            _bytes += de->getTotalDataSize();
+                    }
+                }
+            }
+            traverse(geode);
         }
-        else
+
+        void apply(osg::Array* array)
         {
-            // still not there, make it.
-            output = skin->createStateSet( _dbOptions.get() );
-            if ( output.valid() )
+            if ( array && _seen.insert(array).second )
+                _bytes += array->getTotalDataSize();
+        }
+
+        void apply(osg::StateSet* stateset)
+        {
+            if ( !stateset || !_seen.insert(stateset).second )
+                return;
+
+            const osg::StateSet::TextureAttributeList& units = stateset->getTextureAttributeList();
+            for(unsigned u=0; u<units.size(); ++u)
             {
-                _skinCache.insert( key, output.get() );
+                for(osg::StateSet::AttributeList::const_iterator i = units[u].begin(); i != units[u].end(); ++i)
+                {
+                    const osg::Texture* tex = dynamic_cast<const osg::Texture*>( i->second.first.get() );
+                    if ( !tex )
+                        continue;
+                    for(unsigned k=0; k<tex->getNumImages(); ++k)
+                    {
+                        const osg::Image* image = tex->getImage(k);
+                        if ( image && _seen.insert(image).second )
+                            _bytes += image->getTotalSizeInBytes();
+                    }
+                }
             }
         }
+
+        std::set<const void*> _seen;
+        unsigned long long    _bytes;
+    };
+
+    unsigned long long computeBytes(osg::Node* node)
+    {
+        ComputeBytes cb;
+        if ( node )
+            node->accept( cb );
+        return cb._bytes;
     }
 
-    return output.valid();
+    unsigned long long computeBytes(osg::StateSet* stateset)
+    {
+        ComputeBytes cb;
+        cb.apply( stateset );
+        return cb._bytes;
+    }
 }
 
+//------------------------------------------------------------------------
 
-bool
-ResourceCache::getOrCreateInstanceNode(InstanceResource*        res,
-                                       osg::ref_ptr<osg::Node>& output)
+struct ResourceCache::Budget
 {
-    output = 0L;
-    std::string key = res->getConfig().toJSON(false);
+    Budget() : _max(0), _used(0) { }
+    unsigned long long _max;
+    unsigned long long _used;
+    Threading::Mutex   _mutex;
 
-    // exclusive lock (since it's an LRU)
+    void add(long long bytes) {
+        Threading::ScopedMutexLock lock( _mutex );
+        _used = (unsigned long long)( (long long)_used + bytes );
+    }
+
+    bool over() {
+        Threading::ScopedMutexLock lock( _mutex );
+        return _max > 0 && _used > _max;
+    }
+};
+
+/**
+ * Thread-safe cache of objects created from resources. Keys are spread over
+ * shards so that readers only contend with writers of the same shard, and
+ * a key that is being created is marked "in flight" so that concurrent
+ * requesters wait for that one creation instead of repeating it.
+ */
+template<typename T>
+class ResourceCache::ObjectCache
+{
+public:
+    typedef osg::ref_ptr<T> Ptr;
+
+    ObjectCache(Budget* budget, unsigned maxEntries) : _budget(budget)
     {
-        Threading::ScopedMutexLock exclusive( _instanceMutex );
+        _maxPerShard = std::max( 1u, (maxEntries + NUM_SHARDS - 1) / NUM_SHARDS );
+    }
 
-        // double check to avoid race condition
-        InstanceCache::Record rec;
-        if ( _instanceCache.get(key, rec) && rec.value().valid() )
+    /**
+     * Returns the cached object for key, or creates it with create() (outside
+     * of any lock) and caches it. CREATE has "T* operator()() const".
+     */
+    template<typename CREATE>
+    bool getOrCreate(const std::string& key, const CREATE& create, Ptr& output)
+    {
+        output = 0L;
+        Shard& shard = shardFor(key);
+        ++shard._queries;
+
+        // fast path: shared lock.
         {
-            output = rec.value().get();
+            Threading::ScopedReadLock shared( shard._mutex );
+            typename EntryMap::iterator i = shard._entries.find(key);
+            if ( i != shard._entries.end() )
+            {
+                i->second._stamp = ++_clock; // benign race; any writer just sets it too
+                output = i->second._value.get();
+                ++shard._hits;
+                return output.valid();
+            }
         }
-        else
+
+        osg::ref_ptr<InFlight> flight;
+        bool creator = false;
         {
-            // still not there, make it.
-            output = res->createNode( _dbOptions.get() );
-            if ( output.valid() )
+            Threading::ScopedWriteLock exclusive( shard._mutex );
+
+            // double check to avoid race condition
+            typename EntryMap::iterator i = shard._entries.find(key);
+            if ( i != shard._entries.end() )
+            {
+                i->second._stamp = ++_clock;
+                output = i->second._value.get();
+                ++shard._hits;
+                return output.valid();
+            }
+
+            typename FlightMap::iterator f = shard._inFlight.find(key);
+            if ( f != shard._inFlight.end() )
+            {
+                flight = f->second.get();
+            }
+            else
             {
-                _instanceCache.insert( key, output.get() );
+                flight = new InFlight();
+                shard._inFlight[key] = flight.get();
+                creator = true;
             }
         }
+
+        if ( !creator )
+        {
+            // someone else is already making it; wait for them.
+            flight->_done.wait();
+            output = flight->_result.get();
+            return output.valid();
+        }
+
+        // make it.
+        Ptr value = create();
+        unsigned long long bytes = value.valid() && _budget->_max > 0 ? computeBytes(value.get()) : 0;
+
+        {
+            Threading::ScopedWriteLock exclusive( shard._mutex );
+
+            if ( value.valid() )
+            {
+                if ( shard._entries.size() >= _maxPerShard )
+                    evictOldest( shard );
+
+                Entry& e = shard._entries[key];
+                e._value = value.get();
+                e._bytes = bytes;
+                e._stamp = ++_clock;
+                _budget->add( (long long)bytes );
+            }
+
+            shard._inFlight.erase( key );
+        }
+
+        flight->_result = value.get();
+        flight->_done.set();
+
+        output = value.get();
+        return output.valid();
     }
 
-    return output.valid();
+    /** Evicts unreferenced entries, oldest first, until within the budget. */
+    void trim()
+    {
+        if ( !_budget->over() )
+            return;
+
+        // candidates: entries nobody outside the cache is using.
+        std::vector<Candidate> candidates;
+        for(unsigned s=0; s<NUM_SHARDS; ++s)
+        {
+            Threading::ScopedReadLock shared( _shards[s]._mutex );
+            for(typename EntryMap::const_iterator i = _shards[s]._entries.begin(); i != _shards[s]._entries.end(); ++i)
+            {
+                if ( i->second._value->referenceCount() == 1 )
+                    candidates.push_back( Candidate(i->second._stamp, s, i->first) );
+            }
+        }
+
+        std::sort( candidates.begin(), candidates.end() );
+
+        for(unsigned c=0; c<candidates.size() && _budget->over(); ++c)
+        {
+            Shard& shard = _shards[candidates[c]._shard];
+            Threading::ScopedWriteLock exclusive( shard._mutex );
+            typename EntryMap::iterator i = shard._entries.find( candidates[c]._key );
+            if ( i != shard._entries.end() && i->second._value->referenceCount() == 1 )
+            {
+                _budget->add( -(long long)i->second._bytes );
+                shard._entries.erase( i );
+            }
+        }
+    }
+
+    CacheStats getStats() const
+    {
+        unsigned entries = 0, queries = 0, hits = 0;
+        for(unsigned s=0; s<NUM_SHARDS; ++s)
+        {
+            Threading::ScopedReadLock shared( const_cast<Threading::ReadWriteMutex&>(_shards[s]._mutex) );
+            entries += _shards[s]._entries.size();
+            queries += (unsigned)_shards[s]._queries;
+            hits    += (unsigned)_shards[s]._hits;
+        }
+        return CacheStats( entries, _maxPerShard*NUM_SHARDS, queries, queries > 0 ? (float)hits/(float)queries : 0.0f );
+    }
+
+private:
+    struct Entry {
+        Entry() : _bytes(0), _stamp(0) { }
+        Ptr                _value;
+        unsigned long long _bytes;
+        volatile unsigned  _stamp;
+    };
+
+    struct InFlight : public osg::Referenced {
+        Threading::Event _done;
+        Ptr              _result;
+    };
+
+    struct Candidate {
+        Candidate(unsigned stamp, unsigned shard, const std::string& key) : _stamp(stamp), _shard(shard), _key(key) { }
+        bool operator < (const Candidate& rhs) const { return _stamp < rhs._stamp; }
+        unsigned    _stamp;
+        unsigned    _shard;
+        std::string _key;
+    };
+
+    typedef std::map<std::string, Entry>                    EntryMap;
+    typedef std::map<std::string, osg::ref_ptr<InFlight> >  FlightMap;
+
+    struct Shard {
+        EntryMap                  _entries;
+        FlightMap                 _inFlight;
+        OpenThreads::Atomic       _queries;
+        OpenThreads::Atomic       _hits;
+        Threading::ReadWriteMutex _mutex;
+    };
+
+    Shard& shardFor(const std::string& key) {
+        return _shards[ LRUHash<std::string>()(key) % NUM_SHARDS ];
+    }
+
+    // called with the shard's write lock held.
+    void evictOldest(Shard& shard) {
+        typename EntryMap::iterator oldest = shard._entries.begin();
+        for(typename EntryMap::iterator i = shard._entries.begin(); i != shard._entries.end(); ++i)
+            if ( i->second._stamp < oldest->second._stamp )
+                oldest = i;
+        if ( oldest != shard._entries.end() )
+        {
+            _budget->add( -(long long)oldest->second._bytes );
+            shard._entries.erase( oldest );
+        }
+    }
+
+    Shard               _shards[NUM_SHARDS];
+    unsigned            _maxPerShard;
+    Budget*             _budget;
+    OpenThreads::Atomic _clock;
+};
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    struct CreateSkinStateSet {
+        CreateSkinStateSet(SkinResource* skin, const osgDB::Options* dbOptions) : _skin(skin), _dbOptions(dbOptions) { }
+        osg::StateSet* operator()() const { return _skin->createStateSet( _dbOptions ); }
+        SkinResource*         _skin;
+        const osgDB::Options* _dbOptions;
+    };
+
+    struct CreateInstanceNode {
+        CreateInstanceNode(InstanceResource* res, const osgDB::Options* dbOptions) : _res(res), _dbOptions(dbOptions) { }
+        osg::Node* operator()() const { return _res->createNode( _dbOptions ); }
+        InstanceResource*     _res;
+        const osgDB::Options* _dbOptions;
+    };
+}
+
+
+ResourceCache::ResourceCache(const osgDB::Options* dbOptions ) :
+_dbOptions    ( dbOptions )
+{
+    _budget        = new Budget();
+    _skinCache     = new ObjectCache<osg::StateSet>( _budget, 100 );
+    _instanceCache = new ObjectCache<osg::Node>( _budget, 100 );
+}
+
+ResourceCache::~ResourceCache()
+{
+    delete _skinCache;
+    delete _instanceCache;
+    delete _budget;
+}
+
+const CacheStats
+ResourceCache::getSkinStats() const
+{
+    return _skinCache->getStats();
+}
+
+void
+ResourceCache::setMaxBytes(unsigned long long value)
+{
+    {
+        Threading::ScopedMutexLock lock( _budget->_mutex );
+        _budget->_max = value;
+    }
+    trim();
+}
+
+unsigned long long
+ResourceCache::getMaxBytes() const
+{
+    Threading::ScopedMutexLock lock( _budget->_mutex );
+    return _budget->_max;
+}
+
+unsigned long long
+ResourceCache::getNumBytes() const
+{
+    Threading::ScopedMutexLock lock( _budget->_mutex );
+    return _budget->_used;
+}
+
+void
+ResourceCache::trim()
+{
+    // models are the big ones, so give them up first.
+    _instanceCache->trim();
+    _skinCache->trim();
+}
+
+bool
+ResourceCache::getOrCreateStateSet(SkinResource*                skin,
+                                   osg::ref_ptr<osg::StateSet>& output)
+{
+    //std::string key = skin->getConfig().toJSON(false);
+
+    // Note: we use the imageURI as the basis for the caching key since 
+    // it's the only property used by Skin->createStateSet(). If that
+    // changes, we need to address it here. It might be better it SkinResource
+    // were to provide a unique key.
+    std::string key = skin->getUniqueID();
+
+    bool ok = _skinCache->getOrCreate( key, CreateSkinStateSet(skin, _dbOptions.get()), output );
+    trim();
+    return ok;
+}
+
+
+bool
+ResourceCache::getOrCreateInstanceNode(InstanceResource*        res,
+                                       osg::ref_ptr<osg::Node>& output)
+{
+    std::string key = res->getConfig().toJSON(false);
+
+    bool ok = _instanceCache->getOrCreate( key, CreateInstanceNode(res, _dbOptions.get()), output );
+    trim();
+    return ok;
 }
 
 bool
 ResourceCache::cloneOrCreateInstanceNode(InstanceResource*        res,
-                                         osg::ref_ptr<osg::Node>& output)
+                                         osg::ref_ptr<osg::Node>& output,
+                                         const osg::CopyOp&       copyop)
 {
     output = 0L;
     std::string key = res->getConfig().toJSON(false);
 
-    // exclusive lock (since it's an LRU)
-    {
-        Threading::ScopedMutexLock exclusive( _instanceMutex );
+    bool sharesArrays = (copyop.getCopyFlags() & osg::CopyOp::DEEP_COPY_ARRAYS) == 0;
 
-        // double check to avoid race condition
-        InstanceCache::Record rec;
-        if ( _instanceCache.get(key, rec) && rec.value().valid() )
-        {
-            output = osg::clone(rec.value().get(), osg::CopyOp::DEEP_COPY_ALL);
-        }
-        else
+    osg::ref_ptr<osg::Node> master;
+    if ( _instanceCache->getOrCreate( key, CreateInstanceNode(res, _dbOptions.get()), master ) )
+    {
+        // set up the shared arrays before copying. Once done the setters are
+        // no-ops, so after the first time this writes nothing.
+        if ( sharesArrays )
         {
-            // still not there, make it.
-            output = res->createNode( _dbOptions.get() );
-            if ( output.valid() )
-            {
-                _instanceCache.insert( key, output.get() );
-                output = osg::clone(output.get(), osg::CopyOp::DEEP_COPY_ALL);
-            }
+            Threading::ScopedMutexLock lock( _vboMutex );
+            ActivateVBOs visitor;
+            master->accept( visitor );
         }
+
+        output = osg::clone(master.get(), copyop);
     }
 
+    master = 0L;
+    trim();
+
     return output.valid();
 }
@@ -0,0 +1,106 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthSymbology/VertexTagTable>
+#include <algorithm>
+
+using namespace osgEarth;
+using namespace osgEarth::Symbology;
+
+namespace
+{
+    struct FirstLess
+    {
+        bool operator()(unsigned vertex, const VertexTagTable::Range& range) const {
+            return vertex < range._first;
+        }
+    };
+}
+
+VertexTagTable*
+VertexTagTable::get(const osg::Geometry* geom)
+{
+    return geom ? dynamic_cast<VertexTagTable*>( const_cast<osg::Referenced*>(geom->getUserData()) ) : 0L;
+}
+
+VertexTagTable*
+VertexTagTable::getOrCreate(osg::Geometry* geom)
+{
+    if ( !geom )
+        return 0L;
+
+    if ( geom->getUserData() == 0L )
+    {
+        VertexTagTable* table = new VertexTagTable();
+        geom->setUserData( table );
+        return table;
+    }
+
+    return get( geom );
+}
+
+void
+VertexTagTable::add(unsigned first, unsigned count, Tag tag)
+{
+    if ( count == 0 )
+        return;
+
+    Range range;
+    range._first = first;
+    range._count = count;
+    range._tag   = tag;
+
+    // the usual case: tagging in vertex order.
+    if ( _ranges.empty() || first >= _ranges.back()._first + _ranges.back()._count )
+    {
+        Range* last = _ranges.empty() ? 0L : &_ranges.back();
+        if ( last && last->_tag == tag && last->_first + last->_count == first )
+            last->_count += count;
+        else
+            _ranges.push_back( range );
+    }
+    else
+    {
+        Ranges::iterator i = std::upper_bound( _ranges.begin(), _ranges.end(), first, FirstLess() );
+        _ranges.insert( i, range );
+    }
+}
+
+bool
+VertexTagTable::getTag(unsigned vertex, Tag& out_tag) const
+{
+    Ranges::const_iterator i = std::upper_bound( _ranges.begin(), _ranges.end(), vertex, FirstLess() );
+    if ( i == _ranges.begin() )
+        return false;
+
+    --i;
+    if ( vertex >= i->_first + i->_count )
+        return false;
+
+    out_tag = i->_tag;
+    return true;
+}
+
+void
+VertexTagTable::append(const VertexTagTable& rhs, unsigned offset)
+{
+    for( Ranges::const_iterator i = rhs._ranges.begin(); i != rhs._ranges.end(); ++i )
+    {
+        add( i->_first + offset, i->_count, i->_tag );
+    }
+}
@@ -0,0 +1,149 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthUtil/BackgroundCompiler>
+#include <osgUtil/IncrementalCompileOperation>
+#include <osgDB/DatabasePager>
+#include <osgViewer/Scene>
+#include <osg/DisplaySettings>
+#include <osg/Timer>
+#include <osgEarth/Notify>
+
+#define LC "[BackgroundCompiler] "
+
+using namespace osgEarth;
+using namespace osgEarth::Util;
+
+
+TileCompileOperation::TileCompileOperation() :
+osgUtil::IncrementalCompileOperation(),
+_compileTimeThisFrame( 0.0 )
+{
+    //nop
+}
+
+void
+TileCompileOperation::getStats( Stats& output ) const
+{
+    Threading::ScopedMutexLock lock( _statsMutex );
+    output = _stats;
+}
+
+void
+TileCompileOperation::operator () (osg::GraphicsContext* context)
+{
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    osgUtil::IncrementalCompileOperation::operator()( context );
+
+    double t = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+    Threading::ScopedMutexLock lock( _statsMutex );
+    _compileTimeThisFrame += t;
+    _stats._compileTime   += t;
+}
+
+void
+TileCompileOperation::mergeCompiledSubgraphs(const osg::FrameStamp* frameStamp)
+{
+    unsigned compiled;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( *getCompiledMutex() );
+        compiled = _compiled.size();
+    }
+    unsigned toCompile;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( *getToCompiledMutex() );
+        toCompile = _toCompile.size();
+    }
+
+    osgUtil::IncrementalCompileOperation::mergeCompiledSubgraphs( frameStamp );
+
+    unsigned remaining;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( *getCompiledMutex() );
+        remaining = _compiled.size();
+    }
+
+    Threading::ScopedMutexLock lock( _statsMutex );
+    _stats._mergedLastFrame      = compiled > remaining ? compiled - remaining : 0;
+    _stats._merged              += _stats._mergedLastFrame;
+    _stats._pending              = toCompile + remaining;
+    _stats._compileTimeLastFrame = _compileTimeThisFrame;
+    _compileTimeThisFrame        = 0.0;
+}
+
+//------------------------------------------------------------------------
+
+TileCompileOperation*
+BackgroundCompiler::install( osgViewer::ViewerBase* viewer, bool useCompileContexts )
+{
+    if ( !viewer )
+        return 0L;
+
+    if ( viewer->isRealized() )
+    {
+        OE_WARN << LC << "Install before the viewer is realized; compile contexts are only created at realize time" << std::endl;
+    }
+
+    // realize() creates one compile context (a pbuffer sharing with the first
+    // window's context) and graphics thread per context ID.
+    if ( useCompileContexts )
+    {
+        osg::DisplaySettings::instance()->setCompileContextsHint( true );
+    }
+
+    // the incremental compile operation does the actual compiling, on the
+    // compile contexts when they exist and within a per-frame budget on the
+    // draw threads when they don't.
+    if ( !viewer->getIncrementalCompileOperation() )
+    {
+        viewer->setIncrementalCompileOperation( new TileCompileOperation() );
+    }
+
+    // have the pagers hand newly loaded tiles to it before merging them.
+    osgViewer::ViewerBase::Scenes scenes;
+    viewer->getScenes( scenes );
+    for( osgViewer::ViewerBase::Scenes::iterator i = scenes.begin(); i != scenes.end(); ++i )
+    {
+        osgDB::DatabasePager* pager = (*i)->getDatabasePager();
+        if ( pager )
+        {
+            pager->setDoPreCompile( true );
+            pager->setIncrementalCompileOperation( viewer->getIncrementalCompileOperation() );
+        }
+    }
+
+    OE_INFO << LC << (useCompileContexts ? "Background" : "Budgeted")
+        << " GL compilation enabled for " << scenes.size() << " scene(s)" << std::endl;
+
+    return dynamic_cast<TileCompileOperation*>( viewer->getIncrementalCompileOperation() );
+}
+
+
+osg::GraphicsContext::Traits*
+BackgroundCompiler::createSharedTraits(const osg::GraphicsContext::Traits* traits,
+                                       osg::GraphicsContext*               shareWith)
+{
+    osg::GraphicsContext::Traits* result = traits ?
+        new osg::GraphicsContext::Traits( *traits ) :
+        new osg::GraphicsContext::Traits();
+
+    result->sharedContext = shareWith;
+    return result;
+}
@@ -102,6 +102,21 @@ void BrightnessContrastColorFilter::install(osg::StateSet* stateSet) const
     }
 }
 
+bool BrightnessContrastColorFilter::getInlineCode(InlineCode& out) const
+{
+    const std::string& u = m_bc->getName();
+    out.declarations = "uniform vec2 " + u + ";\n";
+    out.identity     = u + " == vec2(1.0)";
+    out.code         = "color.rgb = clamp(((color.rgb - 0.5) * " + u + ".y + 0.5) * " + u + ".x, 0.0, 1.0);\n";
+    return true;
+}
+
+void BrightnessContrastColorFilter::installInline(osg::StateSet* stateSet) const
+{
+    // the chain compiler inlines the code, so all we need is the uniform.
+    stateSet->addUniform(m_bc.get());
+}
+
 //---------------------------------------------------------------------------
 
 OSGEARTH_REGISTER_COLORFILTER( brightness_contrast, osgEarth::Util::BrightnessContrastColorFilter );
@@ -158,6 +158,21 @@ void CMYKColorFilter::install(osg::StateSet* stateSet) const
     }
 }
 
+bool CMYKColorFilter::getInlineCode(InlineCode& out) const
+{
+    const std::string& u = m_cmyk->getName();
+    out.declarations = "uniform vec4 " + u + ";\n";
+    out.identity     = u + " == vec4(0.0)";
+    out.code         = "color.rgb = clamp(color.rgb - " + u + ".xyz - " + u + ".w, 0.0, 1.0);\n";
+    return true;
+}
+
+void CMYKColorFilter::installInline(osg::StateSet* stateSet) const
+{
+    // the chain compiler inlines the code, so all we need is the uniform.
+    stateSet->addUniform(m_cmyk.get());
+}
+
 
 //---------------------------------------------------------------------------
 
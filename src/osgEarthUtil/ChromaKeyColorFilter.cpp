@@ -125,6 +125,24 @@ void ChromaKeyColorFilter::install(osg::StateSet* stateSet) const
     }
 }
 
+bool ChromaKeyColorFilter::getInlineCode(InlineCode& out) const
+{
+    // no identity test: a zero distance still keys out an exact match.
+    out.declarations =
+        "uniform vec3 "  + _color->getName() + ";\n"
+        "uniform float " + _distance->getName() + ";\n";
+    out.code =
+        "if (distance(color.rgb, " + _color->getName() + ") <= " + _distance->getName() + ") color.a = 0.0;\n";
+    return true;
+}
+
+void ChromaKeyColorFilter::installInline(osg::StateSet* stateSet) const
+{
+    // the chain compiler inlines the code, so all we need are the uniforms.
+    stateSet->addUniform(_color.get());
+    stateSet->addUniform(_distance.get());
+}
+
 
 
 //---------------------------------------------------------------------------
@@ -50,8 +50,8 @@ ContourMap::init()
     _unit = -1;
 
     // uniforms we'll need:
-    _xferMin     = new osg::Uniform(osg::Uniform::FLOAT,      "oe_contour_min" );
-    _xferRange   = new osg::Uniform(osg::Uniform::FLOAT,      "oe_contour_range" );
+    _xferScale   = new osg::Uniform(osg::Uniform::FLOAT,      "oe_contour_scale" );
+    _xferBias    = new osg::Uniform(osg::Uniform::FLOAT,      "oe_contour_bias" );
     _xferSampler = new osg::Uniform(osg::Uniform::SAMPLER_1D, "oe_contour_xfer" );
     _opacityUniform = new osg::Uniform(osg::Uniform::FLOAT,   "oe_contour_opacity" );
     _opacityUniform->set( _opacity.getOrUse(1.0f) );
@@ -93,8 +93,19 @@ ContourMap::setTransferFunction(osg::TransferFunction1D* xfer)
     _xfer = xfer;
 
     _xferTexture->setImage( _xfer->getImage() );
-    _xferMin->set( _xfer->getMinimum() );
-    _xferRange->set( _xfer->getMaximum() - _xfer->getMinimum() );
+    updateTransferUniforms();
+}
+
+
+void
+ContourMap::updateTransferUniforms()
+{
+    // precompute the height-to-lookup transform, so the shader does a
+    // multiply-add instead of a divide at every vertex.
+    float range = _xfer->getMaximum() - _xfer->getMinimum();
+    float scale = range > 0.0f ? 1.0f/range : 0.0f;
+    _xferScale->set( scale );
+    _xferBias->set( -_xfer->getMinimum() * scale );
 }
 
 
@@ -133,12 +144,10 @@ ContourMap::onInstall(TerrainEngineNode* engine)
         pkg.loadFunction(vp, pkg.ContourMap_Vertex);
         pkg.loadFunction(vp, pkg.ContourMap_Fragment);
 
-        // Install some uniforms that tell the shader the height range of the color map.
-        stateset->addUniform( _xferMin.get() );
-        _xferMin->set( _xfer->getMinimum() );
-
-        stateset->addUniform( _xferRange.get() );
-        _xferRange->set( _xfer->getMaximum() - _xfer->getMinimum() );
+        // Install some uniforms that map the height range of the color map to [0..1].
+        stateset->addUniform( _xferScale.get() );
+        stateset->addUniform( _xferBias.get() );
+        updateTransferUniforms();
 
         stateset->addUniform( _opacityUniform.get() );
     }
@@ -153,8 +162,8 @@ ContourMap::onUninstall(TerrainEngineNode* engine)
         osg::StateSet* stateset = engine->getStateSet();
         if ( stateset )
         {
-            stateset->removeUniform( _xferMin.get() );
-            stateset->removeUniform( _xferRange.get() );
+            stateset->removeUniform( _xferScale.get() );
+            stateset->removeUniform( _xferBias.get() );
             stateset->removeUniform( _xferSampler.get() );
             stateset->removeUniform( _opacityUniform.get() );
 
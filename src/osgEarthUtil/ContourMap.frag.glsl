@@ -11,6 +11,9 @@ varying float oe_contour_lookup;
 
 void oe_contour_fragment( inout vec4 color )
 {
+    if ( oe_contour_opacity <= 0.0 )
+        return;
+
     vec4 texel = texture1D( oe_contour_xfer, oe_contour_lookup );
     color.rgb = mix(color.rgb, texel.rgb, texel.a * oe_contour_opacity);
 }
\ No newline at end of file
@@ -6,13 +6,12 @@ $GLSL_DEFAULT_PRECISION_FLOAT
 #pragma vp_order      "0.5"
 
 attribute vec4 oe_terrain_attr;
-uniform float oe_contour_min;
-uniform float oe_contour_range;
+uniform float oe_contour_scale;   // 1/(max-min) of the transfer function
+uniform float oe_contour_bias;    // -min/(max-min) of the transfer function
 varying float oe_contour_lookup;
 
 void oe_contour_vertex(inout vec4 VertexModel)
 {
     float height = oe_terrain_attr[3];
-    float height_normalized = (height-oe_contour_min)/oe_contour_range;
-    oe_contour_lookup = clamp( height_normalized, 0.0, 1.0 );
+    oe_contour_lookup = clamp( height*oe_contour_scale + oe_contour_bias, 0.0, 1.0 );
 }
\ No newline at end of file
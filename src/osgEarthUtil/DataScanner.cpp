@@ -17,9 +17,20 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include <osgEarthUtil/DataScanner>
+#include <osgEarthUtil/TileIndex>
 #include <osgEarthDrivers/gdal/GDALOptions>
+#include <osgEarthDrivers/tileindex/TileIndexOptions>
+#include <osgEarth/FileUtils>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
+#include <osg/Math>
+#include <OpenThreads/Thread>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <map>
 
 #define LC "[DataScanner] "
 
@@ -31,7 +42,7 @@ namespace
 {
     void traverse(const std::string&              path,
                   const std::vector<std::string>& extensions,
-                  ImageLayerVector&               out_imageLayers)
+                  std::vector<std::string>&       out_files)
     {
         if ( osgDB::fileType(path) == osgDB::DIRECTORY )
         {
@@ -42,7 +53,7 @@ namespace
                     continue;
 
                 std::string filepath = osgDB::concatPaths( path, *f );
-                traverse( filepath, extensions, out_imageLayers );
+                traverse( filepath, extensions, out_files );
             }
         }
 
@@ -52,26 +63,275 @@ namespace
 
             if ( std::find(extensions.begin(), extensions.end(), ext) != extensions.end() )
             {
-                GDALOptions gdal;
-                gdal.url() = path;
-                //gdal.interpolation() = INTERP_NEAREST;
+                out_files.push_back( path );
+            }
+        }
+    }
+
+    // What the manifest remembers about one raster.
+    struct ManifestEntry
+    {
+        ManifestEntry() : mtime(0), valid(false), xmin(0.0), ymin(0.0), xmax(0.0), ymax(0.0) { }
+
+        TimeStamp   mtime;
+        bool        valid;      // false if the raster could not be opened
+        std::string srs;        // WKT
+        double      xmin, ymin, xmax, ymax;
+    };
+
+    typedef std::map<std::string, ManifestEntry> Manifest;
+
+    void readManifest(const std::string& location, Manifest& out)
+    {
+        std::ifstream in( location.c_str() );
+        if ( !in.is_open() )
+            return;
+
+        std::stringstream buf;
+        buf << in.rdbuf();
+
+        Config conf;
+        if ( !conf.fromJSON(buf.str()) )
+        {
+            OE_WARN << LC << "Ignoring unreadable manifest " << location << std::endl;
+            return;
+        }
 
-                ImageLayerOptions options( path, gdal );
-                options.cachePolicy() = CachePolicy::NO_CACHE;
+        ConfigSet files = conf.children("file");
+        for( ConfigSet::const_iterator i = files.begin(); i != files.end(); ++i )
+        {
+            ManifestEntry& e = out[i->value("path")];
+            e.mtime = i->value<TimeStamp>("mtime", 0);
+            e.valid = i->value<bool>("valid", false);
+            e.srs   = i->value("srs");
+            e.xmin  = i->value<double>("xmin", 0.0);
+            e.ymin  = i->value<double>("ymin", 0.0);
+            e.xmax  = i->value<double>("xmax", 0.0);
+            e.ymax  = i->value<double>("ymax", 0.0);
+        }
+    }
 
-                ImageLayer* layer = new ImageLayer(options);
-                out_imageLayers.push_back( layer );
-                OE_INFO << LC << "Found " << path << std::endl;
+    void writeManifest(const std::string& location, const Manifest& manifest)
+    {
+        Config conf("manifest");
+        for( Manifest::const_iterator i = manifest.begin(); i != manifest.end(); ++i )
+        {
+            const ManifestEntry& e = i->second;
+            Config file("file");
+            file.add( "path",  i->first );
+            file.add( "mtime", e.mtime );
+            file.add( "valid", e.valid );
+            if ( e.valid )
+            {
+                file.add( "srs",  e.srs );
+                file.add( "xmin", e.xmin );
+                file.add( "ymin", e.ymin );
+                file.add( "xmax", e.xmax );
+                file.add( "ymax", e.ymax );
             }
+            conf.add( file );
+        }
+
+        makeDirectoryForFile( location );
+        std::ofstream out( location.c_str() );
+        if ( out.is_open() )
+            out << conf.toJSON(true);
+        else
+            OE_WARN << LC << "Failed to write manifest " << location << std::endl;
+    }
+
+    // Opens one raster and records its extent; run in parallel.
+    struct OpenRaster
+    {
+        void execute()
+        {
+            GDALOptions gdal;
+            gdal.url() = _path;
+
+            ImageLayerOptions options( "", gdal );
+            options.cachePolicy() = CachePolicy::NO_CACHE;
+
+            osg::ref_ptr<ImageLayer> layer = new ImageLayer( options );
+            TileSource* source = layer->getTileSource();
+            if ( source && source->getProfile() )
+            {
+                GeoExtent extent = source->getDataExtentsUnion();
+                if ( !extent.isValid() )
+                    extent = source->getProfile()->getExtent();
+
+                if ( extent.isValid() )
+                {
+                    _entry->valid = true;
+                    _entry->srs   = extent.getSRS()->getWKT();
+                    _entry->xmin  = extent.xMin();
+                    _entry->ymin  = extent.yMin();
+                    _entry->xmax  = extent.xMax();
+                    _entry->ymax  = extent.yMax();
+                }
+            }
+
+            if ( !_entry->valid )
+            {
+                OE_WARN << LC << "Skipping " << _path << "; failed to open" << std::endl;
+            }
+        }
+
+        std::string    _path;
+        ManifestEntry* _entry;
+    };
+
+    bool writeIndex(const std::string& indexPath, const Manifest& manifest)
+    {
+        // OGR won't create a shapefile on top of an existing one.
+        const char* parts[] = { ".shp", ".shx", ".dbf", ".prj" };
+        std::string base = osgDB::getNameLessExtension( indexPath );
+        for( unsigned i = 0; i < 4; ++i )
+            ::remove( (base + parts[i]).c_str() );
+
+        makeDirectoryForFile( indexPath );
+        osg::ref_ptr<TileIndex> index = TileIndex::create( indexPath, SpatialReference::create("wgs84") );
+        if ( !index.valid() )
+            return false;
+
+        // Locations are relative to the index, like the ones TileIndexBuilder writes.
+        std::string indexDir = osgDB::getFilePath( indexPath );
+
+        for( Manifest::const_iterator i = manifest.begin(); i != manifest.end(); ++i )
+        {
+            const ManifestEntry& e = i->second;
+            if ( !e.valid )
+                continue;
+
+            osg::ref_ptr<const SpatialReference> srs = SpatialReference::create( e.srs );
+            if ( !srs.valid() )
+                continue;
+
+            index->add(
+                osgDB::getPathRelative( indexDir, i->first ),
+                GeoExtent(srs.get(), e.xmin, e.ymin, e.xmax, e.ymax) );
         }
+
+        return true;
     }
 }
 
 
+DataScanner::DataScanner() :
+_numThreads( osg::clampBetween(OpenThreads::GetNumberOfProcessors(), 1, 16) )
+{
+    //nop
+}
+
 void
 DataScanner::findImageLayers(const std::string&              absRootPath,
                              const std::vector<std::string>& extensions,
                              ImageLayerVector&               out_imageLayers) const
 {
-    traverse( absRootPath, extensions, out_imageLayers );
+    std::vector<std::string> files;
+    traverse( absRootPath, extensions, files );
+
+    for( std::vector<std::string>::const_iterator path = files.begin(); path != files.end(); ++path )
+    {
+        GDALOptions gdal;
+        gdal.url() = *path;
+        //gdal.interpolation() = INTERP_NEAREST;
+
+        ImageLayerOptions options( *path, gdal );
+        options.cachePolicy() = CachePolicy::NO_CACHE;
+
+        ImageLayer* layer = new ImageLayer(options);
+        out_imageLayers.push_back( layer );
+        OE_INFO << LC << "Found " << *path << std::endl;
+    }
+}
+
+ImageLayer*
+DataScanner::createImageLayer(const std::string&              absRootPath,
+                              const std::vector<std::string>& extensions,
+                              const std::string&              indexPath,
+                              const std::string&              layerName) const
+{
+    std::vector<std::string> files;
+    traverse( absRootPath, extensions, files );
+
+    Manifest previous;
+    if ( !_manifest.empty() )
+        readManifest( _manifest, previous );
+
+    // Reuse what the manifest knows about any raster that hasn't been touched
+    // since the last scan; everything else has to be opened.
+    Manifest current;
+    std::vector<std::string> toOpen;
+    for( std::vector<std::string>::const_iterator path = files.begin(); path != files.end(); ++path )
+    {
+        TimeStamp mtime = getLastModifiedTime( *path );
+        ManifestEntry& e = current[*path];
+
+        Manifest::const_iterator p = previous.find( *path );
+        if ( p != previous.end() && p->second.mtime == mtime )
+        {
+            e = p->second;
+        }
+        else
+        {
+            e.mtime = mtime;
+            toOpen.push_back( *path );
+        }
+    }
+
+    // Every current raster was found in the old manifest unless it's in toOpen,
+    // so equal sizes mean nothing was removed either.
+    bool changed = !toOpen.empty() || current.size() != previous.size();
+
+    if ( !toOpen.empty() )
+    {
+        OE_INFO << LC << "Opening " << toOpen.size() << " new or changed rasters (of "
+            << files.size() << ")..." << std::endl;
+
+        unsigned numThreads = osg::clampBetween( _numThreads, 1u, (unsigned)toOpen.size() );
+        osg::ref_ptr<TaskService> service = new TaskService( "DataScanner", numThreads );
+
+        Threading::MultiEvent semaphore( (int)toOpen.size() );
+        for( unsigned i = 0; i < toOpen.size(); ++i )
+        {
+            ParallelTask<OpenRaster>* task = new ParallelTask<OpenRaster>( &semaphore );
+            task->_path  = toOpen[i];
+            task->_entry = &current[toOpen[i]];
+            service->add( task );
+        }
+        semaphore.wait();
+    }
+
+    if ( changed && !_manifest.empty() )
+        writeManifest( _manifest, current );
+
+    unsigned numValid = 0;
+    for( Manifest::const_iterator i = current.begin(); i != current.end(); ++i )
+        if ( i->second.valid )
+            ++numValid;
+
+    if ( numValid == 0 )
+    {
+        OE_INFO << LC << "No usable rasters found in " << absRootPath << std::endl;
+        return 0L;
+    }
+
+    if ( changed || osgDB::fileType(indexPath) != osgDB::REGULAR_FILE )
+    {
+        if ( !writeIndex(indexPath, current) )
+        {
+            OE_WARN << LC << "Failed to write tile index " << indexPath << std::endl;
+            return 0L;
+        }
+    }
+
+    OE_INFO << LC << "Indexed " << numValid << " rasters in " << indexPath << std::endl;
+
+    TileIndexOptions tileIndex;
+    tileIndex.url() = indexPath;
+
+    ImageLayerOptions options( layerName.empty() ? absRootPath : layerName, tileIndex );
+    options.cachePolicy() = CachePolicy::NO_CACHE;
+
+    return new ImageLayer( options );
 }
@@ -0,0 +1,293 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthUtil/ElevationAnalysis>
+#include <osgEarth/ElevationQuery>
+#include <osgEarth/GeoMath>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <OpenThreads/Thread>
+#include <cmath>
+
+#define LC "[ElevationAnalysis] "
+
+using namespace osgEarth;
+using namespace osgEarth::Util;
+
+namespace
+{
+    // approximate length of one degree at the equator, in meters.
+    const double METERS_PER_DEGREE = 111319.49;
+
+    // lines are never split into more samples than this when the
+    // resolution is automatic.
+    const double AUTO_NUM_SAMPLES = 1024.0;
+
+    // converts a resolution in meters to the map SRS units expected
+    // by the ElevationQuery.
+    double toMapUnits(const SpatialReference* srs, double meters)
+    {
+        return srs->isGeographic() ? meters / METERS_PER_DEGREE : meters;
+    }
+
+    double stepFor(double resolution, double length)
+    {
+        return resolution > 0.0 ? resolution : osg::maximum(1.0, length / AUTO_NUM_SAMPLES);
+    }
+
+    // expresses a point in the map SRS with an absolute altitude.
+    bool toAbsolute(ElevationQuery&         eq,
+                    const GeoPoint&         input,
+                    const SpatialReference* mapSRS,
+                    double                  desiredRes,
+                    GeoPoint&               output)
+    {
+        if ( !input.isValid() || !input.transform(mapSRS, output) )
+            return false;
+
+        if ( output.altitudeMode() == ALTMODE_RELATIVE )
+        {
+            double h;
+            if ( eq.getElevation(output, h, desiredRes) )
+                output.z() += h;
+            output.altitudeMode() = ALTMODE_ABSOLUTE;
+        }
+        return true;
+    }
+
+    // steps along the straight line between the endpoints and compares
+    // the height of each sample with the terrain beneath it.
+    bool computeLOS(const Map*                         map,
+                    ElevationQuery&                    eq,
+                    double                             resolution,
+                    ElevationAnalysis::LineOfSight&    q)
+    {
+        q._valid   = false;
+        q._visible = false;
+        q._hit     = GeoPoint::INVALID;
+
+        const SpatialReference* mapSRS = map->getProfile()->getSRS();
+        double desiredRes = resolution > 0.0 ? toMapUnits(mapSRS, resolution) : 0.0;
+
+        GeoPoint start, end;
+        if ( !toAbsolute(eq, q._start, mapSRS, desiredRes, start) ||
+             !toAbsolute(eq, q._end,   mapSRS, desiredRes, end) )
+        {
+            return false;
+        }
+
+        osg::Vec3d startWorld, endWorld;
+        if ( !start.toWorld(startWorld) || !end.toWorld(endWorld) )
+            return false;
+
+        osg::Vec3d delta  = endWorld - startWorld;
+        double     length = delta.length();
+        unsigned   n      = osg::maximum( 2u, (unsigned)ceil(length / stepFor(resolution, length)) );
+
+        std::vector<osg::Vec3d> points;
+        std::vector<double>     heights;
+        points.reserve( n-1 );
+        heights.reserve( n-1 );
+
+        for( unsigned i = 1; i < n; ++i )
+        {
+            GeoPoint sample;
+            if ( sample.fromWorld(mapSRS, startWorld + delta * ((double)i/(double)n)) )
+            {
+                points.push_back( osg::Vec3d(sample.x(), sample.y(), 0.0) );
+                heights.push_back( sample.z() );
+            }
+        }
+
+        std::vector<double> elevations;
+        std::vector<bool>   valid;
+        eq.getElevations( points, mapSRS, elevations, valid, desiredRes );
+
+        q._valid   = true;
+        q._visible = true;
+
+        for( unsigned i = 0; i < points.size(); ++i )
+        {
+            if ( valid[i] && elevations[i] > heights[i] )
+            {
+                q._visible = false;
+                q._hit     = GeoPoint(mapSRS, points[i].x(), points[i].y(), elevations[i], ALTMODE_ABSOLUTE);
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    // computes a contiguous range of queries on one thread.
+    struct ComputeLOSRange
+    {
+        void execute()
+        {
+            ElevationQuery eq( _map );
+            eq.setNumBulkQueryThreads( 1 );
+            for( unsigned i = _first; i < _last; ++i )
+                computeLOS( _map, eq, _resolution, (*_queries)[i] );
+        }
+
+        const Map*                                   _map;
+        double                                       _resolution;
+        std::vector<ElevationAnalysis::LineOfSight>* _queries;
+        unsigned                                     _first, _last;
+    };
+}
+
+//------------------------------------------------------------------------
+
+ElevationAnalysis::ElevationAnalysis(const Map* map, double resolution) :
+_map       ( map ),
+_resolution( resolution )
+{
+    //nop
+}
+
+bool
+ElevationAnalysis::computeLineOfSight(LineOfSight& query) const
+{
+    if ( !_map.valid() )
+        return false;
+
+    ElevationQuery eq( _map.get() );
+    eq.setNumBulkQueryThreads( 1 );
+    return computeLOS( _map.get(), eq, _resolution, query );
+}
+
+void
+ElevationAnalysis::computeLinesOfSight(std::vector<LineOfSight>& queries, unsigned numThreads) const
+{
+    if ( !_map.valid() || queries.empty() )
+        return;
+
+    if ( numThreads == 0 )
+        numThreads = OpenThreads::GetNumberOfProcessors();
+
+    numThreads = osg::clampBetween( numThreads, 1u, (unsigned)queries.size() );
+
+    if ( numThreads == 1 )
+    {
+        ComputeLOSRange range;
+        range._map        = _map.get();
+        range._resolution = _resolution;
+        range._queries    = &queries;
+        range._first      = 0;
+        range._last       = queries.size();
+        range.execute();
+        return;
+    }
+
+    osg::ref_ptr<TaskService> service = new TaskService( "Elevation analysis", numThreads );
+    Threading::MultiEvent semaphore( (int)numThreads );
+
+    unsigned perTask = (queries.size() + numThreads - 1) / numThreads;
+    unsigned numTasks = 0;
+    for( unsigned first = 0; first < queries.size(); first += perTask )
+    {
+        ParallelTask<ComputeLOSRange>* task = new ParallelTask<ComputeLOSRange>( &semaphore );
+        task->_map        = _map.get();
+        task->_resolution = _resolution;
+        task->_queries    = &queries;
+        task->_first      = first;
+        task->_last       = osg::minimum( first + perTask, (unsigned)queries.size() );
+        service->add( task );
+        ++numTasks;
+    }
+
+    // rounding can leave fewer ranges than threads.
+    for( ; numTasks < numThreads; ++numTasks )
+        semaphore.notify();
+
+    semaphore.wait();
+}
+
+bool
+ElevationAnalysis::computeProfile(const GeoPoint& start, const GeoPoint& end, TerrainProfile& out_profile) const
+{
+    out_profile.clear();
+
+    if ( !_map.valid() || !start.isValid() || !end.isValid() )
+        return false;
+
+    const SpatialReference* mapSRS = _map->getProfile()->getSRS();
+    double desiredRes = _resolution > 0.0 ? toMapUnits(mapSRS, _resolution) : 0.0;
+
+    GeoPoint p1, p2;
+    if ( !start.transform(mapSRS, p1) || !end.transform(mapSRS, p2) )
+        return false;
+
+    // geographic maps follow the great circle; projected maps the straight line.
+    double length;
+    if ( mapSRS->isGeographic() )
+    {
+        length = GeoMath::distance(
+            osg::DegreesToRadians(p1.y()), osg::DegreesToRadians(p1.x()),
+            osg::DegreesToRadians(p2.y()), osg::DegreesToRadians(p2.x()) );
+    }
+    else
+    {
+        length = (p2.vec3d() - p1.vec3d()).length();
+    }
+
+    unsigned n = osg::maximum( 1u, (unsigned)ceil(length / stepFor(_resolution, length)) );
+
+    std::vector<osg::Vec3d> points;
+    points.reserve( n+1 );
+    for( unsigned i = 0; i <= n; ++i )
+    {
+        double t = (double)i / (double)n;
+        if ( mapSRS->isGeographic() )
+        {
+            double lat, lon;
+            GeoMath::interpolate(
+                osg::DegreesToRadians(p1.y()), osg::DegreesToRadians(p1.x()),
+                osg::DegreesToRadians(p2.y()), osg::DegreesToRadians(p2.x()),
+                t, lat, lon );
+            points.push_back( osg::Vec3d(osg::RadiansToDegrees(lon), osg::RadiansToDegrees(lat), 0.0) );
+        }
+        else
+        {
+            osg::Vec3d p = p1.vec3d() + (p2.vec3d() - p1.vec3d()) * t;
+            points.push_back( osg::Vec3d(p.x(), p.y(), 0.0) );
+        }
+    }
+
+    ElevationQuery eq( _map.get() );
+    eq.setNumBulkQueryThreads( 1 );
+
+    std::vector<double> elevations;
+    std::vector<bool>   valid;
+    eq.getElevations( points, mapSRS, elevations, valid, desiredRes );
+
+    bool found = false;
+    for( unsigned i = 0; i <= n; ++i )
+    {
+        if ( valid[i] )
+        {
+            out_profile.addElevation( length * (double)i / (double)n, elevations[i] );
+            found = true;
+        }
+    }
+
+    OE_DEBUG << LC << "Profile of " << length << " m sampled at " << (n+1) << " points" << std::endl;
+
+    return found;
+}
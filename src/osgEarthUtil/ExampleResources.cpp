@@ -28,7 +28,9 @@
 #include <osgEarthUtil/Ocean>
 #include <osgEarthUtil/Shadowing>
 #include <osgEarthUtil/ActivityMonitorTool>
+#include <osgEarthUtil/FrameStatsTool>
 #include <osgEarthUtil/LogarithmicDepthBuffer>
+#include <osgEarthUtil/BackgroundCompiler>
 
 #include <osgEarthUtil/LODBlending>
 #include <osgEarthUtil/VerticalScale>
@@ -464,10 +466,14 @@ MapNodeHelper::parse(MapNode*             mapNode,
     bool useShadows    = args.read("--shadows");
     bool animateSky    = args.read("--animate-sky");
     bool showActivity  = args.read("--activity");
+    bool showFrameStats= args.read("--frame-stats");
     bool useLogDepth   = args.read("--logdepth");
     bool useLogDepth2  = args.read("--logdepth2");
+    bool useReversedZ  = args.read("--reversedz");
     bool kmlUI         = args.read("--kmlui");
     bool inspect       = args.read("--inspect");
+    bool compileThread = args.read("--compile-thread");
+    bool precompile    = args.read("--precompile");
 
     if (args.read("--verbose"))
         osgEarth::setNotifyLevel(osg::INFO);
@@ -486,7 +492,21 @@ MapNodeHelper::parse(MapNode*             mapNode,
 
     std::string imageExtensions;
     args.read("--image-extensions", imageExtensions);
+
+    std::string imageIndex;
+    args.read("--image-index", imageIndex);
     
+    // upload paged tiles on a background compile context, or before merging
+    // within a per-frame budget:
+    if ( compileThread || precompile )
+    {
+        osgViewer::ViewerBase* viewer = dynamic_cast<osgViewer::ViewerBase*>( view );
+        if ( viewer )
+            BackgroundCompiler::install( viewer, compileThread );
+        else
+            OE_WARN << LC << "--compile-thread and --precompile require a viewer" << std::endl;
+    }
+
     // animation path:
     std::string animpath;
     if ( args.read("--path", animpath) )
@@ -683,6 +703,17 @@ MapNodeHelper::parse(MapNode*             mapNode,
         canvas->addControl( vbox );
     }
 
+    // per-frame subsystem timings (debugging)
+    if ( showFrameStats )
+    {
+        VBox* vbox = new VBox();
+        vbox->setBackColor( Color(Color::Black, 0.8) );
+        vbox->setHorizAlign( Control::ALIGN_LEFT );
+        vbox->setVertAlign( Control::ALIGN_BOTTOM );
+        view->addEventHandler( new FrameStatsTool(vbox) );
+        canvas->addControl( vbox );
+    }
+
     // Install an auto clip plane clamper
     if ( useAutoClip )
     {
@@ -706,6 +737,14 @@ MapNodeHelper::parse(MapNode*             mapNode,
         logDepth.install( view->getCamera() );
     }
 
+    else if ( useReversedZ )
+    {
+        OE_INFO << LC << "Activating reversed-Z depth buffer on main camera" << std::endl;
+        osgEarth::Util::LogarithmicDepthBuffer logDepth;
+        logDepth.setUseReversedZ( true );
+        logDepth.install( view->getCamera() );
+    }
+
     // Scan for images if necessary.
     if ( !imageFolder.empty() )
     {
@@ -718,7 +757,18 @@ MapNodeHelper::parse(MapNode*             mapNode,
         OE_INFO << LC << "Loading images from " << imageFolder << "..." << std::endl;
         ImageLayerVector imageLayers;
         DataScanner scanner;
-        scanner.findImageLayers( imageFolder, extensions, imageLayers );
+        if ( !imageIndex.empty() )
+        {
+            // one tile-indexed layer for the whole folder; rescans only reopen changed files.
+            scanner.setManifest( osgDB::getNameLessExtension(imageIndex) + ".manifest.json" );
+            osg::ref_ptr<ImageLayer> layer = scanner.createImageLayer( imageFolder, extensions, imageIndex );
+            if ( layer.valid() )
+                imageLayers.push_back( layer.get() );
+        }
+        else
+        {
+            scanner.findImageLayers( imageFolder, extensions, imageLayers );
+        }
 
         if ( imageLayers.size() > 0 )
         {
@@ -832,10 +882,14 @@ MapNodeHelper::usage() const
         << "  --mgrs                        : show MGRS coords under mouse\n"
         << "  --ortho                       : use an orthographic camera\n"
         << "  --logdepth                    : activates the logarithmic depth buffer\n"
+        << "  --reversedz                   : activates the reversed-Z depth buffer\n"
         << "  --autoclip                    : installs an auto-clip plane callback\n"
         << "  --images [path]               : finds and loads image layers from folder [path]\n"
         << "  --image-extensions [ext,...]  : with --images, extensions to use\n"
         << "  --out-earth [file]            : write the loaded map to an earth file\n"
         << "  --uniform [name] [min] [max]  : create a uniform controller with min/max values\n"
-        << "  --path [file]                 : load and playback an animation path\n";
+        << "  --path [file]                 : load and playback an animation path\n"
+        << "  --compile-thread              : upload tiles on a background compile context\n"
+        << "  --precompile                  : upload tiles before merging, within a frame budget\n"
+        << "  --frame-stats                 : show per-frame cull, GPU, pager and fetch timings\n";
 }
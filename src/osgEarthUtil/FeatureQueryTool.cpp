@@ -57,12 +57,101 @@ FeatureQueryTool::setMapNode( MapNode* mapNode )
     _mapNode = mapNode;
 }
 
+namespace
+{
+    // holds the latest GPU pick result until the tool dispatches it.
+    struct GPUPickResult : public RTTPicker::Callback
+    {
+        GPUPickResult() : _ready(false), _pickID(0u) { }
+        void onHit(unsigned pickID) { _ready = true; _pickID = pickID; }
+        void onMiss()               { _ready = true; _pickID = 0u; }
+        bool     _ready;
+        unsigned _pickID;
+    };
+}
+
+void
+FeatureQueryTool::setGPUPicking( bool value )
+{
+    if ( value && !_rttPicker.valid() )
+    {
+        _rttPicker   = new RTTPicker();
+        _rttCallback = new GPUPickResult();
+    }
+    else if ( !value )
+    {
+        _rttPicker   = 0L;
+        _rttCallback = 0L;
+    }
+}
+
+void
+FeatureQueryTool::fireHit( FeatureSourceIndexNode* index, FeatureID fid, const Callback::EventArgs& args )
+{
+    OE_DEBUG << LC << "HIT: feature ID = " << (unsigned)fid << std::endl;
+
+    for( Callbacks::iterator i = _callbacks.begin(); i != _callbacks.end(); )
+    {
+        if ( i->valid() )
+        {
+            i->get()->onHit( index, fid, args );
+            ++i;
+        }
+        else
+        {
+            i = _callbacks.erase( i );
+        }
+    }
+}
+
+void
+FeatureQueryTool::fireMiss( const Callback::EventArgs& args )
+{
+    OE_DEBUG << LC << "miss" << std::endl;
+
+    for( Callbacks::iterator i = _callbacks.begin(); i != _callbacks.end(); )
+    {
+        if ( i->valid() )
+        {
+            i->get()->onMiss( args );
+            ++i;
+        }
+        else
+        {
+            i = _callbacks.erase( i );
+        }
+    }
+}
+
 bool
 FeatureQueryTool::handle( const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdapter& aa )
 {
     bool handled = false;
     bool attempt;
 
+    if ( _rttPicker.valid() )
+    {
+        // deliver any GPU pick that finished since the last event.
+        _rttPicker->handle( ea, aa );
+
+        GPUPickResult* result = static_cast<GPUPickResult*>( _rttCallback.get() );
+        if ( result->_ready )
+        {
+            result->_ready = false;
+
+            Callback::EventArgs args;
+            args._ea = &ea;
+            args._aa = &aa;
+
+            osg::ref_ptr<FeatureSourceIndexNode> index;
+            FeatureID                            fid;
+            if ( FeatureSourceIndexNode::getFeatureByPickID(result->_pickID, index, fid) )
+                fireHit( index.get(), fid, args );
+            else
+                fireMiss( args );
+        }
+    }
+
     if ( _inputPredicate.valid() )
     {
         attempt = _inputPredicate->accept(ea);
@@ -76,7 +165,14 @@ FeatureQueryTool::handle( const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdap
             fabs(ea.getY()-_mouseDownY) <= 3.0;
     }
 
-    if ( attempt && getMapNode() )
+    if ( attempt && getMapNode() && _rttPicker.valid() )
+    {
+        // answered from a later frame event.
+        _rttPicker->pick( dynamic_cast<osgViewer::View*>(aa.asView()), ea.getX(), ea.getY(), _rttCallback.get() );
+        _mouseDown = false;
+    }
+
+    else if ( attempt && getMapNode() )
     {
         osg::View* view = aa.asView();
 
@@ -114,25 +210,12 @@ FeatureQueryTool::handle( const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdap
 
             if ( closestIndex )
             {
-                OE_DEBUG << LC << "HIT: feature ID = " << (unsigned)closestFID << std::endl;
-
                 Callback::EventArgs args;
                 args._ea = &ea;
                 args._aa = &aa;
                 args._worldPoint = closestWorldPt;
 
-                for( Callbacks::iterator i = _callbacks.begin(); i != _callbacks.end(); )
-                {
-                    if ( i->valid() )
-                    {
-                        i->get()->onHit( closestIndex, closestFID, args );
-                        ++i;
-                    }
-                    else
-                    {
-                        i = _callbacks.erase( i );
-                    }
-                }
+                fireHit( closestIndex, closestFID, args );
 
                 handled = true;
             }
@@ -140,24 +223,11 @@ FeatureQueryTool::handle( const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdap
 
         if ( !handled )
         {
-            OE_DEBUG << LC << "miss" << std::endl;
-
             Callback::EventArgs args;
             args._ea = &ea;
             args._aa = &aa;
 
-            for( Callbacks::iterator i = _callbacks.begin(); i != _callbacks.end(); )
-            {
-                if ( i->valid() )
-                {
-                    i->get()->onMiss( args );
-                    ++i;
-                }
-                else
-                {
-                    i = _callbacks.erase( i );
-                }
-            }
+            fireMiss( args );
         }
 
         _mouseDown = false;
@@ -0,0 +1,177 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarthUtil/FrameStatsTool>
+#include <osgEarth/StringUtils>
+#include <osgViewer/View>
+#include <osgDB/DatabasePager>
+#include <iomanip>
+
+using namespace osgEarth;
+using namespace osgEarth::Util;
+using namespace osgEarth::Util::Controls;
+
+namespace
+{
+    const float FONT_SIZE = 14.0f;
+
+    void addRow(Grid* grid, unsigned& row, const std::string& name, const std::string& value)
+    {
+        grid->setControl( 0, row, new LabelControl(name,  FONT_SIZE) );
+        grid->setControl( 1, row, new LabelControl(value, FONT_SIZE) );
+        ++row;
+    }
+
+    void addHeader(Grid* grid, unsigned& row, const std::string& name)
+    {
+        grid->setControl( 0, row++, new LabelControl(name, FONT_SIZE, osg::Vec4f(1,1,0,1)) );
+    }
+}
+
+//-----------------------------------------------------------------------
+
+FrameStatsTool::Averages::Averages() :
+_frames        ( 0u ),
+_pagerRequests ( 0u ),
+_pagerToCompile( 0u ),
+_pagerToMerge  ( 0u )
+{
+    for( unsigned i = 0; i < FrameStats::NUM_CULL_STAGES; ++i )
+        _cull_ms[i] = 0.0;
+    for( unsigned i = 0; i < FrameStats::NUM_GPU_STAGES; ++i )
+    {
+        _gpu_ms[i]   = 0.0;
+        _gpuValid[i] = false;
+    }
+}
+
+//-----------------------------------------------------------------------
+
+FrameStatsTool::FrameStatsTool(VBox* vbox) :
+_vbox       ( vbox ),
+_interval   ( 0.5 ),
+_lastRefresh( 0.0 )
+{
+    FrameStats::setEnabled( true );
+}
+
+FrameStatsTool::~FrameStatsTool()
+{
+    FrameStats::setEnabled( false );
+}
+
+bool
+FrameStatsTool::handle(const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdapter& aa)
+{
+    if (ea.getEventType() == ea.FRAME)
+    {
+        FrameStats::Sample sample;
+        FrameStats::collect( sample );
+
+        _sum._frames++;
+        for( unsigned i = 0; i < FrameStats::NUM_CULL_STAGES; ++i )
+            _sum._cull_ms[i] += sample._cull_ms[i];
+
+        for( unsigned i = 0; i < FrameStats::NUM_GPU_STAGES; ++i )
+        {
+            _sum._gpu_ms[i]   += sample._gpu_ms[i];
+            _sum._gpuValid[i] |= sample._gpuValid[i];
+        }
+
+        for( FrameStats::Fetches::const_iterator f = sample._fetches.begin(); f != sample._fetches.end(); ++f )
+        {
+            FrameStats::Fetch& sum = _sum._fetches[f->first];
+            sum._count   += f->second._count;
+            sum._total_s += f->second._total_s;
+            sum._max_s    = osg::maximum( sum._max_s, f->second._max_s );
+        }
+
+        // queue depths are levels, not totals; keep the latest.
+        osgViewer::View* view = dynamic_cast<osgViewer::View*>( aa.asView() );
+        osgDB::DatabasePager* pager = view ? view->getDatabasePager() : 0L;
+        if ( pager )
+        {
+            _sum._pagerRequests  = pager->getFileRequestListSize();
+            _sum._pagerToCompile = pager->getDataToCompileListSize();
+            _sum._pagerToMerge   = pager->getDataToMergeListSize();
+        }
+
+        if ( ea.getTime() - _lastRefresh >= _interval )
+        {
+            double frames = (double)osg::maximum( _sum._frames, 1u );
+            for( unsigned i = 0; i < FrameStats::NUM_CULL_STAGES; ++i )
+                _sum._cull_ms[i] /= frames;
+            for( unsigned i = 0; i < FrameStats::NUM_GPU_STAGES; ++i )
+                _sum._gpu_ms[i] /= frames;
+
+            _last = _sum;
+            _sum  = Averages();
+            _lastRefresh = ea.getTime();
+            refresh();
+        }
+    }
+
+    return false;
+}
+
+void
+FrameStatsTool::refresh()
+{
+    osg::ref_ptr<VBox> vbox;
+    if ( !_vbox.lock(vbox) )
+        return;
+
+    vbox->clearControls();
+    Grid* grid = vbox->addControl( new Grid() );
+    grid->setChildSpacing( 5 );
+
+    unsigned row = 0u;
+    addHeader( grid, row, "Cull (ms/frame)" );
+    for( unsigned i = 0; i < FrameStats::NUM_CULL_STAGES; ++i )
+    {
+        addRow( grid, row, FrameStats::getName((FrameStats::CullStage)i),
+            Stringify() << std::fixed << std::setprecision(2) << _last._cull_ms[i] );
+    }
+
+    addHeader( grid, row, "GPU (ms/frame)" );
+    for( unsigned i = 0; i < FrameStats::NUM_GPU_STAGES; ++i )
+    {
+        addRow( grid, row, FrameStats::getName((FrameStats::GPUStage)i),
+            _last._gpuValid[i] ? (std::string)(Stringify() << std::fixed << std::setprecision(2) << _last._gpu_ms[i]) : "-" );
+    }
+
+    addHeader( grid, row, "Pager queues" );
+    addRow( grid, row, "Requests",   Stringify() << _last._pagerRequests );
+    addRow( grid, row, "To compile", Stringify() << _last._pagerToCompile );
+    addRow( grid, row, "To merge",   Stringify() << _last._pagerToMerge );
+
+    if ( !_last._fetches.empty() )
+    {
+        addHeader( grid, row, "Fetch (avg/max ms, count)" );
+        for( FrameStats::Fetches::const_iterator f = _last._fetches.begin(); f != _last._fetches.end(); ++f )
+        {
+            const FrameStats::Fetch& fetch = f->second;
+            addRow( grid, row, f->first, Stringify()
+                << std::fixed << std::setprecision(1)
+                << (fetch._count > 0u ? 1000.0 * fetch._total_s / (double)fetch._count : 0.0) << " / "
+                << 1000.0 * fetch._max_s << "  ("
+                << fetch._count << ")" );
+        }
+    }
+}
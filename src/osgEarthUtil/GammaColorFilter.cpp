@@ -106,6 +106,21 @@ void GammaColorFilter::install(osg::StateSet* stateSet) const
     }
 }
 
+bool GammaColorFilter::getInlineCode(InlineCode& out) const
+{
+    const std::string& u = m_gamma->getName();
+    out.declarations = "uniform vec3 " + u + ";\n";
+    out.identity     = u + " == vec3(1.0)";
+    out.code         = "color.rgb = pow(color.rgb, 1.0 / " + u + ");\n";
+    return true;
+}
+
+void GammaColorFilter::installInline(osg::StateSet* stateSet) const
+{
+    // the chain compiler inlines the code, so all we need is the uniform.
+    stateSet->addUniform(m_gamma.get());
+}
+
 
 //---------------------------------------------------------------------------
 
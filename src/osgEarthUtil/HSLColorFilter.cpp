@@ -234,6 +234,42 @@ HSLColorFilter::install( osg::StateSet* stateSet ) const
     }
 }
 
+
+bool
+HSLColorFilter::getInlineCode( InlineCode& out ) const
+{
+    // consecutive HSL filters share a single conversion to and from HSL space.
+    const std::string& u = _hsl->getName();
+    out.declarations =
+        "void oe_hsl_RGB_2_HSL(in float r, in float g, in float b, out float h, out float s, out float l);\n"
+        "void oe_hsl_HSL_2_RGB(in float h, in float s, in float l, out float r, out float g, out float b);\n"
+        "uniform vec3 " + u + ";\n";
+    out.identity   = u + " == vec3(0.0)";
+    out.code       = "hsl = clamp(hsl + " + u + ", 0.0, 1.0);\n";
+    out.space      = "hsl";
+    out.enterSpace =
+        "vec3 hsl;\n"
+        "oe_hsl_RGB_2_HSL(color.r, color.g, color.b, hsl.x, hsl.y, hsl.z);\n";
+    out.leaveSpace =
+        "oe_hsl_HSL_2_RGB(hsl.x, hsl.y, hsl.z, color.r, color.g, color.b);\n";
+    return true;
+}
+
+
+void
+HSLColorFilter::installInline( osg::StateSet* stateSet ) const
+{
+    // safe: won't add twice.
+    stateSet->addUniform( _hsl.get() );
+
+    // the conversion functions are still needed; the per-instance entry point isn't.
+    VirtualProgram* vp = dynamic_cast<VirtualProgram*>(stateSet->getAttribute(VirtualProgram::SA_TYPE));
+    if ( vp )
+    {
+        vp->setShader( "osgEarthUtil::HSLColorFilter_common", s_commonShader.get() );
+    }
+}
+
 //---------------------------------------------------------------------------
 
 OSGEARTH_REGISTER_COLORFILTER( hsl, osgEarth::Util::HSLColorFilter );
@@ -24,7 +24,11 @@
 #include <osgEarth/Capabilities>
 #include <osgEarth/ShaderUtils>
 #include <osgUtil/CullVisitor>
+#include <osgUtil/StateGraph>
 #include <osg/Uniform>
+#include <osg/Depth>
+#include <osg/Geode>
+#include <osg/GLExtensions>
 #include <osg/buffered_value>
 #include <cmath>
 
@@ -38,6 +42,20 @@
 #define C_UNIFORM  "oe_logDepth_C"
 #define FC_UNIFORM "oe_logDepth_FC"
 
+// GL_ARB_clip_control / GL_ARB_depth_buffer_float tokens
+#ifndef GL_LOWER_LEFT
+#define GL_LOWER_LEFT 0x8CA1
+#endif
+#ifndef GL_NEGATIVE_ONE_TO_ONE
+#define GL_NEGATIVE_ONE_TO_ONE 0x935E
+#endif
+#ifndef GL_ZERO_TO_ONE
+#define GL_ZERO_TO_ONE 0x935F
+#endif
+#ifndef GL_DEPTH_COMPONENT32F
+#define GL_DEPTH_COMPONENT32F 0x8CAC
+#endif
+
 using namespace osgEarth;
 using namespace osgEarth::Util;
 
@@ -104,13 +122,213 @@ namespace
         // context-specific stateset collection
         osg::buffered_value<osg::ref_ptr<osg::StateSet> > _stateSets;
     };
+
+    //..................................................................
+
+    // Attribute type for ClipControl; clear of OSG's built-in types.
+    const osg::StateAttribute::Type CLIP_CONTROL_TYPE = (osg::StateAttribute::Type)0x4F45434C;
+
+    /**
+     * Sets the clip-space depth range through glClipControl. The default
+     * instance restores GL's [-1..1] convention, so OSG resets it when
+     * leaving a stateset that carries the [0..1] version.
+     */
+    class ClipControl : public osg::StateAttribute
+    {
+        typedef void (GL_APIENTRY * ClipControlProc)(GLenum origin, GLenum depth);
+
+    public:
+        ClipControl(GLenum depthMode =GL_NEGATIVE_ONE_TO_ONE) :
+            _depthMode( depthMode ) { }
+
+        ClipControl(const ClipControl& rhs, const osg::CopyOp& copyop =osg::CopyOp::SHALLOW_COPY) :
+            osg::StateAttribute( rhs, copyop ),
+            _depthMode         ( rhs._depthMode ) { }
+
+        META_StateAttribute(osgEarth, ClipControl, CLIP_CONTROL_TYPE);
+
+        virtual int compare(const osg::StateAttribute& sa) const
+        {
+            COMPARE_StateAttribute_Types(ClipControl, sa);
+            COMPARE_StateAttribute_Parameter(_depthMode);
+            return 0;
+        }
+
+        virtual void apply(osg::State& state) const
+        {
+            ClipControlProc& proc = _procs[state.getContextID()];
+            if ( !proc )
+                osg::setGLExtensionFuncPtr( proc, "glClipControl" );
+            if ( proc )
+                proc( GL_LOWER_LEFT, _depthMode );
+        }
+
+    protected:
+        virtual ~ClipControl() { }
+
+        GLenum _depthMode;
+        mutable osg::buffered_value<ClipControlProc> _procs;
+    };
+
+    /** Marks a depth attribute that has been flipped for reversed-Z. */
+    struct ReversedDepthTag : public osg::Referenced { };
+
+    /**
+     * Mirrors a depth attribute across the depth range: the comparison
+     * changes direction and the window range maps [a..b] to [1-b..1-a]
+     * (so a sky pinned to the far plane at 1 lands on 0). Flipping twice
+     * restores the original.
+     */
+    void flipDepth(osg::Depth* depth)
+    {
+        switch( depth->getFunction() )
+        {
+        case osg::Depth::LESS:    depth->setFunction(osg::Depth::GREATER); break;
+        case osg::Depth::LEQUAL:  depth->setFunction(osg::Depth::GEQUAL);  break;
+        case osg::Depth::GREATER: depth->setFunction(osg::Depth::LESS);    break;
+        case osg::Depth::GEQUAL:  depth->setFunction(osg::Depth::LEQUAL);  break;
+        default: break;
+        }
+        depth->setRange( 1.0 - depth->getZFar(), 1.0 - depth->getZNear() );
+    }
+
+    /** Flips the stateset's depth attribute for reversed-Z, once. */
+    void reverseDepth(const osg::StateSet* stateset)
+    {
+        if ( stateset )
+        {
+            osg::Depth* depth = dynamic_cast<osg::Depth*>(
+                const_cast<osg::StateAttribute*>(stateset->getAttribute(osg::StateAttribute::DEPTH)) );
+
+            if ( depth && !dynamic_cast<ReversedDepthTag*>(depth->getUserData()) )
+            {
+                flipDepth( depth );
+                depth->setUserData( new ReversedDepthTag() );
+            }
+        }
+    }
+
+    /** Undoes reverseDepth on the stateset's depth attribute. */
+    void restoreDepth(osg::StateSet* stateset)
+    {
+        if ( stateset )
+        {
+            osg::Depth* depth = dynamic_cast<osg::Depth*>(
+                stateset->getAttribute(osg::StateAttribute::DEPTH) );
+
+            if ( depth && dynamic_cast<ReversedDepthTag*>(depth->getUserData()) )
+            {
+                flipDepth( depth );
+                depth->setUserData( 0L );
+            }
+        }
+    }
+
+    /**
+     * Reverses every depth attribute that made it into the render graph.
+     * Running this right after cull catches paged-in and newly created
+     * geometry before it is drawn for the first time.
+     */
+    void reverseDepths(osgUtil::StateGraph* sg)
+    {
+        const osg::StateSet* stateset = sg->_stateset;
+        reverseDepth( stateset );
+
+        for( osgUtil::StateGraph::ChildList::iterator i = sg->_children.begin(); i != sg->_children.end(); ++i )
+        {
+            reverseDepths( i->second.get() );
+        }
+    }
+
+    /** Restores the depth attributes in a subgraph after reversed-Z is removed. */
+    struct RestoreDepthVisitor : public osg::NodeVisitor
+    {
+        RestoreDepthVisitor() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) { }
+
+        void apply(osg::Node& node)
+        {
+            restoreDepth( node.getStateSet() );
+            traverse( node );
+        }
+
+        void apply(osg::Geode& geode)
+        {
+            restoreDepth( geode.getStateSet() );
+            for( unsigned i = 0; i < geode.getNumDrawables(); ++i )
+            {
+                restoreDepth( geode.getDrawable(i)->getStateSet() );
+            }
+        }
+    };
+
+    /**
+     * Replaces the projection used for drawing with a reversed one: depth
+     * runs from 1 at the near plane to 0 at infinity (perspective) or at
+     * the far plane (orthographic), in [0..1] clip-space depth.
+     */
+    osg::Matrixd reverseProjection(const osg::Matrixd& proj)
+    {
+        double L, R, B, T, N, F;
+        if ( proj.getFrustum(L, R, B, T, N, F) )
+        {
+            // keep the field of view, but move the near plane in:
+            double s = DEFAULT_NEAR_PLANE / N;
+            L *= s; R *= s; B *= s; T *= s;
+            N = DEFAULT_NEAR_PLANE;
+            return osg::Matrixd(
+                2.0*N/(R-L),     0.0,             0.0,  0.0,
+                0.0,             2.0*N/(T-B),     0.0,  0.0,
+                (R+L)/(R-L),     (T+B)/(T-B),     0.0, -1.0,
+                0.0,             0.0,             N,    0.0 );
+        }
+        else if ( proj.getOrtho(L, R, B, T, N, F) )
+        {
+            return osg::Matrixd(
+                2.0/(R-L),       0.0,             0.0,        0.0,
+                0.0,             2.0/(T-B),       0.0,        0.0,
+                0.0,             0.0,             1.0/(F-N),  0.0,
+               -(R+L)/(R-L),    -(T+B)/(T-B),     F/(F-N),    1.0 );
+        }
+        return proj;
+    }
+
+    struct ReversedZCullCallback : public osg::NodeCallback
+    {
+        void operator()(osg::Node* node, osg::NodeVisitor* nv)
+        {
+            osgUtil::CullVisitor* cv = Culling::asCullVisitor(nv);
+            osg::RefMatrix* proj = cv->getProjectionMatrix();
+            if ( cv->getCurrentCamera() && proj )
+            {
+                osgUtil::StateGraph* sg = cv->getCurrentStateGraph();
+
+                cv->pushProjectionMatrix( new osg::RefMatrix(reverseProjection(*proj)) );
+                traverse(node, nv);
+                cv->popProjectionMatrix();
+
+                if ( sg )
+                    reverseDepths( sg );
+            }
+            else
+            {
+                traverse(node, nv);
+            }
+        }
+    };
 }
 
 //------------------------------------------------------------------------
 
 LogarithmicDepthBuffer::LogarithmicDepthBuffer() :
-_useFragDepth(true)
+_useFragDepth(true),
+_useReversedZ(false)
 {
+    _supportsReversedZ = Registry::capabilities().supportsClipControl();
+    if ( _supportsReversedZ )
+    {
+        _reversedZCullCallback = new ReversedZCullCallback();
+    }
+
     _supported = Registry::capabilities().supportsGLSL();
     if ( _supported )
     {
@@ -128,9 +346,26 @@ LogarithmicDepthBuffer::setUseFragDepth(bool value)
     _useFragDepth = value;
 }
 
+void
+LogarithmicDepthBuffer::setUseReversedZ(bool value)
+{
+    _useReversedZ = value;
+}
+
 void
 LogarithmicDepthBuffer::install(osg::Camera* camera)
 {
+    if ( camera && _useReversedZ )
+    {
+        if ( _supportsReversedZ )
+        {
+            installReversedZ( camera );
+            return;
+        }
+        OE_WARN << LC << "Reversed-Z not supported on this platform (no GL_ARB_clip_control); "
+            << "using the logarithmic shaders instead" << std::endl;
+    }
+
     if ( camera && _supported )
     {
         // install the shader component:
@@ -162,9 +397,59 @@ LogarithmicDepthBuffer::install(osg::Camera* camera)
     }
 }
 
+void
+LogarithmicDepthBuffer::installReversedZ(osg::Camera* camera)
+{
+    osg::StateSet* stateset = camera->getOrCreateStateSet();
+
+    // [0..1] clip-space depth, so the reversed projection keeps float precision:
+    stateset->setAttribute( new ClipControl(GL_ZERO_TO_ONE) );
+
+    // near is 1 and far is 0, so flip the camera's depth test and clear to the far end:
+    if ( !stateset->getAttribute(osg::StateAttribute::DEPTH) )
+        stateset->setAttributeAndModes( new osg::Depth(osg::Depth::LESS) );
+    reverseDepth( stateset );
+    camera->setClearDepth( 0.0 );
+
+    // a float depth buffer is what makes the reversed range pay off:
+    if ( camera->getRenderTargetImplementation() == osg::Camera::FRAME_BUFFER_OBJECT &&
+         camera->getBufferAttachmentMap().find(osg::Camera::DEPTH_BUFFER) == camera->getBufferAttachmentMap().end() &&
+         camera->getBufferAttachmentMap().find(osg::Camera::PACKED_DEPTH_STENCIL_BUFFER) == camera->getBufferAttachmentMap().end() )
+    {
+        camera->attach( osg::Camera::DEPTH_BUFFER, GL_DEPTH_COMPONENT32F );
+    }
+
+    // the far plane is at infinity, so there's nothing to compute:
+    camera->setComputeNearFarMode(osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR);
+
+    // install a cull callback to reverse the projection and the scene's depth tests:
+    camera->addCullCallback( _reversedZCullCallback.get() );
+}
+
+void
+LogarithmicDepthBuffer::uninstallReversedZ(osg::Camera* camera)
+{
+    camera->removeCullCallback( _reversedZCullCallback.get() );
+
+    osg::StateSet* stateset = camera->getStateSet();
+    if ( stateset && stateset->getAttribute(CLIP_CONTROL_TYPE) )
+    {
+        stateset->removeAttribute( CLIP_CONTROL_TYPE );
+        camera->setClearDepth( 1.0 );
+
+        RestoreDepthVisitor restore;
+        camera->accept( restore );
+    }
+}
+
 void
 LogarithmicDepthBuffer::uninstall(osg::Camera* camera)
 {
+    if ( camera && _supportsReversedZ )
+    {
+        uninstallReversedZ( camera );
+    }
+
     if ( camera && _supported )
     {
         camera->removeCullCallback( _cullCallback.get() );
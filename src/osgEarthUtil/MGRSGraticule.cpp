@@ -18,6 +18,7 @@
  */
 #include <osgEarthUtil/MGRSGraticule>
 #include <osgEarthUtil/MGRSFormatter>
+#include <osgEarthUtil/Shaders>
 
 #include <osgEarthFeatures/GeometryCompiler>
 #include <osgEarthFeatures/TextSymbolizer>
@@ -25,6 +26,9 @@
 #include <osgEarth/ECEF>
 #include <osgEarth/DepthOffset>
 #include <osgEarth/Registry>
+#include <osgEarth/Cache>
+#include <osgEarth/VirtualProgram>
+#include <osgEarth/TerrainEngineNode>
 
 #include <osg/BlendFunc>
 #include <osg/PagedLOD>
@@ -44,10 +48,17 @@ using namespace osgEarth::Symbology;
 
 #define MGRS_GRATICULE_EXTENSION "osgearthutil_mgrs_graticule"
 
+#define MGRS_GRATICULE_CACHE_BIN "mgrs_graticule"
+
+// bump this when the SQID tile geometry changes, to orphan old cache records
+#define MGRS_GRATICULE_CACHE_VERSION 1
+
 //---------------------------------------------------------------------------
 
 MGRSGraticuleOptions::MGRSGraticuleOptions( const Config& conf ) :
-UTMGraticuleOptions( conf )
+UTMGraticuleOptions( conf ),
+_useCache          ( true ),
+_fineGrid          ( true )
 {
     mergeConfig( _conf );
 }
@@ -55,6 +66,8 @@ UTMGraticuleOptions( conf )
 void
 MGRSGraticuleOptions::mergeConfig( const Config& conf )
 {
+    conf.getIfSet( "use_cache", _useCache );
+    conf.getIfSet( "fine_grid", _fineGrid );
     //todo
 }
 
@@ -63,12 +76,77 @@ MGRSGraticuleOptions::getConfig() const
 {
     Config conf = UTMGraticuleOptions::newConfig();
     conf.key() = "mgrs_graticule";
+    conf.addIfSet( "use_cache", _useCache );
+    conf.addIfSet( "fine_grid", _fineGrid );
     //todo
     return conf;
 }
 
 //---------------------------------------------------------------------------
 
+MGRSFineGrid::MGRSFineGrid()
+{
+    _colorUniform = new osg::Uniform(osg::Uniform::FLOAT_VEC4, "oe_mgrs_grid_color");
+    _colorUniform->set( osg::Vec4f(1.0f, 1.0f, 1.0f, 0.5f) );
+
+    _widthUniform = new osg::Uniform(osg::Uniform::FLOAT, "oe_mgrs_grid_width");
+    _widthUniform->set( 1.0f );
+}
+
+void
+MGRSFineGrid::setColor(const osg::Vec4f& color)
+{
+    _colorUniform->set( color );
+}
+
+void
+MGRSFineGrid::setLineWidth(float value)
+{
+    _widthUniform->set( osg::maximum(value, 0.0f) );
+}
+
+void
+MGRSFineGrid::onInstall(TerrainEngineNode* engine)
+{
+    if ( engine )
+    {
+        osg::StateSet* stateset = engine->getOrCreateStateSet();
+
+        VirtualProgram* vp = VirtualProgram::getOrCreate(stateset);
+
+        Shaders pkg;
+        pkg.loadFunction(vp, pkg.MGRSGraticule_Vertex);
+        pkg.loadFunction(vp, pkg.MGRSGraticule_Fragment);
+
+        stateset->addUniform( _colorUniform.get() );
+        stateset->addUniform( _widthUniform.get() );
+    }
+}
+
+void
+MGRSFineGrid::onUninstall(TerrainEngineNode* engine)
+{
+    if ( engine )
+    {
+        osg::StateSet* stateset = engine->getStateSet();
+        if ( stateset )
+        {
+            stateset->removeUniform( _colorUniform.get() );
+            stateset->removeUniform( _widthUniform.get() );
+
+            VirtualProgram* vp = VirtualProgram::get(stateset);
+            if ( vp )
+            {
+                Shaders pkg;
+                pkg.unloadFunction(vp, pkg.MGRSGraticule_Vertex);
+                pkg.unloadFunction(vp, pkg.MGRSGraticule_Fragment);
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+
 
 MGRSGraticule::MGRSGraticule( MapNode* mapNode ) :
 UTMGraticule( 0L )
@@ -90,13 +168,118 @@ UTMGraticule( 0L )
 
 //    _minDepthOffset = DepthOffsetUtils::createMinOffsetUniform();
 //    _minDepthOffset->set( 11000.0f );
+
+    setupCache();
+    installFineGrid();
 }
 
 MGRSGraticule::MGRSGraticule( MapNode* mapNode, const MGRSGraticuleOptions& options ) :
 UTMGraticule( 0L, options )
 {
     _mapNode = mapNode;
+    _options = options;
     init();
+
+    setupCache();
+    installFineGrid();
+}
+
+MGRSGraticule::~MGRSGraticule()
+{
+    uninstallFineGrid();
+}
+
+void
+MGRSGraticule::setOptions( const MGRSGraticuleOptions& options )
+{
+    _options = options;
+    UTMGraticule::setOptions( options );
+
+    setupCache();
+    installFineGrid();
+}
+
+void
+MGRSGraticule::setMapNode( MapNode* mapNode )
+{
+    UTMGraticule::setMapNode( mapNode );
+
+    setupCache();
+    installFineGrid();
+}
+
+void
+MGRSGraticule::setupCache()
+{
+    _cacheBin = 0L;
+
+    if ( !getMapNode() || _options->useCache() == false )
+        return;
+
+    Cache* cache = getMapNode()->getMap()->getCache();
+    if ( !cache )
+        cache = Registry::instance()->getCache();
+    if ( !cache || !cache->isOK() )
+        return;
+
+    optional<CachePolicy> cp;
+    Registry::instance()->resolveCachePolicy( cp );
+    if ( cp.isSet() && !cp->isCacheReadable() )
+        return;
+
+    _cacheBin = cache->getBin( MGRS_GRATICULE_CACHE_BIN );
+    if ( !_cacheBin.valid() )
+        _cacheBin = cache->addBin( MGRS_GRATICULE_CACHE_BIN );
+
+    // the tiles depend on the symbology, so key the records by it too:
+    std::string styles = Stringify()
+        << MGRS_GRATICULE_CACHE_VERSION
+        << _options->primaryStyle()->getConfig().toJSON()
+        << _options->secondaryStyle()->getConfig().toJSON();
+
+    _cacheKeySuffix = Stringify() << "_" << std::hex << hashString(styles);
+
+    if ( _cacheBin.valid() )
+    {
+        OE_INFO << LC << "Caching SQID tiles in bin \"" << _cacheBin->getID() << "\"" << std::endl;
+    }
+}
+
+void
+MGRSGraticule::installFineGrid()
+{
+    uninstallFineGrid();
+
+    if ( !getMapNode() || _options->fineGrid() == false )
+        return;
+
+    TerrainEngineNode* engine = getMapNode()->getTerrainEngine();
+    if ( !engine )
+        return;
+
+    if ( !_fineGridEffect.valid() )
+        _fineGridEffect = new MGRSFineGrid();
+
+    const LineSymbol* line = _options->secondaryStyle()->get<LineSymbol>();
+    if ( line )
+    {
+        _fineGridEffect->setColor( line->stroke()->color() );
+        _fineGridEffect->setLineWidth( line->stroke()->width().get() );
+    }
+
+    engine->addEffect( _fineGridEffect.get() );
+    _fineGridEngine = engine;
+}
+
+void
+MGRSGraticule::uninstallFineGrid()
+{
+    osg::ref_ptr<TerrainEngineNode> engine = _fineGridEngine.get();
+    if ( engine.valid() && _fineGridEffect.valid() )
+    {
+        engine->removeEffect( _fineGridEffect.get() );
+    }
+    _fineGridEngine = 0L;
 }
 
 osg::Group*
@@ -118,7 +301,52 @@ MGRSGraticule::buildGZDChildren( osg::Group* parent, const std::string& gzd )
 osg::Node*
 MGRSGraticule::buildSQIDTiles( const std::string& gzd )
 {
-    const GeoExtent& extent = _gzd[gzd];
+    osg::ref_ptr<osg::Node> node;
+
+    osg::ref_ptr<CacheBin> bin = _cacheBin.get();
+    std::string key = gzd + _cacheKeySuffix;
+
+    if ( bin.valid() )
+    {
+        ReadResult r = bin->readObject( key );
+        if ( r.succeeded() )
+            node = r.releaseNode();
+    }
+
+    if ( !node.valid() )
+    {
+        node = createSQIDTiles( gzd );
+
+        // The graph has no shaders yet, so it serializes cleanly. Write a copy,
+        // since a write-behind bin may still be serializing it when we go on
+        // to generate shaders below.
+        if ( node.valid() && bin.valid() )
+        {
+            osg::ref_ptr<osg::Node> record = osg::clone( node.get(), osg::CopyOp::DEEP_COPY_ALL );
+            bin->write( key, record.get() );
+        }
+    }
+    else
+    {
+        OE_DEBUG << LC << "Read SQID tiles for " << gzd << " from the cache" << std::endl;
+    }
+
+    if ( node.valid() )
+    {
+        Registry::shaderGenerator().run( node.get(), Registry::stateSetCache() );
+    }
+
+    return node.release();
+}
+
+osg::Node*
+MGRSGraticule::createSQIDTiles( const std::string& gzd )
+{
+    SectorTable::const_iterator gzdEntry = _gzd.find( gzd );
+    if ( gzdEntry == _gzd.end() )
+        return 0L;
+
+    const GeoExtent& extent = gzdEntry->second;
 
     // parse the GZD into its components:
     unsigned zone;
@@ -536,6 +764,9 @@ MGRSGraticule::buildSQIDTiles( const std::string& gzd )
     // make sure we get sufficient tessellation:
     compiler.options().maxGranularity() = 0.25;
 
+    // shaders are generated after the tiles are cached (see buildSQIDTiles)
+    compiler.options().shaderPolicy() = SHADERPOLICY_INHERIT;
+
     osg::Node* geomNode = compiler.compile(features, lineStyle, context);
     if ( geomNode ) 
         group->addChild( geomNode );
@@ -544,8 +775,6 @@ MGRSGraticule::buildSQIDTiles( const std::string& gzd )
     mt->addChild(textGeode);
     group->addChild( mt );
 
-    Registry::shaderGenerator().run(textGeode, Registry::stateSetCache());
-
     // prep for depth offset:
     //DepthOffsetUtils::prepareGraph( group );
     //group->getOrCreateStateSet()->addUniform( _minDepthOffset.get() );
@@ -597,6 +826,9 @@ namespace osgEarth { namespace Util
                     graticule = dynamic_cast<MGRSGraticule*>( i->second.get() );
             }
 
+            if ( !graticule )
+                return ReadResult::ERROR_IN_READING_FILE;
+
             osg::Node* result = graticule->buildSQIDTiles( gzd );
             return result ? ReadResult(result) : ReadResult::ERROR_IN_READING_FILE;
         }
@@ -0,0 +1,95 @@
+#version $GLSL_VERSION_STR
+$GLSL_DEFAULT_PRECISION_FLOAT
+
+#pragma vp_entryPoint "oe_mgrs_grid_fragment"
+#pragma vp_location   "fragment_coloring"
+#pragma vp_order      "1.1"
+
+uniform vec4  oe_mgrs_grid_color;
+uniform float oe_mgrs_grid_width;   // line width in pixels
+varying vec3  oe_mgrs_grid_ecef;
+
+// WGS84
+const float oe_mgrs_A   = 6378137.0;
+const float oe_mgrs_B   = 6356752.3142;
+const float oe_mgrs_E2  = 0.00669438;    // first eccentricity squared
+const float oe_mgrs_EP2 = 0.00673950;    // second eccentricity squared
+const float oe_mgrs_K0  = 0.9996;
+
+// Transverse Mercator easting and northing (in meters) of a latitude and a
+// longitude offset from the zone's central meridian, both in radians. The
+// false easting and northing are left off; they're multiples of every grid
+// spacing, and leaving them off keeps more float precision.
+vec2 oe_mgrs_grid_utm(float lat, float dlon)
+{
+    float s = sin(lat);
+    float c = cos(lat);
+    float t = s/c;
+    float N = oe_mgrs_A / sqrt(1.0 - oe_mgrs_E2*s*s);
+    float T = t*t;
+    float C = oe_mgrs_EP2*c*c;
+    float a = c*dlon;
+    float a2 = a*a;
+
+    float M = oe_mgrs_A * (
+        0.9983242984*lat -
+        0.0025146076*sin(2.0*lat) +
+        0.0000026391*sin(4.0*lat) -
+        0.0000000034*sin(6.0*lat) );
+
+    float e = oe_mgrs_K0*N*a*(1.0 + a2*((1.0-T+C)/6.0 + a2*(5.0-18.0*T+T*T+72.0*C-58.0*oe_mgrs_EP2)/120.0));
+    float n = oe_mgrs_K0*(M + N*t*a2*(0.5 + a2*((5.0-T+9.0*C+4.0*C*C)/24.0 + a2*(61.0-58.0*T+T*T+600.0*C-330.0*oe_mgrs_EP2)/720.0)));
+    return vec2(e, n);
+}
+
+// Coverage of the grid lines with the given spacing at this fragment. Lines
+// fade out as they crowd together on screen, which also hides the jump in
+// coordinates along a zone boundary.
+float oe_mgrs_grid_lines(vec2 en, float spacing)
+{
+    vec2 fw = max(fwidth(en), vec2(0.0001));
+    float pixelsApart = spacing / max(fw.x, fw.y);
+    float fade = smoothstep(8.0, 24.0, pixelsApart);
+
+    vec2 pixels = abs(fract(en/spacing + 0.5) - 0.5) * spacing / fw;
+    float d = min(pixels.x, pixels.y);
+    return fade * (1.0 - smoothstep(0.5*oe_mgrs_grid_width, 0.5*oe_mgrs_grid_width + 1.0, d));
+}
+
+void oe_mgrs_grid_fragment(inout vec4 color)
+{
+    if ( oe_mgrs_grid_color.a <= 0.0 )
+        return;
+
+    // geodetic latitude (Bowring) and longitude:
+    vec3 p = oe_mgrs_grid_ecef;
+    float r = length(p.xy);
+    float theta = atan(p.z*oe_mgrs_A, r*oe_mgrs_B);
+    float st = sin(theta);
+    float ct = cos(theta);
+    float lat = atan(p.z + oe_mgrs_EP2*oe_mgrs_B*st*st*st, r - oe_mgrs_E2*oe_mgrs_A*ct*ct*ct);
+    float lon = atan(p.y, p.x);
+
+    float latDeg = degrees(lat);
+    float lonDeg = degrees(lon);
+
+    // the polar (UPS) zones only have 100km squares.
+    if ( latDeg < -80.0 || latDeg > 84.0 )
+        return;
+
+    // zero-based zone index, with the Norway and Svalbard exceptions:
+    float zone = floor((lonDeg + 180.0)/6.0);
+    if ( latDeg >= 56.0 && latDeg < 64.0 && lonDeg >= 3.0 && lonDeg < 12.0 )
+        zone = 31.0;
+    else if ( latDeg >= 72.0 && lonDeg >= 0.0 && lonDeg < 42.0 )
+        zone = lonDeg < 9.0 ? 30.0 : lonDeg < 21.0 ? 32.0 : lonDeg < 33.0 ? 34.0 : 36.0;
+
+    float lon0 = radians(zone*6.0 - 177.0);
+    vec2 en = oe_mgrs_grid_utm(lat, lon - lon0);
+
+    float coverage = max(
+        oe_mgrs_grid_lines(en, 10000.0),
+        oe_mgrs_grid_lines(en, 1000.0) * 0.6 );
+
+    color.rgb = mix(color.rgb, oe_mgrs_grid_color.rgb, oe_mgrs_grid_color.a * coverage);
+}
@@ -0,0 +1,16 @@
+#version $GLSL_VERSION_STR
+$GLSL_DEFAULT_PRECISION_FLOAT
+
+#pragma vp_entryPoint "oe_mgrs_grid_vertex"
+#pragma vp_location   "vertex_view"
+#pragma vp_order      "0.5"
+
+uniform mat4 osg_ViewMatrixInverse;
+varying vec3 oe_mgrs_grid_ecef;
+
+void oe_mgrs_grid_vertex(inout vec4 vertexVIEW)
+{
+    // ECEF interpolates linearly across the triangle, so the fragment
+    // shader can project it without any seams at zone boundaries.
+    oe_mgrs_grid_ecef = (osg_ViewMatrixInverse * vertexVIEW).xyz;
+}
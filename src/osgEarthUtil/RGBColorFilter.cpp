@@ -101,6 +101,21 @@ void RGBColorFilter::install(osg::StateSet* stateSet) const
     }
 }
 
+bool RGBColorFilter::getInlineCode(InlineCode& out) const
+{
+    const std::string& u = m_rgb->getName();
+    out.declarations = "uniform vec3 " + u + ";\n";
+    out.identity     = u + " == vec3(0.0)";
+    out.code         = "color.rgb = clamp(color.rgb + " + u + ", 0.0, 1.0);\n";
+    return true;
+}
+
+void RGBColorFilter::installInline(osg::StateSet* stateSet) const
+{
+    // the chain compiler inlines the code, so all we need is the uniform.
+    stateSet->addUniform(m_rgb.get());
+}
+
 
 //---------------------------------------------------------------------------
 
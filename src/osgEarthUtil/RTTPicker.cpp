@@ -0,0 +1,375 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthUtil/RTTPicker>
+#include <osgEarthFeatures/FeatureSourceIndexNode>
+#include <osgEarth/VirtualProgram>
+#include <climits>
+#include <osgUtil/CullVisitor>
+#include <osgViewer/ViewerBase>
+#include <osg/BufferObject>
+#include <osg/Version>
+
+#if OSG_MIN_VERSION_REQUIRED(3,3,3)
+#  include <osg/GLExtensions>
+#endif
+
+#define LC "[RTTPicker] "
+
+using namespace osgEarth;
+using namespace osgEarth::Util;
+
+namespace
+{
+#if OSG_MIN_VERSION_REQUIRED(3,3,3)
+    typedef osg::GLExtensions BufferExtensions;
+    BufferExtensions* getBufferExtensions(unsigned contextID) {
+        return osg::GLExtensions::Get( contextID, true );
+    }
+#else
+    typedef osg::GLBufferObject::Extensions BufferExtensions;
+    BufferExtensions* getBufferExtensions(unsigned contextID) {
+        return osg::GLBufferObject::getExtensions( contextID, true );
+    }
+#endif
+
+    const char* pickVertex =
+        "#version " GLSL_VERSION_STR "\n"
+        GLSL_DEFAULT_PRECISION_FLOAT "\n"
+        "attribute float oe_index_pickIDAttr; \n"
+        "uniform float oe_index_pickID; \n"
+        "varying float oe_pick_idv; \n"
+        "void oe_pick_vertex(inout vec4 VertexMODEL) \n"
+        "{ \n"
+        "    oe_pick_idv = oe_index_pickID < 0.0 ? oe_index_pickIDAttr : oe_index_pickID; \n"
+        "} \n";
+
+    // encodes the ID as 24-bit RGB, low byte in red.
+    const char* pickFragment =
+        "#version " GLSL_VERSION_STR "\n"
+        GLSL_DEFAULT_PRECISION_FLOAT "\n"
+        "varying float oe_pick_idv; \n"
+        "void oe_pick_fragment(inout vec4 color) \n"
+        "{ \n"
+        "    float id = floor(oe_pick_idv + 0.5); \n"
+        "    float r = mod(id, 256.0); \n"
+        "    float g = mod(floor(id/256.0), 256.0); \n"
+        "    float b = floor(id/65536.0); \n"
+        "    gl_FragColor = vec4(r, g, b, 255.0)/255.0; \n"
+        "} \n";
+
+    /**
+     * Traverses the scene only for frames that carry a pick request, under
+     * the pick state set.
+     */
+    struct PickCullCallback : public osg::NodeCallback
+    {
+        PickCullCallback(RTTPicker* picker) : _picker(picker) { }
+
+        void operator()(osg::Node* node, osg::NodeVisitor* nv)
+        {
+            osg::ref_ptr<RTTPicker> picker;
+            osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor*>( nv );
+            if ( !cv || !nv->getFrameStamp() || !_picker.lock(picker) )
+                return;
+
+            if ( picker->culled(nv->getFrameStamp()->getFrameNumber()) )
+            {
+                cv->pushStateSet( picker->getPickStateSet() );
+                traverse( node, nv );
+                cv->popStateSet();
+            }
+        }
+
+        osg::observer_ptr<RTTPicker> _picker;
+    };
+
+    /**
+     * Copies the ID buffer into one of two pixel buffer objects and reads the
+     * other one, which the GPU filled a frame earlier. That way the CPU never
+     * waits on the frame it just submitted.
+     */
+    struct PickReadback : public osg::Camera::DrawCallback
+    {
+        PickReadback(RTTPicker* picker, int size) : _picker(picker), _size(size), _count(0u)
+        {
+            _pbo[0] = _pbo[1] = 0;
+            _inUse[0] = _inUse[1] = false;
+        }
+
+        void operator()(osg::RenderInfo& ri) const
+        {
+            osg::ref_ptr<RTTPicker> picker;
+            osg::State* state = ri.getState();
+            if ( !state || !state->getFrameStamp() || !_picker.lock(picker) )
+                return;
+
+            BufferExtensions* ext = getBufferExtensions( state->getContextID() );
+            if ( !ext )
+                return;
+
+            const unsigned bytes = _size*_size*4;
+
+            if ( _pbo[0] == 0 )
+            {
+                ext->glGenBuffers( 2, _pbo );
+                for( unsigned i = 0; i < 2; ++i )
+                {
+                    ext->glBindBuffer( GL_PIXEL_PACK_BUFFER_ARB, _pbo[i] );
+                    ext->glBufferData( GL_PIXEL_PACK_BUFFER_ARB, bytes, 0L, GL_STREAM_READ_ARB );
+                }
+                ext->glBindBuffer( GL_PIXEL_PACK_BUFFER_ARB, 0 );
+            }
+
+            unsigned write = _count % 2u;
+            unsigned read  = (_count + 1u) % 2u;
+            ++_count;
+
+            // start the copy for this frame's request, if there is one.
+            _inUse[write] = picker->takeCulled( state->getFrameStamp()->getFrameNumber(), _requests[write] );
+            if ( _inUse[write] )
+            {
+                state->applyTextureAttribute( 0, picker->getTexture() );
+                ext->glBindBuffer( GL_PIXEL_PACK_BUFFER_ARB, _pbo[write] );
+                glGetTexImage( GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0L );
+                ext->glBindBuffer( GL_PIXEL_PACK_BUFFER_ARB, 0 );
+            }
+
+            // finish the previous frame's request.
+            if ( _inUse[read] )
+            {
+                RTTPicker::Result result;
+                result._request = _requests[read];
+                result._pickID  = 0u;
+
+                ext->glBindBuffer( GL_PIXEL_PACK_BUFFER_ARB, _pbo[read] );
+                const unsigned char* pixels = (const unsigned char*)ext->glMapBuffer( GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB );
+                if ( pixels )
+                {
+                    // nearest hit to the center of the buffer wins.
+                    int c = _size/2, best = INT_MAX;
+                    for( int t = 0; t < _size; ++t )
+                    {
+                        for( int s = 0; s < _size; ++s )
+                        {
+                            unsigned id = RTTPicker::decodePickID( pixels + 4*(t*_size + s) );
+                            int d = (s-c)*(s-c) + (t-c)*(t-c);
+                            if ( id != 0u && d < best )
+                            {
+                                best = d;
+                                result._pickID = id;
+                            }
+                        }
+                    }
+                    ext->glUnmapBuffer( GL_PIXEL_PACK_BUFFER_ARB );
+                }
+                ext->glBindBuffer( GL_PIXEL_PACK_BUFFER_ARB, 0 );
+
+                _inUse[read] = false;
+                _requests[read] = RTTPicker::Request();
+                picker->finished( result );
+            }
+        }
+
+        osg::observer_ptr<RTTPicker>     _picker;
+        int                              _size;
+        mutable unsigned                 _count;
+        mutable GLuint                   _pbo[2];
+        mutable bool                     _inUse[2];
+        mutable RTTPicker::Request       _requests[2];
+    };
+}
+
+//-----------------------------------------------------------------------------
+
+RTTPicker::RTTPicker(int bufferSize) :
+_bufferSize   ( osg::maximum(bufferSize, 1) ),
+_nextRequestID( 1u )
+{
+    //nop
+}
+
+unsigned
+RTTPicker::decodePickID(const unsigned char* rgba)
+{
+    return (unsigned)rgba[0] | ((unsigned)rgba[1] << 8) | ((unsigned)rgba[2] << 16);
+}
+
+bool
+RTTPicker::setup(osgViewer::View* view)
+{
+    if ( !view || !view->getCamera() || !view->getCamera()->getGraphicsContext() )
+    {
+        OE_WARN << LC << "Picking requires a view with a graphics context" << std::endl;
+        return false;
+    }
+
+    _view = view;
+
+    _texture = new osg::Texture2D();
+    _texture->setTextureSize( _bufferSize, _bufferSize );
+    _texture->setInternalFormat( GL_RGBA8 );
+    _texture->setSourceFormat( GL_RGBA );
+    _texture->setSourceType( GL_UNSIGNED_BYTE );
+    _texture->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+    _texture->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
+
+    _camera = new osg::Camera();
+    _camera->setName( "osgEarth::Util::RTTPicker" );
+    _camera->setClearColor( osg::Vec4(0,0,0,0) );
+    _camera->setClearMask( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+    _camera->setViewport( 0, 0, _bufferSize, _bufferSize );
+    _camera->setRenderOrder( osg::Camera::PRE_RENDER );
+    _camera->setRenderTargetImplementation( osg::Camera::FRAME_BUFFER_OBJECT );
+    _camera->setImplicitBufferAttachmentMask( 0, 0 );
+    _camera->attach( osg::Camera::COLOR_BUFFER, _texture.get() );
+    _camera->attach( osg::Camera::DEPTH_BUFFER, GL_DEPTH_COMPONENT24 );
+    _camera->setGraphicsContext( view->getCamera()->getGraphicsContext() );
+    _camera->setCullCallback( new PickCullCallback(this) );
+    _camera->setPostDrawCallback( new PickReadback(this, _bufferSize) );
+
+    _stateSet = new osg::StateSet();
+    _stateSet->setMode( GL_BLEND, osg::StateAttribute::OFF | osg::StateAttribute::OVERRIDE | osg::StateAttribute::PROTECTED );
+    _stateSet->addUniform( new osg::Uniform(Features::FeatureSourceIndexNode::PICK_ID_UNIFORM_NAME, 0.0f) );
+
+    VirtualProgram* vp = VirtualProgram::getOrCreate( _stateSet.get() );
+    vp->setName( "RTTPicker" );
+    vp->addBindAttribLocation( Features::FeatureSourceIndexNode::PICK_ID_ATTRIB_NAME, Features::FeatureSourceIndexNode::PICK_ID_ATTRIB_LOCATION );
+    vp->setFunction( "oe_pick_vertex",   pickVertex,   ShaderComp::LOCATION_VERTEX_MODEL );
+    vp->setFunction( "oe_pick_fragment", pickFragment, ShaderComp::LOCATION_FRAGMENT_OUTPUT );
+
+    // a slave rendering the master's scene, so the picker follows the
+    // view's camera with no extra bookkeeping. Adding a camera requires
+    // the viewer's threads to be restarted.
+    osgViewer::ViewerBase* viewer = view->getViewerBase();
+    bool restart = viewer && viewer->areThreadsRunning();
+    if ( restart )
+        viewer->stopThreading();
+
+    view->addSlave( _camera.get(), osg::Matrix::identity(), osg::Matrix::identity(), true );
+
+    if ( restart )
+        viewer->startThreading();
+
+    return true;
+}
+
+bool
+RTTPicker::pick(osgViewer::View* view, float x, float y, Callback* callback)
+{
+    if ( !view || !callback )
+        return false;
+
+    osg::ref_ptr<osgViewer::View> current;
+    if ( !_camera.valid() )
+    {
+        if ( !setup(view) )
+            return false;
+    }
+    else if ( !_view.lock(current) || current.get() != view )
+    {
+        OE_WARN << LC << "A picker can only serve the view it was first used with" << std::endl;
+        return false;
+    }
+
+    const osg::Viewport* vp = view->getCamera()->getViewport();
+    if ( !vp || vp->width() <= 0.0 || vp->height() <= 0.0 )
+        return false;
+
+    // zoom the master projection in so the ID buffer covers just the
+    // pixels around (x, y).
+    double nx = 2.0*(x - vp->x())/vp->width()  - 1.0;
+    double ny = 2.0*(y - vp->y())/vp->height() - 1.0;
+    osg::Matrix offset =
+        osg::Matrix::translate( -nx, -ny, 0.0 ) *
+        osg::Matrix::scale( vp->width()/(double)_bufferSize, vp->height()/(double)_bufferSize, 1.0 );
+
+    osg::View::Slave* slave = view->findSlaveForCamera( _camera.get() );
+    if ( !slave )
+        return false;
+    slave->_projectionOffset = offset;
+
+    Threading::ScopedMutexLock lock( _mutex );
+    _pending._id       = _nextRequestID++;
+    _pending._callback = callback;
+    return true;
+}
+
+bool
+RTTPicker::culled(unsigned frameNumber)
+{
+    Threading::ScopedMutexLock lock( _mutex );
+
+    // forget requests whose draw never happened (e.g. frames skipped)
+    while( !_culledByFrame.empty() && _culledByFrame.begin()->first + 8u < frameNumber )
+    {
+        _culledByFrame.erase( _culledByFrame.begin() );
+    }
+
+    if ( _pending._id == 0u )
+        return false;
+
+    _culledByFrame[frameNumber] = _pending;
+    _pending = Request();
+    return true;
+}
+
+bool
+RTTPicker::takeCulled(unsigned frameNumber, Request& out_request)
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    std::map<unsigned, Request>::iterator i = _culledByFrame.find( frameNumber );
+    if ( i == _culledByFrame.end() )
+        return false;
+    out_request = i->second;
+    _culledByFrame.erase( i );
+    return true;
+}
+
+void
+RTTPicker::finished(const Result& result)
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    _results.push_back( result );
+}
+
+bool
+RTTPicker::handle(const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdapter& aa)
+{
+    if ( ea.getEventType() == ea.FRAME )
+    {
+        std::vector<Result> results;
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            results.swap( _results );
+        }
+
+        for( std::vector<Result>::const_iterator r = results.begin(); r != results.end(); ++r )
+        {
+            osg::ref_ptr<Callback> callback;
+            if ( r->_request._callback.lock(callback) )
+            {
+                if ( r->_pickID != 0u )
+                    callback->onHit( r->_pickID );
+                else
+                    callback->onMiss();
+            }
+        }
+    }
+    return false;
+}
@@ -18,7 +18,7 @@
 */
 #include <osgEarthUtil/RadialLineOfSight>
 #include <osgEarth/TerrainEngineNode>
-#include <osgEarth/DPLineSegmentIntersector>
+#include <osgEarth/MultiLineSegmentIntersector>
 #include <osgSim/LineOfSight>
 #include <osgUtil/IntersectionVisitor>
 #include <osgUtil/LineSegmentIntersector>
@@ -275,7 +275,9 @@ RadialLineOfSightNode::compute_line(osg::Node* node)
     osg::Vec3d previousEnd;
     osg::Vec3d firstEnd;
 
-    osg::ref_ptr<osgUtil::IntersectorGroup> ivGroup = new osgUtil::IntersectorGroup();
+    // all the spokes go through one traversal.
+    osg::ref_ptr<MultiLineSegmentIntersector> mlsi = new MultiLineSegmentIntersector();
+    mlsi->setIntersectionLimit( osgUtil::Intersector::LIMIT_NEAREST );
 
     for (unsigned int i = 0; i < (unsigned int)_numSpokes; i++)
     {
@@ -283,22 +285,20 @@ RadialLineOfSightNode::compute_line(osg::Node* node)
         osg::Quat quat(angle, up );
         osg::Vec3d spoke = quat * (side * _radius);
         osg::Vec3d end = _centerWorld + spoke;
-        osg::ref_ptr<DPLineSegmentIntersector> dplsi = new DPLineSegmentIntersector( _centerWorld, end );
-        ivGroup->addIntersector( dplsi.get() );
+        mlsi->addSegment( _centerWorld, end );
     }
 
     osgUtil::IntersectionVisitor iv;
-    iv.setIntersector( ivGroup.get() );
+    iv.setIntersector( mlsi.get() );
 
     node->accept( iv );
 
     for (unsigned int i = 0; i < (unsigned int)_numSpokes; i++)
     {
-        DPLineSegmentIntersector* los = dynamic_cast<DPLineSegmentIntersector*>(ivGroup->getIntersectors()[i].get());
-        DPLineSegmentIntersector::Intersections& hits = los->getIntersections();
+        MultiLineSegmentIntersector::Intersections& hits = mlsi->getIntersections(i);
 
-        osg::Vec3d start = los->getStart();
-        osg::Vec3d end = los->getEnd();
+        osg::Vec3d start = mlsi->getStart(i);
+        osg::Vec3d end = mlsi->getEnd(i);
 
         osg::Vec3d hit;
         bool hasLOS = hits.empty();
@@ -415,40 +415,39 @@ RadialLineOfSightNode::compute_fill(osg::Node* node)
     geometry->setColorArray( colors );
     geometry->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
 
-    osg::ref_ptr<osgUtil::IntersectorGroup> ivGroup = new osgUtil::IntersectorGroup();
+    // all the spokes go through one traversal.
+    osg::ref_ptr<MultiLineSegmentIntersector> mlsi = new MultiLineSegmentIntersector();
+    mlsi->setIntersectionLimit( osgUtil::Intersector::LIMIT_NEAREST );
 
     for (unsigned int i = 0; i < (unsigned int)_numSpokes; i++)
     {
         double angle = delta * (double)i;
         osg::Quat quat(angle, up );
         osg::Vec3d spoke = quat * (side * _radius);
-        osg::Vec3d end = _centerWorld + spoke;        
-        osg::ref_ptr<DPLineSegmentIntersector> dplsi = new DPLineSegmentIntersector( _centerWorld, end );
-        ivGroup->addIntersector( dplsi.get() );
+        osg::Vec3d end = _centerWorld + spoke;
+        mlsi->addSegment( _centerWorld, end );
     }
 
     osgUtil::IntersectionVisitor iv;
-    iv.setIntersector( ivGroup.get() );
+    iv.setIntersector( mlsi.get() );
 
     node->accept( iv );
 
     for (unsigned int i = 0; i < (unsigned int)_numSpokes; i++)
     {
         //Get the current hit
-        DPLineSegmentIntersector* los = dynamic_cast<DPLineSegmentIntersector*>(ivGroup->getIntersectors()[i].get());
-        DPLineSegmentIntersector::Intersections& hits = los->getIntersections();
+        MultiLineSegmentIntersector::Intersections& hits = mlsi->getIntersections(i);
 
-        osg::Vec3d currEnd = los->getEnd();
+        osg::Vec3d currEnd = mlsi->getEnd(i);
         bool currHasLOS = hits.empty();
         osg::Vec3d currHit = currHasLOS ? osg::Vec3d() : hits.begin()->getWorldIntersectPoint();
 
         //Get the next hit
         unsigned int nextIndex = i + 1;
         if (nextIndex == _numSpokes) nextIndex = 0;
-        DPLineSegmentIntersector* losNext = static_cast<DPLineSegmentIntersector*>(ivGroup->getIntersectors()[nextIndex].get());
-        DPLineSegmentIntersector::Intersections& hitsNext = losNext->getIntersections();
+        MultiLineSegmentIntersector::Intersections& hitsNext = mlsi->getIntersections(nextIndex);
 
-        osg::Vec3d nextEnd = losNext->getEnd();
+        osg::Vec3d nextEnd = mlsi->getEnd(nextIndex);
         bool nextHasLOS = hitsNext.empty();
         osg::Vec3d nextHit = nextHasLOS ? osg::Vec3d() : hitsNext.begin()->getWorldIntersectPoint();
         
@@ -23,6 +23,7 @@
 #include <osgEarth/Capabilities>
 #include <osg/Texture2D>
 #include <osg/CullFace>
+#include <osg/Math>
 #include <osgShadow/ConvexPolyhedron>
 
 #define LC "[ShadowCaster] "
@@ -30,13 +31,32 @@
 using namespace osgEarth::Util;
 
 
+namespace
+{
+    // this xforms from clip [-1..1] to texture [0..1] space
+    const osg::Matrix& scaleBiasMatrix()
+    {
+        static osg::Matrix s_scaleBiasMat = 
+            osg::Matrix::translate(1.0,1.0,1.0) * 
+            osg::Matrix::scale(0.5,0.5,0.5);
+        return s_scaleBiasMat;
+    }
+}
+
+
 ShadowCaster::ShadowCaster() :
-_size        ( 2048 ),
-_texImageUnit( 7 ),
-_blurFactor  ( 0.002f ),
-_color       ( osg::Vec4f(.4f, .4f, .4f, 1) )
+_size               ( 2048 ),
+_dynamicSize        ( 512 ),
+_texImageUnit       ( 7 ),
+_dynamicTexImageUnit( 6 ),
+_blurFactor         ( 0.002f ),
+_color              ( osg::Vec4f(.4f, .4f, .4f, 1) ),
+_cacheStatic        ( true ),
+_lightThreshold     ( 0.25f ),
+_cacheMargin        ( 0.25f )
 {
     _castingGroup = new osg::Group();
+    _dynamicCastingGroup = new osg::Group();
 
     _supported = Registry::capabilities().supportsGLSL();
     if ( _supported )
@@ -77,6 +97,33 @@ ShadowCaster::setTextureSize(unsigned size)
     reinitialize();
 }
 
+void
+ShadowCaster::setDynamicTextureImageUnit(int unit)
+{
+    _dynamicTexImageUnit = unit;
+    reinitialize();
+}
+
+void
+ShadowCaster::setDynamicTextureSize(unsigned size)
+{
+    _dynamicSize = size;
+    reinitialize();
+}
+
+void
+ShadowCaster::setCacheStaticShadows(bool value)
+{
+    _cacheStatic = value;
+    dirtyStaticShadows();
+}
+
+void
+ShadowCaster::dirtyStaticShadows()
+{
+    _sliceCurrent.assign( _sliceCurrent.size(), false );
+}
+
 void
 ShadowCaster::setBlurFactor(float value)
 {
@@ -101,6 +148,10 @@ ShadowCaster::reinitialize()
 
     _shadowmap = 0L;
     _rttCameras.clear();
+    _dynamicShadowmap = 0L;
+    _dynamicRttCameras.clear();
+    _sliceCurrent.clear();
+    _sliceVPS.clear();
 
     int numSlices = (int)_ranges.size() - 1;
     if ( numSlices < 1 )
@@ -109,33 +160,35 @@ ShadowCaster::reinitialize()
         return ;
     }
 
-    // create the projected texture:
-    _shadowmap = new osg::Texture2DArray();
-    _shadowmap->setTextureSize( _size, _size, numSlices );
-    _shadowmap->setInternalFormat( GL_DEPTH_COMPONENT );
-    _shadowmap->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR );
-    _shadowmap->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
-    _shadowmap->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_BORDER );
-    _shadowmap->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_BORDER );
-    _shadowmap->setBorderColor(osg::Vec4(1,1,1,1));
-
-    // set up the RTT camera:
+    // create the projected textures; one for the (cached) static casters
+    // and a smaller one for the dynamic casters.
+    for(int t=0; t<2; ++t)
+    {
+        unsigned size = t == 0 ? _size : _dynamicSize;
+        osg::Texture2DArray* tex = new osg::Texture2DArray();
+        tex->setTextureSize( size, size, numSlices );
+        tex->setInternalFormat( GL_DEPTH_COMPONENT );
+        tex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR );
+        tex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
+        tex->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_BORDER );
+        tex->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_BORDER );
+        tex->setBorderColor(osg::Vec4(1,1,1,1));
+        if ( t == 0 )
+            _shadowmap = tex;
+        else
+            _dynamicShadowmap = tex;
+    }
+
+    // set up the RTT cameras:
     for(int i=0; i<numSlices; ++i)
     {
-        osg::Camera* rtt = new osg::Camera();
-        rtt->setReferenceFrame( osg::Camera::ABSOLUTE_RF_INHERIT_VIEWPOINT );
-        rtt->setClearDepth( 1.0 );
-        rtt->setClearMask( GL_DEPTH_BUFFER_BIT );
-        rtt->setComputeNearFarMode( osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR );
-        rtt->setViewport( 0, 0, _size, _size );
-        rtt->setRenderOrder( osg::Camera::PRE_RENDER );
-        rtt->setRenderTargetImplementation( osg::Camera::FRAME_BUFFER_OBJECT );
-        rtt->setImplicitBufferAttachmentMask(0, 0);
-        rtt->attach( osg::Camera::DEPTH_BUFFER, _shadowmap.get(), 0, i );
-        rtt->addChild( _castingGroup.get() );
-        _rttCameras.push_back(rtt);
+        _rttCameras.push_back( createRTTCamera(_shadowmap.get(), _size, i, _castingGroup.get()) );
+        _dynamicRttCameras.push_back( createRTTCamera(_dynamicShadowmap.get(), _dynamicSize, i, _dynamicCastingGroup.get()) );
     }
 
+    _sliceCurrent.assign( numSlices, false );
+    _sliceVPS.resize( numSlices );
+
     _rttStateSet = new osg::StateSet();
 
     // only draw back faces to the shadow depth map
@@ -149,11 +202,17 @@ ShadowCaster::reinitialize()
         "#version " GLSL_VERSION_STR "\n"
         GLSL_DEFAULT_PRECISION_FLOAT "\n"
         "uniform mat4 oe_shadow_matrix[" << numSlices << "]; \n"
+        "uniform mat4 oe_shadow_dynamic_matrix[" << numSlices << "]; \n"
+        "uniform bool oe_shadow_dynamic; \n"
         "varying vec4 oe_shadow_coord[" << numSlices << "]; \n"
+        "varying vec4 oe_shadow_dynamic_coord[" << numSlices << "]; \n"
         "void oe_shadow_vertex(inout vec4 VertexVIEW) \n"
         "{ \n"
         "    for(int i=0; i<" << numSlices << "; ++i) \n"
         "        oe_shadow_coord[i] = oe_shadow_matrix[i] * VertexVIEW;\n"
+        "    if ( oe_shadow_dynamic ) \n"
+        "        for(int i=0; i<" << numSlices << "; ++i) \n"
+        "            oe_shadow_dynamic_coord[i] = oe_shadow_dynamic_matrix[i] * VertexVIEW;\n"
         "} \n";
 
     std::string fragment = Stringify() << 
@@ -162,10 +221,13 @@ ShadowCaster::reinitialize()
         "#extension GL_EXT_texture_array : enable \n"
 
         "uniform sampler2DArray oe_shadow_map; \n"
+        "uniform sampler2DArray oe_shadow_dynamic_map; \n"
+        "uniform bool oe_shadow_dynamic; \n"
         "uniform vec4 oe_shadow_color; \n"
         "uniform float oe_shadow_blur; \n"
         "varying vec3 oe_Normal; \n"
         "varying vec4 oe_shadow_coord[" << numSlices << "]; \n"
+        "varying vec4 oe_shadow_dynamic_coord[" << numSlices << "]; \n"
 
         //TODO-run a generator and rplace
         "#define OE_SHADOW_NUM_SAMPLES 16\n"
@@ -181,7 +243,7 @@ ShadowCaster::reinitialize()
         "}\n"
 
         // slow PCF sampling.
-        "float oe_shadow_multisample(in vec3 c, in float refvalue, in float blur) \n"
+        "float oe_shadow_multisample(in sampler2DArray smap, in vec3 c, in float refvalue, in float blur) \n"
         "{ \n"
         "    float shadowed = 0.0; \n"
         "    float a = 6.283185 * oe_shadow_rand(c.xy); \n"
@@ -190,7 +252,7 @@ ShadowCaster::reinitialize()
         "        vec2 off = oe_shadow_samples[i];\n"
         "        off = vec2(dot(off,b.xz), dot(off,b.yw)); \n"
         "        vec3 pc = vec3(c.xy + off*blur, c.z); \n"
-        "        float depth = texture2DArray(oe_shadow_map, pc).r; \n"
+        "        float depth = texture2DArray(smap, pc).r; \n"
         "        if ( depth < 1.0 && depth < refvalue ) { \n"
         "           shadowed += 1.0; \n"
         "        } \n"
@@ -198,6 +260,16 @@ ShadowCaster::reinitialize()
         "    return 1.0-(shadowed/OE_SHADOW_NUM_SAMPLES); \n"
         "} \n"
 
+        // lit factor [0..1] of one slice of a shadow map.
+        "float oe_shadow_slice(in sampler2DArray smap, in vec4 c, in float slice, in float bias) \n"
+        "{ \n"
+        "    vec3 coord = vec3(c.x, c.y, slice); \n"
+        "    if ( oe_shadow_blur > 0.0 ) \n"
+        "        return oe_shadow_multisample(smap, coord, c.z-bias, oe_shadow_blur); \n"
+        "    float depth = texture2DArray(smap, coord).r; \n"
+        "    return depth < 1.0 && depth < c.z-bias ? 0.0 : 1.0; \n"
+        "} \n"
+
         "void oe_shadow_fragment( inout vec4 color )\n"
         "{\n"
         "    float alpha = color.a; \n"
@@ -214,19 +286,9 @@ ShadowCaster::reinitialize()
         // loop over the slices:
         "    for(int i=0; i<" << numSlices << " && factor > 0.0; ++i) \n"
         "    { \n"
-        "        vec4 c = oe_shadow_coord[i]; \n"
-        "        vec3 coord = vec3(c.x, c.y, float(i)); \n"
-
-        "        if ( oe_shadow_blur > 0.0 ) \n"
-        "        { \n"
-        "            factor = min(factor, oe_shadow_multisample(coord, c.z-bias, oe_shadow_blur)); \n"
-        "        } \n"
-        "        else \n"
-        "        { \n"
-        "            float depth = texture2DArray(oe_shadow_map, coord).r; \n"
-        "            if ( depth < 1.0 && depth < c.z-bias ) \n"
-        "                factor = 0.0; \n"
-        "        } \n"
+        "        factor = min(factor, oe_shadow_slice(oe_shadow_map, oe_shadow_coord[i], float(i), bias)); \n"
+        "        if ( oe_shadow_dynamic ) \n"
+        "            factor = min(factor, oe_shadow_slice(oe_shadow_dynamic_map, oe_shadow_dynamic_coord[i], float(i), bias)); \n"
         "    } \n"
 
         "    vec4 colorInFullShadow = color * oe_shadow_color; \n"
@@ -262,6 +324,25 @@ ShadowCaster::reinitialize()
 
     _renderStateSet->addUniform( new osg::Uniform("oe_shadow_map", _texImageUnit) );
 
+    // dynamic caster shadow map and its texture coord generator matrices:
+    _dynamicTexGenUniform = _renderStateSet->getOrCreateUniform(
+        "oe_shadow_dynamic_matrix",
+        osg::Uniform::FLOAT_MAT4,
+        numSlices );
+
+    _renderStateSet->setTextureAttribute(
+        _dynamicTexImageUnit,
+        _dynamicShadowmap.get(),
+        osg::StateAttribute::ON );
+
+    _renderStateSet->addUniform( new osg::Uniform("oe_shadow_dynamic_map", _dynamicTexImageUnit) );
+
+    _dynamicEnabledUniform = _renderStateSet->getOrCreateUniform(
+        "oe_shadow_dynamic",
+        osg::Uniform::BOOL );
+
+    _dynamicEnabledUniform->set( false );
+
     // blur factor:
     _shadowBlurUniform = _renderStateSet->getOrCreateUniform(
         "oe_shadow_blur",
@@ -277,6 +358,41 @@ ShadowCaster::reinitialize()
     _shadowColorUniform->set(_color);
 }
 
+osg::Camera*
+ShadowCaster::createRTTCamera(osg::Texture2DArray* tex, unsigned size, int slice, osg::Group* casters) const
+{
+    osg::Camera* rtt = new osg::Camera();
+    rtt->setReferenceFrame( osg::Camera::ABSOLUTE_RF_INHERIT_VIEWPOINT );
+    rtt->setClearDepth( 1.0 );
+    rtt->setClearMask( GL_DEPTH_BUFFER_BIT );
+    rtt->setComputeNearFarMode( osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR );
+    rtt->setViewport( 0, 0, size, size );
+    rtt->setRenderOrder( osg::Camera::PRE_RENDER );
+    rtt->setRenderTargetImplementation( osg::Camera::FRAME_BUFFER_OBJECT );
+    rtt->setImplicitBufferAttachmentMask(0, 0);
+    rtt->attach( osg::Camera::DEPTH_BUFFER, tex, 0, slice );
+    rtt->addChild( casters );
+    return rtt;
+}
+
+bool
+ShadowCaster::isSliceCurrent(int slice, const std::vector<osg::Vec3d>& verts) const
+{
+    if ( !_cacheStatic || !_sliceCurrent[slice] )
+        return false;
+
+    // the cached slice is still good as long as the camera's frustum slice
+    // sits entirely inside the area it was rendered for.
+    const osg::Matrix& VPS = _sliceVPS[slice];
+    for( std::vector<osg::Vec3d>::const_iterator v = verts.begin(); v != verts.end(); ++v )
+    {
+        osg::Vec3d t = (*v) * VPS;
+        if ( t.x() < 0.0 || t.x() > 1.0 || t.y() < 0.0 || t.y() > 1.0 || t.z() < 0.0 || t.z() > 1.0 )
+            return false;
+    }
+    return true;
+}
+
 void
 ShadowCaster::traverse(osg::NodeVisitor& nv)
 {
@@ -306,6 +422,23 @@ ShadowCaster::traverse(osg::NodeVisitor& nv)
             // matter so we'll just use the camera's.
             osg::Matrix lightViewMat;
             lightViewMat.makeLookAt(lightPosWorld, lightPosWorld+lightVectorWorld, camUp);
+
+            // re-render all the static slices if the light moved far enough,
+            // or if the static casters changed (e.g. tiles paged in or out).
+            const osg::BoundingSphere& casterBound = _castingGroup->getBound();
+            if (lightVectorWorld * _cachedLightVector < cos(osg::DegreesToRadians((double)_lightThreshold)) ||
+                casterBound.center() != _cachedCasterBound.center() ||
+                casterBound.radius() != _cachedCasterBound.radius() )
+            {
+                dirtyStaticShadows();
+                _cachedLightVector = lightVectorWorld;
+                _cachedCasterBound = casterBound;
+            }
+
+            bool renderDynamic = _dynamicCastingGroup->getNumChildren() > 0;
+            _dynamicEnabledUniform->set( renderDynamic );
+
+            std::vector<bool> renderStatic( _rttCameras.size(), false );
             
             //int i = nv.getFrameStamp()->getFrameNumber() % (_ranges.size()-1);
             int i;
@@ -343,27 +476,52 @@ ShadowCaster::traverse(osg::NodeVisitor& nv)
                 f = -std::min(bbox.zMin(), bbox.zMax());
                 lightProjMat.makeOrtho(bbox.xMin(), bbox.xMax(), bbox.yMin(), bbox.yMax(), n, f);
 
-                // configure the RTT camera for this slice:
-                _rttCameras[i]->setViewMatrix( lightViewMat );
-                _rttCameras[i]->setProjectionMatrix( lightProjMat );
-
-                // this xforms from clip [-1..1] to texture [0..1] space
-                static osg::Matrix s_scaleBiasMat = 
-                    osg::Matrix::translate(1.0,1.0,1.0) * 
-                    osg::Matrix::scale(0.5,0.5,0.5);
+                // the dynamic casters always render into a tight fit of the slice:
+                if ( renderDynamic )
+                {
+                    _dynamicRttCameras[i]->setViewMatrix( lightViewMat );
+                    _dynamicRttCameras[i]->setProjectionMatrix( lightProjMat );
+                    osg::Matrix VPS = lightViewMat * lightProjMat * scaleBiasMatrix();
+                    _dynamicTexGenUniform->setElement(i, inverseMV * VPS);
+                }
+
+                // the static casters re-render only if the cached slice no longer
+                // covers the camera's frustum slice. Pad the area so that the
+                // camera can move a bit before that happens.
+                if ( !isSliceCurrent(i, verts) )
+                {
+                    if ( _cacheStatic && _cacheMargin > 0.0f )
+                    {
+                        double mx = (bbox.xMax()-bbox.xMin())*_cacheMargin;
+                        double my = (bbox.yMax()-bbox.yMin())*_cacheMargin;
+                        double mz = (f-n)*_cacheMargin;
+                        lightProjMat.makeOrtho(bbox.xMin()-mx, bbox.xMax()+mx, bbox.yMin()-my, bbox.yMax()+my, n-mz, f+mz);
+                    }
+
+                    // configure the RTT camera for this slice:
+                    _rttCameras[i]->setViewMatrix( lightViewMat );
+                    _rttCameras[i]->setProjectionMatrix( lightProjMat );
+
+                    _sliceVPS[i] = lightViewMat * lightProjMat * scaleBiasMatrix();
+                    _sliceCurrent[i] = true;
+                    renderStatic[i] = true;
+                }
                 
                 // set the texture coordinate generation matrix that the shadow
                 // receiver will use to sample the shadow map. Doing this on the CPU
                 // prevents nasty precision issues!
-                osg::Matrix VPS = lightViewMat * lightProjMat * s_scaleBiasMat;
-                _shadowMapTexGenUniform->setElement(i, inverseMV * VPS);
+                _shadowMapTexGenUniform->setElement(i, inverseMV * _sliceVPS[i]);
             }
 
-            // render the shadow maps.
+            // render the shadow maps. A cached slice keeps the depth it
+            // was last rendered with.
             cv->pushStateSet( _rttStateSet.get() );
             for(i=0; i < (int) _rttCameras.size(); ++i)
             {
-                _rttCameras[i]->accept( nv );
+                if ( renderStatic[i] )
+                    _rttCameras[i]->accept( nv );
+                if ( renderDynamic )
+                    _dynamicRttCameras[i]->accept( nv );
             }
             cv->popStateSet();
             
@@ -275,6 +275,80 @@ double SimplexNoise::getValue(double xin, double yin, double zin, double win) co
 }
 
 
+void SimplexNoise::getValues(const double* x, const double* y, const double* z, unsigned count, double* out) const
+{
+    unsigned o = std::max(1u, _octaves);
+
+    double maxamp = 0.0;
+    double amp = 1.0;
+    for(unsigned i=0; i<o; ++i)
+    {
+        maxamp += amp;
+        amp *= _pers;
+    }
+
+    for(unsigned p=0; p<count; ++p)
+    {
+        double freq = _freq;
+        double n = 0.0;
+        amp = 1.0;
+        for(unsigned i=0; i<o; ++i)
+        {
+            n += Noise(x[p]*freq, y[p]*freq, z[p]*freq) * amp;
+            amp *= _pers;
+            freq *= _lacunarity;
+        }
+
+        if ( _normalize )
+        {
+            n /= maxamp;
+            n = n * (_high-_low)/2.0 + (_high+_low)/2.0;
+        }
+        out[p] = n;
+    }
+}
+
+void SimplexNoise::getTiledValues(const double* x, double y, unsigned count, double* out) const
+{
+    const double TwoPI = 2.0 * osg::PI;
+    unsigned o = std::max(1u, _octaves);
+
+    double maxamp = 0.0;
+    double amp = 1.0;
+    for(unsigned i=0; i<o; ++i)
+    {
+        maxamp += amp;
+        amp *= _pers;
+    }
+
+    // y is constant along the row, so its half of the torus mapping is too.
+    double ny = cos(y*TwoPI)/TwoPI;
+    double nw = sin(y*TwoPI)/TwoPI;
+
+    for(unsigned p=0; p<count; ++p)
+    {
+        double nx = cos(x[p]*TwoPI)/TwoPI;
+        double nz = sin(x[p]*TwoPI)/TwoPI;
+
+        double freq = _freq;
+        double n = 0.0;
+        amp = 1.0;
+        for(unsigned i=0; i<o; ++i)
+        {
+            n += Noise(nx*freq, ny*freq, nz*freq, nw*freq) * amp;
+            amp *= _pers;
+            freq *= _lacunarity;
+        }
+
+        if ( _normalize )
+        {
+            n /= maxamp;
+            n = n * (_high-_low)/2.0 + (_high+_low)/2.0;
+        }
+        out[p] = n;
+    }
+}
+
 // 2D simplex noise
 double SimplexNoise::Noise(double xin, double yin) const
 {
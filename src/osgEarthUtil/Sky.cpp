@@ -49,6 +49,8 @@ void
 SkyNode::baseInit(const SkyOptions& options)
 {
     _ephemeris = new Ephemeris();
+    _dateTimeApplied = false;
+    _dateTimeThreshold = 1.0;
     _sunVisible = true;
     _moonVisible = true;
     _starsVisible = true;
@@ -84,6 +86,14 @@ void
 SkyNode::setDateTime(const DateTime& dt)
 {
     _dateTime = dt;
+
+    // skip the ephemeris if the time hasn't moved far enough:
+    double delta = ::fabs( (double)(dt.asTimeStamp() - _appliedDateTime.asTimeStamp()) );
+    if ( _dateTimeApplied && delta < _dateTimeThreshold )
+        return;
+
+    _appliedDateTime = dt;
+    _dateTimeApplied = true;
     //OE_INFO << LC << "Time = " << dt.asRFC1123() << std::endl;
     onSetDateTime();
 }
@@ -19,271 +19,242 @@
 #include <osgEarthUtil/TFSPackager>
 
 #include <osgEarth/Registry>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <osgEarth/StringUtils>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <osgEarth/FileUtils>
+#include <osg/Math>
+#include <OpenThreads/Thread>
+#include <fstream>
+#include <iomanip>
+#include <cstdio>
 
 #define LC "[TFSPackager] "
 
+#define MANIFEST_FILE "tfs_manifest.txt"
+
 using namespace osgEarth;
 using namespace osgEarth::Features;
 using namespace osgEarth::Symbology;
 using namespace osgEarth::Util;
 
 /******************************************************************************************/
-class FeatureTileVisitor;
-class FeatureTile;
-
-typedef std::list< osgEarth::Features::FeatureID > FeatureIDList;
 
-class FeatureTile : public osg::Referenced
+namespace
 {
-public:
-    FeatureTile( const TileKey& key ):
-      _key( key ),
-          _isSplit( false )
-      {        
-      }
-
-      const GeoExtent& getExtent() const
-      {
-          return _key.getExtent();
-      }
-
-      const TileKey& getKey() const
-      {
-          return _key;
-      }
-
-      bool getIsSplit() const { return _isSplit;}
-
-      void split()
-      {
-          if (!_isSplit)
-          {
-              for (unsigned int i = 0; i < 4; ++i)
-              {  
-                  _children[i] = new FeatureTile(_key.createChildKey( i ) );
-              }
-              _isSplit = true;
-          }
-      }
-
-      void accept( FeatureTileVisitor* v);
-
-      void traverse( FeatureTileVisitor* v )
-      {
-          if (_isSplit)
-          {
-              for (unsigned int i = 0; i < 4; ++i)
-              {
-                  _children[i]->accept( v );
-              }
-          }
-      }
-
-      FeatureIDList& getFeatures()
-      {
-          return _features;
-      }
-
-
-private:    
-    FeatureIDList _features;
-    TileKey _key;   
-    osg::ref_ptr<FeatureTile> _children[4];
-    bool _isSplit;
-};
-
-class FeatureTileVisitor : public osg::Referenced
-{
-public:
-    virtual void traverse(FeatureTile* tile)
+    /**
+     * What the packager needs to know to place a feature, gathered in a
+     * single pass over the source. Tiles are built from this index alone;
+     * the features themselves are only read back when a tile is written.
+     */
+    struct IndexEntry
+    {
+        FeatureID  _fid;
+        double     _xmin, _ymin, _xmax, _ymax;
+        osg::Vec3d _center;
+        unsigned   _hash;  // of the FID, bounds and modification attribute
+    };
+    typedef std::vector<IndexEntry> FeatureIndex;
+
+    // indices into the feature index, in source order
+    typedef std::vector<unsigned> EntryList;
+
+    // tile path (relative to the destination) => signature
+    typedef std::map<std::string, unsigned> Manifest;
+
+    bool isPoint(const IndexEntry& e)
     {
-        tile->traverse( this );
+        return e._xmin == e._xmax && e._ymin == e._ymax;
     }
-};
 
-void FeatureTile::accept(FeatureTileVisitor* v)
-{    
-    v->traverse( this );
-}
+    /** Same acceptance test the CropFilter applies when the tile is written. */
+    bool accepts(const GeoExtent& extent, const IndexEntry& e, CropFilter::Method method)
+    {
+        // a single point's bounds aren't valid for an intersection check.
+        if ( isPoint(e) )
+            return extent.contains( e._xmin, e._ymin );
 
-/******************************************************************************************/
+        if ( method == CropFilter::METHOD_CENTROID )
+            return extent.contains( e._center.x(), e._center.y() );
 
-class AddFeatureVisitor : public FeatureTileVisitor
-{
-public:
-    AddFeatureVisitor( Feature* feature, int maxFeatures, int firstLevel, int maxLevel, CropFilter::Method cropMethod):
-      _feature( feature ),
-          _maxFeatures( maxFeatures ),      
-          _maxLevel( maxLevel ),
-          _firstLevel( firstLevel ),
-          _added(false),
-          _numAdded( 0 ),
-          _levelAdded(-1),
-          _cropMethod( cropMethod )
-      {
-
-      }
-
-      virtual void traverse( FeatureTile* tile)
-      {        
-          if (_added && _cropMethod != CropFilter::METHOD_CROPPING) return;
-
-          bool traverse = true;
-
-          GeoExtent featureExtent(_feature->getSRS(), _feature->getGeometry()->getBounds());
-
-          bool valid = false;
-          // It's a single point, so we do a contains check instead of an intersection check b/c the bounds really aren't valid.
-          if (featureExtent.width() == 0 && featureExtent.height() == 0)
-          {                            
-              valid = tile->getExtent().contains( featureExtent.xMin(), featureExtent.yMin());
-          }
-          else
-          {
-              // Do a normal intersection check
-              valid = featureExtent.intersects( tile->getExtent());
-          }
-
-          if (valid)
-          {
-              //If the node contains the feature, and it doesn't contain the max number of features add it.  If it's already full then 
-              //split it.
-              if (tile->getKey().getLevelOfDetail() >= (unsigned int)_firstLevel && 
-                  (tile->getFeatures().size() < (unsigned int)_maxFeatures || tile->getKey().getLevelOfDetail() == _maxLevel || tile->getKey().getLevelOfDetail() == _levelAdded))
-              {
-                  if (_levelAdded < 0 || _levelAdded == tile->getKey().getLevelOfDetail())
-                  {
-                      osg::ref_ptr< Feature > clone = new Feature( *_feature, osg::CopyOp::DEEP_COPY_ALL );
-                      FeatureList features;
-                      features.push_back( clone );
-
-                      CropFilter cropFilter(_cropMethod);
-                      FilterContext context(0);
-                      context.extent() = tile->getExtent();
-                      cropFilter.push( features, context );
-
-
-                      if (!features.empty() && clone->getGeometry() && clone->getGeometry()->isValid())
-                      {
-                          //tile->getFeatures().push_back( clone );
-                          tile->getFeatures().push_back( clone->getFID() );
-                          _added = true;
-                          _levelAdded = tile->getKey().getLevelOfDetail();
-                          _numAdded++;                   
-                          traverse = false;
-                      }
-                  }
-
-                  if (traverse || _cropMethod == CropFilter::METHOD_CROPPING)
-                  {
-                      tile->traverse( this );
-                  }
-              }
-              else
-              {   
-                  tile->split();
-                  tile->traverse( this );
-              }
-
-          }          
-      }
-
-      int _levelAdded;
-
-      bool _added;
-      int _maxFeatures;
-      int _firstLevel;
-      int _maxLevel;
-      int _numAdded;
-
-      CropFilter::Method _cropMethod;
-
-
-
-      osg::ref_ptr< Feature > _feature;
-};
+        return
+            e._xmin <= extent.xMax() && e._xmax >= extent.xMin() &&
+            e._ymin <= extent.yMax() && e._ymax >= extent.yMin();
+    }
 
+    /** Path of a tile's file relative to the destination folder. */
+    std::string tilePath(const TileKey& key)
+    {
+        unsigned int numRows, numCols;
+        key.getProfile()->getNumTiles(key.getLevelOfDetail(), numCols, numRows);
+        int y = numRows - key.getTileY() - 1;
+        return Stringify() << key.getLevelOfDetail() << "/" << key.getTileX() << "/" << y << ".json";
+    }
 
-/******************************************************************************************/
-class WriteFeaturesVisitor : public FeatureTileVisitor
-{
-public:
-    WriteFeaturesVisitor(FeatureSource* features, const std::string& dest, CropFilter::Method cropMethod, const SpatialReference* srs):
-      _dest( dest ),
-          _features( features ),
-          _cropMethod( cropMethod ),
-          _srs( srs )
-      {
-
-      }
-
-      virtual void traverse( FeatureTile* tile)
-      {
-          if (tile->getFeatures().size() > 0)
-          {                 
-              //Actually load up the features
-              FeatureList features;
-              for (FeatureIDList::const_iterator i = tile->getFeatures().begin(); i != tile->getFeatures().end(); i++)
-              {
-                  Feature* f = _features->getFeature( *i );                  
-
-                  if (f)
-                  {
-                      //Reproject the feature to the dest SRS if it's not already
-                      if (!f->getSRS()->isEquivalentTo( _srs ) )
-                      {
-                          f->transform( _srs );
-                      }
-                      features.push_back( f );
-                  }
-                  else
-                  {
-                      OE_NOTICE << "couldn't get feature " << *i << std::endl;
-                  }
-              }
-
-              //Need to do the cropping again since these are brand new features coming from the feature source.
-              CropFilter cropFilter(_cropMethod);
-              FilterContext context(0);
-              context.extent() = tile->getExtent();
-              cropFilter.push( features, context );
-
-              std::string contents = Feature::featuresToGeoJSON( features );
-              std::stringstream buf;
-              int x =  tile->getKey().getTileX();
-              unsigned int numRows, numCols;
-              tile->getKey().getProfile()->getNumTiles(tile->getKey().getLevelOfDetail(), numCols, numRows);
-              int y  = numRows - tile->getKey().getTileY() - 1;
-
-              buf << _dest << "/" << tile->getKey().getLevelOfDetail() << "/" << x << "/" << y << ".json";
-              std::string filename = buf.str();
-              //OE_NOTICE << "Writing " << features.size() << " features to " << filename << std::endl;
-
-              if ( !osgDB::fileExists( osgDB::getFilePath(filename) ) )
-                  osgEarth::makeDirectoryForFile( filename );
-
-
-              std::fstream output( filename.c_str(), std::ios_base::out );
-              if ( output.is_open() )
-              {
-                  output << contents;
-                  output.flush();
-                  output.close();                
-              }            
-          }
-          tile->traverse( this );        
-      }
-
-      osg::ref_ptr< FeatureSource > _features;
-      std::string _dest;      
-      CropFilter::Method _cropMethod;
-      osg::ref_ptr< const SpatialReference > _srs;
-};
+    /**
+     * Decides which of a tile's candidate features the tile keeps, and hands
+     * the rest down to the children. A tile keeps the first maxFeatures
+     * candidates in source order, which is what inserting the features one
+     * at a time produces. Tiles of one level are independent, so each is
+     * its own task.
+     */
+    struct AssignTile
+    {
+        void execute()
+        {
+            unsigned lod = _key.getLevelOfDetail();
+            EntryList::const_iterator rest = _candidates.begin();
+
+            if ( lod >= _firstLevel )
+            {
+                unsigned keep = lod >= _maxLevel ? _candidates.size() : osg::minimum((unsigned)_candidates.size(), _maxFeatures);
+                _own.assign( _candidates.begin(), _candidates.begin() + keep );
+                rest += keep;
+            }
+
+            if ( rest == _candidates.end() || lod >= _maxLevel )
+                return;
 
+            GeoExtent childExtents[4];
+            for( unsigned c = 0; c < 4; ++c )
+            {
+                _childKeys[c]   = _key.createChildKey( c );
+                childExtents[c] = _childKeys[c].getExtent();
+            }
 
+            for( ; rest != _candidates.end(); ++rest )
+            {
+                const IndexEntry& e = (*_index)[*rest];
+                for( unsigned c = 0; c < 4; ++c )
+                {
+                    if ( accepts(childExtents[c], e, _method) )
+                    {
+                        _children[c].push_back( *rest );
+                        // cropped features go to every tile they touch.
+                        if ( _method != CropFilter::METHOD_CROPPING )
+                            break;
+                    }
+                }
+            }
+        }
+
+        const FeatureIndex* _index;
+        TileKey             _key;
+        EntryList           _candidates;
+        unsigned            _firstLevel, _maxLevel, _maxFeatures;
+        CropFilter::Method  _method;
+
+        // results:
+        EntryList           _own;
+        TileKey             _childKeys[4];
+        EntryList           _children[4];
+    };
+    typedef ParallelTask<AssignTile> AssignTileTask;
+
+    /** Reads back, crops and writes out the features of one tile. */
+    struct WriteTile
+    {
+        void execute()
+        {
+            //Actually load up the features
+            FeatureList features;
+            for( EntryList::const_iterator i = _entries.begin(); i != _entries.end(); ++i )
+            {
+                FeatureID fid = (*_index)[*i]._fid;
+                osg::ref_ptr<Feature> f = _source->getFeature( fid );
+                if ( f.valid() )
+                {
+                    //Reproject the feature to the dest SRS if it's not already
+                    if ( !f->getSRS()->isEquivalentTo( _srs.get() ) )
+                    {
+                        f->transform( _srs.get() );
+                    }
+                    features.push_back( f.get() );
+                }
+                else
+                {
+                    OE_NOTICE << LC << "couldn't get feature " << fid << std::endl;
+                }
+            }
+
+            //Need to do the cropping again since these are brand new features coming from the feature source.
+            CropFilter cropFilter(_method);
+            FilterContext context(0);
+            context.extent() = _key.getExtent();
+            cropFilter.push( features, context );
+
+            std::string contents = Feature::featuresToGeoJSON( features );
+
+            {
+                // sibling tiles may race to create the same folder.
+                static Threading::Mutex s_dirMutex;
+                Threading::ScopedMutexLock lock( s_dirMutex );
+                if ( !osgDB::fileExists( osgDB::getFilePath(_filename) ) )
+                    osgEarth::makeDirectoryForFile( _filename );
+            }
+
+            std::fstream output( _filename.c_str(), std::ios_base::out );
+            if ( output.is_open() )
+            {
+                output << contents;
+                output.flush();
+                output.close();                
+            }
+            else
+            {
+                OE_WARN << LC << "Failed to write " << _filename << std::endl;
+            }
+        }
+
+        osg::ref_ptr<FeatureSource>          _source;
+        const FeatureIndex*                  _index;
+        TileKey                              _key;
+        EntryList                            _entries;
+        std::string                          _filename;
+        CropFilter::Method                   _method;
+        osg::ref_ptr<const SpatialReference> _srs;
+    };
+    typedef ParallelTask<WriteTile> WriteTileTask;
+
+    bool readManifest(const std::string& filename, unsigned params, Manifest& out)
+    {
+        std::ifstream in( filename.c_str() );
+        if ( !in.is_open() )
+            return false;
+
+        std::string tag;
+        unsigned    fileParams = 0u;
+        in >> tag >> std::hex >> fileParams;
+        if ( tag != "params" || fileParams != params )
+            return false;
+
+        std::string path;
+        unsigned    signature;
+        while( in >> path >> signature )
+        {
+            out[path] = signature;
+        }
+        return true;
+    }
+
+    void writeManifest(const std::string& filename, unsigned params, const Manifest& manifest)
+    {
+        std::ofstream out( filename.c_str() );
+        if ( !out.is_open() )
+        {
+            OE_WARN << LC << "Failed to write manifest " << filename << std::endl;
+            return;
+        }
+
+        out << "params " << std::hex << params << "\n";
+        for( Manifest::const_iterator i = manifest.begin(); i != manifest.end(); ++i )
+        {
+            out << i->first << " " << i->second << "\n";
+        }
+    }
+}
 
 /******************************************************************************************/
 
@@ -291,7 +262,9 @@ TFSPackager::TFSPackager():
 _firstLevel( 0 ),
     _maxLevel( 10 ),
     _maxFeatures( 300 ),
-    _method( CropFilter::METHOD_CENTROID )
+    _method( CropFilter::METHOD_CENTROID ),
+    _incremental( true ),
+    _numThreads( OpenThreads::GetNumberOfProcessors() )
 {
 }
 
@@ -322,14 +295,17 @@ void
 
     TileKey rootKey = TileKey(0, 0, 0, profile );    
 
+    // Anything that changes where features land or how they're written
+    // invalidates the previous run's tiles.
+    unsigned params = hashString( Stringify()
+        << _firstLevel << " " << _maxLevel << " " << _maxFeatures << " " << (int)_method << " "
+        << _srs->getHorizInitString() << " " << std::setprecision(16) << extent.toString()
+        << " " << _modAttribute );
 
-    osg::ref_ptr< FeatureTile > root = new FeatureTile( rootKey );
-    //Loop through all the features and try to insert them into the quadtree
+    // Index the features: one pass over the source.
+    FeatureIndex index;
     osg::ref_ptr< FeatureCursor > cursor = features->createFeatureCursor( _query );
-    int added = 0;
-    int failed = 0;
     int skipped = 0;
-    int highestLevel = 0;
 
     while (cursor.valid() && cursor->hasMore())
     {        
@@ -343,31 +319,163 @@ void
 
         if (feature->getGeometry() && feature->getGeometry()->getBounds().valid() && feature->getGeometry()->isValid())
         {
+            Bounds b = feature->getGeometry()->getBounds();
+
+            IndexEntry e;
+            e._fid    = feature->getFID();
+            e._xmin   = b.xMin();
+            e._ymin   = b.yMin();
+            e._xmax   = b.xMax();
+            e._ymax   = b.yMax();
+            e._center = b.center();
+
+            std::string mod = _modAttribute.empty() ? "" : feature->getString( _modAttribute );
+            e._hash = hashString( Stringify() << e._fid << " " << std::setprecision(16)
+                << e._xmin << " " << e._ymin << " " << e._xmax << " " << e._ymax << " " << mod );
+
+            index.push_back( e );
+        }
+        else
+        {
+            OE_NOTICE << "Skipping feature " << feature->getFID() << " with null or invalid geometry" << std::endl;
+            skipped++;
+        }
+    }
+    cursor = 0L;
+
+    // Tiles from the previous run, if they were built the same way.
+    std::string manifestFile = osgDB::concatPaths( destination, MANIFEST_FILE );
+    Manifest previous, current;
+    bool incremental = _incremental && readManifest( manifestFile, params, previous );
+    if ( incremental )
+    {
+        OE_NOTICE << LC << "Re-packaging incrementally against " << previous.size() << " existing tiles" << std::endl;
+    }
 
-            AddFeatureVisitor v(feature.get(), _maxFeatures, _firstLevel, _maxLevel, _method);
-            root->accept( &v );
-            if (!v._added)
+    osg::ref_ptr<TaskService> service = new TaskService( "TFSPackager", osg::maximum(_numThreads, 1u) );
+
+    std::vector<char> placed( index.size(), 0 );
+    int highestLevel = 0;
+    int written = 0;
+    int unchanged = 0;
+
+    // Start with every feature the root tile accepts.
+    std::vector< osg::ref_ptr<AssignTileTask> > level( 1, new AssignTileTask() );
+    level[0]->_key = rootKey;
+    for( unsigned i = 0; i < index.size(); ++i )
+    {
+        if ( accepts(rootKey.getExtent(), index[i], _method) )
+            level[0]->_candidates.push_back( i );
+    }
+
+    // Build the quadtree a level at a time: the tiles of a level are placed
+    // in parallel, then the ones that changed are written out right away.
+    while( !level.empty() )
+    {
+        Threading::MultiEvent assigned( (int)level.size() );
+        for( unsigned i = 0; i < level.size(); ++i )
+        {
+            AssignTileTask* task = level[i].get();
+            task->_mev         = &assigned;
+            task->_index       = &index;
+            task->_firstLevel  = _firstLevel;
+            task->_maxLevel    = _maxLevel;
+            task->_maxFeatures = _maxFeatures;
+            task->_method      = _method;
+            service->add( task );
+        }
+        assigned.wait();
+
+        std::vector< osg::ref_ptr<WriteTileTask> > writes;
+        std::vector< osg::ref_ptr<AssignTileTask> > next;
+
+        for( unsigned i = 0; i < level.size(); ++i )
+        {
+            AssignTile& tile = *level[i];
+
+            if ( !tile._own.empty() )
             {
-                OE_NOTICE << "Failed to add feature " << feature->getFID() << std::endl;
-                failed++;
+                highestLevel = osg::maximum( highestLevel, (int)tile._key.getLevelOfDetail() );
+
+                unsigned signature = params;
+                for( EntryList::const_iterator e = tile._own.begin(); e != tile._own.end(); ++e )
+                {
+                    signature = signature*31u + index[*e]._hash;
+                    placed[*e] = 1;
+                }
+
+                std::string path = tilePath( tile._key );
+                current[path] = signature;
+
+                Manifest::const_iterator p = previous.find( path );
+                if ( incremental && p != previous.end() && p->second == signature )
+                {
+                    ++unchanged;
+                }
+                else
+                {
+                    WriteTileTask* write = new WriteTileTask();
+                    write->_source   = features;
+                    write->_index    = &index;
+                    write->_key      = tile._key;
+                    write->_entries.swap( tile._own );
+                    write->_filename = osgDB::concatPaths( destination, path );
+                    write->_method   = _method;
+                    write->_srs      = _srs.get();
+                    writes.push_back( write );
+                }
             }
-            else
-            {                
-                if (highestLevel < v._levelAdded)
+
+            for( unsigned c = 0; c < 4; ++c )
+            {
+                if ( !tile._children[c].empty() )
                 {
-                    highestLevel = v._levelAdded;
+                    AssignTileTask* child = new AssignTileTask();
+                    child->_key = tile._childKeys[c];
+                    child->_candidates.swap( tile._children[c] );
+                    next.push_back( child );
                 }
-                added++;
-                OE_DEBUG << "Added " << added << std::endl;
-            }   
+            }
         }
-        else
+
+        if ( !writes.empty() )
         {
-            OE_NOTICE << "Skipping feature " << feature->getFID() << " with null or invalid geometry" << std::endl;
-            skipped++;
+            Threading::MultiEvent done( (int)writes.size() );
+            for( unsigned i = 0; i < writes.size(); ++i )
+            {
+                writes[i]->_mev = &done;
+                service->add( writes[i].get() );
+            }
+            done.wait();
+            written += writes.size();
+        }
+
+        level.swap( next );
+    }
+
+    // Remove tiles that no longer hold any features.
+    int removed = 0;
+    for( Manifest::const_iterator i = previous.begin(); i != previous.end(); ++i )
+    {
+        if ( current.find(i->first) == current.end() )
+        {
+            if ( ::remove( osgDB::concatPaths(destination, i->first).c_str() ) == 0 )
+                ++removed;
         }
-    }   
+    }
+
+    int added = 0;
+    for( unsigned i = 0; i < placed.size(); ++i )
+    {
+        if ( placed[i] )
+            ++added;
+        else
+            OE_NOTICE << "Failed to add feature " << index[i]._fid << std::endl;
+    }
+    int failed = (int)index.size() - added;
+
     OE_NOTICE << "Added=" << added << " Skipped=" << skipped << " Failed=" << failed << std::endl;
+    OE_NOTICE << "Tiles written=" << written << " Unchanged=" << unchanged << " Removed=" << removed << std::endl;
 
 #if 1
     // Print the width of tiles at each level
@@ -379,8 +487,7 @@ void
     }
 #endif
 
-    WriteFeaturesVisitor write(features, destination, _method, _srs);
-    root->accept( &write );
+    writeManifest( manifestFile, params, current );
 
     //Write out the meta doc
     TFSLayer layer;
@@ -393,4 +500,3 @@ void
     TFSReaderWriter::write( layer, osgDB::concatPaths( destination, "tfs.xml"));
 
 }
-
@@ -26,6 +26,8 @@
 #include <osgEarth/Registry>
 #include <osgEarth/StringUtils>
 #include <osgEarth/Profile>
+#include <osgEarth/MetadataCache>
+#include <osgEarth/URLTemplate>
 
 #include <osg/Notify>
 #include <osgDB/FileUtils>
@@ -285,41 +287,36 @@ TileMap::getURL(const osgEarth::TileKey& tilekey, bool invertY)
 
     //OE_NOTICE << LC << "KEY: " << tilekey.str() << " level " << zoom << " ( " << x << ", " << y << ")" << std::endl;
 
-    //Select the correct TileSet
+    //Select the correct TileSet. With no tilesets, just go with it; there's no way of knowing the max level.
     if ( _tileSets.size() > 0 )
     {
-        for (TileSetList::iterator itr = _tileSets.begin(); itr != _tileSets.end(); ++itr)
+        bool found = false;
+        for (TileSetList::iterator itr = _tileSets.begin(); itr != _tileSets.end() && !found; ++itr)
         { 
-            if (itr->getOrder() == zoom)
-            {                
-                std::stringstream ss; 
-                std::string basePath = osgDB::getFilePath(_filename);                
-                if (!basePath.empty())
-                {
-                    ss << basePath << "/";
-                }
-                ss << zoom << "/" << x << "/" << y << "." << _format.getExtension();                
-                std::string ssStr;
-				ssStr = ss.str();
-				return ssStr;
-            }
+            found = (itr->getOrder() == zoom);
         }
+        if ( !found )
+            return "";
     }
-    else // Just go with it. No way of knowing the max level.
+
+    std::string basePath = osgDB::getFilePath(_filename);
+    const std::string& ext = _format.getExtension();
+
+    std::string url;
+    url.reserve( basePath.size() + ext.size() + 34 );
+    if (!basePath.empty())
     {
-        std::stringstream ss; 
-        std::string basePath = osgDB::getFilePath(_filename);                
-        if (!basePath.empty())
-        {
-            ss << basePath << "/";
-        }
-        ss << zoom << "/" << x << "/" << y << "." << _format.getExtension();                
-        std::string ssStr;
-        ssStr = ss.str();
-        return ssStr;
+        url += basePath;
+        url += '/';
     }
-
-    return "";
+    URLTemplate::appendUnsigned( url, zoom );
+    url += '/';
+    URLTemplate::appendUnsigned( url, x );
+    url += '/';
+    URLTemplate::appendUnsigned( url, y );
+    url += '.';
+    url += ext;
+    return url;
 }
 
 bool
@@ -467,7 +464,7 @@ TileMapReaderWriter::read( const std::string& location, const osgDB::ReaderWrite
 {
     TileMap* tileMap = NULL;
 
-    ReadResult r = URI(location).readString();
+    ReadResult r = MetadataCache::readString( URI(location), options );
     if ( r.failed() )
     {
         OE_WARN << LC << "Failed to read TMS tile map file from " << location << std::endl;
@@ -742,7 +739,7 @@ TileMapServiceReader::TileMapServiceReader(const TileMapServiceReader& rhs)
 bool
 TileMapServiceReader::read( const std::string &location, const osgDB::ReaderWriter::Options* options, TileMapEntryList& tileMaps )
 {     
-    ReadResult r = URI(location).readString();
+    ReadResult r = MetadataCache::readString( URI(location), options );
     if ( r.failed() )
     {
         OE_WARN << LC << "Failed to read TileMapServices from " << location << std::endl;
@@ -25,7 +25,11 @@
 #include <osgEarth/CacheEstimator>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
+#include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
+#include <OpenThreads/Thread>
+#include <algorithm>
+#include <set>
 
 
 #define LC "[TMSPackager] "
@@ -33,10 +37,157 @@
 using namespace osgEarth::Util;
 using namespace osgEarth;
 
+namespace
+{
+    /**
+     * Builds a tile from its four children, already written to the repo.
+     */
+    struct PyramidTileBuilder
+    {
+        TMSPackager*         _packager;
+        WriteTMSTileHandler* _handler;
+        bool                 _elevation;
+        unsigned int         _width;
+        unsigned int         _height;
+
+        bool build( const TileKey& key ) const
+        {
+            std::string path = _handler->getPathForTile( key );
+            if (osgDB::fileExists(path) && !_packager->getOverwrite())
+                return true;
+
+            return _elevation ? buildHeightField( key, path ) : buildImage( key, path );
+        }
+
+        bool buildImage( const TileKey& key, const std::string& path ) const
+        {
+            // Mosaic the children at full resolution, then downsample.
+            osg::ref_ptr< osg::Image > mosaic = ImageUtils::createEmptyImage( _width*2, _height*2 );
+            bool found = false;
+
+            for (unsigned int q = 0; q < 4; ++q)
+            {
+                TileKey child = key.createChildKey( q );
+                std::string childPath = _handler->getPathForTile( child );
+                if (!osgDB::fileExists(childPath))
+                    continue;
+
+                osg::ref_ptr< osg::Image > image = osgDB::readImageFile( childPath );
+                if (!image.valid())
+                    continue;
+
+                if (image->s() != (int)_width || image->t() != (int)_height)
+                {
+                    osg::ref_ptr< osg::Image > resized;
+                    if (!ImageUtils::resizeImage( image.get(), _width, _height, resized ))
+                        continue;
+                    image = resized.get();
+                }
+
+                osg::ref_ptr< osg::Image > rgba = ImageUtils::convertToRGBA8( image.get() );
+
+                // Tile rows run north to south; image rows run south to north.
+                unsigned int col = child.getTileX() - 2*key.getTileX();
+                unsigned int row = child.getTileY() - 2*key.getTileY();
+                ImageUtils::copyAsSubImage( rgba.get(), mosaic.get(), col*_width, (1-row)*_height );
+                found = true;
+            }
+
+            if (!found)
+                return false;
+
+            osg::ref_ptr< osg::Image > image;
+            if (!ImageUtils::resizeImage( mosaic.get(), _width, _height, image ))
+                return false;
+
+            if (!_packager->getKeepEmpties() && ImageUtils::isEmptyImage(image.get()))
+                return false;
+
+            osg::ref_ptr< const osg::Image > final = image.get();
+            if ( _packager->getExtension() == "jpg" )
+            {
+                final = ImageUtils::convertToRGB8( final.get() );
+            }
+
+            osgEarth::makeDirectoryForFile( path );
+            return osgDB::writeImageFile( *final, path, _packager->getOptions() );
+        }
+
+        bool buildHeightField( const TileKey& key, const std::string& path ) const
+        {
+            osg::ref_ptr< osg::HeightField > hf = new osg::HeightField();
+            hf->allocate( _width, _height );
+            std::fill( hf->getFloatArray()->begin(), hf->getFloatArray()->end(), NO_DATA_VALUE );
+
+            ImageToHeightFieldConverter conv;
+            bool found = false;
+
+            for (unsigned int q = 0; q < 4; ++q)
+            {
+                TileKey child = key.createChildKey( q );
+                std::string childPath = _handler->getPathForTile( child );
+                if (!osgDB::fileExists(childPath))
+                    continue;
+
+                osg::ref_ptr< osg::Image > image = osgDB::readImageFile( childPath );
+                if (!image.valid())
+                    continue;
+
+                osg::ref_ptr< osg::HeightField > childHF = conv.convert( image.get() );
+                if (!childHF.valid() || childHF->getNumColumns() != _width || childHF->getNumRows() != _height)
+                    continue;
+
+                // Heightfield rows run south to north.
+                int col = child.getTileX() - 2*key.getTileX();
+                int row = 1 - (int)(child.getTileY() - 2*key.getTileY());
+
+                // Edge samples are shared, so every other child sample lands
+                // exactly on a parent sample.
+                for (unsigned int r = 0; r < _height; ++r)
+                {
+                    int cr = 2*(int)r - row*((int)_height-1);
+                    if (cr < 0 || cr >= (int)_height)
+                        continue;
+
+                    for (unsigned int c = 0; c < _width; ++c)
+                    {
+                        int cc = 2*(int)c - col*((int)_width-1);
+                        if (cc < 0 || cc >= (int)_width)
+                            continue;
+
+                        hf->setHeight( c, r, childHF->getHeight(cc, cr) );
+                    }
+                }
+                found = true;
+            }
+
+            if (!found)
+                return false;
+
+            osg::ref_ptr< osg::Image > image = conv.convert( hf.get(), _packager->getElevationPixelDepth() );
+            osgEarth::makeDirectoryForFile( path );
+            return image.valid() && osgDB::writeImageFile( *image.get(), path, _packager->getOptions() );
+        }
+    };
+
+    struct BuildPyramidTile
+    {
+        void execute()
+        {
+            _written = _builder->build( _key );
+        }
+
+        const PyramidTileBuilder* _builder;
+        TileKey                   _key;
+        bool                      _written;
+    };
+}
+
 WriteTMSTileHandler::WriteTMSTileHandler(TerrainLayer* layer,  Map* map, TMSPackager* packager):
     _layer( layer ),
     _map(map),
-    _packager(packager)
+    _packager(packager),
+    _tileIndex(new TileExistenceIndex())
 {
 }
 
@@ -66,7 +217,10 @@ bool WriteTMSTileHandler::handleTile(const TileKey& key, const TileVisitor& tv)
 
     // Don't write out a new file if we're not overwriting
     if (osgDB::fileExists(path) && !_packager->getOverwrite())
+    {
+        _tileIndex->add( key );
         return true;
+    }
 
     // attempt to create the output folder:        
     osgEarth::makeDirectoryForFile( path );       
@@ -100,7 +254,10 @@ bool WriteTMSTileHandler::handleTile(const TileKey& key, const TileVisitor& tv)
             {
                 final = ImageUtils::convertToRGB8( final );
             }            
-            return osgDB::writeImageFile(*final, path, _packager->getOptions());
+            if ( !osgDB::writeImageFile(*final, path, _packager->getOptions()) )
+                return false;
+            _tileIndex->add( key );
+            return true;
         }            
     }
     else if (elevationLayer )
@@ -111,15 +268,18 @@ bool WriteTMSTileHandler::handleTile(const TileKey& key, const TileVisitor& tv)
             // convert the HF to an image
             ImageToHeightFieldConverter conv;
             osg::ref_ptr< osg::Image > image = conv.convert( hf.getHeightField(), _packager->getElevationPixelDepth() );				            
-            return osgDB::writeImageFile(*image.get(), path, _packager->getOptions());
+            if ( !osgDB::writeImageFile(*image.get(), path, _packager->getOptions()) )
+                return false;
+            _tileIndex->add( key );
+            return true;
         }            
     }
         
-    // If we didn't produce a result but the key isn't within range then we should continue to 
+    // If we didn't produce a result but the key isn't within range then we should continue to 
     // traverse the children b/c a min level was set.
-    if (!_layer->isKeyInRange(key))
-    {
-        return true;
+    if (!_layer->isKeyInRange(key))
+    {
+        return true;
     }
     return false;        
 } 
@@ -190,7 +350,9 @@ _visitor(new TileVisitor()),
     _width(0),
     _height(0),
     _overwrite(false),
-    _keepEmpties(false)
+    _keepEmpties(false),
+    _buildPyramid(false),
+    _numPyramidThreads(0)
 {
 }
 
@@ -274,6 +436,26 @@ void TMSPackager::setVisitor(TileVisitor* visitor)
     _visitor = visitor;
 }    
 
+bool TMSPackager::getBuildPyramid() const
+{
+    return _buildPyramid;
+}
+
+void TMSPackager::setBuildPyramid(bool buildPyramid)
+{
+    _buildPyramid = buildPyramid;
+}
+
+unsigned int TMSPackager::getNumPyramidThreads() const
+{
+    return _numPyramidThreads;
+}
+
+void TMSPackager::setNumPyramidThreads(unsigned int numThreads)
+{
+    _numPyramidThreads = numThreads;
+}
+
 void TMSPackager::run( TerrainLayer* layer,  Map* map  )
 {    
     // Get a test image from the root keys
@@ -386,7 +568,163 @@ void TMSPackager::run( TerrainLayer* layer,  Map* map  )
 
     _handler = new WriteTMSTileHandler(layer, map, this);    
     _visitor->setTileHandler( _handler );    
-    _visitor->run( map->getProfile() );    
+
+    // Processes handed an explicit list of keys are workers; they just write their keys.
+    bool pyramid =
+        _buildPyramid &&
+        _visitor->getMaxLevel() > _visitor->getMinLevel() &&
+        dynamic_cast<TileKeyListVisitor*>(_visitor.get()) == 0L;
+
+    if (pyramid)
+    {
+        unsigned int minLevel = _visitor->getMinLevel();
+        unsigned int maxLevel = _visitor->getMaxLevel();
+
+        // Don't start the pyramid past the deepest level the source has data for.
+        unsigned int baseLevel = maxLevel;
+        TileSource* ts = layer->getTileSource();
+        if (ts && ts->getProfile() && ts->getOptions().maxDataLevel().isSet())
+        {
+            unsigned int dataLevel = map->getProfile()->getEquivalentLOD( ts->getProfile(), ts->getOptions().maxDataLevel().get() );
+            baseLevel = osg::clampBetween( dataLevel, minLevel, maxLevel );
+        }
+
+        OE_NOTICE << LC << "Building a pyramid from level " << baseLevel << " up to level " << minLevel << std::endl;
+
+        // Read only the base level from the layer...
+        _visitor->setMinLevel( baseLevel );
+        _visitor->setMaxLevel( baseLevel );
+        _visitor->run( map->getProfile() );
+        _visitor->setMinLevel( minLevel );
+        _visitor->setMaxLevel( maxLevel );
+
+        // ...and build each coarser level from the one below it.
+        for (unsigned int lod = baseLevel; lod > minLevel; --lod)
+        {
+            buildPyramidLevel( lod-1, map->getProfile(), elevationLayer != 0L );
+        }
+    }
+    else
+    {
+        _visitor->run( map->getProfile() );    
+    }
+
+    // Write a tile existence index next to the tile map so the TMS driver can
+    // skip requests for tiles that were never written. Only a complete
+    // single-process traversal from the root produces a usable index.
+    TileExistenceIndex* index = _handler->getTileIndex();
+    if (index && !index->empty() &&
+        _visitor->getMinLevel() == 0 &&
+        _visitor->getExtents().empty() &&
+        dynamic_cast<MultiprocessTileVisitor*>(_visitor.get()) == 0L &&
+        dynamic_cast<TileKeyListVisitor*>(_visitor.get()) == 0L)
+    {
+        std::string indexFilename = osgDB::concatPaths( osgDB::concatPaths(_destination, toLegalFileName( _layerName )), "tileindex.txt");
+        index->write( indexFilename );
+        OE_INFO << LC << "Wrote tile index (" << index->size() << " tiles) to " << indexFilename << std::endl;
+    }
+}
+
+void TMSPackager::buildPyramidLevel( unsigned int lod, const Profile* profile, bool elevation )
+{
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    // Find the parents of all the tiles written at the next finer level,
+    // ordered by column to follow the TMS directory layout.
+    std::string levelPath = Stringify() << _destination << "/" << toLegalFileName( _layerName ) << "/" << (lod+1);
+
+    unsigned int numX, numY;
+    profile->getNumTiles( lod+1, numX, numY );
+
+    std::set< std::pair<unsigned int, unsigned int> > parents;
+
+    osgDB::DirectoryContents columns = osgDB::getDirectoryContents( levelPath );
+    for (unsigned int i = 0; i < columns.size(); ++i)
+    {
+        unsigned int x = as<unsigned int>( columns[i], numX );
+        if (x >= numX)
+            continue;
+
+        osgDB::DirectoryContents files = osgDB::getDirectoryContents( levelPath + "/" + columns[i] );
+        for (unsigned int j = 0; j < files.size(); ++j)
+        {
+            if (osgDB::getFileExtension(files[j]) != _extension)
+                continue;
+
+            unsigned int tmsY = as<unsigned int>( osgDB::getNameLessExtension(files[j]), numY );
+            if (tmsY >= numY)
+                continue;
+
+            unsigned int y = numY - tmsY - 1;
+            parents.insert( std::make_pair(x >> 1, y >> 1) );
+        }
+    }
+
+    if (parents.empty())
+        return;
+
+    if (_width == 0 || _height == 0)
+    {
+        OE_WARN << LC << "Unknown tile size; cannot build level " << lod << std::endl;
+        return;
+    }
+
+    PyramidTileBuilder builder;
+    builder._packager  = this;
+    builder._handler   = _handler.get();
+    builder._elevation = elevation;
+    builder._width     = _width;
+    builder._height    = _height;
+
+    unsigned int numThreads = _numPyramidThreads > 0 ? _numPyramidThreads : OpenThreads::GetNumberOfProcessors();
+    osg::ref_ptr<TaskService> service = new TaskService( "TMS pyramid", numThreads );
+
+    // Work through the level in a sliding window so that only a bounded
+    // number of tiles is in memory at a time.
+    const unsigned int windowSize = numThreads * 4;
+    unsigned int numWritten = 0;
+
+    std::set< std::pair<unsigned int, unsigned int> >::const_iterator itr = parents.begin();
+    while (itr != parents.end())
+    {
+        std::vector< TileKey > keys;
+        for (; itr != parents.end() && keys.size() < windowSize; ++itr)
+        {
+            TileKey key( lod, itr->first, itr->second, profile );
+            if (_visitor->intersects( key.getExtent() ))
+            {
+                keys.push_back( key );
+            }
+        }
+
+        if (keys.empty())
+            continue;
+
+        Threading::MultiEvent semaphore( (int)keys.size() );
+        std::vector< osg::ref_ptr< ParallelTask<BuildPyramidTile> > > tasks;
+        for (unsigned int i = 0; i < keys.size(); ++i)
+        {
+            ParallelTask<BuildPyramidTile>* task = new ParallelTask<BuildPyramidTile>( &semaphore );
+            task->_builder = &builder;
+            task->_key     = keys[i];
+            task->_written = false;
+            tasks.push_back( task );
+            service->add( task );
+        }
+        semaphore.wait();
+
+        for (unsigned int i = 0; i < tasks.size(); ++i)
+        {
+            if (tasks[i]->_written)
+            {
+                _handler->getTileIndex()->add( tasks[i]->_key );
+                ++numWritten;
+            }
+        }
+    }
+
+    OE_NOTICE << LC << "Built " << numWritten << " tiles at level " << lod << " in "
+        << prettyPrintTime( osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) ) << std::endl;
 }
 
 void TMSPackager::writeXML( TerrainLayer* layer, Map* map)
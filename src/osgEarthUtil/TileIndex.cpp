@@ -24,6 +24,8 @@
 #include <ogr_api.h>
 #include <osgEarthFeatures/OgrUtils>
 #include <osgDB/FileUtils>
+#include <algorithm>
+#include <cmath>
 
 using namespace osgEarth;
 using namespace osgEarth::Util;
@@ -33,7 +35,8 @@ using namespace std;
 
 #define OGR_SCOPED_LOCK GDAL_SCOPED_LOCK
 
-TileIndex::TileIndex()
+TileIndex::TileIndex() :
+_spatialIndexDirty( true )
 {
 }
 
@@ -103,24 +106,97 @@ TileIndex*
 
 
 void
-    TileIndex::getFiles(const osgEarth::GeoExtent& extent, std::vector< std::string >& files)
+TileIndex::buildSpatialIndex()
+{
+    std::vector< std::string > locations;
+    std::vector< Bounds >      footprints;
+    FeatureSpatialIndex::EntryVector entries;
+
+    osg::ref_ptr< FeatureCursor > cursor = _features->createFeatureCursor();
+    while (cursor.valid() && cursor->hasMore())
+    {
+        osg::ref_ptr< Feature > feature = cursor->nextFeature();
+        if (feature.valid() && feature->getGeometry())
+        {
+            Bounds b = feature->getGeometry()->getBounds();
+            if ( b.isValid() )
+            {
+                entries.push_back( FeatureSpatialIndex::Entry(locations.size(), b.xMin(), b.yMin(), b.xMax(), b.yMax()) );
+                locations.push_back( getFullPath(_filename, feature->getString("location")) );
+                footprints.push_back( b );
+            }
+        }
+    }
+
+    OE_INFO << "[TileIndex] Indexed " << locations.size() << " files from " << _filename << std::endl;
+
+    _spatialIndex = new FeatureSpatialIndex( entries );
+    _locations.swap( locations );
+    _footprints.swap( footprints );
+    _spatialIndexDirty = false;
+}
+
+namespace
+{
+    // Whether any of n pixel-center posts spread over [min, max] falls in [lo, hi].
+    bool coversPost(double min, double max, unsigned n, double lo, double hi)
+    {
+        double d = (max - min) / (double)n;
+        if ( d <= 0.0 )
+            return true;
+
+        double first = ceil ( (lo - min)/d - 0.5 );
+        double last  = floor( (hi - min)/d - 0.5 );
+        if ( first < 0.0 ) first = 0.0;
+        if ( last > (double)(n-1) ) last = (double)(n-1);
+        return first <= last;
+    }
+}
+
+void
+    TileIndex::getFiles(const osgEarth::GeoExtent& extent, std::vector< std::string >& files, unsigned postsPerSide)
 {            
     files.clear();
-    osgEarth::Symbology::Query query;    
 
     GeoExtent transformed = extent.transform( _features->getFeatureProfile()->getSRS() );
-    query.bounds() = transformed.bounds();
-    osg::ref_ptr< osgEarth::Features::FeatureCursor> cursor = _features->createFeatureCursor( query );
+    const Bounds bounds = transformed.bounds();
+
+    bool dirty;
+    {
+        Threading::ScopedReadLock shared( _spatialIndexMutex );
+        dirty = _spatialIndexDirty;
+    }
 
-    while (cursor->hasMore())
+    if ( dirty )
     {
-        osg::ref_ptr< osgEarth::Features::Feature> feature = cursor->nextFeature();
-        if (feature.valid())
+        Threading::ScopedWriteLock exclusive( _spatialIndexMutex );
+        if ( _spatialIndexDirty )
+            buildSpatialIndex();
+    }
+
+    Threading::ScopedReadLock shared( _spatialIndexMutex );
+
+    std::vector< FeatureID > hits;
+    _spatialIndex->query( bounds, hits );
+
+    // query order is arbitrary; keep the index order so files composite consistently.
+    std::sort( hits.begin(), hits.end() );
+
+    for( std::vector< FeatureID >::const_iterator i = hits.begin(); i != hits.end(); ++i )
+    {
+        if ( *i >= _locations.size() )
+            continue;
+
+        const Bounds& fp = _footprints[*i];
+        if ( postsPerSide > 0 && !(
+             coversPost(bounds.xMin(), bounds.xMax(), postsPerSide, fp.xMin(), fp.xMax()) &&
+             coversPost(bounds.yMin(), bounds.yMax(), postsPerSide, fp.yMin(), fp.yMax())) )
         {
-            std::string location = getFullPath(_filename, feature->getString("location"));
-            files.push_back( location );
+            continue;
         }
-    }    
+
+        files.push_back( _locations[*i] );
+    }
 }
 
 bool TileIndex::add( const std::string& filename, const GeoExtent& extent )
@@ -138,6 +214,10 @@ bool TileIndex::add( const std::string& filename, const GeoExtent& extent )
     const SpatialReference* wgs84 = SpatialReference::create("epsg:4326");
     feature->transform( wgs84 );
 
-    return _features->insertFeature( feature.get() );    
-    return true;
+    bool ok = _features->insertFeature( feature.get() );
+
+    Threading::ScopedWriteLock exclusive( _spatialIndexMutex );
+    _spatialIndexDirty = true;
+
+    return ok;
 }
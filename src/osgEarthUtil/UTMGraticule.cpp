@@ -33,9 +33,11 @@
 #include <osgEarth/CullingUtils>
 #include <osgEarth/DrapeableNode>
 #include <osgEarth/ThreadingUtils>
+#include <osgEarth/TaskService>
 
 #include <OpenThreads/Mutex>
 #include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
 #include <osg/PagedLOD>
 #include <osg/Depth>
 #include <osg/Program>
@@ -66,6 +68,7 @@ _textScale   ( 1.0f )
 void
 UTMGraticuleOptions::mergeConfig( const Config& conf )
 {
+    conf.getIfSet( "num_threads", _numThreads );
     //todo
 }
 
@@ -74,12 +77,29 @@ UTMGraticuleOptions::getConfig() const
 {
     Config conf = ConfigOptions::newConfig();
     conf.key() = "utm_graticule";
+    conf.addIfSet( "num_threads", _numThreads );
     //todo
     return conf;
 }
 
 //---------------------------------------------------------------------------
 
+/** Builds one GZD tile; runs in a TaskService thread. */
+struct UTMGraticule::BuildGZDTile
+{
+    void execute()
+    {
+        _tile = _graticule->buildGZDTile( _designator, _extent );
+    }
+
+    UTMGraticule*           _graticule;
+    std::string             _designator;
+    GeoExtent               _extent;
+    osg::ref_ptr<osg::Node> _tile;
+};
+
+//---------------------------------------------------------------------------
+
 
 UTMGraticule::UTMGraticule( MapNode* mapNode ) :
 _mapNode   ( mapNode ),
@@ -254,13 +274,38 @@ UTMGraticule::rebuild()
     _gzd.erase( "34X" );
     _gzd.erase( "36X" );
 
-    // now build the lateral tiles for the GZD level.
+    // now build the lateral tiles for the GZD level. There are over a thousand
+    // of them and each one is compiled independently, so spread them across
+    // a pool of threads and add the results in table order.
+    unsigned numThreads = _options->numThreads().isSet() ?
+        _options->numThreads().get() :
+        (unsigned)osg::clampBetween( OpenThreads::GetNumberOfProcessors(), 1, 16 );
+    numThreads = osg::clampBetween( numThreads, 1u, (unsigned)_gzd.size() );
+
+    osg::ref_ptr<TaskService> service = new TaskService( "UTMGraticule", numThreads );
+    Threading::MultiEvent semaphore( (int)_gzd.size() );
+    std::vector< osg::ref_ptr< ParallelTask<BuildGZDTile> > > tasks;
+    tasks.reserve( _gzd.size() );
+
     for( SectorTable::iterator i = _gzd.begin(); i != _gzd.end(); ++i )
     {
-        osg::Node* tile = buildGZDTile( i->first, i->second );
-        if ( tile )
-            _root->addChild( tile );
+        ParallelTask<BuildGZDTile>* task = new ParallelTask<BuildGZDTile>( &semaphore );
+        task->_graticule  = this;
+        task->_designator = i->first;
+        task->_extent     = i->second;
+        tasks.push_back( task );
+        service->add( task );
+    }
+    semaphore.wait();
+
+    for( unsigned i = 0; i < tasks.size(); ++i )
+    {
+        if ( tasks[i]->_tile.valid() )
+            _root->addChild( tasks[i]->_tile.get() );
     }
+
+    OE_INFO << LC << "Built " << _root->getNumChildren() << " grid zone tiles on "
+        << numThreads << " threads" << std::endl;
 }
 
 
@@ -330,10 +375,12 @@ UTMGraticule::buildGZDTile( const std::string& name, const GeoExtent& extent )
         extent.getSRS()->transform( osg::Vec3d(extent.xMin(),tileCenter.y(),0), ecefSRS, west );
         extent.getSRS()->transform( osg::Vec3d(extent.xMax(),tileCenter.y(),0), ecefSRS, east );
 
-        TextSymbol* textSym = _options->primaryStyle()->getOrCreate<TextSymbol>();
+        // copy the symbol, since tiles are built concurrently and each one
+        // sizes its label to fit:
+        osg::ref_ptr<TextSymbol> textSym = new TextSymbol( *_options->primaryStyle()->get<TextSymbol>() );
         textSym->size() = (west-east).length() / 3.0;
 
-        TextSymbolizer ts( textSym );
+        TextSymbolizer ts( textSym.get() );
         
         osg::Geode* textGeode = new osg::Geode();        
         osg::Drawable* d = ts.create(name);
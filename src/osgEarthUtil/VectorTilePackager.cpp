@@ -0,0 +1,605 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthUtil/VectorTilePackager>
+#include <osgEarth/FileUtils>
+#include <osgEarth/SpatialReference>
+#include <osgEarthSymbology/Geometry>
+#include <osg/Math>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+
+#define LC "[VectorTilePackager] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+using namespace osgEarth::Util;
+using namespace osgEarth::Util::VectorTileFormat;
+
+/******************************************************************************************/
+
+namespace
+{
+    // indices into the feature list, in source order
+    typedef std::vector<unsigned> EntryList;
+
+    struct Tile
+    {
+        TileKey   _key;
+        EntryList _entries;
+    };
+
+    bool isPoint(const Bounds& b)
+    {
+        return b.xMin() == b.xMax() && b.yMin() == b.yMax();
+    }
+
+    /** Whether a feature with the given bounds may land in a tile. */
+    bool accepts(const GeoExtent& extent, const Bounds& b)
+    {
+        // a single point's bounds aren't valid for an intersection check.
+        if ( isPoint(b) )
+            return extent.contains( b.xMin(), b.yMin() );
+
+        return
+            b.xMin() <= extent.xMax() && b.xMax() >= extent.xMin() &&
+            b.yMin() <= extent.yMax() && b.yMax() >= extent.yMin();
+    }
+
+    /**
+     * Crops a geometry to a tile. Returns NULL if nothing is left, and sets
+     * "failed" if the geometry couldn't be cropped at all.
+     */
+    Geometry* cropToTile(Geometry* geom, const Bounds& bounds, const GeoExtent& extent, const Polygon* cropPoly, bool& failed)
+    {
+        failed = false;
+
+        if ( extent.contains(bounds) )
+            return geom;
+
+        // points don't need GEOS; keep the ones inside the tile.
+        if ( geom->getComponentType() == Geometry::TYPE_POINTSET )
+        {
+            osg::ref_ptr<PointSet> kept = new PointSet();
+            ConstGeometryIterator i( geom, false );
+            while( i.hasMore() )
+            {
+                const Geometry* part = i.next();
+                for( Geometry::const_iterator p = part->begin(); p != part->end(); ++p )
+                {
+                    if ( extent.contains(p->x(), p->y()) )
+                        kept->push_back( *p );
+                }
+            }
+            return kept->empty() ? 0L : kept.release();
+        }
+
+        osg::ref_ptr<Geometry> cropped;
+        if ( !geom->crop(cropPoly, cropped) )
+        {
+            failed = true;
+            return 0L;
+        }
+
+        return cropped.valid() && cropped->isValid() ? cropped.release() : 0L;
+    }
+
+    void addPart(const Geometry* geom, unsigned type, std::vector<PartRecord>& parts, std::vector<osg::Vec3d>& points)
+    {
+        PartRecord part;
+        part.firstPoint = points.size();
+        part.numPoints  = geom->size();
+        part.type       = type;
+        part.reserved   = 0u;
+        parts.push_back( part );
+        points.insert( points.end(), geom->begin(), geom->end() );
+    }
+
+    /** Flattens a geometry into part records, polygons followed by their holes. */
+    void addParts(const Geometry* geom, std::vector<PartRecord>& parts, std::vector<osg::Vec3d>& points)
+    {
+        if ( geom->getType() == Geometry::TYPE_MULTI )
+        {
+            const GeometryCollection& components = static_cast<const MultiGeometry*>(geom)->getComponents();
+            for( GeometryCollection::const_iterator i = components.begin(); i != components.end(); ++i )
+            {
+                if ( i->valid() )
+                    addParts( i->get(), parts, points );
+            }
+            return;
+        }
+
+        if ( geom->empty() )
+            return;
+
+        switch( geom->getType() )
+        {
+        case Geometry::TYPE_POINTSET:   addPart( geom, PART_POINTSET, parts, points ); break;
+        case Geometry::TYPE_LINESTRING: addPart( geom, PART_LINESTRING, parts, points ); break;
+        case Geometry::TYPE_RING:       addPart( geom, PART_RING, parts, points ); break;
+        case Geometry::TYPE_POLYGON:
+            {
+                addPart( geom, PART_POLYGON, parts, points );
+                const RingCollection& holes = static_cast<const Polygon*>(geom)->getHoles();
+                for( RingCollection::const_iterator h = holes.begin(); h != holes.end(); ++h )
+                {
+                    if ( h->valid() && !(*h)->empty() )
+                        addPart( h->get(), PART_HOLE, parts, points );
+                }
+            }
+            break;
+        default: break;
+        }
+    }
+
+    /** Appends 8-byte aligned sections to a tile block. */
+    struct BlockWriter
+    {
+        unsigned long long append(const void* data, unsigned long long bytes)
+        {
+            _buf.resize( (std::size_t)align(_buf.size()), 0 );
+            unsigned long long offset = _buf.size();
+            if ( bytes > 0ull )
+                _buf.insert( _buf.end(), (const char*)data, (const char*)data + bytes );
+            return offset;
+        }
+
+        template<typename T>
+        unsigned long long append(const std::vector<T>& v)
+        {
+            return append( v.empty() ? 0L : &v[0], v.size() * sizeof(T) );
+        }
+
+        std::vector<char> _buf;
+    };
+
+    /** The attribute columns of a file. */
+    struct Columns
+    {
+        std::vector<std::string>        _names;
+        std::vector<AttributeType>      _types;
+        std::map<std::string, unsigned> _lookup;
+
+        void add(const std::string& name, AttributeType type)
+        {
+            std::map<std::string, unsigned>::iterator i = _lookup.find( name );
+            if ( i == _lookup.end() )
+            {
+                _lookup[name] = _names.size();
+                _names.push_back( name );
+                _types.push_back( type );
+            }
+            else if ( _types[i->second] == ATTRTYPE_UNSPECIFIED )
+            {
+                _types[i->second] = type;
+            }
+        }
+    };
+
+    /** Lays out one tile's features in a block. */
+    void encodeTile(const std::vector<const Feature*>& features, const std::vector< osg::ref_ptr<Geometry> >& geoms,
+                    const Columns& columns, std::vector<char>& output)
+    {
+        unsigned n = features.size();
+
+        std::vector<unsigned long long> fids( n );
+        std::vector<unsigned>           featureParts( 1, 0u );
+        std::vector<PartRecord>         parts;
+        std::vector<osg::Vec3d>         points;
+
+        for( unsigned i = 0; i < n; ++i )
+        {
+            fids[i] = features[i]->getFID();
+            addParts( geoms[i].get(), parts, points );
+            featureParts.push_back( parts.size() );
+        }
+
+        // quantise across the bounds of the tile's points.
+        Bounds b;
+        bool hasZ = false;
+        for( std::vector<osg::Vec3d>::const_iterator p = points.begin(); p != points.end(); ++p )
+        {
+            b.expandBy( p->x(), p->y() );
+            hasZ = hasZ || p->z() != 0.0;
+        }
+
+        TileHeader header;
+        ::memset( &header, 0, sizeof(TileHeader) );
+        header.numFeatures = n;
+        header.numParts    = parts.size();
+        header.numPoints   = points.size();
+        header.hasZ        = hasZ ? 1u : 0u;
+        header.origin[0]   = points.empty() ? 0.0 : b.xMin();
+        header.origin[1]   = points.empty() ? 0.0 : b.yMin();
+        header.scale[0]    = points.empty() ? 0.0 : b.width()  / QUANTA;
+        header.scale[1]    = points.empty() ? 0.0 : b.height() / QUANTA;
+
+        std::vector<unsigned> xy( 2*points.size() );
+        std::vector<float>    z;
+        if ( hasZ )
+            z.resize( points.size() );
+
+        for( unsigned k = 0; k < points.size(); ++k )
+        {
+            for( unsigned axis = 0; axis < 2; ++axis )
+            {
+                double q = header.scale[axis] > 0.0 ? (points[k][axis] - header.origin[axis]) / header.scale[axis] : 0.0;
+                xy[2*k+axis] = (unsigned)osg::clampBetween( ::floor(q + 0.5), 0.0, QUANTA );
+            }
+            if ( hasZ )
+                z[k] = (float)points[k].z();
+        }
+
+        BlockWriter block;
+        block.append( &header, sizeof(TileHeader) );
+        header.fidsOffset         = block.append( fids );
+        header.featurePartsOffset = block.append( featureParts );
+        header.partsOffset        = block.append( parts );
+        header.xyOffset           = block.append( xy );
+        header.zOffset            = hasZ ? block.append( z ) : 0ull;
+
+        std::string                     strings;
+        std::vector<unsigned long long> columnOffsets( columns._names.size() );
+
+        for( unsigned a = 0; a < columns._names.size(); ++a )
+        {
+            const std::string& name = columns._names[a];
+            AttributeType      type = columns._types[a];
+
+            std::vector<unsigned char> valid( n, 0 );
+            std::vector<int>           ints;
+            std::vector<double>        doubles;
+            std::vector<unsigned char> bools;
+            std::vector<unsigned>      offsets;
+
+            if      ( type == ATTRTYPE_INT )    ints.resize( n, 0 );
+            else if ( type == ATTRTYPE_DOUBLE ) doubles.resize( n, 0.0 );
+            else if ( type == ATTRTYPE_BOOL )   bools.resize( n, 0 );
+            else                                offsets.resize( n+1, strings.size() );
+
+            for( unsigned i = 0; i < n; ++i )
+            {
+                const AttributeTable&          attrs = features[i]->getAttrs();
+                AttributeTable::const_iterator attr  = attrs.find( name );
+                bool set = attr != attrs.end() && attr->second.second.set;
+                valid[i] = set ? 1 : 0;
+
+                if      ( type == ATTRTYPE_INT )    { if ( set ) ints[i]    = attr->second.getInt(); }
+                else if ( type == ATTRTYPE_DOUBLE ) { if ( set ) doubles[i] = attr->second.getDouble(); }
+                else if ( type == ATTRTYPE_BOOL )   { if ( set ) bools[i]   = attr->second.getBool() ? 1 : 0; }
+                else
+                {
+                    if ( set )
+                        strings += attr->second.getString();
+                    offsets[i+1] = strings.size();
+                }
+            }
+
+            columnOffsets[a] =
+                type == ATTRTYPE_INT    ? block.append( ints ) :
+                type == ATTRTYPE_DOUBLE ? block.append( doubles ) :
+                type == ATTRTYPE_BOOL   ? block.append( bools ) :
+                                          block.append( offsets );
+            block.append( valid );
+        }
+
+        header.columnsOffset = block.append( columnOffsets );
+        header.stringsOffset = block.append( strings.data(), strings.size() );
+        header.stringsSize   = strings.size();
+
+        ::memcpy( &block._buf[0], &header, sizeof(TileHeader) );
+        output.swap( block._buf );
+    }
+
+    /** Writes data followed by zeros up to the next section boundary. */
+    void writePadded(std::ostream& out, const void* data, unsigned long long bytes, unsigned long long& pos)
+    {
+        static const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+        if ( bytes > 0ull )
+            out.write( (const char*)data, (std::streamsize)bytes );
+        pos += bytes;
+        unsigned long long pad = align(pos) - pos;
+        out.write( zeros, (std::streamsize)pad );
+        pos += pad;
+    }
+}
+
+/******************************************************************************************/
+
+VectorTilePackager::VectorTilePackager() :
+_firstLevel ( 0 ),
+_maxLevel   ( 10 ),
+_maxFeatures( 300 )
+{
+    //nop
+}
+
+bool
+VectorTilePackager::package( FeatureSource* features, const std::string& filename )
+{
+    if ( !features || !features->getFeatureProfile() )
+    {
+        OE_WARN << LC << "Feature source is missing or has no profile" << std::endl;
+        return false;
+    }
+
+    osg::ref_ptr<const SpatialReference> srs;
+    if ( !_destSRSString.empty() )
+    {
+        srs = SpatialReference::create( _destSRSString );
+    }
+
+    //Get the destination SRS from the feature source if it's not already set
+    if ( !srs.valid() )
+    {
+        srs = features->getFeatureProfile()->getSRS();
+    }
+
+    //Get the extent of the dataset, or use the custom extent value
+    GeoExtent srsExtent = _customExtent;
+    if ( !srsExtent.isValid() )
+        srsExtent = features->getFeatureProfile()->getExtent();
+
+    GeoExtent extent = srsExtent.transform( srs.get() );
+    if ( !extent.isValid() )
+    {
+        OE_WARN << LC << "Failed to transform the extent " << srsExtent.toString() << " to the destination SRS" << std::endl;
+        return false;
+    }
+
+    osg::ref_ptr<const Profile> profile = Profile::create( srs.get(), extent.xMin(), extent.yMin(), extent.xMax(), extent.yMax(), 1, 1 );
+    TileKey rootKey( 0, 0, 0, profile.get() );
+
+    // Read and reproject the features, and work out the attribute columns.
+    std::vector< osg::ref_ptr<Feature> > source;
+    std::vector< Bounds >                bounds;
+    Columns                              columns;
+    int                                  skipped = 0;
+
+    const FeatureSchema& schema = features->getSchema();
+    for( FeatureSchema::const_iterator i = schema.begin(); i != schema.end(); ++i )
+    {
+        columns.add( i->first, i->second );
+    }
+
+    osg::ref_ptr< FeatureCursor > cursor = features->createFeatureCursor( _query );
+    while( cursor.valid() && cursor->hasMore() )
+    {
+        osg::ref_ptr< Feature > feature = cursor->nextFeature();
+
+        //Reproject the feature to the dest SRS if it's not already
+        if ( !feature->getSRS()->isEquivalentTo( srs.get() ) )
+        {
+            feature->transform( srs.get() );
+        }
+
+        Geometry* geom = feature->getGeometry();
+        if ( geom && geom->getBounds().isValid() && geom->isValid() )
+        {
+            const AttributeTable& attrs = feature->getAttrs();
+            for( AttributeTable::const_iterator a = attrs.begin(); a != attrs.end(); ++a )
+            {
+                columns.add( a->first, a->second.second.set ? a->second.first : ATTRTYPE_UNSPECIFIED );
+            }
+
+            source.push_back( feature.get() );
+            bounds.push_back( geom->getBounds() );
+        }
+        else
+        {
+            OE_NOTICE << LC << "Skipping feature " << feature->getFID() << " with null or invalid geometry" << std::endl;
+            skipped++;
+        }
+    }
+    cursor = 0L;
+
+    // columns with no values still need a layout.
+    for( unsigned a = 0; a < columns._types.size(); ++a )
+    {
+        if ( columns._types[a] == ATTRTYPE_UNSPECIFIED )
+            columns._types[a] = ATTRTYPE_STRING;
+    }
+
+    // Build the quadtree a level at a time. A tile keeps the first maxFeatures of
+    // its candidates and hands the rest to every child they touch.
+    std::vector<Tile> tiles;
+    std::vector<Tile> level( 1 );
+    level[0]._key = rootKey;
+    for( unsigned i = 0; i < source.size(); ++i )
+    {
+        if ( accepts(rootKey.getExtent(), bounds[i]) )
+            level[0]._entries.push_back( i );
+    }
+
+    while( !level.empty() )
+    {
+        std::vector<Tile> next;
+
+        for( unsigned t = 0; t < level.size(); ++t )
+        {
+            const Tile& tile = level[t];
+            unsigned    lod  = tile._key.getLevelOfDetail();
+            EntryList::const_iterator rest = tile._entries.begin();
+
+            if ( lod >= _firstLevel )
+            {
+                unsigned keep = lod >= _maxLevel ? tile._entries.size() : osg::minimum((unsigned)tile._entries.size(), _maxFeatures);
+                tiles.push_back( Tile() );
+                tiles.back()._key = tile._key;
+                tiles.back()._entries.assign( tile._entries.begin(), tile._entries.begin() + keep );
+                rest += keep;
+            }
+
+            if ( rest == tile._entries.end() || lod >= _maxLevel )
+                continue;
+
+            Tile children[4];
+            for( unsigned c = 0; c < 4; ++c )
+                children[c]._key = tile._key.createChildKey( c );
+
+            for( ; rest != tile._entries.end(); ++rest )
+            {
+                for( unsigned c = 0; c < 4; ++c )
+                {
+                    if ( accepts(children[c]._key.getExtent(), bounds[*rest]) )
+                        children[c]._entries.push_back( *rest );
+                }
+            }
+
+            for( unsigned c = 0; c < 4; ++c )
+            {
+                if ( !children[c]._entries.empty() )
+                    next.push_back( children[c] );
+            }
+        }
+
+        level.swap( next );
+    }
+
+    // Lay out everything ahead of the tiles; the index is written last, once
+    // the tile offsets are known.
+    std::string wkt = srs->getWKT();
+
+    FileHeader header;
+    ::memset( &header, 0, sizeof(FileHeader) );
+    header.magic         = MAGIC;
+    header.version       = VERSION;
+    header.endian        = ENDIAN;
+    header.firstLevel    = _firstLevel;
+    header.maxLevel      = _maxLevel;
+    header.numAttributes = columns._names.size();
+    header.numTiles      = tiles.size();
+    header.extent[0]     = extent.xMin();
+    header.extent[1]     = extent.yMin();
+    header.extent[2]     = extent.xMax();
+    header.extent[3]     = extent.yMax();
+
+    unsigned long long offset = align( sizeof(FileHeader) );
+    header.srsOffset        = offset;
+    header.srsLength        = wkt.size();
+    offset = align( offset + wkt.size() );
+    header.attributesOffset = offset;
+    offset += columns._names.size() * sizeof(AttributeDef);
+
+    std::vector<AttributeDef> defs( columns._names.size() );
+    std::string names;
+    for( unsigned a = 0; a < defs.size(); ++a )
+    {
+        defs[a].type       = columns._types[a];
+        defs[a].nameLength = columns._names[a].size();
+        defs[a].nameOffset = offset + names.size();
+        names += columns._names[a];
+    }
+    offset = align( offset + names.size() );
+    header.indexOffset = offset;
+
+    osgEarth::makeDirectoryForFile( filename );
+    std::ofstream out( filename.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
+    if ( !out.is_open() )
+    {
+        OE_WARN << LC << "Failed to open " << filename << " for writing" << std::endl;
+        return false;
+    }
+
+    unsigned long long pos = 0ull;
+    writePadded( out, &header, sizeof(FileHeader), pos );
+    writePadded( out, wkt.data(), wkt.size(), pos );
+    out.write( defs.empty() ? 0L : (const char*)&defs[0], defs.size() * sizeof(AttributeDef) );
+    pos += defs.size() * sizeof(AttributeDef);
+    writePadded( out, names.data(), names.size(), pos );
+
+    std::vector<TileIndexEntry> index( tiles.size() );
+    ::memset( index.empty() ? 0L : &index[0], 0, index.size() * sizeof(TileIndexEntry) );
+    writePadded( out, index.empty() ? 0L : &index[0], index.size() * sizeof(TileIndexEntry), pos );
+
+    // Crop and write the tiles.
+    osg::ref_ptr<Polygon> cropPoly = new Polygon();
+    unsigned written = 0u;
+    int highestLevel = 0;
+
+    for( unsigned t = 0; t < tiles.size(); ++t )
+    {
+        const Tile&      tile       = tiles[t];
+        const GeoExtent& tileExtent = tile._key.getExtent();
+
+        cropPoly->clear();
+        cropPoly->push_back( osg::Vec3d( tileExtent.xMin(), tileExtent.yMin(), 0 ));
+        cropPoly->push_back( osg::Vec3d( tileExtent.xMax(), tileExtent.yMin(), 0 ));
+        cropPoly->push_back( osg::Vec3d( tileExtent.xMax(), tileExtent.yMax(), 0 ));
+        cropPoly->push_back( osg::Vec3d( tileExtent.xMin(), tileExtent.yMax(), 0 ));
+
+        std::vector<const Feature*>           tileFeatures;
+        std::vector< osg::ref_ptr<Geometry> > tileGeoms;
+
+        for( EntryList::const_iterator e = tile._entries.begin(); e != tile._entries.end(); ++e )
+        {
+            bool failed;
+            osg::ref_ptr<Geometry> geom = cropToTile( source[*e]->getGeometry(), bounds[*e], tileExtent, cropPoly.get(), failed );
+
+            // can't crop (no GEOS): the whole feature goes to the tile holding its center.
+            if ( failed && tileExtent.contains(bounds[*e].center().x(), bounds[*e].center().y()) )
+                geom = source[*e]->getGeometry();
+
+            if ( geom.valid() )
+            {
+                tileFeatures.push_back( source[*e].get() );
+                tileGeoms.push_back( geom.get() );
+            }
+        }
+
+        std::vector<char> block;
+        encodeTile( tileFeatures, tileGeoms, columns, block );
+
+        TileIndexEntry& entry = index[t];
+        entry.lod         = tile._key.getLevelOfDetail();
+        entry.x           = tile._key.getTileX();
+        entry.y           = tile._key.getTileY();
+        entry.numFeatures = tileFeatures.size();
+        entry.offset      = pos;
+        entry.size        = block.size();
+        writePadded( out, &block[0], block.size(), pos );
+
+        written += tileFeatures.size();
+        highestLevel = osg::maximum( highestLevel, (int)entry.lod );
+    }
+
+    // readers page no deeper than the last level that has tiles.
+    header.maxLevel = osg::maximum( (unsigned)highestLevel, _firstLevel );
+    out.seekp( 0 );
+    out.write( (const char*)&header, sizeof(FileHeader) );
+
+    std::sort( index.begin(), index.end() );
+    out.seekp( (std::streamoff)header.indexOffset );
+    out.write( index.empty() ? 0L : (const char*)&index[0], index.size() * sizeof(TileIndexEntry) );
+    out.close();
+
+    if ( out.fail() )
+    {
+        OE_WARN << LC << "Failed to write " << filename << std::endl;
+        return false;
+    }
+
+    OE_NOTICE << LC << "Wrote " << tiles.size() << " tiles (" << written << " tiled features from "
+        << source.size() << " source features, " << skipped << " skipped) to " << filename
+        << "; deepest populated level " << highestLevel << std::endl;
+
+    return true;
+}
@@ -0,0 +1,399 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthUtil/VectorTiles>
+#include <osgEarth/SpatialReference>
+#include <osgEarthSymbology/Geometry>
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#else
+#   include <unistd.h>
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#endif
+
+#define LC "[VectorTileFile] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+using namespace osgEarth::Util;
+using namespace osgEarth::Util::VectorTileFormat;
+
+//------------------------------------------------------------------------
+
+/**
+ * Read-only memory mapping of a whole file.
+ */
+class VectorTileFile::Mapping : public osg::Referenced
+{
+public:
+    Mapping( const std::string& path ) :
+    _data( 0L ),
+    _size( 0ull )
+    {
+#ifdef _WIN32
+        _map  = 0L;
+        _file = ::CreateFileA(
+            path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+            0L, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0L );
+
+        LARGE_INTEGER fileSize;
+        if ( _file != INVALID_HANDLE_VALUE && ::GetFileSizeEx(_file, &fileSize) && fileSize.QuadPart > 0 )
+        {
+            _map = ::CreateFileMappingA( _file, 0L, PAGE_READONLY, 0, 0, 0L );
+            if ( _map )
+            {
+                _data = static_cast<const char*>( ::MapViewOfFile(_map, FILE_MAP_READ, 0, 0, 0) );
+                if ( _data )
+                    _size = (unsigned long long)fileSize.QuadPart;
+            }
+        }
+#else
+        _fd = ::open( path.c_str(), O_RDONLY );
+
+        struct stat s;
+        if ( _fd >= 0 && ::fstat(_fd, &s) == 0 && s.st_size > 0 && (unsigned long long)s.st_size <= (unsigned long long)(~(std::size_t)0) )
+        {
+            void* ptr = ::mmap( 0L, (std::size_t)s.st_size, PROT_READ, MAP_SHARED, _fd, 0 );
+            if ( ptr != MAP_FAILED )
+            {
+                _data = static_cast<const char*>(ptr);
+                _size = (unsigned long long)s.st_size;
+            }
+        }
+#endif
+    }
+
+    bool valid() const { return _data != 0L; }
+
+    const char* data() const { return _data; }
+
+    unsigned long long size() const { return _size; }
+
+protected:
+    virtual ~Mapping()
+    {
+#ifdef _WIN32
+        if ( _data )
+            ::UnmapViewOfFile( _data );
+        if ( _map )
+            ::CloseHandle( _map );
+        if ( _file != INVALID_HANDLE_VALUE )
+            ::CloseHandle( _file );
+#else
+        if ( _data )
+            ::munmap( const_cast<char*>(_data), (std::size_t)_size );
+        if ( _fd >= 0 )
+            ::close( _fd );
+#endif
+    }
+
+    const char*        _data;
+    unsigned long long _size;
+#ifdef _WIN32
+    HANDLE             _file;
+    HANDLE             _map;
+#else
+    int                _fd;
+#endif
+};
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    /** Pointer to a section of a tile block, or NULL if it runs past the block. */
+    template<typename T>
+    const T* section(const char* block, unsigned long long blockSize, unsigned long long offset, unsigned long long count)
+    {
+        unsigned long long bytes = count * sizeof(T);
+        if ( offset > blockSize || bytes > blockSize - offset || (offset & 7ull) != 0ull )
+            return 0L;
+        return reinterpret_cast<const T*>( block + offset );
+    }
+
+    Geometry* createPart(unsigned type, unsigned numPoints)
+    {
+        switch( type )
+        {
+        case PART_POINTSET:   return new PointSet( numPoints );
+        case PART_LINESTRING: return new LineString( numPoints );
+        case PART_RING:
+        case PART_HOLE:       return new Ring( numPoints );
+        case PART_POLYGON:    return new Polygon( numPoints );
+        default:              return 0L;
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+
+VectorTileFile*
+VectorTileFile::open(const std::string& path)
+{
+    osg::ref_ptr<VectorTileFile> file = new VectorTileFile();
+    return file->init( path ) ? file.release() : 0L;
+}
+
+VectorTileFile::VectorTileFile() :
+_firstLevel( 0u ),
+_maxLevel  ( 0u ),
+_numTiles  ( 0u ),
+_index     ( 0L )
+{
+    //nop
+}
+
+VectorTileFile::~VectorTileFile()
+{
+    //nop
+}
+
+const char*
+VectorTileFile::at(unsigned long long offset, unsigned long long size) const
+{
+    if ( offset > _mapping->size() || size > _mapping->size() - offset || (offset & 7ull) != 0ull )
+        return 0L;
+    return _mapping->data() + offset;
+}
+
+bool
+VectorTileFile::init(const std::string& path)
+{
+    _mapping = new Mapping( path );
+    if ( !_mapping->valid() )
+    {
+        OE_WARN << LC << "Failed to map \"" << path << "\"" << std::endl;
+        return false;
+    }
+
+    const FileHeader* header = reinterpret_cast<const FileHeader*>( at(0ull, sizeof(FileHeader)) );
+    if ( !header || header->magic != MAGIC || header->endian != ENDIAN )
+    {
+        OE_WARN << LC << "\"" << path << "\" is not a vector tile file, or was written on a platform with a different byte order" << std::endl;
+        return false;
+    }
+
+    if ( header->version != VERSION )
+    {
+        OE_WARN << LC << "\"" << path << "\" has unsupported version " << header->version << std::endl;
+        return false;
+    }
+
+    const char* wkt = at( header->srsOffset, header->srsLength );
+    osg::ref_ptr<const SpatialReference> srs = wkt ? SpatialReference::create( std::string(wkt, (std::size_t)header->srsLength) ) : 0L;
+    if ( !srs.valid() )
+    {
+        OE_WARN << LC << "\"" << path << "\" has an invalid SRS" << std::endl;
+        return false;
+    }
+
+    _profile = Profile::create( srs.get(), header->extent[0], header->extent[1], header->extent[2], header->extent[3], 1, 1 );
+    _firstLevel = header->firstLevel;
+    _maxLevel   = header->maxLevel;
+
+    const AttributeDef* defs = reinterpret_cast<const AttributeDef*>(
+        at(header->attributesOffset, (unsigned long long)header->numAttributes * sizeof(AttributeDef)) );
+    if ( !defs && header->numAttributes > 0u )
+    {
+        OE_WARN << LC << "\"" << path << "\" has a corrupt attribute table" << std::endl;
+        return false;
+    }
+
+    for( unsigned i = 0; i < header->numAttributes; ++i )
+    {
+        // names are packed end to end, so they needn't be aligned.
+        const char* name = defs[i].nameOffset <= _mapping->size() && defs[i].nameLength <= _mapping->size() - defs[i].nameOffset ?
+            _mapping->data() + defs[i].nameOffset : 0L;
+        if ( !name )
+        {
+            OE_WARN << LC << "\"" << path << "\" has a corrupt attribute table" << std::endl;
+            return false;
+        }
+        _attrNames.push_back( std::string(name, defs[i].nameLength) );
+        _attrTypes.push_back( (AttributeType)defs[i].type );
+        _schema[_attrNames.back()] = _attrTypes.back();
+    }
+
+    _index = reinterpret_cast<const TileIndexEntry*>(
+        at(header->indexOffset, header->numTiles * sizeof(TileIndexEntry)) );
+    if ( !_index && header->numTiles > 0ull )
+    {
+        OE_WARN << LC << "\"" << path << "\" has a corrupt tile index" << std::endl;
+        return false;
+    }
+    _numTiles = (unsigned)header->numTiles;
+
+    OE_INFO << LC << "Mapped \"" << path << "\": " << _numTiles << " tiles, levels "
+        << _firstLevel << "-" << _maxLevel << ", " << _attrNames.size() << " attributes" << std::endl;
+
+    return true;
+}
+
+const TileIndexEntry*
+VectorTileFile::findTile(const TileKey& key) const
+{
+    if ( !_index )
+        return 0L;
+
+    TileIndexEntry probe;
+    probe.lod = key.getLevelOfDetail();
+    probe.x   = key.getTileX();
+    probe.y   = key.getTileY();
+
+    const TileIndexEntry* end   = _index + _numTiles;
+    const TileIndexEntry* entry = std::lower_bound( _index, end, probe );
+    if ( entry == end || probe < *entry )
+        return 0L;
+    return entry;
+}
+
+bool
+VectorTileFile::readTile(const TileKey& key, FeatureList& output) const
+{
+    const TileIndexEntry* entry = findTile( key );
+    if ( !entry )
+        return false;
+
+    const char*        block = at( entry->offset, entry->size );
+    unsigned long long size  = entry->size;
+    const TileHeader*  tile  = block ? section<TileHeader>( block, size, 0ull, 1ull ) : 0L;
+    if ( !tile )
+    {
+        OE_WARN << LC << "Tile " << key.str() << " is corrupt" << std::endl;
+        return false;
+    }
+
+    unsigned n = tile->numFeatures;
+
+    const unsigned long long* fids         = section<unsigned long long>( block, size, tile->fidsOffset, n );
+    const unsigned*           featureParts = section<unsigned>( block, size, tile->featurePartsOffset, n+1ull );
+    const PartRecord*         parts        = section<PartRecord>( block, size, tile->partsOffset, tile->numParts );
+    const unsigned*           xy           = section<unsigned>( block, size, tile->xyOffset, 2ull*tile->numPoints );
+    const float*              z            = tile->hasZ ? section<float>( block, size, tile->zOffset, tile->numPoints ) : 0L;
+    const unsigned long long* columns      = section<unsigned long long>( block, size, tile->columnsOffset, _attrTypes.size() );
+    const char*               strings      = tile->stringsOffset <= size && tile->stringsSize <= size - tile->stringsOffset ?
+                                             block + tile->stringsOffset : 0L;
+
+    if ( !fids || !featureParts || (!parts && tile->numParts) || (!xy && tile->numPoints) ||
+         (tile->hasZ && !z && tile->numPoints) || (!columns && !_attrTypes.empty()) || !strings )
+    {
+        OE_WARN << LC << "Tile " << key.str() << " is corrupt" << std::endl;
+        return false;
+    }
+
+    // locate each attribute column's values and validity bytes.
+    std::vector<const char*> values  ( _attrTypes.size(), (const char*)0L );
+    std::vector<const char*> validity( _attrTypes.size(), (const char*)0L );
+    for( unsigned a = 0; a < _attrTypes.size(); ++a )
+    {
+        unsigned long long valueBytes =
+            _attrTypes[a] == ATTRTYPE_INT    ? n * sizeof(int) :
+            _attrTypes[a] == ATTRTYPE_DOUBLE ? n * sizeof(double) :
+            _attrTypes[a] == ATTRTYPE_BOOL   ? n * sizeof(unsigned char) :
+                                               (n+1ull) * sizeof(unsigned);
+
+        values[a]   = section<char>( block, size, columns[a], align(valueBytes) + n );
+        validity[a] = values[a] ? values[a] + align(valueBytes) : 0L;
+        if ( !values[a] )
+        {
+            OE_WARN << LC << "Tile " << key.str() << " is corrupt" << std::endl;
+            return false;
+        }
+    }
+
+    const SpatialReference* srs = getSRS();
+
+    for( unsigned i = 0; i < n; ++i )
+    {
+        GeometryCollection geoms;
+        Polygon* polygon = 0L;
+
+        for( unsigned p = featureParts[i]; p < featureParts[i+1] && p < tile->numParts; ++p )
+        {
+            const PartRecord& part = parts[p];
+            if ( part.firstPoint > tile->numPoints || part.numPoints > tile->numPoints - part.firstPoint )
+                continue;
+
+            osg::ref_ptr<Geometry> geom = createPart( part.type, part.numPoints );
+            if ( !geom.valid() )
+                continue;
+
+            const unsigned* q = xy + 2u*part.firstPoint;
+            for( unsigned k = 0; k < part.numPoints; ++k, q += 2 )
+            {
+                geom->push_back(
+                    tile->origin[0] + (double)q[0] * tile->scale[0],
+                    tile->origin[1] + (double)q[1] * tile->scale[1],
+                    z ? (double)z[part.firstPoint + k] : 0.0 );
+            }
+
+            if ( part.type == PART_HOLE )
+            {
+                if ( polygon )
+                    polygon->getHoles().push_back( static_cast<Ring*>(geom.get()) );
+            }
+            else
+            {
+                polygon = part.type == PART_POLYGON ? static_cast<Polygon*>(geom.get()) : 0L;
+                geoms.push_back( geom.get() );
+            }
+        }
+
+        if ( geoms.empty() )
+            continue;
+
+        Geometry* geometry = geoms.size() == 1 ? geoms[0].get() : new MultiGeometry( geoms );
+        Feature*  feature  = new Feature( geometry, srs, Style(), (FeatureID)fids[i] );
+
+        for( unsigned a = 0; a < _attrTypes.size(); ++a )
+        {
+            if ( !validity[a][i] )
+                continue;
+
+            switch( _attrTypes[a] )
+            {
+            case ATTRTYPE_INT:
+                feature->set( _attrNames[a], reinterpret_cast<const int*>(values[a])[i] );
+                break;
+            case ATTRTYPE_DOUBLE:
+                feature->set( _attrNames[a], reinterpret_cast<const double*>(values[a])[i] );
+                break;
+            case ATTRTYPE_BOOL:
+                feature->set( _attrNames[a], reinterpret_cast<const unsigned char*>(values[a])[i] != 0 );
+                break;
+            default:
+                {
+                    const unsigned* offsets = reinterpret_cast<const unsigned*>(values[a]);
+                    if ( offsets[i] <= offsets[i+1] && offsets[i+1] <= tile->stringsSize )
+                        feature->set( _attrNames[a], std::string(strings + offsets[i], offsets[i+1] - offsets[i]) );
+                }
+            }
+        }
+
+        output.push_back( feature );
+    }
+
+    return true;
+}
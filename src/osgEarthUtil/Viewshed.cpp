@@ -0,0 +1,439 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthUtil/Viewshed>
+#include <osgEarth/CullingUtils>
+#include <osgEarth/VirtualProgram>
+#include <osgEarth/Registry>
+#include <osgEarth/Capabilities>
+#include <osgEarth/ElevationQuery>
+#include <osgEarth/Map>
+#include <osgEarth/StringUtils>
+#include <osg/Image>
+#include <osg/Vec4ub>
+#include <algorithm>
+#include <cmath>
+
+#define LC "[ViewshedNode] "
+
+#ifndef GL_RED
+#define GL_RED 0x1903
+#endif
+#ifndef GL_R32F
+#define GL_R32F 0x822E
+#endif
+
+using namespace osgEarth;
+using namespace osgEarth::Util;
+
+namespace
+{
+    // distance stored where nothing was drawn (the sky).
+    const float NO_SURFACE = 1.0e20f;
+
+    // view direction and up vector of the camera for each cube map face, in
+    // TextureCubeMap face order (+X, -X, +Y, -Y, +Z, -Z).
+    const osg::Vec3d s_faceDir[6] = {
+        osg::Vec3d( 1, 0, 0), osg::Vec3d(-1, 0, 0),
+        osg::Vec3d( 0, 1, 0), osg::Vec3d( 0,-1, 0),
+        osg::Vec3d( 0, 0, 1), osg::Vec3d( 0, 0,-1) };
+
+    const osg::Vec3d s_faceUp[6] = {
+        osg::Vec3d( 0,-1, 0), osg::Vec3d( 0,-1, 0),
+        osg::Vec3d( 0, 0, 1), osg::Vec3d( 0, 0,-1),
+        osg::Vec3d( 0,-1, 0), osg::Vec3d( 0,-1, 0) };
+
+    // the range bias that keeps a surface from occluding itself.
+    double rangeBias( double d )
+    {
+        return osg::maximum( 1.0, d * 0.002 );
+    }
+}
+
+
+ViewshedNode::ViewshedNode( MapNode* mapNode ) :
+_mapNode      ( mapNode ),
+_radius       ( 10000.0 ),
+_size         ( 1024 ),
+_texImageUnit ( 6 ),
+_visibleColor ( osg::Vec4f(0.0f, 1.0f, 0.0f, 0.35f) ),
+_occludedColor( osg::Vec4f(1.0f, 0.0f, 0.0f, 0.35f) ),
+_readback     ( false )
+{
+    _supported = mapNode != 0L && Registry::capabilities().supportsGLSL();
+    if ( _supported )
+    {
+        reinitialize();
+    }
+    else
+    {
+        OE_WARN << LC << "ViewshedNode not supported (no GLSL or no map); disabled." << std::endl;
+    }
+}
+
+void
+ViewshedNode::setObserver( const GeoPoint& observer )
+{
+    _observer = observer;
+
+    osg::ref_ptr<MapNode> mapNode;
+    if ( _mapNode.lock(mapNode) )
+    {
+        GeoPoint p = observer.transform( mapNode->getMapSRS() );
+        p.toWorld( _observerWorld, mapNode->getTerrain() );
+    }
+
+    updateCameras();
+}
+
+void
+ViewshedNode::setRadius( double meters )
+{
+    _radius = osg::maximum( meters, 1.0 );
+    if ( _radiusUniform.valid() )
+        _radiusUniform->set( (float)_radius );
+    updateCameras();
+}
+
+void
+ViewshedNode::setTextureSize( unsigned size )
+{
+    _size = osg::maximum( size, 16u );
+    reinitialize();
+}
+
+void
+ViewshedNode::setTextureImageUnit( int unit )
+{
+    _texImageUnit = unit;
+    reinitialize();
+}
+
+void
+ViewshedNode::setVisibleColor( const osg::Vec4f& color )
+{
+    _visibleColor = color;
+    if ( _visibleColorUniform.valid() )
+        _visibleColorUniform->set( color );
+}
+
+void
+ViewshedNode::setOccludedColor( const osg::Vec4f& color )
+{
+    _occludedColor = color;
+    if ( _occludedColorUniform.valid() )
+        _occludedColorUniform->set( color );
+}
+
+void
+ViewshedNode::setReadbackEnabled( bool value )
+{
+    if ( _readback != value )
+    {
+        _readback = value;
+        reinitialize();
+    }
+}
+
+void
+ViewshedNode::reinitialize()
+{
+    if ( !_supported )
+        return;
+
+    osg::ref_ptr<MapNode> mapNode;
+    if ( !_mapNode.lock(mapNode) )
+        return;
+
+    _rttCameras.clear();
+    _faceImages.clear();
+
+    // cube map holding the distance to the nearest surface in each direction.
+    _cubeMap = new osg::TextureCubeMap();
+    _cubeMap->setTextureSize( _size, _size );
+    _cubeMap->setInternalFormat( GL_R32F );
+    _cubeMap->setSourceFormat( GL_RED );
+    _cubeMap->setSourceType( GL_FLOAT );
+    _cubeMap->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+    _cubeMap->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
+    _cubeMap->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    _cubeMap->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+    _cubeMap->setWrap( osg::Texture::WRAP_R, osg::Texture::CLAMP_TO_EDGE );
+
+    // one RTT camera per cube face, all rendering the map from the observer.
+    for( unsigned face = 0; face < 6; ++face )
+    {
+        osg::Camera* rtt = new osg::Camera();
+        rtt->setReferenceFrame( osg::Camera::ABSOLUTE_RF );
+        rtt->setClearColor( osg::Vec4(NO_SURFACE, NO_SURFACE, NO_SURFACE, NO_SURFACE) );
+        rtt->setClearMask( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+        rtt->setComputeNearFarMode( osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR );
+        rtt->setViewport( 0, 0, _size, _size );
+        rtt->setRenderOrder( osg::Camera::PRE_RENDER );
+        rtt->setRenderTargetImplementation( osg::Camera::FRAME_BUFFER_OBJECT );
+        rtt->setImplicitBufferAttachmentMask( 0, 0 );
+        rtt->attach( osg::Camera::COLOR_BUFFER, _cubeMap.get(), 0, face );
+        rtt->attach( osg::Camera::DEPTH_BUFFER, GL_DEPTH_COMPONENT24 );
+
+        if ( _readback )
+        {
+            // also copy the face into memory for createImage().
+            osg::Image* image = new osg::Image();
+            image->allocateImage( _size, _size, 1, GL_RED, GL_FLOAT );
+            image->setInternalTextureFormat( GL_R32F );
+            float* data = reinterpret_cast<float*>( image->data() );
+            std::fill( data, data + _size*_size, -1.0f ); // not rendered yet
+            rtt->attach( osg::Camera::COLOR_BUFFER, image );
+            _faceImages.push_back( image );
+        }
+
+        rtt->addChild( mapNode.get() );
+        _rttCameras.push_back( rtt );
+    }
+
+    updateCameras();
+
+    // RTT pass: write each fragment's distance from the observer.
+    _rttStateSet = new osg::StateSet();
+    _rttStateSet->setMode( GL_BLEND, osg::StateAttribute::OFF | osg::StateAttribute::OVERRIDE | osg::StateAttribute::PROTECTED );
+
+    std::string rttVertex =
+        "#version " GLSL_VERSION_STR "\n"
+        GLSL_DEFAULT_PRECISION_FLOAT "\n"
+        "varying vec3 oe_viewshed_rttPos; \n"
+        "void oe_viewshed_rtt_vertex(inout vec4 VertexVIEW) \n"
+        "{ \n"
+        "    oe_viewshed_rttPos = VertexVIEW.xyz/VertexVIEW.w; \n"
+        "} \n";
+
+    std::string rttFragment =
+        "#version " GLSL_VERSION_STR "\n"
+        GLSL_DEFAULT_PRECISION_FLOAT "\n"
+        "varying vec3 oe_viewshed_rttPos; \n"
+        "void oe_viewshed_rtt_fragment(inout vec4 color) \n"
+        "{ \n"
+        "    gl_FragColor = vec4(length(oe_viewshed_rttPos)); \n"
+        "} \n";
+
+    VirtualProgram* rttVP = VirtualProgram::getOrCreate( _rttStateSet.get() );
+    rttVP->setFunction( "oe_viewshed_rtt_vertex",   rttVertex,   ShaderComp::LOCATION_VERTEX_VIEW );
+    rttVP->setFunction( "oe_viewshed_rtt_fragment", rttFragment, ShaderComp::LOCATION_FRAGMENT_OUTPUT );
+
+    // render pass: compare each fragment's distance with the nearest surface
+    // in its direction.
+    _renderStateSet = new osg::StateSet();
+
+    std::string vertex =
+        "#version " GLSL_VERSION_STR "\n"
+        GLSL_DEFAULT_PRECISION_FLOAT "\n"
+        "uniform vec3 oe_viewshed_observerView; \n"
+        "uniform mat4 oe_viewshed_viewToWorld; \n"
+        "varying vec3 oe_viewshed_vec; \n"
+        "void oe_viewshed_vertex(inout vec4 VertexVIEW) \n"
+        "{ \n"
+        "    oe_viewshed_vec = mat3(oe_viewshed_viewToWorld) * (VertexVIEW.xyz/VertexVIEW.w - oe_viewshed_observerView); \n"
+        "} \n";
+
+    std::string fragment =
+        "#version " GLSL_VERSION_STR "\n"
+        GLSL_DEFAULT_PRECISION_FLOAT "\n"
+        "uniform samplerCube oe_viewshed_map; \n"
+        "uniform float oe_viewshed_radius; \n"
+        "uniform vec4 oe_viewshed_visibleColor; \n"
+        "uniform vec4 oe_viewshed_occludedColor; \n"
+        "varying vec3 oe_viewshed_vec; \n"
+        "void oe_viewshed_fragment(inout vec4 color) \n"
+        "{ \n"
+        "    float d = length(oe_viewshed_vec); \n"
+        "    if ( d > oe_viewshed_radius ) \n"
+        "        return; \n"
+        "    float nearest = textureCube(oe_viewshed_map, oe_viewshed_vec).r; \n"
+        "    float bias = max(1.0, d*0.002); \n"
+        "    vec4 tint = d <= nearest+bias ? oe_viewshed_visibleColor : oe_viewshed_occludedColor; \n"
+        "    color.rgb = mix(color.rgb, tint.rgb, tint.a); \n"
+        "} \n";
+
+    VirtualProgram* vp = VirtualProgram::getOrCreate( _renderStateSet.get() );
+    vp->setFunction( "oe_viewshed_vertex",   vertex,   ShaderComp::LOCATION_VERTEX_VIEW );
+    vp->setFunction( "oe_viewshed_fragment", fragment, ShaderComp::LOCATION_FRAGMENT_LIGHTING, 0.9f );
+
+    _renderStateSet->setTextureAttribute( _texImageUnit, _cubeMap.get(), osg::StateAttribute::ON );
+    _renderStateSet->addUniform( new osg::Uniform("oe_viewshed_map", _texImageUnit) );
+
+    _observerViewUniform  = _renderStateSet->getOrCreateUniform( "oe_viewshed_observerView",  osg::Uniform::FLOAT_VEC3 );
+    _viewToWorldUniform   = _renderStateSet->getOrCreateUniform( "oe_viewshed_viewToWorld",   osg::Uniform::FLOAT_MAT4 );
+    _radiusUniform        = _renderStateSet->getOrCreateUniform( "oe_viewshed_radius",        osg::Uniform::FLOAT );
+    _visibleColorUniform  = _renderStateSet->getOrCreateUniform( "oe_viewshed_visibleColor",  osg::Uniform::FLOAT_VEC4 );
+    _occludedColorUniform = _renderStateSet->getOrCreateUniform( "oe_viewshed_occludedColor", osg::Uniform::FLOAT_VEC4 );
+
+    _radiusUniform->set( (float)_radius );
+    _visibleColorUniform->set( _visibleColor );
+    _occludedColorUniform->set( _occludedColor );
+}
+
+void
+ViewshedNode::updateCameras()
+{
+    for( unsigned face = 0; face < _rttCameras.size(); ++face )
+    {
+        _rttCameras[face]->setViewMatrixAsLookAt( _observerWorld, _observerWorld + s_faceDir[face], s_faceUp[face] );
+        _rttCameras[face]->setProjectionMatrixAsPerspective( 90.0, 1.0, 1.0, _radius * 1.5 );
+    }
+}
+
+void
+ViewshedNode::traverse( osg::NodeVisitor& nv )
+{
+    if (_supported                             &&
+        nv.getVisitorType() == nv.CULL_VISITOR &&
+        _cubeMap.valid() )
+    {
+        osgUtil::CullVisitor* cv = Culling::asCullVisitor(nv);
+        if ( cv && cv->getCurrentCamera() )
+        {
+            // observer position and world orientation, in this camera's view space:
+            osg::Matrix MV = *cv->getModelViewMatrix();
+            osg::Matrix viewToWorld = osg::Matrix::inverse( MV );
+            viewToWorld.setTrans( 0, 0, 0 );
+
+            _observerViewUniform->set( osg::Vec3f(_observerWorld * MV) );
+            _viewToWorldUniform->set( osg::Matrixf(viewToWorld) );
+
+            // render the distance cube map.
+            cv->pushStateSet( _rttStateSet.get() );
+            for( unsigned i = 0; i < _rttCameras.size(); ++i )
+            {
+                _rttCameras[i]->accept( nv );
+            }
+            cv->popStateSet();
+
+            // render the analyzed subgraph.
+            cv->pushStateSet( _renderStateSet.get() );
+            osg::Group::traverse( nv );
+            cv->popStateSet();
+
+            return;
+        }
+    }
+
+    osg::Group::traverse( nv );
+}
+
+int
+ViewshedNode::classify( const osg::Vec3d& world ) const
+{
+    osg::Vec3d v = world - _observerWorld;
+    double d = v.length();
+    if ( d > _radius || _faceImages.size() != 6 )
+        return -1;
+
+    // select the cube face and face coordinates the same way GL does.
+    double ax = fabs(v.x()), ay = fabs(v.y()), az = fabs(v.z());
+    unsigned face;
+    double sc, tc, ma;
+    if ( ax >= ay && ax >= az )
+    {
+        face = v.x() > 0.0 ? 0 : 1;
+        sc   = v.x() > 0.0 ? -v.z() : v.z();
+        tc   = -v.y();
+        ma   = ax;
+    }
+    else if ( ay >= az )
+    {
+        face = v.y() > 0.0 ? 2 : 3;
+        sc   = v.x();
+        tc   = v.y() > 0.0 ? v.z() : -v.z();
+        ma   = ay;
+    }
+    else
+    {
+        face = v.z() > 0.0 ? 4 : 5;
+        sc   = v.z() > 0.0 ? v.x() : -v.x();
+        tc   = -v.y();
+        ma   = az;
+    }
+
+    if ( ma <= 0.0 )
+        return 1;
+
+    double s = 0.5 * (sc/ma + 1.0);
+    double t = 0.5 * (tc/ma + 1.0);
+    unsigned col = osg::clampBetween( (unsigned)(s * _size), 0u, _size-1 );
+    unsigned row = osg::clampBetween( (unsigned)(t * _size), 0u, _size-1 );
+
+    const osg::Image* image = _faceImages[face].get();
+    float nearest = *reinterpret_cast<const float*>( image->data(col, row) );
+    if ( nearest < 0.0f )
+        return -1;
+
+    return d <= (double)nearest + rangeBias(d) ? 1 : 0;
+}
+
+bool
+ViewshedNode::createImage(const GeoExtent& extent,
+                          unsigned         width,
+                          unsigned         height,
+                          GeoImage&        output)
+{
+    osg::ref_ptr<MapNode> mapNode;
+    if ( !_supported || !_readback || !extent.isValid() || width == 0 || height == 0 || !_mapNode.lock(mapNode) )
+        return false;
+
+    // sample points at the cell centers; image row 0 is the southern edge.
+    std::vector<osg::Vec3d> points;
+    points.reserve( width*height );
+    double dx = extent.width() / (double)width;
+    double dy = extent.height() / (double)height;
+    for( unsigned t = 0; t < height; ++t )
+        for( unsigned s = 0; s < width; ++s )
+            points.push_back( osg::Vec3d(extent.xMin() + dx*((double)s+0.5), extent.yMin() + dy*((double)t+0.5), 0.0) );
+
+    ElevationQuery query( mapNode->getMap() );
+    if ( !query.getElevations(points, extent.getSRS(), true) )
+    {
+        OE_WARN << LC << "Failed to query elevations for the export extent" << std::endl;
+        return false;
+    }
+
+    osg::ref_ptr<osg::Image> image = new osg::Image();
+    image->allocateImage( width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+
+    osg::Vec4ub visible(
+        (unsigned char)(_visibleColor.r()*255.0f), (unsigned char)(_visibleColor.g()*255.0f),
+        (unsigned char)(_visibleColor.b()*255.0f), 255 );
+    osg::Vec4ub occluded(
+        (unsigned char)(_occludedColor.r()*255.0f), (unsigned char)(_occludedColor.g()*255.0f),
+        (unsigned char)(_occludedColor.b()*255.0f), 255 );
+    osg::Vec4ub none( 0, 0, 0, 0 );
+
+    for( unsigned t = 0; t < height; ++t )
+    {
+        for( unsigned s = 0; s < width; ++s )
+        {
+            const osg::Vec3d& p = points[t*width + s];
+            osg::Vec3d world;
+            GeoPoint( extent.getSRS(), p.x(), p.y(), p.z(), ALTMODE_ABSOLUTE ).toWorld( world );
+
+            int c = classify( world );
+            *reinterpret_cast<osg::Vec4ub*>( image->data(s, t) ) = c == 1 ? visible : c == 0 ? occluded : none;
+        }
+    }
+
+    output = GeoImage( image.get(), extent );
+    return true;
+}
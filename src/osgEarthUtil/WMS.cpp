@@ -19,6 +19,7 @@
 
 #include <osgEarthUtil/WMS>
 #include <osgEarth/XmlUtils>
+#include <osgEarth/MetadataCache>
 
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
@@ -139,7 +140,7 @@ WMSCapabilitiesReader::read( const std::string &location, const osgDB::ReaderWri
     WMSCapabilities *caps = NULL;
     if ( osgDB::containsServerAddress( location ) )
     {
-        ReadResult rr = URI(location).readString( options );
+        ReadResult rr = MetadataCache::readString( URI(location), options );
         if ( rr.succeeded() )
         {
             std::istringstream in( rr.getString() );